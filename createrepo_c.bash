@@ -2,7 +2,7 @@
 
 _cr_compress_type()
 {
-    COMPREPLY=( $( compgen -W "bz2 gz xz" -- "$2" ) )
+    COMPREPLY=( $( compgen -W "bz2 gz xz zstd" -- "$2" ) )
 }
 
 _cr_checksum_type()
@@ -30,7 +30,8 @@ _cr_createrepo()
             _cr_checksum_type "$1" "$2"
             return 0
             ;;
-        -i|--pkglist|--read-pkgs-list)
+        -i|--pkglist|--read-pkgs-list|--repos-file|--remote-manifest|\
+        --changed-pkgs|--removed-pkgs)
             COMPREPLY=( $( compgen -f -o plusdirs -- "$2" ) )
             return 0
             ;;
@@ -56,6 +57,10 @@ _cr_createrepo()
             _cr_compress_type "$1" "$2"
             return 0
             ;;
+        --checksum-io)
+            COMPREPLY=( $( compgen -W 'read mmap direct' -- "$2" ) )
+            return 0
+            ;;
     esac
 
     if [[ $2 == -* ]] ; then
@@ -65,12 +70,27 @@ _cr_createrepo()
             --skip-stat --pkglist --includepkg --outputdir
             --skip-symlinks --changelog-limit --unique-md-filenames
             --simple-md-filenames --retain-old-md --distro --content --repo
-            --revision --read-pkgs-list --workers --xz
-            --compress-type --keep-all-metadata --compatibility
-            --retain-old-md-by-age --cachedir --local-sqlite
-            --cut-dirs --location-prefix
+            --revision --read-pkgs-list --workers --max-workers
+            --progress --progress-file --reorder-buffer-mb --large-first
+            --stream-walk --prefetch
+            --metrics-file --trace-file --repos-file --watch --watch-delay
+            --worker-cpus --writer-cpus --compress-threads --xz
+            --zstd-level --zstd-long --zck-auto-dict --zck-chunking
+            --compress-type --compress-level --keep-all-metadata
+            --strict-keep-all-metadata
+            --compatibility
+            --retain-old-md-by-age --cachedir --checksum-cache
+            --compact-checksum-cache --pkg-cache --shared-pkg-cache --pkg-index
+            --shared-store
+            --block-index
+            --primary-only --set-contenthash --shard --remote-manifest --remote-baseurl
+            --remote-transfers --local-sqlite --reuse-sqlite
+            --sqlite-in-memory --update-from-sqlite
+            --cut-dirs --location-prefix --checksum-io
             --deltas --oldpackagedirs
-            --num-deltas --max-delta-rpm-size --recycle-pkglist' -- "$2" ) )
+            --num-deltas --max-delta-rpm-size --delta-memory-mb
+            --delta-processes --recycle-pkglist
+            --changed-pkgs --removed-pkgs' -- "$2" ) )
     else
         COMPREPLY=( $( compgen -d -- "$2" ) )
     fi
@@ -108,7 +128,7 @@ _cr_mergerepo()
             --no-database --verbose --outputdir --nogroups --noupdateinfo
             --compress-type --method --all --noarch-repo --unique-md-filenames
             --simple-md-filenames --omit-baseurl --koji --groupfile
-            --blocked' -- "$2" ) )
+            --blocked --shards --concat' -- "$2" ) )
     else
         COMPREPLY=( $( compgen -d -- "$2" ) )
     fi
@@ -176,6 +196,48 @@ _cr_sqliterepo()
 } &&
 complete -F _cr_sqliterepo -o filenames sqliterepo_c
 
+_cr_repodiff()
+{
+    COMPREPLY=()
+
+    case $3 in
+        -h|--help|-V|--version)
+            return 0
+            ;;
+    esac
+
+    if [[ $2 == -* ]] ; then
+        COMPREPLY=( $( compgen -W '--help --version --quiet --verbose
+            --summary --no-index ' -- "$2" ) )
+    else
+        COMPREPLY=( $( compgen -f -- "$2" ) )
+    fi
+} &&
+complete -F _cr_repodiff -o filenames repodiff_c
+
+_cr_verifyrepo()
+{
+    COMPREPLY=()
+
+    case $3 in
+        -h|--help|-V|--version|--workers)
+            return 0
+            ;;
+        --checksum-io)
+            COMPREPLY=( $( compgen -W 'read mmap direct' -- "$2" ) )
+            return 0
+            ;;
+    esac
+
+    if [[ $2 == -* ]] ; then
+        COMPREPLY=( $( compgen -W '--help --version --quiet --verbose
+            --workers --checksum-io --size-only ' -- "$2" ) )
+    else
+        COMPREPLY=( $( compgen -f -- "$2" ) )
+    fi
+} &&
+complete -F _cr_verifyrepo -o filenames verifyrepo_c
+
 # Local variables:
 # mode: shell-script
 # sh-basic-offset: 4
@@ -44,6 +44,8 @@ BuildRequires:  sqlite-devel
 BuildRequires:  xz
 BuildRequires:  xz-devel
 BuildRequires:  zlib-devel
+BuildRequires:  pkgconfig(libzstd) >= 1.4.0
+BuildRequires:  zstd
 %if %{with zchunk}
 BuildRequires:  pkgconfig(zck) >= 0.9.11
 BuildRequires:  zchunk
@@ -106,6 +108,7 @@ mkdir build-py3
 pushd build-py3
   %cmake .. \
       -DWITH_ZCHUNK=%{?with_zchunk:ON}%{!?with_zchunk:OFF} \
+      -DWITH_ZSTD=ON \
       -DWITH_LIBMODULEMD=%{?with_libmodulemd:ON}%{!?with_libmodulemd:OFF} \
       -DENABLE_DRPM=%{?with_drpm:ON}%{!?with_drpm:OFF}
   make %{?_smp_mflags} RPM_OPT_FLAGS="%{optflags}"
@@ -148,11 +151,15 @@ ln -sr %{buildroot}%{_bindir}/modifyrepo_c %{buildroot}%{_bindir}/modifyrepo
 %{_mandir}/man8/mergerepo_c.8*
 %{_mandir}/man8/modifyrepo_c.8*
 %{_mandir}/man8/sqliterepo_c.8*
+%{_mandir}/man8/repodiff_c.8*
+%{_mandir}/man8/verifyrepo_c.8*
 %{bash_completion}
 %{_bindir}/createrepo_c
 %{_bindir}/mergerepo_c
 %{_bindir}/modifyrepo_c
 %{_bindir}/sqliterepo_c
+%{_bindir}/repodiff_c
+%{_bindir}/verifyrepo_c
 
 %if 0%{?fedora} || 0%{?rhel} > 7
 %{_bindir}/createrepo
@@ -0,0 +1,324 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "blockindex.h"
+#include "compression_wrapper.h"
+#include "error.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+#define BLOCKINDEX_MAGIC_LEN    8
+#define BLOCKINDEX_HEADER_LEN   24
+#define BLOCKINDEX_ENTRY_LEN    40
+#define BLOCKINDEX_FILES        3   // primary, filelists and other
+
+struct _cr_BlockIndex {
+    GArray *blocks[BLOCKINDEX_FILES];  // cr_BlockIndexEntry per block
+};
+
+static GArray *
+blockindex_blocks(cr_BlockIndex *index, cr_XmlFileType type)
+{
+    assert(index);
+    assert(type == CR_XMLFILE_PRIMARY
+           || type == CR_XMLFILE_FILELISTS
+           || type == CR_XMLFILE_OTHER);
+
+    return index->blocks[type];
+}
+
+cr_BlockIndex *
+cr_blockindex_new(void)
+{
+    cr_BlockIndex *index = g_new0(cr_BlockIndex, 1);
+
+    for (int x = 0; x < BLOCKINDEX_FILES; x++)
+        index->blocks[x] = g_array_new(FALSE, FALSE,
+                                       sizeof(cr_BlockIndexEntry));
+    return index;
+}
+
+void
+cr_blockindex_add(cr_BlockIndex *index,
+                  cr_XmlFileType type,
+                  const cr_BlockIndexEntry *entry)
+{
+    assert(entry);
+
+    g_array_append_val(blockindex_blocks(index, type), *entry);
+}
+
+void
+cr_blockindex_shift(cr_BlockIndex *index,
+                    cr_XmlFileType type,
+                    gint64 delta,
+                    gint64 uncompressed_delta)
+{
+    GArray *blocks = blockindex_blocks(index, type);
+
+    for (guint x = 0; x < blocks->len; x++) {
+        cr_BlockIndexEntry *entry = &g_array_index(blocks, cr_BlockIndexEntry,
+                                                   x);
+        entry->offset += delta;
+        entry->uncompressed_offset += uncompressed_delta;
+    }
+}
+
+guint
+cr_blockindex_count(cr_BlockIndex *index, cr_XmlFileType type)
+{
+    return blockindex_blocks(index, type)->len;
+}
+
+const cr_BlockIndexEntry *
+cr_blockindex_get(cr_BlockIndex *index, cr_XmlFileType type, guint n)
+{
+    GArray *blocks = blockindex_blocks(index, type);
+
+    if (n >= blocks->len)
+        return NULL;
+    return &g_array_index(blocks, cr_BlockIndexEntry, n);
+}
+
+gint
+cr_blockindex_find(cr_BlockIndex *index, cr_XmlFileType type, guint pkg)
+{
+    GArray *blocks = blockindex_blocks(index, type);
+    guint lo = 0, hi = blocks->len;
+
+    // The last block starting at or before the package
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(blocks, cr_BlockIndexEntry, mid).first_pkg <= pkg)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return -1;
+
+    const cr_BlockIndexEntry *entry = &g_array_index(blocks,
+                                                     cr_BlockIndexEntry,
+                                                     lo - 1);
+    if (pkg - entry->first_pkg >= entry->pkgs)
+        return -1;
+    return (gint) (lo - 1);
+}
+
+gboolean
+cr_blockindex_write(cr_BlockIndex *index, const char *path, GError **err)
+{
+    guint32 header[(BLOCKINDEX_HEADER_LEN - BLOCKINDEX_MAGIC_LEN) / 4];
+    gboolean ok;
+    FILE *f;
+
+    assert(index);
+    assert(path);
+    assert(!err || *err == NULL);
+
+    for (int x = 0; x < BLOCKINDEX_FILES; x++)
+        header[x] = GUINT32_TO_LE(index->blocks[x]->len);
+    header[BLOCKINDEX_FILES] = 0;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    ok = fwrite(CR_BLOCKINDEX_MAGIC, BLOCKINDEX_MAGIC_LEN, 1, f) == 1
+         && fwrite(header, sizeof(header), 1, f) == 1;
+    for (int x = 0; ok && x < BLOCKINDEX_FILES; x++) {
+        for (guint y = 0; ok && y < index->blocks[x]->len; y++) {
+            const cr_BlockIndexEntry *entry = &g_array_index(index->blocks[x],
+                                                             cr_BlockIndexEntry,
+                                                             y);
+            guint32 rec32[2];
+            guint64 rec64[4];
+
+            rec32[0] = GUINT32_TO_LE(entry->first_pkg);
+            rec32[1] = GUINT32_TO_LE(entry->pkgs);
+            rec64[0] = GUINT64_TO_LE(entry->offset);
+            rec64[1] = GUINT64_TO_LE(entry->size);
+            rec64[2] = GUINT64_TO_LE(entry->uncompressed_offset);
+            rec64[3] = GUINT64_TO_LE(entry->uncompressed_size);
+            ok = fwrite(rec32, sizeof(rec32), 1, f) == 1
+                 && fwrite(rec64, sizeof(rec64), 1, f) == 1;
+        }
+    }
+    if (fclose(f) != 0)
+        ok = FALSE;
+
+    if (!ok) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write %s: %s", path, g_strerror(errno));
+        g_remove(path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+cr_BlockIndex *
+cr_blockindex_load(const char *path, GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_BlockIndex *index;
+    guint32 header[(BLOCKINDEX_HEADER_LEN - BLOCKINDEX_MAGIC_LEN) / 4];
+    guint64 total = 0;
+    const char *data;
+    gchar *content;
+    gsize len;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    if (!g_file_get_contents(path, &content, &len, &tmp_err)) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot read block index %s: %s", path, tmp_err->message);
+        g_clear_error(&tmp_err);
+        return NULL;
+    }
+
+    if (len < BLOCKINDEX_HEADER_LEN
+        || memcmp(content, CR_BLOCKINDEX_MAGIC, BLOCKINDEX_MAGIC_LEN))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s is not a block index", path);
+        g_free(content);
+        return NULL;
+    }
+
+    memcpy(header, content + BLOCKINDEX_MAGIC_LEN, sizeof(header));
+    for (int x = 0; x < BLOCKINDEX_FILES; x++)
+        total += GUINT32_FROM_LE(header[x]);
+
+    if (total * BLOCKINDEX_ENTRY_LEN != len - BLOCKINDEX_HEADER_LEN) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Block index %s is truncated or corrupted", path);
+        g_free(content);
+        return NULL;
+    }
+
+    index = cr_blockindex_new();
+    data = content + BLOCKINDEX_HEADER_LEN;
+    for (int x = 0; x < BLOCKINDEX_FILES; x++) {
+        guint count = GUINT32_FROM_LE(header[x]);
+
+        for (guint y = 0; y < count; y++, data += BLOCKINDEX_ENTRY_LEN) {
+            cr_BlockIndexEntry entry;
+            guint32 rec32[2];
+            guint64 rec64[4];
+
+            memcpy(rec32, data, sizeof(rec32));
+            memcpy(rec64, data + sizeof(rec32), sizeof(rec64));
+            entry.first_pkg             = GUINT32_FROM_LE(rec32[0]);
+            entry.pkgs                  = GUINT32_FROM_LE(rec32[1]);
+            entry.offset                = GUINT64_FROM_LE(rec64[0]);
+            entry.size                  = GUINT64_FROM_LE(rec64[1]);
+            entry.uncompressed_offset   = GUINT64_FROM_LE(rec64[2]);
+            entry.uncompressed_size     = GUINT64_FROM_LE(rec64[3]);
+            g_array_append_val(index->blocks[x], entry);
+        }
+    }
+
+    g_free(content);
+    return index;
+}
+
+gchar *
+cr_blockindex_read_block(const char *path,
+                         const cr_BlockIndexEntry *entry,
+                         GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_CompressionType type;
+    gchar *in, *out;
+    FILE *f;
+
+    assert(path);
+    assert(entry);
+    assert(!err || *err == NULL);
+
+    type = cr_detect_compression(path, &tmp_err);
+    if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        return NULL;
+    }
+
+    if (entry->size > G_MAXSIZE - 1 || entry->uncompressed_size > G_MAXSIZE - 1) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Block of %s is too large", path);
+        return NULL;
+    }
+
+    f = fopen(path, "rb");
+    if (!f) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    in = g_malloc(entry->size ? entry->size : 1);
+    if (fseeko(f, entry->offset, SEEK_SET) != 0
+        || (entry->size && fread(in, entry->size, 1, f) != 1))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot read the block of %s at %" G_GUINT64_FORMAT ": %s",
+                    path, entry->offset,
+                    ferror(f) ? g_strerror(errno) : "Unexpected end of file");
+        g_free(in);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    out = g_malloc(entry->uncompressed_size + 1);
+    if (!cr_decompress_member(type, in, entry->size, out,
+                              entry->uncompressed_size, &tmp_err)) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot decompress the block of %s at %"
+                                   G_GUINT64_FORMAT ": ", path, entry->offset);
+        g_free(in);
+        g_free(out);
+        return NULL;
+    }
+    out[entry->uncompressed_size] = '\0';
+
+    g_free(in);
+    return out;
+}
+
+void
+cr_blockindex_free(cr_BlockIndex *index)
+{
+    if (!index)
+        return;
+    for (int x = 0; x < BLOCKINDEX_FILES; x++)
+        g_array_free(index->blocks[x], TRUE);
+    g_free(index);
+}
@@ -0,0 +1,182 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_BLOCKINDEX_H__
+#define __C_CREATEREPOLIB_BLOCKINDEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include "xml_file.h"
+
+/** \defgroup   blockindex  Index of the independent blocks of xml files
+ *
+ * primary.xml, filelists.xml and other.xml written with a block index
+ * (see cr_xmlfile_set_blockindex()) are sequences of gzip members or zstd
+ * frames: the header, blocks of whole packages and the footer. Standard
+ * decompressors read them as one ordinary file. The index is an additional
+ * uncompressed repodata file (record type "blockindex") with the position
+ * of every block, so a reader aware of it can decompress and parse the
+ * blocks in parallel (e.g. by cr_xml_parse_primary_snippet()) or seek
+ * directly to the block with a package.
+ *
+ * File format (all numbers are little endian):
+ *
+ *  Header (24 bytes):
+ *      char[8]     CR_BLOCKINDEX_MAGIC
+ *      guint32     number of blocks of primary.xml
+ *      guint32     number of blocks of filelists.xml
+ *      guint32     number of blocks of other.xml
+ *      guint32     reserved (0)
+ *  Blocks of primary.xml, filelists.xml and other.xml, every one 40 bytes:
+ *      guint32     number of the first package of the block
+ *      guint32     number of packages in the block
+ *      guint64     compressed offset of the block in the file
+ *      guint64     compressed size of the block
+ *      guint64     uncompressed offset of the block
+ *      guint64     uncompressed size of the block
+ *
+ *  \addtogroup blockindex
+ *  @{
+ */
+
+#define CR_BLOCKINDEX_MAGIC     "CRBLKI01"
+
+/** Default amount of uncompressed xml per block.
+ */
+#define CR_BLOCKINDEX_DEFAULT_BLOCK_SIZE    (1024*1024)
+
+/** Block of an xml file.
+ */
+typedef struct {
+    guint32 first_pkg;          /*!< number of the first package (from 0) */
+    guint32 pkgs;               /*!< number of packages */
+    guint64 offset;             /*!< compressed offset in the file */
+    guint64 size;               /*!< compressed size */
+    guint64 uncompressed_offset;/*!< offset in the uncompressed content */
+    guint64 uncompressed_size;  /*!< size of the uncompressed content */
+} cr_BlockIndexEntry;
+
+/** Index of the blocks of primary.xml, filelists.xml and other.xml.
+ */
+typedef struct _cr_BlockIndex cr_BlockIndex;
+
+/** Create an empty index.
+ * @return              New index
+ */
+cr_BlockIndex *
+cr_blockindex_new(void);
+
+/** Append a block of a file. Blocks of every file must be added in their
+ * order. Blocks of different files may be added from different threads,
+ * blocks of the same file must not.
+ * @param index         Index
+ * @param type          CR_XMLFILE_PRIMARY, CR_XMLFILE_FILELISTS or
+ *                      CR_XMLFILE_OTHER
+ * @param entry         Block (copied)
+ */
+void
+cr_blockindex_add(cr_BlockIndex *index,
+                  cr_XmlFileType type,
+                  const cr_BlockIndexEntry *entry);
+
+/** Move all the blocks of a file, e.g. after its header was replaced
+ * by another one of a different size.
+ * @param index         Index
+ * @param type          Type of the file
+ * @param delta         Change of the compressed offsets
+ * @param uncompressed_delta    Change of the uncompressed offsets
+ */
+void
+cr_blockindex_shift(cr_BlockIndex *index,
+                    cr_XmlFileType type,
+                    gint64 delta,
+                    gint64 uncompressed_delta);
+
+/** Number of blocks of a file.
+ * @param index         Index
+ * @param type          Type of the file
+ * @return              Number of blocks
+ */
+guint
+cr_blockindex_count(cr_BlockIndex *index, cr_XmlFileType type);
+
+/** Get a block of a file.
+ * @param index         Index
+ * @param type          Type of the file
+ * @param n             0 .. cr_blockindex_count() - 1
+ * @return              Block owned by the index or NULL if out of range
+ */
+const cr_BlockIndexEntry *
+cr_blockindex_get(cr_BlockIndex *index, cr_XmlFileType type, guint n);
+
+/** Find the block with a package by binary search.
+ * @param index         Index
+ * @param type          Type of the file
+ * @param pkg           Number of the package in the file (from 0)
+ * @return              Number of the block or -1 if not found
+ */
+gint
+cr_blockindex_find(cr_BlockIndex *index, cr_XmlFileType type, guint pkg);
+
+/** Write the index into the file.
+ * @param index         Index
+ * @param path          Path to the new index (an existing file is replaced)
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_blockindex_write(cr_BlockIndex *index, const char *path, GError **err);
+
+/** Load the index from the file.
+ * @param path          Path to the index
+ * @param err           GError **
+ * @return              Loaded index or NULL on error
+ */
+cr_BlockIndex *
+cr_blockindex_load(const char *path, GError **err);
+
+/** Read and decompress a block of an xml file. The content is a sequence
+ * of whole package elements.
+ * @param path          Path to the xml file
+ * @param entry         Block of the file
+ * @param err           GError **
+ * @return              '\0' terminated content of the block or NULL
+ *                      on error, free it with g_free()
+ */
+gchar *
+cr_blockindex_read_block(const char *path,
+                         const cr_BlockIndexEntry *entry,
+                         GError **err);
+
+/** Free the index.
+ * @param index         Index or NULL
+ */
+void
+cr_blockindex_free(cr_BlockIndex *index);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_BLOCKINDEX_H__ */
@@ -17,23 +17,35 @@
  * USA.
  */
 
+#define _GNU_SOURCE             // O_DIRECT
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <openssl/evp.h>
 #include "error.h"
 #include "checksum.h"
 
 #define ERR_DOMAIN              CREATEREPO_C_ERROR
 #define MAX_CHECKSUM_NAME_LEN   7
-#define BUFFER_SIZE             2048
+#define BUFFER_SIZE             (1024*1024)
+#define BUFFER_ALIGNMENT        4096    // Alignment required by O_DIRECT
+#define MMAP_WINDOW_SIZE        (64*1024*1024)
+#define READ_AHEAD_MIN_SIZE     (16*1024*1024)  // Use a reader thread for
+                                                // files bigger than this
+#define READ_AHEAD_BUFFER_SIZE  (4*1024*1024)
 
 struct _cr_ChecksumCtx {
-    EVP_MD_CTX      *ctx;
-    cr_ChecksumType type;
+    guint           count;                          // Number of checksums
+    EVP_MD_CTX      *ctx[CR_CHECKSUM_MULTI_MAX];
+    cr_ChecksumType type[CR_CHECKSUM_MULTI_MAX];
 };
 
 cr_ChecksumType
@@ -111,115 +123,499 @@ cr_checksum_file(const char *filename,
                  cr_ChecksumType type,
                  GError **err)
 {
-    FILE *f;
-    int rc;
-    unsigned int len;
+    return cr_checksum_file_with_mode(filename, type, CR_CHECKSUM_IO_READ,
+                                      err);
+}
+
+cr_ChecksumIoMode
+cr_checksum_io_mode(const char *name)
+{
+    if (!name)
+        return CR_CHECKSUM_IO_UNKNOWN;
+
+    if (!g_ascii_strcasecmp(name, "read"))
+        return CR_CHECKSUM_IO_READ;
+    if (!g_ascii_strcasecmp(name, "mmap"))
+        return CR_CHECKSUM_IO_MMAP;
+    if (!g_ascii_strcasecmp(name, "direct"))
+        return CR_CHECKSUM_IO_DIRECT;
+
+    return CR_CHECKSUM_IO_UNKNOWN;
+}
+
+/* Big sequential reads by pread(). pread() keeps the file offset untouched.
+ * With O_DIRECT the page cache is bypassed, the buffer, the offsets and
+ * the sizes of the reads are aligned.
+ */
+struct FdReader {
+    int fd;                     // File descriptor
+    off_t offset;               // Offset of the next read
+    gboolean direct;            // Is O_DIRECT used?
+    int flags;                  // Original file status flags
+};
+
+static ssize_t
+fd_reader_read(struct FdReader *reader, void *buf, size_t len)
+{
     ssize_t readed;
-    char buf[BUFFER_SIZE];
-    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
-    char *checksum;
-    EVP_MD_CTX *ctx;
-    const EVP_MD *ctx_type;
 
-    switch (type) {
-        //case CR_CHECKSUM_MD2:    ctx_type = EVP_md2();    break;
-        case CR_CHECKSUM_MD5:    ctx_type = EVP_md5();    break;
-        case CR_CHECKSUM_SHA:    ctx_type = EVP_sha1();   break;
-        case CR_CHECKSUM_SHA1:   ctx_type = EVP_sha1();   break;
-        case CR_CHECKSUM_SHA224: ctx_type = EVP_sha224(); break;
-        case CR_CHECKSUM_SHA256: ctx_type = EVP_sha256(); break;
-        case CR_CHECKSUM_SHA384: ctx_type = EVP_sha384(); break;
-        case CR_CHECKSUM_SHA512: ctx_type = EVP_sha512(); break;
-        case CR_CHECKSUM_UNKNOWN:
-        default:
-            g_set_error(err, ERR_DOMAIN, CRE_UNKNOWNCHECKSUMTYPE,
-                        "Unknown checksum type");
-            return NULL;
+    while ((readed = pread(reader->fd, buf, len, reader->offset)) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (reader->direct && errno == EINVAL) {
+            // Some filesystems refuse O_DIRECT reads only at read time
+            g_debug("%s: O_DIRECT read failed, using buffered reads",
+                    __func__);
+            fcntl(reader->fd, F_SETFL, reader->flags);
+            reader->direct = FALSE;
+            continue;
+        }
+        return -1;
+    }
+
+    reader->offset += readed;
+    return readed;
+}
+
+/* Double buffered read ahead. A reader thread fills one buffer while
+ * the calling thread feeds the other one into the digest, so a big file
+ * is read and hashed at the same time.
+ */
+struct ReadAhead {
+    struct FdReader *reader;
+    void *buf[2];               // Buffers (READ_AHEAD_BUFFER_SIZE)
+    ssize_t len[2];             // Result of the read into the buffer
+    int error[2];               // errno if the read failed
+    gboolean full[2];           // Is the buffer ready for the digest?
+    gboolean stop;              // Stop reading (the digest failed)
+    GMutex mutex;
+    GCond cond;
+};
+
+static gpointer
+read_ahead_thread(gpointer data)
+{
+    struct ReadAhead *ra = data;
+
+    for (int i = 0; ; i ^= 1) {
+        g_mutex_lock(&(ra->mutex));
+        while (ra->full[i] && !ra->stop)
+            g_cond_wait(&(ra->cond), &(ra->mutex));
+        gboolean stop = ra->stop;
+        g_mutex_unlock(&(ra->mutex));
+        if (stop)
+            break;
+
+        ssize_t len = fd_reader_read(ra->reader, ra->buf[i],
+                                     READ_AHEAD_BUFFER_SIZE);
+        int error = errno;
+
+        g_mutex_lock(&(ra->mutex));
+        ra->len[i] = len;
+        ra->error[i] = error;
+        ra->full[i] = TRUE;
+        g_cond_broadcast(&(ra->cond));
+        g_mutex_unlock(&(ra->mutex));
+
+        if (len <= 0)
+            break;
+    }
+
+    return NULL;
+}
+
+/* Returns -1 if the read ahead thread couldn't be started,
+ * 1 on success and 0 on error.
+ */
+static int
+checksum_fd_read_ahead(struct FdReader *reader,
+                       cr_ChecksumCtx *ctx,
+                       GError **err)
+{
+    GError *tmp_err = NULL;
+    struct ReadAhead ra;
+    GThread *thread;
+    int ret = 1;
+
+    memset(&ra, 0, sizeof(ra));
+    ra.reader = reader;
+    if (posix_memalign(&ra.buf[0], BUFFER_ALIGNMENT, READ_AHEAD_BUFFER_SIZE)) {
+        return -1;
+    }
+    if (posix_memalign(&ra.buf[1], BUFFER_ALIGNMENT, READ_AHEAD_BUFFER_SIZE)) {
+        free(ra.buf[0]);
+        return -1;
+    }
+    g_mutex_init(&(ra.mutex));
+    g_cond_init(&(ra.cond));
+
+    thread = g_thread_try_new("checksum", read_ahead_thread, &ra, NULL);
+    if (!thread) {
+        ret = -1;
+        goto exit;
     }
 
-    f = fopen(filename, "rb");
-    if (!f) {
+    for (int i = 0; ; i ^= 1) {
+        g_mutex_lock(&(ra.mutex));
+        while (!ra.full[i])
+            g_cond_wait(&(ra.cond), &(ra.mutex));
+        ssize_t len = ra.len[i];
+        int error = ra.error[i];
+        g_mutex_unlock(&(ra.mutex));
+
+        if (len < 0) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Error while reading a file: %s", g_strerror(error));
+            ret = 0;
+        }
+        if (len <= 0)
+            break;
+
+        if (cr_checksum_update(ctx, ra.buf[i], len, &tmp_err) != CRE_OK) {
+            g_propagate_error(err, tmp_err);
+            ret = 0;
+            break;
+        }
+
+        g_mutex_lock(&(ra.mutex));
+        ra.full[i] = FALSE;
+        g_cond_broadcast(&(ra.cond));
+        g_mutex_unlock(&(ra.mutex));
+    }
+
+    g_mutex_lock(&(ra.mutex));
+    ra.stop = TRUE;
+    g_cond_broadcast(&(ra.cond));
+    g_mutex_unlock(&(ra.mutex));
+    g_thread_join(thread);
+
+exit:
+    g_mutex_clear(&(ra.mutex));
+    g_cond_clear(&(ra.cond));
+    free(ra.buf[0]);
+    free(ra.buf[1]);
+    return ret;
+}
+
+static gboolean
+checksum_fd_read(int fd, cr_ChecksumCtx *ctx, gboolean direct, GError **err)
+{
+    GError *tmp_err = NULL;
+    struct FdReader reader;
+    struct stat st;
+    void *buf;
+    ssize_t readed;
+    gboolean ret = TRUE;
+
+    reader.fd = fd;
+    reader.offset = 0;
+    reader.direct = FALSE;
+    reader.flags = 0;
+
+    if (direct) {
+        reader.flags = fcntl(fd, F_GETFL);
+        if (reader.flags == -1
+            || fcntl(fd, F_SETFL, reader.flags | O_DIRECT) == -1)
+        {
+            g_debug("%s: O_DIRECT is not supported (%s), using buffered "
+                    "reads", __func__, g_strerror(errno));
+        } else {
+            reader.direct = TRUE;
+        }
+    }
+
+    // Overlap reading and hashing of big files
+    if (fstat(fd, &st) == 0 && st.st_size >= READ_AHEAD_MIN_SIZE) {
+        int rc = checksum_fd_read_ahead(&reader, ctx, err);
+        if (rc >= 0) {
+            ret = rc ? TRUE : FALSE;
+            goto exit;
+        }
+        g_debug("%s: Cannot start a read ahead thread", __func__);
+    }
+
+    if (posix_memalign(&buf, BUFFER_ALIGNMENT, BUFFER_SIZE)) {
+        g_set_error(err, ERR_DOMAIN, CRE_MEMORY,
+                    "Cannot allocate a read buffer");
+        ret = FALSE;
+        goto exit;
+    }
+
+    while ((readed = fd_reader_read(&reader, buf, BUFFER_SIZE)) != 0) {
+        if (readed < 0) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Error while reading a file: %s", g_strerror(errno));
+            ret = FALSE;
+            break;
+        }
+        if (cr_checksum_update(ctx, buf, readed, &tmp_err) != CRE_OK) {
+            g_propagate_error(err, tmp_err);
+            ret = FALSE;
+            break;
+        }
+    }
+
+    free(buf);
+
+exit:
+    if (reader.direct)
+        fcntl(fd, F_SETFL, reader.flags);
+
+    return ret;
+}
+
+/* The file is mapped in windows, so a huge file doesn't need a huge
+ * continuous part of the address space.
+ */
+static gboolean
+checksum_fd_mmap(int fd, cr_ChecksumCtx *ctx, GError **err)
+{
+    GError *tmp_err = NULL;
+    struct stat st;
+
+    if (fstat(fd, &st) == -1) {
         g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot open a file: %s", g_strerror(errno));
-        return NULL;
+                    "Cannot stat a file: %s", g_strerror(errno));
+        return FALSE;
     }
 
-    ctx = EVP_MD_CTX_create();
-    rc = EVP_DigestInit_ex(ctx, ctx_type, NULL);
-    if (!rc) {
-        g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
-                    "EVP_DigestInit_ex() failed");
-        EVP_MD_CTX_destroy(ctx);
-        fclose(f);
+    if (!S_ISREG(st.st_mode))
+        return checksum_fd_read(fd, ctx, FALSE, err);
+
+    for (off_t offset = 0; offset < st.st_size; offset += MMAP_WINDOW_SIZE) {
+        size_t len = MIN((off_t) MMAP_WINDOW_SIZE, st.st_size - offset);
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (map == MAP_FAILED) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Cannot mmap a file: %s", g_strerror(errno));
+            return FALSE;
+        }
+
+        madvise(map, len, MADV_SEQUENTIAL);
+        int rc = cr_checksum_update(ctx, map, len, &tmp_err);
+        munmap(map, len);
+        if (rc != CRE_OK) {
+            g_propagate_error(err, tmp_err);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Feeds the whole content of the file into the ctx
+ */
+static gboolean
+checksum_fd_ctx(int fd,
+                cr_ChecksumCtx *ctx,
+                cr_ChecksumIoMode mode,
+                GError **err)
+{
+    gboolean ret;
+
+    // Data which were just read by the header parser are still
+    // in the page cache, so the advice doesn't cause re-reading of them
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    switch (mode) {
+        case CR_CHECKSUM_IO_MMAP:
+            ret = checksum_fd_mmap(fd, ctx, err);
+            break;
+        case CR_CHECKSUM_IO_DIRECT:
+            ret = checksum_fd_read(fd, ctx, TRUE, err);
+            break;
+        case CR_CHECKSUM_IO_READ:
+        default:
+            ret = checksum_fd_read(fd, ctx, FALSE, err);
+            break;
+    }
+
+    return ret;
+}
+
+char *
+cr_checksum_fd_with_mode(int fd,
+                         cr_ChecksumType type,
+                         cr_ChecksumIoMode mode,
+                         GError **err)
+{
+    cr_ChecksumCtx *ctx;
+
+    assert(fd >= 0);
+    assert(!err || *err == NULL);
+
+    ctx = cr_checksum_new(type, err);
+    if (!ctx)
+        return NULL;
+
+    if (!checksum_fd_ctx(fd, ctx, mode, err)) {
+        g_free(cr_checksum_final(ctx, NULL));
         return NULL;
     }
 
-    while ((readed = fread(buf, 1, BUFFER_SIZE, f)) == BUFFER_SIZE)
-        EVP_DigestUpdate(ctx, buf, readed);
+    return cr_checksum_final(ctx, err);
+}
 
-    if (feof(f)) {
-        EVP_DigestUpdate(ctx, buf, readed);
-    } else {
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Error while reading a file: %s", g_strerror(errno));
-        EVP_MD_CTX_destroy(ctx);
-        fclose(f);
+gchar **
+cr_checksum_fd_multi(int fd,
+                     const cr_ChecksumType *types,
+                     guint count,
+                     cr_ChecksumIoMode mode,
+                     GError **err)
+{
+    cr_ChecksumCtx *ctx;
+
+    assert(fd >= 0);
+    assert(!err || *err == NULL);
+
+    ctx = cr_checksum_multi_new(types, count, err);
+    if (!ctx)
+        return NULL;
+
+    if (!checksum_fd_ctx(fd, ctx, mode, err)) {
+        g_strfreev(cr_checksum_multi_final(ctx, NULL));
         return NULL;
     }
 
-    fclose(f);
+    return cr_checksum_multi_final(ctx, err);
+}
+
+char *
+cr_checksum_fd(int fd, cr_ChecksumType type, GError **err)
+{
+    return cr_checksum_fd_with_mode(fd, type, CR_CHECKSUM_IO_READ, err);
+}
+
+char *
+cr_checksum_file_with_mode(const char *filename,
+                           cr_ChecksumType type,
+                           cr_ChecksumIoMode mode,
+                           GError **err)
+{
+    char *checksum;
+    int fd;
 
-    EVP_DigestFinal_ex(ctx, raw_checksum, &len);
-    EVP_MD_CTX_destroy(ctx);
-    checksum = g_malloc0(sizeof(char) * (len * 2 + 1));
-    for (size_t x = 0; x < len; x++)
-        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+    assert(filename);
+    assert(!err || *err == NULL);
 
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open a file: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    checksum = cr_checksum_fd_with_mode(fd, type, mode, err);
+    close(fd);
     return checksum;
 }
 
-cr_ChecksumCtx *
-cr_checksum_new(cr_ChecksumType type, GError **err)
+gchar **
+cr_checksum_file_multi(const char *filename,
+                       const cr_ChecksumType *types,
+                       guint count,
+                       cr_ChecksumIoMode mode,
+                       GError **err)
 {
-    EVP_MD_CTX *ctx;
-    const EVP_MD *ctx_type;
-    cr_ChecksumCtx *cr_ctx;
+    gchar **checksums;
+    int fd;
 
+    assert(filename);
     assert(!err || *err == NULL);
 
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open a file: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    checksums = cr_checksum_fd_multi(fd, types, count, mode, err);
+    close(fd);
+    return checksums;
+}
+
+static const EVP_MD *
+checksum_evp_md(cr_ChecksumType type)
+{
     switch (type) {
-        //case CR_CHECKSUM_MD2:    ctx_type = EVP_md2();    break;
-        case CR_CHECKSUM_MD5:    ctx_type = EVP_md5();    break;
-        case CR_CHECKSUM_SHA:    ctx_type = EVP_sha1();   break;
-        case CR_CHECKSUM_SHA1:   ctx_type = EVP_sha1();   break;
-        case CR_CHECKSUM_SHA224: ctx_type = EVP_sha224(); break;
-        case CR_CHECKSUM_SHA256: ctx_type = EVP_sha256(); break;
-        case CR_CHECKSUM_SHA384: ctx_type = EVP_sha384(); break;
-        case CR_CHECKSUM_SHA512: ctx_type = EVP_sha512(); break;
+        //case CR_CHECKSUM_MD2:    return EVP_md2();
+        case CR_CHECKSUM_MD5:    return EVP_md5();
+        case CR_CHECKSUM_SHA:    return EVP_sha1();
+        case CR_CHECKSUM_SHA1:   return EVP_sha1();
+        case CR_CHECKSUM_SHA224: return EVP_sha224();
+        case CR_CHECKSUM_SHA256: return EVP_sha256();
+        case CR_CHECKSUM_SHA384: return EVP_sha384();
+        case CR_CHECKSUM_SHA512: return EVP_sha512();
         case CR_CHECKSUM_UNKNOWN:
         default:
-            g_set_error(err, ERR_DOMAIN, CRE_UNKNOWNCHECKSUMTYPE,
-                        "Unknown checksum type");
             return NULL;
     }
+}
 
-    ctx = EVP_MD_CTX_create();
-    if (!ctx) {
-        g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
-                    "EVP_MD_CTX_create() failed");
-        return NULL;
-    }
+static void
+checksum_ctx_free(cr_ChecksumCtx *ctx)
+{
+    for (guint x = 0; x < ctx->count; x++)
+        EVP_MD_CTX_destroy(ctx->ctx[x]);
+    g_free(ctx);
+}
 
-    if (!EVP_DigestInit_ex(ctx, ctx_type, NULL)) {
-        g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
-                    "EVP_DigestInit_ex() failed");
-        EVP_MD_CTX_destroy(ctx);
+cr_ChecksumCtx *
+cr_checksum_new(cr_ChecksumType type, GError **err)
+{
+    return cr_checksum_multi_new(&type, 1, err);
+}
+
+cr_ChecksumCtx *
+cr_checksum_multi_new(const cr_ChecksumType *types,
+                      guint count,
+                      GError **err)
+{
+    cr_ChecksumCtx *cr_ctx;
+
+    assert(types || count == 0);
+    assert(!err || *err == NULL);
+
+    if (count == 0 || count > CR_CHECKSUM_MULTI_MAX) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Bad number of checksum types: %u", count);
         return NULL;
     }
 
     cr_ctx = g_malloc0(sizeof(cr_ChecksumCtx));
-    cr_ctx->ctx = ctx;
-    cr_ctx->type = type;
+
+    for (guint x = 0; x < count; x++) {
+        const EVP_MD *ctx_type = checksum_evp_md(types[x]);
+        EVP_MD_CTX *ctx;
+
+        if (!ctx_type) {
+            g_set_error(err, ERR_DOMAIN, CRE_UNKNOWNCHECKSUMTYPE,
+                        "Unknown checksum type");
+            checksum_ctx_free(cr_ctx);
+            return NULL;
+        }
+
+        ctx = EVP_MD_CTX_create();
+        if (!ctx) {
+            g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
+                        "EVP_MD_CTX_create() failed");
+            checksum_ctx_free(cr_ctx);
+            return NULL;
+        }
+
+        if (!EVP_DigestInit_ex(ctx, ctx_type, NULL)) {
+            g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
+                        "EVP_DigestInit_ex() failed");
+            EVP_MD_CTX_destroy(ctx);
+            checksum_ctx_free(cr_ctx);
+            return NULL;
+        }
+
+        cr_ctx->ctx[x] = ctx;
+        cr_ctx->type[x] = types[x];
+        cr_ctx->count++;
+    }
 
     return cr_ctx;
 }
@@ -236,40 +632,220 @@ cr_checksum_update(cr_ChecksumCtx *ctx,
     if (len == 0)
         return CRE_OK;
 
-    if (!EVP_DigestUpdate(ctx->ctx, buf, len)) {
-        g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
-                    "EVP_DigestUpdate() failed");
-        return CRE_OPENSSL;
+    // All digests are updated while the buffer is hot in the cache
+    for (guint x = 0; x < ctx->count; x++) {
+        if (!EVP_DigestUpdate(ctx->ctx[x], buf, len)) {
+            g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
+                        "EVP_DigestUpdate() failed");
+            return CRE_OPENSSL;
+        }
     }
 
     return CRE_OK;
 }
 
-char *
-cr_checksum_final(cr_ChecksumCtx *ctx, GError **err)
+gchar **
+cr_checksum_multi_final(cr_ChecksumCtx *ctx, GError **err)
 {
     unsigned int len;
     unsigned char raw_checksum[EVP_MAX_MD_SIZE];
+    gchar **checksums;
+
+    assert(ctx);
+    assert(!err || *err == NULL);
+
+    checksums = g_new0(gchar *, ctx->count + 1);
+
+    for (guint x = 0; x < ctx->count; x++) {
+        if (!EVP_DigestFinal_ex(ctx->ctx[x], raw_checksum, &len)) {
+            g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
+                        "EVP_DigestFinal_ex() failed");
+            g_strfreev(checksums);
+            checksum_ctx_free(ctx);
+            return NULL;
+        }
+
+        checksums[x] = g_malloc0(sizeof(char) * (len * 2 + 1));
+        for (size_t y = 0; y < len; y++)
+            sprintf(checksums[x]+(y*2), "%02x", raw_checksum[y]);
+    }
+
+    checksum_ctx_free(ctx);
+
+    return checksums;
+}
+
+char *
+cr_checksum_final(cr_ChecksumCtx *ctx, GError **err)
+{
+    gchar **checksums;
     char *checksum;
 
     assert(ctx);
     assert(!err || *err == NULL);
 
-    if (!EVP_DigestFinal_ex(ctx->ctx, raw_checksum, &len)) {
-        g_set_error(err, ERR_DOMAIN, CRE_OPENSSL,
-                    "EVP_DigestFinal_ex() failed");
-        EVP_MD_CTX_destroy(ctx->ctx);
-        g_free(ctx);
+    checksums = cr_checksum_multi_final(ctx, err);
+    if (!checksums)
         return NULL;
+
+    // Only the first checksum is requested
+    checksum = checksums[0];
+    for (gchar **x = checksums + 1; *x; x++)
+        g_free(*x);
+    g_free(checksums);
+
+    return checksum;
+}
+
+/*
+ * XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md)
+ */
+
+#define XXH_PRIME64_1   G_GUINT64_CONSTANT(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2   G_GUINT64_CONSTANT(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3   G_GUINT64_CONSTANT(0x165667B19E3779F9)
+#define XXH_PRIME64_4   G_GUINT64_CONSTANT(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5   G_GUINT64_CONSTANT(0x27D4EB2F165667C5)
+#define XXH_STRIPE_LEN  32
+
+struct _cr_FingerprintCtx {
+    guint64 acc[4];                     // Accumulators
+    guint64 total_len;                  // Length of all data
+    guchar  buf[XXH_STRIPE_LEN];        // Incomplete stripe
+    gsize   buf_len;                    // Used part of the buf
+};
+
+static inline guint64
+xxh_rotl(guint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline guint64
+xxh_read64(const guchar *p)
+{
+    guint64 val;
+    memcpy(&val, p, sizeof(val));
+    return GUINT64_FROM_LE(val);
+}
+
+static inline guint32
+xxh_read32(const guchar *p)
+{
+    guint32 val;
+    memcpy(&val, p, sizeof(val));
+    return GUINT32_FROM_LE(val);
+}
+
+static inline guint64
+xxh_round(guint64 acc, guint64 input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline guint64
+xxh_merge(guint64 acc, guint64 val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline void
+xxh_stripe(guint64 *acc, const guchar *p)
+{
+    acc[0] = xxh_round(acc[0], xxh_read64(p));
+    acc[1] = xxh_round(acc[1], xxh_read64(p + 8));
+    acc[2] = xxh_round(acc[2], xxh_read64(p + 16));
+    acc[3] = xxh_round(acc[3], xxh_read64(p + 24));
+}
+
+cr_FingerprintCtx *
+cr_fingerprint_new(void)
+{
+    cr_FingerprintCtx *ctx = g_new0(cr_FingerprintCtx, 1);
+
+    // Seed 0
+    ctx->acc[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    ctx->acc[1] = XXH_PRIME64_2;
+    ctx->acc[2] = 0;
+    ctx->acc[3] = -XXH_PRIME64_1;
+    return ctx;
+}
+
+void
+cr_fingerprint_update(cr_FingerprintCtx *ctx, const void *buf, size_t len)
+{
+    const guchar *p = buf;
+
+    assert(ctx);
+
+    ctx->total_len += len;
+
+    if (ctx->buf_len + len < XXH_STRIPE_LEN) {
+        memcpy(ctx->buf + ctx->buf_len, p, len);
+        ctx->buf_len += len;
+        return;
     }
 
-    EVP_MD_CTX_destroy(ctx->ctx);
+    if (ctx->buf_len) {
+        gsize fill = XXH_STRIPE_LEN - ctx->buf_len;
+        memcpy(ctx->buf + ctx->buf_len, p, fill);
+        xxh_stripe(ctx->acc, ctx->buf);
+        p += fill;
+        len -= fill;
+        ctx->buf_len = 0;
+    }
 
-    checksum = g_malloc0(sizeof(char) * (len * 2 + 1));
-    for (size_t x = 0; x < len; x++)
-        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+    for (; len >= XXH_STRIPE_LEN; p += XXH_STRIPE_LEN, len -= XXH_STRIPE_LEN)
+        xxh_stripe(ctx->acc, p);
 
-    g_free(ctx);
+    memcpy(ctx->buf, p, len);
+    ctx->buf_len = len;
+}
 
-    return checksum;
+char *
+cr_fingerprint_final(cr_FingerprintCtx *ctx)
+{
+    const guchar *p, *end;
+    guint64 h;
+
+    assert(ctx);
+
+    if (ctx->total_len >= XXH_STRIPE_LEN) {
+        h = xxh_rotl(ctx->acc[0], 1) + xxh_rotl(ctx->acc[1], 7)
+            + xxh_rotl(ctx->acc[2], 12) + xxh_rotl(ctx->acc[3], 18);
+        for (int x = 0; x < 4; x++)
+            h = xxh_merge(h, ctx->acc[x]);
+    } else {
+        h = ctx->acc[2] + XXH_PRIME64_5;
+    }
+    h += ctx->total_len;
+
+    p = ctx->buf;
+    end = ctx->buf + ctx->buf_len;
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (guint64) xxh_read32(p) * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (guint64) *p * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    g_free(ctx);
+    return g_strdup_printf("%016"G_GINT64_MODIFIER"x", h);
 }
@@ -53,6 +53,23 @@ typedef enum {
     CR_CHECKSUM_SENTINEL,   /*!< sentinel of the list */
 } cr_ChecksumType;
 
+/**
+ * Enum of strategies for reading of files during checksum calculation.
+ */
+typedef enum {
+    CR_CHECKSUM_IO_UNKNOWN,     /*!< Unknown mode */
+    CR_CHECKSUM_IO_READ,        /*!< Big sequential reads (default) */
+    CR_CHECKSUM_IO_MMAP,        /*!< Memory mapped file */
+    CR_CHECKSUM_IO_DIRECT,      /*!< O_DIRECT reads bypassing the page cache
+                                     (buffered reads are used if the
+                                     filesystem doesn't support it) */
+    CR_CHECKSUM_IO_SENTINEL,    /*!< sentinel of the list */
+} cr_ChecksumIoMode;
+
+/** Maximal number of checksums calculated by one checksum context.
+ */
+#define CR_CHECKSUM_MULTI_MAX   8
+
 /** Return checksum name.
  * @param type          checksum type
  * @return              constant null terminated string with checksum name
@@ -77,6 +94,51 @@ char *cr_checksum_file(const char *filename,
                        cr_ChecksumType type,
                        GError **err);
 
+/** Return checksum io mode.
+ * @param name          mode name ("read", "mmap" or "direct")
+ * @return              io mode or CR_CHECKSUM_IO_UNKNOWN
+ */
+cr_ChecksumIoMode cr_checksum_io_mode(const char *name);
+
+/** Compute file checksum using the specified io mode.
+ * @param filename      filename
+ * @param type          type of checksum
+ * @param mode          io mode
+ * @param err           GError **
+ * @return              malloced null terminated string with checksum
+ *                      or NULL on error
+ */
+char *cr_checksum_file_with_mode(const char *filename,
+                                 cr_ChecksumType type,
+                                 cr_ChecksumIoMode mode,
+                                 GError **err);
+
+/** Compute checksum of the whole content of an opened file.
+ * The file offset is not changed. Big sequential reads are used
+ * (CR_CHECKSUM_IO_READ).
+ * @param fd            file descriptor opened for reading
+ * @param type          type of checksum
+ * @param err           GError **
+ * @return              malloced null terminated string with checksum
+ *                      or NULL on error
+ */
+char *cr_checksum_fd(int fd,
+                     cr_ChecksumType type,
+                     GError **err);
+
+/** Same as cr_checksum_fd() but using the specified io mode.
+ * @param fd            file descriptor opened for reading
+ * @param type          type of checksum
+ * @param mode          io mode
+ * @param err           GError **
+ * @return              malloced null terminated string with checksum
+ *                      or NULL on error
+ */
+char *cr_checksum_fd_with_mode(int fd,
+                               cr_ChecksumType type,
+                               cr_ChecksumIoMode mode,
+                               GError **err);
+
 /** Create new checksum context.
  * @param type      Checksum algorithm of the new checksum context.
  * @param err       GError **
@@ -84,6 +146,19 @@ char *cr_checksum_file(const char *filename,
  */
 cr_ChecksumCtx *cr_checksum_new(cr_ChecksumType type, GError **err);
 
+/** Create new checksum context which calculates several checksums
+ * from the same data at once.
+ * @param types     Checksum algorithms (order of the checksums returned
+ *                  by cr_checksum_multi_final()).
+ * @param count     Number of items in types (at most
+ *                  CR_CHECKSUM_MULTI_MAX).
+ * @param err       GError **
+ * @return          cr_ChecksumCtx or NULL on error
+ */
+cr_ChecksumCtx *cr_checksum_multi_new(const cr_ChecksumType *types,
+                                      guint count,
+                                      GError **err);
+
 /** Feeds data into the checksum.
  * @param ctx       Checksum context.
  * @param buf       Pointer to the data.
@@ -97,13 +172,83 @@ int cr_checksum_update(cr_ChecksumCtx *ctx,
                        GError **err);
 
 /** Finalize checksum calculation, return checksum string and frees
- * all checksum context resources.
+ * all checksum context resources. If the context calculates several
+ * checksums, only the first one is returned.
  * @param ctx       Checksum context.
  * @param err       GError **
  * @return          Checksum string or NULL on error.
  */
 char *cr_checksum_final(cr_ChecksumCtx *ctx, GError **err);
 
+/** Finalize calculation of all checksums of the context, return them
+ * and free all checksum context resources.
+ * @param ctx       Checksum context.
+ * @param err       GError **
+ * @return          NULL terminated array of checksum strings in the order
+ *                  of types passed to cr_checksum_multi_new() (free it
+ *                  by g_strfreev()) or NULL on error.
+ */
+gchar **cr_checksum_multi_final(cr_ChecksumCtx *ctx, GError **err);
+
+/** Compute several checksums of the whole content of an opened file
+ * reading it only once. See cr_checksum_fd_with_mode().
+ * @param fd            file descriptor opened for reading
+ * @param types         types of checksums
+ * @param count         number of items in types
+ * @param mode          io mode
+ * @param err           GError **
+ * @return              NULL terminated array of checksums in the order
+ *                      of types (free it by g_strfreev()) or NULL on error
+ */
+gchar **cr_checksum_fd_multi(int fd,
+                             const cr_ChecksumType *types,
+                             guint count,
+                             cr_ChecksumIoMode mode,
+                             GError **err);
+
+/** Compute several checksums of a file reading it only once.
+ * See cr_checksum_file_with_mode().
+ * @param filename      filename
+ * @param types         types of checksums
+ * @param count         number of items in types
+ * @param mode          io mode
+ * @param err           GError **
+ * @return              NULL terminated array of checksums in the order
+ *                      of types (free it by g_strfreev()) or NULL on error
+ */
+gchar **cr_checksum_file_multi(const char *filename,
+                               const cr_ChecksumType *types,
+                               guint count,
+                               cr_ChecksumIoMode mode,
+                               GError **err);
+
+/** Context of a fast non-cryptographic fingerprint (XXH64).
+ * Fingerprints are meant for internal purposes only (cache keys, ...),
+ * never use them for checksums published in the metadata.
+ */
+typedef struct _cr_FingerprintCtx cr_FingerprintCtx;
+
+/** Create new fingerprint context.
+ * @return          cr_FingerprintCtx
+ */
+cr_FingerprintCtx *cr_fingerprint_new(void);
+
+/** Feeds data into the fingerprint.
+ * @param ctx       Fingerprint context.
+ * @param buf       Pointer to the data.
+ * @param len       Length of the data.
+ */
+void cr_fingerprint_update(cr_FingerprintCtx *ctx,
+                           const void *buf,
+                           size_t len);
+
+/** Finalize fingerprint calculation, return fingerprint string
+ * (16 hex digits) and free the context.
+ * @param ctx       Fingerprint context.
+ * @return          Malloced fingerprint string.
+ */
+char *cr_fingerprint_final(cr_FingerprintCtx *ctx);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -0,0 +1,385 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checksum_cache.h"
+#include "error.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+/*
+ * File format (native byte order, the cache is local to the machine):
+ *
+ *  Header:
+ *      char[8]     CHKSUMCACHE_MAGIC
+ *  Records (until EOF):
+ *      struct RecordHeader
+ *      char[]      key (without '\0')
+ *      char[]      checksum (without '\0')
+ */
+
+#define CHKSUMCACHE_MAGIC       "CRCSUM01"
+#define CHKSUMCACHE_MAGIC_LEN   8
+#define MAX_VALUE_LEN           1024
+
+struct RecordHeader {
+    guint32 key_len;
+    guint32 value_len;
+};
+
+struct _cr_ChecksumCache {
+    gchar *path;                // Path to the cache file
+    int fd;                     // Cache file opened for appending
+    GHashTable *entries;        // Key: gchar *, Value: gchar * (checksum)
+    guint records;              // Number of records in the file
+    GMutex mutex;               // Guards the entries, records and the fd
+};
+
+
+static gboolean
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *data = buf;
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        data += written;
+        len -= written;
+    }
+    return TRUE;
+}
+
+static GString *
+make_record(const char *key, const char *value)
+{
+    struct RecordHeader hdr;
+    GString *record;
+
+    hdr.key_len   = strlen(key);
+    hdr.value_len = strlen(value);
+
+    record = g_string_sized_new(sizeof(hdr) + hdr.key_len + hdr.value_len);
+    g_string_append_len(record, (const gchar *) &hdr, sizeof(hdr));
+    g_string_append_len(record, key, hdr.key_len);
+    g_string_append_len(record, value, hdr.value_len);
+    return record;
+}
+
+/* Returns the length of the valid part of the data
+ */
+static gsize
+load_records(cr_ChecksumCache *cache, const char *data, gsize len)
+{
+    gsize off = CHKSUMCACHE_MAGIC_LEN;
+    gsize good = off;           // End of the last valid record
+
+    while (off < len) {
+        struct RecordHeader hdr;
+
+        good = off;
+        if (len - off < sizeof(hdr))
+            goto corrupted;
+        memcpy(&hdr, data + off, sizeof(hdr));
+        off += sizeof(hdr);
+
+        if (hdr.key_len == 0 || hdr.value_len == 0
+            || hdr.value_len > MAX_VALUE_LEN
+            || hdr.key_len > len - off
+            || hdr.value_len > len - off - hdr.key_len)
+            goto corrupted;
+
+        g_hash_table_replace(cache->entries,
+                             g_strndup(data + off, hdr.key_len),
+                             g_strndup(data + off + hdr.key_len,
+                                       hdr.value_len));
+        off += hdr.key_len + hdr.value_len;
+        cache->records++;
+    }
+
+    return len;
+
+corrupted:
+    // Records loaded so far are fine, use them
+    g_warning("%s: Checksum cache %s is truncated or corrupted - "
+              "using %u valid records", __func__, cache->path,
+              g_hash_table_size(cache->entries));
+    return good;
+}
+
+cr_ChecksumCache *
+cr_checksum_cache_open(const char *path, GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_ChecksumCache *cache;
+    struct stat st;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    cache = g_new0(cr_ChecksumCache, 1);
+    cache->path = g_strdup(path);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, g_free);
+    g_mutex_init(&(cache->mutex));
+
+    cache->fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0666);
+    if (cache->fd < 0 || fstat(cache->fd, &st) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open checksum cache %s: %s",
+                    path, g_strerror(errno));
+        cr_checksum_cache_free(cache);
+        return NULL;
+    }
+
+    if (st.st_size == 0) {
+        // New cache
+        if (!write_all(cache->fd, CHKSUMCACHE_MAGIC, CHKSUMCACHE_MAGIC_LEN)) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Cannot write checksum cache %s: %s",
+                        path, g_strerror(errno));
+            cr_checksum_cache_free(cache);
+            return NULL;
+        }
+        return cache;
+    }
+
+    GMappedFile *map = g_mapped_file_new(path, FALSE, &tmp_err);
+    if (!map) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot map checksum cache %s: %s",
+                    path, tmp_err->message);
+        g_clear_error(&tmp_err);
+        cr_checksum_cache_free(cache);
+        return NULL;
+    }
+
+    const char *data = g_mapped_file_get_contents(map);
+    gsize len = g_mapped_file_get_length(map);
+
+    if (len < CHKSUMCACHE_MAGIC_LEN
+        || memcmp(data, CHKSUMCACHE_MAGIC, CHKSUMCACHE_MAGIC_LEN))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s is not a checksum cache", path);
+        g_mapped_file_unref(map);
+        cr_checksum_cache_free(cache);
+        return NULL;
+    }
+
+    gsize valid = load_records(cache, data, len);
+    g_mapped_file_unref(map);
+
+    // Records appended after the garbage couldn't be loaded next time
+    if (valid < len && ftruncate(cache->fd, valid) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot truncate checksum cache %s: %s",
+                    path, g_strerror(errno));
+        cr_checksum_cache_free(cache);
+        return NULL;
+    }
+
+    g_debug("%s: Loaded %u checksums from %s", __func__,
+            g_hash_table_size(cache->entries), path);
+    return cache;
+}
+
+guint
+cr_checksum_cache_size(cr_ChecksumCache *cache)
+{
+    guint size;
+
+    if (!cache)
+        return 0;
+
+    g_mutex_lock(&(cache->mutex));
+    size = g_hash_table_size(cache->entries);
+    g_mutex_unlock(&(cache->mutex));
+    return size;
+}
+
+guint
+cr_checksum_cache_garbage(cr_ChecksumCache *cache)
+{
+    guint garbage;
+
+    if (!cache)
+        return 0;
+
+    g_mutex_lock(&(cache->mutex));
+    garbage = cache->records - g_hash_table_size(cache->entries);
+    g_mutex_unlock(&(cache->mutex));
+    return garbage;
+}
+
+gchar *
+cr_checksum_cache_lookup(cr_ChecksumCache *cache, const char *key)
+{
+    gchar *checksum;
+
+    if (!cache || !key)
+        return NULL;
+
+    g_mutex_lock(&(cache->mutex));
+    checksum = g_strdup(g_hash_table_lookup(cache->entries, key));
+    g_mutex_unlock(&(cache->mutex));
+    return checksum;
+}
+
+gboolean
+cr_checksum_cache_add(cr_ChecksumCache *cache,
+                      const char *key,
+                      const char *checksum,
+                      GError **err)
+{
+    GString *record;
+    gboolean ret = TRUE;
+
+    assert(cache);
+    assert(key && *key);
+    assert(checksum && *checksum);
+    assert(!err || *err == NULL);
+
+    record = make_record(key, checksum);
+
+    g_mutex_lock(&(cache->mutex));
+    const gchar *current = g_hash_table_lookup(cache->entries, key);
+    if (!g_strcmp0(current, checksum)) {
+        // Nothing new
+        g_mutex_unlock(&(cache->mutex));
+        g_string_free(record, TRUE);
+        return TRUE;
+    }
+
+    // The file is opened with O_APPEND and every record is written by
+    // a single write(), so the records of concurrent createrepo_c
+    // processes don't interleave
+    if (write(cache->fd, record->str, record->len) != (ssize_t) record->len) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write checksum cache %s: %s",
+                    cache->path, g_strerror(errno));
+        ret = FALSE;
+    } else {
+        g_hash_table_replace(cache->entries, g_strdup(key),
+                             g_strdup(checksum));
+        cache->records++;
+    }
+    g_mutex_unlock(&(cache->mutex));
+
+    g_string_free(record, TRUE);
+    return ret;
+}
+
+gboolean
+cr_checksum_cache_compact(cr_ChecksumCache *cache, GError **err)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    gchar *tmp_path;
+    GString *data;
+    int fd;
+
+    assert(cache);
+    assert(!err || *err == NULL);
+
+    g_mutex_lock(&(cache->mutex));
+
+    data = g_string_new_len(CHKSUMCACHE_MAGIC, CHKSUMCACHE_MAGIC_LEN);
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        GString *record = make_record(key, value);
+        g_string_append_len(data, record->str, record->len);
+        g_string_free(record, TRUE);
+    }
+
+    tmp_path = g_strconcat(cache->path, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmp_path);
+    if (fd < 0 || !write_all(fd, data->str, data->len) || fsync(fd) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write checksum cache %s: %s",
+                    tmp_path, g_strerror(errno));
+        goto error;
+    }
+
+    if (g_rename(tmp_path, cache->path) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot rename %s -> %s: %s", tmp_path,
+                    cache->path, g_strerror(errno));
+        goto error;
+    }
+
+    // Continue with appending into the new file
+    close(fd);
+    fd = open(cache->path, O_RDWR | O_APPEND);
+    if (fd < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open checksum cache %s: %s",
+                    cache->path, g_strerror(errno));
+        g_free(tmp_path);
+        g_string_free(data, TRUE);
+        g_mutex_unlock(&(cache->mutex));
+        return FALSE;
+    }
+
+    g_debug("%s: %s compacted (%u -> %u records)", __func__, cache->path,
+            cache->records, g_hash_table_size(cache->entries));
+
+    close(cache->fd);
+    cache->fd = fd;
+    cache->records = g_hash_table_size(cache->entries);
+
+    g_free(tmp_path);
+    g_string_free(data, TRUE);
+    g_mutex_unlock(&(cache->mutex));
+    return TRUE;
+
+error:
+    if (fd >= 0) {
+        close(fd);
+        g_remove(tmp_path);
+    }
+    g_free(tmp_path);
+    g_string_free(data, TRUE);
+    g_mutex_unlock(&(cache->mutex));
+    return FALSE;
+}
+
+void
+cr_checksum_cache_free(cr_ChecksumCache *cache)
+{
+    if (!cache)
+        return;
+
+    if (cache->fd >= 0)
+        close(cache->fd);
+    g_hash_table_destroy(cache->entries);
+    g_mutex_clear(&(cache->mutex));
+    g_free(cache->path);
+    g_free(cache);
+}
@@ -0,0 +1,116 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_CHECKSUM_CACHE_H__
+#define __C_CREATEREPOLIB_CHECKSUM_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+
+/** \defgroup   checksum_cache  Single file cache of package checksums
+ *
+ * Alternative to the --cachedir, which creates one file per package.
+ * All the checksums are stored in one append-only file. The whole file
+ * is loaded into a hash table when the cache is opened, so a lookup
+ * doesn't touch the filesystem. New checksums are appended by a single
+ * write() each, the latest record of a key wins. Obsolete records are
+ * removed by cr_checksum_cache_compact().
+ *
+ *  \addtogroup checksum_cache
+ *  @{
+ */
+
+/** Opened checksum cache.
+ */
+typedef struct _cr_ChecksumCache cr_ChecksumCache;
+
+/** Open the cache file (create it if it doesn't exist) and load it.
+ * Truncated or corrupted tail of the file is ignored.
+ * @param path          Path to the cache file
+ * @param err           GError **
+ * @return              Opened cache or NULL on error
+ */
+cr_ChecksumCache *
+cr_checksum_cache_open(const char *path, GError **err);
+
+/** Number of keys in the cache.
+ * @param cache         Opened cache
+ * @return              Number of keys
+ */
+guint
+cr_checksum_cache_size(cr_ChecksumCache *cache);
+
+/** Find a checksum in the cache. This function is thread safe.
+ * @param cache         Opened cache
+ * @param key           Identification of the package (the same as
+ *                      the name of the file in the --cachedir)
+ * @return              Newly allocated checksum or NULL
+ */
+gchar *
+cr_checksum_cache_lookup(cr_ChecksumCache *cache, const char *key);
+
+/** Add a checksum into the cache and append it to the cache file.
+ * This function is thread safe.
+ * @param cache         Opened cache
+ * @param key           Identification of the package
+ * @param checksum      Checksum of the package
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_checksum_cache_add(cr_ChecksumCache *cache,
+                      const char *key,
+                      const char *checksum,
+                      GError **err);
+
+/** Rewrite the cache file so that it contains only the latest record
+ * of every key. The new file replaces the old one atomically. Records
+ * appended to the old file by other processes during the compaction
+ * are lost (it's just a cache).
+ * @param cache         Opened cache
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_checksum_cache_compact(cr_ChecksumCache *cache, GError **err);
+
+/** Number of obsolete records in the cache file.
+ * @param cache         Opened cache
+ * @return              Number of records which would be removed
+ *                      by cr_checksum_cache_compact()
+ */
+guint
+cr_checksum_cache_garbage(cr_ChecksumCache *cache);
+
+/** Close and free the cache.
+ * @param cache         Opened cache
+ */
+void
+cr_checksum_cache_free(cr_ChecksumCache *cache);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_CHECKSUM_CACHE_H__ */
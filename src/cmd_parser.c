@@ -27,6 +27,7 @@
 #include "error.h"
 #include "compression_wrapper.h"
 #include "misc.h"
+#include "remotepkg.h"
 #include "cleanup.h"
 
 
@@ -36,11 +37,13 @@
 #define DEFAULT_UNIQUE_MD_FILENAMES     TRUE
 #define DEFAULT_IGNORE_LOCK             FALSE
 #define DEFAULT_LOCAL_SQLITE            FALSE
+#define DEFAULT_WATCH_DELAY             2
 
-struct CmdOptions _cmd_options = {
+static const struct CmdOptions default_options = {
         .changelog_limit            = DEFAULT_CHANGELOG_LIMIT,
         .checksum                   = NULL,
         .workers                    = DEFAULT_WORKERS,
+        .reorder_buffer_mb          = DEFAULT_REORDER_BUFFER_MB,
         .unique_md_filenames        = DEFAULT_UNIQUE_MD_FILENAMES,
         .checksum_type              = CR_CHECKSUM_SHA256,
         .retain_old                 = 0,
@@ -49,9 +52,17 @@ struct CmdOptions _cmd_options = {
         .ignore_lock                = DEFAULT_IGNORE_LOCK,
         .md_max_age                 = G_GINT64_CONSTANT(0),
         .cachedir                   = NULL,
+        .checksum_io                = NULL,
+        .checksum_cache             = NULL,
+        .compact_checksum_cache     = FALSE,
+        .checksum_io_mode           = CR_CHECKSUM_IO_READ,
         .local_sqlite               = DEFAULT_LOCAL_SQLITE,
+        .reuse_sqlite               = FALSE,
+        .update_from_sqlite         = FALSE,
+        .sqlite_in_memory           = FALSE,
         .cut_dirs                   = 0,
         .location_prefix            = NULL,
+        .remote_transfers           = CR_REMOTEPKG_DEFAULT_TRANSFERS,
         .repomd_checksum            = NULL,
 
         .deltas                     = FALSE,
@@ -64,157 +75,343 @@ struct CmdOptions _cmd_options = {
 
         .zck_compression            = FALSE,
         .zck_dict_dir               = NULL,
+        .pri_zck_chunking           = CR_ZCK_CHUNKING_SRPM,
+        .fil_zck_chunking           = CR_ZCK_CHUNKING_SRPM,
+        .oth_zck_chunking           = CR_ZCK_CHUNKING_SRPM,
         .recycle_pkglist            = FALSE,
+        .watch                      = FALSE,
+        .watch_delay                = DEFAULT_WATCH_DELAY,
     };
 
+// The option entries hold offsets of the values in struct CmdOptions,
+// option_entries_new() points them to the options of one parse
+#define OPT(member) \
+    GSIZE_TO_POINTER(G_STRUCT_OFFSET(struct CmdOptions, member))
+
 
 
 // Command line params
 
-static GOptionEntry cmd_entries[] =
+static const GOptionEntry cmd_entries[] =
 {
-    { "version", 'V', 0, G_OPTION_ARG_NONE, &(_cmd_options.version),
+    { "version", 'V', 0, G_OPTION_ARG_NONE, OPT(version),
       "Show program's version number and exit.", NULL},
-    { "quiet", 'q', 0, G_OPTION_ARG_NONE, &(_cmd_options.quiet),
+    { "quiet", 'q', 0, G_OPTION_ARG_NONE, OPT(quiet),
       "Run quietly.", NULL },
-    { "verbose", 'v', 0, G_OPTION_ARG_NONE, &(_cmd_options.verbose),
+    { "verbose", 'v', 0, G_OPTION_ARG_NONE, OPT(verbose),
       "Run verbosely.", NULL },
-    { "excludes", 'x', 0, G_OPTION_ARG_FILENAME_ARRAY, &(_cmd_options.excludes),
+    { "excludes", 'x', 0, G_OPTION_ARG_FILENAME_ARRAY, OPT(excludes),
       "Path patterns to exclude, can be specified multiple times.", "PACKAGE_NAME_GLOB" },
-    { "basedir", 0, 0, G_OPTION_ARG_FILENAME, &(_cmd_options.basedir),
+    { "basedir", 0, 0, G_OPTION_ARG_FILENAME, OPT(basedir),
       "Basedir for path to directories.", "BASEDIR" },
-    { "baseurl", 'u', 0, G_OPTION_ARG_FILENAME, &(_cmd_options.location_base),
+    { "baseurl", 'u', 0, G_OPTION_ARG_FILENAME, OPT(location_base),
       "Optional base URL location for all files.", "URL" },
-    { "groupfile", 'g', 0, G_OPTION_ARG_FILENAME, &(_cmd_options.groupfile),
+    { "groupfile", 'g', 0, G_OPTION_ARG_FILENAME, OPT(groupfile),
       "Path to groupfile to include in metadata.",
       "GROUPFILE" },
-    { "checksum", 's', 0, G_OPTION_ARG_STRING, &(_cmd_options.checksum),
+    { "checksum", 's', 0, G_OPTION_ARG_STRING, OPT(checksum),
       "Choose the checksum type used in repomd.xml and for packages in the "
       "metadata. The default is now \"sha256\".", "CHECKSUM_TYPE" },
-    { "pretty", 'p', 0, G_OPTION_ARG_NONE, &(_cmd_options.pretty),
+    { "pretty", 'p', 0, G_OPTION_ARG_NONE, OPT(pretty),
       "Make sure all xml generated is formatted (default)", NULL },
-    { "database", 'd', 0, G_OPTION_ARG_NONE, &(_cmd_options.database),
+    { "database", 'd', 0, G_OPTION_ARG_NONE, OPT(database),
       "Generate sqlite databases for use with yum.", NULL },
-    { "no-database", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.no_database),
+    { "no-database", 0, 0, G_OPTION_ARG_NONE, OPT(no_database),
       "Do not generate sqlite databases in the repository.", NULL },
-    { "update", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.update),
+    { "update", 0, 0, G_OPTION_ARG_NONE, OPT(update),
       "If metadata already exists in the outputdir and an rpm is unchanged "
       "(based on file size and mtime) since the metadata was generated, reuse "
       "the existing metadata rather than recalculating it. In the case of a "
       "large repository with only a few new or modified rpms "
       "this can significantly reduce I/O and processing time.", NULL },
-    { "update-md-path", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &(_cmd_options.update_md_paths),
+    { "update-md-path", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, OPT(update_md_paths),
       "Existing metadata from this path are loaded and reused in addition to those "
       "present in the outputdir (works only with --update). Can be specified multiple times.", NULL },
-    { "skip-stat", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.skip_stat),
+    { "skip-stat", 0, 0, G_OPTION_ARG_NONE, OPT(skip_stat),
       "Skip the stat() call on a --update, assumes if the filename is the same "
       "then the file is still the same (only use this if you're fairly "
       "trusting or gullible).", NULL },
-    { "split", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.split),
+    { "split", 0, 0, G_OPTION_ARG_NONE, OPT(split),
       "Run in split media mode. Rather than pass a single directory, take a set of"
       "directories corresponding to different volumes in a media set. "
       "Meta data is created in the first given directory", NULL },
-    { "pkglist", 'i', 0, G_OPTION_ARG_FILENAME, &(_cmd_options.pkglist),
+    { "pkglist", 'i', 0, G_OPTION_ARG_FILENAME, OPT(pkglist),
       "Specify a text file which contains the complete list of files to "
       "include in the repository from the set found in the directory. File "
       "format is one package per line, no wildcards or globs.", "FILENAME" },
-    { "includepkg", 'n', 0, G_OPTION_ARG_FILENAME_ARRAY, &(_cmd_options.includepkg),
+    { "includepkg", 'n', 0, G_OPTION_ARG_FILENAME_ARRAY, OPT(includepkg),
       "Specify pkgs to include on the command line. Takes urls as well as local paths.",
       "PACKAGE" },
-    { "outputdir", 'o', 0, G_OPTION_ARG_FILENAME, &(_cmd_options.outputdir),
+    { "outputdir", 'o', 0, G_OPTION_ARG_FILENAME, OPT(outputdir),
       "Optional output directory.", "URL" },
-    { "skip-symlinks", 'S', 0, G_OPTION_ARG_NONE, &(_cmd_options.skip_symlinks),
+    { "skip-symlinks", 'S', 0, G_OPTION_ARG_NONE, OPT(skip_symlinks),
       "Ignore symlinks of packages.", NULL},
-    { "changelog-limit", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.changelog_limit),
+    { "changelog-limit", 0, 0, G_OPTION_ARG_INT, OPT(changelog_limit),
       "Only import the last N changelog entries, from each rpm, into the metadata.",
       "NUM" },
-    { "unique-md-filenames", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.unique_md_filenames),
+    { "unique-md-filenames", 0, 0, G_OPTION_ARG_NONE, OPT(unique_md_filenames),
       "Include the file's checksum in the metadata filename, helps HTTP caching (default).",
       NULL },
-    { "simple-md-filenames", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.simple_md_filenames),
+    { "simple-md-filenames", 0, 0, G_OPTION_ARG_NONE, OPT(simple_md_filenames),
       "Do not include the file's checksum in the metadata filename.", NULL },
-    { "retain-old-md", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.retain_old),
+    { "shared-store", 0, 0, G_OPTION_ARG_FILENAME, OPT(shared_store),
+      "Directory shared by many repositories. Metadata files already present "
+      "there (by their checksum filename) are hardlinked into the repodata "
+      "instead of keeping another copy, new ones are added to it. "
+      "Requires the unique md filenames.", "DIR" },
+    { "retain-old-md", 0, 0, G_OPTION_ARG_INT, OPT(retain_old),
       "Specify NUM to 0 to remove all repodata present in old repomd.xml or any other positive number to keep all old repodata. "
       "Use --compatibility flag to get the behavior of original createrepo: "
       "Keep around the latest (by timestamp) NUM copies of the old repodata (works only for primary, filelists, other and their DB variants).", "NUM" },
-    { "distro", 0, 0, G_OPTION_ARG_STRING_ARRAY, &(_cmd_options.distro_tags),
+    { "distro", 0, 0, G_OPTION_ARG_STRING_ARRAY, OPT(distro_tags),
       "Distro tag and optional cpeid: --distro'cpeid,textname'.", "DISTRO" },
-    { "content", 0, 0, G_OPTION_ARG_STRING_ARRAY, &(_cmd_options.content_tags),
+    { "content", 0, 0, G_OPTION_ARG_STRING_ARRAY, OPT(content_tags),
       "Tags for the content in the repository.", "CONTENT_TAGS" },
-    { "repo", 0, 0, G_OPTION_ARG_STRING_ARRAY, &(_cmd_options.repo_tags),
+    { "repo", 0, 0, G_OPTION_ARG_STRING_ARRAY, OPT(repo_tags),
       "Tags to describe the repository itself.", "REPO_TAGS" },
-    { "revision", 0, 0, G_OPTION_ARG_STRING, &(_cmd_options.revision),
+    { "revision", 0, 0, G_OPTION_ARG_STRING, OPT(revision),
       "User-specified revision for this repository.", "REVISION" },
-    { "set-timestamp-to-revision", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.set_timestamp_to_revision),
+    { "set-timestamp-to-revision", 0, 0, G_OPTION_ARG_NONE, OPT(set_timestamp_to_revision),
       "Set timestamp fields in repomd.xml and last modification times of created repodata to a value given with --revision. "
       "This requires --revision to be a timestamp formatted in 'date +%s' format.", NULL },
-    { "read-pkgs-list", 0, 0, G_OPTION_ARG_FILENAME, &(_cmd_options.read_pkgs_list),
+    { "set-contenthash", 0, 0, G_OPTION_ARG_NONE, OPT(set_contenthash),
+      "Store a hash of the pkgIds and locations of the packages (in the order of primary.xml) "
+      "as the contenthash of repomd.xml, unchanged content results in the same hash.", NULL },
+    { "read-pkgs-list", 0, 0, G_OPTION_ARG_FILENAME, OPT(read_pkgs_list),
       "Output the paths to the pkgs actually read useful with --update.",
       "READ_PKGS_LIST" },
-    { "workers", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.workers),
+    { "workers", 0, 0, G_OPTION_ARG_INT, OPT(workers),
       "Number of workers to spawn to read rpms.", NULL },
-    { "xz", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.xz_compression),
+    { "max-workers", 0, 0, G_OPTION_ARG_INT, OPT(max_workers),
+      "Adapt the number of workers during the run (from 1 up to N, starting "
+      "with --workers) to the time they wait for I/O. Disabled by default.",
+      "N" },
+    { "progress", 0, 0, G_OPTION_ARG_NONE, OPT(progress),
+      "Print the number of processed packages, packages/s, MiB/s, ETA "
+      "and the memory usage to stderr every 5 seconds.", NULL },
+    { "progress-file", 0, 0, G_OPTION_ARG_FILENAME, OPT(progress_file),
+      "Rewrite this file with the progress (JSON) every 5 seconds.", "FILE" },
+    { "reorder-buffer-mb", 0, 0, G_OPTION_ARG_INT, OPT(reorder_buffer_mb),
+      "Max size (in MiB) of generated metadata of packages waiting to be "
+      "written in the right order. Workers wait when the limit is reached. "
+      "Defaults to 256.", "MB" },
+    { "prefetch", 0, 0, G_OPTION_ARG_INT, OPT(prefetch),
+      "Let the kernel read the next N packages in the background before "
+      "the workers get to them. Useful on high latency storage (e.g. NFS). "
+      "Disabled by default.", "N" },
+    { "large-first", 0, 0, G_OPTION_ARG_NONE, OPT(large_first),
+      "Process packages of 32 MiB or more first (the biggest first), so "
+      "the run doesn't end with a few workers reading huge packages. "
+      "It costs a stat() of every package during the directory walk.", NULL },
+    { "stream-walk", 0, 0, G_OPTION_ARG_NONE, OPT(stream_walk),
+      "Order the packages in the metadata by their directories instead of "
+      "by their filenames, so the workers start on the packages of "
+      "the directories already read while the rest of the tree is walked.",
+      NULL },
+    { "worker-cpus", 0, 0, G_OPTION_ARG_STRING, OPT(worker_cpus),
+      "Bind the workers reading rpms to these CPUs (e.g. \"0-15,32-47\"). "
+      "Use together with --writer-cpus to keep the workers and the writers "
+      "on separate cores or NUMA nodes.", "CPULIST" },
+    { "writer-cpus", 0, 0, G_OPTION_ARG_STRING, OPT(writer_cpus),
+      "Bind the threads writing and compressing the metadata "
+      "to these CPUs (e.g. \"16-19\").", "CPULIST" },
+    { "compress-threads", 0, 0, G_OPTION_ARG_INT, OPT(compress_threads),
+      "Number of threads compressing each gz or xz metadata file. "
+      "By default every file is compressed by a single thread.", "N" },
+    { "xz", 0, 0, G_OPTION_ARG_NONE, OPT(xz_compression),
       "Use xz for repodata compression.", NULL },
-    { "compress-type", 0, 0, G_OPTION_ARG_STRING, &(_cmd_options.compress_type),
+    { "compress-type", 0, 0, G_OPTION_ARG_STRING, OPT(compress_type),
       "Which compression type to use.", "COMPRESSION_TYPE" },
-    { "general-compress-type", 0, 0, G_OPTION_ARG_STRING, &(_cmd_options.general_compress_type),
+    { "general-compress-type", 0, 0, G_OPTION_ARG_STRING, OPT(general_compress_type),
       "Which compression type to use (even for primary, filelists and other xml).",
       "COMPRESSION_TYPE" },
+    { "compress-level", 0, 0, G_OPTION_ARG_STRING, OPT(compress_level),
+      "Compression level of the files compressed by the type (gz and bz2: "
+      "1-9, xz: 0-9, zstd: 1-19), e.g. \"xz:9\". More values are separated "
+      "by commas (e.g. \"gz:1,zstd:3\"). Lower levels are faster, higher ones "
+      "compress better.", "TYPE:LEVEL" },
 #ifdef WITH_ZCHUNK
-    { "zck", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.zck_compression),
+    { "zck", 0, 0, G_OPTION_ARG_NONE, OPT(zck_compression),
       "Generate zchunk files as well as the standard repodata.", NULL },
-    { "zck-dict-dir", 0, 0, G_OPTION_ARG_FILENAME, &(_cmd_options.zck_dict_dir),
+    { "zck-dict-dir", 0, 0, G_OPTION_ARG_FILENAME, OPT(zck_dict_dir),
       "Directory containing compression dictionaries for use by zchunk", "ZCK_DICT_DIR" },
+    { "zck-auto-dict", 0, 0, G_OPTION_ARG_NONE, OPT(zck_auto_dict),
+      "Train the dictionaries missing in --zck-dict-dir from the zchunk "
+      "files of the previous repodata. Existing dictionaries are never "
+      "retrained.", NULL },
+    { "zck-chunking", 0, 0, G_OPTION_ARG_STRING, OPT(zck_chunking),
+      "Where the chunks of the zchunk files end: \"srpm\" (default) - "
+      "every srpm gets a chunk, \"sized\" - as srpm but chunks bigger than "
+      "64 KiB are split, \"hash\" - groups of srpms selected by a hash of "
+      "their names, so the chunks change less between runs. Use "
+      "TYPE:POLICY (e.g. \"filelists:hash\") to set it just for primary, "
+      "filelists or other, more values are separated by commas.",
+      "[TYPE:]POLICY" },
+#endif
+#ifdef WITH_ZSTD
+    { "zstd-level", 0, 0, G_OPTION_ARG_INT, OPT(zstd_level),
+      "Compression level used for zstd compressed files (1-19). "
+      "Defaults to 9.", "LEVEL" },
+    { "zstd-long", 0, 0, G_OPTION_ARG_NONE, OPT(zstd_long),
+      "Use zstd long distance matching with a 128 MiB window for better "
+      "compression of big metadata. The window stays within the default "
+      "decompression limit of zstd.", NULL },
 #endif
-    { "keep-all-metadata", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.keep_all_metadata),
+    { "keep-all-metadata", 0, 0, G_OPTION_ARG_NONE, OPT(keep_all_metadata),
       "Keep all additional metadata (not primary, filelists and other xml or sqlite files, "
       "nor their compressed variants) from source repository during update.", NULL },
-    { "compatibility", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.compatibility),
+    { "strict-keep-all-metadata", 0, 0, G_OPTION_ARG_NONE, OPT(strict_keep_all_metadata),
+      "Always compute the checksums of the metadata kept by --keep-all-metadata. "
+      "By default, the checksums from the old repomd.xml are reused for the files "
+      "whose size and modification time match their old repomd.xml record.", NULL },
+    { "compatibility", 0, 0, G_OPTION_ARG_NONE, OPT(compatibility),
       "Enforce maximal compatibility with classical createrepo (Affects only: --retain-old-md).", NULL },
-    { "retain-old-md-by-age", 0, 0, G_OPTION_ARG_STRING, &(_cmd_options.retain_old_md_by_age),
+    { "retain-old-md-by-age", 0, 0, G_OPTION_ARG_STRING, OPT(retain_old_md_by_age),
       "During --update, remove all files in repodata/ which are older "
       "then the specified period of time. (e.g. '2h', '30d', ...). "
       "Available units (m - minutes, h - hours, d - days)", "AGE" },
-    { "cachedir", 'c', 0, G_OPTION_ARG_FILENAME, &(_cmd_options.cachedir),
+    { "cachedir", 'c', 0, G_OPTION_ARG_FILENAME, OPT(cachedir),
       "Set path to cache dir", "CACHEDIR." },
+    { "checksum-cache", 0, 0, G_OPTION_ARG_FILENAME, OPT(checksum_cache),
+      "Single file cache of package checksums. An alternative to --cachedir "
+      "which doesn't create a file per package. The file is created if it "
+      "doesn't exist.", "FILE" },
+    { "compact-checksum-cache", 0, 0, G_OPTION_ARG_NONE, OPT(compact_checksum_cache),
+      "Remove obsolete records from the --checksum-cache file at the end "
+      "of the run.", NULL },
+    { "pkg-cache", 0, 0, G_OPTION_ARG_FILENAME, OPT(pkg_cache),
+      "Cache file with generated metadata of packages. Packages whose rpm "
+      "file didn't change (device, inode, size and mtime) since the previous "
+      "run are not read again. The file is created if it doesn't exist.",
+      "FILE" },
+    { "shared-pkg-cache", 0, 0, G_OPTION_ARG_NONE, OPT(shared_pkg_cache),
+      "The --pkg-cache file is shared by more repos (and concurrent runs) "
+      "with the same rpm files. Cached packages of the other repos are kept "
+      "in it.", NULL },
+    { "pkg-index", 0, 0, G_OPTION_ARG_NONE, OPT(pkg_index),
+      "Generate also a binary index of the packages (\"pkgindex\" record) "
+      "for lookups without parsing of the xml metadata.", NULL },
+    { "block-index", 0, 0, G_OPTION_ARG_NONE, OPT(block_index),
+      "Compress primary, filelists and other xml in independent blocks of "
+      "packages and generate an index of them (\"blockindex\" record) for "
+      "parallel parsing and seeking. Only for gz, zstd and no compression.",
+      NULL },
+    { "primary-only", 0, 0, G_OPTION_ARG_NONE, OPT(primary_only),
+      "Generate only primary metadata (no filelists and other). Changelogs "
+      "and files which don't belong to primary are not read from the "
+      "packages.", NULL },
+    { "shard", 0, 0, G_OPTION_ARG_STRING, OPT(shard),
+      "Generate only the K-th of N shards of the repo (e.g. 2/8), with "
+      "the packages selected by a hash of their relative path. The shards "
+      "generated on more hosts are joined by mergerepo_c --shards.",
+      "K/N" },
+    { "remote-manifest", 0, 0, G_OPTION_ARG_FILENAME, OPT(remote_manifest),
+      "Add the packages of a remote storage listed in this manifest. Only "
+      "their headers are read by HTTP range requests, the checksums, sizes "
+      "and mtimes are taken from the manifest (tab separated location, "
+      "size, mtime, checksum type, checksum and an optional url).", "FILE" },
+    { "remote-baseurl", 0, 0, G_OPTION_ARG_STRING, OPT(remote_baseurl),
+      "Url of the --remote-manifest packages without their own url, "
+      "their locations are relative to it.", "URL" },
+    { "remote-transfers", 0, 0, G_OPTION_ARG_INT, OPT(remote_transfers),
+      "Max number of the range requests of --remote-manifest in flight. "
+      "Defaults to 64.", "N" },
+    { "metrics-file", 0, 0, G_OPTION_ARG_FILENAME, OPT(metrics_file),
+      "Write times, throughputs and histograms of durations of the phases "
+      "of the run (per phase and per thread) and the memory usage "
+      "into this file as JSON.",
+      "FILE" },
+    { "trace-file", 0, 0, G_OPTION_ARG_FILENAME, OPT(trace_file),
+      "Write every phase of every package (header reading, checksum, "
+      "XML dump, waiting for the buffer and writes) into this file "
+      "in the Chrome trace event format.", "FILE" },
 #ifdef CR_DELTA_RPM_SUPPORT
-    { "deltas", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.deltas),
+    { "deltas", 0, 0, G_OPTION_ARG_NONE, OPT(deltas),
       "Tells createrepo to generate deltarpms and the delta metadata.", NULL },
-    { "oldpackagedirs", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &(_cmd_options.oldpackagedirs),
+    { "oldpackagedirs", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, OPT(oldpackagedirs),
       "Paths to look for older pkgs to delta against. Can be specified "
       "multiple times.", "PATH" },
-    { "num-deltas", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.num_deltas),
+    { "num-deltas", 0, 0, G_OPTION_ARG_INT, OPT(num_deltas),
       "The number of older versions to make deltas against. Defaults to 1.", "INT" },
-    { "max-delta-rpm-size", 0, 0, G_OPTION_ARG_INT64, &(_cmd_options.max_delta_rpm_size),
+    { "max-delta-rpm-size", 0, 0, G_OPTION_ARG_INT64, OPT(max_delta_rpm_size),
       "Max size of an rpm that to run deltarpm against (in bytes).", "MAX_DELTA_RPM_SIZE" },
+    { "delta-memory-mb", 0, 0, G_OPTION_ARG_INT, OPT(delta_memory_mb),
+      "Memory the deltas made at once may use (in MiB). The memory of every "
+      "delta is estimated from the size of the package. By default, only "
+      "the sum of the installed sizes of the packages is limited by "
+      "--max-delta-rpm-size.", "MB" },
+    { "delta-processes", 0, 0, G_OPTION_ARG_NONE, OPT(delta_processes),
+      "Make every delta in a separate process. With --delta-memory-mb, "
+      "a process is limited to the budget and its memory usage refines "
+      "the estimates.", NULL },
 #endif
-    { "local-sqlite", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.local_sqlite),
+    { "local-sqlite", 0, 0, G_OPTION_ARG_NONE, OPT(local_sqlite),
       "Gen sqlite DBs locally (into a directory for temporary files). "
       "Sometimes, sqlite has a trouble to gen DBs on a NFS mount, "
       "use this option in such cases. "
       "This option could lead to a higher memory consumption "
       "if TMPDIR is set to /tmp or not set at all, because then the /tmp is "
       "used and /tmp dir is often a ramdisk.", NULL },
-    { "cut-dirs", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.cut_dirs),
+    { "reuse-sqlite", 0, 0, G_OPTION_ARG_NONE, OPT(reuse_sqlite),
+      "During --update start from the sqlite DBs of the old repodata, "
+      "only removed and changed packages are deleted from them and only "
+      "new packages are inserted.", NULL },
+    { "update-from-sqlite", 0, 0, G_OPTION_ARG_NONE, OPT(update_from_sqlite),
+      "During --update read the old packages from the sqlite DBs of the old "
+      "repodata on demand instead of loading the old XML files. The XML is "
+      "loaded if the old repodata have no usable sqlite DBs.", NULL },
+    { "sqlite-in-memory", 0, 0, G_OPTION_ARG_NONE, OPT(sqlite_in_memory),
+      "Gen sqlite DBs in memory and write them straight into the compressed "
+      "files, the uncompressed DBs never exist on the disk. "
+      "All the DBs have to fit into the memory.", NULL },
+    { "cut-dirs", 0, 0, G_OPTION_ARG_INT, OPT(cut_dirs),
       "Ignore NUM of directory components in location_href during repodata "
       "generation", "NUM" },
-    { "location-prefix", 0, 0, G_OPTION_ARG_FILENAME, &(_cmd_options.location_prefix),
+    { "location-prefix", 0, 0, G_OPTION_ARG_FILENAME, OPT(location_prefix),
       "Append this prefix before location_href in output repodata", "PREFIX" },
-    { "repomd-checksum", 0, 0, G_OPTION_ARG_STRING, &(_cmd_options.repomd_checksum),
+    { "repomd-checksum", 0, 0, G_OPTION_ARG_STRING, OPT(repomd_checksum),
       "Checksum type to be used in repomd.xml", "CHECKSUM_TYPE"},
-    { "error-exit-val", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.error_exit_val),
+    { "checksum-io", 0, 0, G_OPTION_ARG_STRING, OPT(checksum_io),
+      "How to read packages during checksum calculation: \"read\" "
+      "(big sequential reads, default), \"mmap\" or \"direct\" (O_DIRECT, "
+      "bypasses the page cache).", "MODE"},
+    { "error-exit-val", 0, 0, G_OPTION_ARG_NONE, OPT(error_exit_val),
       "Exit with retval 2 if there were any errors during processing", NULL },
-    { "recycle-pkglist", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.recycle_pkglist),
+    { "recycle-pkglist", 0, 0, G_OPTION_ARG_NONE, OPT(recycle_pkglist),
       "Read the list of packages from old metadata directory and re-use it.  This "
       "option is only useful with --update (complements --pkglist and friends).",
       NULL },
+    { "changed-pkgs", 0, 0, G_OPTION_ARG_FILENAME, OPT(changed_pkgs),
+      "File with a list of packages (paths relative to the directory, one "
+      "per line) added or changed since the previous run. Implies --update, "
+      "--recycle-pkglist and --skip-stat: the metadata of all the other "
+      "packages are reused from the old metadata without a directory walk, "
+      "only the listed packages are read.", "FILE" },
+    { "removed-pkgs", 0, 0, G_OPTION_ARG_FILENAME, OPT(removed_pkgs),
+      "File with a list of packages (paths relative to the directory, one "
+      "per line) removed since the previous run. Implies the same options "
+      "as --changed-pkgs.", "FILE" },
+    { "watch", 0, 0, G_OPTION_ARG_NONE, OPT(watch),
+      "Don't exit after the repodata are generated, watch the directories "
+      "and regenerate the repodata when packages are added, changed or "
+      "removed. Only the changed packages are read (as with --changed-pkgs "
+      "and --removed-pkgs), a change of a directory makes a full --update.",
+      NULL },
+    { "watch-delay", 0, 0, G_OPTION_ARG_INT, OPT(watch_delay),
+      "Seconds without changes of the packages to wait before the repodata "
+      "are regenerated in --watch mode (default 2).", "SECONDS" },
+    { "repos-file", 0, 0, G_OPTION_ARG_FILENAME, OPT(repos_file),
+      "Generate all the repos of this file in one process, one repo per line "
+      "(the options and the directory of the repo, added to the options of "
+      "the command line). Up to --workers repos are generated at once, "
+      "their packages are read by one pool of --workers threads.", "FILE" },
     { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
 };
 
 
-static GOptionEntry expert_entries[] =
+static const GOptionEntry expert_entries[] =
 {
-    { "ignore-lock", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.ignore_lock),
+    { "ignore-lock", 0, 0, G_OPTION_ARG_NONE, OPT(ignore_lock),
       "Expert (risky) option: Ignore an existing .repodata/. "
       "(Remove the existing .repodata/ and create an empty new one "
       "to serve as a lock for other createrepo instances. For the repodata "
@@ -228,34 +425,66 @@ static GOptionEntry expert_entries[] =
 };
 
 
-struct CmdOptions *parse_arguments(int *argc, char ***argv, GError **err)
+/** Copy of the entries (terminated by the NULL entry) which store
+ * the values in the options.
+ */
+static GOptionEntry *
+option_entries_new(const GOptionEntry *entries, struct CmdOptions *options)
 {
+    gsize len = 0;
+    GOptionEntry *copy;
+
+    while (entries[len].long_name)
+        len++;
+
+    copy = g_new(GOptionEntry, len + 1);
+    memcpy(copy, entries, (len + 1) * sizeof(GOptionEntry));
+    for (gsize x = 0; x < len; x++)
+        copy[x].arg_data = (char *) options
+                           + GPOINTER_TO_SIZE(entries[x].arg_data);
+    return copy;
+}
+
+struct CmdOptions *
+cr_cmd_parse_arguments(int *argc, char ***argv, GError **err)
+{
+    struct CmdOptions *options;
     gboolean ret;
     GOptionContext *context;
     GOptionGroup *group_expert;
+    GOptionEntry *entries;
 
     assert(!err || *err == NULL);
 
+    options = g_malloc(sizeof(*options));
+    *options = default_options;
+
     context = g_option_context_new("<directory_to_index>");
     g_option_context_set_summary(context, "Program that creates a repomd "
             "(xml-based rpm metadata) repository from a set of rpms.");
-    g_option_context_add_main_entries(context, cmd_entries, NULL);
+    entries = option_entries_new(cmd_entries, options);
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_free(entries);
 
     group_expert = g_option_group_new("expert",
                                       "Expert (risky) options",
                                       "Expert (risky) options",
                                       NULL,
                                       NULL);
-    g_option_group_add_entries(group_expert, expert_entries);
+    entries = option_entries_new(expert_entries, options);
+    g_option_group_add_entries(group_expert, entries);
+    g_free(entries);
     g_option_context_add_group(context, group_expert);
 
     ret = g_option_context_parse(context, argc, argv, err);
     g_option_context_free(context);
 
-    if (!ret)
+    if (!ret) {
+        cr_cmd_free_options(options);
         return NULL;
+    }
 
-    return &(_cmd_options);
+    return options;
 }
 
 /** Convert string to compression type set an error if failed.
@@ -279,6 +508,9 @@ check_and_set_compression_type(const char *type_str,
         *type = CR_CW_BZ2_COMPRESSION;
     } else if (!strcmp(compress_str->str, "xz")) {
         *type = CR_CW_XZ_COMPRESSION;
+    } else if (!strcmp(compress_str->str, "zstd") ||
+               !strcmp(compress_str->str, "zst")) {
+        *type = CR_CW_ZSTD_COMPRESSION;
     } else {
         g_set_error(err, ERR_DOMAIN, CRE_BADARG,
                     "Unknown/Unsupported compression type \"%s\"", type_str);
@@ -340,14 +572,152 @@ parse_period_of_time(const gchar *timeperiod, gint64 *time, GError **err)
     return TRUE;
 }
 
+/** Set the zchunk chunking policies from a comma separated list
+ * of [TYPE:]POLICY values.
+ */
+static gboolean
+parse_zck_chunking(struct CmdOptions *options,
+                   const char *value,
+                   GError **err)
+{
+    gboolean ret = TRUE;
+    gchar **items = g_strsplit(value, ",", -1);
+
+    for (gchar **item = items; *item && ret; item++) {
+        gchar *type = NULL;
+        gchar *policy = strchr(*item, ':');
+        if (policy) {
+            type = *item;
+            *policy++ = '\0';
+        } else {
+            policy = *item;
+        }
+
+        cr_ZckChunking chunking = cr_zck_chunking(policy);
+        if (chunking == CR_ZCK_CHUNKING_UNKNOWN) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Unknown zchunk chunking policy \"%s\"", policy);
+            ret = FALSE;
+        } else if (!type) {
+            options->pri_zck_chunking = chunking;
+            options->fil_zck_chunking = chunking;
+            options->oth_zck_chunking = chunking;
+        } else if (!g_strcmp0(type, "primary")) {
+            options->pri_zck_chunking = chunking;
+        } else if (!g_strcmp0(type, "filelists")) {
+            options->fil_zck_chunking = chunking;
+        } else if (!g_strcmp0(type, "other")) {
+            options->oth_zck_chunking = chunking;
+        } else {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Unknown metadata type \"%s\" for --zck-chunking "
+                        "(use primary, filelists or other)", type);
+            ret = FALSE;
+        }
+    }
+
+    g_strfreev(items);
+    return ret;
+}
+
+static gboolean
+parse_compress_level(const char *value,
+                     cr_CompressionSettings *compression,
+                     GError **err)
+{
+    gboolean ret = TRUE;
+    gchar **items = g_strsplit(value, ",", -1);
+
+    for (gchar **item = items; *item && ret; item++) {
+        gchar *level_str = strchr(*item, ':');
+        gchar *endptr = NULL;
+        gint64 level = 0;
+        cr_CompressionType type;
+
+        if (!level_str) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Bad --compress-level value \"%s\" (use TYPE:LEVEL, "
+                        "e.g. \"xz:9\")", *item);
+            ret = FALSE;
+            break;
+        }
+
+        *level_str++ = '\0';
+        level = g_ascii_strtoll(level_str, &endptr, 10);
+        if (!*level_str || *endptr) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Bad compression level \"%s\" for %s", level_str,
+                        *item);
+            ret = FALSE;
+            break;
+        }
+
+        type = cr_compression_type(*item);
+        if (type == CR_CW_UNKNOWN_COMPRESSION) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Unknown compression type \"%s\" for "
+                        "--compress-level", *item);
+            ret = FALSE;
+        } else if (level < G_MININT || level > G_MAXINT) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Compression level %s is out of range", level_str);
+            ret = FALSE;
+        } else {
+            ret = cr_compression_settings_set_level(compression, type,
+                                                    (int) level, err);
+        }
+    }
+
+    g_strfreev(items);
+    return ret;
+}
+
+/** Read a list of packages (one per line) from the file.
+ * @param path          Path to the file
+ * @param option        Name of the option (for error messages)
+ * @param list          List to prepend the packages to
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+static gboolean
+read_pkg_list_file(const char *path,
+                   const char *option,
+                   GSList **list,
+                   GError **err)
+{
+    char *content = NULL;
+    char **pkgs;
+    GError *tmp_err = NULL;
+
+    if (!g_file_get_contents(path, &content, NULL, &tmp_err)) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot read %s file \"%s\": %s",
+                    option, path, tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
+    }
+
+    pkgs = g_strsplit(content, "\n", 0);
+    for (int x = 0; pkgs[x]; x++)
+        if (pkgs[x][0])
+            *list = g_slist_prepend(*list, g_strdup(pkgs[x]));
+
+    g_strfreev(pkgs);
+    g_free(content);
+    return TRUE;
+}
+
 gboolean
-check_arguments(struct CmdOptions *options,
-                const char *input_dir,
-                GError **err)
+cr_cmd_check_arguments(struct CmdOptions *options,
+                       const char *input_dir,
+                       cr_CompressionSettings *compression,
+                       GError **err)
 {
+    assert(compression);
     assert(!err || *err == NULL);
 
     // Check outputdir
+
     if (options->outputdir && !g_file_test(options->outputdir, G_FILE_TEST_EXISTS|G_FILE_TEST_IS_DIR)) {
         g_set_error(err, ERR_DOMAIN, CRE_BADARG,
                     "Specified outputdir \"%s\" doesn't exists",
@@ -361,6 +731,37 @@ check_arguments(struct CmdOptions *options,
         options->workers = DEFAULT_WORKERS;
     }
 
+    // Check max_workers
+    if (options->max_workers
+        && (options->max_workers < options->workers
+            || options->max_workers > 1000)) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--max-workers must be between --workers (%d) and 1000",
+                    options->workers);
+        return FALSE;
+    }
+
+    // Check reorder_buffer_mb
+    if (options->reorder_buffer_mb < 1) {
+        g_warning("Wrong reorder buffer size \"%d\" - Using %d MiB",
+                  options->reorder_buffer_mb, DEFAULT_REORDER_BUFFER_MB);
+        options->reorder_buffer_mb = DEFAULT_REORDER_BUFFER_MB;
+    }
+
+    // Check remote_transfers
+    if (options->remote_transfers < 1) {
+        g_warning("Wrong number of remote transfers \"%d\" - Using %d",
+                  options->remote_transfers, CR_REMOTEPKG_DEFAULT_TRANSFERS);
+        options->remote_transfers = CR_REMOTEPKG_DEFAULT_TRANSFERS;
+    }
+
+    // Check prefetch
+    if (options->prefetch < 0) {
+        g_warning("Wrong number of prefetched packages \"%d\" - "
+                  "Prefetch disabled", options->prefetch);
+        options->prefetch = 0;
+    }
+
     // Check changelog_limit
     if ((options->changelog_limit < -1)) {
         g_warning("Wrong changelog limit \"%d\" - Using 10", options->changelog_limit);
@@ -372,6 +773,22 @@ check_arguments(struct CmdOptions *options,
         options->unique_md_filenames = FALSE;
     }
 
+    // Check shared store
+    if (options->shared_store) {
+        if (!options->unique_md_filenames) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "--shared-store cannot be used with "
+                        "--simple-md-filenames");
+            return FALSE;
+        }
+        if (!g_file_test(options->shared_store, G_FILE_TEST_IS_DIR)) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Specified shared store \"%s\" is not a directory",
+                        options->shared_store);
+            return FALSE;
+        }
+    }
+
     // Check and set checksum type
     if (options->checksum) {
         cr_ChecksumType type;
@@ -400,6 +817,60 @@ check_arguments(struct CmdOptions *options,
         options->repomd_checksum_type = options->checksum_type;
     }
 
+    // Check and set checksum io mode
+    if (options->checksum_io) {
+        cr_ChecksumIoMode mode = cr_checksum_io_mode(options->checksum_io);
+        if (mode == CR_CHECKSUM_IO_UNKNOWN) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Unknown checksum io mode \"%s\"",
+                        options->checksum_io);
+            return FALSE;
+        }
+        options->checksum_io_mode = mode;
+    }
+
+    // Check and set CPU sets
+    if (options->worker_cpus) {
+        GError *tmp_err = NULL;
+        options->worker_cpuset = cr_cpuset_from_str(options->worker_cpus,
+                                                    &tmp_err);
+        if (!options->worker_cpuset) {
+            g_propagate_prefixed_error(err, tmp_err, "--worker-cpus: ");
+            return FALSE;
+        }
+    }
+
+    if (options->writer_cpus) {
+        GError *tmp_err = NULL;
+        options->writer_cpuset = cr_cpuset_from_str(options->writer_cpus,
+                                                    &tmp_err);
+        if (!options->writer_cpuset) {
+            g_propagate_prefixed_error(err, tmp_err, "--writer-cpus: ");
+            return FALSE;
+        }
+    }
+
+    // --remote-baseurl makes sense only with --remote-manifest
+    if (options->remote_baseurl && !options->remote_manifest) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--remote-baseurl requires --remote-manifest");
+        return FALSE;
+    }
+
+    // The media of the split mode are local directories
+    if (options->remote_manifest && options->split) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--remote-manifest cannot be used with --split");
+        return FALSE;
+    }
+
+    // --compact-checksum-cache makes sense only with --checksum-cache
+    if (options->compact_checksum_cache && !options->checksum_cache) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--compact-checksum-cache requires --checksum-cache");
+        return FALSE;
+    }
+
     // Check and set compression type
     if (options->compress_type) {
         if (!check_and_set_compression_type(options->compress_type,
@@ -413,6 +884,15 @@ check_arguments(struct CmdOptions *options,
         options->compression_type = CR_CW_XZ_COMPRESSION;
     }
 
+    if (options->compress_threads < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--compress-threads value must be positive integer");
+        return FALSE;
+    }
+    if (!cr_compression_settings_set_threads(compression,
+                                             options->compress_threads, err))
+        return FALSE;
+
     // Check and set general compression type
     if (options->general_compress_type) {
         if (!check_and_set_compression_type(options->general_compress_type,
@@ -422,14 +902,27 @@ check_arguments(struct CmdOptions *options,
         }
     }
 
+    // The xml files are gz compressed by default
+    if (options->block_index
+        && options->general_compression_type != CR_CW_UNKNOWN_COMPRESSION
+        && options->general_compression_type != CR_CW_GZ_COMPRESSION
+        && options->general_compression_type != CR_CW_ZSTD_COMPRESSION
+        && options->general_compression_type != CR_CW_NO_COMPRESSION)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--block-index supports only gz, zstd and no compression "
+                    "of the xml metadata");
+        return FALSE;
+    }
+
     int x;
 
     // Process exclude glob masks
     x = 0;
     while (options->excludes && options->excludes[x] != NULL) {
-        GPatternSpec *pattern = g_pattern_spec_new(options->excludes[x]);
-        options->exclude_masks = g_slist_prepend(options->exclude_masks,
-                                                 (gpointer) pattern);
+        if (!options->exclude_masks)
+            options->exclude_masks = cr_globset_new();
+        cr_globset_add(options->exclude_masks, options->excludes[x]);
         x++;
     }
 
@@ -498,6 +991,37 @@ check_arguments(struct CmdOptions *options,
         }
     }
 
+    // Process changed_pkgs and removed_pkgs files, the lists could be
+    // filled by the caller already (the --watch mode)
+    if (options->changed_pkgs || options->removed_pkgs
+        || options->changed_pkgs_list || options->removed_pkgs_list) {
+        GSList *removed = options->removed_pkgs_list;
+
+        if (options->changed_pkgs
+            && !read_pkg_list_file(options->changed_pkgs, "--changed-pkgs",
+                                   &(options->changed_pkgs_list), err))
+            return FALSE;
+        if (options->removed_pkgs
+            && !read_pkg_list_file(options->removed_pkgs, "--removed-pkgs",
+                                   &removed, err))
+            return FALSE;
+
+        // The strings are owned by the lists
+        options->changed_pkgs_set = g_hash_table_new(g_str_hash, g_str_equal);
+        for (GSList *elem = options->changed_pkgs_list; elem; elem = g_slist_next(elem))
+            g_hash_table_add(options->changed_pkgs_set,
+                             cr_get_cleaned_href(elem->data));
+        for (GSList *elem = removed; elem; elem = g_slist_next(elem))
+            g_hash_table_add(options->changed_pkgs_set,
+                             cr_get_cleaned_href(elem->data));
+        options->removed_pkgs_list = removed;
+
+        // Everything else comes from the old metadata
+        options->update = TRUE;
+        options->recycle_pkglist = TRUE;
+        options->skip_stat = TRUE;
+    }
+
     // Process update_md_paths
     if (options->update_md_paths && !options->update)
         g_warning("Usage of --update-md-path without --update has no effect!");
@@ -515,6 +1039,10 @@ check_arguments(struct CmdOptions *options,
         g_warning("--keep-all-metadata has no effect (--update is not used)");
     }
 
+    if (options->strict_keep_all_metadata && !options->keep_all_metadata) {
+        g_warning("--strict-keep-all-metadata has no effect (--keep-all-metadata is not used)");
+    }
+
     // Process --distro tags
     x = 0;
     while (options->distro_tags && options->distro_tags[x]) {
@@ -587,6 +1115,13 @@ check_arguments(struct CmdOptions *options,
         x++;
     }
 
+    // Check delta_memory_mb
+    if (options->delta_memory_mb < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--delta-memory-mb value must be positive integer");
+        return FALSE;
+    }
+
     // Check cut_dirs
     if (options->cut_dirs < 0) {
         g_set_error(err, ERR_DOMAIN, CRE_BADARG,
@@ -594,14 +1129,121 @@ check_arguments(struct CmdOptions *options,
         return FALSE;
     }
 
+    // Reused sqlite DBs
+    if (options->reuse_sqlite && !options->update) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --reuse-sqlite without setting --update");
+        return FALSE;
+    }
+    if (options->update_from_sqlite && !options->update) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --update-from-sqlite without setting --update");
+        return FALSE;
+    }
+    if (options->update_from_sqlite && options->recycle_pkglist) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --update-from-sqlite together with "
+                    "--recycle-pkglist, --changed-pkgs or --removed-pkgs");
+        return FALSE;
+    }
+    if (options->reuse_sqlite && options->no_database) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --reuse-sqlite together with --no-database");
+        return FALSE;
+    }
+
+    if (options->shared_pkg_cache && !options->pkg_cache) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--shared-pkg-cache can be used only with --pkg-cache");
+        return FALSE;
+    }
+
+    if (options->primary_only && options->pkg_cache) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --primary-only together with --pkg-cache");
+        return FALSE;
+    }
+
+    if (options->shard) {
+        gchar *end;
+        guint64 index = g_ascii_strtoull(options->shard, &end, 10);
+        guint64 count = 0;
+        if (end != options->shard && *end == '/') {
+            gchar *count_str = end + 1;
+            count = g_ascii_strtoull(count_str, &end, 10);
+            if (end == count_str || *end != '\0')
+                count = 0;
+        }
+        if (count < 1 || count > G_MAXUINT || index < 1 || index > count) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Bad --shard \"%s\" (expected K/N, 1 <= K <= N)",
+                        options->shard);
+            return FALSE;
+        }
+        options->shard_index = (guint) index - 1;
+        options->shard_count = (guint) count;
+    }
+
+    if (options->sqlite_in_memory && options->local_sqlite) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --sqlite-in-memory together with --local-sqlite");
+        return FALSE;
+    }
+    if (options->sqlite_in_memory && options->reuse_sqlite) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --sqlite-in-memory together with --reuse-sqlite");
+        return FALSE;
+    }
+
     // Zchunk options
     if (options->zck_dict_dir && !options->zck_compression) {
         g_set_error(err, ERR_DOMAIN, CRE_BADARG,
                     "Cannot use --zck-dict-dir without setting --zck");
         return FALSE;
     }
+    if (options->zck_auto_dict && !options->zck_dict_dir) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Cannot use --zck-auto-dict without setting --zck-dict-dir");
+        return FALSE;
+    }
     if (options->zck_dict_dir)
         options->zck_dict_dir = cr_normalize_dir_path(options->zck_dict_dir);
+    if (options->zck_chunking) {
+        if (!options->zck_compression) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Cannot use --zck-chunking without setting --zck");
+            return FALSE;
+        }
+        if (!parse_zck_chunking(options, options->zck_chunking, err))
+            return FALSE;
+    }
+
+    // Zstd options
+    if (options->zstd_level || options->zstd_long) {
+        int window_log = options->zstd_long ? DEFAULT_ZSTD_LONG_WINDOW_LOG : 0;
+        if (!cr_compression_settings_set_zstd_params(compression,
+                                                     options->zstd_level,
+                                                     window_log, err))
+            return FALSE;
+    }
+
+    if (options->watch_delay < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Bad --watch-delay value %d", options->watch_delay);
+        return FALSE;
+    }
+#ifndef __linux__
+    if (options->watch) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "--watch is supported only on Linux");
+        return FALSE;
+    }
+#endif
+
+    // Compression levels (after --zstd-level, "zstd:LEVEL" overrides it)
+    if (options->compress_level
+        && !parse_compress_level(options->compress_level, compression, err))
+        return FALSE;
 
     return TRUE;
 }
@@ -609,20 +1251,43 @@ check_arguments(struct CmdOptions *options,
 
 
 void
-free_options(struct CmdOptions *options)
+cr_cmd_free_options(struct CmdOptions *options)
 {
     g_free(options->basedir);
     g_free(options->location_base);
     g_free(options->outputdir);
+    g_free(options->shared_store);
     g_free(options->pkglist);
     g_free(options->checksum);
+    g_free(options->checksum_io);
+    g_free(options->zck_chunking);
+    g_free(options->checksum_cache);
     g_free(options->compress_type);
+    g_free(options->compress_level);
     g_free(options->groupfile);
     g_free(options->groupfile_fullpath);
     g_free(options->revision);
     g_free(options->retain_old_md_by_age);
     g_free(options->cachedir);
+    g_free(options->pkg_cache);
+    g_free(options->remote_manifest);
+    g_free(options->remote_baseurl);
+    g_free(options->shard);
+    g_free(options->changed_pkgs);
+    g_free(options->removed_pkgs);
+    g_free(options->repos_file);
+    if (options->changed_pkgs_set)
+        g_hash_table_destroy(options->changed_pkgs_set);
+    cr_slist_free_full(options->changed_pkgs_list, g_free);
+    cr_slist_free_full(options->removed_pkgs_list, g_free);
+    g_free(options->metrics_file);
+    g_free(options->trace_file);
+    g_free(options->progress_file);
     g_free(options->checksum_cachedir);
+    g_free(options->worker_cpus);
+    g_free(options->writer_cpus);
+    cr_cpuset_free(options->worker_cpuset);
+    cr_cpuset_free(options->writer_cpuset);
 
     g_strfreev(options->excludes);
     g_strfreev(options->includepkg);
@@ -632,11 +1297,12 @@ free_options(struct CmdOptions *options)
     g_strfreev(options->oldpackagedirs);
 
     cr_slist_free_full(options->include_pkgs, g_free);
-    cr_slist_free_full(options->exclude_masks,
-                      (GDestroyNotify) g_pattern_spec_free);
+    cr_globset_free(options->exclude_masks);
     cr_slist_free_full(options->l_update_md_paths, g_free);
     cr_slist_free_full(options->distro_cpeids, g_free);
     cr_slist_free_full(options->distro_values, g_free);
     cr_slist_free_full(options->modulemd_metadata, g_free);
     g_slist_free(options->oldpackagedirs_paths);
+    g_free(options);
 }
+
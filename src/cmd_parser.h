@@ -23,8 +23,13 @@
 #include <glib.h>
 #include "checksum.h"
 #include "compression_wrapper.h"
+#include "dumper_thread.h"
+#include "globset.h"
+#include "threads.h"
 
 #define DEFAULT_CHANGELOG_LIMIT         10
+#define DEFAULT_REORDER_BUFFER_MB       256
+#define DEFAULT_ZSTD_LONG_WINDOW_LOG    27
 
 
 /**
@@ -56,6 +61,7 @@ struct CmdOptions {
     char *compress_type;        /*!< which compression type to use */
     char *general_compress_type;/*!< which compression type to use (even for
                                      primary, filelists and other xml) */
+    char *compress_level;       /*!< compression levels of the types */
     gboolean skip_symlinks;     /*!< ignore symlinks of packages */
     gint changelog_limit;       /*!< number of changelog messages in
                                      other.(xml|sqlite) */
@@ -63,6 +69,8 @@ struct CmdOptions {
                                              the filenames */
     gboolean simple_md_filenames;       /*!< simple filenames (names without
                                              checksums) */
+    char *shared_store;         /*!< directory with metadata files shared
+                                     by many repositories */
     gint retain_old;            /*!< keep latest N copies of the old repodata */
     char **distro_tags;         /*!< distro tag and optional cpeid */
     char **content_tags;        /*!< tags for the content in the repository */
@@ -70,13 +78,37 @@ struct CmdOptions {
     char *revision;             /*!< user-specified revision */
     gboolean set_timestamp_to_revision; /*!< use --revision instead of current
                                              time for timestamps */
+    gboolean set_contenthash;   /*!< store a hash of the packages as
+                                     the contenthash of repomd.xml */
     char *read_pkgs_list;       /*!< output the paths to pkgs actually read */
     gint workers;               /*!< number of threads to spawn */
+    gint max_workers;           /*!< max number of adaptive workers
+                                     (0 - the number is fixed) */
+    gboolean progress;          /*!< print the progress to stderr */
+    char *progress_file;        /*!< status file with the progress */
+    gint reorder_buffer_mb;     /*!< max size (MiB) of generated metadata
+                                     of packages waiting to be written */
+    gint prefetch;              /*!< number of packages prefetched ahead
+                                     of the workers (0 - disabled) */
+    gboolean large_first;       /*!< process the large packages first */
+    gboolean stream_walk;       /*!< order the packages by directories and
+                                     process them during the walk */
+    char *worker_cpus;          /*!< CPUs for the workers reading packages */
+    char *writer_cpus;          /*!< CPUs for the writer and compression
+                                     threads */
+    gint compress_threads;      /*!< threads compressing one gz/xz file */
     gboolean xz_compression;    /*!< use xz for repodata compression */
     gboolean zck_compression;   /*!< generate zchunk files */
     char *zck_dict_dir;         /*!< directory with zchunk dictionaries */
+    gboolean zck_auto_dict;     /*!< train missing zchunk dictionaries */
+    char *zck_chunking;         /*!< zchunk chunking policies */
+    gint zstd_level;            /*!< zstd compression level (0 - default) */
+    gboolean zstd_long;         /*!< use zstd long distance matching */
     gboolean keep_all_metadata; /*!< keep groupfile and updateinfo from source
                                      repo during update */
+    gboolean strict_keep_all_metadata; /*!< always compute the checksums
+                                     of the kept metadata, do not reuse its
+                                     old repomd records */
     gboolean ignore_lock;       /*!< Ignore existing .repodata/ - remove it,
                                      create the new one (empty) to serve as
                                      a lock and use a .repodata.date.pid for
@@ -93,6 +125,25 @@ struct CmdOptions {
                                      Available units: (m - minutes, h - hours,
                                      d - days) */
     char *cachedir;             /*!< Cache dir for checksums */
+    char *checksum_io;          /*!< How to read packages for checksums */
+    char *checksum_cache;       /*!< Single file cache for checksums */
+    gboolean compact_checksum_cache; /*!< Remove obsolete records from
+                                          the checksum_cache */
+    char *pkg_cache;            /*!< Cache file with generated metadata
+                                     of packages */
+    gboolean shared_pkg_cache;  /*!< The pkg_cache is shared by more repos */
+    gboolean pkg_index;         /*!< Generate the binary pkgindex */
+    gboolean block_index;       /*!< Write the xml files in indexed
+                                     independent blocks */
+    gboolean primary_only;      /*!< Generate only the primary metadata */
+    char *shard;                /*!< Shard of the repo to generate (K/N) */
+    char *remote_manifest;      /*!< Manifest of the packages read by HTTP
+                                     range requests */
+    char *remote_baseurl;       /*!< Url of the packages of the manifest */
+    gint remote_transfers;      /*!< Max number of the range requests
+                                     in flight */
+    char *metrics_file;         /*!< JSON report of the phase timings */
+    char *trace_file;           /*!< Trace of the phases of every package */
 
     gboolean deltas;            /*!< Is delta generation enabled? */
     char **oldpackagedirs;      /*!< Paths to look for older pks
@@ -101,10 +152,20 @@ struct CmdOptions {
                                      deltas against */
     gint64 max_delta_rpm_size;  /*!< Max size of an rpm that to run
                                      deltarpm against */
+    gint delta_memory_mb;       /*!< Memory (MiB) of the deltas made at once,
+                                     0 to limit their max_delta_rpm_size */
+    gboolean delta_processes;   /*!< Make every delta in a forked process */
     gboolean local_sqlite;      /*!< Gen sqlite locally into a directory for
                                      temporary files.
                                      For situations when sqlite has a trouble
                                      to gen DBs on NFS mounts. */
+    gboolean reuse_sqlite;      /*!< Start from the sqlite DBs of the old
+                                     repodata during --update */
+    gboolean update_from_sqlite; /*!< Read the old packages from the sqlite
+                                     DBs of the old repodata during
+                                     --update */
+    gboolean sqlite_in_memory;  /*!< Gen sqlite DBs in memory and write
+                                     them compressed only */
     gint cut_dirs;              /*!< Ignore *num* of directory components
                                      during repodata generation in location
                                      href value. */
@@ -112,12 +173,22 @@ struct CmdOptions {
                                      during repodata generation. */
     gchar *repomd_checksum;     /*!< Checksum type for entries in repomd.xml */
     gboolean error_exit_val;        /*!< exit 2 on processing errors */
+    char *changed_pkgs;         /*!< File with a list of added or changed
+                                     packages since the previous run */
+    char *removed_pkgs;         /*!< File with a list of removed packages
+                                     since the previous run */
+    gboolean watch;             /*!< Keep running and regenerate the repodata
+                                     when the packages change */
+    gint watch_delay;           /*!< Seconds without changes before
+                                     the regeneration in --watch mode */
+    char *repos_file;           /*!< Manifest of the repos generated
+                                     at once by one process */
 
-    /* Items filled by check_arguments() */
+    /* Items filled by cr_cmd_check_arguments() */
 
     char *groupfile_fullpath;   /*!< full path to groupfile */
-    GSList *exclude_masks;      /*!< list of exclude masks
-                                     (list of GPatternSpec pointers) */
+    cr_GlobSet *exclude_masks;  /*!< compiled exclude masks
+                                     (NULL if there are none) */
     GSList *include_pkgs;       /*!< list of packages to include (build from
                                      includepkg options and pkglist file) */
     GSList *l_update_md_paths;  /*!< list of repo from update_md_paths
@@ -126,6 +197,7 @@ struct CmdOptions {
     GSList *distro_values;      /*!< values from --distro params */
     cr_ChecksumType checksum_type;          /*!< checksum type */
     cr_ChecksumType repomd_checksum_type;   /*!< checksum type */
+    cr_ChecksumIoMode checksum_io_mode;     /*!< io mode for pkg checksums */
     cr_CompressionType compression_type;    /*!< compression type */
     cr_CompressionType general_compression_type; /*!< compression type */
     gint64 md_max_age;          /*!< Max age of files in repodata/.
@@ -134,35 +206,55 @@ struct CmdOptions {
                                      Filled if --retain-old-md-by-age
                                      is used */
     char *checksum_cachedir;    /*!< Path to cachedir */
+    cr_CpuSet *worker_cpuset;   /*!< CPU set from --worker-cpus */
+    cr_CpuSet *writer_cpuset;   /*!< CPU set from --writer-cpus */
+    guint shard_index;          /*!< shard from --shard (0 .. count-1) */
+    guint shard_count;          /*!< number of shards, 0 without --shard */
+    cr_ZckChunking pri_zck_chunking; /*!< chunking of primary.xml.zck */
+    cr_ZckChunking fil_zck_chunking; /*!< chunking of filelists.xml.zck */
+    cr_ZckChunking oth_zck_chunking; /*!< chunking of other.xml.zck */
     GSList *oldpackagedirs_paths; /*!< paths to look for older pkgs to delta against */
     GSList *modulemd_metadata;  /*!< paths to all modulemd metadata */
+    GSList *changed_pkgs_list;  /*!< packages from the changed_pkgs file
+                                     (or set before the check by --watch) */
+    GSList *removed_pkgs_list;  /*!< packages from the removed_pkgs file
+                                     (or set before the check by --watch) */
+    GHashTable *changed_pkgs_set; /*!< cleaned hrefs of the packages from
+                                       the changed_pkgs and removed_pkgs
+                                       files (their old metadata are not
+                                       reused) */
 
     gboolean recycle_pkglist;
 };
 
+
 /**
- * Parses commandline arguments.
+ * Parses commandline arguments. Every call fills its own CmdOptions,
+ * more threads can parse at once.
  * @param argc          pointer to argc
  * @param argv          pointer to argv
- * @return              CmdOptions filled by command line arguments
+ * @return              New CmdOptions filled by command line arguments
  */
 struct CmdOptions *
-parse_arguments(int *argc, char ***argv, GError **err);
+cr_cmd_parse_arguments(int *argc, char ***argv, GError **err);
 
 /**
  * Performs some checks of arguments and fill some other items.
- * in the CmdOptions structure.
+ * in the CmdOptions structure. The compression options set the
+ * compression settings of the run.
  */
 gboolean
-check_arguments(struct CmdOptions *options,
-                const char *inputdir,
-                GError **err);
+cr_cmd_check_arguments(struct CmdOptions *options,
+                       const char *inputdir,
+                       cr_CompressionSettings *compression,
+                       GError **err);
 
 /**
- * Frees CmdOptions.
+ * Frees CmdOptions (and the structure itself).
+
  * @param options       pointer to struct with command line options
  */
 void
-free_options(struct CmdOptions *options);
+cr_cmd_free_options(struct CmdOptions *options);
 
 #endif /* __C_CREATEREPOLIB_CMD_PARSER_H__ */
@@ -30,11 +30,22 @@
 #include <zlib.h>
 #include <bzlib.h>
 #include <lzma.h>
+#include <curl/curl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #ifdef WITH_ZCHUNK
 #include <zck.h>
 #endif  // WITH_ZCHUNK
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#ifdef WITH_ZCHUNK
+#include <zdict.h>
+#endif  // WITH_ZCHUNK
+#endif  // WITH_ZSTD
 #include "error.h"
 #include "compression_wrapper.h"
+#include "pkgindex.h"
 
 
 #define ERR_DOMAIN                      CREATEREPO_C_ERROR
@@ -55,7 +66,12 @@
 #define Z_DEFAULT_STRATEGY    0
 */
 #define GZ_STRATEGY             Z_DEFAULT_STRATEGY
-#define GZ_BUFFER_SIZE          (1024*128)
+#define GZ_MT_BLOCK_SIZE        (1024*256)  // Input compressed by one thread
+#define GZ_MT_DICT_SIZE         (1024*32)   // Size of the deflate window
+#define GZ_MT_BLOCKS_PER_THREAD 2   // Blocks in flight = threads * this
+#define GZ_MT_HEADER_LEN        10  // Gzip header written by the mt writer
+#define WRITE_BUFFER_SIZE       (1024*256)  // Small writes are batched
+#define GZ_OS_CODE              3   // Unix, the same value as zlib writes
 
 #define BZ2_VERBOSITY           0
 #define BZ2_BLOCKSIZE100K       5  // Higher gives better compression but takes
@@ -84,7 +100,12 @@ LZMA_CHECK_SHA256
 /* UINT64_MAX effectively disable the limiter */
 #define XZ_MEMORY_USAGE_LIMIT   UINT64_MAX
 #define XZ_DECODER_FLAGS        0
-#define XZ_BUFFER_SIZE          (1024*32)
+
+/*
+Level 9 compresses repodata as well as bzip2, several times faster;
+decompression is faster than any other supported type
+*/
+#define CR_CW_ZSTD_COMPRESSION_LEVEL    9
 
 #if ZLIB_VERNUM < 0x1240
 // XXX: Zlib has gzbuffer since 1.2.4
@@ -104,6 +125,46 @@ cr_contentstat_new(cr_ChecksumType type, GError **err)
     return cstat;
 }
 
+cr_ContentStat *
+cr_contentstat_multi_new(const cr_ChecksumType *types,
+                         guint count,
+                         GError **err)
+{
+    cr_ContentStat *cstat;
+
+    assert(types || count == 0);
+    assert(!err || *err == NULL);
+
+    if (count == 0 || count > CR_CHECKSUM_MULTI_MAX) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Bad number of checksum types: %u", count);
+        return NULL;
+    }
+
+    cstat = g_malloc0(sizeof(cr_ContentStat));
+    cstat->checksum_type = types[0];
+    cstat->checksums_count = count;
+    for (guint x = 0; x < count; x++)
+        cstat->checksum_types[x] = types[x];
+
+    return cstat;
+}
+
+const char *
+cr_contentstat_checksum(cr_ContentStat *cstat, cr_ChecksumType type)
+{
+    assert(cstat);
+
+    for (guint x = 0; x < cstat->checksums_count; x++)
+        if (cstat->checksum_types[x] == type)
+            return cstat->checksums[x];
+
+    if (type == cstat->checksum_type)
+        return cstat->checksum;
+
+    return NULL;
+}
+
 void
 cr_contentstat_free(cr_ContentStat *cstat, GError **err)
 {
@@ -112,6 +173,8 @@ cr_contentstat_free(cr_ContentStat *cstat, GError **err)
     if (!cstat)
         return;
 
+    for (guint x = 0; x < cstat->checksums_count; x++)
+        g_free(cstat->checksums[x]);
     g_free(cstat->hdr_checksum);
     g_free(cstat->checksum);
     g_free(cstat);
@@ -120,27 +183,90 @@ cr_contentstat_free(cr_ContentStat *cstat, GError **err)
 typedef struct {
     lzma_stream stream;
     FILE *file;
-    unsigned char buffer[XZ_BUFFER_SIZE];
+    gboolean eos;               // End of the stream was decoded
+    size_t buffer_size;
+    unsigned char buffer[];
 } XzFile;
 
-cr_CompressionType
-cr_detect_compression(const char *filename, GError **err)
-{
-    cr_CompressionType type = CR_CW_UNKNOWN_COMPRESSION;
-
-    assert(filename);
-    assert(!err || *err == NULL);
+/* Threaded gzip writer. The input is split to blocks compressed by
+ * a thread pool as independent raw deflate streams (pigz-like). Every
+ * block uses the tail of the previous one as a dictionary, is flushed
+ * to a byte boundary and the blocks are written in the original order
+ * between the gzip header and trailer, so the result is an ordinary
+ * gzip member (or several of them, see cr_end_member()).
+ */
+typedef struct {
+    unsigned char *data;        // Dictionary followed by the block input
+    size_t dict_len;
+    size_t len;                 // Length of the block input
+    gboolean last;              // Last block of the stream
+    unsigned char *out;
+    size_t out_len;
+    uLong crc;                  // CRC32 of the block input
+    int zret;                   // Result of deflate()
+    gboolean done;
+} GzMtBlock;
 
-    if (!g_file_test(filename, G_FILE_TEST_IS_REGULAR)) {
-        g_debug("%s: File %s doesn't exists or not a regular file",
-                __func__, filename);
-        g_set_error(err, ERR_DOMAIN, CRE_NOFILE,
-                    "File %s doesn't exists or not a regular file", filename);
-        return CR_CW_UNKNOWN_COMPRESSION;
+typedef struct {
+    FILE *file;
+    GThreadPool *pool;
+    GMutex mutex;
+    GCond cond;
+    GQueue *blocks;             // Blocks in flight in the stream order
+    guint max_blocks;
+    unsigned char *buffer;      // Dictionary + input of the next block
+    size_t dict_len;
+    size_t len;
+    uLong crc;                  // CRC32 of the written input
+    uLong total_in;
+    int level;                  // Compression level of the blocks
+} GzMtFile;
+
+struct _cr_CompressionSettings {
+    unsigned int compression_threads;
+    unsigned int decompression_threads;     // 0 - all CPUs
+    int gz_level;
+    int bz2_level;
+    int xz_level;
+    int zstd_level;
+    int zstd_window_log;
+};
+
+#define CR_COMPRESSION_SETTINGS_INIT { \
+        .compression_threads = 0, \
+        .decompression_threads = 0, \
+        .gz_level = CR_CW_GZ_COMPRESSION_LEVEL, \
+        .bz2_level = BZ2_BLOCKSIZE100K, \
+        .xz_level = CR_CW_XZ_COMPRESSION_LEVEL, \
+        .zstd_level = CR_CW_ZSTD_COMPRESSION_LEVEL, \
+        .zstd_window_log = 0, \
     }
 
-    // Try determine compression type via filename suffix
+// Settings of the threads without thread default settings
+static cr_CompressionSettings cr_default_settings = CR_COMPRESSION_SETTINGS_INIT;
+
+// Stack of the thread default settings (GSList of cr_CompressionSettings *)
+static GPrivate cr_settings_key = G_PRIVATE_INIT((GDestroyNotify) g_slist_free);
+
+static gsize cr_io_buffer_size = 0;     // 0 - not set yet
 
+#ifdef WITH_ZSTD
+typedef struct {
+    ZSTD_CCtx *cctx;            // Compression context (write mode)
+    ZSTD_DCtx *dctx;            // Decompression context (read mode)
+    FILE *file;
+    ZSTD_inBuffer in;           // Compressed input (read mode)
+    gboolean frame_pending;     // Decoder is in the middle of a frame
+    gboolean output_pending;    // Decoder could have buffered output
+    size_t buffer_size;
+    unsigned char *buffer;      // Buffer for compressed data
+} ZstdFile;
+
+#endif  // WITH_ZSTD
+
+static cr_CompressionType
+cr_detect_compression_by_suffix(const char *filename)
+{
     if (g_str_has_suffix(filename, ".gz") ||
         g_str_has_suffix(filename, ".gzip") ||
         g_str_has_suffix(filename, ".gunzip"))
@@ -156,6 +282,10 @@ cr_detect_compression(const char *filename, GError **err)
     } else if (g_str_has_suffix(filename, ".zck"))
     {
         return CR_CW_ZCK_COMPRESSION;
+    } else if (g_str_has_suffix(filename, ".zst") ||
+               g_str_has_suffix(filename, ".zstd"))
+    {
+        return CR_CW_ZSTD_COMPRESSION;
     } else if (g_str_has_suffix(filename, ".xml") ||
                g_str_has_suffix(filename, ".tar") ||
                g_str_has_suffix(filename, ".yaml") ||
@@ -164,7 +294,78 @@ cr_detect_compression(const char *filename, GError **err)
         return CR_CW_NO_COMPRESSION;
     }
 
-    // No success? Let's get hardcore... (Use magic bytes)
+    return CR_CW_UNKNOWN_COMPRESSION;
+}
+
+/** Detect the compression by the signature at the beginning of the file.
+ * @return      Compression type or CR_CW_UNKNOWN_COMPRESSION if the file
+ *              cannot be read or doesn't start by a known signature
+ */
+static cr_CompressionType
+cr_detect_compression_by_signature(const char *filename)
+{
+    static const struct {
+        const char *magic;
+        size_t len;
+        cr_CompressionType type;
+    } signatures[] = {
+        { "\x1f\x8b",                  2, CR_CW_GZ_COMPRESSION },
+        { "BZh",                       3, CR_CW_BZ2_COMPRESSION },
+        { "\xfd" "7zXZ\x00",           6, CR_CW_XZ_COMPRESSION },
+        { "\x28\xb5\x2f\xfd",          4, CR_CW_ZSTD_COMPRESSION },
+        { "\x00ZCK1",                  5, CR_CW_ZCK_COMPRESSION },
+        { "<?xml",                     5, CR_CW_NO_COMPRESSION },
+        { CR_PKGINDEX_MAGIC,           8, CR_CW_NO_COMPRESSION },
+    };
+    unsigned char buf[8];
+    size_t len;
+    FILE *f = fopen(filename, "rb");
+
+    if (!f)
+        return CR_CW_UNKNOWN_COMPRESSION;
+    len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    if (len == 0)
+        return CR_CW_NO_COMPRESSION;    // Empty file
+
+    for (size_t x = 0; x < G_N_ELEMENTS(signatures); x++)
+        if (len >= signatures[x].len
+            && !memcmp(buf, signatures[x].magic, signatures[x].len))
+            return signatures[x].type;
+
+    return CR_CW_UNKNOWN_COMPRESSION;
+}
+
+cr_CompressionType
+cr_detect_compression(const char *filename, GError **err)
+{
+    cr_CompressionType type = CR_CW_UNKNOWN_COMPRESSION;
+
+    assert(filename);
+    assert(!err || *err == NULL);
+
+    if (!g_file_test(filename, G_FILE_TEST_IS_REGULAR)) {
+        g_debug("%s: File %s doesn't exists or not a regular file",
+                __func__, filename);
+        g_set_error(err, ERR_DOMAIN, CRE_NOFILE,
+                    "File %s doesn't exists or not a regular file", filename);
+        return CR_CW_UNKNOWN_COMPRESSION;
+    }
+
+    // Try determine compression type via filename suffix
+
+    type = cr_detect_compression_by_suffix(filename);
+    if (type != CR_CW_UNKNOWN_COMPRESSION)
+        return type;
+
+    // No success? Check the signatures of the supported compressions
+
+    type = cr_detect_compression_by_signature(filename);
+    if (type != CR_CW_UNKNOWN_COMPRESSION)
+        return type;
+
+    // Still unknown content, let's get hardcore... (Use libmagic)
 
     magic_t myt = magic_open(MAGIC_MIME | MAGIC_SYMLINK);
     if (myt == NULL) {
@@ -176,6 +377,7 @@ cr_detect_compression(const char *filename, GError **err)
     if (magic_load(myt, NULL) == -1) {
         g_set_error(err, ERR_DOMAIN, CRE_MAGIC,
                     "magic_load() failed: %s", magic_error(myt));
+        magic_close(myt);
         return CR_CW_UNKNOWN_COMPRESSION;
     }
 
@@ -210,6 +412,12 @@ cr_detect_compression(const char *filename, GError **err)
             type = CR_CW_XZ_COMPRESSION;
         }
 
+        else if (g_str_has_prefix(mime_type, "application/zstd") ||
+                 g_str_has_prefix(mime_type, "application/x-zstd"))
+        {
+            type = CR_CW_ZSTD_COMPRESSION;
+        }
+
         else if (g_str_has_prefix(mime_type, "text/plain") ||
                  g_str_has_prefix(mime_type, "text/xml") ||
                  g_str_has_prefix(mime_type, "application/xml") ||
@@ -260,6 +468,8 @@ cr_compression_type(const char *name)
         type = CR_CW_XZ_COMPRESSION;
     if (!g_strcmp0(name_lower, "zck"))
         type = CR_CW_ZCK_COMPRESSION;
+    if (!g_strcmp0(name_lower, "zstd") || !g_strcmp0(name_lower, "zst"))
+        type = CR_CW_ZSTD_COMPRESSION;
     g_free(name_lower);
 
     return type;
@@ -277,6 +487,8 @@ cr_compression_suffix(cr_CompressionType comtype)
             return ".xz";
         case CR_CW_ZCK_COMPRESSION:
             return ".zck";
+        case CR_CW_ZSTD_COMPRESSION:
+            return ".zst";
         default:
             return NULL;
     }
@@ -318,135 +530,807 @@ cr_cktype_from_zck(zckCtx *zck, GError **err)
 }
 #endif // WITH_ZCHUNK
 
-CR_FILE *
-cr_sopen(const char *filename,
-         cr_OpenMode mode,
-         cr_CompressionType comtype,
-         cr_ContentStat *stat,
-         GError **err)
+/** Settings of the files opened by the current thread. */
+static const cr_CompressionSettings *
+cr_settings(void)
 {
-    CR_FILE *file = NULL;
-    cr_CompressionType type = comtype;
-    GError *tmp_err = NULL;
+    GSList *stack = g_private_get(&cr_settings_key);
+    if (stack && stack->data)
+        return stack->data;
+    return &cr_default_settings;
+}
 
-    assert(filename);
-    assert(mode == CR_CW_MODE_READ || mode == CR_CW_MODE_WRITE);
-    assert(mode < CR_CW_MODE_SENTINEL);
-    assert(comtype < CR_CW_COMPRESSION_SENTINEL);
+cr_CompressionSettings *
+cr_compression_settings_new(void)
+{
+    cr_CompressionSettings *settings = g_new(cr_CompressionSettings, 1);
+    *settings = (cr_CompressionSettings) CR_COMPRESSION_SETTINGS_INIT;
+    return settings;
+}
+
+void
+cr_compression_settings_free(cr_CompressionSettings *settings)
+{
+    g_free(settings);
+}
+
+void
+cr_compression_settings_push_thread_default(cr_CompressionSettings *settings)
+{
+    GSList *stack = g_private_get(&cr_settings_key);
+    g_private_set(&cr_settings_key, g_slist_prepend(stack, settings));
+}
+
+void
+cr_compression_settings_pop_thread_default(cr_CompressionSettings *settings)
+{
+    GSList *stack = g_private_get(&cr_settings_key);
+
+    assert(stack && stack->data == settings);
+    (void) settings;
+
+    g_private_set(&cr_settings_key, g_slist_delete_link(stack, stack));
+}
+
+cr_CompressionSettings *
+cr_compression_settings_get_thread_default(void)
+{
+    GSList *stack = g_private_get(&cr_settings_key);
+    return stack ? stack->data : NULL;
+}
+
+gboolean
+cr_zstd_set_params(int level, int window_log, GError **err)
+{
+    return cr_compression_settings_set_zstd_params(&cr_default_settings,
+                                                   level, window_log, err);
+}
+
+gboolean
+cr_compression_settings_set_zstd_params(cr_CompressionSettings *settings,
+                                        int level,
+                                        int window_log,
+                                        GError **err)
+{
+    assert(settings);
     assert(!err || *err == NULL);
 
-    if (mode == CR_CW_MODE_WRITE) {
-        if (comtype == CR_CW_AUTO_DETECT_COMPRESSION) {
-            g_debug("%s: CR_CW_AUTO_DETECT_COMPRESSION cannot be used if "
-                    "mode is CR_CW_MODE_WRITE", __func__);
-            assert(0);
-            g_set_error(err, ERR_DOMAIN, CRE_ASSERT,
-                        "CR_CW_AUTO_DETECT_COMPRESSION cannot be used if "
-                        "mode is CR_CW_MODE_WRITE");
-            return NULL;
-        }
+#ifdef WITH_ZSTD
+    if (level == 0)
+        level = CR_CW_ZSTD_COMPRESSION_LEVEL;
 
-        if (comtype == CR_CW_UNKNOWN_COMPRESSION) {
-            g_debug("%s: CR_CW_UNKNOWN_COMPRESSION cannot be used if mode"
-                    " is CR_CW_MODE_WRITE", __func__);
-            assert(0);
-            g_set_error(err, ERR_DOMAIN, CRE_ASSERT,
-                        "CR_CW_UNKNOWN_COMPRESSION cannot be used if mode "
-                        "is CR_CW_MODE_WRITE");
-            return NULL;
-        }
+    if (level < 1 || level > ZSTD_maxCLevel()) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Zstd compression level must be 1 - %d", ZSTD_maxCLevel());
+        return FALSE;
     }
 
-
-    if (comtype == CR_CW_AUTO_DETECT_COMPRESSION) {
-        // Try to detect type of compression
-        type = cr_detect_compression(filename, &tmp_err);
-        if (tmp_err) {
-            // Error while detection
-            g_propagate_error(err, tmp_err);
-            return NULL;
+    if (window_log) {
+        ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+        if (window_log < bounds.lowerBound || window_log > bounds.upperBound) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Zstd window log must be %d - %d",
+                        bounds.lowerBound, bounds.upperBound);
+            return FALSE;
         }
     }
 
-    if (type == CR_CW_UNKNOWN_COMPRESSION) {
-        // Detection without error but compression type is unknown
-        g_debug("%s: Cannot detect compression type", __func__);
-        g_set_error(err, ERR_DOMAIN, CRE_UNKNOWNCOMPRESSION,
-                    "Cannot detect compression type");
-        return NULL;
+    settings->zstd_level = level;
+    settings->zstd_window_log = window_log;
+    return TRUE;
+#else
+    (void) settings;
+    (void) level;
+    (void) window_log;
+    g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't compiled "
+                "with zstd support");
+    return FALSE;
+#endif // WITH_ZSTD
+}
+
+gboolean
+cr_compression_set_level(cr_CompressionType type, int level, GError **err)
+{
+    return cr_compression_settings_set_level(&cr_default_settings,
+                                             type, level, err);
+}
+
+gboolean
+cr_compression_settings_set_level(cr_CompressionSettings *settings,
+                                  cr_CompressionType type,
+                                  int level,
+                                  GError **err)
+{
+    int min, max, def;
+
+    assert(settings);
+    assert(!err || *err == NULL);
+
+    switch (type) {
+        case CR_CW_GZ_COMPRESSION:
+            min = 1, max = 9, def = CR_CW_GZ_COMPRESSION_LEVEL;
+            break;
+        case CR_CW_BZ2_COMPRESSION:
+            min = 1, max = 9, def = BZ2_BLOCKSIZE100K;
+            break;
+        case CR_CW_XZ_COMPRESSION:
+            min = 0, max = 9, def = CR_CW_XZ_COMPRESSION_LEVEL;
+            break;
+        case CR_CW_ZSTD_COMPRESSION:
+#ifdef WITH_ZSTD
+            min = 1, max = ZSTD_maxCLevel(), def = CR_CW_ZSTD_COMPRESSION_LEVEL;
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            return FALSE;
+#endif // WITH_ZSTD
+        default:
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Compression level can be set only for gz, bz2, "
+                        "xz and zstd");
+            return FALSE;
     }
 
+    if (level == CR_CW_DEFAULT_COMPRESSION_LEVEL) {
+        level = def;
+    } else if (level < min || level > max) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Compression level for %s must be %d - %d",
+                    cr_compression_suffix(type) + 1, min, max);
+        return FALSE;
+    }
 
-    // Open file
+    if (type == CR_CW_GZ_COMPRESSION)
+        settings->gz_level = level;
+    else if (type == CR_CW_BZ2_COMPRESSION)
+        settings->bz2_level = level;
+    else if (type == CR_CW_XZ_COMPRESSION)
+        settings->xz_level = level;
+    else
+        settings->zstd_level = level;
 
-    const char *mode_str = (mode == CR_CW_MODE_WRITE) ? "wb" : "rb";
+    return TRUE;
+}
 
-    file = g_malloc0(sizeof(CR_FILE));
-    file->mode = mode;
-    file->type = type;
-    file->INNERFILE = NULL;
+int
+cr_compression_level(cr_CompressionType type)
+{
+    const cr_CompressionSettings *settings = cr_settings();
 
     switch (type) {
+        case CR_CW_GZ_COMPRESSION:  return settings->gz_level;
+        case CR_CW_BZ2_COMPRESSION: return settings->bz2_level;
+        case CR_CW_XZ_COMPRESSION:  return settings->xz_level;
+#ifdef WITH_ZSTD
+        case CR_CW_ZSTD_COMPRESSION: return settings->zstd_level;
+#endif
+        default: return CR_CW_DEFAULT_COMPRESSION_LEVEL;
+    }
+}
 
-        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
-            mode_str = (mode == CR_CW_MODE_WRITE) ? "w" : "r";
-            file->FILE = (void *) fopen(filename, mode_str);
-            if (!file->FILE)
-                g_set_error(err, ERR_DOMAIN, CRE_IO,
-                            "fopen(): %s", g_strerror(errno));
-            break;
+#ifdef WITH_ZSTD
+static void
+cr_zstd_file_free(ZstdFile *zstd_file)
+{
+    if (zstd_file->file)
+        fclose(zstd_file->file);
+    ZSTD_freeCCtx(zstd_file->cctx);
+    ZSTD_freeDCtx(zstd_file->dctx);
+    g_free(zstd_file->buffer);
+    g_free(zstd_file);
+}
 
-        case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
-            file->FILE = (void *) gzopen(filename, mode_str);
-            if (!file->FILE) {
-                g_set_error(err, ERR_DOMAIN, CRE_GZ,
-                            "gzopen(): %s", g_strerror(errno));
-                break;
-            }
+/* Compress the input and write out everything the encoder produced.
+ * The ZSTD_e_end ends the frame and flushes all the buffered data.
+ */
+static gboolean
+cr_zstd_compress(ZstdFile *zstd_file,
+                 ZSTD_inBuffer *in,
+                 ZSTD_EndDirective mode,
+                 GError **err)
+{
+    size_t remaining;
 
-            if (mode == CR_CW_MODE_WRITE)
-                gzsetparams((gzFile) file->FILE,
-                            CR_CW_GZ_COMPRESSION_LEVEL,
-                            GZ_STRATEGY);
+    do {
+        ZSTD_outBuffer out = { zstd_file->buffer, zstd_file->buffer_size, 0 };
 
-            if (gzbuffer((gzFile) file->FILE, GZ_BUFFER_SIZE) == -1) {
-                g_debug("%s: gzbuffer() call failed", __func__);
-                g_set_error(err, ERR_DOMAIN, CRE_GZ,
-                            "gzbuffer() call failed");
-            }
-            break;
+        remaining = ZSTD_compressStream2(zstd_file->cctx, &out, in, mode);
+        if (ZSTD_isError(remaining)) {
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                        "ZSTD: Error while compressing: %s",
+                        ZSTD_getErrorName(remaining));
+            return FALSE;
+        }
 
-        case (CR_CW_BZ2_COMPRESSION): { // ------------------------------------
-            FILE *f = fopen(filename, mode_str);
-            file->INNERFILE = f;
-            int bzerror;
+        if (fwrite(zstd_file->buffer, 1, out.pos, zstd_file->file) != out.pos) {
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                        "ZSTD: fwrite(): %s", g_strerror(errno));
+            return FALSE;
+        }
+    } while (mode == ZSTD_e_end ? remaining != 0 : in->pos < in->size);
 
-            if (!f) {
-                g_set_error(err, ERR_DOMAIN, CRE_IO,
-                            "fopen(): %s", g_strerror(errno));
-                break;
-            }
+    return TRUE;
+}
+#endif // WITH_ZSTD
 
-            if (mode == CR_CW_MODE_WRITE) {
-                file->FILE = (void *) BZ2_bzWriteOpen(&bzerror,
-                                                      f,
-                                                      BZ2_BLOCKSIZE100K,
-                                                      BZ2_VERBOSITY,
-                                                      BZ2_WORK_FACTOR);
-            } else {
-                file->FILE = (void *) BZ2_bzReadOpen(&bzerror,
-                                                     f,
-                                                     BZ2_VERBOSITY,
-                                                     BZ2_USE_LESS_MEMORY,
-                                                     NULL, 0);
-            }
+static gboolean
+cr_parse_buffer_size(const char *str, gsize *size, GError **err)
+{
+    char *end = NULL;
+    guint64 value;
+
+    errno = 0;
+    value = g_ascii_strtoull(str, &end, 10);
+    if (end != str && errno == 0) {
+        if (g_ascii_tolower(*end) == 'k') {
+            value *= 1024;
+            end++;
+        } else if (g_ascii_tolower(*end) == 'm') {
+            value *= 1024 * 1024;
+            end++;
+        }
+    }
 
-            if (bzerror != BZ_OK) {
-                const char *err_msg;
+    if (end == str || *end != '\0' || errno != 0
+        || value < CR_CW_MIN_BUFFER_SIZE || value > CR_CW_MAX_BUFFER_SIZE) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Bad I/O buffer size \"%s\", use %d - %d bytes "
+                    "(K and M suffixes are accepted)", str,
+                    CR_CW_MIN_BUFFER_SIZE, CR_CW_MAX_BUFFER_SIZE);
+        return FALSE;
+    }
 
-                fclose(f);
+    *size = (gsize) value;
+    return TRUE;
+}
 
-                switch (bzerror) {
+gboolean
+cr_set_io_buffer_size(gsize size, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (size == 0) {
+        // Back to the default (or the environment) on the next use
+        cr_io_buffer_size = 0;
+        return TRUE;
+    }
+
+    if (size < CR_CW_MIN_BUFFER_SIZE || size > CR_CW_MAX_BUFFER_SIZE) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "I/O buffer size must be %d - %d bytes",
+                    CR_CW_MIN_BUFFER_SIZE, CR_CW_MAX_BUFFER_SIZE);
+        return FALSE;
+    }
+
+    cr_io_buffer_size = size;
+    return TRUE;
+}
+
+gsize
+cr_get_io_buffer_size(void)
+{
+    if (cr_io_buffer_size == 0) {
+        const char *env = g_getenv(CR_CW_BUFFER_SIZE_ENV);
+        gsize size = CR_CW_DEFAULT_BUFFER_SIZE;
+        GError *tmp_err = NULL;
+
+        if (env && !cr_parse_buffer_size(env, &size, &tmp_err)) {
+            g_warning("%s: %s", CR_CW_BUFFER_SIZE_ENV, tmp_err->message);
+            g_error_free(tmp_err);
+            size = CR_CW_DEFAULT_BUFFER_SIZE;
+        }
+        cr_io_buffer_size = size;
+    }
+
+    return cr_io_buffer_size;
+}
+
+gboolean
+cr_decompression_set_threads(unsigned int threads, GError **err)
+{
+    return cr_compression_settings_set_decompression_threads(
+                                    &cr_default_settings, threads, err);
+}
+
+gboolean
+cr_compression_settings_set_decompression_threads(
+                                    cr_CompressionSettings *settings,
+                                    unsigned int threads,
+                                    GError **err)
+{
+    assert(settings);
+    assert(!err || *err == NULL);
+
+    if (threads > CR_CW_MAX_COMPRESSION_THREADS) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Max number of decompression threads is %d",
+                    CR_CW_MAX_COMPRESSION_THREADS);
+        return FALSE;
+    }
+
+    settings->decompression_threads = threads;
+    return TRUE;
+}
+
+gboolean
+cr_compression_set_threads(unsigned int threads, GError **err)
+{
+    return cr_compression_settings_set_threads(&cr_default_settings,
+                                               threads, err);
+}
+
+gboolean
+cr_compression_settings_set_threads(cr_CompressionSettings *settings,
+                                    unsigned int threads,
+                                    GError **err)
+{
+    assert(settings);
+    assert(!err || *err == NULL);
+
+    if (threads > CR_CW_MAX_COMPRESSION_THREADS) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Number of compression threads must be 0 - %d",
+                    CR_CW_MAX_COMPRESSION_THREADS);
+        return FALSE;
+    }
+
+    settings->compression_threads = threads;
+    return TRUE;
+}
+
+static void
+cr_gz_mt_compress_block(gpointer data, gpointer user_data)
+{
+    GzMtBlock *block = data;
+    GzMtFile *gz_file = user_data;
+    z_stream strm;
+    int rc;
+
+    memset(&strm, 0, sizeof(strm));
+    rc = deflateInit2(&strm, gz_file->level, Z_DEFLATED,
+                      -MAX_WBITS, 8, GZ_STRATEGY);
+    if (rc == Z_OK && block->dict_len)
+        rc = deflateSetDictionary(&strm, block->data, block->dict_len);
+
+    if (rc == Z_OK) {
+        // Room for the empty stored block appended by Z_SYNC_FLUSH
+        size_t out_size = deflateBound(&strm, block->len) + 16;
+        block->out = g_malloc(out_size);
+        strm.next_in = block->data + block->dict_len;
+        strm.avail_in = block->len;
+        strm.next_out = block->out;
+        strm.avail_out = out_size;
+        rc = deflate(&strm, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (block->last && rc == Z_STREAM_END)
+            rc = Z_OK;
+        else if (!block->last && (strm.avail_in || !strm.avail_out))
+            rc = Z_BUF_ERROR;
+        block->out_len = out_size - strm.avail_out;
+        deflateEnd(&strm);
+    }
+
+    block->crc = crc32(crc32(0L, Z_NULL, 0),
+                       block->data + block->dict_len, block->len);
+
+    g_mutex_lock(&gz_file->mutex);
+    block->zret = rc;
+    block->done = TRUE;
+    g_cond_broadcast(&gz_file->cond);
+    g_mutex_unlock(&gz_file->mutex);
+}
+
+static void
+cr_gz_mt_block_free(GzMtBlock *block)
+{
+    g_free(block->data);
+    g_free(block->out);
+    g_free(block);
+}
+
+/* Wait for the oldest block in flight and write it out. */
+static gboolean
+cr_gz_mt_write_block(GzMtFile *gz_file, GError **err)
+{
+    GzMtBlock *block = g_queue_pop_head(gz_file->blocks);
+    gboolean ret = TRUE;
+
+    g_mutex_lock(&gz_file->mutex);
+    while (!block->done)
+        g_cond_wait(&gz_file->cond, &gz_file->mutex);
+    g_mutex_unlock(&gz_file->mutex);
+
+    if (block->zret != Z_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                    "deflate(): %s", zError(block->zret));
+        ret = FALSE;
+    } else if (fwrite(block->out, 1, block->out_len, gz_file->file)
+               != block->out_len) {
+        g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                    "fwrite(): %s", g_strerror(errno));
+        ret = FALSE;
+    } else {
+        gz_file->crc = crc32_combine(gz_file->crc, block->crc, block->len);
+        gz_file->total_in += block->len;
+    }
+
+    cr_gz_mt_block_free(block);
+    return ret;
+}
+
+/* Pass the buffered input to the thread pool and write out the blocks
+ * which exceed the limit of blocks in flight (all of them if last).
+ */
+static gboolean
+cr_gz_mt_flush(GzMtFile *gz_file, gboolean last, GError **err)
+{
+    GzMtBlock *block = g_malloc0(sizeof(GzMtBlock));
+    GError *tmp_err = NULL;
+
+    block->data = gz_file->buffer;
+    block->dict_len = gz_file->dict_len;
+    block->len = gz_file->len;
+    block->last = last;
+    g_queue_push_tail(gz_file->blocks, block);
+
+    if (!last) {
+        size_t input_len = gz_file->dict_len + gz_file->len;
+        size_t dict_len = MIN(input_len, GZ_MT_DICT_SIZE);
+        gz_file->buffer = g_malloc(GZ_MT_DICT_SIZE + GZ_MT_BLOCK_SIZE);
+        memcpy(gz_file->buffer, block->data + input_len - dict_len, dict_len);
+        gz_file->dict_len = dict_len;
+    } else {
+        gz_file->buffer = NULL;
+        gz_file->dict_len = 0;
+    }
+    gz_file->len = 0;
+
+    g_thread_pool_push(gz_file->pool, block, &tmp_err);
+    if (tmp_err) {
+        // The block is never going to be compressed
+        g_queue_pop_tail(gz_file->blocks);
+        cr_gz_mt_block_free(block);
+        g_propagate_prefixed_error(err, tmp_err, "Cannot push a block: ");
+        return FALSE;
+    }
+
+    while (g_queue_get_length(gz_file->blocks) > (last ? 0 : gz_file->max_blocks))
+        if (!cr_gz_mt_write_block(gz_file, err))
+            return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+cr_gz_mt_write_header(FILE *f, GError **err)
+{
+    static const unsigned char header[GZ_MT_HEADER_LEN] = {
+        0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, GZ_OS_CODE };
+
+    if (fwrite(header, 1, sizeof(header), f) != sizeof(header)) {
+        g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                    "fwrite(): %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Compress the rest of the input of the current member and write
+ * its trailer. */
+static gboolean
+cr_gz_mt_finish_member(GzMtFile *gz_file, GError **err)
+{
+    unsigned char trailer[8];
+
+    if (!cr_gz_mt_flush(gz_file, TRUE, err))
+        return FALSE;
+
+    for (int x = 0; x < 4; x++) {
+        trailer[x] = (gz_file->crc >> (8 * x)) & 0xff;
+        trailer[x + 4] = (gz_file->total_in >> (8 * x)) & 0xff;
+    }
+    if (fwrite(trailer, 1, sizeof(trailer), gz_file->file)
+        != sizeof(trailer)) {
+        g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                    "fwrite(): %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* End the current member and start a new one. The new member does not
+ * use the previous input as a dictionary, it is decompressed on its own. */
+static gboolean
+cr_gz_mt_end_member(GzMtFile *gz_file, GError **err)
+{
+    if (!cr_gz_mt_finish_member(gz_file, err)
+        || !cr_gz_mt_write_header(gz_file->file, err))
+        return FALSE;
+
+    gz_file->buffer = g_malloc(GZ_MT_DICT_SIZE + GZ_MT_BLOCK_SIZE);
+    gz_file->crc = crc32(0L, Z_NULL, 0);
+    gz_file->total_in = 0;
+    return TRUE;
+}
+
+static GzMtFile *
+cr_gz_mt_open(const char *filename,
+              unsigned int threads,
+              int level,
+              GError **err)
+{
+    GzMtFile *gz_file;
+    FILE *f;
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "fopen(): %s", g_strerror(errno));
+        return NULL;
+    }
+
+    if (!cr_gz_mt_write_header(f, err)) {
+        fclose(f);
+        return NULL;
+    }
+
+    gz_file = g_malloc0(sizeof(GzMtFile));
+    gz_file->pool = g_thread_pool_new(cr_gz_mt_compress_block, gz_file,
+                                      threads, FALSE, err);
+    if (!gz_file->pool) {
+        g_free(gz_file);
+        fclose(f);
+        return NULL;
+    }
+
+    gz_file->file = f;
+    g_mutex_init(&gz_file->mutex);
+    g_cond_init(&gz_file->cond);
+    gz_file->blocks = g_queue_new();
+    gz_file->max_blocks = threads * GZ_MT_BLOCKS_PER_THREAD;
+    gz_file->buffer = g_malloc(GZ_MT_DICT_SIZE + GZ_MT_BLOCK_SIZE);
+    gz_file->crc = crc32(0L, Z_NULL, 0);
+    gz_file->level = level;
+    return gz_file;
+}
+
+static gboolean
+cr_gz_mt_write(GzMtFile *gz_file,
+               const void *buffer,
+               unsigned int len,
+               GError **err)
+{
+    const unsigned char *in = buffer;
+
+    while (len) {
+        size_t chunk = MIN(len, GZ_MT_BLOCK_SIZE - gz_file->len);
+        memcpy(gz_file->buffer + gz_file->dict_len + gz_file->len, in, chunk);
+        gz_file->len += chunk;
+        in += chunk;
+        len -= chunk;
+
+        if (gz_file->len == GZ_MT_BLOCK_SIZE)
+            if (!cr_gz_mt_flush(gz_file, FALSE, err))
+                return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Compress the rest of the input, write the trailer and free the file. */
+static int
+cr_gz_mt_close(GzMtFile *gz_file, GError **err)
+{
+    int ret = CRE_OK;
+
+    if (!cr_gz_mt_finish_member(gz_file, err))
+        ret = CRE_GZ;
+
+    // Wait for the blocks which are still compressed after an error
+    g_thread_pool_free(gz_file->pool, FALSE, TRUE);
+    g_queue_free_full(gz_file->blocks, (GDestroyNotify) cr_gz_mt_block_free);
+    g_free(gz_file->buffer);
+    g_mutex_clear(&gz_file->mutex);
+    g_cond_clear(&gz_file->cond);
+
+    if (fclose(gz_file->file) != 0 && ret == CRE_OK) {
+        ret = CRE_IO;
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "fclose(): %s", g_strerror(errno));
+    }
+
+    g_free(gz_file);
+    return ret;
+}
+
+static FILE *
+cr_fopen_fd(const char *filename, int fd, const char *mode_str)
+{
+    FILE *f;
+    int new_fd;
+
+    if (fd < 0)
+        return fopen(filename, mode_str);
+
+    new_fd = dup(fd);
+    if (new_fd < 0)
+        return NULL;
+
+    f = fdopen(new_fd, mode_str);
+    if (!f) {
+        int errsv = errno;
+        close(new_fd);
+        errno = errsv;
+    }
+
+    return f;
+}
+
+/** Open a file by the name or (fd >= 0) a duplicate of the fd.
+ * The filename is only used in messages then.
+ */
+static CR_FILE *
+cr_sopen_internal(const char *filename,
+                  int fd,
+                  cr_OpenMode mode,
+                  cr_CompressionType comtype,
+                  cr_ContentStat *stat,
+                  GError **err)
+{
+    CR_FILE *file = NULL;
+    cr_CompressionType type = comtype;
+    const cr_CompressionSettings *settings = cr_settings();
+    GError *tmp_err = NULL;
+
+    assert(filename);
+    assert(mode == CR_CW_MODE_READ || mode == CR_CW_MODE_WRITE);
+    assert(mode < CR_CW_MODE_SENTINEL);
+    assert(comtype < CR_CW_COMPRESSION_SENTINEL);
+    assert(!err || *err == NULL);
+
+    if (mode == CR_CW_MODE_WRITE) {
+        if (comtype == CR_CW_AUTO_DETECT_COMPRESSION) {
+            g_debug("%s: CR_CW_AUTO_DETECT_COMPRESSION cannot be used if "
+                    "mode is CR_CW_MODE_WRITE", __func__);
+            assert(0);
+            g_set_error(err, ERR_DOMAIN, CRE_ASSERT,
+                        "CR_CW_AUTO_DETECT_COMPRESSION cannot be used if "
+                        "mode is CR_CW_MODE_WRITE");
+            return NULL;
+        }
+
+        if (comtype == CR_CW_UNKNOWN_COMPRESSION) {
+            g_debug("%s: CR_CW_UNKNOWN_COMPRESSION cannot be used if mode"
+                    " is CR_CW_MODE_WRITE", __func__);
+            assert(0);
+            g_set_error(err, ERR_DOMAIN, CRE_ASSERT,
+                        "CR_CW_UNKNOWN_COMPRESSION cannot be used if mode "
+                        "is CR_CW_MODE_WRITE");
+            return NULL;
+        }
+    }
+
+
+    if (comtype == CR_CW_AUTO_DETECT_COMPRESSION && fd >= 0) {
+        // The content is not available before it's read
+        type = cr_detect_compression_by_suffix(filename);
+    } else if (comtype == CR_CW_AUTO_DETECT_COMPRESSION) {
+        // Try to detect type of compression
+        type = cr_detect_compression(filename, &tmp_err);
+        if (tmp_err) {
+            // Error while detection
+            g_propagate_error(err, tmp_err);
+            return NULL;
+        }
+    }
+
+    if (type == CR_CW_UNKNOWN_COMPRESSION) {
+        // Detection without error but compression type is unknown
+        g_debug("%s: Cannot detect compression type", __func__);
+        g_set_error(err, ERR_DOMAIN, CRE_UNKNOWNCOMPRESSION,
+                    "Cannot detect compression type");
+        return NULL;
+    }
+
+
+    // Open file
+
+    const char *mode_str = (mode == CR_CW_MODE_WRITE) ? "wb" : "rb";
+    gsize buffer_size = cr_get_io_buffer_size();
+
+    file = g_malloc0(sizeof(CR_FILE));
+    file->mode = mode;
+    file->type = type;
+    file->INNERFILE = NULL;
+
+    switch (type) {
+
+        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
+            mode_str = (mode == CR_CW_MODE_WRITE) ? "w" : "r";
+            file->FILE = (void *) cr_fopen_fd(filename, fd, mode_str);
+            if (!file->FILE)
+                g_set_error(err, ERR_DOMAIN, CRE_IO,
+                            "fopen(): %s", g_strerror(errno));
+            else
+                setvbuf((FILE *) file->FILE, NULL, _IOFBF, buffer_size);
+            break;
+
+        case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
+            if (mode == CR_CW_MODE_WRITE && settings->compression_threads > 1) {
+                // FILE is a GzMtFile and INNERFILE its underlying FILE
+                GzMtFile *gz_file = cr_gz_mt_open(filename,
+                                                  settings->compression_threads,
+                                                  settings->gz_level,
+                                                  err);
+                if (gz_file) {
+                    file->FILE = (void *) gz_file;
+                    file->INNERFILE = gz_file->file;
+                }
+                break;
+            }
+
+            if (fd >= 0) {
+                int gz_fd = dup(fd);
+                file->FILE = (gz_fd >= 0) ? (void *) gzdopen(gz_fd, mode_str)
+                                          : NULL;
+                if (!file->FILE && gz_fd >= 0)
+                    close(gz_fd);
+            } else
+                file->FILE = (void *) gzopen(filename, mode_str);
+            if (!file->FILE) {
+                g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                            "gzopen(): %s", g_strerror(errno));
+                break;
+            }
+
+            if (mode == CR_CW_MODE_WRITE)
+                gzsetparams((gzFile) file->FILE,
+                            settings->gz_level,
+                            GZ_STRATEGY);
+
+            if (gzbuffer((gzFile) file->FILE, buffer_size) == -1) {
+                g_debug("%s: gzbuffer() call failed", __func__);
+                g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                            "gzbuffer() call failed");
+            }
+            break;
+
+        case (CR_CW_BZ2_COMPRESSION): { // ------------------------------------
+            FILE *f = cr_fopen_fd(filename, fd, mode_str);
+            file->INNERFILE = f;
+            int bzerror;
+
+            if (!f) {
+                g_set_error(err, ERR_DOMAIN, CRE_IO,
+                            "fopen(): %s", g_strerror(errno));
+                break;
+            }
+
+            // libbz2 reads and writes in small pieces, let stdio batch them
+            setvbuf(f, NULL, _IOFBF, buffer_size);
+
+            if (mode == CR_CW_MODE_WRITE) {
+                file->FILE = (void *) BZ2_bzWriteOpen(&bzerror,
+                                                      f,
+                                                      settings->bz2_level,
+                                                      BZ2_VERBOSITY,
+                                                      BZ2_WORK_FACTOR);
+            } else {
+                file->FILE = (void *) BZ2_bzReadOpen(&bzerror,
+                                                     f,
+                                                     BZ2_VERBOSITY,
+                                                     BZ2_USE_LESS_MEMORY,
+                                                     NULL, 0);
+            }
+
+            if (bzerror != BZ_OK) {
+                const char *err_msg;
+
+                fclose(f);
+
+                switch (bzerror) {
                     case BZ_CONFIG_ERROR:
                         err_msg = "library has been mis-compiled";
                         break;
@@ -472,7 +1356,9 @@ cr_sopen(const char *filename,
 
         case (CR_CW_XZ_COMPRESSION): { // -------------------------------------
             int ret;
-            XzFile *xz_file = g_malloc(sizeof(XzFile));
+            XzFile *xz_file = g_malloc(sizeof(XzFile) + buffer_size);
+            xz_file->eos = FALSE;
+            xz_file->buffer_size = buffer_size;
             lzma_stream *stream = &(xz_file->stream);
             memset(stream, 0, sizeof(lzma_stream));
             /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ XXX: This part
@@ -486,62 +1372,78 @@ cr_sopen(const char *filename,
 
             if (mode == CR_CW_MODE_WRITE) {
 
+                unsigned int threads = settings->compression_threads;
 #ifdef ENABLE_THREADED_XZ_ENCODER
-                // The threaded encoder takes the options as pointer to
-                // a lzma_mt structure.
-                lzma_mt mt = {
-                    // No flags are needed.
-                    .flags = 0,
-
-                    // Let liblzma determine a sane block size.
-                    .block_size = 0,
-
-                    // Use no timeout for lzma_code() calls by setting timeout
-                    // to zero. That is, sometimes lzma_code() might block for
-                    // a long time (from several seconds to even minutes).
-                    // If this is not OK, for example due to progress indicator
-                    // needing updates, specify a timeout in milliseconds here.
-                    // See the documentation of lzma_mt in lzma/container.h for
-                    // information how to choose a reasonable timeout.
-                    .timeout = 0,
-
-                    // Use the default preset (6) for LZMA2.
-                    // To use a preset, filters must be set to NULL.
-                    .preset = LZMA_PRESET_DEFAULT,
-                    .filters = NULL,
-
-                    // Integrity checking.
-                    .check = XZ_CHECK,
-                };
-
-                // Detect how many threads the CPU supports.
-                mt.threads = lzma_cputhreads();
-
-                // If the number of CPU cores/threads cannot be detected,
-                // use one thread.
-                if (mt.threads == 0)
-                    mt.threads = 1;
-
-                // If the number of CPU cores/threads exceeds threads_max,
-                // limit the number of threads to keep memory usage lower.
-                const uint32_t threads_max = 2;
-                if (mt.threads > threads_max)
-                    mt.threads = threads_max;
-
-                if (mt.threads > 1)
+                // Keep the old build time default of up to two threads
+                if (threads == 0)
+                    threads = MIN(lzma_cputhreads(), 2);
+#endif
+                if (threads > 1) {
+                    // The threaded encoder takes the options as pointer to
+                    // a lzma_mt structure.
+                    lzma_mt mt = {
+                        // No flags are needed.
+                        .flags = 0,
+
+                        // Let liblzma determine a sane block size.
+                        .block_size = 0,
+
+                        // Use no timeout for lzma_code() calls, they block
+                        // until the output is available.
+                        .timeout = 0,
+
+                        // To use a preset, filters must be set to NULL.
+                        .preset = settings->xz_level,
+                        .filters = NULL,
+
+                        // Integrity checking.
+                        .check = XZ_CHECK,
+
+                        .threads = threads,
+                    };
+
                     // Initialize the threaded encoder
                     ret = lzma_stream_encoder_mt(stream, &mt);
-                else
-#endif
+                } else
                     // Initialize the single-threaded encoder
                     ret = lzma_easy_encoder(stream,
-                                            CR_CW_XZ_COMPRESSION_LEVEL,
+                                            settings->xz_level,
                                             XZ_CHECK);
 
             } else {
-                ret = lzma_auto_decoder(stream,
-                                        XZ_MEMORY_USAGE_LIMIT,
-                                        XZ_DECODER_FLAGS);
+
+                unsigned int threads = settings->decompression_threads;
+#if LZMA_VERSION >= 50040002
+                if (threads == 0)
+                    threads = lzma_cputhreads();
+#else
+                // The threaded decoder is available since liblzma 5.4.0
+                threads = 1;
+#endif
+                if (threads > 1) {
+#if LZMA_VERSION >= 50040002
+                    // Streams of multiple blocks (written by a threaded
+                    // encoder) are decoded in parallel, single block
+                    // streams are decoded as by the single-threaded decoder.
+                    uint64_t physmem = lzma_physmem();
+                    lzma_mt mt = {
+                        .flags = XZ_DECODER_FLAGS,
+                        .threads = threads,
+                        .timeout = 0,
+
+                        // Reduce the number of threads rather than
+                        // to use more than a quarter of RAM (like xz does)
+                        .memlimit_threading = physmem ? physmem / 4
+                                                      : XZ_MEMORY_USAGE_LIMIT,
+                        .memlimit_stop = XZ_MEMORY_USAGE_LIMIT,
+                    };
+
+                    ret = lzma_stream_decoder_mt(stream, &mt);
+#endif
+                } else
+                    ret = lzma_auto_decoder(stream,
+                                            XZ_MEMORY_USAGE_LIMIT,
+                                            XZ_DECODER_FLAGS);
             }
 
             if (ret != LZMA_OK) {
@@ -574,7 +1476,7 @@ cr_sopen(const char *filename,
 
             // Open input/output file
 
-            FILE *f = fopen(filename, mode_str);
+            FILE *f = cr_fopen_fd(filename, fd, mode_str);
             if (!f) {
                 g_set_error(err, ERR_DOMAIN, CRE_XZ,
                             "fopen(): %s", g_strerror(errno));
@@ -589,7 +1491,14 @@ cr_sopen(const char *filename,
         }
         case (CR_CW_ZCK_COMPRESSION): { // -------------------------------------
 #ifdef WITH_ZCHUNK
-            FILE *f = fopen(filename, mode_str);
+            if (fd >= 0) {
+                // The zchunk library seeks in the file
+                g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                            "Zchunk file %s cannot be streamed", filename);
+                break;
+            }
+
+            FILE *f = cr_fopen_fd(filename, fd, mode_str);
 
             if (!f) {
                 g_set_error(err, ERR_DOMAIN, CRE_IO,
@@ -625,6 +1534,73 @@ cr_sopen(const char *filename,
 #endif // WITH_ZCHUNK
         }
 
+        case (CR_CW_ZSTD_COMPRESSION): { // -----------------------------------
+#ifdef WITH_ZSTD
+            ZstdFile *zstd_file = g_malloc0(sizeof(ZstdFile));
+            size_t rc = 0;
+
+            if (mode == CR_CW_MODE_WRITE) {
+                zstd_file->cctx = ZSTD_createCCtx();
+                zstd_file->buffer_size = ZSTD_CStreamOutSize();
+                if (zstd_file->cctx) {
+                    ZSTD_CCtx *cctx = zstd_file->cctx;
+                    rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                                settings->zstd_level);
+                    if (!ZSTD_isError(rc))
+                        rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+                    if (!ZSTD_isError(rc) && settings->zstd_window_log) {
+                        rc = ZSTD_CCtx_setParameter(cctx,
+                                        ZSTD_c_enableLongDistanceMatching, 1);
+                        if (!ZSTD_isError(rc))
+                            rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog,
+                                                        settings->zstd_window_log);
+                    }
+                }
+            } else {
+                zstd_file->dctx = ZSTD_createDCtx();
+                zstd_file->buffer_size = ZSTD_DStreamInSize();
+                // Accept files compressed with any window size (--long=31)
+                if (zstd_file->dctx) {
+                    ZSTD_bounds bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+                    rc = ZSTD_DCtx_setParameter(zstd_file->dctx,
+                                                ZSTD_d_windowLogMax,
+                                                bounds.upperBound);
+                }
+            }
+
+            if (!zstd_file->cctx && !zstd_file->dctx) {
+                g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                            "ZSTD: Cannot create (de)compression context");
+                cr_zstd_file_free(zstd_file);
+                break;
+            }
+
+            if (ZSTD_isError(rc)) {
+                g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                            "ZSTD: Cannot set parameters: %s",
+                            ZSTD_getErrorName(rc));
+                cr_zstd_file_free(zstd_file);
+                break;
+            }
+
+            zstd_file->file = cr_fopen_fd(filename, fd, mode_str);
+            if (!zstd_file->file) {
+                g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                            "fopen(): %s", g_strerror(errno));
+                cr_zstd_file_free(zstd_file);
+                break;
+            }
+
+            zstd_file->buffer = g_malloc(zstd_file->buffer_size);
+            file->FILE = (void *) zstd_file;
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            break;
+#endif // WITH_ZSTD
+        }
+
         default: // -----------------------------------------------------------
             break;
     }
@@ -641,7 +1617,17 @@ cr_sopen(const char *filename,
     if (stat) {
         file->stat = stat;
 
-        if (stat->checksum_type == CR_CHECKSUM_UNKNOWN) {
+        if (stat->checksums_count > 0) {
+            // All checksums are updated from the same buffers
+            file->checksum_ctx = cr_checksum_multi_new(stat->checksum_types,
+                                                       stat->checksums_count,
+                                                       &tmp_err);
+            if (tmp_err) {
+                g_propagate_error(err, tmp_err);
+                cr_close(file, NULL);
+                return NULL;
+            }
+        } else if (stat->checksum_type == CR_CHECKSUM_UNKNOWN) {
             file->checksum_ctx = NULL;
         } else {
             file->checksum_ctx = cr_checksum_new(stat->checksum_type,
@@ -675,9 +1661,457 @@ cr_sopen(const char *filename,
 #endif // WITH_ZCHUNK
     }
 
-    assert(!err || (!file && *err != NULL) || (file && *err == NULL));
+    assert(!err || (!file && *err != NULL) || (file && *err == NULL));
+
+    return file;
+}
+
+/** Download of a file opened by cr_sopen_url(). The data are written into
+ * a socket, the other end of which is read by the CR_FILE.
+ */
+typedef struct {
+    GThread *thread;
+    CURL *handle;
+    int fd;                 // writing end of the socket
+    FILE *tee;              // copy of the downloaded data or NULL
+    gchar *tee_path;
+    gchar *tee_tmp_path;
+    gint done;              // (atomic) the download finished or failed
+    gboolean joined;
+    GError *err;
+    char errorbuf[CURL_ERROR_SIZE];
+} cr_StreamSource;
+
+
+gboolean
+cr_is_url(const char *filename)
+{
+    return g_str_has_prefix(filename, "http://") ||
+           g_str_has_prefix(filename, "https://") ||
+           g_str_has_prefix(filename, "ftp://");
+}
+
+
+static size_t
+cr_stream_source_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    cr_StreamSource *source = userdata;
+    size_t len = size * nmemb;
+    size_t written = 0;
+
+    if (source->tee && fwrite(ptr, 1, len, source->tee) != len) {
+        g_set_error(&source->err, ERR_DOMAIN, CRE_IO, "Cannot write %s: %s",
+                    source->tee_tmp_path, g_strerror(errno));
+        return 0;
+    }
+
+    while (written < len) {
+        // MSG_NOSIGNAL - no SIGPIPE if the reader closed the file
+        ssize_t ret = send(source->fd, ptr + written, len - written,
+                           MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        written += ret;
+    }
+
+    return len;
+}
+
+
+static gpointer
+cr_stream_source_thread(gpointer data)
+{
+    cr_StreamSource *source = data;
+    CURLcode rcode;
+
+    rcode = curl_easy_perform(source->handle);
+    if (rcode != CURLE_OK && !source->err) {
+        char *url = NULL;
+        curl_easy_getinfo(source->handle, CURLINFO_EFFECTIVE_URL, &url);
+        g_set_error(&source->err, ERR_DOMAIN, CRE_CURL,
+                    "Cannot download %s: %s: %s", url,
+                    curl_easy_strerror(rcode), source->errorbuf);
+    }
+
+    // The reader gets the end of file
+    close(source->fd);
+    source->fd = -1;
+
+    if (source->tee) {
+        if (fclose(source->tee) != 0 && !source->err)
+            g_set_error(&source->err, ERR_DOMAIN, CRE_IO, "Cannot write %s: %s",
+                        source->tee_tmp_path, g_strerror(errno));
+        source->tee = NULL;
+
+        if (source->err
+            || g_rename(source->tee_tmp_path, source->tee_path) == -1)
+            remove(source->tee_tmp_path);
+    }
+
+    g_atomic_int_set(&source->done, 1);
+
+    return NULL;
+}
+
+
+/** Wait for the end of the download (the reading end of the socket
+ * has to be at its end or closed).
+ * @return              error of the download or NULL
+ */
+static GError *
+cr_stream_source_finish(cr_StreamSource *source)
+{
+    GError *err;
+
+    if (!source->joined) {
+        g_thread_join(source->thread);
+        source->joined = TRUE;
+    }
+
+    err = source->err;
+    source->err = NULL;
+    return err;
+}
+
+
+static void
+cr_stream_source_free(cr_StreamSource *source)
+{
+    if (!source)
+        return;
+
+    if (source->thread && !source->joined) {
+        g_thread_join(source->thread);
+        source->joined = TRUE;
+    }
+    if (source->fd >= 0)
+        close(source->fd);
+    if (source->tee) {
+        fclose(source->tee);
+        remove(source->tee_tmp_path);
+    }
+    g_clear_error(&source->err);
+    if (source->handle)
+        curl_easy_cleanup(source->handle);
+    g_free(source->tee_path);
+    g_free(source->tee_tmp_path);
+    g_free(source);
+}
+
+
+CR_FILE *
+cr_sopen_url(const char *url,
+             cr_CompressionType comtype,
+             const char *tee_path,
+             cr_ContentStat *stat,
+             GError **err)
+{
+    CR_FILE *file;
+    cr_StreamSource *source;
+    int sv[2];
+    CURLcode rcode = CURLE_OK;
+    GError *tmp_err = NULL;
+
+    assert(url);
+    assert(!err || *err == NULL);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO, "socketpair(): %s",
+                    g_strerror(errno));
+        return NULL;
+    }
+
+    source = g_malloc0(sizeof(cr_StreamSource));
+    source->fd = sv[1];
+
+    file = cr_sopen_internal(url, sv[0], CR_CW_MODE_READ, comtype, stat, err);
+    close(sv[0]);   // The CR_FILE uses a duplicate
+    if (!file) {
+        cr_stream_source_free(source);
+        return NULL;
+    }
+
+    if (tee_path) {
+        source->tee_path = g_strdup(tee_path);
+        source->tee_tmp_path = g_strconcat(tee_path, ".part", NULL);
+        source->tee = fopen(source->tee_tmp_path, "wb");
+        if (!source->tee) {
+            g_set_error(&tmp_err, ERR_DOMAIN, CRE_IO, "Cannot open %s: %s",
+                        source->tee_tmp_path, g_strerror(errno));
+            goto sopen_url_error;
+        }
+    }
+
+    source->handle = curl_easy_init();
+    if (!source->handle) {
+        g_set_error(&tmp_err, ERR_DOMAIN, CRE_CURL, "curl_easy_init failed");
+        goto sopen_url_error;
+    }
+
+    source->errorbuf[0] = '\0';
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_URL, url);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_ERRORBUFFER,
+                                 source->errorbuf);
+    // Fail on HTTP error (return code >= 400)
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_FAILONERROR, 1L);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_FOLLOWLOCATION, 1L);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_MAXREDIRS, 6L);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_WRITEFUNCTION,
+                                 cr_stream_source_write_cb);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(source->handle, CURLOPT_WRITEDATA, source);
+    if (rcode != CURLE_OK) {
+        g_set_error(&tmp_err, ERR_DOMAIN, CRE_CURL,
+                    "curl_easy_setopt failed: %s", curl_easy_strerror(rcode));
+        goto sopen_url_error;
+    }
+
+    source->thread = g_thread_try_new("cr_stream_source",
+                                      cr_stream_source_thread,
+                                      source, &tmp_err);
+    if (!source->thread)
+        goto sopen_url_error;
+
+    file->source = source;
+    return file;
+
+sopen_url_error:
+    // Close the reading end first, the writing end is not used yet
+    cr_close(file, NULL);
+    cr_stream_source_free(source);
+    g_propagate_error(err, tmp_err);
+    return NULL;
+}
+
+
+CR_FILE *
+cr_sopen(const char *filename,
+         cr_OpenMode mode,
+         cr_CompressionType comtype,
+         cr_ContentStat *stat,
+         GError **err)
+{
+    assert(filename);
+
+    if (mode == CR_CW_MODE_READ && cr_is_url(filename))
+        return cr_sopen_url(filename, comtype, NULL, stat, err);
+
+    return cr_sopen_internal(filename, -1, mode, comtype, stat, err);
+}
+
+/** Update the stats and pass the data to the compression.
+ */
+static int
+cr_write_direct(CR_FILE *cr_file,
+                const void *buffer,
+                unsigned int len,
+                GError **err)
+{
+    int bzerror;
+    int ret = CR_CW_ERR;
+
+    if (cr_file->stat) {
+        cr_file->stat->size += len;
+        if (cr_file->checksum_ctx) {
+            GError *tmp_err = NULL;
+            cr_checksum_update(cr_file->checksum_ctx, buffer, len, &tmp_err);
+            if (tmp_err) {
+                g_propagate_error(err, tmp_err);
+                return CR_CW_ERR;
+            }
+        }
+    }
+
+    switch (cr_file->type) {
+
+        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
+            if ((ret = (int) fwrite(buffer, 1, len, (FILE *) cr_file->FILE)) != (int) len) {
+                ret = CR_CW_ERR;
+                g_set_error(err, ERR_DOMAIN, CRE_IO,
+                            "fwrite(): %s", g_strerror(errno));
+            }
+            break;
+
+        case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
+            if (len == 0) {
+                ret = 0;
+                break;
+            }
+
+            if (cr_file->INNERFILE) {
+                ret = len;
+                if (!cr_gz_mt_write((GzMtFile *) cr_file->FILE, buffer, len, err))
+                    ret = CR_CW_ERR;
+                break;
+            }
+
+            if ((ret = gzwrite((gzFile) cr_file->FILE, buffer, len)) == 0) {
+                ret = CR_CW_ERR;
+                g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                    "gzwrite(): %s", cr_gz_strerror((gzFile) cr_file->FILE));
+            }
+            break;
+
+        case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
+            BZ2_bzWrite(&bzerror, (BZFILE *) cr_file->FILE, (void *) buffer, len);
+            if (bzerror == BZ_OK) {
+                ret = len;
+            } else {
+                const char *err_msg;
+                ret = CR_CW_ERR;
+
+                switch (bzerror) {
+                    case BZ_PARAM_ERROR:
+                        // This should not happend
+                        err_msg = "bad function params!";
+                        break;
+                    case BZ_SEQUENCE_ERROR:
+                        // This should not happend
+                        err_msg = "file was opened with BZ2_bzReadOpen";
+                        break;
+                    case BZ_IO_ERROR:
+                        err_msg = "error while reading from the compressed file";
+                        break;
+                    default:
+                        err_msg = "other error";
+                }
+
+                g_set_error(err, ERR_DOMAIN, CRE_BZ2,
+                            "Bz2 error: %s", err_msg);
+            }
+            break;
+
+        case (CR_CW_XZ_COMPRESSION): { // -------------------------------------
+            XzFile *xz_file = (XzFile *) cr_file->FILE;
+            lzma_stream *stream = &(xz_file->stream);
+
+            ret = len;
+            stream->next_in = buffer;
+            stream->avail_in = len;
+
+            while (stream->avail_in) {
+                int lret;
+                stream->next_out = xz_file->buffer;
+                stream->avail_out = xz_file->buffer_size;
+                lret = lzma_code(stream, LZMA_RUN);
+                if (lret != LZMA_OK) {
+                    const char *err_msg;
+                    ret = CR_CW_ERR;
+
+                    switch (lret) {
+                        case LZMA_MEM_ERROR:
+                            err_msg = "Memory allocation failed";
+                            break;
+			case LZMA_DATA_ERROR:
+                            // This error is returned if the compressed
+                            // or uncompressed size get near 8 EiB
+                            // (2^63 bytes) because that's where the .xz
+                            // file format size limits currently are.
+                            // That is, the possibility of this error
+                            // is mostly theoretical unless you are doing
+                            // something very unusual.
+                            //
+                            // Note that strm->total_in and strm->total_out
+                            // have nothing to do with this error. Changing
+                            // those variables won't increase or decrease
+                            // the chance of getting this error.
+                            err_msg = "File size limits exceeded";
+                            break;
+			default:
+                            // This is most likely LZMA_PROG_ERROR.
+                            err_msg = "Unknown error, possibly a bug";
+                            break;
+                    }
+
+                    g_set_error(err, ERR_DOMAIN, CRE_XZ,
+                                "XZ: lzma_code() error (%d): %s",
+                                lret, err_msg);
+                    break;   // Error while coding
+                }
+
+                size_t out_len = xz_file->buffer_size - stream->avail_out;
+                if ((fwrite(xz_file->buffer, 1, out_len, xz_file->file)) != out_len) {
+                    ret = CR_CW_ERR;
+                    g_set_error(err, ERR_DOMAIN, CRE_XZ,
+                                "XZ: fwrite(): %s", g_strerror(errno));
+                    break;   // Error while writing
+                }
+            }
+
+            break;
+        }
+
+        case (CR_CW_ZCK_COMPRESSION): { // ------------------------------------
+#ifdef WITH_ZCHUNK
+            zckCtx *zck = (zckCtx *) cr_file->FILE;
+            ssize_t wb = zck_write(zck, buffer, len);
+            if (wb < 0) {
+                ret = CR_CW_ERR;
+                g_set_error(err, ERR_DOMAIN, CRE_ZCK,
+                            "ZCK: Unable to write: %s", zck_get_error(zck));
+                break;
+            }
+            ret = wb;
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_IO, "createrepo_c wasn't compiled "
+                        "with zchunk support");
+            break;
+#endif // WITH_ZCHUNK
+        }
+
+        case (CR_CW_ZSTD_COMPRESSION): { // -----------------------------------
+#ifdef WITH_ZSTD
+            ZstdFile *zstd_file = (ZstdFile *) cr_file->FILE;
+            ZSTD_inBuffer in = { buffer, len, 0 };
+
+            ret = len;
+            if (!cr_zstd_compress(zstd_file, &in, ZSTD_e_continue, err))
+                ret = CR_CW_ERR;
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            break;
+#endif // WITH_ZSTD
+        }
+
+        default: // -----------------------------------------------------------
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Bad compressed file type");
+            break;
+    }
+
+    assert(!err || (ret == CR_CW_ERR && *err != NULL)
+           || (ret != CR_CW_ERR && *err == NULL));
 
-    return file;
+    return ret;
+}
+
+/** Pass the buffered small writes to the compression.
+ */
+static int
+cr_write_flush(CR_FILE *cr_file, GError **err)
+{
+    size_t len = cr_file->wbuffer_len;
+
+    if (len == 0)
+        return CRE_OK;
+
+    cr_file->wbuffer_len = 0;
+    if (cr_write_direct(cr_file, cr_file->wbuffer, len, err) != (int) len)
+        return CR_CW_ERR;
+
+    return CRE_OK;
 }
 
 int
@@ -689,6 +2123,9 @@ cr_set_dict(CR_FILE *cr_file, const void *dict, unsigned int len, GError **err)
     if (len == 0)
         return CRE_OK;
 
+    if (cr_write_flush(cr_file, err) != CRE_OK)
+        return CRE_ERROR;
+
     switch (cr_file->type) {
 
         case (CR_CW_ZCK_COMPRESSION): { // ------------------------------------
@@ -725,12 +2162,16 @@ cr_close(CR_FILE *cr_file, GError **err)
 {
     int ret = CRE_ERROR;
     int rc;
+    GError *flush_err = NULL;
 
     assert(!err || *err == NULL);
 
     if (!cr_file)
         return CRE_OK;
 
+    // The file is closed even if the buffered writes fail
+    cr_write_flush(cr_file, &flush_err);
+
     switch (cr_file->type) {
 
         case (CR_CW_NO_COMPRESSION): // ---------------------------------------
@@ -744,6 +2185,11 @@ cr_close(CR_FILE *cr_file, GError **err)
             break;
 
         case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
+            if (cr_file->INNERFILE) {
+                ret = cr_gz_mt_close((GzMtFile *) cr_file->FILE, err);
+                break;
+            }
+
             rc = gzclose((gzFile) cr_file->FILE);
             if (rc == Z_OK)
                 ret = CRE_OK;
@@ -812,7 +2258,7 @@ cr_close(CR_FILE *cr_file, GError **err)
                 // Write out rest of buffer
                 while (1) {
                     stream->next_out = (uint8_t*) xz_file->buffer;
-                    stream->avail_out = XZ_BUFFER_SIZE;
+                    stream->avail_out = xz_file->buffer_size;
 
                     rc = lzma_code(stream, LZMA_FINISH);
 
@@ -852,7 +2298,7 @@ cr_close(CR_FILE *cr_file, GError **err)
                         break;
                     }
 
-                    size_t olen = XZ_BUFFER_SIZE - stream->avail_out;
+                    size_t olen = xz_file->buffer_size - stream->avail_out;
                     if (fwrite(xz_file->buffer, 1, olen, xz_file->file) != olen) {
                         // Error while writing
                         ret = CRE_XZ;
@@ -920,6 +2366,31 @@ cr_close(CR_FILE *cr_file, GError **err)
                         "with zchunk support");
             break;
 #endif // WITH_ZCHUNK
+        }
+        case (CR_CW_ZSTD_COMPRESSION): { // -----------------------------------
+#ifdef WITH_ZSTD
+            ZstdFile *zstd_file = (ZstdFile *) cr_file->FILE;
+            ret = CRE_OK;
+
+            if (cr_file->mode == CR_CW_MODE_WRITE) {
+                ZSTD_inBuffer in = { NULL, 0, 0 };
+                if (!cr_zstd_compress(zstd_file, &in, ZSTD_e_end, err))
+                    ret = CRE_ZSTD;
+            }
+
+            if (fclose(zstd_file->file) != 0 && ret == CRE_OK) {
+                ret = CRE_IO;
+                g_set_error(err, ERR_DOMAIN, CRE_IO,
+                            "fclose(): %s", g_strerror(errno));
+            }
+            zstd_file->file = NULL;
+            cr_zstd_file_free(zstd_file);
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            break;
+#endif // WITH_ZSTD
         }
         default: // -----------------------------------------------------------
             ret = CRE_BADARG;
@@ -928,15 +2399,46 @@ cr_close(CR_FILE *cr_file, GError **err)
             break;
     }
 
+    if (flush_err) {
+        if (ret == CRE_OK) {
+            ret = flush_err->code;
+            g_propagate_error(err, flush_err);
+        } else {
+            g_error_free(flush_err);
+        }
+    }
+
     if (cr_file->stat) {
-        g_free(cr_file->stat->checksum);
-        if (cr_file->checksum_ctx)
-            cr_file->stat->checksum = cr_checksum_final(cr_file->checksum_ctx,
+        cr_ContentStat *stat = cr_file->stat;
+
+        g_free(stat->checksum);
+        stat->checksum = NULL;
+        for (guint x = 0; x < stat->checksums_count; x++) {
+            g_free(stat->checksums[x]);
+            stat->checksums[x] = NULL;
+        }
+
+        if (cr_file->checksum_ctx && stat->checksums_count > 0) {
+            gchar **checksums = cr_checksum_multi_final(cr_file->checksum_ctx,
                                                         NULL);
-        else
-            cr_file->stat->checksum = NULL;
+            if (checksums) {
+                for (guint x = 0; x < stat->checksums_count; x++)
+                    stat->checksums[x] = checksums[x];
+                g_free(checksums);
+                stat->checksum = g_strdup(stat->checksums[0]);
+            }
+        } else if (cr_file->checksum_ctx) {
+            stat->checksum = cr_checksum_final(cr_file->checksum_ctx, NULL);
+        }
     }
 
+    // The reading end is closed, the download stops
+    cr_stream_source_free(cr_file->source);
+
+    if (cr_file->mapping)
+        g_mapped_file_unref(cr_file->mapping);
+
+    g_free(cr_file->wbuffer);
     g_free(cr_file);
 
     assert(!err || (ret != CRE_OK && *err != NULL)
@@ -1033,6 +2535,10 @@ cr_read(CR_FILE *cr_file, void *buffer, unsigned int len, GError **err)
         case (CR_CW_XZ_COMPRESSION): { // -------------------------------------
             XzFile *xz_file = (XzFile *) cr_file->FILE;
             lzma_stream *stream = &(xz_file->stream);
+            lzma_action action = LZMA_RUN;
+
+            if (xz_file->eos)
+                return 0;
 
             stream->next_out = buffer;
             stream->avail_out = len;
@@ -1041,22 +2547,26 @@ cr_read(CR_FILE *cr_file, void *buffer, unsigned int len, GError **err)
                 int lret;
 
                 // Fill input buffer
-                if (stream->avail_in == 0) {
-                    if ((lret = fread(xz_file->buffer, 1, XZ_BUFFER_SIZE, xz_file->file)) < 0) {
+                if (stream->avail_in == 0 && action == LZMA_RUN) {
+                    lret = fread(xz_file->buffer, 1, xz_file->buffer_size,
+                                 xz_file->file);
+                    if (ferror(xz_file->file)) {
                         g_debug("%s: XZ: Error while fread", __func__);
                         g_set_error(err, ERR_DOMAIN, CRE_XZ,
                                     "XZ: fread(): %s", g_strerror(errno));
                         return CR_CW_ERR;   // Error while reading input file
                     } else if (lret == 0) {
+                        // EOF - the decoder (especially the threaded one)
+                        // may still have buffered output
                         g_debug("%s: EOF", __func__);
-                        break;   // EOF
+                        action = LZMA_FINISH;
                     }
                     stream->next_in = xz_file->buffer;
                     stream->avail_in = lret;
                 }
 
                 // Decode
-                lret = lzma_code(stream, LZMA_RUN);
+                lret = lzma_code(stream, action);
 
                 if (lret != LZMA_OK && lret != LZMA_STREAM_END) {
                     const char *err_msg;
@@ -1113,8 +2623,10 @@ cr_read(CR_FILE *cr_file, void *buffer, unsigned int len, GError **err)
                     return CR_CW_ERR;  // Error while decoding
                 }
 
-                if (lret == LZMA_STREAM_END)
+                if (lret == LZMA_STREAM_END) {
+                    xz_file->eos = TRUE;
                     break;
+                }
             }
 
             ret = len - stream->avail_out;
@@ -1139,205 +2651,193 @@ cr_read(CR_FILE *cr_file, void *buffer, unsigned int len, GError **err)
 #endif // WITH_ZCHUNK
         }
 
-        default: // -----------------------------------------------------------
-            ret = CR_CW_ERR;
-            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
-                        "Bad compressed file type");
-            break;
-    }
-
-    assert(!err || (ret == CR_CW_ERR && *err != NULL)
-           || (ret != CR_CW_ERR && *err == NULL));
-
-    if (cr_file->stat && ret != CR_CW_ERR) {
-        cr_file->stat->size += ret;
-        if (cr_file->checksum_ctx) {
-            GError *tmp_err = NULL;
-            cr_checksum_update(cr_file->checksum_ctx, buffer, ret, &tmp_err);
-            if (tmp_err) {
-                g_propagate_error(err, tmp_err);
-                return CR_CW_ERR;
-            }
-        }
-    }
-
-    return ret;
-}
-
-
-
-int
-cr_write(CR_FILE *cr_file, const void *buffer, unsigned int len, GError **err)
-{
-    int bzerror;
-    int ret = CR_CW_ERR;
-
-    assert(cr_file);
-    assert(buffer);
-    assert(!err || *err == NULL);
-
-    if (cr_file->mode != CR_CW_MODE_WRITE) {
-        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
-                    "File is not opened in read mode");
-        return ret;
-    }
-
-    if (cr_file->stat) {
-        cr_file->stat->size += len;
-        if (cr_file->checksum_ctx) {
-            GError *tmp_err = NULL;
-            cr_checksum_update(cr_file->checksum_ctx, buffer, len, &tmp_err);
-            if (tmp_err) {
-                g_propagate_error(err, tmp_err);
-                return CR_CW_ERR;
-            }
-        }
-    }
-
-    switch (cr_file->type) {
-
-        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
-            if ((ret = (int) fwrite(buffer, 1, len, (FILE *) cr_file->FILE)) != (int) len) {
-                ret = CR_CW_ERR;
-                g_set_error(err, ERR_DOMAIN, CRE_IO,
-                            "fwrite(): %s", g_strerror(errno));
-            }
-            break;
-
-        case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
-            if (len == 0) {
-                ret = 0;
-                break;
-            }
-
-            if ((ret = gzwrite((gzFile) cr_file->FILE, buffer, len)) == 0) {
-                ret = CR_CW_ERR;
-                g_set_error(err, ERR_DOMAIN, CRE_GZ,
-                    "gzwrite(): %s", cr_gz_strerror((gzFile) cr_file->FILE));
-            }
-            break;
-
-        case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
-            BZ2_bzWrite(&bzerror, (BZFILE *) cr_file->FILE, (void *) buffer, len);
-            if (bzerror == BZ_OK) {
-                ret = len;
-            } else {
-                const char *err_msg;
-                ret = CR_CW_ERR;
-
-                switch (bzerror) {
-                    case BZ_PARAM_ERROR:
-                        // This should not happend
-                        err_msg = "bad function params!";
-                        break;
-                    case BZ_SEQUENCE_ERROR:
-                        // This should not happend
-                        err_msg = "file was opened with BZ2_bzReadOpen";
-                        break;
-                    case BZ_IO_ERROR:
-                        err_msg = "error while reading from the compressed file";
+        case (CR_CW_ZSTD_COMPRESSION): { // -----------------------------------
+#ifdef WITH_ZSTD
+            ZstdFile *zstd_file = (ZstdFile *) cr_file->FILE;
+            ZSTD_outBuffer out = { buffer, len, 0 };
+
+            ret = 0;
+            while (out.pos < out.size) {
+                // A decoder which filled the whole output last time could
+                // still hold some data, let it flush them before reading
+                if (zstd_file->in.pos == zstd_file->in.size
+                    && !zstd_file->output_pending)
+                {
+                    size_t rlen = fread(zstd_file->buffer, 1,
+                                        zstd_file->buffer_size,
+                                        zstd_file->file);
+                    if (rlen == 0 && ferror(zstd_file->file)) {
+                        ret = CR_CW_ERR;
+                        g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                                    "ZSTD: fread(): %s", g_strerror(errno));
                         break;
-                    default:
-                        err_msg = "other error";
-                }
-
-                g_set_error(err, ERR_DOMAIN, CRE_BZ2,
-                            "Bz2 error: %s", err_msg);
-            }
-            break;
-
-        case (CR_CW_XZ_COMPRESSION): { // -------------------------------------
-            XzFile *xz_file = (XzFile *) cr_file->FILE;
-            lzma_stream *stream = &(xz_file->stream);
-
-            ret = len;
-            stream->next_in = buffer;
-            stream->avail_in = len;
-
-            while (stream->avail_in) {
-                int lret;
-                stream->next_out = xz_file->buffer;
-                stream->avail_out = XZ_BUFFER_SIZE;
-                lret = lzma_code(stream, LZMA_RUN);
-                if (lret != LZMA_OK) {
-                    const char *err_msg;
-                    ret = CR_CW_ERR;
-
-                    switch (lret) {
-                        case LZMA_MEM_ERROR:
-                            err_msg = "Memory allocation failed";
-                            break;
-			case LZMA_DATA_ERROR:
-                            // This error is returned if the compressed
-                            // or uncompressed size get near 8 EiB
-                            // (2^63 bytes) because that's where the .xz
-                            // file format size limits currently are.
-                            // That is, the possibility of this error
-                            // is mostly theoretical unless you are doing
-                            // something very unusual.
-                            //
-                            // Note that strm->total_in and strm->total_out
-                            // have nothing to do with this error. Changing
-                            // those variables won't increase or decrease
-                            // the chance of getting this error.
-                            err_msg = "File size limits exceeded";
-                            break;
-			default:
-                            // This is most likely LZMA_PROG_ERROR.
-                            err_msg = "Unknown error, possibly a bug";
-                            break;
                     }
-
-                    g_set_error(err, ERR_DOMAIN, CRE_XZ,
-                                "XZ: lzma_code() error (%d): %s",
-                                lret, err_msg);
-                    break;   // Error while coding
+                    if (rlen == 0) {
+                        if (zstd_file->frame_pending) {
+                            ret = CR_CW_ERR;
+                            g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                                        "ZSTD: Compressed file is truncated");
+                        }
+                        break;  // EOF
+                    }
+                    zstd_file->in.src = zstd_file->buffer;
+                    zstd_file->in.size = rlen;
+                    zstd_file->in.pos = 0;
                 }
 
-                size_t out_len = XZ_BUFFER_SIZE - stream->avail_out;
-                if ((fwrite(xz_file->buffer, 1, out_len, xz_file->file)) != out_len) {
+                size_t rc = ZSTD_decompressStream(zstd_file->dctx, &out,
+                                                  &(zstd_file->in));
+                if (ZSTD_isError(rc)) {
                     ret = CR_CW_ERR;
-                    g_set_error(err, ERR_DOMAIN, CRE_XZ,
-                                "XZ: fwrite(): %s", g_strerror(errno));
-                    break;   // Error while writing
+                    g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                                "ZSTD: Error while decoding: %s",
+                                ZSTD_getErrorName(rc));
+                    break;
                 }
+                zstd_file->frame_pending = (rc != 0);
+                zstd_file->output_pending = (out.pos == out.size);
             }
-
-            break;
-        }
-
-        case (CR_CW_ZCK_COMPRESSION): { // ------------------------------------
-#ifdef WITH_ZCHUNK
-            zckCtx *zck = (zckCtx *) cr_file->FILE;
-            ssize_t wb = zck_write(zck, buffer, len);
-            if (wb < 0) {
-                ret = CR_CW_ERR;
-                g_set_error(err, ERR_DOMAIN, CRE_ZCK,
-                            "ZCK: Unable to write: %s", zck_get_error(zck));
-                break;
-            }
-            ret = wb;
+
+            if (ret != CR_CW_ERR)
+                ret = out.pos;
             break;
 #else
-            g_set_error(err, ERR_DOMAIN, CRE_IO, "createrepo_c wasn't compiled "
-                        "with zchunk support");
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
             break;
-#endif // WITH_ZCHUNK
+#endif // WITH_ZSTD
         }
 
         default: // -----------------------------------------------------------
+            ret = CR_CW_ERR;
             g_set_error(err, ERR_DOMAIN, CRE_BADARG,
                         "Bad compressed file type");
             break;
     }
 
+    if (cr_file->source && (ret == 0 || (ret == CR_CW_ERR &&
+            g_atomic_int_get(&((cr_StreamSource *) cr_file->source)->done))))
+    {
+        // End of a streamed file, a failed download is the reason
+        // of incomplete data
+        GError *source_err = cr_stream_source_finish(cr_file->source);
+        if (source_err) {
+            g_clear_error(err);
+            g_propagate_error(err, source_err);
+            ret = CR_CW_ERR;
+        }
+    }
+
     assert(!err || (ret == CR_CW_ERR && *err != NULL)
            || (ret != CR_CW_ERR && *err == NULL));
 
+    if (cr_file->stat && ret != CR_CW_ERR) {
+        cr_file->stat->size += ret;
+        if (cr_file->checksum_ctx) {
+            GError *tmp_err = NULL;
+            cr_checksum_update(cr_file->checksum_ctx, buffer, ret, &tmp_err);
+            if (tmp_err) {
+                g_propagate_error(err, tmp_err);
+                return CR_CW_ERR;
+            }
+        }
+    }
+
     return ret;
 }
 
 
+const char *
+cr_map(CR_FILE *cr_file, gsize *len, GError **err)
+{
+    GError *tmp_err = NULL;
+    FILE *f;
+    struct stat st;
+    off_t pos;
+    const char *content;
+    gsize size;
+
+    assert(cr_file);
+    assert(len);
+    assert(!err || *err == NULL);
+
+    *len = 0;
+
+    if (cr_file->type != CR_CW_NO_COMPRESSION
+        || cr_file->mode != CR_CW_MODE_READ
+        || cr_file->source
+        || cr_file->mapping)
+        return NULL;
+
+    f = (FILE *) cr_file->FILE;
+    if (fstat(fileno(f), &st) == -1 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    pos = ftello(f);
+    if (pos < 0)
+        return NULL;
+
+    cr_file->mapping = g_mapped_file_new_from_fd(fileno(f), FALSE, &tmp_err);
+    if (!cr_file->mapping) {
+        g_debug("%s: Cannot map the file: %s", __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+        return NULL;
+    }
+
+    // An empty file has no content
+    content = g_mapped_file_get_contents(cr_file->mapping);
+    size = g_mapped_file_get_length(cr_file->mapping);
+    if (!content)
+        content = "";
+    pos = MIN((gsize) pos, size);
+    content += pos;
+    *len = size - pos;
+
+    // The content is consumed, the next cr_read() finds EOF
+    fseeko(f, 0, SEEK_END);
+
+    if (cr_file->stat) {
+        cr_file->stat->size += *len;
+        if (cr_file->checksum_ctx) {
+            cr_checksum_update(cr_file->checksum_ctx, content, *len, &tmp_err);
+            if (tmp_err) {
+                g_propagate_error(err, tmp_err);
+                return NULL;
+            }
+        }
+    }
+
+    return content;
+}
+
+
+int
+cr_write(CR_FILE *cr_file, const void *buffer, unsigned int len, GError **err)
+{
+    assert(cr_file);
+    assert(buffer);
+    assert(!err || *err == NULL);
+
+    if (cr_file->mode != CR_CW_MODE_WRITE) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "File is not opened in read mode");
+        return CR_CW_ERR;
+    }
+
+    if (len > WRITE_BUFFER_SIZE - cr_file->wbuffer_len
+        && cr_write_flush(cr_file, err) != CRE_OK)
+        return CR_CW_ERR;
+
+    if (len >= WRITE_BUFFER_SIZE)
+        return cr_write_direct(cr_file, buffer, len, err);
+
+    if (!cr_file->wbuffer)
+        cr_file->wbuffer = g_malloc(WRITE_BUFFER_SIZE);
+
+    memcpy(cr_file->wbuffer + cr_file->wbuffer_len, buffer, len);
+    cr_file->wbuffer_len += len;
+    return len;
+}
 
 int
 cr_puts(CR_FILE *cr_file, const char *str, GError **err)
@@ -1364,6 +2864,7 @@ cr_puts(CR_FILE *cr_file, const char *str, GError **err)
         case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
         case (CR_CW_XZ_COMPRESSION): // ---------------------------------------
         case (CR_CW_ZCK_COMPRESSION): // --------------------------------------
+        case (CR_CW_ZSTD_COMPRESSION): // -------------------------------------
             len = strlen(str);
             ret = cr_write(cr_file, str, len, err);
             if (ret != (int) len)
@@ -1396,11 +2897,15 @@ cr_end_chunk(CR_FILE *cr_file, GError **err)
         return CR_CW_ERR;
     }
 
+    if (cr_write_flush(cr_file, err) != CRE_OK)
+        return CR_CW_ERR;
+
     switch (cr_file->type) {
         case (CR_CW_NO_COMPRESSION): // ---------------------------------------
         case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
         case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
         case (CR_CW_XZ_COMPRESSION): // ---------------------------------------
+        case (CR_CW_ZSTD_COMPRESSION): // -------------------------------------
             break;
         case (CR_CW_ZCK_COMPRESSION): { // ------------------------------------
 #ifdef WITH_ZCHUNK
@@ -1434,6 +2939,322 @@ cr_end_chunk(CR_FILE *cr_file, GError **err)
     return ret;
 }
 
+int
+cr_end_member(CR_FILE *cr_file, GError **err)
+{
+    int ret = CRE_OK;
+
+    assert(cr_file);
+    assert(!err || *err == NULL);
+
+    if (cr_file->mode != CR_CW_MODE_WRITE) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "File is not opened in write mode");
+        return CR_CW_ERR;
+    }
+
+    if (cr_write_flush(cr_file, err) != CRE_OK)
+        return CR_CW_ERR;
+
+    switch (cr_file->type) {
+        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
+        case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
+        case (CR_CW_XZ_COMPRESSION): // ---------------------------------------
+        case (CR_CW_ZCK_COMPRESSION): // --------------------------------------
+            break;
+
+        case (CR_CW_GZ_COMPRESSION): { // -------------------------------------
+            if (cr_file->INNERFILE) {
+                if (!cr_gz_mt_end_member((GzMtFile *) cr_file->FILE, err))
+                    ret = CR_CW_ERR;
+                break;
+            }
+
+            // The next gzwrite() starts a new gzip member
+            int rc = gzflush((gzFile) cr_file->FILE, Z_FINISH);
+            if (rc != Z_OK) {
+                int errnum;
+                const char *err_msg = gzerror((gzFile) cr_file->FILE, &errnum);
+                g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                            "gzflush(): %s", err_msg);
+                ret = CR_CW_ERR;
+            }
+            break;
+        }
+
+        case (CR_CW_ZSTD_COMPRESSION): { // -----------------------------------
+#ifdef WITH_ZSTD
+            // The next write starts a new frame
+            ZSTD_inBuffer in = { NULL, 0, 0 };
+            if (!cr_zstd_compress((ZstdFile *) cr_file->FILE, &in,
+                                  ZSTD_e_end, err))
+                ret = CR_CW_ERR;
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            ret = CR_CW_ERR;
+            break;
+#endif // WITH_ZSTD
+        }
+
+        default: // -----------------------------------------------------------
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Bad compressed file type");
+            return CR_CW_ERR;
+    }
+
+    assert(!err || (ret == CR_CW_ERR && *err != NULL)
+           || (ret != CR_CW_ERR && *err == NULL));
+
+    return ret;
+}
+
+gint64
+cr_read_first_member(const char *filename,
+                     cr_CompressionType type,
+                     gsize max_len,
+                     gchar **content,
+                     gsize *content_len,
+                     GError **err)
+{
+    gint64 ret = 0;
+    unsigned char *out;
+    FILE *f;
+
+    assert(filename);
+    assert(content);
+    assert(content_len);
+    assert(!err || *err == NULL);
+
+    *content = NULL;
+    *content_len = 0;
+
+    if (type != CR_CW_GZ_COMPRESSION && type != CR_CW_ZSTD_COMPRESSION)
+        return 0;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "fopen(): %s", g_strerror(errno));
+        return -1;
+    }
+
+    // One more byte to recognize a member longer than max_len
+    out = g_malloc(max_len + 1);
+
+    if (type == CR_CW_GZ_COMPRESSION) {
+        unsigned char in[4096];
+        z_stream strm;
+        int rc;
+
+        memset(&strm, 0, sizeof(strm));
+        // Gzip wrapper, inflate() stops at the end of the first member
+        rc = inflateInit2(&strm, 16 + MAX_WBITS);
+        strm.next_out = out;
+        strm.avail_out = max_len + 1;
+        while (rc == Z_OK && strm.avail_out) {
+            if (strm.avail_in == 0) {
+                strm.avail_in = fread(in, 1, sizeof(in), f);
+                strm.next_in = in;
+                if (strm.avail_in == 0)
+                    break;  // Truncated, let the caller's reader fail
+            }
+            rc = inflate(&strm, Z_NO_FLUSH);
+        }
+
+        if (rc == Z_STREAM_END && strm.total_out <= max_len) {
+            *content_len = strm.total_out;
+            ret = strm.total_in;
+        } else if (rc != Z_OK && rc != Z_STREAM_END) {
+            g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                        "inflate(): %s", strm.msg ? strm.msg : zError(rc));
+            ret = -1;
+        }
+        inflateEnd(&strm);
+    }
+#ifdef WITH_ZSTD
+    else {
+        // A frame of max_len bytes of content cannot be longer
+        // (the bound plus room for the content checksum)
+        size_t in_size = ZSTD_compressBound(max_len) + 32;
+        unsigned char *in = g_malloc(in_size);
+        size_t in_len = fread(in, 1, in_size, f);
+        size_t frame_len = ZSTD_findFrameCompressedSize(in, in_len);
+
+        if (!ZSTD_isError(frame_len)) {
+            size_t out_len = ZSTD_decompress(out, max_len + 1, in, frame_len);
+            if (ZSTD_isError(out_len) || out_len > max_len) {
+                // Too long or broken, let the caller's reader decide
+            } else {
+                *content_len = out_len;
+                ret = frame_len;
+            }
+        }
+        g_free(in);
+    }
+#endif // WITH_ZSTD
+
+    if (ferror(f) && ret != -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "fread(): %s", g_strerror(errno));
+        ret = -1;
+    }
+    fclose(f);
+
+    if (ret > 0)
+        *content = (gchar *) out;
+    else
+        g_free(out);
+
+    return ret;
+}
+
+gint64
+cr_member_offset(CR_FILE *cr_file, GError **err)
+{
+    off_t offset = -1;
+
+    assert(cr_file);
+    assert(!err || *err == NULL);
+
+    if (cr_file->mode != CR_CW_MODE_WRITE) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "File is not opened in write mode");
+        return -1;
+    }
+
+    if (cr_write_flush(cr_file, err) != CRE_OK)
+        return -1;
+
+    switch (cr_file->type) {
+        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
+            offset = ftello((FILE *) cr_file->FILE);
+            break;
+
+        case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
+            if (cr_file->INNERFILE) {
+                // The header of the next member was already written
+                offset = ftello((FILE *) cr_file->INNERFILE);
+                if (offset >= 0)
+                    offset -= GZ_MT_HEADER_LEN;
+                break;
+            }
+
+            // Everything up to the end of the member was flushed
+            // and the next member starts with the next gzwrite()
+            offset = gzoffset((gzFile) cr_file->FILE);
+            break;
+
+        case (CR_CW_ZSTD_COMPRESSION): // -------------------------------------
+#ifdef WITH_ZSTD
+            offset = ftello(((ZstdFile *) cr_file->FILE)->file);
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            return -1;
+#endif // WITH_ZSTD
+
+        default: // -----------------------------------------------------------
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Compression type %s has no members",
+                        cr_compression_suffix(cr_file->type));
+            return -1;
+    }
+
+    if (offset < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot get the offset: %s", g_strerror(errno));
+        return -1;
+    }
+
+    return offset;
+}
+
+gboolean
+cr_decompress_member(cr_CompressionType type,
+                     const void *in,
+                     gsize in_len,
+                     void *out,
+                     gsize out_len,
+                     GError **err)
+{
+    assert(in || in_len == 0);
+    assert(out || out_len == 0);
+    assert(!err || *err == NULL);
+
+    switch (type) {
+        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
+            if (in_len != out_len)
+                break;
+            memcpy(out, in, out_len);
+            return TRUE;
+
+        case (CR_CW_GZ_COMPRESSION): { // -------------------------------------
+            z_stream strm;
+            int rc;
+            gboolean ok;
+
+            if (in_len > G_MAXUINT || out_len > G_MAXUINT)
+                break;
+
+            memset(&strm, 0, sizeof(strm));
+            rc = inflateInit2(&strm, 16 + MAX_WBITS);
+            if (rc != Z_OK) {
+                g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                            "inflateInit2(): %s", zError(rc));
+                return FALSE;
+            }
+            strm.next_in = (unsigned char *) in;
+            strm.avail_in = in_len;
+            strm.next_out = out;
+            strm.avail_out = out_len;
+            // One member exactly fills the output
+            rc = inflate(&strm, Z_FINISH);
+            ok = rc == Z_STREAM_END && strm.avail_in == 0
+                 && strm.avail_out == 0;
+            inflateEnd(&strm);
+            if (ok)
+                return TRUE;
+            if (rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                g_set_error(err, ERR_DOMAIN, CRE_GZ,
+                            "inflate(): %s", strm.msg ? strm.msg : zError(rc));
+                return FALSE;
+            }
+            break;
+        }
+
+        case (CR_CW_ZSTD_COMPRESSION): { // -----------------------------------
+#ifdef WITH_ZSTD
+            size_t len = ZSTD_decompress(out, out_len, in, in_len);
+            if (ZSTD_isError(len)) {
+                g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                            "ZSTD_decompress(): %s", ZSTD_getErrorName(len));
+                return FALSE;
+            }
+            if (len == out_len)
+                return TRUE;
+            break;
+#else
+            g_set_error(err, ERR_DOMAIN, CRE_ZSTD, "createrepo_c wasn't "
+                        "compiled with zstd support");
+            return FALSE;
+#endif // WITH_ZSTD
+        }
+
+        default: // -----------------------------------------------------------
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Compression type %s has no members",
+                        cr_compression_suffix(type));
+            return FALSE;
+    }
+
+    g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                "The member has not the expected size");
+    return FALSE;
+}
+
 int
 cr_set_autochunk(CR_FILE *cr_file, gboolean auto_chunk, GError **err)
 {
@@ -1448,11 +3269,15 @@ cr_set_autochunk(CR_FILE *cr_file, gboolean auto_chunk, GError **err)
         return CR_CW_ERR;
     }
 
+    if (cr_write_flush(cr_file, err) != CRE_OK)
+        return CR_CW_ERR;
+
     switch (cr_file->type) {
         case (CR_CW_NO_COMPRESSION): // ---------------------------------------
         case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
         case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
         case (CR_CW_XZ_COMPRESSION): // ---------------------------------------
+        case (CR_CW_ZSTD_COMPRESSION): // -------------------------------------
             break;
         case (CR_CW_ZCK_COMPRESSION): { // ------------------------------------
 #ifdef WITH_ZCHUNK
@@ -1487,7 +3312,7 @@ cr_set_autochunk(CR_FILE *cr_file, gboolean auto_chunk, GError **err)
 int
 cr_printf(GError **err, CR_FILE *cr_file, const char *format, ...)
 {
-    va_list vl;
+    va_list vl, vl_copy;
     int ret;
     gchar *buf = NULL;
 
@@ -1503,11 +3328,27 @@ cr_printf(GError **err, CR_FILE *cr_file, const char *format, ...)
         return CR_CW_ERR;
     }
 
-    // Fill format string
+    if (!cr_file->wbuffer)
+        cr_file->wbuffer = g_malloc(WRITE_BUFFER_SIZE);
+
+    // Fill format string straight into the write buffer if it fits there
     va_start(vl, format);
-    ret = g_vasprintf(&buf, format, vl);
+    va_copy(vl_copy, vl);
+    ret = g_vsnprintf(cr_file->wbuffer + cr_file->wbuffer_len,
+                      WRITE_BUFFER_SIZE - cr_file->wbuffer_len,
+                      format, vl);
     va_end(vl);
 
+    if (ret >= 0 && (size_t) ret < WRITE_BUFFER_SIZE - cr_file->wbuffer_len) {
+        cr_file->wbuffer_len += ret;
+        va_end(vl_copy);
+        return ret;
+    }
+
+    if (ret >= 0)
+        ret = g_vasprintf(&buf, format, vl_copy);
+    va_end(vl_copy);
+
     if (ret < 0) {
         g_debug("%s: vasprintf() call failed", __func__);
         g_set_error(err, ERR_DOMAIN, CRE_MEMORY,
@@ -1518,26 +3359,8 @@ cr_printf(GError **err, CR_FILE *cr_file, const char *format, ...)
 
     assert(buf);
 
-    int tmp_ret;
-
-    switch (cr_file->type) {
-
-        case (CR_CW_NO_COMPRESSION): // ---------------------------------------
-        case (CR_CW_GZ_COMPRESSION): // ---------------------------------------
-        case (CR_CW_BZ2_COMPRESSION): // --------------------------------------
-        case (CR_CW_XZ_COMPRESSION): // ---------------------------------------
-        case (CR_CW_ZCK_COMPRESSION): // --------------------------------------
-            tmp_ret = cr_write(cr_file, buf, ret, err);
-            if (tmp_ret != (int) ret)
-                ret = CR_CW_ERR;
-            break;
-
-        default: // -----------------------------------------------------------
-            ret = CR_CW_ERR;
-            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
-                        "Bad compressed file type");
-            break;
-    }
+    if (cr_write(cr_file, buf, ret, err) != ret)
+        ret = CR_CW_ERR;
 
     g_free(buf);
 
@@ -1576,3 +3399,76 @@ cr_get_zchunk_with_index(CR_FILE *cr_file, ssize_t zchunk_index, char **copy_buf
     return 0;
 #endif // WITH_ZCHUNK
 }
+
+#define CR_ZCK_DICT_SAMPLES_FACTOR      100
+
+gchar *
+cr_zck_train_dict(const char *filename,
+                  gsize dict_size,
+                  gsize *out_size,
+                  GError **err)
+{
+    assert(filename);
+    assert(dict_size > 0);
+    assert(out_size);
+    assert(!err || *err == NULL);
+
+#if defined(WITH_ZCHUNK) && defined(WITH_ZSTD)
+    GError *tmp_err = NULL;
+    CR_FILE *f = cr_open(filename, CR_CW_MODE_READ, CR_CW_ZCK_COMPRESSION,
+                         &tmp_err);
+    if (!f) {
+        g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ", filename);
+        return NULL;
+    }
+
+    GByteArray *samples = g_byte_array_new();
+    GArray *sample_sizes = g_array_new(FALSE, FALSE, sizeof(size_t));
+    gsize max_samples = dict_size * CR_ZCK_DICT_SAMPLES_FACTOR;
+
+    // The first chunk is the dictionary of the file
+    for (ssize_t idx = 1; samples->len < max_samples; idx++) {
+        char *chunk = NULL;
+        ssize_t len = cr_get_zchunk_with_index(f, idx, &chunk, &tmp_err);
+        if (len > 0) {
+            size_t sample_size = len;
+            g_byte_array_append(samples, (guint8 *) chunk, len);
+            g_array_append_val(sample_sizes, sample_size);
+        }
+        g_free(chunk);
+        if (len <= 0)
+            break;
+    }
+    cr_close(f, NULL);
+
+    gchar *dict = NULL;
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "Cannot read chunks of %s: ",
+                                   filename);
+        goto train_dict_cleanup;
+    }
+
+    dict = g_malloc(dict_size);
+    size_t ret = ZDICT_trainFromBuffer(dict, dict_size, samples->data,
+                                       (size_t *) sample_sizes->data,
+                                       sample_sizes->len);
+    if (ZDICT_isError(ret)) {
+        g_set_error(err, ERR_DOMAIN, CRE_ZSTD,
+                    "Cannot train a dictionary from %u chunks of %s: %s",
+                    sample_sizes->len, filename, ZDICT_getErrorName(ret));
+        g_free(dict);
+        dict = NULL;
+        goto train_dict_cleanup;
+    }
+    *out_size = ret;
+
+train_dict_cleanup:
+    g_byte_array_free(samples, TRUE);
+    g_array_free(sample_sizes, TRUE);
+    return dict;
+#else
+    g_set_error(err, ERR_DOMAIN, CRE_IO, "createrepo_c wasn't compiled "
+                "with zchunk and zstd support");
+    return NULL;
+#endif // WITH_ZCHUNK && WITH_ZSTD
+}
@@ -42,6 +42,7 @@ typedef enum {
     CR_CW_BZ2_COMPRESSION,            /*!< BZip2 compression */
     CR_CW_XZ_COMPRESSION,             /*!< XZ compression */
     CR_CW_ZCK_COMPRESSION,            /*!< ZCK compression */
+    CR_CW_ZSTD_COMPRESSION,           /*!< Zstandard compression */
     CR_CW_COMPRESSION_SENTINEL,       /*!< Sentinel of the list */
 } cr_CompressionType;
 
@@ -62,6 +63,13 @@ typedef struct {
     gint64          hdr_size;           /*!< Size of content */
     cr_ChecksumType hdr_checksum_type;  /*!< Checksum type */
     char            *hdr_checksum;      /*!< Checksum */
+    guint           checksums_count;    /*!< Number of items in
+                                             checksum_types (0 if only
+                                             checksum_type is used) */
+    cr_ChecksumType checksum_types[CR_CHECKSUM_MULTI_MAX]; /*!< All checksum
+                                             types calculated in one pass */
+    char            *checksums[CR_CHECKSUM_MULTI_MAX]; /*!< Checksums in the
+                                             order of checksum_types */
 } cr_ContentStat;
 
 /** Creates new cr_ContentStat object
@@ -72,6 +80,26 @@ typedef struct {
  */
 cr_ContentStat *cr_contentstat_new(cr_ChecksumType type, GError **err);
 
+/** Creates new cr_ContentStat object which calculates several checksums
+ * of the content at once.
+ * @param types     Types of checksums. The first one is used as
+ *                  the checksum_type.
+ * @param count     Number of items in types (1 - CR_CHECKSUM_MULTI_MAX)
+ * @param err       GError **
+ * @return          cr_ContentStat object or NULL on error
+ */
+cr_ContentStat *cr_contentstat_multi_new(const cr_ChecksumType *types,
+                                         guint count,
+                                         GError **err);
+
+/** Return checksum of the specified type.
+ * @param cstat     cr_ContentStat object
+ * @param type      Type of checksum
+ * @return          Checksum or NULL if it wasn't calculated
+ */
+const char *cr_contentstat_checksum(cr_ContentStat *cstat,
+                                    cr_ChecksumType type);
+
 /** Frees cr_ContentStat object.
  * @param cstat     cr_ContentStat object
  * @param err       GError **
@@ -87,10 +115,29 @@ typedef struct {
     cr_OpenMode         mode;           /*!< Mode */
     cr_ContentStat      *stat;          /*!< Content stats */
     cr_ChecksumCtx      *checksum_ctx;  /*!< Checksum contenxt */
+    void                *source;        /*!< Download of a file opened
+                                             by cr_sopen_url() or NULL */
+    void                *mapping;       /*!< GMappedFile of cr_map()
+                                             or NULL */
+    char                *wbuffer;       /*!< Small writes not passed
+                                             to the compression yet
+                                             or NULL */
+    size_t              wbuffer_len;    /*!< Used size of the wbuffer */
 } CR_FILE;
 
 #define CR_CW_ERR       -1      /*!< Return value - Error */
 
+#define CR_CW_MAX_COMPRESSION_THREADS   256 /*!< Max threads per file */
+
+#define CR_CW_DEFAULT_BUFFER_SIZE   (1024*128)      /*!< Default I/O buffer */
+#define CR_CW_MIN_BUFFER_SIZE       (1024*4)        /*!< Min I/O buffer */
+#define CR_CW_MAX_BUFFER_SIZE       (1024*1024*64)  /*!< Max I/O buffer */
+
+/** Environment variable with the I/O buffer size used when it is not set
+ * by cr_set_io_buffer_size() - in bytes, K and M suffixes are accepted.
+ */
+#define CR_CW_BUFFER_SIZE_ENV       "CREATEREPO_C_IO_BUFFER_SIZE"
+
 /** Returns a common suffix for the specified cr_CompressionType.
  * @param comtype       compression type
  * @return              common file suffix
@@ -110,6 +157,179 @@ cr_CompressionType cr_detect_compression(const char* filename, GError **err);
  */
 cr_CompressionType cr_compression_type(const char *name);
 
+/** Settings of the compression (levels and threads) of the opened files.
+ *
+ * The files are opened by the settings of the opening thread, those
+ * pushed by cr_compression_settings_push_thread_default() or the process
+ * defaults (cr_compression_set_level(), ...) if there are none. So
+ * a pipeline which has its own settings (e.g. a createrepo_c run) pushes
+ * them in every thread working for it and doesn't touch the process
+ * defaults used by the others.
+ */
+typedef struct _cr_CompressionSettings cr_CompressionSettings;
+
+/** New settings with the default levels and threads of createrepo_c.
+ * @return              settings
+ */
+cr_CompressionSettings *cr_compression_settings_new(void);
+
+/** Free the settings.
+ * @param settings      settings or NULL
+ */
+void cr_compression_settings_free(cr_CompressionSettings *settings);
+
+/** Make the settings the thread default of the calling thread, the files
+ * it opens afterwards use them. The settings must not be changed nor
+ * freed until the matching cr_compression_settings_pop_thread_default().
+ * The calls can nest.
+ * @param settings      settings, NULL - the process defaults
+ */
+void cr_compression_settings_push_thread_default(
+                                    cr_CompressionSettings *settings);
+
+/** Undo the cr_compression_settings_push_thread_default() of the settings.
+ * @param settings      settings of the matching push
+ */
+void cr_compression_settings_pop_thread_default(
+                                    cr_CompressionSettings *settings);
+
+/** Get the thread default settings of the calling thread.
+ * @return              settings or NULL if the thread uses the process
+ *                      defaults
+ */
+cr_CompressionSettings *cr_compression_settings_get_thread_default(void);
+
+/** The same as cr_zstd_set_params(), but of the settings.
+ * @param settings      settings
+ * @param level         see cr_zstd_set_params()
+ * @param window_log    see cr_zstd_set_params()
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean cr_compression_settings_set_zstd_params(
+                                    cr_CompressionSettings *settings,
+                                    int level,
+                                    int window_log,
+                                    GError **err);
+
+/** The same as cr_compression_set_level(), but of the settings.
+ * @param settings      settings
+ * @param type          see cr_compression_set_level()
+ * @param level         see cr_compression_set_level()
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean cr_compression_settings_set_level(cr_CompressionSettings *settings,
+                                           cr_CompressionType type,
+                                           int level,
+                                           GError **err);
+
+/** The same as cr_compression_set_threads(), but of the settings.
+ * @param settings      settings
+ * @param threads       see cr_compression_set_threads()
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean cr_compression_settings_set_threads(cr_CompressionSettings *settings,
+                                             unsigned int threads,
+                                             GError **err);
+
+/** The same as cr_decompression_set_threads(), but of the settings.
+ * @param settings      settings
+ * @param threads       see cr_decompression_set_threads()
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean cr_compression_settings_set_decompression_threads(
+                                    cr_CompressionSettings *settings,
+                                    unsigned int threads,
+                                    GError **err);
+
+/** Set parameters of the zstd compression of files which will be opened
+ * for writing afterwards (the process defaults, see
+ * cr_CompressionSettings). This function is not thread safe, call it
+ * before the files are opened.
+ * @param level         compression level (1 - 19 or more, see zstd,
+ *                      0 - the default level of createrepo_c)
+ * @param window_log    log2 of the window size for long distance
+ *                      matching (e.g. 27 - 128 MiB, decompressors accept
+ *                      windows up to 27 by default), 0 - disabled
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if the parameters are out
+ *                      of range or zstd support wasn't compiled in
+ */
+gboolean cr_zstd_set_params(int level, int window_log, GError **err);
+
+#define CR_CW_DEFAULT_COMPRESSION_LEVEL (-1) /*!< Default level of the type */
+
+/** Set the compression level of files of the type which will be opened
+ * for writing afterwards (the process defaults). Lower levels trade the compression ratio for
+ * speed (see bench_compression in tests/ to compare them on a repo).
+ * This function is not thread safe, call it before the files are opened.
+ * @param type          CR_CW_GZ_COMPRESSION (1 - 9), CR_CW_BZ2_COMPRESSION
+ *                      (1 - 9, the block size in 100 kB),
+ *                      CR_CW_XZ_COMPRESSION (0 - 9) or
+ *                      CR_CW_ZSTD_COMPRESSION (1 - 19 or more, see zstd)
+ * @param level         compression level, CR_CW_DEFAULT_COMPRESSION_LEVEL
+ *                      - the default level of createrepo_c
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if the level is out of range
+ *                      or the type has no levels
+ */
+gboolean cr_compression_set_level(cr_CompressionType type,
+                                  int level,
+                                  GError **err);
+
+/** Get the compression level of files of the type opened for writing
+ * by the calling thread.
+ * @param type          compression type
+ * @return              compression level (Z_DEFAULT_COMPRESSION for
+ *                      the default gz level),
+ *                      CR_CW_DEFAULT_COMPRESSION_LEVEL if the type has
+ *                      no levels
+ */
+int cr_compression_level(cr_CompressionType type);
+
+/** Set the number of threads which compress a single gzip or xz file
+ * opened for writing afterwards (the process defaults). Gzip files are compressed in
+ * independent blocks (like pigz does) and xz files by the liblzma
+ * threaded encoder, both are readable by any decompressor.
+ * This function is not thread safe, call it before the files are opened.
+ * @param threads       number of threads (0 or 1 - compress in the thread
+ *                      which writes the file)
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if the number is too big
+ */
+gboolean cr_compression_set_threads(unsigned int threads, GError **err);
+
+/** Set the number of threads which decompress a single xz file opened
+ * for reading afterwards (the process defaults). Files of multiple blocks (written by a threaded
+ * encoder, e.g. xz -T or cr_compression_set_threads()) are decoded
+ * in parallel by the liblzma (>= 5.4.0) threaded decoder.
+ * This function is not thread safe, call it before the files are opened.
+ * @param threads       number of threads (0 - one per CPU, the default;
+ *                      1 - decompress in the thread which reads the file)
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if the number is too big
+ */
+gboolean cr_decompression_set_threads(unsigned int threads, GError **err);
+
+/** Set the size of I/O buffers of files opened afterwards. It is the size
+ * of the buffer of the underlying file, of the zlib buffer and of the xz
+ * coder buffer, and the size of blocks the xml parsers read.
+ * This function is not thread safe, call it before the files are opened.
+ * @param size          buffer size in bytes, 0 - the default size
+ *                      (CR_CW_BUFFER_SIZE_ENV or CR_CW_DEFAULT_BUFFER_SIZE)
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if the size is out of range
+ */
+gboolean cr_set_io_buffer_size(gsize size, GError **err);
+
+/** Get the size of I/O buffers.
+ * @return              buffer size in bytes
+ */
+gsize cr_get_io_buffer_size(void);
+
 /** Open/Create the specified file.
  * @param FILENAME      filename
  * @param MODE          open mode
@@ -136,6 +356,35 @@ CR_FILE *cr_sopen(const char *filename,
                   cr_ContentStat *stat,
                   GError **err);
 
+/** Open a remote file for reading. The file is downloaded by a separate
+ * thread while it is read, so the decompression and parsing overlap
+ * the transfer and no temporary file is needed. cr_sopen() opens
+ * an URL filename this way. Zchunk files cannot be streamed.
+ * An error of the download is reported by cr_read() at the end of
+ * the data.
+ * @param url           http://, https:// or ftp:// URL
+ * @param comtype       type of compression (CR_CW_AUTO_DETECT_COMPRESSION
+ *                      detects it by the suffix of the url only)
+ * @param tee_path      if not NULL, the downloaded (compressed) data are
+ *                      stored into this file too. It is created only if
+ *                      the whole file is downloaded.
+ * @param stat          pointer to cr_ContentStat or NULL
+ * @param err           GError **
+ * @return              pointer to a CR_FILE or NULL
+ */
+CR_FILE *cr_sopen_url(const char *url,
+                      cr_CompressionType comtype,
+                      const char *tee_path,
+                      cr_ContentStat *stat,
+                      GError **err);
+
+/** Check if the filename is an URL of a remote file (http://, https://
+ * or ftp://).
+ * @param filename      filename
+ * @return              TRUE if the filename is an URL
+ */
+gboolean cr_is_url(const char *filename);
+
 /** Sets the compression dictionary for a file
  * @param cr_file       CR_FILE pointer
  * @param dict          dictionary
@@ -154,7 +403,25 @@ int cr_set_dict(CR_FILE *cr_file, const void *dict, unsigned int len, GError **e
  */
 int cr_read(CR_FILE *cr_file, void *buffer, unsigned int len, GError **err);
 
+/** Map the rest of an uncompressed local file opened for reading into
+ * memory. The whole rest is consumed at once, the next cr_read() returns
+ * 0 (EOF). The content stats are updated as by cr_read().
+ * @param cr_file       CR_FILE pointer
+ * @param len           length of the returned content
+ * @param err           GError **
+ * @return              content (not NULL terminated) valid until
+ *                      the cr_close(), or NULL if the file cannot be
+ *                      mapped (compressed, not a regular file, ...),
+ *                      err is set only on an error of the stats,
+ *                      otherwise cr_read() has to be used
+ */
+const char *cr_map(CR_FILE *cr_file, gsize *len, GError **err);
+
 /** Writes the array of len bytes from buffer to the cr_file.
+ * Small writes are collected in a buffer of the cr_file and passed
+ * to the checksums and to the compression together, so an error
+ * of the compression could be reported by a later call (at the latest
+ * by cr_close()).
  * @param cr_file       CR_FILE pointer
  * @param buffer        source buffer
  * @param len           number of bytes to read
@@ -182,6 +449,63 @@ int cr_puts(CR_FILE *cr_file, const char *str, GError **err);
  */
 int cr_end_chunk(CR_FILE *cr_file, GError **err);
 
+/** End the current independently compressed part of the file - a gzip
+ * member or a zstd frame - the following writes start a new one.
+ * Standard decompressors read such parts as one content. It is a no-op
+ * for the other compression types.
+ * @param cr_file       CR_FILE pointer
+ * @param err           GError **
+ * @return              CRE_OK or CR_CW_ERR
+ */
+int cr_end_member(CR_FILE *cr_file, GError **err);
+
+/** Decompress the first gzip member or zstd frame of a file.
+ * @param filename      filename
+ * @param type          CR_CW_GZ_COMPRESSION or CR_CW_ZSTD_COMPRESSION
+ * @param max_len       max length of the uncompressed member content
+ * @param content       uncompressed content (not NULL terminated),
+ *                      free it with g_free()
+ * @param content_len   length of the content
+ * @param err           GError **
+ * @return              compressed size of the member, 0 if the file
+ *                      type has no members or the first member has more
+ *                      than max_len bytes, -1 on error
+ */
+gint64 cr_read_first_member(const char *filename,
+                            cr_CompressionType type,
+                            gsize max_len,
+                            gchar **content,
+                            gsize *content_len,
+                            GError **err);
+
+/** Compressed offset of the next gzip member or zstd frame, or of the next
+ * byte of an uncompressed file. Right after cr_end_member() it is where
+ * the next independently compressed part of the file starts.
+ * @param cr_file       CR_FILE pointer opened for writing
+ * @param err           GError **
+ * @return              offset or -1 on error (also for the compression
+ *                      types without members)
+ */
+gint64 cr_member_offset(CR_FILE *cr_file, GError **err);
+
+/** Decompress one gzip member or zstd frame (or copy an uncompressed
+ * part of a file) of a known size.
+ * @param type          CR_CW_GZ_COMPRESSION, CR_CW_ZSTD_COMPRESSION
+ *                      or CR_CW_NO_COMPRESSION
+ * @param in            compressed member
+ * @param in_len        length of the member
+ * @param out           buffer for the content
+ * @param out_len       exact length of the content
+ * @param err           GError **
+ * @return              TRUE if the content has exactly out_len bytes
+ */
+gboolean cr_decompress_member(cr_CompressionType type,
+                              const void *in,
+                              gsize in_len,
+                              void *out,
+                              gsize out_len,
+                              GError **err);
+
 /** Set zchunk auto-chunk algorithm.  Must be done before first byte is written
  * @param cr_file       CR_FILE pointer
  * @param auto_chunk    Whether auto-chunking should be enabled
@@ -199,6 +523,23 @@ int cr_set_autochunk(CR_FILE *cr_file, gboolean auto_chunk, GError **err);
  */
 ssize_t cr_get_zchunk_with_index(CR_FILE *f, ssize_t zchunk_index, char **copy_buf, GError **err);
 
+/** Default size of zchunk dictionaries trained by cr_zck_train_dict() */
+#define CR_ZCK_DEFAULT_DICT_SIZE        (110*1024)
+
+/** Train a zstd dictionary from the chunks of a zchunk file.
+ * Up to 100 times dict_size bytes of the chunks are used as samples.
+ * @param filename      path to the zchunk file
+ * @param dict_size     max size of the dictionary
+ * @param out_size      size of the trained dictionary
+ * @param err           GError **
+ * @return              dictionary (free it with g_free()) or NULL,
+ *                      e.g. if the file hasn't enough chunks
+ */
+gchar *cr_zck_train_dict(const char *filename,
+                         gsize dict_size,
+                         gsize *out_size,
+                         GError **err);
+
 /** Writes a formatted string into the cr_file.
  * @param err           GError **
  * @param cr_file       CR_FILE pointer
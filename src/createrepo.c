@@ -0,0 +1,4365 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "blockindex.h"
+#include "cmd_parser.h"
+#include "compression_wrapper.h"
+#include "createrepo.h"
+#include "createrepo_internal.h"
+#include "createrepo_shared.h"
+
+#include "deltarpms.h"
+#include "dumper_thread.h"
+#include "checksum.h"
+#include "cleanup.h"
+#include "error.h"
+#include "helpers.h"
+#include "load_metadata.h"
+#include "metadata_internal.h"
+#include "locate_metadata.h"
+#include "metrics.h"
+#include "misc.h"
+#include "parsepkg.h"
+#include "pkgcache.h"
+#include "remotepkg.h"
+#include "repomd.h"
+#include "shard.h"
+#include "sqlite.h"
+#include "threads.h"
+#include "version.h"
+#include "xml_dump.h"
+#include "xml_file.h"
+#include "xml_parser.h"
+
+#ifdef WITH_LIBMODULEMD
+#include <modulemd.h>
+#endif /* WITH_LIBMODULEMD */
+
+#define ERR_DOMAIN                  CREATEREPO_C_ERROR
+#define OUTDELTADIR "drpms/"
+#define ADDITIONAL_METADATA_THREADS 3
+#define PARALLEL_SORT_MIN_PART      32768   // Min tasks sorted by a thread
+#define AUTOSCALE_INTERVAL          (100 * 1000) // Period of the updates of
+                                                 // the number of workers (us)
+
+/** Check if the filename is excluded by any exclude mask.
+ * @param filename      Filename (basename).
+ * @param exclude_masks Compiled exclude masks or NULL
+ * @return              TRUE if file should be included, FALSE otherwise
+ */
+static gboolean
+allowed_file(const gchar *filename, const cr_GlobSet *exclude_masks)
+{
+    // Check file against exclude glob masks
+    if (cr_globset_match(exclude_masks, filename)) {
+        g_debug("Exclude masks hit - skipping: %s", filename);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+allowed_modulemd_module_metadata_file(const gchar *filename)
+{
+    if (g_strrstr(filename, "modules.yaml"))
+        return TRUE;
+    if (g_strrstr(filename, ".modulemd.yaml"))
+        return TRUE;
+    if (g_strrstr(filename, ".modulemd-defaults.yaml"))
+        return TRUE;
+
+    return FALSE;
+}
+
+#ifdef WITH_LIBMODULEMD
+/** Path of the merged module metadata of the files in the cache dir.
+ * The filename is a checksum of the libmodulemd version and of the
+ * checksums of the files (in their order), so a cached file is used only
+ * when none of the inputs changed.
+ * @param cachedir      Cache directory or NULL (no caching)
+ * @param paths         Paths to the module metadata files (gchar *)
+ * @return              Newly allocated path or NULL if the cache is
+ *                      not used
+ */
+static gchar *
+modules_cache_path(const gchar *cachedir, GPtrArray *paths)
+{
+    if (!cachedir)
+        return NULL;
+
+    GString *key = g_string_new(modulemd_get_version());
+    for (guint x = 0; x < paths->len; x++) {
+        GError *tmp_err = NULL;
+        const gchar *path = g_ptr_array_index(paths, x);
+        char *checksum = cr_checksum_file(path, CR_CHECKSUM_SHA256, &tmp_err);
+        if (!checksum) {
+            g_debug("Module metadata are not cached - cannot checksum %s: %s",
+                    path, tmp_err->message);
+            g_clear_error(&tmp_err);
+            g_string_free(key, TRUE);
+            return NULL;
+        }
+        g_string_append_printf(key, "\n%s", checksum);
+        g_free(checksum);
+    }
+
+    gchar *key_checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                                        key->str, key->len);
+    gchar *filename = g_strconcat("modules-", key_checksum, ".yaml", NULL);
+    gchar *path = g_build_filename(cachedir, filename, NULL);
+    g_free(filename);
+    g_free(key_checksum);
+    g_string_free(key, TRUE);
+    return path;
+}
+#endif /* WITH_LIBMODULEMD */
+
+
+/** Function used to sort pool tasks.
+ * This function is responsible for order of packages in metadata.
+ *
+ * @param a_p           Pointer to first struct PoolTask
+ * @param b_p           Pointer to second struct PoolTask
+ * @param user_data     Unused (user data)
+ */
+static int
+task_cmp(gconstpointer a_p, gconstpointer b_p, G_GNUC_UNUSED gpointer user_data)
+{
+    int ret;
+    const struct PoolTask *a = a_p;
+    const struct PoolTask *b = b_p;
+    ret = g_strcmp0(a->filename, b->filename);
+    if (ret) return ret;
+    return g_strcmp0(a->path, b->path);
+}
+
+
+/** task_cmp() of two pointers to struct PoolTask (for qsort()).
+ */
+static int
+task_ptr_cmp(const void *a_p, const void *b_p)
+{
+    return task_cmp(*(struct PoolTask * const *) a_p,
+                    *(struct PoolTask * const *) b_p,
+                    NULL);
+}
+
+/** Part of the tasks sorted by one thread.
+ */
+struct TaskSortPart {
+    struct PoolTask **tasks;    /*!< First task of the part */
+    gsize len;                  /*!< Number of the tasks */
+};
+
+static gpointer
+task_sort_thread(gpointer data)
+{
+    struct TaskSortPart *part = data;
+    qsort(part->tasks, part->len, sizeof(struct PoolTask *), task_ptr_cmp);
+    return NULL;
+}
+
+/** Sort the tasks by task_cmp(). Large arrays are cut into parts
+ * (at least PARALLEL_SORT_MIN_PART tasks each) which are sorted
+ * in parallel and merged.
+ * @param tasks         Array of struct PoolTask
+ * @param threads       Max number of the sorting threads
+ */
+static void
+sort_tasks(GPtrArray *tasks, int threads)
+{
+    struct PoolTask **data = (struct PoolTask **) tasks->pdata;
+    gsize len = tasks->len;
+    int parts = (int) MIN((gsize) threads, len / PARALLEL_SORT_MIN_PART);
+
+    if (parts < 2) {
+        if (len > 1)
+            qsort(data, len, sizeof(struct PoolTask *), task_ptr_cmp);
+        return;
+    }
+
+    gsize *bounds = g_new(gsize, parts + 1);
+    struct TaskSortPart *part = g_new(struct TaskSortPart, parts);
+    GThread **sorters = g_new(GThread *, parts);
+
+    for (int x = 0; x <= parts; x++)
+        bounds[x] = len * x / parts;
+    for (int x = 0; x < parts; x++) {
+        part[x].tasks = data + bounds[x];
+        part[x].len = bounds[x+1] - bounds[x];
+        sorters[x] = g_thread_new("sort", task_sort_thread, &part[x]);
+    }
+    for (int x = 0; x < parts; x++)
+        g_thread_join(sorters[x]);
+
+    // Merge the sorted parts pairwise
+    struct PoolTask **tmp = g_new(struct PoolTask *, len);
+    for (int width = 1; width < parts; width *= 2) {
+        for (int x = 0; x + width < parts; x += 2 * width) {
+            gsize lo = bounds[x];
+            gsize mid = bounds[x + width];
+            gsize hi = bounds[MIN(x + 2 * width, parts)];
+            gsize a = lo, b = mid, out = 0;
+
+            while (a < mid && b < hi)
+                tmp[out++] = task_cmp(data[b], data[a], NULL) < 0 ? data[b++]
+                                                                  : data[a++];
+            while (a < mid)
+                tmp[out++] = data[a++];
+            // The rest of the second part is already on its place
+            memcpy(data + lo, tmp, out * sizeof(struct PoolTask *));
+        }
+    }
+
+    g_free(tmp);
+    g_free(sorters);
+    g_free(part);
+    g_free(bounds);
+}
+
+
+/** Function used to order tasks pushed into the thread pool with
+ * --large-first. Large packages go first (the biggest one first), so
+ * that the run doesn't end with a few workers hashing huge files. The rest
+ * is processed in the order of the IDs (order of packages in metadata).
+ *
+ * @param a_p           Pointer to pointer to first struct PoolTask
+ * @param b_p           Pointer to pointer to second struct PoolTask
+ */
+static int
+task_dispatch_cmp(gconstpointer a_p, gconstpointer b_p)
+{
+    const struct PoolTask *a = *((struct PoolTask **) a_p);
+    const struct PoolTask *b = *((struct PoolTask **) b_p);
+    gboolean a_large = a->size >= LARGE_PACKAGE_SIZE;
+    gboolean b_large = b->size >= LARGE_PACKAGE_SIZE;
+
+    if (a_large != b_large)
+        return a_large ? -1 : 1;
+    if (a_large && a->size != b->size)
+        return a->size > b->size ? -1 : 1;
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+/** Size of a file (0 if the stat() fails).
+ */
+static gint64
+task_file_size(const gchar *full_path)
+{
+    struct stat st;
+    if (stat(full_path, &st) == -1)
+        return 0;
+    return (gint64) st.st_size;
+}
+
+
+/** New task for the package. The full path is allocated together with
+ * the task, the filename points into it.
+ * @param full_path     Path to the package
+ * @param full_path_len Length of the full_path
+ * @param filename_off  Offset of the filename in the full_path
+ * @param path          Directory of the package (shared by the tasks)
+ * @param size          Size of the package (0 if unknown)
+ * @return              Task (free it by g_free())
+ */
+static struct PoolTask *
+pool_task_new(const gchar *full_path,
+              gsize full_path_len,
+              gsize filename_off,
+              const gchar *path,
+              gint64 size)
+{
+    struct PoolTask *task = g_malloc(sizeof(struct PoolTask)
+                                     + full_path_len + 1);
+    task->full_path = (char *) (task + 1);
+    memcpy(task->full_path, full_path, full_path_len + 1);
+    task->filename = task->full_path + filename_off;
+    task->path = path;
+    task->size = size;
+    task->remote = FALSE;
+    task->pkg = NULL;
+    return task;
+}
+
+
+/** Destination of the found packages.
+ */
+struct TaskPush {
+    GThreadPool *pool;          /*!< Dumper pool */
+    struct CmdOptions *cmd_options; /*!< Options specified on command line */
+    struct UserData *udata;     /*!< User data of the pool (its prefetch
+                                     and progress get the pushed tasks) */
+    GSList **current_pkglist;   /*!< Basenames of the pushed packages
+                                     or NULL */
+    GPtrArray *held;            /*!< Tasks pushed after the walk
+                                     or NULL */
+    long *task_count;           /*!< Number of the pushed tasks */
+};
+
+/** Push the task into the pool (and its prefetch).
+ * @param pool          Dumper pool
+ * @param udata         User data of the pool
+ * @param task          Task
+ */
+static void
+task_dispatch(GThreadPool *pool, struct UserData *udata, struct PoolTask *task)
+{
+    if (udata->prefetch)
+        cr_dumper_prefetch_add(udata->prefetch, task);
+    cr_dumper_push_task(pool, udata, task);
+}
+
+/** Give the next ID to the task and push it into the pool. The packages
+ * of the other shards are dropped.
+ * @param push          Destination
+ * @param task          Task (ownership is taken)
+ * @param media_index   Index of the media of the task
+ * @param in_dir_len    Length of the path to the media
+ */
+static void
+task_push(struct TaskPush *push,
+          struct PoolTask *task,
+          guint media_index,
+          size_t in_dir_len)
+{
+    struct CmdOptions *cmd_options = push->cmd_options;
+
+    if (cmd_options->shard_count
+        && cr_shard_of(task->full_path + in_dir_len, cmd_options->shard_count)
+           != cmd_options->shard_index)
+    {
+        // The package belongs to another shard
+        g_free(task);
+        return;
+    }
+
+    task->id = (*push->task_count)++;
+    task->media_id = cmd_options->split ? media_index + 1 : 0;
+    if (push->current_pkglist)
+        *push->current_pkglist = g_slist_prepend(*push->current_pkglist,
+                                                 (gpointer) task->filename);
+    if (push->held)
+        g_ptr_array_add(push->held, task);
+    else
+        task_dispatch(push->pool, push->udata, task);
+}
+
+/** Directory of the walk ordered by directories (--stream-walk).
+ * The packages get their IDs in the pre-order of the tree, the packages
+ * of a directory go before its sub directories, both sorted by name.
+ * So the packages of a directory are pushed as soon as all the directories
+ * before it are read, not after the whole walk.
+ */
+struct DirWalkNode {
+    gchar *name;                /*!< Name of the directory */
+    struct DirWalkNode *parent; /*!< Parent directory or NULL (media) */
+    GPtrArray *tasks;           /*!< Found packages sorted by filename
+                                     or NULL if already pushed */
+    GPtrArray *children;        /*!< Sub directories sorted by name */
+    guint next_child;           /*!< First child not pushed yet */
+    gboolean read;              /*!< The directory was read */
+};
+
+/** One input directory (media in the split mode) of the directory walk.
+ */
+struct DirWalkMedia {
+    guint index;                /*!< Index of the media */
+    size_t in_dir_len;          /*!< Length of the input dir path */
+    GPtrArray *tasks;           /*!< Found packages (struct PoolTask),
+                                     guarded by the mutex of the walk */
+    struct DirWalkNode *root;   /*!< Input dir with --stream-walk */
+};
+
+/** Shared state of the parallel directory walk.
+ * All the media are walked at once by the same pool of readers.
+ */
+struct DirWalk {
+    GThreadPool *pool;          /*!< Pool of directory readers */
+    struct CmdOptions *cmd_options; /*!< Options specified on command line */
+    cr_RunContext *run_ctx;     /*!< Settings of the run */
+    GMutex mutex;               /*!< Mutex for the items bellow */
+    GCond cond;                 /*!< Signaled when pending drops to zero */
+    long pending;               /*!< Number of dirs pushed but not read yet */
+    GStringChunk *task_paths;   /*!< Directories of the found packages */
+    struct TaskPush *push;      /*!< Destination of the packages pushed
+                                     during the walk (--stream-walk) */
+    struct DirWalkMedia *media; /*!< The media */
+    guint media_count;          /*!< Number of the media */
+    guint cur_media;            /*!< Media being pushed (--stream-walk) */
+    struct DirWalkNode *cur;    /*!< Dir being pushed (--stream-walk) */
+};
+
+/** Directory waiting in the pool of directory readers.
+ */
+struct DirWalkDir {
+    gchar *dirname;             /*!< Path to the directory */
+    struct DirWalkMedia *media; /*!< Media of the directory */
+    struct DirWalkNode *node;   /*!< Node of the directory or NULL */
+};
+
+static struct DirWalkNode *
+dir_walk_node_new(const gchar *name, struct DirWalkNode *parent)
+{
+    struct DirWalkNode *node = g_new0(struct DirWalkNode, 1);
+    node->name = g_strdup(name);
+    node->parent = parent;
+    return node;
+}
+
+/** Sort pointers to struct DirWalkDir by the names of their nodes.
+ */
+static int
+dir_walk_dir_cmp(gconstpointer a_p, gconstpointer b_p)
+{
+    const struct DirWalkDir *a = *((struct DirWalkDir **) a_p);
+    const struct DirWalkDir *b = *((struct DirWalkDir **) b_p);
+    return strcmp(a->node->name, b->node->name);
+}
+
+/** Push the packages of the read directories which follow the already
+ * pushed ones (--stream-walk). Call it with the mutex of the walk locked.
+ * @param walk          Shared state of the directory walk
+ */
+static void
+dir_walk_push_tasks(struct DirWalk *walk)
+{
+    struct DirWalkNode *node = walk->cur;
+    long pushed = *walk->push->task_count;
+
+    while (node && node->read) {
+        struct DirWalkMedia *media = &walk->media[walk->cur_media];
+
+        if (node->tasks) {
+            for (guint x = 0; x < node->tasks->len; x++)
+                task_push(walk->push, g_ptr_array_index(node->tasks, x),
+                          media->index, media->in_dir_len);
+            g_ptr_array_free(node->tasks, TRUE);
+            node->tasks = NULL;
+        }
+
+        if (node->children && node->next_child < node->children->len) {
+            node = g_ptr_array_index(node->children, node->next_child++);
+            continue;
+        }
+
+        // The whole sub tree was pushed
+        struct DirWalkNode *parent = node->parent;
+        if (node->children)
+            g_ptr_array_free(node->children, TRUE);
+        g_free(node->name);
+        g_free(node);
+        node = parent;
+
+        if (!node && ++walk->cur_media < walk->media_count)
+            node = walk->media[walk->cur_media].root;
+    }
+    walk->cur = node;
+
+    if (walk->push->udata->progress && *walk->push->task_count != pushed)
+        cr_dumper_progress_set_total(walk->push->udata->progress,
+                                     *walk->push->task_count);
+}
+
+/** Push a directory into the pool of directory readers.
+ * @param walk          Shared state of the directory walk
+ * @param media         Media of the directory
+ * @param node          Node of the directory (--stream-walk) or NULL
+ * @param dirname       Path to the directory (ownership is taken)
+ */
+static void
+dir_walk_push(struct DirWalk *walk,
+              struct DirWalkMedia *media,
+              struct DirWalkNode *node,
+              gchar *dirname)
+{
+    struct DirWalkDir *dir = g_new(struct DirWalkDir, 1);
+    dir->dirname = dirname;
+    dir->media = media;
+    dir->node = node;
+    g_mutex_lock(&(walk->mutex));
+    walk->pending++;
+    g_mutex_unlock(&(walk->mutex));
+    g_thread_pool_push(walk->pool, dir, NULL);
+}
+
+/** Get a type of a directory entry.
+ * The d_type from readdir() is used when available, so the stat() call
+ * is needed only for symlinks and on filesystems which don't fill d_type.
+ * Symlinks are followed (as g_file_test() does).
+ * @param entry         Directory entry
+ * @param full_path     Path to the entry
+ * @return              G_FILE_TEST_IS_REGULAR, G_FILE_TEST_IS_DIR or 0
+ */
+static GFileTest
+dir_entry_type(struct dirent *entry, const gchar *full_path)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (entry->d_type == DT_REG)
+        return G_FILE_TEST_IS_REGULAR;
+    if (entry->d_type == DT_DIR)
+        return G_FILE_TEST_IS_DIR;
+    if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+        return 0;
+#else
+    (void) entry;
+#endif
+
+    struct stat st;
+    if (stat(full_path, &st) == -1)
+        return 0;
+    if (S_ISREG(st.st_mode))
+        return G_FILE_TEST_IS_REGULAR;
+    if (S_ISDIR(st.st_mode))
+        return G_FILE_TEST_IS_DIR;
+    return 0;
+}
+
+/** Check if a directory entry is a symlink.
+ * @param entry         Directory entry
+ * @param full_path     Path to the entry
+ * @return              TRUE if the entry is a symlink
+ */
+static gboolean
+dir_entry_is_symlink(struct dirent *entry, const gchar *full_path)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_LNK;
+#else
+    (void) entry;
+#endif
+    return g_file_test(full_path, G_FILE_TEST_IS_SYMLINK);
+}
+
+/** Read one directory of the input tree.
+ * Sub directories are pushed back into the pool of directory readers,
+ * found packages are collected into the tasks of the media. With
+ * --stream-walk they are pushed into the dumper pool as soon as
+ * the directories before them are read.
+ * @param data          Directory (struct DirWalkDir *)
+ * @param user_data     Shared state of the walk (struct DirWalk *)
+ */
+static void
+dir_walk_thread(gpointer data, gpointer user_data)
+{
+    struct DirWalkDir *dir = data;
+    gchar *dirname = dir->dirname;
+    struct DirWalkMedia *media = dir->media;
+    struct DirWalkNode *node = dir->node;
+    struct DirWalk *walk = user_data;
+    struct CmdOptions *cmd_options = walk->cmd_options;
+    GQueue tasks = G_QUEUE_INIT;
+    GPtrArray *subdirs = node ? g_ptr_array_new() : NULL;
+    GSList *modulemd_metadata = NULL;
+    GString *full_path = NULL;
+    gsize dir_len;
+    DIR *dirp;
+
+    cr_run_context_push(walk->run_ctx);
+
+    dirp = opendir(dirname);
+    if (!dirp) {
+        g_warning("Cannot open directory: %s", dirname);
+        goto cleanup;
+    }
+
+    // Paths of the entries are built in one buffer
+    full_path = g_string_new(dirname);
+    g_string_append_c(full_path, '/');
+    dir_len = full_path->len;
+
+    struct dirent *entry;
+    while ((entry = readdir(dirp))) {
+        const gchar *filename = entry->d_name;
+
+        if (!strcmp(filename, ".") || !strcmp(filename, ".."))
+            continue;
+
+        if (!allowed_file(filename, cmd_options->exclude_masks)) {
+            continue;
+        }
+
+        g_string_truncate(full_path, dir_len);
+        g_string_append(full_path, filename);
+        GFileTest type = dir_entry_type(entry, full_path->str);
+
+        if (type != G_FILE_TEST_IS_REGULAR) {
+            if (type == G_FILE_TEST_IS_DIR) {
+                // Directory
+                g_debug("Dir to scan: %s", full_path->str);
+                gchar *subdir = g_strndup(full_path->str, full_path->len);
+                if (subdirs) {
+                    // Pushed when their order is known
+                    struct DirWalkDir *sub = g_new(struct DirWalkDir, 1);
+                    sub->dirname = subdir;
+                    sub->media = media;
+                    sub->node = dir_walk_node_new(filename, node);
+                    g_ptr_array_add(subdirs, sub);
+                } else {
+                    dir_walk_push(walk, media, NULL, subdir);
+                }
+            }
+            continue;
+        }
+
+        // Skip symbolic links if --skip-symlinks arg is used
+        if (cmd_options->skip_symlinks
+            && dir_entry_is_symlink(entry, full_path->str))
+        {
+            g_debug("Skipped symlink: %s", full_path->str);
+            continue;
+        }
+
+        if (allowed_modulemd_module_metadata_file(full_path->str)) {
+#ifdef WITH_LIBMODULEMD
+            modulemd_metadata = g_slist_prepend(modulemd_metadata,
+                                    g_strndup(full_path->str, full_path->len));
+#else
+            g_warning("createrepo_c not compiled with libmodulemd support, "
+                      "ignoring found module metadata: %s", full_path->str);
+#endif /* WITH_LIBMODULEMD */
+            continue;
+        }
+
+        // Non .rpm files are ignored
+        if (!g_str_has_suffix (filename, ".rpm"))
+            continue;
+
+        // Check filename against exclude glob masks
+        const gchar *repo_relative_path = filename;
+        if (media->in_dir_len < full_path->len)
+            // This probably should be always true
+            repo_relative_path = full_path->str + media->in_dir_len;
+
+        if (allowed_file(repo_relative_path, cmd_options->exclude_masks)) {
+            // FINALLY! Add file into pool
+            // The size is needed only to dispatch the large packages
+            // first, the open directory saves the path lookup
+            struct stat st;
+            gint64 size = 0;
+            if (cmd_options->large_first
+                && !fstatat(dirfd(dirp), filename, &st, 0))
+                size = (gint64) st.st_size;
+
+            g_debug("Adding pkg: %s", full_path->str);
+            struct PoolTask *task = pool_task_new(full_path->str,
+                                                  full_path->len,
+                                                  dir_len, NULL, size);
+            g_queue_push_tail(&tasks, task);
+        }
+    }
+
+    // Cleanup
+    closedir(dirp);
+    g_string_free(full_path, TRUE);
+
+cleanup:
+    if (subdirs)
+        g_ptr_array_sort(subdirs, dir_walk_dir_cmp);
+
+    g_mutex_lock(&(walk->mutex));
+    // Hand over the results of this directory, its tasks share one path
+    if (!g_queue_is_empty(&tasks)) {
+        const gchar *path = g_string_chunk_insert(walk->task_paths, dirname);
+        GPtrArray *found = node ? g_ptr_array_sized_new(tasks.length)
+                                : media->tasks;
+        while (!g_queue_is_empty(&tasks)) {
+            struct PoolTask *task = g_queue_pop_head(&tasks);
+            task->path = path;
+            g_ptr_array_add(found, task);
+        }
+        if (node) {
+            g_ptr_array_sort(found, task_ptr_cmp);
+            node->tasks = found;
+        }
+    }
+    cmd_options->modulemd_metadata = g_slist_concat(modulemd_metadata,
+                                            cmd_options->modulemd_metadata);
+    if (node) {
+        // The sub directories are pending before this one is done
+        node->children = g_ptr_array_sized_new(subdirs->len);
+        for (guint x = 0; x < subdirs->len; x++) {
+            struct DirWalkDir *sub = g_ptr_array_index(subdirs, x);
+            g_ptr_array_add(node->children, sub->node);
+        }
+        node->read = TRUE;
+        walk->pending += subdirs->len;
+        dir_walk_push_tasks(walk);
+    }
+    if (--walk->pending == 0)
+        g_cond_signal(&(walk->cond));
+    g_mutex_unlock(&(walk->mutex));
+
+    if (subdirs) {
+        for (guint x = 0; x < subdirs->len; x++)
+            g_thread_pool_push(walk->pool, g_ptr_array_index(subdirs, x),
+                               NULL);
+        g_ptr_array_free(subdirs, TRUE);
+    }
+
+    cr_run_context_pop(walk->run_ctx);
+    g_free(dirname);
+    g_free(dir);
+}
+
+
+/** Recursively walkt throught the input directories and add push the found
+ * rpms to the thread pool (create a PoolTask and push it to the pool).
+ * The directories are read in parallel by cmd_options->workers threads,
+ * in the split mode all the media are read at once.
+ * If the filelists is supplied then no recursive walk is done and only
+ * files from filelists are pushed into the pool.
+ * This function also filters out files that shouldn't be processed
+ * (e.g. directories with .rpm suffix, files that match one of
+ * the exclude masks, etc.).
+ * The tasks are pushed in the order of the media (the order of the packages
+ * in the metadata), their media_id is 1..N in the split mode and 0 otherwise.
+ * With --stream-walk the packages are ordered by their directories and
+ * pushed during the walk, the pool could already be running.
+ *
+ * @param pool              GThreadPool pool
+ * @param in_dirs           Directories to scan (media in the split mode)
+ * @param dirs_count        Number of the directories
+ * @param cmd_options       Options specified on command line
+ * @param run_ctx           Settings of the run
+ * @param current_pkglist   Pointer to a list where basenames of files that
+ *                          will be processed will be appended to or NULL
+ * @param task_paths        Directories of the tasks, must live until
+ *                          the tasks are processed
+ * @param udata             User data of the pool, its prefetch (if any)
+ *                          and progress (if any) get the pushed tasks
+ * @param held              Array the tasks are added to (in the order
+ *                          of the dispatch) instead of being pushed,
+ *                          required with --large-first, NULL to push them
+ * @param task_count        Number of the pushed tasks (incremented)
+ * @return                  Number of packages that are going to be processed
+ */
+static long
+fill_pool(GThreadPool *pool,
+          gchar **in_dirs,
+          guint dirs_count,
+          struct CmdOptions *cmd_options,
+          cr_RunContext *run_ctx,
+          GSList **current_pkglist,
+          GStringChunk *task_paths,
+          struct UserData *udata,
+          GPtrArray *held,
+          long *task_count)
+{
+    struct DirWalkMedia *media = g_new0(struct DirWalkMedia, dirs_count);
+    struct PoolTask *task;
+    struct TaskPush push;
+
+    // The pool takes the tasks in the order of the pushes, the order
+    // of their IDs, unless the large ones go first
+    assert(held || !cmd_options->large_first);
+    push.pool = pool;
+    push.cmd_options = cmd_options;
+    push.udata = udata;
+    push.current_pkglist = current_pkglist;
+    push.held = held;
+    push.task_count = task_count;
+
+    for (guint x = 0; x < dirs_count; x++) {
+        media[x].index = x;
+        media[x].in_dir_len = strlen(in_dirs[x]);
+        media[x].tasks = g_ptr_array_new();
+    }
+
+    if ((cmd_options->pkglist || cmd_options->recycle_pkglist) && !cmd_options->include_pkgs) {
+        g_warning("Used pkglist doesn't contain any useful items");
+    } else if (!(cmd_options->include_pkgs)) {
+        // --pkglist (or --includepkg, or --recycle-pkglist) is not supplied
+        //  --> do dir walk
+
+        g_message("Directory walk started");
+
+        struct DirWalk walk;
+        walk.cmd_options = cmd_options;
+        walk.run_ctx = run_ctx;
+        walk.pending = 0;
+        walk.task_paths = task_paths;
+        walk.push = &push;
+        walk.media = media;
+        walk.media_count = dirs_count;
+        walk.cur_media = 0;
+        walk.cur = NULL;
+        if (cmd_options->stream_walk) {
+            for (guint x = 0; x < dirs_count; x++)
+                media[x].root = dir_walk_node_new("", NULL);
+            walk.cur = media[0].root;
+        }
+        g_mutex_init(&(walk.mutex));
+        g_cond_init(&(walk.cond));
+        walk.pool = g_thread_pool_new(dir_walk_thread,
+                                      &walk,
+                                      cmd_options->workers,
+                                      FALSE,
+                                      NULL);
+
+        for (guint x = 0; x < dirs_count; x++)
+            dir_walk_push(&walk, &media[x], media[x].root,
+                          g_strndup(in_dirs[x], media[x].in_dir_len-1));
+
+        // Wait until all the (sub)directories of all the media are read
+        g_mutex_lock(&(walk.mutex));
+        while (walk.pending > 0)
+            g_cond_wait(&(walk.cond), &(walk.mutex));
+        g_mutex_unlock(&(walk.mutex));
+
+        g_thread_pool_free(walk.pool, FALSE, TRUE);
+        g_mutex_clear(&(walk.mutex));
+        g_cond_clear(&(walk.cond));
+
+        cmd_options->modulemd_metadata = g_slist_sort(
+                                            cmd_options->modulemd_metadata,
+                                            (GCompareFunc) g_strcmp0);
+    } else {
+        // pkglist is supplied - use only files in pkglist
+
+        g_debug("Skipping dir walk - using pkglist");
+
+        for (guint m = 0; m < dirs_count; m++) {
+            GSList *element = cmd_options->include_pkgs;
+            for (; element; element=g_slist_next(element)) {
+                gchar *relative_path = (gchar *) element->data;
+                //     ^^^ path from pkglist e.g. packages/i386/foobar.rpm
+
+                if (allowed_modulemd_module_metadata_file(relative_path)) {
+#ifdef WITH_LIBMODULEMD
+                    cmd_options->modulemd_metadata = g_slist_prepend(
+                        cmd_options->modulemd_metadata,
+                        (gpointer) g_strdup(relative_path));
+#else
+                g_warning("createrepo_c not compiled with libmodulemd support, "
+                          "ignoring found module metadata: %s", relative_path);
+#endif /* WITH_LIBMODULEMD */
+                    continue;
+                }
+
+                gchar *filename; // foobar.rpm
+
+                // Get index of last '/'
+                int x = strlen(relative_path);
+                for (; x > 0 && relative_path[x] != '/'; x--)
+                    ;
+
+                if (!x) // There was no '/' in path
+                    filename = relative_path;
+                else    // Use only a last part of the path
+                    filename = relative_path + x + 1;
+
+                if (allowed_file(relative_path, cmd_options->exclude_masks)) {
+                    // Check filename against exclude glob masks
+                    gchar *full_path = g_strconcat(in_dirs[m], relative_path, NULL);
+                    //     ^^^ /path/to/in_repo/packages/i386/foobar.rpm
+                    gchar *path = g_strndup(relative_path, x);  // packages/i386/
+                    gsize full_path_len = strlen(full_path);
+                    g_debug("Adding pkg: %s", full_path);
+                    task = pool_task_new(full_path, full_path_len,
+                                         full_path_len - strlen(filename),
+                                         g_string_chunk_insert_const(task_paths, path),
+                                         cmd_options->large_first
+                                            ? task_file_size(full_path) : 0);
+                    //     ^^^ filename is foobar.rpm
+                    g_free(full_path);
+                    g_free(path);
+                    g_ptr_array_add(media[m].tasks, task);
+                }
+            }
+        }
+    }
+
+    // Push sorted tasks into the thread pool. The tasks are sorted at once,
+    // order of packages in metadata doesn't depend on the order in which
+    // the readers finished. With --stream-walk they were already pushed.
+    // The held ones are pushed by the caller.
+    for (guint x = 0; x < dirs_count; x++) {
+        sort_tasks(media[x].tasks, cmd_options->workers);
+        for (guint y = 0; y < media[x].tasks->len; y++)
+            task_push(&push, g_ptr_array_index(media[x].tasks, y),
+                      x, media[x].in_dir_len);
+        g_ptr_array_free(media[x].tasks, TRUE);
+    }
+
+    if (cmd_options->large_first)
+        g_ptr_array_sort(held, task_dispatch_cmp);
+
+    g_free(media);
+    return *task_count;
+}
+
+
+/** Load the packages of --remote-manifest which belong to the shard.
+ * Their checksums aren't computed, they have to be of the type used
+ * by the repo.
+ *
+ * @param cmd_options       Options specified on command line
+ * @param err               GError **
+ * @return                  Array of cr_RemotePkg or NULL on error
+ */
+static GPtrArray *
+load_remote_pkgs(struct CmdOptions *cmd_options, GError **err)
+{
+    GPtrArray *all, *remotes;
+
+    all = cr_remotepkg_load_manifest(cmd_options->remote_manifest,
+                                     cmd_options->remote_baseurl, err);
+    if (!all)
+        return NULL;
+
+    remotes = g_ptr_array_new_with_free_func(
+                                    (GDestroyNotify) cr_remotepkg_free);
+    for (guint x = 0; x < all->len; x++) {
+        cr_RemotePkg *remote = g_ptr_array_index(all, x);
+
+        if (remote->checksum_type != cmd_options->checksum_type) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "%s: Checksum of %s is %s, the repo uses %s",
+                        cmd_options->remote_manifest, remote->location_href,
+                        cr_checksum_name_str(remote->checksum_type),
+                        cr_checksum_name_str(cmd_options->checksum_type));
+            g_ptr_array_free(remotes, TRUE);
+            g_ptr_array_free(all, TRUE);
+            return NULL;
+        }
+
+        if (cmd_options->shard_count
+            && cr_shard_of(cr_get_cleaned_href(remote->location_href),
+                           cmd_options->shard_count)
+               != cmd_options->shard_index)
+        {
+            // The package belongs to another shard
+            continue;
+        }
+
+        // Moved to the result
+        g_ptr_array_add(remotes, remote);
+        all->pdata[x] = NULL;
+    }
+
+    g_ptr_array_free(all, TRUE);
+    return remotes;
+}
+
+
+/** Dispatching of the remote packages to the workers.
+ */
+struct RemoteDispatch {
+    GThreadPool *pool;          /*!< Pool of the workers */
+    struct UserData *udata;     /*!< User data of the run */
+    long first_id;              /*!< ID of the task of the first package */
+};
+
+/** Push the task of a package read by cr_remotepkg_read_headers().
+ * Every package gets its task, even if it couldn't be read, the writers
+ * wait for all the IDs.
+ */
+static void
+remote_pkg_read_cb(cr_RemotePkg *remote,
+                   guint n,
+                   cr_Package *pkg,
+                   const GError *err,
+                   void *cbdata)
+{
+    struct RemoteDispatch *dispatch = cbdata;
+    gsize len = strlen(remote->url);
+    struct PoolTask *task;
+
+    if (err)
+        g_warning("Cannot read package: %s: %s", remote->url, err->message);
+
+    task = g_malloc(sizeof(struct PoolTask) + len + 1);
+    task->full_path = (char *) (task + 1);
+    memcpy(task->full_path, remote->url, len + 1);
+    task->filename = cr_get_filename(task->full_path);
+    task->path = NULL;
+    task->id = dispatch->first_id + n;
+    task->media_id = 0;
+    task->size = 0;     // The payload isn't read
+    task->remote = TRUE;
+    task->pkg = pkg;
+    cr_dumper_push_task(dispatch->pool, dispatch->udata, task);
+}
+
+/** Read the headers of the remote packages and push them into the pool
+ * as they come. It returns after all of them were pushed.
+ *
+ * @param pool              GThreadPool pool of the workers
+ * @param udata             User data of the run
+ * @param remotes           Array of cr_RemotePkg
+ * @param first_id          ID of the task of the first package
+ * @param cmd_options       Options specified on command line
+ */
+static void
+dispatch_remote_pkgs(GThreadPool *pool,
+                     struct UserData *udata,
+                     GPtrArray *remotes,
+                     long first_id,
+                     struct CmdOptions *cmd_options)
+{
+    struct RemoteDispatch dispatch = { pool, udata, first_id };
+    cr_HeaderReadingFlags hdrrflags = CR_HDRR_USEARENA;
+    GError *tmp_err = NULL;
+    CURL *handle;
+
+    if (cmd_options->primary_only)
+        hdrrflags |= CR_HDRR_PRIMARYONLY;
+
+    handle = curl_easy_init();
+    if (!handle) {
+        g_set_error(&tmp_err, ERR_DOMAIN, CRE_CURL, "curl_easy_init failed");
+        for (guint x = 0; x < remotes->len; x++)
+            remote_pkg_read_cb(g_ptr_array_index(remotes, x), x, NULL,
+                               tmp_err, &dispatch);
+        g_clear_error(&tmp_err);
+        return;
+    }
+
+    // The failed packages were reported by the callback
+    if (cr_remotepkg_read_headers(handle, remotes,
+                                  cmd_options->remote_transfers,
+                                  cmd_options->changelog_limit, hdrrflags,
+                                  remote_pkg_read_cb, &dispatch,
+                                  &tmp_err) != CRE_OK)
+        g_clear_error(&tmp_err);
+
+    curl_easy_cleanup(handle);
+}
+
+/** Walk the input directories and push the found packages into the pool
+ * (see fill_pool()), the remote packages get the IDs after them.
+ *
+ * @param pool              GThreadPool pool of the workers
+ * @param in_dirs           Normalized input directories
+ * @param dirs_count        Number of the directories
+ * @param cmd_options       Options specified on command line
+ * @param run_ctx           Settings of the run
+ * @param current_pkglist   Basenames of the found packages or NULL
+ * @param task_paths        Directories of the tasks
+ * @param udata             User data of the pool
+ * @param held              Tasks pushed after the walk or NULL
+ *                          (see fill_pool())
+ * @param metrics           Metrics or NULL
+ * @param remotes           Array of cr_RemotePkg or NULL
+ * @param remote_first_id   ID of the first remote package (set)
+ * @param task_count        Number of the tasks (incremented)
+ */
+static void
+walk_input_dirs(GThreadPool *pool,
+                gchar **in_dirs,
+                guint dirs_count,
+                struct CmdOptions *cmd_options,
+                cr_RunContext *run_ctx,
+                GSList **current_pkglist,
+                GStringChunk *task_paths,
+                struct UserData *udata,
+                GPtrArray *held,
+                cr_Metrics *metrics,
+                GPtrArray *remotes,
+                long *remote_first_id,
+                long *task_count)
+{
+    gint64 walk_start = cr_metrics_start(metrics);
+    fill_pool(pool,
+              in_dirs,
+              dirs_count,
+              cmd_options,
+              run_ctx,
+              current_pkglist,
+              task_paths,
+              udata,
+              held,
+              task_count);
+    cr_metrics_stop(metrics, CR_METRICS_WALK, walk_start, 0);
+
+    g_message("Directory walk done - %ld packages", *task_count);
+
+    if (remotes) {
+        *remote_first_id = *task_count;
+        *task_count += remotes->len;
+    }
+}
+
+
+/** Prepare cache dir for checksums.
+ * Called only if --cachedir options is used.
+ * It tries to create cache directory if it doesn't exist yet.
+ * It also fill checksum_cachedir option in cmd_options structure.
+ *
+ * @param cmd_options       Commandline options
+ * @param out_dir           Repo output directory
+ * @param err               GError **
+ * @return                  FALSE if err is set, TRUE otherwise
+ */
+static gboolean
+prepare_cache_dir(struct CmdOptions *cmd_options,
+                  const gchar *out_dir,
+                  GError **err)
+{
+    if (!cmd_options->cachedir)
+        return TRUE;
+
+    if (g_str_has_prefix(cmd_options->cachedir, "/")) {
+        // Absolute local path
+        cmd_options->checksum_cachedir = cr_normalize_dir_path(
+                                                    cmd_options->cachedir);
+    } else {
+        // Relative path (from intput_dir)
+        gchar *tmp = g_strconcat(out_dir, cmd_options->cachedir, NULL);
+        cmd_options->checksum_cachedir = cr_normalize_dir_path(tmp);
+        g_free(tmp);
+    }
+
+    // Create the cache directory
+    if (g_mkdir(cmd_options->checksum_cachedir, S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH)) {
+        if (errno == EEXIST) {
+            if (!g_file_test(cmd_options->checksum_cachedir,
+                             G_FILE_TEST_IS_DIR))
+            {
+                g_set_error(err, CREATEREPO_C_ERROR, CRE_BADARG,
+                            "The %s already exists and it is not a directory!",
+                            cmd_options->checksum_cachedir);
+                return FALSE;
+            }
+        } else {
+            g_set_error(err, CREATEREPO_C_ERROR, CRE_BADARG,
+                        "cannot use cachedir %s: %s",
+                        cmd_options->checksum_cachedir, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    g_debug("Cachedir for checksums is %s", cmd_options->checksum_cachedir);
+    return TRUE;
+}
+
+/** Load the records of the old repomd.xml, which could be reused for
+ *  the kept additional metadata (see remember_kept_metadatum_record()).
+ *
+ * @param repomd_path               Path to the old repomd.xml
+ *
+ * @return                          cr_Repomd or NULL if it cannot be parsed
+ */
+static cr_Repomd *
+load_old_repomd(const char *repomd_path)
+{
+    GError *tmp_err = NULL;
+    cr_Repomd *repomd;
+
+    if (!repomd_path)
+        return NULL;
+
+    repomd = cr_repomd_new();
+    cr_xml_parse_repomd(repomd_path, repomd, cr_warning_cb,
+                        "Repomd xml parser", &tmp_err);
+    if (tmp_err) {
+        g_debug("Cannot parse old %s, the kept metadata are checksummed "
+                "again: %s", repomd_path, tmp_err->message);
+        g_clear_error(&tmp_err);
+        cr_repomd_free(repomd);
+        return NULL;
+    }
+
+    return repomd;
+}
+
+/** Remember the old record of a metadatum kept by --keep-all-metadata,
+ *  if the record still describes the file. That is when the basename
+ *  of the file is the basename of the record location and the size and
+ *  the modification time of the file are the size and the timestamp
+ *  of the record (they are taken from stat() when the record is filled).
+ *
+ * @param kept_records              Hashtable: path of the copy -> record
+ * @param old_repomd                Old repomd
+ * @param src                       Path to the file in the old repodata
+ * @param dst                       Path to the copy of the file
+ * @param type                      Type of the metadatum
+ * @param repomd_checksum_type      Checksum type of the new repomd.xml
+ */
+static void
+remember_kept_metadatum_record(GHashTable *kept_records,
+                               cr_Repomd *old_repomd,
+                               const char *src,
+                               const char *dst,
+                               const char *type,
+                               cr_ChecksumType repomd_checksum_type)
+{
+    struct stat st;
+    cr_RepomdRecord *rec;
+
+    if (!old_repomd || !src || !dst || !type)
+        return;
+
+    rec = cr_repomd_get_record(old_repomd, type);
+    if (!rec || !rec->location_href || !rec->checksum || !rec->checksum_type)
+        return;
+
+    if (g_strcmp0(cr_get_filename(rec->location_href), cr_get_filename(src))
+        || cr_checksum_type(rec->checksum_type) != repomd_checksum_type
+        || (rec->checksum_open_type
+            && cr_checksum_type(rec->checksum_open_type) != repomd_checksum_type))
+        return;
+
+    if (stat(src, &st) || st.st_size != rec->size || st.st_mtime != rec->timestamp)
+        return;
+
+    g_debug("Reusing checksums of unchanged %s", src);
+    g_hash_table_replace(kept_records, g_strdup(dst), cr_repomd_record_copy(rec));
+}
+
+/** Task filling the cr_RepomdRecords of an additional metadatum.
+ *  The tasks are processed by a pool while the packages are dumped.
+ */
+typedef struct {
+    cr_RepomdRecord *record;        /*!< Record of the metadatum */
+    cr_RepomdRecord *crecord;       /*!< Record of the compressed copy
+                                         (groupfile) or NULL */
+    gchar *content;                 /*!< Content to be written into
+                                         the file first or NULL */
+    cr_CompressionType compression; /*!< Compression of the content or of
+                                         the compressed copy */
+    cr_ChecksumType checksum_type;  /*!< Repomd checksum type */
+    GError *err;                    /*!< Error of the task */
+} cr_AdditionalMetadatumTask;
+
+/** Create a task filling the record of an additional metadatum and push
+ *  it into the pool. If the metadatum is unchanged kept metadata,
+ *  the checksums of its old record are reused.
+ *
+ * @param pool                      Pool of additional metadata tasks
+ * @param tasks                     Hashtable: cr_Metadatum -> task
+ * @param metadatum                 Metadatum
+ * @param kept_records              Hashtable with the old records of
+ *                                  unchanged kept metadata (path -> record)
+ *                                  or NULL
+ * @param content                   Content to be compressed into the file
+ *                                  of the metadatum or NULL (the task
+ *                                  takes it over)
+ * @param compression               Compression of the content, or of
+ *                                  the compressed copy of the groupfile
+ * @param groupfile                 Create a compressed copy (groupfile)?
+ * @param repomd_checksum_type
+ */
+static void
+cr_push_additional_metadatum_task(GThreadPool *pool,
+                                  GHashTable *tasks,
+                                  const cr_Metadatum *metadatum,
+                                  GHashTable *kept_records,
+                                  gchar *content,
+                                  cr_CompressionType compression,
+                                  gboolean groupfile,
+                                  cr_ChecksumType repomd_checksum_type)
+{
+    cr_AdditionalMetadatumTask *task = g_malloc0(sizeof(*task));
+    cr_RepomdRecord *rec, *old_rec = NULL;
+
+    rec = cr_repomd_record_new(metadatum->type, metadatum->name);
+    task->record = rec;
+    task->content = content;
+    task->compression = compression;
+    task->checksum_type = repomd_checksum_type;
+
+    if (groupfile) {
+        char *compression_suffix = g_strdup(cr_compression_suffix(compression));
+        compression_suffix[0] = '_'; //replace '.'
+        gchar *compressed_record_type = g_strconcat(metadatum->type, compression_suffix, NULL);
+        task->crecord = cr_repomd_record_new(compressed_record_type, NULL);
+        g_free(compressed_record_type);
+        g_free(compression_suffix);
+    }
+
+    if (kept_records && metadatum->name)
+        old_rec = g_hash_table_lookup(kept_records, metadatum->name);
+    if (old_rec) {
+        // The file is unchanged, only its size and timestamp
+        // are filled from the copy
+        rec->checksum = cr_safe_string_chunk_insert(rec->chunk, old_rec->checksum);
+        rec->checksum_type = cr_safe_string_chunk_insert(rec->chunk, old_rec->checksum_type);
+        rec->checksum_open = cr_safe_string_chunk_insert(rec->chunk, old_rec->checksum_open);
+        rec->checksum_open_type = cr_safe_string_chunk_insert(rec->chunk, old_rec->checksum_open_type);
+        rec->checksum_header = cr_safe_string_chunk_insert(rec->chunk, old_rec->checksum_header);
+        rec->checksum_header_type = cr_safe_string_chunk_insert(rec->chunk, old_rec->checksum_header_type);
+        rec->size_open = old_rec->size_open;
+        rec->size_header = old_rec->size_header;
+    }
+
+    g_hash_table_insert(tasks, (gpointer) metadatum, task);
+    g_thread_pool_push(pool, task, NULL);
+}
+
+/** Write the content of a metadatum (if any) and compress
+ *  (the groupfile) and fill its records.
+ */
+static void
+additional_metadatum_process(cr_AdditionalMetadatumTask *task)
+{
+    GError *tmp_err = NULL;
+
+    if (task->content) {
+        const char *path = task->record->location_real;
+        cr_ContentStat *stat = cr_contentstat_new(task->checksum_type, NULL);
+        CR_FILE *file = cr_sopen(path, CR_CW_MODE_WRITE, task->compression,
+                                 stat, &tmp_err);
+        if (!file) {
+            g_propagate_prefixed_error(&task->err, tmp_err,
+                                       "Cannot open %s: ", path);
+            cr_contentstat_free(stat, NULL);
+            return;
+        }
+        cr_puts(file, task->content, &tmp_err);
+        cr_close(file, tmp_err ? NULL : &tmp_err);
+        g_clear_pointer(&task->content, g_free);
+        if (tmp_err) {
+            g_propagate_prefixed_error(&task->err, tmp_err,
+                                       "Cannot write %s: ", path);
+            cr_contentstat_free(stat, NULL);
+            return;
+        }
+
+        // The open checksum and size of the written content, the file
+        // doesn't have to be decompressed by cr_repomd_record_fill()
+        // (an uncompressed file has none)
+        if (task->compression != CR_CW_NO_COMPRESSION && !task->crecord
+            && stat->checksum
+            && (task->compression != CR_CW_ZCK_COMPRESSION || stat->hdr_checksum))
+        {
+            cr_repomd_record_load_contentstat(task->record, stat);
+            if (task->compression == CR_CW_ZCK_COMPRESSION)
+                cr_repomd_record_load_zck_contentstat(task->record, stat);
+        }
+        cr_contentstat_free(stat, NULL);
+    }
+
+    if (task->crecord)
+        cr_repomd_record_compress_and_fill(task->record,
+                                           task->crecord,
+                                           task->checksum_type,
+                                           task->compression,
+                                           NULL,
+                                           &tmp_err);
+    else
+        cr_repomd_record_fill(task->record, task->checksum_type, &tmp_err);
+
+    if (tmp_err)
+        g_propagate_error(&task->err, tmp_err);
+}
+
+/** Function for GThreadPool, the user_data is the cr_RunContext.
+ */
+static void
+cr_additional_metadatum_thread(gpointer data, gpointer user_data)
+{
+    cr_RunContext *run_ctx = user_data;
+
+    cr_run_context_push(run_ctx);
+    additional_metadatum_process(data);
+    cr_run_context_pop(run_ctx);
+}
+
+/** Wait for the additional metadata tasks and create the list of their
+ *  cr_RepomdRecords. Exits if any task failed.
+ *
+ * @param pool                      Pool of additional metadata tasks
+ *                                  (freed by this function)
+ * @param tasks                     Hashtable: cr_Metadatum -> task
+ * @param additional_metadata       List of cr_Metadatum
+ * @param groupfile_metadatum       Metadatum of the groupfile or NULL
+ * @param records                   New GSList of cr_RepomdRecords
+ * @param err                       GError **
+ *
+ * @return                          TRUE if every metadatum was processed
+ */
+static gboolean
+cr_collect_additional_metadata_records(GThreadPool *pool,
+                                       GHashTable *tasks,
+                                       GSList *additional_metadata,
+                                       const cr_Metadatum *groupfile_metadatum,
+                                       GSList **records,
+                                       GError **err)
+{
+    GSList *additional_metadata_rec = NULL;
+    GSList *metadata = g_slist_copy(additional_metadata);
+    gboolean ret = TRUE;
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    if (groupfile_metadatum)
+        metadata = g_slist_append(metadata, (gpointer) groupfile_metadatum);
+
+    for (GSList *elem = metadata; elem; elem = g_slist_next(elem)) {
+        cr_Metadatum *m = elem->data;
+        cr_AdditionalMetadatumTask *task = g_hash_table_lookup(tasks, m);
+
+        if (!task)
+            continue;
+
+        if (task->err) {
+            if (ret)
+                g_set_error(err, ERR_DOMAIN, task->err->code,
+                            "Cannot process %s %s: %s",
+                            m->type, m->name, task->err->message);
+            ret = FALSE;
+        }
+
+        if (!ret) {
+            // Just free the rest of the tasks
+            cr_repomd_record_free(task->record);
+            cr_repomd_record_free(task->crecord);
+            g_clear_error(&task->err);
+            g_free(task->content);
+            g_free(task);
+            continue;
+        }
+
+        additional_metadata_rec = g_slist_prepend(additional_metadata_rec,
+                                                  task->record);
+        if (task->crecord)
+            additional_metadata_rec = g_slist_prepend(additional_metadata_rec,
+                                                      task->crecord);
+
+        g_free(task->content);
+        g_free(task);
+    }
+
+    g_slist_free(metadata);
+    g_hash_table_destroy(tasks);
+
+    if (!ret)
+        cr_slist_free_full(additional_metadata_rec,
+                           (GDestroyNotify) cr_repomd_record_free);
+    else
+        *records = additional_metadata_rec;
+
+    return ret;
+}
+
+/** Fill the open checksum and size of a .xml.zck record without reading
+ *  the file again. The .xml.zck files are written without a checksum of
+ *  their open content, it is the same as the content of the .xml files,
+ *  unless the package count was rewritten - then the stats of the
+ *  rewritten file have the checksum.
+ *
+ * @param zck_rec       Record of the .xml.zck file
+ * @param xml_rec       Record of the .xml file with the same content
+ * @param zck_stat      Content stats of the .xml.zck file
+ */
+static void
+load_zck_open_contentstat(cr_RepomdRecord *zck_rec,
+                          cr_RepomdRecord *xml_rec,
+                          cr_ContentStat *zck_stat)
+{
+    if (zck_stat && zck_stat->checksum) {
+        cr_repomd_record_load_contentstat(zck_rec, zck_stat);
+        return;
+    }
+
+    if (!xml_rec->checksum_open || (zck_stat && zck_stat->size != xml_rec->size_open))
+        return;     // cr_repomd_record_fill() computes it from the file
+
+    zck_rec->checksum_open = cr_safe_string_chunk_insert(zck_rec->chunk,
+                                                         xml_rec->checksum_open);
+    zck_rec->checksum_open_type = cr_safe_string_chunk_insert(zck_rec->chunk,
+                                                              xml_rec->checksum_open_type);
+    zck_rec->size_open = xml_rec->size_open;
+}
+
+/** Atomically exchange two directories by renameat2(RENAME_EXCHANGE).
+ *  Fails when the dst doesn't exist or when the system or the filesystem
+ *  doesn't support the exchange, the caller renames the directories
+ *  one by one then.
+ *
+ * @param src           A directory
+ * @param dst           The other directory
+ * @return              TRUE if the directories were exchanged
+ */
+static gboolean
+exchange_dirs(const char *src, const char *dst)
+{
+#ifdef RENAME_EXCHANGE
+    if (renameat2(AT_FDCWD, src, AT_FDCWD, dst, RENAME_EXCHANGE) == 0)
+        return TRUE;
+    if (errno != ENOENT)
+        g_debug("%s: Cannot exchange %s <-> %s: %s", __func__, src, dst,
+                g_strerror(errno));
+#endif
+    return FALSE;
+}
+
+/** Share the file of a record with other repositories by the --shared-store.
+ *  The name of the file contains its checksum, a file of the same name and
+ *  size in the store has the same content. Then the file in the repodata
+ *  is replaced by a hardlink to the stored one, otherwise the file is added
+ *  to the store. When a link can't be created (e.g. the store is on another
+ *  filesystem) the repodata keep their own copy.
+ *
+ * @param rec           Record with a renamed (unique) file or NULL
+ * @param store         The shared store directory
+ * @return              Size of the file if it was replaced by the stored one
+ */
+static gint64
+share_record_file(cr_RepomdRecord *rec, const char *store)
+{
+    GStatBuf st, st_stored;
+    gchar *filename, *stored, *tmp_path;
+    gint64 shared = 0;
+
+    if (!rec || !rec->location_real || g_stat(rec->location_real, &st) != 0)
+        return 0;
+
+    filename = g_path_get_basename(rec->location_real);
+    stored = g_build_filename(store, filename, NULL);
+    g_free(filename);
+
+    if (g_stat(stored, &st_stored) != 0) {
+        // A new file, EEXIST means a concurrent run just added the same one
+        if (link(rec->location_real, stored) == 0)
+            g_debug("%s: Added %s to the shared store", __func__, stored);
+        else if (errno != EEXIST)
+            g_warning("Cannot add %s to the shared store: %s",
+                      rec->location_real, g_strerror(errno));
+        g_free(stored);
+        return 0;
+    }
+
+    if (st.st_dev == st_stored.st_dev && st.st_ino == st_stored.st_ino) {
+        g_free(stored);
+        return 0;   // Already linked
+    }
+
+    if (st.st_size != st_stored.st_size) {
+        g_warning("Cannot share %s: %s has a different size",
+                  rec->location_real, stored);
+        g_free(stored);
+        return 0;
+    }
+
+    // Swap the file atomically, the repodata never miss it
+    tmp_path = g_strconcat(rec->location_real, ".shared", NULL);
+    if (link(stored, tmp_path) == 0 && rename(tmp_path, rec->location_real) == 0) {
+        g_debug("%s: Using %s from the shared store", __func__, stored);
+        shared = st.st_size;
+    } else {
+        g_warning("Cannot link %s from the shared store: %s",
+                  stored, g_strerror(errno));
+        unlink(tmp_path);
+    }
+
+    g_free(tmp_path);
+    g_free(stored);
+    return shared;
+}
+
+/** Fill the checksums of a reused old db from its old record,
+ *  cr_repomd_record_fill() doesn't have to read the file then.
+ *
+ * @param db_rec        Record of the reused db
+ * @param old_rec       Old record of the db
+ * @param checksum_type Checksum type of the records
+ */
+static void
+load_old_db_checksums(cr_RepomdRecord *db_rec,
+                      cr_RepomdRecord *old_rec,
+                      cr_ChecksumType checksum_type)
+{
+    const char *type_str = cr_checksum_name_str(checksum_type);
+
+    if (old_rec->checksum && !g_strcmp0(old_rec->checksum_type, type_str)) {
+        db_rec->checksum = cr_safe_string_chunk_insert(db_rec->chunk,
+                                                       old_rec->checksum);
+        db_rec->checksum_type = cr_safe_string_chunk_insert(db_rec->chunk,
+                                                            type_str);
+    }
+
+    if (old_rec->checksum_open && old_rec->size_open != G_GINT64_CONSTANT(-1)
+        && !g_strcmp0(old_rec->checksum_open_type, type_str)) {
+        db_rec->checksum_open = cr_safe_string_chunk_insert(db_rec->chunk,
+                                                            old_rec->checksum_open);
+        db_rec->checksum_open_type = cr_safe_string_chunk_insert(db_rec->chunk,
+                                                                 type_str);
+        db_rec->size_open = old_rec->size_open;
+    }
+}
+
+/** Check if task finished without error, if yes
+ *  use content stats of the new file
+ *
+ * @param task          Rewrite pkg count task
+ * @param filename      Name of file with wrong package count 
+ * @param exit_val      If errors occured set createrepo_c exit value
+ * @param content_stat  Content stats for filename    
+ *
+ */
+static void
+error_check_and_set_content_stat(cr_CompressionTask *task, char *filename, int *exit_val, cr_ContentStat **content_stat){
+    if (task->err) {
+        g_critical("Cannot rewrite pkg count in %s: %s",
+                   filename, task->err->message);
+        *exit_val = 2;
+    }else{
+        cr_contentstat_free(*content_stat, NULL);
+        *content_stat = task->stat;
+        task->stat = NULL;
+    }
+}
+
+/** The files of one type of metadata (primary, filelists or other) and
+ *  their records. The steps of the job are tasks of a cr_TaskGraph, every
+ *  step depends only on the files it needs.
+ */
+typedef struct {
+    struct CmdOptions *cmd_options;
+    cr_Metrics *metrics;                    /*!< Timing of the phases or NULL */
+    const char *type;                       /*!< Type of the xml record */
+    char *xml_filename;                     /*!< Path to the xml file */
+    cr_ContentStat *stat;                   /*!< Stats of the xml file */
+    cr_CompressionTask *rewrite_task;       /*!< Rewrite of the package count
+                                                 in the xml file or NULL */
+    cr_RepomdRecord *xml_rec;               /*!< Record of the xml file */
+    cr_SqliteDb *db;                        /*!< Sqlite db or NULL */
+    char *db_filename;                      /*!< Path to the open db */
+    cr_CompressionTask *db_task;            /*!< Compression of the db */
+    cr_RepomdRecord *db_rec;                /*!< Record of the compressed db */
+    cr_RepomdRecord *old_xml_rec;           /*!< Record of the old xml file
+                                                 or NULL */
+    cr_RepomdRecord *old_db_rec;            /*!< Record of the old compressed
+                                                 db or NULL */
+    char *old_db_path;                      /*!< Path to the old compressed db
+                                                 (same compression) or NULL */
+    gboolean db_unchanged;                  /*!< The old compressed db is
+                                                 reused */
+    char *zck_filename;                     /*!< Path to the zchunk file */
+    cr_ContentStat *zck_stat;               /*!< Stats of the zchunk file */
+    cr_CompressionTask *zck_rewrite_task;   /*!< Rewrite of the package count
+                                                 in the zchunk file or NULL */
+    cr_RepomdRecord *zck_rec;               /*!< Record of the zchunk file */
+    int exit_val;                           /*!< Exit value if the package
+                                                 count was not rewritten */
+    GError *err;                            /*!< Fatal error of the db */
+} cr_MetadataFileJob;
+
+/** Fill the record of the xml file. Task of a cr_TaskGraph, it depends
+ *  on the rewrite of the package count.
+ */
+static void
+metadata_file_xml_fill_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    cr_MetadataFileJob *job = data;
+
+    if (job->rewrite_task)
+        error_check_and_set_content_stat(job->rewrite_task, job->xml_filename,
+                                         &job->exit_val, &job->stat);
+
+    cr_repomd_record_load_contentstat(job->xml_rec, job->stat);
+    cr_contentstat_free(job->stat, NULL);
+    job->stat = NULL;
+
+    cr_metrics_set_thread_name(job->metrics, "finish");
+    gint64 start = cr_metrics_start(job->metrics);
+    cr_repomd_record_fill(job->xml_rec, job->cmd_options->repomd_checksum_type, NULL);
+    cr_metrics_stop(job->metrics, CR_METRICS_REPOMD, start, job->xml_rec->size);
+}
+
+/** Check if the xml file is the same as the old one. The old compressed db
+ *  was then generated from the same packages and stores the same checksum
+ *  of the xml file, it can be reused instead of compressing the new db.
+ */
+static gboolean
+metadata_file_db_unchanged(cr_MetadataFileJob *job)
+{
+    cr_RepomdRecord *rec = job->xml_rec, *old_rec = job->old_xml_rec;
+
+    if (!old_rec || !job->old_db_rec || !job->old_db_path)
+        return FALSE;
+
+    return rec->checksum && rec->checksum_open
+           && !g_strcmp0(rec->checksum, old_rec->checksum)
+           && !g_strcmp0(rec->checksum_type, old_rec->checksum_type)
+           && !g_strcmp0(rec->checksum_open, old_rec->checksum_open)
+           && g_file_test(job->old_db_path, G_FILE_TEST_IS_REGULAR);
+}
+
+/** Remove the packages which are not in the repo anymore from the db,
+ *  store the checksum of the xml file into it and close it unless it is
+ *  an in-memory db (it is closed by its compression). Task of
+ *  a cr_TaskGraph, it depends on the record of the xml file.
+ *  If the xml file didn't change the db is just closed, the old
+ *  compressed db is used.
+ */
+static void
+metadata_file_db_close_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    cr_MetadataFileJob *job = data;
+    guint removed = 0;
+    GError *tmp_err = NULL;
+
+    if (metadata_file_db_unchanged(job)) {
+        g_debug("%s: %s didn't change, reusing %s", __func__,
+                job->type, job->old_db_path);
+        job->db_unchanged = TRUE;
+        // Not closed by the compression
+        job->db_task->db = NULL;
+        cr_db_close(job->db, &tmp_err);
+        if (tmp_err) {
+            g_propagate_prefixed_error(&job->err, tmp_err,
+                                       "Error while closing db: ");
+        }
+        return;
+    }
+
+    cr_db_remove_unused_packages(job->db, &removed, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(&job->err, tmp_err,
+                                   "Error updating reused db: ");
+        return;
+    }
+    if (removed)
+        g_debug("%u packages removed from the reused %s", removed,
+                job->db_filename);
+
+    cr_db_dbinfo_update(job->db, job->xml_rec->checksum, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(&job->err, tmp_err,
+                                   "Error updating dbinfo: ");
+        return;
+    }
+
+    if (!job->cmd_options->sqlite_in_memory) {
+        cr_db_close(job->db, &tmp_err);
+        if (tmp_err) {
+            g_propagate_prefixed_error(&job->err, tmp_err,
+                                       "Error while closing db: ");
+            return;
+        }
+    }
+}
+
+/** Compress the db. Task of a cr_TaskGraph, it depends on the close
+ *  of the db. The user_data is the cr_CpuSet of the writers or NULL.
+ */
+static void
+metadata_file_db_compress_thread(gpointer data, gpointer user_data)
+{
+    cr_MetadataFileJob *job = data;
+    GError *tmp_err = NULL;
+
+    if (job->err)
+        return;
+
+    if (job->db_unchanged) {
+        // The old repodata are removed later, a link is enough
+        if (link(job->old_db_path, job->db_task->dst) == 0
+            || cr_copy_file(job->old_db_path, job->db_task->dst, &tmp_err))
+            return;
+        g_propagate_prefixed_error(&job->err, tmp_err,
+                                   "Cannot reuse the old db: ");
+        return;
+    }
+
+    cr_metrics_set_thread_name(job->metrics, "finish");
+    gint64 start = cr_metrics_start(job->metrics);
+    cr_compressing_thread(job->db_task, user_data);
+    cr_metrics_stop(job->metrics, CR_METRICS_COMPRESS, start,
+                    job->db_task->stat ? job->db_task->stat->size : 0);
+}
+
+/** Fill the record of the compressed db. Task of a cr_TaskGraph, it
+ *  depends on the compression of the db.
+ */
+static void
+metadata_file_db_fill_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    cr_MetadataFileJob *job = data;
+    struct CmdOptions *cmd_options = job->cmd_options;
+
+    if (job->err || job->db_task->err)
+        return;
+
+    if (!cmd_options->local_sqlite && !cmd_options->sqlite_in_memory)
+        cr_rm(job->db_filename, CR_RM_FORCE, NULL, NULL);
+
+    gchar *db_type = g_strconcat(job->type, "_db", NULL);
+    job->db_rec = cr_repomd_record_new(db_type, job->db_task->dst);
+    g_free(db_type);
+
+    cr_repomd_record_load_contentstat(job->db_rec, job->db_task->stat);
+    if (job->db_unchanged)
+        load_old_db_checksums(job->db_rec, job->old_db_rec,
+                              cmd_options->repomd_checksum_type);
+
+    cr_metrics_set_thread_name(job->metrics, "finish");
+    gint64 start = cr_metrics_start(job->metrics);
+    cr_repomd_record_fill(job->db_rec, cmd_options->repomd_checksum_type, NULL);
+    cr_metrics_stop(job->metrics, CR_METRICS_REPOMD, start, job->db_rec->size);
+}
+
+/** Fill the record of the zchunk file. Task of a cr_TaskGraph, it
+ *  depends on the record of the xml file (the open content is the same)
+ *  and on the rewrite of the package count in the zchunk file.
+ */
+static void
+metadata_file_zck_fill_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    cr_MetadataFileJob *job = data;
+
+    if (job->zck_rewrite_task)
+        error_check_and_set_content_stat(job->zck_rewrite_task, job->zck_filename,
+                                         &job->exit_val, &job->zck_stat);
+
+    gchar *zck_type = g_strconcat(job->type, "_zck", NULL);
+    job->zck_rec = cr_repomd_record_new(zck_type, job->zck_filename);
+    g_free(zck_type);
+
+    cr_repomd_record_load_zck_contentstat(job->zck_rec, job->zck_stat);
+    load_zck_open_contentstat(job->zck_rec, job->xml_rec, job->zck_stat);
+
+    cr_metrics_set_thread_name(job->metrics, "finish");
+    gint64 start = cr_metrics_start(job->metrics);
+    cr_repomd_record_fill(job->zck_rec, job->cmd_options->repomd_checksum_type, NULL);
+    cr_metrics_stop(job->metrics, CR_METRICS_REPOMD, start, job->zck_rec->size);
+}
+
+/** Names of the decompressed old sqlite DBs in the temporary repodata.
+ */
+static const char *old_sqlite_db_names[CR_DB_SENTINEL] = {
+    "old-primary.sqlite",
+    "old-filelists.sqlite",
+    "old-other.sqlite",
+};
+
+/** Remove the decompressed old sqlite DBs from the temporary repodata.
+ */
+static void
+remove_old_sqlite_dbs(const gchar *tmp_dir)
+{
+    for (int x = 0; x < CR_DB_SENTINEL; x++) {
+        gchar *path = g_build_filename(tmp_dir, old_sqlite_db_names[x], NULL);
+        cr_rm(path, CR_RM_FORCE, NULL, NULL);
+        g_free(path);
+    }
+}
+
+/** Open the sqlite DBs of the old repodata, the old packages are read
+ *  from them on demand instead of loading the old XML (--update-from-sqlite).
+ *  The DBs are decompressed into the tmp_dir.
+ *
+ * @param ml                Location of the old repodata
+ * @param cmd_options       Options
+ * @param tmp_dir           Temporary repodata directory
+ * @return                  Reader or NULL if the DBs cannot be used
+ */
+static cr_DbPackageReader *
+open_old_sqlite_dbs(struct cr_MetadataLocation *ml,
+                    struct CmdOptions *cmd_options,
+                    const gchar *tmp_dir)
+{
+    const gchar *db_hrefs[CR_DB_SENTINEL] = { ml->pri_sqlite_href,
+                                              ml->fil_sqlite_href,
+                                              ml->oth_sqlite_href };
+    gchar *db_paths[CR_DB_SENTINEL] = { NULL };
+    cr_DbPackageReader *reader = NULL;
+    GError *tmp_err = NULL;
+
+    if (!db_hrefs[CR_DB_PRIMARY] || !db_hrefs[CR_DB_FILELISTS]
+        || !db_hrefs[CR_DB_OTHER]) {
+        g_message("Old repodata have no sqlite DBs, loading their XML");
+        return NULL;
+    }
+
+#ifdef WITH_LIBMODULEMD
+    // The kept module metadata are loaded together with the XML
+    if (cmd_options->keep_all_metadata
+        && g_slist_find_custom(ml->additional_metadata, "modules",
+                               cr_cmp_metadatum_type)) {
+        g_message("Old repodata have module metadata, loading their XML");
+        return NULL;
+    }
+#else
+    (void) cmd_options;
+#endif /* WITH_LIBMODULEMD */
+
+    for (int x = 0; x < CR_DB_SENTINEL && !tmp_err; x++) {
+        db_paths[x] = g_build_filename(tmp_dir, old_sqlite_db_names[x], NULL);
+        cr_decompress_file(db_hrefs[x], db_paths[x],
+                           CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+    }
+
+    if (!tmp_err)
+        reader = cr_db_package_reader_new(db_paths[CR_DB_PRIMARY],
+                                          db_paths[CR_DB_FILELISTS],
+                                          db_paths[CR_DB_OTHER],
+                                          &tmp_err);
+
+    if (tmp_err) {
+        g_warning("Cannot read the old sqlite DBs, loading the old XML: %s",
+                  tmp_err->message);
+        g_clear_error(&tmp_err);
+        remove_old_sqlite_dbs(tmp_dir);
+    }
+
+    for (int x = 0; x < CR_DB_SENTINEL; x++)
+        g_free(db_paths[x]);
+
+    return reader;
+}
+
+static gboolean
+load_old_metadata(cr_Metadata **md,
+                  cr_DbPackageReader **old_db,
+                  struct cr_MetadataLocation **md_location,
+                  GSList *current_pkglist,
+                  struct CmdOptions *cmd_options,
+                  gchar *dir,
+                  const gchar *tmp_dir,
+                  GError **err)
+{
+    GError *tmp_err = NULL;
+
+    // The sqlite DBs are located only if the old packages are read from them
+    *md_location = cr_locate_metadata(dir,
+                                      !(old_db && cmd_options->update_from_sqlite),
+                                      &tmp_err);
+    if (tmp_err) {
+        if (tmp_err->domain == CRE_MODULEMD) {
+            g_clear_pointer(md_location, cr_metadatalocation_free);
+            g_propagate_error(err, tmp_err);
+            return FALSE;
+        } else {
+            g_debug("Old metadata from default outputdir not found: %s",tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    *md = cr_metadata_new(CR_HT_KEY_HREF, 1, current_pkglist);
+    cr_metadata_set_dupaction(*md, CR_HT_DUPACT_REMOVEALL);
+    // Keep raw xml of the packages, unchanged packages are written
+    // without dumping them again
+    cr_metadata_set_store_raw(*md, TRUE);
+    // Files and changelogs are parsed only if they are really needed
+    cr_metadata_set_lazy(*md, TRUE);
+    // Their raw xml waits in temporary files meanwhile, most of the old
+    // packages are only matched with the stat of their files
+    cr_metadata_set_spool_raw(*md, TRUE);
+    // Old packages share repeated strings (arch, dependencies, ...)
+    cr_metadata_set_intern_strings(*md, TRUE);
+
+    if (*md_location && old_db && cmd_options->update_from_sqlite) {
+        *old_db = open_old_sqlite_dbs(*md_location, cmd_options, tmp_dir);
+        if (*old_db)
+            g_message("Reading information about %u old packages from "
+                      "the sqlite DBs on demand",
+                      cr_db_package_reader_size(*old_db));
+    }
+
+    // The old repodata and all the --update-md-path repos are loaded
+    // concurrently and merged in this order
+    gboolean load_old_xml = *md_location && !(old_db && *old_db);
+    guint count = g_slist_length(cmd_options->l_update_md_paths)
+                  + (load_old_xml ? 1 : 0);
+    cr_MetadataSource *sources = g_new0(cr_MetadataSource, count);
+    guint x = 0;
+
+    if (load_old_xml)
+        sources[x++].ml = *md_location;
+
+    GSList *element = cmd_options->l_update_md_paths;
+    for (; element; element = g_slist_next(element)) {
+        char *path = (char *) element->data;
+        g_message("Loading metadata from md-path: %s", path);
+        sources[x++].repopath = path;
+    }
+
+    cr_metadata_load_sources(*md, sources, count, cmd_options->workers);
+
+    for (x = 0; x < count; x++) {
+        cr_MetadataSource *source = &sources[x];
+        assert(source->code == CRE_OK || source->err);
+
+        if (source->ml) {
+            if (source->code == CRE_OK)
+                g_debug("Old metadata from: %s - loaded",
+                        source->ml->original_url);
+            else
+                g_debug("Old metadata from %s - loading failed: %s",
+                        source->ml->original_url, source->err->message);
+        } else {
+            if (source->code == CRE_OK)
+                g_debug("Metadata from md-path %s - loaded",
+                        source->repopath);
+            else
+                g_warning("Metadata from md-path %s - loading failed: %s",
+                          source->repopath, source->err->message);
+        }
+        g_clear_error(&source->err);
+    }
+    g_free(sources);
+
+    if (!(old_db && *old_db) || cmd_options->l_update_md_paths)
+        g_message("Loaded information about %d packages",
+                  g_hash_table_size(cr_metadata_hashtable(*md)));
+    return TRUE;
+}
+
+/** Account the loading of the old metadata which started at the load_start
+ * when the RSS was load_rss. The growth of the RSS is the memory held
+ * by the old metadata, their strings are in GStringChunks whose size
+ * isn't known otherwise.
+ */
+static void
+account_old_metadata(cr_Metrics *metrics, gint64 load_start, gint64 load_rss)
+{
+    cr_metrics_stop(metrics, CR_METRICS_LOAD_OLD, load_start, 0);
+    if (!metrics || load_rss < 0)
+        return;
+
+    gint64 rss = cr_metrics_rss(NULL);
+    if (rss >= 0)
+        cr_metrics_memory_add(metrics, CR_METRICS_MEM_OLD_METADATA,
+                              MAX(rss - load_rss, 0));
+}
+
+
+/** Train the zchunk dictionaries missing in the dictionary directory
+ *  from the .xml.zck files of the old repodata. An existing dictionary
+ *  is never retrained - clients reuse the chunks of their old files
+ *  only while the dictionary stays the same.
+ *
+ * @param dict_dir          Directory with zchunk dictionaries
+ * @param old_metadata_dir  Directory with the old repodata
+ */
+static void
+train_missing_zck_dicts(const gchar *dict_dir, const gchar *old_metadata_dir)
+{
+    const gchar *names[] = { "primary.xml", "filelists.xml", "other.xml" };
+    struct cr_MetadataLocation *ml = NULL;
+    GError *tmp_err = NULL;
+
+    for (int x = 0; x < 3; x++) {
+        gchar *dict_file = g_strconcat(dict_dir, names[x], ".zdict", NULL);
+        if (g_file_test(dict_file, G_FILE_TEST_EXISTS)) {
+            g_free(dict_file);
+            continue;
+        }
+
+        if (!ml) {
+            ml = cr_locate_metadata(old_metadata_dir, TRUE, &tmp_err);
+            if (!ml) {
+                g_debug("Cannot train zchunk dicts - no old metadata: %s",
+                        tmp_err ? tmp_err->message : "not found");
+                g_clear_error(&tmp_err);
+                g_free(dict_file);
+                return;
+            }
+        }
+
+        const gchar *zck_href = (x == 0) ? ml->pri_zck_href :
+                                (x == 1) ? ml->fil_zck_href : ml->oth_zck_href;
+        if (!zck_href) {
+            g_debug("Cannot train %s - no old %s.zck", dict_file, names[x]);
+            g_free(dict_file);
+            continue;
+        }
+
+        gsize dict_size = 0;
+        gchar *dict = cr_zck_train_dict(zck_href, CR_ZCK_DEFAULT_DICT_SIZE,
+                                        &dict_size, &tmp_err);
+        if (dict && g_mkdir_with_parents(dict_dir, 0755))
+            g_set_error(&tmp_err, CREATEREPO_C_ERROR, CRE_IO,
+                        "Cannot create %s: %s", dict_dir, g_strerror(errno));
+        if (!tmp_err)
+            g_file_set_contents(dict_file, dict, dict_size, &tmp_err);
+
+        if (tmp_err) {
+            g_warning("Cannot train zchunk dict %s: %s",
+                      dict_file, tmp_err->message);
+            g_clear_error(&tmp_err);
+        } else {
+            g_message("Zchunk dict %s trained from %s", dict_file, zck_href);
+        }
+        g_free(dict);
+        g_free(dict_file);
+    }
+
+    cr_metadatalocation_free(ml);
+}
+
+/** Open the sqlite databases from the sqlite DBs of the old repodata,
+ *  the old DBs are decompressed into the db_filenames. A database which
+ *  cannot be reused is left NULL and should be created from scratch.
+ *
+ * @param old_metadata_dir  Directory with the old repodata
+ * @param db_filenames      Paths of the new databases (NULL for
+ *                          the databases which are not generated)
+ * @param dbs               Opened databases
+ */
+static void
+open_reused_sqlite_dbs(const gchar *old_metadata_dir,
+                       gchar *db_filenames[CR_DB_SENTINEL],
+                       cr_SqliteDb *dbs[CR_DB_SENTINEL])
+{
+    struct cr_MetadataLocation *ml = NULL;
+    GError *tmp_err = NULL;
+
+    ml = cr_locate_metadata(old_metadata_dir, TRUE, &tmp_err);
+    if (!ml) {
+        g_warning("Cannot reuse sqlite DBs - no old metadata: %s",
+                  tmp_err ? tmp_err->message : "not found");
+        g_clear_error(&tmp_err);
+        return;
+    }
+
+    for (int x = 0; x < CR_DB_SENTINEL; x++) {
+        const gchar *db_href = (x == CR_DB_PRIMARY) ? ml->pri_sqlite_href :
+                               (x == CR_DB_FILELISTS) ? ml->fil_sqlite_href :
+                               ml->oth_sqlite_href;
+        cr_SqliteDb *db = NULL;
+
+        if (!db_filenames[x])
+            continue;   // The database is not generated
+        if (!db_href) {
+            g_debug("No old sqlite DB to reuse for %s", db_filenames[x]);
+            continue;
+        }
+
+        cr_decompress_file(db_href, db_filenames[x],
+                           CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+        if (!tmp_err)
+            db = cr_db_open(db_filenames[x], x, &tmp_err);
+        if (!tmp_err)
+            cr_db_reuse_packages(db, &tmp_err);
+
+        if (tmp_err) {
+            g_warning("Cannot reuse %s: %s", db_href, tmp_err->message);
+            g_clear_error(&tmp_err);
+            cr_db_close(db, NULL);
+            cr_rm(db_filenames[x], CR_RM_FORCE, NULL, NULL);
+            continue;
+        }
+
+        g_debug("Reusing %s", db_href);
+        dbs[x] = db;
+    }
+
+    cr_metadatalocation_free(ml);
+}
+
+struct _cr_CreaterepoOptions {
+    struct CmdOptions *cmd_options; /*!< parsed options */
+    gchar **directories;            /*!< directories to index */
+    gboolean used;                  /*!< the options were used by a run */
+};
+
+cr_CreaterepoOptions *
+cr_createrepo_options_new(const gchar * const *args, GError **err)
+{
+    cr_CreaterepoOptions *options = NULL;
+    struct CmdOptions *cmd_options;
+    int argc = (args ? g_strv_length((gchar **) args) : 0) + 1;
+    gchar **strv = g_new0(gchar *, argc + 1);
+    gchar **argv = g_new0(gchar *, argc + 1);
+
+    assert(!err || *err == NULL);
+
+    // The parser removes the parsed options from the argv, the strings
+    // are freed by the strv
+    strv[0] = g_strdup("createrepo_c");
+    for (int x = 1; x < argc; x++)
+        strv[x] = g_strdup(args[x-1]);
+    memcpy(argv, strv, argc * sizeof(gchar *));
+
+    cmd_options = cr_cmd_parse_arguments(&argc, &argv, err);
+    if (cmd_options) {
+        options = g_malloc0(sizeof(*options));
+        options->cmd_options = cmd_options;
+        options->directories = g_new0(gchar *, argc);
+        for (int x = 1; x < argc; x++)
+            options->directories[x-1] = g_strdup(argv[x]);
+    }
+
+    g_free(argv);
+    g_strfreev(strv);
+    return options;
+}
+
+void
+cr_createrepo_options_free(cr_CreaterepoOptions *options)
+{
+    if (!options)
+        return;
+    cr_cmd_free_options(options->cmd_options);
+    g_strfreev(options->directories);
+    g_free(options);
+}
+
+cr_CreaterepoResult *
+cr_createrepo_run(cr_CreaterepoOptions *options, GError **err)
+{
+    assert(options);
+    assert(!err || *err == NULL);
+
+    if (options->used) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "The options were already used by another run");
+        return NULL;
+    }
+    options->used = TRUE;
+
+    return cr_createrepo_run_cmd_options(options->cmd_options,
+                                         options->directories,
+                                         FALSE, NULL, err);
+}
+
+void
+cr_createrepo_result_free(cr_CreaterepoResult *result)
+{
+    if (!result)
+        return;
+    g_free(result->repomd_path);
+    g_free(result);
+}
+
+GThreadPool *
+cr_createrepo_shared_pool_new(gint workers)
+{
+    return g_thread_pool_new(cr_dumper_thread, NULL, workers, FALSE, NULL);
+}
+
+cr_CreaterepoResult *
+cr_createrepo_run_cmd_options(struct CmdOptions *cmd_options,
+                              gchar **dirs,
+                              gboolean cleanup_handler,
+                              GThreadPool *shared_pool,
+                              GError **err)
+{
+    cr_CreaterepoResult *result = NULL;
+    cr_RunContext *run_ctx = NULL;
+    gboolean ret;
+    GError *tmp_err = NULL;
+    int exit_val = EXIT_SUCCESS;
+    guint dirs_count = dirs ? g_strv_length(dirs) : 0;
+
+    assert(!err || *err == NULL);
+
+    if (cmd_options->split ? dirs_count < 1 : dirs_count != 1) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Must specify %s directory to index",
+                    cmd_options->split ? "at least one" : "exactly one");
+        return NULL;
+    }
+
+    // Settings of this run, every thread working for it uses them, the runs
+    // in the process don't share them
+    run_ctx = cr_run_context_new(cmd_options->quiet, cmd_options->verbose);
+    cr_run_context_push(run_ctx);
+
+    // The libraries stay initialized between the runs if the caller
+    // (e.g. the createrepo_c program) initialized them too
+    cr_package_parser_init();
+    cr_xml_dump_init();
+
+    // Dirs
+    gchar *in_dir       = NULL;  // path/to/repo/
+    gchar *in_repo      = NULL;  // path/to/repo/repodata/
+    gchar *out_dir      = NULL;  // path/to/out_repo/
+    gchar *out_repo     = NULL;  // path/to/out_repo/repodata/
+    gchar *tmp_out_repo = NULL;  // usually path/to/out_repo/.repodata/
+    gchar *lock_dir     = NULL;  // path/to/out_repo/.repodata/
+
+    // Resources released in the fail path
+    FILE *output_pkg_list = NULL;
+    cr_Metrics *metrics = NULL;
+    struct UserData user_data = {0};
+    char *contenthash = NULL;
+    GThreadPool *pool = NULL;
+    GThreadPool *additional_pool = NULL;
+    GHashTable *additional_tasks = NULL;
+    cr_Metadata *old_metadata = NULL;
+    cr_DbPackageReader *old_db = NULL;
+    GStringChunk *task_paths = NULL;  // Directories of the tasks, shared
+                                      // by the tasks of a directory
+    GPtrArray *remote_pkgs = NULL;    // Packages of --remote-manifest
+    long remote_first_id = 0;         // ID of the first remote package
+    gchar **in_dirs = NULL;           // Normalized input dirs
+    GPtrArray *held_tasks = NULL;     // Tasks pushed when the pool starts
+    gboolean stream_walk;             // Walk while the pool is running
+    struct cr_MetadataLocation *old_metadata_location = NULL;
+    cr_XmlFile *pri_cr_file = NULL;
+    cr_XmlFile *fil_cr_file = NULL;
+    cr_XmlFile *oth_cr_file = NULL;
+    cr_XmlFile *pri_cr_zck = NULL;
+    cr_XmlFile *fil_cr_zck = NULL;
+    cr_XmlFile *oth_cr_zck = NULL;
+    cr_BlockIndex *block_index = NULL;
+    cr_SqliteDb *pri_db = NULL;
+    cr_SqliteDb *fil_db = NULL;
+    cr_SqliteDb *oth_db = NULL;
+    gchar *pri_xml_filename = NULL;
+    gchar *fil_xml_filename = NULL;
+    gchar *oth_xml_filename = NULL;
+    gchar *pri_db_filename = NULL;
+    gchar *fil_db_filename = NULL;
+    gchar *oth_db_filename = NULL;
+    gchar *pri_zck_filename = NULL;
+    gchar *fil_zck_filename = NULL;
+    gchar *oth_zck_filename = NULL;
+    gchar *pri_dict_file = NULL;
+    gchar *fil_dict_file = NULL;
+    gchar *oth_dict_file = NULL;
+    gchar *pri_dict = NULL;
+    gchar *fil_dict = NULL;
+    gchar *oth_dict = NULL;
+    cr_ContentStat *pri_stat = NULL;
+    cr_ContentStat *fil_stat = NULL;
+    cr_ContentStat *oth_stat = NULL;
+    cr_ContentStat *pri_zck_stat = NULL;
+    cr_ContentStat *fil_zck_stat = NULL;
+    cr_ContentStat *oth_zck_stat = NULL;
+    cr_TaskGraph *graph = NULL;
+    gboolean jobs_started = FALSE;  // The jobs own the stats and the dbs
+    cr_Repomd *old_repomd = NULL;   // Records of the reused unchanged dbs
+    GSList *additional_metadata = NULL;
+    GSList *additional_metadata_rec = NULL;  // List of cr_RepomdRecords
+
+
+
+    // Set logging stuff, the workers log per package and shouldn't wait
+    // for the output
+    cr_setup_async_logging(cmd_options->quiet, cmd_options->verbose);
+
+    if (cmd_options->basedir && !g_str_has_prefix(dirs[0], "/")) {
+        gchar *tmp = cr_normalize_dir_path(dirs[0]);
+        in_dir = g_build_filename(cmd_options->basedir, tmp, NULL);
+        g_free(tmp);
+    } else {
+        in_dir = cr_normalize_dir_path(dirs[0]);
+    }
+
+    // Check if inputdir exists
+    if (!g_file_test(in_dir, G_FILE_TEST_IS_DIR)) {
+        g_set_error(err, ERR_DOMAIN, CRE_NODIR,
+                    "Directory %s must exist", in_dir);
+        goto fail;
+    }
+
+
+    // Check parsed arguments
+    if (!cr_cmd_check_arguments(cmd_options, in_dir, run_ctx->compression, err))
+        goto fail;
+
+    // Emit debug message with version
+    g_debug("Version: %s", cr_version_string_with_features());
+
+    // Set paths of input and output repos
+    in_repo = g_strconcat(in_dir, "repodata/", NULL);
+
+    if (cmd_options->outputdir) {
+        out_dir = cr_normalize_dir_path(cmd_options->outputdir);
+        out_repo = g_strconcat(out_dir, "repodata/", NULL);
+    } else {
+        out_dir  = g_strdup(in_dir);
+        out_repo = g_strdup(in_repo);
+    }
+
+    // Prepare cachedir for checksum if --cachedir is used
+    if (!prepare_cache_dir(cmd_options, out_dir, err))
+        goto fail;
+
+    // Block signals that terminates the process
+    if (!cr_block_terminating_signals(err))
+        goto fail;
+
+    // Check if lock exists & Create lock dir
+    if (!cr_lock_repo(out_dir, cmd_options->ignore_lock, &lock_dir, &tmp_out_repo, err)) {
+        // The lock may belong to another process, it must stay
+        g_clear_pointer(&lock_dir, g_free);
+        g_clear_pointer(&tmp_out_repo, g_free);
+        cr_unblock_terminating_signals(NULL);
+        goto fail;
+    }
+
+    // Setup cleanup handlers, a library call removes the lock by itself
+    if (cleanup_handler
+        && !cr_set_cleanup_handler(lock_dir, tmp_out_repo, err)) {
+        cr_unblock_terminating_signals(NULL);
+        goto fail;
+    }
+
+    // Unblock the blocked signals
+    if (!cr_unblock_terminating_signals(err))
+        goto fail;
+
+    // Open package list
+    if (cmd_options->read_pkgs_list) {
+        output_pkg_list = fopen(cmd_options->read_pkgs_list, "w");
+        if (!output_pkg_list) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Cannot open \"%s\" for writing: %s",
+                        cmd_options->read_pkgs_list, g_strerror(errno));
+            goto fail;
+        }
+    }
+
+
+    // Timing of the phases
+    if (cmd_options->metrics_file || cmd_options->trace_file) {
+        metrics = cr_metrics_new();
+        if (cmd_options->trace_file)
+            cr_metrics_enable_trace(metrics);
+        cr_metrics_set_thread_name(metrics, "main");
+    }
+
+    // Thread pool - Creation, the tasks know their user data
+    user_data.metrics = metrics;
+    user_data.run_ctx = run_ctx;
+    g_mutex_init(&(user_data.mutex_tasks));
+    g_cond_init(&(user_data.cond_tasks));
+    if (shared_pool)
+        pool = shared_pool;
+    else
+        pool = g_thread_pool_new(cr_dumper_thread, NULL, 0, TRUE, NULL);
+    g_debug("Thread pool ready");
+
+    long task_count = 0;
+
+    GSList *current_pkglist = NULL;
+    /* ^^^ List with basenames of files which will be processed */
+    task_paths = g_string_chunk_new(4096);
+
+    // Load old metadata if --update
+    gchar *old_metadata_dir = cmd_options->outputdir ? out_dir : in_dir;
+
+    if (cmd_options->recycle_pkglist) {
+        // load the old metadata early, so we can read the list of RPMs
+        gint64 load_start = cr_metrics_start(metrics);
+        gint64 load_rss = metrics ? cr_metrics_rss(NULL) : -1;
+        if (!load_old_metadata(&old_metadata,
+                               NULL /* the whole list of packages is needed */,
+                               &old_metadata_location,
+                               NULL /* no filter wanted in this case */,
+                               cmd_options,
+                               old_metadata_dir,
+                               tmp_out_repo,
+                               err))
+            goto fail;
+        account_old_metadata(metrics, load_start, load_rss);
+
+        GHashTableIter iter;
+        g_hash_table_iter_init(&iter, cr_metadata_hashtable(old_metadata));
+        gpointer pkg_pointer;
+        guint dropped = 0;
+        while (g_hash_table_iter_next(&iter, NULL, &pkg_pointer)) {
+            cr_Package *pkg = (cr_Package *)pkg_pointer;
+            if (cmd_options->changed_pkgs_set
+                && g_hash_table_contains(cmd_options->changed_pkgs_set,
+                                cr_get_cleaned_href(pkg->location_href))) {
+                // --changed-pkgs or --removed-pkgs, the old metadata
+                // of the package must not be used
+                g_hash_table_iter_remove(&iter);
+                dropped++;
+                continue;
+            }
+            cmd_options->include_pkgs = g_slist_prepend(
+                    cmd_options->include_pkgs,
+                    (gpointer) g_strdup(pkg->location_href));
+        }
+
+        if (cmd_options->changed_pkgs_set) {
+            for (GSList *elem = cmd_options->changed_pkgs_list;
+                 elem;
+                 elem = g_slist_next(elem))
+                cmd_options->include_pkgs = g_slist_prepend(
+                        cmd_options->include_pkgs,
+                        (gpointer) g_strdup(elem->data));
+            g_message("Reusing %u packages of the old metadata, "
+                      "%u added or changed, %u dropped",
+                      g_hash_table_size(cr_metadata_hashtable(old_metadata)),
+                      g_slist_length(cmd_options->changed_pkgs_list),
+                      dropped);
+        }
+    }
+
+    // Setup compression types
+    const char *xml_compression_suffix = NULL;
+    const char *sqlite_compression_suffix = NULL;
+    const char *compression_suffix = NULL;
+    cr_CompressionType xml_compression = CR_CW_GZ_COMPRESSION;
+    gboolean xml_deferred;
+    cr_CompressionType sqlite_compression = CR_CW_BZ2_COMPRESSION;
+    cr_CompressionType compression = CR_CW_GZ_COMPRESSION;
+
+    if (cmd_options->compression_type != CR_CW_UNKNOWN_COMPRESSION) {
+        sqlite_compression = cmd_options->compression_type;
+        compression        = cmd_options->compression_type;
+    }
+
+    if (cmd_options->general_compression_type != CR_CW_UNKNOWN_COMPRESSION) {
+        xml_compression    = cmd_options->general_compression_type;
+        sqlite_compression = cmd_options->general_compression_type;
+        compression        = cmd_options->general_compression_type;
+    }
+
+    xml_compression_suffix = cr_compression_suffix(xml_compression);
+    sqlite_compression_suffix = cr_compression_suffix(sqlite_compression);
+    compression_suffix = cr_compression_suffix(compression);
+
+    // The packages are processed during the walk only if the headers of
+    // the xml files are written at their end (see cr_xmlfile_sopen_deferred())
+    // and the order of the dispatch doesn't need the whole walk
+    stream_walk = cmd_options->stream_walk
+                  && !cmd_options->include_pkgs
+                  && !cmd_options->pkglist
+                  && !cmd_options->recycle_pkglist
+                  && !cmd_options->large_first
+                  && !cmd_options->zck_compression
+                  && cr_xmlfile_deferred_supported(xml_compression);
+
+    // The IDs of the remote packages follow the local ones
+    if (cmd_options->remote_manifest) {
+        remote_pkgs = load_remote_pkgs(cmd_options, err);
+        if (!remote_pkgs)
+            goto fail;
+        g_message("Remote manifest loaded - %u packages", remote_pkgs->len);
+    }
+
+    in_dirs = g_new0(gchar *, dirs_count + 1);
+    for (guint x = 0; x < dirs_count; x++)
+        in_dirs[x] = cr_normalize_dir_path(dirs[x]);
+    if (cmd_options->prefetch)
+        user_data.prefetch = cr_dumper_prefetch_new(cmd_options->prefetch);
+
+    // Thread pool - Fill with tasks
+    if (!stream_walk) {
+        held_tasks = g_ptr_array_new();
+        walk_input_dirs(pool, in_dirs, dirs_count, cmd_options, run_ctx,
+                        &current_pkglist, task_paths, &user_data, held_tasks,
+                        metrics, remote_pkgs, &remote_first_id, &task_count);
+        g_strfreev(in_dirs);
+        in_dirs = NULL;
+        g_debug("Package count: %ld", task_count);
+    }
+
+    if (cmd_options->update) {
+        if (old_metadata)
+            g_debug("Old metadata already loaded.");
+        else if (!task_count && !stream_walk)
+            g_debug("No packages found - skipping metadata loading");
+        else {
+            // The packages aren't known yet with --stream-walk,
+            // the whole metadata are loaded (the current_pkglist is NULL)
+            gint64 load_start = cr_metrics_start(metrics);
+            gint64 load_rss = metrics ? cr_metrics_rss(NULL) : -1;
+            if (!load_old_metadata(&old_metadata,
+                                   &old_db,
+                                   &old_metadata_location,
+                                   current_pkglist,
+                                   cmd_options,
+                                   old_metadata_dir,
+                                   tmp_out_repo,
+                                   err)) {
+                g_slist_free(current_pkglist);
+                goto fail;
+            }
+            account_old_metadata(metrics, load_start, load_rss);
+        }
+    }
+
+    g_slist_free(current_pkglist);
+    current_pkglist = NULL;
+    GHashTable *kept_records = NULL;
+
+    // The additional metadata don't depend on the packages, their records
+    // are filled while the packages are dumped
+    additional_pool = g_thread_pool_new(cr_additional_metadatum_thread,
+                                        run_ctx,
+                                        ADDITIONAL_METADATA_THREADS,
+                                        FALSE,
+                                        NULL);
+    additional_tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    cr_Metadatum *new_groupfile_metadatum = NULL;
+
+    // Groupfile specified as argument 
+    if (cmd_options->groupfile_fullpath) {
+        new_groupfile_metadatum = g_malloc0(sizeof(cr_Metadatum));
+        new_groupfile_metadatum->name = cr_copy_metadatum(cmd_options->groupfile_fullpath, tmp_out_repo, &tmp_err);
+        new_groupfile_metadatum->type = g_strdup("group");
+        //remove old groupfile(s) (every [compressed] variant)
+        if (old_metadata_location){
+            GSList *node_iter = old_metadata_location->additional_metadata;
+            while (node_iter != NULL){
+                cr_Metadatum *m = node_iter->data;
+                GSList *next = g_slist_next(node_iter);
+                if(g_str_has_prefix(m->type, "group")){
+                    old_metadata_location->additional_metadata = g_slist_delete_link(old_metadata_location->additional_metadata,
+                                                                                     node_iter);
+                    cr_metadatum_free(m);
+                }
+                node_iter = next;
+            }
+        }
+        cr_push_additional_metadatum_task(additional_pool,
+                                          additional_tasks,
+                                          new_groupfile_metadatum,
+                                          NULL,
+                                          NULL,
+                                          compression,
+                                          TRUE,
+                                          cmd_options->repomd_checksum_type);
+    }
+
+    // The dbs of the unchanged xml files are not compressed again,
+    // the old ones are reused (see metadata_file_db_unchanged())
+    if (cmd_options->update && !cmd_options->no_database && old_metadata_location)
+        old_repomd = load_old_repomd(old_metadata_location->repomd);
+
+    // Create and open new compressed files
+    g_message("Temporary output repo path: %s", tmp_out_repo);
+    g_debug("Creating .xml.gz files");
+
+    pri_xml_filename = g_strconcat(tmp_out_repo, "/primary.xml", xml_compression_suffix, NULL);
+    fil_xml_filename = g_strconcat(tmp_out_repo, "/filelists.xml", xml_compression_suffix, NULL);
+    oth_xml_filename = g_strconcat(tmp_out_repo, "/other.xml", xml_compression_suffix, NULL);
+
+    // The number of packages is known after all of them were read,
+    // the headers are corrected on close if some of them were invalid
+    xml_deferred = cr_xmlfile_deferred_supported(xml_compression);
+
+    pri_stat = cr_contentstat_new(cmd_options->repomd_checksum_type, NULL);
+    if (xml_deferred)
+        pri_cr_file = cr_xmlfile_sopen_deferred(pri_xml_filename,
+                                                CR_XMLFILE_PRIMARY,
+                                                xml_compression,
+                                                pri_stat,
+                                                &tmp_err);
+    else
+        pri_cr_file = cr_xmlfile_sopen_primary(pri_xml_filename,
+                                               xml_compression,
+                                               pri_stat,
+                                               &tmp_err);
+    assert(pri_cr_file || tmp_err);
+    if (!pri_cr_file) {
+        g_propagate_prefixed_error(err, tmp_err, "Cannot open file %s: ",
+                                   pri_xml_filename);
+        goto fail;
+    }
+
+    // Only primary is generated with --primary-only
+    if (!cmd_options->primary_only) {
+        fil_stat = cr_contentstat_new(cmd_options->repomd_checksum_type, NULL);
+        if (xml_deferred)
+            fil_cr_file = cr_xmlfile_sopen_deferred(fil_xml_filename,
+                                                    CR_XMLFILE_FILELISTS,
+                                                    xml_compression,
+                                                    fil_stat,
+                                                    &tmp_err);
+        else
+            fil_cr_file = cr_xmlfile_sopen_filelists(fil_xml_filename,
+                                                    xml_compression,
+                                                    fil_stat,
+                                                    &tmp_err);
+        assert(fil_cr_file || tmp_err);
+        if (!fil_cr_file) {
+            g_propagate_prefixed_error(err, tmp_err, "Cannot open file %s: ",
+                                       fil_xml_filename);
+            goto fail;
+        }
+
+        oth_stat = cr_contentstat_new(cmd_options->repomd_checksum_type, NULL);
+        if (xml_deferred)
+            oth_cr_file = cr_xmlfile_sopen_deferred(oth_xml_filename,
+                                                    CR_XMLFILE_OTHER,
+                                                    xml_compression,
+                                                    oth_stat,
+                                                    &tmp_err);
+        else
+            oth_cr_file = cr_xmlfile_sopen_other(oth_xml_filename,
+                                                xml_compression,
+                                                oth_stat,
+                                                &tmp_err);
+        assert(oth_cr_file || tmp_err);
+        if (!oth_cr_file) {
+            g_propagate_prefixed_error(err, tmp_err, "Cannot open file %s: ",
+                                       oth_xml_filename);
+            goto fail;
+        }
+    }
+
+    // Set number of packages
+    g_debug("Setting number of packages");
+    cr_xmlfile_set_num_of_pkgs(pri_cr_file, task_count, NULL);
+    if (!cmd_options->primary_only) {
+        cr_xmlfile_set_num_of_pkgs(fil_cr_file, task_count, NULL);
+        cr_xmlfile_set_num_of_pkgs(oth_cr_file, task_count, NULL);
+    }
+
+    // Independent blocks of the packages, the index is written with
+    // the other additional metadata
+    if (cmd_options->block_index) {
+        block_index = cr_blockindex_new();
+        if (cr_xmlfile_set_blockindex(pri_cr_file, block_index,
+                                      CR_BLOCKINDEX_DEFAULT_BLOCK_SIZE,
+                                      &tmp_err) == CRE_OK
+            && !cmd_options->primary_only
+            && cr_xmlfile_set_blockindex(fil_cr_file, block_index,
+                                         CR_BLOCKINDEX_DEFAULT_BLOCK_SIZE,
+                                         &tmp_err) == CRE_OK)
+            cr_xmlfile_set_blockindex(oth_cr_file, block_index,
+                                      CR_BLOCKINDEX_DEFAULT_BLOCK_SIZE,
+                                      &tmp_err);
+        if (tmp_err) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot set the block index: ");
+            goto fail;
+        }
+    }
+
+    // Open sqlite databases
+    if (!cmd_options->no_database) {
+        _cleanup_file_close_ int pri_db_fd = -1;
+        _cleanup_file_close_ int fil_db_fd = -1;
+        _cleanup_file_close_ int oth_db_fd = -1;
+
+        g_message("Preparing sqlite DBs");
+        if (cmd_options->sqlite_in_memory) {
+            g_debug("Creating databases in memory");
+            pri_db_filename = g_strdup(CR_DB_IN_MEMORY);
+            if (!cmd_options->primary_only) {
+                fil_db_filename = g_strdup(CR_DB_IN_MEMORY);
+                oth_db_filename = g_strdup(CR_DB_IN_MEMORY);
+            }
+        } else if (!cmd_options->local_sqlite) {
+            g_debug("Creating databases");
+            pri_db_filename = g_strconcat(tmp_out_repo, "/primary.sqlite", NULL);
+            if (!cmd_options->primary_only) {
+                fil_db_filename = g_strconcat(tmp_out_repo, "/filelists.sqlite", NULL);
+                oth_db_filename = g_strconcat(tmp_out_repo, "/other.sqlite", NULL);
+            }
+        } else {
+            g_debug("Creating databases localy");
+            const gchar *tmpdir = g_get_tmp_dir();
+            pri_db_filename = g_build_filename(tmpdir, "primary.XXXXXX.sqlite", NULL);
+            pri_db_fd = g_mkstemp(pri_db_filename);
+            g_debug("%s", pri_db_filename);
+            if (pri_db_fd == -1) {
+                g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot open %s: %s",
+                            pri_db_filename, g_strerror(errno));
+                goto fail;
+            }
+            if (!cmd_options->primary_only) {
+                fil_db_filename = g_build_filename(tmpdir, "filelists.XXXXXX.sqlite", NULL);
+                oth_db_filename = g_build_filename(tmpdir, "other.XXXXXXX.sqlite", NULL);
+                fil_db_fd = g_mkstemp(fil_db_filename);
+                g_debug("%s", fil_db_filename);
+                if (fil_db_fd == -1) {
+                    g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot open %s: %s",
+                                fil_db_filename, g_strerror(errno));
+                    goto fail;
+                }
+                oth_db_fd = g_mkstemp(oth_db_filename);
+                g_debug("%s", oth_db_filename);
+                if (oth_db_fd == -1) {
+                    g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot open %s: %s",
+                                oth_db_filename, g_strerror(errno));
+                    goto fail;
+                }
+            }
+        }
+
+        if (cmd_options->reuse_sqlite) {
+            gchar *db_filenames[CR_DB_SENTINEL] = {
+                pri_db_filename, fil_db_filename, oth_db_filename };
+            cr_SqliteDb *dbs[CR_DB_SENTINEL] = { NULL };
+
+            open_reused_sqlite_dbs(old_metadata_dir, db_filenames, dbs);
+            pri_db = dbs[CR_DB_PRIMARY];
+            fil_db = dbs[CR_DB_FILELISTS];
+            oth_db = dbs[CR_DB_OTHER];
+        }
+
+        if (!pri_db)
+            pri_db = cr_db_open_primary(pri_db_filename, &tmp_err);
+        assert(pri_db || tmp_err);
+        if (!pri_db) {
+            g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ",
+                                       pri_db_filename);
+            goto fail;
+        }
+
+        // No filelists and other dbs with --primary-only
+        if (!fil_db && fil_db_filename) {
+            fil_db = cr_db_open_filelists(fil_db_filename, &tmp_err);
+            assert(fil_db || tmp_err);
+            if (!fil_db) {
+                g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ",
+                                           fil_db_filename);
+                goto fail;
+            }
+        }
+
+        if (!oth_db && oth_db_filename) {
+            oth_db = cr_db_open_other(oth_db_filename, &tmp_err);
+            assert(oth_db || tmp_err);
+            if (!oth_db) {
+                g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ",
+                                           oth_db_filename);
+                goto fail;
+            }
+        }
+    }
+
+    size_t pri_dict_size = 0;
+    size_t fil_dict_size = 0;
+    size_t oth_dict_size = 0;
+
+    if (cmd_options->zck_auto_dict)
+        train_missing_zck_dicts(cmd_options->zck_dict_dir, old_metadata_dir);
+
+    if (cmd_options->zck_dict_dir) {
+        pri_dict_file = cr_get_dict_file(cmd_options->zck_dict_dir,
+                                         "primary.xml");
+        fil_dict_file = cr_get_dict_file(cmd_options->zck_dict_dir,
+                                         "filelists.xml");
+        oth_dict_file = cr_get_dict_file(cmd_options->zck_dict_dir,
+                                         "other.xml");
+        if (pri_dict_file && !g_file_get_contents(pri_dict_file, &pri_dict,
+                                                 &pri_dict_size, &tmp_err)) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Error reading zchunk primary dict %s: %s",
+                        pri_dict_file, tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto fail;
+        }
+        if (fil_dict_file && !g_file_get_contents(fil_dict_file, &fil_dict,
+                                                 &fil_dict_size, &tmp_err)) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Error reading zchunk filelists dict %s: %s",
+                        fil_dict_file, tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto fail;
+        }
+        if (oth_dict_file && !g_file_get_contents(oth_dict_file, &oth_dict,
+                                                 &oth_dict_size, &tmp_err)) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Error reading zchunk other dict %s: %s",
+                        oth_dict_file, tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto fail;
+        }
+
+    }
+    if (cmd_options->zck_compression) {
+        g_debug("Creating .xml.zck files");
+
+        pri_zck_filename = g_strconcat(tmp_out_repo, "/primary.xml.zck", NULL);
+        fil_zck_filename = g_strconcat(tmp_out_repo, "/filelists.xml.zck", NULL);
+        oth_zck_filename = g_strconcat(tmp_out_repo, "/other.xml.zck", NULL);
+
+        // The open content is the same as the content of the .xml files,
+        // its checksum is computed just once by the .xml writers
+        pri_zck_stat = cr_contentstat_new(CR_CHECKSUM_UNKNOWN, NULL);
+        pri_cr_zck = cr_xmlfile_sopen_primary(pri_zck_filename,
+                                              CR_CW_ZCK_COMPRESSION,
+                                              pri_zck_stat,
+                                              &tmp_err);
+        assert(pri_cr_zck || tmp_err);
+        if (!pri_cr_zck) {
+            g_propagate_prefixed_error(err, tmp_err, "Cannot open file %s: ",
+                                       pri_zck_filename);
+            goto fail;
+        }
+        cr_set_dict(pri_cr_zck->f, pri_dict, pri_dict_size, &tmp_err);
+        if (tmp_err) {
+            g_propagate_prefixed_error(err, tmp_err,
+                    "Error reading setting primary dict %s: ", pri_dict_file);
+            tmp_err = NULL;
+            goto fail;
+        }
+        g_clear_pointer(&pri_dict, g_free);
+
+        if (!cmd_options->primary_only) {
+            fil_zck_stat = cr_contentstat_new(CR_CHECKSUM_UNKNOWN, NULL);
+            fil_cr_zck = cr_xmlfile_sopen_filelists(fil_zck_filename,
+                                                    CR_CW_ZCK_COMPRESSION,
+                                                    fil_zck_stat,
+                                                    &tmp_err);
+            assert(fil_cr_zck || tmp_err);
+            if (!fil_cr_zck) {
+                g_propagate_prefixed_error(err, tmp_err, "Cannot open file %s: ",
+                                           fil_zck_filename);
+                goto fail;
+            }
+            cr_set_dict(fil_cr_zck->f, fil_dict, fil_dict_size, &tmp_err);
+            if (tmp_err) {
+                g_propagate_prefixed_error(err, tmp_err,
+                        "Error reading setting filelists dict %s: ", fil_dict_file);
+                tmp_err = NULL;
+                goto fail;
+            }
+            g_clear_pointer(&fil_dict, g_free);
+
+            oth_zck_stat = cr_contentstat_new(CR_CHECKSUM_UNKNOWN, NULL);
+            oth_cr_zck = cr_xmlfile_sopen_other(oth_zck_filename,
+                                                CR_CW_ZCK_COMPRESSION,
+                                                oth_zck_stat,
+                                                &tmp_err);
+            assert(oth_cr_zck || tmp_err);
+            if (!oth_cr_zck) {
+                g_propagate_prefixed_error(err, tmp_err, "Cannot open file %s: ",
+                                           oth_zck_filename);
+                goto fail;
+            }
+            cr_set_dict(oth_cr_zck->f, oth_dict, oth_dict_size, &tmp_err);
+            if (tmp_err) {
+                g_propagate_prefixed_error(err, tmp_err,
+                        "Error reading setting other dict %s: ", oth_dict_file);
+                tmp_err = NULL;
+                goto fail;
+            }
+            g_clear_pointer(&oth_dict, g_free);
+        }
+
+        // Set number of packages
+        g_debug("Setting number of packages");
+        cr_xmlfile_set_num_of_pkgs(pri_cr_zck, task_count, NULL);
+        if (!cmd_options->primary_only) {
+            cr_xmlfile_set_num_of_pkgs(fil_cr_zck, task_count, NULL);
+            cr_xmlfile_set_num_of_pkgs(oth_cr_zck, task_count, NULL);
+        }
+    }
+
+    // Thread pool - User data initialization
+    user_data.pri_f             = pri_cr_file;
+    user_data.fil_f             = fil_cr_file;
+    user_data.oth_f             = oth_cr_file;
+    user_data.pri_db            = pri_db;
+    user_data.fil_db            = fil_db;
+    user_data.oth_db            = oth_db;
+    user_data.pri_zck           = pri_cr_zck;
+    user_data.fil_zck           = fil_cr_zck;
+    user_data.oth_zck           = oth_cr_zck;
+    user_data.pri_zck_chunking  = cmd_options->pri_zck_chunking;
+    user_data.fil_zck_chunking  = cmd_options->fil_zck_chunking;
+    user_data.oth_zck_chunking  = cmd_options->oth_zck_chunking;
+    if (cmd_options->compatibility && cmd_options->changelog_limit == DEFAULT_CHANGELOG_LIMIT ) {
+      user_data.changelog_limit   = -1;
+    } else {
+      user_data.changelog_limit   = cmd_options->changelog_limit;
+    }
+    user_data.primary_only      = cmd_options->primary_only;
+    user_data.location_base     = cmd_options->location_base;
+    if (cmd_options->split) {
+        // Computed once, the tasks of a media share the string
+        user_data.media_location_bases = g_ptr_array_new_with_free_func(g_free);
+        for (guint x = 1; x <= dirs_count; x++)
+            g_ptr_array_add(user_data.media_location_bases,
+                            prepare_split_media_baseurl(x,
+                                                cmd_options->location_base));
+    }
+    user_data.checksum_type_str = cr_checksum_name_str(cmd_options->checksum_type);
+    user_data.checksum_type     = cmd_options->checksum_type;
+    user_data.checksum_io_mode  = cmd_options->checksum_io_mode;
+    user_data.checksum_cachedir = cmd_options->checksum_cachedir;
+    user_data.skip_symlinks     = cmd_options->skip_symlinks;
+    user_data.repodir_name_len  = strlen(in_dir);
+    user_data.task_count        = task_count;
+    user_data.task_count_open   = stream_walk;
+    user_data.package_count     = 0;
+    user_data.skip_stat         = cmd_options->skip_stat;
+    user_data.old_md            = old_metadata
+                                  ? cr_dumper_old_md_new(old_metadata)
+                                  : NULL;
+    user_data.old_db            = old_db;
+    user_data.deltas            = cmd_options->deltas;
+    user_data.max_delta_rpm_size= cmd_options->max_delta_rpm_size;
+    user_data.deltatargetpackages = NULL;
+    user_data.cut_dirs          = cmd_options->cut_dirs;
+    user_data.location_prefix   = cmd_options->location_prefix;
+    user_data.had_errors        = 0;
+    user_data.output_pkg_list   = output_pkg_list;
+
+    g_mutex_init(&(user_data.mutex_output_pkg_list));
+    g_mutex_init(&(user_data.mutex_deltatargetpackages));
+
+    // Package cache
+    if (cmd_options->pkg_cache) {
+        _cleanup_free_ gchar *fingerprint = g_strdup_printf("%s %d",
+                                                user_data.checksum_type_str,
+                                                user_data.changelog_limit);
+
+        user_data.pkg_cache = cr_pkgcache_open(cmd_options->pkg_cache,
+                                               fingerprint, &tmp_err);
+        if (!user_data.pkg_cache) {
+            g_warning("Package cache is not used: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        } else {
+            g_message("Package cache loaded - %u packages",
+                      cr_pkgcache_size(user_data.pkg_cache));
+        }
+
+        user_data.pkg_cache_writer = cr_pkgcache_writer_new(
+                                                    cmd_options->pkg_cache,
+                                                    fingerprint, &tmp_err);
+        if (!user_data.pkg_cache_writer) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot create package cache: ");
+            goto fail;
+        }
+
+        if (cmd_options->shared_pkg_cache)
+            cr_pkgcache_writer_set_shared(user_data.pkg_cache_writer);
+    }
+
+    // Binary index of the packages, filled by its own writer
+    if (cmd_options->pkg_index)
+        user_data.pkg_index = cr_pkgindex_writer_new();
+
+    // Content hash, updated by the writer of primary.xml
+    if (cmd_options->set_contenthash) {
+        user_data.contenthash = cr_checksum_new(cmd_options->checksum_type,
+                                                &tmp_err);
+        if (!user_data.contenthash) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot compute content hash: ");
+            goto fail;
+        }
+    }
+
+    // Single file checksum cache
+    if (cmd_options->checksum_cache) {
+        user_data.checksum_cache = cr_checksum_cache_open(
+                                                cmd_options->checksum_cache,
+                                                &tmp_err);
+        if (!user_data.checksum_cache) {
+            g_warning("Checksum cache is not used: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        } else {
+            g_message("Checksum cache loaded - %u checksums",
+                      cr_checksum_cache_size(user_data.checksum_cache));
+        }
+    }
+
+    user_data.worker_cpuset     = cmd_options->worker_cpuset;
+    user_data.writer_cpuset     = cmd_options->writer_cpuset;
+
+    // The workers shared by more runs are not resized by one of them
+    if (cmd_options->max_workers && shared_pool)
+        g_warning("--max-workers is ignored, the workers are shared "
+                  "by more repos");
+    if (cmd_options->max_workers && !shared_pool) {
+        guint cpus = user_data.worker_cpuset
+                     ? cr_cpuset_count(user_data.worker_cpuset)
+                     : g_get_num_processors();
+        user_data.autoscale = cr_dumper_autoscale_new(1,
+                                                cmd_options->max_workers,
+                                                cpus);
+    }
+
+    g_debug("Thread pool user data ready");
+
+    // Start writers - the amount of finished packages waiting for them is
+    // limited by --reorder-buffer-mb, the slots are just pointers.
+    // Large packages are processed out of order, there must be a slot
+    // for every package, otherwise they could wait for a queued task.
+    // The packages found during the walk are processed in order.
+    if (!cr_dumper_writers_start(&user_data,
+                                 MAX(cmd_options->workers * 64, task_count),
+                                 (gsize) cmd_options->reorder_buffer_mb * 1024 * 1024,
+                                 &tmp_err))
+    {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot start writer threads: ");
+        goto fail;
+    }
+
+    // Progress of the packages
+    if (cmd_options->progress || cmd_options->progress_file) {
+        user_data.progress = cr_dumper_progress_new(cmd_options->progress,
+                                                    cmd_options->progress_file,
+                                                    metrics, run_ctx);
+        cr_dumper_progress_start(user_data.progress, task_count);
+    }
+
+    // Start pool
+    if (user_data.prefetch) {
+        g_debug("Prefetching %d packages ahead of the workers",
+                cmd_options->prefetch);
+        cr_dumper_prefetch_start(user_data.prefetch);
+    }
+    if (shared_pool) {
+        g_message("Pool started (shared with other repos)");
+    } else {
+        g_thread_pool_set_max_threads(pool, cmd_options->workers, NULL);
+        g_message("Pool started (with %d workers)", cmd_options->workers);
+    }
+    if (user_data.worker_cpuset || user_data.writer_cpuset)
+        g_debug("Workers bound to %u CPUs, writers to %u CPUs",
+                cr_cpuset_count(user_data.worker_cpuset),
+                cr_cpuset_count(user_data.writer_cpuset));
+
+    if (stream_walk) {
+        walk_input_dirs(pool, in_dirs, dirs_count, cmd_options, run_ctx,
+                        NULL, task_paths, &user_data, NULL, metrics,
+                        remote_pkgs, &remote_first_id, &task_count);
+        g_strfreev(in_dirs);
+        in_dirs = NULL;
+        cr_dumper_writers_set_task_count(&user_data, task_count, TRUE);
+        if (user_data.progress)
+            cr_dumper_progress_set_total(user_data.progress, task_count);
+    } else {
+        for (guint x = 0; x < held_tasks->len; x++)
+            task_dispatch(pool, &user_data, g_ptr_array_index(held_tasks, x));
+        g_ptr_array_free(held_tasks, TRUE);
+        held_tasks = NULL;
+    }
+    if (user_data.prefetch)
+        cr_dumper_prefetch_close(user_data.prefetch);
+
+    if (remote_pkgs) {
+        dispatch_remote_pkgs(pool, &user_data, remote_pkgs, remote_first_id,
+                             cmd_options);
+        g_debug("Headers of the remote packages read");
+    }
+
+    // Adapt the number of workers until the last package is dispatched,
+    // the pool can't be resized any more while it's being freed
+    if (user_data.autoscale) {
+        gint workers = cmd_options->workers;
+        while (g_thread_pool_unprocessed(pool) > 0) {
+            g_usleep(AUTOSCALE_INTERVAL);
+            gint new_workers = cr_dumper_autoscale_update(user_data.autoscale,
+                                                          workers);
+            if (new_workers == workers)
+                continue;
+            g_debug("Number of workers changed %d -> %d", workers, new_workers);
+            g_thread_pool_set_max_threads(pool, new_workers, NULL);
+            workers = new_workers;
+        }
+    }
+
+    // Wait until all the packages are processed, the shared pool works
+    // for the other repos further
+    cr_dumper_wait_tasks(&user_data);
+    if (!shared_pool)
+        g_thread_pool_free(pool, FALSE, TRUE);
+    pool = NULL;
+    g_string_chunk_free(task_paths);
+    task_paths = NULL;
+    if (remote_pkgs)
+        g_ptr_array_free(remote_pkgs, TRUE);
+    remote_pkgs = NULL;
+    cr_dumper_prefetch_free(user_data.prefetch);
+    user_data.prefetch = NULL;
+    cr_dumper_autoscale_free(user_data.autoscale);
+    user_data.autoscale = NULL;
+
+
+    // Wait until everything is written
+    cr_dumper_writers_finish(&user_data);
+    cr_dumper_progress_free(user_data.progress);
+    user_data.progress = NULL;
+
+    if (user_data.contenthash) {
+        contenthash = cr_checksum_final(user_data.contenthash, &tmp_err);
+        user_data.contenthash = NULL;
+        if (!contenthash) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot compute content hash: ");
+            goto fail;
+        }
+        g_debug("Content hash: %s", contenthash);
+    }
+
+    if (user_data.old_md) {
+        g_debug("Old metadata of %u packages were not used",
+                cr_dumper_old_md_unclaimed(user_data.old_md));
+        cr_dumper_old_md_free(user_data.old_md);
+        user_data.old_md = NULL;
+    }
+
+    if (old_db) {
+        cr_db_package_reader_free(old_db);
+        old_db = user_data.old_db = NULL;
+        remove_old_sqlite_dbs(tmp_out_repo);
+    }
+
+    // The old metadata and the written tasks point to the strings
+    if (user_data.media_location_bases) {
+        g_ptr_array_free(user_data.media_location_bases, TRUE);
+        user_data.media_location_bases = NULL;
+    }
+
+    if (user_data.pkg_cache_writer) {
+        if (!cr_pkgcache_writer_close(user_data.pkg_cache_writer, TRUE, &tmp_err)) {
+            g_warning("Cannot save package cache: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+        user_data.pkg_cache_writer = NULL;
+    }
+    cr_pkgcache_free(user_data.pkg_cache);
+    user_data.pkg_cache = NULL;
+
+    if (user_data.checksum_cache) {
+        // Compact the cache when asked or when most of it is garbage
+        guint garbage = cr_checksum_cache_garbage(user_data.checksum_cache);
+        if (cmd_options->compact_checksum_cache
+            || garbage > cr_checksum_cache_size(user_data.checksum_cache))
+        {
+            if (!cr_checksum_cache_compact(user_data.checksum_cache,
+                                           &tmp_err)) {
+                g_warning("Cannot compact checksum cache: %s",
+                          tmp_err->message);
+                g_clear_error(&tmp_err);
+            }
+        }
+        cr_checksum_cache_free(user_data.checksum_cache);
+        user_data.checksum_cache = NULL;
+    }
+
+    // if there were any errors, exit nonzero
+    if ( cmd_options->error_exit_val && user_data.had_errors ) {
+	exit_val = 2;
+    }
+
+    g_message("Pool finished%s", (user_data.had_errors ? " with errors" : ""));
+
+    if (output_pkg_list)
+        fclose(output_pkg_list);
+    output_pkg_list = NULL;
+
+    // The module metadata are found by the walk, which runs with the pool
+    // with --stream-walk
+#ifdef WITH_LIBMODULEMD
+    // module metadata found in repo
+    if (cmd_options->modulemd_metadata) {
+        gboolean merger_is_empty = TRUE;
+        ModulemdModuleIndexMerger *merger = modulemd_module_index_merger_new();
+        if (!merger) {
+            g_set_error(err, ERR_DOMAIN, CRE_MEMORY,
+                        "Could not allocate module merger");
+            goto fail;
+        }
+
+        //files the merged module metadata are made of (key of the cache)
+        GPtrArray *modules_inputs = g_ptr_array_new_with_free_func(g_free);
+
+        if (cmd_options->update && old_metadata_location && old_metadata_location->additional_metadata){
+            //associate old metadata into the merger if we want to keep them (--keep-all-metadata)
+            gboolean keep_old_modules = FALSE;
+            if (cr_metadata_modulemd(old_metadata) && cmd_options->keep_all_metadata){
+                modulemd_module_index_merger_associate_index(merger, cr_metadata_modulemd(old_metadata), 0);
+                merger_is_empty = FALSE;
+                keep_old_modules = TRUE;
+                if (tmp_err) {
+                    g_propagate_prefixed_error(err, tmp_err,
+                            "%s: Cannot merge old module index with new: ", __func__);
+                    tmp_err = NULL;
+                    g_ptr_array_free(modules_inputs, TRUE);
+                    g_clear_pointer(&merger, g_object_unref);
+                    goto fail;
+                }
+            }
+            //remove old modules (every [compressed] variant)
+            GSList *node_iter = old_metadata_location->additional_metadata;
+            while (node_iter != NULL){
+                GSList *next = g_slist_next(node_iter);
+                cr_Metadatum *m = node_iter->data;
+
+                if (keep_old_modules && g_str_has_prefix(m->type, "modules"))
+                    g_ptr_array_add(modules_inputs, g_strdup(m->name));
+
+                /* If we are updating some existing repodata that have modular metadata
+                 * remove those from found cmd_options->modulemd_metadata.
+                 * If --keel-all-metadata is not specified we don't want them and if it is they
+                 * were already added from old_metadata module index above.
+                 */
+                GSList *element_iter = cmd_options->modulemd_metadata;
+                while (element_iter != NULL){
+                    GSList *next_inner = g_slist_next(element_iter);
+                    gchar *path_to_found_md = (gchar *) element_iter->data;
+                    if (!g_strcmp0(path_to_found_md, m->name)) {
+                        cmd_options->modulemd_metadata = g_slist_delete_link(
+                            cmd_options->modulemd_metadata, element_iter);
+                    }
+                    element_iter = next_inner;
+                }
+
+                if(g_str_has_prefix(m->type, "modules")){
+                    old_metadata_location->additional_metadata = g_slist_delete_link(
+                        old_metadata_location->additional_metadata, node_iter);
+                    cr_metadatum_free(m);
+                }
+                node_iter = next;
+            }
+        }
+
+        ModulemdModuleIndex *moduleindex;
+        char *moduleindex_str = NULL;
+        guint modules_count = g_slist_length(cmd_options->modulemd_metadata);
+
+        GSList *element = cmd_options->modulemd_metadata;
+        for (; element; element=g_slist_next(element))
+            g_ptr_array_add(modules_inputs, g_strdup(element->data));
+        gchar *modules_cache = modules_cache_path(cmd_options->checksum_cachedir,
+                                                  modules_inputs);
+        g_ptr_array_free(modules_inputs, TRUE);
+
+        if (modules_cache
+            && g_file_get_contents(modules_cache, &moduleindex_str, NULL, NULL))
+        {
+            //the same inputs were already merged by a previous run
+            g_debug("Module metadata loaded from the cache %s", modules_cache);
+        } else {
+            //load all found module metatada (in parallel) and associate it with merger
+            gchar **modules_paths = g_new0(gchar *, modules_count + 1);
+            ModulemdModuleIndex **moduleindexes = g_new0(ModulemdModuleIndex *, modules_count);
+            guint x = 0;
+            for (element = cmd_options->modulemd_metadata; element; element=g_slist_next(element))
+                modules_paths[x++] = element->data;
+
+            int result = cr_metadata_load_modulemds(moduleindexes,
+                                                    modules_paths,
+                                                    modules_count,
+                                                    cmd_options->workers,
+                                                    &tmp_err);
+            g_free(modules_paths);
+            if (result != CRE_OK) {
+                g_set_error(err, ERR_DOMAIN, result,
+                            "Could not load module index file %s",
+                            (tmp_err ? tmp_err->message : "Unknown error"));
+                g_clear_error(&tmp_err);
+                g_free(moduleindexes);
+                g_free(modules_cache);
+                g_clear_pointer(&merger, g_object_unref);
+                goto fail;
+            }
+
+            for (x = 0; x < modules_count; x++) {
+                modulemd_module_index_merger_associate_index(merger, moduleindexes[x], 0);
+                merger_is_empty = FALSE;
+                g_clear_pointer(&moduleindexes[x], g_object_unref);
+            }
+            g_free(moduleindexes);
+
+            if (!merger_is_empty) {
+                //merge module metadata and dump it to string
+                moduleindex = modulemd_module_index_merger_resolve (merger, &tmp_err);
+                moduleindex_str = modulemd_module_index_dump_to_string (moduleindex, &tmp_err);
+                g_clear_pointer(&moduleindex, g_object_unref);
+                if (tmp_err) {
+                    g_propagate_prefixed_error(err, tmp_err,
+                            "%s: Cannot dump module index: ", __func__);
+                    tmp_err = NULL;
+                    g_free(moduleindex_str);
+                    g_free(modules_cache);
+                    g_clear_pointer(&merger, g_object_unref);
+                    goto fail;
+                }
+
+                //g_file_set_contents() replaces the cached file atomically
+                if (modules_cache
+                    && !g_file_set_contents(modules_cache, moduleindex_str, -1, &tmp_err))
+                {
+                    g_warning("Cannot cache module metadata: %s", tmp_err->message);
+                    g_clear_error(&tmp_err);
+                }
+            }
+        }
+        g_free(modules_cache);
+
+        if (moduleindex_str) {
+            //compress new module metadata string to a file in temporary .repodata
+            //(by the pool of additional metadata tasks)
+            gchar *modules_metadata_path = g_strconcat(tmp_out_repo, "modules.yaml", compression_suffix, NULL);
+
+            //create additional metadatum for new module metadata file
+            cr_Metadatum *new_modules_metadatum = g_malloc0(sizeof(cr_Metadatum));
+            new_modules_metadatum->name = modules_metadata_path;
+            new_modules_metadatum->type = g_strdup("modules");
+            additional_metadata = g_slist_prepend(additional_metadata, new_modules_metadatum);
+            cr_push_additional_metadatum_task(additional_pool,
+                                              additional_tasks,
+                                              new_modules_metadatum,
+                                              NULL,
+                                              moduleindex_str,
+                                              compression,
+                                              FALSE,
+                                              cmd_options->repomd_checksum_type);
+        }
+
+        g_clear_pointer(&merger, g_object_unref);
+
+    }
+#endif /* WITH_LIBMODULEMD */
+
+    if (cmd_options->update && cmd_options->keep_all_metadata &&
+        old_metadata_location && old_metadata_location->additional_metadata)
+    {
+        GSList *element = old_metadata_location->additional_metadata;
+        cr_Metadatum *m;
+        cr_Repomd *kept_repomd = NULL;
+
+        if (!cmd_options->strict_keep_all_metadata) {
+            kept_repomd = load_old_repomd(old_metadata_location->repomd);
+            kept_records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                 (GDestroyNotify) cr_repomd_record_free);
+        }
+
+        for (; element; element=g_slist_next(element)) {
+            m = g_malloc0(sizeof(cr_Metadatum));
+            m->name = cr_copy_metadatum(((cr_Metadatum *) element->data)->name, tmp_out_repo, &tmp_err);
+            m->type = g_strdup(((cr_Metadatum *) element->data)->type);
+            additional_metadata = g_slist_prepend(additional_metadata, m);
+            if (kept_records)
+                remember_kept_metadatum_record(kept_records,
+                                               kept_repomd,
+                                               ((cr_Metadatum *) element->data)->name,
+                                               m->name,
+                                               m->type,
+                                               cmd_options->repomd_checksum_type);
+            cr_push_additional_metadatum_task(additional_pool,
+                                              additional_tasks,
+                                              m,
+                                              kept_records,
+                                              NULL,
+                                              CR_CW_UNKNOWN_COMPRESSION,
+                                              FALSE,
+                                              cmd_options->repomd_checksum_type);
+        }
+
+        cr_repomd_free(kept_repomd);
+        if (kept_records)
+            g_hash_table_destroy(kept_records);
+        kept_records = NULL;
+    }
+
+    if (xml_deferred) {
+        cr_xmlfile_set_num_of_pkgs(pri_cr_file, user_data.package_count, NULL);
+        if (!cmd_options->primary_only) {
+            cr_xmlfile_set_num_of_pkgs(fil_cr_file, user_data.package_count, NULL);
+            cr_xmlfile_set_num_of_pkgs(oth_cr_file, user_data.package_count, NULL);
+        }
+    }
+
+    cr_xmlfile_close(pri_cr_file, &tmp_err);
+    pri_cr_file = NULL;
+    if (!tmp_err)
+        cr_xmlfile_close(fil_cr_file, &tmp_err);
+    fil_cr_file = NULL;
+    if (!tmp_err)
+        cr_xmlfile_close(oth_cr_file, &tmp_err);
+    oth_cr_file = NULL;
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Error while closing xml files: ");
+        goto fail;
+    }
+
+    cr_xmlfile_close(pri_cr_zck, &tmp_err);
+    pri_cr_zck = NULL;
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "%s: ", pri_zck_filename);
+        goto fail;
+    }
+    cr_xmlfile_close(fil_cr_zck, &tmp_err);
+    fil_cr_zck = NULL;
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "%s: ", fil_zck_filename);
+        goto fail;
+    }
+    cr_xmlfile_close(oth_cr_zck, &tmp_err);
+    oth_cr_zck = NULL;
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "%s: ", oth_zck_filename);
+        goto fail;
+    }
+
+    /* At the time of writing xml metadata headers we haven't yet parsed all
+     * the packages and we don't know whether there were some invalid ones,
+     * therefore we write the task count into the headers instead of the actual package count.
+     * If there actually were some invalid packages we have to correct this value
+     * that unfortunately means we have to decompress metadata files change package
+     * count value and compress them again.
+     * The deferred xml files (see cr_xmlfile_sopen_deferred()) were already
+     * corrected on close, without recompression.
+     */
+    gboolean rewrite_pkg_count = user_data.package_count != user_data.task_count
+                                 && (!xml_deferred || cmd_options->zck_compression);
+    if (rewrite_pkg_count)
+        g_message("Warning: There were some invalid packages: we have to recompress other, filelists and primary xml metadata files in order to have correct package counts");
+
+    g_mutex_clear(&(user_data.mutex_output_pkg_list));
+    g_mutex_clear(&(user_data.mutex_deltatargetpackages));
+    g_mutex_clear(&(user_data.mutex_tasks));
+    g_cond_clear(&(user_data.cond_tasks));
+
+    // Create repomd records for each file
+    g_debug("Generating repomd.xml");
+
+    cr_Repomd *repomd_obj = cr_repomd_new();
+
+    cr_RepomdRecord *pri_xml_rec = cr_repomd_record_new("primary", pri_xml_filename);
+    cr_RepomdRecord *fil_xml_rec = NULL;
+    cr_RepomdRecord *oth_xml_rec = NULL;
+    if (!cmd_options->primary_only) {
+        fil_xml_rec = cr_repomd_record_new("filelists", fil_xml_filename);
+        oth_xml_rec = cr_repomd_record_new("other", oth_xml_filename);
+    }
+    cr_RepomdRecord *pri_db_rec               = NULL;
+    cr_RepomdRecord *fil_db_rec               = NULL;
+    cr_RepomdRecord *oth_db_rec               = NULL;
+    cr_RepomdRecord *pri_zck_rec              = NULL;
+    cr_RepomdRecord *fil_zck_rec              = NULL;
+    cr_RepomdRecord *oth_zck_rec              = NULL;
+    cr_RepomdRecord *prestodelta_rec          = NULL;
+    cr_RepomdRecord *prestodelta_zck_rec      = NULL;
+
+
+    /* The rest of the work is a graph of tasks: every step starts as soon
+     * as the files it needs are ready, e.g. the primary db is compressed
+     * while the record of filelists.xml is still being filled and the records
+     * are filled while the deltas are generated. */
+    graph = cr_taskgraph_new(cmd_options->workers, err);
+    if (!graph)
+        goto fail;
+
+    cr_MetadataFileJob jobs[] = {
+        { .type = "primary", .xml_filename = pri_xml_filename,
+          .stat = pri_stat, .xml_rec = pri_xml_rec,
+          .db = pri_db, .db_filename = pri_db_filename,
+          .zck_filename = pri_zck_filename, .zck_stat = pri_zck_stat, },
+        { .type = "filelists", .xml_filename = fil_xml_filename,
+          .stat = fil_stat, .xml_rec = fil_xml_rec,
+          .db = fil_db, .db_filename = fil_db_filename,
+          .zck_filename = fil_zck_filename, .zck_stat = fil_zck_stat, },
+        { .type = "other", .xml_filename = oth_xml_filename,
+          .stat = oth_stat, .xml_rec = oth_xml_rec,
+          .db = oth_db, .db_filename = oth_db_filename,
+          .zck_filename = oth_zck_filename, .zck_stat = oth_zck_stat, },
+    };
+    gchar *dict_files[] = { pri_dict_file, fil_dict_file, oth_dict_file };
+
+    // With --primary-only just the job of primary is run
+    int jobs_count = cmd_options->primary_only ? 1 : G_N_ELEMENTS(jobs);
+
+    // The jobs close the dbs and free the stats of the xml files
+    jobs_started = TRUE;
+
+
+    for (int x = 0; x < jobs_count; x++) {
+        cr_MetadataFileJob *job = &jobs[x];
+        cr_TaskGraphNode *rewrite_node = NULL, *zck_rewrite_node = NULL;
+        cr_TaskGraphNode *xml_fill_node, *db_node;
+
+        job->cmd_options = cmd_options;
+        job->metrics = metrics;
+
+        if (old_repomd) {
+            gchar *db_type = g_strconcat(job->type, "_db", NULL);
+            gchar *db_suffix = g_strconcat(".sqlite", sqlite_compression_suffix,
+                                           NULL);
+            job->old_xml_rec = cr_repomd_get_record(old_repomd, job->type);
+            job->old_db_rec = cr_repomd_get_record(old_repomd, db_type);
+            if (job->old_db_rec && job->old_db_rec->location_href
+                && !job->old_db_rec->location_base
+                && g_str_has_suffix(job->old_db_rec->location_href, db_suffix))
+                job->old_db_path = g_build_filename(old_metadata_location->local_path,
+                                                    job->old_db_rec->location_href,
+                                                    NULL);
+            g_free(db_suffix);
+            g_free(db_type);
+        }
+
+        if (rewrite_pkg_count && !xml_deferred) {
+            job->rewrite_task = cr_compressiontask_new(job->xml_filename,
+                                                       NULL,
+                                                       xml_compression,
+                                                       cmd_options->repomd_checksum_type,
+                                                       NULL, FALSE, 1,
+                                                       NULL);
+            rewrite_node = cr_taskgraph_add(graph, cr_rewrite_pkg_count_thread,
+                                            job->rewrite_task, &user_data,
+                                            NULL, 0);
+        }
+
+        if (rewrite_pkg_count && cmd_options->zck_compression) {
+            job->zck_rewrite_task = cr_compressiontask_new(job->zck_filename,
+                                                           NULL,
+                                                           CR_CW_ZCK_COMPRESSION,
+                                                           cmd_options->repomd_checksum_type,
+                                                           dict_files[x],
+                                                           FALSE, 1, NULL);
+            zck_rewrite_node = cr_taskgraph_add(graph, cr_rewrite_pkg_count_thread,
+                                                job->zck_rewrite_task, &user_data,
+                                                NULL, 0);
+        }
+
+        xml_fill_node = cr_taskgraph_add(graph, metadata_file_xml_fill_thread,
+                                         job, NULL, &rewrite_node, 1);
+
+        // Sqlite db
+        if (!cmd_options->no_database) {
+            gchar *db_name = g_strconcat(tmp_out_repo, "/", job->type, ".sqlite",
+                                         sqlite_compression_suffix, NULL);
+            job->db_task = cr_compressiontask_new(job->db_filename,
+                                                  db_name,
+                                                  sqlite_compression,
+                                                  cmd_options->repomd_checksum_type,
+                                                  NULL, FALSE, 1, NULL);
+            g_free(db_name);
+            // In-memory dbs are closed by their compression tasks
+            if (cmd_options->sqlite_in_memory)
+                job->db_task->db = job->db;
+
+            db_node = cr_taskgraph_add(graph, metadata_file_db_close_thread,
+                                       job, NULL, &xml_fill_node, 1);
+            db_node = cr_taskgraph_add(graph, metadata_file_db_compress_thread,
+                                       job, cmd_options->writer_cpuset,
+                                       &db_node, 1);
+            cr_taskgraph_add(graph, metadata_file_db_fill_thread,
+                             job, NULL, &db_node, 1);
+        }
+
+        // Zchunk
+        if (cmd_options->zck_compression) {
+            cr_TaskGraphNode *zck_deps[] = { xml_fill_node, zck_rewrite_node };
+            cr_taskgraph_add(graph, metadata_file_zck_fill_thread,
+                             job, NULL, zck_deps, 2);
+        }
+    }
+
+    ret = cr_collect_additional_metadata_records(additional_pool,
+                                                 additional_tasks,
+                                                 additional_metadata,
+                                                 new_groupfile_metadatum,
+                                                 &additional_metadata_rec,
+                                                 err);
+    // Both were freed by the function
+    additional_pool = NULL;
+    additional_tasks = NULL;
+    if (!ret)
+        goto fail;
+
+    if (new_groupfile_metadatum) {
+        //NOTE(amatej): Now we can add groupfile metadata to the additional_metadata list, for unified handlig while zck compressing
+        additional_metadata = g_slist_prepend(additional_metadata, new_groupfile_metadatum);
+        cr_Metadatum *compressed_new_groupfile_metadatum = g_malloc0(sizeof(cr_Metadatum));
+        compressed_new_groupfile_metadatum->name = g_strdup(((cr_RepomdRecord *) additional_metadata_rec->data)->location_real);
+        compressed_new_groupfile_metadatum->type = g_strdup(((cr_RepomdRecord *) additional_metadata_rec->data)->type);
+        additional_metadata = g_slist_prepend(additional_metadata, compressed_new_groupfile_metadatum);
+    }
+
+    // Binary index of the packages
+    if (user_data.pkg_index) {
+        _cleanup_free_ gchar *pkg_index_path = g_build_filename(tmp_out_repo,
+                                                                "pkgindex",
+                                                                NULL);
+        cr_RepomdRecord *pkg_index_rec;
+
+        if (!cr_pkgindex_writer_write(user_data.pkg_index, pkg_index_path,
+                                      &tmp_err)) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot write package index: ");
+            goto fail;
+        }
+        g_debug("Package index written - %u packages",
+                cr_pkgindex_writer_size(user_data.pkg_index));
+        cr_pkgindex_writer_free(user_data.pkg_index);
+        user_data.pkg_index = NULL;
+
+        pkg_index_rec = cr_repomd_record_new("pkgindex", pkg_index_path);
+        additional_metadata_rec = g_slist_append(additional_metadata_rec,
+                                                 pkg_index_rec);
+        if (cr_repomd_record_fill(pkg_index_rec,
+                                  cmd_options->repomd_checksum_type,
+                                  &tmp_err) != CRE_OK) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot fill package index record: ");
+            goto fail;
+        }
+    }
+
+    // Index of the blocks of the xml files
+    if (block_index) {
+        _cleanup_free_ gchar *block_index_path = g_build_filename(tmp_out_repo,
+                                                                  "blockindex",
+                                                                  NULL);
+        cr_RepomdRecord *block_index_rec;
+
+        if (!cr_blockindex_write(block_index, block_index_path, &tmp_err)) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot write block index: ");
+            goto fail;
+        }
+        g_debug("Block index written - %u primary blocks",
+                cr_blockindex_count(block_index, CR_XMLFILE_PRIMARY));
+
+        block_index_rec = cr_repomd_record_new("blockindex", block_index_path);
+        additional_metadata_rec = g_slist_append(additional_metadata_rec,
+                                                 block_index_rec);
+        if (cr_repomd_record_fill(block_index_rec,
+                                  cmd_options->repomd_checksum_type,
+                                  &tmp_err) != CRE_OK) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot fill block index record: ");
+            goto fail;
+        }
+    }
+
+    // Additional metadata are compressed as tasks of the graph too,
+    // every file by its own thread
+    GSList *compress_tasks = NULL;
+
+    if (cmd_options->zck_compression) {
+        //ZCK for additional metadata
+        GSList *element = additional_metadata;
+        for (; element; element=g_slist_next(element)) {
+            cr_CompressionType com_type = cr_detect_compression(((cr_Metadatum *) element->data)->name, &tmp_err);
+            gchar *elem_type = g_strdup(((cr_Metadatum *) element->data)->type);
+            gchar *elem_name = g_strdup(((cr_Metadatum *) element->data)->name);
+            if (com_type != CR_CW_NO_COMPRESSION){
+                const gchar *compression_suffix = cr_compression_suffix(com_type);
+                //remove suffixes if present
+                if (g_str_has_suffix(elem_name, compression_suffix)){
+                    gchar *tmp = elem_name;
+                    elem_name = g_strndup(elem_name, (strlen(elem_name) - strlen(compression_suffix)));
+                    g_free(tmp);
+                }
+                gchar *type_compression_suffix = g_strdup(compression_suffix);
+                type_compression_suffix[0] = '_'; //replace '.'
+                if (g_str_has_suffix(elem_type, type_compression_suffix)){
+                    gchar *tmp = elem_type;
+                    elem_type = g_strndup(elem_type, (strlen(elem_type) - strlen(type_compression_suffix)));
+                    g_free(tmp);
+                }
+                g_free(type_compression_suffix);
+            }
+            gchar *additional_metadatum_rec_zck_type = g_strconcat(elem_type, "_zck", NULL);
+            gchar *additional_metadatum_rec_zck_name = g_strconcat(elem_name, ".zck", NULL);
+            g_free(elem_name);
+            g_free(elem_type);
+            if (tmp_err) {
+                g_propagate_prefixed_error(err, tmp_err,
+                        "Cannot detect compression type of %s: ",
+                        ((cr_Metadatum *) element->data)->name);
+                goto fail;
+            }
+            /* Only create additional_metadata_zck if additional_metadata isn't already zchunk 
+             * and its zck version doesn't yet exists */
+            if (com_type != CR_CW_ZCK_COMPRESSION && 
+                !g_slist_find_custom(additional_metadata_rec, additional_metadatum_rec_zck_type, cr_cmp_repomd_record_type)) {
+                GSList *additional_metadatum_rec_elem = g_slist_find_custom(additional_metadata_rec,
+                                                                            ((cr_Metadatum *) element->data)->type,
+                                                                            cr_cmp_repomd_record_type);
+
+                additional_metadata_rec = g_slist_prepend(additional_metadata_rec,
+                                                          cr_repomd_record_new(
+                                                              additional_metadatum_rec_zck_type,
+                                                              additional_metadatum_rec_zck_name
+                                                          ));
+
+                cr_RepomdRecordCompressTask *task;
+                task = cr_repomdrecordcompresstask_new(additional_metadatum_rec_elem->data,
+                                                       additional_metadata_rec->data,
+                                                       cmd_options->repomd_checksum_type,
+                                                       CR_CW_ZCK_COMPRESSION,
+                                                       cmd_options->zck_dict_dir,
+                                                       NULL);
+                compress_tasks = g_slist_append(compress_tasks, task);
+                cr_taskgraph_add(graph, cr_repomd_record_compress_thread,
+                                 task, NULL, NULL, 0);
+            }
+            g_free(additional_metadatum_rec_zck_type);
+            g_free(additional_metadatum_rec_zck_name);
+        }
+    }
+
+#ifdef CR_DELTA_RPM_SUPPORT
+    // Delta generation
+    if (cmd_options->deltas) {
+        gchar *filename, *outdeltadir = NULL;
+        gchar *prestodelta_xml_filename = NULL;
+        gchar *prestodelta_zck_filename = NULL;
+
+        GHashTable *ht_oldpackagedirs = NULL;
+        cr_XmlFile *prestodelta_cr_file = NULL;
+        cr_XmlFile *prestodelta_cr_zck_file = NULL;
+        cr_ContentStat *prestodelta_stat = NULL;
+        cr_ContentStat *prestodelta_zck_stat = NULL;
+
+        filename = g_strconcat("prestodelta.xml",
+                               compression_suffix,
+                               NULL);
+        outdeltadir = g_build_filename(out_dir, OUTDELTADIR, NULL);
+        prestodelta_xml_filename = g_build_filename(tmp_out_repo,
+                                                    filename,
+                                                    NULL);
+        g_free(filename);
+
+        // 0) Prepare outdeltadir
+        if (g_file_test(outdeltadir, G_FILE_TEST_EXISTS)) {
+            if (!g_file_test(outdeltadir, G_FILE_TEST_IS_DIR)) {
+                g_critical("The file %s already exists and it is not a directory",
+                        outdeltadir);
+                goto deltaerror;
+            }
+        } else if (g_mkdir(outdeltadir, S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH)) {
+            g_critical("Cannot create %s: %s", outdeltadir, g_strerror(errno));
+            goto deltaerror;
+        }
+
+        // 1) Scan old package directories
+        ht_oldpackagedirs = cr_deltarpms_scan_oldpackagedirs(cmd_options->oldpackagedirs_paths,
+                                                   cmd_options->max_delta_rpm_size,
+                                                   &tmp_err);
+        if (!ht_oldpackagedirs) {
+            g_critical("cr_deltarpms_scan_oldpackagedirs failed: %s\n", tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto deltaerror;
+        }
+
+        // 2) Generate drpms in parallel
+        cr_DeltaRpmsOptions delta_options = { 0 };
+        delta_options.num_deltas         = cmd_options->num_deltas;
+        delta_options.workers            = cmd_options->workers;
+        delta_options.max_delta_rpm_size = cmd_options->max_delta_rpm_size;
+        delta_options.max_work_size      = cmd_options->max_delta_rpm_size;
+        delta_options.max_memory         = (gint64) cmd_options->delta_memory_mb
+                                           * 1024 * 1024;
+        delta_options.processes          = cmd_options->delta_processes;
+        ret = cr_deltarpms_parallel_deltas_with_options(
+                                 user_data.deltatargetpackages,
+                                 ht_oldpackagedirs,
+                                 outdeltadir,
+                                 &delta_options,
+                                 &tmp_err);
+        if (!ret) {
+            g_critical("Parallel generation of drpms failed: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto deltaerror;
+        }
+
+        // 3) Generate prestodelta.xml file
+        prestodelta_stat = cr_contentstat_new(cmd_options->repomd_checksum_type, NULL);
+        prestodelta_cr_file = cr_xmlfile_sopen_prestodelta(prestodelta_xml_filename,
+                                                           compression,
+                                                           prestodelta_stat,
+                                                           &tmp_err);
+        if (!prestodelta_cr_file) {
+            g_critical("Cannot open %s: %s", prestodelta_xml_filename, tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto deltaerror;
+        }
+        if (cmd_options->zck_compression && compression != CR_CW_ZCK_COMPRESSION) {
+            filename = g_strconcat("prestodelta.xml",
+                                   cr_compression_suffix(CR_CW_ZCK_COMPRESSION),
+                                   NULL);
+            prestodelta_zck_filename = g_build_filename(tmp_out_repo,
+                                                        filename,
+                                                        NULL);
+            g_free(filename);
+
+            prestodelta_zck_stat = cr_contentstat_new(cmd_options->repomd_checksum_type, NULL);
+            prestodelta_cr_zck_file = cr_xmlfile_sopen_prestodelta(prestodelta_zck_filename,
+                                                                   CR_CW_ZCK_COMPRESSION,
+                                                                   prestodelta_zck_stat,
+                                                                   &tmp_err);
+            if (!prestodelta_cr_zck_file) {
+                g_critical("Cannot open %s: %s", prestodelta_zck_filename, tmp_err->message);
+                g_clear_error(&tmp_err);
+                goto deltaerror;
+            }
+        }
+
+        ret = cr_deltarpms_generate_prestodelta_file(
+                        outdeltadir,
+                        prestodelta_cr_file,
+                        prestodelta_cr_zck_file,
+                        //cmd_options->checksum_type,
+                        CR_CHECKSUM_SHA256, // Createrepo always uses SHA256
+                        cmd_options->workers,
+                        out_dir,
+                        &tmp_err);
+        if (!ret) {
+            g_critical("Cannot generate %s: %s", prestodelta_xml_filename,
+                    tmp_err->message);
+            g_clear_error(&tmp_err);
+            goto deltaerror;
+        }
+
+        cr_xmlfile_close(prestodelta_cr_file, NULL);
+        prestodelta_cr_file = NULL;
+        cr_xmlfile_close(prestodelta_cr_zck_file, NULL);
+        prestodelta_cr_zck_file = NULL;
+
+        // 4) Prepare repomd record
+        prestodelta_rec = cr_repomd_record_new("prestodelta", prestodelta_xml_filename);
+        cr_repomd_record_load_contentstat(prestodelta_rec, prestodelta_stat);
+        cr_repomd_record_fill(prestodelta_rec, cmd_options->repomd_checksum_type, NULL);
+        if (prestodelta_zck_stat) {
+            prestodelta_zck_rec = cr_repomd_record_new("prestodelta_zck", prestodelta_zck_filename);
+            cr_repomd_record_load_contentstat(prestodelta_zck_rec, prestodelta_zck_stat);
+            cr_repomd_record_fill(prestodelta_zck_rec, cmd_options->repomd_checksum_type, NULL);
+        }
+
+deltaerror:
+        // 5) Cleanup
+        g_hash_table_destroy(ht_oldpackagedirs);
+        g_free(outdeltadir);
+        g_free(prestodelta_xml_filename);
+        g_free(prestodelta_zck_filename);
+        cr_xmlfile_close(prestodelta_cr_file, NULL);
+        cr_xmlfile_close(prestodelta_cr_zck_file, NULL);
+        cr_contentstat_free(prestodelta_stat, NULL);
+        cr_contentstat_free(prestodelta_zck_stat, NULL);
+        cr_slist_free_full(user_data.deltatargetpackages,
+                       (GDestroyNotify) cr_deltatargetpackage_free);
+    }
+#endif
+
+    // Wait till all the tasks of the graph end
+    cr_taskgraph_free(graph);
+    graph = NULL;
+
+    for (int x = 0; x < jobs_count; x++) {
+        cr_MetadataFileJob *job = &jobs[x];
+
+        if (job->err) {
+            g_propagate_error(err, job->err);
+            job->err = NULL;
+            goto fail;
+        }
+        if (job->db_task && job->db_task->err) {
+            g_set_error(err, ERR_DOMAIN, job->db_task->err->code,
+                        "Cannot compress sqlite db: %s",
+                        job->db_task->err->message);
+            goto fail;
+        }
+        if (job->exit_val)
+            exit_val = job->exit_val;
+
+        cr_compressiontask_free(job->rewrite_task, NULL);
+        cr_compressiontask_free(job->zck_rewrite_task, NULL);
+        cr_compressiontask_free(job->db_task, NULL);
+        cr_contentstat_free(job->zck_stat, NULL);
+        g_free(job->old_db_path);
+    }
+
+    cr_repomd_free(old_repomd);
+    old_repomd = NULL;
+    cr_metadatalocation_free(old_metadata_location);
+    old_metadata_location = NULL;
+
+    pri_db_rec = jobs[0].db_rec;
+    fil_db_rec = jobs[1].db_rec;
+    oth_db_rec = jobs[2].db_rec;
+    pri_zck_rec = jobs[0].zck_rec;
+    fil_zck_rec = jobs[1].zck_rec;
+    oth_zck_rec = jobs[2].zck_rec;
+
+    for (GSList *elem = compress_tasks; elem; elem = g_slist_next(elem)) {
+        cr_RepomdRecordCompressTask *task = elem->data;
+        if (task->err) {
+            g_set_error(err, ERR_DOMAIN, task->err->code,
+                        "Cannot process %s %s: %s",
+                        task->record->type,
+                        task->record->location_real,
+                        task->err->message);
+            goto fail;
+        }
+        cr_repomdrecordcompresstask_free(task, NULL);
+    }
+    g_slist_free(compress_tasks);
+
+    // Add checksums into files names
+    if (cmd_options->unique_md_filenames) {
+        cr_repomd_record_rename_file(pri_xml_rec, NULL);
+        cr_repomd_record_rename_file(fil_xml_rec, NULL);
+        cr_repomd_record_rename_file(oth_xml_rec, NULL);
+        cr_repomd_record_rename_file(pri_db_rec, NULL);
+        cr_repomd_record_rename_file(fil_db_rec, NULL);
+        cr_repomd_record_rename_file(oth_db_rec, NULL);
+        cr_repomd_record_rename_file(pri_zck_rec, NULL);
+        cr_repomd_record_rename_file(fil_zck_rec, NULL);
+        cr_repomd_record_rename_file(oth_zck_rec, NULL);
+        cr_repomd_record_rename_file(prestodelta_rec, NULL);
+        cr_repomd_record_rename_file(prestodelta_zck_rec, NULL);
+        GSList *element = additional_metadata_rec;
+        for (; element; element=g_slist_next(element)) {
+            cr_repomd_record_rename_file(element->data, NULL);
+        }
+    }
+
+    if (cmd_options->set_timestamp_to_revision) {
+        // validated already in cmd_parser.c:cr_cmd_check_arguments
+        gint64 revision = strtoll(cmd_options->revision, NULL, 0);
+        cr_repomd_record_set_timestamp(pri_xml_rec, revision);
+        cr_repomd_record_set_timestamp(fil_xml_rec, revision);
+        cr_repomd_record_set_timestamp(oth_xml_rec, revision);
+        cr_repomd_record_set_timestamp(pri_db_rec, revision);
+        cr_repomd_record_set_timestamp(fil_db_rec, revision);
+        cr_repomd_record_set_timestamp(oth_db_rec, revision);
+        cr_repomd_record_set_timestamp(prestodelta_rec, revision);
+        GSList *element = additional_metadata_rec;
+        for (; element; element=g_slist_next(element)) {
+            cr_repomd_record_set_timestamp(element->data, revision);
+        }
+    }
+
+    // Deduplicate the files by the shared store (after the timestamps are
+    // set, the stored files are never touched)
+    if (cmd_options->shared_store) {
+        cr_RepomdRecord *shared_recs[] = { pri_xml_rec, fil_xml_rec,
+            oth_xml_rec, pri_db_rec, fil_db_rec, oth_db_rec, pri_zck_rec,
+            fil_zck_rec, oth_zck_rec, prestodelta_rec, prestodelta_zck_rec };
+        gint64 shared_size = 0;
+
+        for (size_t x = 0; x < G_N_ELEMENTS(shared_recs); x++)
+            shared_size += share_record_file(shared_recs[x],
+                                             cmd_options->shared_store);
+        for (GSList *elem = additional_metadata_rec; elem; elem = g_slist_next(elem))
+            shared_size += share_record_file(elem->data,
+                                             cmd_options->shared_store);
+
+        g_debug("%" G_GINT64_FORMAT " bytes of metadata shared by %s",
+                shared_size, cmd_options->shared_store);
+    }
+
+    // Gen xml
+    cr_repomd_set_record(repomd_obj, pri_xml_rec);
+    cr_repomd_set_record(repomd_obj, fil_xml_rec);
+    cr_repomd_set_record(repomd_obj, oth_xml_rec);
+    cr_repomd_set_record(repomd_obj, pri_db_rec);
+    cr_repomd_set_record(repomd_obj, fil_db_rec);
+    cr_repomd_set_record(repomd_obj, oth_db_rec);
+    cr_repomd_set_record(repomd_obj, pri_zck_rec);
+    cr_repomd_set_record(repomd_obj, fil_zck_rec);
+    cr_repomd_set_record(repomd_obj, oth_zck_rec);
+    cr_repomd_set_record(repomd_obj, prestodelta_rec);
+    cr_repomd_set_record(repomd_obj, prestodelta_zck_rec);
+    GSList *elem = additional_metadata_rec;
+    for (; elem; elem=g_slist_next(elem)) {
+        cr_repomd_set_record(repomd_obj, elem->data);
+    }
+
+    int i = 0;
+    while (cmd_options->repo_tags && cmd_options->repo_tags[i])
+        cr_repomd_add_repo_tag(repomd_obj, cmd_options->repo_tags[i++]);
+
+    i = 0;
+    while (cmd_options->content_tags && cmd_options->content_tags[i])
+        cr_repomd_add_content_tag(repomd_obj, cmd_options->content_tags[i++]);
+
+    if (cmd_options->distro_cpeids && cmd_options->distro_values) {
+        GSList *cpeid = cmd_options->distro_cpeids;
+        GSList *val   = cmd_options->distro_values;
+        while (cpeid && val) {
+            cr_repomd_add_distro_tag(repomd_obj, cpeid->data, val->data);
+            cpeid = g_slist_next(cpeid);
+            val   = g_slist_next(val);
+        }
+    }
+
+    if (cmd_options->revision)
+        cr_repomd_set_revision(repomd_obj, cmd_options->revision);
+
+    if (contenthash)
+        cr_repomd_set_contenthash(repomd_obj, contenthash,
+                                  user_data.checksum_type_str);
+
+    cr_repomd_sort_records(repomd_obj);
+
+    char *repomd_xml = cr_xml_dump_repomd(repomd_obj, &tmp_err);
+    assert(repomd_xml || tmp_err);
+    cr_repomd_free(repomd_obj);
+
+    if (!repomd_xml) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot generate repomd.xml: ");
+        goto fail;
+    }
+
+    // Write repomd.xml
+    gchar *repomd_path = g_strconcat(tmp_out_repo, "repomd.xml", NULL);
+    FILE *frepomd = fopen(repomd_path, "w");
+    if (!frepomd) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot open %s: %s",
+                    repomd_path, g_strerror(errno));
+        g_free(repomd_xml);
+        g_free(repomd_path);
+        goto fail;
+    }
+    fputs(repomd_xml, frepomd);
+    fclose(frepomd);
+    g_free(repomd_xml);
+    g_free(repomd_path);
+
+
+    // Final move
+    // Copy selected metadata from the old repository
+    cr_RetentionType retentiontype = CR_RETENTION_DEFAULT;
+    gint64 retentionval = (gint64) cmd_options->retain_old;
+
+    if (cmd_options->retain_old_md_by_age) {
+        retentiontype = CR_RETENTION_BYAGE;
+        retentionval = cmd_options->md_max_age;
+    } else if (cmd_options->compatibility) {
+        retentiontype = CR_RETENTION_COMPATIBILITY;
+    }
+
+    ret = cr_old_metadata_retention(out_repo,
+                                    tmp_out_repo,
+                                    retentiontype,
+                                    retentionval,
+                                    err);
+    if (!ret)
+        goto fail;
+
+    gboolean old_repodata_renamed = FALSE;
+    gboolean exchanged = FALSE;
+
+    // === This section should be maximally atomic ===
+
+    sigset_t new_mask, old_mask;
+    sigemptyset(&old_mask);
+    sigfillset(&new_mask);
+    sigdelset(&new_mask, SIGKILL);  // These two signals cannot be
+    sigdelset(&new_mask, SIGSTOP);  // blocked
+
+    sigprocmask(SIG_BLOCK, &new_mask, &old_mask);
+
+    // Rename out_repo to "repodata.old.pid.date.microsecs"
+    gchar *tmp_dirname = cr_append_pid_and_datetime("repodata.old.", NULL);
+    gchar *old_repodata_path = g_build_filename(out_dir, tmp_dirname, NULL);
+    g_free(tmp_dirname);
+
+    exchanged = exchange_dirs(tmp_out_repo, out_repo);
+    if (exchanged) {
+        // The clients never miss the repodata, the old ones are now
+        // in the tmp_out_repo, which is usually the lock
+        g_debug("Exchanged %s <-> %s", tmp_out_repo, out_repo);
+        if (g_rename(tmp_out_repo, old_repodata_path) == -1) {
+            g_debug("Cannot rename %s -> %s: %s", tmp_out_repo,
+                    old_repodata_path, g_strerror(errno));
+            g_free(old_repodata_path);
+            old_repodata_path = g_strdup(tmp_out_repo);
+        }
+        old_repodata_renamed = TRUE;
+    } else if (g_rename(out_repo, old_repodata_path) == -1) {
+        g_debug("Old repodata doesn't exists: Cannot rename %s -> %s: %s",
+                out_repo, old_repodata_path, g_strerror(errno));
+    } else {
+        g_debug("Renamed %s -> %s", out_repo, old_repodata_path);
+        old_repodata_renamed = TRUE;
+    }
+
+    // Rename tmp_out_repo to out_repo (unless they were exchanged)
+    if (!exchanged && g_rename(tmp_out_repo, out_repo) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot rename %s -> %s: %s",
+                    tmp_out_repo, out_repo, g_strerror(errno));
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        g_free(old_repodata_path);
+        goto fail;
+    } else if (!exchanged) {
+        g_debug("Renamed %s -> %s", tmp_out_repo, out_repo);
+    }
+
+    // Remove lock
+    if (g_strcmp0(lock_dir, tmp_out_repo))
+        // If lock_dir is not same as temporary repo dir then remove it
+        cr_remove_dir(lock_dir, NULL);
+
+    // Disable path stored for exit handler
+    cr_unset_cleanup_handler_for(lock_dir, NULL);
+    g_clear_pointer(&lock_dir, g_free);
+    g_clear_pointer(&tmp_out_repo, g_free);
+
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+    // === End of section that has to be maximally atomic ===
+
+    if (old_repodata_renamed) {
+        // Remove "metadata.old" dir
+        if (cr_rm(old_repodata_path, CR_RM_RECURSIVE, NULL, &tmp_err)) {
+            g_debug("Old repo %s removed", old_repodata_path);
+        } else {
+            g_warning("Cannot remove %s: %s", old_repodata_path, tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    if (metrics && cmd_options->trace_file) {
+        if (!cr_metrics_write_trace(metrics, cmd_options->trace_file, &tmp_err)) {
+            g_warning("%s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    if (metrics && cmd_options->metrics_file) {
+        cr_metrics_set_value(metrics, "packages", user_data.package_count);
+        cr_metrics_set_value(metrics, "tasks", user_data.task_count);
+        cr_metrics_set_value(metrics, "workers", cmd_options->workers);
+        cr_metrics_memory_set(metrics, CR_METRICS_MEM_SQLITE,
+                              sqlite3_memory_used(),
+                              sqlite3_memory_highwater(0));
+        gchar *locks_summary = cr_metrics_locks_summary(metrics);
+        if (locks_summary)
+            g_message("Lock contention:\n%s", locks_summary);
+        g_free(locks_summary);
+        gchar *memory_summary = cr_metrics_memory_summary(metrics);
+        g_message("Memory: %s", memory_summary);
+        g_free(memory_summary);
+        if (!cr_metrics_write_json(metrics, cmd_options->metrics_file, &tmp_err)) {
+            g_warning("%s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    g_free(old_repodata_path);
+
+    result = g_malloc0(sizeof(*result));
+    result->task_count = user_data.task_count;
+    result->package_count = user_data.package_count;
+    result->had_errors = user_data.had_errors;
+    result->exit_val = exit_val;
+    result->repomd_path = g_strconcat(out_repo, "repomd.xml", NULL);
+
+fail:
+    if (!result) {
+        // Stop the threads before their files are removed
+        if (graph)
+            cr_taskgraph_free(graph);
+        if (pool && pool != shared_pool)
+            g_thread_pool_free(pool, TRUE, TRUE);
+        if (held_tasks)
+            g_ptr_array_free(held_tasks, TRUE);
+        if (task_paths)
+            g_string_chunk_free(task_paths);
+        if (remote_pkgs)
+            g_ptr_array_free(remote_pkgs, TRUE);
+        cr_dumper_prefetch_free(user_data.prefetch);
+        cr_dumper_autoscale_free(user_data.autoscale);
+        cr_dumper_progress_free(user_data.progress);
+        if (additional_pool)
+            g_thread_pool_free(additional_pool, FALSE, TRUE);
+        if (additional_tasks)
+            g_hash_table_destroy(additional_tasks);
+        cr_dumper_old_md_free(user_data.old_md);
+        cr_db_package_reader_free(old_db);
+        if (user_data.media_location_bases)
+            g_ptr_array_free(user_data.media_location_bases, TRUE);
+
+        cr_pkgcache_writer_close(user_data.pkg_cache_writer, FALSE, NULL);
+        cr_pkgcache_free(user_data.pkg_cache);
+        cr_pkgindex_writer_free(user_data.pkg_index);
+        cr_checksum_cache_free(user_data.checksum_cache);
+        if (user_data.contenthash)
+            g_free(cr_checksum_final(user_data.contenthash, NULL));
+        if (output_pkg_list)
+            fclose(output_pkg_list);
+
+        cr_xmlfile_close(pri_cr_file, NULL);
+        cr_xmlfile_close(fil_cr_file, NULL);
+        cr_xmlfile_close(oth_cr_file, NULL);
+        cr_xmlfile_close(pri_cr_zck, NULL);
+        cr_xmlfile_close(fil_cr_zck, NULL);
+        cr_xmlfile_close(oth_cr_zck, NULL);
+        if (!jobs_started) {
+            cr_db_close(pri_db, NULL);
+            cr_db_close(fil_db, NULL);
+            cr_db_close(oth_db, NULL);
+            cr_contentstat_free(pri_stat, NULL);
+            cr_contentstat_free(fil_stat, NULL);
+            cr_contentstat_free(oth_stat, NULL);
+            cr_contentstat_free(pri_zck_stat, NULL);
+            cr_contentstat_free(fil_zck_stat, NULL);
+            cr_contentstat_free(oth_zck_stat, NULL);
+        }
+        cr_metadatalocation_free(old_metadata_location);
+        cr_repomd_free(old_repomd);
+
+        // Do what the exit handler of the createrepo_c does
+        if (tmp_out_repo)
+            cr_remove_dir(tmp_out_repo, NULL);
+        if (lock_dir && g_strcmp0(lock_dir, tmp_out_repo))
+            cr_remove_dir(lock_dir, NULL);
+        if (lock_dir)
+            cr_unset_cleanup_handler_for(lock_dir, NULL);
+    }
+
+    // Clean up
+    g_debug("Memory cleanup");
+
+    g_strfreev(in_dirs);
+    cr_metrics_free(metrics);
+    cr_blockindex_free(block_index);
+    if (old_metadata)
+        cr_metadata_free(old_metadata);
+
+    g_free(contenthash);
+    g_free(in_repo);
+    g_free(out_repo);
+    g_free(tmp_out_repo);
+    g_free(in_dir);
+    g_free(out_dir);
+    g_free(lock_dir);
+    g_free(pri_xml_filename);
+    g_free(fil_xml_filename);
+    g_free(oth_xml_filename);
+    g_free(pri_db_filename);
+    g_free(fil_db_filename);
+    g_free(oth_db_filename);
+    g_free(pri_zck_filename);
+    g_free(fil_zck_filename);
+    g_free(oth_zck_filename);
+    g_free(pri_dict_file);
+    g_free(fil_dict_file);
+    g_free(oth_dict_file);
+    g_free(pri_dict);
+    g_free(fil_dict);
+    g_free(oth_dict);
+    g_slist_free_full(additional_metadata, (GDestroyNotify) cr_metadatum_free);
+    g_slist_free(additional_metadata_rec);
+
+    cr_xml_dump_cleanup();
+    cr_package_parser_cleanup();
+
+    // The next messages are written directly
+    cr_log_async_stop();
+
+    if (result)
+        g_debug("All done");
+
+    cr_run_context_pop(run_ctx);
+    cr_run_context_free(run_ctx);
+    return result;
+}
+
@@ -0,0 +1,94 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_CREATEREPO_H__
+#define __C_CREATEREPOLIB_CREATEREPO_H__
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \defgroup   createrepo  The createrepo_c pipeline as a library call.
+ *  \addtogroup createrepo
+ *  @{
+ */
+
+/** Options of a run, the same as the options of the createrepo_c program.
+ */
+typedef struct _cr_CreaterepoOptions cr_CreaterepoOptions;
+
+/** Result of a successful run.
+ */
+typedef struct {
+    long task_count;            /*!< number of found packages */
+    long package_count;         /*!< number of packages in the metadata */
+    gboolean had_errors;        /*!< some packages couldn't be processed */
+    int exit_val;               /*!< exit value of the createrepo_c program
+                                     (2 with --error-exit-val and errors) */
+    gchar *repomd_path;         /*!< path to the new repomd.xml */
+} cr_CreaterepoResult;
+
+/** Parse the options of a run.
+ * @param args          NULL terminated list of the command line arguments
+ *                      of createrepo_c without the program name, e.g.
+ *                      {"--update", "--workers=8", "path/to/repo", NULL}
+ * @param err           GError **
+ * @return              options or NULL on error
+ */
+cr_CreaterepoOptions *
+cr_createrepo_options_new(const gchar * const *args, GError **err);
+
+/** Free the options.
+ * @param options       options or NULL
+ */
+void
+cr_createrepo_options_free(cr_CreaterepoOptions *options);
+
+/** Generate the repodata in the process, as the createrepo_c program does.
+ * Every run initializes the package parser and the xml dump and releases
+ * them at its end, call cr_package_parser_init() and cr_xml_dump_init()
+ * once to keep them initialized between the runs. Runs of different repos
+ * could be made at the same time from more threads, each one has its own
+ * compression settings and log levels and doesn't change the process-wide
+ * ones (see cr_CompressionSettings). The options are used up by the run,
+ * parse new ones for the next run.
+ * On error the lock and the temporary repodata are removed.
+ * @param options       options
+ * @param err           GError **
+ * @return              result (free it by cr_createrepo_result_free())
+ *                      or NULL on error
+ */
+cr_CreaterepoResult *
+cr_createrepo_run(cr_CreaterepoOptions *options, GError **err);
+
+/** Free the result.
+ * @param result        result or NULL
+ */
+void
+cr_createrepo_result_free(cr_CreaterepoResult *result);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_CREATEREPO_H__ */
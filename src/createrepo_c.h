@@ -39,8 +39,10 @@ extern "C" {
  */
 
 #include <glib.h>
+#include "blockindex.h"
 #include "checksum.h"
 #include "compression_wrapper.h"
+#include "createrepo.h"
 #include "deltarpms.h"
 #include "error.h"
 #include "load_metadata.h"
@@ -49,10 +51,15 @@ extern "C" {
 #include "package.h"
 #include "parsehdr.h"
 #include "parsepkg.h"
+#include "pkgindex.h"
+#include "remotepkg.h"
+#include "repodiff.h"
 #include "repomd.h"
+#include "shard.h"
 #include "sqlite.h"
 #include "threads.h"
 #include "updateinfo.h"
+#include "verify.h"
 #include "version.h"
 #include "xml_dump.h"
 #include "xml_file.h"
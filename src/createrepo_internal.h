@@ -0,0 +1,64 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_CREATEREPO_INTERNAL_H__
+#define __C_CREATEREPOLIB_CREATEREPO_INTERNAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include "cmd_parser.h"
+#include "createrepo.h"
+
+/** Pool of workers which reads the packages of more runs at once
+ * (see cr_createrepo_run_cmd_options()).
+ * @param workers           number of the workers
+ * @return                  pool (free it by g_thread_pool_free() after
+ *                          all its runs ended)
+ */
+GThreadPool *
+cr_createrepo_shared_pool_new(gint workers);
+
+/** Run the pipeline with options parsed by cr_cmd_parse_arguments()
+ * (see cr_createrepo_run()).
+ * @param cmd_options       options, they are changed by the run
+ * @param directories       NULL terminated list of directories to index
+ * @param cleanup_handler   remove the lock on exit() and on terminating
+ *                          signals (the createrepo_c program)
+ * @param shared_pool       pool of workers shared with other runs
+ *                          (see cr_createrepo_shared_pool_new()) or NULL
+ *                          for the own pool of --workers threads
+ *                          (--max-workers is ignored with a shared pool)
+ * @param err               GError **
+ * @return                  result or NULL on error
+ */
+cr_CreaterepoResult *
+cr_createrepo_run_cmd_options(struct CmdOptions *cmd_options,
+                              gchar **directories,
+                              gboolean cleanup_handler,
+                              GThreadPool *shared_pool,
+                              GError **err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_CREATEREPO_INTERNAL_H__ */
@@ -24,18 +24,36 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include "createrepo_shared.h"
 #include "error.h"
 #include "misc.h"
 #include "cleanup.h"
 
-char *global_lock_dir     = NULL;  // Path to .repodata/ dir that is used as a lock
-char *global_tmp_out_repo = NULL;  // Path to temporary repodata directory,
-                                   // if NULL that it's same as
-                                   // the global_lock_dir
+/** Directories removed by the exit cleanup. A process could generate
+ * more repos at once (e.g. more pipelines of the library in threads),
+ * every one registers its own.
+ */
+typedef struct {
+    char *lock_dir;         // Path to .repodata/ dir that is used as a lock
+    char *tmp_out_repo;     // Path to temporary repodata directory,
+                            // if NULL that it's same as the lock_dir
+} CleanupDirs;
+
+static GMutex cleanup_mutex;            // Guards the cleanup_dirs
+static GSList *cleanup_dirs = NULL;     // CleanupDirs *
+static gboolean exit_cleanup_registered = FALSE;
+
+static void
+cleanup_dirs_free(CleanupDirs *dirs)
+{
+    g_free(dirs->lock_dir);
+    g_free(dirs->tmp_out_repo);
+    g_free(dirs);
+}
 
 /**
  * Clean up function called on normal program termination.
- * It removes temporary .repodata/ directory that servers as a lock
+ * It removes temporary .repodata/ directories that servers as a lock
  * for other createrepo[_c] processes.
  * This functions acts only if exit status != EXIST_SUCCESS.
  *
@@ -43,15 +61,24 @@ char *global_tmp_out_repo = NULL;  // Path to temporary repodata directory,
 static void
 exit_cleanup()
 {
-    if (global_lock_dir) {
-        g_debug("Removing %s", global_lock_dir);
-        cr_remove_dir(global_lock_dir, NULL);
-    }
+    // The exit could be called by the signal handler in a thread which
+    // holds the mutex, the directories are removed anyway then
+    gboolean locked = g_mutex_trylock(&cleanup_mutex);
+
+    for (GSList *elem = cleanup_dirs; elem; elem = g_slist_next(elem)) {
+        CleanupDirs *dirs = elem->data;
+
+        g_debug("Removing %s", dirs->lock_dir);
+        cr_remove_dir(dirs->lock_dir, NULL);
 
-    if (global_tmp_out_repo) {
-        g_debug("Removing %s", global_tmp_out_repo);
-        cr_remove_dir(global_tmp_out_repo, NULL);
+        if (dirs->tmp_out_repo) {
+            g_debug("Removing %s", dirs->tmp_out_repo);
+            cr_remove_dir(dirs->tmp_out_repo, NULL);
+        }
     }
+
+    if (locked)
+        g_mutex_unlock(&cleanup_mutex);
 }
 
 /** Signal handler
@@ -69,18 +96,26 @@ cr_set_cleanup_handler(const char *lock_dir,
                        const char *tmp_out_repo,
                        G_GNUC_UNUSED GError **err)
 {
+    assert(lock_dir);
     assert(!err || *err == NULL);
 
-    // Set global variables
-    global_lock_dir     = g_strdup(lock_dir);
+    CleanupDirs *dirs = g_new0(CleanupDirs, 1);
+    dirs->lock_dir = g_strdup(lock_dir);
     if (g_strcmp0(lock_dir, tmp_out_repo))
-        global_tmp_out_repo = g_strdup(tmp_out_repo);
-    else
-        global_tmp_out_repo = NULL;
-
-    // Register on exit cleanup function
-    if (atexit(exit_cleanup))
-        g_warning("Cannot set exit cleanup function by atexit()");
+        dirs->tmp_out_repo = g_strdup(tmp_out_repo);
+
+    g_mutex_lock(&cleanup_mutex);
+    cleanup_dirs = g_slist_prepend(cleanup_dirs, dirs);
+
+    // Register on exit cleanup function (just once, a process could
+    // generate the repodata several times, e.g. createrepo_c --watch)
+    if (!exit_cleanup_registered) {
+        if (atexit(exit_cleanup))
+            g_warning("Cannot set exit cleanup function by atexit()");
+        else
+            exit_cleanup_registered = TRUE;
+    }
+    g_mutex_unlock(&cleanup_mutex);
 
     // Prepare signal handler configuration
     g_debug("Signal handler setup");
@@ -111,10 +146,30 @@ cr_set_cleanup_handler(const char *lock_dir,
 gboolean
 cr_unset_cleanup_handler(G_GNUC_UNUSED GError **err)
 {
-    g_free(global_lock_dir);
-    global_lock_dir = NULL;
-    g_free(global_tmp_out_repo);
-    global_tmp_out_repo = NULL;
+    g_mutex_lock(&cleanup_mutex);
+    g_slist_free_full(cleanup_dirs, (GDestroyNotify) cleanup_dirs_free);
+    cleanup_dirs = NULL;
+    g_mutex_unlock(&cleanup_mutex);
+
+    return TRUE;
+}
+
+gboolean
+cr_unset_cleanup_handler_for(const char *lock_dir,
+                             G_GNUC_UNUSED GError **err)
+{
+    assert(lock_dir);
+
+    g_mutex_lock(&cleanup_mutex);
+    for (GSList *elem = cleanup_dirs; elem; elem = g_slist_next(elem)) {
+        CleanupDirs *dirs = elem->data;
+        if (!strcmp(dirs->lock_dir, lock_dir)) {
+            cleanup_dirs = g_slist_delete_link(cleanup_dirs, elem);
+            cleanup_dirs_free(dirs);
+            break;
+        }
+    }
+    g_mutex_unlock(&cleanup_mutex);
 
     return TRUE;
 }
@@ -268,20 +323,64 @@ cr_lock_repo(const gchar *repo_dir,
     return TRUE;
 }
 
+static GLogLevelFlags
+logging_hidden_levels(gboolean quiet, gboolean verbose)
+{
+    if (quiet)  // Quiet mode
+        return G_LOG_LEVEL_MESSAGE | G_LOG_LEVEL_INFO |
+               G_LOG_LEVEL_DEBUG | G_LOG_LEVEL_WARNING;
+    if (verbose)  // Verbose mode
+        return 0;
+    return G_LOG_LEVEL_DEBUG;  // Standard mode
+}
+
 void
 cr_setup_logging(gboolean quiet, gboolean verbose)
 {
-    if (quiet) {
-        // Quiet mode
-        GLogLevelFlags hidden_levels = G_LOG_LEVEL_MESSAGE | G_LOG_LEVEL_INFO |
-                                       G_LOG_LEVEL_DEBUG | G_LOG_LEVEL_WARNING;
-        g_log_set_default_handler (cr_log_fn, GINT_TO_POINTER(hidden_levels));
-    } else if (verbose) {
-        // Verbose mode
-        g_log_set_default_handler (cr_log_fn, GINT_TO_POINTER(0));
-    } else {
-        // Standard mode
-        GLogLevelFlags hidden_levels = G_LOG_LEVEL_DEBUG;
-        g_log_set_default_handler (cr_log_fn, GINT_TO_POINTER(hidden_levels));
-    }
+    GLogLevelFlags hidden_levels = logging_hidden_levels(quiet, verbose);
+    g_log_set_default_handler (cr_log_fn, GINT_TO_POINTER(hidden_levels));
+}
+
+void
+cr_setup_async_logging(gboolean quiet, gboolean verbose)
+{
+    GLogLevelFlags hidden_levels = logging_hidden_levels(quiet, verbose);
+    cr_log_async_start();
+    g_log_set_default_handler (cr_log_async_fn, GINT_TO_POINTER(hidden_levels));
+}
+
+cr_RunContext *
+cr_run_context_new(gboolean quiet, gboolean verbose)
+{
+    cr_RunContext *ctx = g_new0(cr_RunContext, 1);
+    ctx->compression = cr_compression_settings_new();
+    ctx->hidden_log_levels = logging_hidden_levels(quiet, verbose);
+    return ctx;
+}
+
+void
+cr_run_context_free(cr_RunContext *ctx)
+{
+    if (!ctx)
+        return;
+    cr_compression_settings_free(ctx->compression);
+    g_free(ctx);
+}
+
+void
+cr_run_context_push(cr_RunContext *ctx)
+{
+    if (!ctx)
+        return;
+    cr_compression_settings_push_thread_default(ctx->compression);
+    cr_log_push_thread_hidden_levels(ctx->hidden_log_levels);
+}
+
+void
+cr_run_context_pop(cr_RunContext *ctx)
+{
+    if (!ctx)
+        return;
+    cr_log_pop_thread_hidden_levels();
+    cr_compression_settings_pop_thread_default(ctx->compression);
 }
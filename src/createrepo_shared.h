@@ -47,6 +47,9 @@ extern "C" {
  * This handler assures that the cleanup function that is hooked on exit
  * gets called.
  *
+ * More repos generated at once register their dirs by more calls,
+ * the exit cleanup removes all the registered dirs.
+ *
  * @param lock_dir      Dir that serves as lock (".repodata/")
  * @param tmp_out_repo  Dir that is really used for repodata generation
  *                      (usually exactly the same as lock dir if not
@@ -107,19 +110,81 @@ cr_lock_repo(const gchar *repo_dir,
              GError **err);
 
 /**
- * Unset cleanup handler.
+ * Unset cleanup handler (forget all the registered dirs).
  * @param err               GError **
  * @return                  TRUE on success, FALSE if err is set.
  */
 gboolean
 cr_unset_cleanup_handler(GError **err);
 
+/**
+ * Forget the dirs registered with the lock_dir by cr_set_cleanup_handler(),
+ * the dirs of other repos generated at the same time stay registered.
+ * @param lock_dir          Dir that serves as lock (".repodata/")
+ * @param err               GError **
+ * @return                  TRUE on success, FALSE if err is set.
+ */
+gboolean
+cr_unset_cleanup_handler_for(const char *lock_dir, GError **err);
+
 /**
  * Setup logging for the application.
  */
 void
 cr_setup_logging(gboolean quiet, gboolean verbose);
 
+/**
+ * Setup logging for the application, the messages are written by
+ * a background thread (see cr_log_async_fn()). Stop it by
+ * cr_log_async_stop().
+ */
+void
+cr_setup_async_logging(gboolean quiet, gboolean verbose);
+
+/**
+ * Settings of a run of the pipeline which are process-wide otherwise,
+ * so the runs in the process don't share them. Every thread doing work
+ * of the run (also a thread of a pool shared with other runs) does it
+ * between cr_run_context_push() and cr_run_context_pop().
+ */
+typedef struct {
+    cr_CompressionSettings *compression; /*!< Compression of the written
+                                              files (owned) */
+    GLogLevelFlags hidden_log_levels;    /*!< Levels not logged by the run */
+} cr_RunContext;
+
+/**
+ * New context of a run, with the default compression settings.
+ * @param quiet             Log only errors
+ * @param verbose           Log debug messages too
+ * @return                  Context
+ */
+cr_RunContext *
+cr_run_context_new(gboolean quiet, gboolean verbose);
+
+/**
+ * Free the context.
+ * @param ctx               Context or NULL
+ */
+void
+cr_run_context_free(cr_RunContext *ctx);
+
+/**
+ * Make the context the thread default of the calling thread (see
+ * cr_compression_settings_push_thread_default() and
+ * cr_log_push_thread_hidden_levels()).
+ * @param ctx               Context or NULL (nothing is done)
+ */
+void
+cr_run_context_push(cr_RunContext *ctx);
+
+/**
+ * Undo the cr_run_context_push() of the context.
+ * @param ctx               Context or NULL (nothing is done)
+ */
+void
+cr_run_context_pop(cr_RunContext *ctx);
+
 /**
  * Set global pointer to exit value that is used in function set by atexit
  * @param exit_val          Pointer to exit_value int
@@ -24,8 +24,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include "deltarpms.h"
 #ifdef    CR_DELTA_RPM_SUPPORT
 #include <drpm.h>
@@ -34,10 +38,37 @@
 #include "parsepkg.h"
 #include "misc.h"
 #include "error.h"
+#include "checksum.h"
+#include "cleanup.h"
 
 
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 
+/** Name of the file with cached results of the previous runs
+ * inside of the outdeltadir.
+ */
+#define DELTACACHE_FILENAME     ".deltacache"
+
+/** Name of the file with the index of headers of the old packages
+ * inside of the outdeltadir.
+ */
+#define DELTAHEADERS_FILENAME   ".deltaheaders"
+
+/** Initial estimate of the memory drpm needs per byte of size_installed
+ * of the target. It keeps the uncompressed payloads of the old and
+ * the new package and the suffix array of the old one.
+ */
+#define DELTA_MEMORY_RATIO      6.0
+
+/** Memory drpm needs for any delta, regardless of the sizes.
+ */
+#define DELTA_MEMORY_BASE       G_GINT64_CONSTANT(16*1024*1024)
+
+/** Targets smaller than this don't calibrate the memory model,
+ * their usage is dominated by the DELTA_MEMORY_BASE.
+ */
+#define DELTA_CALIBRATION_MIN_SIZE  G_GINT64_CONSTANT(1024*1024)
+
 gboolean
 cr_drpm_support(void)
 {
@@ -49,11 +80,10 @@ cr_drpm_support(void)
 
 #ifdef    CR_DELTA_RPM_SUPPORT
 
-char *
-cr_drpm_create(cr_DeltaTargetPackage *old,
-               cr_DeltaTargetPackage *new,
-               const char *destdir,
-               GError **err)
+static gchar *
+cr_drpm_path(cr_DeltaTargetPackage *old,
+             cr_DeltaTargetPackage *new,
+             const char *destdir)
 {
     gchar *drpmfn, *drpmpath;
 
@@ -62,6 +92,16 @@ cr_drpm_create(cr_DeltaTargetPackage *old,
                              new->version, new->release, old->arch);
     drpmpath = g_build_filename(destdir, drpmfn, NULL);
     g_free(drpmfn);
+    return drpmpath;
+}
+
+char *
+cr_drpm_create(cr_DeltaTargetPackage *old,
+               cr_DeltaTargetPackage *new,
+               const char *destdir,
+               GError **err)
+{
+    gchar *drpmpath = cr_drpm_path(old, new, destdir);
 
     drpm_make_options *opts;
     drpm_make_options_init(&opts);
@@ -80,6 +120,109 @@ cr_drpm_create(cr_DeltaTargetPackage *old,
     return drpmpath;
 }
 
+/** Read the virtual size and the resident set size (bytes) of this
+ * process from /proc/self/statm.
+ */
+static gboolean
+cr_drpm_statm(gint64 *vsize, gint64 *rss)
+{
+    gchar *content = NULL;
+    long long pages_vsize, pages_rss;
+    gint64 page_size = sysconf(_SC_PAGESIZE);
+    gboolean ret = FALSE;
+
+    if (g_file_get_contents("/proc/self/statm", &content, NULL, NULL)
+        && sscanf(content, "%lld %lld", &pages_vsize, &pages_rss) == 2)
+    {
+        *vsize = pages_vsize * page_size;
+        *rss = pages_rss * page_size;
+        ret = TRUE;
+    }
+
+    g_free(content);
+    return ret;
+}
+
+/** Same as cr_drpm_create() but the delta is made by a forked process
+ * whose address space is limited to max_memory bytes above the current
+ * one (if max_memory > 0). A process that hits the limit or crashes
+ * fails only its delta.
+ * @param used_memory   the peak RSS of the process above the RSS of this
+ *                      process at the fork or -1 if unknown
+ */
+static gchar *
+cr_drpm_create_in_process(cr_DeltaTargetPackage *old,
+                          cr_DeltaTargetPackage *new,
+                          const char *destdir,
+                          gint64 max_memory,
+                          gint64 *used_memory,
+                          GError **err)
+{
+    gchar *drpmpath = cr_drpm_path(old, new, destdir);
+    gint64 vsize = -1, rss = -1;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    *used_memory = -1;
+    if (!cr_drpm_statm(&vsize, &rss))
+        vsize = rss = -1;
+
+    pid = fork();
+    if (pid < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_DELTARPM,
+                    "Cannot fork to make %s: %s", drpmpath, g_strerror(errno));
+        g_free(drpmpath);
+        return NULL;
+    }
+
+    if (pid == 0) {
+        // Child of a multithreaded process, only drpm is called
+        // and the process ends by _exit()
+        if (max_memory > 0 && vsize >= 0) {
+            struct rlimit limit;
+            limit.rlim_cur = limit.rlim_max = (rlim_t) (vsize + max_memory);
+            setrlimit(RLIMIT_AS, &limit);
+        }
+
+        drpm_make_options *opts;
+        drpm_make_options_init(&opts);
+        drpm_make_options_defaults(opts);
+        int ret = drpm_make(old->path, new->path, drpmpath, opts);
+        _exit(ret == DRPM_ERR_OK ? 0 : (ret & 0x7f) ? (ret & 0x7f) : 1);
+    }
+
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno == EINTR)
+            continue;
+        g_set_error(err, ERR_DOMAIN, CRE_DELTARPM,
+                    "Cannot wait for the process making %s: %s",
+                    drpmpath, g_strerror(errno));
+        g_free(drpmpath);
+        return NULL;
+    }
+
+    // ru_maxrss (KiB) includes the pages shared with this process
+    if (rss >= 0)
+        *used_memory = MAX((gint64) usage.ru_maxrss * 1024 - rss, 0);
+
+    if (WIFSIGNALED(status) || WEXITSTATUS(status) != 0) {
+        if (WIFSIGNALED(status))
+            g_set_error(err, ERR_DOMAIN, CRE_DELTARPM,
+                        "Process making %s was killed by signal %d "
+                        "(out of memory?)", drpmpath, WTERMSIG(status));
+        else
+            g_set_error(err, ERR_DOMAIN, CRE_DELTARPM,
+                        "Deltarpm cannot make %s (%d) from old: %s and new: %s",
+                        drpmpath, WEXITSTATUS(status), old->path, new->path);
+        g_unlink(drpmpath);
+        g_free(drpmpath);
+        return NULL;
+    }
+
+    return drpmpath;
+}
+
 void
 cr_deltapackage_free(cr_DeltaPackage *deltapackage)
 {
@@ -163,6 +306,351 @@ cr_free_gslist_of_strings(gpointer list)
     cr_slist_free_full((GSList *) list, (GDestroyNotify) g_free);
 }
 
+/*
+ * 0) Cache of the results of the previous runs
+ *
+ * The cache is a key file in the outdeltadir with a group per drpm file:
+ *   old, new       - identity of the old and new package (see
+ *                    cr_deltatargetpackage_id())
+ *   size, mtime    - of the drpm file, the cached data are valid only
+ *                    while the file is unchanged
+ *   checksum_type, location_href, nevra, xml
+ *                  - prestodelta xml chunk of the drpm
+ *
+ * The same format is used by the index of the headers of old packages,
+ * with a group per full path of an old rpm:
+ *   size, mtime    - of the rpm file
+ *   name, arch, epoch, version, release, size_installed
+ *                  - data of cr_DeltaTargetPackage
+ */
+
+typedef struct {
+    GKeyFile *keyfile;
+    gchar *path;
+    gboolean groups_in_dir; // groups are filenames in the dir of the cache
+    GMutex mutex;
+    gboolean changed;
+} cr_DeltaCache;
+
+
+static cr_DeltaCache *
+cr_deltacache_load(const char *dir, const char *filename, gboolean groups_in_dir)
+{
+    cr_DeltaCache *cache = g_new0(cr_DeltaCache, 1);
+
+    cache->keyfile = g_key_file_new();
+    cache->path = g_build_filename(dir, filename, NULL);
+    cache->groups_in_dir = groups_in_dir;
+    g_mutex_init(&(cache->mutex));
+
+    // A missing or broken cache means nothing is cached
+    if (g_file_test(cache->path, G_FILE_TEST_EXISTS)
+        && !g_key_file_load_from_file(cache->keyfile, cache->path,
+                                      G_KEY_FILE_NONE, NULL))
+    {
+        g_debug("%s: Ignoring broken cache %s", __func__, cache->path);
+        g_key_file_free(cache->keyfile);
+        cache->keyfile = g_key_file_new();
+    }
+
+    return cache;
+}
+
+
+/** Save the cache (without entries of the removed files) and free it.
+ */
+static void
+cr_deltacache_save_and_free(cr_DeltaCache *cache)
+{
+    gchar **groups;
+    gchar *data;
+    gsize length;
+    _cleanup_free_ gchar *dir = NULL;
+    GError *tmp_err = NULL;
+
+    if (!cache)
+        return;
+
+    dir = g_path_get_dirname(cache->path);
+    groups = g_key_file_get_groups(cache->keyfile, NULL);
+    for (gchar **group = groups; *group; group++) {
+        _cleanup_free_ gchar *path = NULL;
+        if (cache->groups_in_dir)
+            path = g_build_filename(dir, *group, NULL);
+        else
+            path = g_strdup(*group);
+        if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+            g_key_file_remove_group(cache->keyfile, *group, NULL);
+            cache->changed = TRUE;
+        }
+    }
+    g_strfreev(groups);
+
+    if (cache->changed) {
+        data = g_key_file_to_data(cache->keyfile, &length, NULL);
+        if (!g_file_set_contents(cache->path, data, length, &tmp_err)) {
+            g_debug("%s: Cannot save %s: %s", __func__, cache->path,
+                    tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+        g_free(data);
+    }
+
+    g_key_file_free(cache->keyfile);
+    g_free(cache->path);
+    g_mutex_clear(&(cache->mutex));
+    g_free(cache);
+}
+
+
+/** Is the drpm file the same as the one recorded in the cache?
+ * The cache mutex has to be locked.
+ */
+static gboolean
+cr_deltacache_file_unchanged(cr_DeltaCache *cache,
+                             const char *group,
+                             const char *drpmpath)
+{
+    struct stat st;
+
+    if (!g_key_file_has_group(cache->keyfile, group))
+        return FALSE;
+
+    if (stat(drpmpath, &st) == -1)
+        return FALSE;
+
+    return g_key_file_get_int64(cache->keyfile, group, "size", NULL) == st.st_size
+        && g_key_file_get_int64(cache->keyfile, group, "mtime", NULL) == st.st_mtime;
+}
+
+
+static gboolean
+cr_deltacache_has_value(cr_DeltaCache *cache,
+                        const char *group,
+                        const char *key,
+                        const char *value)
+{
+    _cleanup_free_ gchar *cached = NULL;
+
+    cached = g_key_file_get_string(cache->keyfile, group, key, NULL);
+    return value && !g_strcmp0(cached, value);
+}
+
+
+/** Could the string be used as a group name in the key file?
+ */
+static gboolean
+cr_deltacache_valid_group(const char *group)
+{
+    if (!group || !*group)
+        return FALSE;
+
+    for (const char *c = group; *c; c++)
+        if (*c == '[' || *c == ']' || g_ascii_iscntrl(*c))
+            return FALSE;
+
+    return TRUE;
+}
+
+
+/** Record the size and mtime of the file.
+ * The cache mutex has to be locked.
+ */
+static void
+cr_deltacache_set_file(cr_DeltaCache *cache,
+                       const char *group,
+                       const char *drpmpath)
+{
+    struct stat st;
+
+    cache->changed = TRUE;
+
+    if (stat(drpmpath, &st) == -1) {
+        g_key_file_remove_group(cache->keyfile, group, NULL);
+        return;
+    }
+
+    g_key_file_set_int64(cache->keyfile, group, "size", st.st_size);
+    g_key_file_set_int64(cache->keyfile, group, "mtime", st.st_mtime);
+}
+
+
+/** Identity of a package used as a cache key - its checksum if known,
+ * otherwise the size and the mtime of the rpm file.
+ */
+static gchar *
+cr_deltatargetpackage_id(cr_DeltaTargetPackage *tpkg)
+{
+    struct stat st;
+
+    if (tpkg->pkgid)
+        return g_strdup(tpkg->pkgid);
+
+    if (stat(tpkg->path, &st) == -1)
+        return NULL;
+
+    return g_strdup_printf("%"G_GINT64_FORMAT":%"G_GINT64_FORMAT,
+                           (gint64) st.st_size, (gint64) st.st_mtime);
+}
+
+
+/** Was the drpm of the old and new package generated by a previous run?
+ */
+static gboolean
+cr_deltacache_has_delta(cr_DeltaCache *cache,
+                        const char *drpmpath,
+                        const char *old_id,
+                        const char *new_id)
+{
+    const char *group = cr_get_filename(drpmpath);
+    gboolean ret;
+
+    g_mutex_lock(&(cache->mutex));
+    ret = cr_deltacache_file_unchanged(cache, group, drpmpath)
+          && cr_deltacache_has_value(cache, group, "old", old_id)
+          && cr_deltacache_has_value(cache, group, "new", new_id);
+    g_mutex_unlock(&(cache->mutex));
+
+    return ret;
+}
+
+
+static void
+cr_deltacache_set_delta(cr_DeltaCache *cache,
+                        const char *drpmpath,
+                        const char *old_id,
+                        const char *new_id)
+{
+    const char *group = cr_get_filename(drpmpath);
+
+    if (!cr_deltacache_valid_group(group))
+        return;
+
+    g_mutex_lock(&(cache->mutex));
+    g_key_file_remove_group(cache->keyfile, group, NULL);
+    cache->changed = TRUE;
+    if (old_id && new_id) {
+        g_key_file_set_string(cache->keyfile, group, "old", old_id);
+        g_key_file_set_string(cache->keyfile, group, "new", new_id);
+        cr_deltacache_set_file(cache, group, drpmpath);
+    }
+    g_mutex_unlock(&(cache->mutex));
+}
+
+
+/** Return the cached prestodelta xml chunk of the drpm or NULL.
+ */
+static gchar *
+cr_deltacache_get_xml(cr_DeltaCache *cache,
+                      const char *drpmpath,
+                      cr_ChecksumType checksum_type,
+                      const char *location_href,
+                      gchar **nevra)
+{
+    const char *group = cr_get_filename(drpmpath);
+    gchar *xml = NULL;
+
+    g_mutex_lock(&(cache->mutex));
+    if (cr_deltacache_file_unchanged(cache, group, drpmpath)
+        && cr_deltacache_has_value(cache, group, "checksum_type",
+                                   cr_checksum_name_str(checksum_type))
+        && cr_deltacache_has_value(cache, group, "location_href", location_href))
+    {
+        *nevra = g_key_file_get_string(cache->keyfile, group, "nevra", NULL);
+        xml = g_key_file_get_string(cache->keyfile, group, "xml", NULL);
+        if (!*nevra || !xml) {
+            g_clear_pointer(nevra, g_free);
+            g_clear_pointer(&xml, g_free);
+        }
+    }
+    g_mutex_unlock(&(cache->mutex));
+
+    return xml;
+}
+
+
+static void
+cr_deltacache_set_xml(cr_DeltaCache *cache,
+                      const char *drpmpath,
+                      cr_ChecksumType checksum_type,
+                      const char *location_href,
+                      const char *nevra,
+                      const char *xml)
+{
+    const char *group = cr_get_filename(drpmpath);
+
+    if (!cr_deltacache_valid_group(group))
+        return;
+
+    g_mutex_lock(&(cache->mutex));
+    // Keep the old and new package of the drpm only if it is unchanged
+    if (!cr_deltacache_file_unchanged(cache, group, drpmpath))
+        g_key_file_remove_group(cache->keyfile, group, NULL);
+    g_key_file_set_string(cache->keyfile, group, "checksum_type",
+                          cr_checksum_name_str(checksum_type));
+    g_key_file_set_string(cache->keyfile, group, "location_href", location_href);
+    g_key_file_set_string(cache->keyfile, group, "nevra", nevra);
+    g_key_file_set_string(cache->keyfile, group, "xml", xml);
+    cr_deltacache_set_file(cache, group, drpmpath);
+    g_mutex_unlock(&(cache->mutex));
+}
+
+
+/** Return the old package from the index of headers or read it
+ * from the rpm (and add it to the index).
+ */
+static cr_DeltaTargetPackage *
+cr_deltacache_get_tpkg(cr_DeltaCache *cache, const char *path)
+{
+    cr_DeltaTargetPackage *tpkg = NULL;
+    GKeyFile *kf = cache->keyfile;
+
+    g_mutex_lock(&(cache->mutex));
+    if (cr_deltacache_file_unchanged(cache, path, path)) {
+        _cleanup_free_ gchar *name = g_key_file_get_string(kf, path, "name", NULL);
+        _cleanup_free_ gchar *arch = g_key_file_get_string(kf, path, "arch", NULL);
+        _cleanup_free_ gchar *epoch = g_key_file_get_string(kf, path, "epoch", NULL);
+        _cleanup_free_ gchar *version = g_key_file_get_string(kf, path, "version", NULL);
+        _cleanup_free_ gchar *release = g_key_file_get_string(kf, path, "release", NULL);
+
+        if (name && arch && version && release) {
+            tpkg = g_new0(cr_DeltaTargetPackage, 1);
+            tpkg->chunk = g_string_chunk_new(0);
+            tpkg->name = cr_safe_string_chunk_insert(tpkg->chunk, name);
+            tpkg->arch = cr_safe_string_chunk_insert(tpkg->chunk, arch);
+            tpkg->epoch = cr_safe_string_chunk_insert(tpkg->chunk, epoch);
+            tpkg->version = cr_safe_string_chunk_insert(tpkg->chunk, version);
+            tpkg->release = cr_safe_string_chunk_insert(tpkg->chunk, release);
+            tpkg->size_installed = g_key_file_get_int64(kf, path,
+                                                        "size_installed", NULL);
+            tpkg->path = cr_safe_string_chunk_insert(tpkg->chunk, path);
+        }
+    }
+    g_mutex_unlock(&(cache->mutex));
+
+    if (tpkg)
+        return tpkg;
+
+    tpkg = cr_deltatargetpackage_from_rpm(path, NULL);
+    if (!tpkg || !cr_deltacache_valid_group(path))
+        return tpkg;
+
+    g_mutex_lock(&(cache->mutex));
+    g_key_file_remove_group(kf, path, NULL);
+    g_key_file_set_string(kf, path, "name", tpkg->name);
+    g_key_file_set_string(kf, path, "arch", tpkg->arch);
+    if (tpkg->epoch)
+        g_key_file_set_string(kf, path, "epoch", tpkg->epoch);
+    g_key_file_set_string(kf, path, "version", tpkg->version);
+    g_key_file_set_string(kf, path, "release", tpkg->release);
+    g_key_file_set_int64(kf, path, "size_installed", tpkg->size_installed);
+    cr_deltacache_set_file(cache, path, path);
+    g_mutex_unlock(&(cache->mutex));
+
+    return tpkg;
+}
+
+
 /*
  * 1) Scanning for old candidate rpms
  */
@@ -240,20 +728,74 @@ cr_deltarpms_scan_oldpackagedirs(GSList *oldpackagedirs,
 
 typedef struct {
     cr_DeltaTargetPackage *tpkg;
+    gint64 work_size;           // work_size the task was scheduled with
 } cr_DeltaTask;
 
 
+/** Old packages of one directory indexed by "name.arch" parsed
+ * from their filenames.
+ */
+typedef struct {
+    const gchar *dirname;
+    GHashTable *by_name_arch;   // "name.arch" -> GSList of filenames
+    GSList *unparsed;           // filenames which are not N-V-R.A.rpm
+} cr_DeltaOldDir;
+
+
 typedef struct {
     const char *outdeltadir;
     gint num_deltas;
-    GHashTable *oldpackages;
+    GSList *olddirs;            // cr_DeltaOldDir
+    cr_DeltaCache *cache;
+    cr_DeltaCache *headers;     // index of headers of the old packages
     GMutex mutex;
     gint64 active_work_size;
     gint active_tasks;
     GCond cond_task_finished;
+    gboolean processes;         // make the deltas by forked processes
+    gint64 max_memory;          // limit of a process, 0 for none
+    gdouble memory_ratio;       // estimated memory per size_installed
+    gint calibrations;          // measurements the memory_ratio is from
 } cr_DeltaThreadUserData;
 
 
+/** Memory estimated for making the deltas of the target.
+ * Call with the mutex locked.
+ */
+static gint64
+cr_delta_estimate_memory(cr_DeltaThreadUserData *user_data,
+                         cr_DeltaTargetPackage *tpkg)
+{
+    return DELTA_MEMORY_BASE
+           + (gint64) (user_data->memory_ratio * tpkg->size_installed);
+}
+
+
+/** Calibrate the memory model by the memory a process used for
+ * the target. The biggest ratio measured is kept, an underestimate
+ * would let the workers run out of the budget.
+ */
+static void
+cr_delta_calibrate_memory(cr_DeltaThreadUserData *user_data,
+                          cr_DeltaTargetPackage *tpkg,
+                          gint64 used_memory)
+{
+    gdouble ratio;
+
+    if (used_memory < 0 || tpkg->size_installed < DELTA_CALIBRATION_MIN_SIZE)
+        return;
+
+    ratio = (gdouble) MAX(used_memory - DELTA_MEMORY_BASE, 0)
+            / tpkg->size_installed;
+
+    g_mutex_lock(&(user_data->mutex));
+    if (user_data->calibrations == 0 || ratio > user_data->memory_ratio)
+        user_data->memory_ratio = ratio;
+    user_data->calibrations++;
+    g_mutex_unlock(&(user_data->mutex));
+}
+
+
 static gint
 cmp_deltatargetpackage_evr(gconstpointer aa, gconstpointer bb)
 {
@@ -265,29 +807,106 @@ cmp_deltatargetpackage_evr(gconstpointer aa, gconstpointer bb)
 }
 
 
+static void
+cr_delta_olddir_free(cr_DeltaOldDir *olddir)
+{
+    if (!olddir)
+        return;
+
+    g_hash_table_destroy(olddir->by_name_arch);
+    g_slist_free(olddir->unparsed);
+    g_free(olddir);
+}
+
+
+static void
+cr_free_gslist(gpointer list)
+{
+    g_slist_free((GSList *) list);
+}
+
+
+/** Index the old packages (see cr_deltarpms_scan_oldpackagedirs()) by
+ * name and arch, so the delta threads don't have to scan all
+ * the filenames for every target package. The filenames are borrowed.
+ */
+static GSList *
+cr_delta_index_oldpackages(GHashTable *oldpackages)
+{
+    GSList *olddirs = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, oldpackages);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        cr_DeltaOldDir *olddir = g_new0(cr_DeltaOldDir, 1);
+        olddir->dirname = key;
+        olddir->by_name_arch = g_hash_table_new_full(g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     cr_free_gslist);
+
+        for (GSList *elem = value; elem; elem = g_slist_next(elem)) {
+            gchar *filename = elem->data;
+            cr_NEVRA *nevra = cr_split_rpm_filename(filename);
+            gchar *name_arch;
+            GSList *list;
+
+            if (!nevra || !nevra->name || !nevra->arch) {
+                olddir->unparsed = g_slist_prepend(olddir->unparsed, filename);
+                cr_nevra_free(nevra);
+                continue;
+            }
+
+            name_arch = g_strconcat(nevra->name, ".", nevra->arch, NULL);
+            cr_nevra_free(nevra);
+            list = g_hash_table_lookup(olddir->by_name_arch, name_arch);
+            if (list) {
+                // Keep the head of the list stored in the table
+                list = g_slist_insert(list, filename, 1);
+                g_free(name_arch);
+            } else {
+                g_hash_table_insert(olddir->by_name_arch, name_arch,
+                                    g_slist_prepend(NULL, filename));
+            }
+        }
+
+        olddirs = g_slist_prepend(olddirs, olddir);
+    }
+
+    return g_slist_reverse(olddirs);
+}
+
+
 static void
 cr_delta_thread(gpointer data, gpointer udata)
 {
     cr_DeltaTask *task = data;
     cr_DeltaThreadUserData *user_data = udata;
     cr_DeltaTargetPackage *tpkg = task->tpkg;  // Shortcut
-
-    GHashTableIter iter;
-    gpointer key, value;
+    gchar *name_arch = g_strconcat(tpkg->name, ".", tpkg->arch, NULL);
+    gchar *new_id = NULL;
 
     // Iterate through specified oldpackage directories
-    g_hash_table_iter_init(&iter, user_data->oldpackages);
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-        gchar *dirname = key;
+    for (GSList *delem = user_data->olddirs; delem; delem = g_slist_next(delem)) {
+        cr_DeltaOldDir *olddir = delem->data;
+        const gchar *dirname = olddir->dirname;
         GSList *local_candidates = NULL;
+        GSList *filenames;
+
+        // Only the packages with the same name and arch and the ones
+        // whose filename cannot be parsed are considered
+        filenames = g_slist_concat(
+                g_slist_copy(g_hash_table_lookup(olddir->by_name_arch, name_arch)),
+                g_slist_copy(olddir->unparsed));
 
         // Select appropriate candidates from the directory
-        for (GSList *elem = value; elem; elem = g_slist_next(elem)) {
+        for (GSList *elem = filenames; elem; elem = g_slist_next(elem)) {
             gchar *filename = elem->data;
             if (g_str_has_prefix(filename, tpkg->name)) {
                 cr_DeltaTargetPackage *l_tpkg;
                 gchar *path = g_build_filename(dirname, filename, NULL);
-                l_tpkg = cr_deltatargetpackage_from_rpm(path, NULL);
+                l_tpkg = cr_deltacache_get_tpkg(user_data->headers, path);
                 g_free(path);
                 if (!l_tpkg)
                     continue;
@@ -315,6 +934,7 @@ cr_delta_thread(gpointer data, gpointer udata)
                 local_candidates = g_slist_prepend(local_candidates, l_tpkg);
             }
         }
+        g_slist_free(filenames);
 
         // Sort the candidates
         local_candidates = g_slist_sort(local_candidates,
@@ -326,25 +946,58 @@ cr_delta_thread(gpointer data, gpointer udata)
         for (GSList *lelem = local_candidates; lelem; lelem = g_slist_next(lelem)){
             GError *tmp_err = NULL;
             cr_DeltaTargetPackage *old = lelem->data;
-
-            g_debug("Generating delta %s -> %s", old->path, tpkg->path);
-            cr_drpm_create(old, tpkg, user_data->outdeltadir, &tmp_err);
-            if (tmp_err) {
-                g_warning("Cannot generate delta %s -> %s : %s",
-                          old->path, tpkg->path, tmp_err->message);
-                g_error_free(tmp_err);
-                continue;
+            _cleanup_free_ gchar *drpmpath = NULL;
+            _cleanup_free_ gchar *old_id = NULL;
+
+            if (!new_id)
+                new_id = cr_deltatargetpackage_id(tpkg);
+            old_id = cr_deltatargetpackage_id(old);
+            drpmpath = cr_drpm_path(old, tpkg, user_data->outdeltadir);
+
+            if (cr_deltacache_has_delta(user_data->cache, drpmpath, old_id, new_id)) {
+                g_debug("Using delta %s -> %s from the previous run",
+                        old->path, tpkg->path);
+            } else {
+                gchar *created;
+
+                g_debug("Generating delta %s -> %s", old->path, tpkg->path);
+                if (user_data->processes) {
+                    gint64 used_memory;
+                    created = cr_drpm_create_in_process(old, tpkg,
+                                                        user_data->outdeltadir,
+                                                        user_data->max_memory,
+                                                        &used_memory,
+                                                        &tmp_err);
+                    cr_delta_calibrate_memory(user_data, tpkg, used_memory);
+                } else {
+                    created = cr_drpm_create(old, tpkg, user_data->outdeltadir, &tmp_err);
+                }
+                if (tmp_err) {
+                    g_warning("Cannot generate delta %s -> %s : %s",
+                              old->path, tpkg->path, tmp_err->message);
+                    g_error_free(tmp_err);
+                    cr_deltacache_set_delta(user_data->cache, drpmpath, NULL, NULL);
+                    continue;
+                }
+                g_free(created);
+                cr_deltacache_set_delta(user_data->cache, drpmpath, old_id, new_id);
             }
             if (++x == user_data->num_deltas)
                 break;
         }
+
+        cr_slist_free_full(local_candidates,
+                           (GDestroyNotify) cr_deltatargetpackage_free);
     }
 
+    g_free(name_arch);
+    g_free(new_id);
+
     g_debug("Deltas for \"%s\" (%"G_GINT64_FORMAT") generated",
             tpkg->name, tpkg->size_installed);
 
     g_mutex_lock(&(user_data->mutex));
-    user_data->active_work_size -= tpkg->size_installed;
+    user_data->active_work_size -= task->work_size;
     user_data->active_tasks--;
     g_cond_signal(&(user_data->cond_task_finished));
     g_mutex_unlock(&(user_data->mutex));
@@ -355,8 +1008,9 @@ cr_delta_thread(gpointer data, gpointer udata)
 static gint
 cmp_deltatargetpackage_sizes(gconstpointer a, gconstpointer b)
 {
-    const cr_DeltaTargetPackage *dtpk_a = a;
-    const cr_DeltaTargetPackage *dtpk_b = b;
+    // Elements of GPtrArray
+    const cr_DeltaTargetPackage *dtpk_a = *((cr_DeltaTargetPackage **) a);
+    const cr_DeltaTargetPackage *dtpk_b = *((cr_DeltaTargetPackage **) b);
 
     if (dtpk_a->size_installed < dtpk_b->size_installed)
         return -1;
@@ -376,14 +1030,45 @@ cr_deltarpms_parallel_deltas(GSList *targetpackages,
                    gint64 max_delta_rpm_size,
                    gint64 max_work_size,
                    GError **err)
+{
+    cr_DeltaRpmsOptions options = { 0 };
+
+    options.num_deltas          = num_deltas;
+    options.workers             = workers;
+    options.max_delta_rpm_size  = max_delta_rpm_size;
+    options.max_work_size       = max_work_size;
+
+    return cr_deltarpms_parallel_deltas_with_options(targetpackages,
+                                                     oldpackages,
+                                                     outdeltadir,
+                                                     &options,
+                                                     err);
+}
+
+
+gboolean
+cr_deltarpms_parallel_deltas_with_options(GSList *targetpackages,
+                                          GHashTable *oldpackages,
+                                          const char *outdeltadir,
+                                          const cr_DeltaRpmsOptions *options,
+                                          GError **err)
 {
     GThreadPool *pool;
     cr_DeltaThreadUserData user_data;
-    GList *targets = NULL;
+    GPtrArray *targets;
     GError *tmp_err = NULL;
+    gint num_deltas, workers;
+    gint64 max_delta_rpm_size, max_work_size;
 
+    assert(options);
     assert(!err || *err == NULL);
 
+    num_deltas          = options->num_deltas;
+    workers             = options->workers;
+    max_delta_rpm_size  = options->max_delta_rpm_size;
+    max_work_size       = options->max_memory > 0 ? options->max_memory
+                                                  : options->max_work_size;
+
     if (num_deltas < 1)
         return TRUE;
 
@@ -396,21 +1081,28 @@ cr_deltarpms_parallel_deltas(GSList *targetpackages,
     // Init user_data
     user_data.outdeltadir           = outdeltadir;
     user_data.num_deltas            = num_deltas;
-    user_data.oldpackages           = oldpackages;
+    user_data.olddirs               = cr_delta_index_oldpackages(oldpackages);
+    user_data.cache                 = cr_deltacache_load(outdeltadir, DELTACACHE_FILENAME, TRUE);
+    user_data.headers               = cr_deltacache_load(outdeltadir, DELTAHEADERS_FILENAME, FALSE);
     user_data.active_work_size      = G_GINT64_CONSTANT(0);
     user_data.active_tasks          = 0;
+    user_data.processes             = options->processes;
+    user_data.max_memory            = options->max_memory;
+    user_data.memory_ratio          = DELTA_MEMORY_RATIO;
+    user_data.calibrations          = 0;
 
     g_mutex_init(&(user_data.mutex));
     g_cond_init(&(user_data.cond_task_finished));
 
-    // Make sorted list of targets without packages
+    // Make list of targets sorted by size without packages
     // that are bigger then max_delta_rpm_size
+    targets = g_ptr_array_new();
     for (GSList *elem = targetpackages; elem; elem = g_slist_next(elem)) {
         cr_DeltaTargetPackage *tpkg = elem->data;
         if (tpkg->size_installed < max_delta_rpm_size)
-            targets = g_list_insert_sorted(targets, tpkg, cmp_deltatargetpackage_sizes);
+            g_ptr_array_add(targets, tpkg);
     }
-    targets = g_list_reverse(targets);
+    g_ptr_array_sort(targets, cmp_deltatargetpackage_sizes);
 
     // Setup the pool of workers
     pool = g_thread_pool_new(cr_delta_thread,
@@ -420,15 +1112,27 @@ cr_deltarpms_parallel_deltas(GSList *targetpackages,
                              &tmp_err);
     if (tmp_err) {
         g_propagate_prefixed_error(err, tmp_err, "Cannot create delta pool: ");
-        g_list_free_full(targets, (GDestroyNotify) cr_deltapackage_free);
+        g_ptr_array_free(targets, TRUE);
+        g_slist_free_full(user_data.olddirs, (GDestroyNotify) cr_delta_olddir_free);
+        cr_deltacache_save_and_free(user_data.cache);
+        cr_deltacache_save_and_free(user_data.headers);
+        g_mutex_clear(&(user_data.mutex));
+        g_cond_clear(&(user_data.cond_task_finished));
         return FALSE;
     }
 
-    // Push tasks into the pool
-    while (targets) {
-        gboolean inserted = FALSE;
+    // Push tasks into the pool. Every free worker gets the biggest
+    // remaining target that fits into max_work_size (longest processing
+    // time first), so the big targets don't end up last on a single worker.
+    // With max_memory the work size of a target is its estimated memory,
+    // which grows with size_installed as well, so the targets stay sorted.
+    while (targets->len) {
         gint64 active_work_size;
-        gint64 active_tasks;
+        gint active_tasks;
+        gint64 work_size;
+        guint lo, hi;
+        cr_DeltaTargetPackage *tpkg;
+        cr_DeltaTask *task;
 
         g_mutex_lock(&(user_data.mutex));
         while (user_data.active_tasks == workers)
@@ -436,38 +1140,61 @@ cr_deltarpms_parallel_deltas(GSList *targetpackages,
             g_cond_wait(&(user_data.cond_task_finished), &(user_data.mutex));
         active_work_size = user_data.active_work_size;
         active_tasks = user_data.active_tasks;
-        g_mutex_unlock(&(user_data.mutex));
-
-        for (GList *elem = targets; elem; elem = g_list_next(elem)) {
-            cr_DeltaTargetPackage *tpkg = elem->data;
-            if ((active_work_size + tpkg->size_installed) <= max_work_size) {
-                cr_DeltaTask *task = g_new0(cr_DeltaTask, 1);
-                task->tpkg = tpkg;
-
-                g_mutex_lock(&(user_data.mutex));
-                user_data.active_work_size += tpkg->size_installed;
-                user_data.active_tasks++;
-                g_mutex_unlock(&(user_data.mutex));
 
-                g_thread_pool_push(pool, task, NULL);
-                targets = g_list_delete_link(targets, elem);
-                inserted = TRUE;
-                break;
-            }
+        // Binary search for the number of targets that fit
+        lo = 0;
+        hi = targets->len;
+        while (lo < hi) {
+            guint mid = lo + (hi - lo) / 2;
+            tpkg = g_ptr_array_index(targets, mid);
+            work_size = options->max_memory > 0
+                        ? cr_delta_estimate_memory(&user_data, tpkg)
+                        : tpkg->size_installed;
+            if ((active_work_size + work_size) <= max_work_size)
+                lo = mid + 1;
+            else
+                hi = mid;
         }
+        g_mutex_unlock(&(user_data.mutex));
 
-        if (!inserted) {
-            // In this iteration, no task was pushed to the pool
+        if (lo == 0 && active_tasks > 0) {
+            // No target fits now, wait until any of running tasks finishes
             g_mutex_lock(&(user_data.mutex));
             while (user_data.active_tasks == active_tasks)
-                // Wait until any of running tasks finishes
                 g_cond_wait(&(user_data.cond_task_finished), &(user_data.mutex));
             g_mutex_unlock(&(user_data.mutex));
+            continue;
         }
+
+        // A target bigger than max_work_size is processed alone
+        tpkg = g_ptr_array_index(targets, lo ? lo - 1 : 0);
+        g_ptr_array_remove_index(targets, lo ? lo - 1 : 0);
+
+        task = g_new0(cr_DeltaTask, 1);
+        task->tpkg = tpkg;
+
+        g_mutex_lock(&(user_data.mutex));
+        task->work_size = options->max_memory > 0
+                          ? cr_delta_estimate_memory(&user_data, tpkg)
+                          : tpkg->size_installed;
+        user_data.active_work_size += task->work_size;
+        user_data.active_tasks++;
+        g_mutex_unlock(&(user_data.mutex));
+
+        g_thread_pool_push(pool, task, NULL);
     }
 
     g_thread_pool_free(pool, FALSE, TRUE);
-    g_list_free(targets);
+
+    if (user_data.calibrations)
+        g_debug("Deltas used up to %.2f bytes of memory per installed byte "
+                "(%d measurements)", user_data.memory_ratio,
+                user_data.calibrations);
+
+    g_ptr_array_free(targets, TRUE);
+    g_slist_free_full(user_data.olddirs, (GDestroyNotify) cr_delta_olddir_free);
+    cr_deltacache_save_and_free(user_data.cache);
+    cr_deltacache_save_and_free(user_data.headers);
     g_mutex_clear(&(user_data.mutex));
     g_cond_clear(&(user_data.cond_task_finished));
 
@@ -495,6 +1222,7 @@ cr_deltatargetpackage_from_package(cr_Package *pkg,
     tpkg->location_href = cr_safe_string_chunk_insert(tpkg->chunk, pkg->location_href);
     tpkg->size_installed = pkg->size_installed;
     tpkg->path = cr_safe_string_chunk_insert(tpkg->chunk, path);
+    tpkg->pkgid = cr_safe_string_chunk_insert(tpkg->chunk, pkg->pkgId);
 
     return tpkg;
 }
@@ -608,13 +1336,22 @@ cr_deltarpms_scan_targetdir(const char *path,
  * 3) Parallel xml chunk generation
  */
 
+/** Number of drpms processed ahead of the one which is being written
+ * per worker. Limits the number of xml chunks kept in memory.
+ */
+#define PRESTODELTA_TASKS_PER_WORKER    16
+
 typedef struct {
     gchar *full_path;
+    gchar *nevra;       // nevra of the new package (1st pass)
+    gchar *xml_chunk;   // delta element (2nd pass)
+    gboolean done;      // 2nd pass finished
 } cr_PrestoDeltaTask;
 
 typedef struct {
     GMutex mutex;
-    GHashTable *ht;
+    GCond cond_task_done;
+    cr_DeltaCache *cache;
     cr_ChecksumType checksum_type;
     const gchar *prefix_to_strip;
     size_t prefix_len;
@@ -626,6 +1363,8 @@ cr_prestodeltatask_free(cr_PrestoDeltaTask *task)
     if (!task)
         return;
     g_free(task->full_path);
+    g_free(task->nevra);
+    g_free(task->xml_chunk);
     g_free(task);
 }
 
@@ -695,6 +1434,42 @@ exit:
 }
 
 
+/** 1st pass - get nevra of the new package of the drpm, the drpms are
+ * written grouped and sorted by it.
+ */
+static void
+cr_prestodelta_nevra_thread(gpointer data, gpointer udata)
+{
+    cr_PrestoDeltaTask *task          = data;
+    cr_PrestoDeltaUserData *user_data = udata;
+    cr_Package *pkg;
+    gchar *xml_chunk;
+    GError *tmp_err = NULL;
+
+    xml_chunk = cr_deltacache_get_xml(user_data->cache,
+                                      task->full_path,
+                                      user_data->checksum_type,
+                                      task->full_path + user_data->prefix_len,
+                                      &task->nevra);
+    if (xml_chunk) {
+        g_free(xml_chunk);
+        return;
+    }
+
+    pkg = cr_package_from_rpm_base(task->full_path, 0, 0, &tmp_err);
+    if (!pkg) {
+        g_warning("Cannot read drpm %s: %s", task->full_path, tmp_err->message);
+        g_error_free(tmp_err);
+        return;
+    }
+
+    task->nevra = cr_package_nevra(pkg);
+    cr_package_free(pkg);
+}
+
+
+/** 2nd pass - generate the delta element of the drpm.
+ */
 static void
 cr_prestodelta_thread(gpointer data, gpointer udata)
 {
@@ -703,11 +1478,20 @@ cr_prestodelta_thread(gpointer data, gpointer udata)
 
     cr_DeltaPackage *dpkg = NULL;
     struct stat st;
-    gchar *xml_chunk = NULL, *key = NULL, *checksum = NULL;
+    gchar *xml_chunk = NULL, *nevra = NULL, *checksum = NULL;
     GError *tmp_err = NULL;
 
     printf("%s\n", task->full_path);
 
+    // Use the xml from the previous run if the drpm is unchanged
+    xml_chunk = cr_deltacache_get_xml(user_data->cache,
+                                      task->full_path,
+                                      user_data->checksum_type,
+                                      task->full_path + user_data->prefix_len,
+                                      &nevra);
+    if (xml_chunk)
+        goto exit;
+
     // Load delta package
     dpkg = cr_deltapackage_from_drpm_base(task->full_path, 0, 0, &tmp_err);
     if (!dpkg) {
@@ -753,36 +1537,40 @@ cr_prestodelta_thread(gpointer data, gpointer udata)
         g_warning("Cannot generate xml for drpm %s: %s",
                   task->full_path, tmp_err->message);
         g_error_free(tmp_err);
+        g_clear_pointer(&xml_chunk, g_free);
         goto exit;
     }
 
-    // Put the XML into the shared hash table
-    gpointer pkey = NULL;
-    gpointer pval = NULL;
-    key = cr_package_nevra(dpkg->package);
+    cr_deltacache_set_xml(user_data->cache,
+                          task->full_path,
+                          user_data->checksum_type,
+                          dpkg->package->location_href,
+                          task->nevra,
+                          xml_chunk);
+
+exit:
+    // Hand the XML over to the writer
     g_mutex_lock(&(user_data->mutex));
-    if (g_hash_table_lookup_extended(user_data->ht, key, &pkey, &pval)) {
-        // Key exists in the table
-        // 1. Remove the key and value from the table without freeing them
-        g_hash_table_steal(user_data->ht, key);
-        // 2. Append to the list (the value from the hash table)
-        GSList *list = (GSList *) pval;
-        list = g_slist_append(pval, xml_chunk);
-        // 3. Insert the modified list again
-        g_hash_table_insert(user_data->ht, pkey, list);
-    } else {
-        // Key doesn't exist yet
-        GSList *list = g_slist_prepend(NULL, xml_chunk);
-        g_hash_table_insert(user_data->ht, g_strdup(key), list);
-    }
+    task->xml_chunk = xml_chunk;
+    task->done = TRUE;
+    g_cond_broadcast(&(user_data->cond_task_done));
     g_mutex_unlock(&(user_data->mutex));
 
-exit:
     g_free(checksum);
-    g_free(key);
+    g_free(nevra);
     cr_deltapackage_free(dpkg);
 }
 
+
+static gint
+cmp_prestodeltatask_nevra(gconstpointer aa, gconstpointer bb)
+{
+    const cr_PrestoDeltaTask *a = *((cr_PrestoDeltaTask **) aa);
+    const cr_PrestoDeltaTask *b = *((cr_PrestoDeltaTask **) bb);
+    gint ret = g_strcmp0(a->nevra, b->nevra);
+    return ret ? ret : g_strcmp0(a->full_path, b->full_path);
+}
+
 static gchar *
 gen_newpackage_xml_chunk(const char *strnevra,
                          GSList *delta_chunks)
@@ -813,6 +1601,39 @@ gen_newpackage_xml_chunk(const char *strnevra,
     return g_string_free(chunk, FALSE);
 }
 
+/** Write the newpackage element with the delta elements.
+ */
+static gboolean
+write_newpackage_xml_chunk(cr_XmlFile *f,
+                           cr_XmlFile *zck_f,
+                           const char *strnevra,
+                           GSList *delta_chunks,
+                           GError **err)
+{
+    gchar *chunk = gen_newpackage_xml_chunk(strnevra, delta_chunks);
+    GError *tmp_err = NULL;
+
+    if (!chunk)
+        return TRUE;
+
+    cr_xmlfile_add_chunk(f, chunk, NULL);
+
+    /* Write out zchunk file */
+    if (zck_f) {
+        cr_xmlfile_add_chunk(zck_f, chunk, NULL);
+        cr_end_chunk(zck_f->f, &tmp_err);
+        if (tmp_err) {
+            g_free(chunk);
+            g_propagate_prefixed_error(err, tmp_err,
+                    "Cannot end zchunk of prestodelta file: ");
+            return FALSE;
+        }
+    }
+
+    g_free(chunk);
+    return TRUE;
+}
+
 gboolean
 cr_deltarpms_generate_prestodelta_file(const gchar *drpmsdir,
                                        cr_XmlFile *f,
@@ -824,11 +1645,12 @@ cr_deltarpms_generate_prestodelta_file(const gchar *drpmsdir,
 {
     gboolean ret = TRUE;
     GSList *candidates = NULL;
-    GThreadPool *pool;
+    GThreadPool *pool = NULL;
     cr_PrestoDeltaUserData user_data;
-    GHashTable *ht = NULL;
-    GHashTableIter iter;
-    gpointer key, value;
+    GPtrArray *tasks = NULL;
+    GSList *group = NULL;
+    const gchar *group_nevra = NULL;
+    guint window, pushed = 0;
     GError *tmp_err = NULL;
 
     assert(drpmsdir);
@@ -839,24 +1661,19 @@ cr_deltarpms_generate_prestodelta_file(const gchar *drpmsdir,
 
     if (!walk_drpmsdir(drpmsdir, &candidates, &tmp_err)) {
         g_propagate_prefixed_error(err, tmp_err, "%s: ", __func__);
-        ret = FALSE;
-        goto exit;
+        return FALSE;
     }
 
-    // Setup pool of workers
-
-    ht = g_hash_table_new_full(g_str_hash,
-                               g_str_equal,
-                               (GDestroyNotify) g_free,
-                               (GDestroyNotify) cr_free_gslist_of_strings);
-
-    user_data.ht                = ht;
+    user_data.cache             = cr_deltacache_load(drpmsdir, DELTACACHE_FILENAME, TRUE);
     user_data.checksum_type     = checksum_type;
     user_data.prefix_to_strip   = prefix_to_strip,
     user_data.prefix_len        = prefix_to_strip ? strlen(prefix_to_strip) : 0;
     g_mutex_init(&(user_data.mutex));
+    g_cond_init(&(user_data.cond_task_done));
 
-    pool = g_thread_pool_new(cr_prestodelta_thread,
+    // 1st pass - get nevras of the new packages (from headers only)
+
+    pool = g_thread_pool_new(cr_prestodelta_nevra_thread,
                              &user_data,
                              workers,
                              TRUE,
@@ -868,46 +1685,81 @@ cr_deltarpms_generate_prestodelta_file(const gchar *drpmsdir,
         goto exit;
     }
 
-    // Push tasks to the pool
+    for (GSList *elem = candidates; elem; elem = g_slist_next(elem))
+        g_thread_pool_push(pool, elem->data, NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
+    pool = NULL;
+
+    // Sort the drpms by the new packages, drop the unreadable ones
 
+    tasks = g_ptr_array_new();
     for (GSList *elem = candidates; elem; elem = g_slist_next(elem)) {
-        g_thread_pool_push(pool, elem->data, NULL);
+        cr_PrestoDeltaTask *task = elem->data;
+        if (task->nevra)
+            g_ptr_array_add(tasks, task);
     }
+    g_ptr_array_sort(tasks, cmp_prestodeltatask_nevra);
 
-    // Wait until the pool finishes
+    // 2nd pass - generate the xml in parallel and write it in order
+    // (at most window drpms are processed ahead of the written one)
 
-    g_thread_pool_free(pool, FALSE, TRUE);
+    pool = g_thread_pool_new(cr_prestodelta_thread,
+                             &user_data,
+                             workers,
+                             TRUE,
+                             &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err,
+                "Cannot create pool for prestodelta file generation: ");
+        ret = FALSE;
+        goto exit;
+    }
 
-    // Write out the results
+    window = MAX(workers, 1) * PRESTODELTA_TASKS_PER_WORKER;
 
+    for (guint i = 0; i < tasks->len; i++) {
+        cr_PrestoDeltaTask *task;
 
-    g_hash_table_iter_init(&iter, user_data.ht);
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-        gchar *chunk = NULL;
-        gchar *nevra = key;
-
-        chunk = gen_newpackage_xml_chunk(nevra, (GSList *) value);
-        cr_xmlfile_add_chunk(f, chunk, NULL);
-
-        /* Write out zchunk file */
-        if (zck_f) {
-            cr_xmlfile_add_chunk(zck_f, chunk, NULL);
-            cr_end_chunk(zck_f->f, &tmp_err);
-            if (tmp_err) {
-                g_free(chunk);
-                g_propagate_prefixed_error(err, tmp_err,
-                    "Cannot create pool for prestodelta file generation: ");
-                ret = FALSE;
+        while (pushed < tasks->len && pushed < i + window)
+            g_thread_pool_push(pool, g_ptr_array_index(tasks, pushed++), NULL);
+
+        task = g_ptr_array_index(tasks, i);
+        g_mutex_lock(&(user_data.mutex));
+        while (!task->done)
+            g_cond_wait(&(user_data.cond_task_done), &(user_data.mutex));
+        g_mutex_unlock(&(user_data.mutex));
+
+        // The deltas of a new package are consecutive
+        if (group_nevra && strcmp(group_nevra, task->nevra)) {
+            group = g_slist_reverse(group);
+            ret = write_newpackage_xml_chunk(f, zck_f, group_nevra, group, err);
+            cr_slist_free_full(group, g_free);
+            group = NULL;
+            if (!ret)
                 goto exit;
-            }
         }
-        g_free(chunk);
+
+        group_nevra = task->nevra;
+        if (task->xml_chunk)
+            group = g_slist_prepend(group, g_steal_pointer(&task->xml_chunk));
+    }
+
+    if (group_nevra) {
+        group = g_slist_reverse(group);
+        ret = write_newpackage_xml_chunk(f, zck_f, group_nevra, group, err);
     }
 
 exit:
+    if (pool)
+        // The pushed tasks have to finish before they are freed
+        g_thread_pool_free(pool, FALSE, TRUE);
+    cr_slist_free_full(group, g_free);
+    if (tasks)
+        g_ptr_array_free(tasks, TRUE);
     g_slist_free_full(candidates, (GDestroyNotify) cr_prestodeltatask_free);
+    cr_deltacache_save_and_free(user_data.cache);
     g_mutex_clear(&(user_data.mutex));
-    g_hash_table_destroy(ht);
+    g_cond_clear(&(user_data.cond_task_done));
 
     return ret;
 }
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include "checksum.h"
 #include "cleanup.h"
 #include "deltarpms.h"
@@ -33,198 +34,1215 @@
 #include "error.h"
 #include "misc.h"
 #include "parsepkg.h"
+#include "pkgcache.h"
+#include "pkgtable.h"
 #include "xml_dump.h"
+#include "xml_parser.h"
 #include <fcntl.h>
-
-#define MAX_TASK_BUFFER_LEN         20
+#include <unistd.h>
+
+#define MIN_RING_LEN                20
+#define AUTOSCALE_MIN_TASKS         8       // Min packages per update
+#define AUTOSCALE_MIN_CPU_RATIO     0.05    // Limits the growth at once
+#define AUTOSCALE_WAIT_RATIO        0.2     // Max share of waiting for
+                                            // the writers
+#define PROGRESS_INTERVAL           (5 * G_USEC_PER_SEC) // Report period
 #define CACHEDCHKSUM_BUFFER_LEN     2048
 
 struct BufferedTask {
     long id;                        // ID of the task
     struct cr_XmlStruct res;        // XML for primary, filelists and other
-    cr_Package *pkg;                // Package structure
+    GString *xml_bufs[3];           // Buffers of the res from udata->xml_pool
+                                    // or NULLs if the res is allocated
+    cr_Package *pkg;                // Package structure, NULL if the task
+                                    // failed or if the XML is from
+                                    // the package cache and no db is used
+    gboolean ok;                    // FALSE if the task failed and there
+                                    // is nothing to write
+    gboolean res_from_cache;        // XML points into the package cache
+                                    // and must not be freed
+    char *relocated_primary;        // res.primary of a cached package
+                                    // with a different location
+    const char *rpm_sourcerpm;      // Source rpm of the package
+    gboolean has_cache_key;         // Is the cache_key valid?
+    cr_PkgCacheKey cache_key;       // Identification of the rpm file
     char *location_href;            // location_href path
-    char *location_base;            // location_base path
+    const char *location_base;      // location_base path (shared by tasks)
     int pkg_from_md;                // If true - package structure if from
                                     // old metadata and must not be freed!
                                     // If false - package is from file and
                                     // it must be freed!
+    gboolean pkg_borrowed;          // Package is owned by the caller of
+                                    // cr_dumper_publish_xml()
+    gsize size;                     // Size of the generated XML
+    gboolean large;                 // Large package scheduled out of order
+    gint refs;                      // Number of writers which haven't
+                                    // written the task yet
+};
+
+typedef enum {
+    WRITER_PRI_XML,
+    WRITER_FIL_XML,
+    WRITER_OTH_XML,
+    WRITER_PRI_ZCK,
+    WRITER_FIL_ZCK,
+    WRITER_OTH_ZCK,
+    WRITER_PRI_DB,
+    WRITER_FIL_DB,
+    WRITER_OTH_DB,
+    WRITER_PKG_CACHE,               // Package cache for the next run
+    WRITER_PKG_INDEX,               // Binary index of the packages
+} WriterType;
+
+// Names of the writer threads in the metrics
+static const char *writer_names[] = {
+    [WRITER_PRI_XML]    = "writer primary.xml",
+    [WRITER_FIL_XML]    = "writer filelists.xml",
+    [WRITER_OTH_XML]    = "writer other.xml",
+    [WRITER_PRI_ZCK]    = "writer primary.xml.zck",
+    [WRITER_FIL_ZCK]    = "writer filelists.xml.zck",
+    [WRITER_OTH_ZCK]    = "writer other.xml.zck",
+    [WRITER_PRI_DB]     = "writer primary.sqlite",
+    [WRITER_FIL_DB]     = "writer filelists.sqlite",
+    [WRITER_OTH_DB]     = "writer other.sqlite",
+    [WRITER_PKG_CACHE]  = "writer pkg cache",
+    [WRITER_PKG_INDEX]  = "writer pkg index",
 };
 
+struct DumperWriter {
+    WriterType type;                // Output written by the writer
+    struct UserData *udata;         // Shared user data
+    long id;                        // ID of the next task to write
+    char *prev_srpm;                // Srpm of the previously written package
+    gsize chunk_size;               // Size of the current zchunk chunk,
+                                    // 0 before the first package
+    GThread *thread;                // Thread of the writer
+};
 
-static gint
-buf_task_sort_func(gconstpointer a, gconstpointer b, G_GNUC_UNUSED gpointer data)
+
+static void
+buffered_task_free(struct UserData *udata, struct BufferedTask *buf_task)
 {
-    const struct BufferedTask *task_a = a;
-    const struct BufferedTask *task_b = b;
-    if (task_a->id < task_b->id)  return -1;
-    if (task_a->id == task_b->id) return 0;
-    return 1;
+    if (!buf_task)
+        return;
+    if (!buf_task->pkg_borrowed)
+        cr_package_free(buf_task->pkg);
+    if (buf_task->xml_bufs[0]) {
+        for (int x = 0; x < 3; x++)
+            cr_xml_buffer_pool_put(udata->xml_pool, buf_task->xml_bufs[x]);
+    } else if (!buf_task->res_from_cache) {
+        g_free(buf_task->res.primary);
+        g_free(buf_task->res.filelists);
+        g_free(buf_task->res.other);
+    }
+    g_free(buf_task->relocated_primary);
+    g_free(buf_task->location_href);
+    g_free(buf_task);
 }
 
-
 static void
-write_pkg(long id,
-          struct cr_XmlStruct res,
-          cr_Package *pkg,
-          struct UserData *udata)
+write_xml_chunk(cr_XmlFile *f,
+                const char *chunk,
+                const char *name,
+                struct UserData *udata)
 {
     GError *tmp_err = NULL;
 
-    // Write primary data
-    g_mutex_lock(&(udata->mutex_pri));
-    while (udata->id_pri != id)
-        g_cond_wait (&(udata->cond_pri), &(udata->mutex_pri));
-
-    udata->package_count++;
-    g_free(udata->prev_srpm);
-    udata->prev_srpm = udata->cur_srpm;
-    udata->cur_srpm = g_strdup(pkg->rpm_sourcerpm);
-    gboolean new_pkg = FALSE;
-    if (g_strcmp0(udata->prev_srpm, udata->cur_srpm) != 0)
-        new_pkg = TRUE;
-
-    ++udata->id_pri;
-    cr_xmlfile_add_chunk(udata->pri_f, (const char *) res.primary, &tmp_err);
+    cr_xmlfile_add_chunk(f, chunk, &tmp_err);
     if (tmp_err) {
-        g_critical("Cannot add primary chunk:\n%s\nError: %s",
-                   res.primary, tmp_err->message);
+        g_critical("Cannot add %s chunk:\n%s\nError: %s",
+                   name, chunk, tmp_err->message);
         udata->had_errors = TRUE;
         g_clear_error(&tmp_err);
     }
+}
 
-    if (udata->pri_db) {
-        cr_db_add_pkg(udata->pri_db, pkg, &tmp_err);
-        if (tmp_err) {
-            g_critical("Cannot add record of %s (%s) to primary db: %s",
-                       pkg->name, pkg->pkgId, tmp_err->message);
-            udata->had_errors = TRUE;
+cr_ZckChunking
+cr_zck_chunking(const char *name)
+{
+    if (!g_strcmp0(name, "srpm"))
+        return CR_ZCK_CHUNKING_SRPM;
+    if (!g_strcmp0(name, "sized"))
+        return CR_ZCK_CHUNKING_SIZED;
+    if (!g_strcmp0(name, "hash"))
+        return CR_ZCK_CHUNKING_HASH;
+    return CR_ZCK_CHUNKING_UNKNOWN;
+}
+
+/** Slot of the old metadata index.
+ */
+struct OldMdEntry {
+    const char *key;                // Cleaned location_href
+    cr_Package *pkg;                // Package, NULL if the slot is empty
+    guint hash;                     // Hash of the key
+    gint claimed;                   // Set by the first cr_dumper_old_md_claim()
+};
+
+/** Open addressing (linear probing) table, it is never modified after
+ * it is built, except of the claimed flags.
+ */
+struct _cr_DumperOldMd {
+    struct OldMdEntry *entries;     // Slots, the count is a power of 2
+    gsize mask;                     // Number of slots - 1
+    guint size;                     // Number of packages
+    GStringChunk *keys;             // Keys (the claimed packages are freed
+                                    // by other threads during lookups)
+};
+
+cr_DumperOldMd *
+cr_dumper_old_md_new(cr_Metadata *md)
+{
+    GHashTable *ht = cr_metadata_hashtable(md);
+    cr_DumperOldMd *old_md = g_new0(cr_DumperOldMd, 1);
+    gsize slots = 16;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    // At most half of the slots is used
+    while (slots < 2 * (gsize) g_hash_table_size(ht))
+        slots <<= 1;
+
+    old_md->entries = g_new0(struct OldMdEntry, slots);
+    old_md->mask    = slots - 1;
+    old_md->keys    = g_string_chunk_new(64 * 1024);
+
+    g_hash_table_iter_init(&iter, ht);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const char *href = g_string_chunk_insert(old_md->keys, key);
+        guint hash = cr_pkgtable_hash(href);
+        gsize x = hash & old_md->mask;
+
+        while (old_md->entries[x].pkg)
+            x = (x + 1) & old_md->mask;
+        old_md->entries[x].key = href;
+        old_md->entries[x].hash = hash;
+        old_md->entries[x].pkg = value;
+        old_md->size++;
+        g_hash_table_iter_steal(&iter);
+    }
+
+    return old_md;
+}
+
+cr_Package *
+cr_dumper_old_md_claim(cr_DumperOldMd *old_md, const char *href)
+{
+    guint hash = cr_pkgtable_hash(href);
+
+    for (gsize x = hash & old_md->mask;
+         old_md->entries[x].pkg;
+         x = (x + 1) & old_md->mask)
+    {
+        struct OldMdEntry *entry = &(old_md->entries[x]);
+        // Most of the other keys are skipped by their hashes
+        if (entry->hash != hash || strcmp(entry->key, href))
+            continue;
+        if (!g_atomic_int_compare_and_exchange(&(entry->claimed), 0, 1))
+            return NULL;
+        return entry->pkg;
+    }
+
+    return NULL;
+}
+
+guint
+cr_dumper_old_md_unclaimed(cr_DumperOldMd *old_md)
+{
+    guint count = 0;
+
+    for (gsize x = 0; x <= old_md->mask; x++)
+        if (old_md->entries[x].pkg
+            && !g_atomic_int_get(&(old_md->entries[x].claimed)))
+            count++;
+
+    return count;
+}
+
+void
+cr_dumper_old_md_free(cr_DumperOldMd *old_md)
+{
+    if (!old_md)
+        return;
+
+    for (gsize x = 0; x <= old_md->mask; x++)
+        if (old_md->entries[x].pkg && !old_md->entries[x].claimed)
+            cr_package_free(old_md->entries[x].pkg);
+
+    g_free(old_md->entries);
+    g_string_chunk_free(old_md->keys);
+    g_free(old_md);
+}
+
+struct _cr_DumperPrefetch {
+    guint depth;                    // Max number of tasks prefetched ahead
+    GArray *tasks;                  // Copies of the tasks (struct PoolTask)
+                                    // in the order of their dispatch
+    GStringChunk *paths;            // Full paths of the copies
+    GThread *thread;                // Prefetching thread or NULL
+    GMutex mutex;                   // Mutex for the items bellow
+    GCond cond;                     // Signaled when a task is started
+                                    // or added
+    long started;                   // Number of tasks started by workers
+    gboolean closed;                // No more tasks will be added
+    gboolean stop;                  // The thread should end
+};
+
+cr_DumperPrefetch *
+cr_dumper_prefetch_new(guint depth)
+{
+    cr_DumperPrefetch *prefetch = g_new0(cr_DumperPrefetch, 1);
+    prefetch->depth = depth;
+    prefetch->tasks = g_array_new(FALSE, FALSE, sizeof(struct PoolTask));
+    prefetch->paths = g_string_chunk_new(64 * 1024);
+    g_mutex_init(&(prefetch->mutex));
+    g_cond_init(&(prefetch->cond));
+    return prefetch;
+}
+
+void
+cr_dumper_prefetch_add(cr_DumperPrefetch *prefetch,
+                       const struct PoolTask *task)
+{
+    struct PoolTask copy = *task;
+    g_mutex_lock(&(prefetch->mutex));
+    copy.full_path = g_string_chunk_insert(prefetch->paths, task->full_path);
+    copy.filename = copy.path = NULL;
+    g_array_append_val(prefetch->tasks, copy);
+    g_cond_signal(&(prefetch->cond));
+    g_mutex_unlock(&(prefetch->mutex));
+}
+
+void
+cr_dumper_prefetch_close(cr_DumperPrefetch *prefetch)
+{
+    g_mutex_lock(&(prefetch->mutex));
+    prefetch->closed = TRUE;
+    g_cond_signal(&(prefetch->cond));
+    g_mutex_unlock(&(prefetch->mutex));
+}
+
+static gpointer
+prefetch_thread(gpointer data)
+{
+    cr_DumperPrefetch *prefetch = data;
+
+    for (guint x = 0; ; x++) {
+        const char *full_path = NULL;
+        gboolean stop;
+        long started;
+
+        // The array grows while the tasks are added, the copies are
+        // read under the mutex
+        g_mutex_lock(&(prefetch->mutex));
+        while (!prefetch->stop
+               && ((x >= prefetch->tasks->len && !prefetch->closed)
+                   || (long) x >= prefetch->started + (long) prefetch->depth))
+            g_cond_wait(&(prefetch->cond), &(prefetch->mutex));
+        stop = prefetch->stop || x >= prefetch->tasks->len;
+        if (!stop)
+            full_path = g_array_index(prefetch->tasks,
+                                      struct PoolTask, x).full_path;
+        started = prefetch->started;
+        g_mutex_unlock(&(prefetch->mutex));
+
+        if (stop)
+            break;
+        if ((long) x < started)
+            continue;   // A worker is already reading the package
+
+        // The kernel reads the file in the background, the checksum
+        // and the header reading of the worker find it in the page cache
+        int fd = open(full_path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+void
+cr_dumper_prefetch_start(cr_DumperPrefetch *prefetch)
+{
+    prefetch->thread = g_thread_new("prefetch", prefetch_thread, prefetch);
+}
+
+/** A worker started the next task. */
+static void
+prefetch_task_started(cr_DumperPrefetch *prefetch)
+{
+    g_mutex_lock(&(prefetch->mutex));
+    prefetch->started++;
+    g_cond_signal(&(prefetch->cond));
+    g_mutex_unlock(&(prefetch->mutex));
+}
+
+void
+cr_dumper_prefetch_free(cr_DumperPrefetch *prefetch)
+{
+    if (!prefetch)
+        return;
+
+    if (prefetch->thread) {
+        g_mutex_lock(&(prefetch->mutex));
+        prefetch->stop = TRUE;
+        g_cond_signal(&(prefetch->cond));
+        g_mutex_unlock(&(prefetch->mutex));
+        g_thread_join(prefetch->thread);
+    }
+
+    g_array_free(prefetch->tasks, TRUE);
+    g_string_chunk_free(prefetch->paths);
+    g_mutex_clear(&(prefetch->mutex));
+    g_cond_clear(&(prefetch->cond));
+    g_free(prefetch);
+}
+
+struct _cr_DumperAutoscale {
+    guint min_workers;              // Bounds of the number of workers
+    guint max_workers;
+    guint cpus;                     // CPUs available to the workers
+    GMutex mutex;                   // Mutex for the items bellow
+    guint tasks;                    // Packages finished since the update
+    gint64 wall;                    // Their wall time (us)
+    gint64 cpu;                     // Their CPU time (us)
+    gint64 wait;                    // Time of waiting for the writers (us)
+};
+
+/** CPU time of the calling thread in microseconds */
+static gint64
+thread_cpu_time(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+cr_DumperAutoscale *
+cr_dumper_autoscale_new(guint min_workers, guint max_workers, guint cpus)
+{
+    cr_DumperAutoscale *autoscale = g_new0(cr_DumperAutoscale, 1);
+    autoscale->min_workers = MAX(min_workers, 1);
+    autoscale->max_workers = MAX(max_workers, autoscale->min_workers);
+    autoscale->cpus = MAX(cpus, 1);
+    g_mutex_init(&(autoscale->mutex));
+    return autoscale;
+}
+
+/** A worker finished a package. */
+static void
+autoscale_task_done(cr_DumperAutoscale *autoscale, gint64 wall, gint64 cpu)
+{
+    g_mutex_lock(&(autoscale->mutex));
+    autoscale->tasks++;
+    autoscale->wall += wall;
+    autoscale->cpu += MIN(cpu, wall);
+    g_mutex_unlock(&(autoscale->mutex));
+}
+
+/** A worker waited for the writers. */
+static void
+autoscale_waited(cr_DumperAutoscale *autoscale, gint64 wait)
+{
+    g_mutex_lock(&(autoscale->mutex));
+    autoscale->wait += wait;
+    g_mutex_unlock(&(autoscale->mutex));
+}
+
+guint
+cr_dumper_autoscale_update(cr_DumperAutoscale *autoscale, guint workers)
+{
+    guint tasks;
+    gint64 wall, cpu, wait;
+    guint target;
+
+    g_mutex_lock(&(autoscale->mutex));
+    tasks = autoscale->tasks;
+    wall  = autoscale->wall;
+    cpu   = autoscale->cpu;
+    wait  = autoscale->wait;
+    if (tasks >= MAX(AUTOSCALE_MIN_TASKS, workers) && wall > 0)
+        autoscale->tasks = autoscale->wall = autoscale->cpu
+                         = autoscale->wait = 0;
+    g_mutex_unlock(&(autoscale->mutex));
+
+    if (tasks < MAX(AUTOSCALE_MIN_TASKS, workers) || wall <= 0)
+        return workers;
+
+    if (wait > (wall + wait) * AUTOSCALE_WAIT_RATIO) {
+        // The writers are the bottleneck, more workers would only fill
+        // the reorder buffer
+        target = workers - workers / 4;
+    } else {
+        // Enough workers to keep all the CPUs busy, a worker uses a CPU
+        // for the cpu/wall part of its time, the rest it waits for I/O
+        double ratio = MAX((double) cpu / wall, AUTOSCALE_MIN_CPU_RATIO);
+        target = (guint) (autoscale->cpus / ratio + 0.5);
+
+        // Gradually, at most twice as many or a half at once
+        target = CLAMP(target, workers - workers / 2, workers * 2);
+
+        // Ignore small changes
+        if (target > workers - MAX(workers / 8, 1)
+            && target < workers + MAX(workers / 8, 1))
+            target = workers;
+    }
+
+    return CLAMP(target, autoscale->min_workers, autoscale->max_workers);
+}
+
+void
+cr_dumper_autoscale_free(cr_DumperAutoscale *autoscale)
+{
+    if (!autoscale)
+        return;
+
+    g_mutex_clear(&(autoscale->mutex));
+    g_free(autoscale);
+}
+
+struct _cr_DumperProgress {
+    gboolean to_stderr;             // Print the reports to stderr
+    gchar *path;                    // Status file or NULL
+    cr_Metrics *metrics;            // Metrics or NULL
+    cr_RunContext *run_ctx;         // Settings of the run or NULL
+    long total;                     // Number of packages
+    gint64 start;                   // Start of the reporting
+    volatile gint read;             // Packages read by the workers
+    volatile gint done;             // Packages written by all the writers
+    volatile gsize bytes;           // Size of the read packages
+    GThread *thread;                // Reporting thread or NULL
+    GMutex mutex;                   // Mutex for the items bellow
+    GCond cond;                     // Signaled when the thread should end
+    gboolean stop;                  // The thread should end
+};
+
+cr_DumperProgress *
+cr_dumper_progress_new(gboolean to_stderr,
+                       const char *path,
+                       cr_Metrics *metrics,
+                       cr_RunContext *run_ctx)
+{
+    cr_DumperProgress *progress = g_new0(cr_DumperProgress, 1);
+    progress->to_stderr = to_stderr;
+    progress->path = g_strdup(path);
+    progress->metrics = metrics;
+    progress->run_ctx = run_ctx;
+    g_mutex_init(&(progress->mutex));
+    g_cond_init(&(progress->cond));
+    return progress;
+}
+
+/** H:MM:SS */
+static gchar *
+progress_time_str(gint64 seconds)
+{
+    return g_strdup_printf("%" G_GINT64_FORMAT ":%02d:%02d", seconds / 3600,
+                           (int) (seconds / 60 % 60), (int) (seconds % 60));
+}
+
+static void
+progress_report(cr_DumperProgress *progress, gboolean finished)
+{
+    GError *tmp_err = NULL;
+    gint read = g_atomic_int_get(&(progress->read));
+    gint done = g_atomic_int_get(&(progress->done));
+    gsize bytes = (gsize) g_atomic_pointer_get(&(progress->bytes));
+    double elapsed = (double) (g_get_monotonic_time() - progress->start)
+                     / G_USEC_PER_SEC;
+    double pkgs_rate = elapsed > 0 ? done / elapsed : 0;
+    double bytes_rate = elapsed > 0 ? bytes / elapsed : 0;
+    long total;
+    g_mutex_lock(&(progress->mutex));
+    total = progress->total;
+    g_mutex_unlock(&(progress->mutex));
+    // The rest takes as long as the packages done so far
+    double eta = done > 0 ? (total - done) * elapsed / done : -1;
+    gint64 peak_rss;
+    gint64 rss = cr_metrics_rss(&peak_rss);
+
+    cr_metrics_memory_set(progress->metrics, CR_METRICS_MEM_SQLITE,
+                          sqlite3_memory_used(), sqlite3_memory_highwater(0));
+
+    if (progress->to_stderr) {
+        _cleanup_free_ gchar *time_str = progress_time_str(
+                                    (gint64) (finished ? elapsed : eta));
+        _cleanup_free_ gchar *memory = cr_metrics_memory_summary(
+                                                        progress->metrics);
+        fprintf(stderr, "Progress: %d/%ld packages (%ld %%), "
+                "%.1f packages/s, %.1f MiB/s, %s %s, %s\n",
+                done, total, total ? done * 100L / total : 100L,
+                pkgs_rate, bytes_rate / (1024 * 1024),
+                finished ? "done in" : "ETA",
+                finished || eta >= 0 ? time_str : "unknown", memory);
+    }
+
+    if (progress->path) {
+        _cleanup_free_ gchar *eta_str = eta >= 0
+                                        ? g_strdup_printf("%.1f", eta)
+                                        : g_strdup("null");
+        _cleanup_free_ gchar *status = g_strdup_printf(
+            "{\"total\": %ld, \"read\": %d, \"done\": %d, "
+            "\"bytes\": %" G_GSIZE_FORMAT ", \"elapsed\": %.1f, "
+            "\"packages_per_second\": %.1f, \"bytes_per_second\": %.0f, "
+            "\"eta\": %s, \"rss_bytes\": %" G_GINT64_FORMAT ", "
+            "\"peak_rss_bytes\": %" G_GINT64_FORMAT ", \"finished\": %s}\n",
+            total, read, done, bytes, elapsed, pkgs_rate,
+            bytes_rate, eta_str, rss, peak_rss, finished ? "true" : "false");
+        if (!g_file_set_contents(progress->path, status, -1, &tmp_err)) {
+            g_warning("Cannot write progress: %s", tmp_err->message);
             g_clear_error(&tmp_err);
         }
     }
-    if (udata->pri_zck) {
-        if (new_pkg) {
-            cr_end_chunk(udata->pri_zck->f, &tmp_err);
-            if (tmp_err) {
-                g_critical("Unable to end primary zchunk: %s", tmp_err->message);
-                udata->had_errors = TRUE;
-                g_clear_error(&tmp_err);
-            }
-        }
-        cr_xmlfile_add_chunk(udata->pri_zck, (const char *) res.primary, &tmp_err);
+}
+
+static gpointer
+progress_thread(gpointer data)
+{
+    cr_DumperProgress *progress = data;
+    gint64 deadline = g_get_monotonic_time() + PROGRESS_INTERVAL;
+
+    cr_run_context_push(progress->run_ctx);
+
+    g_mutex_lock(&(progress->mutex));
+    while (!progress->stop) {
+        if (g_cond_wait_until(&(progress->cond), &(progress->mutex), deadline))
+            continue;
+        g_mutex_unlock(&(progress->mutex));
+        progress_report(progress, FALSE);
+        deadline = g_get_monotonic_time() + PROGRESS_INTERVAL;
+        g_mutex_lock(&(progress->mutex));
+    }
+    g_mutex_unlock(&(progress->mutex));
+
+    cr_run_context_pop(progress->run_ctx);
+    return NULL;
+}
+
+void
+cr_dumper_progress_start(cr_DumperProgress *progress, long total)
+{
+    progress->total = total;
+    progress->start = g_get_monotonic_time();
+    progress->thread = g_thread_new("progress", progress_thread, progress);
+}
+
+void
+cr_dumper_progress_set_total(cr_DumperProgress *progress, long total)
+{
+    g_mutex_lock(&(progress->mutex));
+    progress->total = total;
+    g_mutex_unlock(&(progress->mutex));
+}
+
+void
+cr_dumper_progress_free(cr_DumperProgress *progress)
+{
+    if (!progress)
+        return;
+
+    if (progress->thread) {
+        g_mutex_lock(&(progress->mutex));
+        progress->stop = TRUE;
+        g_cond_signal(&(progress->cond));
+        g_mutex_unlock(&(progress->mutex));
+        g_thread_join(progress->thread);
+        progress_report(progress, TRUE);
+    }
+
+    g_free(progress->path);
+    g_mutex_clear(&(progress->mutex));
+    g_cond_clear(&(progress->cond));
+    g_free(progress);
+}
+
+/** FNV-1a hash of the srpm name without version and release, it must
+ * not change between runs (and glib versions) */
+static guint32
+srpm_name_hash(const char *rpm_sourcerpm)
+{
+    const char *end = NULL;
+    guint32 hash = 2166136261U;
+
+    if (!rpm_sourcerpm)
+        return hash;
+
+    // name-version-release.src.rpm
+    end = strrchr(rpm_sourcerpm, '-');
+    if (end && end != rpm_sourcerpm) {
+        const char *ver = end - 1;
+        while (ver > rpm_sourcerpm && *ver != '-')
+            ver--;
+        if (ver > rpm_sourcerpm)
+            end = ver;
+    }
+    if (!end)
+        end = rpm_sourcerpm + strlen(rpm_sourcerpm);
+
+    for (const char *c = rpm_sourcerpm; c < end; c++) {
+        hash ^= (guchar) *c;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void
+write_zck_chunk(struct DumperWriter *writer,
+                cr_XmlFile *f,
+                cr_ZckChunking chunking,
+                const char *rpm_sourcerpm,
+                const char *chunk,
+                const char *name)
+{
+    GError *tmp_err = NULL;
+    struct UserData *udata = writer->udata;
+    gsize len = strlen(chunk);
+    gboolean end_chunk;
+
+    if (writer->chunk_size == 0) {
+        // Packages never share the chunk with the xml header
+        end_chunk = TRUE;
+    } else if (g_strcmp0(writer->prev_srpm, rpm_sourcerpm) != 0) {
+        // Every srpm gets its own zchunk chunk, unless the hash of its
+        // name says it continues the chunk of the previous one
+        end_chunk = chunking != CR_ZCK_CHUNKING_HASH
+            || srpm_name_hash(rpm_sourcerpm) % CR_ZCK_CHUNK_HASH_GROUP == 0;
+    } else {
+        end_chunk = FALSE;
+    }
+
+    if ((chunking == CR_ZCK_CHUNKING_SIZED || chunking == CR_ZCK_CHUNKING_HASH)
+        && writer->chunk_size + len > CR_ZCK_CHUNK_MAX_SIZE)
+        end_chunk = TRUE;
+
+    if (end_chunk) {
+        cr_end_chunk(f->f, &tmp_err);
         if (tmp_err) {
-            g_critical("Cannot add primary zchunk:\n%s\nError: %s",
-                       res.primary, tmp_err->message);
+            g_critical("Unable to end %s zchunk: %s", name, tmp_err->message);
             udata->had_errors = TRUE;
             g_clear_error(&tmp_err);
         }
+        writer->chunk_size = 0;
     }
+    writer->chunk_size += len;
+    g_free(writer->prev_srpm);
+    writer->prev_srpm = g_strdup(rpm_sourcerpm);
 
-    g_cond_broadcast(&(udata->cond_pri));
-    g_mutex_unlock(&(udata->mutex_pri));
-
-    // Write fielists data
-    g_mutex_lock(&(udata->mutex_fil));
-    while (udata->id_fil != id)
-        g_cond_wait (&(udata->cond_fil), &(udata->mutex_fil));
-    ++udata->id_fil;
-    cr_xmlfile_add_chunk(udata->fil_f, (const char *) res.filelists, &tmp_err);
+    cr_xmlfile_add_chunk(f, chunk, &tmp_err);
     if (tmp_err) {
-        g_critical("Cannot add filelists chunk:\n%s\nError: %s",
-                   res.filelists, tmp_err->message);
+        g_critical("Cannot add %s zchunk:\n%s\nError: %s",
+                   name, chunk, tmp_err->message);
         udata->had_errors = TRUE;
         g_clear_error(&tmp_err);
     }
+}
 
-    if (udata->fil_db) {
-        cr_db_add_pkg(udata->fil_db, pkg, &tmp_err);
-        if (tmp_err) {
-            g_critical("Cannot add record of %s (%s) to filelists db: %s",
-                       pkg->name, pkg->pkgId, tmp_err->message);
-            udata->had_errors = TRUE;
-            g_clear_error(&tmp_err);
-        }
+static void
+write_db_record(cr_SqliteDb *db,
+                const cr_Package *pkg,
+                const char *name,
+                struct UserData *udata)
+{
+    GError *tmp_err = NULL;
+
+    if (!db)
+        return;
+
+    // The package is shared with the other writers, it must not be modified
+    cr_db_add_const_pkg(db, pkg, &tmp_err);
+    if (tmp_err) {
+        g_critical("Cannot add record of %s (%s) to %s db: %s",
+                   pkg->name, pkg->pkgId, name, tmp_err->message);
+        udata->had_errors = TRUE;
+        g_clear_error(&tmp_err);
     }
-    if (udata->fil_zck) {
-        if (new_pkg) {
-            cr_end_chunk(udata->fil_zck->f, &tmp_err);
-            if (tmp_err) {
-                g_critical("Unable to end filelists zchunk: %s", tmp_err->message);
-                udata->had_errors = TRUE;
-                g_clear_error(&tmp_err);
-            }
-        }
-        cr_xmlfile_add_chunk(udata->fil_zck, (const char *) res.filelists, &tmp_err);
-        if (tmp_err) {
-            g_critical("Cannot add filelists zchunk:\n%s\nError: %s",
-                       res.filelists, tmp_err->message);
-            udata->had_errors = TRUE;
-            g_clear_error(&tmp_err);
-        }
+}
+
+static void
+write_pkg_cache_record(struct BufferedTask *buf_task, struct UserData *udata)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCacheEntry entry;
+
+    if (!buf_task->has_cache_key)
+        return;
+
+    entry.key           = buf_task->cache_key;
+    entry.location_href = buf_task->location_href;
+    entry.location_base = buf_task->location_base;
+    entry.rpm_sourcerpm = buf_task->rpm_sourcerpm;
+    entry.primary       = buf_task->res.primary;
+    entry.filelists     = buf_task->res.filelists;
+    entry.other         = buf_task->res.other;
+
+    if (!cr_pkgcache_writer_add(udata->pkg_cache_writer, &entry, &tmp_err)) {
+        // Not fatal, the cache only speeds up the next run
+        g_warning("Cannot add %s to the package cache: %s",
+                  buf_task->location_href, tmp_err->message);
+        g_clear_error(&tmp_err);
     }
+}
 
-    g_cond_broadcast(&(udata->cond_fil));
-    g_mutex_unlock(&(udata->mutex_fil));
+static void
+write_pkg_index_record(const cr_Package *pkg, struct UserData *udata)
+{
+    GError *tmp_err = NULL;
 
-    // Write other data
-    g_mutex_lock(&(udata->mutex_oth));
-    while (udata->id_oth != id)
-        g_cond_wait (&(udata->cond_oth), &(udata->mutex_oth));
-    ++udata->id_oth;
-    cr_xmlfile_add_chunk(udata->oth_f, (const char *) res.other, &tmp_err);
-    if (tmp_err) {
-        g_critical("Cannot add other chunk:\n%s\nError: %s",
-                   res.other, tmp_err->message);
+    if (!cr_pkgindex_writer_add(udata->pkg_index, pkg, &tmp_err)) {
+        g_critical("Cannot add %s (%s) to the package index: %s",
+                   pkg->name, pkg->pkgId, tmp_err->message);
         udata->had_errors = TRUE;
         g_clear_error(&tmp_err);
     }
+}
 
-    if (udata->oth_db) {
-        cr_db_add_pkg(udata->oth_db, pkg, NULL);
-        if (tmp_err) {
-            g_critical("Cannot add record of %s (%s) to other db: %s",
-                       pkg->name, pkg->pkgId, tmp_err->message);
-            udata->had_errors = TRUE;
-            g_clear_error(&tmp_err);
-        }
+/** pkgId of a package of the package cache from its primary chunk
+ * (<checksum type="..." pkgid="YES">pkgId</checksum>).
+ */
+static const char *
+primary_pkgid(const char *primary, size_t *len)
+{
+    const char *start = primary ? strstr(primary, "pkgid=\"YES\">") : NULL;
+
+    if (!start)
+        return NULL;
+    start += strlen("pkgid=\"YES\">");
+    *len = strcspn(start, "<");
+    return start;
+}
+
+/** Feed the pkgId and the location of the package into the content hash.
+ * Only the writer of primary.xml calls it, in the order of the packages.
+ */
+static void
+update_contenthash(struct UserData *udata, struct BufferedTask *buf_task)
+{
+    cr_Package *pkg = buf_task->pkg;
+    const char *pkgid = pkg ? pkg->pkgId : NULL;
+    const char *href = buf_task->location_href;
+    size_t len = pkgid ? strlen(pkgid) : 0;
+
+    if (!pkgid)
+        pkgid = primary_pkgid(buf_task->res.primary, &len);
+    if (!href && pkg)
+        href = pkg->location_href;
+
+    // Both strings are terminated, the hash doesn't depend on their split
+    cr_checksum_update(udata->contenthash, pkgid ? pkgid : "", len, NULL);
+    cr_checksum_update(udata->contenthash, "\0", 1, NULL);
+    if (href)
+        cr_checksum_update(udata->contenthash, href, strlen(href), NULL);
+    cr_checksum_update(udata->contenthash, "\n", 1, NULL);
+}
+
+static void
+write_pkg(struct DumperWriter *writer, struct BufferedTask *buf_task)
+{
+    struct UserData *udata = writer->udata;
+    cr_Package *pkg = buf_task->pkg;
+    struct cr_XmlStruct *res = &buf_task->res;
+
+    switch (writer->type) {
+        case WRITER_PRI_XML:
+            udata->package_count++;
+            write_xml_chunk(udata->pri_f, res->primary, "primary", udata);
+            if (udata->contenthash)
+                update_contenthash(udata, buf_task);
+            break;
+        case WRITER_FIL_XML:
+            if (res->filelists)
+                write_xml_chunk(udata->fil_f, res->filelists, "filelists", udata);
+            break;
+        case WRITER_OTH_XML:
+            if (res->other)
+                write_xml_chunk(udata->oth_f, res->other, "other", udata);
+            break;
+        case WRITER_PRI_ZCK:
+            write_zck_chunk(writer, udata->pri_zck, udata->pri_zck_chunking,
+                            buf_task->rpm_sourcerpm, res->primary, "primary");
+            break;
+        case WRITER_FIL_ZCK:
+            if (res->filelists)
+                write_zck_chunk(writer, udata->fil_zck, udata->fil_zck_chunking,
+                                buf_task->rpm_sourcerpm, res->filelists, "filelists");
+            break;
+        case WRITER_OTH_ZCK:
+            if (res->other)
+                write_zck_chunk(writer, udata->oth_zck, udata->oth_zck_chunking,
+                                buf_task->rpm_sourcerpm, res->other, "other");
+            break;
+        case WRITER_PRI_DB:
+            write_db_record(udata->pri_db, pkg, "primary", udata);
+            break;
+        case WRITER_FIL_DB:
+            if (res->filelists)
+                write_db_record(udata->fil_db, pkg, "filelists", udata);
+            break;
+        case WRITER_OTH_DB:
+            if (res->other)
+                write_db_record(udata->oth_db, pkg, "other", udata);
+            break;
+        case WRITER_PKG_CACHE:
+            write_pkg_cache_record(buf_task, udata);
+            break;
+        case WRITER_PKG_INDEX:
+            write_pkg_index_record(pkg, udata);
+            break;
     }
-    if (udata->oth_zck) {
-        if (new_pkg) {
-            cr_end_chunk(udata->oth_zck->f, &tmp_err);
-            if (tmp_err) {
-                g_critical("Unable to end other zchunk: %s", tmp_err->message);
-                udata->had_errors = TRUE;
-                g_clear_error(&tmp_err);
+}
+
+/** Account the write of the task by the writer into the metrics.
+ */
+static void
+account_write(struct DumperWriter *writer,
+              struct BufferedTask *buf_task,
+              gint64 start)
+{
+    cr_MetricsPhase phase = CR_METRICS_XML_WRITE;
+    const char *xml = NULL;
+
+    if (!writer->udata->metrics)
+        return;
+
+    switch (writer->type) {
+        case WRITER_PRI_XML:
+        case WRITER_PRI_ZCK:
+            xml = buf_task->res.primary;
+            break;
+        case WRITER_FIL_XML:
+        case WRITER_FIL_ZCK:
+            xml = buf_task->res.filelists;
+            break;
+        case WRITER_OTH_XML:
+        case WRITER_OTH_ZCK:
+            xml = buf_task->res.other;
+            break;
+        case WRITER_PRI_DB:
+        case WRITER_FIL_DB:
+        case WRITER_OTH_DB:
+            phase = CR_METRICS_SQLITE;
+            break;
+        case WRITER_PKG_CACHE:
+            phase = CR_METRICS_PKG_CACHE;
+            break;
+        case WRITER_PKG_INDEX:
+            phase = CR_METRICS_PKG_INDEX;
+            break;
+    }
+
+    cr_metrics_stop(writer->udata->metrics, phase, start,
+                    xml ? strlen(xml) : 0);
+}
+
+static gpointer
+dumper_writer_thread(gpointer data)
+{
+    struct DumperWriter *writer = data;
+    struct UserData *udata = writer->udata;
+    GError *tmp_err = NULL;
+
+    cr_run_context_push(udata->run_ctx);
+
+    if (!cr_cpuset_bind_current_thread(udata->writer_cpuset, &tmp_err)) {
+        g_warning("%s", tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    cr_metrics_set_thread_name(udata->metrics, writer_names[writer->type]);
+
+    for (;; writer->id++) {
+        long slot = writer->id % udata->ring_len;
+        gsize ring_id = (gsize) writer->id + 1;
+
+        // The waiting for the task is traced as a part of it
+        cr_metrics_set_task(udata->metrics, writer->id, NULL);
+
+        // Sleep only if the task we are waiting for isn't published yet,
+        // the task doesn't come if it's after the final count of the tasks
+        if (g_atomic_pointer_get(&udata->ring_ids[slot]) != ring_id) {
+            gboolean last = FALSE;
+            gint64 start = cr_metrics_start(udata->metrics);
+            cr_metrics_mutex_lock(udata->metrics, CR_METRICS_LOCK_RING,
+                                  &(udata->mutex_ring));
+            while (g_atomic_pointer_get(&udata->ring_ids[slot]) != ring_id) {
+                if (!udata->task_count_open
+                    && writer->id >= udata->task_count) {
+                    last = TRUE;
+                    break;
+                }
+                g_cond_wait(&(udata->cond_ring_filled), &(udata->mutex_ring));
             }
+            g_mutex_unlock(&(udata->mutex_ring));
+            if (last)
+                break;
+            cr_metrics_stop(udata->metrics, CR_METRICS_WRITER_WAIT, start, 0);
         }
-        cr_xmlfile_add_chunk(udata->oth_zck, (const char *) res.other, &tmp_err);
-        if (tmp_err) {
-            g_critical("Cannot add other zchunk:\n%s\nError: %s",
-                       res.other, tmp_err->message);
-            udata->had_errors = TRUE;
-            g_clear_error(&tmp_err);
+
+        struct BufferedTask *buf_task = g_atomic_pointer_get(&udata->ring[slot]);
+        if (buf_task->ok) {
+            gint64 start = cr_metrics_start(udata->metrics);
+            write_pkg(writer, buf_task);
+            account_write(writer, buf_task, start);
+        }
+
+        if (g_atomic_int_dec_and_test(&(buf_task->refs))) {
+            // We are the last writer of the task - release its slot
+            gint64 locked = cr_metrics_mutex_lock(udata->metrics,
+                                                  CR_METRICS_LOCK_RING,
+                                                  &(udata->mutex_ring));
+            udata->id_done = writer->id + 1;
+            udata->ring_bytes -= buf_task->size;
+            cr_metrics_memory_add(udata->metrics, CR_METRICS_MEM_RING,
+                                  -(gint64) buf_task->size);
+            if (udata->progress)
+                g_atomic_int_inc(&(udata->progress->done));
+            g_cond_broadcast(&(udata->cond_ring_freed));
+            cr_metrics_mutex_unlock(udata->metrics, CR_METRICS_LOCK_RING,
+                                    &(udata->mutex_ring), locked);
+            buffered_task_free(udata, buf_task);
         }
     }
-    g_cond_broadcast(&(udata->cond_oth));
-    g_mutex_unlock(&(udata->mutex_oth));
+
+    cr_metrics_set_task(udata->metrics, -1, NULL);
+
+    cr_run_context_pop(udata->run_ctx);
+    return NULL;
+}
+
+static void
+publish_task(struct UserData *udata, struct BufferedTask *buf_task)
+{
+    long slot = buf_task->id % udata->ring_len;
+
+    buf_task->refs = udata->writers_count;
+    if (buf_task->ok && !buf_task->res_from_cache)
+        buf_task->size = strlen(buf_task->res.primary)
+                         + (buf_task->res.filelists
+                            ? strlen(buf_task->res.filelists) : 0)
+                         + (buf_task->res.other
+                            ? strlen(buf_task->res.other) : 0);
+
+    // Wait until all the writers are done with the previous user of the slot
+    // and until there is enough room in the buffer. The task the writers
+    // wait for must always pass, otherwise nobody could make progress.
+    // Large packages are processed before the rest, a worker holding one
+    // of them could wait for a task which is still queued, so they pass too.
+    gint64 start = cr_metrics_start(udata->metrics);
+    gint64 wait_start = udata->autoscale ? g_get_monotonic_time() : 0;
+    gboolean slept = FALSE;
+    gint64 locked = cr_metrics_mutex_lock(udata->metrics, CR_METRICS_LOCK_RING,
+                                          &(udata->mutex_ring));
+    while (buf_task->id >= udata->id_done + udata->ring_len
+           || (buf_task->id != udata->id_done && !buf_task->large
+               && udata->ring_bytes + buf_task->size > udata->ring_max_bytes)) {
+        g_cond_wait(&(udata->cond_ring_freed), &(udata->mutex_ring));
+        slept = TRUE;
+    }
+    udata->ring_bytes += buf_task->size;
+    cr_metrics_memory_add(udata->metrics, CR_METRICS_MEM_RING,
+                          (gint64) buf_task->size);
+    if (slept)
+        g_mutex_unlock(&(udata->mutex_ring));
+    else
+        cr_metrics_mutex_unlock(udata->metrics, CR_METRICS_LOCK_RING,
+                                &(udata->mutex_ring), locked);
+    cr_metrics_stop(udata->metrics, CR_METRICS_PUBLISH_WAIT, start, 0);
+    if (udata->autoscale && slept)
+        autoscale_waited(udata->autoscale, g_get_monotonic_time() - wait_start);
+
+    if (udata->writers_count == 0) {
+        if (udata->progress)
+            g_atomic_int_inc(&(udata->progress->done));
+        buffered_task_free(udata, buf_task);
+        return;
+    }
+
+    g_atomic_pointer_set(&udata->ring[slot], buf_task);
+    g_atomic_pointer_set(&udata->ring_ids[slot], (gsize) buf_task->id + 1);
+
+    locked = cr_metrics_mutex_lock(udata->metrics, CR_METRICS_LOCK_RING,
+                                   &(udata->mutex_ring));
+    g_cond_broadcast(&(udata->cond_ring_filled));
+    cr_metrics_mutex_unlock(udata->metrics, CR_METRICS_LOCK_RING,
+                            &(udata->mutex_ring), locked);
+}
+
+static gboolean
+start_writer(struct UserData *udata, WriterType type, GError **err)
+{
+    struct DumperWriter *writer = g_malloc0(sizeof(struct DumperWriter));
+    writer->type  = type;
+    writer->udata = udata;
+    writer->id    = 0;
+    writer->thread = g_thread_try_new("writer", dumper_writer_thread,
+                                      writer, err);
+    if (!writer->thread) {
+        g_free(writer);
+        return FALSE;
+    }
+
+    udata->writers = g_slist_prepend(udata->writers, writer);
+    udata->writers_count++;
+    return TRUE;
+}
+
+gboolean
+cr_dumper_writers_start(struct UserData *udata,
+                        long ring_len,
+                        gsize max_bytes,
+                        GError **err)
+{
+    assert(udata);
+    assert(!err || *err == NULL);
+
+    udata->ring_len = MAX(ring_len, MIN_RING_LEN);
+    udata->ring     = g_new0(struct BufferedTask *, udata->ring_len);
+    udata->ring_ids = g_new0(gsize, udata->ring_len);
+    udata->id_done  = 0;
+    udata->ring_bytes = 0;
+    udata->ring_max_bytes = max_bytes;
+    // Every slot holds up to three buffers, a few more are being filled
+    // by the workers
+    udata->xml_pool = cr_xml_buffer_pool_new(3 * udata->ring_len);
+    udata->writers  = NULL;
+    udata->writers_count = 0;
+    g_mutex_init(&(udata->mutex_ring));
+    g_cond_init(&(udata->cond_ring_filled));
+    g_cond_init(&(udata->cond_ring_freed));
+
+    if (udata->pri_f && !start_writer(udata, WRITER_PRI_XML, err))
+        return FALSE;
+    if (udata->fil_f && !start_writer(udata, WRITER_FIL_XML, err))
+        return FALSE;
+    if (udata->oth_f && !start_writer(udata, WRITER_OTH_XML, err))
+        return FALSE;
+    if (udata->pri_zck && !start_writer(udata, WRITER_PRI_ZCK, err))
+        return FALSE;
+    if (udata->fil_zck && !start_writer(udata, WRITER_FIL_ZCK, err))
+        return FALSE;
+    if (udata->oth_zck && !start_writer(udata, WRITER_OTH_ZCK, err))
+        return FALSE;
+    if (udata->pri_db && !start_writer(udata, WRITER_PRI_DB, err))
+        return FALSE;
+    if (udata->fil_db && !start_writer(udata, WRITER_FIL_DB, err))
+        return FALSE;
+    if (udata->oth_db && !start_writer(udata, WRITER_OTH_DB, err))
+        return FALSE;
+    if (udata->pkg_cache_writer
+        && !start_writer(udata, WRITER_PKG_CACHE, err))
+        return FALSE;
+    if (udata->pkg_index && !start_writer(udata, WRITER_PKG_INDEX, err))
+        return FALSE;
+
+    g_debug("Ordered commit stage started (%d writers, %ld slots, %"
+            G_GSIZE_FORMAT " bytes)", udata->writers_count, udata->ring_len,
+            udata->ring_max_bytes);
+    return TRUE;
+}
+
+void
+cr_dumper_writers_set_task_count(struct UserData *udata,
+                                 long task_count,
+                                 gboolean final)
+{
+    g_mutex_lock(&(udata->mutex_ring));
+    udata->task_count = task_count;
+    udata->task_count_open = !final;
+    g_cond_broadcast(&(udata->cond_ring_filled));
+    g_mutex_unlock(&(udata->mutex_ring));
+}
+
+void
+cr_dumper_writers_finish(struct UserData *udata)
+{
+    for (GSList *elem = udata->writers; elem; elem = g_slist_next(elem)) {
+        struct DumperWriter *writer = elem->data;
+        g_thread_join(writer->thread);
+        g_free(writer->prev_srpm);
+        g_free(writer);
+    }
+    g_slist_free(udata->writers);
+    udata->writers = NULL;
+    udata->writers_count = 0;
+
+    g_free(udata->ring);
+    g_free((gpointer) udata->ring_ids);
+    udata->ring = NULL;
+    udata->ring_ids = NULL;
+    g_mutex_clear(&(udata->mutex_ring));
+    g_cond_clear(&(udata->cond_ring_filled));
+    g_cond_clear(&(udata->cond_ring_freed));
+    cr_xml_buffer_pool_free(udata->xml_pool);
+    udata->xml_pool = NULL;
+}
+
+void
+cr_dumper_publish_xml(struct UserData *udata,
+                      long id,
+                      cr_Package *pkg,
+                      struct cr_XmlStruct res)
+{
+    struct BufferedTask *buf_task = g_malloc0(sizeof(struct BufferedTask));
+
+    buf_task->id            = id;
+    buf_task->ok            = res.primary != NULL;
+    buf_task->res           = res;
+    buf_task->pkg           = pkg;
+    buf_task->pkg_borrowed  = TRUE;
+    buf_task->rpm_sourcerpm = pkg->rpm_sourcerpm;
+
+    publish_task(udata, buf_task);
 }
 
 static char *
-get_checksum(const char *filename,
+get_checksum(int fd,
              cr_ChecksumType type,
+             cr_ChecksumIoMode io_mode,
              cr_Package *pkg,
              const char *cachedir,
+             cr_ChecksumCache *cache,
              GError **err)
 {
     GError *tmp_err = NULL;
     char *checksum = NULL;
     char *cachefn = NULL;
+    char *cachekey = NULL;
+
+    if (cache) {
+        // Key for the single file cache - the key is internal, so a fast
+        // fingerprint is enough, but the checksum type must be a part of it
+        char *fingerprint;
+        cr_FingerprintCtx *ctx = cr_fingerprint_new();
+
+        if (pkg->siggpg)
+            cr_fingerprint_update(ctx, pkg->siggpg->data, pkg->siggpg->size);
+        if (pkg->sigpgp)
+            cr_fingerprint_update(ctx, pkg->sigpgp->data, pkg->sigpgp->size);
+        if (pkg->hdrid)
+            cr_fingerprint_update(ctx, pkg->hdrid, strlen(pkg->hdrid));
+
+        fingerprint = cr_fingerprint_final(ctx);
+        cachekey = g_strdup_printf("%s-%s-%s-%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+                                   cr_get_filename(pkg->location_href),
+                                   fingerprint, cr_checksum_name_str(type),
+                                   pkg->size_installed, pkg->time_file);
+        g_free(fingerprint);
+
+        checksum = cr_checksum_cache_lookup(cache, cachekey);
+        if (checksum) {
+            g_debug("Cached checksum used: %s: \"%s\"", cachekey, checksum);
+            goto exit;
+        }
+    }
 
     if (cachedir) {
-        // Prepare cache fn
+        // Prepare cache fn (the key stays the same as in older
+        // versions, so the existing cache dirs remain valid)
         char *key;
         cr_ChecksumCtx *ctx = cr_checksum_new(type, err);
-        if (!ctx) return NULL;
+        if (!ctx) goto exit;
 
         if (pkg->siggpg)
             cr_checksum_update(ctx, pkg->siggpg->data, pkg->siggpg->size, NULL);
@@ -234,7 +1252,7 @@ get_checksum(const char *filename,
             cr_checksum_update(ctx, pkg->hdrid, strlen(pkg->hdrid), NULL);
 
         key = cr_checksum_final(ctx, err);
-        if (!key) return NULL;
+        if (!key) goto exit;
 
         cachefn = g_strdup_printf("%s%s-%s-%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
                                   cachedir,
@@ -255,12 +1273,17 @@ get_checksum(const char *filename,
 
         if (checksum) {
             g_debug("Cached checksum used: %s: \"%s\"", cachefn, checksum);
+            if (cache && !cr_checksum_cache_add(cache, cachekey, checksum,
+                                                &tmp_err)) {
+                g_warning("%s", tmp_err->message);
+                g_clear_error(&tmp_err);
+            }
             goto exit;
         }
     }
 
     // Calculate checksum
-    checksum = cr_checksum_file(filename, type, &tmp_err);
+    checksum = cr_checksum_fd_with_mode(fd, type, io_mode, &tmp_err);
     if (!checksum) {
         g_propagate_prefixed_error(err, tmp_err,
                                    "Error while checksum calculation: ");
@@ -268,17 +1291,22 @@ get_checksum(const char *filename,
     }
 
     // Cache the checksum value
+    if (cache && !cr_checksum_cache_add(cache, cachekey, checksum, &tmp_err)) {
+        g_warning("%s", tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
     if (cachefn && !g_file_test(cachefn, G_FILE_TEST_EXISTS)) {
         gchar *template = g_strconcat(cachefn, "-XXXXXX", NULL);
         // Files should not be executable so use only 0666
-        gint fd = g_mkstemp_full(template, O_RDWR, 0666);
-        if (fd < 0) {
+        gint tmp_fd = g_mkstemp_full(template, O_RDWR, 0666);
+        if (tmp_fd < 0) {
             g_free(template);
             goto exit;
         }
 
-        write(fd, checksum, strlen(checksum));
-        close(fd);
+        write(tmp_fd, checksum, strlen(checksum));
+        close(tmp_fd);
         if (g_rename(template, cachefn) == -1)
             g_remove(template);
         g_free(template);
@@ -286,6 +1314,7 @@ get_checksum(const char *filename,
 
 exit:
     g_free(cachefn);
+    g_free(cachekey);
 
     return checksum;
 }
@@ -311,22 +1340,41 @@ prepare_split_media_baseurl(int media_id, const char *location_base)
 static cr_Package *
 load_rpm(const char *fullpath,
          cr_ChecksumType checksum_type,
+         cr_ChecksumIoMode checksum_io_mode,
          const char *checksum_cachedir,
+         cr_ChecksumCache *checksum_cache,
          const char *location_href,
          const char *location_base,
          int changelog_limit,
          struct stat *stat_buf,
          cr_HeaderReadingFlags hdrrflags,
+         gboolean drop_cache,
+         cr_Metrics *metrics,
          GError **err)
 {
     cr_Package *pkg = NULL;
+    gint64 start;
     GError *tmp_err = NULL;
 
     assert(fullpath);
     assert(!err || *err == NULL);
 
+    // Open the file only once, the header, the checksum and the header
+    // range are all read from the same descriptor
+    int fd = open(fullpath, O_RDONLY);
+    if (fd < 0) {
+        g_warning("%s: open(%s) error (%s)", __func__,
+                  fullpath, g_strerror(errno));
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_IO, "Cannot open %s: %s",
+                    fullpath, g_strerror(errno));
+        return NULL;
+    }
+
     // Get a package object
-    pkg = cr_package_from_rpm_base(fullpath, changelog_limit, hdrrflags, err);
+    start = cr_metrics_start(metrics);
+    pkg = cr_package_from_rpm_fd(fd, fullpath, changelog_limit, hdrrflags,
+                                 err);
+    cr_metrics_stop(metrics, CR_METRICS_READ_HEADER, start, 0);
     if (!pkg)
         goto errexit;
 
@@ -341,7 +1389,7 @@ load_rpm(const char *fullpath,
     // Get file stat
     if (!stat_buf) {
         struct stat stat_buf_own;
-        if (stat(fullpath, &stat_buf_own) == -1) {
+        if (fstat(fd, &stat_buf_own) == -1) {
             g_warning("%s: stat(%s) error (%s)", __func__,
                       fullpath, g_strerror(errno));
             g_set_error(err,  CREATEREPO_C_ERROR, CRE_IO, "stat(%s) failed: %s",
@@ -356,8 +1404,11 @@ load_rpm(const char *fullpath,
     }
 
     // Compute checksum
-    char *checksum = get_checksum(fullpath, checksum_type, pkg,
-                                  checksum_cachedir, &tmp_err);
+    start = cr_metrics_start(metrics);
+    char *checksum = get_checksum(fd, checksum_type, checksum_io_mode, pkg,
+                                  checksum_cachedir, checksum_cache,
+                                  &tmp_err);
+    cr_metrics_stop(metrics, CR_METRICS_CHECKSUM, start, pkg->size_package);
     if (!checksum) {
         g_propagate_error(err, tmp_err);
         goto errexit;
@@ -366,8 +1417,8 @@ load_rpm(const char *fullpath,
     g_free(checksum);
 
     // Get header range
-    struct cr_HeaderRangeStruct hdr_r = cr_get_header_byte_range(fullpath,
-                                                                 &tmp_err);
+    struct cr_HeaderRangeStruct hdr_r;
+    hdr_r = cr_get_header_byte_range_fd(fd, fullpath, &tmp_err);
     if (tmp_err) {
         g_propagate_prefixed_error(err, tmp_err,
                                    "Error while determining header range: ");
@@ -377,15 +1428,143 @@ load_rpm(const char *fullpath,
     pkg->rpm_header_start = hdr_r.start;
     pkg->rpm_header_end = hdr_r.end;
 
+    // This was the last read of the package, don't let it push
+    // more useful data out of the page cache
+    if (drop_cache)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
     return pkg;
 
 errexit:
+    close(fd);
     cr_package_free(pkg);
     return NULL;
 }
 
+static int
+pkg_from_cache_newpkgcb(cr_Package **pkg,
+                        G_GNUC_UNUSED const char *pkgId,
+                        G_GNUC_UNUSED const char *name,
+                        G_GNUC_UNUSED const char *arch,
+                        void *cbdata,
+                        G_GNUC_UNUSED GError **err)
+{
+    // Primary, filelists and other chunks go into the same package
+    *pkg = cbdata;
+    return CR_CB_RET_OK;
+}
+
+/** Primary chunk of a cached package with another location (the same
+ * rpm could be in more repos which share the cache).
+ */
+static char *
+relocate_cached_primary(const cr_PkgCacheEntry *entry,
+                        const char *location_href,
+                        const char *location_base,
+                        GError **err)
+{
+    cr_Package pkg;
+    gsize len = strlen(entry->primary);
+    char *primary;
+
+    // The raw xml is without the trailing newline
+    if (len && entry->primary[len-1] == '\n')
+        len--;
+
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.raw_primary   = g_strndup(entry->primary, len);
+    pkg.location_href = (char *) location_href;
+    pkg.location_base = (char *) location_base;
+    primary = cr_xml_dump_primary_from_raw(&pkg, err);
+    g_free(pkg.raw_primary);
+    return primary;
+}
+
+/** Parse the cached XML chunks back into a package.
+ * Only needed when the package has to be written into the sqlite dbs.
+ */
+static cr_Package *
+pkg_from_cache(const cr_PkgCacheEntry *entry, GError **err)
+{
+    // The strings of the package are sized by its XML
+    cr_Package *pkg = cr_package_new_sized(cr_package_chunk_size(
+                                                strlen(entry->primary)
+                                                + strlen(entry->filelists)
+                                                + strlen(entry->other)));
+
+    if (cr_xml_parse_primary_snippet(entry->primary, pkg_from_cache_newpkgcb,
+                                     pkg, NULL, NULL, NULL, NULL, 0, err)
+        || cr_xml_parse_filelists_snippet(entry->filelists,
+                                          pkg_from_cache_newpkgcb, pkg,
+                                          NULL, NULL, NULL, NULL, err)
+        || cr_xml_parse_other_snippet(entry->other, pkg_from_cache_newpkgcb,
+                                      pkg, NULL, NULL, NULL, NULL, err))
+    {
+        cr_package_free(pkg);
+        return NULL;
+    }
+
+    return pkg;
+}
+
+/** Dump the package into buffers of the pool, the three buffers are
+ * returned in bufs (NULLs on error or without the pool). With
+ * udata->primary_only only the primary chunk is dumped.
+ */
+static struct cr_XmlStruct
+dump_pkg(struct UserData *udata, cr_Package *pkg, GString **bufs,
+         GError **err)
+{
+    struct cr_XmlStruct res;
+    int n_bufs = udata->primary_only ? 1 : 3;
+
+    if (!udata->xml_pool && udata->primary_only) {
+        res.primary   = cr_xml_dump_primary(pkg, err);
+        res.filelists = NULL;
+        res.other     = NULL;
+        return res;
+    }
+
+    if (!udata->xml_pool)
+        return cr_xml_dump(pkg, err);
+
+    for (int x = 0; x < n_bufs; x++)
+        bufs[x] = cr_xml_buffer_pool_get(udata->xml_pool);
+
+    res = cr_xml_dump_to_buffers(pkg, bufs[0], bufs[1], bufs[2], err);
+    if (!res.primary) {
+        for (int x = 0; x < 3; x++) {
+            cr_xml_buffer_pool_put(udata->xml_pool, bufs[x]);
+            bufs[x] = NULL;
+        }
+    }
+
+    return res;
+}
+
 void
-cr_dumper_thread(gpointer data, gpointer user_data)
+cr_dumper_push_task(GThreadPool *pool,
+                    struct UserData *udata,
+                    struct PoolTask *task)
+{
+    task->udata = udata;
+    g_mutex_lock(&(udata->mutex_tasks));
+    udata->tasks_pending++;
+    g_mutex_unlock(&(udata->mutex_tasks));
+    g_thread_pool_push(pool, task, NULL);
+}
+
+void
+cr_dumper_wait_tasks(struct UserData *udata)
+{
+    g_mutex_lock(&(udata->mutex_tasks));
+    while (udata->tasks_pending > 0)
+        g_cond_wait(&(udata->cond_tasks), &(udata->mutex_tasks));
+    g_mutex_unlock(&(udata->mutex_tasks));
+}
+
+void
+cr_dumper_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
 {
     GError *tmp_err = NULL;
     gboolean old_used = FALSE;  // To use old metadata?
@@ -393,18 +1572,57 @@ cr_dumper_thread(gpointer data, gpointer user_data)
     cr_Package *pkg = NULL;     // Package from file
     struct stat stat_buf;       // Struct with info from stat() on file
     struct cr_XmlStruct res;    // Structure for generated XML
-    cr_HeaderReadingFlags hdrrflags = CR_HDRR_NONE;
+    GString *xml_bufs[3] = { NULL, NULL, NULL }; // Pooled buffers of res
+    struct BufferedTask *buf_task = NULL; // Result handed over to writers
+    const cr_PkgCacheEntry *cached = NULL; // Package from the package cache
+    char *relocated = NULL;     // Primary of the cached package (if relocated)
+    gboolean have_stat = FALSE; // Is the stat_buf filled?
+    gint64 task_start = 0;      // Start of the task (for the autoscale)
+    gint64 task_cpu_start = 0;  // CPU time of the thread at the start
+    // Packages are freed right after their metadata are dumped,
+    // so the arena saves a lot of small allocations
+    cr_HeaderReadingFlags hdrrflags = CR_HDRR_USEARENA | CR_HDRR_FASTREAD;
 
-    struct UserData *udata = (struct UserData *) user_data;
     struct PoolTask *task  = (struct PoolTask *) data;
+    struct UserData *udata = task->udata;
+
+    // The pool may work for other runs too
+    cr_run_context_push(udata->run_ctx);
+
+    cr_metrics_set_thread_name(udata->metrics, "worker");
+    cr_metrics_set_task(udata->metrics, task->id, task->filename);
+
+    if (udata->autoscale) {
+        task_start = g_get_monotonic_time();
+        task_cpu_start = thread_cpu_time();
+    }
+
+    // The remote packages aren't prefetched
+    if (udata->prefetch && !task->remote)
+        prefetch_task_started(udata->prefetch);
+
+    // Bind the worker before it allocates its per-thread buffers,
+    // so they are placed on its NUMA node
+    if (!cr_cpuset_bind_current_thread(udata->worker_cpuset, &tmp_err)) {
+        g_warning("%s", tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
 
     // get location_href without leading part of path (path to repo)
-    // including '/' char
+    // including '/' char, the remote packages have it from the manifest
     _cleanup_free_ gchar *location_href = NULL;
-    location_href = g_strdup(task->full_path + udata->repodir_name_len);
-
-    _cleanup_free_ gchar *location_base = NULL;
-    location_base = g_strdup(udata->location_base);
+    if (task->remote)
+        location_href = g_strdup(task->pkg ? task->pkg->location_href
+                                           : task->filename);
+    else
+        location_href = g_strdup(task->full_path + udata->repodir_name_len);
+
+    // Location base of the media in the split mode, the strings
+    // are shared by all the tasks
+    const char *location_base = udata->location_base;
+    if (task->media_id)
+        location_base = g_ptr_array_index(udata->media_location_bases,
+                                          task->media_id - 1);
 
     // User requested modification of the location href
     if (udata->cut_dirs) {
@@ -419,40 +1637,85 @@ cr_dumper_thread(gpointer data, gpointer user_data)
         g_free(tmp);
     }
 
-    // Prepare location base (if split option is used)
-    if (task->media_id) {
-        gchar *new_location_base = prepare_split_media_baseurl(task->media_id,
-                                                               location_base);
-        g_free(location_base);
-        location_base = new_location_base;
-    }
+    // Changelogs and the files out of primary are not needed
+    if (udata->primary_only)
+        hdrrflags |= CR_HDRR_PRIMARYONLY;
 
-    // If --cachedir is used, load signatures and hdrid from packages too
-    if (udata->checksum_cachedir)
-        hdrrflags = CR_HDRR_LOADHDRID | CR_HDRR_LOADSIGNATURES;
+    // If --cachedir or --checksum-cache is used, load signatures and hdrid from packages too
+    if (udata->checksum_cachedir || udata->checksum_cache)
+        hdrrflags |= CR_HDRR_LOADHDRID | CR_HDRR_LOADSIGNATURES;
 
     // Get stat info about file
-    if (udata->old_metadata && !(udata->skip_stat)) {
+    if (task->remote) {
+        // The header is already read, there is no file to stat
+    } else if (((udata->old_md || udata->old_db) && !(udata->skip_stat)) || udata->pkg_cache_writer) {
         if (stat(task->full_path, &stat_buf) == -1) {
             g_critical("Stat() on %s: %s", task->full_path, g_strerror(errno));
             goto task_cleanup;
         }
+        have_stat = TRUE;
+    }
+
+    // Package cache
+    if (udata->pkg_cache && have_stat) {
+        cr_PkgCacheKey key;
+        cr_pkgcache_key_from_stat(&key, &stat_buf);
+        cached = cr_pkgcache_lookup(udata->pkg_cache, &key);
+
+        // The primary chunk contains the location, regenerate it
+        // if the package was cached with another one
+        if (cached
+            && (g_strcmp0(cached->location_href, location_href)
+                || g_strcmp0(cached->location_base, location_base)))
+        {
+            relocated = relocate_cached_primary(cached, location_href,
+                                                location_base, &tmp_err);
+            if (!relocated) {
+                g_warning("Cannot relocate cached metadata of %s: %s",
+                          task->filename, tmp_err->message);
+                g_clear_error(&tmp_err);
+                cached = NULL;
+            }
+        }
+
+        if (cached && (udata->pri_db || udata->fil_db || udata->oth_db
+                       || udata->pkg_index)) {
+            pkg = pkg_from_cache(cached, &tmp_err);
+            if (!pkg) {
+                g_warning("Cannot parse cached metadata of %s: %s",
+                          task->filename, tmp_err->message);
+                g_clear_error(&tmp_err);
+                cached = NULL;
+            } else if (relocated) {
+                pkg->location_href = cr_safe_string_chunk_insert(pkg->chunk,
+                                                            location_href);
+                pkg->location_base = cr_safe_string_chunk_insert(pkg->chunk,
+                                                            location_base);
+            }
+        }
+
+        if (cached) {
+            g_debug("PACKAGE CACHE HIT %s", task->filename);
+            res.primary   = relocated ? relocated : (char *) cached->primary;
+            res.filelists = (char *) cached->filelists;
+            res.other     = (char *) cached->other;
+        }
     }
 
     // Update stuff
-    if (udata->old_metadata) {
-        char *cache_key = cr_get_cleaned_href(location_href);
-
-        // We have old metadata
-        g_mutex_lock(&(udata->mutex_old_md));
-        md = (cr_Package *) g_hash_table_lookup(
-                                cr_metadata_hashtable(udata->old_metadata),
-                                cache_key);
-        // Remove the pkg from the hash table of old metadata, so that no other
-        // thread can use it as CACHE, because later we modify it destructively
-        g_hash_table_steal(cr_metadata_hashtable(udata->old_metadata),
-                                                 cache_key);
-        g_mutex_unlock(&(udata->mutex_old_md));
+    if ((udata->old_md || udata->old_db) && !cached && !task->remote) {
+        // The package is claimed just once, later it's modified destructively
+        if (udata->old_md)
+            md = cr_dumper_old_md_claim(udata->old_md,
+                                        cr_get_cleaned_href(location_href));
+        if (!md && udata->old_db)
+            md = cr_db_package_reader_get(udata->old_db, location_href,
+                                          &tmp_err);
+
+        if (tmp_err) {
+            g_warning("%s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
 
         if (md) {
             g_debug("CACHE HIT %s", task->filename);
@@ -467,6 +1730,8 @@ cr_dumper_thread(gpointer data, gpointer user_data)
             } else {
                 g_debug("%s metadata are obsolete -> generating new",
                         task->filename);
+                cr_package_free(md);
+                md = NULL;
             }
 
             if (old_used) {
@@ -474,7 +1739,7 @@ cr_dumper_thread(gpointer data, gpointer user_data)
                 // WARNING! This two lines destructively modifies content of
                 // packages in old metadata.
                 md->location_href = location_href;
-                md->location_base = location_base;
+                md->location_base = (char *) location_base;
                 // ^^^ The location_base not location_href are properly saved
                 // into pkg chunk this is intentional as after the metadata
                 // are written (dumped) none should use them again.
@@ -483,23 +1748,45 @@ cr_dumper_thread(gpointer data, gpointer user_data)
     }
 
     // Load package and gen XML metadata
-    if (!old_used) {
-        // Load package from file
-        pkg = load_rpm(task->full_path, udata->checksum_type,
-                       udata->checksum_cachedir, location_href,
-                       location_base, udata->changelog_limit,
-                       NULL, hdrrflags, &tmp_err);
-        assert(pkg || tmp_err);
-
-        if (!pkg) {
-            g_warning("Cannot read package: %s: %s",
-                      task->full_path, tmp_err->message);
-            udata->had_errors = TRUE;
-            g_clear_error(&tmp_err);
-            goto task_cleanup;
+    if (cached) {
+        // XML metadata are already generated
+    } else if (!old_used) {
+        if (task->remote) {
+            // The header was read by cr_remotepkg_read_headers(), its
+            // failure was already reported
+            pkg = g_steal_pointer(&task->pkg);
+            if (!pkg) {
+                udata->had_errors = TRUE;
+                goto task_cleanup;
+            }
+            pkg->location_href = cr_safe_string_chunk_insert(pkg->chunk,
+                                                             location_href);
+            pkg->location_base = cr_safe_string_chunk_insert(pkg->chunk,
+                                                             location_base);
+        } else {
+            // Load package from file
+            pkg = load_rpm(task->full_path, udata->checksum_type,
+                           udata->checksum_io_mode,
+                           udata->checksum_cachedir, udata->checksum_cache,
+                           location_href,
+                           location_base, udata->changelog_limit,
+                           NULL, hdrrflags,
+                           !udata->deltas /* delta candidates are read again */,
+                           udata->metrics, &tmp_err);
+            assert(pkg || tmp_err);
+
+            if (!pkg) {
+                g_warning("Cannot read package: %s: %s",
+                          task->full_path, tmp_err->message);
+                udata->had_errors = TRUE;
+                g_clear_error(&tmp_err);
+                goto task_cleanup;
+            }
         }
 
-        res = cr_xml_dump(pkg, &tmp_err);
+        gint64 start = cr_metrics_start(udata->metrics);
+        res = dump_pkg(udata, pkg, xml_bufs, &tmp_err);
+        cr_metrics_stop(udata->metrics, CR_METRICS_XML_DUMP, start, 0);
         if (tmp_err) {
             g_critical("Cannot dump XML for %s (%s): %s",
                        pkg->name, pkg->pkgId, tmp_err->message);
@@ -509,15 +1796,44 @@ cr_dumper_thread(gpointer data, gpointer user_data)
         }
 
         if (udata->output_pkg_list){
-            g_mutex_lock(&(udata->mutex_output_pkg_list));
+            gint64 locked = cr_metrics_mutex_lock(udata->metrics,
+                                                  CR_METRICS_LOCK_PKG_LIST,
+                                                  &(udata->mutex_output_pkg_list));
             fprintf(udata->output_pkg_list, "%s\n", pkg->location_href);
-            g_mutex_unlock(&(udata->mutex_output_pkg_list));
+            cr_metrics_mutex_unlock(udata->metrics, CR_METRICS_LOCK_PKG_LIST,
+                                    &(udata->mutex_output_pkg_list), locked);
         }
     } else {
         // Just gen XML from old loaded metadata
         pkg = md;
-        res = cr_xml_dump(md, &tmp_err);
+        res.primary   = NULL;
+        res.filelists = NULL;
+        res.other     = NULL;
+        gint64 start = cr_metrics_start(udata->metrics);
+        if (md->raw_primary) {
+            // The raw xml of the package is available, only the location
+            // has to be regenerated
+            if (cr_metadata_load_spooled_raw(md, &tmp_err))
+                res = cr_xml_dump_from_raw(md, &tmp_err);
+            if (tmp_err) {
+                g_debug("Cannot reuse raw XML of %s: %s",
+                        task->filename, tmp_err->message);
+                g_clear_error(&tmp_err);
+            }
+        }
+
+        // Files and changelogs are needed for the databases and for
+        // the regular dump
+        if (!res.primary || udata->pri_db || udata->fil_db || udata->oth_db)
+            cr_metadata_load_lazy_data(md, &tmp_err);
+
+        if (!res.primary && !tmp_err)
+            res = dump_pkg(udata, md, xml_bufs, &tmp_err);
+        cr_metrics_stop(udata->metrics, CR_METRICS_XML_DUMP, start, 0);
         if (tmp_err) {
+            g_free(res.primary);
+            g_free(res.filelists);
+            g_free(res.other);
             g_critical("Cannot dump XML for %s (%s): %s",
                        md->name, md->pkgId, tmp_err->message);
             udata->had_errors = TRUE;
@@ -530,6 +1846,8 @@ cr_dumper_thread(gpointer data, gpointer user_data)
     // Delta candidate
     if (udata->deltas
         && !old_used
+        && !cached
+        && !task->remote
         && pkg->size_installed < udata->max_delta_rpm_size)
     {
         cr_DeltaTargetPackage *tpkg;
@@ -537,11 +1855,15 @@ cr_dumper_thread(gpointer data, gpointer user_data)
                                                   task->full_path,
                                                   NULL);
         if (tpkg) {
-            g_mutex_lock(&(udata->mutex_deltatargetpackages));
+            gint64 locked = cr_metrics_mutex_lock(udata->metrics,
+                                                  CR_METRICS_LOCK_DELTAS,
+                                                  &(udata->mutex_deltatargetpackages));
             udata->deltatargetpackages = g_slist_prepend(
                                                 udata->deltatargetpackages,
                                                 tpkg);
-            g_mutex_unlock(&(udata->mutex_deltatargetpackages));
+            cr_metrics_mutex_unlock(udata->metrics, CR_METRICS_LOCK_DELTAS,
+                                    &(udata->mutex_deltatargetpackages),
+                                    locked);
         } else {
             g_warning("Cannot create deltatargetpackage for: %s-%s-%s",
                       pkg->name, pkg->version, pkg->release);
@@ -549,111 +1871,79 @@ cr_dumper_thread(gpointer data, gpointer user_data)
     }
 #endif
 
-    // Buffering stuff
-    g_mutex_lock(&(udata->mutex_buffer));
-
-    if (g_queue_get_length(udata->buffer) < MAX_TASK_BUFFER_LEN
-        && udata->id_pri != task->id
-        && udata->task_count > (task->id + 1))
-    {
-        // If:
-        //  * this isn't our turn
-        //  * the buffer isn't full
-        //  * this isn't the last task
-        // Then: save the task to the buffer
-
-        struct BufferedTask *buf_task = g_malloc0(sizeof(struct BufferedTask));
-        buf_task->id  = task->id;
-        buf_task->res = res;
-        buf_task->pkg = pkg;
-        buf_task->location_href = NULL;
-        buf_task->location_base = NULL;
-        buf_task->pkg_from_md = (pkg == md) ? 1 : 0;
-
-        if (pkg == md) {
-            // We MUST store locations for reused packages who goes to the buffer
-            buf_task->location_href = g_strdup(location_href);
-            buf_task->pkg->location_href = buf_task->location_href;
-
-            buf_task->location_base = g_strdup(location_base);
-            buf_task->pkg->location_base = buf_task->location_base;
-        }
+    // The walk didn't stat the package (no --large-first)
+    if (!task->size)
+        task->size = have_stat ? (gint64) stat_buf.st_size
+                               : (pkg ? pkg->size_package : 0);
 
-        g_queue_insert_sorted(udata->buffer, buf_task, buf_task_sort_func, NULL);
-        g_mutex_unlock(&(udata->mutex_buffer));
+    if (udata->progress) {
+        g_atomic_int_inc(&(udata->progress->read));
+        g_atomic_pointer_add(&(udata->progress->bytes), task->size);
+    }
 
-        g_free(task->full_path);
-        g_free(task->filename);
-        g_free(task->path);
-        g_free(task);
+    // The time of waiting for the writers is reported separately
+    if (udata->autoscale)
+        autoscale_task_done(udata->autoscale,
+                            g_get_monotonic_time() - task_start,
+                            thread_cpu_time() - task_cpu_start);
+
+    // Hand the result over to the writers
+    buf_task = g_malloc0(sizeof(struct BufferedTask));
+    buf_task->id  = task->id;
+    buf_task->ok  = TRUE;
+    buf_task->large = task->size >= LARGE_PACKAGE_SIZE;
+    buf_task->res = res;
+    buf_task->res_from_cache = cached ? TRUE : FALSE;
+    buf_task->relocated_primary = cached ? g_steal_pointer(&relocated) : NULL;
+    memcpy(buf_task->xml_bufs, xml_bufs, sizeof(xml_bufs));
+    buf_task->pkg = pkg;
+    buf_task->location_href = g_steal_pointer(&location_href);
+    buf_task->location_base = location_base;
+    buf_task->pkg_from_md = (pkg && pkg == md) ? 1 : 0;
+    buf_task->rpm_sourcerpm = cached ? cached->rpm_sourcerpm
+                                     : pkg->rpm_sourcerpm;
+    if (have_stat) {
+        buf_task->has_cache_key = TRUE;
+        cr_pkgcache_key_from_stat(&(buf_task->cache_key), &stat_buf);
+    }
 
-        return;
+    if (pkg && pkg == md) {
+        // We MUST store locations for reused packages, the writers use them
+        // after this function returns
+        buf_task->pkg->location_href = buf_task->location_href;
+        buf_task->pkg->location_base = (char *) buf_task->location_base;
     }
 
-    g_mutex_unlock(&(udata->mutex_buffer));
+    publish_task(udata, buf_task);
+    pkg = NULL;
 
-    // Dump XML and SQLite
-    write_pkg(task->id, res, pkg, udata);
+task_cleanup:
+    g_free(relocated);
 
-    // Clean up
-    cr_package_free(pkg);
-    g_free(res.primary);
-    g_free(res.filelists);
-    g_free(res.other);
+    if (pkg) {
+        // The XML couldn't be generated
+        cr_package_free(pkg);
+        pkg = NULL;
+    }
 
-task_cleanup:
-    if (udata->id_pri <= task->id) {
-        // An error was encountered and we have to wait to increment counters
-        g_mutex_lock(&(udata->mutex_pri));
-        while (udata->id_pri != task->id)
-            g_cond_wait (&(udata->cond_pri), &(udata->mutex_pri));
-        ++udata->id_pri;
-        g_cond_broadcast(&(udata->cond_pri));
-        g_mutex_unlock(&(udata->mutex_pri));
-
-        g_mutex_lock(&(udata->mutex_fil));
-        while (udata->id_fil != task->id)
-            g_cond_wait (&(udata->cond_fil), &(udata->mutex_fil));
-        ++udata->id_fil;
-        g_cond_broadcast(&(udata->cond_fil));
-        g_mutex_unlock(&(udata->mutex_fil));
-
-        g_mutex_lock(&(udata->mutex_oth));
-        while (udata->id_oth != task->id)
-            g_cond_wait (&(udata->cond_oth), &(udata->mutex_oth));
-        ++udata->id_oth;
-        g_cond_broadcast(&(udata->cond_oth));
-        g_mutex_unlock(&(udata->mutex_oth));
-    }
-
-    g_free(task->full_path);
-    g_free(task->filename);
-    g_free(task->path);
+    if (!buf_task) {
+        // An error was encountered - publish an empty task so the writers
+        // don't wait for it
+        buf_task = g_malloc0(sizeof(struct BufferedTask));
+        buf_task->id = task->id;
+        buf_task->large = task->size >= LARGE_PACKAGE_SIZE;
+        publish_task(udata, buf_task);
+    }
+
+    cr_metrics_set_task(udata->metrics, -1, NULL);
+    cr_package_free(task->pkg);
     g_free(task);
 
-    // Try to write all results from buffer which was waiting for us
-    while (1) {
-        struct BufferedTask *buf_task;
-        g_mutex_lock(&(udata->mutex_buffer));
-        buf_task = g_queue_peek_head(udata->buffer);
-        if (buf_task && buf_task->id == udata->id_pri) {
-            buf_task = g_queue_pop_head (udata->buffer);
-            g_mutex_unlock(&(udata->mutex_buffer));
-            // Dump XML and SQLite
-            write_pkg(buf_task->id, buf_task->res, buf_task->pkg, udata);
-            // Clean up
-            cr_package_free(buf_task->pkg);
-            g_free(buf_task->res.primary);
-            g_free(buf_task->res.filelists);
-            g_free(buf_task->res.other);
-            g_free(buf_task->location_href);
-            g_free(buf_task->location_base);
-            g_free(buf_task);
-        } else {
-            g_mutex_unlock(&(udata->mutex_buffer));
-            break;
-        }
-    }
+    cr_run_context_pop(udata->run_ctx);
 
-    return;
+    // The run could end right after its last task
+    g_mutex_lock(&(udata->mutex_tasks));
+    if (--udata->tasks_pending == 0)
+        g_cond_broadcast(&(udata->cond_tasks));
+    g_mutex_unlock(&(udata->mutex_tasks));
 }
@@ -26,11 +26,19 @@ extern "C" {
 
 #include <glib.h>
 #include <rpm/rpmlib.h>
+#include "checksum_cache.h"
+#include "createrepo_shared.h"
 #include "load_metadata.h"
 #include "locate_metadata.h"
+#include "metrics.h"
 #include "misc.h"
 #include "package.h"
+#include "pkgcache.h"
+#include "pkgindex.h"
 #include "sqlite.h"
+#include "threads.h"
+#include "xml_dump.h"
+#include "xml_dump_internal.h"
 #include "xml_file.h"
 
 /** \defgroup   dumperthread    Implementation of concurent dumping used in createrepo_c
@@ -38,12 +46,82 @@ extern "C" {
  *  @{
  */
 
+#define LARGE_PACKAGE_SIZE  (32*1024*1024)  /*!< Packages of this size and
+                                                 bigger are processed first
+                                                 with --large-first */
+
+#define CR_ZCK_CHUNK_MAX_SIZE   (64*1024)   /*!< Max size of a zchunk chunk
+                                                 with the sized and hash
+                                                 chunking (a bigger package
+                                                 still gets one chunk) */
+#define CR_ZCK_CHUNK_HASH_GROUP 8           /*!< Avg number of srpms in
+                                                 a zchunk chunk with the
+                                                 hash chunking */
+
+/** Where the chunks of the .xml.zck files end. Clients download just
+ * the changed chunks, so chunks should change as little as possible
+ * between two runs.
+ */
+typedef enum {
+    CR_ZCK_CHUNKING_UNKNOWN,    /*!< Unknown policy */
+    CR_ZCK_CHUNKING_SRPM,       /*!< Every srpm gets its own chunk */
+    CR_ZCK_CHUNKING_SIZED,      /*!< Every srpm gets its own chunk, chunks
+                                     bigger than CR_ZCK_CHUNK_MAX_SIZE are
+                                     split between packages */
+    CR_ZCK_CHUNKING_HASH,       /*!< Chunks end before srpms with a name
+                                     hash divisible by
+                                     CR_ZCK_CHUNK_HASH_GROUP, so the ends
+                                     don't move when other srpms are added
+                                     or removed, and before the chunk gets
+                                     bigger than CR_ZCK_CHUNK_MAX_SIZE */
+} cr_ZckChunking;
+
+/** Read-only index of the old metadata used during --update. The workers
+ * look the packages up without a lock, every package is handed out
+ * (claimed) just once.
+ */
+typedef struct _cr_DumperOldMd cr_DumperOldMd;
+
+/** Prefetch of the packages ahead of the workers. The files of the next
+ * tasks are announced to the kernel (posix_fadvise(POSIX_FADV_WILLNEED)),
+ * which reads them in the background, so the workers don't wait for
+ * the storage (e.g. NFS) when they get to them.
+ */
+typedef struct _cr_DumperPrefetch cr_DumperPrefetch;
+
+/** Adaptive number of workers of the dumper pool. The workers report
+ * the wall and the CPU time of every package (without the time they wait
+ * for the writers) and their waiting for the writers. The pool grows
+ * while the workers mostly wait for the storage (e.g. NFS) and shrinks
+ * when they saturate the CPUs or when the writers can't keep up.
+ */
+typedef struct _cr_DumperAutoscale cr_DumperAutoscale;
+
+/** Progress of the run reported periodically to stderr and/or into
+ * a status file (JSON). The workers and the writers only increment
+ * atomic counters, the report is made by its own thread.
+ */
+typedef struct _cr_DumperProgress cr_DumperProgress;
+
 struct PoolTask {
     long  id;                       // ID of the task
     long  media_id;                 // ID of media in split mode, 0 if not in split mode
     char* full_path;                // Complete path - /foo/bar/packages/foo.rpm
-    char* filename;                 // Just filename - foo.rpm
-    char* path;                     // Just path     - /foo/bar/packages
+                                    // (allocated with the task, g_free()
+                                    // of the task frees it too)
+    const char* filename;           // Just filename - foo.rpm (in full_path)
+    const char* path;               // Just path     - /foo/bar/packages
+                                    // (shared by the tasks of the directory)
+    gint64 size;                    // Size of the rpm (0 if unknown, it is
+                                    // known before the dispatch only with
+                                    // --large-first, the worker sets it)
+    gboolean remote;                // Package of a remote storage, its
+                                    // header was read by
+                                    // cr_remotepkg_read_headers()
+    cr_Package *pkg;                // The remote package, the worker
+                                    // takes it (NULL if it couldn't be read)
+    struct UserData *udata;         // User data of the run of the task
+                                    // (set by cr_dumper_push_task())
 };
 
 struct UserData {
@@ -56,38 +134,74 @@ struct UserData {
     cr_XmlFile *pri_zck;            // Opened compressed primary.xml.zck
     cr_XmlFile *fil_zck;            // Opened compressed filelists.xml.zck
     cr_XmlFile *oth_zck;            // Opened compressed other.xml.zck
-    char *prev_srpm;                // Previous srpm
-    char *cur_srpm;                 // Current srpm
+    cr_ZckChunking pri_zck_chunking; // Chunking of primary.xml.zck
+    cr_ZckChunking fil_zck_chunking; // Chunking of filelists.xml.zck
+    cr_ZckChunking oth_zck_chunking; // Chunking of other.xml.zck
     int changelog_limit;            // Max number of changelogs for a package
+    gboolean primary_only;          // Dump only primary (no filelists
+                                    // and other are opened)
     const char *location_base;      // Base location url
+    GPtrArray *media_location_bases; // Base location url of each media
+                                    // in the split mode (media_id - 1)
     int repodir_name_len;           // Len of path to repo /foo/bar/repodata
                                     //       This part     |<----->|
     const char *checksum_type_str;  // Name of selected checksum
     cr_ChecksumType checksum_type;  // Constant representing selected checksum
     const char *checksum_cachedir;  // Dir with cached checksums
+    cr_ChecksumCache *checksum_cache; // Single file cache of checksums
+    cr_ChecksumIoMode checksum_io_mode; // How to read pkgs for checksums
     gboolean skip_symlinks;         // Skip symlinks
     long task_count;                // Total number of task to process
+    gboolean task_count_open;       // More tasks could still come (see
+                                    // cr_dumper_writers_set_task_count())
     long package_count;             // Total number of packages processed
+    cr_ChecksumCtx *contenthash;    // Digest of the pkgIds and locations
+                                    // of the written packages or NULL
+
+    // Package cache
+    cr_PkgCache *pkg_cache;         // Metadata generated by a previous run
+    cr_PkgCacheWriter *pkg_cache_writer; // Cache for the next run
+    cr_PkgIndexWriter *pkg_index;   // Binary index of the packages
 
     // Update stuff
     gboolean skip_stat;             // Skip stat() while updating
-    cr_Metadata *old_metadata;      // Loaded metadata
-    GMutex mutex_old_md;           // Mutex for accessing old metadata
-
-    // Thread serialization
-    GMutex mutex_pri;              // Mutex for primary metadata
-    GMutex mutex_fil;              // Mutex for filelists metadata
-    GMutex mutex_oth;              // Mutex for other metadata
-    GCond cond_pri;                // Condition for primary metadata
-    GCond cond_fil;                // Condition for filelists metadata
-    GCond cond_oth;                // Condition for other metadata
-    volatile long id_pri;           // ID of task on turn (write primary metadata)
-    volatile long id_fil;           // ID of task on turn (write filelists metadata)
-    volatile long id_oth;           // ID of task on turn (write other metadata)
-
-    // Buffering
-    GQueue *buffer;                 // Buffer for done tasks
-    GMutex mutex_buffer;           // Mutex for accessing the buffer
+    cr_DumperOldMd *old_md;         // Index of the loaded metadata
+    cr_DbPackageReader *old_db;     // Packages of the old sqlite DBs
+                                    // (used instead of the old_md)
+
+    // Prefetch of the packages
+    cr_DumperPrefetch *prefetch;    // Prefetch or NULL
+
+    // Adaptive number of workers
+    cr_DumperAutoscale *autoscale;  // Autoscale or NULL
+
+    // Progress reporting
+    cr_DumperProgress *progress;    // Progress or NULL
+
+    // Tasks pushed into the pool (it could be shared by more runs)
+    GMutex mutex_tasks;             // Mutex for the tasks_pending
+    GCond cond_tasks;               // Signaled when tasks_pending drops to 0
+    long tasks_pending;             // Pushed tasks not processed yet
+
+    // Ordered commit stage
+    struct BufferedTask **ring;     // Finished tasks, task is at id % ring_len
+    volatile gsize *ring_ids;       // ID+1 of the task published in the slot
+    long ring_len;                  // Number of slots in the ring
+    long id_done;                   // ID of the first task not yet written
+                                    // by all writers (guarded by mutex_ring)
+    gsize ring_bytes;               // Size of XML of the tasks in the ring
+                                    // (guarded by mutex_ring)
+    gsize ring_max_bytes;           // Max value of ring_bytes
+    GMutex mutex_ring;              // Mutex for sleeping on the ring
+    GCond cond_ring_filled;         // Signaled when a task is published
+    GCond cond_ring_freed;          // Signaled when a slot is released
+    GSList *writers;                // Running writer threads (one per output)
+    gint writers_count;             // Number of running writer threads
+    cr_XmlBufferPool *xml_pool;     // Reused buffers of the dumped XML
+
+    // Thread placement
+    const cr_CpuSet *worker_cpuset; // CPUs for the workers of the pool
+    const cr_CpuSet *writer_cpuset; // CPUs for the writer threads
 
     // Delta generation
     gboolean deltas;                // Are deltas enabled?
@@ -105,9 +219,267 @@ struct UserData {
 
     FILE *output_pkg_list;          // File where a list of read packages is written
     GMutex mutex_output_pkg_list;   // Mutex for output_pkg_list file
+
+    cr_Metrics *metrics;            // Timing of the phases or NULL
+    cr_RunContext *run_ctx;         // Settings of the run the threads
+                                    // work with or NULL
 };
 
 
+/**
+ * Base location url of a media in the split mode.
+ * @param media_id      ID of the media (1..N)
+ * @param location_base --baseurl or NULL
+ * @return              new string, "media:#ID" without the location_base
+ */
+gchar *
+prepare_split_media_baseurl(int media_id, const char *location_base);
+
+/**
+ * Get the zchunk chunking policy from its name.
+ * @param name          "srpm", "sized" or "hash"
+ * @return              the policy or CR_ZCK_CHUNKING_UNKNOWN
+ */
+cr_ZckChunking
+cr_zck_chunking(const char *name);
+
+/**
+ * Start the writer threads of the ordered commit stage. Each output file
+ * (primary, filelists and other xml, their zchunk variants, the sqlite
+ * databases and the package cache) gets its own thread. The writers drain finished
+ * tasks in the order of their IDs, so the workers of the dumper pool
+ * never wait for their turn to write.
+ * All outputs and the task_count in the udata must be set before the call,
+ * unless the task_count_open is set (the writers then wait for the tasks
+ * until the final count is set by cr_dumper_writers_set_task_count()).
+ * @param udata         user data shared with cr_dumper_thread()
+ * @param ring_len      number of finished tasks which could wait for
+ *                      the writers
+ * @param max_bytes     max total size of XML of finished tasks which
+ *                      could wait for the writers, workers with further
+ *                      tasks block until the writers catch up (large
+ *                      packages are processed out of order and never
+ *                      block, see LARGE_PACKAGE_SIZE)
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if an error occurred
+ */
+gboolean
+cr_dumper_writers_start(struct UserData *udata,
+                        long ring_len,
+                        gsize max_bytes,
+                        GError **err);
+
+/**
+ * Set the number of tasks while the writers are running. Until the count
+ * is final, the writers wait for the tasks after the current count.
+ * @param udata         user data with the started writers
+ * @param task_count    number of the tasks pushed so far
+ * @param final         no more tasks will come
+ */
+void
+cr_dumper_writers_set_task_count(struct UserData *udata,
+                                 long task_count,
+                                 gboolean final);
+
+/**
+ * Wait until the writers wrote all the tasks and free the ordered
+ * commit stage. Call it after the dumper pool is finished.
+ * @param udata         user data shared with cr_dumper_thread()
+ */
+void
+cr_dumper_writers_finish(struct UserData *udata);
+
+/**
+ * Hand the XML of a package generated outside of cr_dumper_thread()
+ * over to the ordered commit stage (e.g. by mergerepo_c). Every task ID
+ * from 0 to task_count - 1 has to be published exactly once.
+ * If filelists (other) of the res is NULL, the package is not written
+ * into the filelists (other) outputs.
+ * @param udata         user data with the started writers
+ * @param id            ID of the task (order of the package in the output)
+ * @param pkg           package for the db writers, it's not modified
+ *                      nor freed and must be valid until the writers
+ *                      are finished
+ * @param res           XML of the package, freed by the writers. If its
+ *                      primary is NULL, nothing is written for the task.
+ */
+void
+cr_dumper_publish_xml(struct UserData *udata,
+                      long id,
+                      cr_Package *pkg,
+                      struct cr_XmlStruct res);
+
+/**
+ * Build the index of the old metadata for cr_dumper_thread(). The packages
+ * are moved from the hash table of the metadata into the index, the
+ * metadata must not be freed before the index (the packages could
+ * reference the lazily loaded data of the metadata).
+ * @param md            metadata loaded by a CR_HT_KEY_HREF key
+ * @return              new index
+ */
+cr_DumperOldMd *
+cr_dumper_old_md_new(cr_Metadata *md);
+
+/**
+ * Claim the package of the location_href from the index. Thread safe
+ * and lock-free, only the first caller for the href gets the package
+ * and becomes its owner.
+ * @param old_md        index
+ * @param href          cleaned location_href (see cr_get_cleaned_href())
+ * @return              package or NULL if it's not in the index
+ *                      or it was already claimed
+ */
+cr_Package *
+cr_dumper_old_md_claim(cr_DumperOldMd *old_md, const char *href);
+
+/**
+ * Number of packages in the index which were not claimed.
+ * @param old_md        index
+ * @return              number of packages
+ */
+guint
+cr_dumper_old_md_unclaimed(cr_DumperOldMd *old_md);
+
+/**
+ * Free the index with the packages which were not claimed.
+ * @param old_md        index or NULL
+ */
+void
+cr_dumper_old_md_free(cr_DumperOldMd *old_md);
+
+/**
+ * New prefetch of the packages.
+ * @param depth         max number of tasks prefetched ahead of the tasks
+ *                      started by the workers
+ * @return              prefetch (free it by cr_dumper_prefetch_free())
+ */
+cr_DumperPrefetch *
+cr_dumper_prefetch_new(guint depth);
+
+/**
+ * Add the task pushed into the dumper pool, in the order of the pushes.
+ * The tasks could be added before and after the start.
+ * @param prefetch      prefetch
+ * @param task          task (it's copied)
+ */
+void
+cr_dumper_prefetch_add(cr_DumperPrefetch *prefetch,
+                       const struct PoolTask *task);
+
+/**
+ * No more tasks will be added, the prefetching thread ends after
+ * the last added one.
+ * @param prefetch      prefetch
+ */
+void
+cr_dumper_prefetch_close(cr_DumperPrefetch *prefetch);
+
+/**
+ * Start the prefetching thread. The tasks are prefetched in the order
+ * in which they were added (the order of the dispatch by the pool),
+ * the workers set as the prefetch of the udata report started tasks.
+ * @param prefetch      prefetch
+ */
+void
+cr_dumper_prefetch_start(cr_DumperPrefetch *prefetch);
+
+/**
+ * Stop the prefetching thread and free the prefetch.
+ * @param prefetch      prefetch or NULL
+ */
+void
+cr_dumper_prefetch_free(cr_DumperPrefetch *prefetch);
+
+/**
+ * New autoscale of the dumper pool.
+ * @param min_workers   min number of workers
+ * @param max_workers   max number of workers
+ * @param cpus          number of CPUs available to the workers
+ * @return              autoscale (free it by cr_dumper_autoscale_free())
+ */
+cr_DumperAutoscale *
+cr_dumper_autoscale_new(guint min_workers, guint max_workers, guint cpus);
+
+/**
+ * Number of workers suited to the packages finished since the previous
+ * call. Call it periodically and set the result as the max number
+ * of threads of the pool.
+ * @param autoscale     autoscale
+ * @param workers       current number of workers
+ * @return              new number of workers (the current one if there
+ *                      are not enough finished packages)
+ */
+guint
+cr_dumper_autoscale_update(cr_DumperAutoscale *autoscale, guint workers);
+
+/**
+ * Free the autoscale.
+ * @param autoscale     autoscale or NULL
+ */
+void
+cr_dumper_autoscale_free(cr_DumperAutoscale *autoscale);
+
+/**
+ * New progress reporting.
+ * @param to_stderr     print the progress to stderr
+ * @param path          status file rewritten with the progress or NULL
+ * @param metrics       metrics whose accounted memory is reported with
+ *                      the progress or NULL
+ * @param run_ctx       settings of the run the reporting thread works
+ *                      with or NULL
+ * @return              progress (free it by cr_dumper_progress_free())
+ */
+cr_DumperProgress *
+cr_dumper_progress_new(gboolean to_stderr,
+                       const char *path,
+                       cr_Metrics *metrics,
+                       cr_RunContext *run_ctx);
+
+/**
+ * Start the reporting thread.
+ * @param progress      progress
+ * @param total         number of the packages of the run
+ */
+void
+cr_dumper_progress_start(cr_DumperProgress *progress, long total);
+
+/**
+ * Change the number of the packages of a started run (e.g. while they
+ * are still being found).
+ * @param progress      progress
+ * @param total         number of the packages of the run
+ */
+void
+cr_dumper_progress_set_total(cr_DumperProgress *progress, long total);
+
+/**
+ * Stop the reporting thread, make the final report and free the progress.
+ * @param progress      progress or NULL
+ */
+void
+cr_dumper_progress_free(cr_DumperProgress *progress);
+
+/**
+ * Push the task into the dumper pool (of the cr_dumper_thread()).
+ * The pool could be shared by more runs, the task is processed with
+ * the udata of its run. The mutex_tasks and cond_tasks of the udata
+ * must be initialized.
+ * @param pool          dumper pool
+ * @param udata         user data of the run
+ * @param task          task (freed by the worker)
+ */
+void
+cr_dumper_push_task(GThreadPool *pool,
+                    struct UserData *udata,
+                    struct PoolTask *task);
+
+/**
+ * Wait until all the tasks pushed with the udata are processed.
+ * @param udata         user data of the run
+ */
+void
+cr_dumper_wait_tasks(struct UserData *udata);
+
 void
 cr_dumper_thread(gpointer data, gpointer user_data);
 
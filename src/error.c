@@ -67,6 +67,8 @@ cr_strerror(cr_Error rc)
             return "Bzip2 library related error";
         case CRE_XZ:
             return "XZ (lzma) library related error";
+        case CRE_ZSTD:
+            return "Zstd library related error";
         case CRE_OPENSSL:
             return "OpenSSL library related error";
         case CRE_CURL:
@@ -0,0 +1,222 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+#include "globset.h"
+
+/** Literal part of a pattern (not terminated when used as a lookup key).
+ */
+typedef struct {
+    const char *str;
+    gsize len;
+} Literal;
+
+/** Literals of the same kind (prefixes or suffixes) with the distinct
+ * lengths, so a string is looked up once per length.
+ */
+typedef struct {
+    GHashTable *literals;       // Literal * (owned)
+    GArray *lens;               // gsize, ascending
+} LiteralBucket;
+
+struct _cr_GlobSet {
+    GHashTable *exact;          // Patterns without wildcards
+    LiteralBucket prefixes;     // "literal*"
+    LiteralBucket suffixes;     // "*literal"
+    GPtrArray *infixes;         // "*literal*" (gchar *)
+    GSList *patterns;           // Other patterns (GPatternSpec *)
+};
+
+static guint
+literal_hash(gconstpointer key)
+{
+    const Literal *literal = key;
+    guint hash = 5381;
+
+    for (gsize x = 0; x < literal->len; x++)
+        hash = (hash << 5) + hash + (unsigned char) literal->str[x];
+
+    return hash;
+}
+
+static gboolean
+literal_equal(gconstpointer a, gconstpointer b)
+{
+    const Literal *literal_a = a, *literal_b = b;
+
+    return literal_a->len == literal_b->len
+           && !memcmp(literal_a->str, literal_b->str, literal_a->len);
+}
+
+static void
+bucket_init(LiteralBucket *bucket)
+{
+    bucket->literals = g_hash_table_new_full(literal_hash, literal_equal,
+                                             g_free, NULL);
+    bucket->lens = g_array_new(FALSE, FALSE, sizeof(gsize));
+}
+
+static void
+bucket_add(LiteralBucket *bucket, const char *str, gsize len)
+{
+    // The string is allocated together with the Literal
+    Literal *literal = g_malloc(sizeof(Literal) + len + 1);
+    char *copy = (char *) (literal + 1);
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    literal->str = copy;
+    literal->len = len;
+
+    if (g_hash_table_contains(bucket->literals, literal)) {
+        g_free(literal);
+        return;
+    }
+    g_hash_table_add(bucket->literals, literal);
+
+    guint x = 0;
+    while (x < bucket->lens->len && g_array_index(bucket->lens, gsize, x) < len)
+        x++;
+    if (x == bucket->lens->len || g_array_index(bucket->lens, gsize, x) != len)
+        g_array_insert_val(bucket->lens, x, len);
+}
+
+/** Check the literals of the bucket against the start (or the end)
+ * of the string.
+ */
+static gboolean
+bucket_match(const LiteralBucket *bucket,
+             const char *str,
+             gsize len,
+             gboolean suffix)
+{
+    for (guint x = 0; x < bucket->lens->len; x++) {
+        gsize literal_len = g_array_index(bucket->lens, gsize, x);
+        if (literal_len > len)
+            break;
+        Literal key = { suffix ? str + len - literal_len : str, literal_len };
+        if (g_hash_table_contains(bucket->literals, &key))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+bucket_clear(LiteralBucket *bucket)
+{
+    g_hash_table_destroy(bucket->literals);
+    g_array_free(bucket->lens, TRUE);
+}
+
+cr_GlobSet *
+cr_globset_new(void)
+{
+    cr_GlobSet *set = g_new0(cr_GlobSet, 1);
+
+    set->exact = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    bucket_init(&set->prefixes);
+    bucket_init(&set->suffixes);
+    set->infixes = g_ptr_array_new_with_free_func(g_free);
+    return set;
+}
+
+void
+cr_globset_add(cr_GlobSet *set, const char *pattern)
+{
+    const char *start = pattern, *end;
+
+    assert(set);
+    assert(pattern);
+
+    // Wildcards at the start and at the end
+    while (*start == '*')
+        start++;
+    end = start + strlen(start);
+    while (end > start && end[-1] == '*')
+        end--;
+
+    if (strcspn(start, "*?") < (gsize) (end - start)) {
+        // Wildcard in the middle
+        set->patterns = g_slist_prepend(set->patterns,
+                                        g_pattern_spec_new(pattern));
+        return;
+    }
+
+    gboolean any_start = start > pattern;
+    gboolean any_end = *end != '\0';
+
+    if (any_start && any_end)
+        g_ptr_array_add(set->infixes, g_strndup(start, end - start));
+    else if (any_start)
+        bucket_add(&set->suffixes, start, end - start);
+    else if (any_end)
+        bucket_add(&set->prefixes, start, end - start);
+    else
+        g_hash_table_add(set->exact, g_strdup(pattern));
+}
+
+gboolean
+cr_globset_match(const cr_GlobSet *set, const char *str)
+{
+    gsize len;
+
+    assert(str);
+
+    if (!set)
+        return FALSE;
+
+    len = strlen(str);
+
+    if (g_hash_table_contains(set->exact, str)
+        || bucket_match(&set->prefixes, str, len, FALSE)
+        || bucket_match(&set->suffixes, str, len, TRUE))
+        return TRUE;
+
+    for (guint x = 0; x < set->infixes->len; x++)
+        if (strstr(str, g_ptr_array_index(set->infixes, x)))
+            return TRUE;
+
+    if (!set->patterns)
+        return FALSE;
+
+    gboolean match = FALSE;
+    gchar *reversed = g_utf8_strreverse(str, len);
+    for (GSList *elem = set->patterns; elem && !match; elem = g_slist_next(elem))
+        match = g_pattern_match(elem->data, len, str, reversed);
+    g_free(reversed);
+
+    return match;
+}
+
+void
+cr_globset_free(cr_GlobSet *set)
+{
+    if (!set)
+        return;
+
+    g_hash_table_destroy(set->exact);
+    bucket_clear(&set->prefixes);
+    bucket_clear(&set->suffixes);
+    g_ptr_array_free(set->infixes, TRUE);
+    g_slist_free_full(set->patterns, (GDestroyNotify) g_pattern_spec_free);
+    g_free(set);
+}
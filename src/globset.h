@@ -0,0 +1,77 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_GLOBSET_H__
+#define __C_CREATEREPOLIB_GLOBSET_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+
+/** \defgroup   globset     Set of glob patterns
+ *
+ * Glob patterns (with the syntax of GPatternSpec: '*' and '?') compiled
+ * into one matcher. The patterns without wildcards, with wildcards only
+ * at the start ("*.src.rpm"), only at the end ("debug*") or only at
+ * both ends ("*-debuginfo-*") are matched by hash lookups and substring
+ * search, only the other patterns are matched one by one by
+ * g_pattern_match(). A string is matched against all the patterns
+ * in one call.
+ *
+ *  \addtogroup globset
+ *  @{
+ */
+
+/** Compiled set of glob patterns.
+ */
+typedef struct _cr_GlobSet cr_GlobSet;
+
+/** Create a new empty set.
+ * @return              New cr_GlobSet
+ */
+cr_GlobSet *cr_globset_new(void);
+
+/** Add a pattern into the set.
+ * @param set           cr_GlobSet
+ * @param pattern       Glob pattern
+ */
+void cr_globset_add(cr_GlobSet *set, const char *pattern);
+
+/** Check if the string matches any pattern of the set.
+ * This function is thread safe.
+ * @param set           cr_GlobSet or NULL (empty set)
+ * @param str           String
+ * @return              TRUE if a pattern matches the whole string
+ */
+gboolean cr_globset_match(const cr_GlobSet *set, const char *str);
+
+/** Free the set.
+ * @param set           cr_GlobSet or NULL
+ */
+void cr_globset_free(cr_GlobSet *set);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_GLOBSET_H__ */
@@ -23,6 +23,10 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "helpers.h"
 #include "error.h"
 #include "misc.h"
@@ -35,9 +39,13 @@
 
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 
+/* A file of the repodata/ directory
+ */
 typedef struct _old_file {
-    time_t mtime;
-    gchar  *path;
+    gchar    *name;         /* Basename of the file */
+    time_t   mtime;         /* Modification time (1 if stat failed) */
+    gboolean stat_failed;   /* The file couldn't be stat'ed */
+    gboolean regular;       /* The file is a regular file */
 } OldFile;
 
 
@@ -45,7 +53,7 @@ static void
 cr_free_old_file(gpointer data)
 {
     OldFile *old_file = (OldFile *) data;
-    g_free(old_file->path);
+    g_free(old_file->name);
     g_free(old_file);
 }
 
@@ -53,35 +61,73 @@ cr_free_old_file(gpointer data)
 static gint
 cr_cmp_old_repodata_files(gconstpointer a, gconstpointer b)
 {
-    if (((OldFile *) a)->mtime < ((OldFile *) b)->mtime)
+    const OldFile *file_a = *((OldFile **) a);
+    const OldFile *file_b = *((OldFile **) b);
+
+    if (file_a->mtime < file_b->mtime)
         return 1;
-    if (((OldFile *) a)->mtime > ((OldFile *) b)->mtime)
+    if (file_a->mtime > file_b->mtime)
         return -1;
     return 0;
 }
 
-static void
-cr_stat_and_insert(const gchar *dirname, const gchar *filename, GSList **list)
+/* List the files of the repodata/ directory. The directory is read and
+ * every file is stat'ed just once (relative to the directory), the listing
+ * is shared by the retention decisions and by the copying or removing
+ * of the files.
+ */
+static GPtrArray *
+cr_repodata_listing(const char *repodata_path, GError **err)
 {
-    struct stat buf;
-    OldFile *old_file;
-    gchar *path = g_strconcat(dirname, filename, NULL);
-    if (stat(path, &buf) == -1)
-        buf.st_mtime = 1;
-    old_file = g_malloc0(sizeof(OldFile));
-    old_file->mtime = buf.st_mtime;
-    old_file->path  = path;
-    *list = g_slist_insert_sorted(*list, old_file, cr_cmp_old_repodata_files);
+    DIR *dirp;
+    struct dirent *entry;
+    GPtrArray *listing;
+
+    assert(!err || *err == NULL);
+
+    dirp = opendir(repodata_path);
+    if (!dirp) {
+        g_warning("Cannot open directory: %s: %s",
+                  repodata_path, g_strerror(errno));
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open directory: %s: %s",
+                    repodata_path, g_strerror(errno));
+        return NULL;
+    }
+
+    listing = g_ptr_array_new_with_free_func(cr_free_old_file);
+
+    while ((entry = readdir(dirp))) {
+        struct stat buf;
+        OldFile *old_file;
+
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        old_file = g_malloc0(sizeof(OldFile));
+        old_file->name = g_strdup(entry->d_name);
+        if (fstatat(dirfd(dirp), entry->d_name, &buf, 0) == -1) {
+            old_file->stat_failed = TRUE;
+            old_file->mtime = 1;
+        } else {
+            old_file->mtime = buf.st_mtime;
+            old_file->regular = S_ISREG(buf.st_mode);
+        }
+        g_ptr_array_add(listing, old_file);
+    }
+
+    closedir(dirp);
+    return listing;
 }
 
-/* List files that should be removed from the repo or not copied
- * to the new repo. (except the repomd.xml)
+/* Add files that should be removed from the repo or not copied
+ * to the new repo to the excludelist. (except the repomd.xml)
  */
 static gboolean
-cr_repodata_excludelist_classic(const char *repodata_path,
-                              int retain,
-                              GSList **excludelist,
-                              GError **err)
+cr_repodata_excludelist_classic(GPtrArray *listing,
+                                int retain,
+                                GHashTable *excludelist,
+                                GError **err)
 {
     /* This piece of code implement the retain_old functionality in
      * the same way as original createrepo does.
@@ -97,28 +143,21 @@ cr_repodata_excludelist_classic(const char *repodata_path,
      * to the new repo) all files that are in the repodata/ directory
      * but are not referenced by the repomd.xml.
      *
-     * But this hack appends to the old_basenames list a metadata
+     * But this hack appends to the excludelist a metadata
      * that should be ignored (that should not be copied to the
      * new repository).
      */
 
-    GSList *pri_lst = NULL, *pri_db_lst = NULL;
-    GSList *fil_lst = NULL, *fil_db_lst = NULL;
-    GSList *oth_lst = NULL, *oth_db_lst = NULL;
-    GSList **lists[] = { &pri_lst, &pri_db_lst,
-                         &fil_lst, &fil_db_lst,
-                         &oth_lst, &oth_db_lst };
+    const char *names[] = { "primary.xml", "primary.sqlite",
+                            "filelists.xml", "filelists.sqlite",
+                            "other.xml", "other.sqlite" };
+    GPtrArray *lists[CR_ARRAYLEN(names)];
     const int num_of_lists = CR_ARRAYLEN(lists);
 
-    GDir *dirp = NULL;
-    const gchar *filename;
-    GError *tmp_err = NULL;
-
+    assert(listing);
     assert(excludelist);
     assert(!err || *err == NULL);
 
-    *excludelist = NULL;
-
     if (retain == -1) {
         // -1 means retain all - nothing to be excluded
         return TRUE;
@@ -130,71 +169,55 @@ cr_repodata_excludelist_classic(const char *repodata_path,
         return FALSE;
     }
 
-    // Open the repodata/ directory
-    dirp = g_dir_open (repodata_path, 0, &tmp_err);
-    if (!dirp) {
-        g_warning("Cannot open directory: %s: %s", repodata_path, tmp_err->message);
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot open directory: %s: %s",
-                    repodata_path, tmp_err->message);
-        g_error_free(tmp_err);
-        return FALSE;
-    }
+    for (int x = 0; x < num_of_lists; x++)
+        lists[x] = g_ptr_array_new();
+
+    // Create lists of old metadata files
+    for (guint i = 0; i < listing->len; i++) {
+        OldFile *old_file = g_ptr_array_index(listing, i);
 
-    // Create sorted (by mtime) lists of old metadata files
-    // More recent files are first
-    while ((filename = g_dir_read_name (dirp))) {
         // Get filename without suffix
         gchar *name_without_suffix;
-        gchar *lastdot = strrchr(filename, '.');
+        gchar *lastdot = strrchr(old_file->name, '.');
         if (!lastdot) continue;  // Filename doesn't contain '.'
-        name_without_suffix = g_strndup(filename, (lastdot - filename));
+        name_without_suffix = g_strndup(old_file->name,
+                                        (lastdot - old_file->name));
 
         // XXX: This detection is pretty shitty, but it mimics
         // behaviour of original createrepo
-        if (g_str_has_suffix(name_without_suffix, "primary.xml")) {
-            cr_stat_and_insert(repodata_path, filename, &pri_lst);
-        } else if (g_str_has_suffix(name_without_suffix, "primary.sqlite")) {
-            cr_stat_and_insert(repodata_path, filename, &pri_db_lst);
-        } else if (g_str_has_suffix(name_without_suffix, "filelists.xml")) {
-            cr_stat_and_insert(repodata_path, filename, &fil_lst);
-        } else if (g_str_has_suffix(name_without_suffix, "filelists.sqlite")) {
-            cr_stat_and_insert(repodata_path, filename, &fil_db_lst);
-        } else if (g_str_has_suffix(name_without_suffix, "other.xml")) {
-            cr_stat_and_insert(repodata_path, filename, &oth_lst);
-        } else if (g_str_has_suffix(name_without_suffix, "other.sqlite")) {
-            cr_stat_and_insert(repodata_path, filename, &oth_db_lst);
+        for (int x = 0; x < num_of_lists; x++) {
+            if (g_str_has_suffix(name_without_suffix, names[x])) {
+                g_ptr_array_add(lists[x], old_file);
+                break;
+            }
         }
         g_free(name_without_suffix);
     }
 
-    g_dir_close(dirp);
-    dirp = NULL;
-
-    // Append files to the excludelist
+    // Sort the lists by mtime, more recent files are first, and append
+    // the files over the retained count to the excludelist
     for (int x = 0; x < num_of_lists; x++) {
-        for (GSList *el = g_slist_nth(*(lists[x]), retain); el; el = g_slist_next(el)) {
-            OldFile *of = (OldFile *) el->data;
-            *excludelist = g_slist_prepend(*excludelist,
-                                         g_path_get_basename(of->path));
+        g_ptr_array_sort(lists[x], cr_cmp_old_repodata_files);
+        for (guint i = (guint) retain; i < lists[x]->len; i++) {
+            OldFile *old_file = g_ptr_array_index(lists[x], i);
+            g_hash_table_add(excludelist, g_strdup(old_file->name));
         }
-        // Free the list
-        cr_slist_free_full(*(lists[x]), cr_free_old_file);
+        g_ptr_array_free(lists[x], TRUE);
     }
 
     return TRUE;
 }
 
-/* List files that should be removed from the repo or not copied
- * to the new repo. (except the repomd.xml)
+/* Add files that should be removed from the repo or not copied
+ * to the new repo to the excludelist. (except the repomd.xml)
  * This function excludes all metadata files listed in repomd.xml
  * if retain == 0, otherwise it don't exclude any file
  */
 static gboolean
 cr_repodata_excludelist(const char *repodata_path,
-                      int retain,
-                      GSList **excludelist,
-                      GError **err)
+                        int retain,
+                        GHashTable *excludelist,
+                        GError **err)
 {
     gchar *old_repomd_path = NULL;
     cr_Repomd *repomd = NULL;
@@ -203,8 +226,6 @@ cr_repodata_excludelist(const char *repodata_path,
     assert(excludelist);
     assert(!err || *err == NULL);
 
-    *excludelist = NULL;
-
     if (retain == -1 || retain > 0) {
         // retain all - nothing to be excluded
         return TRUE;
@@ -229,7 +250,7 @@ cr_repodata_excludelist(const char *repodata_path,
     g_free(old_repomd_path);
 
     // Parse the old repomd.xml and append its items
-    // to the old_basenames list
+    // to the excludelist
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
         cr_RepomdRecord *rec = elem->data;
 
@@ -246,8 +267,7 @@ cr_repodata_excludelist(const char *repodata_path,
             continue;
         }
 
-        *excludelist = g_slist_prepend(*excludelist,
-                                     g_path_get_basename(rec->location_href));
+        g_hash_table_add(excludelist, g_path_get_basename(rec->location_href));
     }
 
     cr_repomd_free(repomd);
@@ -255,65 +275,45 @@ cr_repodata_excludelist(const char *repodata_path,
 }
 
 static gboolean
-cr_repodata_excludelist_by_age(const char *repodata_path,
-                             gint64 md_max_age,
-                             GSList **excludelist,
-                             GError **err)
+cr_repodata_excludelist_by_age(GPtrArray *listing,
+                               gint64 md_max_age,
+                               GHashTable *excludelist,
+                               GError **err)
 {
-    GDir *dirp = NULL;
-    const gchar *filename;
     time_t current_time;
-    GError *tmp_err = NULL;
 
+    assert(listing);
     assert(excludelist);
     assert(!err || *err == NULL);
 
-    *excludelist = NULL;
-
     if (md_max_age < 0) {
         // A negative value means retain all - nothing to be excluded
         return TRUE;
     }
 
-    // Open the repodata/ directory
-    dirp = g_dir_open (repodata_path, 0, &tmp_err);
-    if (!dirp) {
-        g_warning("Cannot open directory: %s: %s", repodata_path, tmp_err->message);
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot open directory: %s: %s",
-                    repodata_path, tmp_err->message);
-        g_error_free(tmp_err);
-        return FALSE;
-    }
-
     current_time = time(NULL);
 
-    // Create sorted (by mtime) lists of old metadata files
-    // More recent files are first
-    while ((filename = g_dir_read_name (dirp))) {
-        struct stat buf;
-        gchar *fullpath = g_strconcat(repodata_path, filename, NULL);
-        if (stat(fullpath, &buf) == -1) {
-            g_warning("Cannot stat %s", fullpath);
-            g_free(fullpath);
+    for (guint i = 0; i < listing->len; i++) {
+        OldFile *old_file = g_ptr_array_index(listing, i);
+
+        if (old_file->stat_failed) {
+            g_warning("Cannot stat %s", old_file->name);
             continue;
         }
-        g_free(fullpath);
 
         // Check file age (current_time - mtime)
-        gint64 age = difftime(current_time, buf.st_mtime);
+        gint64 age = difftime(current_time, old_file->mtime);
         if (age <= md_max_age)
             continue;  // The file is young
 
         // Debug
         g_debug("File is too old (%"G_GINT64_FORMAT" > %"G_GINT64_FORMAT") %s",
-                age, md_max_age, filename);
+                age, md_max_age, old_file->name);
 
         // Add the file to the excludelist
-        *excludelist = g_slist_prepend(*excludelist, g_strdup(filename));
+        g_hash_table_add(excludelist, g_strdup(old_file->name));
     }
 
-    g_dir_close(dirp);
     return TRUE;
 }
 
@@ -321,11 +321,9 @@ int
 cr_remove_metadata_classic(const char *repopath, int retain, GError **err)
 {
     int rc = CRE_OK;
-    gboolean ret = TRUE;
     gchar *full_repopath = NULL;
-    GSList *excludelist = NULL;
-    GDir *dirp = NULL;
-    const gchar *filename;
+    GPtrArray *listing = NULL;
+    GHashTable *excludelist = NULL;
     GError *tmp_err = NULL;
 
     assert(repopath);
@@ -333,33 +331,35 @@ cr_remove_metadata_classic(const char *repopath, int retain, GError **err)
 
     full_repopath = g_strconcat(repopath, "/repodata/", NULL);
 
-    // Get list of files that should be deleted
-    ret = cr_repodata_excludelist_classic(full_repopath, retain, &excludelist, err);
-    if (!ret)
-        return FALSE;
-
-    // Always remove repomd.xml
-    excludelist = g_slist_prepend(excludelist, g_strdup("repomd.xml"));
-
-    // Open the repodata/ directory
-    dirp = g_dir_open(full_repopath, 0, &tmp_err);
-    if (tmp_err) {
+    // List the repodata/ directory
+    listing = cr_repodata_listing(full_repopath, &tmp_err);
+    if (!listing) {
         g_debug("%s: Path %s doesn't exist", __func__, repopath);
         g_propagate_prefixed_error(err, tmp_err, "Cannot open a dir: ");
-        rc = CRE_IO;
+        g_free(full_repopath);
+        return CRE_IO;
+    }
+
+    // Get list of files that should be deleted
+    excludelist = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    if (!cr_repodata_excludelist_classic(listing, retain, excludelist, err)) {
+        rc = CRE_BADARG;
         goto cleanup;
     }
 
-    // Iterate over the files in the repository and remove all files
-    // that are listed on excludelist
-    while ((filename = g_dir_read_name(dirp))) {
+    // Always remove repomd.xml
+    g_hash_table_add(excludelist, g_strdup("repomd.xml"));
+
+    // Remove all files that are listed on excludelist
+    for (guint i = 0; i < listing->len; i++) {
+        OldFile *old_file = g_ptr_array_index(listing, i);
         gchar *full_path;
 
-        if (!g_slist_find_custom(excludelist, filename, (GCompareFunc) g_strcmp0))
+        if (!g_hash_table_contains(excludelist, old_file->name))
             // The filename is not excluded, skip it
             continue;
 
-        full_path = g_strconcat(full_repopath, filename, NULL);
+        full_path = g_strconcat(full_repopath, old_file->name, NULL);
 
         // REMOVE
         // TODO: Use more sophisticated function
@@ -373,10 +373,9 @@ cr_remove_metadata_classic(const char *repopath, int retain, GError **err)
 
 cleanup:
 
-    cr_slist_free_full(excludelist, g_free);
+    g_hash_table_destroy(excludelist);
+    g_ptr_array_free(listing, TRUE);
     g_free(full_repopath);
-    if (dirp)
-        g_dir_close(dirp);
 
     return rc;
 }
@@ -389,9 +388,8 @@ cr_old_metadata_retention(const char *old_repo,
                           GError **err)
 {
     gboolean ret = TRUE;
-    GSList *excludelist = NULL;
-    GDir *dirp = NULL;
-    const gchar *filename;
+    GPtrArray *listing = NULL;
+    GHashTable *excludelist = NULL;
     GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
@@ -401,43 +399,39 @@ cr_old_metadata_retention(const char *old_repo,
 
     g_debug("Copying files from old repository to the new one");
 
+    // List the old repo, the listing is used by all the decisions
+    listing = cr_repodata_listing(old_repo, err);
+    if (!listing)
+        return FALSE;
+
     // Get list of file that should be skiped during copying
     g_debug("Retention type: %d (%"G_GINT64_FORMAT")", type, val);
+    excludelist = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     if (type == CR_RETENTION_BYAGE)
-        ret = cr_repodata_excludelist_by_age(old_repo, val, &excludelist, err);
+        ret = cr_repodata_excludelist_by_age(listing, val, excludelist, err);
     else if (type == CR_RETENTION_COMPATIBILITY)
-        ret = cr_repodata_excludelist_classic(old_repo, (int) val, &excludelist, err);
+        ret = cr_repodata_excludelist_classic(listing, (int) val, excludelist, err);
     else // CR_RETENTION_DEFAULT
-        ret = cr_repodata_excludelist(old_repo, (int) val, &excludelist, err);
+        ret = cr_repodata_excludelist(old_repo, (int) val, excludelist, err);
 
     if (!ret)
-        return FALSE;
+        goto exit;
 
     // Never copy old repomd.xml to the new repository
-    excludelist = g_slist_prepend(excludelist, g_strdup("repomd.xml"));
-
-    // Open directory with old repo
-    dirp = g_dir_open (old_repo, 0, &tmp_err);
-    if (!dirp) {
-        g_warning("Cannot open directory: %s: %s", old_repo, tmp_err->message);
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot open directory: %s: %s",
-                    old_repo, tmp_err->message);
-        g_error_free(tmp_err);
-        ret = FALSE;
-        goto exit;
-    }
+    g_hash_table_add(excludelist, g_strdup("repomd.xml"));
 
     // Iterate over the files in the old repository and copy all
     // that are not listed on excludelist
-    while ((filename = g_dir_read_name(dirp))) {
-        if (g_slist_find_custom(excludelist, filename, (GCompareFunc) g_strcmp0)) {
-            g_debug("Excluded: %s", filename);
+    for (guint i = 0; i < listing->len; i++) {
+        OldFile *old_file = g_ptr_array_index(listing, i);
+
+        if (g_hash_table_contains(excludelist, old_file->name)) {
+            g_debug("Excluded: %s", old_file->name);
             continue;
         }
 
-        gchar *full_path = g_strconcat(old_repo, filename, NULL);
-        gchar *new_full_path = g_strconcat(new_repo, filename, NULL);
+        gchar *full_path = g_strconcat(old_repo, old_file->name, NULL);
+        gchar *new_full_path = g_strconcat(new_repo, old_file->name, NULL);
 
         // Do not override new file with the old one
         if (g_file_test(new_full_path, G_FILE_TEST_EXISTS)) {
@@ -448,6 +442,15 @@ cr_old_metadata_retention(const char *old_repo,
             continue;
         }
 
+        // The old repodata are removed after the swap, a hardlink
+        // preserves everything and doesn't copy the content
+        if (old_file->regular && link(full_path, new_full_path) == 0) {
+            g_debug("Linked %s -> %s", full_path, new_full_path);
+            g_free(full_path);
+            g_free(new_full_path);
+            continue;
+        }
+
         // COPY!
         cr_cp(full_path,
               new_full_path,
@@ -470,11 +473,8 @@ cr_old_metadata_retention(const char *old_repo,
 exit:
 
     // Cleanup
-    cr_slist_free_full(excludelist, g_free);
-    if (dirp)
-        g_dir_close(dirp);
+    g_hash_table_destroy(excludelist);
+    g_ptr_array_free(listing, TRUE);
 
     return ret;
 }
-
-
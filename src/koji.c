@@ -23,11 +23,18 @@
 #include "load_metadata.h"
 #include "misc.h"
 
+#define SRPM_ALLOWED    1
+#define SRPM_FORBIDDEN  2
+
+// Marks the end of the pkgorigins_queue
+static gchar pkgorigins_end[] = "";
+
 void
 cr_srpm_val_destroy(gpointer data)
 {
     struct srpm_val *val = data;
     g_free(val->sourcerpm);
+    cr_nevra_free(val->nevra);
     g_free(val);
 }
 
@@ -42,23 +49,56 @@ koji_stuff_destroy(struct KojiMergedReposStuff **koji_stuff_ptr)
 
     koji_stuff = *koji_stuff_ptr;
 
+    if (koji_stuff->pkgorigins_writer) {
+        // Let the writer write all the queued records
+        g_async_queue_push(koji_stuff->pkgorigins_queue, pkgorigins_end);
+        g_thread_join(koji_stuff->pkgorigins_writer);
+    }
+    g_clear_pointer (&koji_stuff->pkgorigins_queue, g_async_queue_unref);
+
     g_clear_pointer (&koji_stuff->blocked_srpms, g_hash_table_destroy);
     g_clear_pointer (&koji_stuff->include_srpms, g_hash_table_destroy);
     g_clear_pointer (&koji_stuff->seen_rpms, g_hash_table_destroy);
+    g_clear_pointer (&koji_stuff->srpm_verdicts, g_hash_table_destroy);
 
     cr_close(koji_stuff->pkgorigins, NULL);
     g_free(koji_stuff);
 }
 
 
+static gpointer
+pkgorigins_writer_thread(gpointer data)
+{
+    struct KojiMergedReposStuff *koji_stuff = data;
+    GError *tmp_err = NULL;
+    gchar *line;
+
+    while ((line = g_async_queue_pop(koji_stuff->pkgorigins_queue))
+           != pkgorigins_end)
+    {
+        if (!tmp_err)
+            cr_puts(koji_stuff->pkgorigins, line, &tmp_err);
+        g_free(line);
+    }
+
+    if (tmp_err) {
+        g_warning("Cannot write pkgorigins: %s", tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    return NULL;
+}
+
+
 static int
-pkgorigins_prepare_file (const gchar *tmpdir, CR_FILE **pkgorigins_file)
+pkgorigins_prepare_file (const gchar *tmpdir,
+                         struct KojiMergedReposStuff *koji_stuff)
 {
     gchar *pkgorigins_path = NULL;
     GError *tmp_err = NULL;
 
     pkgorigins_path = g_strconcat(tmpdir, "pkgorigins.gz", NULL);
-    *pkgorigins_file = cr_open(pkgorigins_path,
+    koji_stuff->pkgorigins = cr_open(pkgorigins_path,
                                      CR_CW_MODE_WRITE,
                                      CR_CW_GZ_COMPRESSION,
                                      &tmp_err);
@@ -70,10 +110,40 @@ pkgorigins_prepare_file (const gchar *tmpdir, CR_FILE **pkgorigins_file)
     }
     g_free(pkgorigins_path);
 
+    // The records are compressed by a writer thread while the repos
+    // are merged
+    koji_stuff->pkgorigins_queue = g_async_queue_new();
+    koji_stuff->pkgorigins_writer = g_thread_try_new("pkgorigins",
+                                                     pkgorigins_writer_thread,
+                                                     koji_stuff,
+                                                     &tmp_err);
+    if (!koji_stuff->pkgorigins_writer) {
+        // Write the records directly
+        g_debug("Cannot start pkgorigins writer: %s", tmp_err->message);
+        g_clear_error(&tmp_err);
+        g_clear_pointer(&koji_stuff->pkgorigins_queue, g_async_queue_unref);
+    }
+
     return 0;
 }
 
 
+void
+koji_pkgorigins_add(struct KojiMergedReposStuff *koji_stuff,
+                    const char *nvra,
+                    const char *url)
+{
+    if (!koji_stuff->pkgorigins)
+        return;
+
+    if (koji_stuff->pkgorigins_queue)
+        g_async_queue_push(koji_stuff->pkgorigins_queue,
+                           g_strdup_printf("%s\t%s\n", nvra, url));
+    else
+        cr_printf(NULL, koji_stuff->pkgorigins, "%s\t%s\n", nvra, url);
+}
+
+
 /* Limited version of koji_stuff_prepare() that sets up only pkgorigins */
 int
 pkgorigins_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
@@ -84,7 +154,7 @@ pkgorigins_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
         g_malloc0(sizeof(struct KojiMergedReposStuff));
 
     // Prepare pkgorigin file
-    result = pkgorigins_prepare_file (tmpdir, &koji_stuff->pkgorigins);
+    result = pkgorigins_prepare_file (tmpdir, koji_stuff);
     if (result != 0) {
         g_free (koji_stuff);
         return result;
@@ -95,6 +165,93 @@ pkgorigins_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
 }
 
 
+void
+koji_stuff_add_repo(struct KojiMergedReposStuff *koji_stuff,
+                    GHashTable *packages,
+                    int repoid,
+                    const char *original_url)
+{
+    GHashTable *include_srpms = koji_stuff->include_srpms;
+    GHashTableIter iter;
+    gpointer key, void_pkg;
+
+    // Iterate over every package in repo and what "builds"
+    // we're allowing into the repo
+    g_hash_table_iter_init(&iter, packages);
+    while (g_hash_table_iter_next(&iter, &key, &void_pkg)) {
+        cr_Package *pkg = (cr_Package *) void_pkg;
+        cr_NEVRA *nevra;
+        gpointer data;
+        struct srpm_val *srpm_value_new;
+
+        if (!pkg->rpm_sourcerpm) {
+            g_warning("Package '%s' from '%s' doesn't have specified source srpm",
+                      pkg->location_href, original_url);
+            continue;
+        }
+
+        nevra = cr_split_rpm_filename(pkg->rpm_sourcerpm);
+
+        if (!nevra) {
+            g_debug("Srpm name is invalid: %s", pkg->rpm_sourcerpm);
+            continue;
+        }
+
+        data = g_hash_table_lookup(include_srpms, nevra->name);
+        if (data) {
+            // We have already seen build with the same name
+
+            int cmp;
+            struct srpm_val *srpm_value_existing = data;
+
+            if (srpm_value_existing->repo_id != repoid) {
+                // We found a rpm built from an srpm with the same name in
+                // a previous repo. The previous repo takes precendence,
+                // so ignore the srpm found here.
+                cr_nevra_free(nevra);
+                g_debug("Srpm already loaded from previous repo %s",
+                        pkg->rpm_sourcerpm);
+                continue;
+            }
+
+            if (!g_strcmp0(pkg->rpm_sourcerpm,
+                           srpm_value_existing->sourcerpm)) {
+                // Another package built from the same srpm
+                cr_nevra_free(nevra);
+                continue;
+            }
+
+            // We're in the same repo, so compare srpm NVRs
+            if (!srpm_value_existing->nevra)
+                srpm_value_existing->nevra =
+                    cr_split_rpm_filename(srpm_value_existing->sourcerpm);
+            cmp = cr_cmp_nevra(nevra, srpm_value_existing->nevra);
+            if (cmp < 1) {
+                // Existing package is from the newer srpm
+                cr_nevra_free(nevra);
+                g_debug("Srpm already exists in newer version %s",
+                        pkg->rpm_sourcerpm);
+                continue;
+            }
+        }
+
+        // The current package we're processing is from a newer srpm
+        // than the existing srpm in the dict, so update the dict
+        // OR
+        // We found a new build so we add it to the dict
+
+        g_debug("Adding srpm: %s", pkg->rpm_sourcerpm);
+        srpm_value_new = g_malloc0(sizeof(struct srpm_val));
+        srpm_value_new->repo_id = repoid;
+        srpm_value_new->sourcerpm = g_strdup(pkg->rpm_sourcerpm);
+        srpm_value_new->nevra = nevra;
+        g_hash_table_replace(include_srpms,
+                             g_strdup(nevra->name),
+                             srpm_value_new);
+    }
+}
+
+
 int
 koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
                    struct CmdOptions *cmd_options,
@@ -105,9 +262,6 @@ koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
     int repoid;
     int result;
 
-    // Pointers to elements in the koji_stuff_ptr
-    GHashTable *include_srpms = NULL; // XXX
-
     koji_stuff = g_malloc0(sizeof(struct KojiMergedReposStuff));
     *koji_stuff_ptr = koji_stuff;
 
@@ -122,7 +276,10 @@ koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
                                                   g_str_equal,
                                                   g_free,
                                                   NULL);
-    include_srpms = koji_stuff->include_srpms;
+    koji_stuff->srpm_verdicts = g_hash_table_new_full(g_str_hash,
+                                                      g_str_equal,
+                                                      g_free,
+                                                      NULL);
 
     // Load list of blocked srpm packages
 
@@ -160,8 +317,7 @@ koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
     koji_stuff->simple = cmd_options->koji_simple;
 
     // Prepare pkgorigin file
-    result = pkgorigins_prepare_file (cmd_options->tmp_out_repo,
-                                      &koji_stuff->pkgorigins);
+    result = pkgorigins_prepare_file (cmd_options->tmp_out_repo, koji_stuff);
     if (result != 0) {
         return result;
     }
@@ -169,14 +325,13 @@ koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
 
     // Iterate over every repo and fill include_srpms hashtable
 
-    g_debug("Preparing list of allowed srpm builds");
+    if (repos)
+        g_debug("Preparing list of allowed srpm builds");
 
     repoid = 0;
     for (element = repos; element; element = g_slist_next(element)) {
-        struct cr_MetadataLocation *ml;
+        struct cr_MetadataLocation *ml, pri_ml;
         cr_Metadata *metadata;
-        GHashTableIter iter;
-        gpointer key, void_pkg;
 
         ml = (struct cr_MetadataLocation *) element->data;
         if (!ml) {
@@ -185,90 +340,68 @@ koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
             break;
         }
 
-        metadata = cr_metadata_new(CR_HT_KEY_HASH, 0, NULL);
+        // Only the sourcerpms from the primary.xml are needed
+        pri_ml = *ml;
+        pri_ml.fil_xml_href = NULL;
+        pri_ml.oth_xml_href = NULL;
+
+        metadata = cr_metadata_new(CR_HT_KEY_HASH, 1, NULL);
 
         g_debug("Loading srpms from: %s", ml->original_url);
-        if (cr_metadata_load_xml(metadata, ml, NULL) != CRE_OK) {
+        if (cr_metadata_load_xml(metadata, &pri_ml, NULL) != CRE_OK) {
             cr_metadata_free(metadata);
             g_critical("Cannot load repo: \"%s\"", ml->original_url);
             repoid++;
             break;
         }
 
-        // Iterate over every package in repo and what "builds"
-        // we're allowing into the repo
-        g_hash_table_iter_init(&iter, cr_metadata_hashtable(metadata));
-        while (g_hash_table_iter_next(&iter, &key, &void_pkg)) {
-            cr_Package *pkg = (cr_Package *) void_pkg;
-            cr_NEVRA *nevra;
-            gpointer data;
-            struct srpm_val *srpm_value_new;
-
-            if (!pkg->rpm_sourcerpm) {
-                g_warning("Package '%s' from '%s' doesn't have specified source srpm",
-                          pkg->location_href, ml->original_url);
-                continue;
-            }
+        koji_stuff_add_repo(koji_stuff, cr_metadata_hashtable(metadata),
+                            repoid, ml->original_url);
 
-            nevra = cr_split_rpm_filename(pkg->rpm_sourcerpm);
+        cr_metadata_free(metadata);
+        repoid++;
+    }
 
-            if (!nevra) {
-                g_debug("Srpm name is invalid: %s", pkg->rpm_sourcerpm);
-                continue;
-            }
 
-            data = g_hash_table_lookup(include_srpms, nevra->name);
-            if (data) {
-                // We have already seen build with the same name
-
-                int cmp;
-                cr_NEVRA *nevra_existing;
-                struct srpm_val *srpm_value_existing = data;
-
-                if (srpm_value_existing->repo_id != repoid) {
-                    // We found a rpm built from an srpm with the same name in
-                    // a previous repo. The previous repo takes precendence,
-                    // so ignore the srpm found here.
-                    cr_nevra_free(nevra);
-                    g_debug("Srpm already loaded from previous repo %s",
-                            pkg->rpm_sourcerpm);
-                    continue;
-                }
-
-                // We're in the same repo, so compare srpm NVRs
-                nevra_existing = cr_split_rpm_filename(srpm_value_existing->sourcerpm);
-                cmp = cr_cmp_nevra(nevra, nevra_existing);
-                cr_nevra_free(nevra_existing);
-                if (cmp < 1) {
-                    // Existing package is from the newer srpm
-                    cr_nevra_free(nevra);
-                    g_debug("Srpm already exists in newer version %s",
-                            pkg->rpm_sourcerpm);
-                    continue;
-                }
-            }
+    return 0;  // All ok
+}
+
+static gint
+srpm_verdict(cr_Package *pkg, struct KojiMergedReposStuff *koji_stuff)
+{
+    cr_NEVRA *nevra = cr_split_rpm_filename(pkg->rpm_sourcerpm);
+    if (!nevra) {
+        g_debug("Package %s has invalid srpm %s", pkg->name,
+                pkg->rpm_sourcerpm);
+        return SRPM_FORBIDDEN;
+    }
 
-            // The current package we're processing is from a newer srpm
-            // than the existing srpm in the dict, so update the dict
-            // OR
-            // We found a new build so we add it to the dict
-
-            g_debug("Adding srpm: %s", pkg->rpm_sourcerpm);
-            srpm_value_new = g_malloc0(sizeof(struct srpm_val));
-            srpm_value_new->repo_id = repoid;
-            srpm_value_new->sourcerpm = g_strdup(pkg->rpm_sourcerpm);
-            g_hash_table_replace(include_srpms,
-                                 g_strdup(nevra->name),
-                                 srpm_value_new);
+    if (koji_stuff->blocked_srpms) {
+        gboolean is_blocked;
+        is_blocked = g_hash_table_lookup_extended(koji_stuff->blocked_srpms, nevra->name, NULL, NULL);
+        if (is_blocked) {
+            // Srpm of the package is not allowed
+            g_debug("Package %s has blocked srpm %s", pkg->name,
+                    pkg->rpm_sourcerpm);
             cr_nevra_free(nevra);
+            return SRPM_FORBIDDEN;
         }
-
-        cr_metadata_free(metadata);
-        repoid++;
     }
 
+    if (!koji_stuff->simple && koji_stuff->include_srpms) {
+        struct srpm_val *value;
+        value = g_hash_table_lookup(koji_stuff->include_srpms, nevra->name);
+        if (!value || g_strcmp0(pkg->rpm_sourcerpm, value->sourcerpm)) {
+            // Srpm of the package is not allowed
+            g_debug("Package %s has forbidden srpm %s", pkg->name,
+                    pkg->rpm_sourcerpm);
+            cr_nevra_free(nevra);
+            return SRPM_FORBIDDEN;
+        }
+    }
+    cr_nevra_free(nevra);
 
-    return 0;  // All ok
+    return SRPM_ALLOWED;
 }
 
 gboolean
@@ -284,37 +417,21 @@ koji_allowed(cr_Package *pkg, struct KojiMergedReposStuff *koji_stuff)
         // Original mergerepos script doesn't expect such situation.
         // So for now, include them. But it can be changed anytime
         // in future.
-        cr_NEVRA *nevra = cr_split_rpm_filename(pkg->rpm_sourcerpm);
-        if (!nevra) {
-            g_debug("Package %s has invalid srpm %s", pkg->name,
-                    pkg->rpm_sourcerpm);
-            return 0;
+        gint verdict = 0;
+        if (koji_stuff->srpm_verdicts)
+            verdict = GPOINTER_TO_INT(g_hash_table_lookup(
+                            koji_stuff->srpm_verdicts, pkg->rpm_sourcerpm));
+        if (!verdict) {
+            verdict = srpm_verdict(pkg, koji_stuff);
+            // The include_srpms of the srpm name don't change after its
+            // first repo is added, the result could be reused
+            if (koji_stuff->srpm_verdicts)
+                g_hash_table_replace(koji_stuff->srpm_verdicts,
+                                     g_strdup(pkg->rpm_sourcerpm),
+                                     GINT_TO_POINTER(verdict));
         }
-
-        if (koji_stuff->blocked_srpms) {
-            gboolean is_blocked;
-            is_blocked = g_hash_table_lookup_extended(koji_stuff->blocked_srpms, nevra->name, NULL, NULL);
-            if (is_blocked) {
-                // Srpm of the package is not allowed
-                g_debug("Package %s has blocked srpm %s", pkg->name,
-                        pkg->rpm_sourcerpm);
-                cr_nevra_free(nevra);
-                return 0;
-            }
-        }
-
-        if (!koji_stuff->simple && koji_stuff->include_srpms) {
-            struct srpm_val *value;
-            value = g_hash_table_lookup(koji_stuff->include_srpms, nevra->name);
-            if (!value || g_strcmp0(pkg->rpm_sourcerpm, value->sourcerpm)) {
-                // Srpm of the package is not allowed
-                g_debug("Package %s has forbidden srpm %s", pkg->name,
-                        pkg->rpm_sourcerpm);
-                cr_nevra_free(nevra);
-                return 0;
-            }
-        }
-        cr_nevra_free(nevra);
+        if (verdict != SRPM_ALLOWED)
+            return 0;
     }
 
     if (!koji_stuff->simple && koji_stuff->seen_rpms) {
@@ -27,6 +27,7 @@ extern "C" {
 
 #include "package.h"
 #include "mergerepo_c.h"
+#include "misc.h"
 
 // struct KojiMergedReposStuff
 // contains information needed to simulate sort_and_filter() method from
@@ -55,6 +56,8 @@ extern "C" {
 struct srpm_val {
     int repo_id;        // id of repository
     char *sourcerpm;    // pkg->rpm_sourcerpm
+    cr_NEVRA *nevra;    // sourcerpm split by cr_split_rpm_filename(),
+                        // filled on demand (could be NULL)
 };
 
 struct KojiMergedReposStuff {
@@ -75,8 +78,17 @@ struct KojiMergedReposStuff {
     // Purpose of this list is to avoid a duplicit packages in output.
     //   Key: string with package n-v-r.a
     //   Value: NULL (not important)
+    GHashTable *srpm_verdicts;
+    // srpm_verdicts:
+    // Results of the srpm checks of koji_allowed(), the srpm of the most
+    // packages is shared with other packages.
+    //   Key: pkg->rpm_sourcerpm
+    //   Value: GINT_TO_POINTER(SRPM_ALLOWED or SRPM_FORBIDDEN)
     CR_FILE *pkgorigins;
     // Every element has format: pkg_nvra\trepourl
+    GAsyncQueue *pkgorigins_queue;
+    // Lines waiting to be written into the pkgorigins by pkgorigins_writer
+    GThread *pkgorigins_writer;
     gboolean simple;
 };
 
@@ -85,11 +97,27 @@ int
 pkgorigins_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
                    const gchar *tmpdir);
 
+/* If repos is NULL, the include_srpms are not filled and every merged repo
+ * has to be passed to koji_stuff_add_repo() (in the order of the repos)
+ * before its packages are checked by koji_allowed() */
 int
 koji_stuff_prepare(struct KojiMergedReposStuff **koji_stuff_ptr,
                    struct CmdOptions *cmd_options,
                    GSList *repos);
 
+/* Add srpms of the already loaded packages of a repo into include_srpms */
+void
+koji_stuff_add_repo(struct KojiMergedReposStuff *koji_stuff,
+                    GHashTable *packages,
+                    int repoid,
+                    const char *original_url);
+
+/* Queue a pkgorigins record, it is written by the writer thread */
+void
+koji_pkgorigins_add(struct KojiMergedReposStuff *koji_stuff,
+                    const char *nvra,
+                    const char *url);
+
 void
 koji_stuff_destroy(struct KojiMergedReposStuff **koji_stuff_ptr);
 
@@ -18,26 +18,42 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 #ifdef WITH_LIBMODULEMD
 #include <modulemd.h>
 #endif /* WITH_LIBMODULEMD */
 
+#include "compression_wrapper.h"
 #include "error.h"
 #include "package.h"
 #include "misc.h"
 #include "load_metadata.h"
 #include "locate_metadata.h"
+#include "metadata_internal.h"
+#include "pkgtable.h"
 #include "xml_parser.h"
+#include "xml_parser_internal.h"
 
 #define ERR_DOMAIN              CREATEREPO_C_ERROR
 #define STRINGCHUNK_SIZE        16384
 
+/** Bytes read from the start of an xml to find its number of packages.
+ */
+#define PACKAGES_HINT_READ      4096
+
+/** Bigger numbers of packages are not trusted for the sizing of tables
+ * in advance, the tables still grow as needed.
+ */
+#define PACKAGES_HINT_MAX       (1 << 22)
+
 /** Structure for loaded metadata
  */
 struct _cr_Metadata {
@@ -47,6 +63,14 @@ struct _cr_Metadata {
     GHashTable *pkglist_ht; /*!< list of allowed package basenames to load */
     cr_HashTableKeyDupAction dupaction; /*!<
         How to behave in case of duplicated items */
+    gboolean store_raw;     /*!< store raw xml of packages */
+    gboolean lazy;          /*!< parse files and changelogs on demand */
+    gint parser_threads;    /*!< threads parsing the filelists.xml */
+    gboolean fast_parser;   /*!< scan the filelists.xml without libxml2 */
+    gboolean intern;        /*!< share repeated strings in the chunk */
+    gboolean spool_raw;     /*!< keep the lazy raw xml in temporary files */
+    GSList *chunks;         /*!< additional string chunks with strings
+                                 of packages (used with the chunk) */
 
 #ifdef WITH_LIBMODULEMD
     ModulemdModuleIndex *moduleindex; /*!< Module metadata */
@@ -146,6 +170,7 @@ cr_metadata_free(cr_Metadata *md)
     cr_destroy_metadata_hashtable(md->ht);
     if (md->chunk)
         g_string_chunk_free(md->chunk);
+    g_slist_free_full(md->chunks, (GDestroyNotify) g_string_chunk_free);
     if (md->pkglist_ht)
         g_hash_table_destroy(md->pkglist_ht);
     g_free(md);
@@ -160,6 +185,372 @@ cr_metadata_set_dupaction(cr_Metadata *md, cr_HashTableKeyDupAction dupaction)
     return TRUE;
 }
 
+gboolean
+cr_metadata_set_store_raw(cr_Metadata *md, gboolean store_raw)
+{
+    if (!md)
+        return FALSE;
+    md->store_raw = store_raw;
+    return TRUE;
+}
+
+gboolean
+cr_metadata_set_lazy(cr_Metadata *md, gboolean lazy)
+{
+    if (!md)
+        return FALSE;
+    md->lazy = lazy;
+    return TRUE;
+}
+
+gboolean
+cr_metadata_set_spool_raw(cr_Metadata *md, gboolean spool_raw)
+{
+    if (!md)
+        return FALSE;
+    md->spool_raw = spool_raw;
+    return TRUE;
+}
+
+gboolean
+cr_metadata_set_parser_threads(cr_Metadata *md, gint threads)
+{
+    if (!md || threads < 0)
+        return FALSE;
+    md->parser_threads = threads;
+    return TRUE;
+}
+
+gboolean
+cr_metadata_set_fast_parser(cr_Metadata *md, gboolean fast_parser)
+{
+    if (!md)
+        return FALSE;
+    md->fast_parser = fast_parser;
+    return TRUE;
+}
+
+gboolean
+cr_metadata_set_intern_strings(cr_Metadata *md, gboolean intern)
+{
+    if (!md)
+        return FALSE;
+    md->intern = intern;
+    return TRUE;
+}
+
+GSList *
+cr_metadata_steal_chunks(cr_Metadata *md)
+{
+    GSList *chunks;
+
+    if (!md || !md->chunk)
+        return NULL;
+
+    chunks = g_slist_prepend(md->chunks, md->chunk);
+    md->chunk = NULL;
+    md->chunks = NULL;
+    return chunks;
+}
+
+/** Create an unlinked temporary file for the raw xml.
+ * @return      cr_SpoolFile or NULL if the file cannot be created
+ */
+static cr_SpoolFile *
+spool_file_new(void)
+{
+    cr_SpoolFile *file;
+    gchar *path = NULL;
+    GError *tmp_err = NULL;
+    int fd = g_file_open_tmp("createrepo_c_spool_XXXXXX", &path, &tmp_err);
+
+    if (fd == -1) {
+        g_debug("%s: Cannot create a temporary file, the raw xml stays "
+                "in memory: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        return NULL;
+    }
+
+    // The file disappears with its last descriptor
+    g_unlink(path);
+    g_free(path);
+
+    file = g_new0(cr_SpoolFile, 1);
+    file->fd = fd;
+    file->refs = 1;
+    return file;
+}
+
+static cr_SpoolFile *
+spool_file_ref(cr_SpoolFile *file)
+{
+    if (file)
+        g_atomic_int_inc(&file->refs);
+    return file;
+}
+
+static void
+spool_file_unref(cr_SpoolFile *file)
+{
+    if (!file || !g_atomic_int_dec_and_test(&file->refs))
+        return;
+    close(file->fd);
+    g_free(file);
+}
+
+void
+cr_package_spool_free(cr_PackageSpool *spool)
+{
+    if (!spool)
+        return;
+    spool_file_unref(spool->fil);
+    spool_file_unref(spool->oth);
+    g_free(spool);
+}
+
+/** Append the raw xml to the spool file.
+ * @return      Offset of the raw xml or -1 on error
+ */
+static gint64
+spool_file_write(cr_SpoolFile *file, gint64 *size, const char *raw, gsize len)
+{
+    gint64 offset = *size;
+
+    for (gsize written = 0; written < len;) {
+        ssize_t ret = write(file->fd, raw + written, len - written);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        written += ret;
+    }
+
+    *size += len;
+    return offset;
+}
+
+/** Read the raw xml back from the spool file into the chunk.
+ */
+static char *
+spool_file_read(cr_SpoolFile *file,
+                gint64 offset,
+                gsize len,
+                GStringChunk *chunk,
+                GError **err)
+{
+    char *buf = g_malloc(len + 1);
+    char *raw;
+
+    for (gsize done = 0; done < len;) {
+        ssize_t ret = pread(file->fd, buf + done, len - done, offset + done);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Cannot read the raw xml from a temporary file: %s",
+                        ret ? g_strerror(errno) : "Unexpected end of file");
+            g_free(buf);
+            return NULL;
+        }
+        done += ret;
+    }
+
+    buf[len] = '\0';
+    raw = g_string_chunk_insert_len(chunk, buf, len);
+    g_free(buf);
+    return raw;
+}
+
+/** Make sure the package has its own chunk for new strings.
+ * @param pkg           package
+ * @param xml_len       size of the XML whose strings go to the chunk
+ */
+static void
+lazy_own_chunk(cr_Package *pkg, gsize xml_len)
+{
+    if (!pkg->chunk) {
+        // The package uses the single chunk of the cr_Metadata which must
+        // not be modified (other packages could be loaded by other threads
+        // at the same time), the new strings go to its own chunk
+        pkg->chunk = g_string_chunk_new(cr_package_chunk_size(xml_len));
+        pkg->loadingflags &= ~(CR_PACKAGE_SINGLE_CHUNK | CR_PACKAGE_INTERNED);
+    }
+}
+
+gboolean
+cr_metadata_load_spooled_raw(cr_Package *pkg, GError **err)
+{
+    cr_PackageSpool *spool;
+
+    assert(pkg);
+    assert(!err || *err == NULL);
+
+    spool = pkg->spool;
+    if (!spool)
+        return TRUE;
+
+    // The raw XML is copied into the chunk and parsed into it later
+    lazy_own_chunk(pkg, 3 * ((spool->fil ? spool->fil_len : 0)
+                             + (spool->oth ? spool->oth_len : 0)));
+
+    if (spool->fil) {
+        char *raw = spool_file_read(spool->fil, spool->fil_offset,
+                                    spool->fil_len, pkg->chunk, err);
+        if (!raw)
+            return FALSE;
+        pkg->raw_filelists = raw;
+        spool_file_unref(spool->fil);
+        spool->fil = NULL;
+    }
+
+    if (spool->oth) {
+        char *raw = spool_file_read(spool->oth, spool->oth_offset,
+                                    spool->oth_len, pkg->chunk, err);
+        if (!raw)
+            return FALSE;
+        pkg->raw_other = raw;
+        spool_file_unref(spool->oth);
+        spool->oth = NULL;
+    }
+
+    cr_package_spool_free(spool);
+    pkg->spool = NULL;
+    return TRUE;
+}
+
+static int
+lazy_newpkgcb(cr_Package **pkg,
+              G_GNUC_UNUSED const char *pkgId,
+              G_GNUC_UNUSED const char *name,
+              G_GNUC_UNUSED const char *arch,
+              void *cbdata,
+              G_GNUC_UNUSED GError **err)
+{
+    *pkg = cbdata;
+    return CR_CB_RET_OK;
+}
+
+gboolean
+cr_metadata_load_lazy_data(cr_Package *pkg, GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(pkg);
+    assert(!err || *err == NULL);
+
+    if (!(pkg->loadingflags & (CR_PACKAGE_LAZY_FIL | CR_PACKAGE_LAZY_OTH)))
+        return TRUE;
+
+    if (!cr_metadata_load_spooled_raw(pkg, err))
+        return FALSE;
+
+    if (!pkg->chunk) {
+        gsize xml_len = 0;
+        if ((pkg->loadingflags & CR_PACKAGE_LAZY_FIL) && pkg->raw_filelists)
+            xml_len += strlen(pkg->raw_filelists);
+        if ((pkg->loadingflags & CR_PACKAGE_LAZY_OTH) && pkg->raw_other)
+            xml_len += strlen(pkg->raw_other);
+        lazy_own_chunk(pkg, xml_len);
+    }
+
+    if (pkg->loadingflags & CR_PACKAGE_LAZY_FIL) {
+        cr_xml_parse_filelists_snippet(pkg->raw_filelists, lazy_newpkgcb, pkg,
+                                       NULL, NULL, NULL, NULL, &tmp_err);
+        if (tmp_err) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot parse files of %s: ",
+                                       pkg->name);
+            return FALSE;
+        }
+        pkg->loadingflags &= ~CR_PACKAGE_LAZY_FIL;
+    }
+
+    if (pkg->loadingflags & CR_PACKAGE_LAZY_OTH) {
+        cr_xml_parse_other_snippet(pkg->raw_other, lazy_newpkgcb, pkg,
+                                   NULL, NULL, NULL, NULL, &tmp_err);
+        if (tmp_err) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot parse changelogs of %s: ",
+                                       pkg->name);
+            return FALSE;
+        }
+        pkg->loadingflags &= ~CR_PACKAGE_LAZY_OTH;
+    }
+
+    return TRUE;
+}
+
+/** pkgIds of the packages from primary.xml which are not loaded.
+ * The parsers of filelists.xml and other.xml, which run concurrently
+ * with the primary.xml parser, skip the packages already known to be
+ * dropped instead of parsing them only to be thrown away by the merge.
+ */
+typedef struct {
+    GMutex mutex;
+    GHashTable *pkgIds;     /*!< pkgId -> DROPPED_PKG or DROPPED_SKIPPED */
+    gboolean conflict;      /*!< A skipped pkgId was loaded afterwards */
+} cr_DroppedPkgs;
+
+#define DROPPED_PKG         GINT_TO_POINTER(1)
+#define DROPPED_SKIPPED     GINT_TO_POINTER(2)
+
+static void
+dropped_pkgs_init(cr_DroppedPkgs *dropped)
+{
+    g_mutex_init(&dropped->mutex);
+    dropped->pkgIds = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, NULL);
+    dropped->conflict = FALSE;
+}
+
+static void
+dropped_pkgs_clear(cr_DroppedPkgs *dropped)
+{
+    g_hash_table_destroy(dropped->pkgIds);
+    g_mutex_clear(&dropped->mutex);
+}
+
+/** The package with the pkgId was not loaded from primary.xml */
+static void
+dropped_pkgs_add(cr_DroppedPkgs *dropped, const char *pkgId)
+{
+    g_mutex_lock(&dropped->mutex);
+    if (!g_hash_table_contains(dropped->pkgIds, pkgId))
+        g_hash_table_insert(dropped->pkgIds, g_strdup(pkgId), DROPPED_PKG);
+    g_mutex_unlock(&dropped->mutex);
+}
+
+/** The package with the pkgId was loaded from primary.xml, another
+ * package with the same pkgId could be dropped before.
+ */
+static void
+dropped_pkgs_remove(cr_DroppedPkgs *dropped, const char *pkgId)
+{
+    g_mutex_lock(&dropped->mutex);
+    if (g_hash_table_lookup(dropped->pkgIds, pkgId) == DROPPED_SKIPPED)
+        dropped->conflict = TRUE;
+    g_hash_table_remove(dropped->pkgIds, pkgId);
+    g_mutex_unlock(&dropped->mutex);
+}
+
+/** Check if the package should be skipped by a parser.
+ * @return              TRUE if the package was dropped
+ */
+static gboolean
+dropped_pkgs_skip(cr_DroppedPkgs *dropped, const char *pkgId)
+{
+    gboolean skip;
+
+    g_mutex_lock(&dropped->mutex);
+    skip = g_hash_table_contains(dropped->pkgIds, pkgId);
+    if (skip)
+        g_hash_table_insert(dropped->pkgIds, g_strdup(pkgId), DROPPED_SKIPPED);
+    g_mutex_unlock(&dropped->mutex);
+
+    return skip;
+}
+
 // Callbacks for XML parsers
 
 typedef enum {
@@ -169,8 +560,9 @@ typedef enum {
 } cr_ParsingState;
 
 typedef struct {
-    GHashTable      *ht;
+    cr_PkgTable     *table; /*!< Packages by pkgId */
     GStringChunk    *chunk;
+    gboolean        intern; /*!< Share repeated strings in the chunk */
     GHashTable      *pkglist_ht;
     GHashTable      *ignored_pkgIds; /*!< If there are multiple packages
         which have the same checksum (pkgId) but they are in fact different
@@ -180,6 +572,7 @@ typedef struct {
         primary.xml with metadata from filelists.xml and other.xml and
         we want the pkgId to be unique.
         Key is pkgId and value is NULL. */
+    cr_DroppedPkgs  *dropped; /*!< NULL or pkgIds of dropped packages */
     cr_ParsingState state;
     gint64          pkgKey; /*!< basically order of the package */
 } cr_CbData;
@@ -200,6 +593,8 @@ primary_newpkgcb(cr_Package **pkg,
         *pkg = cr_package_new_without_chunk();
         (*pkg)->chunk = cb_data->chunk;
         (*pkg)->loadingflags |= CR_PACKAGE_SINGLE_CHUNK;
+        if (cb_data->intern)
+            (*pkg)->loadingflags |= CR_PACKAGE_INTERNED;
     } else {
         *pkg = cr_package_new();
     }
@@ -241,18 +636,23 @@ primary_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
     }
 
     if (!store_pkg) {
+        // Another package with the pkgId can be already loaded
+        if (cb_data->dropped && !cr_pkgtable_lookup(cb_data->table, pkg->pkgId))
+            dropped_pkgs_add(cb_data->dropped, pkg->pkgId);
         // Drop the currently loaded package
         cr_package_free(pkg);
         return CR_CB_RET_OK;
     }
 
-    epkg = g_hash_table_lookup(cb_data->ht, pkg->pkgId);
+    epkg = cr_pkgtable_lookup(cb_data->table, pkg->pkgId);
 
     if (!epkg) {
         // Store package into the hashtable
         pkg->loadingflags |= CR_PACKAGE_FROM_XML;
         pkg->loadingflags |= CR_PACKAGE_LOADED_PRI;
-        g_hash_table_replace(cb_data->ht, pkg->pkgId, pkg);
+        cr_pkgtable_insert(cb_data->table, pkg->pkgId, pkg);
+        if (cb_data->dropped)
+            dropped_pkgs_remove(cb_data->dropped, pkg->pkgId);
     } else {
         // Package with the same pkgId (hash) already exists
         if (epkg->time_file == pkg->time_file
@@ -274,8 +674,10 @@ primary_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
             g_debug("Multiple different packages (basename, mtime or size "
                     "doesn't match) with the same checksum: %s. "
                     "Ignoring all packages with the checksum.", pkg->pkgId);
-            g_hash_table_remove(cb_data->ht, pkg->pkgId);
+            cr_pkgtable_remove(cb_data->table, pkg->pkgId);
             g_hash_table_replace(cb_data->ignored_pkgIds, g_strdup(pkg->pkgId), NULL);
+            if (cb_data->dropped)
+                dropped_pkgs_add(cb_data->dropped, pkg->pkgId);
         }
 
         // Drop the currently loaded package
@@ -289,150 +691,508 @@ primary_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
     return CR_CB_RET_OK;
 }
 
+/** Data of a thread which parses filelists.xml or other.xml.
+ * The packages are parsed into a separate table (key is pkgId)
+ * and merged with the packages from primary.xml when all parsers finish.
+ */
+typedef struct {
+    cr_ParsingState state;  /*!< PARSING_FIL or PARSING_OTH */
+    const char *path;       /*!< Path to the xml file */
+    cr_PkgTable *table;     /*!< Parsed packages */
+    GStringChunk *chunk;    /*!< NULL or string chunk for all packages */
+    gboolean intern;        /*!< Share repeated strings in the chunk */
+    gboolean store_raw;     /*!< Store raw xml of packages */
+    gboolean lazy;          /*!< Store only raw xml of packages */
+    gint threads;           /*!< Threads parsing the filelists.xml */
+    gboolean fast;          /*!< Use the fast filelists.xml scanner */
+    cr_SpoolFile *spool;    /*!< NULL or file for the raw xml of packages,
+                                 the packages are not kept then */
+    gint64 spool_size;      /*!< Bytes written to the spool */
+    GHashTable *spooled;    /*!< pkgId -> cr_SpoolPos of spooled packages */
+    cr_Package *pkg;        /*!< Package parsed into the spool */
+    cr_DroppedPkgs *dropped;/*!< NULL or packages which are not parsed */
+    GError *err;            /*!< Error encountered during parsing */
+} cr_ParserThreadData;
+
+/** Position of the raw xml of a package in the spool file.
+ */
+typedef struct {
+    gint64 offset;
+    gsize len;
+} cr_SpoolPos;
+
 static int
-newpkgcb(cr_Package **pkg,
-         const char *pkgId,
-         G_GNUC_UNUSED const char *name,
-         G_GNUC_UNUSED const char *arch,
-         void *cbdata,
-         G_GNUC_UNUSED GError **err)
+parser_thread_newpkgcb(cr_Package **pkg,
+                       const char *pkgId,
+                       G_GNUC_UNUSED const char *name,
+                       G_GNUC_UNUSED const char *arch,
+                       void *cbdata,
+                       G_GNUC_UNUSED GError **err)
 {
-    cr_CbData *cb_data = cbdata;
+    cr_ParserThreadData *td = cbdata;
 
     assert(*pkg == NULL);
     assert(pkgId);
 
-    *pkg = g_hash_table_lookup(cb_data->ht, pkgId);
-
-    if (*pkg) {
-        // If package with the pkgId was parsed from primary.xml, then...
+    if (td->dropped && dropped_pkgs_skip(td->dropped, pkgId))
+        // The package is not loaded from primary.xml
+        return CR_CB_RET_OK;
 
-        if (cb_data->state == PARSING_FIL) {
-            if ((*pkg)->loadingflags & CR_PACKAGE_LOADED_FIL) {
-                // For package with this checksum, the filelist was
-                // already loaded.
-                *pkg = NULL;
-            } else {
-                // Make a note that filelist is parsed
-                (*pkg)->loadingflags |= CR_PACKAGE_LOADED_FIL;
-            }
-        }
+    if (cr_pkgtable_lookup(td->table, pkgId)
+        || (td->spooled && g_hash_table_lookup(td->spooled, pkgId)))
+        // Data for the package with the same checksum were already loaded
+        return CR_CB_RET_OK;
 
-        if (cb_data->state == PARSING_OTH) {
-            if ((*pkg)->loadingflags & CR_PACKAGE_LOADED_OTH) {
-                // For package with this checksum, the other (changelogs) were
-                // already loaded.
-                *pkg = NULL;
-            } else {
-                // Make a note that other is parsed
-                (*pkg)->loadingflags |= CR_PACKAGE_LOADED_OTH;
-            }
-        }
+    if (td->spool) {
+        // Only the raw xml is kept, the package is freed by the pkgcb
+        *pkg = cr_package_new();
+        (*pkg)->pkgId = g_string_chunk_insert((*pkg)->chunk, pkgId);
+        td->pkg = *pkg;
+        return CR_CB_RET_OK;
+    }
 
-        if (*pkg && cb_data->chunk) {
-            assert(!(*pkg)->chunk);
-            (*pkg)->chunk = cb_data->chunk;
-        }
+    if (td->chunk) {
+        *pkg = cr_package_new_without_chunk();
+        (*pkg)->chunk = td->chunk;
+        (*pkg)->loadingflags |= CR_PACKAGE_SINGLE_CHUNK;
+        if (td->intern)
+            (*pkg)->loadingflags |= CR_PACKAGE_INTERNED;
+    } else {
+        *pkg = cr_package_new();
     }
 
+    // The table owns the package since now
+    (*pkg)->pkgId = g_string_chunk_insert((*pkg)->chunk, pkgId);
+    cr_pkgtable_insert(td->table, (*pkg)->pkgId, *pkg);
+
     return CR_CB_RET_OK;
 }
 
 static int
-pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
+parser_thread_pkgcb(cr_Package *pkg, void *cbdata, GError **err)
 {
-    cr_CbData *cb_data = cbdata;
+    cr_ParserThreadData *td = cbdata;
+    const char *raw;
+    cr_SpoolPos *pos;
+    gint64 offset;
 
-    if (cb_data->chunk) {
-        assert(pkg->chunk == cb_data->chunk);
-        pkg->chunk = NULL;
+    if (pkg != td->pkg)
+        // Not a spooled package
+        return CR_CB_RET_OK;
+
+    td->pkg = NULL;
+    raw = (td->state == PARSING_FIL) ? pkg->raw_filelists : pkg->raw_other;
+    if (!raw) {
+        g_debug("%s: No raw xml of %s", __func__, pkg->pkgId);
+        cr_package_free(pkg);
+        return CR_CB_RET_OK;
+    }
+
+    offset = spool_file_write(td->spool, &td->spool_size, raw, strlen(raw));
+    if (offset < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write the raw xml into a temporary file: %s",
+                    g_strerror(errno));
+        cr_package_free(pkg);
+        return CR_CB_RET_ERR;
     }
 
+    pos = g_new(cr_SpoolPos, 1);
+    pos->offset = offset;
+    pos->len = strlen(raw);
+    g_hash_table_replace(td->spooled, g_strdup(pkg->pkgId), pos);
+    cr_package_free(pkg);
+
     return CR_CB_RET_OK;
 }
 
+static gpointer
+parser_thread(gpointer data)
+{
+    cr_ParserThreadData *td = data;
+    cr_XmlParserPkgCb pkgcb = td->spool ? parser_thread_pkgcb : NULL;
+
+    if (td->state == PARSING_FIL && td->threads > 1
+        && !td->store_raw && !td->lazy)
+        // The raw xml is not stored by the threaded parser
+        cr_xml_parse_filelists_threaded(td->path,
+                                        parser_thread_newpkgcb,
+                                        td,
+                                        NULL,
+                                        NULL,
+                                        cr_warning_cb,
+                                        "Filelists XML parser",
+                                        td->threads,
+                                        &td->err);
+    else if (td->state == PARSING_FIL && td->fast
+             && !td->store_raw && !td->lazy)
+        cr_xml_parse_filelists_fast(td->path,
+                                    parser_thread_newpkgcb,
+                                    td,
+                                    NULL,
+                                    NULL,
+                                    cr_warning_cb,
+                                    "Filelists XML parser",
+                                    &td->err);
+    else if (td->state == PARSING_FIL)
+        cr_xml_parse_filelists_internal(td->path,
+                                        parser_thread_newpkgcb,
+                                        td,
+                                        pkgcb,
+                                        td,
+                                        cr_warning_cb,
+                                        "Filelists XML parser",
+                                        td->store_raw,
+                                        td->lazy,
+                                        &cr_xml_parser_generic,
+                                        &td->err);
+    else
+        cr_xml_parse_other_internal(td->path,
+                                    parser_thread_newpkgcb,
+                                    td,
+                                    pkgcb,
+                                    td,
+                                    cr_warning_cb,
+                                    "Other XML parser",
+                                    td->store_raw,
+                                    td->lazy,
+                                    &cr_xml_parser_generic,
+                                    &td->err);
+
+    // The package interrupted by an error
+    g_clear_pointer(&td->pkg, cr_package_free);
+
+    return NULL;
+}
+
+/** Start parsing of the filelists.xml or other.xml in a new thread.
+ * If the thread cannot be created, the xml is parsed right away.
+ */
+static GThread *
+parser_thread_start(cr_ParserThreadData *td,
+                    cr_ParsingState state,
+                    const char *path,
+                    GStringChunk *chunk,
+                    gboolean intern,
+                    gboolean store_raw,
+                    gboolean lazy,
+                    gboolean spool_raw,
+                    gint threads,
+                    gboolean fast,
+                    guint packages,
+                    cr_DroppedPkgs *dropped)
+{
+    GThread *thread;
+    GError *tmp_err = NULL;
+
+    td->state       = state;
+    td->path        = path;
+    td->table       = cr_pkgtable_new(packages);
+    // GStringChunk is not thread safe - every parser uses its own
+    td->chunk       = chunk ? g_string_chunk_new(STRINGCHUNK_SIZE) : NULL;
+    td->intern      = intern;
+    td->store_raw   = store_raw;
+    td->lazy        = lazy;
+    td->threads     = threads;
+    td->fast        = fast;
+    // Raw xml of the lazily loaded packages goes to a temporary file,
+    // only the packages which are really used read it back
+    td->spool       = (lazy && store_raw && spool_raw) ? spool_file_new() : NULL;
+    td->spool_size  = 0;
+    td->spooled     = td->spool ? g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                        g_free, g_free)
+                                : NULL;
+    td->pkg         = NULL;
+    td->dropped     = dropped;
+    td->err         = NULL;
+
+    thread = g_thread_try_new(NULL, parser_thread, td, &tmp_err);
+    if (!thread) {
+        g_debug("%s: Cannot create a parser thread: %s",
+                __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+        parser_thread(td);
+    }
+
+    return thread;
+}
+
+/** Free the data of a finished parser thread.
+ */
+static void
+parser_thread_clear(cr_ParserThreadData *td, GSList **chunks)
+{
+    g_clear_error(&td->err);
+    cr_pkgtable_free(td->table, TRUE);
+    td->table = NULL;
+    if (td->spooled)
+        g_hash_table_destroy(td->spooled);
+    spool_file_unref(td->spool);
+    if (td->chunk)
+        *chunks = g_slist_prepend(*chunks, td->chunk);
+}
+
+/** Move files or changelogs parsed by a parser thread into the packages
+ * from primary.xml.
+ */
+static void
+parser_thread_merge(cr_PkgTable *table, cr_ParserThreadData *td)
+{
+    cr_PkgTableIter iter;
+    const char *key;
+    cr_Package *pkg;
+    guint hash;
+
+    cr_pkgtable_iter_init(&iter, table);
+    while (cr_pkgtable_iter_next(&iter, &key, &pkg, &hash)) {
+        cr_Package *tpkg;
+        cr_SpoolPos *pos = td->spooled
+                           ? g_hash_table_lookup(td->spooled, pkg->pkgId)
+                           : NULL;
+
+        if (pos) {
+            if (!pkg->spool)
+                pkg->spool = g_new0(cr_PackageSpool, 1);
+            if (td->state == PARSING_FIL) {
+                pkg->loadingflags |= CR_PACKAGE_LOADED_FIL | CR_PACKAGE_LAZY_FIL;
+                pkg->spool->fil = spool_file_ref(td->spool);
+                pkg->spool->fil_offset = pos->offset;
+                pkg->spool->fil_len = pos->len;
+            } else {
+                pkg->loadingflags |= CR_PACKAGE_LOADED_OTH | CR_PACKAGE_LAZY_OTH;
+                pkg->spool->oth = spool_file_ref(td->spool);
+                pkg->spool->oth_offset = pos->offset;
+                pkg->spool->oth_len = pos->len;
+            }
+            continue;
+        }
+
+        // Both tables are keyed by pkgId, the hash is the same
+        tpkg = cr_pkgtable_lookup_hashed(td->table, key, hash);
+        if (!tpkg)
+            continue;
+
+        // If the package doesn't use the single chunk (pkg->chunk is NULL
+        // after the loading), strings have to be copied into its own chunk
+        GStringChunk *chunk = pkg->chunk;
+
+        if (td->lazy)
+            pkg->loadingflags |= (td->state == PARSING_FIL)
+                                 ? CR_PACKAGE_LAZY_FIL : CR_PACKAGE_LAZY_OTH;
+
+        if (td->state == PARSING_FIL) {
+            pkg->loadingflags |= CR_PACKAGE_LOADED_FIL;
+            pkg->files = g_slist_concat(pkg->files, tpkg->files);
+            tpkg->files = NULL;
+            pkg->raw_filelists = tpkg->raw_filelists;
+            if (chunk) {
+                for (GSList *elem = pkg->files; elem; elem = g_slist_next(elem)) {
+                    cr_PackageFile *file = elem->data;
+                    file->path = cr_safe_string_chunk_insert_const(chunk, file->path);
+                    file->name = cr_safe_string_chunk_insert(chunk, file->name);
+                }
+                pkg->raw_filelists = cr_safe_string_chunk_insert(chunk,
+                                                        pkg->raw_filelists);
+            }
+        } else {
+            pkg->loadingflags |= CR_PACKAGE_LOADED_OTH;
+            pkg->changelogs = g_slist_concat(pkg->changelogs, tpkg->changelogs);
+            tpkg->changelogs = NULL;
+            pkg->raw_other = tpkg->raw_other;
+            if (chunk) {
+                for (GSList *elem = pkg->changelogs; elem; elem = g_slist_next(elem)) {
+                    cr_ChangelogEntry *entry = elem->data;
+                    entry->author = cr_safe_string_chunk_insert(chunk, entry->author);
+                    entry->changelog = cr_safe_string_chunk_insert(chunk, entry->changelog);
+                }
+                pkg->raw_other = cr_safe_string_chunk_insert(chunk,
+                                                             pkg->raw_other);
+            }
+        }
+    }
+}
+
+/** Number of packages in the root element of the xml (packages="N").
+ * @return              The number or 0 if it cannot be read
+ */
+static guint
+cr_xml_packages_hint(const char *path)
+{
+    gchar buf[PACKAGES_HINT_READ + 1];
+    const char *packages;
+    gint64 count;
+    int len;
+
+    CR_FILE *f = cr_open(path, CR_CW_MODE_READ,
+                         CR_CW_AUTO_DETECT_COMPRESSION, NULL);
+    if (!f)
+        return 0;
+    len = cr_read(f, buf, PACKAGES_HINT_READ, NULL);
+    cr_close(f, NULL);
+    if (len <= 0)
+        return 0;
+
+    buf[len] = '\0';
+    packages = strstr(buf, " packages=\"");
+    if (!packages)
+        return 0;
+
+    count = g_ascii_strtoll(packages + 11, NULL, 10);
+    return (guint) CLAMP(count, 0, PACKAGES_HINT_MAX);
+}
+
 static int
-cr_load_xml_files(GHashTable *hashtable,
+cr_load_xml_files(cr_PkgTable *table,
                   const char *primary_xml_path,
                   const char *filelists_xml_path,
                   const char *other_xml_path,
                   GStringChunk *chunk,
+                  gboolean intern,
                   GHashTable *pkglist_ht,
+                  gboolean store_raw,
+                  gboolean lazy,
+                  gboolean spool_raw,
+                  gint parser_threads,
+                  gboolean fast_parser,
+                  GSList **chunks,
                   GError **err)
 {
     cr_CbData cb_data;
+    cr_ParserThreadData fil_data, oth_data;
+    GThread *fil_thread = NULL, *oth_thread = NULL;
+    cr_DroppedPkgs dropped;
+    guint fil_packages = 0, oth_packages = 0;
     GError *tmp_err = NULL;
+    int code = CRE_OK;
+
+    assert(table);
+    assert(chunks);
+
+    // libxml2 must be initialized before it is used from multiple threads
+    xmlInitParser();
 
-    assert(hashtable);
+    // Only a pkglist drops a lot of packages
+    if (pkglist_ht)
+        dropped_pkgs_init(&dropped);
+
+    // Start parsing of filelists.xml and other.xml in background threads,
+    // primary.xml is parsed in this thread
+    if (filelists_xml_path) {
+        fil_packages = cr_xml_packages_hint(filelists_xml_path);
+        fil_thread = parser_thread_start(&fil_data, PARSING_FIL,
+                                         filelists_xml_path, chunk, intern,
+                                         store_raw, lazy, spool_raw,
+                                         parser_threads, fast_parser,
+                                         fil_packages,
+                                         pkglist_ht ? &dropped : NULL);
+    }
+
+    if (other_xml_path) {
+        oth_packages = cr_xml_packages_hint(other_xml_path);
+        oth_thread = parser_thread_start(&oth_data, PARSING_OTH,
+                                         other_xml_path, chunk, intern,
+                                         store_raw, lazy, spool_raw, 1,
+                                         FALSE, oth_packages,
+                                         pkglist_ht ? &dropped : NULL);
+    }
 
     // Prepare cb data
     cb_data.state           = PARSING_PRI;
-    cb_data.ht              = hashtable;
+    cb_data.table           = table;
     cb_data.chunk           = chunk;
+    cb_data.intern          = intern;
     cb_data.pkglist_ht      = pkglist_ht;
+    cb_data.dropped         = pkglist_ht ? &dropped : NULL;
     cb_data.ignored_pkgIds  = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                     g_free, NULL);
     cb_data.pkgKey          = G_GINT64_CONSTANT(0);
 
-    cr_xml_parse_primary(primary_xml_path,
-                         primary_newpkgcb,
-                         &cb_data,
-                         primary_pkgcb,
-                         &cb_data,
-                         cr_warning_cb,
-                         "Primary XML parser",
-                         (filelists_xml_path) ? 0 : 1,
-                         &tmp_err);
+    cr_xml_parse_primary_internal(primary_xml_path,
+                                  primary_newpkgcb,
+                                  &cb_data,
+                                  primary_pkgcb,
+                                  &cb_data,
+                                  cr_warning_cb,
+                                  "Primary XML parser",
+                                  (filelists_xml_path) ? 0 : 1,
+                                  store_raw,
+                                  &cr_xml_parser_generic,
+                                  &tmp_err);
 
     g_hash_table_destroy(cb_data.ignored_pkgIds);
     cb_data.ignored_pkgIds = NULL;
 
+    if (fil_thread)
+        g_thread_join(fil_thread);
+    if (oth_thread)
+        g_thread_join(oth_thread);
+
+    if (pkglist_ht) {
+        if (dropped.conflict && !tmp_err) {
+            // A package was skipped because of a dropped package with
+            // the same pkgId, but another one with the pkgId was loaded
+            // afterwards. This is rare, parse the files again completely.
+            g_debug("%s: A skipped package was loaded from primary.xml, "
+                    "parsing the filelists.xml and other.xml again", __func__);
+            fil_thread = oth_thread = NULL;
+            if (filelists_xml_path) {
+                parser_thread_clear(&fil_data, chunks);
+                fil_thread = parser_thread_start(&fil_data, PARSING_FIL,
+                                                 filelists_xml_path, chunk,
+                                                 intern, store_raw, lazy,
+                                                 spool_raw, parser_threads,
+                                                 fast_parser, fil_packages,
+                                                 NULL);
+            }
+            if (other_xml_path) {
+                parser_thread_clear(&oth_data, chunks);
+                oth_thread = parser_thread_start(&oth_data, PARSING_OTH,
+                                                 other_xml_path, chunk,
+                                                 intern, store_raw, lazy,
+                                                 spool_raw, 1, FALSE,
+                                                 oth_packages, NULL);
+            }
+            if (fil_thread)
+                g_thread_join(fil_thread);
+            if (oth_thread)
+                g_thread_join(oth_thread);
+        }
+        dropped_pkgs_clear(&dropped);
+    }
+
     if (tmp_err) {
-        int code = tmp_err->code;
+        code = tmp_err->code;
         g_debug("primary.xml parsing error: %s", tmp_err->message);
         g_propagate_prefixed_error(err, tmp_err, "primary.xml parsing: ");
-        return code;
     }
 
-    cb_data.state = PARSING_FIL;
-
     if (filelists_xml_path) {
-        cr_xml_parse_filelists(filelists_xml_path,
-                               newpkgcb,
-                               &cb_data,
-                               pkgcb,
-                               &cb_data,
-                               cr_warning_cb,
-                               "Filelists XML parser",
-                               &tmp_err);
-        if (tmp_err) {
-            int code = tmp_err->code;
-            g_debug("filelists.xml parsing error: %s", tmp_err->message);
-            g_propagate_prefixed_error(err, tmp_err, "filelists.xml parsing: ");
-            return code;
+        if (code == CRE_OK && fil_data.err) {
+            code = fil_data.err->code;
+            g_debug("filelists.xml parsing error: %s", fil_data.err->message);
+            g_propagate_prefixed_error(err, fil_data.err,
+                                       "filelists.xml parsing: ");
+            fil_data.err = NULL;
         }
+        if (code == CRE_OK)
+            parser_thread_merge(table, &fil_data);
+        parser_thread_clear(&fil_data, chunks);
     }
 
-    cb_data.state = PARSING_OTH;
-
     if (other_xml_path) {
-        cr_xml_parse_other(other_xml_path,
-                           newpkgcb,
-                           &cb_data,
-                           pkgcb,
-                           &cb_data,
-                           cr_warning_cb,
-                           "Other XML parser",
-                           &tmp_err);
-        if (tmp_err) {
-            int code = tmp_err->code;
-            g_debug("other.xml parsing error: %s", tmp_err->message);
-            g_propagate_prefixed_error(err, tmp_err, "other.xml parsing: ");
-            return code;
+        if (code == CRE_OK && oth_data.err) {
+            code = oth_data.err->code;
+            g_debug("other.xml parsing error: %s", oth_data.err->message);
+            g_propagate_prefixed_error(err, oth_data.err,
+                                       "other.xml parsing: ");
+            oth_data.err = NULL;
         }
+        if (code == CRE_OK)
+            parser_thread_merge(table, &oth_data);
+        parser_thread_clear(&oth_data, chunks);
     }
 
-    return CRE_OK;
+    return code;
 }
 
 static gint
@@ -514,59 +1274,162 @@ cr_metadata_load_modulemd(ModulemdModuleIndex **moduleindex,
 
     return ret;
 }
-#endif /* WITH_LIBMODULEMD */
+
+typedef struct {
+    gchar *path;
+    ModulemdModuleIndex *moduleindex;
+    int code;
+    GError *err;
+} cr_ModulemdLoadTask;
+
+static void
+cr_metadata_load_modulemd_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    cr_ModulemdLoadTask *task = data;
+
+    task->code = cr_metadata_load_modulemd(&task->moduleindex,
+                                           task->path,
+                                           &task->err);
+    if (task->code != CRE_OK)
+        g_clear_pointer(&task->moduleindex, g_object_unref);
+}
 
 int
-cr_metadata_load_xml(cr_Metadata *md,
-                     struct cr_MetadataLocation *ml,
-                     GError **err)
+cr_metadata_load_modulemds(ModulemdModuleIndex **moduleindexes,
+                           gchar **paths,
+                           guint count,
+                           guint threads,
+                           GError **err)
 {
-    int result;
+    int ret = CRE_OK;
     GError *tmp_err = NULL;
-    GHashTable *intern_hashtable;  // key is checksum (pkgId)
-    cr_HashTableKeyDupAction dupaction = md->dupaction;
+    GThreadPool *pool = NULL;
+    cr_ModulemdLoadTask *tasks = g_new0(cr_ModulemdLoadTask, count);
+
+    for (guint x = 0; x < count; x++)
+        tasks[x].path = paths[x];
+
+    if (threads > 1 && count > 1) {
+        pool = g_thread_pool_new(cr_metadata_load_modulemd_thread, NULL,
+                                 MIN(threads, count), TRUE, &tmp_err);
+        if (!pool) {
+            g_debug("%s: Cannot create a thread pool: %s", __func__,
+                    tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
 
-    assert(md);
-    assert(ml);
-    assert(!err || *err == NULL);
+    if (pool) {
+        for (guint x = 0; x < count; x++)
+            g_thread_pool_push(pool, &tasks[x], NULL);
+        g_thread_pool_free(pool, FALSE, TRUE);  // Wait for all the tasks
+    } else {
+        for (guint x = 0; x < count; x++)
+            cr_metadata_load_modulemd_thread(&tasks[x], NULL);
+    }
+
+    // Report the first failed file (in the order of paths)
+    for (guint x = 0; x < count; x++) {
+        if (ret == CRE_OK && tasks[x].code != CRE_OK) {
+            ret = tasks[x].code;
+            if (tasks[x].err)
+                g_propagate_prefixed_error(err, tasks[x].err, "%s: ",
+                                           tasks[x].path);
+            else
+                g_set_error(err, ERR_DOMAIN, ret, "%s: Unknown error",
+                            tasks[x].path);
+            tasks[x].err = NULL;
+        }
+        g_clear_error(&tasks[x].err);
+        moduleindexes[x] = tasks[x].moduleindex;
+    }
+
+    if (ret != CRE_OK)
+        for (guint x = 0; x < count; x++)
+            g_clear_pointer(&moduleindexes[x], g_object_unref);
+
+    g_free(tasks);
+    return ret;
+}
+#endif /* WITH_LIBMODULEMD */
+
+/** Parse the xml files of the location into a new table keyed by pkgId.
+ * @param chunk         NULL or string chunk for all the packages
+ * @param chunks        list for the additional chunks of the parsers
+ * @return              Table or NULL on error
+ */
+static cr_PkgTable *
+cr_metadata_parse_xml(cr_Metadata *md,
+                      struct cr_MetadataLocation *ml,
+                      GStringChunk *chunk,
+                      GSList **chunks,
+                      GError **err)
+{
+    int result;
+    GError *tmp_err = NULL;
+    cr_PkgTable *intern_table;  // key is checksum (pkgId)
 
     if (!ml->pri_xml_href) {
         g_set_error(err, ERR_DOMAIN, CRE_BADARG,
                     "primary.xml file is missing");
-        return CRE_BADARG;
+        return NULL;
     }
 
     // Load metadata
-    intern_hashtable = cr_new_metadata_hashtable();
-    result = cr_load_xml_files(intern_hashtable,
+    // Sized in advance, so it doesn't grow while primary.xml is parsed
+    intern_table = cr_pkgtable_new(cr_xml_packages_hint(ml->pri_xml_href));
+    result = cr_load_xml_files(intern_table,
                                ml->pri_xml_href,
                                ml->fil_xml_href,
                                ml->oth_xml_href,
-                               md->chunk,
+                               chunk,
+                               md->intern,
                                md->pkglist_ht,
+                               md->store_raw,
+                               md->lazy,
+                               md->spool_raw,
+                               md->parser_threads,
+                               md->fast_parser,
+                               chunks,
                                &tmp_err);
 
     if (result != CRE_OK) {
         g_critical("%s: Error encountered while parsing", __func__);
         g_propagate_prefixed_error(err, tmp_err,
                                    "Error encountered while parsing:");
-        cr_destroy_metadata_hashtable(intern_hashtable);
-        return result;
+        cr_pkgtable_free(intern_table, TRUE);
+        return NULL;
     }
 
-    g_debug("%s: Parsed items: %d", __func__,
-            g_hash_table_size(intern_hashtable));
+    g_debug("%s: Parsed items: %u", __func__,
+            cr_pkgtable_size(intern_table));
 
-    // Fill user hashtable and use user selected key
+    return intern_table;
+}
+
+/** Move the parsed packages into the hashtable of the md under its key,
+ * duplicates are resolved by the dupaction of the md. The table is freed.
+ * @return              cr_Error code
+ */
+static int
+cr_metadata_merge_table(cr_Metadata *md,
+                        cr_PkgTable *intern_table,
+                        GError **err)
+{
+    cr_HashTableKeyDupAction dupaction = md->dupaction;
 
-    GHashTableIter iter;
+    // Fill user hashtable and use user selected key, every package
+    // is either moved into it or freed
+
+    cr_PkgTableIter iter;
+    GHashTableIter ignored_iter;
     gpointer p_key, p_value;
+    cr_Package *pkg;
     GHashTable *ignored_keys = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                      g_free, NULL);
 
-    g_hash_table_iter_init (&iter, intern_hashtable);
-    while (g_hash_table_iter_next (&iter, &p_key, &p_value)) {
-        cr_Package *pkg = (cr_Package *) p_value;
+    cr_pkgtable_iter_init(&iter, intern_table);
+    while (cr_pkgtable_iter_next(&iter, NULL, &pkg, NULL)) {
         cr_Package *epkg;
         gpointer new_key;
 
@@ -591,6 +1454,7 @@ cr_metadata_load_xml(cr_Metadata *md,
                 assert(0);
                 g_set_error(err, ERR_DOMAIN, CRE_ASSERT,
                             "Bad db type");
+                g_hash_table_destroy(ignored_keys);
                 return CRE_ASSERT;
         }
 
@@ -625,17 +1489,16 @@ cr_metadata_load_xml(cr_Metadata *md,
                     g_hash_table_insert(ignored_keys, g_strdup((gchar *) new_key), NULL);
                 }
             }
-            // Remove the package from the iterator anyway
-            g_hash_table_iter_remove(&iter);
+            // Drop the package anyway
+            cr_package_free(pkg);
         } else {
-            g_hash_table_insert(md->ht, new_key, p_value);
-            g_hash_table_iter_steal(&iter);
+            g_hash_table_insert(md->ht, new_key, pkg);
         }
     }
 
     // Remove ignored_keys from resulting hashtable
-    g_hash_table_iter_init(&iter, ignored_keys);
-    while (g_hash_table_iter_next(&iter, &p_key, &p_value)) {
+    g_hash_table_iter_init(&ignored_iter, ignored_keys);
+    while (g_hash_table_iter_next(&ignored_iter, &p_key, &p_value)) {
         char *key = (gchar *) p_key;
         g_hash_table_remove(md->ht, key);
     }
@@ -647,20 +1510,64 @@ cr_metadata_load_xml(cr_Metadata *md,
     // Cleanup
 
     g_hash_table_destroy(ignored_keys);
-    cr_destroy_metadata_hashtable(intern_hashtable);
+    cr_pkgtable_free(intern_table, FALSE);
 
-    result = CRE_OK;
+    return CRE_OK;
+
+}
+
+/** Load the module metadata of the location, if it has them.
+ * @return              cr_Error code
+ */
+static int
+cr_metadata_load_xml_modulemd(cr_Metadata *md,
+                              struct cr_MetadataLocation *ml,
+                              GError **err)
+{
+    int result = CRE_OK;
 
 #ifdef WITH_LIBMODULEMD
     if (g_slist_find_custom(ml->additional_metadata, "modules", cr_cmp_metadatum_type)){
       cr_Metadatum *modulemd_metadatum = g_slist_find_custom(ml->additional_metadata, "modules", cr_cmp_metadatum_type)->data;
       result = cr_metadata_load_modulemd(&(md->moduleindex), modulemd_metadatum->name, err);
     }
+#else
+    (void) md;
+    (void) ml;
+    (void) err;
 #endif /* WITH_LIBMODULEMD */
 
     return result;
 }
 
+int
+cr_metadata_load_xml(cr_Metadata *md,
+                     struct cr_MetadataLocation *ml,
+                     GError **err)
+{
+    int result;
+    GError *tmp_err = NULL;
+    cr_PkgTable *intern_table;
+
+    assert(md);
+    assert(ml);
+    assert(!err || *err == NULL);
+
+    intern_table = cr_metadata_parse_xml(md, ml, md->chunk, &(md->chunks),
+                                         &tmp_err);
+    if (!intern_table) {
+        result = tmp_err->code;
+        g_propagate_error(err, tmp_err);
+        return result;
+    }
+
+    result = cr_metadata_merge_table(md, intern_table, err);
+    if (result != CRE_OK)
+        return result;
+
+    return cr_metadata_load_xml_modulemd(md, ml, err);
+}
+
 int
 cr_metadata_locate_and_load_xml(cr_Metadata *md,
                                 const char *repopath,
@@ -687,3 +1594,129 @@ cr_metadata_locate_and_load_xml(cr_Metadata *md,
 
     return ret;
 }
+
+/** Loading of one source by cr_metadata_load_sources().
+ */
+typedef struct {
+    cr_MetadataSource *source;
+    struct cr_MetadataLocation *located;    /*!< Location found by the task */
+    GStringChunk *chunk;    /*!< NULL or string chunk of the source */
+    GSList *chunks;         /*!< Additional chunks of the parsers */
+    cr_PkgTable *table;     /*!< Parsed packages or NULL on error */
+    gboolean done;          /*!< The source was parsed */
+} cr_MetadataSourceTask;
+
+typedef struct {
+    cr_Metadata *md;
+    GMutex mutex;           /*!< Guards the done flags of the tasks */
+    GCond cond;             /*!< Signaled when a task is done */
+} cr_MetadataSourcesData;
+
+static void
+cr_metadata_source_thread(gpointer data, gpointer user_data)
+{
+    cr_MetadataSourceTask *task = data;
+    cr_MetadataSourcesData *sources_data = user_data;
+    cr_MetadataSource *source = task->source;
+    struct cr_MetadataLocation *ml = source->ml;
+    GError *tmp_err = NULL;
+
+    if (!ml) {
+        task->located = cr_locate_metadata(source->repopath, TRUE, &tmp_err);
+        if (tmp_err)
+            g_clear_pointer(&task->located, cr_metadatalocation_free);
+        else if (!task->located)
+            g_set_error(&tmp_err, ERR_DOMAIN, CRE_NOFILE,
+                        "Cannot locate metadata of %s", source->repopath);
+        ml = task->located;
+    }
+
+    if (ml)
+        task->table = cr_metadata_parse_xml(sources_data->md, ml, task->chunk,
+                                            &task->chunks, &tmp_err);
+
+    if (tmp_err) {
+        source->code = tmp_err->code;
+        source->err = tmp_err;
+    }
+
+    g_mutex_lock(&sources_data->mutex);
+    task->done = TRUE;
+    g_cond_broadcast(&sources_data->cond);
+    g_mutex_unlock(&sources_data->mutex);
+}
+
+guint
+cr_metadata_load_sources(cr_Metadata *md,
+                         cr_MetadataSource *sources,
+                         guint count,
+                         gint threads)
+{
+    cr_MetadataSourcesData sources_data;
+    cr_MetadataSourceTask *tasks;
+    GThreadPool *pool;
+    guint failed = 0;
+
+    assert(md);
+    assert(sources || count == 0);
+
+    sources_data.md = md;
+    g_mutex_init(&sources_data.mutex);
+    g_cond_init(&sources_data.cond);
+
+    pool = g_thread_pool_new(cr_metadata_source_thread, &sources_data,
+                             MAX(threads, 1), FALSE, NULL);
+
+    // Every source is parsed into its own table and string chunk,
+    // GStringChunk is not thread safe
+    tasks = g_new0(cr_MetadataSourceTask, count);
+    for (guint x = 0; x < count; x++) {
+        sources[x].code = CRE_OK;
+        sources[x].err = NULL;
+        tasks[x].source = &sources[x];
+        tasks[x].chunk = md->chunk ? g_string_chunk_new(STRINGCHUNK_SIZE)
+                                   : NULL;
+        g_thread_pool_push(pool, &tasks[x], NULL);
+    }
+
+    // The tables are merged in the order of the sources as soon as they
+    // are parsed, the duplicates are resolved as by the sequential loading
+    for (guint x = 0; x < count; x++) {
+        cr_MetadataSourceTask *task = &tasks[x];
+        cr_MetadataSource *source = task->source;
+
+        g_mutex_lock(&sources_data.mutex);
+        while (!task->done)
+            g_cond_wait(&sources_data.cond, &sources_data.mutex);
+        g_mutex_unlock(&sources_data.mutex);
+
+        if (task->table) {
+            struct cr_MetadataLocation *ml = source->ml ? source->ml
+                                                        : task->located;
+            source->code = cr_metadata_merge_table(md, task->table,
+                                                   &source->err);
+            if (source->code == CRE_OK)
+                source->code = cr_metadata_load_xml_modulemd(md, ml,
+                                                             &source->err);
+            // The strings of the packages live as long as the md
+            if (task->chunk)
+                md->chunks = g_slist_prepend(md->chunks, task->chunk);
+            md->chunks = g_slist_concat(task->chunks, md->chunks);
+        } else {
+            if (task->chunk)
+                g_string_chunk_free(task->chunk);
+            g_slist_free_full(task->chunks, (GDestroyNotify) g_string_chunk_free);
+        }
+
+        if (source->code != CRE_OK)
+            failed++;
+        cr_metadatalocation_free(task->located);
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_free(tasks);
+    g_mutex_clear(&sources_data.mutex);
+    g_cond_clear(&sources_data.cond);
+
+    return failed;
+}
@@ -22,6 +22,7 @@
 
 #include <glib.h>
 #include "locate_metadata.h"
+#include "package.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -120,6 +121,114 @@ cr_Metadata *cr_metadata_new(cr_HashTableKey key,
 gboolean
 cr_metadata_set_dupaction(cr_Metadata *md, cr_HashTableKeyDupAction dupaction);
 
+/** Store raw xml of the loaded packages (the raw_primary, raw_filelists
+ * and raw_other of cr_Package). The raw xml could be written into
+ * a new metadata instead of dumping of the package again.
+ * Note: This increases the memory consumption.
+ * @param md            cr_Metadata object
+ * @param store_raw     Store the raw xml?
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_set_store_raw(cr_Metadata *md, gboolean store_raw);
+
+/** Enable lazy loading of files and changelogs. Only the raw xml of
+ * the packages from the filelists.xml and other.xml is kept during
+ * loading (see raw_filelists and raw_other of cr_Package) and the packages
+ * get CR_PACKAGE_LAZY_FIL and CR_PACKAGE_LAZY_OTH flags.
+ * The files and changelogs are parsed by cr_metadata_load_lazy_data(),
+ * which has to be called before they are accessed.
+ * @param md            cr_Metadata object
+ * @param lazy          Load files and changelogs lazily?
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_set_lazy(cr_Metadata *md, gboolean lazy);
+
+/** Keep the raw xml of the lazily loaded packages (see cr_metadata_set_lazy()
+ * and cr_metadata_set_store_raw()) in unlinked temporary files instead
+ * of the memory. The packages get the spool field set instead
+ * of raw_filelists and raw_other, the raw xml is read back by
+ * cr_metadata_load_spooled_raw() or cr_metadata_load_lazy_data().
+ * The memory used by the loaded metadata doesn't grow with the size
+ * of the filelists.xml and other.xml then. If a temporary file cannot be
+ * created, the raw xml is kept in the memory.
+ * @param md            cr_Metadata object
+ * @param spool_raw     Keep the raw xml in temporary files?
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_set_spool_raw(cr_Metadata *md, gboolean spool_raw);
+
+/** Parse the filelists.xml by more threads
+ * (see cr_xml_parse_filelists_threaded()). Only used when neither
+ * the raw xml is stored nor the lazy loading is enabled.
+ * @param md            cr_Metadata object
+ * @param threads       Number of threads (0 or 1 - a single parser)
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_set_parser_threads(cr_Metadata *md, gint threads);
+
+/** Parse the filelists.xml by the specialized scanner
+ * (see cr_xml_parse_filelists_fast()). Only used when neither the raw
+ * xml is stored, the lazy loading is enabled nor more parser threads
+ * are set.
+ * @param md            cr_Metadata object
+ * @param fast_parser   Use the scanner?
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_set_fast_parser(cr_Metadata *md, gboolean fast_parser);
+
+/** Share repeated strings (arch, versions, dependency names, file names,
+ * ...) of the loaded packages instead of storing a copy per package.
+ * The strings are deduplicated within the string chunks of the cr_Metadata,
+ * so it has an effect only with use_single_chunk (see cr_metadata_new()).
+ * The loaded packages get the CR_PACKAGE_INTERNED flag.
+ * @param md            cr_Metadata object
+ * @param intern        Share repeated strings?
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_set_intern_strings(cr_Metadata *md, gboolean intern);
+
+/** Take over the string chunks used by the packages loaded into
+ * a cr_Metadata created with use_single_chunk. The packages moved out
+ * of the cr_Metadata stay valid after cr_metadata_free() as long as
+ * the stolen chunks are not freed. The first chunk of the list is the one
+ * with strings from primary.xml, new strings of the package could be
+ * inserted there.
+ * @param md            cr_Metadata object
+ * @return              list of GStringChunk (free them by
+ *                      g_string_chunk_free()) or NULL
+ */
+GSList *
+cr_metadata_steal_chunks(cr_Metadata *md);
+
+/** Parse files and changelogs of a package loaded in the lazy mode
+ * (see cr_metadata_set_lazy()). Does nothing if they are already parsed.
+ * Different packages could be processed by different threads
+ * at the same time.
+ * @param pkg           Package from cr_Metadata
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_load_lazy_data(cr_Package *pkg, GError **err);
+
+/** Read the raw_filelists and raw_other of a package loaded with
+ * cr_metadata_set_spool_raw() back from the temporary files.
+ * Does nothing if the package has no spool (its raw xml is already
+ * in the memory). Different packages could be processed by different
+ * threads at the same time.
+ * @param pkg           Package from cr_Metadata
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_metadata_load_spooled_raw(cr_Package *pkg, GError **err);
+
 /** Destroy metadata.
  * @param md            cr_Metadata object
  */
@@ -145,6 +254,34 @@ int cr_metadata_locate_and_load_xml(cr_Metadata *md,
                                     const char *repopath,
                                     GError **err);
 
+/** Source of metadata for cr_metadata_load_sources().
+ */
+typedef struct {
+    const char *repopath;           /*!< path to the repo to locate,
+                                         used if ml is NULL */
+    struct cr_MetadataLocation *ml; /*!< already located metadata or NULL */
+    int code;                       /*!< cr_Error code of the loading */
+    GError *err;                    /*!< error of the loading or NULL,
+                                         the caller frees it */
+} cr_MetadataSource;
+
+/** Load metadata from several sources concurrently. Every source is
+ * located and parsed by its own thread (at most threads at once) and
+ * the packages are merged in the order of the sources, so the result is
+ * the same as if they were loaded one by one by cr_metadata_load_xml()
+ * or cr_metadata_locate_and_load_xml(). A source which cannot be loaded
+ * is skipped.
+ * @param md            metadata object
+ * @param sources       array of sources, their code and err are set
+ * @param count         number of the sources
+ * @param threads       max number of sources loaded at once
+ * @return              number of the sources which failed
+ */
+guint cr_metadata_load_sources(cr_Metadata *md,
+                               cr_MetadataSource *sources,
+                               guint count,
+                               gint threads);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -24,8 +24,10 @@
 #include <curl/curl.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include "error.h"
 #include "misc.h"
+#include "checksum.h"
 #include "locate_metadata.h"
 #include "repomd.h"
 #include "xml_parser.h"
@@ -35,6 +37,24 @@
 
 #define TMPDIR_PATTERN  "createrepo_c_tmp_repo_XXXXXX"
 
+#define MAX_HOST_CONNECTIONS    6
+
+static gboolean cr_remote_streaming = FALSE;
+static gchar *cr_remote_cache_dir = NULL;
+
+void
+cr_locate_metadata_set_streaming(gboolean streaming)
+{
+    cr_remote_streaming = streaming;
+}
+
+void
+cr_locate_metadata_set_cache_dir(const char *cache_dir)
+{
+    g_free(cr_remote_cache_dir);
+    cr_remote_cache_dir = g_strdup(cache_dir);
+}
+
 #define FORMAT_XML      1
 #define FORMAT_LEVEL    0
 
@@ -66,6 +86,9 @@ cr_metadatalocation_free(struct cr_MetadataLocation *ml)
     g_free(ml->pri_sqlite_href);
     g_free(ml->fil_sqlite_href);
     g_free(ml->oth_sqlite_href);
+    g_free(ml->pri_zck_href);
+    g_free(ml->fil_zck_href);
+    g_free(ml->oth_zck_href);
     g_free(ml->repomd);
     g_free(ml->original_url);
     g_free(ml->local_path);
@@ -94,7 +117,11 @@ cr_copy_metadatum(const gchar *src,
 
     g_debug("Copy metadatum %s -> %s", src, metadatum);
 
-    if (!cr_better_copy_file(src, metadatum, err)) {
+    // The kept metadata are never modified, they could share the content
+    gboolean copied = strstr(src, "://")
+                        ? cr_better_copy_file(src, metadatum, err)
+                        : cr_link_or_copy_file(src, metadatum, err);
+    if (!copied) {
         g_critical("Error while copy %s -> %s: %s",
                 src, metadatum, (*err)->message);
         g_clear_error(err);
@@ -167,6 +194,15 @@ cr_parse_repomd(const char *repomd_path,
             mdloc->oth_xml_href = full_location_href;
         else if (!g_strcmp0(record->type, "other_db") && !ignore_sqlite)
             mdloc->oth_sqlite_href = full_location_href;
+        else if (!g_strcmp0(record->type, "primary_zck"))
+            mdloc->pri_zck_href = full_location_href;
+        else if (!g_strcmp0(record->type, "filelists_zck"))
+            mdloc->fil_zck_href = full_location_href;
+        else if (!g_strcmp0(record->type, "other_zck"))
+            mdloc->oth_zck_href = full_location_href;
+        else if (!g_strcmp0(record->type, "pkgindex"))
+            // Generated from the packages (--pkg-index), never kept
+            g_free(full_location_href);
         else if ( !g_str_has_prefix(record->type, "primary_"   ) &&
                   !g_str_has_prefix(record->type, "filelists_" ) && 
                   !g_str_has_prefix(record->type, "other_"     ) ) 
@@ -211,46 +247,415 @@ cr_get_local_metadata(const char *repopath, gboolean ignore_sqlite)
 }
 
 
-static struct cr_MetadataLocation *
-cr_get_remote_metadata(const char *repopath, gboolean ignore_sqlite)
+/** A remote repo downloaded by cr_get_remote_metadata()
+ */
+typedef struct {
+    const char *repopath;
+    gchar *tmp_dir;
+    gchar *tmp_repodata;
+    gchar *tmp_repomd;
+    gchar *pri_xml_url;     // streamed or zck primary.xml (or NULL)
+    gchar *fil_xml_url;     // streamed or zck filelists.xml (or NULL)
+    gchar *oth_xml_url;     // streamed or zck other.xml (or NULL)
+    GSList *cache_entries;  // cr_RemoteCacheEntry of the downloaded files
+    gboolean failed;
+} cr_RemoteRepo;
+
+
+/** A downloaded file which will be stored into the cache
+ */
+typedef struct {
+    gchar *path;            // downloaded file
+    gchar *cache_path;      // path inside the cache dir
+    cr_ChecksumType checksum_type;
+    gchar *checksum;        // checksum from the repomd.xml
+} cr_RemoteCacheEntry;
+
+
+static void
+cr_remote_cache_entry_free(cr_RemoteCacheEntry *entry)
 {
-    CURL *handle = NULL;
-    _cleanup_free_ gchar *tmp_dir = NULL;
-    _cleanup_free_ gchar *tmp_repodata = NULL;
-    _cleanup_free_ gchar *tmp_repomd = NULL;
-    _cleanup_free_ gchar *url = NULL;
-    struct cr_MetadataLocation *r_location = NULL;
-    struct cr_MetadataLocation *ret = NULL;
+    if (!entry)
+        return;
+
+    g_free(entry->path);
+    g_free(entry->cache_path);
+    g_free(entry->checksum);
+    g_free(entry);
+}
+
+
+
+
+/** Store a downloaded file into the cache if its checksum matches
+ * the one from repomd.xml. The cached file is replaced atomically, so
+ * concurrent runs sharing the cache never see a partial file.
+ */
+static void
+cr_remote_cache_store(cr_RemoteCacheEntry *entry)
+{
+    _cleanup_free_ gchar *checksum = NULL;
+    _cleanup_free_ gchar *tmp_path = NULL;
     _cleanup_error_free_ GError *tmp_err = NULL;
 
-    if (!repopath)
-        return ret;
+    checksum = cr_checksum_file(entry->path, entry->checksum_type, &tmp_err);
+    if (!checksum) {
+        g_debug("%s: Cannot compute checksum of %s: %s",
+                __func__, entry->path, tmp_err->message);
+        return;
+    }
 
-    // Create temporary repo in /tmp
-    tmp_dir = g_build_filename(g_get_tmp_dir(), TMPDIR_PATTERN, NULL);
-    if (!mkdtemp(tmp_dir)) {
-        g_critical("%s: Cannot create a temporary directory: %s",
-                   __func__, g_strerror(errno));
-        return ret;
+    if (g_strcmp0(checksum, entry->checksum)) {
+        g_debug("%s: Checksum of %s doesn't match repomd.xml - not cached",
+                __func__, entry->path);
+        return;
     }
 
-    g_debug("%s: Using tmp dir: %s", __func__, tmp_dir);
+    tmp_path = g_strdup_printf("%s.%d.tmp", entry->cache_path, (int) getpid());
+    if (!cr_link_or_copy_file(entry->path, tmp_path, NULL)) {
+        g_debug("%s: Cannot store %s into the cache", __func__, entry->path);
+        g_remove(tmp_path);
+        return;
+    }
 
-    // Create repodata subdir in tmp dir
-    tmp_repodata = g_build_filename(tmp_dir, "repodata", NULL);
-    if (g_mkdir (tmp_repodata, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)) {
-        g_critical("%s: Cannot create a temporary directory", __func__);
-        return ret;
+    if (g_rename(tmp_path, entry->cache_path)) {
+        g_debug("%s: Cannot rename %s -> %s: %s", __func__, tmp_path,
+                entry->cache_path, g_strerror(errno));
+        g_remove(tmp_path);
+        return;
     }
 
-    // Prepare temporary repomd.xml filename
-    tmp_repomd = g_build_filename(tmp_repodata, "repomd.xml", NULL);
+    g_debug("%s: Cached %s as %s", __func__, entry->path, entry->cache_path);
+}
+
 
-    // Prepare repomd.xml URL
-    if (g_str_has_suffix(repopath, "/"))
-        url = g_strconcat(repopath, "repodata/repomd.xml", NULL);
-    else
-        url = g_strconcat(repopath, "/repodata/repomd.xml", NULL);
+/** Map full location hrefs of the records of the downloaded repomd.xml
+ * to cr_RepomdRecord. Returns NULL if the cache is not used.
+ */
+static GHashTable *
+cr_remote_repo_records(cr_RemoteRepo *repo, cr_Repomd *repomd)
+{
+    GHashTable *records;
+    _cleanup_error_free_ GError *tmp_err = NULL;
+
+    if (!cr_remote_cache_dir)
+        return NULL;
+
+    cr_xml_parse_repomd(repo->tmp_repomd, repomd, NULL, NULL, &tmp_err);
+    if (tmp_err) {
+        g_debug("%s: %s", __func__, tmp_err->message);
+        return NULL;
+    }
+
+    records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
+        cr_RepomdRecord *record = elem->data;
+        if (record->location_href)
+            g_hash_table_replace(records,
+                                 g_build_filename(repo->repopath,
+                                                  record->location_href,
+                                                  NULL),
+                                 record);
+    }
+
+    return records;
+}
+
+
+/** Path of the file with the checksum of the record in the cache or NULL.
+ */
+static gchar *
+cr_remote_cache_path(cr_RepomdRecord *record)
+{
+    if (!record || !record->checksum || !record->checksum_type
+        || !*record->checksum)
+        return NULL;
+
+    if (cr_checksum_type(record->checksum_type) == CR_CHECKSUM_UNKNOWN)
+        return NULL;
+
+    // The checksum comes from a remote file, it has to be a plain name
+    for (const char *c = record->checksum; *c; c++)
+        if (!g_ascii_isxdigit(*c))
+            return NULL;
+
+    return g_strdup_printf("%s/%s-%s", cr_remote_cache_dir,
+                           record->checksum_type, record->checksum);
+}
+
+
+/** Put the file (full location href) into the temporary repodata from
+ * the cache. If it is not cached and store is TRUE, it is stored into
+ * the cache after the download.
+ * @return              TRUE if the file was taken from the cache
+ */
+static gboolean
+cr_remote_repo_from_cache(cr_RemoteRepo *repo,
+                          GHashTable *records,
+                          const char *href,
+                          gboolean store)
+{
+    cr_RepomdRecord *record;
+    _cleanup_free_ gchar *cache_path = NULL;
+    _cleanup_free_ gchar *dst = NULL;
+
+    if (!records)
+        return FALSE;
+
+    record = g_hash_table_lookup(records, href);
+    cache_path = cr_remote_cache_path(record);
+    if (!cache_path)
+        return FALSE;
+
+    dst = g_build_filename(repo->tmp_repodata, cr_get_filename(href), NULL);
+
+    if (g_file_test(cache_path, G_FILE_TEST_IS_REGULAR)
+        && cr_link_or_copy_file(cache_path, dst, NULL))
+    {
+        g_debug("%s: Using cached %s for %s", __func__, cache_path, href);
+        return TRUE;
+    }
+
+    if (store) {
+        cr_RemoteCacheEntry *entry = g_new0(cr_RemoteCacheEntry, 1);
+        entry->path = g_steal_pointer(&dst);
+        entry->cache_path = g_steal_pointer(&cache_path);
+        entry->checksum_type = cr_checksum_type(record->checksum_type);
+        entry->checksum = g_strdup(record->checksum);
+        repo->cache_entries = g_slist_prepend(repo->cache_entries, entry);
+    }
+
+    return FALSE;
+}
+
+
+#ifdef WITH_ZCHUNK
+/** Path of the last downloaded zchunk file of the type of the repo
+ * in the cache.
+ */
+static gchar *
+cr_remote_zck_last_path(cr_RemoteRepo *repo, const char *type)
+{
+    _cleanup_free_ gchar *key = g_strconcat(repo->repopath, "\n", type, NULL);
+    _cleanup_free_ gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                                                key, -1);
+
+    return g_strdup_printf("%s/last-%s", cr_remote_cache_dir, hash);
+}
+#endif // WITH_ZCHUNK
+
+
+/** Get the zchunk compressed version (full location href) of an xml file
+ * instead of the xml itself. If the previous version of the file is
+ * cached, only its missing chunks are downloaded now, otherwise the whole
+ * file is downloaded with the other ones.
+ * @return              TRUE if the zchunk file is used, its local path
+ *                      is set to xml_path
+ */
+static gboolean
+cr_remote_repo_zck(cr_RemoteRepo *repo,
+                   GHashTable *records,
+                   const char *href,
+                   GSList **targets,
+                   gchar **xml_path)
+{
+#ifdef WITH_ZCHUNK
+    cr_RepomdRecord *record;
+    _cleanup_free_ gchar *checksum = NULL;
+    _cleanup_free_ gchar *dst = NULL;
+    _cleanup_free_ gchar *last_path = NULL;
+    _cleanup_error_free_ GError *tmp_err = NULL;
+
+    record = records ? g_hash_table_lookup(records, href) : NULL;
+    if (!record || record->size_header <= 0 || !cr_remote_cache_path(record))
+        return FALSE;
+
+    dst = g_build_filename(repo->tmp_repodata, cr_get_filename(href), NULL);
+    last_path = cr_remote_zck_last_path(repo, record->type);
+
+    // The file becomes the previous version for the next download
+    cr_RemoteCacheEntry *entry = g_new0(cr_RemoteCacheEntry, 1);
+    entry->path = g_strdup(dst);
+    entry->cache_path = g_strdup(last_path);
+    entry->checksum_type = cr_checksum_type(record->checksum_type);
+    entry->checksum = g_strdup(record->checksum);
+    repo->cache_entries = g_slist_prepend(repo->cache_entries, entry);
+
+    *xml_path = g_strdup(dst);
+
+    if (cr_remote_repo_from_cache(repo, records, href, TRUE))
+        return TRUE;
+
+    if (g_file_test(last_path, G_FILE_TEST_IS_REGULAR)) {
+        CURL *handle = curl_easy_init();
+        curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1);
+        curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
+        curl_easy_setopt(handle, CURLOPT_MAXREDIRS, 6);
+        cr_download_zck(handle, href, last_path, dst, record->size_header,
+                        &tmp_err);
+        curl_easy_cleanup(handle);
+
+        if (!tmp_err)
+            checksum = cr_checksum_file(dst, entry->checksum_type, &tmp_err);
+        if (!tmp_err && !g_strcmp0(checksum, record->checksum))
+            return TRUE;
+
+        g_debug("%s: Cannot download only the changed chunks of %s: %s",
+                __func__, href,
+                tmp_err ? tmp_err->message : "Checksum doesn't match");
+    }
+
+    *targets = g_slist_prepend(*targets,
+                    cr_downloadtarget_new(href, repo->tmp_repodata));
+    return TRUE;
+#else
+    (void) repo;
+    (void) records;
+    (void) href;
+    (void) targets;
+    (void) xml_path;
+    return FALSE;
+#endif // WITH_ZCHUNK
+}
+
+
+static gboolean
+cr_remote_repo_collect_targets(cr_RemoteRepo *repo,
+                               gboolean ignore_sqlite,
+                               GSList **targets)
+{
+    struct cr_MetadataLocation *r_location;
+    cr_Repomd *repomd;
+    GHashTable *records;
+    const char *hrefs[6];
+
+    // Parse downloaded repomd.xml
+    r_location = cr_parse_repomd(repo->tmp_repomd, repo->repopath, ignore_sqlite);
+    if (!r_location) {
+        g_critical("%s: repomd.xml parser failed on %s", __func__,
+                   repo->tmp_repomd);
+        return FALSE;
+    }
+
+    repomd = cr_repomd_new();
+    records = cr_remote_repo_records(repo, repomd);
+
+    if (cr_remote_streaming) {
+        // The xml files are downloaded while they are parsed,
+        // only the cached ones are used locally
+        gchar **urls[3] = { &repo->pri_xml_url,
+                            &repo->fil_xml_url,
+                            &repo->oth_xml_url };
+        const char *xml_hrefs[3] = { r_location->pri_xml_href,
+                                     r_location->fil_xml_href,
+                                     r_location->oth_xml_href };
+        for (int x = 0; x < 3; x++)
+            if (xml_hrefs[x]
+                && !cr_remote_repo_from_cache(repo, records, xml_hrefs[x], FALSE))
+                *urls[x] = g_strdup(xml_hrefs[x]);
+        hrefs[0] = hrefs[1] = hrefs[2] = NULL;
+    } else {
+        // The zchunk files are used instead of the xml files if possible
+        gchar **paths[3] = { &repo->pri_xml_url,
+                             &repo->fil_xml_url,
+                             &repo->oth_xml_url };
+        const char *zck_hrefs[3] = { r_location->pri_zck_href,
+                                     r_location->fil_zck_href,
+                                     r_location->oth_zck_href };
+        hrefs[0] = r_location->pri_xml_href;
+        hrefs[1] = r_location->fil_xml_href;
+        hrefs[2] = r_location->oth_xml_href;
+        for (int x = 0; x < 3; x++)
+            if (hrefs[x] && zck_hrefs[x]
+                && !cr_remote_repo_from_cache(repo, records, hrefs[x], FALSE)
+                && cr_remote_repo_zck(repo, records, zck_hrefs[x], targets,
+                                      paths[x]))
+                hrefs[x] = NULL;
+    }
+    hrefs[3] = r_location->pri_sqlite_href;
+    hrefs[4] = r_location->fil_sqlite_href;
+    hrefs[5] = r_location->oth_sqlite_href;
+
+    for (int x = 0; x < 6; x++)
+        if (hrefs[x] && !cr_remote_repo_from_cache(repo, records, hrefs[x], TRUE))
+            *targets = g_slist_prepend(*targets,
+                            cr_downloadtarget_new(hrefs[x], repo->tmp_repodata));
+
+    for (GSList *elem = r_location->additional_metadata; elem;
+         elem = g_slist_next(elem)) {
+        const char *href = ((cr_Metadatum *) elem->data)->name;
+        if (!cr_remote_repo_from_cache(repo, records, href, TRUE))
+            *targets = g_slist_prepend(*targets,
+                            cr_downloadtarget_new(href, repo->tmp_repodata));
+    }
+
+    if (records)
+        g_hash_table_destroy(records);
+    cr_repomd_free(repomd);
+    cr_metadatalocation_free(r_location);
+    return TRUE;
+}
+
+
+/** Download repodata of the remote repos into temporary directories.
+ * The repomd.xml files of all the repos are downloaded at once, then all
+ * the files listed in them at once.
+ * @param repopaths     array of remote repo urls
+ * @param count         number of repos
+ * @param ignore_sqlite if ignore_sqlite != 0 sqlite dbs are ignored
+ * @param locations     array (count items) filled by the cr_MetadataLocation
+ *                      of the repos (NULL if the repo failed)
+ */
+static void
+cr_get_remote_metadata(const char **repopaths,
+                       guint count,
+                       gboolean ignore_sqlite,
+                       struct cr_MetadataLocation **locations)
+{
+    CURL *handle = NULL;
+    cr_RemoteRepo *repos;
+    GSList *targets = NULL;
+    GSList **repo_targets;
+
+    repos = g_new0(cr_RemoteRepo, count);
+    repo_targets = g_new0(GSList *, count);
+
+    if (cr_remote_cache_dir
+        && g_mkdir_with_parents(cr_remote_cache_dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
+    {
+        g_warning("%s: Cannot create cache directory %s: %s - cache disabled",
+                  __func__, cr_remote_cache_dir, g_strerror(errno));
+        cr_locate_metadata_set_cache_dir(NULL);
+    }
+
+    for (guint i = 0; i < count; i++) {
+        cr_RemoteRepo *repo = &repos[i];
+        locations[i] = NULL;
+        repo->repopath = repopaths[i];
+        repo->failed = TRUE;
+
+        // Create temporary repo in /tmp
+        repo->tmp_dir = g_build_filename(g_get_tmp_dir(), TMPDIR_PATTERN, NULL);
+        if (!mkdtemp(repo->tmp_dir)) {
+            g_critical("%s: Cannot create a temporary directory: %s",
+                       __func__, g_strerror(errno));
+            g_clear_pointer(&repo->tmp_dir, g_free);
+            continue;
+        }
+
+        g_debug("%s: Using tmp dir: %s", __func__, repo->tmp_dir);
+
+        // Create repodata subdir in tmp dir
+        repo->tmp_repodata = g_build_filename(repo->tmp_dir, "repodata", NULL);
+        if (g_mkdir (repo->tmp_repodata, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)) {
+            g_critical("%s: Cannot create a temporary directory", __func__);
+            continue;
+        }
+
+        // Prepare temporary repomd.xml filename
+        repo->tmp_repomd = g_build_filename(repo->tmp_repodata, "repomd.xml", NULL);
+        repo->failed = FALSE;
+    }
 
     // Create and setup CURL handle
     handle = curl_easy_init();
@@ -273,88 +678,143 @@ cr_get_remote_metadata(const char *repopath, gboolean ignore_sqlite)
         goto get_remote_metadata_cleanup;
     }
 
-    // Download repomd.xml
-    cr_download(handle, url, tmp_repomd, &tmp_err);
-    if (tmp_err) {
-        g_critical("%s: %s", __func__, tmp_err->message);
-        goto get_remote_metadata_cleanup;
-    }
+    // Download repomd.xml of all repos
+    for (guint i = 0; i < count; i++) {
+        cr_RemoteRepo *repo = &repos[i];
+        _cleanup_free_ gchar *url = NULL;
 
-    // Parse downloaded repomd.xml
-    r_location = cr_parse_repomd(tmp_repomd, repopath, ignore_sqlite);
-    if (!r_location) {
-        g_critical("%s: repomd.xml parser failed on %s", __func__, tmp_repomd);
-        goto get_remote_metadata_cleanup;
+        if (repo->failed)
+            continue;
+
+        // Prepare repomd.xml URL
+        if (g_str_has_suffix(repo->repopath, "/"))
+            url = g_strconcat(repo->repopath, "repodata/repomd.xml", NULL);
+        else
+            url = g_strconcat(repo->repopath, "/repodata/repomd.xml", NULL);
+
+        repo_targets[i] = g_slist_prepend(NULL,
+                            cr_downloadtarget_new(url, repo->tmp_repomd));
+        targets = g_slist_concat(g_slist_copy(repo_targets[i]), targets);
     }
 
-    // Download all other repofiles
-    if (r_location->pri_xml_href)
-        cr_download(handle, r_location->pri_xml_href, tmp_repodata, &tmp_err);
-    if (!tmp_err && r_location->fil_xml_href)
-        cr_download(handle, r_location->fil_xml_href, tmp_repodata, &tmp_err);
-    if (!tmp_err && r_location->oth_xml_href)
-        cr_download(handle, r_location->oth_xml_href, tmp_repodata, &tmp_err);
-    if (!tmp_err && r_location->pri_sqlite_href)
-        cr_download(handle, r_location->pri_sqlite_href, tmp_repodata, &tmp_err);
-    if (!tmp_err && r_location->fil_sqlite_href)
-        cr_download(handle, r_location->fil_sqlite_href, tmp_repodata, &tmp_err);
-    if (!tmp_err && r_location->oth_sqlite_href)
-        cr_download(handle, r_location->oth_sqlite_href, tmp_repodata, &tmp_err);
-
-    if (!tmp_err && r_location->additional_metadata){
-        GSList *element = r_location->additional_metadata;
-        for (; element; element=g_slist_next(element)) {
-            cr_download(handle, ((cr_Metadatum *)element->data)->name, tmp_repodata, &tmp_err);
-            if (tmp_err) break;
+    cr_download_targets(handle, targets, MAX_HOST_CONNECTIONS, NULL);
+    g_slist_free(targets);
+    targets = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        cr_RemoteRepo *repo = &repos[i];
+        cr_DownloadTarget *target;
+
+        if (repo->failed)
+            continue;
+
+        target = repo_targets[i]->data;
+        if (target->err) {
+            g_critical("%s: %s", __func__, target->err->message);
+            repo->failed = TRUE;
         }
-    }
 
-    cr_metadatalocation_free(r_location);
+        g_slist_free_full(repo_targets[i], (GDestroyNotify) cr_downloadtarget_free);
+        repo_targets[i] = NULL;
 
-    if (tmp_err) {
-        g_critical("%s: Error while downloadig files: %s",
-                   __func__, tmp_err->message);
-        goto get_remote_metadata_cleanup;
+        if (repo->failed)
+            continue;
+
+        if (!cr_remote_repo_collect_targets(repo, ignore_sqlite, &repo_targets[i])) {
+            repo->failed = TRUE;
+            continue;
+        }
+        targets = g_slist_concat(g_slist_copy(repo_targets[i]), targets);
     }
 
-    g_debug("%s: Remote metadata was successfully downloaded", __func__);
+    // Download all other repofiles of all repos
+    cr_download_targets(handle, targets, MAX_HOST_CONNECTIONS, NULL);
+    g_slist_free(targets);
+    targets = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        cr_RemoteRepo *repo = &repos[i];
+
+        if (repo->failed)
+            continue;
+
+        for (GSList *elem = repo_targets[i]; elem; elem = g_slist_next(elem)) {
+            cr_DownloadTarget *target = elem->data;
+            if (target->err) {
+                g_critical("%s: Error while downloadig files: %s",
+                           __func__, target->err->message);
+                repo->failed = TRUE;
+                break;
+            }
+        }
 
-    // Parse downloaded data
-    ret = cr_get_local_metadata(tmp_dir, ignore_sqlite);
-    if (ret)
-        ret->tmp = 1;
+        if (repo->failed)
+            continue;
+
+        g_debug("%s: Remote metadata was successfully downloaded: %s",
+                __func__, repo->repopath);
+
+        for (GSList *elem = repo->cache_entries; elem; elem = g_slist_next(elem))
+            cr_remote_cache_store(elem->data);
+
+        // Parse downloaded data
+        locations[i] = cr_get_local_metadata(repo->tmp_dir, ignore_sqlite);
+        if (locations[i]) {
+            struct cr_MetadataLocation *ml = locations[i];
+            ml->tmp = 1;
+            if (repo->pri_xml_url) {
+                g_free(ml->pri_xml_href);
+                ml->pri_xml_href = g_steal_pointer(&repo->pri_xml_url);
+            }
+            if (repo->fil_xml_url) {
+                g_free(ml->fil_xml_href);
+                ml->fil_xml_href = g_steal_pointer(&repo->fil_xml_url);
+            }
+            if (repo->oth_xml_url) {
+                g_free(ml->oth_xml_href);
+                ml->oth_xml_href = g_steal_pointer(&repo->oth_xml_url);
+            }
+        }
+    }
 
 get_remote_metadata_cleanup:
 
     if (handle)
         curl_easy_cleanup(handle);
-    if (!ret) cr_remove_dir(tmp_dir, NULL);
 
-    return ret;
+    for (guint i = 0; i < count; i++) {
+        cr_RemoteRepo *repo = &repos[i];
+        g_slist_free_full(repo_targets[i], (GDestroyNotify) cr_downloadtarget_free);
+        if (!locations[i] && repo->tmp_dir)
+            cr_remove_dir(repo->tmp_dir, NULL);
+        g_free(repo->tmp_dir);
+        g_free(repo->tmp_repodata);
+        g_free(repo->tmp_repomd);
+        g_free(repo->pri_xml_url);
+        g_free(repo->fil_xml_url);
+        g_free(repo->oth_xml_url);
+        g_slist_free_full(repo->cache_entries,
+                          (GDestroyNotify) cr_remote_cache_entry_free);
+    }
+    g_free(repo_targets);
+    g_free(repos);
 }
 
 
-struct cr_MetadataLocation *
-cr_locate_metadata(const char *repopath, gboolean ignore_sqlite, GError **err)
+static gboolean
+cr_is_remote_repopath(const char *repopath)
 {
-    struct cr_MetadataLocation *ret = NULL;
-
-    assert(repopath);
-    assert(!err || *err == NULL);
+    return g_str_has_prefix(repopath, "ftp://") ||
+           g_str_has_prefix(repopath, "http://") ||
+           g_str_has_prefix(repopath, "https://");
+}
 
-    if (g_str_has_prefix(repopath, "ftp://") ||
-        g_str_has_prefix(repopath, "http://") ||
-        g_str_has_prefix(repopath, "https://"))
-    {
-        // Remote metadata - Download them via curl
-        ret = cr_get_remote_metadata(repopath, ignore_sqlite);
-    } else {
-        // Local metadata
-        if (g_str_has_prefix(repopath, "file:///"))
-            repopath += 7;
-        ret = cr_get_local_metadata(repopath, ignore_sqlite);
-    }
 
+static struct cr_MetadataLocation *
+cr_locate_metadata_finish(struct cr_MetadataLocation *ret,
+                          const char *repopath,
+                          GError **err)
+{
     if (ret) {
         ret->original_url = g_strdup(repopath);
     } else {
@@ -375,3 +835,84 @@ cr_locate_metadata(const char *repopath, gboolean ignore_sqlite, GError **err)
 
     return ret;
 }
+
+
+struct cr_MetadataLocation *
+cr_locate_metadata(const char *repopath, gboolean ignore_sqlite, GError **err)
+{
+    struct cr_MetadataLocation *ret = NULL;
+
+    assert(repopath);
+    assert(!err || *err == NULL);
+
+    if (cr_is_remote_repopath(repopath))
+    {
+        // Remote metadata - Download them via curl
+        cr_get_remote_metadata(&repopath, 1, ignore_sqlite, &ret);
+    } else {
+        // Local metadata
+        if (g_str_has_prefix(repopath, "file:///"))
+            repopath += 7;
+        ret = cr_get_local_metadata(repopath, ignore_sqlite);
+    }
+
+    return cr_locate_metadata_finish(ret, repopath, err);
+}
+
+
+GSList *
+cr_locate_metadata_list(GSList *repopaths, gboolean ignore_sqlite, GError **err)
+{
+    GSList *locations = NULL;
+    GPtrArray *remote_paths;
+    struct cr_MetadataLocation **remote_locations;
+    guint remote_idx = 0;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    // Download all the remote repos at once
+    remote_paths = g_ptr_array_new();
+    for (GSList *elem = repopaths; elem; elem = g_slist_next(elem))
+        if (cr_is_remote_repopath(elem->data))
+            g_ptr_array_add(remote_paths, elem->data);
+
+    remote_locations = g_new0(struct cr_MetadataLocation *, remote_paths->len + 1);
+    if (remote_paths->len)
+        cr_get_remote_metadata((const char **) remote_paths->pdata,
+                               remote_paths->len,
+                               ignore_sqlite,
+                               remote_locations);
+
+    for (GSList *elem = repopaths; elem; elem = g_slist_next(elem)) {
+        const char *repopath = elem->data;
+        struct cr_MetadataLocation *ml;
+
+        if (tmp_err) {
+            // Remove the downloaded metadata of the remaining repos
+            if (cr_is_remote_repopath(repopath))
+                cr_metadatalocation_free(remote_locations[remote_idx++]);
+            continue;
+        }
+
+        if (cr_is_remote_repopath(repopath))
+            ml = cr_locate_metadata_finish(remote_locations[remote_idx++],
+                                           repopath, &tmp_err);
+        else
+            ml = cr_locate_metadata(repopath, ignore_sqlite, &tmp_err);
+
+        if (ml)
+            locations = g_slist_prepend(locations, ml);
+    }
+
+    g_free(remote_locations);
+    g_ptr_array_free(remote_paths, TRUE);
+
+    if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        g_slist_free_full(locations, (GDestroyNotify) cr_metadatalocation_free);
+        return NULL;
+    }
+
+    return g_slist_reverse(locations);
+}
@@ -40,6 +40,9 @@ struct cr_MetadataLocation {
     char *pri_sqlite_href;      /*!< path to primary.sqlite */
     char *fil_sqlite_href;      /*!< path to filelists.sqlite */
     char *oth_sqlite_href;      /*!< path to other.sqlite */
+    char *pri_zck_href;         /*!< path to primary.xml.zck */
+    char *fil_zck_href;         /*!< path to filelists.xml.zck */
+    char *oth_zck_href;         /*!< path to other.xml.zck */
     GSList *additional_metadata; /*!< list of cr_Metadatum: paths 
                                       to additional metadata such 
                                       as updateinfo, modulemd, .. */
@@ -111,6 +114,47 @@ struct cr_MetadataLocation *cr_locate_metadata(const char *repopath,
                                                gboolean ignore_sqlite,
                                                GError **err);
 
+/** Same as cr_locate_metadata() for more repos. The repodata of all
+ * the remote repos are downloaded concurrently (see cr_download_targets()).
+ * @param repopaths     list of paths to directories with repodata/ subdir
+ * @param ignore_sqlite if ignore_sqlite != 0 sqlite dbs are ignored
+ * @param err           GError **
+ * @return              list of filled cr_MetadataLocation structures in
+ *                      the order of repopaths or NULL if the metadata of
+ *                      any repo cannot be located
+ */
+GSList *cr_locate_metadata_list(GSList *repopaths,
+                                gboolean ignore_sqlite,
+                                GError **err);
+
+/** Do not download the primary.xml, filelists.xml and other.xml of remote
+ * repos into the temporary directory. Their hrefs in cr_MetadataLocation
+ * are the remote URLs then and they are downloaded while parsed
+ * (see cr_sopen_url()), every time they are opened. The files found in
+ * the cache (see cr_locate_metadata_set_cache_dir()) are used locally.
+ * This function is not thread safe, call it before the metadata
+ * are located.
+ * @param streaming     stream the xml files
+ */
+void cr_locate_metadata_set_streaming(gboolean streaming);
+
+/** Cache the files downloaded from remote repos in the directory.
+ * Every file listed in repomd.xml is stored there under its checksum
+ * from repomd.xml (after the checksum is verified) and it is taken from
+ * the cache instead of downloading when a repomd.xml lists the same
+ * checksum again. The repomd.xml itself is always downloaded.
+ * The zchunk compressed primary.xml, filelists.xml and other.xml are used
+ * instead of the xml files if the repo has them and the last downloaded
+ * version of each is kept in the cache, so only their changed chunks are
+ * downloaded next time (see cr_download_zck()).
+ * The directory could be shared by more processes.
+ * This function is not thread safe, call it before the metadata
+ * are located.
+ * @param cache_dir     path to the cache directory (created if missing)
+ *                      or NULL to disable the cache
+ */
+void cr_locate_metadata_set_cache_dir(const char *cache_dir);
+
 /** Free cr_MetadataLocation. If repodata were downloaded remove
  * a temporary directory with repodata.
  * @param ml            MeatadaLocation
@@ -38,12 +38,16 @@
 #include "load_metadata.h"
 #include "package.h"
 #include "xml_dump.h"
+#include "xml_dump_internal.h"
 #include "repomd.h"
+#include "shard.h"
 #include "sqlite.h"
 #include "threads.h"
 #include "xml_file.h"
 #include "cleanup.h"
 #include "koji.h"
+#include "dumper_thread.h"
+#include "xml_parser.h"
 
 #define DEFAULT_OUTPUTDIR               "merged_repo/"
 
@@ -55,6 +59,9 @@ struct CmdOptions _cmd_options = {
         .merge_method = MM_DEFAULT,
         .unique_md_filenames = TRUE,
         .simple_md_filenames = FALSE,
+        .parser_threads = 1,
+        .load_threads = 1,
+        .workers = DEFAULT_WORKERS,
 
         .zck_compression = FALSE,
         .zck_dict_dir = NULL,
@@ -111,6 +118,36 @@ static GOptionEntry cmd_entries[] =
       "Do not include the file's checksum in the metadata filename.", NULL },
     { "omit-baseurl", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.omit_baseurl),
       "Don't add a baseurl to packages that don't have one before." , NULL},
+    { "parser-threads", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.parser_threads),
+      "Number of threads parsing the filelists.xml of every repo "
+      "(default: 1).", "THREADS" },
+    { "workers", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.workers),
+      "Number of workers generating the XML of the merged packages "
+      "(default: 5).", "WORKERS" },
+    { "load-threads", 0, 0, G_OPTION_ARG_INT, &(_cmd_options.load_threads),
+      "Number of repos loaded in parallel (default: 1).", "THREADS" },
+    { "streaming", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.streaming),
+      "Load only the primary.xml of the repos and stream the files and "
+      "changelogs of the merged packages from their filelists.xml and "
+      "other.xml during the dump. Lowers the memory consumption.", NULL },
+    { "intern-strings", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.intern_strings),
+      "Share repeated strings of the loaded packages. Lowers the memory "
+      "consumption when a lot of repos are merged.", NULL },
+    { "stream-remote", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.stream_remote),
+      "Parse the primary.xml, filelists.xml and other.xml of remote repos "
+      "while they are downloaded instead of storing them first.", NULL },
+    { "shards", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.shards),
+      "The repos are shards of one repo generated by createrepo_c --shard. "
+      "Their metadata are joined as they are (without parsing of "
+      "the packages) in the order of the packages of a whole repo.", NULL },
+    { "concat", 0, 0, G_OPTION_ARG_NONE, &(_cmd_options.concat),
+      "The repos have no common packages (name and arch). Their metadata "
+      "are concatenated as they are (without parsing of the packages), "
+      "only the xml:base of the locations is added. Fails if the repos "
+      "have a common package.", NULL },
+    { "cachedir", 0, 0, G_OPTION_ARG_FILENAME, &(_cmd_options.cachedir),
+      "Keep the metadata downloaded from remote repos in this directory and "
+      "reuse the files whose checksums in repomd.xml did not change.", "CACHEDIR" },
 
     // -- Options related to Koji-mergerepos behaviour
     { "koji", 'k', 0, G_OPTION_ARG_NONE, &(_cmd_options.koji),
@@ -271,6 +308,21 @@ check_arguments(struct CmdOptions *options)
         ret = FALSE;
     }
 
+    if (options->parser_threads < 1) {
+        g_critical("--parser-threads must be a positive number");
+        ret = FALSE;
+    }
+
+    if (options->workers < 1) {
+        g_critical("--workers must be a positive number");
+        ret = FALSE;
+    }
+
+    if (options->load_threads < 1) {
+        g_critical("--load-threads must be a positive number");
+        ret = FALSE;
+    }
+
     // Compress type
     if (options->compress_type) {
 
@@ -279,7 +331,7 @@ check_arguments(struct CmdOptions *options)
 
         if (type == CR_CW_UNKNOWN_COMPRESSION) {
             g_critical("Compression %s not available: Please choose from: "
-                       "gz or bz2 or xz", options->compress_type);
+                       "gz or bz2 or xz or zstd", options->compress_type);
             ret = FALSE;
         } else {
             options->db_compression_type = type;
@@ -355,6 +407,25 @@ check_arguments(struct CmdOptions *options)
     if (options->zck_dict_dir)
         options->zck_dict_dir = cr_normalize_dir_path(options->zck_dict_dir);
 
+    // The shards (concatenated repos) are joined without any selection
+    // of the packages
+    if ((options->shards || options->concat)
+        && (options->koji || options->pkgorigins
+            || options->archlist || options->noarch_repo_url
+            || options->all || options->merge_method_str
+            || options->repo_prefix_search))
+    {
+        g_critical("--shards and --concat cannot be used together with "
+                   "-k/--koji, --pkgorigins, -a/--archlist, --noarch-repo, "
+                   "--all, --method or --repo-prefix-search");
+        ret = FALSE;
+    }
+
+    if (options->shards && options->concat) {
+        g_critical("--shards cannot be used together with --concat");
+        ret = FALSE;
+    }
+
     return ret;
 }
 
@@ -398,6 +469,7 @@ free_options(struct CmdOptions *options)
     g_free(options->compress_type);
     g_free(options->merge_method_str);
     g_free(options->noarch_repo_url);
+    g_free(options->cachedir);
 
     g_free(options->groupfile);
     g_free(options->blocked);
@@ -459,6 +531,53 @@ destroy_merged_metadata_hashtable(GHashTable *hashtable)
 
 
 
+// Append a version string to the key in nevra_index. Versions which are
+// equal by rpmvercmp() get the same key: only its alphanumeric segments
+// are used and the leading zeros of the numeric ones are stripped.
+// The '~' and '^' are ignored, the versions with the same key still have
+// to be compared by cr_cmp_version_str().
+static void
+append_version_key(GString *key, const char *str)
+{
+    g_string_append_c(key, '\n');
+    if (!str)
+        return;
+
+    while (*str) {
+        if (g_ascii_isdigit(*str)) {
+            g_string_append_c(key, '#');
+            while (*str == '0')
+                str++;
+            while (g_ascii_isdigit(*str))
+                g_string_append_c(key, *str++);
+        } else if (g_ascii_isalpha(*str)) {
+            g_string_append_c(key, '@');
+            while (g_ascii_isalpha(*str))
+                g_string_append_c(key, *str++);
+        } else {
+            str++;
+        }
+    }
+}
+
+static gchar *
+nevra_index_key(cr_Package *pkg)
+{
+    GString *key = g_string_new(pkg->name);
+    g_string_append_c(key, '\n');
+    g_string_append(key, pkg->arch ? pkg->arch : "");
+    append_version_key(key, pkg->epoch);
+    append_version_key(key, pkg->version);
+    append_version_key(key, pkg->release);
+    return g_string_free(key, FALSE);
+}
+
+static void
+nevra_index_value_free(gpointer data)
+{
+    g_slist_free(data);
+}
+
 // Merged table structure: {"package_name": [pkg, pkg, pkg, ...], ...}
 // Return codes:
 //  0 = Package was not added
@@ -469,13 +588,15 @@ static int
 add_package(cr_Package *pkg,
             gchar *repopath,
             GHashTable *merged,
-            GSList *arch_list,
+            GHashTable *arch_set,
+            GHashTable *nevra_index,
             MergeMethod merge_method,
             struct KojiMergedReposStuff *koji_stuff,
             gboolean omit_baseurl,
             int repoid)
 {
     GSList *list, *element;
+    gchar *nevra_key = NULL;
     int ret = 1;
 
 
@@ -484,15 +605,8 @@ add_package(cr_Package *pkg,
 
     // Check if the package meet the command line architecture constraints
 
-    if (arch_list) {
-        gboolean right_arch = FALSE;
-        for (element=arch_list; element; element=g_slist_next(element)) {
-            if (!g_strcmp0(pkg->arch, (gchar *) element->data)) {
-                right_arch = TRUE;
-            }
-        }
-
-        if (!right_arch) {
+    if (arch_set) {
+        if (!pkg->arch || !g_hash_table_contains(arch_set, pkg->arch)) {
             g_debug("Skip - %s (Bad arch: %s)", pkg->name, pkg->arch);
             return 0;
         }
@@ -512,6 +626,15 @@ add_package(cr_Package *pkg,
     // Lookup package in the merged
     list = (GSList *) g_hash_table_lookup(merged, pkg->name);
 
+    if (nevra_index) {
+        // The list could contain a lot of versions of the package,
+        // only the packages with an equal NEVRA are needed
+        nevra_key = nevra_index_key(pkg);
+        element = g_hash_table_lookup(nevra_index, nevra_key);
+    } else {
+        element = list;
+    }
+
     // Key doesn't exist yet
     if (!list) {
         list = g_slist_prepend(list, pkg);
@@ -519,11 +642,14 @@ add_package(cr_Package *pkg,
             pkg->location_base = cr_safe_string_chunk_insert(pkg->chunk, repopath);
         }
         g_hash_table_insert (merged, (gpointer) g_strdup(pkg->name), (gpointer) list);
+        if (nevra_index)
+            g_hash_table_insert(nevra_index, nevra_key,
+                                g_slist_prepend(NULL, pkg));
         return 1;
     }
 
     // Check if package with the architecture isn't in the list already
-    for (element=list; element; element=g_slist_next(element)) {
+    for (; element; element=g_slist_next(element)) {
         cr_Package *c_pkg = (cr_Package *) element->data;
         if (!g_strcmp0(pkg->arch, c_pkg->arch)) {
 
@@ -609,6 +735,7 @@ add_package(cr_Package *pkg,
                                 pkg->epoch   ? pkg->epoch   : "0",
                                 pkg->version ? pkg->version : "N/A",
                                 pkg->release ? pkg->release : "N/A");
+                        g_free(nevra_key);
                         return 0;
                     }
                     break;
@@ -647,10 +774,80 @@ add_package:
         assert(0);
     }
 
+    if (nevra_index) {
+        GSList *same = g_hash_table_lookup(nevra_index, nevra_key);
+        if (same) {
+            // The first element stays in the index
+            same = g_slist_insert(same, pkg, 1);
+            g_free(nevra_key);
+        } else {
+            g_hash_table_insert(nevra_index, nevra_key,
+                                g_slist_prepend(NULL, pkg));
+        }
+    }
+
     return ret;
 }
 
 
+/** Loading of a repo by the load pool of merge_repos()
+ */
+typedef struct {
+    struct cr_MetadataLocation *ml; /*!< location of the repodata */
+    gint parser_threads;            /*!< threads parsing the filelists.xml */
+    gboolean intern_strings;        /*!< share repeated strings */
+    gboolean primary_only;          /*!< load only the primary.xml */
+    cr_Metadata *metadata;          /*!< loaded metadata or NULL on error */
+    gboolean done;                  /*!< loading finished */
+    GMutex *mutex;                  /*!< protects done */
+    GCond *cond;                    /*!< signals done */
+} LoadRepoTask;
+
+static cr_Metadata *
+load_repo(struct cr_MetadataLocation *ml,
+          gint parser_threads,
+          gboolean intern_strings,
+          gboolean primary_only)
+{
+    cr_Metadata *metadata;
+    struct cr_MetadataLocation pri_ml;
+
+    metadata = cr_metadata_new(CR_HT_KEY_HASH, intern_strings, NULL);
+    cr_metadata_set_parser_threads(metadata, parser_threads);
+    cr_metadata_set_intern_strings(metadata, intern_strings);
+
+    if (primary_only) {
+        // The filelists.xml and other.xml are streamed during the dump
+        pri_ml = *ml;
+        pri_ml.fil_xml_href = NULL;
+        pri_ml.oth_xml_href = NULL;
+        ml = &pri_ml;
+    }
+
+    if (cr_metadata_load_xml(metadata, ml, NULL) != CRE_OK) {
+        cr_metadata_free(metadata);
+        return NULL;
+    }
+
+    return metadata;
+}
+
+static void
+load_repo_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    LoadRepoTask *task = data;
+    cr_Metadata *metadata;
+
+    metadata = load_repo(task->ml, task->parser_threads, task->intern_strings,
+                         task->primary_only);
+
+    g_mutex_lock(task->mutex);
+    task->metadata = metadata;
+    task->done = TRUE;
+    g_cond_broadcast(task->cond);
+    g_mutex_unlock(task->mutex);
+}
+
 long
 merge_repos(GHashTable *merged,
 #ifdef WITH_LIBMODULEMD
@@ -663,10 +860,22 @@ merge_repos(GHashTable *merged,
             struct KojiMergedReposStuff *koji_stuff,
             gboolean omit_baseurl,
             gchar *repo_prefix_search,
-            gchar *repo_prefix_replace)
+            gchar *repo_prefix_replace,
+            gint parser_threads,
+            gboolean intern_strings,
+            GSList **string_chunks,
+            gint load_threads,
+            gboolean primary_only)
 {
     long loaded_packages = 0;
     GSList *used_noarch_keys = NULL;
+    GThreadPool *load_pool = NULL;
+    LoadRepoTask *tasks;
+    GMutex load_mutex;
+    GCond load_cond;
+    guint repo_count = g_slist_length(repo_list);
+    GHashTable *arch_set = NULL;
+    GHashTable *nevra_index = NULL;
 
 #ifdef WITH_LIBMODULEMD
     g_autoptr(ModulemdModuleIndexMerger) merger = NULL;
@@ -675,14 +884,66 @@ merge_repos(GHashTable *merged,
     merger = modulemd_module_index_merger_new();
 #endif /* WITH_LIBMODULEMD */
 
-    // Load all repos
+    if (arch_list) {
+        arch_set = g_hash_table_new(g_str_hash, g_str_equal);
+        for (GSList *elem = arch_list; elem; elem = g_slist_next(elem))
+            g_hash_table_add(arch_set, elem->data);
+    }
+
+    if (merge_method == MM_FIRST_FROM_IDENTICAL_NEVRA
+        || merge_method == MM_ALL_WITH_IDENTICAL_NEVRA)
+        // Lists of packages with the same name are not limited to a package
+        // per arch, pkgs with the same NEVRA are looked up by the index
+        // (key: nevra_index_key(), value: GSList of packages)
+        nevra_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, nevra_index_value_free);
+
+    // Prepare loading of the repos
+
+    g_mutex_init(&load_mutex);
+    g_cond_init(&load_cond);
+    tasks = g_new0(LoadRepoTask, repo_count);
 
     int repoid = 0;
     GSList *element = NULL;
+    for (element = repo_list; element; element = g_slist_next(element), repoid++) {
+        tasks[repoid].ml                = element->data;
+        tasks[repoid].parser_threads    = parser_threads;
+        tasks[repoid].intern_strings    = intern_strings;
+        tasks[repoid].primary_only      = primary_only;
+        tasks[repoid].mutex             = &load_mutex;
+        tasks[repoid].cond              = &load_cond;
+    }
+
+    if (load_threads > 1 && repo_count > 1) {
+        // The repos are loaded in parallel, but merged one by one in
+        // the original order, so the result doesn't depend on the order
+        // in which they are loaded. Only load_threads repos are loaded
+        // in advance to limit the memory consumption.
+        GError *tmp_err = NULL;
+        load_pool = g_thread_pool_new(load_repo_thread, NULL, load_threads,
+                                      FALSE, &tmp_err);
+        if (!load_pool) {
+            g_debug("Cannot create a pool for loading of repos: %s",
+                    tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    guint pushed = 0;
+    if (load_pool)
+        for (; pushed < repo_count && pushed < (guint) load_threads; pushed++)
+            if (tasks[pushed].ml)
+                g_thread_pool_push(load_pool, &tasks[pushed], NULL);
+
+    // Load all repos
+
+    repoid = 0;
     for (element = repo_list; element; element = g_slist_next(element), repoid++) {
         gchar *repopath;                    // base url of current repodata
         cr_Metadata *metadata;              // current repodata
         struct cr_MetadataLocation *ml;     // location of current repodata
+        LoadRepoTask *task = &tasks[repoid];
 
         ml = (struct cr_MetadataLocation *) element->data;
         if (!ml) {
@@ -690,7 +951,6 @@ merge_repos(GHashTable *merged,
             break;
         }
 
-        metadata = cr_metadata_new(CR_HT_KEY_HASH, 0, NULL);
         repopath = cr_normalize_dir_path(ml->original_url);
 
         // Base paths in output of original createrepo doesn't have trailing '/'
@@ -710,8 +970,19 @@ merge_repos(GHashTable *merged,
 
         g_debug("Processing: %s", repopath);
 
-        if (cr_metadata_load_xml(metadata, ml, NULL) != CRE_OK) {
-            cr_metadata_free(metadata);
+        if (load_pool) {
+            g_mutex_lock(&load_mutex);
+            while (!task->done)
+                g_cond_wait(&load_cond, &load_mutex);
+            g_mutex_unlock(&load_mutex);
+            metadata = task->metadata;
+            task->metadata = NULL;
+        } else {
+            metadata = load_repo(ml, parser_threads, intern_strings,
+                                 primary_only);
+        }
+
+        if (!metadata) {
             g_critical("Cannot load repo: \"%s\"", ml->repomd);
             g_free(repopath);
             break;
@@ -728,9 +999,28 @@ merge_repos(GHashTable *merged,
         gpointer key, value;
         guint original_size;
         long repo_loaded_packages = 0;
+        GStringChunk *repo_chunk = NULL;
+
+        if (intern_strings) {
+            // The used packages outlive the metadata object,
+            // their strings have to be kept until the dump
+            GSList *repo_chunks = cr_metadata_steal_chunks(metadata);
+            if (repo_chunks)
+                repo_chunk = repo_chunks->data;
+            *string_chunks = g_slist_concat(repo_chunks, *string_chunks);
+        }
 
         original_size = g_hash_table_size(cr_metadata_hashtable(metadata));
 
+        // Koji-mergerepos specific behaviour -----------
+        // The srpms of the repo are taken from the already loaded packages,
+        // the previous repos take precedence, so the srpm names of the repo
+        // are decided before its packages are checked by koji_allowed()
+        if (koji_stuff && koji_stuff->include_srpms)
+            koji_stuff_add_repo(koji_stuff, cr_metadata_hashtable(metadata),
+                                repoid, ml->original_url);
+        // Koji-mergerepos specific behaviour - end -----
+
         g_hash_table_iter_init (&iter, cr_metadata_hashtable(metadata));
         while (g_hash_table_iter_next (&iter, &key, &value)) {
             int ret;
@@ -750,11 +1040,17 @@ merge_repos(GHashTable *merged,
             g_debug("Reading metadata for %s (%s-%s.%s)",
                     pkg->name, pkg->version, pkg->release, pkg->arch);
 
+            // Packages sharing the chunk don't have it set after loading,
+            // the location_base is inserted into it
+            if (!pkg->chunk)
+                pkg->chunk = repo_chunk;
+
             // Add package
             ret = add_package(pkg,
                               repopath,
                               merged,
-                              arch_list,
+                              arch_set,
+                              nevra_index,
                               merge_method,
                               koji_stuff,
                               omit_baseurl,
@@ -781,10 +1077,7 @@ merge_repos(GHashTable *merged,
                         _cleanup_free_ gchar *nvra = cr_package_nvra(pkg);
                         _cleanup_free_ gchar *url = cr_prepend_protocol(ml->original_url);
 
-                        cr_printf(NULL,
-                                  koji_stuff->pkgorigins,
-                                  "%s\t%s\n",
-                                  nvra, url);
+                        koji_pkgorigins_add(koji_stuff, nvra, url);
                     }
                     // Koji-mergerepos specific behaviour - end -----
                 }
@@ -796,7 +1089,29 @@ merge_repos(GHashTable *merged,
         g_debug("Repo: %s (Loaded: %ld Used: %ld)", repopath,
                 (unsigned long) original_size, repo_loaded_packages);
         g_free(repopath);
+
+        if (load_pool && pushed < repo_count) {
+            // Start loading of the next repo
+            if (tasks[pushed].ml)
+                g_thread_pool_push(load_pool, &tasks[pushed], NULL);
+            pushed++;
+        }
+    }
+
+    if (load_pool) {
+        // Wait for the repos loaded in advance (if the merging was stopped)
+        g_thread_pool_free(load_pool, FALSE, TRUE);
+        for (guint x = 0; x < repo_count; x++)
+            if (tasks[x].metadata)
+                cr_metadata_free(tasks[x].metadata);
     }
+    g_free(tasks);
+    g_mutex_clear(&load_mutex);
+    g_cond_clear(&load_cond);
+    if (arch_set)
+        g_hash_table_destroy(arch_set);
+    if (nevra_index)
+        g_hash_table_destroy(nevra_index);
 
 #ifdef WITH_LIBMODULEMD
     g_autoptr(ModulemdModuleIndex) moduleindex =
@@ -838,6 +1153,538 @@ package_cmp(gconstpointer a_p, gconstpointer b_p)
 }
 
 
+/** Dump of a merged package by the pool of dump_merged_metadata()
+ */
+typedef struct {
+    long id;                /*!< order of the package in the output */
+    cr_Package *pkg;        /*!< merged package */
+    gboolean primary_only;  /*!< files and changelogs are streamed later */
+} DumpTask;
+
+static void
+dump_pkg_thread(gpointer data, gpointer user_data)
+{
+    DumpTask *task = data;
+    struct UserData *udata = user_data;
+    cr_Package *pkg = task->pkg;
+    struct cr_XmlStruct res;
+
+    g_debug("Writing metadata for %s (%s-%s.%s)",
+            pkg->name, pkg->version, pkg->release, pkg->arch);
+
+    if (task->primary_only) {
+        res.primary = cr_xml_dump_primary(pkg, NULL);
+        res.filelists = NULL;
+        res.other = NULL;
+    } else {
+        res = cr_xml_dump(pkg, NULL);
+    }
+
+    cr_dumper_publish_xml(udata, task->id, pkg, res);
+    g_free(task);
+}
+
+/** Package selected by the first pass of the --streaming mode whose
+ * files and changelogs are streamed from its repo during the dump.
+ */
+typedef struct {
+    cr_Package *pkg;        /*!< merged package (only primary data) */
+    guint fil_left;         /*!< copies missing in filelists.xml */
+    guint oth_left;         /*!< copies missing in other.xml */
+} StreamedPkg;
+
+/** Writing of filelists.xml or other.xml in the --streaming mode
+ */
+typedef struct {
+    GHashTable *selected;   /*!< pkgId -> StreamedPkg */
+    gboolean filelists;     /*!< writing filelists (TRUE) or other (FALSE) */
+    cr_XmlFile *f;          /*!< output xml file */
+    cr_XmlFile *zck_f;      /*!< output zchunk file or NULL */
+    cr_SqliteDb *db;        /*!< output sqlite db or NULL */
+    char *prev_srpm;        /*!< source rpm of the last zchunk chunk */
+} StreamData;
+
+static void
+stream_write_pkg(StreamData *sd, cr_Package *merged_pkg, cr_Package *pkg)
+{
+    char *xml;
+
+    if (sd->filelists)
+        xml = cr_xml_dump_filelists(pkg, NULL);
+    else
+        xml = cr_xml_dump_other(pkg, NULL);
+
+    if (sd->zck_f &&
+       (!sd->prev_srpm || !merged_pkg->rpm_sourcerpm ||
+        strcmp(merged_pkg->rpm_sourcerpm, sd->prev_srpm) != 0)) {
+        cr_end_chunk(sd->zck_f->f, NULL);
+        g_free(sd->prev_srpm);
+        sd->prev_srpm = g_strdup(merged_pkg->rpm_sourcerpm);
+    }
+
+    cr_xmlfile_add_chunk(sd->f, (const char *) xml, NULL);
+    if (sd->zck_f)
+        cr_xmlfile_add_chunk(sd->zck_f, (const char *) xml, NULL);
+    if (sd->db)
+        cr_db_add_pkg(sd->db, pkg, NULL);
+
+    free(xml);
+}
+
+static int
+stream_newpkgcb(cr_Package **pkg,
+                const char *pkgId,
+                G_GNUC_UNUSED const char *name,
+                G_GNUC_UNUSED const char *arch,
+                void *cbdata,
+                G_GNUC_UNUSED GError **err)
+{
+    StreamData *sd = cbdata;
+    StreamedPkg *spkg = g_hash_table_lookup(sd->selected, pkgId);
+
+    // Packages which were not selected are skipped by the parser
+    if (spkg && (sd->filelists ? spkg->fil_left : spkg->oth_left))
+        *pkg = cr_package_new();
+
+    return CR_CB_RET_OK;
+}
+
+static int
+stream_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
+{
+    StreamData *sd = cbdata;
+    StreamedPkg *spkg = g_hash_table_lookup(sd->selected, pkg->pkgId);
+    guint *left = sd->filelists ? &spkg->fil_left : &spkg->oth_left;
+
+    // Packages with the same pkgId are the same, the data could be
+    // written for all their copies
+    for (; *left; (*left)--)
+        stream_write_pkg(sd, spkg->pkg, pkg);
+
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+/** Second pass of the --streaming mode. Write the files (or changelogs)
+ * of the selected packages streamed from filelists.xml (or other.xml)
+ * of the merged repos.
+ */
+static void
+stream_metadata(StreamData *sd, GSList *repo_list)
+{
+    GError *tmp_err = NULL;
+
+    for (GSList *elem = repo_list; elem; elem = g_slist_next(elem)) {
+        struct cr_MetadataLocation *ml = elem->data;
+        const char *path = sd->filelists ? ml->fil_xml_href
+                                         : ml->oth_xml_href;
+        if (!path)
+            continue;
+
+        g_debug("Streaming: %s", path);
+
+        if (sd->filelists)
+            cr_xml_parse_filelists(path, stream_newpkgcb, sd, stream_pkgcb,
+                                   sd, cr_warning_cb, "Filelists XML parser",
+                                   &tmp_err);
+        else
+            cr_xml_parse_other(path, stream_newpkgcb, sd, stream_pkgcb,
+                               sd, cr_warning_cb, "Other XML parser",
+                               &tmp_err);
+        if (tmp_err) {
+            g_critical("Cannot stream %s: %s", path, tmp_err->message);
+            g_clear_error(&tmp_err);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Packages missing in the repos have no files (changelogs)
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, sd->selected);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        StreamedPkg *spkg = value;
+        guint *left = sd->filelists ? &spkg->fil_left : &spkg->oth_left;
+        for (; *left; (*left)--)
+            stream_write_pkg(sd, spkg->pkg, spkg->pkg);
+    }
+
+    g_free(sd->prev_srpm);
+    sd->prev_srpm = NULL;
+}
+
+
+/** Output of one type of the metadata in the --shards and --concat modes
+ */
+typedef struct {
+    cr_XmlFile *f;          /*!< output xml file */
+    cr_XmlFile *zck_f;      /*!< output zchunk file or NULL */
+    cr_SqliteDb *db;        /*!< output sqlite db or NULL */
+} ShardOutput;
+
+static const char *
+shard_xml_href(struct cr_MetadataLocation *ml, cr_DatabaseType type)
+{
+    switch (type) {
+        case CR_DB_PRIMARY:     return ml->pri_xml_href;
+        case CR_DB_FILELISTS:   return ml->fil_xml_href;
+        default:                return ml->oth_xml_href;
+    }
+}
+
+static const char *
+shard_sqlite_href(struct cr_MetadataLocation *ml, cr_DatabaseType type)
+{
+    switch (type) {
+        case CR_DB_PRIMARY:     return ml->pri_sqlite_href;
+        case CR_DB_FILELISTS:   return ml->fil_sqlite_href;
+        default:                return ml->oth_sqlite_href;
+    }
+}
+
+static cr_ShardReader *
+shard_reader_open(struct cr_MetadataLocation *ml,
+                  cr_DatabaseType type,
+                  GError **err)
+{
+    const char *path = shard_xml_href(ml, type);
+
+    if (!path) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_NOFILE,
+                    "Missing %s xml in repo %s",
+                    type == CR_DB_PRIMARY ? "primary" :
+                    type == CR_DB_FILELISTS ? "filelists" : "other",
+                    ml->original_url);
+        return NULL;
+    }
+
+    return cr_shard_reader_open(path, err);
+}
+
+/** Number of packages of all the shards (from the headers of their
+ * primary.xml).
+ */
+static long
+shards_packages(GSList *repo_list)
+{
+    GError *tmp_err = NULL;
+    long packages = 0;
+
+    for (GSList *elem = repo_list; elem; elem = g_slist_next(elem)) {
+        cr_ShardReader *reader = shard_reader_open(elem->data, CR_DB_PRIMARY,
+                                                   &tmp_err);
+        if (!reader) {
+            g_critical("Cannot read repo: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+            exit(EXIT_FAILURE);
+        }
+        packages += cr_shard_reader_packages(reader);
+        cr_shard_reader_free(reader);
+    }
+
+    return packages;
+}
+
+static void
+shard_write_chunk(ShardOutput *out, const char *chunk)
+{
+    cr_xmlfile_add_chunk(out->f, chunk, NULL);
+    if (out->zck_f) {
+        // Every package is a zchunk chunk, the source rpms are not parsed
+        cr_end_chunk(out->zck_f->f, NULL);
+        cr_xmlfile_add_chunk(out->zck_f, chunk, NULL);
+    }
+}
+
+static void
+shard_mismatch_error(GError **err,
+                     GSList *repo_list,
+                     guint shard,
+                     cr_DatabaseType type)
+{
+    struct cr_MetadataLocation *ml = g_slist_nth_data(repo_list, shard);
+    g_set_error(err, CREATEREPO_C_ERROR, CRE_XMLDATA,
+                "Packages of %s don't match the primary.xml of repo %s",
+                shard_xml_href(ml, type), ml->original_url);
+}
+
+/** Base url of the repo as in merge_repos()
+ */
+static gchar *
+concat_repo_base(struct cr_MetadataLocation *ml)
+{
+    gchar *repopath = cr_normalize_dir_path(ml->original_url);
+
+    // Base paths in output of original createrepo doesn't have trailing '/'
+    if (repopath && strlen(repopath) > 1)
+        repopath[strlen(repopath)-1] = '\0';
+
+    return repopath;
+}
+
+/** Text of the first element of the chunk or NULL
+ */
+static gchar *
+chunk_element_text(const char *chunk, const char *start, const char *end)
+{
+    const char *text = strstr(chunk, start);
+    const char *text_end = text ? strstr(text, end) : NULL;
+
+    if (!text_end)
+        return NULL;
+    text += strlen(start);
+    return g_strndup(text, text_end - text);
+}
+
+/** Add the base attribute (` xml:base="..."`) to the location
+ * of the primary chunk without a base (as add_package() does), returns
+ * the chunk or the rewritten chunk in the buf.
+ */
+static const char *
+chunk_set_base(GString *buf, const char *chunk, const char *base_attr)
+{
+    const char *location = strstr(chunk, "<location ");
+    const char *location_end = location ? strchr(location, '>') : NULL;
+    const char *old_base;
+
+    if (!location_end)
+        return chunk;
+
+    old_base = g_strstr_len(location, location_end - location, " xml:base=\"");
+    if (old_base && old_base[11] != '"')
+        return chunk;
+
+    g_string_assign(buf, chunk);
+    if (old_base) {
+        // Empty base is the same as no base
+        gsize offset = old_base - chunk;
+        g_string_erase(buf, offset, strlen(" xml:base=\"\""));
+        g_string_insert(buf, offset, base_attr);
+    } else {
+        g_string_insert(buf, location + strlen("<location") - chunk,
+                        base_attr);
+    }
+
+    return buf->str;
+}
+
+/** Merge the sorted primary chunks of the shards by their locations.
+ */
+static void
+shards_merge_primary(cr_ShardReader **readers,
+                     guint count,
+                     ShardOutput *out,
+                     GArray *order,
+                     GError **err)
+{
+    const char **chunks = g_new0(const char *, count);
+    GError *tmp_err = NULL;
+
+    for (guint x = 0; x < count && !tmp_err; x++)
+        chunks[x] = cr_shard_reader_next(readers[x], &tmp_err);
+
+    while (!tmp_err) {
+        guint best = count;
+        for (guint x = 0; x < count; x++)
+            if (chunks[x] && (best == count
+                    || cr_shard_chunk_cmp(chunks[x], chunks[best]) < 0))
+                best = x;
+        if (best == count)
+            break;
+
+        shard_write_chunk(out, chunks[best]);
+        g_array_append_val(order, best);
+        chunks[best] = cr_shard_reader_next(readers[best], &tmp_err);
+    }
+
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
+    g_free(chunks);
+}
+
+/** Concatenate the primary chunks of the repos (--concat). A package
+ * (name and arch) found in more repos is an error.
+ */
+static void
+concat_primary(GSList *repo_list,
+               cr_ShardReader **readers,
+               gchar **bases,
+               ShardOutput *out,
+               GArray *order,
+               GError **err)
+{
+    // "name.arch" -> repo (its index + 1)
+    GHashTable *owners = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, NULL);
+    GString *buf = g_string_new(NULL);
+    GError *tmp_err = NULL;
+    guint x = 0;
+
+    for (GSList *elem = repo_list; elem && !tmp_err; elem = elem->next, x++) {
+        const char *chunk;
+
+        while (!tmp_err && (chunk = cr_shard_reader_next(readers[x],
+                                                         &tmp_err))) {
+            gchar *name = chunk_element_text(chunk, "<name>", "</name>");
+            gchar *arch = chunk_element_text(chunk, "<arch>", "</arch>");
+            gchar *key = g_strconcat(name ? name : "", ".",
+                                     arch ? arch : "", NULL);
+            guint owner = GPOINTER_TO_UINT(g_hash_table_lookup(owners, key));
+
+            g_free(name);
+            g_free(arch);
+
+            if (owner && owner != x + 1) {
+                struct cr_MetadataLocation *ml;
+                ml = g_slist_nth_data(repo_list, owner - 1);
+                g_set_error(&tmp_err, CREATEREPO_C_ERROR, CRE_BADARG,
+                            "Package %s is in %s and in %s, --concat "
+                            "needs repos without common packages", key,
+                            ml->original_url,
+                            ((struct cr_MetadataLocation *)
+                             elem->data)->original_url);
+                g_free(key);
+                break;
+            }
+
+            if (!owner)
+                g_hash_table_insert(owners, key, GUINT_TO_POINTER(x + 1));
+            else
+                g_free(key);
+
+            if (bases)
+                chunk = chunk_set_base(buf, chunk, bases[x]);
+            shard_write_chunk(out, chunk);
+            g_array_append_val(order, x);
+        }
+    }
+
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
+    g_string_free(buf, TRUE);
+    g_hash_table_destroy(owners);
+}
+
+/** Write the package chunks of the xml files of the shards (the repos
+ * with --concat). The primary chunks are merged by their locations (every
+ * shard is already sorted) or concatenated, the filelists and other
+ * chunks are then written in the same order of the shards.
+ */
+static gboolean
+shards_write_xml(GSList *repo_list,
+                 ShardOutput *out,
+                 long packages,
+                 gboolean concat,
+                 gchar **bases,
+                 GError **err)
+{
+    guint count = g_slist_length(repo_list);
+    cr_ShardReader **readers = g_new0(cr_ShardReader *, count);
+    GArray *order = g_array_new(FALSE, FALSE, sizeof(guint));
+    GError *tmp_err = NULL;
+
+    for (cr_DatabaseType type = CR_DB_PRIMARY; type < CR_DB_SENTINEL; type++) {
+        GSList *elem = repo_list;
+
+        for (guint x = 0; x < count && !tmp_err; x++, elem = elem->next)
+            readers[x] = shard_reader_open(elem->data, type, &tmp_err);
+
+        if (type == CR_DB_PRIMARY && !tmp_err) {
+            if (concat)
+                concat_primary(repo_list, readers, bases, &out[type],
+                               order, &tmp_err);
+            else
+                shards_merge_primary(readers, count, &out[type], order,
+                                     &tmp_err);
+        }
+
+        for (guint y = 0; type != CR_DB_PRIMARY && y < order->len
+                          && !tmp_err; y++) {
+            guint x = g_array_index(order, guint, y);
+            const char *chunk = cr_shard_reader_next(readers[x], &tmp_err);
+            if (chunk)
+                shard_write_chunk(&out[type], chunk);
+            else if (!tmp_err)
+                shard_mismatch_error(&tmp_err, repo_list, x, type);
+        }
+
+        // The rest of the file must be empty
+        for (guint x = 0; type != CR_DB_PRIMARY && x < count && !tmp_err; x++)
+            if (cr_shard_reader_next(readers[x], &tmp_err))
+                shard_mismatch_error(&tmp_err, repo_list, x, type);
+
+        for (guint x = 0; x < count; x++) {
+            cr_shard_reader_free(readers[x]);
+            readers[x] = NULL;
+        }
+
+        if (tmp_err)
+            break;
+    }
+
+    if (!tmp_err && order->len != (guint) packages)
+        g_set_error(&tmp_err, CREATEREPO_C_ERROR, CRE_XMLDATA,
+                    "The repos have %u packages, their headers "
+                    "declare %ld", order->len, packages);
+
+    g_array_free(order, TRUE);
+    g_free(readers);
+
+    if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/** Append the sqlite dbs of the shards (in the order of the shards,
+ * the packages of a shard get consecutive pkgKeys). The bases (or NULL)
+ * are set to the primary packages without a location_base.
+ */
+static gboolean
+shards_write_dbs(GSList *repo_list,
+                 ShardOutput *out,
+                 gchar **bases,
+                 const char *tmp_out_repo,
+                 GError **err)
+{
+    for (cr_DatabaseType type = CR_DB_PRIMARY; type < CR_DB_SENTINEL; type++) {
+        guint x = 0;
+
+        if (!out[type].db)
+            continue;
+
+        for (GSList *elem = repo_list; elem; elem = g_slist_next(elem), x++) {
+            struct cr_MetadataLocation *ml = elem->data;
+            const char *path = shard_sqlite_href(ml, type);
+            gboolean ret;
+
+            if (!path) {
+                g_set_error(err, CREATEREPO_C_ERROR, CRE_NOFILE,
+                            "Missing sqlite db in repo %s "
+                            "(use --no-database)", ml->original_url);
+                return FALSE;
+            }
+
+            gchar *db_path = g_strdup_printf("%sshard-%u-%d.sqlite",
+                                             tmp_out_repo, x, type);
+            ret = cr_decompress_file(path, db_path,
+                                     CR_CW_AUTO_DETECT_COMPRESSION,
+                                     err) == CRE_OK
+                  && cr_db_append_db(out[type].db, db_path,
+                                     bases ? bases[x] : NULL,
+                                     err) == CRE_OK;
+            g_unlink(db_path);
+            g_free(db_path);
+
+            if (!ret)
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 #ifdef WITH_LIBMODULEMD
 static gint
 modulemd_write_handler (void          *data,
@@ -865,6 +1712,7 @@ dump_merged_metadata(GHashTable *merged_hashtable,
 #ifdef WITH_LIBMODULEMD
                      ModulemdModuleIndex *module_index,
 #endif /* WITH_LIBMODULEMD */
+                     GSList *repo_list,
                      struct CmdOptions *cmd_options)
 {
     GError *tmp_err = NULL;
@@ -1147,63 +1995,145 @@ dump_merged_metadata(GHashTable *merged_hashtable,
     }
 
 
-    // Dump hashtable
-
-    GList *keys, *key;
-    keys = g_hash_table_get_keys(merged_hashtable);
-    keys = g_list_sort(keys, (GCompareFunc) g_strcmp0);
-
-    char *prev_srpm = NULL;
+    if (cmd_options->shards || cmd_options->concat) {
+        // The metadata of the packages of the shards (repos) are copied
+        // as they are
+        ShardOutput out[CR_DB_SENTINEL] = {
+            [CR_DB_PRIMARY]   = { pri_f, pri_cr_zck, pri_db },
+            [CR_DB_FILELISTS] = { fil_f, fil_cr_zck, fil_db },
+            [CR_DB_OTHER]     = { oth_f, oth_cr_zck, oth_db },
+        };
+        gchar **bases = NULL;       // location_base of the repos
+        gchar **base_attrs = NULL;  // xml:base attributes of the repos
+
+        if (cmd_options->concat && !cmd_options->omit_baseurl) {
+            guint count = g_slist_length(repo_list), x = 0;
+            bases = g_new0(gchar *, count + 1);
+            base_attrs = g_new0(gchar *, count + 1);
+            for (GSList *elem = repo_list; elem; elem = elem->next, x++) {
+                GString *attr = g_string_new(NULL);
+                bases[x] = concat_repo_base(elem->data);
+                cr_xml_dump_attr(attr, "xml:base", bases[x]);
+                base_attrs[x] = g_string_free(attr, FALSE);
+            }
+        }
 
-    for (key = keys; key; key = g_list_next(key)) {
-        gpointer value = g_hash_table_lookup(merged_hashtable, key->data);
-        GSList *element = (GSList *) value;
-        element = g_slist_sort(element, package_cmp);
-        for (; element; element=g_slist_next(element)) {
-            struct cr_XmlStruct res;
-            cr_Package *pkg;
+        if (!shards_write_xml(repo_list, out, packages, cmd_options->concat,
+                              base_attrs, &tmp_err)
+            || !shards_write_dbs(repo_list, out, bases,
+                                 cmd_options->tmp_out_repo, &tmp_err))
+        {
+            g_critical("Cannot merge %s: %s",
+                       cmd_options->concat ? "repos" : "shards",
+                       tmp_err->message);
+            g_clear_error(&tmp_err);
+            exit(EXIT_FAILURE);
+        }
 
-            pkg = (cr_Package *) element->data;
-            res = cr_xml_dump(pkg, NULL);
+        g_strfreev(bases);
+        g_strfreev(base_attrs);
+    } else {
+        // Dump hashtable
+        // The XML is generated by a pool of workers and written in the order
+        // of the packages by the writers of the ordered commit stage
+        // (the same as in createrepo_c, see dumper_thread.h)
+
+        GList *keys, *key;
+        keys = g_hash_table_get_keys(merged_hashtable);
+        keys = g_list_sort(keys, (GCompareFunc) g_strcmp0);
+
+        GPtrArray *pkgs = g_ptr_array_new();
+        for (key = keys; key; key = g_list_next(key)) {
+            gpointer value = g_hash_table_lookup(merged_hashtable, key->data);
+            GSList *element = (GSList *) value;
+            element = g_slist_sort(element, package_cmp);
+            for (; element; element=g_slist_next(element))
+                g_ptr_array_add(pkgs, element->data);
+        }
+        g_list_free(keys);
+
+        struct UserData udata;
+        memset(&udata, 0, sizeof(struct UserData));
+        udata.pri_f             = pri_f;
+        udata.fil_f             = fil_f;
+        udata.oth_f             = oth_f;
+        udata.pri_db            = pri_db;
+        udata.fil_db            = fil_db;
+        udata.oth_db            = oth_db;
+        udata.pri_zck           = pri_cr_zck;
+        udata.fil_zck           = fil_cr_zck;
+        udata.oth_zck           = oth_cr_zck;
+        udata.pri_zck_chunking  = CR_ZCK_CHUNKING_SRPM;
+        udata.fil_zck_chunking  = CR_ZCK_CHUNKING_SRPM;
+        udata.oth_zck_chunking  = CR_ZCK_CHUNKING_SRPM;
+        udata.task_count        = pkgs->len;
+
+        if (!cr_dumper_writers_start(&udata,
+                                     cmd_options->workers * 64,
+                                     (gsize) DEFAULT_DUMP_BUFFER_MB * 1024 * 1024,
+                                     &tmp_err))
+        {
+            g_critical("Cannot start writer threads: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+            exit(EXIT_FAILURE);
+        }
 
-            g_debug("Writing metadata for %s (%s-%s.%s)",
-                    pkg->name, pkg->version, pkg->release, pkg->arch);
+        GThreadPool *dump_pool = g_thread_pool_new(dump_pkg_thread, &udata,
+                                                   cmd_options->workers, TRUE,
+                                                   &tmp_err);
+        if (!dump_pool) {
+            g_debug("Cannot create a pool of dump workers: %s", tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
 
-            if (cmd_options->zck_compression &&
-               (!prev_srpm || !pkg->rpm_sourcerpm ||
-                strlen(prev_srpm) != strlen(pkg->rpm_sourcerpm) ||
-                strncmp(pkg->rpm_sourcerpm, prev_srpm, strlen(prev_srpm)) != 0)) {
-                cr_end_chunk(pri_cr_zck->f, NULL);
-                cr_end_chunk(fil_cr_zck->f, NULL);
-                cr_end_chunk(oth_cr_zck->f, NULL);
-                g_free(prev_srpm);
-                if (pkg->rpm_sourcerpm)
-                    prev_srpm = g_strdup(pkg->rpm_sourcerpm);
-                else
-                    prev_srpm = NULL;
-            }
-            cr_xmlfile_add_chunk(pri_f, (const char *) res.primary, NULL);
-            cr_xmlfile_add_chunk(fil_f, (const char *) res.filelists, NULL);
-            cr_xmlfile_add_chunk(oth_f, (const char *) res.other, NULL);
-            if (cmd_options->zck_compression) {
-                cr_xmlfile_add_chunk(pri_cr_zck, (const char *) res.primary, NULL);
-                cr_xmlfile_add_chunk(fil_cr_zck, (const char *) res.filelists, NULL);
-                cr_xmlfile_add_chunk(oth_cr_zck, (const char *) res.other, NULL);
+        // pkgId -> StreamedPkg (packages whose files and changelogs have
+        // to be streamed from the repos in the --streaming mode)
+        GHashTable *streamed = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                     NULL, g_free);
+
+        for (guint x = 0; x < pkgs->len; x++) {
+            cr_Package *pkg = g_ptr_array_index(pkgs, x);
+            DumpTask *task = g_new0(DumpTask, 1);
+
+            task->id  = x;
+            task->pkg = pkg;
+            task->primary_only = cmd_options->streaming
+                    && !(pkg->loadingflags & CR_PACKAGE_LOADED_FIL
+                         && pkg->loadingflags & CR_PACKAGE_LOADED_OTH);
+
+            if (task->primary_only) {
+                StreamedPkg *spkg = g_hash_table_lookup(streamed, pkg->pkgId);
+                if (!spkg) {
+                    spkg = g_new0(StreamedPkg, 1);
+                    spkg->pkg = pkg;
+                    g_hash_table_insert(streamed, pkg->pkgId, spkg);
+                }
+                spkg->fil_left++;
+                spkg->oth_left++;
             }
 
-            if (!cmd_options->no_database) {
-                cr_db_add_pkg(pri_db, pkg, NULL);
-                cr_db_add_pkg(fil_db, pkg, NULL);
-                cr_db_add_pkg(oth_db, pkg, NULL);
-            }
+            if (dump_pool)
+                g_thread_pool_push(dump_pool, task, NULL);
+            else
+                dump_pkg_thread(task, &udata);
+        }
 
-            free(res.primary);
-            free(res.filelists);
-            free(res.other);
+        if (dump_pool)
+            g_thread_pool_free(dump_pool, FALSE, TRUE);
+        cr_dumper_writers_finish(&udata);
+        g_ptr_array_free(pkgs, TRUE);
+
+        if (g_hash_table_size(streamed)) {
+            StreamData sd = { streamed, TRUE, fil_f, fil_cr_zck, fil_db, NULL };
+            stream_metadata(&sd, repo_list);
+            sd.filelists = FALSE;
+            sd.f = oth_f;
+            sd.zck_f = oth_cr_zck;
+            sd.db = oth_db;
+            stream_metadata(&sd, repo_list);
         }
+        g_hash_table_destroy(streamed);
     }
-    g_free(prev_srpm);
-    g_list_free(keys);
 
 
     // Close files
@@ -1221,11 +2151,15 @@ dump_merged_metadata(GHashTable *merged_hashtable,
     // Write updateinfo.xml
     // TODO
 
+    cr_ContentStat *update_info_stat = NULL;
+
     if (!cmd_options->noupdateinfo) {
-        CR_FILE *update_info = cr_open(update_info_filename,
-                                       CR_CW_MODE_WRITE,
-                                       cmd_options->groupfile_compression_type,
-                                       &tmp_err);
+        update_info_stat = cr_contentstat_new(CR_CHECKSUM_SHA256, NULL);
+        CR_FILE *update_info = cr_sopen(update_info_filename,
+                                        CR_CW_MODE_WRITE,
+                                        cmd_options->groupfile_compression_type,
+                                        update_info_stat,
+                                        &tmp_err);
         if (update_info) {
             cr_puts(update_info,
                     "<?xml version=\"1.0\"?>\n<updates></updates>\n",
@@ -1243,15 +2177,18 @@ dump_merged_metadata(GHashTable *merged_hashtable,
 #ifdef WITH_LIBMODULEMD
     // Write modulemd
     g_autofree gchar *modulemd_filename = NULL;
+    cr_ContentStat *modulemd_stat = NULL;
 
     if (module_index) {
         gboolean ret;
         modulemd_filename =
             g_strconcat(cmd_options->tmp_out_repo, "/modules.yaml.gz", NULL);
-        CR_FILE *modulemd = cr_open(modulemd_filename,
-                                    CR_CW_MODE_WRITE,
-                                    CR_CW_GZ_COMPRESSION,
-                                    &tmp_err);
+        modulemd_stat = cr_contentstat_new(CR_CHECKSUM_SHA256, NULL);
+        CR_FILE *modulemd = cr_sopen(modulemd_filename,
+                                     CR_CW_MODE_WRITE,
+                                     CR_CW_GZ_COMPRESSION,
+                                     modulemd_stat,
+                                     &tmp_err);
         if (modulemd) {
             ret = modulemd_module_index_dump_to_custom(module_index,
                                                        modulemd_write_handler,
@@ -1299,6 +2236,8 @@ dump_merged_metadata(GHashTable *merged_hashtable,
     if (module_index) {
         modulemd_rec =
           cr_repomd_record_new("modules", modulemd_filename);
+        cr_repomd_record_load_contentstat(modulemd_rec, modulemd_stat);
+        cr_contentstat_free(modulemd_stat, NULL);
     }
 #endif /* WITH_LIBMODULEMD */
 
@@ -1380,7 +2319,13 @@ dump_merged_metadata(GHashTable *merged_hashtable,
 
     if (!cmd_options->noupdateinfo) {
         update_info_rec = cr_repomd_record_new("updateinfo", update_info_filename);
+        // The stats of the written content, unless the file has no open
+        // checksum (uncompressed) or needs the zchunk header checksum too
+        if (cmd_options->groupfile_compression_type != CR_CW_NO_COMPRESSION
+            && cmd_options->groupfile_compression_type != CR_CW_ZCK_COMPRESSION)
+            cr_repomd_record_load_contentstat(update_info_rec, update_info_stat);
         cr_repomd_record_fill(update_info_rec, CR_CHECKSUM_SHA256, NULL);
+        cr_contentstat_free(update_info_stat, NULL);
         if (cmd_options->zck_compression) {
             update_info_zck_rec = cr_repomd_record_new("updateinfo_zck", NULL);
             cr_repomd_record_compress_and_fill(update_info_rec,
@@ -1790,27 +2735,27 @@ main(int argc, char **argv)
     GSList *local_repos = NULL;
     GSList *element = NULL;
     gchar *groupfile = NULL;
-    gboolean cr_download_failed = FALSE;
 
-    for (element = cmd_options->repo_list; element; element = g_slist_next(element)) {
-        struct cr_MetadataLocation *loc = cr_locate_metadata((gchar *) element->data, TRUE, NULL);
-        if (!loc) {
-            g_warning("Downloading of repodata failed: %s", (gchar *) element->data);
-            cr_download_failed = TRUE;
-            break;
-        }
-        local_repos = g_slist_prepend(local_repos, loc);
-    }
-
-    if (cr_download_failed) {
-        // Remove downloaded metadata and free structures
-        for (element = local_repos; element; element = g_slist_next(element)) {
-            struct cr_MetadataLocation *loc = (struct cr_MetadataLocation  *) element->data;
-            cr_metadatalocation_free(loc);
-        }
+    // The remote repos are downloaded in parallel
+    cr_locate_metadata_set_streaming(cmd_options->stream_remote);
+    cr_locate_metadata_set_cache_dir(cmd_options->cachedir);
+    // The sqlite dbs of the shards (--concat repos) are appended
+    // to the merged dbs
+    local_repos = cr_locate_metadata_list(cmd_options->repo_list,
+                                          !(cmd_options->shards
+                                            || cmd_options->concat)
+                                          || cmd_options->no_database,
+                                          &tmp_err);
+    if (tmp_err) {
+        // The downloaded metadata are already removed
+        g_warning("Downloading of repodata failed: %s", tmp_err->message);
+        g_clear_error(&tmp_err);
         return 1;
     }
 
+    // The repo_list is in the reversed order
+    local_repos = g_slist_reverse(local_repos);
+
 
     // Groupfile
     // XXX: There must be a better logic
@@ -1908,7 +2853,8 @@ main(int argc, char **argv)
 
     struct KojiMergedReposStuff *koji_stuff = NULL;
     if (cmd_options->koji)
-        koji_stuff_prepare(&koji_stuff, cmd_options, local_repos);
+        // The srpms are collected by merge_repos() from the loaded repos
+        koji_stuff_prepare(&koji_stuff, cmd_options, NULL);
     else if (cmd_options->pkgorigins)
         pkgorigins_prepare(&koji_stuff, cmd_options->tmp_out_repo);
 
@@ -1916,6 +2862,7 @@ main(int argc, char **argv)
     // Load metadata
 
     long loaded_packages;
+    GSList *string_chunks = NULL;
     GHashTable *merged_hashtable = new_merged_metadata_hashtable();
     // merged_hashtable:
     //   Key: pkg->name
@@ -1924,21 +2871,30 @@ main(int argc, char **argv)
     g_autoptr(ModulemdModuleIndex) merged_index = NULL;
 #endif
 
-    loaded_packages = merge_repos(merged_hashtable,
+    if (cmd_options->shards || cmd_options->concat)
+        // The packages of the shards (repos) are not loaded
+        loaded_packages = shards_packages(local_repos);
+    else
+        loaded_packages = merge_repos(merged_hashtable,
 #ifdef WITH_LIBMODULEMD
-                                  &merged_index,
+                                      &merged_index,
 #endif /* WITH_LIBMODULEMD */
-                                  local_repos,
-                                  cmd_options->arch_list,
-                                  cmd_options->merge_method,
-                                  noarch_metadata ?
-                                        cr_metadata_hashtable(noarch_metadata)
-                                      : NULL,
-                                  koji_stuff,
-                                  cmd_options->omit_baseurl,
-                                  cmd_options->repo_prefix_search,
-                                  cmd_options->repo_prefix_replace
-                                 );
+                                      local_repos,
+                                      cmd_options->arch_list,
+                                      cmd_options->merge_method,
+                                      noarch_metadata ?
+                                            cr_metadata_hashtable(noarch_metadata)
+                                          : NULL,
+                                      koji_stuff,
+                                      cmd_options->omit_baseurl,
+                                      cmd_options->repo_prefix_search,
+                                      cmd_options->repo_prefix_replace,
+                                      cmd_options->parser_threads,
+                                      cmd_options->intern_strings,
+                                      &string_chunks,
+                                      cmd_options->load_threads,
+                                      cmd_options->streaming
+                                     );
 
 
     // Destroy koji stuff - we have to close pkgorigins file before dump
@@ -1954,6 +2910,7 @@ main(int argc, char **argv)
 #ifdef WITH_LIBMODULEMD
                          merged_index,
 #endif
+                         local_repos,
                          cmd_options);
 
 
@@ -1971,6 +2928,7 @@ main(int argc, char **argv)
     g_free(groupfile);
     cr_metadata_free(noarch_metadata);
     destroy_merged_metadata_hashtable(merged_hashtable);
+    g_slist_free_full(string_chunks, (GDestroyNotify) g_string_chunk_free);
     free_options(cmd_options);
     return 0;
 }
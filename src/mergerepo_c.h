@@ -29,6 +29,8 @@ extern "C" {
 
 #define DEFAULT_DB_COMPRESSION_TYPE             CR_CW_BZ2_COMPRESSION
 #define DEFAULT_GROUPFILE_COMPRESSION_TYPE      CR_CW_GZ_COMPRESSION
+#define DEFAULT_WORKERS                         5
+#define DEFAULT_DUMP_BUFFER_MB                  256
 
 typedef enum {
     MM_DEFAULT,
@@ -65,6 +67,15 @@ struct CmdOptions {
     gboolean unique_md_filenames;
     gboolean simple_md_filenames;
     gboolean omit_baseurl;
+    gint parser_threads;
+    gint load_threads;
+    gint workers;
+    gboolean streaming;
+    gboolean intern_strings;
+    gboolean stream_remote;
+    gboolean shards;
+    gboolean concat;
+    char *cachedir;
 
     // Koji mergerepos specific options
     gboolean koji;
@@ -24,6 +24,31 @@
 extern "C" {
 #endif
 
+#include <glib.h>
+#include "package.h"
+
+/** Temporary file with the raw xml of packages.
+ */
+typedef struct {
+    int fd;                 /*!< descriptor of the unlinked file */
+    gint refs;              /*!< number of users (packages, the parser) */
+} cr_SpoolFile;
+
+struct _cr_PackageSpool {
+    cr_SpoolFile *fil;      /*!< NULL or file with the raw_filelists */
+    gint64 fil_offset;      /*!< offset of the raw_filelists */
+    gsize fil_len;          /*!< length of the raw_filelists */
+    cr_SpoolFile *oth;      /*!< NULL or file with the raw_other */
+    gint64 oth_offset;      /*!< offset of the raw_other */
+    gsize oth_len;          /*!< length of the raw_other */
+};
+
+/** Free a spool of a package (called by cr_package_free()).
+ * @param spool     cr_PackageSpool or NULL
+ */
+void
+cr_package_spool_free(cr_PackageSpool *spool);
+
 #ifdef WITH_LIBMODULEMD
 #include <modulemd.h>
 #include "load_metadata.h"
@@ -46,6 +71,23 @@ cr_metadata_load_modulemd(ModulemdModuleIndex **moduleindex,
                           gchar *path_to_md,
                           GError **err);
 
+/** Load several (compressed) module metadata files at once, each file
+ * into its own ModulemdModuleIndex. The files are parsed by a pool
+ * of threads, so merge the indexes afterwards in the order of paths.
+ * @param moduleindexes array of count pointers where to store
+ *                      the created indexes (all NULL on error)
+ * @param paths         paths to module metadata
+ * @param count         number of paths
+ * @param threads       max number of threads (<= 1 - load serially)
+ * @param err           GError ** (the first failed file is reported)
+ * @return              cr_Error code
+ */
+int
+cr_metadata_load_modulemds(ModulemdModuleIndex **moduleindexes,
+                           gchar **paths,
+                           guint count,
+                           guint threads,
+                           GError **err);
 
 #endif /* WITH_LIBMODULEMD */
 
@@ -0,0 +1,848 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "error.h"
+#include "metrics.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+static const char *phase_names[CR_METRICS_SENTINEL] = {
+    [CR_METRICS_WALK]           = "walk",
+    [CR_METRICS_LOAD_OLD]       = "load_old_metadata",
+    [CR_METRICS_READ_HEADER]    = "read_header",
+    [CR_METRICS_CHECKSUM]       = "checksum",
+    [CR_METRICS_XML_DUMP]       = "xml_dump",
+    [CR_METRICS_PUBLISH_WAIT]   = "publish_wait",
+    [CR_METRICS_WRITER_WAIT]    = "writer_wait",
+    [CR_METRICS_XML_WRITE]      = "xml_write",
+    [CR_METRICS_SQLITE]         = "sqlite",
+    [CR_METRICS_PKG_CACHE]      = "pkg_cache",
+    [CR_METRICS_PKG_INDEX]      = "pkg_index",
+    [CR_METRICS_LOCK_WAIT]      = "lock_wait",
+    [CR_METRICS_COMPRESS]       = "compress",
+    [CR_METRICS_REPOMD]         = "repomd",
+};
+
+static const char *lock_names[CR_METRICS_LOCK_SENTINEL] = {
+    [CR_METRICS_LOCK_RING]      = "ring",
+    [CR_METRICS_LOCK_PKG_LIST]  = "pkg_list",
+    [CR_METRICS_LOCK_DELTAS]    = "delta_targets",
+};
+
+static const char *memory_names[CR_METRICS_MEM_SENTINEL] = {
+    [CR_METRICS_MEM_OLD_METADATA]   = "old_metadata",
+    [CR_METRICS_MEM_RING]           = "reorder_buffer",
+    [CR_METRICS_MEM_SQLITE]         = "sqlite",
+};
+
+typedef struct {
+    guint64 count;
+    guint64 time_us;
+    guint64 bytes;
+    guint64 histogram[CR_METRICS_BUCKETS];
+} PhaseStats;
+
+typedef struct {
+    guint64 count;                      // Acquisitions
+    guint64 contended;                  // Acquisitions which had to wait
+    guint64 wait_us;
+    guint64 max_wait_us;
+    guint64 holds;                      // Unlocks by cr_metrics_mutex_unlock()
+    guint64 hold_us;
+    guint64 max_hold_us;
+    guint64 histogram[CR_METRICS_BUCKETS]; // Of the waits
+} LockStats;
+
+typedef struct {
+    gboolean used;                      // Was accounted at least once
+    gint64 bytes;
+    gint64 peak_bytes;
+} MemoryStats;
+
+typedef struct {
+    gint64 start;                       // Since the creation of cr_Metrics
+    gint64 duration;
+    long task;                          // Task of the thread
+    cr_MetricsPhase phase;
+} TraceEvent;
+
+typedef struct {
+    guint id;                           // Order of the first measurement
+    gchar *name;                        // Name of the thread or NULL
+    PhaseStats phases[CR_METRICS_SENTINEL];
+    LockStats locks[CR_METRICS_LOCK_SENTINEL];
+    long task;                          // Current task or -1
+    GArray *events;                     // TraceEvent (if the trace is on)
+} MetricsThread;
+
+struct _cr_Metrics {
+    guint serial;               // Unique id of this cr_Metrics
+    gint64 start;               // Creation time
+    gboolean trace;             // Record the trace events
+    GMutex mutex;               // Guards the threads, the values and
+                                // the task names
+    GPtrArray *threads;         // MetricsThread * (owned)
+    GHashTable *values;         // Key: gchar *, Value: gint64 *
+    GHashTable *task_names;     // Key: gint64 *, Value: gchar *
+    GMutex mutex_memory;        // Guards the memory
+    MemoryStats memory[CR_METRICS_MEM_SENTINEL];
+};
+
+/* The slot of the current thread. It remembers the serial instead
+ * of the pointer to the cr_Metrics, the cr_Metrics it was created for
+ * could be freed and another one allocated at the same address. */
+typedef struct {
+    guint serial;
+    MetricsThread *thread;
+} ThreadSlot;
+
+static GPrivate thread_slot = G_PRIVATE_INIT(g_free);
+static guint last_serial = 0;
+
+static void
+metrics_thread_free(MetricsThread *thread)
+{
+    if (thread->events)
+        g_array_free(thread->events, TRUE);
+    g_free(thread->name);
+    g_free(thread);
+}
+
+
+cr_Metrics *
+cr_metrics_new(void)
+{
+    cr_Metrics *metrics = g_malloc0(sizeof(*metrics));
+    metrics->serial = (guint) g_atomic_int_add(&last_serial, 1) + 1;
+    metrics->start = g_get_monotonic_time();
+    g_mutex_init(&metrics->mutex);
+    metrics->threads = g_ptr_array_new_with_free_func(
+                            (GDestroyNotify) metrics_thread_free);
+    metrics->values = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, g_free);
+    metrics->task_names = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                g_free, g_free);
+    g_mutex_init(&metrics->mutex_memory);
+    return metrics;
+}
+
+void
+cr_metrics_enable_trace(cr_Metrics *metrics)
+{
+    if (!metrics)
+        return;
+    metrics->trace = TRUE;
+}
+
+const char *
+cr_metrics_phase_name(cr_MetricsPhase phase)
+{
+    if (phase < 0 || phase >= CR_METRICS_SENTINEL)
+        return NULL;
+    return phase_names[phase];
+}
+
+gint64
+cr_metrics_start(cr_Metrics *metrics)
+{
+    if (!metrics)
+        return 0;
+    return g_get_monotonic_time();
+}
+
+static MetricsThread *
+current_thread(cr_Metrics *metrics)
+{
+    ThreadSlot *slot = g_private_get(&thread_slot);
+
+    if (!slot) {
+        slot = g_malloc0(sizeof(*slot));
+        g_private_set(&thread_slot, slot);
+    }
+
+    if (slot->serial != metrics->serial) {
+        MetricsThread *thread = g_malloc0(sizeof(*thread));
+        thread->task = -1;
+        if (metrics->trace)
+            thread->events = g_array_new(FALSE, FALSE, sizeof(TraceEvent));
+        g_mutex_lock(&metrics->mutex);
+        thread->id = metrics->threads->len;
+        g_ptr_array_add(metrics->threads, thread);
+        g_mutex_unlock(&metrics->mutex);
+        slot->serial = metrics->serial;
+        slot->thread = thread;
+    }
+
+    return slot->thread;
+}
+
+static guint
+histogram_bucket(guint64 duration)
+{
+    guint bucket = duration ? g_bit_storage((gulong) duration) : 0;
+    return MIN(bucket, CR_METRICS_BUCKETS - 1);
+}
+
+static void
+account_phase(cr_Metrics *metrics,
+              cr_MetricsPhase phase,
+              guint64 duration,
+              guint64 bytes)
+{
+    PhaseStats *stats = &current_thread(metrics)->phases[phase];
+    stats->count++;
+    stats->time_us += duration;
+    stats->bytes += bytes;
+    stats->histogram[histogram_bucket(duration)]++;
+}
+
+void
+cr_metrics_stop(cr_Metrics *metrics,
+                cr_MetricsPhase phase,
+                gint64 start,
+                guint64 bytes)
+{
+    if (!metrics)
+        return;
+
+    assert(phase >= 0 && phase < CR_METRICS_SENTINEL);
+
+    gint64 duration = g_get_monotonic_time() - start;
+    account_phase(metrics, phase, MAX(duration, 0), bytes);
+
+    if (metrics->trace) {
+        MetricsThread *thread = current_thread(metrics);
+        if (thread->task >= 0) {
+            // Guarded against a concurrent cr_metrics_trace_to_json()
+            TraceEvent event = { start - metrics->start, MAX(duration, 0),
+                                 thread->task, phase };
+            g_mutex_lock(&metrics->mutex);
+            g_array_append_val(thread->events, event);
+            g_mutex_unlock(&metrics->mutex);
+        }
+    }
+}
+
+void
+cr_metrics_set_task(cr_Metrics *metrics, long task, const char *name)
+{
+    if (!metrics || !metrics->trace)
+        return;
+
+    current_thread(metrics)->task = task;
+
+    if (task < 0 || !name)
+        return;
+
+    gint64 *key = g_new(gint64, 1);
+    *key = task;
+    g_mutex_lock(&metrics->mutex);
+    if (!g_hash_table_contains(metrics->task_names, key))
+        g_hash_table_insert(metrics->task_names, key, g_strdup(name));
+    else
+        g_free(key);
+    g_mutex_unlock(&metrics->mutex);
+}
+
+const char *
+cr_metrics_lock_name(cr_MetricsLock lock)
+{
+    if (lock < 0 || lock >= CR_METRICS_LOCK_SENTINEL)
+        return NULL;
+    return lock_names[lock];
+}
+
+gint64
+cr_metrics_mutex_lock(cr_Metrics *metrics,
+                      cr_MetricsLock lock,
+                      GMutex *mutex)
+{
+    if (!metrics) {
+        g_mutex_lock(mutex);
+        return 0;
+    }
+
+    assert(lock >= 0 && lock < CR_METRICS_LOCK_SENTINEL);
+
+    LockStats *stats = &current_thread(metrics)->locks[lock];
+    guint64 wait = 0;
+    gint64 locked;
+
+    if (g_mutex_trylock(mutex)) {
+        locked = g_get_monotonic_time();
+    } else {
+        gint64 start = g_get_monotonic_time();
+        g_mutex_lock(mutex);
+        locked = g_get_monotonic_time();
+        wait = MAX(locked - start, 0);
+        stats->contended++;
+    }
+
+    stats->count++;
+    stats->wait_us += wait;
+    stats->max_wait_us = MAX(stats->max_wait_us, wait);
+    stats->histogram[histogram_bucket(wait)]++;
+    account_phase(metrics, CR_METRICS_LOCK_WAIT, wait, 0);
+
+    return locked;
+}
+
+void
+cr_metrics_mutex_unlock(cr_Metrics *metrics,
+                        cr_MetricsLock lock,
+                        GMutex *mutex,
+                        gint64 locked)
+{
+    if (!metrics) {
+        g_mutex_unlock(mutex);
+        return;
+    }
+
+    assert(lock >= 0 && lock < CR_METRICS_LOCK_SENTINEL);
+
+    guint64 hold = MAX(g_get_monotonic_time() - locked, 0);
+    g_mutex_unlock(mutex);
+
+    LockStats *stats = &current_thread(metrics)->locks[lock];
+    stats->holds++;
+    stats->hold_us += hold;
+    stats->max_hold_us = MAX(stats->max_hold_us, hold);
+}
+
+void
+cr_metrics_set_thread_name(cr_Metrics *metrics, const char *name)
+{
+    if (!metrics)
+        return;
+
+    MetricsThread *thread = current_thread(metrics);
+    // Only the thread itself sets its name
+    if (thread->name)
+        return;
+
+    g_mutex_lock(&metrics->mutex);
+    thread->name = g_strdup(name);
+    g_mutex_unlock(&metrics->mutex);
+}
+
+void
+cr_metrics_set_value(cr_Metrics *metrics, const char *name, gint64 value)
+{
+    if (!metrics)
+        return;
+
+    assert(name);
+
+    gint64 *stored = g_malloc(sizeof(*stored));
+    *stored = value;
+    g_mutex_lock(&metrics->mutex);
+    g_hash_table_replace(metrics->values, g_strdup(name), stored);
+    g_mutex_unlock(&metrics->mutex);
+}
+
+const char *
+cr_metrics_memory_name(cr_MetricsMemory mem)
+{
+    if (mem < 0 || mem >= CR_METRICS_MEM_SENTINEL)
+        return NULL;
+    return memory_names[mem];
+}
+
+void
+cr_metrics_memory_add(cr_Metrics *metrics, cr_MetricsMemory mem, gint64 bytes)
+{
+    if (!metrics)
+        return;
+
+    assert(mem >= 0 && mem < CR_METRICS_MEM_SENTINEL);
+
+    MemoryStats *stats = &metrics->memory[mem];
+    g_mutex_lock(&metrics->mutex_memory);
+    stats->used = TRUE;
+    stats->bytes += bytes;
+    stats->peak_bytes = MAX(stats->peak_bytes, stats->bytes);
+    g_mutex_unlock(&metrics->mutex_memory);
+}
+
+void
+cr_metrics_memory_set(cr_Metrics *metrics,
+                      cr_MetricsMemory mem,
+                      gint64 bytes,
+                      gint64 peak)
+{
+    if (!metrics)
+        return;
+
+    assert(mem >= 0 && mem < CR_METRICS_MEM_SENTINEL);
+
+    MemoryStats *stats = &metrics->memory[mem];
+    g_mutex_lock(&metrics->mutex_memory);
+    stats->used = TRUE;
+    stats->bytes = bytes;
+    stats->peak_bytes = MAX(stats->peak_bytes, MAX(bytes, peak));
+    g_mutex_unlock(&metrics->mutex_memory);
+}
+
+gint64
+cr_metrics_rss(gint64 *peak)
+{
+    gint64 rss = -1;
+    gchar *statm = NULL;
+    struct rusage usage;
+
+    // The second field is the number of resident pages
+    if (g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+        gint64 pages;
+        if (sscanf(statm, "%*s %" G_GINT64_FORMAT, &pages) == 1)
+            rss = pages * sysconf(_SC_PAGESIZE);
+        g_free(statm);
+    }
+
+    if (peak) {
+        *peak = -1;
+        // The ru_maxrss is in kilobytes, except of macOS
+        if (getrusage(RUSAGE_SELF, &usage) == 0 && usage.ru_maxrss > 0)
+#ifdef __APPLE__
+            *peak = usage.ru_maxrss;
+#else
+            *peak = (gint64) usage.ru_maxrss * 1024;
+#endif
+        // Both are sampled differently, the current one could be higher
+        if (*peak >= 0 && rss > *peak)
+            *peak = rss;
+    }
+
+    return rss;
+}
+
+/** Copy of the memory stats taken under the lock */
+static void
+memory_snapshot(cr_Metrics *metrics, MemoryStats *memory)
+{
+    g_mutex_lock(&metrics->mutex_memory);
+    memcpy(memory, metrics->memory, sizeof(metrics->memory));
+    g_mutex_unlock(&metrics->mutex_memory);
+}
+
+gchar *
+cr_metrics_memory_summary(cr_Metrics *metrics)
+{
+    MemoryStats memory[CR_METRICS_MEM_SENTINEL];
+    GString *summary = g_string_new(NULL);
+    gint64 peak_rss;
+    gint64 rss = cr_metrics_rss(&peak_rss);
+    const double mib = 1024.0 * 1024.0;
+
+    g_string_append_printf(summary, "RSS %.1f MiB (peak %.1f MiB)",
+                           rss / mib, peak_rss / mib);
+
+    if (!metrics)
+        return g_string_free(summary, FALSE);
+
+    memory_snapshot(metrics, memory);
+    for (int x = 0; x < CR_METRICS_MEM_SENTINEL; x++) {
+        if (!memory[x].used)
+            continue;
+        g_string_append_printf(summary, ", %s %.1f MiB (peak %.1f MiB)",
+                               memory_names[x], memory[x].bytes / mib,
+                               memory[x].peak_bytes / mib);
+    }
+
+    return g_string_free(summary, FALSE);
+}
+
+static void
+memory_to_json(GString *json, cr_Metrics *metrics)
+{
+    MemoryStats memory[CR_METRICS_MEM_SENTINEL];
+    gint64 peak_rss;
+    gint64 rss = cr_metrics_rss(&peak_rss);
+
+    g_string_append_printf(json, "{\"rss_bytes\": %" G_GINT64_FORMAT
+                           ", \"peak_rss_bytes\": %" G_GINT64_FORMAT,
+                           rss, peak_rss);
+
+    memory_snapshot(metrics, memory);
+    for (int x = 0; x < CR_METRICS_MEM_SENTINEL; x++) {
+        if (!memory[x].used)
+            continue;
+        g_string_append_printf(json, ",\n    \"%s\": {\"bytes\": %"
+                               G_GINT64_FORMAT ", \"peak_bytes\": %"
+                               G_GINT64_FORMAT "}", memory_names[x],
+                               memory[x].bytes, memory[x].peak_bytes);
+    }
+    g_string_append(json, "}");
+}
+
+static void
+histogram_to_json(GString *json, guint64 *histogram)
+{
+    const char *sep = "";
+
+    for (int b = 0; b < CR_METRICS_BUCKETS; b++) {
+        if (!histogram[b])
+            continue;
+        if (b == CR_METRICS_BUCKETS - 1)
+            g_string_append_printf(json, "%s{\"lt\": null", sep);
+        else
+            g_string_append_printf(json, "%s{\"lt\": %" G_GUINT64_FORMAT,
+                                   sep, (guint64) 1 << b);
+        g_string_append_printf(json, ", \"count\": %" G_GUINT64_FORMAT "}",
+                               histogram[b]);
+        sep = ", ";
+    }
+}
+
+static void
+phases_to_json(GString *json, PhaseStats *phases, const char *indent)
+{
+    const char *sep = "";
+
+    g_string_append(json, "{");
+    for (int x = 0; x < CR_METRICS_SENTINEL; x++) {
+        PhaseStats *stats = &phases[x];
+        // Per a second of the phase time, the sub-microsecond calls
+        // count as one microsecond
+        gdouble seconds = MAX(stats->time_us, 1) / 1000000.0;
+
+        if (!stats->count)
+            continue;
+
+        g_string_append_printf(json,
+            "%s\n%s    \"%s\": {\"count\": %" G_GUINT64_FORMAT
+            ", \"time_us\": %" G_GUINT64_FORMAT
+            ", \"bytes\": %" G_GUINT64_FORMAT
+            ", \"bytes_per_second\": %.0f"
+            ", \"calls_per_second\": %.1f"
+            ", \"histogram_us\": [",
+            sep, indent, phase_names[x],
+            stats->count, stats->time_us, stats->bytes,
+            stats->bytes / seconds, stats->count / seconds);
+        sep = ",";
+
+        histogram_to_json(json, stats->histogram);
+        g_string_append(json, "]}");
+    }
+
+    if (*sep)
+        g_string_append_printf(json, "\n%s  }", indent);
+    else
+        g_string_append(json, "}");
+}
+
+static void
+locks_to_json(GString *json, LockStats *locks, const char *indent)
+{
+    const char *sep = "";
+
+    g_string_append(json, "{");
+    for (int x = 0; x < CR_METRICS_LOCK_SENTINEL; x++) {
+        LockStats *stats = &locks[x];
+
+        if (!stats->count)
+            continue;
+
+        g_string_append_printf(json,
+            "%s\n%s    \"%s\": {\"acquisitions\": %" G_GUINT64_FORMAT
+            ", \"contended\": %" G_GUINT64_FORMAT
+            ", \"wait_us\": %" G_GUINT64_FORMAT
+            ", \"max_wait_us\": %" G_GUINT64_FORMAT
+            ", \"holds\": %" G_GUINT64_FORMAT
+            ", \"hold_us\": %" G_GUINT64_FORMAT
+            ", \"max_hold_us\": %" G_GUINT64_FORMAT
+            ", \"wait_histogram_us\": [",
+            sep, indent, lock_names[x],
+            stats->count, stats->contended, stats->wait_us,
+            stats->max_wait_us, stats->holds, stats->hold_us,
+            stats->max_hold_us);
+        sep = ",";
+
+        histogram_to_json(json, stats->histogram);
+        g_string_append(json, "]}");
+    }
+
+    if (*sep)
+        g_string_append_printf(json, "\n%s  }", indent);
+    else
+        g_string_append(json, "}");
+}
+
+static void
+sum_locks(LockStats *totals, GPtrArray *threads)
+{
+    memset(totals, 0, sizeof(LockStats) * CR_METRICS_LOCK_SENTINEL);
+
+    for (guint t = 0; t < threads->len; t++) {
+        MetricsThread *thread = g_ptr_array_index(threads, t);
+        for (int x = 0; x < CR_METRICS_LOCK_SENTINEL; x++) {
+            LockStats *stats = &thread->locks[x];
+            totals[x].count += stats->count;
+            totals[x].contended += stats->contended;
+            totals[x].wait_us += stats->wait_us;
+            totals[x].max_wait_us = MAX(totals[x].max_wait_us,
+                                        stats->max_wait_us);
+            totals[x].holds += stats->holds;
+            totals[x].hold_us += stats->hold_us;
+            totals[x].max_hold_us = MAX(totals[x].max_hold_us,
+                                        stats->max_hold_us);
+            for (int b = 0; b < CR_METRICS_BUCKETS; b++)
+                totals[x].histogram[b] += stats->histogram[b];
+        }
+    }
+}
+
+gchar *
+cr_metrics_to_json(cr_Metrics *metrics)
+{
+    GString *json = g_string_new(NULL);
+    PhaseStats totals[CR_METRICS_SENTINEL];
+    LockStats lock_totals[CR_METRICS_LOCK_SENTINEL];
+    GHashTableIter iter;
+    gpointer key, value;
+    gboolean first = TRUE;
+
+    assert(metrics);
+
+    memset(totals, 0, sizeof(totals));
+
+    g_mutex_lock(&metrics->mutex);
+
+    g_string_append_printf(json, "{\n  \"wall_time_us\": %" G_GINT64_FORMAT
+                           ",\n  \"values\": {",
+                           g_get_monotonic_time() - metrics->start);
+    g_hash_table_iter_init(&iter, metrics->values);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_string_append_printf(json, "%s\"%s\": %" G_GINT64_FORMAT,
+                               first ? "" : ", ", (gchar *) key,
+                               *((gint64 *) value));
+        first = FALSE;
+    }
+    g_string_append(json, "},\n  \"memory\": ");
+    memory_to_json(json, metrics);
+    g_string_append(json, ",\n");
+
+    for (guint t = 0; t < metrics->threads->len; t++) {
+        MetricsThread *thread = g_ptr_array_index(metrics->threads, t);
+        for (int x = 0; x < CR_METRICS_SENTINEL; x++) {
+            totals[x].count += thread->phases[x].count;
+            totals[x].time_us += thread->phases[x].time_us;
+            totals[x].bytes += thread->phases[x].bytes;
+            for (int b = 0; b < CR_METRICS_BUCKETS; b++)
+                totals[x].histogram[b] += thread->phases[x].histogram[b];
+        }
+    }
+
+    sum_locks(lock_totals, metrics->threads);
+
+    g_string_append(json, "  \"phases\": ");
+    phases_to_json(json, totals, "");
+    g_string_append(json, ",\n  \"locks\": ");
+    locks_to_json(json, lock_totals, "");
+
+    g_string_append(json, ",\n  \"threads\": [");
+    for (guint t = 0; t < metrics->threads->len; t++) {
+        MetricsThread *thread = g_ptr_array_index(metrics->threads, t);
+        g_string_append_printf(json, "%s\n    {\"id\": %u", t ? "," : "",
+                               thread->id);
+        if (thread->name)
+            g_string_append_printf(json, ", \"name\": \"%s\"", thread->name);
+        g_string_append(json, ", \"phases\": ");
+        phases_to_json(json, thread->phases, "    ");
+        g_string_append(json, ", \"locks\": ");
+        locks_to_json(json, thread->locks, "    ");
+        g_string_append(json, "}");
+    }
+    g_string_append_printf(json, "%s]\n}\n",
+                           metrics->threads->len ? "\n  " : "");
+
+    g_mutex_unlock(&metrics->mutex);
+
+    return g_string_free(json, FALSE);
+}
+
+gchar *
+cr_metrics_locks_summary(cr_Metrics *metrics)
+{
+    LockStats totals[CR_METRICS_LOCK_SENTINEL];
+    GString *summary = g_string_new(NULL);
+
+    assert(metrics);
+
+    g_mutex_lock(&metrics->mutex);
+    sum_locks(totals, metrics->threads);
+    g_mutex_unlock(&metrics->mutex);
+
+    for (int x = 0; x < CR_METRICS_LOCK_SENTINEL; x++) {
+        LockStats *stats = &totals[x];
+
+        if (!stats->count)
+            continue;
+
+        g_string_append_printf(summary,
+            "%s%s: %" G_GUINT64_FORMAT " acquisitions, %" G_GUINT64_FORMAT
+            " contended (%.1f %%), waited %.3f s (max %.3f ms), "
+            "held %.3f s (max %.3f ms)",
+            summary->len ? "\n" : "", lock_names[x],
+            stats->count, stats->contended,
+            100.0 * stats->contended / stats->count,
+            stats->wait_us / 1000000.0, stats->max_wait_us / 1000.0,
+            stats->hold_us / 1000000.0, stats->max_hold_us / 1000.0);
+    }
+
+    if (!summary->len) {
+        g_string_free(summary, TRUE);
+        return NULL;
+    }
+
+    return g_string_free(summary, FALSE);
+}
+
+gboolean
+cr_metrics_write_json(cr_Metrics *metrics,
+                      const char *filename,
+                      GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(metrics);
+    assert(filename);
+    assert(!err || *err == NULL);
+
+    gchar *json = cr_metrics_to_json(metrics);
+    gboolean ret = g_file_set_contents(filename, json, -1, &tmp_err);
+    g_free(json);
+
+    if (!ret) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write metrics: %s", tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    return ret;
+}
+
+/** Append the string as a JSON string literal */
+static void
+json_append_string(GString *json, const char *str)
+{
+    g_string_append_c(json, '"');
+    for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            g_string_append_printf(json, "\\%c", *c);
+        else if (*c < 0x20)
+            g_string_append_printf(json, "\\u%04x", *c);
+        else
+            g_string_append_c(json, *c);
+    }
+    g_string_append_c(json, '"');
+}
+
+gchar *
+cr_metrics_trace_to_json(cr_Metrics *metrics)
+{
+    GString *json = g_string_new("{\"traceEvents\": [");
+    const char *sep = "\n  ";
+
+    assert(metrics);
+
+    g_mutex_lock(&metrics->mutex);
+
+    for (guint t = 0; t < metrics->threads->len; t++) {
+        MetricsThread *thread = g_ptr_array_index(metrics->threads, t);
+
+        if (thread->name) {
+            g_string_append_printf(json, "%s{\"name\": \"thread_name\", "
+                                   "\"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                                   "\"args\": {\"name\": ", sep, thread->id);
+            json_append_string(json, thread->name);
+            g_string_append(json, "}}");
+            sep = ",\n  ";
+        }
+
+        for (guint x = 0; thread->events && x < thread->events->len; x++) {
+            TraceEvent *event = &g_array_index(thread->events, TraceEvent, x);
+            gint64 key = event->task;
+            const char *name = g_hash_table_lookup(metrics->task_names, &key);
+
+            g_string_append_printf(json, "%s{\"name\": \"%s\", \"ph\": \"X\", "
+                                   "\"ts\": %" G_GINT64_FORMAT ", "
+                                   "\"dur\": %" G_GINT64_FORMAT ", "
+                                   "\"pid\": 1, \"tid\": %u, "
+                                   "\"args\": {\"task\": %ld",
+                                   sep, phase_names[event->phase],
+                                   event->start, event->duration,
+                                   thread->id, event->task);
+            if (name) {
+                g_string_append(json, ", \"package\": ");
+                json_append_string(json, name);
+            }
+            g_string_append(json, "}}");
+            sep = ",\n  ";
+        }
+    }
+
+    g_mutex_unlock(&metrics->mutex);
+
+    g_string_append(json, "\n]}\n");
+    return g_string_free(json, FALSE);
+}
+
+gboolean
+cr_metrics_write_trace(cr_Metrics *metrics,
+                       const char *filename,
+                       GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(metrics);
+    assert(filename);
+    assert(!err || *err == NULL);
+
+    gchar *json = cr_metrics_trace_to_json(metrics);
+    gboolean ret = g_file_set_contents(filename, json, -1, &tmp_err);
+    g_free(json);
+
+    if (!ret) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write trace: %s", tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    return ret;
+}
+
+void
+cr_metrics_free(cr_Metrics *metrics)
+{
+    if (!metrics)
+        return;
+
+    g_ptr_array_free(metrics->threads, TRUE);
+    g_hash_table_destroy(metrics->values);
+    g_hash_table_destroy(metrics->task_names);
+    g_mutex_clear(&metrics->mutex);
+    g_mutex_clear(&metrics->mutex_memory);
+    g_free(metrics);
+}
@@ -0,0 +1,344 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_METRICS_H__
+#define __C_CREATEREPOLIB_METRICS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+
+/** \defgroup   metrics     Timing of the phases of a run
+ *
+ * Every thread accumulates the number of calls, the time, the processed
+ * bytes and a histogram of durations of each phase in its own slot, so
+ * the measuring doesn't add any locking. The totals and the per thread
+ * values are reported as JSON (see cr_metrics_to_json()).
+ * All the functions accept NULL instead of the cr_Metrics and do nothing
+ * then, so the disabled measuring costs only a check.
+ *
+ * The shared mutexes are profiled by cr_metrics_mutex_lock() and
+ * cr_metrics_mutex_unlock(), which measure the time waiting for the mutex
+ * and the time holding it.
+ *
+ * Optionally every call of a phase is also recorded as a trace event
+ * of the task (package) processed by the thread (see
+ * cr_metrics_set_task()), the trace is written in the Chrome trace event
+ * format readable by chrome://tracing or Perfetto.
+ *
+ * The memory held by the subsystems is accounted by
+ * cr_metrics_memory_add() and cr_metrics_memory_set(), the current
+ * and the peak values are reported together with the resident set size
+ * of the process (see cr_metrics_rss()).
+ *
+ * \code
+ * gint64 start = cr_metrics_start(metrics);
+ * checksum = cr_checksum_fd(fd, type, NULL);
+ * cr_metrics_stop(metrics, CR_METRICS_CHECKSUM, start, size);
+ *
+ * gint64 locked = cr_metrics_mutex_lock(metrics, CR_METRICS_LOCK_PKG_LIST,
+ *                                       &mutex);
+ * fprintf(pkg_list, "%s\n", pkg->location_href);
+ * cr_metrics_mutex_unlock(metrics, CR_METRICS_LOCK_PKG_LIST, &mutex, locked);
+ * \endcode
+ *
+ *  \addtogroup metrics
+ *  @{
+ */
+
+/** Measured phases.
+ */
+typedef enum {
+    CR_METRICS_WALK,            /*!< Directory walk */
+    CR_METRICS_LOAD_OLD,        /*!< Loading of the old metadata */
+    CR_METRICS_READ_HEADER,     /*!< Reading of rpm headers */
+    CR_METRICS_CHECKSUM,        /*!< Checksumming of packages */
+    CR_METRICS_XML_DUMP,        /*!< Generating of XML of packages */
+    CR_METRICS_PUBLISH_WAIT,    /*!< Workers waiting for room in the ring
+                                     of dumped packages */
+    CR_METRICS_WRITER_WAIT,     /*!< Writers waiting for dumped packages */
+    CR_METRICS_XML_WRITE,       /*!< Compression and writing of XML */
+    CR_METRICS_SQLITE,          /*!< Inserting into sqlite dbs */
+    CR_METRICS_PKG_CACHE,       /*!< Writing of the package cache */
+    CR_METRICS_PKG_INDEX,       /*!< Adding to the binary package index */
+    CR_METRICS_LOCK_WAIT,       /*!< Acquiring of shared mutexes */
+    CR_METRICS_COMPRESS,        /*!< Compression of the sqlite dbs */
+    CR_METRICS_REPOMD,          /*!< Filling of repomd records */
+    CR_METRICS_SENTINEL,        /*!< Last element, terminator, ... */
+} cr_MetricsPhase;
+
+/** Profiled mutexes.
+ */
+typedef enum {
+    CR_METRICS_LOCK_RING,       /*!< Ring of dumped packages */
+    CR_METRICS_LOCK_PKG_LIST,   /*!< List of read packages */
+    CR_METRICS_LOCK_DELTAS,     /*!< Delta target packages */
+    CR_METRICS_LOCK_SENTINEL,   /*!< Last element, terminator, ... */
+} cr_MetricsLock;
+
+/** Accounted memory.
+ */
+typedef enum {
+    CR_METRICS_MEM_OLD_METADATA,    /*!< Old metadata loaded for --update
+                                         (growth of the RSS by the load) */
+    CR_METRICS_MEM_RING,            /*!< XML of the dumped packages waiting
+                                         in the reorder buffer */
+    CR_METRICS_MEM_SQLITE,          /*!< Memory allocated by sqlite
+                                         (page caches of the dbs) */
+    CR_METRICS_MEM_SENTINEL,        /*!< Last element, terminator, ... */
+} cr_MetricsMemory;
+
+/** Number of buckets of the histograms. The bucket N counts durations
+ * shorter than 2^N microseconds (and not counted by a lower bucket),
+ * the last bucket counts all the longer ones.
+ */
+#define CR_METRICS_BUCKETS      26
+
+/** Collected measurements.
+ */
+typedef struct _cr_Metrics cr_Metrics;
+
+/** Create a new cr_Metrics. The wall time of the run is measured
+ * since now.
+ * @return              New cr_Metrics
+ */
+cr_Metrics *
+cr_metrics_new(void);
+
+/** Record the trace events of the tasks. Must be called before the first
+ * measurement.
+ * @param metrics       cr_Metrics or NULL
+ */
+void
+cr_metrics_enable_trace(cr_Metrics *metrics);
+
+/** Name of the phase used in the report.
+ * @param phase         Phase
+ * @return              Constant string
+ */
+const char *
+cr_metrics_phase_name(cr_MetricsPhase phase);
+
+/** Start measuring.
+ * @param metrics       cr_Metrics or NULL
+ * @return              Start time for cr_metrics_stop() (0 if metrics
+ *                      is NULL)
+ */
+gint64
+cr_metrics_start(cr_Metrics *metrics);
+
+/** Account one call of the phase which started at the start
+ * to the current thread. This function is thread safe.
+ * @param metrics       cr_Metrics or NULL
+ * @param phase         Measured phase
+ * @param start         Value returned by cr_metrics_start()
+ * @param bytes         Number of bytes processed by the call
+ */
+void
+cr_metrics_stop(cr_Metrics *metrics,
+                cr_MetricsPhase phase,
+                gint64 start,
+                guint64 bytes);
+
+/** Name of the mutex used in the report.
+ * @param lock          Profiled mutex
+ * @return              Constant string
+ */
+const char *
+cr_metrics_lock_name(cr_MetricsLock lock);
+
+/** Lock the mutex and account the time spent waiting for it to the lock
+ * and to the CR_METRICS_LOCK_WAIT phase (an uncontended lock counts
+ * with zero time).
+ * @param metrics       cr_Metrics or NULL (the mutex is just locked)
+ * @param lock          Profiled mutex
+ * @param mutex         Mutex to lock
+ * @return              Time the mutex was acquired for
+ *                      cr_metrics_mutex_unlock() (0 if metrics is NULL)
+ */
+gint64
+cr_metrics_mutex_lock(cr_Metrics *metrics,
+                      cr_MetricsLock lock,
+                      GMutex *mutex);
+
+/** Unlock the mutex locked by cr_metrics_mutex_lock() and account
+ * the time it was held. A mutex released by g_cond_wait() should be
+ * unlocked by g_mutex_unlock(), the sleeping isn't holding.
+ * @param metrics       cr_Metrics or NULL (the mutex is just unlocked)
+ * @param lock          Profiled mutex
+ * @param mutex         Mutex to unlock
+ * @param locked        Value returned by cr_metrics_mutex_lock()
+ */
+void
+cr_metrics_mutex_unlock(cr_Metrics *metrics,
+                        cr_MetricsLock lock,
+                        GMutex *mutex,
+                        gint64 locked);
+
+/** Name the current thread in the report (e.g. "worker"). Only the first
+ * name is kept, the threads of thread pools are reused by other pools.
+ * @param metrics       cr_Metrics or NULL
+ * @param name          Name of the thread
+ */
+void
+cr_metrics_set_thread_name(cr_Metrics *metrics, const char *name);
+
+/** Set the task processed by the current thread. The following calls
+ * of the phases (not the lock waits) are recorded as trace events
+ * of the task until another task is set. Does nothing if the trace
+ * isn't enabled.
+ * @param metrics       cr_Metrics or NULL
+ * @param task          Id of the task or -1 for no task
+ * @param name          Name of the task (e.g. filename of the package)
+ *                      or NULL, the first name of the task is kept
+ */
+void
+cr_metrics_set_task(cr_Metrics *metrics, long task, const char *name);
+
+/** Set a named value reported with the measurements (e.g. number
+ * of packages). This function is thread safe.
+ * @param metrics       cr_Metrics or NULL
+ * @param name          Name of the value
+ * @param value         Value
+ */
+void
+cr_metrics_set_value(cr_Metrics *metrics, const char *name, gint64 value);
+
+/** Name of the accounted memory used in the report.
+ * @param mem           Accounted memory
+ * @return              Constant string
+ */
+const char *
+cr_metrics_memory_name(cr_MetricsMemory mem);
+
+/** Add (or subtract if negative) bytes to the accounted memory.
+ * The peak is updated. This function is thread safe.
+ * @param metrics       cr_Metrics or NULL
+ * @param mem           Accounted memory
+ * @param bytes         Allocated (freed) bytes
+ */
+void
+cr_metrics_memory_add(cr_Metrics *metrics, cr_MetricsMemory mem, gint64 bytes);
+
+/** Set the accounted memory. The peak is updated.
+ * This function is thread safe.
+ * @param metrics       cr_Metrics or NULL
+ * @param mem           Accounted memory
+ * @param bytes         Current size of the memory
+ * @param peak          Peak size known to the caller (e.g. a high-water
+ *                      mark of an allocator) or -1
+ */
+void
+cr_metrics_memory_set(cr_Metrics *metrics,
+                      cr_MetricsMemory mem,
+                      gint64 bytes,
+                      gint64 peak);
+
+/** Resident set size of the process.
+ * @param peak          Peak RSS of the process or -1 if unknown (could
+ *                      be NULL)
+ * @return              Current RSS in bytes or -1 if unknown
+ */
+gint64
+cr_metrics_rss(gint64 *peak);
+
+/** Human readable one line summary of the memory: the current and the peak
+ * RSS and the accounted memory which was used.
+ * @param metrics       cr_Metrics or NULL (only the RSS is reported)
+ * @return              Newly allocated string
+ */
+gchar *
+cr_metrics_memory_summary(cr_Metrics *metrics);
+
+/** Report the measurements as a JSON object:
+ * "wall_time_us", "values" (see cr_metrics_set_value()), "memory"
+ * with "rss_bytes", "peak_rss_bytes" and "bytes" and "peak_bytes" of every
+ * used accounted memory, "phases"
+ * with the totals of all the threads and "threads" with the values
+ * of every thread ("id", "name" and "phases"). A phase has "count",
+ * "time_us", "bytes", "bytes_per_second", "calls_per_second" (both per
+ * a second of the phase time) and "histogram_us" (list of upper bounds
+ * and counts of the nonempty buckets). Phases without calls are omitted.
+ * The totals and every thread have also "locks" with "acquisitions",
+ * "contended", "wait_us", "max_wait_us", "holds", "hold_us",
+ * "max_hold_us" and "wait_histogram_us" of the used mutexes.
+ * The measuring could continue during the call, the values of the running
+ * phases could be slightly inconsistent then.
+ * @param metrics       cr_Metrics
+ * @return              Newly allocated JSON
+ */
+gchar *
+cr_metrics_to_json(cr_Metrics *metrics);
+
+/** Human readable summary of the lock contention, one line per used
+ * mutex.
+ * @param metrics       cr_Metrics
+ * @return              Newly allocated string, NULL if no mutex was used
+ */
+gchar *
+cr_metrics_locks_summary(cr_Metrics *metrics);
+
+/** Write cr_metrics_to_json() into a file.
+ * @param metrics       cr_Metrics
+ * @param filename      Path to the file
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_metrics_write_json(cr_Metrics *metrics,
+                      const char *filename,
+                      GError **err);
+
+/** Report the trace events as a JSON object in the Chrome trace event
+ * format: "traceEvents" with a complete event ("ph": "X") of every
+ * recorded call ("name" of the phase, "ts" and "dur" in microseconds
+ * since the creation of the cr_Metrics, "tid" of the thread, "args"
+ * with the "task" and the "package" name) and the names of the threads.
+ * @param metrics       cr_Metrics
+ * @return              Newly allocated JSON
+ */
+gchar *
+cr_metrics_trace_to_json(cr_Metrics *metrics);
+
+/** Write cr_metrics_trace_to_json() into a file.
+ * @param metrics       cr_Metrics
+ * @param filename      Path to the file
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_metrics_write_trace(cr_Metrics *metrics,
+                       const char *filename,
+                       GError **err);
+
+/** Free the cr_Metrics. No thread could measure into it anymore.
+ * @param metrics       cr_Metrics or NULL
+ */
+void
+cr_metrics_free(cr_Metrics *metrics);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_METRICS_H__ */
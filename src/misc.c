@@ -18,6 +18,7 @@
  */
 
 #define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE         // syscall()
 
 #include <glib/gstdio.h>
 #include <glib.h>
@@ -25,16 +26,27 @@
 #include <assert.h>
 #include <curl/curl.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ftw.h>
 #include <rpm/rpmlib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/sendfile.h>
+#endif
+#ifdef WITH_ZCHUNK
+#include <zck.h>
+#endif // WITH_ZCHUNK
 #include "cleanup.h"
 #include "error.h"
 #include "misc.h"
@@ -42,6 +54,7 @@
 
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 #define BUFFER_SIZE     4096
+#define ZCK_MAX_RANGES  255     // Ranges requested by one request
 
 #define xstr(s) str(s)
 #define str(s) #s
@@ -50,20 +63,21 @@
 const char *
 cr_flag_to_str(gint64 flags)
 {
+    // The flags are the shared strings of the package module
     flags &= 0xf;
     switch(flags) {
         case 0:
             return NULL;
         case 2:
-            return "LT";
+            return cr_dependency_flag_str(CR_DEP_FLAG_LT);
         case 4:
-            return "GT";
+            return cr_dependency_flag_str(CR_DEP_FLAG_GT);
         case 8:
-            return "EQ";
+            return cr_dependency_flag_str(CR_DEP_FLAG_EQ);
         case 10:
-            return "LE";
+            return cr_dependency_flag_str(CR_DEP_FLAG_LE);
         case 12:
-            return "GE";
+            return cr_dependency_flag_str(CR_DEP_FLAG_GE);
         default:
             return NULL;
     }
@@ -83,16 +97,13 @@ cr_flag_to_str(gint64 flags)
  * Returned structure had all string inserted in the passed chunk.
  *
  */
-cr_EVR *
-cr_str_to_evr(const char *string, GStringChunk *chunk)
+void
+cr_str_to_evr_view(const char *string, cr_EVRView *view)
 {
-    cr_EVR *evr = g_new0(cr_EVR, 1);
-    evr->epoch = NULL;
-    evr->version = NULL;
-    evr->release = NULL;
+    memset(view, 0, sizeof(*view));
 
-    if (!string || !(strlen(string))) {
-        return evr;
+    if (!string || !(*string)) {
+        return;
     }
 
     const char *ptr;  // These names are totally self explaining
@@ -102,19 +113,15 @@ cr_str_to_evr(const char *string, GStringChunk *chunk)
     // Epoch
     gboolean bad_epoch = FALSE;
 
-    ptr = strstr(string, ":");
+    ptr = strchr(string, ':');
     if (ptr) {
         // Check if epoch str is a number
         char *p = NULL;
         strtol(string, &p, 10);
         if (p == ptr) { // epoch str seems to be a number
-            size_t len = ptr - string;
-            if (len) {
-                if (chunk) {
-                    evr->epoch = g_string_chunk_insert_len(chunk, string, len);
-                } else {
-                    evr->epoch = g_strndup(string, len);
-                }
+            if (ptr > string) {
+                view->epoch = string;
+                view->epoch_len = ptr - string;
             }
         } else { // Bad (non-numerical) epoch
             bad_epoch = TRUE;
@@ -123,44 +130,47 @@ cr_str_to_evr(const char *string, GStringChunk *chunk)
         ptr = (char*) string-1;
     }
 
-    if (!evr->epoch && !bad_epoch) {
-        if (chunk) {
-            evr->epoch = g_string_chunk_insert_const(chunk, "0");
-        } else {
-            evr->epoch = g_strdup("0");
-        }
+    if (!view->epoch && !bad_epoch) {
+        view->epoch = "0";
+        view->epoch_len = 1;
     }
 
 
     // Version + release
 
-    ptr2 = strstr(ptr+1, "-");
+    view->version = ptr+1;
+    ptr2 = strchr(ptr+1, '-');
     if (ptr2) {
-        // Version
-        size_t version_len = ptr2 - (ptr+1);
-        if (chunk) {
-            evr->version = g_string_chunk_insert_len(chunk, ptr+1, version_len);
-        } else {
-            evr->version = g_strndup(ptr+1, version_len);
-        }
-
-        // Release
-        size_t release_len = strlen(ptr2+1);
-        if (release_len) {
-            if (chunk) {
-                evr->release = g_string_chunk_insert_len(chunk, ptr2+1,
-                                                        release_len);
-            } else {
-                evr->release = g_strndup(ptr2+1, release_len);
-            }
+        view->version_len = ptr2 - (ptr+1);
+        if (ptr2[1]) {
+            view->release = ptr2+1;
+            view->release_len = strlen(ptr2+1);
         }
     } else { // Release is not here, just version
-        if (chunk) {
-            evr->version = g_string_chunk_insert_const(chunk, ptr+1);
-        } else {
-            evr->version = g_strdup(ptr+1);
-        }
+        view->version_len = strlen(ptr+1);
     }
+}
+
+static char *
+evr_view_dup(const char *str, gsize len, GStringChunk *chunk)
+{
+    if (!str)
+        return NULL;
+    if (chunk)
+        return g_string_chunk_insert_len(chunk, str, len);
+    return g_strndup(str, len);
+}
+
+cr_EVR *
+cr_str_to_evr(const char *string, GStringChunk *chunk)
+{
+    cr_EVR *evr = g_new0(cr_EVR, 1);
+    cr_EVRView view;
+
+    cr_str_to_evr_view(string, &view);
+    evr->epoch   = evr_view_dup(view.epoch, view.epoch_len, chunk);
+    evr->version = evr_view_dup(view.version, view.version_len, chunk);
+    evr->release = evr_view_dup(view.release, view.release_len, chunk);
 
     return evr;
 }
@@ -241,61 +251,57 @@ cr_is_primary(const char *filename)
 
 #define VAL_LEN         4       // Len of numeric values in rpm
 
+/* Read two big-endian 4 bytes long values (index count and data length
+ * of a header structure)
+ */
+static gboolean
+read_header_intro(int fd,
+                  off_t offset,
+                  unsigned int *index,
+                  unsigned int *data,
+                  const char *filename,
+                  GError **err)
+{
+    uint32_t vals[2];
+
+    if (pread(fd, vals, 2 * VAL_LEN, offset) != 2 * VAL_LEN) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "read() error on %s: %s", filename,
+                    errno ? g_strerror(errno) : "Unexpected end of file");
+        return FALSE;
+    }
+
+    *index = ntohl(vals[0]);
+    *data  = ntohl(vals[1]);
+    return TRUE;
+}
+
 struct cr_HeaderRangeStruct
-cr_get_header_byte_range(const char *filename, GError **err)
+cr_get_header_byte_range_fd(int fd, const char *filename, GError **err)
 {
-    /* Values readed by fread are 4 bytes long and stored as big-endian.
-     * So there is htonl function to convert this big-endian number into host
+    /* Values are 4 bytes long and stored as big-endian.
+     * So there is ntohl function to convert this big-endian number into host
      * byte order.
      */
 
     struct cr_HeaderRangeStruct results;
 
+    assert(fd >= 0);
     assert(!err || *err == NULL);
 
     results.start = 0;
     results.end   = 0;
 
-
-    // Open file
-
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        g_debug("%s: Cannot open file %s (%s)", __func__, filename,
-                g_strerror(errno));
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot open %s: %s", filename, g_strerror(errno));
-        return results;
-    }
-
+    if (!filename)
+        filename = "(fd)";
 
     // Get header range
 
-    if (fseek(fp, 104, SEEK_SET) != 0) {
-        g_debug("%s: fseek fail on %s (%s)", __func__, filename,
-                g_strerror(errno));
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot seek over %s: %s", filename, g_strerror(errno));
-        fclose(fp);
-        return results;
-    }
-
     unsigned int sigindex = 0;
     unsigned int sigdata  = 0;
-    if (fread(&sigindex, VAL_LEN, 1, fp) != 1) {
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "fread() error on %s: %s", filename, g_strerror(errno));
-        fclose(fp);
-        return results;
-    }
-    sigindex = htonl(sigindex);
-    if (fread(&sigdata, VAL_LEN, 1, fp) != 1) {
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "fread() error on %s: %s", filename, g_strerror(errno));
-        fclose(fp);
+    errno = 0;
+    if (!read_header_intro(fd, 104, &sigindex, &sigdata, filename, err))
         return results;
-    }
-    sigdata = htonl(sigdata);
 
     unsigned int sigindexsize = sigindex * 16;
     unsigned int sigsize = sigdata + sigindexsize;
@@ -305,31 +311,17 @@ cr_get_header_byte_range(const char *filename, GError **err)
     }
     unsigned int hdrstart = 112 + sigsize + disttoboundary;
 
-    fseek(fp, hdrstart, SEEK_SET);
-    fseek(fp, 8, SEEK_CUR);
-
     unsigned int hdrindex = 0;
     unsigned int hdrdata  = 0;
-    if (fread(&hdrindex, VAL_LEN, 1, fp) != 1) {
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "fread() error on %s: %s", filename, g_strerror(errno));
-        fclose(fp);
-        return results;
-    }
-    hdrindex = htonl(hdrindex);
-    if (fread(&hdrdata, VAL_LEN, 1, fp) != 1) {
-        g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "fread() error on %s: %s", filename, g_strerror(errno));
-        fclose(fp);
+    errno = 0;
+    if (!read_header_intro(fd, hdrstart + 8, &hdrindex, &hdrdata,
+                           filename, err))
         return results;
-    }
-    hdrdata = htonl(hdrdata);
+
     unsigned int hdrindexsize = hdrindex * 16;
     unsigned int hdrsize = hdrdata + hdrindexsize + 16;
     unsigned int hdrend = hdrstart + hdrsize;
 
-    fclose(fp);
-
 
     // Check sanity
 
@@ -348,6 +340,118 @@ cr_get_header_byte_range(const char *filename, GError **err)
     return results;
 }
 
+/* Read two big-endian 4 bytes long values from the data
+ */
+static void
+data_header_intro(const unsigned char *data,
+                  unsigned int *index,
+                  unsigned int *data_len)
+{
+    uint32_t vals[2];
+
+    memcpy(vals, data, 2 * VAL_LEN);
+    *index    = ntohl(vals[0]);
+    *data_len = ntohl(vals[1]);
+}
+
+struct cr_HeaderRangeStruct
+cr_get_header_byte_range_data(const void *in_data,
+                              gsize len,
+                              gsize *needed,
+                              GError **err)
+{
+    static const unsigned char lead_magic[] = { 0xed, 0xab, 0xee, 0xdb };
+    const unsigned char *data = in_data;
+    struct cr_HeaderRangeStruct results;
+
+    assert(data || !len);
+    assert(needed);
+    assert(!err || *err == NULL);
+
+    results.start = 0;
+    results.end   = 0;
+    *needed = 0;
+
+    // The same computation as in cr_get_header_byte_range_fd(), the lead
+    // is checked too, the data could be e.g. an error page of a server
+    if (len < 112) {
+        *needed = 112;
+        return results;
+    }
+
+    if (memcmp(data, lead_magic, sizeof(lead_magic))) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG, "Not a rpm package");
+        return results;
+    }
+
+    unsigned int sigindex = 0;
+    unsigned int sigdata  = 0;
+    data_header_intro(data + 104, &sigindex, &sigdata);
+
+    guint64 sigsize = (guint64) sigdata + (guint64) sigindex * 16;
+    guint64 hdrstart = 112 + sigsize + (8 - sigsize % 8) % 8;
+    if (hdrstart + 16 > G_MAXUINT) {
+        g_set_error(err, ERR_DOMAIN, CRE_ERROR,
+                    "sanity check error (signature size: %" G_GUINT64_FORMAT
+                    ")", sigsize);
+        return results;
+    }
+    if (len < hdrstart + 16) {
+        *needed = hdrstart + 16;
+        return results;
+    }
+
+    unsigned int hdrindex = 0;
+    unsigned int hdrdata  = 0;
+    data_header_intro(data + hdrstart + 8, &hdrindex, &hdrdata);
+
+    guint64 hdrend = hdrstart + (guint64) hdrdata
+                     + (guint64) hdrindex * 16 + 16;
+    if (hdrend > G_MAXUINT) {
+        g_set_error(err, ERR_DOMAIN, CRE_ERROR,
+                    "sanity check error (hdrstart: %" G_GUINT64_FORMAT
+                    ", hdrend: %" G_GUINT64_FORMAT ")", hdrstart, hdrend);
+        return results;
+    }
+    if (len < hdrend) {
+        *needed = hdrend;
+        return results;
+    }
+
+    results.start = hdrstart;
+    results.end   = hdrend;
+
+    return results;
+}
+
+struct cr_HeaderRangeStruct
+cr_get_header_byte_range(const char *filename, GError **err)
+{
+    struct cr_HeaderRangeStruct results;
+
+    assert(!err || *err == NULL);
+
+    results.start = 0;
+    results.end   = 0;
+
+
+    // Open file
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        g_debug("%s: Cannot open file %s (%s)", __func__, filename,
+                g_strerror(errno));
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open %s: %s", filename, g_strerror(errno));
+        return results;
+    }
+
+    results = cr_get_header_byte_range_fd(fd, filename, err);
+    close(fd);
+
+    return results;
+}
+
 char *
 cr_get_filename(const char *filepath)
 {
@@ -385,14 +489,83 @@ cr_get_cleaned_href(const char *filepath)
     return filename;
 }
 
+/** Copy the content of the file by the kernel, without moving it through
+ * a user space buffer. A reflink (FICLONE) shares the data blocks on
+ * filesystems that support it (btrfs, XFS), copy_file_range() copies
+ * them in the kernel (or shares them on NFS, ...) and sendfile() is
+ * the fallback for older kernels.
+ * @param src_fd        source file descriptor
+ * @param dst_fd        destination file descriptor (empty file)
+ * @param size          size of the source file
+ * @return              0 when the content was copied, -1 and errno when
+ *                      the copy failed or when none of the methods is
+ *                      supported (errno is ENOSYS then) - in that case
+ *                      nothing was written and the destination is still
+ *                      empty
+ */
+static int
+cr_copy_file_kernel(int src_fd, int dst_fd, off_t size)
+{
+#ifdef __linux__
+    off_t copied = 0;
+
+    if (size == 0)
+        return 0;
+
+#ifdef FICLONE
+    if (!ioctl(dst_fd, FICLONE, src_fd))
+        return 0;
+#endif
+
+#ifdef __NR_copy_file_range
+    while (copied < size) {
+        ssize_t ret = syscall(__NR_copy_file_range, src_fd, NULL, dst_fd,
+                              NULL, (size_t) (size - copied), 0);
+        if (ret < 0) {
+            if (copied == 0 && (errno == ENOSYS || errno == EXDEV
+                                || errno == EINVAL || errno == EOPNOTSUPP))
+                break;  // Not supported for these files, try sendfile()
+            return -1;
+        }
+        if (ret == 0)
+            break;      // The file shrank meanwhile
+        copied += ret;
+    }
+    if (copied > 0)
+        return 0;
+#endif
+
+    while (copied < size) {
+        ssize_t ret = sendfile(dst_fd, src_fd, NULL, (size_t) (size - copied));
+        if (ret < 0) {
+            if (copied == 0 && (errno == ENOSYS || errno == EINVAL))
+                break;
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        copied += ret;
+    }
+    if (copied > 0)
+        return 0;
+#endif /* __linux__ */
+
+    (void) src_fd;
+    (void) dst_fd;
+    (void) size;
+    errno = ENOSYS;
+    return -1;
+}
+
 gboolean
 cr_copy_file(const char *src, const char *in_dst, GError **err)
 {
-    size_t readed;
+    ssize_t readed;
     char buf[BUFFER_SIZE];
+    struct stat st;
     _cleanup_free_ gchar *dst = NULL;
-    _cleanup_file_fclose_ FILE *orig = NULL;
-    _cleanup_file_fclose_ FILE *new  = NULL;
+    _cleanup_file_close_ int orig = -1;
+    _cleanup_file_close_ int new  = -1;
 
     assert(src);
     assert(in_dst);
@@ -405,7 +578,7 @@ cr_copy_file(const char *src, const char *in_dst, GError **err)
         dst = g_strdup(in_dst);
 
     // Open src file
-    if ((orig = fopen(src, "rb")) == NULL) {
+    if ((orig = open(src, O_RDONLY)) < 0 || fstat(orig, &st)) {
         g_debug("%s: Cannot open source file %s (%s)", __func__, src,
                 g_strerror(errno));
         g_set_error(err, ERR_DOMAIN, CRE_IO,
@@ -414,7 +587,7 @@ cr_copy_file(const char *src, const char *in_dst, GError **err)
     }
 
     // Open dst file
-    if ((new = fopen(dst, "wb")) == NULL) {
+    if ((new = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
         g_debug("%s: Cannot open destination file %s (%s)", __func__, dst,
                 g_strerror(errno));
         g_set_error(err, ERR_DOMAIN, CRE_IO,
@@ -423,25 +596,81 @@ cr_copy_file(const char *src, const char *in_dst, GError **err)
     }
 
     // Copy content from src -> dst
-    while ((readed = fread(buf, 1, BUFFER_SIZE, orig)) > 0) {
-        if (readed != BUFFER_SIZE && ferror(orig)) {
+    if (S_ISREG(st.st_mode)) {
+        if (!cr_copy_file_kernel(orig, new, st.st_size))
+            return TRUE;
+        if (errno != ENOSYS) {
+            g_debug("%s: Error while copy %s -> %s (%s)", __func__, src,
+                    dst, g_strerror(errno));
             g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Error while read %s: %s", src, g_strerror(errno));
+                    "Error while copy %s -> %s: %s", src, dst,
+                    g_strerror(errno));
             return FALSE;
         }
+    }
 
-        if (fwrite(buf, 1, readed, new) != readed) {
-            g_debug("%s: Error while copy %s -> %s (%s)", __func__, src,
-                    dst, g_strerror(errno));
+    while ((readed = read(orig, buf, BUFFER_SIZE)) != 0) {
+        if (readed < 0) {
+            if (errno == EINTR)
+                continue;
             g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Error while write %s: %s", dst, g_strerror(errno));
+                    "Error while read %s: %s", src, g_strerror(errno));
             return FALSE;
         }
+
+        for (ssize_t written = 0; written < readed;) {
+            ssize_t ret = write(new, buf + written, readed - written);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0) {
+                g_debug("%s: Error while copy %s -> %s (%s)", __func__, src,
+                        dst, g_strerror(errno));
+                g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Error while write %s: %s", dst, g_strerror(errno));
+                return FALSE;
+            }
+            written += ret;
+        }
     }
 
     return TRUE;
 }
 
+gboolean
+cr_link_or_copy_file(const char *src, const char *in_dst, GError **err)
+{
+    _cleanup_free_ gchar *dst = NULL;
+
+    assert(src);
+    assert(in_dst);
+    assert(!err || *err == NULL);
+
+    if (g_str_has_suffix(in_dst, "/"))
+        dst = g_strconcat(in_dst, cr_get_filename(src), NULL);
+    else
+        dst = g_strdup(in_dst);
+
+    if (!link(src, dst))
+        return TRUE;
+
+    if (errno == EEXIST) {
+        // Replace the existing file by the link, as the copy would do
+        _cleanup_free_ gchar *tmp = g_strdup_printf("%s.link.%d", dst,
+                                                    (int) getpid());
+        if (!link(src, tmp)) {
+            int rc = rename(tmp, dst);
+            // rename() does nothing if dst is already a link to src
+            unlink(tmp);
+            if (!rc)
+                return TRUE;
+        }
+    }
+
+    g_debug("%s: Cannot link %s -> %s (%s), copying", __func__, src, dst,
+            g_strerror(errno));
+    return cr_copy_file(src, dst, err);
+}
+
 
 
 int
@@ -789,71 +1018,584 @@ cr_download(CURL *in_handle,
 }
 
 
-
-gboolean
-cr_better_copy_file(const char *src, const char *in_dst, GError **err)
+#ifdef WITH_ZCHUNK
+static size_t
+cr_download_zck_header_cb(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
-    GError *tmp_err = NULL;
+    int fd = *((int *) userdata);
+    size_t len = size * nmemb;
+
+    for (size_t written = 0; written < len; ) {
+        ssize_t ret = write(fd, (char *) ptr + written, len - written);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        written += ret;
+    }
 
-    assert(!err || *err == NULL);
+    return len;
+}
 
-    if (!strstr(src, "://"))   // Probably local path
-        return cr_copy_file(src, in_dst, err);
+/** Perform the range request, the server has to reply by a partial content.
+ */
+static gboolean
+cr_download_zck_range(CURL *handle,
+                      const char *url,
+                      const char *range,
+                      const char *errorbuf,
+                      GError **err)
+{
+    CURLcode rcode;
+    long code = 0;
 
-    CURL *handle = curl_easy_init();
-    cr_download(handle, src, in_dst, &tmp_err);
-    curl_easy_cleanup(handle);
-    if (tmp_err) {
-        g_debug("%s: Error while downloading %s: %s", __func__, src,
-                tmp_err->message);
-        g_propagate_prefixed_error(err, tmp_err,
-                                   "Error while downloading %s: ", src);
+    rcode = curl_easy_setopt(handle, CURLOPT_RANGE, range);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_perform(handle);
+    if (rcode != CURLE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL,
+                    "Cannot download %s: %s: %s",
+                    url, curl_easy_strerror(rcode), errorbuf);
+        return FALSE;
+    }
+
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+    if (code != 206) {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL,
+                    "Server doesn't support range requests of %s "
+                    "(response code %ld)", url, code);
         return FALSE;
     }
 
     return TRUE;
 }
-
+#endif // WITH_ZCHUNK
 
 int
-cr_remove_dir_cb(const char *fpath,
-                 G_GNUC_UNUSED const struct stat *sb,
-                 G_GNUC_UNUSED int typeflag,
-                 G_GNUC_UNUSED struct FTW *ftwbuf)
+cr_download_zck(CURL *in_handle,
+                const char *url,
+                const char *source,
+                const char *destination,
+                gint64 header_size,
+                GError **err)
 {
-    int rv = remove(fpath);
-    if (rv)
-        g_warning("%s: Cannot remove: %s: %s", __func__, fpath, g_strerror(errno));
-
-    return rv;
-}
-
+    assert(in_handle);
+    assert(url);
+    assert(source);
+    assert(destination);
+    assert(!err || *err == NULL);
 
-int
-cr_remove_dir(const char *path, GError **err)
-{
-    int ret;
+#ifdef WITH_ZCHUNK
+    int ret = CRE_ZCK;
+    int fd = -1, src_fd = -1;
+    CURL *handle = NULL;
+    zckCtx *zck = NULL, *zck_src = NULL;
+    zckDL *dl = NULL;
+    char errorbuf[CURL_ERROR_SIZE];
+    _cleanup_free_ gchar *header_range = NULL;
 
-    assert(!err || *err == NULL);
+    if (header_size <= 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Unknown zchunk header size of %s", url);
+        return CRE_BADARG;
+    }
 
-    ret = nftw(path, cr_remove_dir_cb, 64, FTW_DEPTH | FTW_PHYS);
-    if (ret != 0) {
+    fd = open(destination, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
         g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Cannot remove dir %s: %s", path, g_strerror(errno));
+                    "Cannot open %s: %s", destination, g_strerror(errno));
         return CRE_IO;
     }
 
-    return CRE_OK;
-}
+    handle = curl_easy_duphandle(in_handle);
+    errorbuf[0] = '\0';
+    curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, errorbuf);
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+
+    // The header first, its size is listed in repomd.xml
+    header_range = g_strdup_printf("0-%" G_GINT64_FORMAT, header_size - 1);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, cr_download_zck_header_cb);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &fd);
+    if (!cr_download_zck_range(handle, url, header_range, errorbuf, err))
+        goto download_zck_cleanup;
+
+    zck = zck_create();
+    if (lseek(fd, 0, SEEK_SET) != 0
+        || !zck_init_adv_read(zck, fd)
+        || !zck_read_lead(zck)
+        || !zck_read_header(zck))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_ZCK,
+                    "Cannot read zchunk header of %s: %s",
+                    url, zck_get_error(zck));
+        goto download_zck_cleanup;
+    }
+
+    // The chunks already present in the older version are copied
+    src_fd = open(source, O_RDONLY);
+    if (src_fd >= 0) {
+        zck_src = zck_create();
+        if (!zck_init_read(zck_src, src_fd) || !zck_copy_chunks(zck_src, zck))
+            g_debug("%s: Cannot reuse chunks of %s: %s", __func__, source,
+                    zck_get_error(zck_src));
+    }
+
+    dl = zck_dl_init(zck);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, zck_header_cb);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, dl);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, zck_write_chunk_cb);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, dl);
+
+    ssize_t missing;
+    while ((missing = zck_missing_chunks(zck)) > 0) {
+        zckRange *range = zck_dl_get_range(dl);
+        if (range)
+            zck_range_free(&range);
+
+        range = zck_get_missing_range(zck, ZCK_MAX_RANGES);
+        if (!range || !zck_dl_set_range(dl, range)) {
+            g_set_error(err, ERR_DOMAIN, CRE_ZCK,
+                        "Cannot prepare download of chunks of %s: %s",
+                        url, zck_get_error(zck));
+            zck_range_free(&range);
+            goto download_zck_cleanup;
+        }
 
+        char *chunks_range = zck_get_range_char(zck, range);
+        gboolean downloaded = chunks_range != NULL
+            && cr_download_zck_range(handle, url, chunks_range, errorbuf, err);
+        free(chunks_range);
+        if (!downloaded) {
+            if (err && !*err)
+                g_set_error(err, ERR_DOMAIN, CRE_ZCK,
+                            "Cannot prepare download of chunks of %s: %s",
+                            url, zck_get_error(zck));
+            goto download_zck_cleanup;
+        }
 
-// Return path with exactly one trailing '/'
-char *
-cr_normalize_dir_path(const char *path)
-{
-    char *normalized = NULL;
+        // Every request has to make a progress
+        if (zck_failed_chunks(zck) > 0 || zck_missing_chunks(zck) >= missing) {
+            g_set_error(err, ERR_DOMAIN, CRE_ZCK,
+                        "Chunks of %s don't match their checksums", url);
+            goto download_zck_cleanup;
+        }
+    }
 
-    if (!path)
+    if (missing < 0 || zck_validate_checksums(zck) < 1) {
+        g_set_error(err, ERR_DOMAIN, CRE_ZCK,
+                    "Downloaded %s doesn't match its checksums: %s",
+                    url, zck_get_error(zck));
+        goto download_zck_cleanup;
+    }
+
+    g_debug("%s: Successfully downloaded: %s (chunks of %s reused)",
+            __func__, destination, source);
+    ret = CRE_OK;
+
+download_zck_cleanup:
+
+    if (dl) {
+        zckRange *range = zck_dl_get_range(dl);
+        if (range)
+            zck_range_free(&range);
+        zck_dl_free(&dl);
+    }
+    zck_free(&zck_src);
+    zck_free(&zck);
+    curl_easy_cleanup(handle);
+    if (src_fd >= 0)
+        close(src_fd);
+    close(fd);
+    if (ret != CRE_OK)
+        remove(destination);
+
+    return ret;
+#else
+    g_set_error(err, ERR_DOMAIN, CRE_ZCK, "createrepo_c wasn't compiled "
+                "with zchunk support");
+    return CRE_ZCK;
+#endif // WITH_ZCHUNK
+}
+
+
+cr_DownloadTarget *
+cr_downloadtarget_new(const char *url, const char *destination)
+{
+    cr_DownloadTarget *target = g_malloc0(sizeof(cr_DownloadTarget));
+    target->url = g_strdup(url);
+    target->destination = g_strdup(destination);
+    return target;
+}
+
+
+void
+cr_downloadtarget_free(cr_DownloadTarget *target)
+{
+    if (!target)
+        return;
+
+    g_free(target->url);
+    g_free(target->destination);
+    g_free(target->etag);
+    g_clear_error(&target->err);
+    g_free(target);
+}
+
+
+/** A transfer of a cr_DownloadTarget by cr_download_targets()
+ */
+typedef struct {
+    cr_DownloadTarget *target;
+    CURL *handle;
+    struct curl_slist *headers;
+    FILE *file;
+    gchar *dst;             // final destination
+    gchar *tmp_dst;         // file the data are written into
+    gchar *etag;            // ETag from the response headers
+    char errorbuf[CURL_ERROR_SIZE];
+} cr_DownloadTransfer;
+
+
+static size_t
+download_header_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    cr_DownloadTransfer *transfer = userdata;
+    size_t len = size * nitems;
+
+    if (len > 5 && !strncmp(buffer, "HTTP/", 5)) {
+        // Status line of a new response (e.g. after a redirect)
+        g_clear_pointer(&transfer->etag, g_free);
+    } else if (len > 5 && !g_ascii_strncasecmp(buffer, "ETag:", 5)) {
+        g_free(transfer->etag);
+        transfer->etag = g_strstrip(g_strndup(buffer + 5, len - 5));
+    }
+
+    return len;
+}
+
+
+static void
+download_transfer_free(cr_DownloadTransfer *transfer)
+{
+    if (!transfer)
+        return;
+
+    if (transfer->handle)
+        curl_easy_cleanup(transfer->handle);
+    curl_slist_free_all(transfer->headers);
+    if (transfer->file) {
+        fclose(transfer->file);
+        remove(transfer->tmp_dst);
+    }
+    g_free(transfer->dst);
+    g_free(transfer->tmp_dst);
+    g_free(transfer->etag);
+    g_free(transfer);
+}
+
+
+static cr_DownloadTransfer *
+download_transfer_new(CURL *in_handle, cr_DownloadTarget *target, GError **err)
+{
+    cr_DownloadTransfer *transfer;
+    CURLcode rcode = CURLE_OK;
+
+    transfer = g_malloc0(sizeof(cr_DownloadTransfer));
+    transfer->target = target;
+
+    // If destination is dir use filename from src
+    if (g_str_has_suffix(target->destination, "/"))
+        transfer->dst = g_strconcat(target->destination,
+                                    cr_get_filename(target->url), NULL);
+    else if (g_file_test(target->destination, G_FILE_TEST_IS_DIR))
+        transfer->dst = g_strconcat(target->destination, "/",
+                                    cr_get_filename(target->url), NULL);
+    else
+        transfer->dst = g_strdup(target->destination);
+
+    // The destination is replaced only by a complete file
+    transfer->tmp_dst = g_strconcat(transfer->dst, ".part", NULL);
+    transfer->file = fopen(transfer->tmp_dst, "wb");
+    if (!transfer->file) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot open %s: %s",
+                    transfer->tmp_dst, g_strerror(errno));
+        download_transfer_free(transfer);
+        return NULL;
+    }
+
+    transfer->handle = curl_easy_duphandle(in_handle);
+    transfer->errorbuf[0] = '\0';
+
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_ERRORBUFFER,
+                                 transfer->errorbuf);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_URL, target->url);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_WRITEDATA,
+                                 transfer->file);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_PRIVATE, transfer);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_HEADERFUNCTION,
+                                 download_header_cb);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_HEADERDATA,
+                                 transfer);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_FILETIME, 1L);
+    if (rcode == CURLE_OK && target->mtime > 0) {
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_TIMECONDITION,
+                                 (long) CURL_TIMECOND_IFMODSINCE);
+        if (rcode == CURLE_OK)
+            rcode = curl_easy_setopt(transfer->handle, CURLOPT_TIMEVALUE,
+                                     (long) target->mtime);
+    }
+    if (rcode == CURLE_OK && target->etag) {
+        _cleanup_free_ gchar *header = g_strconcat("If-None-Match: ",
+                                                   target->etag, NULL);
+        transfer->headers = curl_slist_append(NULL, header);
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_HTTPHEADER,
+                                 transfer->headers);
+    }
+
+    if (rcode != CURLE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL,
+                    "curl_easy_setopt failed: %s",
+                    curl_easy_strerror(rcode));
+        download_transfer_free(transfer);
+        return NULL;
+    }
+
+    // Optional, not supported by every libcurl build
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    curl_easy_setopt(transfer->handle, CURLOPT_HTTP_VERSION,
+                     (long) CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    // Rather wait for a connection that could be multiplexed
+    // than open a new one
+    curl_easy_setopt(transfer->handle, CURLOPT_PIPEWAIT, 1L);
+#endif
+
+    return transfer;
+}
+
+
+static void
+download_transfer_done(cr_DownloadTransfer *transfer, CURLcode result)
+{
+    cr_DownloadTarget *target = transfer->target;
+    long response_code = 0;
+    long condition_unmet = 0;
+    long filetime = -1;
+
+    fclose(transfer->file);
+    transfer->file = NULL;
+
+    if (result != CURLE_OK) {
+        g_set_error(&target->err, ERR_DOMAIN, CRE_CURL,
+                    "curl_easy_perform failed: %s: %s: %s",
+                    target->url, curl_easy_strerror(result),
+                    transfer->errorbuf);
+        remove(transfer->tmp_dst);
+        return;
+    }
+
+    curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_getinfo(transfer->handle, CURLINFO_CONDITION_UNMET, &condition_unmet);
+    if (response_code == 304 || condition_unmet) {
+        g_debug("%s: Not modified: %s", __func__, target->url);
+        target->not_modified = TRUE;
+        remove(transfer->tmp_dst);
+        return;
+    }
+
+    if (g_rename(transfer->tmp_dst, transfer->dst) == -1) {
+        g_set_error(&target->err, ERR_DOMAIN, CRE_IO,
+                    "Cannot rename %s -> %s: %s", transfer->tmp_dst,
+                    transfer->dst, g_strerror(errno));
+        remove(transfer->tmp_dst);
+        return;
+    }
+
+    curl_easy_getinfo(transfer->handle, CURLINFO_FILETIME, &filetime);
+    target->mtime = (filetime > 0) ? filetime : 0;
+    g_free(target->etag);
+    target->etag = transfer->etag;
+    transfer->etag = NULL;
+
+    g_debug("%s: Successfully downloaded: %s", __func__, transfer->dst);
+}
+
+
+int
+cr_download_targets(CURL *in_handle,
+                    GSList *targets,
+                    long max_host_connections,
+                    GError **err)
+{
+    CURLM *multi;
+    CURLMcode mcode = CURLM_OK;
+    GSList *transfers = NULL;
+    int running = 0;
+
+    assert(in_handle);
+    assert(!err || *err == NULL);
+
+    multi = curl_multi_init();
+    if (!multi) {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL, "curl_multi_init failed");
+        return CRE_CURL;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+    if (max_host_connections > 0)
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          max_host_connections);
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        cr_DownloadTarget *target = elem->data;
+        cr_DownloadTransfer *transfer;
+
+        g_clear_error(&target->err);
+        target->not_modified = FALSE;
+
+        transfer = download_transfer_new(in_handle, target, &target->err);
+        if (!transfer)
+            continue;
+
+        mcode = curl_multi_add_handle(multi, transfer->handle);
+        if (mcode != CURLM_OK) {
+            g_set_error(&target->err, ERR_DOMAIN, CRE_CURL,
+                        "curl_multi_add_handle failed: %s",
+                        curl_multi_strerror(mcode));
+            download_transfer_free(transfer);
+            continue;
+        }
+
+        transfers = g_slist_prepend(transfers, transfer);
+    }
+
+    // Run all the transfers
+    do {
+        CURLMsg *msg;
+        int msgs_left;
+
+        mcode = curl_multi_perform(multi, &running);
+        if (mcode != CURLM_OK)
+            break;
+
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            cr_DownloadTransfer *transfer = NULL;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            download_transfer_done(transfer, msg->data.result);
+        }
+
+        if (running)
+            mcode = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    } while (running && mcode == CURLM_OK);
+
+    for (GSList *elem = transfers; elem; elem = g_slist_next(elem)) {
+        cr_DownloadTransfer *transfer = elem->data;
+
+        if (transfer->file && !transfer->target->err)
+            // Unfinished transfer
+            g_set_error(&transfer->target->err, ERR_DOMAIN, CRE_CURL,
+                        "curl_multi failed: %s: %s", transfer->target->url,
+                        curl_multi_strerror(mcode));
+
+        curl_multi_remove_handle(multi, transfer->handle);
+        download_transfer_free(transfer);
+    }
+    g_slist_free(transfers);
+    curl_multi_cleanup(multi);
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        cr_DownloadTarget *target = elem->data;
+        if (target->err) {
+            int code = target->err->code;
+            g_propagate_error(err, g_error_copy(target->err));
+            return code;
+        }
+    }
+
+    return CRE_OK;
+}
+
+
+
+gboolean
+cr_better_copy_file(const char *src, const char *in_dst, GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!strstr(src, "://"))   // Probably local path
+        return cr_copy_file(src, in_dst, err);
+
+    CURL *handle = curl_easy_init();
+    cr_download(handle, src, in_dst, &tmp_err);
+    curl_easy_cleanup(handle);
+    if (tmp_err) {
+        g_debug("%s: Error while downloading %s: %s", __func__, src,
+                tmp_err->message);
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Error while downloading %s: ", src);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+int
+cr_remove_dir_cb(const char *fpath,
+                 G_GNUC_UNUSED const struct stat *sb,
+                 G_GNUC_UNUSED int typeflag,
+                 G_GNUC_UNUSED struct FTW *ftwbuf)
+{
+    int rv = remove(fpath);
+    if (rv)
+        g_warning("%s: Cannot remove: %s: %s", __func__, fpath, g_strerror(errno));
+
+    return rv;
+}
+
+
+int
+cr_remove_dir(const char *path, GError **err)
+{
+    int ret;
+
+    assert(!err || *err == NULL);
+
+    ret = nftw(path, cr_remove_dir_cb, 64, FTW_DEPTH | FTW_PHYS);
+    if (ret != 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot remove dir %s: %s", path, g_strerror(errno));
+        return CRE_IO;
+    }
+
+    return CRE_OK;
+}
+
+
+// Return path with exactly one trailing '/'
+char *
+cr_normalize_dir_path(const char *path)
+{
+    char *normalized = NULL;
+
+    if (!path)
         return normalized;
 
     int i = strlen(path);
@@ -943,8 +1685,84 @@ cr_str_to_version(const char *str)
     return ver;
 }
 
+/** rpmvercmp() of two strings given by pointers and lengths.
+ * Everything but the '~' and '^' separators (their meaning depends on the
+ * version of rpm) is compared here, segment by segment and without any
+ * allocation, exactly as rpmvercmp() does. Strings which contain them are
+ * copied and passed to rpmvercmp().
+ */
 static int
-cr_compare_values(const char *str1, const char *str2)
+cr_vercmp_len(const char *one, gsize one_len, const char *two, gsize two_len)
+{
+    const char *one_end = one + one_len;
+    const char *two_end = two + two_len;
+
+    if (one_len == two_len && !memcmp(one, two, one_len))
+        return 0;
+
+    if (memchr(one, '~', one_len) || memchr(one, '^', one_len)
+        || memchr(two, '~', two_len) || memchr(two, '^', two_len))
+    {
+        _cleanup_free_ gchar *str1 = g_strndup(one, one_len);
+        _cleanup_free_ gchar *str2 = g_strndup(two, two_len);
+        return rpmvercmp(str1, str2);
+    }
+
+    while (one < one_end || two < two_end) {
+        const char *seg1, *seg2;
+        gsize len1, len2;
+        gboolean isnum;
+        int rc;
+
+        while (one < one_end && !g_ascii_isalnum(*one)) one++;
+        while (two < two_end && !g_ascii_isalnum(*two)) two++;
+
+        // If we ran to the end of either, we are finished with the loop
+        if (one == one_end || two == two_end)
+            break;
+
+        seg1 = one;
+        seg2 = two;
+        isnum = g_ascii_isdigit(*one);
+        if (isnum) {
+            while (one < one_end && g_ascii_isdigit(*one)) one++;
+            while (two < two_end && g_ascii_isdigit(*two)) two++;
+        } else {
+            while (one < one_end && g_ascii_isalpha(*one)) one++;
+            while (two < two_end && g_ascii_isalpha(*two)) two++;
+        }
+
+        // The segments are of different types: numeric segments are
+        // always newer than alpha segments
+        if (two == seg2)
+            return isnum ? 1 : -1;
+
+        if (isnum) {
+            // The longer number (without leading zeros) is newer
+            while (seg1 < one && *seg1 == '0') seg1++;
+            while (seg2 < two && *seg2 == '0') seg2++;
+            if (one - seg1 != two - seg2)
+                return (one - seg1 > two - seg2) ? 1 : -1;
+        }
+
+        len1 = one - seg1;
+        len2 = two - seg2;
+        rc = memcmp(seg1, seg2, MIN(len1, len2));
+        if (rc)
+            return rc < 0 ? -1 : 1;
+        if (len1 != len2)
+            return len1 < len2 ? -1 : 1;
+    }
+
+    // Whichever version still has characters left over wins
+    if (one == one_end && two == two_end)
+        return 0;
+    return (one == one_end) ? -1 : 1;
+}
+
+static int
+cr_compare_values_len(const char *str1, gsize len1,
+                      const char *str2, gsize len2)
 {
     if (!str1 && !str2)
         return 0;
@@ -952,7 +1770,14 @@ cr_compare_values(const char *str1, const char *str2)
         return 1;
     else if (!str1 && str2)
         return -1;
-    return rpmvercmp(str1, str2);
+    return cr_vercmp_len(str1, len1, str2, len2);
+}
+
+static int
+cr_compare_values(const char *str1, const char *str2)
+{
+    return cr_compare_values_len(str1, str1 ? strlen(str1) : 0,
+                                 str2, str2 ? strlen(str2) : 0);
 }
 
 // Return values:
@@ -981,15 +1806,36 @@ cr_null_log_fn(G_GNUC_UNUSED const gchar *log_domain,
 }
 
 
-void
-cr_log_fn(const gchar *log_domain,
+/** Formatted time of the debug messages, it changes once a second.
+ */
+typedef struct {
+    gint64 sec;
+    char buffer[16];
+} LogTimestamp;
+
+static GPrivate log_timestamp_key = G_PRIVATE_INIT(g_free);
+
+static const char *
+log_timestamp(LogTimestamp *ts, gint64 sec)
+{
+    if (ts->sec != sec || !ts->buffer[0]) {
+        time_t rawtime = (time_t) sec;
+        struct tm timeinfo;
+
+        localtime_r(&rawtime, &timeinfo);
+        strftime(ts->buffer, sizeof(ts->buffer), "%H:%M:%S", &timeinfo);
+        ts->sec = sec;
+    }
+    return ts->buffer;
+}
+
+static void
+log_write(const gchar *log_domain,
           GLogLevelFlags log_level,
           const gchar *message,
-          gpointer user_data)
+          gint64 sec,
+          LogTimestamp *ts)
 {
-    gint hidden_log_levels = GPOINTER_TO_INT(user_data);
-    if (log_level & hidden_log_levels)
-        return;
     switch(log_level) {
         case G_LOG_LEVEL_ERROR:
             if (log_domain) g_printerr("%s: ", log_domain);
@@ -1003,255 +1849,691 @@ cr_log_fn(const gchar *log_domain,
             if (log_domain) g_printerr("%s: ", log_domain);
             g_printerr("Warning: %s\n", message);
             break;
-        case G_LOG_LEVEL_DEBUG: {
-            time_t rawtime;
-            struct tm * timeinfo;
-            char buffer[80];
-
-            time ( &rawtime );
-            timeinfo = localtime ( &rawtime );
-            strftime (buffer, 80, "%H:%M:%S", timeinfo);
-
+        case G_LOG_LEVEL_DEBUG:
             //if (log_domain) g_printerr("%s: ", log_domain);
-            g_printerr("%s: %s\n", buffer, message);
+            g_printerr("%s: %s\n", log_timestamp(ts, sec), message);
             break;
-        }
         default:
             printf("%s\n", message);
     }
-
-    return;
 }
 
+// Stack of the hidden levels of the thread (GArray of gint)
+static GPrivate log_levels_key = G_PRIVATE_INIT((GDestroyNotify) g_array_unref);
 
 void
-cr_slist_free_full(GSList *list, GDestroyNotify free_f)
+cr_log_push_thread_hidden_levels(GLogLevelFlags levels)
 {
-    g_slist_free_full(list, free_f);
+    GArray *stack = g_private_get(&log_levels_key);
+    gint value = (gint) levels;
+
+    if (!stack) {
+        stack = g_array_new(FALSE, FALSE, sizeof(gint));
+        g_private_set(&log_levels_key, stack);
+    }
+    g_array_append_val(stack, value);
 }
 
+void
+cr_log_pop_thread_hidden_levels(void)
+{
+    GArray *stack = g_private_get(&log_levels_key);
 
-void cr_queue_free_full(GQueue *queue, GDestroyNotify free_f)
+    assert(stack && stack->len > 0);
+    g_array_set_size(stack, stack->len - 1);
+}
+
+gint
+cr_log_get_thread_hidden_levels(void)
 {
-    g_queue_free_full(queue, free_f);
+    GArray *stack = g_private_get(&log_levels_key);
+
+    if (!stack || stack->len == 0)
+        return -1;
+    return g_array_index(stack, gint, stack->len - 1);
 }
 
+/** Hidden levels of the calling thread, those of the handler if it
+ * has none.
+ */
+static gint
+log_hidden_levels(gpointer user_data)
+{
+    gint levels = cr_log_get_thread_hidden_levels();
+    return levels >= 0 ? levels : GPOINTER_TO_INT(user_data);
+}
 
-cr_NEVRA *
-cr_split_rpm_filename(const char *filename)
+void
+cr_log_fn(const gchar *log_domain,
+          GLogLevelFlags log_level,
+          const gchar *message,
+          gpointer user_data)
 {
-    cr_NEVRA *nevra = NULL;
-    gchar *str, *epoch = NULL;
-    size_t len;
+    gint hidden_log_levels = log_hidden_levels(user_data);
+    LogTimestamp *ts;
 
-    filename = cr_get_filename(filename);
+    if (log_level & hidden_log_levels)
+        return;
 
-    if (!filename)
-        return NULL;
+    ts = g_private_get(&log_timestamp_key);
+    if (!ts) {
+        ts = g_malloc0(sizeof(*ts));
+        g_private_set(&log_timestamp_key, ts);
+    }
+
+    log_write(log_domain, log_level, message, g_get_real_time() / G_USEC_PER_SEC,
+              ts);
+}
 
-    str = g_strdup(filename);
+/* Asynchronous logging
+ *
+ * Every logging thread has its own ring of messages, it is the only writer
+ * of the ring head and the drain thread the only writer of the tail, so the
+ * messages are passed without any lock. The drain thread writes them
+ * in the order of their sequence numbers, a number is taken before its
+ * message is published, so the drain waits for a missing number instead
+ * of writing the later messages before it. The rings belong to the session
+ * (cr_log_async_start() .. cr_log_async_stop()), the slot of a thread
+ * remembers the serial of the session like the slots of cr_Metrics.
+ */
 
-    // N-V-R.rpm:E
-    if (strchr(str, ':')) {
-        gchar **filename_epoch = g_strsplit(str, ":", 2);
-        if (g_str_has_suffix(filename_epoch[0], ".rpm")) {
-            g_free(str);
-            str = filename_epoch[0];
-            epoch = filename_epoch[1];
-        } else {
-            g_strfreev(filename_epoch);
+#define LOG_RING_SIZE           512     // Power of 2
+#define LOG_DRAIN_INTERVAL      (G_TIME_SPAN_MILLISECOND * 20)
+
+typedef struct {
+    guint seq;                  // Order of the message
+    GLogLevelFlags level;
+    gint64 sec;                 // Time of the message
+    gchar *domain;              // Only of the levels which print it
+    gchar *message;
+} LogRecord;
+
+typedef struct {
+    LogRecord records[LOG_RING_SIZE];
+    guint head;                 // Next record to write (logging thread)
+    guint tail;                 // Next record to drain (drain thread)
+} LogRing;
+
+typedef struct {
+    guint serial;
+    LogRing *ring;
+} LogSlot;
+
+static GPrivate log_slot_key = G_PRIVATE_INIT(g_free);
+
+static struct {
+    GMutex mutex;               // Guards the rings and the drain state
+    GCond wake;                 // Wakes up the drain thread
+    GCond drained;              // Signaled after every drain
+    GPtrArray *rings;           // LogRing * of the session (owned)
+    GThread *thread;            // Drain thread
+    guint serial;               // Serial of the running session
+    gint running;               // The messages are queued
+    gint producers;             // Threads in cr_log_async_fn()
+    gint seq;                   // Sequence number of the next message
+    guint next_seq;             // Sequence number of the next message
+                                // to write (drain thread)
+    gboolean wakeup;            // The drain was requested
+    guint requested;            // Number of the requested flushes
+    guint served;               // Number of the served flushes
+    LogTimestamp ts;            // Cache of the drain thread
+} log_async;
+
+static guint log_last_serial = 0;
+
+// Guards the start and the stop of the session, the session is shared
+// by its users and stopped by the last of them
+static GMutex log_async_users_mutex;
+static guint log_async_users = 0;
+
+static void
+log_ring_free(LogRing *ring)
+{
+    for (guint x = ring->tail; x != ring->head; x++) {
+        g_free(ring->records[x % LOG_RING_SIZE].domain);
+        g_free(ring->records[x % LOG_RING_SIZE].message);
+    }
+    g_free(ring);
+}
+
+/** Write all the queued messages. Called by the drain thread only.
+ */
+static void
+log_async_drain(void)
+{
+    GPtrArray *rings = g_ptr_array_new();
+    gboolean missing = TRUE;
+
+    while (TRUE) {
+        LogRing *next = NULL;
+        LogRecord *rec = NULL;
+
+        // A new ring could be added after a number was taken for its first
+        // message, so the rings are taken again when a number is missing
+        if (missing) {
+            g_ptr_array_set_size(rings, 0);
+            g_mutex_lock(&log_async.mutex);
+            for (guint x = 0; x < log_async.rings->len; x++)
+                g_ptr_array_add(rings, g_ptr_array_index(log_async.rings, x));
+            g_mutex_unlock(&log_async.mutex);
         }
+
+        // The oldest message of all the rings
+        for (guint x = 0; x < rings->len; x++) {
+            LogRing *ring = g_ptr_array_index(rings, x);
+            guint head = (guint) g_atomic_int_get(&ring->head);
+            LogRecord *first = &ring->records[ring->tail % LOG_RING_SIZE];
+
+            if (ring->tail == head)
+                continue;
+            if (!rec || (gint) (first->seq - rec->seq) < 0) {
+                next = ring;
+                rec = first;
+            }
+        }
+        if (!rec)
+            break;
+
+        // The message of the next number is being published by its thread
+        missing = rec->seq != log_async.next_seq;
+        if (missing) {
+            g_thread_yield();
+            continue;
+        }
+        log_async.next_seq++;
+
+        log_write(rec->domain, rec->level, rec->message, rec->sec,
+                  &log_async.ts);
+        g_free(rec->domain);
+        g_free(rec->message);
+        g_atomic_int_set(&next->tail, next->tail + 1);
     }
 
-    len = strlen(str);
+    g_ptr_array_free(rings, TRUE);
+}
+
+static gpointer
+log_async_thread(G_GNUC_UNUSED gpointer data)
+{
+    gboolean stop = FALSE;
 
-    // Get rid off .rpm suffix
-    if (len >= 4 && !strcmp(str+(len-4), ".rpm")) {
-        len -= 4;
-        str[len] = '\0';
+    while (!stop) {
+        guint requested;
+
+        g_mutex_lock(&log_async.mutex);
+        if (!log_async.wakeup && g_atomic_int_get(&log_async.running))
+            g_cond_wait_until(&log_async.wake, &log_async.mutex,
+                              g_get_monotonic_time() + LOG_DRAIN_INTERVAL);
+        log_async.wakeup = FALSE;
+        requested = log_async.requested;
+        // A thread waiting for a room in its ring is still served
+        stop = !g_atomic_int_get(&log_async.running)
+               && !g_atomic_int_get(&log_async.producers);
+        g_mutex_unlock(&log_async.mutex);
+
+        log_async_drain();
+
+        g_mutex_lock(&log_async.mutex);
+        log_async.served = requested;
+        g_cond_broadcast(&log_async.drained);
+        g_mutex_unlock(&log_async.mutex);
     }
 
-    nevra = cr_str_to_nevra(str);
-    g_free(str);
+    return NULL;
+}
 
-    if (epoch) {
-        g_free(nevra->epoch);
-        nevra->epoch = epoch;
+static void
+log_async_wakeup(void)
+{
+    g_mutex_lock(&log_async.mutex);
+    log_async.wakeup = TRUE;
+    g_cond_signal(&log_async.wake);
+    g_mutex_unlock(&log_async.mutex);
+}
+
+void
+cr_log_async_start(void)
+{
+    g_mutex_lock(&log_async_users_mutex);
+    if (log_async_users++ > 0) {
+        g_mutex_unlock(&log_async_users_mutex);
+        return;
     }
 
-    return nevra;
+    log_async.rings = g_ptr_array_new_with_free_func(
+                            (GDestroyNotify) log_ring_free);
+    log_async.serial = (guint) g_atomic_int_add(&log_last_serial, 1) + 1;
+    log_async.wakeup = FALSE;
+    log_async.next_seq = (guint) g_atomic_int_get(&log_async.seq);
+    g_atomic_int_set(&log_async.running, 1);
+    log_async.thread = g_thread_new("cr_log", log_async_thread, NULL);
+    g_mutex_unlock(&log_async_users_mutex);
+}
+
+void
+cr_log_async_flush(void)
+{
+    guint requested;
+
+    if (!g_atomic_int_get(&log_async.running))
+        return;
+
+    g_mutex_lock(&log_async.mutex);
+    requested = ++log_async.requested;
+    log_async.wakeup = TRUE;
+    g_cond_signal(&log_async.wake);
+    while ((gint) (log_async.served - requested) < 0)
+        g_cond_wait(&log_async.drained, &log_async.mutex);
+    g_mutex_unlock(&log_async.mutex);
 }
 
-/** Split N-V-R:E or E:N-V-R or N-E:V-R
+void
+cr_log_async_stop(void)
+{
+    g_mutex_lock(&log_async_users_mutex);
+    if (log_async_users == 0 || --log_async_users > 0) {
+        // Not started or still used by others
+        g_mutex_unlock(&log_async_users_mutex);
+        return;
+    }
+
+    // The threads which saw the logger running finish their messages
+    // first, the next ones are written directly
+    g_atomic_int_set(&log_async.running, 0);
+    while (g_atomic_int_get(&log_async.producers))
+        g_thread_yield();
+
+    log_async_wakeup();
+    g_thread_join(log_async.thread);
+    log_async.thread = NULL;
+
+    g_ptr_array_free(log_async.rings, TRUE);
+    log_async.rings = NULL;
+    g_mutex_unlock(&log_async_users_mutex);
+}
+
+/** Queue the message in the ring of the current thread.
  */
-cr_NEVR *
-cr_str_to_nevr(const char *instr)
+static void
+log_async_push(const gchar *log_domain,
+               GLogLevelFlags log_level,
+               const gchar *message)
 {
-    gchar *nvr = NULL;
-    gchar *epoch = NULL;
-    gchar **nvr_epoch_list = NULL;
-    cr_NEVR *nevr = NULL;
-    size_t len;
-    int i;
+    LogSlot *slot = g_private_get(&log_slot_key);
+    LogRing *ring;
+    LogRecord *rec;
+
+    if (!slot) {
+        slot = g_malloc0(sizeof(*slot));
+        g_private_set(&log_slot_key, slot);
+    }
+
+    if (slot->serial != log_async.serial) {
+        ring = g_malloc0(sizeof(*ring));
+        g_mutex_lock(&log_async.mutex);
+        g_ptr_array_add(log_async.rings, ring);
+        g_mutex_unlock(&log_async.mutex);
+        slot->serial = log_async.serial;
+        slot->ring = ring;
+    }
+    ring = slot->ring;
+
+    // The ring is full, wait for the drain thread
+    while (ring->head - (guint) g_atomic_int_get(&ring->tail) == LOG_RING_SIZE) {
+        log_async_wakeup();
+        g_usleep(1000);
+    }
+
+    rec = &ring->records[ring->head % LOG_RING_SIZE];
+    rec->seq     = (guint) g_atomic_int_add(&log_async.seq, 1);
+    rec->level   = log_level;
+    rec->sec     = g_get_real_time() / G_USEC_PER_SEC;
+    rec->domain  = (log_level & (G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING))
+                   ? g_strdup(log_domain) : NULL;
+    rec->message = g_strdup(message);
+    g_atomic_int_set(&ring->head, ring->head + 1);
+
+    // Half of the ring shouldn't wait for the next drain
+    if (ring->head - (guint) g_atomic_int_get(&ring->tail) == LOG_RING_SIZE / 2)
+        log_async_wakeup();
+}
 
-    if (!instr)
-        return NULL;
+void
+cr_log_async_fn(const gchar *log_domain,
+                GLogLevelFlags log_level,
+                const gchar *message,
+                gpointer user_data)
+{
+    gint hidden_log_levels = log_hidden_levels(user_data);
+    gboolean queued;
+
+    if (log_level & hidden_log_levels)
+        return;
+
+    // The fatal messages abort the program right after this function,
+    // everything is written before them
+    if (log_level & (G_LOG_LEVEL_ERROR | G_LOG_FLAG_FATAL)) {
+        cr_log_async_flush();
+        cr_log_fn(log_domain, log_level, message, user_data);
+        return;
+    }
+
+    g_atomic_int_inc(&log_async.producers);
+    queued = g_atomic_int_get(&log_async.running);
+    if (queued)
+        log_async_push(log_domain, log_level, message);
+    g_atomic_int_add(&log_async.producers, -1);
+
+    if (!queued)
+        cr_log_fn(log_domain, log_level, message, user_data);
+}
+
+
+void
+cr_slist_free_full(GSList *list, GDestroyNotify free_f)
+{
+    g_slist_free_full(list, free_f);
+}
+
+
+void cr_queue_free_full(GQueue *queue, GDestroyNotify free_f)
+{
+    g_queue_free_full(queue, free_f);
+}
+
+
+/** Last occurrence of the c in the first len bytes of the str
+ */
+static const char *
+str_rchr_len(const char *str, gsize len, char c)
+{
+    while (len--)
+        if (str[len] == c)
+            return str + len;
+    return NULL;
+}
+
+/** Split N-V-R:E or E:N-V-R or N-E:V-R given by the str and len
+ */
+static void
+nevr_view_parse(const char *str, gsize len, cr_NEVRAView *view)
+{
+    const char *nvr = str, *epoch = NULL, *colon, *dash;
+    gsize nvr_len = len, epoch_len = 0;
 
     // 1)
-    // Try to split by ':'
+    // Try to split by the first ':'
     // If we have N-V-R:E or E:N-V-R then nvr and epoch will be filled
     // If we have N-E:V-R or N-V-R then only nvr will be filed
 
-    nvr_epoch_list = g_strsplit(instr, ":", 2);
-
-    if (!nvr_epoch_list || !(*nvr_epoch_list)) {
-        g_strfreev(nvr_epoch_list);
-        return NULL;
+    colon = memchr(str, ':', len);
+    if (colon) {
+        const char *after = colon + 1;
+        gsize before_len = colon - str, after_len = len - before_len - 1;
+
+        if (!memchr(after, '-', after_len)) {
+            // N-V-R:E
+            nvr_len = before_len;
+            epoch = after;
+            epoch_len = after_len;
+        } else if (!memchr(str, '-', before_len)) {
+            // E:N-V-R
+            nvr = after;
+            nvr_len = after_len;
+            epoch = str;
+            epoch_len = before_len;
+        }
+        // else probably the N-E:V-R format, handle it after the split
     }
 
-    nvr     = nvr_epoch_list[0];
-    epoch   = nvr_epoch_list[1];  // May be NULL
+    // 2)
+    // Now split the nvr by the '-' into three parts
 
-    if (epoch && strchr(epoch, '-')) {
-        if (!strchr(nvr, '-')) {
-            // Switch nvr and epoch
-            char *tmp = nvr;
-            nvr = epoch;
-            epoch = tmp;
-        } else {
-            // Probably the N-E:V-R format, handle it after the split
-            g_free(nvr);
-            g_free(epoch);
-            nvr = g_strdup(instr);
-            epoch = NULL;
+    dash = str_rchr_len(nvr, nvr_len, '-');
+    if (dash) {
+        view->release = dash + 1;
+        view->release_len = nvr + nvr_len - view->release;
+        nvr_len = dash - nvr;
+
+        dash = str_rchr_len(nvr, nvr_len, '-');
+        if (dash) {
+            view->version = dash + 1;
+            view->version_len = nvr + nvr_len - view->version;
+            nvr_len = dash - nvr;
         }
     }
 
-    g_free(nvr_epoch_list);
+    view->name = nvr;
+    view->name_len = nvr_len;
 
-    // 2)
-    // Now split the nvr by the '-' into three parts
+    // 3)
+    // Now split the E:V
 
-    nevr = g_new0(cr_NEVR, 1);
-    len = strlen(nvr);
-
-    // Get release
-    for (i = len-1; i >= 0; i--)
-        if (nvr[i] == '-') {
-            nevr->release = g_strdup(nvr+i+1);
-            nvr[i] = '\0';
-            len = i;
-            break;
+    if (!epoch && view->version
+        && (colon = memchr(view->version, ':', view->version_len)))
+    {
+        epoch = view->version;
+        epoch_len = colon - epoch;
+        view->version = colon + 1;
+        view->version_len -= epoch_len + 1;
+    }
+
+    view->epoch = epoch;
+    view->epoch_len = epoch_len;
+}
+
+/** Split N-V-R.A:E, E:N-V-R.A, N-E:V-R.A or N-V-R.A
+ */
+static gboolean
+nevra_view_parse(const char *str, gsize len, cr_NEVRAView *view)
+{
+    const char *epoch = NULL, *colon, *dot;
+    gsize epoch_len = 0;
+
+    memset(view, 0, sizeof(*view));
+
+    // N-V-R.A:E
+    colon = memchr(str, ':', len);
+    if (colon) {
+        const char *candidate = colon + 1;
+        gsize candidate_len = len - (candidate - str);
+        if (!memchr(candidate, '-', candidate_len)
+            && !memchr(candidate, '.', candidate_len))
+        {
+            // Strip epoch from the very end
+            epoch = candidate;
+            epoch_len = candidate_len;
+            len = colon - str;
         }
+    }
 
-    // Get version
-    for (i = len-1; i >= 0; i--)
-        if (nvr[i] == '-') {
-            nevr->version = g_strdup(nvr+i+1);
-            nvr[i] = '\0';
-            len = i;
-            break;
+    // Get arch
+    dot = str_rchr_len(str, len, '.');
+    if (dot) {
+        view->arch = dot + 1;
+        view->arch_len = len - (view->arch - str);
+        len = dot - str;
+
+        if (memchr(view->arch, '-', view->arch_len)) {
+            g_warning("Invalid arch %.*s", (int) view->arch_len, view->arch);
+            return FALSE;
         }
+    }
 
-    // Get name
-    nevr->name = g_strdup(nvr);
+    nevr_view_parse(str, len, view);
 
-    g_free(nvr);
+    if (epoch) {
+        view->epoch = epoch;
+        view->epoch_len = epoch_len;
+    }
 
-    // 3)
-    // Now split the E:V
+    return TRUE;
+}
 
-    if (epoch == NULL && (nevr->version && strchr(nevr->version, ':'))) {
-        gchar **epoch_version = g_strsplit(nevr->version, ":", 2);
-        g_free(nevr->version);
-        nevr->epoch = epoch_version[0];
-        nevr->version = epoch_version[1];
-        g_free(epoch_version);
-    } else {
-        nevr->epoch = epoch;
+gboolean
+cr_str_to_nevra_view(const char *str, cr_NEVRAView *view)
+{
+    if (!str)
+        return FALSE;
+    return nevra_view_parse(str, strlen(str), view);
+}
+
+gboolean
+cr_split_rpm_filename_view(const char *filename, cr_NEVRAView *view)
+{
+    const char *epoch = NULL, *colon;
+    gsize len, epoch_len = 0;
+
+    filename = cr_get_filename(filename);
+
+    if (!filename)
+        return FALSE;
+
+    len = strlen(filename);
+
+    // N-V-R.rpm:E
+    colon = strchr(filename, ':');
+    if (colon && colon - filename >= 4 && !memcmp(colon - 4, ".rpm", 4)) {
+        epoch = colon + 1;
+        epoch_len = len - (epoch - filename);
+        len = colon - filename;
     }
 
-    return nevr;
+    // Get rid off .rpm suffix
+    if (len >= 4 && !memcmp(filename + (len - 4), ".rpm", 4))
+        len -= 4;
+
+    if (!nevra_view_parse(filename, len, view))
+        return FALSE;
+
+    if (epoch) {
+        view->epoch = epoch;
+        view->epoch_len = epoch_len;
+    }
+
+    return TRUE;
 }
 
-void
-cr_nevr_free(cr_NEVR *nevr)
+static gchar *
+nevra_view_dup(const char *str, gsize len)
 {
-    if (!nevr)
-        return;
-    g_free(nevr->name);
-    g_free(nevr->epoch);
-    g_free(nevr->version);
-    g_free(nevr->release);
-    g_free(nevr);
+    return str ? g_strndup(str, len) : NULL;
 }
 
+static cr_NEVRA *
+nevra_from_view(const cr_NEVRAView *view)
+{
+    cr_NEVRA *nevra = g_new0(cr_NEVRA, 1);
+    nevra->name     = nevra_view_dup(view->name, view->name_len);
+    nevra->epoch    = nevra_view_dup(view->epoch, view->epoch_len);
+    nevra->version  = nevra_view_dup(view->version, view->version_len);
+    nevra->release  = nevra_view_dup(view->release, view->release_len);
+    nevra->arch     = nevra_view_dup(view->arch, view->arch_len);
+    return nevra;
+}
 
 cr_NEVRA *
-cr_str_to_nevra(const char *instr)
+cr_split_rpm_filename(const char *filename)
 {
-    cr_NEVR *nevr;
-    cr_NEVRA *nevra = NULL;
-    gchar *str, *epoch = NULL;
-    size_t len;
-    int i;
+    cr_NEVRAView view;
 
-    if (!instr)
+    if (!cr_split_rpm_filename_view(filename, &view))
         return NULL;
+    return nevra_from_view(&view);
+}
 
-    nevra = g_new0(cr_NEVRA, 1);
-    str = g_strdup(instr);
-
-    // N-V-R.A:E
-    if (strchr(str, ':')) {
-        gchar **nvra_epoch = g_strsplit(str, ":", 2);
-        char *epoch_candidate = nvra_epoch[1];
-        if (epoch_candidate
-            && !strchr(epoch_candidate, '-')
-            && !strchr(epoch_candidate, '.'))
-        {
-            // Strip epoch from the very end
-            epoch = epoch_candidate;
-            g_free(str);
-            str = nvra_epoch[0];
-        } else {
-            g_strfreev(nvra_epoch);
+cr_NEVRA *
+cr_split_rpm_filenames(const char **filenames, gsize count)
+{
+    cr_NEVRAView *views = g_new(cr_NEVRAView, count);
+    gboolean *parsed = g_new(gboolean, count);
+    gsize size = count * sizeof(cr_NEVRA);
+    cr_NEVRA *nevras;
+    gchar *strings;
+
+    // The first pass parses the filenames and counts the size of
+    // the strings, the second one copies them behind the structures
+    for (gsize x = 0; x < count; x++) {
+        cr_NEVRAView *v = &views[x];
+        parsed[x] = cr_split_rpm_filename_view(filenames[x], v);
+        if (parsed[x])
+            size += v->name_len + v->epoch_len + v->version_len
+                    + v->release_len + v->arch_len + 5;
+    }
+
+    nevras = g_malloc0(size);
+    strings = (gchar *) (nevras + count);
+
+    for (gsize x = 0; x < count; x++) {
+        const cr_NEVRAView *v = &views[x];
+        const char *slices[] = { v->name, v->epoch, v->version,
+                                 v->release, v->arch };
+        gsize lens[] = { v->name_len, v->epoch_len, v->version_len,
+                         v->release_len, v->arch_len };
+        char **items[] = { &nevras[x].name, &nevras[x].epoch,
+                           &nevras[x].version, &nevras[x].release,
+                           &nevras[x].arch };
+
+        if (!parsed[x])
+            continue;
+
+        for (int i = 0; i < 5; i++) {
+            if (!slices[i]) {
+                strings++;  // Keep the counted '\0'
+                continue;
+            }
+            memcpy(strings, slices[i], lens[i]);
+            *items[i] = strings;
+            strings += lens[i] + 1;
         }
     }
 
-    len = strlen(str);
+    g_free(views);
+    g_free(parsed);
+    return nevras;
+}
 
-    // Get arch
-    for (i = len-1; i >= 0; i--)
-        if (str[i] == '.') {
-            nevra->arch = g_strdup(str+i+1);
-            str[i] = '\0';
-            len = i;
-            break;
-        }
+cr_NEVR *
+cr_str_to_nevr(const char *instr)
+{
+    cr_NEVRAView view;
+    cr_NEVR *nevr;
 
-    if (nevra->arch && strchr(nevra->arch, '-')) {
-        g_warning("Invalid arch %s", nevra->arch);
-        cr_nevra_free(nevra);
-        g_free(str);
+    if (!instr || !(*instr))
         return NULL;
-    }
 
-    nevr = cr_str_to_nevr(str);
-    nevra->name     = nevr->name;
-    nevra->epoch    = nevr->epoch;
-    nevra->version  = nevr->version;
-    nevra->release  = nevr->release;
+    memset(&view, 0, sizeof(view));
+    nevr_view_parse(instr, strlen(instr), &view);
+
+    nevr = g_new0(cr_NEVR, 1);
+    nevr->name      = nevra_view_dup(view.name, view.name_len);
+    nevr->epoch     = nevra_view_dup(view.epoch, view.epoch_len);
+    nevr->version   = nevra_view_dup(view.version, view.version_len);
+    nevr->release   = nevra_view_dup(view.release, view.release_len);
+    return nevr;
+}
+
+void
+cr_nevr_free(cr_NEVR *nevr)
+{
+    if (!nevr)
+        return;
+    g_free(nevr->name);
+    g_free(nevr->epoch);
+    g_free(nevr->version);
+    g_free(nevr->release);
     g_free(nevr);
+}
 
-    g_free(str);
 
-    if (epoch) {
-        g_free(nevra->epoch);
-        nevra->epoch = epoch;
-    }
+cr_NEVRA *
+cr_str_to_nevra(const char *instr)
+{
+    cr_NEVRAView view;
 
-    return nevra;
+    if (!cr_str_to_nevra_view(instr, &view))
+        return NULL;
+    return nevra_from_view(&view);
 }
 
 
@@ -1285,6 +2567,34 @@ cr_cmp_evr(const char *e1, const char *v1, const char *r1,
     return rc;
 }
 
+int
+cr_cmp_evr_view(const cr_EVRView *evr1, const cr_EVRView *evr2)
+{
+    int rc;
+
+    rc = cr_compare_values_len(evr1->epoch ? evr1->epoch : "0",
+                               evr1->epoch ? evr1->epoch_len : 1,
+                               evr2->epoch ? evr2->epoch : "0",
+                               evr2->epoch ? evr2->epoch_len : 1);
+    if (rc) return rc;
+    rc = cr_compare_values_len(evr1->version, evr1->version_len,
+                               evr2->version, evr2->version_len);
+    if (rc) return rc;
+    rc = cr_compare_values_len(evr1->release, evr1->release_len,
+                               evr2->release, evr2->release_len);
+    return rc;
+}
+
+int
+cr_cmp_evr_str(const char *evr1, const char *evr2)
+{
+    cr_EVRView view1, view2;
+
+    cr_str_to_evr_view(evr1, &view1);
+    cr_str_to_evr_view(evr2, &view2);
+    return cr_cmp_evr_view(&view1, &view2);
+}
+
 int
 cr_warning_cb(G_GNUC_UNUSED cr_XmlParserWarningType type,
               char *msg,
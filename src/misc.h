@@ -57,6 +57,18 @@ typedef struct {
     char *release;      /*!< release */
 } cr_EVR;
 
+/** Epoch-Version-Release parsed in place (see cr_str_to_evr_view()).
+ * The strings point into the parsed string and are not '\0' terminated.
+ */
+typedef struct {
+    const char *epoch;      /*!< epoch or NULL if bad (non-numerical) */
+    gsize epoch_len;        /*!< length of the epoch */
+    const char *version;    /*!< version */
+    gsize version_len;      /*!< length of the version */
+    const char *release;    /*!< release or NULL */
+    gsize release_len;      /*!< length of the release */
+} cr_EVRView;
+
 typedef struct {
     char *name;
     char *epoch;
@@ -72,6 +84,23 @@ typedef struct {
     char *arch;
 } cr_NEVRA;
 
+/** N-E-V-R-A parsed in place (see cr_str_to_nevra_view()).
+ * The strings point into the parsed string and are not '\0' terminated,
+ * missing items are NULL.
+ */
+typedef struct {
+    const char *name;       /*!< name */
+    gsize name_len;         /*!< length of the name */
+    const char *epoch;      /*!< epoch */
+    gsize epoch_len;        /*!< length of the epoch */
+    const char *version;    /*!< version */
+    gsize version_len;      /*!< length of the version */
+    const char *release;    /*!< release */
+    gsize release_len;      /*!< length of the release */
+    const char *arch;       /*!< architecture */
+    gsize arch_len;         /*!< length of the architecture */
+} cr_NEVRAView;
+
 /** Version representation
  * e.g. for openssl-devel-1.0.0i = version: 1, release: 0, patch: 0, suffix: i
  */
@@ -93,6 +122,14 @@ struct cr_Version {
  */
 cr_EVR *cr_str_to_evr(const char *string, GStringChunk *chunk);
 
+/** Parse epoch-version-release string as cr_str_to_evr() does, but
+ * without any allocation. The items of the view point into the string
+ * (the default epoch "0" is a static string).
+ * @param string        NULL terminated e-v-r string or NULL
+ * @param view          view to fill
+ */
+void cr_str_to_evr_view(const char *string, cr_EVRView *view);
+
 /** Free cr_EVR
  * Warning: Do not use this function when a string chunk was
  * used in the cr_str_to_evr! In that case use only g_free on
@@ -102,19 +139,62 @@ cr_EVR *cr_str_to_evr(const char *string, GStringChunk *chunk);
 void
 cr_evr_free(cr_EVR *evr);
 
+/** Check if there is "bin/" anywhere in the path (a rule of
+ *  cr_is_primary()).
+ * @param path          path
+ * @return              1 if the path contains "bin/", otherwise 0
+ */
+static inline int cr_path_has_bin_dir(const char *path) {
+    return strstr(path, "bin/") != NULL;
+};
+
 /** Check if the filename match pattern for primary files (files listed
  *  in primary.xml).
+ *  The rules are: the "/etc/" prefix, the "/usr/lib/sendmail" file and
+ *  "bin/" anywhere in the path. The first two are switched on the second
+ *  character of the path.
  * @param filename      full path to file
  * @return              1 if it is primary file, otherwise 0
  */
 static inline int cr_is_primary(const char *filename) {
-    if (!strncmp(filename, "/etc/", 5))
-        return 1;
-    if (!strcmp(filename, "/usr/lib/sendmail"))
-        return 1;
-    if (strstr(filename, "bin/"))
+    if (filename[0] == '/') {
+        switch (filename[1]) {
+            case 'e':
+                if (!strncmp(filename + 2, "tc/", 3))
+                    return 1;
+                break;
+            case 'u':
+                if (!strcmp(filename + 2, "sr/lib/sendmail"))
+                    return 1;
+                break;
+        }
+    }
+    return cr_path_has_bin_dir(filename);
+};
+
+/** Same as cr_is_primary() for the concatenation of path and name, but
+ *  without building it (if the name doesn't contain a '/', the "/etc/"
+ *  and "bin/" rules depend on the path only).
+ * @param path          path of the file (e.g. cr_PackageFile->path)
+ * @param name          name of the file (e.g. cr_PackageFile->name)
+ * @return              1 if it is primary file, otherwise 0
+ */
+static inline int cr_is_primary_file(const char *path, const char *name) {
+    static const char sendmail[] = "/usr/lib/sendmail";
+    size_t path_len;
+
+    if (strchr(name, '/')) {
+        gchar *filename = g_strconcat(path, name, NULL);
+        int ret = cr_is_primary(filename);
+        g_free(filename);
+        return ret;
+    }
+    if (!strncmp(path, "/etc/", 5) || cr_path_has_bin_dir(path))
         return 1;
-    return 0;
+    path_len = strlen(path);
+    return path_len < sizeof(sendmail)
+           && !strncmp(path, sendmail, path_len)
+           && !strcmp(name, sendmail + path_len);
 };
 
 /** Header range
@@ -132,6 +212,34 @@ struct cr_HeaderRangeStruct {
 struct cr_HeaderRangeStruct cr_get_header_byte_range(const char *filename,
                                                      GError **err);
 
+/** Return header byte range of an already opened rpm file.
+ * The data are read by pread(), so the file offset is not changed.
+ * @param fd            file descriptor opened for reading
+ * @param filename      filename used in error messages (could be NULL)
+ * @param err           GError **
+ * @return              header range (start = end = 0 on error)
+ */
+struct cr_HeaderRangeStruct cr_get_header_byte_range_fd(int fd,
+                                                        const char *filename,
+                                                        GError **err);
+
+/** Return header byte range of a package from the beginning of its file
+ * in the memory (e.g. read by a HTTP range request). If the data are too
+ * short, the length of the data needed for the next step is returned
+ * in the needed and the function should be called again with it (the
+ * needed length could grow once more).
+ * @param data          beginning of the rpm file
+ * @param len           length of the data
+ * @param needed        0 or the length of the data needed
+ * @param err           GError **
+ * @return              header range (start = end = 0 on error or if
+ *                      more data are needed)
+ */
+struct cr_HeaderRangeStruct cr_get_header_byte_range_data(const void *data,
+                                                          gsize len,
+                                                          gsize *needed,
+                                                          GError **err);
+
 /** Return pointer to the rest of string after last '/'.
  * (e.g. for "/foo/bar" returns "bar")
  * @param filepath      path
@@ -159,7 +267,78 @@ int cr_download(CURL *handle,
                 const char *destination,
                 GError **err);
 
-/** Copy file.
+/** Download a zchunk compressed file from the URL, reusing the chunks
+ * of an older version of the file. Only the zchunk header and the missing
+ * chunks are downloaded (by HTTP range requests), all the chunks are
+ * verified by their checksums from the header.
+ * @param handle        CURL handle
+ * @param url           source url
+ * @param source        older version of the file (if it cannot be read,
+ *                      all the chunks are downloaded)
+ * @param destination   destination path
+ * @param header_size   size of the zchunk header (from repomd.xml)
+ * @param err           GError **
+ * @return              cr_Error
+ */
+int cr_download_zck(CURL *handle,
+                    const char *url,
+                    const char *source,
+                    const char *destination,
+                    gint64 header_size,
+                    GError **err);
+
+/** A file to download by cr_download_targets().
+ */
+typedef struct {
+    char *url;              /*!< source url */
+    char *destination;      /*!< destination (if destination is dir,
+                                 filename from the url is used) */
+    char *etag;             /*!< ETag of the existing destination file (sent
+                                 as If-None-Match) or NULL. Replaced by
+                                 the ETag of the downloaded file. */
+    gint64 mtime;           /*!< If > 0, the file is downloaded only if it
+                                 was modified after the time (If-Modified-
+                                 Since). Replaced by the remote time of
+                                 the downloaded file (or 0 if unknown). */
+    gboolean not_modified;  /*!< TRUE if the server replied that the file
+                                 was not modified (the destination is kept
+                                 untouched) */
+    GError *err;            /*!< error of the download or NULL */
+} cr_DownloadTarget;
+
+/** Create a new cr_DownloadTarget.
+ * @param url           source url
+ * @param destination   destination path or directory
+ * @return              new cr_DownloadTarget
+ */
+cr_DownloadTarget *cr_downloadtarget_new(const char *url,
+                                         const char *destination);
+
+/** Free a cr_DownloadTarget.
+ * @param target        cr_DownloadTarget
+ */
+void cr_downloadtarget_free(cr_DownloadTarget *target);
+
+/** Download files concurrently via the curl multi interface. Transfers to
+ * the same host share connections and HTTP/2 multiplexing is used when
+ * supported by the server. Every download is written into a temporary file
+ * next to the destination first, so on an error or a not modified reply
+ * the existing destination is kept.
+ * @param handle        CURL handle used as a template for the transfers
+ * @param targets       list of cr_DownloadTarget
+ * @param max_host_connections  maximal number of connections to one host
+ *                      (0 - libcurl default)
+ * @param err           GError ** (the first one of the failed targets)
+ * @return              cr_Error
+ */
+int cr_download_targets(CURL *handle,
+                        GSList *targets,
+                        long max_host_connections,
+                        GError **err);
+
+/** Copy file. On Linux the file is reflinked (FICLONE) or copied by
+ * copy_file_range() or sendfile() when the filesystem supports it,
+ * the content then does not pass through the user space.
  * @param src           source filename
  * @param dst           destination (if dst is dir, filename of src is used)
  * @param err           GError **
@@ -169,6 +348,19 @@ gboolean cr_copy_file(const char *src,
                       const char *dst,
                       GError **err);
 
+/** Hard link the file, or copy it (see cr_copy_file()) if it cannot be
+ * linked (e.g. it is on another filesystem). An existing dst is replaced.
+ * Use it only for files which are never modified in place, the dst
+ * shares the content with the src.
+ * @param src           source filename
+ * @param dst           destination (if dst is dir, filename of src is used)
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if an error occured
+ */
+gboolean cr_link_or_copy_file(const char *src,
+                              const char *dst,
+                              GError **err);
+
 /** Compress file.
  * @param SRC           source filename
  * @param DST           destination (If dst is dir, filename of src +
@@ -282,17 +474,69 @@ void cr_null_log_fn(const gchar *log_domain,
                     const gchar *message,
                     gpointer user_data);
 
+/** Hide the levels of the messages logged by the calling thread
+ * by cr_log_fn() and cr_log_async_fn(), instead of the levels they
+ * were set up with. A pipeline which has its own levels (e.g.
+ * a createrepo_c run) sets them in every thread working for it.
+ * The calls can nest.
+ * @param levels        hidden levels
+ */
+void cr_log_push_thread_hidden_levels(GLogLevelFlags levels);
+
+/** Undo the last cr_log_push_thread_hidden_levels() of the calling thread.
+ */
+void cr_log_pop_thread_hidden_levels(void);
+
+/** Get the hidden levels of the calling thread.
+ * @return              levels of the last
+ *                      cr_log_push_thread_hidden_levels() or -1 if
+ *                      the thread has none
+ */
+gint cr_log_get_thread_hidden_levels(void);
+
 /** Createrepo_c library standard logging function.
  * @param log_domain    logging domain
  * @param log_level     logging level
  * @param message       message
- * @param user_data     user data
+ * @param user_data     user data (hidden log levels, unless the thread
+ *                      has its own, see cr_log_push_thread_hidden_levels())
  */
 void cr_log_fn(const gchar *log_domain,
                GLogLevelFlags log_level,
                const gchar *message,
                gpointer user_data);
 
+/** Asynchronous variant of cr_log_fn(). The messages are queued in a ring
+ * of the calling thread, without any lock, and written in their order
+ * by a background thread, so the logging threads don't wait for
+ * the output. Fatal messages are written directly after all the queued
+ * ones. Without a running cr_log_async_start() it is cr_log_fn().
+ * @param log_domain    logging domain
+ * @param log_level     logging level
+ * @param message       message
+ * @param user_data     user data (hidden log levels as for cr_log_fn())
+ */
+void cr_log_async_fn(const gchar *log_domain,
+                     GLogLevelFlags log_level,
+                     const gchar *message,
+                     gpointer user_data);
+
+/** Start the background thread of cr_log_async_fn(). The thread is shared,
+ * every call must be paired with cr_log_async_stop().
+ */
+void cr_log_async_start(void);
+
+/** Wait until all the messages queued by cr_log_async_fn() so far
+ * are written.
+ */
+void cr_log_async_flush(void);
+
+/** Write all the queued messages and stop the background thread
+ * if this is the stop of its last start, cr_log_async_fn() writes
+ * the next messages directly.
+ */
+void cr_log_async_stop(void);
+
 /** Frees all the memory used by a GSList, and calls the specified destroy
  * function on every element's data.
  * This is the same function as g_slist_free_full(). The original function
@@ -322,6 +566,25 @@ void cr_queue_free_full(GQueue *queue, GDestroyNotify free_f);
  */
 cr_NEVRA *cr_split_rpm_filename(const char *filename);
 
+/** Split filename into the NEVRA as cr_split_rpm_filename() does, but
+ * without any allocation.
+ * @param filename      filename
+ * @param view          view to fill (it points into the filename)
+ * @return              FALSE if the filename cannot be parsed
+ */
+gboolean cr_split_rpm_filename_view(const char *filename,
+                                    cr_NEVRAView *view);
+
+/** Split a list of filenames into the NEVRAs (see cr_split_rpm_filename()).
+ * All the structures and their strings are in one allocation.
+ * @param filenames     array of filenames
+ * @param count         number of filenames
+ * @return              array of count cr_NEVRA (all items of those which
+ *                      cannot be parsed are NULL), free it by g_free()
+ *                      (not by cr_nevra_free())
+ */
+cr_NEVRA *cr_split_rpm_filenames(const char **filenames, gsize count);
+
 /** Compare evr of two cr_NEVRA. Name and arch are ignored.
  * @param A     pointer to first cr_NEVRA
  * @param B     pointer to second cr_NEVRA
@@ -342,6 +605,20 @@ cr_NEVRA *cr_split_rpm_filename(const char *filename);
 int cr_cmp_evr(const char *e1, const char *v1, const char *r1,
                const char *e2, const char *v2, const char *r2);
 
+/** Compare two parsed e-v-r strings, the same as cr_cmp_evr().
+ * @param evr1   1. e-v-r
+ * @param evr2   2. e-v-r
+ * @return       0 = same, 1 = first is newer, -1 = second is newer
+ */
+int cr_cmp_evr_view(const cr_EVRView *evr1, const cr_EVRView *evr2);
+
+/** Compare two e-v-r strings (e.g. "1:2.3-4") without any allocation.
+ * @param evr1   1. e-v-r string
+ * @param evr2   2. e-v-r string
+ * @return       0 = same, 1 = first is newer, -1 = second is newer
+ */
+int cr_cmp_evr_str(const char *evr1, const char *evr2);
+
 
 /** Safe insert into GStringChunk.
  * @param chunk     a GStringChunk
@@ -514,6 +791,15 @@ cr_nevr_free(cr_NEVR *nevr);
 cr_NEVRA *
 cr_str_to_nevra(const char *str);
 
+/** Parse NEVRA string as cr_str_to_nevra() does, but without
+ * any allocation.
+ * @param str           NEVRA string
+ * @param view          view to fill (it points into the str)
+ * @returns             FALSE on error
+ */
+gboolean
+cr_str_to_nevra_view(const char *str, cr_NEVRAView *view);
+
 /** Free cr_NEVRA
  * @param nevra     cr_NEVRA structure
  */
@@ -27,12 +27,12 @@
 #include "checksum.h"
 #include "modifyrepo_shared.h"
 #include "compression_wrapper.h"
-#include "threads.h"
 #include "xml_dump.h"
 
 #define ERR_DOMAIN              CREATEREPO_C_ERROR
 #define DEFAULT_COMPRESSION     CR_CW_GZ_COMPRESSION
 #define DEFAULT_CHECKSUM        CR_CHECKSUM_SHA256
+#define DEFAULT_WORKERS         5
 
 cr_ModifyRepoTask *
 cr_modifyrepotask_new(void)
@@ -129,6 +129,57 @@ cr_write_file(gchar *repopath, cr_ModifyRepoTask *task,
     return dst_fn;
 }
 
+/** Processing of a single (non remove) cr_ModifyRepoTask in a pool
+ */
+typedef struct {
+    cr_ModifyRepoTask *task;
+    const gchar *repopath;
+    cr_RepomdRecord *rec;       // Record of the added file
+    cr_RepomdRecord *zck_rec;   // Record of the zchunk file or NULL
+    GError *err;
+} cr_ModifyRepoJob;
+
+/** Copy & compress the file of the task and fill its records
+ * (the checksums, sizes, ...).
+ */
+static void
+cr_modifyrepo_job_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    cr_ModifyRepoJob *job = data;
+    cr_ModifyRepoTask *task = job->task;
+    cr_CompressionType compress_type = CR_CW_NO_COMPRESSION;
+    _cleanup_free_ gchar *dst_fn = NULL;
+
+    if (task->compress)
+        compress_type = task->compress_type;
+
+    dst_fn = cr_write_file((gchar *) job->repopath, task, compress_type, &job->err);
+    if (dst_fn == NULL)
+        return;
+
+    task->repopath = cr_safe_string_chunk_insert_null(task->chunk, dst_fn);
+#ifdef WITH_ZCHUNK
+    if (task->zck) {
+        free(dst_fn);
+        dst_fn = cr_write_file((gchar *) job->repopath, task,
+                               CR_CW_ZCK_COMPRESSION, &job->err);
+        if (dst_fn == NULL)
+            return;
+        task->zck_repopath = cr_safe_string_chunk_insert_null(task->chunk, dst_fn);
+    }
+#endif
+
+    job->rec = cr_repomd_record_new(task->type, task->repopath);
+    if (cr_repomd_record_fill(job->rec, task->checksum_type, &job->err) != CRE_OK)
+        return;
+
+    if (task->zck) {
+        _cleanup_free_ gchar *type = g_strconcat(task->type, "_zck", NULL);
+        job->zck_rec = cr_repomd_record_new(type, task->zck_repopath);
+        cr_repomd_record_fill(job->zck_rec, task->checksum_type, &job->err);
+    }
+}
+
 gboolean
 cr_modifyrepo(GSList *modifyrepotasks, gchar *repopath, GError **err)
 {
@@ -253,91 +304,63 @@ cr_modifyrepo(GSList *modifyrepotasks, gchar *repopath, GError **err)
     // Modifications of the target repository starts here
     //
 
-    // Add (copy) new metadata to repodata/ directory
+    // Add (copy & compress) new metadata to repodata/ directory
+    // and prepare new repomd records. The tasks are processed in parallel.
+    GSList *repomdrecords = NULL;
+    GSList *repomdrecords_uniquefn = NULL;
+    GSList *jobs = NULL;
+    GError *tmp_err = NULL;
+
+    GThreadPool *pool = g_thread_pool_new(cr_modifyrepo_job_thread,
+                                          NULL, DEFAULT_WORKERS, FALSE, NULL);
+
     for (GSList *elem = modifyrepotasks; elem; elem = g_slist_next(elem)) {
         cr_ModifyRepoTask *task = elem->data;
-        _cleanup_free_ gchar *dst_fn = NULL;
 
         if (task->remove)
             // Skip removing task
             continue;
 
-        cr_CompressionType compress_type = CR_CW_NO_COMPRESSION;
-
-        if (task->compress)
-            compress_type = task->compress_type;
-
-        dst_fn = cr_write_file(repopath, task, compress_type, err);
-        if (dst_fn == NULL) {
-            cr_repomd_free(repomd);
-            g_free(repomd_path);
-            return FALSE;
-        }
-        
-        task->repopath = cr_safe_string_chunk_insert_null(task->chunk, dst_fn);
-#ifdef WITH_ZCHUNK
-        if (task->zck) {
-            free(dst_fn);
-            dst_fn = cr_write_file(repopath, task, CR_CW_ZCK_COMPRESSION, err);
-            if (dst_fn == NULL) {
-                cr_repomd_free(repomd);
-                g_free(repomd_path);
-                return FALSE;
-            }
-            task->zck_repopath = cr_safe_string_chunk_insert_null(task->chunk, dst_fn);
-        }
-#endif
+        cr_ModifyRepoJob *job = g_new0(cr_ModifyRepoJob, 1);
+        job->task = task;
+        job->repopath = repopath;
+        jobs = g_slist_prepend(jobs, job);
+        g_thread_pool_push(pool, job, NULL);
     }
 
-    // Prepare new repomd records
-    GSList *repomdrecords = NULL;
-    GSList *repomdrecords_uniquefn = NULL;
-    GSList *repomdrecordfilltasks = NULL;
+    g_thread_pool_free(pool, FALSE, TRUE); // Wait
+    jobs = g_slist_reverse(jobs);
 
-    GThreadPool *fill_pool = g_thread_pool_new(cr_repomd_record_fill_thread,
-                                               NULL, 5, FALSE, NULL);
+    for (GSList *elem = jobs; elem; elem = g_slist_next(elem)) {
+        cr_ModifyRepoJob *job = elem->data;
 
-    for (GSList *elem = modifyrepotasks; elem; elem = g_slist_next(elem)) {
-        cr_ModifyRepoTask *task = elem->data;
+        if (job->err && !tmp_err)
+            tmp_err = g_steal_pointer(&job->err);
+        g_clear_error(&job->err);
 
-        if (task->remove)
-            continue;
-
-        cr_RepomdRecord *rec = cr_repomd_record_new(task->type,
-                                                    task->repopath);
-        cr_RepomdRecordFillTask *filltask = cr_repomdrecordfilltask_new(rec,
-                                            task->checksum_type, NULL);
-        g_thread_pool_push(fill_pool, filltask, NULL);
-
-        repomdrecords = g_slist_append(repomdrecords, rec); 
-
-        if (task->unique_md_filenames)
-            repomdrecords_uniquefn = g_slist_prepend(repomdrecords_uniquefn, rec);
-        repomdrecordfilltasks = g_slist_prepend(repomdrecordfilltasks,
-                                                filltask);
-        if (task->zck) {
-            _cleanup_free_ gchar *type = g_strconcat(task->type, "_zck", NULL);
-            rec = cr_repomd_record_new(type, task->zck_repopath);
-            filltask = cr_repomdrecordfilltask_new(rec, task->checksum_type, NULL);
-            g_thread_pool_push(fill_pool, filltask, NULL);
-
-            repomdrecords = g_slist_append(repomdrecords, rec);
-
-            if (task->unique_md_filenames)
-                repomdrecords_uniquefn = g_slist_prepend(repomdrecords_uniquefn, rec);
-            repomdrecordfilltasks = g_slist_prepend(repomdrecordfilltasks,
-                                                    filltask);
+        if (job->rec) {
+            repomdrecords = g_slist_append(repomdrecords, job->rec);
+            if (job->task->unique_md_filenames)
+                repomdrecords_uniquefn = g_slist_prepend(repomdrecords_uniquefn,
+                                                         job->rec);
+        }
+        if (job->zck_rec) {
+            repomdrecords = g_slist_append(repomdrecords, job->zck_rec);
+            if (job->task->unique_md_filenames)
+                repomdrecords_uniquefn = g_slist_prepend(repomdrecords_uniquefn,
+                                                         job->zck_rec);
         }
     }
+    g_slist_free_full(jobs, g_free);
 
-    g_thread_pool_free(fill_pool, FALSE, TRUE); // Wait
-
-    for (GSList *elem = repomdrecordfilltasks; elem; elem = g_slist_next(elem)) {
-        // Clean up tasks
-        cr_RepomdRecordFillTask *filltask = elem->data;
-        cr_repomdrecordfilltask_free(filltask, NULL);
+    if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        cr_slist_free_full(repomdrecords, (GDestroyNotify) cr_repomd_record_free);
+        g_slist_free(repomdrecords_uniquefn);
+        cr_repomd_free(repomd);
+        g_free(repomd_path);
+        return FALSE;
     }
-    g_slist_free(repomdrecordfilltasks);
 
     // Detach records from repomd
     GSList *recordstoremove = NULL;
@@ -388,8 +411,14 @@ cr_modifyrepo(GSList *modifyrepotasks, gchar *repopath, GError **err)
     gchar *repomd_xml = cr_xml_dump_repomd(repomd, NULL);
     g_debug("Generated repomd.xml:\n%s", repomd_xml);
 
+    // The repomd.xml is replaced atomically
     g_debug("%s: Writing modified %s", __func__, repomd_path);
-    gboolean ret = cr_write_to_file(err, repomd_path, "%s", repomd_xml);
+    gboolean ret = g_file_set_contents(repomd_path, repomd_xml, -1, &tmp_err);
+    if (!ret) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO, "Cannot write %s: %s",
+                    repomd_path, tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
 
     g_free(repomd_xml);
     g_free(repomd_path);
@@ -18,11 +18,139 @@
  * USA.
  */
 
+#include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include "package.h"
+#include "metadata_internal.h"
 #include "misc.h"
 
 #define PACKAGE_CHUNK_SIZE 2048
+#define PACKAGE_CHUNK_MIN_SIZE      256
+#define PACKAGE_CHUNK_MAX_SIZE      (256*1024)
+#define PACKAGE_ARENA_BLOCK_SIZE    8192
+#define PACKAGE_ARENA_ALIGN         (2 * sizeof(gpointer))
+#define PACKAGE_ARENA_ROUND(x)      (((x) + PACKAGE_ARENA_ALIGN - 1) \
+                                     & ~(PACKAGE_ARENA_ALIGN - 1))
+
+/* Free blocks of PACKAGE_ARENA_BLOCK_SIZE are kept for the next packages
+ * of the thread. Packages are often freed by another thread than the one
+ * which created them (the dumper workers and writers), so the blocks over
+ * the limit of a thread move in batches into the depot shared by all
+ * the threads and the threads without free blocks take them from there. */
+#define PACKAGE_ARENA_CACHE_BLOCKS  64      // Max free blocks of a thread
+#define PACKAGE_ARENA_DEPOT_BLOCKS  1024    // Max free blocks of the depot
+
+typedef struct _cr_PackageArenaBlock cr_PackageArenaBlock;
+
+/* Every block starts with a header */
+struct _cr_PackageArenaBlock {
+    cr_PackageArenaBlock *prev; // The previously allocated block of
+                                // the arena or the next free block
+    gsize size;                 // Size of the block without the header
+};
+
+#define PACKAGE_ARENA_HDR_SIZE  PACKAGE_ARENA_ROUND(sizeof(cr_PackageArenaBlock))
+
+struct _cr_PackageArena {
+    cr_PackageArenaBlock *blocks; // The last allocated block (NULL if none)
+    gchar *free;            // Free space in the current block
+    gsize left;             // Size of the free space
+};
+
+/* List of the free blocks */
+typedef struct {
+    cr_PackageArenaBlock *blocks;
+    guint count;
+} cr_PackageArenaCache;
+
+static void cr_package_arena_cache_free(gpointer data);
+
+static GPrivate arena_cache_key = G_PRIVATE_INIT(cr_package_arena_cache_free);
+static GMutex arena_depot_mutex;
+static cr_PackageArenaCache arena_depot;    // Guarded by arena_depot_mutex
+
+/* Shared strings of the known flags and file types, see cr_DependencyFlag */
+static const char dep_flag_strs[CR_DEP_FLAG_UNKNOWN][3] = {
+    [CR_DEP_FLAG_LT] = "LT",
+    [CR_DEP_FLAG_GT] = "GT",
+    [CR_DEP_FLAG_EQ] = "EQ",
+    [CR_DEP_FLAG_LE] = "LE",
+    [CR_DEP_FLAG_GE] = "GE",
+};
+
+static const char file_type_strs[CR_FILE_TYPE_UNKNOWN][6] = {
+    [CR_FILE_TYPE_FILE]  = "",
+    [CR_FILE_TYPE_DIR]   = "dir",
+    [CR_FILE_TYPE_GHOST] = "ghost",
+};
+
+/* Index of the string in the table or -1 if it's not one of them */
+#define SHARED_STR_INDEX(table, str) \
+    ((uintptr_t) (str) - (uintptr_t) (table) < sizeof(table) \
+     ? (int) (((uintptr_t) (str) - (uintptr_t) (table)) / sizeof((table)[0])) \
+     : -1)
+
+const char *
+cr_dependency_flag_str(cr_DependencyFlag flag)
+{
+    if (flag <= CR_DEP_FLAG_NONE || flag >= CR_DEP_FLAG_UNKNOWN)
+        return NULL;
+    return dep_flag_strs[flag];
+}
+
+cr_DependencyFlag
+cr_dependency_flag_from_str(const char *flags)
+{
+    if (!flags)
+        return CR_DEP_FLAG_NONE;
+
+    if (flags[0] != '\0' && flags[1] != '\0' && flags[2] == '\0')
+        for (int x = CR_DEP_FLAG_LT; x < CR_DEP_FLAG_UNKNOWN; x++)
+            if (flags[0] == dep_flag_strs[x][0]
+                && flags[1] == dep_flag_strs[x][1])
+                return x;
+
+    return CR_DEP_FLAG_UNKNOWN;
+}
+
+cr_DependencyFlag
+cr_dependency_flag(const cr_Dependency *dep)
+{
+    int x = SHARED_STR_INDEX(dep_flag_strs, dep->flags);
+    if (x > CR_DEP_FLAG_NONE)
+        return x;
+    return cr_dependency_flag_from_str(dep->flags);
+}
+
+const char *
+cr_package_file_type_str(cr_PackageFileType type)
+{
+    if (type < CR_FILE_TYPE_FILE || type >= CR_FILE_TYPE_UNKNOWN)
+        return NULL;
+    return file_type_strs[type];
+}
+
+cr_PackageFileType
+cr_package_file_type_from_str(const char *type)
+{
+    if (!type || type[0] == '\0' || !strcmp(type, "file"))
+        return CR_FILE_TYPE_FILE;
+    if (!strcmp(type, "dir"))
+        return CR_FILE_TYPE_DIR;
+    if (!strcmp(type, "ghost"))
+        return CR_FILE_TYPE_GHOST;
+    return CR_FILE_TYPE_UNKNOWN;
+}
+
+cr_PackageFileType
+cr_package_file_type(const cr_PackageFile *file)
+{
+    int x = SHARED_STR_INDEX(file_type_strs, file->type);
+    if (x >= 0)
+        return x;
+    return cr_package_file_type_from_str(file->type);
+}
 
 cr_Dependency *
 cr_dependency_new(void)
@@ -71,21 +199,301 @@ cr_package_new(void)
     return package;
 }
 
+cr_Package *
+cr_package_new_sized(gsize chunk_size)
+{
+    cr_Package *package;
+
+    package = g_new0 (cr_Package, 1);
+    package->chunk = g_string_chunk_new (chunk_size);
+
+    return package;
+}
+
+gsize
+cr_package_chunk_size(gsize data_size)
+{
+    // About a half of a header or of the XML are the strings, the rest
+    // are numbers, digests, signatures or markup
+    return CLAMP(data_size / 2, PACKAGE_CHUNK_MIN_SIZE,
+                 PACKAGE_CHUNK_MAX_SIZE);
+}
+
 cr_Package *
 cr_package_new_without_chunk(void)
 {
     return g_new0(cr_Package, 1);
 }
 
+cr_Package *
+cr_package_new_with_arena(void)
+{
+    cr_Package *package = cr_package_new();
+    package->arena = g_new0(cr_PackageArena, 1);
+    return package;
+}
+
+cr_Package *
+cr_package_new_with_arena_sized(gsize chunk_size)
+{
+    cr_Package *package = cr_package_new_sized(chunk_size);
+    package->arena = g_new0(cr_PackageArena, 1);
+    return package;
+}
+
+static cr_PackageArenaCache *
+cr_package_arena_cache(void)
+{
+    cr_PackageArenaCache *cache = g_private_get(&arena_cache_key);
+
+    if (!cache) {
+        cache = g_new0(cr_PackageArenaCache, 1);
+        g_private_set(&arena_cache_key, cache);
+    }
+    return cache;
+}
+
+/** Move the free blocks of the thread over keep into the depot */
+static void
+cr_package_arena_cache_flush(cr_PackageArenaCache *cache, guint keep)
+{
+    cr_PackageArenaBlock *first, *last;
+    guint count;
+
+    if (cache->count <= keep)
+        return;
+
+    // Detach the batch out of the lock
+    count = cache->count - keep;
+    first = last = cache->blocks;
+    for (guint x = 1; x < count; x++)
+        last = last->prev;
+    cache->blocks = last->prev;
+    cache->count = keep;
+
+    g_mutex_lock(&arena_depot_mutex);
+    if (arena_depot.count + count <= PACKAGE_ARENA_DEPOT_BLOCKS) {
+        last->prev = arena_depot.blocks;
+        arena_depot.blocks = first;
+        arena_depot.count += count;
+        first = NULL;
+    }
+    g_mutex_unlock(&arena_depot_mutex);
+
+    // The depot is full
+    if (first)
+        last->prev = NULL;
+    while (first) {
+        cr_PackageArenaBlock *next = first->prev;
+        g_free(first);
+        first = next;
+    }
+}
+
+static void
+cr_package_arena_cache_free(gpointer data)
+{
+    cr_PackageArenaCache *cache = data;
+
+    // The blocks of an exiting thread are left to the others
+    cr_package_arena_cache_flush(cache, 0);
+    g_free(cache);
+}
+
+static cr_PackageArenaBlock *
+cr_package_arena_block_get(void)
+{
+    cr_PackageArenaCache *cache = cr_package_arena_cache();
+    cr_PackageArenaBlock *block;
+
+    if (!cache->blocks) {
+        // Take a batch from the depot
+        g_mutex_lock(&arena_depot_mutex);
+        while (arena_depot.blocks
+               && cache->count < PACKAGE_ARENA_CACHE_BLOCKS / 2)
+        {
+            block = arena_depot.blocks;
+            arena_depot.blocks = block->prev;
+            arena_depot.count--;
+            block->prev = cache->blocks;
+            cache->blocks = block;
+            cache->count++;
+        }
+        g_mutex_unlock(&arena_depot_mutex);
+    }
+
+    block = cache->blocks;
+    if (!block) {
+        block = g_malloc(PACKAGE_ARENA_HDR_SIZE + PACKAGE_ARENA_BLOCK_SIZE);
+        block->size = PACKAGE_ARENA_BLOCK_SIZE;
+        return block;
+    }
+
+    cache->blocks = block->prev;
+    cache->count--;
+    return block;
+}
+
+static void
+cr_package_arena_block_put(cr_PackageArenaBlock *block)
+{
+    cr_PackageArenaCache *cache = cr_package_arena_cache();
+
+    // Half of the blocks are left to the other threads
+    if (cache->count >= PACKAGE_ARENA_CACHE_BLOCKS)
+        cr_package_arena_cache_flush(cache, PACKAGE_ARENA_CACHE_BLOCKS / 2);
+
+    block->prev = cache->blocks;
+    cache->blocks = block;
+    cache->count++;
+}
+
+static gpointer
+cr_package_arena_new_block(cr_PackageArena *arena, gsize size)
+{
+    cr_PackageArenaBlock *block;
+
+    // The allocations are zeroed by cr_package_alloc()
+    if (size == PACKAGE_ARENA_BLOCK_SIZE) {
+        block = cr_package_arena_block_get();
+    } else {
+        block = g_malloc(PACKAGE_ARENA_HDR_SIZE + size);
+        block->size = size;
+    }
+
+    block->prev = arena->blocks;
+    arena->blocks = block;
+    return ((gchar *) block) + PACKAGE_ARENA_HDR_SIZE;
+}
+
+static void
+cr_package_arena_free(cr_PackageArena *arena)
+{
+    cr_PackageArenaBlock *block = arena->blocks;
+    while (block) {
+        cr_PackageArenaBlock *prev = block->prev;
+        if (block->size == PACKAGE_ARENA_BLOCK_SIZE)
+            cr_package_arena_block_put(block);
+        else
+            g_free(block);
+        block = prev;
+    }
+    g_free(arena);
+}
+
+gpointer
+cr_package_alloc(cr_Package *package, gsize size)
+{
+    cr_PackageArena *arena = package->arena;
+    gpointer mem;
+
+    if (!arena)
+        return g_malloc0(size);
+
+    size = PACKAGE_ARENA_ROUND(size);
+
+    if (size > arena->left) {
+        if (size > PACKAGE_ARENA_BLOCK_SIZE / 4) {
+            // Big allocation gets its own block, current block stays in use
+            mem = cr_package_arena_new_block(arena, size);
+            return memset(mem, 0, size);
+        }
+        arena->free = cr_package_arena_new_block(arena,
+                                                 PACKAGE_ARENA_BLOCK_SIZE);
+        arena->left = PACKAGE_ARENA_BLOCK_SIZE;
+    }
+
+    mem = arena->free;
+    arena->free += size;
+    arena->left -= size;
+    memset(mem, 0, size);
+    return mem;
+}
+
+cr_Dependency *
+cr_package_new_dependency(cr_Package *package)
+{
+    return cr_package_alloc(package, sizeof(cr_Dependency));
+}
+
+cr_PackageFile *
+cr_package_new_file(cr_Package *package)
+{
+    return cr_package_alloc(package, sizeof(cr_PackageFile));
+}
+
+cr_ChangelogEntry *
+cr_package_new_changelog_entry(cr_Package *package)
+{
+    return cr_package_alloc(package, sizeof(cr_ChangelogEntry));
+}
+
+GSList *
+cr_package_list_prepend(cr_Package *package, GSList *list, gpointer data)
+{
+    GSList *node;
+
+    if (!package->arena)
+        return g_slist_prepend(list, data);
+
+    node = cr_package_alloc(package, sizeof(GSList));
+    node->data = data;
+    node->next = list;
+    return node;
+}
+
+cr_Package *
+cr_package_ref(cr_Package *package)
+{
+    assert(package);
+    g_atomic_int_inc(&package->refs);
+    return package;
+}
+
+gboolean
+cr_package_is_shared(cr_Package *package)
+{
+    assert(package);
+    return g_atomic_int_get(&package->refs) > 0;
+}
+
+cr_Package *
+cr_package_make_writable(cr_Package *package)
+{
+    assert(package);
+
+    if (!cr_package_is_shared(package))
+        return package;
+
+    cr_Package *copy = cr_package_copy(package);
+    cr_package_free(package);
+    return copy;
+}
+
 void
 cr_package_free(cr_Package *package)
 {
     if (!package)
         return;
 
+    // Other references are still held
+    if (g_atomic_int_add(&package->refs, -1) > 0)
+        return;
+
     if (package->chunk && !(package->loadingflags & CR_PACKAGE_SINGLE_CHUNK))
         g_string_chunk_free (package->chunk);
 
+    cr_package_spool_free(package->spool);
+
+    if (package->arena) {
+        // All the lists and their items live in the arena
+        cr_package_arena_free(package->arena);
+        g_free(package->siggpg);
+        g_free(package->sigpgp);
+        g_free(package);
+        return;
+    }
+
 /* Note: Since glib 2.28
  * g_slist_foreach && g_slist_free could be replaced with one function:
  * g_slist_free_full()
@@ -166,7 +574,10 @@ cr_dependency_dup(GStringChunk *chunk, GSList *orig)
         cr_Dependency *odep = elem->data;
         cr_Dependency *ndep  = cr_dependency_new();
         ndep->name    = cr_safe_string_chunk_insert(chunk, odep->name);
-        ndep->flags   = cr_safe_string_chunk_insert(chunk, odep->flags);
+        // The shared strings are not copied
+        ndep->flags   = SHARED_STR_INDEX(dep_flag_strs, odep->flags) >= 0
+                        ? odep->flags
+                        : cr_safe_string_chunk_insert(chunk, odep->flags);
         ndep->epoch   = cr_safe_string_chunk_insert(chunk, odep->epoch);
         ndep->version = cr_safe_string_chunk_insert(chunk, odep->version);
         ndep->release = cr_safe_string_chunk_insert(chunk, odep->release);
@@ -221,7 +632,9 @@ cr_package_copy(cr_Package *orig)
     for (GSList *elem = orig->files; elem; elem = g_slist_next(elem)) {
         cr_PackageFile *orig_file = elem->data;
         cr_PackageFile *file = cr_package_file_new();
-        file->type = cr_safe_string_chunk_insert(pkg->chunk, orig_file->type);
+        file->type = SHARED_STR_INDEX(file_type_strs, orig_file->type) >= 0
+                     ? orig_file->type
+                     : cr_safe_string_chunk_insert(pkg->chunk, orig_file->type);
         file->path = cr_safe_string_chunk_insert(pkg->chunk, orig_file->path);
         file->name = cr_safe_string_chunk_insert(pkg->chunk, orig_file->name);
         pkg->files = g_slist_prepend(pkg->files, file);
@@ -41,14 +41,50 @@ typedef enum {
     CR_PACKAGE_LOADED_FIL   = (1<<11),  /*!< Filelists metadata was loaded */
     CR_PACKAGE_LOADED_OTH   = (1<<12),  /*!< Other metadata was loaded */
     CR_PACKAGE_SINGLE_CHUNK = (1<<13),  /*!< Package uses single chunk */
+    CR_PACKAGE_LAZY_FIL     = (1<<14),  /*!< Files weren't parsed yet, only
+                                             raw_filelists is available */
+    CR_PACKAGE_LAZY_OTH     = (1<<15),  /*!< Changelogs weren't parsed yet,
+                                             only raw_other is available */
+    CR_PACKAGE_INTERNED     = (1<<16),  /*!< Repeated strings are shared in
+                                             the single chunk */
 } cr_PackageLoadingFlags;
 
+/** Known flags of a dependency.
+ * The strings of the known flags (and of the known file types, see
+ * cr_PackageFileType) are static strings shared by all the packages.
+ * The dependencies point to them instead of keeping their own copies,
+ * and the XML and sqlite writers recognize them by the address and emit
+ * their pre-escaped forms.
+ */
+typedef enum {
+    CR_DEP_FLAG_NONE,           /*!< no flags (NULL) */
+    CR_DEP_FLAG_LT,             /*!< "LT" */
+    CR_DEP_FLAG_GT,             /*!< "GT" */
+    CR_DEP_FLAG_EQ,             /*!< "EQ" */
+    CR_DEP_FLAG_LE,             /*!< "LE" */
+    CR_DEP_FLAG_GE,             /*!< "GE" */
+    CR_DEP_FLAG_UNKNOWN,        /*!< any other string */
+    CR_DEP_FLAG_SENTINEL,       /*!< sentinel of the list */
+} cr_DependencyFlag;
+
+/** Known types of a file in package (see cr_DependencyFlag).
+ */
+typedef enum {
+    CR_FILE_TYPE_FILE,          /*!< regular file (NULL, "" or "file") */
+    CR_FILE_TYPE_DIR,           /*!< "dir" */
+    CR_FILE_TYPE_GHOST,         /*!< "ghost" */
+    CR_FILE_TYPE_UNKNOWN,       /*!< any other string */
+    CR_FILE_TYPE_SENTINEL,      /*!< sentinel of the list */
+} cr_PackageFileType;
+
 /** Dependency (Provides, Conflicts, Obsoletes, Requires).
  */
 typedef struct {
     char *name;                 /*!< name */
     char *flags;                /*!< flags (value returned by cr_flag_to_str()
-                                     from misc module) */
+                                     from misc module, the known flags are
+                                     shared static strings of
+                                     cr_dependency_flag_str()) */
     char *epoch;                /*!< epoch */
     char *version;              /*!< version */
     char *release;              /*!< release */
@@ -58,7 +94,9 @@ typedef struct {
 /** File in package.
  */
 typedef struct {
-    char *type;                 /*!< one of "" (regular file), "dir", "ghost" */
+    char *type;                 /*!< one of "" (regular file), "dir", "ghost"
+                                     (shared static strings of
+                                     cr_package_file_type_str()) */
     char *path;                 /*!< path to file */
     char *name;                 /*!< filename */
 } cr_PackageFile;
@@ -71,6 +109,15 @@ typedef struct {
     char *changelog;            /*!< text of changelog */
 } cr_ChangelogEntry;
 
+/** Memory arena of a package (see cr_package_new_with_arena()).
+ */
+typedef struct _cr_PackageArena cr_PackageArena;
+
+/** Position of the raw xml of a package in the temporary files
+ * (see cr_metadata_set_spool_raw()).
+ */
+typedef struct _cr_PackageSpool cr_PackageSpool;
+
 /** Binary data.
  */
 typedef struct {
@@ -135,6 +182,28 @@ typedef struct {
 
     cr_PackageLoadingFlags loadingflags; /*!<
         Bitfield flags with information about package loading  */
+
+    char *raw_primary;          /*!< raw xml of the package from primary.xml
+                                     (only if requested during loading of
+                                     metadata, see cr_metadata_set_store_raw)
+                                     - must be set to NULL if the package
+                                     is modified */
+    char *raw_filelists;        /*!< raw xml of the package from
+                                     filelists.xml (see raw_primary) */
+    char *raw_other;            /*!< raw xml of the package from other.xml
+                                     (see raw_primary) */
+
+    cr_PackageArena *arena;     /*!< NULL or memory arena which holds
+                                     dependencies, files, changelogs and
+                                     the nodes of their lists */
+
+    cr_PackageSpool *spool;     /*!< NULL or position of raw_filelists
+                                     and raw_other which were not read
+                                     back yet */
+
+    gint refs;                  /*!< number of references added by
+                                     cr_package_ref() (0 - only the creator
+                                     holds the package) */
 } cr_Package;
 
 /** Create new (empty) dependency structure.
@@ -152,6 +221,46 @@ cr_PackageFile *cr_package_file_new(void);
  */
 cr_ChangelogEntry *cr_changelog_entry_new(void);
 
+/** Shared static string of the flag.
+ * @param flag          flag
+ * @return              the string, NULL for CR_DEP_FLAG_NONE and
+ *                      CR_DEP_FLAG_UNKNOWN
+ */
+const char *cr_dependency_flag_str(cr_DependencyFlag flag);
+
+/** Flag of the string.
+ * @param flags         flags of a dependency or NULL
+ * @return              the flag
+ */
+cr_DependencyFlag cr_dependency_flag_from_str(const char *flags);
+
+/** Flag of the dependency. The shared strings are recognized without
+ * comparing them.
+ * @param dep           cr_Dependency
+ * @return              the flag
+ */
+cr_DependencyFlag cr_dependency_flag(const cr_Dependency *dep);
+
+/** Shared static string of the file type.
+ * @param type          file type
+ * @return              the string ("" for CR_FILE_TYPE_FILE), NULL for
+ *                      CR_FILE_TYPE_UNKNOWN
+ */
+const char *cr_package_file_type_str(cr_PackageFileType type);
+
+/** File type of the string.
+ * @param type          type of a file or NULL
+ * @return              the file type
+ */
+cr_PackageFileType cr_package_file_type_from_str(const char *type);
+
+/** Type of the file. The shared strings are recognized without
+ * comparing them.
+ * @param file          cr_PackageFile
+ * @return              the file type
+ */
+cr_PackageFileType cr_package_file_type(const cr_PackageFile *file);
+
 /** Create new (empty) structure for binary data
  * @return              new mepty cr_BinaryData
  */
@@ -162,16 +271,128 @@ cr_BinaryData *cr_binary_data_new(void);
  */
 cr_Package *cr_package_new(void);
 
+/** Create new (empty) package structure with the string chunk of the given
+ * initial size. Packages with a lot of strings (files, changelogs) don't
+ * need to grow their chunk many times and small packages don't waste
+ * memory, see cr_package_chunk_size().
+ * @param chunk_size    initial size of the string chunk
+ * @return              new empty cr_Package
+ */
+cr_Package *cr_package_new_sized(gsize chunk_size);
+
+/** Initial size of the string chunk of a package whose strings come from
+ * data of the given size (e.g. an rpm header or the XML of the package).
+ * @param data_size     size of the data
+ * @return              size for cr_package_new_sized()
+ */
+gsize cr_package_chunk_size(gsize data_size);
+
 /** Create new (empty) package structure without initialized string chunk.
  * @return              new empty cr_Package
  */
 cr_Package *cr_package_new_without_chunk(void);
 
-/** Free package structure and all its structures.
+/** Create new (empty) package structure with a memory arena.
+ * Dependencies, files and changelog entries created by
+ * cr_package_new_dependency(), cr_package_new_file() and
+ * cr_package_new_changelog_entry() are, together with the nodes of the
+ * lists they are stored in, allocated from continuous blocks of memory
+ * which are released all at once by cr_package_free().
+ * Lists of such package are still ordinary GSLists for reading, but
+ * items could be added only by cr_package_list_prepend() and neither
+ * items nor list nodes could be freed individually.
+ * The blocks of the freed packages are kept for the next packages
+ * of the thread (and shared with the other threads).
+ * @return              new empty cr_Package
+ */
+cr_Package *cr_package_new_with_arena(void);
+
+/** Create new (empty) package structure with a memory arena and the string
+ * chunk of the given initial size (see cr_package_new_with_arena() and
+ * cr_package_new_sized()).
+ * @param chunk_size    initial size of the string chunk
+ * @return              new empty cr_Package
+ */
+cr_Package *cr_package_new_with_arena_sized(gsize chunk_size);
+
+/** Allocate zeroed memory which lives as long as the package.
+ * If the package has no arena, the memory is allocated by g_malloc0()
+ * and the caller is responsible for freeing it.
+ * @param package       cr_Package
+ * @param size          number of bytes
+ * @return              pointer to the allocated memory
+ */
+gpointer cr_package_alloc(cr_Package *package, gsize size);
+
+/** Create new (empty) dependency structure for the package.
+ * It is allocated from the package arena if the package has one.
+ * @param package       cr_Package
+ * @return              new empty cr_Dependency
+ */
+cr_Dependency *cr_package_new_dependency(cr_Package *package);
+
+/** Create new (empty) package file structure for the package.
+ * It is allocated from the package arena if the package has one.
+ * @param package       cr_Package
+ * @return              new empty cr_PackageFile
+ */
+cr_PackageFile *cr_package_new_file(cr_Package *package);
+
+/** Create new (empty) changelog structure for the package.
+ * It is allocated from the package arena if the package has one.
+ * @param package       cr_Package
+ * @return              new empty cr_ChangelogEntry
+ */
+cr_ChangelogEntry *cr_package_new_changelog_entry(cr_Package *package);
+
+/** Prepend an item to a list of the package (requires, files, ...).
+ * The list node is allocated from the package arena if the package has
+ * one, otherwise this is g_slist_prepend().
+ * @param package       cr_Package
+ * @param list          one of the package lists
+ * @param data          item
+ * @return              new start of the list
+ */
+GSList *cr_package_list_prepend(cr_Package *package,
+                                GSList *list,
+                                gpointer data);
+
+/** Release a reference to the package. The package structure and all its
+ * structures are freed when the last reference (the one of the creator
+ * and the ones added by cr_package_ref()) is released.
+ * This function is thread safe.
  * @param package       cr_Package
  */
 void cr_package_free(cr_Package *package);
 
+/** Add a reference to the package, so it could be shared (e.g. by more
+ * stages of a pipeline) instead of copied. Every reference is released
+ * by cr_package_free(). A shared package must not be modified, use
+ * cr_package_make_writable() before a modification.
+ * The strings of a package without its own chunk (e.g. a package of
+ * cr_Metadata with a shared string chunk) live only as long as their
+ * owner, such package must not be referenced beyond it.
+ * This function is thread safe.
+ * @param package       cr_Package
+ * @return              the package
+ */
+cr_Package *cr_package_ref(cr_Package *package);
+
+/** Check if the package has more references than the one of the caller.
+ * @param package       cr_Package
+ * @return              TRUE if the package is shared
+ */
+gboolean cr_package_is_shared(cr_Package *package);
+
+/** Get a package which could be modified by the caller (copy on write).
+ * If the package isn't shared it's returned as it is, otherwise
+ * the caller's reference is released and a new copy
+ * (see cr_package_copy()) is returned.
+ * @param package       cr_Package (the caller's reference is taken)
+ * @return              package owned only by the caller
+ */
+cr_Package *cr_package_make_writable(cr_Package *package);
+
 /** Get NVRA package string
  * @param package       cr_Package
  * @return              nvra string
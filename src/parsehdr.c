@@ -20,6 +20,7 @@
 #include <glib.h>
 #include <assert.h>
 #include <rpm/rpmfi.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include "parsehdr.h"
 #include "xml_dump.h"
@@ -78,6 +79,29 @@ static DepItem dep_items[] = {
     { DEP_SENTINEL, 0, 0, 0 },
 };
 
+typedef struct StrTagItem_s {
+    int tag;
+    size_t offset;      // Offset of the char * member in cr_Package
+    gboolean null_if_empty;
+} StrTagItem;
+
+// Plain string tags which are copied into the package chunk as they are
+static StrTagItem str_tag_items[] = {
+    { RPMTAG_NAME,          offsetof(cr_Package, name),             FALSE },
+    { RPMTAG_VERSION,       offsetof(cr_Package, version),          FALSE },
+    { RPMTAG_RELEASE,       offsetof(cr_Package, release),          FALSE },
+    { RPMTAG_SUMMARY,       offsetof(cr_Package, summary),          FALSE },
+    { RPMTAG_DESCRIPTION,   offsetof(cr_Package, description),      TRUE  },
+    { RPMTAG_URL,           offsetof(cr_Package, url),              FALSE },
+    { RPMTAG_LICENSE,       offsetof(cr_Package, rpm_license),      FALSE },
+    { RPMTAG_VENDOR,        offsetof(cr_Package, rpm_vendor),       FALSE },
+    { RPMTAG_GROUP,         offsetof(cr_Package, rpm_group),        FALSE },
+    { RPMTAG_BUILDHOST,     offsetof(cr_Package, rpm_buildhost),    FALSE },
+    { RPMTAG_SOURCERPM,     offsetof(cr_Package, rpm_sourcerpm),    FALSE },
+    { RPMTAG_PACKAGER,      offsetof(cr_Package, rpm_packager),     FALSE },
+    { 0, 0, FALSE },
+};
+
 static inline int
 cr_compare_dependency(const char *dep1, const char *dep2)
 {
@@ -162,13 +186,25 @@ cr_package_from_header(Header hdr,
     assert(hdr);
     assert(!err || *err == NULL);
 
-    // Create new package structure
+    // Create new package structure, its string chunk is sized by the header
+    // (most of the files and the changelogs are skipped by the primary only
+    // reading)
 
-    pkg = cr_package_new();
+    gsize chunk_size = headerSizeof(hdr, HEADER_MAGIC_NO);
+    if (hdrrflags & CR_HDRR_PRIMARYONLY)
+        chunk_size /= 4;
+    chunk_size = cr_package_chunk_size(chunk_size);
+
+    if (hdrrflags & CR_HDRR_USEARENA)
+        pkg = cr_package_new_with_arena_sized(chunk_size);
+    else
+        pkg = cr_package_new_sized(chunk_size);
     pkg->loadingflags |= CR_PACKAGE_FROM_HEADER;
     pkg->loadingflags |= CR_PACKAGE_LOADED_PRI;
-    pkg->loadingflags |= CR_PACKAGE_LOADED_FIL;
-    pkg->loadingflags |= CR_PACKAGE_LOADED_OTH;
+    if (!(hdrrflags & CR_HDRR_PRIMARYONLY)) {
+        pkg->loadingflags |= CR_PACKAGE_LOADED_FIL;
+        pkg->loadingflags |= CR_PACKAGE_LOADED_OTH;
+    }
 
 
     // Create rpm tag data container
@@ -179,17 +215,22 @@ cr_package_from_header(Header hdr,
 
     // Fill package structure
 
-    pkg->name = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_NAME));
+    for (StrTagItem *item = str_tag_items; item->tag; item++) {
+        const char *str = headerGetString(hdr, item->tag);
+        char **member = (char **) ((char *) pkg + item->offset);
+        if (item->null_if_empty)
+            *member = cr_safe_string_chunk_insert_null(pkg->chunk, str);
+        else
+            *member = cr_safe_string_chunk_insert(pkg->chunk, str);
+    }
 
     gint64 is_src = headerGetNumber(hdr, RPMTAG_SOURCEPACKAGE);
     if (is_src) {
-        pkg->arch = cr_safe_string_chunk_insert(pkg->chunk, "src");
+        pkg->arch = g_string_chunk_insert_const(pkg->chunk, "src");
     } else {
         pkg->arch = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_ARCH));
     }
 
-    pkg->version = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_VERSION));
-
 #define MAX_STR_INT_LEN 24
     char tmp_epoch[MAX_STR_INT_LEN];
     if (snprintf(tmp_epoch, MAX_STR_INT_LEN, "%llu", (long long unsigned int) headerGetNumber(hdr, RPMTAG_EPOCH)) <= 0) {
@@ -197,19 +238,9 @@ cr_package_from_header(Header hdr,
     }
     pkg->epoch = g_string_chunk_insert_len(pkg->chunk, tmp_epoch, MAX_STR_INT_LEN);
 
-    pkg->release = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_RELEASE));
-    pkg->summary = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_SUMMARY));
-    pkg->description = cr_safe_string_chunk_insert_null(pkg->chunk, headerGetString(hdr, RPMTAG_DESCRIPTION));
-    pkg->url = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_URL));
     if (headerGet(hdr, RPMTAG_BUILDTIME, td, flags)) {
         pkg->time_build = rpmtdGetNumber(td);
     }
-    pkg->rpm_license = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_LICENSE));
-    pkg->rpm_vendor = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_VENDOR));
-    pkg->rpm_group = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_GROUP));
-    pkg->rpm_buildhost = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_BUILDHOST));
-    pkg->rpm_sourcerpm = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_SOURCERPM));
-    pkg->rpm_packager = cr_safe_string_chunk_insert(pkg->chunk, headerGetString(hdr, RPMTAG_PACKAGER));
     // RPMTAG_LONGSIZE is allways present (is emulated for small packages because HEADERGET_EXT flag was used)
     if (headerGet(hdr, RPMTAG_LONGSIZE, td, flags)) {
         pkg->size_installed = rpmtdGetNumber(td);
@@ -228,70 +259,136 @@ cr_package_from_header(Header hdr,
     // Fill files
     //
 
-    rpmtd full_filenames = rpmtdNew(); // Only for filenames_hashtable
     rpmtd indexes   = rpmtdNew();
     rpmtd filenames = rpmtdNew();
     rpmtd fileflags = rpmtdNew();
     rpmtd filemodes = rpmtdNew();
 
-    GHashTable *filenames_hashtable = g_hash_table_new(g_str_hash, g_str_equal);
+    // Primary files of the package, used to filter file requires.
+    // Full paths are built here instead of fetching the RPMTAG_FILENAMES
+    // extension which would allocate a path for every single file.
+    GHashTable *filenames_hashtable = g_hash_table_new_full(g_str_hash,
+                                                            g_str_equal,
+                                                            g_free,
+                                                            NULL);
+    GString *full_filename = g_string_sized_new(256);
 
     rpmtd dirnames = rpmtdNew();
 
 
     // Create list of pointer to directory names
-
-    int dir_count;
+    // The dir_primary says for every directory whether all its files are
+    // primary (DIR_PRIMARY), whether none of them is (DIR_NOT_PRIMARY) or
+    // whether the full path of every file must be checked. The names of
+    // files never contain '/', so cr_is_primary() of a path which doesn't
+    // match "/usr/lib/sendmail" depends on its directory only.
+
+    enum { DIR_NOT_PRIMARY, DIR_PRIMARY, DIR_CHECK_FILES };
+    int dir_count = 0;
     char **dir_list = NULL;
+    guint8 *dir_primary = NULL;
     if (headerGet(hdr, RPMTAG_DIRNAMES, dirnames,  flags) && (dir_count = rpmtdCount(dirnames))) {
         int x = 0;
         dir_list = malloc(sizeof(char *) * dir_count);
+        dir_primary = malloc(sizeof(guint8) * dir_count);
         while (rpmtdNext(dirnames) != -1) {
             dir_list[x] = cr_safe_string_chunk_insert(pkg->chunk, rpmtdGetString(dirnames));
+            if (cr_is_primary(dir_list[x]))
+                dir_primary[x] = DIR_PRIMARY;
+            else if (!strcmp(dir_list[x], "/usr/lib/"))
+                dir_primary[x] = DIR_CHECK_FILES;
+            else
+                dir_primary[x] = DIR_NOT_PRIMARY;
             x++;
         }
         assert(x == dir_count);
     }
 
-    if (headerGet(hdr, RPMTAG_FILENAMES,  full_filenames,  flags) &&
-        headerGet(hdr, RPMTAG_DIRINDEXES, indexes,  flags) &&
+    if (headerGet(hdr, RPMTAG_DIRINDEXES, indexes,  flags) &&
         headerGet(hdr, RPMTAG_BASENAMES,  filenames, flags) &&
         headerGet(hdr, RPMTAG_FILEFLAGS,  fileflags, flags) &&
         headerGet(hdr, RPMTAG_FILEMODES,  filemodes, flags))
     {
-        rpmtdInit(full_filenames);
+        // Packages with an arena get all the files and list nodes in
+        // two allocations, the list is built in order (no reversing)
+        // and the type strings are looked up once, not for every file.
+        // With CR_HDRR_PRIMARYONLY only the few primary files are kept.
+        gboolean primary_only = hdrrflags & CR_HDRR_PRIMARYONLY;
+        guint file_count = rpmtdCount(filenames);
+        guint kept = 0;
+        cr_PackageFile *arena_files = NULL;
+        GSList *arena_nodes = NULL;
+        GSList **tail = &pkg->files;
+        char *type_dir = (char *) cr_package_file_type_str(CR_FILE_TYPE_DIR);
+        char *type_ghost = (char *) cr_package_file_type_str(CR_FILE_TYPE_GHOST);
+        char *type_file = (char *) cr_package_file_type_str(CR_FILE_TYPE_FILE);
+
+        if (pkg->arena && file_count && !primary_only) {
+            arena_files = cr_package_alloc(pkg, sizeof(cr_PackageFile) * file_count);
+            arena_nodes = cr_package_alloc(pkg, sizeof(GSList) * file_count);
+        }
+
         rpmtdInit(indexes);
         rpmtdInit(filenames);
         rpmtdInit(fileflags);
         rpmtdInit(filemodes);
-        while ((rpmtdNext(full_filenames) != -1)   &&
-               (rpmtdNext(indexes) != -1)   &&
-               (rpmtdNext(filenames) != -1) &&
-               (rpmtdNext(fileflags) != -1) &&
-               (rpmtdNext(filemodes) != -1))
+        for (guint x = 0;
+             x < file_count                 &&
+             (rpmtdNext(indexes) != -1)     &&
+             (rpmtdNext(filenames) != -1)   &&
+             (rpmtdNext(fileflags) != -1)   &&
+             (rpmtdNext(filemodes) != -1);
+             x++)
         {
-            cr_PackageFile *packagefile = cr_package_file_new();
-            packagefile->name = cr_safe_string_chunk_insert(pkg->chunk,
-                                                         rpmtdGetString(filenames));
-            packagefile->path = (dir_list) ? dir_list[(int) rpmtdGetNumber(indexes)] : "";
+            int dir_index = (int) rpmtdGetNumber(indexes);
+            const char *path = (dir_list) ? dir_list[dir_index] : "";
+            const char *name = rpmtdGetString(filenames);
+            cr_PackageFile *packagefile;
+            GSList *node;
+            int primary;
+
+            primary = (dir_list) ? dir_primary[dir_index] : DIR_CHECK_FILES;
+            if (primary != DIR_NOT_PRIMARY) {
+                g_string_assign(full_filename, path);
+                g_string_append(full_filename, name);
+            }
+            if (primary == DIR_CHECK_FILES)
+                primary = cr_is_primary(full_filename->str);
+            if (primary)
+                g_hash_table_replace(filenames_hashtable,
+                                     g_strdup(full_filename->str), NULL);
+            else if (primary_only)
+                continue;
+
+            if (arena_files) {
+                packagefile = &arena_files[kept];
+                node = &arena_nodes[kept];
+            } else {
+                packagefile = cr_package_new_file(pkg);
+                node = (pkg->arena) ? cr_package_alloc(pkg, sizeof(GSList))
+                                    : g_slist_alloc();
+            }
+            kept++;
+
+            packagefile->name = cr_safe_string_chunk_insert(pkg->chunk, name);
+            packagefile->path = (char *) path;
 
             if (S_ISDIR(rpmtdGetNumber(filemodes))) {
                 // Directory
-                packagefile->type = cr_safe_string_chunk_insert(pkg->chunk, "dir");
+                packagefile->type = type_dir;
             } else if (rpmtdGetNumber(fileflags) & RPMFILE_GHOST) {
                 // Ghost
-                packagefile->type = cr_safe_string_chunk_insert(pkg->chunk, "ghost");
+                packagefile->type = type_ghost;
             } else {
                 // Regular file
-                packagefile->type = cr_safe_string_chunk_insert(pkg->chunk, "");
+                packagefile->type = type_file;
             }
 
-            g_hash_table_replace(filenames_hashtable,
-                                 (gpointer) rpmtdGetString(full_filenames),
-                                 (gpointer) rpmtdGetString(full_filenames));
-            pkg->files = g_slist_prepend(pkg->files, packagefile);
+            node->data = packagefile;
+            node->next = NULL;
+            *tail = node;
+            tail = &node->next;
         }
-        pkg->files = g_slist_reverse (pkg->files);
 
         rpmtdFreeData(dirnames);
         rpmtdFreeData(indexes);
@@ -300,12 +397,14 @@ cr_package_from_header(Header hdr,
         rpmtdFreeData(filemodes);
     }
 
+    g_string_free(full_filename, TRUE);
     rpmtdFree(dirnames);
     rpmtdFree(indexes);
     rpmtdFree(filemodes);
 
     if (dir_list) {
         free((void *) dir_list);
+        free(dir_primary);
     }
 
 
@@ -314,6 +413,7 @@ cr_package_from_header(Header hdr,
     //
 
     rpmtd fileversions = rpmtdNew();
+    GString *depnfv = g_string_sized_new(128);  // Dep NameFlagsVersion
 
     // Struct used as value in ap_hashtable
     struct ap_value_struct {
@@ -357,11 +457,14 @@ cr_package_from_header(Header hdr,
                 const char *flags = cr_flag_to_str(num_flags);
                 const char *full_version = rpmtdGetString(fileversions);
 
-                _cleanup_free_ char *depnfv = NULL;  // Dep NameFlagsVersion
-                depnfv = g_strconcat(filename,
-                                     flags ? flags : "",
-                                     full_version ? full_version : "",
-                                     NULL);
+                // Only provides and requires are matched against each other
+                if (deptype == DEP_PROVIDES || deptype == DEP_REQUIRES) {
+                    g_string_assign(depnfv, filename);
+                    if (flags)
+                        g_string_append(depnfv, flags);
+                    if (full_version)
+                        g_string_append(depnfv, full_version);
+                }
 
                 // Requires specific stuff
                 if (deptype == DEP_REQUIRES) {
@@ -372,13 +475,11 @@ cr_package_from_header(Header hdr,
 
                     // Skip package primary files
                     if (*filename == '/' && g_hash_table_lookup_extended(filenames_hashtable, filename, NULL, NULL)) {
-                        if (cr_is_primary(filename)) {
-                            continue;
-                        }
+                        continue;
                     }
 
                     // Skip files which are provided
-                    if (g_hash_table_lookup_extended(provided_hashtable, depnfv, NULL, NULL)) {
+                    if (g_hash_table_lookup_extended(provided_hashtable, depnfv->str, NULL, NULL)) {
                         continue;
                     }
 
@@ -403,44 +504,48 @@ cr_package_from_header(Header hdr,
                     }
                 }
 
-                // Parse dep string
-                cr_EVR *evr = cr_str_to_evr(full_version, pkg->chunk);
-                if ((full_version && *full_version) && !evr->epoch) {
+                // Parse dep string (in place, nothing is copied for
+                // the skipped dependencies)
+                cr_EVRView evr;
+                cr_str_to_evr_view(full_version, &evr);
+                if ((full_version && *full_version) && !evr.epoch) {
                     // NULL in epoch mean that the epoch was bad (non-numerical)
                     _cleanup_free_ gchar *pkg_nevra = cr_package_nevra(pkg);
                     g_warning("Bad epoch in version string \"%s\" for dependency \"%s\" in package \"%s\"",
                               full_version, filename, pkg_nevra);
                     g_warning("Skipping this dependency");
-                    g_free(evr);
                     continue;
                 }
 
                 // Create dynamic dependency object
-                cr_Dependency *dependency = cr_dependency_new();
+                cr_Dependency *dependency = cr_package_new_dependency(pkg);
                 dependency->name = cr_safe_string_chunk_insert(pkg->chunk, filename);
-                dependency->flags = cr_safe_string_chunk_insert(pkg->chunk, flags);
-                dependency->epoch = evr->epoch;
-                dependency->version = evr->version;
-                dependency->release = evr->release;
-                g_free(evr);
+                dependency->flags = (char *) flags;  // Shared static string
+                if (evr.epoch_len == 1 && *evr.epoch == '0')
+                    dependency->epoch = g_string_chunk_insert_const(pkg->chunk, "0");
+                else if (evr.epoch)
+                    dependency->epoch = g_string_chunk_insert_len(pkg->chunk, evr.epoch, evr.epoch_len);
+                if (evr.version)
+                    dependency->version = g_string_chunk_insert_len(pkg->chunk, evr.version, evr.version_len);
+                if (evr.release)
+                    dependency->release = g_string_chunk_insert_len(pkg->chunk, evr.release, evr.release_len);
 
                 switch (deptype) {
                     case DEP_PROVIDES: {
-                        char *depnfv_dup = g_strdup(depnfv);
-                        g_hash_table_replace(provided_hashtable, depnfv_dup, NULL);
-                        pkg->provides = g_slist_prepend(pkg->provides, dependency);
+                        g_hash_table_replace(provided_hashtable, g_strdup(depnfv->str), NULL);
+                        pkg->provides = cr_package_list_prepend(pkg, pkg->provides, dependency);
                         break;
                     }
                     case DEP_CONFLICTS:
-                        pkg->conflicts = g_slist_prepend(pkg->conflicts, dependency);
+                        pkg->conflicts = cr_package_list_prepend(pkg, pkg->conflicts, dependency);
                         break;
                     case DEP_OBSOLETES:
-                        pkg->obsoletes = g_slist_prepend(pkg->obsoletes, dependency);
+                        pkg->obsoletes = cr_package_list_prepend(pkg, pkg->obsoletes, dependency);
                         break;
                     case DEP_REQUIRES:
 #ifdef ENABLE_LEGACY_WEAKDEPS
                         if ( num_flags & RPMSENSE_MISSINGOK ) {
-                            pkg->recommends = g_slist_prepend(pkg->recommends, dependency);
+                            pkg->recommends = cr_package_list_prepend(pkg, pkg->recommends, dependency);
                             break;
                         }
 #endif
@@ -454,16 +559,17 @@ cr_package_from_header(Header hdr,
                                 if (cr_compare_dependency(libc_require_highest->name,
                                                        dependency->name) == 2)
                                 {
-                                    g_free(libc_require_highest);
+                                    if (!pkg->arena)
+                                        g_free(libc_require_highest);
                                     libc_require_highest = dependency;
-                                } else
+                                } else if (!pkg->arena)
                                     g_free(dependency);
                             }
                             break;
                         }
                         // XXX: libc.so filtering - END ///////////////////////
 
-                        pkg->requires = g_slist_prepend(pkg->requires, dependency);
+                        pkg->requires = cr_package_list_prepend(pkg, pkg->requires, dependency);
 
                         // Add file into ap_hashtable
                         struct ap_value_struct *value = malloc(sizeof(struct ap_value_struct));
@@ -473,30 +579,30 @@ cr_package_from_header(Header hdr,
                         g_hash_table_replace(ap_hashtable, dependency->name, value);
                         break; //case REQUIRES end
                     case DEP_SUGGESTS:
-                        pkg->suggests = g_slist_prepend(pkg->suggests, dependency);
+                        pkg->suggests = cr_package_list_prepend(pkg, pkg->suggests, dependency);
                         break;
                     case DEP_ENHANCES:
-                        pkg->enhances = g_slist_prepend(pkg->enhances, dependency);
+                        pkg->enhances = cr_package_list_prepend(pkg, pkg->enhances, dependency);
                         break;
                     case DEP_RECOMMENDS:
-                        pkg->recommends = g_slist_prepend(pkg->recommends, dependency);
+                        pkg->recommends = cr_package_list_prepend(pkg, pkg->recommends, dependency);
                         break;
                     case DEP_SUPPLEMENTS:
-                        pkg->supplements = g_slist_prepend(pkg->supplements, dependency);
+                        pkg->supplements = cr_package_list_prepend(pkg, pkg->supplements, dependency);
                         break;
 #ifdef ENABLE_LEGACY_WEAKDEPS
                     case DEP_OLDSUGGESTS:
                         if ( num_flags & RPMSENSE_STRONG ) {
-                            pkg->recommends = g_slist_prepend(pkg->recommends, dependency);
+                            pkg->recommends = cr_package_list_prepend(pkg, pkg->recommends, dependency);
                         } else {
-                            pkg->suggests = g_slist_prepend(pkg->suggests, dependency);
+                            pkg->suggests = cr_package_list_prepend(pkg, pkg->suggests, dependency);
                         }
                         break;
                     case DEP_OLDENHANCES:
                         if ( num_flags & RPMSENSE_STRONG ) {
-                            pkg->supplements = g_slist_prepend(pkg->supplements, dependency);
+                            pkg->supplements = cr_package_list_prepend(pkg, pkg->supplements, dependency);
                         } else {
-                            pkg->enhances = g_slist_prepend(pkg->enhances, dependency);
+                            pkg->enhances = cr_package_list_prepend(pkg, pkg->enhances, dependency);
                         }
                         break;
 #endif
@@ -505,7 +611,7 @@ cr_package_from_header(Header hdr,
 
             // XXX: libc.so filtering ////////////////////////////////
             if (deptype == DEP_REQUIRES && libc_require_highest)
-                pkg->requires = g_slist_prepend(pkg->requires, libc_require_highest);
+                pkg->requires = cr_package_list_prepend(pkg, pkg->requires, libc_require_highest);
             // XXX: libc.so filtering - END ////////////////////////////////
         }
 
@@ -534,9 +640,7 @@ cr_package_from_header(Header hdr,
     rpmtdFree(filenames);
     rpmtdFree(fileflags);
     rpmtdFree(fileversions);
-
-    rpmtdFreeData(full_filenames);
-    rpmtdFree(full_filenames);
+    g_string_free(depnfv, TRUE);
 
 
     //
@@ -547,44 +651,58 @@ cr_package_from_header(Header hdr,
     rpmtd changelognames = rpmtdNew();
     rpmtd changelogtexts = rpmtdNew();
 
-    if (headerGet(hdr, RPMTAG_CHANGELOGTIME, changelogtimes, flags) &&
+    // The limit is applied before the tags are read: nothing is read for
+    // the limit 0, the strings only if there are some times and only
+    // the first changelog_limit entries are decoded. Limits below -1
+    // read nothing, as the limit 0.
+    if (changelog_limit < -1)
+        changelog_limit = 0;
+    if (changelog_limit != 0 &&
+        !(hdrrflags & CR_HDRR_PRIMARYONLY) &&
+        headerGet(hdr, RPMTAG_CHANGELOGTIME, changelogtimes, flags) &&
+        rpmtdCount(changelogtimes) > 0 &&
         headerGet(hdr, RPMTAG_CHANGELOGNAME, changelognames, flags) &&
         headerGet(hdr, RPMTAG_CHANGELOGTEXT, changelogtexts, flags))
     {
         gint64 last_time = G_GINT64_CONSTANT(0);
+        guint count = rpmtdCount(changelogtimes);
+
+        if (rpmtdCount(changelognames) < count)
+            count = rpmtdCount(changelognames);
+        if (rpmtdCount(changelogtexts) < count)
+            count = rpmtdCount(changelogtexts);
+        if (changelog_limit > 0 && (guint) changelog_limit < count)
+            count = changelog_limit;
+
         rpmtdInit(changelogtimes);
         rpmtdInit(changelognames);
         rpmtdInit(changelogtexts);
-        while ((rpmtdNext(changelogtimes) != -1) &&
-               (rpmtdNext(changelognames) != -1) &&
-               (rpmtdNext(changelogtexts) != -1) &&
-               (changelog_limit > 0 || changelog_limit == -1))
+        for (guint x = 0;
+             x < count                          &&
+             (rpmtdNext(changelogtimes) != -1)  &&
+             (rpmtdNext(changelognames) != -1)  &&
+             (rpmtdNext(changelogtexts) != -1);
+             x++)
         {
             gint64 time = rpmtdGetNumber(changelogtimes);
+            const char *author = rpmtdGetString(changelognames);
 
-            cr_ChangelogEntry *changelog = cr_changelog_entry_new();
-            changelog->author    = cr_safe_string_chunk_insert(pkg->chunk,
-                                            rpmtdGetString(changelognames));
+            cr_ChangelogEntry *changelog = cr_package_new_changelog_entry(pkg);
             changelog->date      = time;
             changelog->changelog = cr_safe_string_chunk_insert(pkg->chunk,
                                             rpmtdGetString(changelogtexts));
 
-            // Remove space from end of author name
-            if (changelog->author) {
-                size_t len, x;
-                len = strlen(changelog->author);
-                for (x=(len-1); x > 0; x--) {
-                    if (changelog->author[x] == ' ') {
-                        changelog->author[x] = '\0';
-                    } else {
-                        break;
-                    }
-                }
+            // Remove space from end of author name (the first character
+            // is always kept)
+            if (author) {
+                size_t len = strlen(author);
+                while (len > 1 && author[len - 1] == ' ')
+                    len--;
+                changelog->author = g_string_chunk_insert_len(pkg->chunk,
+                                                              author, len);
             }
 
-            pkg->changelogs = g_slist_prepend(pkg->changelogs, changelog);
-            if (changelog_limit != -1)
-                changelog_limit--;
+            pkg->changelogs = cr_package_list_prepend(pkg, pkg->changelogs, changelog);
 
             // If a previous entry has the same time, increment time of the previous
             // entry by one. Ugly but works!
@@ -599,8 +717,6 @@ cr_package_from_header(Header hdr,
             } else {
                 last_time = time;
             }
-
-
         }
         //pkg->changelogs = g_slist_reverse (pkg->changelogs);
     }
@@ -39,12 +39,28 @@ typedef enum {
     CR_HDRR_NONE            = (1 << 0),
     CR_HDRR_LOADHDRID       = (1 << 1), /*!< Load hdrid */
     CR_HDRR_LOADSIGNATURES  = (1 << 2), /*!< Load siggpg and siggpg */
+    CR_HDRR_USEARENA        = (1 << 3), /*!< Allocate dependencies, files
+                                             and changelogs from the package
+                                             arena (see
+                                             cr_package_new_with_arena()) */
+    CR_HDRR_FASTREAD        = (1 << 4), /*!< Read the signature and the main
+                                             header by a single pread() and
+                                             import them directly instead
+                                             of rpmReadPackageFile() (falls
+                                             back to it for packages which
+                                             need any conversion) */
+    CR_HDRR_PRIMARYONLY     = (1 << 5), /*!< Load only the data of
+                                             primary.xml: no changelogs and
+                                             only the primary files (see
+                                             cr_is_primary()) */
 } cr_HeaderReadingFlags;
 
 /** Read data from header and return filled cr_Package structure.
  * All const char * params could be NULL.
  * @param hdr                   Header
- * @param changelog_limit       number of changelog entries
+ * @param changelog_limit       number of changelog entries (-1 - all,
+ *                              0 or less than -1 - the changelog tags
+ *                              are not read)
  * @param flags                 Flags for header reading
  * @param err                   GError **
  * @return                      Newly allocated cr_Package or NULL on error
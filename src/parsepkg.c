@@ -18,8 +18,11 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -37,69 +40,151 @@
 
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 
+#define RPM_LEAD_SIZE           96
+#define RPM_HEADER_INTRO_SIZE   16      // Magic, reserved, index count and
+                                        // data length (4 bytes each)
+#define RPM_MAX_HEADER_INDEX    0x0000ffff  // Same limits as rpm uses
+#define RPM_MAX_HEADER_DATA     0x0fffffff
+#define FAST_READ_SIZE          (64*1024)   // Headers of most packages
+#define FAST_READ_MAX_KEEP      (4*1024*1024) // Max buffer kept by a thread
+                                            // fit into a single read
+
+static const unsigned char rpm_lead_magic[] = { 0xed, 0xab, 0xee, 0xdb };
+static const unsigned char rpm_header_magic[] = { 0x8e, 0xad, 0xe8, 0x01 };
+
+/* Tags from the signature header used by cr_package_from_header()
+ * and their names in the main header (rpmReadPackageFile() merges
+ * them in the same way) */
+static const struct {
+    rpmTagVal sigtag;
+    rpmTagVal tag;
+} merged_sigtags[] = {
+    { RPMSIGTAG_PGP,                RPMTAG_SIGPGP },
+    { RPMSIGTAG_GPG,                RPMTAG_SIGGPG },
+    { RPMSIGTAG_SHA1,               RPMTAG_SHA1HEADER },
+    { RPMSIGTAG_PAYLOADSIZE,        RPMTAG_ARCHIVESIZE },
+    { RPMSIGTAG_LONGARCHIVESIZE,    RPMTAG_LONGARCHIVESIZE },
+};
 
-rpmts cr_ts = NULL;
 
+rpmts cr_ts = NULL;
 
-static gpointer
-cr_package_parser_init_once_cb(gpointer user_data G_GNUC_UNUSED)
+/* Parser state owned by a single thread. Every dumper thread reads
+ * headers with its own transaction set and scratch buffer, so the threads
+ * never share any rpm state (refcounts, keyring, ...) while parsing.
+ */
+typedef struct {
+    rpmts ts;               /*!< Transaction set for rpmReadPackageFile() */
+    unsigned char *buf;     /*!< Buffer for read_header_fast() */
+    gsize buf_size;         /*!< Allocated size of the buf */
+} cr_ParserThreadData;
+
+static rpmts
+cr_package_parser_ts_new(void)
 {
-    rpmReadConfigFiles(NULL, NULL);
-    cr_ts = rpmtsCreate();
-    if (!cr_ts)
+    rpmts ts = rpmtsCreate();
+    if (!ts) {
         g_critical("%s: rpmtsCreate() failed", __func__);
+        return NULL;
+    }
 
     rpmVSFlags vsflags = 0;
     vsflags |= _RPMVSF_NODIGESTS;
     vsflags |= _RPMVSF_NOSIGNATURES;
     vsflags |= RPMVSF_NOHDRCHK;
-    rpmtsSetVSFlags(cr_ts, vsflags);
-    return NULL;
+    rpmtsSetVSFlags(ts, vsflags);
+    return ts;
+}
+
+static void
+cr_parser_thread_data_free(gpointer data)
+{
+    cr_ParserThreadData *tdata = data;
+
+    if (tdata->ts)
+        rpmtsFree(tdata->ts);
+    g_free(tdata->buf);
+    g_free(tdata);
+}
+
+static GPrivate cr_parser_thread_data_key =
+                            G_PRIVATE_INIT(cr_parser_thread_data_free);
+
+static cr_ParserThreadData *
+cr_parser_thread_data(void)
+{
+    cr_ParserThreadData *tdata = g_private_get(&cr_parser_thread_data_key);
+
+    if (!tdata) {
+        tdata = g_new0(cr_ParserThreadData, 1);
+        tdata->ts = cr_package_parser_ts_new();
+        g_private_set(&cr_parser_thread_data_key, tdata);
+    }
+
+    return tdata;
 }
 
+// Users of the parser (pipelines, the python module, ...) which called
+// cr_package_parser_init() and not yet cr_package_parser_cleanup()
+static GMutex package_parser_mutex;
+static guint package_parser_users = 0;
+
 void
 cr_package_parser_init()
 {
-    static GOnce package_parser_init_once = G_ONCE_INIT;
-    g_once(&package_parser_init_once, cr_package_parser_init_once_cb, NULL);
+    g_mutex_lock(&package_parser_mutex);
+    if (package_parser_users++ == 0) {
+        rpmReadConfigFiles(NULL, NULL);
+        cr_ts = cr_package_parser_ts_new();
+    }
+    g_mutex_unlock(&package_parser_mutex);
 }
 
-static gpointer
-cr_package_parser_cleanup_once_cb(gpointer user_data G_GNUC_UNUSED)
+void
+cr_package_parser_cleanup()
 {
+    g_mutex_lock(&package_parser_mutex);
+
+    if (package_parser_users == 0 || --package_parser_users > 0) {
+        // Not initialized or still used by others
+        g_mutex_unlock(&package_parser_mutex);
+        return;
+    }
+
     if (cr_ts) {
         rpmtsFree(cr_ts);
         cr_ts = NULL;
     }
 
+    // Data of the calling thread, the worker threads free their own
+    // data when they exit
+    g_private_replace(&cr_parser_thread_data_key, NULL);
+
     rpmFreeMacros(NULL);
     rpmFreeRpmrc();
-    return NULL;
-}
 
-void
-cr_package_parser_cleanup()
-{
-    static GOnce package_parser_cleanup_once = G_ONCE_INIT;
-    g_once(&package_parser_cleanup_once, cr_package_parser_cleanup_once_cb, NULL);
+    g_mutex_unlock(&package_parser_mutex);
 }
 
 static gboolean
-read_header(const char *filename, Header *hdr, GError **err)
+read_header(int fd, const char *filename, Header *hdr, GError **err)
 {
+    assert(fd >= 0);
     assert(filename);
     assert(!err || *err == NULL);
 
-    FD_t fd = Fopen(filename, "r.ufdio");
-    if (!fd) {
-        g_warning("%s: Fopen of %s failed %s",
+    // The duplicated descriptor shares the file offset with the fd,
+    // so the fd is left just behind the header
+    FD_t rpmfd = fdDup(fd);
+    if (!rpmfd) {
+        g_warning("%s: fdDup of %s failed %s",
                   __func__, filename, g_strerror(errno));
         g_set_error(err, ERR_DOMAIN, CRE_IO,
-                    "Fopen failed: %s", g_strerror(errno));
+                    "fdDup failed: %s", g_strerror(errno));
         return FALSE;
     }
 
-    int rc = rpmReadPackageFile(cr_ts, fd, NULL, hdr);
+    int rc = rpmReadPackageFile(cr_parser_thread_data()->ts, rpmfd, NULL, hdr);
     if (rc != RPMRC_OK) {
         switch (rc) {
             case RPMRC_NOKEY:
@@ -115,32 +200,333 @@ read_header(const char *filename, Header *hdr, GError **err)
                           __func__);
                 g_set_error(err, ERR_DOMAIN, CRE_IO,
                             "rpmReadPackageFile() error");
-                Fclose(fd);
+                Fclose(rpmfd);
                 return FALSE;
         }
     }
 
-    Fclose(fd);
+    Fclose(rpmfd);
     return TRUE;
 }
 
+/* Length of the header structure (the intro included) which starts at
+ * the data or 0 if there is no valid header
+ */
+static gsize
+header_length(const unsigned char *data)
+{
+    uint32_t il, dl;
+
+    if (memcmp(data, rpm_header_magic, sizeof(rpm_header_magic)))
+        return 0;
+
+    memcpy(&il, data + 8, sizeof(il));
+    memcpy(&dl, data + 12, sizeof(dl));
+    il = ntohl(il);
+    dl = ntohl(dl);
+    if (il > RPM_MAX_HEADER_INDEX || dl > RPM_MAX_HEADER_DATA)
+        return 0;
+
+    return RPM_HEADER_INTRO_SIZE + (gsize) il * 16 + dl;
+}
+
+/* Imports the signature and the main header of a package from the data
+ * (the beginning of the package file) and merges the signature tags
+ * into the main header the same way as rpmReadPackageFile() does.
+ * Returns NULL if the package has to be read by rpmReadPackageFile().
+ */
+static Header
+import_header(const unsigned char *data,
+              gsize siglen,
+              gsize hdrstart,
+              gsize hdrlen)
+{
+    Header sigh, hdr;
+
+    // The blobs start with the index count (behind the magic)
+    sigh = headerImport((void *) (data + RPM_LEAD_SIZE + 8), siglen - 8,
+                        HEADERIMPORT_COPY);
+    hdr = headerImport((void *) (data + hdrstart + 8), hdrlen - 8,
+                       HEADERIMPORT_COPY);
+    if (!sigh || !hdr)
+        goto fallback;
+
+    // Old packages need conversions done by rpmReadPackageFile()
+    if (headerIsEntry(hdr, RPMTAG_OLDFILENAMES)
+        || (!headerIsEntry(hdr, RPMTAG_SOURCERPM)
+            && !headerIsEntry(hdr, RPMTAG_SOURCEPACKAGE)))
+        goto fallback;
+
+    for (size_t x = 0; x < G_N_ELEMENTS(merged_sigtags); x++) {
+        struct rpmtd_s td;
+
+        if (headerIsEntry(hdr, merged_sigtags[x].tag))
+            continue;
+        if (!headerGet(sigh, merged_sigtags[x].sigtag, &td,
+                       HEADERGET_RAW | HEADERGET_MINMEM))
+            continue;
+        td.tag = merged_sigtags[x].tag;
+        headerPut(hdr, &td, HEADERPUT_DEFAULT);
+        rpmtdFreeData(&td);
+    }
+
+    headerFree(sigh);
+    return hdr;
+
+fallback:
+    if (sigh)
+        headerFree(sigh);
+    if (hdr)
+        headerFree(hdr);
+    return NULL;
+}
+
+/* Reads at least len bytes from the beginning of the file into
+ * the buffer of the thread
+ */
+static gboolean
+fast_read_ensure(int fd, cr_ParserThreadData *tdata, gsize *readed, gsize len)
+{
+    if (len <= *readed)
+        return TRUE;
+
+    if (len > tdata->buf_size) {
+        tdata->buf = g_realloc(tdata->buf, len);
+        tdata->buf_size = len;
+    }
+    while (*readed < len) {
+        ssize_t ret = pread(fd, tdata->buf + *readed, len - *readed, *readed);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return FALSE;
+        *readed += ret;
+    }
+    return TRUE;
+}
+
+/* Do not keep memory of an exceptionally big header
+ */
+static void
+read_header_fast_release(cr_ParserThreadData *tdata)
+{
+    if (tdata->buf_size > FAST_READ_MAX_KEEP) {
+        g_free(tdata->buf);
+        tdata->buf = NULL;
+        tdata->buf_size = 0;
+    }
+}
+
+/* Reads the header the same way as rpmReadPackageFile() does
+ * (without any verification, that is disabled in our transaction sets),
+ * but just by one pread() for most of packages.
+ * The read buffer is owned by the calling thread and reused, the headers
+ * are imported as copies.
+ * Returns NULL if the package has to be read by rpmReadPackageFile().
+ */
+static Header
+read_header_fast(int fd)
+{
+    cr_ParserThreadData *tdata = cr_parser_thread_data();
+    gsize readed = 0, siglen, hdrstart, hdrlen;
+    unsigned char *buf;
+    Header hdr;
+    ssize_t ret;
+
+    if (!tdata->buf) {
+        tdata->buf = g_malloc(FAST_READ_SIZE);
+        tdata->buf_size = FAST_READ_SIZE;
+    }
+    buf = tdata->buf;
+
+    do {
+        ret = pread(fd, buf, FAST_READ_SIZE, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < RPM_LEAD_SIZE + RPM_HEADER_INTRO_SIZE)
+        goto fallback;
+    readed = ret;
+
+    // Lead
+    if (memcmp(buf, rpm_lead_magic, sizeof(rpm_lead_magic)))
+        goto fallback;
+
+    // Signature header (padded to 8 bytes)
+    siglen = header_length(buf + RPM_LEAD_SIZE);
+    if (!siglen)
+        goto fallback;
+    hdrstart = RPM_LEAD_SIZE + siglen + (8 - siglen % 8) % 8;
+
+    // Main header
+    if (!fast_read_ensure(fd, tdata, &readed, hdrstart + RPM_HEADER_INTRO_SIZE))
+        goto fallback;
+    buf = tdata->buf;
+    hdrlen = header_length(buf + hdrstart);
+    if (!hdrlen || !fast_read_ensure(fd, tdata, &readed, hdrstart + hdrlen))
+        goto fallback;
+    buf = tdata->buf;
+
+    hdr = import_header(buf, siglen, hdrstart, hdrlen);
+    if (!hdr)
+        goto fallback;
+
+    // Behave as rpmReadPackageFile() - leave the offset behind the header
+    lseek(fd, hdrstart + hdrlen, SEEK_SET);
+
+    read_header_fast_release(tdata);
+    return hdr;
+
+fallback:
+    read_header_fast_release(tdata);
+    return NULL;
+}
+
+static int
+open_rpm(const char *filename, GError **err)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        g_warning("%s: open of %s failed %s",
+                  __func__, filename, g_strerror(errno));
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open %s: %s", filename, g_strerror(errno));
+    }
+    return fd;
+}
+
 cr_Package *
-cr_package_from_rpm_base(const char *filename,
+cr_package_from_rpm_fd(int fd,
+                       const char *filename,
+                       int changelog_limit,
+                       cr_HeaderReadingFlags flags,
+                       GError **err)
+{
+    Header hdr;
+    cr_Package *pkg;
+
+    assert(fd >= 0);
+    assert(!err || *err == NULL);
+
+    if (!filename)
+        filename = "(fd)";
+
+    hdr = (flags & CR_HDRR_FASTREAD) ? read_header_fast(fd) : NULL;
+    if (!hdr && !read_header(fd, filename, &hdr, err))
+        return NULL;
+
+    pkg = cr_package_from_header(hdr, changelog_limit, flags, err);
+    headerFree(hdr);
+    return pkg;
+}
+
+/* Reads the header by rpmReadPackageFile() from a temporary copy
+ * of the data
+ */
+static gboolean
+read_header_data(const unsigned char *data,
+                 gsize len,
+                 const char *filename,
+                 Header *hdr,
+                 GError **err)
+{
+    GError *tmp_err = NULL;
+    gchar *tmp_path = NULL;
+    gboolean ret;
+    int fd;
+
+    fd = g_file_open_tmp("createrepo_c_hdr_XXXXXX", &tmp_path, &tmp_err);
+    if (fd < 0) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot create a temporary file: ");
+        return FALSE;
+    }
+    g_unlink(tmp_path);
+    g_free(tmp_path);
+
+    for (gsize written = 0; written < len; ) {
+        ssize_t r = write(fd, data + written, len - written);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0) {
+            g_set_error(err, ERR_DOMAIN, CRE_IO,
+                        "Cannot write a temporary file: %s",
+                        g_strerror(errno));
+            close(fd);
+            return FALSE;
+        }
+        written += r;
+    }
+    lseek(fd, 0, SEEK_SET);
+
+    ret = read_header(fd, filename, hdr, err);
+    close(fd);
+    return ret;
+}
+
+cr_Package *
+cr_package_from_rpm_data(const void *data,
+                         gsize len,
+                         const char *filename,
                          int changelog_limit,
                          cr_HeaderReadingFlags flags,
                          GError **err)
 {
+    GError *tmp_err = NULL;
+    struct cr_HeaderRangeStruct hdr_r;
+    gsize needed, siglen;
     Header hdr;
     cr_Package *pkg;
 
-    assert(filename);
+    assert(data);
     assert(!err || *err == NULL);
 
-    if (!read_header(filename, &hdr, err))
+    if (!filename)
+        filename = "(data)";
+
+    hdr_r = cr_get_header_byte_range_data(data, len, &needed, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "%s: ", filename);
+        return NULL;
+    }
+    if (!hdr_r.end) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s: Incomplete header (%" G_GSIZE_FORMAT " bytes of at "
+                    "least %" G_GSIZE_FORMAT ")", filename, len, needed);
+        return NULL;
+    }
+
+    siglen = header_length((const unsigned char *) data + RPM_LEAD_SIZE);
+    hdr = siglen ? import_header(data, siglen, hdr_r.start,
+                                 hdr_r.end - hdr_r.start) : NULL;
+    if (!hdr && !read_header_data(data, hdr_r.end, filename, &hdr, err))
         return NULL;
 
     pkg = cr_package_from_header(hdr, changelog_limit, flags, err);
     headerFree(hdr);
+    if (!pkg)
+        return NULL;
+
+    pkg->rpm_header_start = hdr_r.start;
+    pkg->rpm_header_end = hdr_r.end;
+    return pkg;
+}
+
+cr_Package *
+cr_package_from_rpm_base(const char *filename,
+                         int changelog_limit,
+                         cr_HeaderReadingFlags flags,
+                         GError **err)
+{
+    cr_Package *pkg;
+
+    assert(filename);
+    assert(!err || *err == NULL);
+
+    int fd = open_rpm(filename, err);
+    if (fd < 0)
+        return NULL;
+
+    pkg = cr_package_from_rpm_fd(fd, filename, changelog_limit, flags, err);
+    close(fd);
     return pkg;
 }
 
@@ -160,8 +546,14 @@ cr_package_from_rpm(const char *filename,
     assert(filename);
     assert(!err || *err == NULL);
 
+    // The file is opened only once, the header, the checksum and
+    // the header range are read from the same descriptor
+    int fd = open_rpm(filename, err);
+    if (fd < 0)
+        return NULL;
+
     // Get a package object
-    pkg = cr_package_from_rpm_base(filename, changelog_limit, flags, err);
+    pkg = cr_package_from_rpm_fd(fd, filename, changelog_limit, flags, err);
     if (!pkg)
         goto errexit;
 
@@ -175,7 +567,7 @@ cr_package_from_rpm(const char *filename,
     // Get file stat
     if (!stat_buf) {
         struct stat stat_buf_own;
-        if (stat(filename, &stat_buf_own) == -1) {
+        if (fstat(fd, &stat_buf_own) == -1) {
             g_warning("%s: stat(%s) error (%s)", __func__,
                       filename, g_strerror(errno));
             g_set_error(err,  ERR_DOMAIN, CRE_IO, "stat(%s) failed: %s",
@@ -190,7 +582,7 @@ cr_package_from_rpm(const char *filename,
     }
 
     // Compute checksum
-    char *checksum = cr_checksum_file(filename, checksum_type, &tmp_err);
+    char *checksum = cr_checksum_fd(fd, checksum_type, &tmp_err);
     if (!checksum) {
         g_propagate_prefixed_error(err, tmp_err,
                                    "Error while checksum calculation: ");
@@ -200,8 +592,8 @@ cr_package_from_rpm(const char *filename,
     free(checksum);
 
     // Get header range
-    struct cr_HeaderRangeStruct hdr_r = cr_get_header_byte_range(filename,
-                                                                 &tmp_err);
+    struct cr_HeaderRangeStruct hdr_r;
+    hdr_r = cr_get_header_byte_range_fd(fd, filename, &tmp_err);
     if (tmp_err) {
         g_propagate_prefixed_error(err, tmp_err,
                                    "Error while determinig header range: ");
@@ -211,9 +603,11 @@ cr_package_from_rpm(const char *filename,
     pkg->rpm_header_start = hdr_r.start;
     pkg->rpm_header_end = hdr_r.end;
 
+    close(fd);
     return pkg;
 
 errexit:
+    close(fd);
     cr_package_free(pkg);
     return NULL;
 }
@@ -36,12 +36,20 @@ extern "C" {
  */
 
 /** Initialize global structures for package parsing.
- * This function call rpmReadConfigFiles() and create global transaction set.
- * This function should be called only once! This function is not thread safe!
+ * The first call reads the rpm configuration (rpmReadConfigFiles())
+ * and creates the global transaction set.
+ * Every thread which parses packages then lazily creates its own
+ * transaction set and read buffer, they are freed when the thread exits.
+ * Every independent user of the library (e.g. a pipeline) calls it
+ * before the parsing and calls cr_package_parser_cleanup() after it,
+ * so the users don't need to know about each other.
+ * This function is thread safe.
  */
 void cr_package_parser_init();
 
-/** Free global structures for package parsing.
+/** Release the structures for package parsing initialized by
+ * cr_package_parser_init(). They are freed by the last user.
+ * This function is thread safe.
  */
 void cr_package_parser_cleanup();
 
@@ -61,6 +69,48 @@ cr_package_from_rpm_base(const char *filename,
                          cr_HeaderReadingFlags flags,
                          GError **err);
 
+/** Generate a package object from an opened package file.
+ * The header is read from the current offset of the fd (it should be
+ * the beginning of the file) and the offset is left just behind
+ * the header. The same attributes as in cr_package_from_rpm_base()
+ * are not filled.
+ * @param fd                    file descriptor opened for reading
+ * @param filename              filename used in messages (could be NULL)
+ * @param changelog_limit       number of changelogs that will be loaded
+ * @param flags                 Flags for header reading
+ * @param err                   GError **
+ * @return                      cr_Package or NULL on error
+ */
+cr_Package *
+cr_package_from_rpm_fd(int fd,
+                       const char *filename,
+                       int changelog_limit,
+                       cr_HeaderReadingFlags flags,
+                       GError **err);
+
+/** Generate a package object from the beginning of a package file
+ * in the memory (e.g. read by a HTTP range request), the data must contain
+ * the whole header (see cr_get_header_byte_range_data()). The same
+ * attributes as in cr_package_from_rpm_base() are not filled, except
+ * of rpm_header_start and rpm_header_end.
+ * @param data                  beginning of the package file
+ * @param len                   length of the data
+ * @param filename              filename used in messages (could be NULL)
+ * @param changelog_limit       number of changelogs that will be loaded
+ * @param flags                 Flags for header reading (CR_HDRR_FASTREAD
+ *                              is not needed, the data are always
+ *                              imported directly when possible)
+ * @param err                   GError **
+ * @return                      cr_Package or NULL on error
+ */
+cr_Package *
+cr_package_from_rpm_data(const void *data,
+                         gsize len,
+                         const char *filename,
+                         int changelog_limit,
+                         cr_HeaderReadingFlags flags,
+                         GError **err);
+
 /** Generate a package object from a package file.
  * @param filename              filename
  * @param checksum_type         type of checksum to be used
@@ -0,0 +1,467 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "cleanup.h"
+#include "error.h"
+#include "pkgcache.h"
+#include "version.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+/*
+ * File format (native byte order, the cache is local to the machine):
+ *
+ *  Header:
+ *      char[8]     PKGCACHE_MAGIC
+ *      guint32     length of the identification string (including '\0')
+ *      char[]      identification string ("version fingerprint")
+ *  Records (until EOF):
+ *      struct RecordHeader
+ *      char[]      strings, each terminated by '\0', zero length means NULL
+ */
+
+#define PKGCACHE_MAGIC          "CRPKGC01"
+#define PKGCACHE_MAGIC_LEN      8
+#define PKGCACHE_STRINGS        6
+
+struct RecordHeader {
+    guint64 dev;
+    guint64 ino;
+    gint64 size;
+    gint64 mtime;
+    guint32 len[PKGCACHE_STRINGS];  // Lengths of strings including '\0'
+};
+
+struct _cr_PkgCache {
+    GMappedFile *map;           // Mapped cache file (NULL if empty)
+    GHashTable *entries;        // Key: cr_PkgCacheKey *, Value: entry
+};
+
+struct _cr_PkgCacheWriter {
+    FILE *f;                    // Temporary file
+    gchar *path;                // Final path
+    gchar *tmp_path;            // Path of the temporary file
+    gchar *fingerprint;         // Fingerprint of the cache
+    GHashTable *written;        // Keys of the added packages if the cache
+                                // is shared, NULL otherwise
+};
+
+
+static gchar *
+pkgcache_identification(const char *fingerprint)
+{
+    return g_strdup_printf("%d.%d.%d %s", CR_VERSION_MAJOR, CR_VERSION_MINOR,
+                           CR_VERSION_PATCH, fingerprint ? fingerprint : "");
+}
+
+static guint
+pkgcache_key_hash(gconstpointer v)
+{
+    const cr_PkgCacheKey *key = v;
+    guint64 h = key->ino ^ (key->dev << 32) ^ (guint64) key->mtime
+                ^ ((guint64) key->size << 16);
+    return (guint) (h ^ (h >> 32));
+}
+
+static gboolean
+pkgcache_key_equal(gconstpointer a_p, gconstpointer b_p)
+{
+    const cr_PkgCacheKey *a = a_p;
+    const cr_PkgCacheKey *b = b_p;
+    return a->dev == b->dev && a->ino == b->ino
+           && a->size == b->size && a->mtime == b->mtime;
+}
+
+void
+cr_pkgcache_key_from_stat(cr_PkgCacheKey *key, const struct stat *st)
+{
+    key->dev   = (guint64) st->st_dev;
+    key->ino   = (guint64) st->st_ino;
+    key->size  = (gint64) st->st_size;
+    key->mtime = (gint64) st->st_mtime;
+}
+
+cr_PkgCache *
+cr_pkgcache_open(const char *path,
+                 const char *fingerprint,
+                 GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCache *cache;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    cache = g_new0(cr_PkgCache, 1);
+    cache->entries = g_hash_table_new_full(pkgcache_key_hash,
+                                           pkgcache_key_equal,
+                                           NULL,
+                                           g_free);
+
+    if (!g_file_test(path, G_FILE_TEST_EXISTS))
+        return cache;
+
+    cache->map = g_mapped_file_new(path, FALSE, &tmp_err);
+    if (!cache->map) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot map package cache %s: %s", path, tmp_err->message);
+        g_clear_error(&tmp_err);
+        cr_pkgcache_free(cache);
+        return NULL;
+    }
+
+    const char *data = g_mapped_file_get_contents(cache->map);
+    gsize len = g_mapped_file_get_length(cache->map);
+    gsize off = 0;
+    guint32 id_len;
+    _cleanup_free_ gchar *identification = pkgcache_identification(fingerprint);
+
+    // Check the header
+    if (len < PKGCACHE_MAGIC_LEN + sizeof(id_len)
+        || memcmp(data, PKGCACHE_MAGIC, PKGCACHE_MAGIC_LEN))
+    {
+        g_warning("%s: %s is not a package cache - ignored", __func__, path);
+        return cache;
+    }
+    off = PKGCACHE_MAGIC_LEN;
+    memcpy(&id_len, data + off, sizeof(id_len));
+    off += sizeof(id_len);
+    if (id_len > len - off || id_len != strlen(identification) + 1
+        || memcmp(data + off, identification, id_len))
+    {
+        g_debug("%s: Package cache %s was created by a different version "
+                "or with different options - ignored", __func__, path);
+        return cache;
+    }
+    off += id_len;
+
+    // Load records
+    while (off < len) {
+        struct RecordHeader hdr;
+        const char *strings[PKGCACHE_STRINGS];
+
+        if (len - off < sizeof(hdr))
+            goto corrupted;
+        memcpy(&hdr, data + off, sizeof(hdr));
+        off += sizeof(hdr);
+
+        for (int x = 0; x < PKGCACHE_STRINGS; x++) {
+            if (hdr.len[x] > len - off)
+                goto corrupted;
+            if (hdr.len[x] == 0) {
+                strings[x] = NULL;
+                continue;
+            }
+            if (data[off + hdr.len[x] - 1] != '\0')
+                goto corrupted;
+            strings[x] = data + off;
+            off += hdr.len[x];
+        }
+
+        cr_PkgCacheEntry *entry = g_new0(cr_PkgCacheEntry, 1);
+        entry->key.dev          = hdr.dev;
+        entry->key.ino          = hdr.ino;
+        entry->key.size         = hdr.size;
+        entry->key.mtime        = hdr.mtime;
+        entry->location_href    = strings[0];
+        entry->location_base    = strings[1];
+        entry->rpm_sourcerpm    = strings[2];
+        entry->primary          = strings[3];
+        entry->filelists        = strings[4];
+        entry->other            = strings[5];
+
+        if (!entry->primary || !entry->filelists || !entry->other) {
+            g_free(entry);
+            goto corrupted;
+        }
+
+        g_hash_table_replace(cache->entries, &entry->key, entry);
+    }
+
+    g_debug("%s: Loaded %u packages from %s", __func__,
+            g_hash_table_size(cache->entries), path);
+    return cache;
+
+corrupted:
+    // Records loaded so far are fine, use them
+    g_warning("%s: Package cache %s is truncated or corrupted - "
+              "using %u valid records", __func__, path,
+              g_hash_table_size(cache->entries));
+    return cache;
+}
+
+guint
+cr_pkgcache_size(cr_PkgCache *cache)
+{
+    return cache ? g_hash_table_size(cache->entries) : 0;
+}
+
+const cr_PkgCacheEntry *
+cr_pkgcache_lookup(cr_PkgCache *cache, const cr_PkgCacheKey *key)
+{
+    if (!cache)
+        return NULL;
+    return g_hash_table_lookup(cache->entries, key);
+}
+
+void
+cr_pkgcache_free(cr_PkgCache *cache)
+{
+    if (!cache)
+        return;
+    g_hash_table_destroy(cache->entries);
+    if (cache->map)
+        g_mapped_file_unref(cache->map);
+    g_free(cache);
+}
+
+cr_PkgCacheWriter *
+cr_pkgcache_writer_new(const char *path,
+                       const char *fingerprint,
+                       GError **err)
+{
+    cr_PkgCacheWriter *writer;
+    _cleanup_free_ gchar *identification = NULL;
+    guint32 id_len;
+    int fd;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    writer = g_new0(cr_PkgCacheWriter, 1);
+    writer->path = g_strdup(path);
+    writer->tmp_path = g_strconcat(path, ".XXXXXX", NULL);
+    writer->fingerprint = g_strdup(fingerprint);
+
+    fd = g_mkstemp(writer->tmp_path);
+    if (fd < 0 || !(writer->f = fdopen(fd, "wb"))) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot create package cache %s: %s",
+                    writer->tmp_path, g_strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            g_remove(writer->tmp_path);
+        }
+        g_free(writer->path);
+        g_free(writer->tmp_path);
+        g_free(writer->fingerprint);
+        g_free(writer);
+        return NULL;
+    }
+
+    identification = pkgcache_identification(fingerprint);
+    id_len = strlen(identification) + 1;
+    if (fwrite(PKGCACHE_MAGIC, PKGCACHE_MAGIC_LEN, 1, writer->f) != 1
+        || fwrite(&id_len, sizeof(id_len), 1, writer->f) != 1
+        || fwrite(identification, id_len, 1, writer->f) != 1)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write package cache %s: %s",
+                    writer->tmp_path, g_strerror(errno));
+        cr_pkgcache_writer_close(writer, FALSE, NULL);
+        return NULL;
+    }
+
+    return writer;
+}
+
+void
+cr_pkgcache_writer_set_shared(cr_PkgCacheWriter *writer)
+{
+    assert(writer);
+
+    if (!writer->written)
+        writer->written = g_hash_table_new_full(pkgcache_key_hash,
+                                                pkgcache_key_equal,
+                                                g_free,
+                                                NULL);
+}
+
+gboolean
+cr_pkgcache_writer_add(cr_PkgCacheWriter *writer,
+                       const cr_PkgCacheEntry *entry,
+                       GError **err)
+{
+    struct RecordHeader hdr;
+    const char *strings[PKGCACHE_STRINGS] = {
+        entry->location_href,
+        entry->location_base,
+        entry->rpm_sourcerpm,
+        entry->primary,
+        entry->filelists,
+        entry->other,
+    };
+
+    assert(writer);
+    assert(!err || *err == NULL);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.dev   = entry->key.dev;
+    hdr.ino   = entry->key.ino;
+    hdr.size  = entry->key.size;
+    hdr.mtime = entry->key.mtime;
+    for (int x = 0; x < PKGCACHE_STRINGS; x++)
+        hdr.len[x] = strings[x] ? strlen(strings[x]) + 1 : 0;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, writer->f) != 1)
+        goto error;
+    for (int x = 0; x < PKGCACHE_STRINGS; x++)
+        if (hdr.len[x] && fwrite(strings[x], hdr.len[x], 1, writer->f) != 1)
+            goto error;
+
+    if (writer->written) {
+        cr_PkgCacheKey *key = g_new(cr_PkgCacheKey, 1);
+        *key = entry->key;
+        g_hash_table_add(writer->written, key);
+    }
+
+    return TRUE;
+
+error:
+    g_set_error(err, ERR_DOMAIN, CRE_IO,
+                "Cannot write package cache %s: %s",
+                writer->tmp_path, g_strerror(errno));
+    return FALSE;
+}
+
+/** Lock the shared cache (PATH.lock, the cache file itself is replaced
+ * by rename). The lock is released by close() of the returned descriptor.
+ */
+static int
+pkgcache_lock(const char *path, GError **err)
+{
+    _cleanup_free_ gchar *lock_path = g_strconcat(path, ".lock", NULL);
+    int fd = open(lock_path, O_RDWR | O_CREAT, 0666);
+
+    if (fd < 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open package cache lock %s: %s",
+                    lock_path, g_strerror(errno));
+        return -1;
+    }
+
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno == EINTR)
+            continue;
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot lock package cache %s: %s",
+                    lock_path, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/** Append the packages of the current cache file which weren't added
+ * by this writer.
+ */
+static gboolean
+pkgcache_writer_keep_others(cr_PkgCacheWriter *writer, GError **err)
+{
+    GHashTableIter iter;
+    gpointer value;
+    guint kept = 0;
+    gboolean ret = TRUE;
+
+    cr_PkgCache *cache = cr_pkgcache_open(writer->path, writer->fingerprint,
+                                          err);
+    if (!cache)
+        return FALSE;
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (ret && g_hash_table_iter_next(&iter, NULL, &value)) {
+        const cr_PkgCacheEntry *entry = value;
+        if (g_hash_table_contains(writer->written, &entry->key))
+            continue;
+        ret = cr_pkgcache_writer_add(writer, entry, err);
+        kept++;
+    }
+
+    g_debug("%s: Kept %u packages of other runs in %s", __func__,
+            kept, writer->path);
+    cr_pkgcache_free(cache);
+    return ret;
+}
+
+gboolean
+cr_pkgcache_writer_close(cr_PkgCacheWriter *writer,
+                         gboolean commit,
+                         GError **err)
+{
+    gboolean ret = TRUE;
+    int lock_fd = -1;
+
+    assert(!err || *err == NULL);
+
+    if (!writer)
+        return TRUE;
+
+    // The cache is shared by more runs, keep the packages of the others.
+    // The current file is read under the lock, so a concurrent run can't
+    // replace it by a file without the packages added by this one.
+    if (commit && writer->written) {
+        lock_fd = pkgcache_lock(writer->path, err);
+        if (lock_fd < 0
+            || !pkgcache_writer_keep_others(writer, err))
+        {
+            commit = FALSE;
+            ret = FALSE;
+        }
+    }
+
+    if (fclose(writer->f) != 0 && commit) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write package cache %s: %s",
+                    writer->tmp_path, g_strerror(errno));
+        commit = FALSE;
+        ret = FALSE;
+    }
+
+    if (commit && g_rename(writer->tmp_path, writer->path) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot rename %s -> %s: %s", writer->tmp_path,
+                    writer->path, g_strerror(errno));
+        commit = FALSE;
+        ret = FALSE;
+    }
+
+    if (!commit)
+        g_remove(writer->tmp_path);
+
+    if (lock_fd >= 0)
+        close(lock_fd);   // Releases the lock
+
+    if (writer->written)
+        g_hash_table_destroy(writer->written);
+    g_free(writer->path);
+    g_free(writer->tmp_path);
+    g_free(writer->fingerprint);
+    g_free(writer);
+    return ret;
+}
@@ -0,0 +1,170 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_PKGCACHE_H__
+#define __C_CREATEREPOLIB_PKGCACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include <sys/stat.h>
+
+/** \defgroup   pkgcache    Persistent cache of generated package metadata
+ *
+ * The cache stores already generated primary, filelists and other xml
+ * chunks of packages. Packages are identified by device, inode, size and
+ * mtime of their rpm files, so an unchanged rpm doesn't need to be read
+ * again. The cache file is memory mapped and all the strings returned by
+ * the lookup point directly into the mapping.
+ *
+ * One cache could be shared by more repos on the same host (the same rpm
+ * files hardlinked into them), see cr_pkgcache_writer_set_shared().
+ *
+ *  \addtogroup pkgcache
+ *  @{
+ */
+
+/** Identification of a package file.
+ */
+typedef struct {
+    guint64 dev;        /*!< st_dev of the rpm */
+    guint64 ino;        /*!< st_ino of the rpm */
+    gint64 size;        /*!< st_size of the rpm */
+    gint64 mtime;       /*!< st_mtime of the rpm */
+} cr_PkgCacheKey;
+
+/** Cached metadata of one package.
+ * Strings are NULL terminated, NULL if the value was NULL.
+ */
+typedef struct {
+    cr_PkgCacheKey key;         /*!< Identification of the rpm file */
+    const char *location_href;  /*!< location_href used in the xml chunks */
+    const char *location_base;  /*!< location_base used in the xml chunks */
+    const char *rpm_sourcerpm;  /*!< Source rpm of the package */
+    const char *primary;        /*!< primary.xml chunk */
+    const char *filelists;      /*!< filelists.xml chunk */
+    const char *other;          /*!< other.xml chunk */
+} cr_PkgCacheEntry;
+
+/** Opened (read-only) package cache.
+ */
+typedef struct _cr_PkgCache cr_PkgCache;
+
+/** Writer of a new package cache file.
+ */
+typedef struct _cr_PkgCacheWriter cr_PkgCacheWriter;
+
+/** Fill the key from the stat() result.
+ * @param key           Key to fill
+ * @param st            stat() result of the rpm file
+ */
+void
+cr_pkgcache_key_from_stat(cr_PkgCacheKey *key, const struct stat *st);
+
+/** Open and map the cache file.
+ * Missing file or a cache created by a different version or with
+ * a different fingerprint results in an empty cache (not an error).
+ * @param path          Path to the cache file
+ * @param fingerprint   String describing options which affect
+ *                      the generated metadata (checksum type, ...)
+ * @param err           GError **
+ * @return              Opened cache or NULL on error
+ */
+cr_PkgCache *
+cr_pkgcache_open(const char *path,
+                 const char *fingerprint,
+                 GError **err);
+
+/** Number of packages in the cache.
+ * @param cache         Opened cache
+ * @return              Number of packages
+ */
+guint
+cr_pkgcache_size(cr_PkgCache *cache);
+
+/** Find a package in the cache. This function is thread safe.
+ * @param cache         Opened cache
+ * @param key           Identification of the rpm file
+ * @return              Cached entry (owned by the cache) or NULL
+ */
+const cr_PkgCacheEntry *
+cr_pkgcache_lookup(cr_PkgCache *cache, const cr_PkgCacheKey *key);
+
+/** Unmap and free the cache.
+ * @param cache         Opened cache
+ */
+void
+cr_pkgcache_free(cr_PkgCache *cache);
+
+/** Create a new cache file. The data are written into a temporary file
+ * which replaces the path in cr_pkgcache_writer_close().
+ * @param path          Path to the cache file
+ * @param fingerprint   String describing options which affect
+ *                      the generated metadata
+ * @param err           GError **
+ * @return              Writer or NULL on error
+ */
+cr_PkgCacheWriter *
+cr_pkgcache_writer_new(const char *path,
+                       const char *fingerprint,
+                       GError **err);
+
+/** Share the cache with other runs (e.g. of createrepo_c on other repos
+ * with the same rpms). cr_pkgcache_writer_close() then keeps also the
+ * packages of the current cache file which weren't added by this writer
+ * and the closes of more writers (processes) of the same cache are
+ * serialized by a lock of PATH.lock file. Must be called before any
+ * package is added.
+ * @param writer        Writer
+ */
+void
+cr_pkgcache_writer_set_shared(cr_PkgCacheWriter *writer);
+
+/** Append a package to the new cache. This function is not thread safe.
+ * @param writer        Writer
+ * @param entry         Package metadata (strings could be NULL)
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_pkgcache_writer_add(cr_PkgCacheWriter *writer,
+                       const cr_PkgCacheEntry *entry,
+                       GError **err);
+
+/** Close the writer and free it.
+ * @param writer        Writer
+ * @param commit        If TRUE, the new cache replaces the old one,
+ *                      otherwise the new cache is removed.
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_pkgcache_writer_close(cr_PkgCacheWriter *writer,
+                         gboolean commit,
+                         GError **err);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_PKGCACHE_H__ */
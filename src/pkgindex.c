@@ -0,0 +1,494 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "error.h"
+#include "pkgindex.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+#define PKGINDEX_MAGIC_LEN      8
+#define PKGINDEX_HEADER_LEN     32
+#define PKGINDEX_PKG_FIELDS     13
+#define PKGINDEX_DEP_FIELDS     6
+
+// Fields of a package record
+enum {
+    PKG_NAME,
+    PKG_EPOCH,
+    PKG_VERSION,
+    PKG_RELEASE,
+    PKG_ARCH,
+    PKG_LOCATION_HREF,
+    PKG_LOCATION_BASE,
+    PKG_CHECKSUM_TYPE,
+    PKG_PKGID,
+    PKG_PROVIDES_FIRST,
+    PKG_PROVIDES_COUNT,
+    PKG_REQUIRES_FIRST,
+    PKG_REQUIRES_COUNT,
+};
+
+struct _cr_PkgIndex {
+    GMappedFile *map;           // Mapped index file
+    const guint32 *pkgs;        // Package records
+    const guint32 *deps;        // Dependency records
+    const char *strings;        // String table
+    guint32 pkgs_count;
+    guint32 deps_count;
+    guint32 strings_size;
+};
+
+struct _cr_PkgIndexWriter {
+    GArray *pkgs;               // guint32[PKGINDEX_PKG_FIELDS] per package
+    GArray *deps;               // guint32[PKGINDEX_DEP_FIELDS] per dep
+    GString *strings;           // String table
+    GHashTable *offsets;        // String -> offset in the table
+    GStringChunk *chunk;        // Keys of the offsets
+    gboolean overflow;          // The table doesn't fit 32 bits
+};
+
+
+static const char *
+pkgindex_string(cr_PkgIndex *index, guint32 le_offset)
+{
+    guint32 offset = GUINT32_FROM_LE(le_offset);
+
+    // The table ends by '\0', every offset in the range is a valid string
+    if (offset == 0 || offset >= index->strings_size)
+        return NULL;
+    return index->strings + offset;
+}
+
+cr_PkgIndex *
+cr_pkgindex_open(const char *path, GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_PkgIndex *index;
+    guint32 header[(PKGINDEX_HEADER_LEN - PKGINDEX_MAGIC_LEN) / 4];
+    guint32 pkgs_off, deps_off, strings_off;
+    const char *data;
+    gsize len;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    index = g_new0(cr_PkgIndex, 1);
+    index->map = g_mapped_file_new(path, FALSE, &tmp_err);
+    if (!index->map) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot map package index %s: %s", path, tmp_err->message);
+        g_clear_error(&tmp_err);
+        g_free(index);
+        return NULL;
+    }
+
+    data = g_mapped_file_get_contents(index->map);
+    len = g_mapped_file_get_length(index->map);
+
+    if (len < PKGINDEX_HEADER_LEN
+        || memcmp(data, CR_PKGINDEX_MAGIC, PKGINDEX_MAGIC_LEN))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s is not a package index", path);
+        cr_pkgindex_free(index);
+        return NULL;
+    }
+
+    memcpy(header, data + PKGINDEX_MAGIC_LEN, sizeof(header));
+    index->pkgs_count   = GUINT32_FROM_LE(header[0]);
+    index->deps_count   = GUINT32_FROM_LE(header[1]);
+    pkgs_off            = GUINT32_FROM_LE(header[2]);
+    deps_off            = GUINT32_FROM_LE(header[3]);
+    strings_off         = GUINT32_FROM_LE(header[4]);
+    index->strings_size = GUINT32_FROM_LE(header[5]);
+
+    // The sections must be aligned, inside the file and the string table
+    // must end by '\0'
+    if (pkgs_off % 4 || deps_off % 4
+        || pkgs_off < PKGINDEX_HEADER_LEN
+        || (guint64) index->pkgs_count * PKGINDEX_PKG_FIELDS * 4 > len - pkgs_off
+        || deps_off > len
+        || (guint64) index->deps_count * PKGINDEX_DEP_FIELDS * 4 > len - deps_off
+        || strings_off > len
+        || index->strings_size == 0
+        || index->strings_size > len - strings_off
+        || data[strings_off + index->strings_size - 1] != '\0')
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Package index %s is truncated or corrupted", path);
+        cr_pkgindex_free(index);
+        return NULL;
+    }
+
+    index->pkgs    = (const guint32 *) (data + pkgs_off);
+    index->deps    = (const guint32 *) (data + deps_off);
+    index->strings = data + strings_off;
+
+    return index;
+}
+
+guint
+cr_pkgindex_size(cr_PkgIndex *index)
+{
+    return index ? index->pkgs_count : 0;
+}
+
+gboolean
+cr_pkgindex_get(cr_PkgIndex *index, guint n, cr_PkgIndexEntry *entry)
+{
+    const guint32 *rec;
+
+    assert(index);
+    assert(entry);
+
+    if (n >= index->pkgs_count)
+        return FALSE;
+
+    rec = index->pkgs + (gsize) n * PKGINDEX_PKG_FIELDS;
+    entry->name             = pkgindex_string(index, rec[PKG_NAME]);
+    entry->epoch            = pkgindex_string(index, rec[PKG_EPOCH]);
+    entry->version          = pkgindex_string(index, rec[PKG_VERSION]);
+    entry->release          = pkgindex_string(index, rec[PKG_RELEASE]);
+    entry->arch             = pkgindex_string(index, rec[PKG_ARCH]);
+    entry->location_href    = pkgindex_string(index, rec[PKG_LOCATION_HREF]);
+    entry->location_base    = pkgindex_string(index, rec[PKG_LOCATION_BASE]);
+    entry->checksum_type    = pkgindex_string(index, rec[PKG_CHECKSUM_TYPE]);
+    entry->pkgId            = pkgindex_string(index, rec[PKG_PKGID]);
+    entry->provides_first   = GUINT32_FROM_LE(rec[PKG_PROVIDES_FIRST]);
+    entry->provides_count   = GUINT32_FROM_LE(rec[PKG_PROVIDES_COUNT]);
+    entry->requires_first   = GUINT32_FROM_LE(rec[PKG_REQUIRES_FIRST]);
+    entry->requires_count   = GUINT32_FROM_LE(rec[PKG_REQUIRES_COUNT]);
+
+    // Every package has a name, the dependencies must be in the range
+    return entry->name
+           && entry->provides_first <= index->deps_count
+           && entry->provides_count <= index->deps_count - entry->provides_first
+           && entry->requires_first <= index->deps_count
+           && entry->requires_count <= index->deps_count - entry->requires_first;
+}
+
+gint
+cr_pkgindex_find(cr_PkgIndex *index, const char *name)
+{
+    guint lo = 0, hi;
+
+    assert(index);
+    assert(name);
+
+    // The first package with the name >= the searched one
+    hi = index->pkgs_count;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        const char *mid_name = pkgindex_string(index,
+                        index->pkgs[(gsize) mid * PKGINDEX_PKG_FIELDS + PKG_NAME]);
+        if (g_strcmp0(mid_name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < index->pkgs_count
+        && !g_strcmp0(pkgindex_string(index,
+                        index->pkgs[(gsize) lo * PKGINDEX_PKG_FIELDS + PKG_NAME]),
+                      name))
+        return (gint) lo;
+    return -1;
+}
+
+static gboolean
+pkgindex_get_dep(cr_PkgIndex *index,
+                 guint first,
+                 guint count,
+                 guint n,
+                 cr_PkgIndexDep *dep)
+{
+    const guint32 *rec;
+
+    if (n >= count || first + n >= index->deps_count)
+        return FALSE;
+
+    rec = index->deps + (gsize) (first + n) * PKGINDEX_DEP_FIELDS;
+    dep->name       = pkgindex_string(index, rec[0]);
+    dep->flags      = pkgindex_string(index, rec[1]);
+    dep->epoch      = pkgindex_string(index, rec[2]);
+    dep->version    = pkgindex_string(index, rec[3]);
+    dep->release    = pkgindex_string(index, rec[4]);
+    dep->pre        = GUINT32_FROM_LE(rec[5]) ? TRUE : FALSE;
+    return dep->name != NULL;
+}
+
+gboolean
+cr_pkgindex_get_provide(cr_PkgIndex *index,
+                        const cr_PkgIndexEntry *entry,
+                        guint n,
+                        cr_PkgIndexDep *dep)
+{
+    assert(index);
+    assert(entry);
+    assert(dep);
+
+    return pkgindex_get_dep(index, entry->provides_first,
+                            entry->provides_count, n, dep);
+}
+
+gboolean
+cr_pkgindex_get_require(cr_PkgIndex *index,
+                        const cr_PkgIndexEntry *entry,
+                        guint n,
+                        cr_PkgIndexDep *dep)
+{
+    assert(index);
+    assert(entry);
+    assert(dep);
+
+    return pkgindex_get_dep(index, entry->requires_first,
+                            entry->requires_count, n, dep);
+}
+
+void
+cr_pkgindex_free(cr_PkgIndex *index)
+{
+    if (!index)
+        return;
+    if (index->map)
+        g_mapped_file_unref(index->map);
+    g_free(index);
+}
+
+cr_PkgIndexWriter *
+cr_pkgindex_writer_new(void)
+{
+    cr_PkgIndexWriter *writer = g_new0(cr_PkgIndexWriter, 1);
+
+    writer->pkgs    = g_array_new(FALSE, FALSE,
+                                  sizeof(guint32) * PKGINDEX_PKG_FIELDS);
+    writer->deps    = g_array_new(FALSE, FALSE,
+                                  sizeof(guint32) * PKGINDEX_DEP_FIELDS);
+    writer->strings = g_string_sized_new(4096);
+    writer->offsets = g_hash_table_new(g_str_hash, g_str_equal);
+    writer->chunk   = g_string_chunk_new(4096);
+
+    // The offset 0 is the NULL
+    g_string_append_c(writer->strings, '\0');
+
+    return writer;
+}
+
+/** Offset of the string in the table (little endian), the same strings
+ *  are stored just once.
+ */
+static guint32
+pkgindex_writer_string(cr_PkgIndexWriter *writer, const char *str)
+{
+    gpointer value;
+    gsize offset;
+
+    if (!str || !*str)
+        return 0;
+
+    if (g_hash_table_lookup_extended(writer->offsets, str, NULL, &value))
+        return GUINT32_TO_LE(GPOINTER_TO_UINT(value));
+
+    offset = writer->strings->len;
+    if (offset + strlen(str) + 1 > G_MAXUINT32) {
+        writer->overflow = TRUE;
+        return 0;
+    }
+
+    g_string_append_len(writer->strings, str, strlen(str) + 1);
+    g_hash_table_insert(writer->offsets,
+                        g_string_chunk_insert(writer->chunk, str),
+                        GUINT_TO_POINTER((guint) offset));
+    return GUINT32_TO_LE((guint32) offset);
+}
+
+/** Append the dependencies, return the index of the first one.
+ */
+static guint32
+pkgindex_writer_deps(cr_PkgIndexWriter *writer, GSList *deps)
+{
+    guint32 first = writer->deps->len;
+
+    for (GSList *elem = deps; elem; elem = g_slist_next(elem)) {
+        cr_Dependency *dep = elem->data;
+        guint32 rec[PKGINDEX_DEP_FIELDS];
+
+        rec[0] = pkgindex_writer_string(writer, dep->name);
+        rec[1] = pkgindex_writer_string(writer, dep->flags);
+        rec[2] = pkgindex_writer_string(writer, dep->epoch);
+        rec[3] = pkgindex_writer_string(writer, dep->version);
+        rec[4] = pkgindex_writer_string(writer, dep->release);
+        rec[5] = GUINT32_TO_LE(dep->pre ? 1 : 0);
+        g_array_append_val(writer->deps, rec);
+    }
+
+    return first;
+}
+
+gboolean
+cr_pkgindex_writer_add(cr_PkgIndexWriter *writer,
+                       const cr_Package *pkg,
+                       GError **err)
+{
+    guint32 rec[PKGINDEX_PKG_FIELDS];
+
+    assert(writer);
+    assert(pkg);
+    assert(!err || *err == NULL);
+
+    rec[PKG_NAME]           = pkgindex_writer_string(writer, pkg->name);
+    rec[PKG_EPOCH]          = pkgindex_writer_string(writer, pkg->epoch);
+    rec[PKG_VERSION]        = pkgindex_writer_string(writer, pkg->version);
+    rec[PKG_RELEASE]        = pkgindex_writer_string(writer, pkg->release);
+    rec[PKG_ARCH]           = pkgindex_writer_string(writer, pkg->arch);
+    rec[PKG_LOCATION_HREF]  = pkgindex_writer_string(writer, pkg->location_href);
+    rec[PKG_LOCATION_BASE]  = pkgindex_writer_string(writer, pkg->location_base);
+    rec[PKG_CHECKSUM_TYPE]  = pkgindex_writer_string(writer, pkg->checksum_type);
+    rec[PKG_PKGID]          = pkgindex_writer_string(writer, pkg->pkgId);
+    rec[PKG_PROVIDES_FIRST] = GUINT32_TO_LE(pkgindex_writer_deps(writer, pkg->provides));
+    rec[PKG_PROVIDES_COUNT] = GUINT32_TO_LE(g_slist_length(pkg->provides));
+    rec[PKG_REQUIRES_FIRST] = GUINT32_TO_LE(pkgindex_writer_deps(writer, pkg->requires));
+    rec[PKG_REQUIRES_COUNT] = GUINT32_TO_LE(g_slist_length(pkg->requires));
+
+    if (writer->overflow
+        || writer->deps->len > G_MAXUINT32 / (PKGINDEX_DEP_FIELDS * 4)
+        || writer->pkgs->len >= G_MAXUINT32 / (PKGINDEX_PKG_FIELDS * 4))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_ERROR,
+                    "Package index is too large");
+        return FALSE;
+    }
+
+    g_array_append_val(writer->pkgs, rec);
+    return TRUE;
+}
+
+guint
+cr_pkgindex_writer_size(cr_PkgIndexWriter *writer)
+{
+    return writer ? writer->pkgs->len : 0;
+}
+
+/** Sort the packages by name, the packages of the same name stay
+ *  in the order of their addition.
+ */
+static gint
+pkgindex_writer_cmp(gconstpointer a_p, gconstpointer b_p, gpointer user_data)
+{
+    cr_PkgIndexWriter *writer = user_data;
+    guint a = *((const guint *) a_p), b = *((const guint *) b_p);
+    const guint32 *rec_a = &g_array_index(writer->pkgs, guint32,
+                                          (gsize) a * PKGINDEX_PKG_FIELDS);
+    const guint32 *rec_b = &g_array_index(writer->pkgs, guint32,
+                                          (gsize) b * PKGINDEX_PKG_FIELDS);
+    int ret = strcmp(writer->strings->str + GUINT32_FROM_LE(rec_a[PKG_NAME]),
+                     writer->strings->str + GUINT32_FROM_LE(rec_b[PKG_NAME]));
+    if (ret)
+        return ret;
+    return (a > b) - (a < b);
+}
+
+gboolean
+cr_pkgindex_writer_write(cr_PkgIndexWriter *writer,
+                         const char *path,
+                         GError **err)
+{
+    guint pkgs_count = writer->pkgs->len;
+    guint32 header[(PKGINDEX_HEADER_LEN - PKGINDEX_MAGIC_LEN) / 4];
+    gsize pkgs_size = (gsize) pkgs_count * PKGINDEX_PKG_FIELDS * 4;
+    gsize deps_size = (gsize) writer->deps->len * PKGINDEX_DEP_FIELDS * 4;
+    guint *order;
+    FILE *f;
+
+    assert(writer);
+    assert(path);
+    assert(!err || *err == NULL);
+
+    if (writer->overflow
+        || PKGINDEX_HEADER_LEN + pkgs_size + deps_size + writer->strings->len
+           > G_MAXUINT32)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_ERROR, "Package index is too large");
+        return FALSE;
+    }
+
+    header[0] = GUINT32_TO_LE(pkgs_count);
+    header[1] = GUINT32_TO_LE(writer->deps->len);
+    header[2] = GUINT32_TO_LE(PKGINDEX_HEADER_LEN);
+    header[3] = GUINT32_TO_LE(PKGINDEX_HEADER_LEN + pkgs_size);
+    header[4] = GUINT32_TO_LE(PKGINDEX_HEADER_LEN + pkgs_size + deps_size);
+    header[5] = GUINT32_TO_LE(writer->strings->len);
+
+    order = g_new(guint, pkgs_count ? pkgs_count : 1);
+    for (guint x = 0; x < pkgs_count; x++)
+        order[x] = x;
+    g_qsort_with_data(order, pkgs_count, sizeof(guint),
+                      pkgindex_writer_cmp, writer);
+
+    f = fopen(path, "wb");
+    if (!f) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        g_free(order);
+        return FALSE;
+    }
+
+    gboolean ok = fwrite(CR_PKGINDEX_MAGIC, PKGINDEX_MAGIC_LEN, 1, f) == 1
+                  && fwrite(header, sizeof(header), 1, f) == 1;
+    for (guint x = 0; ok && x < pkgs_count; x++)
+        ok = fwrite(&g_array_index(writer->pkgs, guint32,
+                                   (gsize) order[x] * PKGINDEX_PKG_FIELDS),
+                    PKGINDEX_PKG_FIELDS * 4, 1, f) == 1;
+    if (ok && deps_size)
+        ok = fwrite(writer->deps->data, deps_size, 1, f) == 1;
+    if (ok)
+        ok = fwrite(writer->strings->str, writer->strings->len, 1, f) == 1;
+    if (fclose(f) != 0)
+        ok = FALSE;
+
+    g_free(order);
+
+    if (!ok) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot write %s: %s", path, g_strerror(errno));
+        g_remove(path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+cr_pkgindex_writer_free(cr_PkgIndexWriter *writer)
+{
+    if (!writer)
+        return;
+    g_array_free(writer->pkgs, TRUE);
+    g_array_free(writer->deps, TRUE);
+    g_string_free(writer->strings, TRUE);
+    g_hash_table_destroy(writer->offsets);
+    g_string_chunk_free(writer->chunk);
+    g_free(writer);
+}
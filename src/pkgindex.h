@@ -0,0 +1,216 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_PKGINDEX_H__
+#define __C_CREATEREPOLIB_PKGINDEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include "package.h"
+
+/** \defgroup   pkgindex    Binary index of the packages of a repository
+ *
+ * The index is an additional uncompressed repodata file (record type
+ * "pkgindex") with the NEVRAs, locations, checksums, provides and requires
+ * of the packages. It is meant to be memory mapped, the lookups don't parse
+ * anything and all the returned strings point directly into the mapping.
+ *
+ * File format (all numbers are little endian guint32):
+ *
+ *  Header (32 bytes):
+ *      char[8]     CR_PKGINDEX_MAGIC
+ *      guint32     number of packages
+ *      guint32     number of dependencies
+ *      guint32     offset of the packages
+ *      guint32     offset of the dependencies
+ *      guint32     offset of the strings
+ *      guint32     size of the strings
+ *  Packages (sorted by name), every one 13 numbers:
+ *      name, epoch, version, release, arch, location_href, location_base,
+ *      checksum_type and pkgId (offsets of the strings), the first provide
+ *      and the number of provides, the first require and the number of
+ *      requires (indexes of the dependencies)
+ *  Dependencies, every one 6 numbers:
+ *      name, flags, epoch, version and release (offsets of the strings),
+ *      pre (0 or 1)
+ *  Strings:
+ *      '\0' terminated strings, the offset 0 is an empty string and
+ *      means NULL
+ *
+ *  \addtogroup pkgindex
+ *  @{
+ */
+
+#define CR_PKGINDEX_MAGIC       "CRPKGI01"
+
+/** Package of the index. The strings are owned by the index.
+ */
+typedef struct {
+    const char *name;           /*!< name */
+    const char *epoch;          /*!< epoch */
+    const char *version;        /*!< version */
+    const char *release;        /*!< release */
+    const char *arch;           /*!< architecture */
+    const char *location_href;  /*!< location of the package */
+    const char *location_base;  /*!< base location of the package */
+    const char *checksum_type;  /*!< type of the pkgId */
+    const char *pkgId;          /*!< checksum of the package */
+    guint provides_count;       /*!< number of provides */
+    guint requires_count;       /*!< number of requires */
+    guint provides_first;       /*!< internal: first provide */
+    guint requires_first;       /*!< internal: first require */
+} cr_PkgIndexEntry;
+
+/** Dependency of a package of the index. The strings are owned
+ * by the index.
+ */
+typedef struct {
+    const char *name;           /*!< name */
+    const char *flags;          /*!< flags (e.g. "EQ") */
+    const char *epoch;          /*!< epoch */
+    const char *version;        /*!< version */
+    const char *release;        /*!< release */
+    gboolean pre;               /*!< preinstall */
+} cr_PkgIndexDep;
+
+/** Opened (memory mapped, read-only) index.
+ */
+typedef struct _cr_PkgIndex cr_PkgIndex;
+
+/** Writer of a new index.
+ */
+typedef struct _cr_PkgIndexWriter cr_PkgIndexWriter;
+
+/** Open and map the index file.
+ * @param path          Path to the index
+ * @param err           GError **
+ * @return              Opened index or NULL on error
+ */
+cr_PkgIndex *
+cr_pkgindex_open(const char *path, GError **err);
+
+/** Number of packages in the index.
+ * @param index         Opened index
+ * @return              Number of packages
+ */
+guint
+cr_pkgindex_size(cr_PkgIndex *index);
+
+/** Get a package of the index.
+ * @param index         Opened index
+ * @param n             Index of the package (packages are sorted by name)
+ * @param entry         Entry to fill
+ * @return              FALSE if n is out of range or the record is corrupted
+ */
+gboolean
+cr_pkgindex_get(cr_PkgIndex *index, guint n, cr_PkgIndexEntry *entry);
+
+/** Find the first package of the name by binary search.
+ * The packages of the same name follow it.
+ * @param index         Opened index
+ * @param name          Name of the package
+ * @return              Index of the package or -1 if not found
+ */
+gint
+cr_pkgindex_find(cr_PkgIndex *index, const char *name);
+
+/** Get a provide of a package.
+ * @param index         Opened index
+ * @param entry         Package from cr_pkgindex_get()
+ * @param n             0 .. entry->provides_count - 1
+ * @param dep           Dependency to fill
+ * @return              FALSE if n is out of range or the record is corrupted
+ */
+gboolean
+cr_pkgindex_get_provide(cr_PkgIndex *index,
+                        const cr_PkgIndexEntry *entry,
+                        guint n,
+                        cr_PkgIndexDep *dep);
+
+/** Get a require of a package.
+ * @param index         Opened index
+ * @param entry         Package from cr_pkgindex_get()
+ * @param n             0 .. entry->requires_count - 1
+ * @param dep           Dependency to fill
+ * @return              FALSE if n is out of range or the record is corrupted
+ */
+gboolean
+cr_pkgindex_get_require(cr_PkgIndex *index,
+                        const cr_PkgIndexEntry *entry,
+                        guint n,
+                        cr_PkgIndexDep *dep);
+
+/** Unmap and free the index.
+ * @param index         Opened index or NULL
+ */
+void
+cr_pkgindex_free(cr_PkgIndex *index);
+
+/** Create a writer of a new index. The packages are collected in memory
+ * and sorted by cr_pkgindex_writer_write().
+ * @return              Writer
+ */
+cr_PkgIndexWriter *
+cr_pkgindex_writer_new(void);
+
+/** Add a package to the index. This function is not thread safe.
+ * @param writer        Writer
+ * @param pkg           Package (the strings are copied)
+ * @param err           GError **
+ * @return              TRUE on success, FALSE if the index is too large
+ */
+gboolean
+cr_pkgindex_writer_add(cr_PkgIndexWriter *writer,
+                       const cr_Package *pkg,
+                       GError **err);
+
+/** Number of packages added to the writer.
+ * @param writer        Writer
+ * @return              Number of packages
+ */
+guint
+cr_pkgindex_writer_size(cr_PkgIndexWriter *writer);
+
+/** Write the index into the file.
+ * @param writer        Writer
+ * @param path          Path to the new index (an existing file is replaced)
+ * @param err           GError **
+ * @return              TRUE on success
+ */
+gboolean
+cr_pkgindex_writer_write(cr_PkgIndexWriter *writer,
+                         const char *path,
+                         GError **err);
+
+/** Free the writer.
+ * @param writer        Writer or NULL
+ */
+void
+cr_pkgindex_writer_free(cr_PkgIndexWriter *writer);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_PKGINDEX_H__ */
@@ -0,0 +1,243 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+#include "pkgtable.h"
+
+/** Minimal number of slots.
+ */
+#define PKGTABLE_MIN_SLOTS      16
+
+/** Slot of the table, pkg is NULL if the slot is empty.
+ */
+struct PkgTableEntry {
+    guint hash;
+    const char *key;
+    cr_Package *pkg;
+};
+
+struct _cr_PkgTable {
+    struct PkgTableEntry *entries;  // Slots, the count is a power of 2
+    gsize mask;                     // Number of slots - 1
+    guint size;                     // Number of packages
+};
+
+guint
+cr_pkgtable_hash(const char *key)
+{
+    return g_str_hash(key);
+}
+
+/** Number of slots for the number of packages, at most 3/4 of the slots
+ * are used.
+ */
+static gsize
+pkgtable_slots(gsize size)
+{
+    gsize slots = PKGTABLE_MIN_SLOTS;
+
+    while (slots * 3 < size * 4)
+        slots <<= 1;
+    return slots;
+}
+
+cr_PkgTable *
+cr_pkgtable_new(guint size_hint)
+{
+    cr_PkgTable *table = g_new0(cr_PkgTable, 1);
+    gsize slots = pkgtable_slots(size_hint);
+
+    table->entries = g_new0(struct PkgTableEntry, slots);
+    table->mask    = slots - 1;
+    return table;
+}
+
+guint
+cr_pkgtable_size(cr_PkgTable *table)
+{
+    assert(table);
+    return table->size;
+}
+
+/** Slot of the key or the empty slot where the key belongs.
+ */
+static gsize
+pkgtable_find(cr_PkgTable *table, const char *key, guint hash)
+{
+    gsize x = hash & table->mask;
+
+    while (table->entries[x].pkg
+           && (table->entries[x].hash != hash
+               || strcmp(table->entries[x].key, key)))
+        x = (x + 1) & table->mask;
+
+    return x;
+}
+
+/** Double the number of slots, the stored hashes are used.
+ */
+static void
+pkgtable_grow(cr_PkgTable *table)
+{
+    struct PkgTableEntry *old = table->entries;
+    gsize old_slots = table->mask + 1;
+    gsize slots = old_slots << 1;
+
+    table->entries = g_new0(struct PkgTableEntry, slots);
+    table->mask    = slots - 1;
+
+    for (gsize x = 0; x < old_slots; x++) {
+        if (!old[x].pkg)
+            continue;
+        gsize y = old[x].hash & table->mask;
+        while (table->entries[y].pkg)
+            y = (y + 1) & table->mask;
+        table->entries[y] = old[x];
+    }
+
+    g_free(old);
+}
+
+cr_Package *
+cr_pkgtable_lookup_hashed(cr_PkgTable *table, const char *key, guint hash)
+{
+    assert(table);
+    assert(key);
+    return table->entries[pkgtable_find(table, key, hash)].pkg;
+}
+
+cr_Package *
+cr_pkgtable_lookup(cr_PkgTable *table, const char *key)
+{
+    return cr_pkgtable_lookup_hashed(table, key, cr_pkgtable_hash(key));
+}
+
+void
+cr_pkgtable_insert(cr_PkgTable *table, const char *key, cr_Package *pkg)
+{
+    guint hash = cr_pkgtable_hash(key);
+    gsize x;
+
+    assert(table);
+    assert(pkg);
+
+    if ((gsize) (table->size + 1) * 4 > (table->mask + 1) * 3)
+        pkgtable_grow(table);
+
+    x = pkgtable_find(table, key, hash);
+    assert(!table->entries[x].pkg);
+    table->entries[x].hash = hash;
+    table->entries[x].key  = key;
+    table->entries[x].pkg  = pkg;
+    table->size++;
+}
+
+cr_Package *
+cr_pkgtable_steal(cr_PkgTable *table, const char *key)
+{
+    gsize x, y;
+    cr_Package *pkg;
+
+    assert(table);
+    assert(key);
+
+    x = pkgtable_find(table, key, cr_pkgtable_hash(key));
+    pkg = table->entries[x].pkg;
+    if (!pkg)
+        return NULL;
+
+    // Shift the following entries of the cluster back, so no lookup
+    // stops at the emptied slot before reaching its key
+    for (y = (x + 1) & table->mask;
+         table->entries[y].pkg;
+         y = (y + 1) & table->mask)
+    {
+        gsize home = table->entries[y].hash & table->mask;
+        // The entry stays if its home is cyclically in (x, y]
+        if (x <= y ? (x < home && home <= y) : (x < home || home <= y))
+            continue;
+        table->entries[x] = table->entries[y];
+        x = y;
+    }
+
+    memset(&(table->entries[x]), 0, sizeof(struct PkgTableEntry));
+    table->size--;
+    return pkg;
+}
+
+gboolean
+cr_pkgtable_remove(cr_PkgTable *table, const char *key)
+{
+    cr_Package *pkg = cr_pkgtable_steal(table, key);
+
+    if (!pkg)
+        return FALSE;
+    cr_package_free(pkg);
+    return TRUE;
+}
+
+void
+cr_pkgtable_iter_init(cr_PkgTableIter *iter, cr_PkgTable *table)
+{
+    assert(iter);
+    assert(table);
+    iter->table = table;
+    iter->pos = 0;
+}
+
+gboolean
+cr_pkgtable_iter_next(cr_PkgTableIter *iter,
+                      const char **key,
+                      cr_Package **pkg,
+                      guint *hash)
+{
+    cr_PkgTable *table = iter->table;
+
+    while (iter->pos <= table->mask) {
+        struct PkgTableEntry *entry = &(table->entries[iter->pos++]);
+        if (!entry->pkg)
+            continue;
+        if (key)
+            *key = entry->key;
+        if (pkg)
+            *pkg = entry->pkg;
+        if (hash)
+            *hash = entry->hash;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+void
+cr_pkgtable_free(cr_PkgTable *table, gboolean free_packages)
+{
+    if (!table)
+        return;
+
+    if (free_packages)
+        for (gsize x = 0; x <= table->mask; x++)
+            if (table->entries[x].pkg)
+                cr_package_free(table->entries[x].pkg);
+
+    g_free(table->entries);
+    g_free(table);
+}
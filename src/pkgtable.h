@@ -0,0 +1,144 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_PKGTABLE_H__
+#define __C_CREATEREPOLIB_PKGTABLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include "package.h"
+
+/** \defgroup   pkgtable    Open addressing table of packages
+ *
+ * Table of packages indexed by a string key borrowed from the package
+ * (usually its pkgId). The slots are kept in one array and probed
+ * linearly, every slot stores the hash of its key, so a mismatching
+ * slot is mostly skipped without touching the key and the table grows
+ * without hashing the keys again. The table can be sized in advance
+ * from the expected number of packages.
+ *
+ *  \addtogroup pkgtable
+ *  @{
+ */
+
+/** Table of packages, it owns the packages.
+ */
+typedef struct _cr_PkgTable cr_PkgTable;
+
+/** Iterator over the packages of a table. The table must not be modified
+ * during the iteration.
+ */
+typedef struct {
+    cr_PkgTable *table;
+    gsize pos;
+} cr_PkgTableIter;
+
+/** Hash of a key (the same as g_str_hash()).
+ * @param key           Key
+ * @return              Hash
+ */
+guint cr_pkgtable_hash(const char *key);
+
+/** Create a new table.
+ * @param size_hint     Expected number of packages or 0
+ * @return              New cr_PkgTable
+ */
+cr_PkgTable *cr_pkgtable_new(guint size_hint);
+
+/** Number of packages in the table.
+ * @param table         cr_PkgTable
+ * @return              Number of packages
+ */
+guint cr_pkgtable_size(cr_PkgTable *table);
+
+/** Find the package of the key.
+ * @param table         cr_PkgTable
+ * @param key           Key
+ * @return              Package or NULL
+ */
+cr_Package *cr_pkgtable_lookup(cr_PkgTable *table, const char *key);
+
+/** Same as cr_pkgtable_lookup() with the hash of the key already known
+ * (e.g. from an iterator of another table).
+ * @param table         cr_PkgTable
+ * @param key           Key
+ * @param hash          cr_pkgtable_hash() of the key
+ * @return              Package or NULL
+ */
+cr_Package *cr_pkgtable_lookup_hashed(cr_PkgTable *table,
+                                      const char *key,
+                                      guint hash);
+
+/** Insert a package, the key must not be in the table yet.
+ * @param table         cr_PkgTable
+ * @param key           Key, it must live as long as the package is
+ *                      in the table
+ * @param pkg           Package, the table owns it since now
+ */
+void cr_pkgtable_insert(cr_PkgTable *table, const char *key, cr_Package *pkg);
+
+/** Remove the package of the key from the table without freeing it.
+ * @param table         cr_PkgTable
+ * @param key           Key
+ * @return              Package or NULL if the key is not in the table
+ */
+cr_Package *cr_pkgtable_steal(cr_PkgTable *table, const char *key);
+
+/** Remove and free the package of the key.
+ * @param table         cr_PkgTable
+ * @param key           Key
+ * @return              TRUE if the key was in the table
+ */
+gboolean cr_pkgtable_remove(cr_PkgTable *table, const char *key);
+
+/** Initialize an iterator.
+ * @param iter          Iterator
+ * @param table         cr_PkgTable
+ */
+void cr_pkgtable_iter_init(cr_PkgTableIter *iter, cr_PkgTable *table);
+
+/** Get the next package of the table.
+ * @param iter          Iterator
+ * @param key           Key of the package or NULL
+ * @param pkg           Package or NULL
+ * @param hash          Hash of the key or NULL
+ * @return              FALSE if there are no more packages
+ */
+gboolean cr_pkgtable_iter_next(cr_PkgTableIter *iter,
+                               const char **key,
+                               cr_Package **pkg,
+                               guint *hash);
+
+/** Free the table.
+ * @param table         cr_PkgTable or NULL
+ * @param free_packages Free the packages as well, FALSE if they were
+ *                      all taken over by the iteration
+ */
+void cr_pkgtable_free(cr_PkgTable *table, gboolean free_packages);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_PKGTABLE_H__ */
@@ -76,12 +76,31 @@ py_compression_type(G_GNUC_UNUSED PyObject *self, PyObject *args)
  * CrFile object
  */
 
+// Size of the chunks returned by the iteration over a CrFile
+// and of the buffer of CrFile.copy_to()
+#define CRFILE_CHUNK_SIZE   (1024*1024)
+
+// Max bytes read by a single cr_read() call
+#define CRFILE_MAX_READ     (1024*1024*1024)
+
 typedef struct {
     PyObject_HEAD
     CR_FILE *f;
     PyObject *py_stat;
+    int busy;       /*!< The file is used without the GIL */
 } _CrFileObject;
 
+static int
+check_CrFileBusy(const _CrFileObject *self)
+{
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "CrFile object is being used by another thread.");
+        return -1;
+    }
+    return 0;
+}
+
 static PyObject * py_close(_CrFileObject *self, void *nothing);
 
 static int
@@ -94,7 +113,7 @@ check_CrFileStatus(const _CrFileObject *self)
             "Improper createrepo_c CrFile object (Already closed file?).");
         return -1;
     }
-    return 0;
+    return check_CrFileBusy(self);
 }
 
 /* Function on the type */
@@ -108,6 +127,7 @@ crfile_new(PyTypeObject *type,
     if (self) {
         self->f = NULL;
         self->py_stat = NULL;
+        self->busy = 0;
     }
     return (PyObject *)self;
 }
@@ -157,7 +177,11 @@ crfile_init(_CrFileObject *self, PyObject *args, G_GNUC_UNUSED PyObject *kwds)
     }
 
     /* Init */
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
     self->f = cr_sopen(path, mode, comtype, stat, &err);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
     if (err) {
         nice_exception(&err, "CrFile %s init failed: ", path);
         return -1;
@@ -199,23 +223,30 @@ crfile_repr(_CrFileObject *self)
 /* CrFile methods */
 
 PyDoc_STRVAR(write__doc__,
-"write() -> None\n\n"
-"Write a data to the file");
+"write(data) -> None\n\n"
+"Write a data (str or bytes-like object) to the file");
 
 static PyObject *
 py_write(_CrFileObject *self, PyObject *args)
 {
-    char *str;
-    Py_ssize_t len;
+    Py_buffer data;
     GError *tmp_err = NULL;
 
-    if (!PyArg_ParseTuple(args, "s#:set_num_of_pkgs", &str, &len))
+    if (!PyArg_ParseTuple(args, "s*:write", &data))
         return NULL;
 
-    if (check_CrFileStatus(self))
+    if (check_CrFileStatus(self)) {
+        PyBuffer_Release(&data);
         return NULL;
+    }
 
-    cr_write(self->f, str, len, &tmp_err);
+    // The exported buffer can't be resized or freed until it's released
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    cr_write(self->f, data.buf, data.len, &tmp_err);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+    PyBuffer_Release(&data);
     if (tmp_err) {
         nice_exception(&tmp_err, NULL);
         return NULL;
@@ -224,6 +255,209 @@ py_write(_CrFileObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+/** Read up to len bytes (less only at the end of the file) without the GIL.
+ * @return      Number of read bytes or -1 (err is set)
+ */
+static Py_ssize_t
+crfile_read(_CrFileObject *self, char *buf, Py_ssize_t len, GError **err)
+{
+    Py_ssize_t total = 0;
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    while (total < len) {
+        int ret = cr_read(self->f, buf + total,
+                          (unsigned int) MIN(len - total, CRFILE_MAX_READ),
+                          err);
+        if (ret == CR_CW_ERR) {
+            total = -1;
+            break;
+        }
+        if (ret == 0)
+            break;  // EOF
+        total += ret;
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+
+    return total;
+}
+
+/** Read whole rest of the file into a new bytes object.
+ */
+static PyObject *
+crfile_read_all(_CrFileObject *self, GError **err)
+{
+    Py_ssize_t size = 0, alloc = CRFILE_CHUNK_SIZE;
+    PyObject *bytes = PyBytes_FromStringAndSize(NULL, alloc);
+
+    while (bytes) {
+        Py_ssize_t ret = crfile_read(self, PyBytes_AS_STRING(bytes) + size,
+                                     alloc - size, err);
+        if (ret < 0) {
+            Py_CLEAR(bytes);
+            break;
+        }
+        size += ret;
+        if (size < alloc)
+            break;  // EOF
+        alloc *= 2;
+        if (_PyBytes_Resize(&bytes, alloc))
+            return NULL;
+    }
+
+    if (bytes && _PyBytes_Resize(&bytes, size))
+        return NULL;
+    return bytes;
+}
+
+PyDoc_STRVAR(read__doc__,
+"read(size=-1) -> bytes\n\n"
+"Read at most size bytes of decompressed data (everything to the end\n"
+"of the file if size is negative). Empty bytes are returned at the end\n"
+"of the file");
+
+static PyObject *
+py_read(_CrFileObject *self, PyObject *args)
+{
+    Py_ssize_t size = -1, ret;
+    PyObject *bytes;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "|n:read", &size))
+        return NULL;
+
+    if (check_CrFileStatus(self))
+        return NULL;
+
+    if (size < 0) {
+        bytes = crfile_read_all(self, &tmp_err);
+    } else {
+        bytes = PyBytes_FromStringAndSize(NULL, size);
+        if (!bytes)
+            return NULL;
+        ret = crfile_read(self, PyBytes_AS_STRING(bytes), size, &tmp_err);
+        if (ret < 0)
+            Py_CLEAR(bytes);
+        else if (_PyBytes_Resize(&bytes, ret))
+            return NULL;
+    }
+
+    if (tmp_err) {
+        nice_exception(&tmp_err, NULL);
+        return NULL;
+    }
+
+    return bytes;
+}
+
+PyDoc_STRVAR(readinto__doc__,
+"readinto(buffer) -> int\n\n"
+"Read decompressed data directly into a writable bytes-like object\n"
+"(bytearray, memoryview, ...), return number of read bytes\n"
+"(0 at the end of the file)");
+
+static PyObject *
+py_readinto(_CrFileObject *self, PyObject *args)
+{
+    Py_buffer buffer;
+    Py_ssize_t ret;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "w*:readinto", &buffer))
+        return NULL;
+
+    if (check_CrFileStatus(self)) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    ret = crfile_read(self, buffer.buf, buffer.len, &tmp_err);
+    PyBuffer_Release(&buffer);
+    if (tmp_err) {
+        nice_exception(&tmp_err, NULL);
+        return NULL;
+    }
+
+    return PyLong_FromSsize_t(ret);
+}
+
+PyDoc_STRVAR(copy_to__doc__,
+"copy_to(dst) -> int\n\n"
+"Copy the rest of the file into another CrFile opened for writing,\n"
+"return number of copied (decompressed) bytes. Data don't pass through\n"
+"Python objects and the GIL is released");
+
+static PyObject *
+py_copy_to(_CrFileObject *self, PyObject *args)
+{
+    _CrFileObject *dst;
+    gint64 copied = 0;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!:copy_to", &CrFile_Type, &dst))
+        return NULL;
+
+    if (check_CrFileStatus(self) || check_CrFileStatus(dst))
+        return NULL;
+
+    if (dst == self) {
+        PyErr_SetString(PyExc_ValueError, "Cannot copy a CrFile into itself");
+        return NULL;
+    }
+
+    self->busy = dst->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    char *buf = g_malloc(CRFILE_CHUNK_SIZE);
+    int ret;
+    while ((ret = cr_read(self->f, buf, CRFILE_CHUNK_SIZE, &tmp_err)) > 0) {
+        if (cr_write(dst->f, buf, ret, &tmp_err) == CR_CW_ERR)
+            break;
+        copied += ret;
+    }
+    g_free(buf);
+    Py_END_ALLOW_THREADS
+    self->busy = dst->busy = 0;
+
+    if (tmp_err) {
+        nice_exception(&tmp_err, "Copy error: ");
+        return NULL;
+    }
+
+    return PyLong_FromLongLong(copied);
+}
+
+/* CrFile iteration - chunks of the decompressed data */
+
+static PyObject *
+crfile_iternext(_CrFileObject *self)
+{
+    Py_ssize_t ret;
+    PyObject *bytes;
+    GError *tmp_err = NULL;
+
+    if (check_CrFileStatus(self))
+        return NULL;
+
+    bytes = PyBytes_FromStringAndSize(NULL, CRFILE_CHUNK_SIZE);
+    if (!bytes)
+        return NULL;
+
+    ret = crfile_read(self, PyBytes_AS_STRING(bytes), CRFILE_CHUNK_SIZE,
+                      &tmp_err);
+    if (ret <= 0) {
+        // End of the file (NULL without an exception) or an error
+        Py_DECREF(bytes);
+        if (tmp_err)
+            nice_exception(&tmp_err, NULL);
+        return NULL;
+    }
+
+    if (_PyBytes_Resize(&bytes, ret))
+        return NULL;
+    return bytes;
+}
+
 PyDoc_STRVAR(close__doc__,
 "close() -> None\n\n"
 "Close the file");
@@ -233,9 +467,16 @@ py_close(_CrFileObject *self, G_GNUC_UNUSED void *nothing)
 {
     GError *tmp_err = NULL;
 
+    if (check_CrFileBusy(self))
+        return NULL;
+
     if (self->f) {
-        cr_close(self->f, &tmp_err);
+        // Flushing of the compressor could take a while
+        CR_FILE *f = self->f;
         self->f = NULL;
+        Py_BEGIN_ALLOW_THREADS
+        cr_close(f, &tmp_err);
+        Py_END_ALLOW_THREADS
     }
 
     Py_XDECREF(self->py_stat);
@@ -251,6 +492,9 @@ py_close(_CrFileObject *self, G_GNUC_UNUSED void *nothing)
 
 static struct PyMethodDef crfile_methods[] = {
     {"write", (PyCFunction)py_write, METH_VARARGS, write__doc__},
+    {"read", (PyCFunction)py_read, METH_VARARGS, read__doc__},
+    {"readinto", (PyCFunction)py_readinto, METH_VARARGS, readinto__doc__},
+    {"copy_to", (PyCFunction)py_copy_to, METH_VARARGS, copy_to__doc__},
     {"close", (PyCFunction)py_close, METH_NOARGS, close__doc__},
     {NULL, NULL, 0, NULL} /* sentinel */
 };
@@ -264,6 +508,7 @@ PyTypeObject CrFile_Type = {
     .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
     .tp_doc = "CrFile object",
     .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) crfile_iternext,
     .tp_methods = crfile_methods,
     .tp_init = (initproc) crfile_init,
     .tp_new = crfile_new,
@@ -0,0 +1,89 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <Python.h>
+#include <assert.h>
+#include <stddef.h>
+
+#include "src/createrepo_c.h"
+
+#include "createrepo-py.h"
+#include "exception-py.h"
+
+PyObject *
+py_createrepo(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    PyObject *py_args, *seq, *dict;
+    cr_CreaterepoOptions *options;
+    cr_CreaterepoResult *result;
+    GPtrArray *argv;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "O:py_createrepo", &py_args))
+        return NULL;
+
+    seq = PySequence_Fast(py_args, "args must be a sequence of strings");
+    if (!seq)
+        return NULL;
+
+    argv = g_ptr_array_new_with_free_func(g_free);
+    for (Py_ssize_t x = 0; x < PySequence_Fast_GET_SIZE(seq); x++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, x);
+        const char *arg = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item)
+                                                : NULL;
+        if (!arg) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError,
+                                "args must be a sequence of strings");
+            g_ptr_array_free(argv, TRUE);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        g_ptr_array_add(argv, g_strdup(arg));
+    }
+    g_ptr_array_add(argv, NULL);
+    Py_DECREF(seq);
+
+    options = cr_createrepo_options_new((const gchar * const *) argv->pdata,
+                                        &tmp_err);
+    g_ptr_array_free(argv, TRUE);
+    if (!options) {
+        nice_exception(&tmp_err, "Bad arguments: ");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = cr_createrepo_run(options, &tmp_err);
+    Py_END_ALLOW_THREADS
+    cr_createrepo_options_free(options);
+
+    if (!result) {
+        nice_exception(&tmp_err, NULL);
+        return NULL;
+    }
+
+    dict = Py_BuildValue("{s:l,s:l,s:O,s:i,s:s}",
+                         "task_count", result->task_count,
+                         "package_count", result->package_count,
+                         "had_errors", result->had_errors ? Py_True : Py_False,
+                         "exit_val", result->exit_val,
+                         "repomd_path", result->repomd_path);
+    cr_createrepo_result_free(result);
+    return dict;
+}
@@ -49,6 +49,9 @@ XZ_COMPRESSION          = _createrepo_c.XZ_COMPRESSION
 #: Zchunk compression
 ZCK_COMPRESSION         = _createrepo_c.ZCK_COMPRESSION
 
+#: Zstd compression
+ZSTD_COMPRESSION        = _createrepo_c.ZSTD_COMPRESSION
+
 #: Gzip compression alias
 GZ                      = _createrepo_c.GZ_COMPRESSION
 
@@ -61,6 +64,9 @@ XZ                      = _createrepo_c.XZ_COMPRESSION
 #: Zchunk compression alias
 ZCK                     = _createrepo_c.ZCK_COMPRESSION
 
+#: Zstd compression alias
+ZSTD                    = _createrepo_c.ZSTD_COMPRESSION
+
 HT_KEY_DEFAULT  = _createrepo_c.HT_KEY_DEFAULT  #: Default key (hash)
 HT_KEY_HASH     = _createrepo_c.HT_KEY_HASH     #: Package hash as a key
 HT_KEY_NAME     = _createrepo_c.HT_KEY_NAME     #: Package name as a key
@@ -145,6 +151,10 @@ MetadataLocation = _createrepo_c.MetadataLocation
 
 Package = _createrepo_c.Package
 
+# PackageIterator class
+
+PackageIterator = _createrepo_c.PackageIterator
+
 # Repomd class
 
 class Repomd(_createrepo_c.Repomd):
@@ -293,6 +303,19 @@ def package_from_rpm(filename, checksum_type=SHA256, location_href=None,
     return _createrepo_c.package_from_rpm(filename, checksum_type,
                       location_href, location_base, changelog_limit)
 
+def package_from_rpms(filenames, workers=0, checksum_type=SHA256,
+                      location_base=None, changelog_limit=10, ordered=False):
+    """Iterator of :class:`.Package` objects from the rpm packages.
+
+    The packages are parsed by a pool of workers threads (0 - one per
+    CPU) without the GIL and yielded as they are done, or in the order
+    of the filenames if ordered is True. The location_href of every
+    package is its filename. A package which cannot be parsed raises
+    an exception from next(), the iteration could continue afterwards.
+    """
+    return _createrepo_c.package_from_rpms(list(filenames), checksum_type,
+                      location_base, changelog_limit, workers, ordered)
+
 def xml_from_rpm(filename, checksum_type=SHA256, location_href=None,
                      location_base=None, changelog_limit=10):
     """XML for the rpm package"""
@@ -304,6 +327,7 @@ xml_dump_filelists      = _createrepo_c.xml_dump_filelists
 xml_dump_other          =  _createrepo_c.xml_dump_other
 xml_dump_updaterecord   = _createrepo_c.xml_dump_updaterecord
 xml_dump                = _createrepo_c.xml_dump
+xml_dump_many           = _createrepo_c.xml_dump_many
 
 def xml_parse_primary(path, newpkgcb=None, pkgcb=None,
                       warningcb=None, do_files=1):
@@ -358,6 +382,34 @@ compression_suffix  = _createrepo_c.compression_suffix
 detect_compression  = _createrepo_c.detect_compression
 compression_type    = _createrepo_c.compression_type
 
+def createrepo(directory, **options):
+    """Generate the repodata of the directory in the process.
+
+    The options are the long options of the createrepo_c program with
+    underscores instead of dashes, e.g. createrepo(path, update=True,
+    workers=8, excludes=["*.src.rpm"]). True is a flag, False and None
+    leave the option out and a list repeats the option for every item.
+    The directory could be a list of directories for split=True.
+    Returns a dict with task_count, package_count, had_errors, exit_val
+    and repomd_path.
+    """
+    args = []
+    for name, value in sorted(options.items()):
+        opt = "--" + name.replace("_", "-")
+        if value is True:
+            args.append(opt)
+        elif value is False or value is None:
+            continue
+        elif isinstance(value, (list, tuple)):
+            args.extend("%s=%s" % (opt, item) for item in value)
+        else:
+            args.append("%s=%s" % (opt, value))
+    if isinstance(directory, str):
+        args.append(directory)
+    else:
+        args.extend(directory)
+    return _createrepo_c.createrepo(args)
+
 
 # If we have been built as a Python package, e.g. "setup.py", this is where the binaries
 # will be located.
@@ -25,6 +25,7 @@
 #include "checksum-py.h"
 #include "compression_wrapper-py.h"
 #include "contentstat-py.h"
+#include "createrepo-py.h"
 #include "exception-py.h"
 #include "load_metadata-py.h"
 #include "locate_metadata-py.h"
@@ -53,6 +54,8 @@ static struct PyMethodDef createrepo_c_methods[] = {
         METH_VARARGS | METH_KEYWORDS, package_from_rpm__doc__},
     {"xml_from_rpm",            (PyCFunction)py_xml_from_rpm,
         METH_VARARGS | METH_KEYWORDS, xml_from_rpm__doc__},
+    {"package_from_rpms",       (PyCFunction)py_package_from_rpms,
+        METH_VARARGS, package_from_rpms__doc__},
     {"xml_dump_primary",        (PyCFunction)py_xml_dump_primary,
         METH_VARARGS, xml_dump_primary__doc__},
     {"xml_dump_filelists",      (PyCFunction)py_xml_dump_filelists,
@@ -63,6 +66,8 @@ static struct PyMethodDef createrepo_c_methods[] = {
         METH_VARARGS, xml_dump_updaterecord__doc__},
     {"xml_dump",                (PyCFunction)py_xml_dump,
         METH_VARARGS, xml_dump__doc__},
+    {"xml_dump_many",           (PyCFunction)py_xml_dump_many,
+        METH_VARARGS | METH_KEYWORDS, xml_dump_many__doc__},
     {"xml_parse_primary",       (PyCFunction)py_xml_parse_primary,
         METH_VARARGS, xml_parse_primary__doc__},
     {"xml_parse_primary_snippet",(PyCFunction)py_xml_parse_primary_snippet,
@@ -93,6 +98,8 @@ static struct PyMethodDef createrepo_c_methods[] = {
         METH_VARARGS, detect_compression__doc__},
     {"compression_type",        (PyCFunction)py_compression_type,
         METH_VARARGS, compression_type__doc__},
+    {"createrepo",              (PyCFunction)py_createrepo,
+        METH_VARARGS, createrepo__doc__},
     {NULL, NULL, 0, NULL} /* sentinel */
 };
 
@@ -134,18 +141,33 @@ PyInit__createrepo_c(void)
     Py_INCREF(&CrFile_Type);
     PyModule_AddObject(m, "CrFile", (PyObject *)&CrFile_Type);
 
+    /* Iterator returned by _createrepo_c.package_from_rpms() */
+    if (PyType_Ready(&RpmBatch_Type) < 0)
+        return NULL;
+
     /* _createrepo_c.Package */
     if (PyType_Ready(&Package_Type) < 0)
         return NULL;
     Py_INCREF(&Package_Type);
     PyModule_AddObject(m, "Package", (PyObject *)&Package_Type);
 
+    /* _createrepo_c.PackageIterator */
+    if (PyType_Ready(&PackageIterator_Type) < 0)
+        return NULL;
+    Py_INCREF(&PackageIterator_Type);
+    PyModule_AddObject(m, "PackageIterator",
+                       (PyObject *)&PackageIterator_Type);
+
     /* _createrepo_c.Metadata */
     if (PyType_Ready(&Metadata_Type) < 0)
         return NULL;
     Py_INCREF(&Metadata_Type);
     PyModule_AddObject(m, "Metadata", (PyObject *)&Metadata_Type);
 
+    /* Iterator returned by _createrepo_c.Metadata.items() etc. */
+    if (PyType_Ready(&MetadataIter_Type) < 0)
+        return NULL;
+
     /* _createrepo_c.MetadataLocation */
     if (PyType_Ready(&MetadataLocation_Type) < 0)
         return NULL;
@@ -256,6 +278,7 @@ PyInit__createrepo_c(void)
     PyModule_AddIntConstant(m, "BZ2_COMPRESSION", CR_CW_BZ2_COMPRESSION);
     PyModule_AddIntConstant(m, "XZ_COMPRESSION", CR_CW_XZ_COMPRESSION);
     PyModule_AddIntConstant(m, "ZCK_COMPRESSION", CR_CW_ZCK_COMPRESSION);
+    PyModule_AddIntConstant(m, "ZSTD_COMPRESSION", CR_CW_ZSTD_COMPRESSION);
 
     /* Zchunk support */
 #ifdef WITH_ZCHUNK
@@ -264,6 +287,13 @@ PyInit__createrepo_c(void)
     PyModule_AddIntConstant(m, "HAS_ZCK", 0);
 #endif // WITH_ZCHUNK
 
+    /* Zstd support */
+#ifdef WITH_ZSTD
+    PyModule_AddIntConstant(m, "HAS_ZSTD", 1);
+#else
+    PyModule_AddIntConstant(m, "HAS_ZSTD", 0);
+#endif // WITH_ZSTD
+
     /* Load Metadata key values */
     PyModule_AddIntConstant(m, "HT_KEY_DEFAULT", CR_HT_KEY_DEFAULT);
     PyModule_AddIntConstant(m, "HT_KEY_HASH", CR_HT_KEY_HASH);
@@ -27,15 +27,70 @@
 #include "exception-py.h"
 #include "typeconversion.h"
 
-/* TODO:
- * keys() and records() method (same method - alias only)
- **/
-
 typedef struct {
     PyObject_HEAD
     cr_Metadata *md;
+    int loading;    /*!< Metadata are being loaded without the GIL */
+    GHashTable *wrappers;   /*!< cr_Package -> its Package object */
+    guint changes;  /*!< Number of modifications of the hashtable */
 } _MetadataObject;
 
+/** Package object of the package from the hashtable. The object is
+ * cached, so repeated lookups and iterations don't create new objects.
+ */
+static PyObject *
+metadata_wrap_package(_MetadataObject *self, cr_Package *pkg)
+{
+    PyObject *py_pkg = g_hash_table_lookup(self->wrappers, pkg);
+
+    if (!py_pkg) {
+        py_pkg = Object_FromPackage(pkg, 0);
+        if (!py_pkg)
+            return NULL;
+        g_hash_table_insert(self->wrappers, pkg, py_pkg);
+    }
+
+    Py_INCREF(py_pkg);
+    return py_pkg;
+}
+
+static void
+metadata_release_wrapper(PyObject *py_pkg)
+{
+    if (Py_REFCNT(py_pkg) > 1)
+        Package_Detach(py_pkg);
+    Py_DECREF(py_pkg);
+}
+
+/** Drop the cached Package object of the package (or of all the packages
+ * if pkg is NULL) before the package is freed. The objects still used
+ * elsewhere get their own copy of the package.
+ */
+static void
+metadata_forget_packages(_MetadataObject *self, cr_Package *pkg)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    self->changes++;
+    if (!self->wrappers)
+        return;
+
+    if (pkg) {
+        if ((value = g_hash_table_lookup(self->wrappers, pkg))) {
+            g_hash_table_remove(self->wrappers, pkg);
+            metadata_release_wrapper(value);
+        }
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, self->wrappers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_hash_table_iter_remove(&iter);
+        metadata_release_wrapper(value);
+    }
+}
+
 static int
 check_MetadataStatus(const _MetadataObject *self)
 {
@@ -45,6 +100,11 @@ check_MetadataStatus(const _MetadataObject *self)
         PyErr_SetString(PyExc_TypeError, "Improper createrepo_c Metadata object.");
         return -1;
     }
+    if (self->loading) {
+        PyErr_SetString(CrErr_Exception,
+            "Metadata object is being loaded by another thread.");
+        return -1;
+    }
     return 0;
 }
 
@@ -56,8 +116,12 @@ metadata_new(PyTypeObject *type,
              G_GNUC_UNUSED PyObject *kwds)
 {
     _MetadataObject *self = (_MetadataObject *)type->tp_alloc(type, 0);
-    if (self)
+    if (self) {
         self->md = NULL;
+        self->loading = 0;
+        self->wrappers = g_hash_table_new(g_direct_hash, g_direct_equal);
+        self->changes = 0;
+    }
     return (PyObject *)self;
 }
 
@@ -84,8 +148,15 @@ metadata_init(_MetadataObject *self, PyObject *args, PyObject *kwds)
                           &key, &use_single_chunk, &PyList_Type, &py_pkglist))
         return -1;
 
+    if (self->loading) {
+        PyErr_SetString(CrErr_Exception,
+            "Metadata object is being loaded by another thread.");
+        return -1;
+    }
+
     /* Free all previous resources when reinitialization */
     if (self->md) {
+        metadata_forget_packages(self, NULL);
         cr_metadata_free(self->md);
     }
 
@@ -103,6 +174,10 @@ metadata_init(_MetadataObject *self, PyObject *args, PyObject *kwds)
 static void
 metadata_dealloc(_MetadataObject *self)
 {
+    if (self->wrappers) {
+        metadata_forget_packages(self, NULL);
+        g_hash_table_destroy(self->wrappers);
+    }
     if (self->md)
         cr_metadata_free(self->md);
     Py_TYPE(self)->tp_free(self);
@@ -140,7 +215,9 @@ static PyObject *
 load_xml(_MetadataObject *self, PyObject *args)
 {
     PyObject *ml;
+    struct cr_MetadataLocation *c_ml;
     GError *tmp_err = NULL;
+    int rc;
 
     if (!PyArg_ParseTuple(args, "O!:load_xml", &MetadataLocation_Type, &ml))
         return NULL;
@@ -148,7 +225,20 @@ load_xml(_MetadataObject *self, PyObject *args)
     if (check_MetadataStatus(self))
         return NULL;
 
-    if (cr_metadata_load_xml(self->md, MetadataLocation_FromPyObject(ml), &tmp_err) != CRE_OK) {
+    // Already loaded packages could be removed as duplicates
+    metadata_forget_packages(self, NULL);
+
+    // The loading doesn't touch Python objects, other threads can run
+    c_ml = MetadataLocation_FromPyObject(ml);
+    Py_INCREF(ml);
+    self->loading = 1;
+    Py_BEGIN_ALLOW_THREADS
+    rc = cr_metadata_load_xml(self->md, c_ml, &tmp_err);
+    Py_END_ALLOW_THREADS
+    self->loading = 0;
+    Py_DECREF(ml);
+
+    if (rc != CRE_OK) {
         nice_exception(&tmp_err, NULL);
         return NULL;
     }
@@ -172,7 +262,12 @@ locate_and_load_xml(_MetadataObject *self, PyObject *args)
     if (check_MetadataStatus(self))
         return NULL;
 
+    metadata_forget_packages(self, NULL);
+    self->loading = 1;
+    Py_BEGIN_ALLOW_THREADS
     cr_metadata_locate_and_load_xml(self->md, path, &tmp_err);
+    Py_END_ALLOW_THREADS
+    self->loading = 0;
     if (tmp_err) {
         nice_exception(&tmp_err, NULL);
         return NULL;
@@ -283,9 +378,14 @@ ht_remove(_MetadataObject *self, PyObject *args)
     if (check_MetadataStatus(self))
         return NULL;
 
-    if (g_hash_table_remove(cr_metadata_hashtable(self->md), key))
-        Py_RETURN_TRUE;
-    Py_RETURN_FALSE;
+    GHashTable *ht = cr_metadata_hashtable(self->md);
+    cr_Package *pkg = g_hash_table_lookup(ht, key);
+    if (!pkg)
+        Py_RETURN_FALSE;
+
+    metadata_forget_packages(self, pkg);
+    g_hash_table_remove(ht, key);
+    Py_RETURN_TRUE;
 }
 
 PyDoc_STRVAR(get__doc__,
@@ -305,9 +405,181 @@ ht_get(_MetadataObject *self, PyObject *args)
     cr_Package *pkg = g_hash_table_lookup(cr_metadata_hashtable(self->md), key);
     if (!pkg)
         Py_RETURN_NONE;
-    return (Object_FromPackage_WithParent(pkg, 0, (PyObject *) self));
+    return metadata_wrap_package(self, pkg);
 }
 
+/* Iterators */
+
+typedef enum {
+    METADATA_ITER_KEYS,
+    METADATA_ITER_VALUES,
+    METADATA_ITER_ITEMS,
+} MetadataIterKind;
+
+typedef struct {
+    PyObject_HEAD
+    _MetadataObject *metadata;
+    GHashTableIter iter;
+    MetadataIterKind kind;
+    guint changes;      /*!< Modifications of the hashtable at creation */
+} _MetadataIterObject;
+
+static void
+metadataiter_dealloc(_MetadataIterObject *self)
+{
+    Py_XDECREF(self->metadata);
+    PyObject_Del(self);
+}
+
+static PyObject *
+metadataiter_iternext(_MetadataIterObject *self)
+{
+    _MetadataObject *md = self->metadata;
+    gpointer key, value;
+
+    if (!md)
+        return NULL;    // StopIteration
+
+    if (check_MetadataStatus(md))
+        return NULL;
+
+    if (md->changes != self->changes) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Metadata changed during iteration");
+        return NULL;
+    }
+
+    if (!g_hash_table_iter_next(&self->iter, &key, &value)) {
+        Py_CLEAR(self->metadata);
+        return NULL;    // StopIteration
+    }
+
+    switch (self->kind) {
+        case METADATA_ITER_KEYS:
+            return PyUnicode_FromString(key);
+        case METADATA_ITER_VALUES:
+            return metadata_wrap_package(md, value);
+        case METADATA_ITER_ITEMS:
+            return Py_BuildValue("(sN)", (char *) key,
+                                 metadata_wrap_package(md, value));
+    }
+
+    return NULL;
+}
+
+PyTypeObject MetadataIter_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "createrepo_c.MetadataIterator",
+    .tp_basicsize = sizeof(_MetadataIterObject),
+    .tp_dealloc = (destructor) metadataiter_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Iterator over Metadata",
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) metadataiter_iternext,
+};
+
+static PyObject *
+metadata_iterator(_MetadataObject *self, MetadataIterKind kind)
+{
+    _MetadataIterObject *it;
+
+    if (check_MetadataStatus(self))
+        return NULL;
+
+    it = PyObject_New(_MetadataIterObject, &MetadataIter_Type);
+    if (!it)
+        return NULL;
+
+    Py_INCREF(self);
+    it->metadata = self;
+    it->kind = kind;
+    it->changes = self->changes;
+    g_hash_table_iter_init(&it->iter, cr_metadata_hashtable(self->md));
+    return (PyObject *) it;
+}
+
+static PyObject *
+metadata_iter(_MetadataObject *self)
+{
+    return metadata_iterator(self, METADATA_ITER_KEYS);
+}
+
+PyDoc_STRVAR(iterkeys__doc__,
+"iterkeys() -> iterator\n\n"
+"Iterator over all keys");
+
+static PyObject *
+ht_iterkeys(_MetadataObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    return metadata_iterator(self, METADATA_ITER_KEYS);
+}
+
+PyDoc_STRVAR(values__doc__,
+"values() -> iterator\n\n"
+"Iterator over all packages");
+
+static PyObject *
+ht_values(_MetadataObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    return metadata_iterator(self, METADATA_ITER_VALUES);
+}
+
+PyDoc_STRVAR(items__doc__,
+"items() -> iterator\n\n"
+"Iterator over all (key, Package) pairs");
+
+static PyObject *
+ht_items(_MetadataObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    return metadata_iterator(self, METADATA_ITER_ITEMS);
+}
+
+/* Mapping and sequence protocols
+ * (no length, an empty Metadata object is still true) */
+
+static PyObject *
+metadata_subscript(_MetadataObject *self, PyObject *py_key)
+{
+    const char *key;
+
+    if (check_MetadataStatus(self))
+        return NULL;
+    if (!(key = PyUnicode_Check(py_key) ? PyUnicode_AsUTF8(py_key) : NULL)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_TypeError, "Metadata keys are strings");
+        return NULL;
+    }
+
+    cr_Package *pkg = g_hash_table_lookup(cr_metadata_hashtable(self->md), key);
+    if (!pkg) {
+        PyErr_SetObject(PyExc_KeyError, py_key);
+        return NULL;
+    }
+    return metadata_wrap_package(self, pkg);
+}
+
+static int
+metadata_contains(_MetadataObject *self, PyObject *py_key)
+{
+    const char *key;
+
+    if (check_MetadataStatus(self))
+        return -1;
+    if (!PyUnicode_Check(py_key))
+        return 0;
+    if (!(key = PyUnicode_AsUTF8(py_key)))
+        return -1;
+    return g_hash_table_contains(cr_metadata_hashtable(self->md), key);
+}
+
+static PyMappingMethods metadata_mapping = {
+    .mp_subscript = (binaryfunc) metadata_subscript,
+};
+
+static PySequenceMethods metadata_sequence = {
+    .sq_contains = (objobjproc) metadata_contains,
+};
+
 PyDoc_STRVAR(metadata_dupaction__doc__,
 ".. method:: dupaction(dupaction)\n\n"
 "    :arg dupation: What to do when we encounter already existing key.\n"
@@ -343,6 +615,9 @@ static struct PyMethodDef metadata_methods[] = {
     {"keys",    (PyCFunction)ht_keys, METH_NOARGS, keys__doc__},
     {"remove",  (PyCFunction)ht_remove, METH_VARARGS, remove__doc__},
     {"get",     (PyCFunction)ht_get, METH_VARARGS, get__doc__},
+    {"iterkeys",(PyCFunction)ht_iterkeys, METH_NOARGS, iterkeys__doc__},
+    {"values",  (PyCFunction)ht_values, METH_NOARGS, values__doc__},
+    {"items",   (PyCFunction)ht_items, METH_NOARGS, items__doc__},
     {"dupaction",(PyCFunction)metadata_dupaction, METH_VARARGS, metadata_dupaction__doc__},
     {NULL, NULL, 0, NULL} /* sentinel */
 };
@@ -355,9 +630,11 @@ PyTypeObject Metadata_Type = {
     .tp_basicsize = sizeof(_MetadataObject),
     .tp_dealloc = (destructor)metadata_dealloc,
     .tp_repr = (reprfunc)metadata_repr,
+    .tp_as_sequence = &metadata_sequence,
+    .tp_as_mapping = &metadata_mapping,
     .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
     .tp_doc = metadata_init__doc__,
-    .tp_iter = PyObject_SelfIter,
+    .tp_iter = (getiterfunc)metadata_iter,
     .tp_methods = metadata_methods,
     .tp_getset = metadata_getsetters,
     .tp_init = (initproc)metadata_init,
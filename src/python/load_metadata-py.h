@@ -26,4 +26,6 @@ extern PyTypeObject Metadata_Type;
 
 #define MetadataObject_Check(o)   PyObject_TypeCheck(o, &Metadata_Type)
 
+extern PyTypeObject MetadataIter_Type;
+
 #endif
@@ -25,13 +25,69 @@
 #include "exception-py.h"
 #include "typeconversion.h"
 
+/** Python object created from a string or a list member of the cr_Package.
+ * It is valid while the member points to the same C value, so changes
+ * done through another Package object of the same cr_Package are noticed.
+ */
+typedef struct {
+    const void *key;    /*!< Value of the member the obj was created from */
+    PyObject *obj;      /*!< str or tuple with the list items */
+} CachedMember;
+
+/** Number of pointers in cr_Package - every member has its own slot. */
+#define CACHE_SLOTS     (sizeof(cr_Package) / sizeof(gpointer) + 1)
+
 typedef struct {
     PyObject_HEAD
     cr_Package *package;
     int free_on_destroy;
     PyObject *parent;
+    CachedMember *cache; /*!< NULL or CACHE_SLOTS members */
 } _PackageObject;
 
+static PyObject *
+cache_get(_PackageObject *self, size_t offset, const void *key)
+{
+    CachedMember *member;
+
+    if (!self->cache)
+        return NULL;
+
+    member = &self->cache[offset / sizeof(gpointer)];
+    if (!member->obj || member->key != key)
+        return NULL;
+
+    Py_INCREF(member->obj);
+    return member->obj;
+}
+
+static void
+cache_set(_PackageObject *self, size_t offset, const void *key, PyObject *obj)
+{
+    CachedMember *member;
+
+    if (!self->cache)
+        self->cache = g_new0(CachedMember, CACHE_SLOTS);
+
+    member = &self->cache[offset / sizeof(gpointer)];
+    Py_XDECREF(member->obj);
+    Py_XINCREF(obj);
+    member->key = key;
+    member->obj = obj;
+}
+
+static void
+cache_clear(_PackageObject *self)
+{
+    if (!self->cache)
+        return;
+
+    for (size_t x = 0; x < CACHE_SLOTS; x++)
+        Py_XDECREF(self->cache[x].obj);
+    g_free(self->cache);
+    self->cache = NULL;
+}
+
 cr_Package *
 Package_FromPyObject(PyObject *o)
 {
@@ -42,6 +98,29 @@ Package_FromPyObject(PyObject *o)
     return ((_PackageObject *)o)->package;
 }
 
+/** Package of the object which could be modified. A package shared
+ * with copies of the object (see copy_pkg()) is copied first.
+ */
+static cr_Package *
+package_writable(_PackageObject *self)
+{
+    if (cr_package_is_shared(self->package)) {
+        self->package = cr_package_make_writable(self->package);
+        cache_clear(self);
+    }
+    return self->package;
+}
+
+cr_Package *
+Package_WritableFromPyObject(PyObject *o)
+{
+    if (!PackageObject_Check(o)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a createrepo_c.Package object.");
+        return NULL;
+    }
+    return package_writable((_PackageObject *)o);
+}
+
 PyObject *
 Object_FromPackage(cr_Package *pkg, int free_on_destroy)
 {
@@ -74,6 +153,19 @@ Object_FromPackage_WithParent(cr_Package *pkg, int free_on_destroy, PyObject *pa
     return pypkg;
 }
 
+void
+Package_Detach(PyObject *o)
+{
+    _PackageObject *self = (_PackageObject *) o;
+
+    assert(PackageObject_Check(o));
+    if (!self->package || self->free_on_destroy)
+        return;
+    self->package = cr_package_copy(self->package);
+    self->free_on_destroy = 1;
+    cache_clear(self);
+}
+
 static int
 check_PackageStatus(const _PackageObject *self)
 {
@@ -98,6 +190,7 @@ package_new(PyTypeObject *type,
         self->package = NULL;
         self->free_on_destroy = 1;
         self->parent = NULL;
+        self->cache = NULL;
     }
     return (PyObject *)self;
 }
@@ -121,6 +214,7 @@ package_init(_PackageObject *self, PyObject *args, PyObject *kwds)
         Py_DECREF(self->parent);
         self->parent = NULL;
     }
+    cache_clear(self);
 
     self->package = cr_package_new();
     if (self->package == NULL) {
@@ -139,6 +233,7 @@ package_dealloc(_PackageObject *self)
         Py_DECREF(self->parent);
         self->parent = NULL;
     }
+    cache_clear(self);
     Py_TYPE(self)->tp_free(self);
 }
 
@@ -211,12 +306,28 @@ PyDoc_STRVAR(copy__doc__,
 "copy() -> Package\n\n"
 "Copy of the package object");
 
+/** Copy of the package for a copy of the object. A package owned by
+ * the object with its own strings is shared instead, the setters copy it
+ * on the first modification (see package_writable()).
+ */
+static cr_Package *
+package_copy(_PackageObject *self)
+{
+    cr_Package *pkg = self->package;
+
+    if (self->free_on_destroy && !self->parent && pkg->chunk
+        && !(pkg->loadingflags & CR_PACKAGE_SINGLE_CHUNK))
+        return cr_package_ref(pkg);
+
+    return cr_package_copy(pkg);
+}
+
 static PyObject *
 copy_pkg(_PackageObject *self, G_GNUC_UNUSED void *nothing)
 {
     if (check_PackageStatus(self))
         return NULL;
-    return Object_FromPackage(cr_package_copy(self->package), 1);
+    return Object_FromPackage(package_copy(self), 1);
 }
 
 static PyObject *
@@ -228,7 +339,7 @@ deepcopy_pkg(_PackageObject *self, PyObject *args)
         return NULL;
     if (check_PackageStatus(self))
         return NULL;
-    return Object_FromPackage(cr_package_copy(self->package), 1);
+    return Object_FromPackage(package_copy(self), 1);
 }
 
 static struct PyMethodDef package_methods[] = {
@@ -259,9 +370,14 @@ get_str(_PackageObject *self, void *member_offset)
         return NULL;
     cr_Package *pkg = self->package;
     char *str = *((char **) ((size_t) pkg + (size_t) member_offset));
+    PyObject *pystr;
     if (str == NULL)
         Py_RETURN_NONE;
-    return PyUnicode_FromString(str);
+    if ((pystr = cache_get(self, (size_t) member_offset, str)))
+        return pystr;
+    if ((pystr = PyUnicode_FromString(str)))
+        cache_set(self, (size_t) member_offset, str, pystr);
+    return pystr;
 }
 
 /** Return offset of a selected member of cr_Package structure. */
@@ -345,13 +461,24 @@ static PyObject *
 get_list(_PackageObject *self, void *conv)
 {
     ListConvertor *convertor = conv;
-    PyObject *list;
-    cr_Package *pkg = self->package;
-    GSList *glist = *((GSList **) ((size_t) pkg + (size_t) convertor->offset));
+    PyObject *list, *items;
+    cr_Package *pkg;
+    GSList *glist;
 
     if (check_PackageStatus(self))
         return NULL;
 
+    pkg = self->package;
+    glist = *((GSList **) ((size_t) pkg + (size_t) convertor->offset));
+
+    // The items are converted only once, every call returns a new list
+    // of the same (immutable) tuples
+    if ((items = cache_get(self, convertor->offset, glist))) {
+        list = PySequence_List(items);
+        Py_DECREF(items);
+        return list;
+    }
+
     if ((list = PyList_New(0)) == NULL)
         return NULL;
 
@@ -362,6 +489,15 @@ get_list(_PackageObject *self, void *conv)
         Py_DECREF(obj);
     }
 
+    if (glist) {
+        if ((items = PyList_AsTuple(list)) == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        cache_set(self, convertor->offset, glist, items);
+        Py_DECREF(items);
+    }
+
     return list;
 }
 
@@ -381,7 +517,7 @@ set_num(_PackageObject *self, PyObject *value, void *member_offset)
         PyErr_SetString(PyExc_TypeError, "Number expected!");
         return -1;
     }
-    cr_Package *pkg = self->package;
+    cr_Package *pkg = package_writable(self);
     *((gint64 *) ((size_t) pkg + (size_t) member_offset)) = val;
     return 0;
 }
@@ -395,7 +531,7 @@ set_str(_PackageObject *self, PyObject *value, void *member_offset)
         PyErr_SetString(PyExc_TypeError, "Unicode, bytes, or None expected!");
         return -1;
     }
-    cr_Package *pkg = self->package;
+    cr_Package *pkg = package_writable(self);
 
     if (value == Py_None) {
         // If value is None exist right now (avoid possibly
@@ -452,11 +588,12 @@ static int
 set_list(_PackageObject *self, PyObject *list, void *conv)
 {
     ListConvertor *convertor = conv;
-    cr_Package *pkg = self->package;
+    cr_Package *pkg;
     GSList *glist = NULL;
 
     if (check_PackageStatus(self))
         return -1;
+    pkg = package_writable(self);
 
     if (!PyList_Check(list)) {
         PyErr_SetString(PyExc_TypeError, "List expected!");
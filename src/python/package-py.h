@@ -28,6 +28,12 @@ extern PyTypeObject Package_Type;
 
 PyObject *Object_FromPackage(cr_Package *pkg, int free_on_destroy);
 cr_Package *Package_FromPyObject(PyObject *o);
+cr_Package *Package_WritableFromPyObject(PyObject *o);
 PyObject * Object_FromPackage_WithParent(cr_Package *pkg, int free_on_destroy, PyObject *parent);
 
+/** Give the object its own copy of a package it doesn't own. Used before
+ * the owner of the package frees it while the object is still alive.
+ */
+void Package_Detach(PyObject *o);
+
 #endif
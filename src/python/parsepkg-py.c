@@ -47,9 +47,11 @@ py_package_from_rpm(G_GNUC_UNUSED PyObject *self, PyObject *args)
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS
     pkg = cr_package_from_rpm(filename, checksum_type, location_href,
                               location_base, changelog_limit, NULL,
                               flags, &tmp_err);
+    Py_END_ALLOW_THREADS
     if (tmp_err) {
         nice_exception(&tmp_err, "Cannot load %s: ", filename);
         return NULL;
@@ -77,8 +79,10 @@ py_xml_from_rpm(G_GNUC_UNUSED PyObject *self, PyObject *args)
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS
     xml_res = cr_xml_from_rpm(filename, checksum_type, location_href,
                               location_base, changelog_limit, NULL, &tmp_err);
+    Py_END_ALLOW_THREADS
     if (tmp_err) {
         nice_exception(&tmp_err, "Cannot load %s: ", filename);
         return NULL;
@@ -99,3 +103,205 @@ py_xml_from_rpm_end:
     return tuple;
 }
 
+
+/* Parsing of more rpms by a pool of C threads */
+
+typedef struct {
+    guint index;            /*!< Position in the list of paths */
+    gchar *path;
+    cr_Package *pkg;
+    GError *err;
+} RpmTask;
+
+typedef struct {
+    PyObject_HEAD
+    GThreadPool *pool;
+    GAsyncQueue *done;      /*!< Parsed RpmTasks */
+    GHashTable *pending;    /*!< Parsed RpmTasks waiting for their turn
+                                 (ordered mode only) */
+    guint total;            /*!< Number of all the paths */
+    guint yielded;          /*!< Number of already returned results */
+    int ordered;
+    int checksum_type;
+    int changelog_limit;
+    gchar *location_base;
+    gint cancelled;         /*!< Workers skip the rest of the paths */
+} _RpmBatchObject;
+
+static void
+rpmtask_free(RpmTask *task)
+{
+    if (!task)
+        return;
+    g_free(task->path);
+    cr_package_free(task->pkg);
+    if (task->err)
+        g_error_free(task->err);
+    g_free(task);
+}
+
+static void
+rpmbatch_worker(gpointer data, gpointer user_data)
+{
+    RpmTask *task = data;
+    _RpmBatchObject *self = user_data;
+
+    // Runs without the GIL, it touches no Python object
+    if (!g_atomic_int_get(&self->cancelled))
+        task->pkg = cr_package_from_rpm(task->path, self->checksum_type,
+                                        task->path, self->location_base,
+                                        self->changelog_limit, NULL,
+                                        CR_HDRR_NONE, &task->err);
+    g_async_queue_push(self->done, task);
+}
+
+static void
+rpmbatch_dealloc(_RpmBatchObject *self)
+{
+    if (self->pool) {
+        // Wait for the running workers, the queued paths are skipped
+        g_atomic_int_set(&self->cancelled, 1);
+        Py_BEGIN_ALLOW_THREADS
+        g_thread_pool_free(self->pool, FALSE, TRUE);
+        Py_END_ALLOW_THREADS
+    }
+    if (self->done)
+        g_async_queue_unref(self->done);
+    if (self->pending)
+        g_hash_table_destroy(self->pending);
+    g_free(self->location_base);
+    PyObject_Del(self);
+}
+
+static PyObject *
+rpmbatch_iternext(_RpmBatchObject *self)
+{
+    RpmTask *task;
+    PyObject *ret;
+
+    if (self->yielded == self->total)
+        return NULL;    // StopIteration
+
+    if (self->ordered) {
+        gpointer key = GUINT_TO_POINTER(self->yielded);
+        while (!(task = g_hash_table_lookup(self->pending, key))) {
+            Py_BEGIN_ALLOW_THREADS
+            task = g_async_queue_pop(self->done);
+            Py_END_ALLOW_THREADS
+            g_hash_table_insert(self->pending,
+                                GUINT_TO_POINTER(task->index), task);
+        }
+        g_hash_table_steal(self->pending, key);
+    } else {
+        Py_BEGIN_ALLOW_THREADS
+        task = g_async_queue_pop(self->done);
+        Py_END_ALLOW_THREADS
+    }
+    self->yielded++;
+
+    if (task->err) {
+        nice_exception(&task->err, "Cannot load %s: ", task->path);
+        rpmtask_free(task);
+        return NULL;
+    }
+
+    ret = Object_FromPackage(task->pkg, 1);
+    task->pkg = NULL;
+    rpmtask_free(task);
+    return ret;
+}
+
+PyTypeObject RpmBatch_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "createrepo_c.RpmBatch",
+    .tp_basicsize = sizeof(_RpmBatchObject),
+    .tp_dealloc = (destructor) rpmbatch_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Iterator of packages parsed by package_from_rpms()",
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) rpmbatch_iternext,
+};
+
+PyObject *
+py_package_from_rpms(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    PyObject *py_paths, *seq;
+    int checksum_type, changelog_limit, workers, ordered;
+    char *location_base;
+    _RpmBatchObject *batch;
+    GPtrArray *paths;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "Oiziii:py_package_from_rpms",
+                                         &py_paths,
+                                         &checksum_type,
+                                         &location_base,
+                                         &changelog_limit,
+                                         &workers,
+                                         &ordered)) {
+        return NULL;
+    }
+
+    seq = PySequence_Fast(py_paths, "paths must be a sequence of strings");
+    if (!seq)
+        return NULL;
+
+    paths = g_ptr_array_new_with_free_func(g_free);
+    for (Py_ssize_t x = 0; x < PySequence_Fast_GET_SIZE(seq); x++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, x);
+        const char *path = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item)
+                                                 : NULL;
+        if (!path) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError,
+                                "paths must be a sequence of strings");
+            g_ptr_array_free(paths, TRUE);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        g_ptr_array_add(paths, g_strdup(path));
+    }
+    Py_DECREF(seq);
+
+    if (workers <= 0)
+        workers = g_get_num_processors();
+
+    batch = PyObject_New(_RpmBatchObject, &RpmBatch_Type);
+    if (!batch) {
+        g_ptr_array_free(paths, TRUE);
+        return NULL;
+    }
+    batch->pool = NULL;
+    // The results are freed by rpmtask_free() if they are not consumed
+    batch->done = g_async_queue_new_full((GDestroyNotify) rpmtask_free);
+    batch->pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL,
+                                           (GDestroyNotify) rpmtask_free);
+    batch->total = 0;
+    batch->yielded = 0;
+    batch->ordered = ordered;
+    batch->checksum_type = checksum_type;
+    batch->changelog_limit = changelog_limit;
+    batch->location_base = g_strdup(location_base);
+    batch->cancelled = 0;
+
+    batch->pool = g_thread_pool_new(rpmbatch_worker, batch, workers, TRUE,
+                                    &tmp_err);
+    if (!batch->pool) {
+        nice_exception(&tmp_err, "Cannot create a thread pool: ");
+        g_ptr_array_free(paths, TRUE);
+        Py_DECREF(batch);
+        return NULL;
+    }
+
+    for (guint x = 0; x < paths->len; x++) {
+        RpmTask *task = g_new0(RpmTask, 1);
+        task->index = batch->total++;
+        task->path = paths->pdata[x];
+        g_thread_pool_push(batch->pool, task, NULL);
+    }
+
+    // The tasks own the paths now
+    g_free(g_ptr_array_free(paths, FALSE));
+    return (PyObject *) batch;
+}
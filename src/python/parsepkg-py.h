@@ -36,4 +36,13 @@ PyDoc_STRVAR(xml_from_rpm__doc__,
 
 PyObject *py_xml_from_rpm(PyObject *self, PyObject *args);
 
+extern PyTypeObject RpmBatch_Type;
+
+PyDoc_STRVAR(package_from_rpms__doc__,
+"package_from_rpms(filenames, checksum_type, location_base, "
+"changelog_limit, workers, ordered) -> iterator of Package\n\n"
+"Package objects from the rpm packages parsed by a pool of threads");
+
+PyObject *py_package_from_rpms(PyObject *self, PyObject *args);
+
 #endif
@@ -26,9 +26,13 @@
 #include "exception-py.h"
 #include "typeconversion.h"
 
+// Packages added by add_pkgs() without the GIL at once
+#define ADD_PKGS_BATCH  1024
+
 typedef struct {
     PyObject_HEAD
     cr_SqliteDb *db;
+    int busy;           // add_pkgs() works with the db without the GIL
 } _SqliteObject;
 
 // Forward declaration
@@ -45,6 +49,11 @@ check_SqliteStatus(const _SqliteObject *self)
             "Improper createrepo_c Sqlite object (Already closed db?)");
         return -1;
     }
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "Sqlite object is used by another thread");
+        return -1;
+    }
     return 0;
 }
 
@@ -56,8 +65,10 @@ sqlite_new(PyTypeObject *type,
            G_GNUC_UNUSED PyObject *kwds)
 {
     _SqliteObject *self = (_SqliteObject *)type->tp_alloc(type, 0);
-    if (self)
+    if (self) {
         self->db = NULL;
+        self->busy = 0;
+    }
     return (PyObject *)self;
 }
 
@@ -146,7 +157,8 @@ add_pkg(_SqliteObject *self, PyObject *args)
     if (check_SqliteStatus(self))
         return NULL;
 
-    cr_db_add_pkg(self->db, Package_FromPyObject(py_pkg), &err);
+    // The pkgKey of the package is set
+    cr_db_add_pkg(self->db, Package_WritableFromPyObject(py_pkg), &err);
     if (err) {
         nice_exception(&err, NULL);
         return NULL;
@@ -155,6 +167,107 @@ add_pkg(_SqliteObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(add_pkgs__doc__,
+"add_pkgs(packages) -> int\n\n"
+"Add all Packages from an iterable to the database, return their count.\n"
+"The packages are inserted in batches without holding the GIL.\n"
+"All packages go into the single transaction of the database, indexes\n"
+"are created when the database is closed.");
+
+/** Insert the packages of a batch into the db without the GIL.
+ * The objects of the batch are released.
+ */
+static int
+add_pkgs_batch(_SqliteObject *self,
+               PyObject **py_pkgs,
+               cr_Package **pkgs,
+               guint count,
+               GError **err)
+{
+    int rc = CRE_OK;
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    for (guint x = 0; x < count && rc == CRE_OK; x++)
+        rc = cr_db_add_pkg(self->db, pkgs[x], err);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+
+    for (guint x = 0; x < count; x++)
+        Py_DECREF(py_pkgs[x]);
+
+    return rc;
+}
+
+static PyObject *
+add_pkgs(_SqliteObject *self, PyObject *args)
+{
+    PyObject *py_iterable, *iter, *item;
+    PyObject *py_pkgs[ADD_PKGS_BATCH];
+    cr_Package *pkgs[ADD_PKGS_BATCH];
+    guint count = 0;
+    long added = 0;
+    GError *err = NULL;
+
+    if (!PyArg_ParseTuple(args, "O:add_pkgs", &py_iterable))
+        return NULL;
+
+    if (check_SqliteStatus(self))
+        return NULL;
+
+    iter = PyObject_GetIter(py_iterable);
+    if (!iter)
+        return NULL;
+
+    while ((item = PyIter_Next(iter))) {
+        if (!PackageObject_Check(item)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "Expected createrepo_c.Package objects");
+            Py_DECREF(item);
+            break;
+        }
+
+        // The iterator could use the db, it's checked for every package
+        if (check_SqliteStatus(self)) {
+            Py_DECREF(item);
+            break;
+        }
+
+        // Reference to the package is kept until the batch is inserted
+        py_pkgs[count] = item;
+        pkgs[count] = Package_WritableFromPyObject(item);
+        if (++count < ADD_PKGS_BATCH)
+            continue;
+
+        add_pkgs_batch(self, py_pkgs, pkgs, count, &err);
+        added += count;
+        count = 0;
+        if (err)
+            break;
+    }
+    Py_DECREF(iter);
+
+    if (PyErr_Occurred()) {
+        // Packages of an unfinished batch are not inserted
+        for (guint x = 0; x < count; x++)
+            Py_DECREF(py_pkgs[x]);
+        g_clear_error(&err);
+        return NULL;
+    }
+
+    if (!err && count) {
+        add_pkgs_batch(self, py_pkgs, pkgs, count, &err);
+        added += count;
+    }
+
+    if (err) {
+        nice_exception(&err, NULL);
+        return NULL;
+    }
+
+    return PyLong_FromLong(added);
+}
+
 PyDoc_STRVAR(dbinfo_update__doc__,
 "dbinfo_update(checksum) -> None\n\n"
 "Set checksum of the xml file representing same data");
@@ -189,6 +302,12 @@ close_db(_SqliteObject *self, G_GNUC_UNUSED void *nothing)
 {
     GError *err = NULL;
 
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "Sqlite object is used by another thread");
+        return NULL;
+    }
+
     if (self->db) {
         cr_db_close(self->db, &err);
         self->db = NULL;
@@ -204,6 +323,8 @@ close_db(_SqliteObject *self, G_GNUC_UNUSED void *nothing)
 static struct PyMethodDef sqlite_methods[] = {
     {"add_pkg", (PyCFunction)add_pkg, METH_VARARGS,
         add_pkg__doc__},
+    {"add_pkgs", (PyCFunction)add_pkgs, METH_VARARGS,
+        add_pkgs__doc__},
     {"dbinfo_update", (PyCFunction)dbinfo_update, METH_VARARGS,
         dbinfo_update__doc__},
     {"close", (PyCFunction)close_db, METH_NOARGS,
@@ -146,11 +146,78 @@ xml_dump(_UpdateInfoObject *self, G_GNUC_UNUSED void *nothing)
     return py_str;
 }
 
+PyDoc_STRVAR(get_record__doc__,
+"get_record(id) -> UpdateRecord or None\n\n"
+"Find the UpdateRecord (a copy of it) by its id");
+
+static PyObject *
+get_record(_UpdateInfoObject *self, PyObject *args)
+{
+    char *id;
+    cr_UpdateRecord *rec;
+
+    if (!PyArg_ParseTuple(args, "s:get_record", &id))
+        return NULL;
+    if (check_UpdateInfoStatus(self))
+        return NULL;
+
+    rec = cr_updateinfo_get_record(self->updateinfo, id);
+    if (!rec)
+        Py_RETURN_NONE;
+    return Object_FromUpdateRecord(cr_updaterecord_copy(rec));
+}
+
+PyDoc_STRVAR(get_records_by_package__doc__,
+"get_records_by_package(name, epoch=None, version=None, release=None, "
+"arch=None) -> list\n\n"
+"List of UpdateRecords (copies of them) which reference the package. "
+"Without the version the packages are matched by the name only");
+
+static PyObject *
+get_records_by_package(_UpdateInfoObject *self,
+                       PyObject *args,
+                       PyObject *kwargs)
+{
+    static char *kwlist[] = { "name", "epoch", "version", "release", "arch",
+                              NULL };
+    char *name, *epoch = NULL, *version = NULL, *release = NULL, *arch = NULL;
+    GPtrArray *records;
+    PyObject *list;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+                                     "s|zzzz:get_records_by_package", kwlist,
+                                     &name, &epoch, &version, &release,
+                                     &arch))
+        return NULL;
+    if (check_UpdateInfoStatus(self))
+        return NULL;
+
+    if ((list = PyList_New(0)) == NULL)
+        return NULL;
+
+    records = cr_updateinfo_get_records_by_package(self->updateinfo, name,
+                                                   epoch, version, release,
+                                                   arch);
+    for (guint x = 0; records && x < records->len; x++) {
+        PyObject *obj = Object_FromUpdateRecord(
+                            cr_updaterecord_copy(records->pdata[x]));
+        if (!obj) continue;
+        PyList_Append(list, obj);
+        Py_DECREF(obj);
+    }
+
+    return list;
+}
+
 static struct PyMethodDef updateinfo_methods[] = {
     {"append", (PyCFunction)append, METH_VARARGS,
         append__doc__},
     {"xml_dump", (PyCFunction)xml_dump, METH_NOARGS,
         xml_dump__doc__},
+    {"get_record", (PyCFunction)get_record, METH_VARARGS,
+        get_record__doc__},
+    {"get_records_by_package", (PyCFunction)get_records_by_package,
+        METH_VARARGS | METH_KEYWORDS, get_records_by_package__doc__},
     {NULL, NULL, 0, NULL} /* sentinel */
 };
 
@@ -27,6 +27,10 @@
 #include "package-py.h"
 #include "exception-py.h"
 #include "updaterecord-py.h"
+#include "xml_file-py.h"
+
+// Packages dumped at once by xml_dump_many()
+#define XML_DUMP_MANY_BATCH     4096
 
 PyObject *
 py_xml_dump_primary(G_GNUC_UNUSED PyObject *self, PyObject *args)
@@ -128,6 +132,185 @@ py_xml_dump(G_GNUC_UNUSED PyObject *self, PyObject *args)
     return tuple;
 }
 
+/** A batch of packages dumped by the threads of xml_dump_many().
+ */
+typedef struct {
+    cr_Package **pkgs;
+    struct cr_XmlStruct *res;
+    GError **errs;
+    guint count;
+    gint next;          // Index of the next package to dump (atomic)
+} XmlDumpBatch;
+
+static void
+xml_dump_many_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    XmlDumpBatch *batch = data;
+    gint x;
+
+    while ((x = g_atomic_int_add(&batch->next, 1)) < (gint) batch->count)
+        batch->res[x] = cr_xml_dump(batch->pkgs[x], &batch->errs[x]);
+}
+
+static void
+xml_dump_batch(XmlDumpBatch *batch, int workers)
+{
+    GThreadPool *pool = NULL;
+
+    batch->next = 0;
+    if (workers > 1 && batch->count > 1)
+        pool = g_thread_pool_new(xml_dump_many_thread, NULL,
+                                 MIN((guint) workers, batch->count),
+                                 TRUE, NULL);
+
+    if (pool) {
+        for (int x = 0; x < workers; x++)
+            g_thread_pool_push(pool, batch, NULL);
+        g_thread_pool_free(pool, FALSE, TRUE);  // Wait for the threads
+    } else {
+        xml_dump_many_thread(batch, NULL);
+    }
+}
+
+/** Write the dumped chunks of the batch into the XmlFile objects
+ * (Py_None is skipped) or append tuples of them to the list.
+ */
+static int
+xml_dump_batch_output(XmlDumpBatch *batch,
+                      PyObject *list,
+                      PyObject *py_files[3])
+{
+    if (list) {
+        for (guint x = 0; x < batch->count; x++) {
+            PyObject *tuple = Py_BuildValue("(NNN)",
+                    PyUnicodeOrNone_FromString(batch->res[x].primary),
+                    PyUnicodeOrNone_FromString(batch->res[x].filelists),
+                    PyUnicodeOrNone_FromString(batch->res[x].other));
+            if (!tuple || PyList_Append(list, tuple)) {
+                Py_XDECREF(tuple);
+                return -1;
+            }
+            Py_DECREF(tuple);
+        }
+        return 0;
+    }
+
+    char **chunks = g_new(char *, batch->count);
+    int ret = 0;
+    for (int type = 0; type < 3 && !ret; type++) {
+        if (py_files[type] == Py_None)
+            continue;
+        for (guint x = 0; x < batch->count; x++)
+            chunks[x] = (type == 0) ? batch->res[x].primary
+                      : (type == 1) ? batch->res[x].filelists
+                      : batch->res[x].other;
+        ret = XmlFile_AddChunks(py_files[type], chunks, batch->count);
+    }
+    g_free(chunks);
+    return ret;
+}
+
+PyObject *
+py_xml_dump_many(G_GNUC_UNUSED PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *py_pkgs, *seq, *list = NULL;
+    PyObject *py_files[3] = { Py_None, Py_None, Py_None };
+    int workers = 1, ret = 0;
+    XmlDumpBatch batch;
+    GError *err = NULL;
+    static char *kwlist[] = { "packages", "workers", "primary", "filelists",
+                              "other", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iOOO:xml_dump_many",
+                                     kwlist, &py_pkgs, &workers, &py_files[0],
+                                     &py_files[1], &py_files[2]))
+        return NULL;
+
+    gboolean to_files = FALSE;
+    for (int x = 0; x < 3; x++) {
+        if (py_files[x] == Py_None)
+            continue;
+        if (!XmlFileObject_Check(py_files[x])) {
+            PyErr_SetString(PyExc_TypeError, "Use XmlFile or None");
+            return NULL;
+        }
+        to_files = TRUE;
+    }
+
+    // The sequence holds references of all the packages
+    seq = PySequence_Fast(py_pkgs, "Expected an iterable of Packages");
+    if (!seq)
+        return NULL;
+
+    Py_ssize_t total = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for (Py_ssize_t x = 0; x < total; x++) {
+        if (!PackageObject_Check(items[x])) {
+            PyErr_SetString(PyExc_TypeError, "Expected createrepo_c.Package objects");
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+
+    if (!to_files && !(list = PyList_New(0))) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    guint batch_size = MIN(total, XML_DUMP_MANY_BATCH);
+    batch.pkgs = g_new(cr_Package *, batch_size);
+    batch.res = g_new(struct cr_XmlStruct, batch_size);
+    batch.errs = g_new(GError *, batch_size);
+
+    for (Py_ssize_t start = 0; start < total && !ret; start += batch_size) {
+        batch.count = MIN(batch_size, total - start);
+        for (guint x = 0; x < batch.count; x++) {
+            batch.pkgs[x] = Package_FromPyObject(items[start + x]);
+            batch.errs[x] = NULL;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        xml_dump_batch(&batch, workers);
+        Py_END_ALLOW_THREADS
+
+        // The first error of the batch is reported
+        for (guint x = 0; x < batch.count; x++) {
+            if (batch.errs[x] && !err)
+                err = batch.errs[x];
+            else
+                g_clear_error(&batch.errs[x]);
+        }
+
+        if (!err)
+            ret = xml_dump_batch_output(&batch, list, py_files);
+
+        for (guint x = 0; x < batch.count; x++) {
+            free(batch.res[x].primary);
+            free(batch.res[x].filelists);
+            free(batch.res[x].other);
+        }
+
+        if (err) {
+            nice_exception(&err, NULL);
+            ret = -1;
+        }
+    }
+
+    g_free(batch.pkgs);
+    g_free(batch.res);
+    g_free(batch.errs);
+    Py_DECREF(seq);
+
+    if (ret) {
+        Py_XDECREF(list);
+        return NULL;
+    }
+
+    if (!list)
+        Py_RETURN_NONE;
+    return list;
+}
+
 PyObject *
 py_xml_dump_updaterecord(G_GNUC_UNUSED PyObject *self, PyObject *args)
 {
@@ -46,6 +46,17 @@ PyDoc_STRVAR(xml_dump__doc__,
 
 PyObject *py_xml_dump(PyObject *self, PyObject *args);
 
+PyDoc_STRVAR(xml_dump_many__doc__,
+"xml_dump_many(packages, workers=1, primary=None, filelists=None, other=None)"
+" -> list or None\n\n"
+"Generate primary, filelists and other xml chunks from many packages\n"
+"by workers threads without the GIL. If any of primary, filelists\n"
+"and other XmlFile objects is specified, chunks are written into\n"
+"the files (in the order of the packages) and None is returned,\n"
+"otherwise a list of (primary, filelists, other) tuples is returned");
+
+PyObject *py_xml_dump_many(PyObject *self, PyObject *args, PyObject *kwargs);
+
 PyDoc_STRVAR(xml_dump_updaterecord__doc__,
 "xml_dump_updaterecord(pkg) -> str\n\n"
 "Generate xml chunk from UpdateRecord");
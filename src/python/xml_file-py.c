@@ -31,6 +31,7 @@ typedef struct {
     PyObject_HEAD
     cr_XmlFile *xmlfile;
     PyObject *py_stat;
+    int busy;       /*!< The file is used without the GIL */
 } _XmlFileObject;
 
 static PyObject * xmlfile_close(_XmlFileObject *self, void *nothing);
@@ -45,6 +46,35 @@ check_XmlFileStatus(const _XmlFileObject *self)
             "Improper createrepo_c XmlFile object (Already closed file?).");
         return -1;
     }
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "XmlFile object is being used by another thread.");
+        return -1;
+    }
+    return 0;
+}
+
+int
+XmlFile_AddChunks(PyObject *o, char **chunks, guint count)
+{
+    _XmlFileObject *self = (_XmlFileObject *) o;
+    GError *err = NULL;
+
+    if (check_XmlFileStatus(self))
+        return -1;
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    for (guint x = 0; x < count && !err; x++)
+        cr_xmlfile_add_chunk(self->xmlfile, chunks[x], &err);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+
+    if (err) {
+        nice_exception(&err, NULL);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -59,6 +89,7 @@ xmlfile_new(PyTypeObject *type,
     if (self) {
         self->xmlfile = NULL;
         self->py_stat = NULL;
+        self->busy = 0;
     }
     return (PyObject *)self;
 }
@@ -248,6 +279,12 @@ xmlfile_close(_XmlFileObject *self, G_GNUC_UNUSED void *nothing)
 {
     GError *err = NULL;
 
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "XmlFile object is being used by another thread.");
+        return NULL;
+    }
+
     if (self->xmlfile) {
         cr_xmlfile_close(self->xmlfile, &err);
         self->xmlfile = NULL;
@@ -26,4 +26,12 @@ extern PyTypeObject XmlFile_Type;
 
 #define XmlFileObject_Check(o)   PyObject_TypeCheck(o, &XmlFile_Type)
 
+/** Add chunks into an XmlFile object (without the GIL).
+ * @param o         XmlFile object
+ * @param chunks    xml chunks (NULLs are skipped)
+ * @param count     number of the chunks
+ * @return          0 or -1 with an exception set
+ */
+int XmlFile_AddChunks(PyObject *o, char **chunks, guint count);
+
 #endif
@@ -35,10 +35,19 @@ typedef struct {
     PyObject *py_pkgcb;
     PyObject *py_warningcb;
     PyObject *py_pkg;       /*!< Current processed package */
+    PyThreadState *thread_state; /*!< Saved while the C parser runs
+                                      without the GIL */
 } CbData;
 
+/* The parsing runs without the GIL, so other Python threads could run
+ * meanwhile. The callbacks take it back only while they call Python. */
+#define CB_ALLOW_THREADS(data) \
+    ((data)->thread_state = PyEval_SaveThread())
+#define CB_END_ALLOW_THREADS(data) \
+    PyEval_RestoreThread((data)->thread_state)
+
 static int
-c_newpkgcb(cr_Package **pkg,
+newpkgcb(cr_Package **pkg,
            const char *pkgId,
            const char *name,
            const char *arch,
@@ -76,7 +85,8 @@ c_newpkgcb(cr_Package **pkg,
         data->py_pkg = NULL;
         Py_DECREF(result);
     } else {
-        *pkg = Package_FromPyObject(result);
+        // The parser fills the package
+        *pkg = Package_WritableFromPyObject(result);
         data->py_pkg = result; // Store reference to current package
     }
 
@@ -84,9 +94,9 @@ c_newpkgcb(cr_Package **pkg,
 }
 
 static int
-c_pkgcb(cr_Package *pkg,
-        void *cbdata,
-        GError **err)
+pkgcb(cr_Package *pkg,
+      void *cbdata,
+      GError **err)
 {
     PyObject *arglist, *result, *py_pkg;
     CbData *data = cbdata;
@@ -113,10 +123,10 @@ c_pkgcb(cr_Package *pkg,
 }
 
 static int
-c_warningcb(cr_XmlParserWarningType type,
-            char *msg,
-            void *cbdata,
-            GError **err)
+warningcb(cr_XmlParserWarningType type,
+          char *msg,
+          void *cbdata,
+          GError **err)
 {
     PyObject *arglist, *result;
     CbData *data = cbdata;
@@ -135,6 +145,46 @@ c_warningcb(cr_XmlParserWarningType type,
     return CR_CB_RET_OK;
 }
 
+static int
+c_newpkgcb(cr_Package **pkg,
+           const char *pkgId,
+           const char *name,
+           const char *arch,
+           void *cbdata,
+           GError **err)
+{
+    int ret;
+    CB_END_ALLOW_THREADS((CbData *) cbdata);
+    ret = newpkgcb(pkg, pkgId, name, arch, cbdata, err);
+    CB_ALLOW_THREADS((CbData *) cbdata);
+    return ret;
+}
+
+static int
+c_pkgcb(cr_Package *pkg,
+        void *cbdata,
+        GError **err)
+{
+    int ret;
+    CB_END_ALLOW_THREADS((CbData *) cbdata);
+    ret = pkgcb(pkg, cbdata, err);
+    CB_ALLOW_THREADS((CbData *) cbdata);
+    return ret;
+}
+
+static int
+c_warningcb(cr_XmlParserWarningType type,
+            char *msg,
+            void *cbdata,
+            GError **err)
+{
+    int ret;
+    CB_END_ALLOW_THREADS((CbData *) cbdata);
+    ret = warningcb(type, msg, cbdata, err);
+    CB_ALLOW_THREADS((CbData *) cbdata);
+    return ret;
+}
+
 PyObject *
 py_xml_parse_primary(G_GNUC_UNUSED PyObject *self, PyObject *args)
 {
@@ -193,6 +243,7 @@ py_xml_parse_primary(G_GNUC_UNUSED PyObject *self, PyObject *args)
     cbdata.py_warningcb = py_warningcb;
     cbdata.py_pkg       = NULL;
 
+    CB_ALLOW_THREADS(&cbdata);
     cr_xml_parse_primary(filename,
                          ptr_c_newpkgcb,
                          &cbdata,
@@ -202,6 +253,7 @@ py_xml_parse_primary(G_GNUC_UNUSED PyObject *self, PyObject *args)
                          &cbdata,
                          do_files,
                          &tmp_err);
+    CB_END_ALLOW_THREADS(&cbdata);
 
     Py_XDECREF(py_newpkgcb);
     Py_XDECREF(py_pkgcb);
@@ -274,8 +326,10 @@ py_xml_parse_primary_snippet(G_GNUC_UNUSED PyObject *self, PyObject *args)
     cbdata.py_warningcb = py_warningcb;
     cbdata.py_pkg       = NULL;
 
+    CB_ALLOW_THREADS(&cbdata);
     cr_xml_parse_primary_snippet(target, ptr_c_newpkgcb, &cbdata, ptr_c_pkgcb, &cbdata,
                                  ptr_c_warningcb, &cbdata, do_files, &tmp_err);
+    CB_END_ALLOW_THREADS(&cbdata);
 
     Py_XDECREF(py_newpkgcb);
     Py_XDECREF(py_pkgcb);
@@ -346,6 +400,7 @@ py_xml_parse_filelists(G_GNUC_UNUSED PyObject *self, PyObject *args)
     cbdata.py_warningcb = py_warningcb;
     cbdata.py_pkg       = NULL;
 
+    CB_ALLOW_THREADS(&cbdata);
     cr_xml_parse_filelists(filename,
                            ptr_c_newpkgcb,
                            &cbdata,
@@ -354,6 +409,7 @@ py_xml_parse_filelists(G_GNUC_UNUSED PyObject *self, PyObject *args)
                            ptr_c_warningcb,
                            &cbdata,
                            &tmp_err);
+    CB_END_ALLOW_THREADS(&cbdata);
 
     Py_XDECREF(py_newpkgcb);
     Py_XDECREF(py_pkgcb);
@@ -424,8 +480,10 @@ py_xml_parse_filelists_snippet(G_GNUC_UNUSED PyObject *self, PyObject *args)
     cbdata.py_warningcb = py_warningcb;
     cbdata.py_pkg       = NULL;
 
+    CB_ALLOW_THREADS(&cbdata);
     cr_xml_parse_filelists_snippet(target, ptr_c_newpkgcb, &cbdata, ptr_c_pkgcb,
                                    &cbdata, ptr_c_warningcb, &cbdata, &tmp_err);
+    CB_END_ALLOW_THREADS(&cbdata);
 
     Py_XDECREF(py_newpkgcb);
     Py_XDECREF(py_pkgcb);
@@ -496,6 +554,7 @@ py_xml_parse_other(G_GNUC_UNUSED PyObject *self, PyObject *args)
     cbdata.py_warningcb = py_warningcb;
     cbdata.py_pkg       = NULL;
 
+    CB_ALLOW_THREADS(&cbdata);
     cr_xml_parse_other(filename,
                        ptr_c_newpkgcb,
                        &cbdata,
@@ -504,6 +563,7 @@ py_xml_parse_other(G_GNUC_UNUSED PyObject *self, PyObject *args)
                        ptr_c_warningcb,
                        &cbdata,
                        &tmp_err);
+    CB_END_ALLOW_THREADS(&cbdata);
 
     Py_XDECREF(py_newpkgcb);
     Py_XDECREF(py_pkgcb);
@@ -574,8 +634,10 @@ py_xml_parse_other_snippet(G_GNUC_UNUSED PyObject *self, PyObject *args)
     cbdata.py_warningcb = py_warningcb;
     cbdata.py_pkg       = NULL;
 
+    CB_ALLOW_THREADS(&cbdata);
     cr_xml_parse_other_snippet(target, ptr_c_newpkgcb, &cbdata, ptr_c_pkgcb, &cbdata,
                                ptr_c_warningcb, &cbdata, &tmp_err);
+    CB_END_ALLOW_THREADS(&cbdata);
 
     Py_XDECREF(py_newpkgcb);
     Py_XDECREF(py_pkgcb);
@@ -617,8 +679,11 @@ py_xml_parse_repomd(G_GNUC_UNUSED PyObject *self, PyObject *args)
 
     cr_XmlParserWarningCb   ptr_c_warningcb = NULL;
 
+    // Other threads could use the Python object of the parsed C struct,
+    // the file is small, so it is parsed with the GIL held
+    // (the callback is called without taking the GIL)
     if (py_warningcb != Py_None)
-        ptr_c_warningcb = c_warningcb;
+        ptr_c_warningcb = warningcb;
 
     cbdata.py_newpkgcb  = NULL;
     cbdata.py_pkgcb     = NULL;
@@ -671,8 +736,11 @@ py_xml_parse_updateinfo(G_GNUC_UNUSED PyObject *self, PyObject *args)
 
     cr_XmlParserWarningCb   ptr_c_warningcb = NULL;
 
+    // Other threads could use the Python object of the parsed C struct,
+    // the file is small, so it is parsed with the GIL held
+    // (the callback is called without taking the GIL)
     if (py_warningcb != Py_None)
-        ptr_c_warningcb = c_warningcb;
+        ptr_c_warningcb = warningcb;
 
     cbdata.py_newpkgcb  = NULL;
     cbdata.py_pkgcb     = NULL;
@@ -697,3 +765,165 @@ py_xml_parse_updateinfo(G_GNUC_UNUSED PyObject *self, PyObject *args)
 
     Py_RETURN_NONE;
 }
+
+/* PackageIterator */
+
+/* Number of packages fetched from the cr_PkgIterator per a release
+ * of the GIL. */
+#define PKGITER_BATCH   64
+
+typedef struct {
+    PyObject_HEAD
+    cr_PkgIterator *iter;
+    GPtrArray *batch;   /*!< Fetched packages not yielded yet */
+    guint batch_pos;    /*!< Index of the next package to yield */
+    GError *err;        /*!< Error to raise after the batch is yielded */
+    int busy;           /*!< Packages are being fetched without the GIL */
+} _PackageIteratorObject;
+
+static PyObject *
+packageiterator_new(PyTypeObject *type,
+                    G_GNUC_UNUSED PyObject *args,
+                    G_GNUC_UNUSED PyObject *kwds)
+{
+    _PackageIteratorObject *self;
+
+    self = (_PackageIteratorObject *)type->tp_alloc(type, 0);
+    if (self) {
+        self->iter = NULL;
+        self->batch = g_ptr_array_new();
+        self->batch_pos = 0;
+        self->err = NULL;
+        self->busy = 0;
+    }
+    return (PyObject *)self;
+}
+
+static void
+packageiterator_clear(_PackageIteratorObject *self)
+{
+    if (self->iter) {
+        // Wait for the parser threads
+        Py_BEGIN_ALLOW_THREADS
+        cr_pkg_iterator_free(self->iter);
+        Py_END_ALLOW_THREADS
+        self->iter = NULL;
+    }
+    for (guint x = self->batch_pos; x < self->batch->len; x++)
+        cr_package_free(self->batch->pdata[x]);
+    g_ptr_array_set_size(self->batch, 0);
+    self->batch_pos = 0;
+    g_clear_error(&self->err);
+}
+
+PyDoc_STRVAR(packageiterator_init__doc__,
+".. method:: __init__(primary_path, filelists_path=None, other_path=None)\n\n"
+"    Iterator over complete packages of the metadata. The files are\n"
+"    parsed by C threads ahead of the iteration and the filelists and\n"
+"    other data are merged into the packages from the primary.xml\n"
+"    by pkgId, so no Python callback is called during the parsing.\n"
+"    Warnings of the parsers are ignored.\n\n"
+"    :arg primary_path: Path to the primary.xml\n"
+"    :arg filelists_path: Path to the filelists.xml or None\n"
+"    :arg other_path: Path to the other.xml or None\n");
+
+static int
+packageiterator_init(_PackageIteratorObject *self,
+                     PyObject *args,
+                     PyObject *kwds)
+{
+    static char *kwlist[] = { "primary_path", "filelists_path",
+                              "other_path", NULL };
+    char *primary_path, *filelists_path = NULL, *other_path = NULL;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|zz:packageiterator_init",
+                                     kwlist, &primary_path, &filelists_path,
+                                     &other_path))
+        return -1;
+
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "PackageIterator is being used by another thread.");
+        return -1;
+    }
+
+    /* Free all previous resources when reinitialization */
+    packageiterator_clear(self);
+
+    self->iter = cr_pkg_iterator_new(primary_path, filelists_path, other_path,
+                                     NULL, NULL, &tmp_err);
+    if (!self->iter) {
+        nice_exception(&tmp_err, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+packageiterator_dealloc(_PackageIteratorObject *self)
+{
+    packageiterator_clear(self);
+    g_ptr_array_free(self->batch, TRUE);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *
+packageiterator_iternext(_PackageIteratorObject *self)
+{
+    if (!self->iter) {
+        PyErr_SetString(PyExc_TypeError,
+                        "Improper createrepo_c PackageIterator object.");
+        return NULL;
+    }
+    if (self->busy) {
+        PyErr_SetString(CrErr_Exception,
+            "PackageIterator is being used by another thread.");
+        return NULL;
+    }
+
+    if (self->batch_pos == self->batch->len) {
+        cr_PkgIterator *iter = self->iter;
+        GPtrArray *batch = self->batch;
+        GError *tmp_err = NULL;
+
+        g_ptr_array_set_size(batch, 0);
+        self->batch_pos = 0;
+
+        if (!self->err) {
+            self->busy = 1;
+            Py_BEGIN_ALLOW_THREADS
+            while (batch->len < PKGITER_BATCH) {
+                cr_Package *pkg = cr_pkg_iterator_next(iter, &tmp_err);
+                if (!pkg)
+                    break;
+                g_ptr_array_add(batch, pkg);
+            }
+            Py_END_ALLOW_THREADS
+            self->busy = 0;
+            self->err = tmp_err;
+        }
+
+        if (!batch->len) {
+            if (self->err) {
+                nice_exception(&self->err, NULL);
+            }
+            return NULL;    // StopIteration
+        }
+    }
+
+    return Object_FromPackage(self->batch->pdata[self->batch_pos++], 1);
+}
+
+PyTypeObject PackageIterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "createrepo_c.PackageIterator",
+    .tp_basicsize = sizeof(_PackageIteratorObject),
+    .tp_dealloc = (destructor) packageiterator_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    .tp_doc = packageiterator_init__doc__,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) packageiterator_iternext,
+    .tp_init = (initproc) packageiterator_init,
+    .tp_new = packageiterator_new,
+};
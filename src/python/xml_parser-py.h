@@ -22,6 +22,8 @@
 
 #include "src/createrepo_c.h"
 
+extern PyTypeObject PackageIterator_Type;
+
 PyDoc_STRVAR(xml_parse_primary__doc__,
 "xml_parse_primary(filename, newpkgcb, pkgcb, warningcb, do_files) -> None\n\n"
 "Parse primary.xml");
@@ -0,0 +1,609 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "error.h"
+#include "misc.h"
+#include "parsepkg.h"
+#include "remotepkg.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+#define MANIFEST_FIELDS         5   // Without the optional url
+
+cr_RemotePkg *
+cr_remotepkg_new(const char *url,
+                 const char *location_href,
+                 gint64 size,
+                 gint64 mtime,
+                 cr_ChecksumType checksum_type,
+                 const char *checksum)
+{
+    cr_RemotePkg *remote = g_new0(cr_RemotePkg, 1);
+
+    remote->url             = g_strdup(url);
+    remote->location_href   = g_strdup(location_href);
+    remote->size            = size;
+    remote->mtime           = mtime;
+    remote->checksum_type   = checksum_type;
+    remote->checksum        = g_strdup(checksum);
+    return remote;
+}
+
+void
+cr_remotepkg_free(cr_RemotePkg *remote)
+{
+    if (!remote)
+        return;
+    g_free(remote->url);
+    g_free(remote->location_href);
+    g_free(remote->checksum);
+    g_free(remote);
+}
+
+static gboolean
+manifest_number(const char *str, gint64 *val)
+{
+    char *endptr;
+
+    if (!*str)
+        return FALSE;
+    *val = g_ascii_strtoll(str, &endptr, 10);
+    return *endptr == '\0' && *val >= 0;
+}
+
+static cr_RemotePkg *
+manifest_line(const char *path,
+              guint lineno,
+              const char *line,
+              const char *baseurl,
+              GError **err)
+{
+    gchar **fields = g_strsplit(line, "\t", -1);
+    guint count = g_strv_length(fields);
+    cr_RemotePkg *remote = NULL;
+    cr_ChecksumType checksum_type;
+    gint64 size, mtime;
+    gchar *url;
+
+    if (count != MANIFEST_FIELDS && count != MANIFEST_FIELDS + 1) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s:%u: Expected %d or %d tab separated fields, got %u",
+                    path, lineno, MANIFEST_FIELDS, MANIFEST_FIELDS + 1, count);
+        goto exit;
+    }
+
+    if (!*fields[0]) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s:%u: Empty location", path, lineno);
+        goto exit;
+    }
+
+    if (!manifest_number(fields[1], &size)
+        || !manifest_number(fields[2], &mtime))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s:%u: Bad size or mtime of %s", path, lineno, fields[0]);
+        goto exit;
+    }
+
+    checksum_type = cr_checksum_type(fields[3]);
+    if (checksum_type == CR_CHECKSUM_UNKNOWN || !*fields[4]) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s:%u: Bad checksum of %s", path, lineno, fields[0]);
+        goto exit;
+    }
+
+    if (count > MANIFEST_FIELDS && *fields[MANIFEST_FIELDS])
+        url = g_strdup(fields[MANIFEST_FIELDS]);
+    else if (baseurl)
+        url = g_strconcat(baseurl, g_str_has_suffix(baseurl, "/") ? "" : "/",
+                          cr_get_cleaned_href(fields[0]), NULL);
+    else {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s:%u: No url of %s and no base url",
+                    path, lineno, fields[0]);
+        goto exit;
+    }
+
+    remote = cr_remotepkg_new(url, fields[0], size, mtime, checksum_type,
+                              fields[4]);
+    g_free(url);
+
+exit:
+    g_strfreev(fields);
+    return remote;
+}
+
+GPtrArray *
+cr_remotepkg_load_manifest(const char *path,
+                           const char *baseurl,
+                           GError **err)
+{
+    GError *tmp_err = NULL;
+    GPtrArray *remotes;
+    gchar *content, *line, *next;
+    guint lineno = 0;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    if (!g_file_get_contents(path, &content, NULL, &tmp_err)) {
+        g_set_error(err, ERR_DOMAIN, CRE_IO,
+                    "Cannot read manifest %s: %s", path, tmp_err->message);
+        g_clear_error(&tmp_err);
+        return NULL;
+    }
+
+    remotes = g_ptr_array_new_with_free_func(
+                                    (GDestroyNotify) cr_remotepkg_free);
+    for (line = content; line; line = next) {
+        cr_RemotePkg *remote;
+
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        lineno++;
+
+        g_strchomp(line);
+        if (!*line || *line == '#')
+            continue;
+
+        remote = manifest_line(path, lineno, line, baseurl, err);
+        if (!remote) {
+            g_ptr_array_free(remotes, TRUE);
+            g_free(content);
+            return NULL;
+        }
+        g_ptr_array_add(remotes, remote);
+    }
+
+    g_free(content);
+    return remotes;
+}
+
+/** A transfer of the header of a cr_RemotePkg
+ */
+typedef struct {
+    cr_RemotePkg *remote;
+    guint n;                // index of the package
+    CURL *handle;
+    GByteArray *data;       // beginning of the file
+    gsize requested;        // end of the requested range
+    gboolean whole_file;    // the server ignored the range
+    gboolean enough;        // the whole header is in the data
+    gint64 total;           // size of the file from Content-Range or -1
+    GError *err;            // error found while receiving
+    char range[64];
+    char errorbuf[CURL_ERROR_SIZE];
+} RemoteTransfer;
+
+static size_t
+remote_header_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    RemoteTransfer *transfer = userdata;
+    size_t len = size * nitems;
+
+    if (len > 5 && !strncmp(buffer, "HTTP/", 5)) {
+        // Status line of a new response (e.g. after a redirect), 200
+        // instead of 206 is the whole file
+        const char *code = memchr(buffer, ' ', len);
+        transfer->whole_file = code && !strncmp(code, " 200", 4);
+        if (transfer->whole_file)
+            g_byte_array_set_size(transfer->data, 0);
+        transfer->total = -1;
+    } else if (len > 14 && !g_ascii_strncasecmp(buffer, "Content-Range:", 14)) {
+        // bytes <first>-<last>/<total>
+        const char *total = memchr(buffer, '/', len);
+        if (total && g_ascii_isdigit(total[1]))
+            transfer->total = g_ascii_strtoll(total + 1, NULL, 10);
+    }
+
+    return len;
+}
+
+static size_t
+remote_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    RemoteTransfer *transfer = userdata;
+    size_t len = size * nmemb;
+    struct cr_HeaderRangeStruct hdr_r;
+    gsize needed;
+
+    g_byte_array_append(transfer->data, (const guint8 *) ptr, len);
+
+    // A server ignoring the range sends the whole file, the transfer
+    // is aborted as soon as the header is here
+    if (transfer->data->len <= transfer->requested)
+        return len;
+
+    hdr_r = cr_get_header_byte_range_data(transfer->data->data,
+                                          transfer->data->len,
+                                          &needed, &transfer->err);
+    if (transfer->err)
+        return 0;
+    if (hdr_r.end) {
+        transfer->enough = TRUE;
+        return 0;
+    }
+    return len;
+}
+
+static void
+remote_transfer_free(RemoteTransfer *transfer)
+{
+    if (!transfer)
+        return;
+
+    if (transfer->handle)
+        curl_easy_cleanup(transfer->handle);
+    g_byte_array_free(transfer->data, TRUE);
+    g_clear_error(&transfer->err);
+    g_free(transfer);
+}
+
+/* Set the next range of the transfer
+ */
+static CURLcode
+remote_transfer_range(RemoteTransfer *transfer, gsize end)
+{
+    g_snprintf(transfer->range, sizeof(transfer->range),
+               "%u-%" G_GSIZE_FORMAT, transfer->data->len, end - 1);
+    transfer->requested = end;
+    transfer->whole_file = FALSE;
+    transfer->total = -1;
+    return curl_easy_setopt(transfer->handle, CURLOPT_RANGE, transfer->range);
+}
+
+static RemoteTransfer *
+remote_transfer_new(CURL *in_handle,
+                    cr_RemotePkg *remote,
+                    guint n,
+                    GError **err)
+{
+    RemoteTransfer *transfer;
+    CURLcode rcode = CURLE_OK;
+    gsize first_range = CR_REMOTEPKG_FIRST_RANGE;
+
+    transfer = g_malloc0(sizeof(RemoteTransfer));
+    transfer->remote = remote;
+    transfer->n = n;
+    transfer->data = g_byte_array_sized_new(CR_REMOTEPKG_FIRST_RANGE);
+    transfer->handle = curl_easy_duphandle(in_handle);
+    transfer->errorbuf[0] = '\0';
+
+    if (!transfer->handle) {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL, "curl_easy_duphandle failed");
+        remote_transfer_free(transfer);
+        return NULL;
+    }
+
+    // A small package is read at once
+    if (remote->size > 0 && (guint64) remote->size < first_range)
+        first_range = remote->size;
+
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_ERRORBUFFER,
+                                 transfer->errorbuf);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_URL, remote->url);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_FAILONERROR, 1L);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_FOLLOWLOCATION, 1L);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_WRITEFUNCTION,
+                                 remote_write_cb);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_WRITEDATA,
+                                 transfer);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_HEADERFUNCTION,
+                                 remote_header_cb);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_HEADERDATA,
+                                 transfer);
+    if (rcode == CURLE_OK)
+        rcode = curl_easy_setopt(transfer->handle, CURLOPT_PRIVATE, transfer);
+    if (rcode == CURLE_OK)
+        rcode = remote_transfer_range(transfer, first_range);
+
+    if (rcode != CURLE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL,
+                    "curl_easy_setopt failed: %s",
+                    curl_easy_strerror(rcode));
+        remote_transfer_free(transfer);
+        return NULL;
+    }
+
+    // Optional, not supported by every libcurl build
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    curl_easy_setopt(transfer->handle, CURLOPT_HTTP_VERSION,
+                     (long) CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    // Rather wait for a connection that could be multiplexed
+    // than open a new one
+    curl_easy_setopt(transfer->handle, CURLOPT_PIPEWAIT, 1L);
+#endif
+
+    return transfer;
+}
+
+/* Process the finished request of the transfer. Returns TRUE if another
+ * range has to be requested (the range is already set), otherwise
+ * the package or the err is set.
+ */
+static gboolean
+remote_transfer_done(RemoteTransfer *transfer,
+                     CURLcode result,
+                     int changelog_limit,
+                     cr_HeaderReadingFlags flags,
+                     cr_Package **pkg,
+                     GError **err)
+{
+    cr_RemotePkg *remote = transfer->remote;
+    struct cr_HeaderRangeStruct hdr_r;
+    GError *tmp_err = NULL;
+    CURLcode rcode;
+    gsize needed;
+
+    if (transfer->err) {
+        g_propagate_prefixed_error(err, g_steal_pointer(&transfer->err),
+                                   "%s: ", remote->url);
+        return FALSE;
+    }
+
+    if (result != CURLE_OK
+        && !(result == CURLE_WRITE_ERROR && transfer->enough))
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_CURL,
+                    "curl_easy_perform failed: %s: %s: %s",
+                    remote->url, curl_easy_strerror(result),
+                    transfer->errorbuf);
+        return FALSE;
+    }
+
+    // The manifest is probably out of date
+    if (transfer->total >= 0 && remote->size > 0
+        && transfer->total != remote->size)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "%s: Size %" G_GINT64_FORMAT " differs from the size "
+                    "%" G_GINT64_FORMAT " in the manifest", remote->url,
+                    transfer->total, remote->size);
+        return FALSE;
+    }
+
+    hdr_r = cr_get_header_byte_range_data(transfer->data->data,
+                                          transfer->data->len,
+                                          &needed, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "%s: ", remote->url);
+        return FALSE;
+    }
+
+    if (!hdr_r.end) {
+        // The end of the file was reached
+        if (transfer->whole_file || transfer->data->len < transfer->requested) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "%s: Incomplete header (%u bytes of at least %"
+                        G_GSIZE_FORMAT ")", remote->url,
+                        transfer->data->len, needed);
+            return FALSE;
+        }
+
+        // The header is bigger than the first range
+        g_debug("%s: Reading %" G_GSIZE_FORMAT " bytes of the header of %s",
+                __func__, needed - transfer->data->len, remote->url);
+        rcode = remote_transfer_range(transfer, needed);
+        if (rcode != CURLE_OK) {
+            g_set_error(err, ERR_DOMAIN, CRE_CURL,
+                        "curl_easy_setopt failed: %s",
+                        curl_easy_strerror(rcode));
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    *pkg = cr_package_from_rpm_data(transfer->data->data, transfer->data->len,
+                                    remote->url, changelog_limit, flags,
+                                    &tmp_err);
+    if (!*pkg) {
+        g_propagate_error(err, tmp_err);
+        return FALSE;
+    }
+
+    (*pkg)->pkgId = cr_safe_string_chunk_insert((*pkg)->chunk,
+                                                remote->checksum);
+    (*pkg)->checksum_type = cr_safe_string_chunk_insert((*pkg)->chunk,
+                                cr_checksum_name_str(remote->checksum_type));
+    (*pkg)->location_href = cr_safe_string_chunk_insert((*pkg)->chunk,
+                                                        remote->location_href);
+    (*pkg)->size_package = remote->size;
+    (*pkg)->time_file = remote->mtime;
+    return FALSE;
+}
+
+/* Hand the result of a package over to the callback
+ */
+static void
+remote_report(cr_RemotePkg *remote,
+              guint n,
+              cr_Package *pkg,
+              GError *pkg_err,
+              cr_RemotePkgCb cb,
+              void *cbdata,
+              GError **first_err)
+{
+    if (pkg_err && !*first_err)
+        *first_err = g_error_copy(pkg_err);
+    cb(remote, n, pkg, pkg_err, cbdata);
+    g_clear_error(&pkg_err);
+}
+
+int
+cr_remotepkg_read_headers(CURL *in_handle,
+                          GPtrArray *remotes,
+                          long max_transfers,
+                          int changelog_limit,
+                          cr_HeaderReadingFlags flags,
+                          cr_RemotePkgCb cb,
+                          void *cbdata,
+                          GError **err)
+{
+    GError *first_err = NULL;
+    GSList *transfers = NULL;
+    CURLMcode mcode = CURLM_OK;
+    CURLM *multi;
+    guint next = 0;
+    long active = 0;
+    int running = 0;
+
+    assert(in_handle);
+    assert(remotes);
+    assert(cb);
+    assert(!err || *err == NULL);
+
+    if (max_transfers <= 0)
+        max_transfers = CR_REMOTEPKG_DEFAULT_TRANSFERS;
+
+    multi = curl_multi_init();
+    if (!multi) {
+        GError *tmp_err = g_error_new(ERR_DOMAIN, CRE_CURL,
+                                      "curl_multi_init failed");
+        for (; next < remotes->len; next++)
+            remote_report(g_ptr_array_index(remotes, next), next, NULL,
+                          g_error_copy(tmp_err), cb, cbdata, &first_err);
+        g_error_free(tmp_err);
+        goto exit;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+    do {
+        CURLMsg *msg;
+        int msgs_left;
+
+        // Keep the max number of transfers in flight
+        while (active < max_transfers && next < remotes->len) {
+            cr_RemotePkg *remote = g_ptr_array_index(remotes, next);
+            GError *tmp_err = NULL;
+            RemoteTransfer *transfer;
+
+            transfer = remote_transfer_new(in_handle, remote, next, &tmp_err);
+            if (transfer) {
+                mcode = curl_multi_add_handle(multi, transfer->handle);
+                if (mcode != CURLM_OK) {
+                    g_set_error(&tmp_err, ERR_DOMAIN, CRE_CURL,
+                                "curl_multi_add_handle failed: %s",
+                                curl_multi_strerror(mcode));
+                    remote_transfer_free(transfer);
+                    transfer = NULL;
+                }
+            }
+
+            if (transfer) {
+                transfers = g_slist_prepend(transfers, transfer);
+                active++;
+            } else {
+                remote_report(remote, next, NULL, tmp_err, cb, cbdata,
+                              &first_err);
+            }
+            next++;
+        }
+
+        mcode = curl_multi_perform(multi, &running);
+        if (mcode != CURLM_OK)
+            break;
+
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            RemoteTransfer *transfer = NULL;
+            cr_Package *pkg = NULL;
+            GError *tmp_err = NULL;
+            gboolean again;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            curl_multi_remove_handle(multi, transfer->handle);
+            again = remote_transfer_done(transfer, msg->data.result,
+                                         changelog_limit, flags, &pkg,
+                                         &tmp_err);
+            if (again) {
+                mcode = curl_multi_add_handle(multi, transfer->handle);
+                if (mcode == CURLM_OK)
+                    continue;
+                g_set_error(&tmp_err, ERR_DOMAIN, CRE_CURL,
+                            "curl_multi_add_handle failed: %s",
+                            curl_multi_strerror(mcode));
+                mcode = CURLM_OK;
+            }
+
+            remote_report(transfer->remote, transfer->n, pkg, tmp_err, cb,
+                          cbdata, &first_err);
+            transfers = g_slist_remove(transfers, transfer);
+            remote_transfer_free(transfer);
+            active--;
+        }
+
+        if (active)
+            mcode = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    } while ((active || next < remotes->len) && mcode == CURLM_OK);
+
+    // Every package is reported, even if the multi interface failed
+    for (GSList *elem = transfers; elem; elem = g_slist_next(elem)) {
+        RemoteTransfer *transfer = elem->data;
+
+        curl_multi_remove_handle(multi, transfer->handle);
+        remote_report(transfer->remote, transfer->n, NULL,
+                      g_error_new(ERR_DOMAIN, CRE_CURL,
+                                  "curl_multi failed: %s: %s",
+                                  transfer->remote->url,
+                                  curl_multi_strerror(mcode)),
+                      cb, cbdata, &first_err);
+        remote_transfer_free(transfer);
+    }
+    g_slist_free(transfers);
+    for (; next < remotes->len; next++) {
+        cr_RemotePkg *remote = g_ptr_array_index(remotes, next);
+        remote_report(remote, next, NULL,
+                      g_error_new(ERR_DOMAIN, CRE_CURL,
+                                  "curl_multi failed: %s: %s", remote->url,
+                                  curl_multi_strerror(mcode)),
+                      cb, cbdata, &first_err);
+    }
+    curl_multi_cleanup(multi);
+
+exit:
+    if (first_err) {
+        int code = first_err->code;
+        g_propagate_error(err, first_err);
+        return code;
+    }
+
+    return CRE_OK;
+}
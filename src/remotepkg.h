@@ -0,0 +1,157 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_REMOTEPKG_H__
+#define __C_CREATEREPOLIB_REMOTEPKG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "checksum.h"
+#include "package.h"
+#include "parsehdr.h"
+
+/** \defgroup   remotepkg   Packages read by HTTP range requests
+ *
+ * Packages in a remote storage (e.g. an S3 compatible object store) are
+ * read without downloading their payload. Only the beginning of every
+ * package file with its header ([0, rpm_header_end), see
+ * cr_get_header_byte_range_data()) is fetched by HTTP range requests,
+ * many of them in flight at once. The checksum, the size and the time
+ * of the file, which would need the whole file, are taken from
+ * a manifest supplied by the storage (e.g. by its upload service).
+ *
+ * Manifest format - one package per line, tab separated fields:
+ *
+ *      location_href   size    mtime   checksum_type   checksum    [url]
+ *
+ * Empty lines and lines starting with '#' are ignored. Without the url
+ * the package is read from baseurl/location_href.
+ *
+ *  \addtogroup remotepkg
+ *  @{
+ */
+
+/** Default max number of the transfers in flight.
+ */
+#define CR_REMOTEPKG_DEFAULT_TRANSFERS  64
+
+/** Length of the first range request of a package. Headers of most
+ * packages fit into it, a bigger header is read by another request.
+ */
+#define CR_REMOTEPKG_FIRST_RANGE        (64*1024)
+
+/** A package in a remote storage.
+ */
+typedef struct {
+    char *url;                      /*!< url of the package file */
+    char *location_href;            /*!< location in the repo */
+    gint64 size;                    /*!< size of the file */
+    gint64 mtime;                   /*!< modification time of the file */
+    cr_ChecksumType checksum_type;  /*!< type of the checksum */
+    char *checksum;                 /*!< checksum of the file (pkgId) */
+} cr_RemotePkg;
+
+/** Create a new cr_RemotePkg.
+ * @param url           url of the package file
+ * @param location_href location in the repo
+ * @param size          size of the file
+ * @param mtime         modification time of the file
+ * @param checksum_type type of the checksum
+ * @param checksum      checksum of the file
+ * @return              new cr_RemotePkg
+ */
+cr_RemotePkg *
+cr_remotepkg_new(const char *url,
+                 const char *location_href,
+                 gint64 size,
+                 gint64 mtime,
+                 cr_ChecksumType checksum_type,
+                 const char *checksum);
+
+/** Free a cr_RemotePkg.
+ * @param remote        cr_RemotePkg or NULL
+ */
+void
+cr_remotepkg_free(cr_RemotePkg *remote);
+
+/** Load the packages of a manifest.
+ * @param path          path to the manifest
+ * @param baseurl       url of the packages without their url in
+ *                      the manifest (could be NULL if all have it)
+ * @param err           GError **
+ * @return              array of cr_RemotePkg in the order of the manifest
+ *                      (the array frees them) or NULL on error
+ */
+GPtrArray *
+cr_remotepkg_load_manifest(const char *path,
+                           const char *baseurl,
+                           GError **err);
+
+/** Callback for every package of cr_remotepkg_read_headers().
+ * @param remote        the remote package
+ * @param n             index of the package in the array
+ * @param pkg           the package (the callback owns it) or NULL
+ *                      on error
+ * @param err           error of the package or NULL
+ * @param cbdata        user data
+ */
+typedef void (*cr_RemotePkgCb)(cr_RemotePkg *remote,
+                               guint n,
+                               cr_Package *pkg,
+                               const GError *err,
+                               void *cbdata);
+
+/** Read the headers of the packages by HTTP range requests via the curl
+ * multi interface and generate their cr_Package objects by
+ * cr_package_from_rpm_data(). pkgId, checksum_type, size_package,
+ * time_file and location_href are filled from the remote packages,
+ * location_base is not filled. The callback is called from the calling
+ * thread for every package (in the order in which they were read),
+ * even if the transfers fail.
+ * @param handle        CURL handle used as a template for the transfers
+ * @param remotes       array of cr_RemotePkg
+ * @param max_transfers max number of transfers in flight (0 - default)
+ * @param changelog_limit number of changelogs that will be loaded
+ * @param flags         Flags for header reading
+ * @param cb            callback
+ * @param cbdata        user data for the callback
+ * @param err           GError ** (the first error of the packages)
+ * @return              cr_Error
+ */
+int
+cr_remotepkg_read_headers(CURL *handle,
+                          GPtrArray *remotes,
+                          long max_transfers,
+                          int changelog_limit,
+                          cr_HeaderReadingFlags flags,
+                          cr_RemotePkgCb cb,
+                          void *cbdata,
+                          GError **err);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_REMOTEPKG_H__ */
@@ -0,0 +1,317 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+#include "cleanup.h"
+#include "error.h"
+#include "misc.h"
+#include "package.h"
+#include "pkgindex.h"
+#include "repodiff.h"
+#include "repomd.h"
+#include "xml_parser.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+struct _cr_RepoDiffPkgs {
+    GArray *pkgs;           // cr_RepoDiffPkg sorted by name, arch and pkgId
+    GStringChunk *chunk;    // Strings of the packages from primary.xml
+    cr_PkgIndex *index;     // Strings of the packages from the index
+    const char *source;     // "pkgindex" or "primary"
+};
+
+static int
+repodiff_pkg_cmp(gconstpointer a, gconstpointer b)
+{
+    const cr_RepoDiffPkg *pa = a, *pb = b;
+    int ret;
+
+    if ((ret = g_strcmp0(pa->name, pb->name)))
+        return ret;
+    if ((ret = g_strcmp0(pa->arch, pb->arch)))
+        return ret;
+    return g_strcmp0(pa->pkgId, pb->pkgId);
+}
+
+/** Packages of the same name and arch?
+ */
+static gboolean
+repodiff_same_na(const cr_RepoDiffPkg *a, const cr_RepoDiffPkg *b)
+{
+    return !g_strcmp0(a->name, b->name) && !g_strcmp0(a->arch, b->arch);
+}
+
+static int
+repodiff_pkg_evr_cmp(gconstpointer a, gconstpointer b)
+{
+    const cr_RepoDiffPkg *pa = *((const cr_RepoDiffPkg **) a);
+    const cr_RepoDiffPkg *pb = *((const cr_RepoDiffPkg **) b);
+
+    return cr_cmp_evr(pa->epoch, pa->version, pa->release,
+                      pb->epoch, pb->version, pb->release);
+}
+
+static gboolean
+repodiff_load_index(cr_RepoDiffPkgs *pkgs, const char *path, GError **err)
+{
+    cr_PkgIndexEntry entry;
+
+    if (!(pkgs->index = cr_pkgindex_open(path, err)))
+        return FALSE;
+
+    guint count = cr_pkgindex_size(pkgs->index);
+    g_array_set_size(pkgs->pkgs, count);
+    for (guint x = 0; x < count; x++) {
+        cr_RepoDiffPkg *pkg = &g_array_index(pkgs->pkgs, cr_RepoDiffPkg, x);
+
+        if (!cr_pkgindex_get(pkgs->index, x, &entry)) {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Package index %s is corrupted", path);
+            return FALSE;
+        }
+
+        // The strings point into the mapped index
+        pkg->pkgId          = entry.pkgId;
+        pkg->name           = entry.name;
+        pkg->epoch          = entry.epoch;
+        pkg->version        = entry.version;
+        pkg->release        = entry.release;
+        pkg->arch           = entry.arch;
+        pkg->location_href  = entry.location_href;
+    }
+
+    pkgs->source = "pkgindex";
+    return TRUE;
+}
+
+static int
+repodiff_primary_pkgcb(cr_Package *pkg,
+                       void *cbdata,
+                       G_GNUC_UNUSED GError **err)
+{
+    cr_RepoDiffPkgs *pkgs = cbdata;
+    cr_RepoDiffPkg rec;
+
+    // Names, epochs and archs repeat a lot, they are stored once
+    rec.pkgId           = cr_safe_string_chunk_insert(pkgs->chunk, pkg->pkgId);
+    rec.name            = cr_safe_string_chunk_insert_const(pkgs->chunk, pkg->name);
+    rec.epoch           = cr_safe_string_chunk_insert_const(pkgs->chunk, pkg->epoch);
+    rec.version         = cr_safe_string_chunk_insert(pkgs->chunk, pkg->version);
+    rec.release         = cr_safe_string_chunk_insert(pkgs->chunk, pkg->release);
+    rec.arch            = cr_safe_string_chunk_insert_const(pkgs->chunk, pkg->arch);
+    rec.location_href   = cr_safe_string_chunk_insert(pkgs->chunk,
+                                                      pkg->location_href);
+    g_array_append_val(pkgs->pkgs, rec);
+
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+static gboolean
+repodiff_load_primary(cr_RepoDiffPkgs *pkgs, const char *path, GError **err)
+{
+    pkgs->chunk = g_string_chunk_new(64 * 1024);
+
+    // The files are not needed, only the rest of the package is parsed
+    if (cr_xml_parse_primary(path, NULL, NULL, repodiff_primary_pkgcb, pkgs,
+                             NULL, NULL, 0, err) != CRE_OK)
+        return FALSE;
+
+    pkgs->source = "primary";
+    return TRUE;
+}
+
+cr_RepoDiffPkgs *
+cr_repodiff_pkgs_load(const char *path, gboolean use_index, GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_RepoDiffPkgs *pkgs;
+    cr_RepomdRecord *rec;
+    gboolean ret;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    _cleanup_free_ gchar *repomd_path = g_build_filename(path, "repodata",
+                                                         "repomd.xml", NULL);
+    cr_Repomd *repomd = cr_repomd_new();
+    if (cr_xml_parse_repomd(repomd_path, repomd, NULL, NULL, &tmp_err)
+            != CRE_OK) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot parse repomd.xml of %s: ", path);
+        cr_repomd_free(repomd);
+        return NULL;
+    }
+
+    pkgs = g_new0(cr_RepoDiffPkgs, 1);
+    pkgs->pkgs = g_array_new(FALSE, FALSE, sizeof(cr_RepoDiffPkg));
+
+    if (use_index && (rec = cr_repomd_get_record(repomd, "pkgindex"))) {
+        _cleanup_free_ gchar *index_path = g_build_filename(path,
+                                                    rec->location_href, NULL);
+        ret = repodiff_load_index(pkgs, index_path, err);
+    } else if ((rec = cr_repomd_get_record(repomd, "primary"))) {
+        _cleanup_free_ gchar *primary_path = g_build_filename(path,
+                                                    rec->location_href, NULL);
+        ret = repodiff_load_primary(pkgs, primary_path, err);
+    } else {
+        g_set_error(err, ERR_DOMAIN, CRE_NOFILE,
+                    "Repository %s has no primary metadata", path);
+        ret = FALSE;
+    }
+    cr_repomd_free(repomd);
+
+    if (!ret) {
+        cr_repodiff_pkgs_free(pkgs);
+        return NULL;
+    }
+
+    g_array_sort(pkgs->pkgs, repodiff_pkg_cmp);
+    return pkgs;
+}
+
+guint
+cr_repodiff_pkgs_size(cr_RepoDiffPkgs *pkgs)
+{
+    assert(pkgs);
+    return pkgs->pkgs->len;
+}
+
+const char *
+cr_repodiff_pkgs_source(cr_RepoDiffPkgs *pkgs)
+{
+    assert(pkgs);
+    return pkgs->source;
+}
+
+void
+cr_repodiff_pkgs_free(cr_RepoDiffPkgs *pkgs)
+{
+    if (!pkgs)
+        return;
+
+    g_array_free(pkgs->pkgs, TRUE);
+    if (pkgs->chunk)
+        g_string_chunk_free(pkgs->chunk);
+    cr_pkgindex_free(pkgs->index);
+    g_free(pkgs);
+}
+
+/** Report the differences of the packages of one name and arch.
+ * The packages of both groups are sorted by pkgId. The packages without
+ * the same pkgId in the other group are paired by their EVRs, the pairs
+ * are changed packages, the rest is added or removed.
+ * @return              FALSE if the callback stopped the comparison
+ */
+static gboolean
+repodiff_group(const cr_RepoDiffPkg *old_pkgs, guint old_count,
+               const cr_RepoDiffPkg *new_pkgs, guint new_count,
+               GPtrArray *old_only, GPtrArray *new_only,
+               cr_RepoDiffCb cb, void *cbdata, guint *diffs)
+{
+    guint o = 0, n = 0;
+
+    g_ptr_array_set_size(old_only, 0);
+    g_ptr_array_set_size(new_only, 0);
+
+    while (o < old_count || n < new_count) {
+        int cmp = (o == old_count) ? 1
+                : (n == new_count) ? -1
+                : g_strcmp0(old_pkgs[o].pkgId, new_pkgs[n].pkgId);
+        if (cmp < 0) {
+            g_ptr_array_add(old_only, (gpointer) &old_pkgs[o++]);
+        } else if (cmp > 0) {
+            g_ptr_array_add(new_only, (gpointer) &new_pkgs[n++]);
+        } else {
+            o++;
+            n++;
+        }
+    }
+
+    if (old_only->len > 1)
+        g_ptr_array_sort(old_only, repodiff_pkg_evr_cmp);
+    if (new_only->len > 1)
+        g_ptr_array_sort(new_only, repodiff_pkg_evr_cmp);
+
+    for (guint x = 0; x < MAX(old_only->len, new_only->len); x++) {
+        const cr_RepoDiffPkg *old_pkg = x < old_only->len
+                                        ? old_only->pdata[x] : NULL;
+        const cr_RepoDiffPkg *new_pkg = x < new_only->len
+                                        ? new_only->pdata[x] : NULL;
+        cr_RepoDiffType type = !old_pkg ? CR_REPODIFF_ADDED
+                             : !new_pkg ? CR_REPODIFF_REMOVED
+                             : CR_REPODIFF_CHANGED;
+
+        (*diffs)++;
+        if (cb && !cb(type, old_pkg, new_pkg, cbdata))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+guint
+cr_repodiff(cr_RepoDiffPkgs *old_pkgs,
+            cr_RepoDiffPkgs *new_pkgs,
+            cr_RepoDiffCb cb,
+            void *cbdata)
+{
+    const cr_RepoDiffPkg *o = (const cr_RepoDiffPkg *) old_pkgs->pkgs->data;
+    const cr_RepoDiffPkg *n = (const cr_RepoDiffPkg *) new_pkgs->pkgs->data;
+    guint o_len = old_pkgs->pkgs->len, n_len = new_pkgs->pkgs->len;
+    guint x = 0, y = 0, diffs = 0;
+    GPtrArray *old_only = g_ptr_array_new();
+    GPtrArray *new_only = g_ptr_array_new();
+
+    // Both lists are sorted, they are walked by the groups of packages
+    // of the same name and arch
+    while (x < o_len || y < n_len) {
+        const cr_RepoDiffPkg *first;
+        guint x_end = x, y_end = y;
+
+        if (x == o_len)
+            first = &n[y];
+        else if (y == n_len)
+            first = &o[x];
+        else {
+            int cmp = g_strcmp0(o[x].name, n[y].name);
+            if (!cmp)
+                cmp = g_strcmp0(o[x].arch, n[y].arch);
+            first = (cmp <= 0) ? &o[x] : &n[y];
+        }
+
+        while (x_end < o_len && repodiff_same_na(&o[x_end], first))
+            x_end++;
+        while (y_end < n_len && repodiff_same_na(&n[y_end], first))
+            y_end++;
+
+        if (!repodiff_group(&o[x], x_end - x, &n[y], y_end - y,
+                            old_only, new_only, cb, cbdata, &diffs))
+            break;
+
+        x = x_end;
+        y = y_end;
+    }
+
+    g_ptr_array_free(old_only, TRUE);
+    g_ptr_array_free(new_only, TRUE);
+    return diffs;
+}
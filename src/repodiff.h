@@ -0,0 +1,130 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_REPODIFF_H__
+#define __C_CREATEREPOLIB_REPODIFF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+
+/** \defgroup   repodiff    Differences between two repositories
+ *
+ * Only the pkgIds, NEVRAs and locations of the packages are loaded,
+ * from the binary package index (see pkgindex) if the repository has
+ * one, otherwise from primary.xml which is parsed as a stream without
+ * the files. The packages of both repositories are compared by their
+ * name and arch: a package of the old repository without the same pkgId
+ * in the new one is changed if the new repository has a package of the
+ * same name and arch which isn't in the old one, otherwise it's removed.
+ *
+ *  \addtogroup repodiff
+ *  @{
+ */
+
+/** Package of a repository. The strings are owned by cr_RepoDiffPkgs.
+ */
+typedef struct {
+    const char *pkgId;          /*!< checksum of the package */
+    const char *name;           /*!< name */
+    const char *epoch;          /*!< epoch */
+    const char *version;        /*!< version */
+    const char *release;        /*!< release */
+    const char *arch;           /*!< architecture */
+    const char *location_href;  /*!< location of the package */
+} cr_RepoDiffPkg;
+
+/** Packages of a repository.
+ */
+typedef struct _cr_RepoDiffPkgs cr_RepoDiffPkgs;
+
+/** Kind of a difference.
+ */
+typedef enum {
+    CR_REPODIFF_ADDED,      /*!< Package is only in the new repository */
+    CR_REPODIFF_REMOVED,    /*!< Package is only in the old repository */
+    CR_REPODIFF_CHANGED,    /*!< Package was replaced by another one
+                                 of the same name and arch */
+} cr_RepoDiffType;
+
+/** Callback called for every difference.
+ * @param type          kind of the difference
+ * @param old_pkg       package of the old repository (NULL if added)
+ * @param new_pkg       package of the new repository (NULL if removed)
+ * @param cbdata        user data
+ * @return              FALSE to stop the comparison
+ */
+typedef gboolean (*cr_RepoDiffCb)(cr_RepoDiffType type,
+                                  const cr_RepoDiffPkg *old_pkg,
+                                  const cr_RepoDiffPkg *new_pkg,
+                                  void *cbdata);
+
+/** Load the packages of a local repository.
+ * @param path          path to the repository (with repodata/repomd.xml)
+ * @param use_index     use the binary package index if the repository
+ *                      has one
+ * @param err           GError **
+ * @return              packages or NULL on error
+ */
+cr_RepoDiffPkgs *
+cr_repodiff_pkgs_load(const char *path, gboolean use_index, GError **err);
+
+/** Number of the packages.
+ * @param pkgs          packages
+ * @return              number of the packages
+ */
+guint
+cr_repodiff_pkgs_size(cr_RepoDiffPkgs *pkgs);
+
+/** Metadata the packages were loaded from.
+ * @param pkgs          packages
+ * @return              "pkgindex" or "primary"
+ */
+const char *
+cr_repodiff_pkgs_source(cr_RepoDiffPkgs *pkgs);
+
+/** Free the packages.
+ * @param pkgs          packages or NULL
+ */
+void
+cr_repodiff_pkgs_free(cr_RepoDiffPkgs *pkgs);
+
+/** Compare the packages of two repositories. The differences are
+ * reported in the order of the names and the archs of the packages.
+ * @param old_pkgs      packages of the old repository
+ * @param new_pkgs      packages of the new repository
+ * @param cb            callback called for every difference or NULL
+ * @param cbdata        user data for the cb
+ * @return              number of the reported differences
+ */
+guint
+cr_repodiff(cr_RepoDiffPkgs *old_pkgs,
+            cr_RepoDiffPkgs *new_pkgs,
+            cr_RepoDiffCb cb,
+            void *cbdata);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_REPODIFF_H__ */
@@ -0,0 +1,193 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "version.h"
+#include "createrepo_shared.h"
+#include "repodiff.h"
+
+// Exit codes of diff(1)
+#define EXIT_SAME       0
+#define EXIT_DIFFERENT  1
+#define EXIT_TROUBLE    2
+
+typedef struct {
+    gboolean version;
+    gboolean quiet;
+    gboolean verbose;
+    gboolean summary;
+    gboolean no_index;
+} RepodiffCmdOptions;
+
+typedef struct {
+    gboolean print;         // Print the differences
+    guint added;
+    guint removed;
+    guint changed;
+} RepodiffStats;
+
+static gboolean
+parse_arguments(int *argc, char ***argv, RepodiffCmdOptions *options,
+                GError **err)
+{
+    const GOptionEntry cmd_entries[] = {
+        { "version", 'V', 0, G_OPTION_ARG_NONE, &(options->version),
+          "Show program's version number and exit.", NULL },
+        { "quiet", 'q', 0, G_OPTION_ARG_NONE, &(options->quiet),
+          "Print nothing, only the exit status tells if the repositories "
+          "differ.", NULL },
+        { "verbose", 'v', 0, G_OPTION_ARG_NONE, &(options->verbose),
+          "Run verbosely.", NULL },
+        { "summary", 's', 0, G_OPTION_ARG_NONE, &(options->summary),
+          "Print only the numbers of added, removed and changed packages.",
+          NULL },
+        { "no-index", 0, 0, G_OPTION_ARG_NONE, &(options->no_index),
+          "Read primary.xml even if the repository has a package index.",
+          NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
+    };
+
+    GOptionContext *context;
+    context = g_option_context_new("<old_repo> <new_repo>");
+    g_option_context_set_summary(context, "Compare the packages of two "
+            "repositories. Every added package is printed as \"+ NEVRA\", "
+            "removed as \"- NEVRA\" and changed as \"~ OLD_NEVRA NEVRA\". "
+            "Exit status is 0 if the repositories have the same packages, "
+            "1 if they differ and 2 on error.");
+    g_option_context_add_main_entries(context, cmd_entries, NULL);
+    gboolean ret = g_option_context_parse(context, argc, argv, err);
+    g_option_context_free(context);
+    return ret;
+}
+
+static void
+print_nevra(const cr_RepoDiffPkg *pkg)
+{
+    if (pkg->epoch && *pkg->epoch && strcmp(pkg->epoch, "0"))
+        printf("%s-%s:%s-%s.%s", pkg->name, pkg->epoch, pkg->version,
+               pkg->release, pkg->arch);
+    else
+        printf("%s-%s-%s.%s", pkg->name, pkg->version, pkg->release,
+               pkg->arch);
+}
+
+static gboolean
+diff_cb(cr_RepoDiffType type,
+        const cr_RepoDiffPkg *old_pkg,
+        const cr_RepoDiffPkg *new_pkg,
+        void *cbdata)
+{
+    RepodiffStats *stats = cbdata;
+
+    switch (type) {
+        case CR_REPODIFF_ADDED:
+            stats->added++;
+            if (stats->print) {
+                printf("+ ");
+                print_nevra(new_pkg);
+            }
+            break;
+        case CR_REPODIFF_REMOVED:
+            stats->removed++;
+            if (stats->print) {
+                printf("- ");
+                print_nevra(old_pkg);
+            }
+            break;
+        case CR_REPODIFF_CHANGED:
+            stats->changed++;
+            if (stats->print) {
+                printf("~ ");
+                print_nevra(old_pkg);
+                printf(" ");
+                print_nevra(new_pkg);
+            }
+            break;
+    }
+
+    if (stats->print)
+        printf("\n");
+    return TRUE;
+}
+
+int
+main(int argc, char **argv)
+{
+    RepodiffCmdOptions options = { 0 };
+    RepodiffStats stats = { 0 };
+    cr_RepoDiffPkgs *old_pkgs = NULL, *new_pkgs = NULL;
+    GError *tmp_err = NULL;
+    guint diffs;
+
+    // Parse arguments
+    if (!parse_arguments(&argc, &argv, &options, &tmp_err)) {
+        g_printerr("%s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        exit(EXIT_TROUBLE);
+    }
+
+    // Set logging
+    cr_setup_logging(options.quiet, options.verbose);
+
+    // Print version if required
+    if (options.version) {
+        printf("Version: %s\n", cr_version_string_with_features());
+        exit(EXIT_SUCCESS);
+    }
+
+    if (argc != 3) {
+        g_printerr("Usage: repodiff_c [options] <old_repo> <new_repo>\n");
+        exit(EXIT_TROUBLE);
+    }
+
+    // Load the packages
+    old_pkgs = cr_repodiff_pkgs_load(argv[1], !options.no_index, &tmp_err);
+    if (old_pkgs)
+        new_pkgs = cr_repodiff_pkgs_load(argv[2], !options.no_index, &tmp_err);
+    if (!new_pkgs) {
+        g_printerr("%s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        cr_repodiff_pkgs_free(old_pkgs);
+        exit(EXIT_TROUBLE);
+    }
+
+    g_debug("%u packages of %s loaded from %s",
+            cr_repodiff_pkgs_size(old_pkgs), argv[1],
+            cr_repodiff_pkgs_source(old_pkgs));
+    g_debug("%u packages of %s loaded from %s",
+            cr_repodiff_pkgs_size(new_pkgs), argv[2],
+            cr_repodiff_pkgs_source(new_pkgs));
+
+    // Compare them
+    stats.print = !options.quiet && !options.summary;
+    diffs = cr_repodiff(old_pkgs, new_pkgs, diff_cb, &stats);
+
+    if (options.summary && !options.quiet)
+        printf("Added: %u\nRemoved: %u\nChanged: %u\n",
+               stats.added, stats.removed, stats.changed);
+
+    cr_repodiff_pkgs_free(old_pkgs);
+    cr_repodiff_pkgs_free(new_pkgs);
+
+    exit(diffs ? EXIT_DIFFERENT : EXIT_SAME);
+}
@@ -350,11 +350,12 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
     gchar *clocation_real, *clocation_href;
     gchar *checksum = NULL;
     gchar *cchecksum = NULL;
-    gchar *hdrchecksum = NULL;
     int readed;
+    gboolean plain_compressed;
     char buf[BUFFER_SIZE];
     CR_FILE *cw_plain;
     CR_FILE *cw_compressed;
+    cr_ContentStat *out_stat;
     gint64 gf_size = G_GINT64_CONSTANT(-1), cgf_size = G_GINT64_CONSTANT(-1);
     gint64 gf_time = G_GINT64_CONSTANT(-1), cgf_time = G_GINT64_CONSTANT(-1);
     gint64 cgf_hdrsize = G_GINT64_CONSTANT(-1);
@@ -440,7 +441,11 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
         }
     }
 
-    _cleanup_free_ cr_ContentStat *out_stat = g_malloc0(sizeof(cr_ContentStat));
+    // The stats of the written content are the open checksum and size
+    // of the compressed file and, unless the source is compressed too,
+    // also the checksum and size of the source. So the source is read
+    // only once.
+    out_stat = cr_contentstat_new(checksum_type, NULL);
     cw_compressed = cr_sopen(cpath,
                              CR_CW_MODE_WRITE,
                              record_compression,
@@ -449,6 +454,8 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
     if (!cw_compressed) {
         ret = tmp_err->code;
         g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ", cpath);
+        cr_close(cw_plain, NULL);
+        cr_contentstat_free(out_stat, NULL);
         return ret;
     }
 
@@ -456,15 +463,23 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
         if (dict && cr_set_dict(cw_compressed, dict, dict_size, &tmp_err) != CRE_OK) {
             ret = tmp_err->code;
             g_propagate_prefixed_error(err, tmp_err, "Unable to set zdict for %s: ", cpath);
+            cr_close(cw_plain, NULL);
+            cr_close(cw_compressed, NULL);
+            cr_contentstat_free(out_stat, NULL);
             return ret;
         }
         if (cr_set_autochunk(cw_compressed, TRUE, &tmp_err) != CRE_OK) {
             ret = tmp_err->code;
             g_propagate_prefixed_error(err, tmp_err, "Unable to set auto-chunking for %s: ", cpath);
+            cr_close(cw_plain, NULL);
+            cr_close(cw_compressed, NULL);
+            cr_contentstat_free(out_stat, NULL);
             return ret;
         }
     }
 
+    plain_compressed = (cw_plain->type != CR_CW_NO_COMPRESSION);
+
     while ((readed = cr_read(cw_plain, buf, BUFFER_SIZE, &tmp_err)) > 0) {
         cr_write(cw_compressed, buf, (unsigned int) readed, &tmp_err);
         if (tmp_err)
@@ -476,6 +491,7 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
     if (tmp_err) {
         ret = tmp_err->code;
         cr_close(cw_compressed, NULL);
+        cr_contentstat_free(out_stat, NULL);
         g_debug("%s: Error while repomd record compression: %s", __func__,
                 tmp_err->message);
         g_propagate_prefixed_error(err, tmp_err,
@@ -486,6 +502,7 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
     cr_close(cw_compressed, &tmp_err);
     if (tmp_err) {
         ret = tmp_err->code;
+        cr_contentstat_free(out_stat, NULL);
         g_propagate_prefixed_error(err, tmp_err,
                 "Error while closing %s: ", path);
         return ret;
@@ -493,14 +510,19 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
 
     // Compute checksums
 
-    checksum  = cr_checksum_file(path, checksum_type, &tmp_err);
-    if (!checksum) {
-        ret = tmp_err->code;
-        g_propagate_prefixed_error(err, tmp_err,
-                                   "Error while checksum calculation:");
-        goto end;
+    if (plain_compressed) {
+        // The source is compressed (input of zchunk compression),
+        // its own checksum differs from the checksum of its content
+        checksum = cr_checksum_file(path, checksum_type, &tmp_err);
+        if (!checksum) {
+            ret = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Error while checksum calculation:");
+            goto end;
+        }
     }
 
+    // Only the compressed output has to be hashed, it is not decompressed
     cchecksum = cr_checksum_file(cpath, checksum_type, &tmp_err);
     if (!cchecksum) {
         ret = tmp_err->code;
@@ -536,12 +558,12 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
     if (out_stat->hdr_checksum) {
         cgf_hdrsize = out_stat->hdr_size;
         hdr_checksum_str = cr_checksum_name_str(out_stat->hdr_checksum_type);
-        hdrchecksum = out_stat->hdr_checksum;
     }
 
     // Results
 
-    record->checksum = g_string_chunk_insert(record->chunk, checksum);
+    record->checksum = g_string_chunk_insert(record->chunk,
+                                plain_compressed ? checksum : out_stat->checksum);
     record->checksum_type = g_string_chunk_insert(record->chunk, checksum_str);
     record->checksum_open = NULL;
     record->checksum_open_type = NULL;
@@ -554,10 +576,11 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
 
     crecord->checksum = g_string_chunk_insert(crecord->chunk, cchecksum);
     crecord->checksum_type = g_string_chunk_insert(crecord->chunk, checksum_str);
-    crecord->checksum_open = g_string_chunk_insert(record->chunk, checksum);
-    crecord->checksum_open_type = g_string_chunk_insert(record->chunk, checksum_str);
+    crecord->checksum_open = g_string_chunk_insert(crecord->chunk, out_stat->checksum);
+    crecord->checksum_open_type = g_string_chunk_insert(crecord->chunk, checksum_str);
     if (hdr_checksum_str) {
-        crecord->checksum_header = g_string_chunk_insert(crecord->chunk, hdrchecksum);
+        crecord->checksum_header = g_string_chunk_insert(crecord->chunk,
+                                                         out_stat->hdr_checksum);
         crecord->checksum_header_type = g_string_chunk_insert(crecord->chunk, hdr_checksum_str);
     } else {
         crecord->checksum_header = NULL;
@@ -565,13 +588,13 @@ cr_repomd_record_compress_and_fill(cr_RepomdRecord *record,
     }
     crecord->timestamp = cgf_time;
     crecord->size = cgf_size;
-    crecord->size_open = gf_size;
+    crecord->size_open = out_stat->size;
     crecord->size_header = cgf_hdrsize;
 
 end:
     g_free(checksum);
     g_free(cchecksum);
-    g_free(hdrchecksum);
+    cr_contentstat_free(out_stat, NULL);
 
     return ret;
 }
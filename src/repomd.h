@@ -154,6 +154,8 @@ int cr_repomd_record_fill(cr_RepomdRecord *record,
 /** Almost analogous to cr_repomd_record_fill but suitable for groupfile.
  * Record must be set with the path to existing non compressed groupfile.
  * Compressed file will be created and compressed_record updated.
+ * The source file is read only once, its checksum and size are computed
+ * while it is compressed, only the compressed file is hashed afterwards.
  * @param record                cr_RepomdRecord initialized to an existing
  *                              uncompressed file
  * @param compressed_record     empty cr_RepomdRecord object that will by filled
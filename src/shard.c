@@ -0,0 +1,252 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+#include "compression_wrapper.h"
+#include "error.h"
+#include "shard.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+#define SHARD_READ_SIZE         (128 * 1024)
+#define SHARD_MAX_HEADER        (64 * 1024)
+
+#define PKG_START               "<package"
+#define PKG_END                 "</package>"
+
+struct _cr_ShardReader {
+    CR_FILE *f;             // Opened xml file
+    gchar *path;            // Path to the file (for the error messages)
+    GString *buf;           // Read and not yet returned content
+    gsize pos;              // Start of the not yet returned content
+    gsize scan;             // The end of the package is not before this
+    gboolean eof;           // Whole file was read
+    GString *chunk;         // Last returned chunk
+    gint64 packages;        // Number of packages from the header
+};
+
+guint
+cr_shard_of(const char *path, guint count)
+{
+    // 32 bit FNV-1a, the shards must be the same on all the hosts
+    guint32 hash = 2166136261u;
+
+    assert(path);
+    assert(count > 0);
+
+    for (const unsigned char *c = (const unsigned char *) path; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+
+    return hash % count;
+}
+
+/** Location (href) of the package chunk of primary.xml
+ */
+static const char *
+chunk_location(const char *chunk, gsize *len)
+{
+    const char *location = strstr(chunk, "<location ");
+    const char *href = location ? strstr(location, " href=\"") : NULL;
+    const char *end = href ? strchr(href + 7, '"') : NULL;
+
+    if (!end) {
+        *len = 0;
+        return "";
+    }
+
+    *len = end - (href + 7);
+    return href + 7;
+}
+
+/** strcmp() of two not terminated strings
+ */
+static int
+part_cmp(const char *a, gsize a_len, const char *b, gsize b_len)
+{
+    int ret = memcmp(a, b, MIN(a_len, b_len));
+    if (ret)
+        return ret;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+int
+cr_shard_chunk_cmp(const char *a, const char *b)
+{
+    gsize a_len, b_len, a_dir, b_dir;
+    const char *a_href = chunk_location(a, &a_len);
+    const char *b_href = chunk_location(b, &b_len);
+    int ret;
+
+    // Length of the directory (without the trailing slash)
+    for (a_dir = a_len; a_dir && a_href[a_dir-1] != '/'; a_dir--) ;
+    for (b_dir = b_len; b_dir && b_href[b_dir-1] != '/'; b_dir--) ;
+
+    ret = part_cmp(a_href + a_dir, a_len - a_dir, b_href + b_dir, b_len - b_dir);
+    if (ret)
+        return ret;
+    return part_cmp(a_href, a_dir ? a_dir - 1 : 0, b_href, b_dir ? b_dir - 1 : 0);
+}
+
+/** Read the next part of the file, the already returned content
+ * is dropped from the buffer.
+ */
+static gboolean
+reader_fill(cr_ShardReader *reader, GError **err)
+{
+    int len;
+
+    if (reader->pos) {
+        g_string_erase(reader->buf, 0, reader->pos);
+        reader->scan -= MIN(reader->scan, reader->pos);
+        reader->pos = 0;
+    }
+
+    if (reader->eof) {
+        g_set_error(err, ERR_DOMAIN, CRE_XMLDATA,
+                    "Unexpected end of %s", reader->path);
+        return FALSE;
+    }
+
+    gsize old_len = reader->buf->len;
+    g_string_set_size(reader->buf, old_len + SHARD_READ_SIZE);
+    len = cr_read(reader->f, reader->buf->str + old_len, SHARD_READ_SIZE, err);
+    if (len == CR_CW_ERR) {
+        g_string_set_size(reader->buf, old_len);
+        return FALSE;
+    }
+
+    g_string_set_size(reader->buf, old_len + len);
+    if (len == 0)
+        reader->eof = TRUE;
+    return TRUE;
+}
+
+cr_ShardReader *
+cr_shard_reader_open(const char *path, GError **err)
+{
+    cr_ShardReader *reader;
+    const char *packages, *end;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    CR_FILE *f = cr_open(path, CR_CW_MODE_READ,
+                         CR_CW_AUTO_DETECT_COMPRESSION, err);
+    if (!f)
+        return NULL;
+
+    reader = g_new0(cr_ShardReader, 1);
+    reader->f = f;
+    reader->path = g_strdup(path);
+    reader->buf = g_string_sized_new(SHARD_READ_SIZE + 1);
+    reader->chunk = g_string_new(NULL);
+
+    // The root element with the number of packages
+    while (!(packages = strstr(reader->buf->str, " packages=\""))
+           || !(end = strchr(packages, '>')))
+    {
+        if (reader->buf->len > SHARD_MAX_HEADER) {
+            g_set_error(err, ERR_DOMAIN, CRE_XMLDATA,
+                        "Missing number of packages in %s", path);
+            cr_shard_reader_free(reader);
+            return NULL;
+        }
+        if (!reader_fill(reader, err)) {
+            cr_shard_reader_free(reader);
+            return NULL;
+        }
+    }
+
+    reader->packages = g_ascii_strtoll(packages + 11, NULL, 10);
+    reader->pos = reader->scan = end + 1 - reader->buf->str;
+    return reader;
+}
+
+gint64
+cr_shard_reader_packages(cr_ShardReader *reader)
+{
+    assert(reader);
+    return reader->packages;
+}
+
+const char *
+cr_shard_reader_next(cr_ShardReader *reader, GError **err)
+{
+    assert(reader);
+    assert(!err || *err == NULL);
+
+    while (1) {
+        const char *buf = reader->buf->str;
+        gsize pos = reader->pos;
+
+        while (pos < reader->buf->len && g_ascii_isspace(buf[pos]))
+            pos++;
+        reader->pos = pos;
+
+        gsize left = reader->buf->len - pos;
+        if (left >= 2 && !strncmp(buf + pos, "</", 2))
+            // End of the root element
+            return NULL;
+
+        if (left >= strlen(PKG_START)
+            && strncmp(buf + pos, PKG_START, strlen(PKG_START)))
+        {
+            g_set_error(err, ERR_DOMAIN, CRE_XMLDATA,
+                        "Unexpected content of %s", reader->path);
+            return NULL;
+        }
+
+        if (left >= strlen(PKG_START)) {
+            gsize scan = MAX(reader->scan, pos);
+            const char *end = strstr(buf + scan, PKG_END);
+            if (end) {
+                gsize len = end + strlen(PKG_END) - (buf + pos);
+                g_string_truncate(reader->chunk, 0);
+                g_string_append_len(reader->chunk, buf + pos, len);
+                g_string_append_c(reader->chunk, '\n');
+                reader->pos = reader->scan = pos + len;
+                return reader->chunk->str;
+            }
+            // The end could be split by the end of the buffer
+            reader->scan = MAX(pos, reader->buf->len
+                                    - MIN(reader->buf->len,
+                                          strlen(PKG_END) - 1));
+        }
+
+        if (!reader_fill(reader, err))
+            return NULL;
+    }
+}
+
+void
+cr_shard_reader_free(cr_ShardReader *reader)
+{
+    if (!reader)
+        return;
+
+    cr_close(reader->f, NULL);
+    g_free(reader->path);
+    g_string_free(reader->buf, TRUE);
+    g_string_free(reader->chunk, TRUE);
+    g_free(reader);
+}
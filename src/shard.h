@@ -0,0 +1,99 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_SHARD_H__
+#define __C_CREATEREPOLIB_SHARD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+
+/** \defgroup   shard   Repository generated in shards
+ *
+ * A big repository could be generated by more hosts at once. Every one
+ * runs createrepo_c --shard=K/N on the same package directory and gets
+ * the packages whose relative path falls into its shard (see
+ * cr_shard_of()). The shards are then joined by mergerepo_c --shards,
+ * which copies the metadata of the packages as they are (without parsing
+ * them) in the order used by createrepo_c for a whole repository.
+ *
+ * The package chunks of the xml files are read by cr_ShardReader.
+ * The files must be written by createrepo_c: every package element
+ * starts at the beginning of a line and it is followed by a newline.
+ *
+ *  \addtogroup shard
+ *  @{
+ */
+
+/** Shard of a package.
+ * @param path          path of the package relative to the repo
+ * @param count         number of the shards (at least 1)
+ * @return              shard of the package (0 .. count-1)
+ */
+guint cr_shard_of(const char *path, guint count);
+
+/** Compare two package chunks of primary.xml by their locations in the
+ * order used by createrepo_c (by the filename and then by the directory).
+ * The locations are compared as they are written in the xml (escaped).
+ * @param a             package chunk
+ * @param b             package chunk
+ * @return              <0, 0 or >0 as strcmp()
+ */
+int cr_shard_chunk_cmp(const char *a, const char *b);
+
+/** Reader of the package chunks of primary.xml, filelists.xml
+ * or other.xml.
+ */
+typedef struct _cr_ShardReader cr_ShardReader;
+
+/** Open a (compressed) xml file and read its header.
+ * @param path          path to the xml file
+ * @param err           GError **
+ * @return              new reader or NULL on error
+ */
+cr_ShardReader *cr_shard_reader_open(const char *path, GError **err);
+
+/** Number of packages from the header of the file.
+ * @param reader        cr_ShardReader
+ * @return              number of packages
+ */
+gint64 cr_shard_reader_packages(cr_ShardReader *reader);
+
+/** Read the next package chunk (from "<package" to "</package>\n").
+ * @param reader        cr_ShardReader
+ * @param err           GError **
+ * @return              chunk valid until the next call, NULL at the end
+ *                      of the file or on error
+ */
+const char *cr_shard_reader_next(cr_ShardReader *reader, GError **err);
+
+/** Close the file.
+ * @param reader        cr_ShardReader or NULL
+ */
+void cr_shard_reader_free(cr_ShardReader *reader);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_SHARD_H__ */
@@ -24,6 +24,7 @@
 
 #include <glib.h>
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -37,57 +38,85 @@
 #define ENCODED_PACKAGE_FILE_FILES  2048
 #define ENCODED_PACKAGE_FILE_TYPES  60
 
+#define DB_INSERT_MAX_ROWS          16
+#define DB_SERIALIZE_WRITE_SIZE     (64*1024*1024)
+
+/** Insertion of several rows into a table by one multi-row statement.
+ * The statement inserting n rows is handles[n-1], it is prepared when it
+ * is needed for the first time.
+ */
+typedef struct {
+    const char *table;
+    const char *columns;
+    int ncolumns;
+    sqlite3_stmt *handles[DB_INSERT_MAX_ROWS];
+} DbBatchInsert;
+
 struct _DbPrimaryStatements {
     sqlite3 *db;
     sqlite3_stmt *pkg_handle;
-    sqlite3_stmt *provides_handle;
-    sqlite3_stmt *conflicts_handle;
-    sqlite3_stmt *obsoletes_handle;
-    sqlite3_stmt *requires_handle;
-    sqlite3_stmt *suggests_handle;
-    sqlite3_stmt *enhances_handle;
-    sqlite3_stmt *recommends_handle;
-    sqlite3_stmt *supplements_handle;
-    sqlite3_stmt *files_handle;
+    DbBatchInsert *provides_insert;
+    DbBatchInsert *conflicts_insert;
+    DbBatchInsert *obsoletes_insert;
+    DbBatchInsert *requires_insert;
+    DbBatchInsert *suggests_insert;
+    DbBatchInsert *enhances_insert;
+    DbBatchInsert *recommends_insert;
+    DbBatchInsert *supplements_insert;
+    DbBatchInsert *files_insert;
 };
 
 struct _DbFilelistsStatements {
     sqlite3 *db;
     sqlite3_stmt *package_id_handle;
     sqlite3_stmt *filelists_handle;
+    GArray *sorted_files;       // Buffers reused by all packages
+    GString *enc_files;
+    GString *enc_types;
 };
 
 struct _DbOtherStatements {
     sqlite3 *db;
     sqlite3_stmt *package_id_handle;
-    sqlite3_stmt *changelog_handle;
+    DbBatchInsert *changelog_insert;
 };
 
+/** Bind the text, strings which are not valid UTF-8 or contain control
+ * chars are converted from latin1. Clean strings (the usual case) are
+ * bound as they are with their length, so sqlite doesn't measure them
+ * again.
+ */
 static inline int cr_sqlite3_bind_text(sqlite3_stmt *stmt, int i,
                                        const char *orig_content, int len,
                                        void(*desctructor)(void *))
 {
     int ret;
-    int free_content = 0;
+    size_t full_len, clean;
     unsigned char *content;
 
-    if (!orig_content) {
-        content = (unsigned char *) orig_content;
-    } else if (xmlCheckUTF8((const unsigned char *) orig_content)
-               && !cr_hascontrollchars((const unsigned char *) orig_content)) {
-        content = (unsigned char *) orig_content;
-    } else {
-        desctructor = SQLITE_TRANSIENT;
-        size_t llen = strlen((const char *) orig_content);
-        content = malloc(sizeof(unsigned char)*llen*2 + 1);
-        cr_latin1_to_utf8((const unsigned char *) orig_content, content);
-        free_content = 1;
-    }
+    if (!orig_content)
+        return sqlite3_bind_text(stmt, i, NULL, len, desctructor);
 
-    ret = sqlite3_bind_text(stmt, i, (char *) content, len, desctructor);
+    full_len = strlen(orig_content);
+    if (len < 0)
+        len = (int) full_len;
 
-    if (free_content)
-        free(content);
+    // Fast path - printable ASCII. The validity of the rest doesn't
+    // depend on the clean prefix
+    clean = cr_clean_prefix_len(orig_content, full_len);
+    if (clean == full_len
+        || (xmlCheckUTF8((const unsigned char *) orig_content + clean)
+            && !cr_hascontrollchars((const unsigned char *) orig_content + clean)))
+        return sqlite3_bind_text(stmt, i, orig_content, len, desctructor);
+
+    content = malloc(sizeof(unsigned char)*full_len*2 + 1);
+    cr_latin1_to_utf8((const unsigned char *) orig_content, content);
+
+    // The conversion doesn't touch the ASCII tail cut off by the len
+    len = (int) strlen((const char *) content) - (int) (full_len - len);
+    ret = sqlite3_bind_text(stmt, i, (char *) content, len, SQLITE_TRANSIENT);
+
+    free(content);
 
     return ret;
 }
@@ -370,6 +399,11 @@ db_tweak(sqlite3 *db, G_GNUC_UNUSED GError **err)
     sqlite3_exec (db, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
 
     sqlite3_exec (db, "PRAGMA temp_store = MEMORY", NULL, NULL, NULL);
+
+    // The indexes are created at the end, a bigger cache (32 MiB)
+    // speeds up sorting of their keys
+
+    sqlite3_exec (db, "PRAGMA cache_size = -32768", NULL, NULL, NULL);
 }
 
 
@@ -642,7 +676,8 @@ force_null(const char *str)
 static void
 db_package_write (sqlite3 *db,
                   sqlite3_stmt *handle,
-                  cr_Package *p,
+                  const cr_Package *p,
+                  gint64 *pkgKey,
                   GError **err)
 {
     int rc;
@@ -679,7 +714,7 @@ db_package_write (sqlite3 *db,
     sqlite3_reset (handle);
 
     if (rc == SQLITE_DONE) {
-        p->pkgKey = sqlite3_last_insert_rowid (db);
+        *pkgKey = sqlite3_last_insert_rowid (db);
     } else {
         g_critical ("Error adding package to db: %s",
                     sqlite3_errmsg(db));
@@ -690,143 +725,199 @@ db_package_write (sqlite3 *db,
 }
 
 
+static DbBatchInsert *
+db_batch_insert_new(const char *table, const char *columns, int ncolumns)
+{
+    DbBatchInsert *insert = g_new0(DbBatchInsert, 1);
+    insert->table    = table;
+    insert->columns  = columns;
+    insert->ncolumns = ncolumns;
+    return insert;
+}
+
+static void
+db_batch_insert_free(DbBatchInsert *insert)
+{
+    if (!insert)
+        return;
+
+    for (int x = 0; x < DB_INSERT_MAX_ROWS; x++)
+        if (insert->handles[x])
+            sqlite3_finalize(insert->handles[x]);
+    g_free(insert);
+}
+
+/** Get the statement inserting rows (1 - DB_INSERT_MAX_ROWS) rows.
+ * Parameters of the row n (from 0) start at n * ncolumns + 1.
+ */
 static sqlite3_stmt *
-db_dependency_prepare (sqlite3 *db, const char *table, GError **err)
+db_batch_insert_handle(sqlite3 *db,
+                       DbBatchInsert *insert,
+                       int rows,
+                       GError **err)
 {
     int rc;
-    sqlite3_stmt *handle = NULL;
-    char *query;
-
-    const char *pre_name = "";
-    const char *pre_value = "";
 
+    assert(rows > 0 && rows <= DB_INSERT_MAX_ROWS);
     assert(!err || *err == NULL);
 
-    if (!strcmp (table, "requires")) {
-        pre_name = ", pre";
-        pre_value = ", ?";
-    }
+    if (insert->handles[rows-1])
+        return insert->handles[rows-1];
 
-    query = g_strdup_printf
-        ("INSERT INTO %s (name, flags, epoch, version, release, pkgKey%s) "
-         "VALUES (?, ?, ?, ?, ?, ?%s)", table, pre_name, pre_value);
+    GString *query = g_string_new(NULL);
+    g_string_printf(query, "INSERT INTO %s (%s) VALUES ",
+                    insert->table, insert->columns);
+    for (int row = 0; row < rows; row++) {
+        g_string_append(query, row ? ", (" : "(");
+        for (int col = 0; col < insert->ncolumns; col++)
+            g_string_append(query, col ? ", ?" : "?");
+        g_string_append_c(query, ')');
+    }
 
-    rc = sqlite3_prepare_v2 (db, query, -1, &handle, NULL);
-    g_free (query);
+    rc = sqlite3_prepare_v2 (db, query->str, -1,
+                             &(insert->handles[rows-1]), NULL);
+    g_string_free(query, TRUE);
 
     if (rc != SQLITE_OK) {
         g_set_error(err, ERR_DOMAIN, CRE_DB,
-                     "Cannot prepare dependency insertion: %s",
-                     sqlite3_errmsg (db));
-        sqlite3_finalize (handle);
-        handle = NULL;
+                     "Cannot prepare %s insertion: %s",
+                     insert->table, sqlite3_errmsg (db));
+        sqlite3_finalize (insert->handles[rows-1]);
+        insert->handles[rows-1] = NULL;
     }
 
-    return handle;
+    return insert->handles[rows-1];
 }
 
 static void
-db_dependency_write (sqlite3 *db,
+db_batch_insert_step(sqlite3 *db,
                      sqlite3_stmt *handle,
-                     gint64 pkgKey,
-                     cr_Dependency *dep,
-                     gboolean isRequirement,
+                     const char *what,
                      GError **err)
 {
     int rc;
 
     assert(!err || *err == NULL);
 
-    cr_sqlite3_bind_text (handle, 1, dep->name,    -1, SQLITE_STATIC);
-    cr_sqlite3_bind_text (handle, 2, dep->flags,   -1, SQLITE_STATIC);
-    cr_sqlite3_bind_text (handle, 3, dep->epoch,   -1, SQLITE_STATIC);
-    cr_sqlite3_bind_text (handle, 4, dep->version, -1, SQLITE_STATIC);
-    cr_sqlite3_bind_text (handle, 5, dep->release, -1, SQLITE_STATIC);
-    sqlite3_bind_int  (handle, 6, pkgKey);
-
-    if (isRequirement) {
-        if (dep->pre)
-            cr_sqlite3_bind_text (handle, 7, "TRUE", -1, SQLITE_TRANSIENT);
-        else
-            cr_sqlite3_bind_text (handle, 7, "FALSE", -1, SQLITE_TRANSIENT);
-    }
-
     rc = sqlite3_step (handle);
     sqlite3_reset (handle);
 
     if (rc != SQLITE_DONE) {
-        g_critical ("Error adding package dependency to db: %s",
-                    sqlite3_errmsg (db));
+        g_critical ("Error adding %s to db: %s", what, sqlite3_errmsg (db));
         g_set_error(err, ERR_DOMAIN, CRE_DB,
-                    "Error adding package dependency to db: %s",
-                    sqlite3_errmsg(db));
+                    "Error adding %s to db: %s", what, sqlite3_errmsg(db));
     }
 }
 
-static sqlite3_stmt *
-db_file_prepare (sqlite3 *db, GError **err)
+static DbBatchInsert *
+db_dependency_insert_new(const char *table)
 {
-    int rc;
-    sqlite3_stmt *handle = NULL;
-    const char *query;
+    // Only the requires table has the pre column
+    if (!strcmp (table, "requires"))
+        return db_batch_insert_new(table, "name, flags, epoch, version, "
+                                   "release, pkgKey, pre", 7);
+    return db_batch_insert_new(table, "name, flags, epoch, version, "
+                               "release, pkgKey", 6);
+}
+
+static void
+db_dependencies_write (sqlite3 *db,
+                       DbBatchInsert *insert,
+                       gint64 pkgKey,
+                       GSList *deps,
+                       GError **err)
+{
+    GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
 
-    query = "INSERT INTO files (name, type, pkgKey) VALUES (?, ?, ?)";
+    while (deps) {
+        int rows = 0;
+        for (GSList *elem = deps; elem && rows < DB_INSERT_MAX_ROWS; elem = elem->next)
+            rows++;
 
-    rc = sqlite3_prepare_v2 (db, query, -1, &handle, NULL);
-    if (rc != SQLITE_OK) {
-        g_set_error(err, ERR_DOMAIN, CRE_DB,
-                     "Can not prepare file insertion: %s",
-                     sqlite3_errmsg (db));
-        sqlite3_finalize (handle);
-        handle = NULL;
-    }
+        sqlite3_stmt *handle = db_batch_insert_handle(db, insert, rows, &tmp_err);
+        if (!handle) {
+            g_propagate_error(err, tmp_err);
+            return;
+        }
 
-    return handle;
+        for (int row = 0; row < rows; row++, deps = deps->next) {
+            cr_Dependency *dep = deps->data;
+            int col = row * insert->ncolumns;
+
+            cr_sqlite3_bind_text (handle, col+1, dep->name,    -1, SQLITE_STATIC);
+            cr_sqlite3_bind_text (handle, col+2, dep->flags,   -1, SQLITE_STATIC);
+            cr_sqlite3_bind_text (handle, col+3, dep->epoch,   -1, SQLITE_STATIC);
+            cr_sqlite3_bind_text (handle, col+4, dep->version, -1, SQLITE_STATIC);
+            cr_sqlite3_bind_text (handle, col+5, dep->release, -1, SQLITE_STATIC);
+            sqlite3_bind_int  (handle, col+6, pkgKey);
+            if (insert->ncolumns == 7)
+                cr_sqlite3_bind_text (handle, col+7, dep->pre ? "TRUE" : "FALSE",
+                                      -1, SQLITE_STATIC);
+        }
 
+        db_batch_insert_step(db, handle, "package dependency", &tmp_err);
+        if (tmp_err) {
+            g_propagate_error(err, tmp_err);
+            return;
+        }
+    }
 }
 
 static void
-db_file_write (sqlite3 *db,
-               sqlite3_stmt *handle,
-               gint64 pkgKey,
-               cr_PackageFile *file,
-               GError **err)
+db_files_write (sqlite3 *db,
+                DbBatchInsert *insert,
+                gint64 pkgKey,
+                GSList *files,
+                GError **err)
 {
-    int rc;
+    GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
 
-    gchar *fullpath = g_strconcat(file->path, file->name, NULL);
-    if (!fullpath)
-        return; // Nothing to do
+    // Just the primary files, the paths must live until the insertion
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *types = g_ptr_array_new();
 
-    if (!cr_is_primary(fullpath)) {
-        g_free(fullpath);
-        return;
-    }
+    for (GSList *elem = files; elem; elem = elem->next) {
+        cr_PackageFile *file = elem->data;
+        const char *name = file->name ? file->name : "";
+        if (!file->path || !cr_is_primary_file(file->path, name))
+            continue;
 
-    const char* file_type = file->type;
-    if (!file_type || file_type[0] == '\0') {
-        file_type = "file";
+        gchar *fullpath = g_strconcat(file->path, name, NULL);
+
+        const char* file_type = file->type;
+        if (cr_package_file_type(file) == CR_FILE_TYPE_FILE)
+            file_type = "file";
+
+        g_ptr_array_add(paths, fullpath);
+        g_ptr_array_add(types, (gpointer) file_type);
     }
 
-    cr_sqlite3_bind_text (handle, 1, fullpath, -1, SQLITE_TRANSIENT);
-    g_free(fullpath);
-    cr_sqlite3_bind_text (handle, 2, file_type, -1, SQLITE_STATIC);
-    sqlite3_bind_int  (handle, 3, pkgKey);
+    for (guint x = 0; x < paths->len && !tmp_err; ) {
+        int rows = MIN(paths->len - x, DB_INSERT_MAX_ROWS);
 
-    rc = sqlite3_step (handle);
-    sqlite3_reset (handle);
+        sqlite3_stmt *handle = db_batch_insert_handle(db, insert, rows, &tmp_err);
+        if (!handle)
+            break;
 
-    if (rc != SQLITE_DONE) {
-        g_critical ("Error adding package file to db: %s",
-                    sqlite3_errmsg (db));
-        g_set_error(err, ERR_DOMAIN, CRE_DB,
-                    "Error adding package file to db: %s",
-                    sqlite3_errmsg(db));
+        for (int row = 0; row < rows; row++, x++) {
+            int col = row * insert->ncolumns;
+            cr_sqlite3_bind_text (handle, col+1, paths->pdata[x], -1, SQLITE_STATIC);
+            cr_sqlite3_bind_text (handle, col+2, types->pdata[x], -1, SQLITE_STATIC);
+            sqlite3_bind_int  (handle, col+3, pkgKey);
+        }
+
+        db_batch_insert_step(db, handle, "package file", &tmp_err);
     }
+
+    g_ptr_array_free(paths, TRUE);
+    g_ptr_array_free(types, TRUE);
+
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
 }
 
 
@@ -862,79 +953,83 @@ db_filelists_prepare (sqlite3 *db, GError **err)
 
 
 typedef struct {
-    GString *files;
-    GString *types;
-} EncodedPackageFile;
+    cr_PackageFile *file;
+    guint index;        // Position in the package, keeps the sort stable
+} SortedPackageFile;
 
 
-static EncodedPackageFile *
-encoded_package_file_new (void)
+static gint
+sorted_package_file_cmp (gconstpointer a, gconstpointer b)
 {
-    EncodedPackageFile *enc;
+    const SortedPackageFile *fa = a;
+    const SortedPackageFile *fb = b;
+    int cmp = strcmp (fa->file->path, fb->file->path);
 
-    enc = g_new0 (EncodedPackageFile, 1);
-    enc->files = g_string_sized_new (ENCODED_PACKAGE_FILE_FILES);
-    enc->types = g_string_sized_new (ENCODED_PACKAGE_FILE_TYPES);
-
-    return enc;
+    if (cmp)
+        return cmp;
+    return (fa->index > fb->index) - (fa->index < fb->index);
 }
 
 
+/** Fill the reusable array of the statements with package files grouped
+ * by their directory. Files from the same directory keep their order.
+ * Files coming from rpm headers are mostly already ordered, so the sort
+ * is skipped when it isn't needed.
+ */
 static void
-encoded_package_file_free (EncodedPackageFile *file)
+package_files_sort (GArray *sorted, GSList *files)
 {
-    g_string_free (file->files, TRUE);
-    g_string_free (file->types, TRUE);
-    g_free (file);
-}
-
+    gboolean ordered = TRUE;
+    const char *prev = NULL;
 
-static GHashTable *
-package_files_to_hash (GSList *files)
-{
-    GHashTable *hash;
-    GSList *iter;
+    g_array_set_size (sorted, 0);
 
-    hash = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                  NULL,
-                                  (GDestroyNotify) encoded_package_file_free);
+    for (GSList *iter = files; iter; iter = iter->next) {
+        SortedPackageFile item;
 
-    for (iter = files; iter; iter = iter->next) {
-        cr_PackageFile *file;
-        EncodedPackageFile *enc;
-        char *dir;
-        char *name;
+        item.file = (cr_PackageFile *) iter->data;
+        item.index = sorted->len;
+        if (prev && ordered && strcmp (prev, item.file->path) > 0)
+            ordered = FALSE;
+        prev = item.file->path;
+        g_array_append_val (sorted, item);
+    }
 
-        file = (cr_PackageFile *) iter->data;
+    if (!ordered)
+        g_array_sort (sorted, sorted_package_file_cmp);
+}
 
-        dir = file->path;
-        name = file->name;
 
-        enc = (EncodedPackageFile *) g_hash_table_lookup (hash, dir);
-        if (!enc) {
-            enc = encoded_package_file_new ();
-            g_hash_table_insert (hash, dir, enc);
-        }
+static void
+package_file_encode (GString *enc_files,
+                     GString *enc_types,
+                     const cr_PackageFile *file)
+{
+    const char *name = file->name;
 
-        if (enc->files->len)
-            g_string_append_c (enc->files, '/');
+    if (enc_files->len)
+        g_string_append_c (enc_files, '/');
 
-        if (!name || name[0] == '\0')
-            // Root directory '/' has empty name
-            g_string_append_c (enc->files, '/');
-        else
-            g_string_append (enc->files, name);
+    if (!name || name[0] == '\0')
+        // Root directory '/' has empty name
+        g_string_append_c (enc_files, '/');
+    else
+        g_string_append (enc_files, name);
 
 
-        if (!(file->type) || file->type[0] == '\0' || !strcmp (file->type, "file"))
-            g_string_append_c (enc->types, 'f');
-        else if (!strcmp (file->type, "dir"))
-            g_string_append_c (enc->types, 'd');
-        else if (!strcmp (file->type, "ghost"))
-            g_string_append_c (enc->types, 'g');
+    switch (cr_package_file_type(file)) {
+        case CR_FILE_TYPE_FILE:
+            g_string_append_c (enc_types, 'f');
+            break;
+        case CR_FILE_TYPE_DIR:
+            g_string_append_c (enc_types, 'd');
+            break;
+        case CR_FILE_TYPE_GHOST:
+            g_string_append_c (enc_types, 'g');
+            break;
+        default:
+            break;
     }
-
-    return hash;
 }
 
 
@@ -942,21 +1037,21 @@ static void
 cr_db_write_file (sqlite3 *db,
                   sqlite3_stmt *handle,
                   gint64 pkgKey,
-                  gpointer key,
-                  gpointer value,
+                  const char *key,
+                  GString *enc_files,
+                  GString *enc_types,
                   GError **err)
 {
     // key is a path to directory eg. "/etc/X11/xinit/xinitrc.d"
-    // value is a struct eg. { .files="foo/bar/dir", .types="ffd"}
+    // enc_files and enc_types are eg. "foo/bar/dir" and "ffd"
 
     int rc;
     size_t key_len;
-    EncodedPackageFile *file = (EncodedPackageFile *) value;
 
     assert(!err || *err == NULL);
 
-    key_len = strlen((const char *) key);
-    while (key_len > 1 && ((char *) key)[key_len-1] == '/') {
+    key_len = strlen(key);
+    while (key_len > 1 && key[key_len-1] == '/') {
         // Remove trailing '/' char(s)
         // If there are only '/' symbols leave only the first one
         key_len--;
@@ -969,9 +1064,9 @@ cr_db_write_file (sqlite3 *db,
     }
 
     sqlite3_bind_int (handle, 1, pkgKey);
-    cr_sqlite3_bind_text(handle, 2, (const char *) key, (int) key_len, SQLITE_STATIC);
-    cr_sqlite3_bind_text(handle, 3, file->files->str, -1, SQLITE_STATIC);
-    cr_sqlite3_bind_text(handle, 4, file->types->str, -1, SQLITE_STATIC);
+    cr_sqlite3_bind_text(handle, 2, key, (int) key_len, SQLITE_STATIC);
+    cr_sqlite3_bind_text(handle, 3, enc_files->str, -1, SQLITE_STATIC);
+    cr_sqlite3_bind_text(handle, 4, enc_types->str, -1, SQLITE_STATIC);
 
     rc = sqlite3_step (handle);
     sqlite3_reset (handle);
@@ -991,32 +1086,6 @@ cr_db_write_file (sqlite3 *db,
  */
 
 
-static sqlite3_stmt *
-db_changelog_prepare (sqlite3 *db, GError **err)
-{
-    int rc;
-    sqlite3_stmt *handle = NULL;
-    const char *query;
-
-    assert(!err || *err == NULL);
-
-    query =
-        "INSERT INTO changelog (pkgKey, author, date, changelog) "
-        " VALUES (?, ?, ?, ?)";
-
-    rc = sqlite3_prepare_v2 (db, query, -1, &handle, NULL);
-    if (rc != SQLITE_OK) {
-        g_set_error(err, ERR_DOMAIN, CRE_DB,
-                     "Can not prepare changelog insertion: %s",
-                     sqlite3_errmsg (db));
-        sqlite3_finalize (handle);
-        handle = NULL;
-    }
-
-    return handle;
-}
-
-
 // Stuff common for both filelists.sqlite and other.sqlite
 
 
@@ -1045,7 +1114,8 @@ db_package_ids_prepare(sqlite3 *db, GError **err)
 static void
 db_package_ids_write(sqlite3 *db,
                      sqlite3_stmt *handle,
-                     cr_Package *pkg,
+                     const cr_Package *pkg,
+                     gint64 *pkgKey,
                      GError **err)
 {
     int rc;
@@ -1057,7 +1127,7 @@ db_package_ids_write(sqlite3 *db,
     sqlite3_reset (handle);
 
     if (rc == SQLITE_DONE) {
-        pkg->pkgKey = sqlite3_last_insert_rowid (db);
+        *pkgKey = sqlite3_last_insert_rowid (db);
     } else {
         g_critical("Error adding package to db: %s",
                    sqlite3_errmsg(db));
@@ -1082,24 +1152,15 @@ cr_db_destroy_primary_statements(cr_DbPrimaryStatements stmts)
 
     if (stmts->pkg_handle)
         sqlite3_finalize(stmts->pkg_handle);
-    if (stmts->provides_handle)
-        sqlite3_finalize(stmts->provides_handle);
-    if (stmts->conflicts_handle)
-        sqlite3_finalize(stmts->conflicts_handle);
-    if (stmts->obsoletes_handle)
-        sqlite3_finalize(stmts->obsoletes_handle);
-    if (stmts->requires_handle)
-        sqlite3_finalize(stmts->requires_handle);
-    if (stmts->suggests_handle)
-        sqlite3_finalize(stmts->suggests_handle);
-    if (stmts->enhances_handle)
-        sqlite3_finalize(stmts->enhances_handle);
-    if (stmts->recommends_handle)
-        sqlite3_finalize(stmts->recommends_handle);
-    if (stmts->supplements_handle)
-        sqlite3_finalize(stmts->supplements_handle);
-    if (stmts->files_handle)
-        sqlite3_finalize(stmts->files_handle);
+    db_batch_insert_free(stmts->provides_insert);
+    db_batch_insert_free(stmts->conflicts_insert);
+    db_batch_insert_free(stmts->obsoletes_insert);
+    db_batch_insert_free(stmts->requires_insert);
+    db_batch_insert_free(stmts->suggests_insert);
+    db_batch_insert_free(stmts->enhances_insert);
+    db_batch_insert_free(stmts->recommends_insert);
+    db_batch_insert_free(stmts->supplements_insert);
+    db_batch_insert_free(stmts->files_insert);
     free(stmts);
 }
 
@@ -1114,15 +1175,16 @@ cr_db_prepare_primary_statements(sqlite3 *db, GError **err)
 
     ret->db                 = db;
     ret->pkg_handle         = NULL;
-    ret->provides_handle    = NULL;
-    ret->conflicts_handle   = NULL;
-    ret->obsoletes_handle   = NULL;
-    ret->requires_handle    = NULL;
-    ret->suggests_handle    = NULL;
-    ret->enhances_handle    = NULL;
-    ret->recommends_handle  = NULL;
-    ret->supplements_handle = NULL;
-    ret->files_handle       = NULL;
+    ret->provides_insert    = db_dependency_insert_new("provides");
+    ret->conflicts_insert   = db_dependency_insert_new("conflicts");
+    ret->obsoletes_insert   = db_dependency_insert_new("obsoletes");
+    ret->requires_insert    = db_dependency_insert_new("requires");
+    ret->suggests_insert    = db_dependency_insert_new("suggests");
+    ret->enhances_insert    = db_dependency_insert_new("enhances");
+    ret->recommends_insert  = db_dependency_insert_new("recommends");
+    ret->supplements_insert = db_dependency_insert_new("supplements");
+    ret->files_insert       = db_batch_insert_new("files",
+                                                  "name, type, pkgKey", 3);
 
     ret->pkg_handle = db_package_prepare(db, &tmp_err);
     if (tmp_err) {
@@ -1130,56 +1192,11 @@ cr_db_prepare_primary_statements(sqlite3 *db, GError **err)
         goto error;
     }
 
-    ret->provides_handle = db_dependency_prepare(db, "provides", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->conflicts_handle = db_dependency_prepare(db, "conflicts", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->obsoletes_handle = db_dependency_prepare(db, "obsoletes", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->requires_handle = db_dependency_prepare(db, "requires", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->suggests_handle = db_dependency_prepare(db, "suggests", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->enhances_handle = db_dependency_prepare(db, "enhances", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->recommends_handle = db_dependency_prepare(db, "recommends", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->supplements_handle = db_dependency_prepare(db, "supplements", &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        goto error;
-    }
-
-    ret->files_handle = db_file_prepare(db, &tmp_err);
-    if (tmp_err) {
+    // Check the tables now, the other statements are prepared when
+    // they are used for the first time
+    if (!db_batch_insert_handle(db, ret->requires_insert, 1, &tmp_err)
+        || !db_batch_insert_handle(db, ret->provides_insert, 1, &tmp_err)
+        || !db_batch_insert_handle(db, ret->files_insert, 1, &tmp_err)) {
         g_propagate_error(err, tmp_err);
         goto error;
     }
@@ -1194,132 +1211,47 @@ error:
 
 void
 cr_db_add_primary_pkg(cr_DbPrimaryStatements stmts,
-                      cr_Package *pkg,
+                      const cr_Package *pkg,
+                      gint64 *pkgKey,
                       GError **err)
 {
     GError *tmp_err = NULL;
-    GSList *iter;
 
     assert(!err || *err == NULL);
 
-    db_package_write(stmts->db, stmts->pkg_handle, pkg, &tmp_err);
+    db_package_write(stmts->db, stmts->pkg_handle, pkg, pkgKey, &tmp_err);
     if (tmp_err) {
         g_propagate_error(err, tmp_err);
         return;
     }
 
-    for (iter = pkg->provides; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->provides_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            FALSE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->conflicts; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->conflicts_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            FALSE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->obsoletes; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->obsoletes_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            FALSE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->requires; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->requires_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            TRUE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->suggests; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->suggests_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            TRUE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->enhances; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->enhances_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            TRUE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->recommends; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->recommends_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            TRUE,
-                            &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
-
-    for (iter = pkg->supplements; iter; iter = iter->next) {
-        db_dependency_write(stmts->db,
-                            stmts->supplements_handle,
-                            pkg->pkgKey,
-                            (cr_Dependency *) iter->data,
-                            TRUE,
-                            &tmp_err);
+    struct {
+        DbBatchInsert *insert;
+        GSList *deps;
+    } deps[] = {
+        { stmts->provides_insert,    pkg->provides },
+        { stmts->conflicts_insert,   pkg->conflicts },
+        { stmts->obsoletes_insert,   pkg->obsoletes },
+        { stmts->requires_insert,    pkg->requires },
+        { stmts->suggests_insert,    pkg->suggests },
+        { stmts->enhances_insert,    pkg->enhances },
+        { stmts->recommends_insert,  pkg->recommends },
+        { stmts->supplements_insert, pkg->supplements },
+    };
+
+    for (size_t x = 0; x < G_N_ELEMENTS(deps); x++) {
+        db_dependencies_write(stmts->db, deps[x].insert, *pkgKey,
+                              deps[x].deps, &tmp_err);
         if (tmp_err) {
             g_propagate_error(err, tmp_err);
             return;
         }
     }
 
-    for (iter = pkg->files; iter; iter = iter->next) {
-        db_file_write(stmts->db, stmts->files_handle, pkg->pkgKey,
-                      (cr_PackageFile *) iter->data, &tmp_err);
-        if (tmp_err) {
-            g_propagate_error(err, tmp_err);
-            return;
-        }
-    }
+    db_files_write(stmts->db, stmts->files_insert, *pkgKey, pkg->files,
+                   &tmp_err);
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
 }
 
 
@@ -1336,6 +1268,9 @@ cr_db_destroy_filelists_statements(cr_DbFilelistsStatements stmts)
         sqlite3_finalize(stmts->package_id_handle);
     if (stmts->filelists_handle)
         sqlite3_finalize(stmts->filelists_handle);
+    g_array_free(stmts->sorted_files, TRUE);
+    g_string_free(stmts->enc_files, TRUE);
+    g_string_free(stmts->enc_types, TRUE);
     free(stmts);
 }
 
@@ -1351,6 +1286,10 @@ cr_db_prepare_filelists_statements(sqlite3 *db, GError **err)
     ret->db                = db;
     ret->package_id_handle = NULL;
     ret->filelists_handle  = NULL;
+    ret->sorted_files      = g_array_new(FALSE, FALSE,
+                                         sizeof(SortedPackageFile));
+    ret->enc_files         = g_string_sized_new(ENCODED_PACKAGE_FILE_FILES);
+    ret->enc_types         = g_string_sized_new(ENCODED_PACKAGE_FILE_TYPES);
 
     ret->package_id_handle = db_package_ids_prepare(db, &tmp_err);
     if (tmp_err) {
@@ -1374,7 +1313,8 @@ error:
 
 void
 cr_db_add_filelists_pkg(cr_DbFilelistsStatements stmts,
-                        cr_Package *pkg,
+                        const cr_Package *pkg,
+                        gint64 *pkgKey,
                         GError **err)
 {
     GError *tmp_err = NULL;
@@ -1382,31 +1322,39 @@ cr_db_add_filelists_pkg(cr_DbFilelistsStatements stmts,
     assert(!err || *err == NULL);
 
     // Add record into the package table
-    db_package_ids_write(stmts->db, stmts->package_id_handle, pkg, &tmp_err);
+    db_package_ids_write(stmts->db, stmts->package_id_handle, pkg, pkgKey,
+                         &tmp_err);
     if (tmp_err) {
         g_propagate_error(err, tmp_err);
         return;
     }
 
-    // Add records into the filelist table
-    GHashTable *hash;
-    GHashTableIter iter;
-    gpointer key, value;
+    // Add records into the filelist table, one per directory
+    GArray *sorted = stmts->sorted_files;
+    GString *enc_files = stmts->enc_files;
+    GString *enc_types = stmts->enc_types;
 
-    // Create a hashtable where:
-    // key is a path to directory eg. "/etc/X11/xinit/xinitrc.d"
-    // value is a struct eg. { .files="foo/bar/dir", .types="ffd"}
-    hash = package_files_to_hash(pkg->files);
-    g_hash_table_iter_init(&iter, hash);
-    while (g_hash_table_iter_next (&iter, &key, &value)) {
-        cr_db_write_file(stmts->db, stmts->filelists_handle, pkg->pkgKey, key, value, &tmp_err);
+    package_files_sort(sorted, pkg->files);
+    for (guint x = 0; x < sorted->len; x++) {
+        cr_PackageFile *file = g_array_index(sorted, SortedPackageFile, x).file;
+
+        package_file_encode(enc_files, enc_types, file);
+
+        // Write the directory when its last file was encoded
+        if (x + 1 < sorted->len
+            && !strcmp(file->path,
+                       g_array_index(sorted, SortedPackageFile, x+1).file->path))
+            continue;
+
+        cr_db_write_file(stmts->db, stmts->filelists_handle, *pkgKey,
+                         file->path, enc_files, enc_types, &tmp_err);
+        g_string_truncate(enc_files, 0);
+        g_string_truncate(enc_types, 0);
         if (tmp_err) {
             g_propagate_error(err, tmp_err);
             break;
         }
     }
-
-    g_hash_table_destroy(hash);
 }
 
 
@@ -1421,8 +1369,7 @@ cr_db_destroy_other_statements(cr_DbOtherStatements stmts)
 
     if (stmts->package_id_handle)
         sqlite3_finalize(stmts->package_id_handle);
-    if (stmts->changelog_handle)
-        sqlite3_finalize(stmts->changelog_handle);
+    db_batch_insert_free(stmts->changelog_insert);
     free(stmts);
 }
 
@@ -1437,7 +1384,8 @@ cr_db_prepare_other_statements(sqlite3 *db, GError **err)
 
     ret->db                = db;
     ret->package_id_handle = NULL;
-    ret->changelog_handle  = NULL;
+    ret->changelog_insert  = db_batch_insert_new("changelog",
+                                        "pkgKey, author, date, changelog", 4);
 
     ret->package_id_handle = db_package_ids_prepare(db, &tmp_err);
     if (tmp_err) {
@@ -1445,8 +1393,7 @@ cr_db_prepare_other_statements(sqlite3 *db, GError **err)
         goto error;
     }
 
-    ret->changelog_handle = db_changelog_prepare(db, &tmp_err);
-    if (tmp_err) {
+    if (!db_batch_insert_handle(db, ret->changelog_insert, 1, &tmp_err)) {
         g_propagate_error(err, tmp_err);
         goto error;
     }
@@ -1460,42 +1407,52 @@ error:
 
 
 void
-cr_db_add_other_pkg(cr_DbOtherStatements stmts, cr_Package *pkg, GError **err)
+cr_db_add_other_pkg(cr_DbOtherStatements stmts,
+                    const cr_Package *pkg,
+                    gint64 *pkgKey,
+                    GError **err)
 {
-    int rc;
     GSList *iter;
-    cr_ChangelogEntry *entry;
     GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
 
-    sqlite3_stmt *handle = stmts->changelog_handle;
-
     // Add package record into the packages table
-    db_package_ids_write(stmts->db, stmts->package_id_handle, pkg, &tmp_err);
+    db_package_ids_write(stmts->db, stmts->package_id_handle, pkg, pkgKey,
+                         &tmp_err);
     if (tmp_err) {
         g_propagate_error(err, tmp_err);
         return;
     }
 
     // Add changelog recrods into the changelog table
-    for (iter = pkg->changelogs; iter; iter = iter->next) {
-        entry = (cr_ChangelogEntry *) iter->data;
+    iter = pkg->changelogs;
+    while (iter) {
+        int rows = 0;
+        for (GSList *elem = iter; elem && rows < DB_INSERT_MAX_ROWS; elem = elem->next)
+            rows++;
+
+        sqlite3_stmt *handle = db_batch_insert_handle(stmts->db,
+                                                      stmts->changelog_insert,
+                                                      rows, &tmp_err);
+        if (!handle) {
+            g_propagate_error(err, tmp_err);
+            return;
+        }
 
-        sqlite3_bind_int  (handle, 1, pkg->pkgKey);
-        cr_sqlite3_bind_text (handle, 2, entry->author, -1, SQLITE_STATIC);
-        sqlite3_bind_int  (handle, 3, entry->date);
-        cr_sqlite3_bind_text (handle, 4, entry->changelog, -1, SQLITE_STATIC);
+        for (int row = 0; row < rows; row++, iter = iter->next) {
+            cr_ChangelogEntry *entry = iter->data;
+            int col = row * stmts->changelog_insert->ncolumns;
 
-        rc = sqlite3_step (handle);
-        sqlite3_reset (handle);
+            sqlite3_bind_int  (handle, col+1, *pkgKey);
+            cr_sqlite3_bind_text (handle, col+2, entry->author, -1, SQLITE_STATIC);
+            sqlite3_bind_int  (handle, col+3, entry->date);
+            cr_sqlite3_bind_text (handle, col+4, entry->changelog, -1, SQLITE_STATIC);
+        }
 
-        if (rc != SQLITE_DONE) {
-            g_critical ("Error adding changelog to db: %s",
-                        sqlite3_errmsg (stmts->db));
-            g_set_error(err, ERR_DOMAIN, CRE_DB,
-                        "Error adding changelog to db : %s",
-                        sqlite3_errmsg(stmts->db));
+        db_batch_insert_step(stmts->db, handle, "changelog", &tmp_err);
+        if (tmp_err) {
+            g_propagate_error(err, tmp_err);
             return;
         }
     }
@@ -1523,7 +1480,8 @@ cr_db_open(const char *path, cr_DatabaseType db_type, GError **err)
         return NULL;
     }
 
-    exists = g_file_test(path, G_FILE_TEST_IS_REGULAR);
+    exists = strcmp(path, CR_DB_IN_MEMORY)
+             && g_file_test(path, G_FILE_TEST_IS_REGULAR);
     if (exists) {
         struct stat stat_buf;
         if (stat(path, &stat_buf) == -1) {
@@ -1555,15 +1513,15 @@ cr_db_open(const char *path, cr_DatabaseType db_type, GError **err)
         return NULL;
     }
 
-    db_create_dbinfo_table(db, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        sqlite3_close(db);
-        return NULL;
-    }
-
     if (!exists) {
         // Do not recreate tables, indexes and triggers if db has existed.
+        db_create_dbinfo_table(db, &tmp_err);
+        if (tmp_err) {
+            g_propagate_error(err, tmp_err);
+            sqlite3_close(db);
+            return NULL;
+        }
+
         switch (db_type) {
             case CR_DB_PRIMARY:
                 db_create_primary_tables(db, &tmp_err);
@@ -1637,16 +1595,16 @@ cr_db_open(const char *path, cr_DatabaseType db_type, GError **err)
 }
 
 
-int
-cr_db_close(cr_SqliteDb *sqlitedb, GError **err)
+/** Create indexes, destroy compiled statements and commit the transaction
+ * of the db before it is closed.
+ */
+static int
+db_finish(cr_SqliteDb *sqlitedb, GError **err)
 {
     GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
 
-    if (!sqlitedb)
-        return CRE_OK;
-
     switch (sqlitedb->type) {
         case CR_DB_PRIMARY:
             db_index_primary_tables(sqlitedb->db, &tmp_err);
@@ -1674,18 +1632,465 @@ cr_db_close(cr_SqliteDb *sqlitedb, GError **err)
     }
 
     sqlite3_exec (sqlitedb->db, "COMMIT", NULL, NULL, NULL);
-    sqlite3_close(sqlitedb->db);
-
-    g_free(sqlitedb);
 
     return CRE_OK;
 }
 
 
-int
-cr_db_add_pkg(cr_SqliteDb *sqlitedb, cr_Package *pkg, GError **err)
+static void
+db_free(cr_SqliteDb *sqlitedb)
 {
-    GError *tmp_err = NULL;
+    sqlite3_close(sqlitedb->db);
+
+    if (sqlitedb->reused_pkgs)
+        g_hash_table_destroy(sqlitedb->reused_pkgs);
+    g_free(sqlitedb);
+}
+
+
+int
+cr_db_close(cr_SqliteDb *sqlitedb, GError **err)
+{
+    int rc;
+
+    assert(!err || *err == NULL);
+
+    if (!sqlitedb)
+        return CRE_OK;
+
+    rc = db_finish(sqlitedb, err);
+    if (rc != CRE_OK)
+        return rc;
+
+    db_free(sqlitedb);
+
+    return CRE_OK;
+}
+
+
+int
+cr_db_close_compressed(cr_SqliteDb *sqlitedb,
+                       const char *dst,
+                       cr_CompressionType comtype,
+                       cr_ContentStat *stat,
+                       GError **err)
+{
+    int rc;
+    GError *tmp_err = NULL;
+
+    assert(sqlitedb);
+    assert(dst);
+    assert(!err || *err == NULL);
+
+    rc = db_finish(sqlitedb, err);
+    if (rc != CRE_OK)
+        return rc;
+
+#if SQLITE_VERSION_NUMBER >= 3036000
+    sqlite3_int64 size = 0;
+    unsigned char *data;
+    gboolean copied = FALSE;
+
+    // The content of an in-memory db is used without a copy if possible
+    data = sqlite3_serialize(sqlitedb->db, "main", &size,
+                             SQLITE_SERIALIZE_NOCOPY);
+    if (!data) {
+        data = sqlite3_serialize(sqlitedb->db, "main", &size, 0);
+        copied = TRUE;
+    }
+
+    if (!data) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Cannot serialize db: %s", sqlite3_errmsg(sqlitedb->db));
+        db_free(sqlitedb);
+        return CRE_DB;
+    }
+
+    CR_FILE *cr_file = cr_sopen(dst, CR_CW_MODE_WRITE, comtype, stat, &tmp_err);
+    if (cr_file) {
+        for (sqlite3_int64 off = 0; off < size && !tmp_err; ) {
+            unsigned int len = (unsigned int) MIN(size - off,
+                                                  DB_SERIALIZE_WRITE_SIZE);
+            cr_write(cr_file, data + off, len, &tmp_err);
+            off += len;
+        }
+        cr_close(cr_file, tmp_err ? NULL : &tmp_err);
+    }
+
+    if (copied)
+        sqlite3_free(data);
+#else
+    (void) comtype;
+    (void) stat;
+    g_set_error(&tmp_err, ERR_DOMAIN, CRE_DB,
+                "Cannot serialize db: sqlite older than 3.36.0");
+#endif
+
+    db_free(sqlitedb);
+
+    if (tmp_err) {
+        int code = tmp_err->code;
+        g_propagate_prefixed_error(err, tmp_err, "Cannot write %s: ", dst);
+        return code;
+    }
+
+    return CRE_OK;
+}
+
+
+/** Package of a reused database.
+ */
+typedef struct {
+    gint64 pkgKey;
+    gboolean used;      // The package was added again
+} DbReusedPkg;
+
+
+static gchar *
+db_reused_pkg_key(cr_DatabaseType type,
+                  const char *pkgId,
+                  const char *location_href,
+                  const char *location_base)
+{
+    // A primary package also describes its location
+    if (type == CR_DB_PRIMARY)
+        return g_strconcat(pkgId, "\t",
+                           location_href ? location_href : "", "\t",
+                           location_base ? location_base : "", NULL);
+    return g_strdup(pkgId);
+}
+
+
+/** Check that the existing database was created by the same version
+ * of the db api.
+ */
+static gboolean
+db_check_version(sqlite3 *db, const char *what, GError **err)
+{
+    int rc;
+    sqlite3_stmt *handle;
+
+    rc = sqlite3_prepare_v2(db, "SELECT dbversion FROM db_info",
+                            -1, &handle, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_step(handle);
+    if (rc != SQLITE_ROW
+        || sqlite3_column_int(handle, 0) != CR_DB_CACHE_DBVERSION)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Cannot %s db: missing or unsupported db version", what);
+        sqlite3_finalize(handle);
+        return FALSE;
+    }
+    sqlite3_finalize(handle);
+    return TRUE;
+}
+
+
+int
+cr_db_reuse_packages(cr_SqliteDb *sqlitedb, GError **err)
+{
+    int rc;
+    sqlite3_stmt *handle;
+    const char *query;
+
+    assert(sqlitedb);
+    assert(!err || *err == NULL);
+
+    if (!db_check_version(sqlitedb->db, "reuse", err))
+        return CRE_DB;
+
+    if (sqlitedb->type == CR_DB_PRIMARY)
+        query = "SELECT pkgKey, pkgId, location_href, location_base "
+                "FROM packages";
+    else
+        query = "SELECT pkgKey, pkgId FROM packages";
+
+    rc = sqlite3_prepare_v2(sqlitedb->db, query, -1, &handle, NULL);
+    if (rc != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Cannot prepare packages select: %s",
+                    sqlite3_errmsg(sqlitedb->db));
+        sqlite3_finalize(handle);
+        return CRE_DB;
+    }
+
+    if (!sqlitedb->reused_pkgs)
+        sqlitedb->reused_pkgs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                      g_free, g_free);
+
+    while ((rc = sqlite3_step(handle)) == SQLITE_ROW) {
+        const char *pkgId = (const char *) sqlite3_column_text(handle, 1);
+        const char *location_href = NULL;
+        const char *location_base = NULL;
+
+        if (!pkgId)
+            continue;
+
+        if (sqlitedb->type == CR_DB_PRIMARY) {
+            location_href = (const char *) sqlite3_column_text(handle, 2);
+            location_base = (const char *) sqlite3_column_text(handle, 3);
+        }
+
+        DbReusedPkg *reused = g_new0(DbReusedPkg, 1);
+        reused->pkgKey = sqlite3_column_int64(handle, 0);
+        g_hash_table_replace(sqlitedb->reused_pkgs,
+                             db_reused_pkg_key(sqlitedb->type, pkgId,
+                                               location_href, location_base),
+                             reused);
+    }
+
+    sqlite3_finalize(handle);
+
+    if (rc != SQLITE_DONE) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Error reading packages of db: %s",
+                    sqlite3_errmsg(sqlitedb->db));
+        g_hash_table_destroy(sqlitedb->reused_pkgs);
+        sqlitedb->reused_pkgs = NULL;
+        return CRE_DB;
+    }
+
+    return CRE_OK;
+}
+
+
+int
+cr_db_remove_unused_packages(cr_SqliteDb *sqlitedb,
+                             guint *removed,
+                             GError **err)
+{
+    int rc;
+    guint count = 0;
+    sqlite3_stmt *handle;
+    GHashTableIter iter;
+    gpointer value;
+
+    assert(sqlitedb);
+    assert(!err || *err == NULL);
+
+    if (removed)
+        *removed = 0;
+
+    if (!sqlitedb->reused_pkgs)
+        return CRE_OK;
+
+    // Related rows are removed by the triggers of the packages table
+    rc = sqlite3_prepare_v2(sqlitedb->db,
+                            "DELETE FROM packages WHERE pkgKey = ?",
+                            -1, &handle, NULL);
+    if (rc != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Cannot prepare packages delete: %s",
+                    sqlite3_errmsg(sqlitedb->db));
+        sqlite3_finalize(handle);
+        return CRE_DB;
+    }
+
+    g_hash_table_iter_init(&iter, sqlitedb->reused_pkgs);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        DbReusedPkg *reused = value;
+
+        if (reused->used)
+            continue;
+
+        sqlite3_bind_int64(handle, 1, reused->pkgKey);
+        rc = sqlite3_step(handle);
+        sqlite3_reset(handle);
+        if (rc != SQLITE_DONE) {
+            g_set_error(err, ERR_DOMAIN, CRE_DB,
+                        "Error removing package from db: %s",
+                        sqlite3_errmsg(sqlitedb->db));
+            sqlite3_finalize(handle);
+            return CRE_DB;
+        }
+        count++;
+    }
+
+    sqlite3_finalize(handle);
+    g_hash_table_destroy(sqlitedb->reused_pkgs);
+    sqlitedb->reused_pkgs = NULL;
+
+    if (removed)
+        *removed = count;
+
+    return CRE_OK;
+}
+
+
+/** Copy all rows of the table of the attached "shard" db into the same
+ * table of the main db, the pkgKeys are moved by the offset.
+ */
+static gboolean
+db_append_table(sqlite3 *db, const char *table, gint64 offset, GError **err)
+{
+    int rc;
+    sqlite3_stmt *handle;
+    gchar *query;
+
+    query = g_strdup_printf("PRAGMA shard.table_info(%s)", table);
+    rc = sqlite3_prepare_v2(db, query, -1, &handle, NULL);
+    g_free(query);
+    if (rc != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Cannot prepare table_info of %s: %s",
+                    table, sqlite3_errmsg(db));
+        sqlite3_finalize(handle);
+        return FALSE;
+    }
+
+    GString *cols = g_string_new(NULL);
+    GString *vals = g_string_new(NULL);
+
+    while ((rc = sqlite3_step(handle)) == SQLITE_ROW) {
+        const char *col = (const char *) sqlite3_column_text(handle, 1);
+        if (cols->len) {
+            g_string_append_c(cols, ',');
+            g_string_append_c(vals, ',');
+        }
+        g_string_append(cols, col);
+        if (!strcmp(col, "pkgKey"))
+            g_string_append_printf(vals, "pkgKey + %" G_GINT64_FORMAT,
+                                   offset);
+        else
+            g_string_append(vals, col);
+    }
+    sqlite3_finalize(handle);
+
+    if (rc == SQLITE_DONE && cols->len) {
+        query = g_strdup_printf("INSERT INTO main.%s (%s) SELECT %s "
+                                "FROM shard.%s", table, cols->str,
+                                vals->str, table);
+        rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+        g_free(query);
+    } else if (rc == SQLITE_DONE) {
+        rc = SQLITE_ERROR;
+    }
+
+    g_string_free(cols, TRUE);
+    g_string_free(vals, TRUE);
+
+    if (rc != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Cannot copy table %s: %s", table, sqlite3_errmsg(db));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+int
+cr_db_append_db(cr_SqliteDb *sqlitedb,
+                const char *path,
+                const char *location_base,
+                GError **err)
+{
+    static const char *primary_tables[] = {
+        "packages", "files", "requires", "provides", "conflicts",
+        "obsoletes", "suggests", "enhances", "recommends", "supplements",
+        NULL };
+    static const char *filelists_tables[] = { "packages", "filelist", NULL };
+    static const char *other_tables[] = { "packages", "changelog", NULL };
+    const char **tables;
+    GError *tmp_err = NULL;
+    sqlite3_stmt *handle;
+    gint64 offset = 0;
+    gchar *query;
+    int rc;
+
+    assert(sqlitedb);
+    assert(path);
+    assert(!err || *err == NULL);
+
+    switch (sqlitedb->type) {
+        case CR_DB_PRIMARY:     tables = primary_tables;    break;
+        case CR_DB_FILELISTS:   tables = filelists_tables;  break;
+        case CR_DB_OTHER:       tables = other_tables;      break;
+        default:
+            g_set_error(err, ERR_DOMAIN, CRE_ASSERT, "Bad db type");
+            return CRE_ASSERT;
+    }
+
+    // A database cannot be attached inside of a transaction
+    sqlite3_exec(sqlitedb->db, "COMMIT", NULL, NULL, NULL);
+
+    query = sqlite3_mprintf("ATTACH %Q AS shard", path);
+    rc = sqlite3_exec(sqlitedb->db, query, NULL, NULL, NULL);
+    sqlite3_free(query);
+    if (rc != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB, "Cannot attach %s: %s",
+                    path, sqlite3_errmsg(sqlitedb->db));
+        sqlite3_exec(sqlitedb->db, "BEGIN", NULL, NULL, NULL);
+        return CRE_DB;
+    }
+
+    sqlite3_exec(sqlitedb->db, "BEGIN", NULL, NULL, NULL);
+
+    rc = sqlite3_prepare_v2(sqlitedb->db,
+                            "SELECT dbversion FROM shard.db_info",
+                            -1, &handle, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_step(handle);
+    if (rc != SQLITE_ROW
+        || sqlite3_column_int(handle, 0) != CR_DB_CACHE_DBVERSION)
+        g_set_error(&tmp_err, ERR_DOMAIN, CRE_DB,
+                    "Cannot append db %s: missing or unsupported db version",
+                    path);
+    sqlite3_finalize(handle);
+
+    if (!tmp_err) {
+        rc = sqlite3_prepare_v2(sqlitedb->db,
+                                "SELECT IFNULL(MAX(pkgKey), 0) "
+                                "FROM main.packages",
+                                -1, &handle, NULL);
+        if (rc == SQLITE_OK && sqlite3_step(handle) == SQLITE_ROW)
+            offset = sqlite3_column_int64(handle, 0);
+        else
+            g_set_error(&tmp_err, ERR_DOMAIN, CRE_DB,
+                        "Cannot select max pkgKey: %s",
+                        sqlite3_errmsg(sqlitedb->db));
+        sqlite3_finalize(handle);
+    }
+
+    for (int x = 0; tables[x] && !tmp_err; x++)
+        db_append_table(sqlitedb->db, tables[x], offset, &tmp_err);
+
+    if (!tmp_err && location_base && sqlitedb->type == CR_DB_PRIMARY) {
+        query = sqlite3_mprintf("UPDATE main.packages SET location_base = %Q "
+                                "WHERE pkgKey > %lld AND (location_base IS "
+                                "NULL OR location_base = '')",
+                                location_base, (long long) offset);
+        rc = sqlite3_exec(sqlitedb->db, query, NULL, NULL, NULL);
+        sqlite3_free(query);
+        if (rc != SQLITE_OK)
+            g_set_error(&tmp_err, ERR_DOMAIN, CRE_DB,
+                        "Cannot set location_base: %s",
+                        sqlite3_errmsg(sqlitedb->db));
+    }
+
+    // The rows are kept even on error, the db is not used then anyway
+    sqlite3_exec(sqlitedb->db, "COMMIT", NULL, NULL, NULL);
+    sqlite3_exec(sqlitedb->db, "DETACH shard", NULL, NULL, NULL);
+    sqlite3_exec(sqlitedb->db, "BEGIN", NULL, NULL, NULL);
+
+    if (tmp_err) {
+        int code = tmp_err->code;
+        g_propagate_error(err, tmp_err);
+        return code;
+    }
+
+    return CRE_OK;
+}
+
+
+static int
+db_add_pkg(cr_SqliteDb *sqlitedb,
+           const cr_Package *pkg,
+           gint64 *pkgKey,
+           GError **err)
+{
+    GError *tmp_err = NULL;
 
     assert(sqlitedb);
     assert(sqlitedb->type < CR_DB_SENTINEL);
@@ -1694,15 +2099,29 @@ cr_db_add_pkg(cr_SqliteDb *sqlitedb, cr_Package *pkg, GError **err)
     if (!pkg)
         return CRE_OK;
 
+    if (sqlitedb->reused_pkgs && pkg->pkgId) {
+        // Keep the package of a reused database
+        gchar *key = db_reused_pkg_key(sqlitedb->type, pkg->pkgId,
+                                       pkg->location_href,
+                                       pkg->location_base);
+        DbReusedPkg *reused = g_hash_table_lookup(sqlitedb->reused_pkgs, key);
+        g_free(key);
+        if (reused && !reused->used) {
+            reused->used = TRUE;
+            *pkgKey = reused->pkgKey;
+            return CRE_OK;
+        }
+    }
+
     switch (sqlitedb->type) {
     case CR_DB_PRIMARY:
-        cr_db_add_primary_pkg(sqlitedb->statements.pri, pkg, &tmp_err);
+        cr_db_add_primary_pkg(sqlitedb->statements.pri, pkg, pkgKey, &tmp_err);
         break;
     case CR_DB_FILELISTS:
-        cr_db_add_filelists_pkg(sqlitedb->statements.fil, pkg, &tmp_err);
+        cr_db_add_filelists_pkg(sqlitedb->statements.fil, pkg, pkgKey, &tmp_err);
         break;
     case CR_DB_OTHER:
-        cr_db_add_other_pkg(sqlitedb->statements.oth, pkg, &tmp_err);
+        cr_db_add_other_pkg(sqlitedb->statements.oth, pkg, pkgKey, &tmp_err);
         break;
     default:
         g_critical("%s: Bad db type", __func__);
@@ -1719,3 +2138,512 @@ cr_db_add_pkg(cr_SqliteDb *sqlitedb, cr_Package *pkg, GError **err)
 
     return CRE_OK;
 }
+
+
+int
+cr_db_add_pkg(cr_SqliteDb *sqlitedb, cr_Package *pkg, GError **err)
+{
+    gint64 pkgKey;
+    int rc;
+
+    if (!pkg)
+        return CRE_OK;
+
+    pkgKey = pkg->pkgKey;
+    rc = db_add_pkg(sqlitedb, pkg, &pkgKey, err);
+    pkg->pkgKey = pkgKey;
+    return rc;
+}
+
+
+int
+cr_db_add_const_pkg(cr_SqliteDb *sqlitedb, const cr_Package *pkg, GError **err)
+{
+    gint64 pkgKey = 0;
+
+    return db_add_pkg(sqlitedb, pkg, &pkgKey, err);
+}
+
+
+// Reading of packages
+
+
+/** Tables with dependencies and the lists of cr_Package they are read to.
+ */
+static const struct {
+    const char *table;
+    size_t listoffset;
+} db_dependency_tables[] = {
+    { "provides",    offsetof(cr_Package, provides) },
+    { "conflicts",   offsetof(cr_Package, conflicts) },
+    { "obsoletes",   offsetof(cr_Package, obsoletes) },
+    { "requires",    offsetof(cr_Package, requires) },
+    { "suggests",    offsetof(cr_Package, suggests) },
+    { "enhances",    offsetof(cr_Package, enhances) },
+    { "recommends",  offsetof(cr_Package, recommends) },
+    { "supplements", offsetof(cr_Package, supplements) },
+};
+
+#define DB_DEPENDENCY_TABLES    G_N_ELEMENTS(db_dependency_tables)
+
+struct _cr_DbPackageReader {
+    sqlite3 *pri_db;
+    sqlite3 *fil_db;
+    sqlite3 *oth_db;
+    sqlite3_stmt *pkg_handle;
+    sqlite3_stmt *dep_handles[DB_DEPENDENCY_TABLES];
+    sqlite3_stmt *files_handle;
+    sqlite3_stmt *changelogs_handle;
+    GHashTable *hrefs;      // cleaned location_href -> pkgKey (0 if
+                            // the href is used by more packages)
+    GMutex lock;            // Statements are used by one thread at a time
+};
+
+
+static sqlite3 *
+db_open_readonly(const char *path, GError **err)
+{
+    sqlite3 *db = NULL;
+    int rc = sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL);
+
+    if (rc != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB, "Cannot open %s: %s",
+                    path, db ? sqlite3_errmsg(db) : sqlite3_errstr(rc));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    if (!db_check_version(db, "read", err)) {
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+
+static sqlite3_stmt *
+db_reader_prepare(sqlite3 *db, const char *query, GError **err)
+{
+    sqlite3_stmt *handle = NULL;
+
+    if (sqlite3_prepare_v2(db, query, -1, &handle, NULL) != SQLITE_OK) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB, "Cannot prepare \"%s\": %s",
+                    query, sqlite3_errmsg(db));
+        sqlite3_finalize(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+
+cr_DbPackageReader *
+cr_db_package_reader_new(const char *primary_path,
+                         const char *filelists_path,
+                         const char *other_path,
+                         GError **err)
+{
+    cr_DbPackageReader *reader;
+    sqlite3_stmt *handle;
+    int rc;
+
+    assert(primary_path);
+    assert(filelists_path);
+    assert(other_path);
+    assert(!err || *err == NULL);
+
+    reader = g_new0(cr_DbPackageReader, 1);
+    g_mutex_init(&reader->lock);
+    reader->hrefs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          g_free, g_free);
+
+    if (!(reader->pri_db = db_open_readonly(primary_path, err))
+        || !(reader->fil_db = db_open_readonly(filelists_path, err))
+        || !(reader->oth_db = db_open_readonly(other_path, err)))
+        goto error;
+
+    reader->pkg_handle = db_reader_prepare(reader->pri_db,
+        "SELECT pkgId, name, arch, version, epoch, release, summary,"
+        "  description, url, time_file, time_build, rpm_license, rpm_vendor,"
+        "  rpm_group, rpm_buildhost, rpm_sourcerpm, rpm_header_start,"
+        "  rpm_header_end, rpm_packager, size_package, size_installed,"
+        "  size_archive, location_href, location_base, checksum_type "
+        "FROM packages WHERE pkgKey = ?", err);
+    if (!reader->pkg_handle)
+        goto error;
+
+    for (size_t x = 0; x < DB_DEPENDENCY_TABLES; x++) {
+        const char *table = db_dependency_tables[x].table;
+        gchar *query = g_strdup_printf(
+                "SELECT name, flags, epoch, version, release%s FROM %s "
+                "WHERE pkgKey = ? ORDER BY rowid",
+                strcmp(table, "requires") ? "" : ", pre", table);
+        reader->dep_handles[x] = db_reader_prepare(reader->pri_db, query, err);
+        g_free(query);
+        if (!reader->dep_handles[x])
+            goto error;
+    }
+
+    reader->files_handle = db_reader_prepare(reader->fil_db,
+        "SELECT dirname, filenames, filetypes FROM filelist WHERE pkgKey = "
+        "(SELECT pkgKey FROM packages WHERE pkgId = ?)", err);
+    if (!reader->files_handle)
+        goto error;
+
+    reader->changelogs_handle = db_reader_prepare(reader->oth_db,
+        "SELECT author, date, changelog FROM changelog WHERE pkgKey = "
+        "(SELECT pkgKey FROM packages WHERE pkgId = ?) ORDER BY rowid", err);
+    if (!reader->changelogs_handle)
+        goto error;
+
+    // The location_href is not indexed, its pkgKeys are read at once
+    handle = db_reader_prepare(reader->pri_db,
+                               "SELECT pkgKey, location_href FROM packages",
+                               err);
+    if (!handle)
+        goto error;
+
+    while ((rc = sqlite3_step(handle)) == SQLITE_ROW) {
+        const char *href = (const char *) sqlite3_column_text(handle, 1);
+        gint64 *pkgKey;
+
+        if (!href)
+            continue;
+
+        href = cr_get_cleaned_href(href);
+        pkgKey = g_hash_table_lookup(reader->hrefs, href);
+        if (pkgKey) {
+            // Packages with the same location are not used at all
+            *pkgKey = 0;
+            continue;
+        }
+
+        pkgKey = g_new(gint64, 1);
+        *pkgKey = sqlite3_column_int64(handle, 0);
+        g_hash_table_insert(reader->hrefs, g_strdup(href), pkgKey);
+    }
+    sqlite3_finalize(handle);
+
+    if (rc != SQLITE_DONE) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Error reading packages of db: %s",
+                    sqlite3_errmsg(reader->pri_db));
+        goto error;
+    }
+
+    return reader;
+
+error:
+    cr_db_package_reader_free(reader);
+    return NULL;
+}
+
+
+guint
+cr_db_package_reader_size(cr_DbPackageReader *reader)
+{
+    assert(reader);
+    return g_hash_table_size(reader->hrefs);
+}
+
+
+static char *
+db_column_text(sqlite3_stmt *handle, int col, GStringChunk *chunk)
+{
+    return cr_safe_string_chunk_insert(chunk,
+                    (const char *) sqlite3_column_text(handle, col));
+}
+
+
+/** Flags of a dependency, the known ones are the shared static strings */
+static char *
+db_column_flags(sqlite3_stmt *handle, int col, GStringChunk *chunk)
+{
+    const char *flags = (const char *) sqlite3_column_text(handle, col);
+    const char *known = cr_dependency_flag_str(
+                                    cr_dependency_flag_from_str(flags));
+
+    if (known)
+        return (char *) known;
+    return cr_safe_string_chunk_insert(chunk, flags);
+}
+
+
+typedef struct {
+    cr_PackageFile *file;
+    gchar *fullpath;
+} DbReadPackageFile;
+
+
+static gint
+db_read_package_file_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(((const DbReadPackageFile *) a)->fullpath,
+                  ((const DbReadPackageFile *) b)->fullpath);
+}
+
+
+/** Decode the files of a filelist row (see package_file_encode()).
+ */
+static void
+db_decode_files(GArray *files,
+                const char *dirname,
+                const char *filenames,
+                const char *filetypes,
+                GStringChunk *chunk)
+{
+    char *path;
+    const char *name = filenames;
+
+    // The trailing '/' of the directory is not stored, "." is used
+    // for the empty one
+    if (!strcmp(dirname, ".")) {
+        path = g_string_chunk_insert_const(chunk, "");
+    } else if (!strcmp(dirname, "/")) {
+        path = g_string_chunk_insert_const(chunk, "/");
+    } else {
+        gchar *tmp = g_strconcat(dirname, "/", NULL);
+        path = g_string_chunk_insert_const(chunk, tmp);
+        g_free(tmp);
+    }
+
+    for (const char *type = filetypes; *type && name; type++) {
+        DbReadPackageFile item;
+        const char *end;
+
+        if (name[0] == '/') {
+            // The root directory has an empty name
+            end = name + 1;
+            item.file = cr_package_file_new();
+            item.file->name = g_string_chunk_insert_const(chunk, "");
+        } else {
+            end = strchr(name, '/');
+            if (!end)
+                end = name + strlen(name);
+            item.file = cr_package_file_new();
+            item.file->name = g_string_chunk_insert_len(chunk, name,
+                                                        end - name);
+        }
+
+        item.file->path = path;
+        if (*type == 'd')
+            item.file->type = (char *) cr_package_file_type_str(CR_FILE_TYPE_DIR);
+        else if (*type == 'g')
+            item.file->type = (char *) cr_package_file_type_str(CR_FILE_TYPE_GHOST);
+        item.fullpath = g_strconcat(path, item.file->name, NULL);
+        g_array_append_val(files, item);
+
+        name = (*end == '/') ? end + 1 : NULL;
+    }
+}
+
+
+static gboolean
+db_read_files(cr_DbPackageReader *reader, cr_Package *pkg, GError **err)
+{
+    sqlite3_stmt *handle = reader->files_handle;
+    GArray *files = g_array_new(FALSE, FALSE, sizeof(DbReadPackageFile));
+    int rc;
+
+    cr_sqlite3_bind_text(handle, 1, pkg->pkgId, -1, SQLITE_STATIC);
+    while ((rc = sqlite3_step(handle)) == SQLITE_ROW) {
+        const char *dirname = (const char *) sqlite3_column_text(handle, 0);
+        const char *filenames = (const char *) sqlite3_column_text(handle, 1);
+        const char *filetypes = (const char *) sqlite3_column_text(handle, 2);
+
+        if (dirname && filenames && filetypes)
+            db_decode_files(files, dirname, filenames, filetypes, pkg->chunk);
+    }
+    sqlite3_reset(handle);
+
+    // The files are grouped by directories in the db, the packages list
+    // them sorted by the full path (as rpm does)
+    g_array_sort(files, db_read_package_file_cmp);
+    for (guint x = files->len; x > 0; x--) {
+        DbReadPackageFile *item = &g_array_index(files, DbReadPackageFile, x-1);
+        pkg->files = g_slist_prepend(pkg->files, item->file);
+        g_free(item->fullpath);
+    }
+    g_array_free(files, TRUE);
+
+    if (rc != SQLITE_DONE) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB, "Error reading files of %s: %s",
+                    pkg->pkgId, sqlite3_errmsg(reader->fil_db));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+static gboolean
+db_read_primary(cr_DbPackageReader *reader,
+                gint64 pkgKey,
+                cr_Package *pkg,
+                GError **err)
+{
+    sqlite3_stmt *handle = reader->pkg_handle;
+    GStringChunk *chunk = pkg->chunk;
+    int rc;
+
+    sqlite3_bind_int64(handle, 1, pkgKey);
+    rc = sqlite3_step(handle);
+    if (rc != SQLITE_ROW) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB, "Error reading package: %s",
+                    rc == SQLITE_DONE ? "Not found"
+                                      : sqlite3_errmsg(reader->pri_db));
+        sqlite3_reset(handle);
+        return FALSE;
+    }
+
+    pkg->pkgKey           = pkgKey;
+    pkg->pkgId            = db_column_text(handle, 0, chunk);
+    pkg->name             = db_column_text(handle, 1, chunk);
+    pkg->arch             = db_column_text(handle, 2, chunk);
+    pkg->version          = db_column_text(handle, 3, chunk);
+    pkg->epoch            = db_column_text(handle, 4, chunk);
+    pkg->release          = db_column_text(handle, 5, chunk);
+    pkg->summary          = db_column_text(handle, 6, chunk);
+    pkg->description      = db_column_text(handle, 7, chunk);
+    pkg->url              = db_column_text(handle, 8, chunk);
+    pkg->time_file        = sqlite3_column_int64(handle, 9);
+    pkg->time_build       = sqlite3_column_int64(handle, 10);
+    pkg->rpm_license      = db_column_text(handle, 11, chunk);
+    pkg->rpm_vendor       = db_column_text(handle, 12, chunk);
+    pkg->rpm_group        = db_column_text(handle, 13, chunk);
+    pkg->rpm_buildhost    = db_column_text(handle, 14, chunk);
+    pkg->rpm_sourcerpm    = db_column_text(handle, 15, chunk);
+    pkg->rpm_header_start = sqlite3_column_int64(handle, 16);
+    pkg->rpm_header_end   = sqlite3_column_int64(handle, 17);
+    pkg->rpm_packager     = db_column_text(handle, 18, chunk);
+    pkg->size_package     = sqlite3_column_int64(handle, 19);
+    pkg->size_installed   = sqlite3_column_int64(handle, 20);
+    pkg->size_archive     = sqlite3_column_int64(handle, 21);
+    pkg->location_href    = db_column_text(handle, 22, chunk);
+    pkg->location_base    = db_column_text(handle, 23, chunk);
+    pkg->checksum_type    = db_column_text(handle, 24, chunk);
+    sqlite3_reset(handle);
+
+    if (!pkg->pkgId) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB, "Package without pkgId");
+        return FALSE;
+    }
+
+    for (size_t x = 0; x < DB_DEPENDENCY_TABLES; x++) {
+        GSList **list = (GSList **) ((char *) pkg
+                                     + db_dependency_tables[x].listoffset);
+        handle = reader->dep_handles[x];
+
+        sqlite3_bind_int64(handle, 1, pkgKey);
+        while ((rc = sqlite3_step(handle)) == SQLITE_ROW) {
+            cr_Dependency *dep = cr_dependency_new();
+            dep->name    = db_column_text(handle, 0, chunk);
+            dep->flags   = db_column_flags(handle, 1, chunk);
+            dep->epoch   = db_column_text(handle, 2, chunk);
+            dep->version = db_column_text(handle, 3, chunk);
+            dep->release = db_column_text(handle, 4, chunk);
+            if (sqlite3_column_count(handle) > 5) {
+                const char *pre = (const char *) sqlite3_column_text(handle, 5);
+                dep->pre = pre && !strcmp(pre, "TRUE");
+            }
+            *list = g_slist_prepend(*list, dep);
+        }
+        sqlite3_reset(handle);
+        *list = g_slist_reverse(*list);
+
+        if (rc != SQLITE_DONE) {
+            g_set_error(err, ERR_DOMAIN, CRE_DB,
+                        "Error reading %s of %s: %s",
+                        db_dependency_tables[x].table, pkg->pkgId,
+                        sqlite3_errmsg(reader->pri_db));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static gboolean
+db_read_changelogs(cr_DbPackageReader *reader, cr_Package *pkg, GError **err)
+{
+    sqlite3_stmt *handle = reader->changelogs_handle;
+    int rc;
+
+    cr_sqlite3_bind_text(handle, 1, pkg->pkgId, -1, SQLITE_STATIC);
+    while ((rc = sqlite3_step(handle)) == SQLITE_ROW) {
+        cr_ChangelogEntry *entry = cr_changelog_entry_new();
+        entry->author    = db_column_text(handle, 0, pkg->chunk);
+        entry->date      = sqlite3_column_int64(handle, 1);
+        entry->changelog = db_column_text(handle, 2, pkg->chunk);
+        pkg->changelogs = g_slist_prepend(pkg->changelogs, entry);
+    }
+    sqlite3_reset(handle);
+    pkg->changelogs = g_slist_reverse(pkg->changelogs);
+
+    if (rc != SQLITE_DONE) {
+        g_set_error(err, ERR_DOMAIN, CRE_DB,
+                    "Error reading changelogs of %s: %s",
+                    pkg->pkgId, sqlite3_errmsg(reader->oth_db));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+cr_Package *
+cr_db_package_reader_get(cr_DbPackageReader *reader,
+                         const char *location_href,
+                         GError **err)
+{
+    cr_Package *pkg;
+    gint64 *pkgKey;
+    gboolean ok;
+
+    assert(reader);
+    assert(location_href);
+    assert(!err || *err == NULL);
+
+    // The hashtable is not modified after the reader is created
+    pkgKey = g_hash_table_lookup(reader->hrefs,
+                                 cr_get_cleaned_href(location_href));
+    if (!pkgKey || !*pkgKey)
+        return NULL;
+
+    pkg = cr_package_new();
+
+    g_mutex_lock(&reader->lock);
+    ok = db_read_primary(reader, *pkgKey, pkg, err)
+         && db_read_files(reader, pkg, err)
+         && db_read_changelogs(reader, pkg, err);
+    g_mutex_unlock(&reader->lock);
+
+    if (!ok) {
+        g_prefix_error(err, "Cannot read %s from db: ", location_href);
+        cr_package_free(pkg);
+        return NULL;
+    }
+
+    pkg->loadingflags |= CR_PACKAGE_LOADED_PRI | CR_PACKAGE_LOADED_FIL
+                         | CR_PACKAGE_LOADED_OTH;
+    return pkg;
+}
+
+
+void
+cr_db_package_reader_free(cr_DbPackageReader *reader)
+{
+    if (!reader)
+        return;
+
+    sqlite3_finalize(reader->pkg_handle);
+    for (size_t x = 0; x < DB_DEPENDENCY_TABLES; x++)
+        sqlite3_finalize(reader->dep_handles[x]);
+    sqlite3_finalize(reader->files_handle);
+    sqlite3_finalize(reader->changelogs_handle);
+    sqlite3_close(reader->pri_db);
+    sqlite3_close(reader->fil_db);
+    sqlite3_close(reader->oth_db);
+    g_hash_table_destroy(reader->hrefs);
+    g_mutex_clear(&reader->lock);
+    g_free(reader);
+}
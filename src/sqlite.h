@@ -22,6 +22,7 @@
 
 #include <glib.h>
 #include <sqlite3.h>
+#include "compression_wrapper.h"
 #include "package.h"
 
 #ifdef __cplusplus
@@ -57,6 +58,8 @@ extern "C" {
  */
 
 #define CR_DB_CACHE_DBVERSION       10      /*!< Version of DB api */
+#define CR_DB_IN_MEMORY             ":memory:" /*!< Path of a db which is
+                                                    kept in memory */
 
 /** Database type.
  */
@@ -91,6 +94,9 @@ typedef struct {
         Type of Sqlite database. */
     cr_Statements statements; /*!<
         Compiled SQL statements */
+    GHashTable *reused_pkgs; /*!<
+        Packages already present in a reused database
+        (see cr_db_reuse_packages()), NULL otherwise */
 } cr_SqliteDb;
 
 /** Macro over cr_db_open function. Open (create new) primary sqlite sqlite db.
@@ -152,6 +158,61 @@ int cr_db_add_pkg(cr_SqliteDb *sqlitedb,
                   cr_Package *pkg,
                   GError **err);
 
+/** Add package into the database. Same as cr_db_add_pkg(), but
+ * the package is not modified (its pkgKey is not set), so the same package
+ * could be added into several databases from several threads at once.
+ * @param sqlitedb              open db connection
+ * @param pkg                   package object
+ * @param err                   **GError
+ * @return                      cr_Error code
+ */
+int cr_db_add_const_pkg(cr_SqliteDb *sqlitedb,
+                        const cr_Package *pkg,
+                        GError **err);
+
+/** Reuse packages already present in an existing database.
+ * The following cr_db_add_pkg() and cr_db_add_const_pkg() calls don't insert
+ * packages which are already in the database (primary packages are matched
+ * by pkgId and location, filelists and other packages by pkgId) and
+ * the packages which weren't added again are then removed by
+ * cr_db_remove_unused_packages(). The database must be created by the same
+ * version of the db api (CR_DB_CACHE_DBVERSION).
+ * @param sqlitedb              open db connection
+ * @param err                   **GError
+ * @return                      cr_Error code
+ */
+int cr_db_reuse_packages(cr_SqliteDb *sqlitedb, GError **err);
+
+/** Remove the packages of a reused database (see cr_db_reuse_packages())
+ * which weren't added again.
+ * @param sqlitedb              open db connection
+ * @param removed               number of removed packages or NULL
+ * @param err                   **GError
+ * @return                      cr_Error code
+ */
+int cr_db_remove_unused_packages(cr_SqliteDb *sqlitedb,
+                                 guint *removed,
+                                 GError **err);
+
+/** Append all packages of another (uncompressed) database of the same
+ * type, e.g. of a shard of the repo (see shard.h). The appended
+ * packages get pkgKeys following the pkgKeys already used in the db,
+ * their related rows (files, dependencies, changelogs) are copied too.
+ * The database must be created by the same version of the db api
+ * (CR_DB_CACHE_DBVERSION).
+ * @param sqlitedb              open db connection
+ * @param path                  path to the appended db
+ * @param location_base         location_base set to the appended
+ *                              packages of a primary db which have none
+ *                              or NULL
+ * @param err                   **GError
+ * @return                      cr_Error code
+ */
+int cr_db_append_db(cr_SqliteDb *sqlitedb,
+                    const char *path,
+                    const char *location_base,
+                    GError **err);
+
 /** Insert record into the updateinfo table
  * @param sqlitedb              open db connection
  * @param checksum              compressed xml file checksum
@@ -172,6 +233,70 @@ int cr_db_dbinfo_update(cr_SqliteDb *sqlitedb,
  */
 int cr_db_close(cr_SqliteDb *sqlitedb, GError **err);
 
+/** Close db and write its content straight into a compressed file.
+ * Meant for databases opened with CR_DB_IN_MEMORY path, which then never
+ * exist uncompressed on a disk.
+ *  - creates indexes on tables
+ *  - commits transaction
+ *  - serializes db into the compressed file
+ *  - closes db
+ * @param sqlitedb              open db connection
+ * @param dst                   path to the compressed file
+ * @param comtype               type of compression
+ * @param stat                  cr_ContentStat of the written file or NULL
+ * @param err                   **GError
+ * @return                      cr_Error code
+ */
+int cr_db_close_compressed(cr_SqliteDb *sqlitedb,
+                           const char *dst,
+                           cr_CompressionType comtype,
+                           cr_ContentStat *stat,
+                           GError **err);
+
+/** Packages of existing primary, filelists and other databases
+ * (uncompressed) read on demand by their location.
+ */
+typedef struct _cr_DbPackageReader cr_DbPackageReader;
+
+/** Open the databases for reading of their packages. Only the locations
+ * of the packages are read at once. The databases must be created
+ * by the same version of the db api (CR_DB_CACHE_DBVERSION).
+ * @param primary_path          Path to the primary db
+ * @param filelists_path        Path to the filelists db
+ * @param other_path            Path to the other db
+ * @param err                   **GError
+ * @return                      cr_DbPackageReader or NULL on error
+ */
+cr_DbPackageReader *cr_db_package_reader_new(const char *primary_path,
+                                             const char *filelists_path,
+                                             const char *other_path,
+                                             GError **err);
+
+/** Number of the package locations in the databases.
+ * @param reader                cr_DbPackageReader
+ * @return                      number of the locations
+ */
+guint cr_db_package_reader_size(cr_DbPackageReader *reader);
+
+/** Read the package (with its dependencies, files and changelogs)
+ * from the databases. Packages with a location used by more packages
+ * are never returned. Could be called from more threads at the same
+ * time, the reads are serialized.
+ * @param reader                cr_DbPackageReader
+ * @param location_href         location_href of the package
+ * @param err                   **GError
+ * @return                      new package (free it by cr_package_free())
+ *                              or NULL if not found or on error
+ */
+cr_Package *cr_db_package_reader_get(cr_DbPackageReader *reader,
+                                     const char *location_href,
+                                     GError **err);
+
+/** Close the databases.
+ * @param reader                cr_DbPackageReader or NULL
+ */
+void cr_db_package_reader_free(cr_DbPackageReader *reader);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -198,6 +198,22 @@ warningcb(G_GNUC_UNUSED cr_XmlParserWarningType type,
     return CR_CB_RET_OK;
 }
 
+/** Packages are only written into a database and freed, so everything
+ * the parsers create for them is allocated from a package arena
+ * instead of by many small allocations.
+ */
+static int
+newpkgcb(cr_Package **pkg,
+         G_GNUC_UNUSED const char *pkgId,
+         G_GNUC_UNUSED const char *name,
+         G_GNUC_UNUSED const char *arch,
+         G_GNUC_UNUSED void *cbdata,
+         G_GNUC_UNUSED GError **err)
+{
+    *pkg = cr_package_new_with_arena();
+    return CR_CB_RET_OK;
+}
+
 static int
 pkgcb(cr_Package *pkg,
               void *cbdata,
@@ -220,7 +236,7 @@ primary_to_sqlite(const gchar *pri_xml_path,
 {
     int rc;
     rc = cr_xml_parse_primary(pri_xml_path,
-                              NULL,
+                              newpkgcb,
                               NULL,
                               pkgcb,
                               (void *) pri_db,
@@ -242,7 +258,7 @@ filelists_to_sqlite(const gchar *fil_xml_path,
 {
     int rc;
     rc = cr_xml_parse_filelists(fil_xml_path,
-                                NULL,
+                                newpkgcb,
                                 NULL,
                                 pkgcb,
                                 (void *) fil_db,
@@ -263,7 +279,7 @@ other_to_sqlite(const gchar *oth_xml_path,
 {
     int rc;
     rc = cr_xml_parse_other(oth_xml_path,
-                            NULL,
+                            newpkgcb,
                             NULL,
                             pkgcb,
                             (void *) oth_db,
@@ -277,201 +293,155 @@ other_to_sqlite(const gchar *oth_xml_path,
 
 // Main
 
-static gboolean
-xml_to_sqlite(const gchar *pri_xml_path,
-              const gchar *fil_xml_path,
-              const gchar *oth_xml_path,
-              cr_SqliteDb *pri_db,
-              cr_SqliteDb *fil_db,
-              cr_SqliteDb *oth_db,
-              GError **err)
+/** Conversion of one xml file into a compressed sqlite database.
+ * The conversions of primary, filelists and other are independent
+ * (every database numbers its packages by itself), each runs in its own
+ * thread.
+ */
+typedef struct {
+    cr_DatabaseType type;               // Type of the database
+    const gchar *xml_path;              // Xml to convert (could be NULL)
+    const gchar *xml_checksum;          // Checksum of the xml from repomd
+    cr_SqliteDb *db;                    // Opened database
+    const gchar *db_filename;           // Path to the database
+    gchar *compressed_filename;         // Path to the compressed database
+    cr_CompressionType compression_type;
+    cr_ChecksumType checksum_type;
+    cr_RepomdRecord *rec;               // Record of the compressed database
+    GError *err;
+} SqliteDbTask;
+
+static const gchar *
+sqlite_db_name(cr_DatabaseType type)
 {
-    gboolean ret;
-
-    if (pri_xml_path && pri_db) {
-        ret = primary_to_sqlite(pri_xml_path,
-                                pri_db,
-                                err);
-        if (!ret)
-            return FALSE;
-        g_debug("Primary sqlite done");
-    }
-
-    if (fil_xml_path && fil_db) {
-        ret = filelists_to_sqlite(fil_xml_path,
-                                  fil_db,
-                                  err);
-        if (!ret)
-            return FALSE;
-        g_debug("Filelists sqlite done");
+    switch (type) {
+        case CR_DB_PRIMARY:     return "primary";
+        case CR_DB_FILELISTS:   return "filelists";
+        default:                return "other";
     }
-
-    if (oth_xml_path && oth_db) {
-        ret = other_to_sqlite(oth_xml_path,
-                              oth_db,
-                              err);
-        if (!ret)
-            return FALSE;
-        g_debug("Other sqlite done");
-    }
-
-    return TRUE;
 }
 
-static gboolean
-sqlite_dbinfo_update(cr_Repomd *repomd,
-                     cr_SqliteDb *pri_db,
-                     cr_SqliteDb *fil_db,
-                     cr_SqliteDb *oth_db,
-                     GError **err)
+static gpointer
+sqlite_db_thread(gpointer data)
 {
-    cr_RepomdRecord *rec = NULL;
-
-    // Parse repomd.xml
-    // Get files checksums and insert them into sqlite dbs
-    if (pri_db) {
-        rec = cr_repomd_get_record(repomd, "primary");
-        if (rec && rec->checksum)
-            if (cr_db_dbinfo_update(pri_db, rec->checksum, err) != CRE_OK)
-                return FALSE;
-    }
+    SqliteDbTask *task = data;
+    const gchar *name = sqlite_db_name(task->type);
+    gboolean ret = TRUE;
 
-    if (fil_db) {
-        rec = cr_repomd_get_record(repomd, "filelists");
-        if (rec && rec->checksum)
-            if (cr_db_dbinfo_update(fil_db, rec->checksum, err) != CRE_OK)
-                return FALSE;
+    // XML to Sqlite
+    if (task->xml_path) {
+        switch (task->type) {
+            case CR_DB_PRIMARY:
+                ret = primary_to_sqlite(task->xml_path, task->db, &task->err);
+                break;
+            case CR_DB_FILELISTS:
+                ret = filelists_to_sqlite(task->xml_path, task->db, &task->err);
+                break;
+            default:
+                ret = other_to_sqlite(task->xml_path, task->db, &task->err);
+                break;
+        }
+        if (ret)
+            g_debug("%s sqlite done", name);
     }
 
-    if (oth_db) {
-        rec = cr_repomd_get_record(repomd, "other");
-        if (rec && rec->checksum)
-            if (cr_db_dbinfo_update(oth_db, rec->checksum, err) != CRE_OK)
-                return FALSE;
-    }
+    // Put checksum of the XML file into Sqlite
+    if (ret && task->xml_checksum)
+        ret = cr_db_dbinfo_update(task->db, task->xml_checksum,
+                                  &task->err) == CRE_OK;
 
-    return TRUE;
+    cr_db_close(task->db, NULL);
+    task->db = NULL;
+    if (!ret)
+        return NULL;
+
+    // Compress the database right away, the others could be still
+    // in progress
+    cr_CompressionTask *compress_task;
+    compress_task = cr_compressiontask_new(task->db_filename,
+                                           task->compressed_filename,
+                                           task->compression_type,
+                                           task->checksum_type,
+                                           NULL, FALSE, 1, &task->err);
+    if (!compress_task)
+        return NULL;
+    cr_compressing_thread(compress_task, NULL);
+    cr_rm(task->db_filename, CR_RM_FORCE, NULL, NULL);
+
+    if (compress_task->err) {
+        g_propagate_prefixed_error(&task->err, compress_task->err,
+                                   "Cannot compress %s: ", task->db_filename);
+        compress_task->err = NULL;
+        cr_compressiontask_free(compress_task, NULL);
+        return NULL;
+    }
+
+    // Fill the repomd record from stats gathered during compression
+    gchar *rec_type = g_strconcat(name, "_db", NULL);
+    task->rec = cr_repomd_record_new(rec_type, task->compressed_filename);
+    g_free(rec_type);
+    cr_repomd_record_load_contentstat(task->rec, compress_task->stat);
+    cr_compressiontask_free(compress_task, NULL);
+
+    cr_repomd_record_fill(task->rec, task->checksum_type, &task->err);
+    return NULL;
 }
 
+/** Convert the xml files into sqlite databases, compress them and
+ * prepare their repomd records. The databases are closed in any case.
+ */
 static gboolean
-compress_sqlite_dbs(const gchar *tmp_out_repo,
-                    const gchar *pri_db_filename,
-                    cr_RepomdRecord **in_pri_db_rec,
-                    const gchar *fil_db_filename,
-                    cr_RepomdRecord **in_fil_db_rec,
-                    const gchar *oth_db_filename,
-                    cr_RepomdRecord **in_oth_db_rec,
-                    cr_CompressionType compression_type,
-                    cr_ChecksumType checksum_type)
+xml_to_compressed_sqlite(const gchar *tmp_out_repo,
+                         cr_Repomd *repomd,
+                         const gchar *xml_paths[CR_DB_SENTINEL],
+                         cr_SqliteDb *dbs[CR_DB_SENTINEL],
+                         const gchar *db_filenames[CR_DB_SENTINEL],
+                         cr_RepomdRecord *recs[CR_DB_SENTINEL],
+                         cr_CompressionType compression_type,
+                         cr_ChecksumType checksum_type,
+                         GError **err)
 {
-    cr_CompressionTask *pri_db_task;
-    cr_CompressionTask *fil_db_task;
-    cr_CompressionTask *oth_db_task;
-    const char *sqlite_compression_suffix;
-    cr_RepomdRecord *pri_db_rec = NULL;
-    cr_RepomdRecord *fil_db_rec = NULL;
-    cr_RepomdRecord *oth_db_rec = NULL;
+    SqliteDbTask tasks[CR_DB_SENTINEL];
+    GThread *threads[CR_DB_SENTINEL];
+    const char *suffix = cr_compression_suffix(compression_type);
+    gboolean ret = TRUE;
 
-    // Prepare thread pool for compression tasks
-    GThreadPool *compress_pool =  g_thread_pool_new(cr_compressing_thread,
-                                                    NULL, 3, FALSE, NULL);
-
-    // Prepare output filenames
-    sqlite_compression_suffix = cr_compression_suffix(compression_type);
-    gchar *pri_db_name = g_strconcat(tmp_out_repo, "/primary.sqlite",
-                                     sqlite_compression_suffix, NULL);
-    gchar *fil_db_name = g_strconcat(tmp_out_repo, "/filelists.sqlite",
-                                     sqlite_compression_suffix, NULL);
-    gchar *oth_db_name = g_strconcat(tmp_out_repo, "/other.sqlite",
-                                     sqlite_compression_suffix, NULL);
-
-    // Prepare compression tasks
-    pri_db_task = cr_compressiontask_new(pri_db_filename,
-                                         pri_db_name,
-                                         compression_type,
-                                         checksum_type,
-                                         NULL, FALSE, 1, NULL);
-    g_thread_pool_push(compress_pool, pri_db_task, NULL);
-
-    fil_db_task = cr_compressiontask_new(fil_db_filename,
-                                         fil_db_name,
-                                         compression_type,
-                                         checksum_type,
-                                         NULL, FALSE, 1, NULL);
-    g_thread_pool_push(compress_pool, fil_db_task, NULL);
-
-    oth_db_task = cr_compressiontask_new(oth_db_filename,
-                                         oth_db_name,
-                                         compression_type,
-                                         checksum_type,
-                                         NULL, FALSE, 1, NULL);
-    g_thread_pool_push(compress_pool, oth_db_task, NULL);
-
-    // Wait till all tasks are complete and free the thread pool
-    g_thread_pool_free(compress_pool, FALSE, TRUE);
-
-    // Remove uncompressed DBs
-    cr_rm(pri_db_filename, CR_RM_FORCE, NULL, NULL);
-    cr_rm(fil_db_filename, CR_RM_FORCE, NULL, NULL);
-    cr_rm(oth_db_filename, CR_RM_FORCE, NULL, NULL);
-
-    // Prepare repomd records
-    pri_db_rec = cr_repomd_record_new("primary_db", pri_db_name);
-    fil_db_rec = cr_repomd_record_new("filelists_db", fil_db_name);
-    oth_db_rec = cr_repomd_record_new("other_db", oth_db_name);
-
-    *in_pri_db_rec = pri_db_rec;
-    *in_fil_db_rec = fil_db_rec;
-    *in_oth_db_rec = oth_db_rec;
-
-    // Free paths to compressed files
-    g_free(pri_db_name);
-    g_free(fil_db_name);
-    g_free(oth_db_name);
-
-    // Fill repomd records from stats gathered during compression
-    cr_repomd_record_load_contentstat(pri_db_rec, pri_db_task->stat);
-    cr_repomd_record_load_contentstat(fil_db_rec, fil_db_task->stat);
-    cr_repomd_record_load_contentstat(oth_db_rec, oth_db_task->stat);
-
-    // Free the compression tasks
-    cr_compressiontask_free(pri_db_task, NULL);
-    cr_compressiontask_free(fil_db_task, NULL);
-    cr_compressiontask_free(oth_db_task, NULL);
-
-    // Prepare thread pool for repomd record filling tasks
-    GThreadPool *fill_pool = g_thread_pool_new(cr_repomd_record_fill_thread,
-                                               NULL, 3, FALSE, NULL);
-
-    // Prepare the tasks themselves
-    cr_RepomdRecordFillTask *pri_db_fill_task;
-    cr_RepomdRecordFillTask *fil_db_fill_task;
-    cr_RepomdRecordFillTask *oth_db_fill_task;
-
-    pri_db_fill_task = cr_repomdrecordfilltask_new(pri_db_rec,
-                                                   checksum_type,
-                                                   NULL);
-    g_thread_pool_push(fill_pool, pri_db_fill_task, NULL);
-
-    fil_db_fill_task = cr_repomdrecordfilltask_new(fil_db_rec,
-                                                   checksum_type,
-                                                   NULL);
-    g_thread_pool_push(fill_pool, fil_db_fill_task, NULL);
-
-    oth_db_fill_task = cr_repomdrecordfilltask_new(oth_db_rec,
-                                                   checksum_type,
-                                                   NULL);
-    g_thread_pool_push(fill_pool, oth_db_fill_task, NULL);
-
-    // Wait till the all tasks are finished and free the pool
-    g_thread_pool_free(fill_pool, FALSE, TRUE);
-
-    // Clear the tasks
-    cr_repomdrecordfilltask_free(pri_db_fill_task, NULL);
-    cr_repomdrecordfilltask_free(fil_db_fill_task, NULL);
-    cr_repomdrecordfilltask_free(oth_db_fill_task, NULL);
+    for (int x = 0; x < CR_DB_SENTINEL; x++) {
+        SqliteDbTask *task = &tasks[x];
+        const gchar *name = sqlite_db_name(x);
+        cr_RepomdRecord *xml_rec = cr_repomd_get_record(repomd, name);
+
+        memset(task, 0, sizeof(*task));
+        task->type              = x;
+        task->xml_path          = xml_paths[x];
+        task->xml_checksum      = xml_rec ? xml_rec->checksum : NULL;
+        task->db                = dbs[x];
+        task->db_filename       = db_filenames[x];
+        task->compressed_filename = g_strconcat(tmp_out_repo, "/", name,
+                                                ".sqlite", suffix, NULL);
+        task->compression_type  = compression_type;
+        task->checksum_type     = checksum_type;
+
+        threads[x] = g_thread_new(name, sqlite_db_thread, task);
+    }
+
+    for (int x = 0; x < CR_DB_SENTINEL; x++) {
+        SqliteDbTask *task = &tasks[x];
+
+        g_thread_join(threads[x]);
+        g_free(task->compressed_filename);
+        recs[x] = task->rec;
+
+        if (task->err) {
+            if (ret)
+                g_propagate_error(err, task->err);
+            else
+                g_error_free(task->err);
+            ret = FALSE;
+        }
+    }
 
-    return TRUE;
+    return ret;
 }
 
 static gboolean
@@ -893,48 +863,34 @@ generate_sqlite_from_xml(const gchar *path,
         return FALSE;
     }
 
-    // XML to Sqlite
-    ret = xml_to_sqlite(pri_xml_path,
-                        fil_xml_path,
-                        oth_xml_path,
-                        pri_db,
-                        fil_db,
-                        oth_db,
-                        err);
-    if (!ret)
-        return FALSE;
-
-    // Put checksums of XML files into Sqlite
-    ret = sqlite_dbinfo_update(repomd,
-                               pri_db,
-                               fil_db,
-                               oth_db,
-                               err);
-    if (!ret)
-        return FALSE;
-
-    // Close dbs
-    cr_db_close(pri_db, NULL);
-    cr_db_close(fil_db, NULL);
-    cr_db_close(oth_db, NULL);
-
     // Repomd records
-    cr_RepomdRecord *pri_db_rec = NULL;
-    cr_RepomdRecord *fil_db_rec = NULL;
-    cr_RepomdRecord *oth_db_rec = NULL;
-
-    // Compress DB files and fill records
-    ret = compress_sqlite_dbs(tmp_out_repo,
-                              pri_db_filename,
-                              &pri_db_rec,
-                              fil_db_filename,
-                              &fil_db_rec,
-                              oth_db_filename,
-                              &oth_db_rec,
-                              compression_type,
-                              checksum_type);
-    if (!ret)
+    cr_RepomdRecord *recs[CR_DB_SENTINEL] = { NULL };
+
+    // XML to Sqlite, compress DB files and fill records
+    const gchar *xml_paths[CR_DB_SENTINEL] = {
+        pri_xml_path, fil_xml_path, oth_xml_path };
+    cr_SqliteDb *dbs[CR_DB_SENTINEL] = { pri_db, fil_db, oth_db };
+    const gchar *db_filenames[CR_DB_SENTINEL] = {
+        pri_db_filename, fil_db_filename, oth_db_filename };
+
+    ret = xml_to_compressed_sqlite(tmp_out_repo,
+                                   repomd,
+                                   xml_paths,
+                                   dbs,
+                                   db_filenames,
+                                   recs,
+                                   compression_type,
+                                   checksum_type,
+                                   err);
+    if (!ret) {
+        for (int x = 0; x < CR_DB_SENTINEL; x++)
+            cr_repomd_record_free(recs[x]);
         return FALSE;
+    }
+
+    cr_RepomdRecord *pri_db_rec = recs[CR_DB_PRIMARY];
+    cr_RepomdRecord *fil_db_rec = recs[CR_DB_FILELISTS];
+    cr_RepomdRecord *oth_db_rec = recs[CR_DB_OTHER];
 
     // Prepare new repomd.xml
     ret = gen_new_repomd(tmp_out_repo,
@@ -17,8 +17,16 @@
  * USA.
  */
 
+#define _GNU_SOURCE             // sched_setaffinity
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include "threads.h"
+#include "cleanup.h"
 #include "error.h"
 #include "misc.h"
 #include "dumper_thread.h"
@@ -26,6 +34,123 @@
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 
 
+/** CPU sets */
+
+struct _cr_CpuSet {
+    guint id;               // Unique id, identifies the set a thread is bound to
+    guint count;            // Number of CPUs in the set
+#ifdef __linux__
+    cpu_set_t set;
+#endif
+};
+
+// Id of the cr_CpuSet the current thread is bound to (0 - none)
+static GPrivate cr_cpuset_bound_key = G_PRIVATE_INIT(NULL);
+
+static gboolean
+parse_cpu_number(const char *str, char **end, guint *cpu)
+{
+    if (!g_ascii_isdigit(*str))
+        return FALSE;
+
+    errno = 0;
+    unsigned long val = strtoul(str, end, 10);
+    if (errno || val >= CR_CPUSET_MAX_CPUS)
+        return FALSE;
+
+    *cpu = (guint) val;
+    return TRUE;
+}
+
+cr_CpuSet *
+cr_cpuset_from_str(const char *str, GError **err)
+{
+    static gint last_id = 0;
+
+    assert(str);
+    assert(!err || *err == NULL);
+
+#ifndef __linux__
+    g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                "Thread CPU affinity is not supported on this platform");
+    return NULL;
+#else
+    cr_CpuSet *cpuset = g_new0(cr_CpuSet, 1);
+    CPU_ZERO(&cpuset->set);
+
+    _cleanup_strv_free_ gchar **ranges = g_strsplit(str, ",", -1);
+    for (gchar **range = ranges; *range; range++) {
+        char *end = NULL;
+        guint first, last;
+
+        if (!parse_cpu_number(*range, &end, &first))
+            goto badformat;
+        last = first;
+        if (*end == '-' && !parse_cpu_number(end + 1, &end, &last))
+            goto badformat;
+        if (*end != '\0' || last < first)
+            goto badformat;
+
+        for (guint cpu = first; cpu <= last; cpu++) {
+            if (!CPU_ISSET(cpu, &cpuset->set))
+                cpuset->count++;
+            CPU_SET(cpu, &cpuset->set);
+        }
+    }
+
+    if (!cpuset->count)
+        goto badformat;
+
+    cpuset->id = (guint) g_atomic_int_add(&last_id, 1) + 1;
+    return cpuset;
+
+badformat:
+    g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                "Bad CPU list \"%s\" (expected e.g. \"0-7,16-23\", "
+                "CPU numbers lower than %d)", str, CR_CPUSET_MAX_CPUS);
+    g_free(cpuset);
+    return NULL;
+#endif
+}
+
+guint
+cr_cpuset_count(const cr_CpuSet *cpuset)
+{
+    return cpuset ? cpuset->count : 0;
+}
+
+gboolean
+cr_cpuset_bind_current_thread(const cr_CpuSet *cpuset, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!cpuset)
+        return TRUE;
+
+    // Threads of GThreadPools are reused, bind each of them only once
+    if (GPOINTER_TO_UINT(g_private_get(&cr_cpuset_bound_key)) == cpuset->id)
+        return TRUE;
+
+#ifdef __linux__
+    if (sched_setaffinity(0, sizeof(cpuset->set), &cpuset->set) == -1) {
+        g_set_error(err, ERR_DOMAIN, CRE_ERROR,
+                    "Cannot set CPU affinity of a thread: %s",
+                    g_strerror(errno));
+        return FALSE;
+    }
+#endif
+
+    g_private_set(&cr_cpuset_bound_key, GUINT_TO_POINTER(cpuset->id));
+    return TRUE;
+}
+
+void
+cr_cpuset_free(cr_CpuSet *cpuset)
+{
+    g_free(cpuset);
+}
+
+
 /** Parallel Compression */
 
 cr_CompressionTask *
@@ -89,32 +214,50 @@ cr_compressiontask_free(cr_CompressionTask *task, GError **err)
 }
 
 void
-cr_compressing_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
+cr_compressing_thread(gpointer data, gpointer user_data)
 {
     cr_CompressionTask *task = data;
     GError *tmp_err = NULL;
 
     assert(task);
 
+    if (!cr_cpuset_bind_current_thread(user_data, &tmp_err)) {
+        g_warning("%s", tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
     if (!task->dst)
         task->dst = g_strconcat(task->src,
                                 cr_compression_suffix(task->type),
                                 NULL);
 
-    cr_compress_file_with_stat(task->src,
+    int delsrc = task->delsrc;
+
+    if (task->db) {
+        // Database is written straight from the sqlite, there is no src
+        delsrc = 0;
+        cr_db_close_compressed(task->db,
                                task->dst,
                                task->type,
                                task->stat,
-                               task->zck_dict_dir,
-                               task->zck_auto_chunk,
                                &tmp_err);
+        task->db = NULL;
+    } else {
+        cr_compress_file_with_stat(task->src,
+                                   task->dst,
+                                   task->type,
+                                   task->stat,
+                                   task->zck_dict_dir,
+                                   task->zck_auto_chunk,
+                                   &tmp_err);
+    }
 
     if (tmp_err) {
         // Error encountered
         g_propagate_error(&task->err, tmp_err);
     } else {
         // Compression was successful
-        if (task->delsrc)
+        if (delsrc)
             remove(task->src);
     }
 }
@@ -187,3 +330,199 @@ cr_repomd_record_fill_thread(gpointer data, G_GNUC_UNUSED gpointer user_data)
         g_propagate_error(&task->err, tmp_err);
     }
 }
+
+/** Parallel Repomd Record Compress and Fill */
+
+cr_RepomdRecordCompressTask *
+cr_repomdrecordcompresstask_new(cr_RepomdRecord *record,
+                                cr_RepomdRecord *crecord,
+                                cr_ChecksumType checksum_type,
+                                cr_CompressionType type,
+                                const char *zck_dict_dir,
+                                GError **err)
+{
+    cr_RepomdRecordCompressTask *task;
+
+    assert(record);
+    assert(crecord);
+    assert(!err || *err == NULL);
+
+    task = g_malloc0(sizeof(cr_RepomdRecordCompressTask));
+    task->record = record;
+    task->crecord = crecord;
+    task->checksum_type = checksum_type;
+    task->type = type;
+    task->zck_dict_dir = g_strdup(zck_dict_dir);
+
+    return task;
+}
+
+void
+cr_repomdrecordcompresstask_free(cr_RepomdRecordCompressTask *task,
+                                 GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (task->err)
+        g_error_free(task->err);
+    g_free(task->zck_dict_dir);
+    g_free(task);
+}
+
+void
+cr_repomd_record_compress_thread(gpointer data,
+                                 G_GNUC_UNUSED gpointer user_data)
+{
+    cr_RepomdRecordCompressTask *task = data;
+    GError *tmp_err = NULL;
+
+    assert(task);
+
+    cr_repomd_record_compress_and_fill(task->record,
+                                       task->crecord,
+                                       task->checksum_type,
+                                       task->type,
+                                       task->zck_dict_dir,
+                                       &tmp_err);
+
+    if (tmp_err) {
+        // Error encountered
+        g_propagate_error(&task->err, tmp_err);
+    }
+}
+
+/** Task graph */
+
+struct _cr_TaskGraphNode {
+    GFunc func;
+    gpointer data;
+    gpointer user_data;
+    guint pending;          // Number of unfinished tasks this one waits for
+    gboolean done;
+    GSList *dependents;     // Tasks waiting for this one
+};
+
+struct _cr_TaskGraph {
+    GThreadPool *pool;
+    GMutex mutex;
+    GCond cond_done;
+    guint unfinished;       // Number of added tasks not finished yet
+    GSList *nodes;          // All the tasks (to be freed)
+    cr_CompressionSettings *compression; // Thread defaults of the creator
+    gint hidden_log_levels;              // of the graph (-1 - none)
+};
+
+static void
+cr_taskgraph_thread(gpointer data, gpointer user_data)
+{
+    cr_TaskGraphNode *node = data;
+    cr_TaskGraph *graph = user_data;
+
+    cr_compression_settings_push_thread_default(graph->compression);
+    if (graph->hidden_log_levels >= 0)
+        cr_log_push_thread_hidden_levels(graph->hidden_log_levels);
+    node->func(node->data, node->user_data);
+    if (graph->hidden_log_levels >= 0)
+        cr_log_pop_thread_hidden_levels();
+    cr_compression_settings_pop_thread_default(graph->compression);
+
+    g_mutex_lock(&graph->mutex);
+    node->done = TRUE;
+    for (GSList *elem = node->dependents; elem; elem = g_slist_next(elem)) {
+        cr_TaskGraphNode *dependent = elem->data;
+        if (--dependent->pending == 0)
+            g_thread_pool_push(graph->pool, dependent, NULL);
+    }
+    g_slist_free(node->dependents);
+    node->dependents = NULL;
+    if (--graph->unfinished == 0)
+        g_cond_broadcast(&graph->cond_done);
+    g_mutex_unlock(&graph->mutex);
+}
+
+cr_TaskGraph *
+cr_taskgraph_new(gint max_threads, GError **err)
+{
+    cr_TaskGraph *graph;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    graph = g_malloc0(sizeof(*graph));
+    g_mutex_init(&graph->mutex);
+    g_cond_init(&graph->cond_done);
+    graph->compression = cr_compression_settings_get_thread_default();
+    graph->hidden_log_levels = cr_log_get_thread_hidden_levels();
+    graph->pool = g_thread_pool_new(cr_taskgraph_thread, graph,
+                                    MAX(max_threads, 1), FALSE, &tmp_err);
+    if (!graph->pool) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot create a thread pool: ");
+        g_mutex_clear(&graph->mutex);
+        g_cond_clear(&graph->cond_done);
+        g_free(graph);
+        return NULL;
+    }
+
+    return graph;
+}
+
+cr_TaskGraphNode *
+cr_taskgraph_add(cr_TaskGraph *graph,
+                 GFunc func,
+                 gpointer data,
+                 gpointer user_data,
+                 cr_TaskGraphNode **deps,
+                 guint n_deps)
+{
+    cr_TaskGraphNode *node;
+
+    assert(graph);
+    assert(func);
+    assert(deps || n_deps == 0);
+
+    node = g_malloc0(sizeof(*node));
+    node->func = func;
+    node->data = data;
+    node->user_data = user_data;
+
+    g_mutex_lock(&graph->mutex);
+    for (guint x = 0; x < n_deps; x++) {
+        if (!deps[x] || deps[x]->done)
+            continue;
+        deps[x]->dependents = g_slist_prepend(deps[x]->dependents, node);
+        node->pending++;
+    }
+    graph->nodes = g_slist_prepend(graph->nodes, node);
+    graph->unfinished++;
+    if (node->pending == 0)
+        g_thread_pool_push(graph->pool, node, NULL);
+    g_mutex_unlock(&graph->mutex);
+
+    return node;
+}
+
+void
+cr_taskgraph_wait(cr_TaskGraph *graph)
+{
+    assert(graph);
+
+    g_mutex_lock(&graph->mutex);
+    while (graph->unfinished > 0)
+        g_cond_wait(&graph->cond_done, &graph->mutex);
+    g_mutex_unlock(&graph->mutex);
+}
+
+void
+cr_taskgraph_free(cr_TaskGraph *graph)
+{
+    if (!graph)
+        return;
+
+    cr_taskgraph_wait(graph);
+    g_thread_pool_free(graph->pool, FALSE, TRUE);
+    g_slist_free_full(graph->nodes, g_free);
+    g_mutex_clear(&graph->mutex);
+    g_cond_clear(&graph->cond_done);
+    g_free(graph);
+}
@@ -24,6 +24,7 @@
 #include "compression_wrapper.h"
 #include "checksum.h"
 #include "repomd.h"
+#include "sqlite.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -64,6 +65,48 @@ extern "C" {
  * @{
  */
 
+/** Max number of CPUs in a cr_CpuSet.
+ */
+#define CR_CPUSET_MAX_CPUS      1024
+
+/** Set of CPUs which threads could be bound to.
+ */
+typedef struct _cr_CpuSet cr_CpuSet;
+
+/** Parse a list of CPUs in the same format as taskset --cpu-list uses,
+ * e.g. "0-7,16-23".
+ * @param str       List of CPU numbers and ranges separated by commas
+ * @param err       GError **
+ * @return          New cr_CpuSet or NULL on error (bad format or
+ *                  CPU affinity is not supported on the platform)
+ */
+cr_CpuSet *
+cr_cpuset_from_str(const char *str, GError **err);
+
+/** Number of CPUs in the set.
+ * @param cpuset    cr_CpuSet or NULL
+ * @return          Number of CPUs (0 for NULL)
+ */
+guint
+cr_cpuset_count(const cr_CpuSet *cpuset);
+
+/** Bind the calling thread to the CPUs of the set. A thread already bound
+ * to the set is not bound again, so it is cheap to call at the start
+ * of every task of a GThreadPool. Memory the thread allocates afterwards
+ * is placed on the NUMA node of those CPUs by the kernel (first touch).
+ * @param cpuset    cr_CpuSet or NULL (does nothing)
+ * @param err       GError **
+ * @return          TRUE on success, FALSE if an error occurred
+ */
+gboolean
+cr_cpuset_bind_current_thread(const cr_CpuSet *cpuset, GError **err);
+
+/** Frees cr_CpuSet
+ * @param cpuset    cr_CpuSet or NULL
+ */
+void
+cr_cpuset_free(cr_CpuSet *cpuset);
+
 /** Object representing a single compression task
  */
 typedef struct {
@@ -84,6 +127,9 @@ typedef struct {
         Indicate if delete source file after successful compression. */
     GError *err; /*!<
         If error was encountered, it will be stored here, if no, then NULL*/
+    cr_SqliteDb *db; /*!<
+        Database to close and compress instead of the src file or NULL.
+        The db is closed by the task (see cr_db_close_compressed()). */
 } cr_CompressionTask;
 
 /** Function to prepare a new cr_CompressionTask.
@@ -123,6 +169,8 @@ void
 cr_compressiontask_free(cr_CompressionTask *task, GError **err);
 
 /** Function for GThreadPool.
+ * The user_data could be a cr_CpuSet the threads of the pool are bound to
+ * or NULL.
  */
 void
 cr_compressing_thread(gpointer data, gpointer user_data);
@@ -161,6 +209,111 @@ cr_repomd_record_fill_thread(gpointer data, gpointer user_data);
 void
 cr_rewrite_pkg_count_thread(gpointer data, gpointer user_data);
 
+/** Object representing a single repomd record compress and fill task
+ */
+typedef struct {
+    cr_RepomdRecord *record;        /*!< Record of the source file */
+    cr_RepomdRecord *crecord;       /*!< Record of the compressed file */
+    cr_ChecksumType checksum_type;  /*!< Type of checksum to be used */
+    cr_CompressionType type;        /*!< Compression type */
+    char *zck_dict_dir;             /*!< Directory with zchunk dictionaries */
+    GError *err;                    /*!< GError ** */
+} cr_RepomdRecordCompressTask;
+
+/** Function to prepare a new cr_RepomdRecordCompressTask.
+ * The arguments are the arguments of cr_repomd_record_compress_and_fill().
+ * @param record            cr_RepomdRecord of the source file.
+ * @param crecord           cr_RepomdRecord of the compressed file.
+ * @param checksum_type     Type of checksum.
+ * @param type              Compression type.
+ * @param zck_dict_dir      Directory with zchunk dictionaries or NULL.
+ * @param err               GError **
+ * @return                  New cr_RepomdRecordCompressTask.
+ */
+cr_RepomdRecordCompressTask *
+cr_repomdrecordcompresstask_new(cr_RepomdRecord *record,
+                                cr_RepomdRecord *crecord,
+                                cr_ChecksumType checksum_type,
+                                cr_CompressionType type,
+                                const char *zck_dict_dir,
+                                GError **err);
+
+/** Frees cr_RepomdRecordCompressTask
+ */
+void
+cr_repomdrecordcompresstask_free(cr_RepomdRecordCompressTask *task,
+                                 GError **err);
+
+/** Function for GThread Pool.
+ */
+void
+cr_repomd_record_compress_thread(gpointer data, gpointer user_data);
+
+/** Graph of tasks processed by a pool of threads. Every task starts
+ * as soon as all the tasks it depends on are finished, there are no
+ * barriers between groups of tasks.
+ *
+ * \code
+ * cr_TaskGraph *graph = cr_taskgraph_new(4, NULL);
+ * cr_TaskGraphNode *close = cr_taskgraph_add(graph, close_db, db, NULL,
+ *                                            NULL, 0);
+ * cr_TaskGraphNode *deps[] = { close };
+ * cr_taskgraph_add(graph, cr_compressing_thread, task, NULL, deps, 1);
+ * cr_taskgraph_free(graph);   // Waits until all the tasks are finished
+ * \endcode
+ */
+typedef struct _cr_TaskGraph cr_TaskGraph;
+
+/** Task of a cr_TaskGraph. It is owned by the graph.
+ */
+typedef struct _cr_TaskGraphNode cr_TaskGraphNode;
+
+/** Create a new graph. The tasks run with the thread default compression
+ * settings and log levels of the calling thread (see
+ * cr_compression_settings_push_thread_default() and
+ * cr_log_push_thread_hidden_levels()).
+ * @param max_threads       Number of threads processing the tasks
+ * @param err               GError **
+ * @return                  New cr_TaskGraph or NULL on error
+ */
+cr_TaskGraph *
+cr_taskgraph_new(gint max_threads, GError **err);
+
+/** Add a task into the graph. The task is started (possibly right away)
+ * after all the tasks from deps are finished. The task function reports
+ * errors by the data, as a function of GThreadPool does, the dependent
+ * tasks are started anyway. This function is thread safe, tasks could
+ * add other tasks.
+ * @param graph             cr_TaskGraph
+ * @param func              Function of the task
+ * @param data              First argument of func
+ * @param user_data         Second argument of func
+ * @param deps              Tasks of the graph this task depends on,
+ *                          NULL items are skipped (could be NULL if
+ *                          n_deps is 0)
+ * @param n_deps            Number of items in deps
+ * @return                  The task
+ */
+cr_TaskGraphNode *
+cr_taskgraph_add(cr_TaskGraph *graph,
+                 GFunc func,
+                 gpointer data,
+                 gpointer user_data,
+                 cr_TaskGraphNode **deps,
+                 guint n_deps);
+
+/** Wait until all the tasks added into the graph are finished.
+ * @param graph             cr_TaskGraph
+ */
+void
+cr_taskgraph_wait(cr_TaskGraph *graph);
+
+/** Wait until all the tasks are finished and free the graph.
+ * @param graph             cr_TaskGraph or NULL
+ */
+void
+cr_taskgraph_free(cr_TaskGraph *graph);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -26,6 +26,11 @@
 #include "misc.h"
 #include "checksum.h"
 
+/* Size of the blocks of the string chunk of an update record,
+ * all the strings of the record and of its references and collections
+ * are usually stored in a few blocks. */
+#define UPDATERECORD_CHUNK_SIZE     2048
+
 
 /*
  * cr_UpdateCollectionPackage
@@ -40,13 +45,27 @@ cr_updatecollectionpackage_new(void)
 }
 
 cr_UpdateCollectionPackage *
-cr_updatecollectionpackage_copy(const cr_UpdateCollectionPackage *orig)
+cr_updatecollectionpackage_new_with_chunk(GStringChunk *chunk)
+{
+    cr_UpdateCollectionPackage *pkg = g_malloc0(sizeof(*pkg));
+    pkg->chunk = chunk;
+    pkg->shared_chunk = TRUE;
+    return pkg;
+}
+
+/** Copy the object, its strings are stored in the chunk (a new chunk
+ * of the copy if NULL).
+ */
+static cr_UpdateCollectionPackage *
+cr_updatecollectionpackage_copy_to_chunk(const cr_UpdateCollectionPackage *orig,
+                                         GStringChunk *chunk)
 {
     cr_UpdateCollectionPackage *pkg;
 
     if (!orig) return NULL;
 
-    pkg = cr_updatecollectionpackage_new();
+    pkg = chunk ? cr_updatecollectionpackage_new_with_chunk(chunk)
+            : cr_updatecollectionpackage_new();
 
     pkg->name     = cr_safe_string_chunk_insert(pkg->chunk, orig->name);
     pkg->version  = cr_safe_string_chunk_insert(pkg->chunk, orig->version);
@@ -65,12 +84,19 @@ cr_updatecollectionpackage_copy(const cr_UpdateCollectionPackage *orig)
     return pkg;
 }
 
+cr_UpdateCollectionPackage *
+cr_updatecollectionpackage_copy(const cr_UpdateCollectionPackage *orig)
+{
+    return cr_updatecollectionpackage_copy_to_chunk(orig, NULL);
+}
+
 void
 cr_updatecollectionpackage_free(cr_UpdateCollectionPackage *pkg)
 {
     if (!pkg)
         return;
-    g_string_chunk_free(pkg->chunk);
+    if (!pkg->shared_chunk)
+        g_string_chunk_free(pkg->chunk);
     g_free(pkg);
 }
 
@@ -88,13 +114,24 @@ cr_updatecollectionmodule_new(void)
 }
 
 cr_UpdateCollectionModule *
-cr_updatecollectionmodule_copy(const cr_UpdateCollectionModule *orig)
+cr_updatecollectionmodule_new_with_chunk(GStringChunk *chunk)
+{
+    cr_UpdateCollectionModule *module = g_malloc0(sizeof(*module));
+    module->chunk = chunk;
+    module->shared_chunk = TRUE;
+    return module;
+}
+
+static cr_UpdateCollectionModule *
+cr_updatecollectionmodule_copy_to_chunk(const cr_UpdateCollectionModule *orig,
+                                        GStringChunk *chunk)
 {
     cr_UpdateCollectionModule *module;
 
     if (!orig) return NULL;
 
-    module = cr_updatecollectionmodule_new();
+    module = chunk ? cr_updatecollectionmodule_new_with_chunk(chunk)
+               : cr_updatecollectionmodule_new();
 
     module->name    = cr_safe_string_chunk_insert(module->chunk, orig->name);
     module->stream  = cr_safe_string_chunk_insert(module->chunk, orig->stream);
@@ -105,12 +142,19 @@ cr_updatecollectionmodule_copy(const cr_UpdateCollectionModule *orig)
     return module;
 }
 
+cr_UpdateCollectionModule *
+cr_updatecollectionmodule_copy(const cr_UpdateCollectionModule *orig)
+{
+    return cr_updatecollectionmodule_copy_to_chunk(orig, NULL);
+}
+
 void
 cr_updatecollectionmodule_free(cr_UpdateCollectionModule *module)
 {
     if (!module)
         return;
-    g_string_chunk_free(module->chunk);
+    if (!module->shared_chunk)
+        g_string_chunk_free(module->chunk);
     g_free(module);
 }
 
@@ -128,19 +172,31 @@ cr_updatecollection_new(void)
 }
 
 cr_UpdateCollection *
-cr_updatecollection_copy(const cr_UpdateCollection *orig)
+cr_updatecollection_new_with_chunk(GStringChunk *chunk)
+{
+    cr_UpdateCollection *collection = g_malloc0(sizeof(*collection));
+    collection->chunk = chunk;
+    collection->shared_chunk = TRUE;
+    return collection;
+}
+
+static cr_UpdateCollection *
+cr_updatecollection_copy_to_chunk(const cr_UpdateCollection *orig,
+                                  GStringChunk *chunk)
 {
     cr_UpdateCollection *col;
 
     if (!orig) return NULL;
 
-    col = cr_updatecollection_new();
+    col = chunk ? cr_updatecollection_new_with_chunk(chunk)
+            : cr_updatecollection_new();
 
     col->shortname = cr_safe_string_chunk_insert(col->chunk, orig->shortname);
     col->name      = cr_safe_string_chunk_insert(col->chunk, orig->name);
 
     if (orig->module) {
-      col->module = cr_updatecollectionmodule_copy(orig->module);
+      col->module = cr_updatecollectionmodule_copy_to_chunk(orig->module,
+                                                            col->chunk);
     }
 
     if (orig->packages) {
@@ -148,7 +204,8 @@ cr_updatecollection_copy(const cr_UpdateCollection *orig)
         for (GSList *elem = orig->packages; elem; elem = g_slist_next(elem)) {
             cr_UpdateCollectionPackage *pkg = elem->data;
             newlist = g_slist_prepend(newlist,
-                                      cr_updatecollectionpackage_copy(pkg));
+                        cr_updatecollectionpackage_copy_to_chunk(pkg,
+                                                                col->chunk));
         }
         col->packages = g_slist_reverse(newlist);
     }
@@ -156,6 +213,12 @@ cr_updatecollection_copy(const cr_UpdateCollection *orig)
     return col;
 }
 
+cr_UpdateCollection *
+cr_updatecollection_copy(const cr_UpdateCollection *orig)
+{
+    return cr_updatecollection_copy_to_chunk(orig, NULL);
+}
+
 void
 cr_updatecollection_free(cr_UpdateCollection *collection)
 {
@@ -164,7 +227,8 @@ cr_updatecollection_free(cr_UpdateCollection *collection)
     cr_updatecollectionmodule_free(collection->module);
     cr_slist_free_full(collection->packages,
                        (GDestroyNotify) cr_updatecollectionpackage_free);
-    g_string_chunk_free(collection->chunk);
+    if (!collection->shared_chunk)
+        g_string_chunk_free(collection->chunk);
     g_free(collection);
 }
 
@@ -190,13 +254,24 @@ cr_updatereference_new(void)
 }
 
 cr_UpdateReference *
-cr_updatereference_copy(const cr_UpdateReference *orig)
+cr_updatereference_new_with_chunk(GStringChunk *chunk)
+{
+    cr_UpdateReference *ref = g_malloc0(sizeof(*ref));
+    ref->chunk = chunk;
+    ref->shared_chunk = TRUE;
+    return ref;
+}
+
+static cr_UpdateReference *
+cr_updatereference_copy_to_chunk(const cr_UpdateReference *orig,
+                                 GStringChunk *chunk)
 {
     cr_UpdateReference *ref;
 
     if (!orig) return NULL;
 
-    ref = cr_updatereference_new();
+    ref = chunk ? cr_updatereference_new_with_chunk(chunk)
+            : cr_updatereference_new();
 
     ref->href  = cr_safe_string_chunk_insert(ref->chunk, orig->href);
     ref->id    = cr_safe_string_chunk_insert(ref->chunk, orig->id);
@@ -206,12 +281,19 @@ cr_updatereference_copy(const cr_UpdateReference *orig)
     return ref;
 }
 
+cr_UpdateReference *
+cr_updatereference_copy(const cr_UpdateReference *orig)
+{
+    return cr_updatereference_copy_to_chunk(orig, NULL);
+}
+
 void
 cr_updatereference_free(cr_UpdateReference *ref)
 {
     if (!ref)
         return;
-    g_string_chunk_free(ref->chunk);
+    if (!ref->shared_chunk)
+        g_string_chunk_free(ref->chunk);
     g_free(ref);
 }
 
@@ -224,7 +306,7 @@ cr_UpdateRecord *
 cr_updaterecord_new(void)
 {
     cr_UpdateRecord *rec = g_malloc0(sizeof(*rec));
-    rec->chunk = g_string_chunk_new(0);
+    rec->chunk = g_string_chunk_new(UPDATERECORD_CHUNK_SIZE);
     return rec;
 }
 
@@ -259,7 +341,7 @@ cr_updaterecord_copy(const cr_UpdateRecord *orig)
         for (GSList *elem = orig->references; elem; elem = g_slist_next(elem)) {
             cr_UpdateReference *ref = elem->data;
             newlist = g_slist_prepend(newlist,
-                                      cr_updatereference_copy(ref));
+                        cr_updatereference_copy_to_chunk(ref, rec->chunk));
         }
         rec->references = g_slist_reverse(newlist);
     }
@@ -269,7 +351,7 @@ cr_updaterecord_copy(const cr_UpdateRecord *orig)
         for (GSList *elem = orig->collections; elem; elem = g_slist_next(elem)) {
             cr_UpdateCollection *col = elem->data;
             newlist = g_slist_prepend(newlist,
-                                      cr_updatecollection_copy(col));
+                        cr_updatecollection_copy_to_chunk(col, rec->chunk));
         }
         rec->collections = g_slist_reverse(newlist);
     }
@@ -322,13 +404,129 @@ cr_updateinfo_free(cr_UpdateInfo *uinfo)
     if (!uinfo)
         return;
     cr_slist_free_full(uinfo->updates, (GDestroyNotify) cr_updaterecord_free);
+    cr_updateinfo_reindex(uinfo);
     g_free(uinfo);
 }
 
+/** Key of the index_packages for the NEVRA (the epoch "0" if missing).
+ */
+static gchar *
+updateinfo_nevra_key(const char *name,
+                     const char *epoch,
+                     const char *version,
+                     const char *release,
+                     const char *arch)
+{
+    return g_strdup_printf("%s-%s:%s-%s.%s", name,
+                           (epoch && *epoch) ? epoch : "0",
+                           version, release ? release : "",
+                           arch ? arch : "");
+}
+
+static void
+updateinfo_index_package(cr_UpdateInfo *uinfo,
+                         gchar *key,
+                         cr_UpdateRecord *record)
+{
+    GPtrArray *records = g_hash_table_lookup(uinfo->index_packages, key);
+
+    if (!records) {
+        records = g_ptr_array_new();
+        g_hash_table_insert(uinfo->index_packages, key, records);
+    } else {
+        g_free(key);
+    }
+
+    // A package could be in more collections of the record
+    if (!records->len || records->pdata[records->len - 1] != record)
+        g_ptr_array_add(records, record);
+}
+
+static void
+updateinfo_index_record(cr_UpdateInfo *uinfo, cr_UpdateRecord *record)
+{
+    if (record->id && !g_hash_table_contains(uinfo->index_ids, record->id))
+        g_hash_table_insert(uinfo->index_ids, record->id, record);
+
+    for (GSList *c = record->collections; c; c = g_slist_next(c)) {
+        cr_UpdateCollection *col = c->data;
+        for (GSList *p = col->packages; p; p = g_slist_next(p)) {
+            cr_UpdateCollectionPackage *pkg = p->data;
+
+            if (!pkg->name)
+                continue;
+
+            updateinfo_index_package(uinfo, g_strdup(pkg->name), record);
+            if (pkg->version)
+                updateinfo_index_package(uinfo,
+                                         updateinfo_nevra_key(pkg->name,
+                                                              pkg->epoch,
+                                                              pkg->version,
+                                                              pkg->release,
+                                                              pkg->arch),
+                                         record);
+        }
+    }
+}
+
+static void
+updateinfo_build_index(cr_UpdateInfo *uinfo)
+{
+    if (uinfo->index_ids)
+        return;
+
+    uinfo->index_ids = g_hash_table_new(g_str_hash, g_str_equal);
+    uinfo->index_packages = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                    g_free, (GDestroyNotify) g_ptr_array_unref);
+
+    for (GSList *elem = uinfo->updates; elem; elem = g_slist_next(elem))
+        updateinfo_index_record(uinfo, elem->data);
+}
+
 void
 cr_updateinfo_apped_record(cr_UpdateInfo *uinfo, cr_UpdateRecord *record)
 {
     if (!uinfo || !record) return;
     uinfo->updates = g_slist_append(uinfo->updates, record);
+    if (uinfo->index_ids)
+        updateinfo_index_record(uinfo, record);
+}
+
+cr_UpdateRecord *
+cr_updateinfo_get_record(cr_UpdateInfo *uinfo, const char *id)
+{
+    if (!uinfo || !id) return NULL;
+    updateinfo_build_index(uinfo);
+    return g_hash_table_lookup(uinfo->index_ids, id);
+}
+
+GPtrArray *
+cr_updateinfo_get_records_by_package(cr_UpdateInfo *uinfo,
+                                     const char *name,
+                                     const char *epoch,
+                                     const char *version,
+                                     const char *release,
+                                     const char *arch)
+{
+    GPtrArray *records;
+
+    if (!uinfo || !name) return NULL;
+    updateinfo_build_index(uinfo);
+
+    if (!version)
+        return g_hash_table_lookup(uinfo->index_packages, name);
+
+    gchar *key = updateinfo_nevra_key(name, epoch, version, release, arch);
+    records = g_hash_table_lookup(uinfo->index_packages, key);
+    g_free(key);
+    return records;
+}
+
+void
+cr_updateinfo_reindex(cr_UpdateInfo *uinfo)
+{
+    if (!uinfo) return;
+    g_clear_pointer(&uinfo->index_ids, g_hash_table_destroy);
+    g_clear_pointer(&uinfo->index_packages, g_hash_table_destroy);
 }
 
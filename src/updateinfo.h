@@ -50,6 +50,7 @@ typedef struct {
     gboolean relogin_suggested;
 
     GStringChunk *chunk;
+    gboolean shared_chunk; /*!< The chunk belongs to the update record */
 } cr_UpdateCollectionPackage;
 
 typedef struct {
@@ -60,6 +61,7 @@ typedef struct {
     gchar *arch;
 
     GStringChunk *chunk;
+    gboolean shared_chunk; /*!< The chunk belongs to the update record */
 } cr_UpdateCollectionModule;
 
 typedef struct {
@@ -68,6 +70,7 @@ typedef struct {
     cr_UpdateCollectionModule *module;
     GSList *packages;   /*!< List of cr_UpdateCollectionPackage */
     GStringChunk *chunk;
+    gboolean shared_chunk; /*!< The chunk belongs to the update record */
 } cr_UpdateCollection;
 
 typedef struct {
@@ -76,6 +79,7 @@ typedef struct {
     gchar *type;    /*!< reference type ("self" for errata, "bugzilla", ...) */
     gchar *title;   /*!< Name of errata, name of bug, etc. */
     GStringChunk *chunk;
+    gboolean shared_chunk; /*!< The chunk belongs to the update record */
 } cr_UpdateReference;
 
 typedef struct {
@@ -104,6 +108,12 @@ typedef struct {
 
 typedef struct {
     GSList *updates;    /*!< List of cr_UpdateRecord */
+
+    GHashTable *index_ids;      /*!< Index of the updates by the id
+                                     (private, built by the first lookup) */
+    GHashTable *index_packages; /*!< Index of the updates by the names
+                                     and NEVRAs of their packages
+                                     (private, built by the first lookup) */
 } cr_UpdateInfo;
 
 /*
@@ -113,6 +123,13 @@ typedef struct {
 cr_UpdateCollectionPackage *
 cr_updatecollectionpackage_new(void);
 
+/** Create an object which stores its strings in the chunk (usually
+ * the chunk of the update record it is going to be appended to).
+ * The chunk is not freed with the object.
+ */
+cr_UpdateCollectionPackage *
+cr_updatecollectionpackage_new_with_chunk(GStringChunk *chunk);
+
 cr_UpdateCollectionPackage *
 cr_updatecollectionpackage_copy(const cr_UpdateCollectionPackage *orig);
 
@@ -126,6 +143,12 @@ cr_updatecollectionpackage_free(cr_UpdateCollectionPackage *pkg);
 cr_UpdateCollectionModule *
 cr_updatecollectionmodule_new(void);
 
+/** Create a module with strings in the chunk,
+ * see cr_updatecollectionpackage_new_with_chunk().
+ */
+cr_UpdateCollectionModule *
+cr_updatecollectionmodule_new_with_chunk(GStringChunk *chunk);
+
 cr_UpdateCollectionModule *
 cr_updatecollectionmodule_copy(const cr_UpdateCollectionModule *orig);
 
@@ -139,6 +162,12 @@ cr_updatecollectionmodule_free(cr_UpdateCollectionModule *pkg);
 cr_UpdateCollection *
 cr_updatecollection_new(void);
 
+/** Create a collection with strings in the chunk,
+ * see cr_updatecollectionpackage_new_with_chunk().
+ */
+cr_UpdateCollection *
+cr_updatecollection_new_with_chunk(GStringChunk *chunk);
+
 cr_UpdateCollection *
 cr_updatecollection_copy(const cr_UpdateCollection *orig);
 
@@ -156,6 +185,12 @@ cr_updatecollection_append_package(cr_UpdateCollection *collection,
 cr_UpdateReference *
 cr_updatereference_new(void);
 
+/** Create a reference with strings in the chunk,
+ * see cr_updatecollectionpackage_new_with_chunk().
+ */
+cr_UpdateReference *
+cr_updatereference_new_with_chunk(GStringChunk *chunk);
+
 cr_UpdateReference *
 cr_updatereference_copy(const cr_UpdateReference *orig);
 
@@ -169,6 +204,9 @@ cr_updatereference_free(cr_UpdateReference *ref);
 cr_UpdateRecord *
 cr_updaterecord_new(void);
 
+/** Copy the record. All the strings of the copy (including the strings
+ * of its references and collections) are stored in its single chunk.
+ */
 cr_UpdateRecord *
 cr_updaterecord_copy(const cr_UpdateRecord *orig);
 
@@ -196,6 +234,44 @@ cr_updateinfo_free(cr_UpdateInfo *uinfo);
 void
 cr_updateinfo_apped_record(cr_UpdateInfo *uinfo, cr_UpdateRecord *record);
 
+/** Find the update record by its id. The indexes of the updateinfo are
+ * built by the first lookup and the later appended records are added
+ * to them. If the id or the packages of an already appended record
+ * change, call cr_updateinfo_reindex().
+ * @param uinfo         cr_UpdateInfo
+ * @param id            Update id (e.g. RHEA-2013:1777)
+ * @return              The first record with the id or NULL
+ */
+cr_UpdateRecord *
+cr_updateinfo_get_record(cr_UpdateInfo *uinfo, const char *id);
+
+/** Find the update records which reference the package.
+ * @param uinfo         cr_UpdateInfo
+ * @param name          Package name
+ * @param epoch         Package epoch (NULL is the same as "0")
+ * @param version       Package version or NULL to find the records
+ *                      by the name only (the rest of the NEVRA is ignored)
+ * @param release       Package release
+ * @param arch          Package arch
+ * @return              Array of the cr_UpdateRecord (in the order of
+ *                      the updates) or NULL if there is none. The array
+ *                      belongs to the index, it's valid until the next
+ *                      change of the updateinfo.
+ */
+GPtrArray *
+cr_updateinfo_get_records_by_package(cr_UpdateInfo *uinfo,
+                                     const char *name,
+                                     const char *epoch,
+                                     const char *version,
+                                     const char *release,
+                                     const char *arch);
+
+/** Drop the indexes, the next lookup builds them again.
+ * @param uinfo         cr_UpdateInfo
+ */
+void
+cr_updateinfo_reindex(cr_UpdateInfo *uinfo);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -0,0 +1,262 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include "checksum.h"
+#include "error.h"
+#include "load_metadata.h"
+#include "locate_metadata.h"
+#include "verify.h"
+
+#define ERR_DOMAIN              CREATEREPO_C_ERROR
+
+typedef struct {
+    cr_Package *pkg;
+    gchar *path;
+    cr_VerifyStatus status;
+    gchar *message;
+    gboolean queued;            // Checksum is calculated by the pool
+    gboolean done;              // Checksum was calculated
+} VerifyTask;
+
+typedef struct {
+    cr_ChecksumIoMode io_mode;
+    GMutex mutex;               // Guards the done flags of the tasks
+    GCond cond;                 // Signaled when a task is done
+} VerifyPoolData;
+
+/** Check the size of the package file. The tasks which pass it still
+ * need the checksum to be calculated.
+ */
+static gboolean
+verify_size(VerifyTask *task)
+{
+    GStatBuf st;
+
+    if (g_stat(task->path, &st) != 0) {
+        task->status = (errno == ENOENT) ? CR_VERIFY_MISSING : CR_VERIFY_ERROR;
+        task->message = g_strdup_printf("Cannot stat %s: %s", task->path,
+                                        g_strerror(errno));
+        return FALSE;
+    }
+
+    if ((gint64) st.st_size != task->pkg->size_package) {
+        task->status = CR_VERIFY_SIZE_MISMATCH;
+        task->message = g_strdup_printf("Size of %s is %" G_GINT64_FORMAT
+                                        " instead of %" G_GINT64_FORMAT,
+                                        task->path, (gint64) st.st_size,
+                                        task->pkg->size_package);
+        return FALSE;
+    }
+
+    task->status = CR_VERIFY_OK;
+    return TRUE;
+}
+
+static void
+verify_checksum(VerifyTask *task, cr_ChecksumIoMode io_mode)
+{
+    GError *tmp_err = NULL;
+    cr_ChecksumType type = cr_checksum_type(task->pkg->checksum_type);
+
+    if (type == CR_CHECKSUM_UNKNOWN) {
+        task->status = CR_VERIFY_ERROR;
+        task->message = g_strdup_printf("Unknown checksum type \"%s\" of %s",
+                                        task->pkg->checksum_type, task->path);
+        return;
+    }
+
+    gchar *checksum = cr_checksum_file_with_mode(task->path, type, io_mode,
+                                                 &tmp_err);
+    if (!checksum) {
+        task->status = CR_VERIFY_ERROR;
+        task->message = g_strdup(tmp_err->message);
+        g_error_free(tmp_err);
+        return;
+    }
+
+    if (g_ascii_strcasecmp(checksum, task->pkg->pkgId)) {
+        task->status = CR_VERIFY_CHECKSUM_MISMATCH;
+        task->message = g_strdup_printf("%s checksum of %s is %s instead "
+                                        "of %s", task->pkg->checksum_type,
+                                        task->path, checksum,
+                                        task->pkg->pkgId);
+    }
+    g_free(checksum);
+}
+
+static void
+verify_thread(gpointer data, gpointer user_data)
+{
+    VerifyTask *task = data;
+    VerifyPoolData *pool_data = user_data;
+
+    verify_checksum(task, pool_data->io_mode);
+
+    g_mutex_lock(&pool_data->mutex);
+    task->done = TRUE;
+    g_cond_broadcast(&pool_data->cond);
+    g_mutex_unlock(&pool_data->mutex);
+}
+
+gint
+cr_verify_packages(GSList *packages,
+                   const char *repopath,
+                   const cr_VerifyOptions *options,
+                   cr_VerifyCb cb,
+                   void *cbdata,
+                   GError **err)
+{
+    VerifyPoolData pool_data;
+    VerifyTask *tasks;
+    GThreadPool *pool = NULL;
+    guint count = g_slist_length(packages);
+    gint workers = (options && options->workers > 0) ? options->workers : 1;
+    gboolean size_only = options ? options->size_only : FALSE;
+    gint failed = 0;
+
+    assert(repopath);
+    assert(!err || *err == NULL);
+
+    pool_data.io_mode = (options && options->io_mode != CR_CHECKSUM_IO_UNKNOWN)
+                        ? options->io_mode : CR_CHECKSUM_IO_READ;
+    g_mutex_init(&pool_data.mutex);
+    g_cond_init(&pool_data.cond);
+
+    if (!size_only)
+        pool = g_thread_pool_new(verify_thread, &pool_data, workers, FALSE,
+                                 NULL);
+
+    // The sizes are checked before any package is read, the pool
+    // calculates the checksums only of the packages which pass it
+    tasks = g_new0(VerifyTask, count);
+    guint x = 0;
+    for (GSList *elem = packages; elem; elem = g_slist_next(elem), x++) {
+        VerifyTask *task = &tasks[x];
+        task->pkg  = elem->data;
+        task->path = g_build_filename(repopath, task->pkg->location_href,
+                                      NULL);
+        if (verify_size(task) && pool) {
+            task->queued = TRUE;
+            g_thread_pool_push(pool, task, NULL);
+        }
+    }
+
+    // The results are reported in the order of the packages as soon
+    // as they are known
+    for (x = 0; x < count; x++) {
+        VerifyTask *task = &tasks[x];
+
+        if (task->queued) {
+            g_mutex_lock(&pool_data.mutex);
+            while (!task->done)
+                g_cond_wait(&pool_data.cond, &pool_data.mutex);
+            g_mutex_unlock(&pool_data.mutex);
+        }
+
+        if (task->status != CR_VERIFY_OK)
+            failed++;
+        if (cb)
+            cb(task->pkg, task->path, task->status, task->message, cbdata);
+
+        g_free(task->path);
+        g_free(task->message);
+    }
+
+    if (pool)
+        g_thread_pool_free(pool, FALSE, TRUE);
+    g_free(tasks);
+    g_mutex_clear(&pool_data.mutex);
+    g_cond_clear(&pool_data.cond);
+
+    return failed;
+}
+
+static gint
+pkg_location_cmp(gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0(((const cr_Package *) a)->location_href,
+                     ((const cr_Package *) b)->location_href);
+}
+
+gint
+cr_verify_repo(const char *repopath,
+               const cr_VerifyOptions *options,
+               cr_VerifyCb cb,
+               void *cbdata,
+               GError **err)
+{
+    GError *tmp_err = NULL;
+    struct cr_MetadataLocation *ml;
+    cr_Metadata *md;
+    gint ret;
+
+    assert(repopath);
+    assert(!err || *err == NULL);
+
+    ml = cr_locate_metadata(repopath, TRUE, &tmp_err);
+    if (!ml) {
+        if (tmp_err)
+            g_propagate_error(err, tmp_err);
+        else
+            g_set_error(err, ERR_DOMAIN, CRE_NOFILE,
+                        "Cannot locate metadata of %s", repopath);
+        return -1;
+    }
+
+    if (ml->tmp) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Only packages of a local repository can be verified");
+        cr_metadatalocation_free(ml);
+        return -1;
+    }
+
+    // Only primary.xml is needed
+    g_clear_pointer(&ml->fil_xml_href, g_free);
+    g_clear_pointer(&ml->oth_xml_href, g_free);
+
+    // Packages of the same pkgId at several locations are all verified
+    md = cr_metadata_new(CR_HT_KEY_HREF, 1, NULL);
+    if (cr_metadata_load_xml(md, ml, &tmp_err) != CRE_OK) {
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot load metadata of %s: ", repopath);
+        cr_metadata_free(md);
+        cr_metadatalocation_free(ml);
+        return -1;
+    }
+
+    GSList *packages = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, cr_metadata_hashtable(md));
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        packages = g_slist_prepend(packages, value);
+    packages = g_slist_sort(packages, pkg_location_cmp);
+
+    ret = cr_verify_packages(packages, repopath, options, cb, cbdata, err);
+
+    g_slist_free(packages);
+    cr_metadata_free(md);
+    cr_metadatalocation_free(ml);
+    return ret;
+}
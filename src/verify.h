@@ -0,0 +1,119 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __C_CREATEREPOLIB_VERIFY_H__
+#define __C_CREATEREPOLIB_VERIFY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include "checksum.h"
+#include "package.h"
+
+/** \defgroup   verify      Verification of the packages of a repository
+ *
+ * The size of every package file is checked first, this is cheap and
+ * catches truncated or replaced files without reading them. Only the
+ * packages of the right size are read and their checksums compared with
+ * the pkgIds, in parallel by a pool of threads.
+ *
+ *  \addtogroup verify
+ *  @{
+ */
+
+/** Result of the verification of a package.
+ */
+typedef enum {
+    CR_VERIFY_OK,                   /*!< Package matches its metadata */
+    CR_VERIFY_MISSING,              /*!< Package file doesn't exist */
+    CR_VERIFY_SIZE_MISMATCH,        /*!< Package file has another size */
+    CR_VERIFY_CHECKSUM_MISMATCH,    /*!< Package file has another checksum */
+    CR_VERIFY_ERROR,                /*!< Package file cannot be read or
+                                         the checksum type is unknown */
+} cr_VerifyStatus;
+
+/** Options of the verification.
+ */
+typedef struct {
+    gint workers;                   /*!< number of threads calculating
+                                         the checksums */
+    cr_ChecksumIoMode io_mode;      /*!< how the package files are read */
+    gboolean size_only;             /*!< check only the sizes */
+} cr_VerifyOptions;
+
+/** Callback called for every verified package, in the order of the
+ * packages, from the thread which started the verification.
+ * @param pkg           package
+ * @param path          path to the package file
+ * @param status        result of the verification
+ * @param message       description of the problem or NULL if OK
+ * @param cbdata        user data
+ */
+typedef void (*cr_VerifyCb)(cr_Package *pkg,
+                            const char *path,
+                            cr_VerifyStatus status,
+                            const char *message,
+                            void *cbdata);
+
+/** Verify packages against their metadata.
+ * @param packages      list of cr_Package
+ * @param repopath      path to the directory the location_hrefs
+ *                      of the packages are relative to
+ * @param options       options or NULL for the defaults (one worker,
+ *                      CR_CHECKSUM_IO_READ)
+ * @param cb            callback
+ * @param cbdata        user data for the cb
+ * @param err           GError **
+ * @return              number of the packages which are not OK,
+ *                      -1 on error
+ */
+gint
+cr_verify_packages(GSList *packages,
+                   const char *repopath,
+                   const cr_VerifyOptions *options,
+                   cr_VerifyCb cb,
+                   void *cbdata,
+                   GError **err);
+
+/** Verify the packages of a local repository against its primary.xml.
+ * The packages are verified in the order of their location_hrefs.
+ * @param repopath      path to the repository (with repodata/ subdir)
+ * @param options       options or NULL for the defaults
+ * @param cb            callback
+ * @param cbdata        user data for the cb
+ * @param err           GError **
+ * @return              number of the packages which are not OK,
+ *                      -1 on error
+ */
+gint
+cr_verify_repo(const char *repopath,
+               const cr_VerifyOptions *options,
+               cr_VerifyCb cb,
+               void *cbdata,
+               GError **err);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C_CREATEREPOLIB_VERIFY_H__ */
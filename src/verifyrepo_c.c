@@ -0,0 +1,160 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "checksum.h"
+#include "error.h"
+#include "version.h"
+#include "createrepo_shared.h"
+#include "verify.h"
+
+#define EXIT_MISMATCH   1
+#define EXIT_TROUBLE    2
+
+typedef struct {
+    gboolean version;
+    gboolean quiet;
+    gboolean verbose;
+    gint workers;
+    gchar *checksum_io;
+    gboolean size_only;
+} VerifyrepoCmdOptions;
+
+typedef struct {
+    gboolean quiet;
+    gboolean verbose;
+    guint verified;
+} VerifyStats;
+
+static gboolean
+parse_arguments(int *argc, char ***argv, VerifyrepoCmdOptions *options,
+                GError **err)
+{
+    const GOptionEntry cmd_entries[] = {
+        { "version", 'V', 0, G_OPTION_ARG_NONE, &(options->version),
+          "Show program's version number and exit.", NULL },
+        { "quiet", 'q', 0, G_OPTION_ARG_NONE, &(options->quiet),
+          "Print nothing, only the exit status tells if all the packages "
+          "are OK.", NULL },
+        { "verbose", 'v', 0, G_OPTION_ARG_NONE, &(options->verbose),
+          "Run verbosely, print also the packages which are OK.", NULL },
+        { "workers", 0, 0, G_OPTION_ARG_INT, &(options->workers),
+          "Number of threads calculating the checksums (the number of CPUs "
+          "by default).", NULL },
+        { "checksum-io", 0, 0, G_OPTION_ARG_STRING, &(options->checksum_io),
+          "How to read packages during checksum calculation: \"read\" "
+          "(big sequential reads, default), \"mmap\" or \"direct\" (O_DIRECT, "
+          "bypasses the page cache).", "MODE"},
+        { "size-only", 0, 0, G_OPTION_ARG_NONE, &(options->size_only),
+          "Check only the sizes of the packages, don't read them.", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
+    };
+
+    GOptionContext *context;
+    context = g_option_context_new("<repo_directory>");
+    g_option_context_set_summary(context, "Verify that the packages of "
+            "a repository match their sizes and checksums in primary.xml. "
+            "Exit status is 0 if all the packages are OK, 1 if some of them "
+            "are not and 2 on error.");
+    g_option_context_add_main_entries(context, cmd_entries, NULL);
+    gboolean ret = g_option_context_parse(context, argc, argv, err);
+    g_option_context_free(context);
+    return ret;
+}
+
+static void
+verify_cb(cr_Package *pkg,
+          G_GNUC_UNUSED const char *path,
+          cr_VerifyStatus status,
+          const char *message,
+          void *cbdata)
+{
+    VerifyStats *stats = cbdata;
+
+    stats->verified++;
+    if (stats->quiet)
+        return;
+
+    if (status != CR_VERIFY_OK)
+        printf("FAILED %s: %s\n", pkg->location_href, message);
+    else if (stats->verbose)
+        printf("OK %s\n", pkg->location_href);
+}
+
+int
+main(int argc, char **argv)
+{
+    VerifyrepoCmdOptions options = { 0 };
+    VerifyStats stats = { 0 };
+    cr_VerifyOptions verify_options = { 0 };
+    GError *tmp_err = NULL;
+    gint failed;
+
+    // Parse arguments
+    if (!parse_arguments(&argc, &argv, &options, &tmp_err)) {
+        g_printerr("%s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        exit(EXIT_TROUBLE);
+    }
+
+    // Set logging
+    cr_setup_logging(options.quiet, options.verbose);
+
+    // Print version if required
+    if (options.version) {
+        printf("Version: %s\n", cr_version_string_with_features());
+        exit(EXIT_SUCCESS);
+    }
+
+    if (argc != 2) {
+        g_printerr("Usage: verifyrepo_c [options] <repo_directory>\n");
+        exit(EXIT_TROUBLE);
+    }
+
+    verify_options.workers = options.workers > 0 ? options.workers
+                                                 : (gint) g_get_num_processors();
+    verify_options.io_mode = CR_CHECKSUM_IO_READ;
+    verify_options.size_only = options.size_only;
+    if (options.checksum_io) {
+        verify_options.io_mode = cr_checksum_io_mode(options.checksum_io);
+        if (verify_options.io_mode == CR_CHECKSUM_IO_UNKNOWN) {
+            g_printerr("Unknown checksum io mode \"%s\"\n",
+                       options.checksum_io);
+            exit(EXIT_TROUBLE);
+        }
+    }
+
+    stats.quiet = options.quiet;
+    stats.verbose = options.verbose;
+    failed = cr_verify_repo(argv[1], &verify_options, verify_cb, &stats,
+                            &tmp_err);
+    g_free(options.checksum_io);
+    if (failed < 0) {
+        g_printerr("%s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        exit(EXIT_TROUBLE);
+    }
+
+    if (!options.quiet)
+        printf("Verified: %u\nFailed: %d\n", stats.verified, failed);
+
+    exit(failed ? EXIT_MISMATCH : EXIT_SUCCESS);
+}
@@ -23,31 +23,231 @@
 #include <libxml/xmlwriter.h>
 #include <libxml/parser.h>
 #include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CR_XML_SCAN_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CR_XML_SCAN_NEON 1
+#endif
 #include "error.h"
 #include "misc.h"
 #include "xml_dump.h"
 #include "xml_dump_internal.h"
 
 
+// Users which called cr_xml_dump_init() and not yet cr_xml_dump_cleanup()
+static GMutex xml_dump_mutex;
+static guint xml_dump_users = 0;
+
 void
 cr_xml_dump_init()
 {
-    xmlInitParser();
+    g_mutex_lock(&xml_dump_mutex);
+    if (xml_dump_users++ == 0)
+        xmlInitParser();
+    g_mutex_unlock(&xml_dump_mutex);
 }
 
 
 void
 cr_xml_dump_cleanup()
 {
-    xmlCleanupParser();
+    g_mutex_lock(&xml_dump_mutex);
+    // The libxml2 is cleaned up only by the last user
+    if (xml_dump_users > 0 && --xml_dump_users == 0)
+        xmlCleanupParser();
+    g_mutex_unlock(&xml_dump_mutex);
+}
+
+/*
+ * Scanning of strings for bytes which need a special care.
+ *
+ * Most of the strings (names, versions, paths, ...) are plain printable
+ * ASCII without any xml special character. Such strings don't need
+ * UTF-8 validation nor escaping and are just copied. Vector instructions
+ * are used to find the first byte which needs attention, 16 or 32 bytes
+ * at a time - SSE2 (always available on x86_64) or AVX2 (selected at
+ * runtime) on x86_64, NEON on aarch64 and a table lookup elsewhere.
+ */
+
+typedef enum {
+    CR_XML_SCAN_CLEAN   = (1 << 0), /*!< Not a printable ASCII or <>&" */
+    CR_XML_SCAN_TEXT    = (1 << 1), /*!< Escaped in element content */
+    CR_XML_SCAN_ATTR    = (1 << 2), /*!< Escaped in attribute value
+                                         (including non-ASCII) */
+    CR_XML_SCAN_CTRL    = (1 << 3), /*!< Control char (< 32) */
+} cr_XmlScanMode;
+
+static guint8 cr_xml_scan_table[256];
+
+static gpointer
+cr_xml_scan_table_init(G_GNUC_UNUSED gpointer data)
+{
+    for (int c = 0; c < 256; c++) {
+        guint8 flags = 0;
+        gboolean special = (c == '<' || c == '>' || c == '&');
+
+        if (c < 0x20 || c >= 0x80 || special || c == '"')
+            flags |= CR_XML_SCAN_CLEAN;
+        if (special || c == '\r')
+            flags |= CR_XML_SCAN_TEXT;
+        if (special || c == '"' || c == '\t' || c == '\n' || c == '\r'
+            || c >= 0x80)
+            flags |= CR_XML_SCAN_ATTR;
+        if (c < 0x20)
+            flags |= CR_XML_SCAN_CTRL;
+
+        cr_xml_scan_table[c] = flags;
+    }
+    return NULL;
+}
+
+static inline size_t
+cr_xml_scan_scalar(const unsigned char *str, size_t len, cr_XmlScanMode mode)
+{
+    size_t x = 0;
+    while (x < len && !(cr_xml_scan_table[str[x]] & mode))
+        x++;
+    return x;
+}
+
+#if defined(CR_XML_SCAN_X86)
+
+#define CR_XML_SCAN_VEC_FUNC(NAME, ATTRS, VEC, W, LOAD, SET1, CMPEQ, MIN, \
+                             CMPLT, OR, MOVEMASK)                        \
+ATTRS static size_t                                                     \
+NAME(const unsigned char *str, size_t len, cr_XmlScanMode mode)         \
+{                                                                       \
+    const VEC lt = SET1(0x1F);                                          \
+    const VEC zero = SET1(0);                                           \
+    size_t x = 0;                                                       \
+                                                                        \
+    for (; x + W <= len; x += W) {                                      \
+        VEC v = LOAD((const VEC *) (str + x));                          \
+        VEC ctrl = CMPEQ(MIN(v, lt), v);                                \
+        VEC hit;                                                        \
+                                                                        \
+        if (mode == CR_XML_SCAN_CTRL) {                                 \
+            hit = ctrl;                                                 \
+        } else {                                                        \
+            hit = OR(OR(CMPEQ(v, SET1('<')), CMPEQ(v, SET1('>'))),      \
+                     CMPEQ(v, SET1('&')));                              \
+            if (mode == CR_XML_SCAN_TEXT)                               \
+                hit = OR(hit, CMPEQ(v, SET1('\r')));                    \
+            else if (mode == CR_XML_SCAN_CLEAN)                         \
+                hit = OR(OR(hit, CMPEQ(v, SET1('"'))),                  \
+                         OR(ctrl, CMPLT(v, zero)));                     \
+            else                                                        \
+                hit = OR(OR(OR(hit, CMPEQ(v, SET1('"'))),               \
+                            OR(CMPEQ(v, SET1('\t')),                    \
+                               CMPEQ(v, SET1('\n')))),                  \
+                         OR(CMPEQ(v, SET1('\r')), CMPLT(v, zero)));     \
+        }                                                               \
+                                                                        \
+        unsigned int mask = (unsigned int) MOVEMASK(hit);               \
+        if (mask)                                                       \
+            return x + __builtin_ctz(mask);                             \
+    }                                                                   \
+                                                                        \
+    return x + cr_xml_scan_scalar(str + x, len - x, mode);              \
+}
+
+CR_XML_SCAN_VEC_FUNC(cr_xml_scan_sse2, , __m128i, 16, _mm_loadu_si128,
+                     _mm_set1_epi8, _mm_cmpeq_epi8, _mm_min_epu8,
+                     _mm_cmplt_epi8, _mm_or_si128, _mm_movemask_epi8)
+
+__attribute__((target("avx2"))) static inline __m256i
+cr_xml_scan_mm256_cmplt_epi8(__m256i a, __m256i b)
+{
+    return _mm256_cmpgt_epi8(b, a);
+}
+
+CR_XML_SCAN_VEC_FUNC(cr_xml_scan_avx2, __attribute__((target("avx2"))),
+                     __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi8,
+                     _mm256_cmpeq_epi8, _mm256_min_epu8,
+                     cr_xml_scan_mm256_cmplt_epi8, _mm256_or_si256,
+                     _mm256_movemask_epi8)
+
+#elif defined(CR_XML_SCAN_NEON)
+
+static size_t
+cr_xml_scan_neon(const unsigned char *str, size_t len, cr_XmlScanMode mode)
+{
+    size_t x = 0;
+
+    for (; x + 16 <= len; x += 16) {
+        uint8x16_t v = vld1q_u8(str + x);
+        uint8x16_t ctrl = vcltq_u8(v, vdupq_n_u8(0x20));
+        uint8x16_t hit;
+
+        if (mode == CR_XML_SCAN_CTRL) {
+            hit = ctrl;
+        } else {
+            hit = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('<')),
+                                    vceqq_u8(v, vdupq_n_u8('>'))),
+                           vceqq_u8(v, vdupq_n_u8('&')));
+            if (mode == CR_XML_SCAN_TEXT)
+                hit = vorrq_u8(hit, vceqq_u8(v, vdupq_n_u8('\r')));
+            else if (mode == CR_XML_SCAN_CLEAN)
+                hit = vorrq_u8(vorrq_u8(hit, vceqq_u8(v, vdupq_n_u8('"'))),
+                               vorrq_u8(ctrl, vcgeq_u8(v, vdupq_n_u8(0x80))));
+            else
+                hit = vorrq_u8(vorrq_u8(hit, vceqq_u8(v, vdupq_n_u8('"'))),
+                               vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\t')),
+                                                 vceqq_u8(v, vdupq_n_u8('\n'))),
+                                        vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')),
+                                                 vcgeq_u8(v, vdupq_n_u8(0x80)))));
+        }
+
+        if (vmaxvq_u8(hit))
+            break;  // The exact position is found by the scalar code
+    }
+
+    return x + cr_xml_scan_scalar(str + x, len - x, mode);
+}
+
+#endif
+
+/** Return length of the prefix of the string without bytes of the mode.
+ */
+static size_t
+cr_xml_scan(const unsigned char *str, size_t len, cr_XmlScanMode mode)
+{
+    static GOnce table_once = G_ONCE_INIT;
+    g_once(&table_once, cr_xml_scan_table_init, NULL);
+
+#if defined(CR_XML_SCAN_X86)
+    static int use_avx2 = -1;
+    if (G_UNLIKELY(use_avx2 == -1))
+        use_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    if (len >= 32 && use_avx2)
+        return cr_xml_scan_avx2(str, len, mode);
+    return cr_xml_scan_sse2(str, len, mode);
+#elif defined(CR_XML_SCAN_NEON)
+    return cr_xml_scan_neon(str, len, mode);
+#else
+    return cr_xml_scan_scalar(str, len, mode);
+#endif
+}
+
+size_t cr_clean_prefix_len(const char *str, size_t len)
+{
+    return cr_xml_scan((const unsigned char *) str, len, CR_XML_SCAN_CLEAN);
 }
 
 gboolean cr_hascontrollchars(const unsigned char *str)
 {
-    while (*str) {
-        if (*str < 32 && (*str != 9 && *str != 10 && *str != 13))
+    size_t len = strlen((const char *) str);
+
+    while (len) {
+        size_t x = cr_xml_scan(str, len, CR_XML_SCAN_CTRL);
+        if (x == len)
+            break;
+        if (str[x] != 9 && str[x] != 10 && str[x] != 13)
             return TRUE;
-        ++str;
+        str += x + 1;
+        len -= x + 1;
     }
 
     return FALSE;
@@ -142,13 +342,285 @@ cr_xmlNewProp(xmlNodePtr node, const xmlChar *name, const xmlChar *orig_content)
     return attr;
 }
 
+static void
+cr_xml_dump_buffer_free(gpointer buf)
+{
+    g_string_free((GString *) buf, TRUE);
+}
+
+static GPrivate cr_xml_dump_buffer_key =
+                            G_PRIVATE_INIT(cr_xml_dump_buffer_free);
+
+GString *
+cr_xml_dump_buffer(void)
+{
+    GString *buf = g_private_get(&cr_xml_dump_buffer_key);
+
+    if (!buf) {
+        buf = g_string_sized_new(XML_DUMP_BUFFER_SIZE);
+        g_private_set(&cr_xml_dump_buffer_key, buf);
+    }
+
+    g_string_truncate(buf, 0);
+    return buf;
+}
+
+char *
+cr_xml_dump_buffer_finish(GString *buf)
+{
+    char *result = g_strndup(buf->str, buf->len);
+
+    // Do not keep memory of an exceptionally big package
+    if (buf->allocated_len > XML_DUMP_BUFFER_MAX_SIZE)
+        g_private_replace(&cr_xml_dump_buffer_key, NULL);
+
+    return result;
+}
+
+struct _cr_XmlBufferPool {
+    GAsyncQueue *buffers;       // Free buffers
+    guint max_buffers;          // Max number of the free buffers
+};
+
+static void
+cr_xml_buffer_pool_buffer_free(gpointer buf)
+{
+    g_string_free((GString *) buf, TRUE);
+}
+
+cr_XmlBufferPool *
+cr_xml_buffer_pool_new(guint max_buffers)
+{
+    cr_XmlBufferPool *pool = g_new0(cr_XmlBufferPool, 1);
+    pool->buffers = g_async_queue_new_full(cr_xml_buffer_pool_buffer_free);
+    pool->max_buffers = max_buffers;
+    return pool;
+}
+
+GString *
+cr_xml_buffer_pool_get(cr_XmlBufferPool *pool)
+{
+    GString *buf = g_async_queue_try_pop(pool->buffers);
+
+    if (!buf)
+        return g_string_sized_new(XML_BUFFER_POOL_BUFFER_SIZE);
+
+    g_string_truncate(buf, 0);
+    return buf;
+}
+
+void
+cr_xml_buffer_pool_put(cr_XmlBufferPool *pool, GString *buf)
+{
+    if (!buf)
+        return;
+
+    // The length of the queue is only a hint, a few more buffers
+    // don't matter
+    if (buf->allocated_len > XML_BUFFER_POOL_MAX_SIZE
+        || g_async_queue_length(pool->buffers) >= (gint) pool->max_buffers)
+    {
+        g_string_free(buf, TRUE);
+        return;
+    }
+
+    g_async_queue_push(pool->buffers, buf);
+}
+
+void
+cr_xml_buffer_pool_free(cr_XmlBufferPool *pool)
+{
+    if (!pool)
+        return;
+
+    g_async_queue_unref(pool->buffers);
+    g_free(pool);
+}
+
+static void
+cr_xml_dump_escape_text(GString *buf, const unsigned char *str, size_t len)
+{
+    const unsigned char *end = str + len;
+
+    while (str < end) {
+        size_t clean = cr_xml_scan(str, end - str, CR_XML_SCAN_TEXT);
+        const char *esc;
+
+        g_string_append_len(buf, (const char *) str, clean);
+        str += clean;
+        if (str == end)
+            break;
+
+        switch (*str) {
+            case '<':   esc = "&lt;";   break;
+            case '>':   esc = "&gt;";   break;
+            case '&':   esc = "&amp;";  break;
+            default:    esc = "&#13;";  break;  // '\r'
+        }
+
+        g_string_append(buf, esc);
+        str++;
+    }
+}
+
+static inline gboolean
+cr_xml_dump_is_char(guint32 val)
+{
+    // IS_CHAR() from libxml2 for values >= 0x80
+    return (val >= 0x80 && val <= 0xD7FF)
+           || (val >= 0xE000 && val <= 0xFFFD)
+           || (val >= 0x10000 && val <= 0x10FFFF);
+}
+
+static void
+cr_xml_dump_escape_attr(GString *buf, const unsigned char *str, size_t len)
+{
+    const unsigned char *end = str + len;
+
+    while (str < end) {
+        size_t clean = cr_xml_scan(str, end - str, CR_XML_SCAN_ATTR);
+        const char *esc;
+
+        g_string_append_len(buf, (const char *) str, clean);
+        str += clean;
+        if (str == end)
+            break;
+
+        switch (*str) {
+            case '\n':  esc = "&#10;";  break;
+            case '\r':  esc = "&#13;";  break;
+            case '\t':  esc = "&#9;";   break;
+            case '"':   esc = "&quot;"; break;
+            case '<':   esc = "&lt;";   break;
+            case '>':   esc = "&gt;";   break;
+            case '&':   esc = "&amp;";  break;
+            default:    esc = NULL;     break;
+        }
+
+        if (esc) {
+            g_string_append(buf, esc);
+            str++;
+            continue;
+        }
+
+        // Non-ASCII byte (the string is NULL terminated, so checks of
+        // the following bytes never read behind the terminator)
+        if (str[1] == '\0') {
+            g_string_append_c(buf, *str);
+            str++;
+            continue;
+        }
+
+        // Non-ASCII characters are written as character references
+        // (libxml2 does this for attributes of nodes without a document)
+        guint32 val = 0;
+        int l = 1;
+
+        if (*str < 0xC0) {
+            l = 1;
+        } else if (*str < 0xE0) {
+            val = ((str[0] & 0x1F) << 6) | (str[1] & 0x3F);
+            l = 2;
+        } else if (*str < 0xF0 && str[2] != '\0') {
+            val = ((str[0] & 0x0F) << 12) | ((str[1] & 0x3F) << 6)
+                  | (str[2] & 0x3F);
+            l = 3;
+        } else if (*str < 0xF8 && str[2] != '\0' && str[3] != '\0') {
+            val = ((str[0] & 0x07) << 18) | ((str[1] & 0x3F) << 12)
+                  | ((str[2] & 0x3F) << 6) | (str[3] & 0x3F);
+            l = 4;
+        }
+
+        if (l == 1 || !cr_xml_dump_is_char(val)) {
+            // Invalid character, write the single byte
+            val = *str;
+            l = 1;
+        }
+
+        g_string_append_printf(buf, "&#x%X;", val);
+        str += l;
+    }
+}
+
+static void
+cr_xml_dump_escaped(GString *buf, const char *str, gboolean attr)
+{
+    size_t len = strlen(str);
+    size_t clean;
+    unsigned char *content = NULL;
+
+    // Fast path - printable ASCII without special characters is valid
+    // UTF-8 and doesn't need escaping
+    clean = cr_xml_scan((const unsigned char *) str, len, CR_XML_SCAN_CLEAN);
+    g_string_append_len(buf, str, clean);
+    if (clean == len)
+        return;
+
+    // The rest of the string needs the full processing. The clean prefix
+    // is ASCII, so the validity of the whole string depends only on the
+    // rest and the conversion doesn't change the prefix.
+    str += clean;
+    len -= clean;
+
+    if (!xmlCheckUTF8((const xmlChar *) str)) {
+        content = g_malloc(len * 2 + 1);
+        cr_latin1_to_utf8((const unsigned char *) str, content);
+        str = (const char *) content;
+        len = strlen(str);
+    }
+
+    if (attr)
+        cr_xml_dump_escape_attr(buf, (const unsigned char *) str, len);
+    else
+        cr_xml_dump_escape_text(buf, (const unsigned char *) str, len);
+
+    g_free(content);
+}
+
+void
+cr_xml_dump_text(GString *buf, const char *content)
+{
+    if (content)
+        cr_xml_dump_escaped(buf, content, FALSE);
+}
+
+void
+cr_xml_dump_attr(GString *buf, const char *name, const char *value)
+{
+    g_string_append_c(buf, ' ');
+    g_string_append(buf, name);
+    g_string_append_len(buf, "=\"", 2);
+    if (value)
+        cr_xml_dump_escaped(buf, value, TRUE);
+    g_string_append_c(buf, '"');
+}
+
 void
-cr_xml_dump_files(xmlNodePtr node, cr_Package *package, int primary)
+cr_xml_dump_attr_raw(GString *buf, const char *name, const char *value)
 {
-    if (!node || !package->files) {
+    g_string_append_c(buf, ' ');
+    g_string_append(buf, name);
+    g_string_append_len(buf, "=\"", 2);
+    if (value)
+        cr_xml_dump_escape_attr(buf, (const unsigned char *) value,
+                                strlen(value));
+    g_string_append_c(buf, '"');
+}
+
+void
+cr_xml_dump_attr_int(GString *buf, const char *name, gint64 value)
+{
+    g_string_append_printf(buf, " %s=\"%"G_GINT64_FORMAT"\"", name, value);
+}
+
+void
+cr_xml_dump_files(GString *buf, cr_Package *package, int primary, int level)
+{
+    if (!package->files) {
         return;
     }
 
+    GString *fullname = g_string_sized_new(256);
 
     GSList *element = NULL;
     for(element = package->files; element; element=element->next) {
@@ -162,40 +634,46 @@ cr_xml_dump_files(xmlNodePtr node, cr_Package *package, int primary)
         }
 
 
-        // String concatenation (path + basename)
-
-        gchar *fullname;
-        fullname = g_strconcat(entry->path, entry->name, NULL);
+        // Skip a file if we want primary files and the file is not one
 
-        if (!fullname) {
+        if (primary && !cr_is_primary_file(entry->path, entry->name)) {
             continue;
         }
 
 
-        // Skip a file if we want primary files and the file is not one
+        // String concatenation (path + basename)
 
-        if (primary && !cr_is_primary(fullname)) {
-            g_free(fullname);
-            continue;
-        }
+        g_string_assign(fullname, entry->path);
+        g_string_append(fullname, entry->name);
 
 
         // ***********************************
         // Element: file
         // ************************************
 
-        xmlNodePtr file_node;
-        file_node = cr_xmlNewTextChild(node,
-                                       NULL,
-                                       BAD_CAST "file",
-                                       BAD_CAST fullname);
-        g_free(fullname);
+        cr_xml_dump_start(buf, level, "file");
 
         // Write type (skip type if type value is empty of "file")
-        if (entry->type && entry->type[0] != '\0' && strcmp(entry->type, "file")) {
-            cr_xmlNewProp(file_node, BAD_CAST "type", BAD_CAST entry->type);
+        switch (cr_package_file_type(entry)) {
+            case CR_FILE_TYPE_FILE:
+                break;
+            case CR_FILE_TYPE_DIR:
+                g_string_append_len(buf, " type=\"dir\"", 11);
+                break;
+            case CR_FILE_TYPE_GHOST:
+                g_string_append_len(buf, " type=\"ghost\"", 13);
+                break;
+            default:
+                cr_xml_dump_attr(buf, "type", entry->type);
+                break;
         }
+
+        g_string_append_c(buf, '>');
+        cr_xml_dump_text(buf, fullname->str);
+        cr_xml_dump_end(buf, 0, "file");
     }
+
+    g_string_free(fullname, TRUE);
 }
 
 gboolean
@@ -320,3 +798,88 @@ cr_xml_dump(cr_Package *pkg, GError **err)
 
     return result;
 }
+
+struct cr_XmlStruct
+cr_xml_dump_to_buffers(cr_Package *pkg,
+                       GString *primary,
+                       GString *filelists,
+                       GString *other,
+                       GError **err)
+{
+    struct cr_XmlStruct result;
+
+    assert(primary);
+    assert(!err || *err == NULL);
+
+    result.primary   = NULL;
+    result.filelists = NULL;
+    result.other     = NULL;
+
+    if (!pkg) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_BADARG,
+                    "No package object to dump specified");
+        return result;
+    }
+
+    if (cr_Package_contains_forbidden_control_chars(pkg)) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_XMLDATA,
+                    "Forbidden control chars found (ASCII values <32 except 9, 10 and 13).");
+        return result;
+    }
+
+    g_string_truncate(primary, 0);
+    cr_xml_dump_primary_base_items(primary, pkg);
+    result.primary = primary->str;
+
+    if (filelists) {
+        g_string_truncate(filelists, 0);
+        cr_xml_dump_filelists_items(filelists, pkg);
+        result.filelists = filelists->str;
+    }
+
+    if (other) {
+        g_string_truncate(other, 0);
+        cr_xml_dump_other_items(other, pkg);
+        result.other = other->str;
+    }
+
+    return result;
+}
+
+struct cr_XmlStruct
+cr_xml_dump_from_raw(cr_Package *pkg, GError **err)
+{
+    struct cr_XmlStruct result;
+
+    assert(!err || *err == NULL);
+
+    result.primary   = NULL;
+    result.filelists = NULL;
+    result.other     = NULL;
+
+    if (!pkg)
+        return result;
+
+    if (!pkg->raw_filelists || !pkg->raw_other) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_BADARG,
+                    "No raw xml of the package available");
+        return result;
+    }
+
+    if ((pkg->location_href && cr_hascontrollchars((unsigned char *) pkg->location_href)) ||
+        (pkg->location_base && cr_hascontrollchars((unsigned char *) pkg->location_base)))
+    {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_XMLDATA,
+                    "Forbidden control chars found (ASCII values <32 except 9, 10 and 13).");
+        return result;
+    }
+
+    result.primary = cr_xml_dump_primary_from_raw(pkg, err);
+    if (!result.primary)
+        return result;
+
+    result.filelists = g_strconcat(pkg->raw_filelists, "\n", NULL);
+    result.other     = g_strconcat(pkg->raw_other, "\n", NULL);
+
+    return result;
+}
@@ -83,10 +83,13 @@ struct cr_XmlStruct {
 };
 
 /** Initialize dumping part of library (Initialize libxml2).
+ * As cr_package_parser_init(), every user calls it once and then calls
+ * cr_xml_dump_cleanup(). This function is thread safe.
  */
 void cr_xml_dump_init();
 
-/** Cleanup initialized dumping part of library
+/** Cleanup initialized dumping part of library. The libxml2 is cleaned
+ * up by the last user. This function is thread safe.
  */
 void cr_xml_dump_cleanup();
 
@@ -97,6 +100,15 @@ void cr_xml_dump_cleanup();
  */
 char *cr_xml_dump_primary(cr_Package *package, GError **err);
 
+/** Generate primary xml chunk from the raw primary xml of the cr_Package
+ * (cr_Package->raw_primary). Only the location element is regenerated
+ * from the location_href and location_base of the package.
+ * @param package       cr_Package
+ * @param err           **GError
+ * @return              xml chunk string or NULL on error
+ */
+char *cr_xml_dump_primary_from_raw(cr_Package *package, GError **err);
+
 /** Generate filelists xml chunk from cr_Package.
  * @param package       cr_Package
  * @param err           **GError
@@ -118,6 +130,16 @@ char *cr_xml_dump_other(cr_Package *package, GError **err);
  */
 struct cr_XmlStruct cr_xml_dump(cr_Package *package, GError **err);
 
+/** Generate all three xml chunks (primary, filelists, other) from the raw
+ * xml of the cr_Package (see cr_metadata_set_store_raw()). The result is
+ * the same as of the cr_xml_dump() if the package wasn't modified, except
+ * of the location which is always taken from the package.
+ * @param package       cr_Package
+ * @param err           **GError
+ * @return              cr_XmlStruct
+ */
+struct cr_XmlStruct cr_xml_dump_from_raw(cr_Package *package, GError **err);
+
 /** Generate xml representation of cr_Repomd.
  * @param repomd        cr_Repomd
  * @param err           **GError
@@ -167,6 +189,18 @@ void cr_latin1_to_utf8(const unsigned char *in,
  */
 gboolean cr_hascontrollchars(const unsigned char *str);
 
+/**
+ * Length of the leading part of the string which is printable ASCII
+ * without xml special chars (<>&"). Such part is valid UTF-8 without
+ * control chars and needs no escaping.
+ *
+ * @param str           String
+ * @param len           Length of the string
+ * @return              Length of the clean prefix (len if whole string
+ *                      is clean)
+ */
+size_t cr_clean_prefix_len(const char *str, size_t len);
+
 /**
  * Prepend protocol if necessary
  *
@@ -25,6 +25,7 @@ extern "C" {
 #endif
 
 #include "package.h"
+#include "xml_dump.h"
 #include <libxml/tree.h>
 
 #define XML_DOC_VERSION "1.0"
@@ -42,13 +43,202 @@ extern "C" {
 #define DATESIZE_STR_MAX_LEN    SIZE_STR_MAX_LEN
 #endif
 
-/** Dump files from the package and append them to the node as childrens.
- * @param node          parent xml node
+/** Size of the per-thread buffer used by the package xml writers */
+#define XML_DUMP_BUFFER_SIZE        (64*1024)
+/** Bigger buffers are not kept for the next package */
+#define XML_DUMP_BUFFER_MAX_SIZE    (4*1024*1024)
+
+/** Package xml chunks (primary, filelists and other) are written directly
+ * into a GString instead of building a libxml2 tree. The output is the
+ * same as the one of xmlNodeDump() with the format enabled:
+ *  - Element content is escaped like the libxml2 does it for text nodes
+ *    ('<', '>', '&' and '\r').
+ *  - Attribute values are escaped like the libxml2 does it for nodes
+ *    without a document ('<', '>', '&', '"', '\n', '\r', '\t' and all
+ *    non-ASCII characters as character references).
+ *  - Child elements are indented by two spaces per level.
+ */
+
+/** Return the empty writer buffer of the current thread.
+ * The buffer must not be freed, use cr_xml_dump_buffer_finish().
+ * @return              empty buffer
+ */
+GString *cr_xml_dump_buffer(void);
+
+/** Return a copy of the buffer content. The buffer is freed if it
+ * grew too much, otherwise it is kept for the next cr_xml_dump_buffer().
+ * @param buf           buffer returned by cr_xml_dump_buffer()
+ * @return              newly allocated string
+ */
+char *cr_xml_dump_buffer_finish(GString *buf);
+
+/** Append escaped element content.
+ * Content could be NULL (nothing is written) and non UTF-8 (if content is
+ * no UTF-8 then iso-8859-1 is assumed) - the same as cr_xmlNewTextChild().
+ * @param buf           buffer
+ * @param content       element content
+ */
+void cr_xml_dump_text(GString *buf, const char *content);
+
+/** Append an attribute (` name="value"`).
+ * Value could be NULL (empty value is written) and non UTF-8 (if value is
+ * no UTF-8 then iso-8859-1 is assumed) - the same as cr_xmlNewProp().
+ * @param buf           buffer
+ * @param name          attribute name
+ * @param value         attribute value
+ */
+void cr_xml_dump_attr(GString *buf, const char *name, const char *value);
+
+/** Append an attribute without the UTF-8 check of the value
+ * (the same as xmlNewProp()).
+ * @param buf           buffer
+ * @param name          attribute name
+ * @param value         attribute value or NULL
+ */
+void cr_xml_dump_attr_raw(GString *buf, const char *name, const char *value);
+
+/** Append an attribute with a numeric value.
+ * @param buf           buffer
+ * @param name          attribute name
+ * @param value         attribute value
+ */
+void cr_xml_dump_attr_int(GString *buf, const char *name, gint64 value);
+
+/** Append indentation of the element and start of its start tag.
+ * @param buf           buffer
+ * @param level         element nesting level (0 for the package element)
+ * @param name          element name
+ */
+static inline void
+cr_xml_dump_start(GString *buf, int level, const char *name)
+{
+    for (int x = 0; x < level; x++)
+        g_string_append_len(buf, "  ", 2);
+    g_string_append_c(buf, '<');
+    g_string_append(buf, name);
+}
+
+/** Append end tag of the element and the newline.
+ * @param buf           buffer
+ * @param level         element nesting level for elements with child
+ *                      elements, 0 for elements with a text content
+ *                      (no indentation)
+ * @param name          element name
+ */
+static inline void
+cr_xml_dump_end(GString *buf, int level, const char *name)
+{
+    for (int x = 0; x < level; x++)
+        g_string_append_len(buf, "  ", 2);
+    g_string_append_len(buf, "</", 2);
+    g_string_append(buf, name);
+    g_string_append_len(buf, ">\n", 2);
+}
+
+/** Append the whole element with a text content
+ * (see cr_xmlNewTextChild(), NULL content is written as an empty element
+ * content).
+ * @param buf           buffer
+ * @param level         element nesting level
+ * @param name          element name
+ * @param content       element content
+ */
+static inline void
+cr_xml_dump_text_element(GString *buf,
+                         int level,
+                         const char *name,
+                         const char *content)
+{
+    cr_xml_dump_start(buf, level, name);
+    g_string_append_c(buf, '>');
+    cr_xml_dump_text(buf, content);
+    cr_xml_dump_end(buf, 0, name);
+}
+
+/** Dump files from the package as file elements.
+ * @param buf           buffer
  * @param package       cr_Package
  * @param primary       process only primary files (see cr_is_primary() function
  *                      in the misc module)
+ * @param level         nesting level of the file elements
+ */
+void cr_xml_dump_files(GString *buf,
+                       cr_Package *package,
+                       int primary,
+                       int level);
+
+/** Dump the package element of primary.xml.
+ * @param buf           buffer
+ * @param package       cr_Package
+ */
+void cr_xml_dump_primary_base_items(GString *buf, cr_Package *package);
+
+/** Dump the package element of filelists.xml.
+ * @param buf           buffer
+ * @param package       cr_Package
+ */
+void cr_xml_dump_filelists_items(GString *buf, cr_Package *package);
+
+/** Dump the package element of other.xml.
+ * @param buf           buffer
+ * @param package       cr_Package
+ */
+void cr_xml_dump_other_items(GString *buf, cr_Package *package);
+
+/** Size of new buffers of the cr_XmlBufferPool */
+#define XML_BUFFER_POOL_BUFFER_SIZE (4*1024)
+/** Bigger buffers are not returned into the cr_XmlBufferPool */
+#define XML_BUFFER_POOL_MAX_SIZE    (256*1024)
+
+/** Pool of reusable output buffers for cr_xml_dump_to_buffers().
+ * The buffers are usually taken by one thread (a worker) and returned
+ * by another one (the last writer of the chunks), the pool is thread safe.
+ */
+typedef struct _cr_XmlBufferPool cr_XmlBufferPool;
+
+/** Create a new pool.
+ * @param max_buffers   max number of kept free buffers
+ * @return              new pool
+ */
+cr_XmlBufferPool *cr_xml_buffer_pool_new(guint max_buffers);
+
+/** Take an empty buffer from the pool, a new one is created if the pool
+ * is empty.
+ * @param pool          pool
+ * @return              empty buffer
+ */
+GString *cr_xml_buffer_pool_get(cr_XmlBufferPool *pool);
+
+/** Return the buffer into the pool. The buffer is freed if the pool
+ * is full or if the buffer grew too much.
+ * @param pool          pool
+ * @param buf           buffer or NULL
+ */
+void cr_xml_buffer_pool_put(cr_XmlBufferPool *pool, GString *buf);
+
+/** Free the pool and all its buffers, all the taken buffers must be
+ * returned before.
+ * @param pool          pool or NULL
+ */
+void cr_xml_buffer_pool_free(cr_XmlBufferPool *pool);
+
+/** The same as cr_xml_dump() but the chunks are written into the given
+ * buffers instead of newly allocated strings. The strings of the result
+ * point into the buffers, they must not be freed.
+ * @param pkg           cr_Package
+ * @param primary       buffer for primary.xml chunk
+ * @param filelists     buffer for filelists.xml chunk or NULL
+ *                      (the filelists of the result is NULL then)
+ * @param other         buffer for other.xml chunk or NULL
+ *                      (the other of the result is NULL then)
+ * @param err           GError **
+ * @return              cr_XmlStruct, all its members are NULL on error
  */
-void cr_xml_dump_files(xmlNodePtr node, cr_Package *package, int primary);
+struct cr_XmlStruct cr_xml_dump_to_buffers(cr_Package *pkg,
+                                           GString *primary,
+                                           GString *filelists,
+                                           GString *other,
+                                           GError **err);
 
 /** Createrepo_c wrapper over libxml xmlNewTextChild.
  * It allows content to be NULL and non UTF-8 (if content is no UTF8
@@ -21,9 +21,6 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
-#include <libxml/encoding.h>
-#include <libxml/xmlwriter.h>
-#include <libxml/xmlsave.h>
 #include "error.h"
 #include "package.h"
 #include "xml_dump.h"
@@ -32,8 +29,8 @@
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 
 
-void
-cr_xml_dump_other_changelog(xmlNodePtr root, cr_Package *package)
+static void
+cr_xml_dump_other_changelog(GString *buf, cr_Package *package)
 {
     if (!package->changelogs) {
         return;
@@ -51,72 +48,72 @@ cr_xml_dump_other_changelog(xmlNodePtr root, cr_Package *package)
         // Element: Changelog
         // ***********************************
 
-        xmlNodePtr changelog;
-
-        // Add changelog element
-        changelog = cr_xmlNewTextChild(root,
-                                       NULL,
-                                       BAD_CAST "changelog",
-                                       BAD_CAST entry->changelog);
+        cr_xml_dump_start(buf, 1, "changelog");
 
         // Write param author
-        cr_xmlNewProp(changelog, BAD_CAST "author", BAD_CAST entry->author);
+        cr_xml_dump_attr(buf, "author", entry->author);
 
         // Write param date
-        char date_str[DATE_STR_MAX_LEN];
-        g_snprintf(date_str, DATE_STR_MAX_LEN, "%"G_GINT64_FORMAT, entry->date);
-        xmlNewProp(changelog, BAD_CAST "date", BAD_CAST date_str);
+        cr_xml_dump_attr_int(buf, "date", entry->date);
+
+        g_string_append_c(buf, '>');
+        cr_xml_dump_text(buf, entry->changelog);
+        cr_xml_dump_end(buf, 0, "changelog");
     }
 }
 
 
 void
-cr_xml_dump_other_items(xmlNodePtr root, cr_Package *package)
+cr_xml_dump_other_items(GString *buf, cr_Package *package)
 {
     /***********************************
      Element: package
     ************************************/
 
+    cr_xml_dump_start(buf, 0, "package");
+
     // Add pkgid attribute
-    cr_xmlNewProp(root, BAD_CAST "pkgid", BAD_CAST package->pkgId);
+    cr_xml_dump_attr(buf, "pkgid", package->pkgId);
 
     // Add name attribute
-    cr_xmlNewProp(root, BAD_CAST "name", BAD_CAST package->name);
+    cr_xml_dump_attr(buf, "name", package->name);
 
     // Add arch attribute
-    cr_xmlNewProp(root, BAD_CAST "arch", BAD_CAST package->arch);
+    cr_xml_dump_attr(buf, "arch", package->arch);
+
+    g_string_append_len(buf, ">\n", 2);
 
 
     /***********************************
      Element: version
     ************************************/
 
-    xmlNodePtr version;
-
-    // Add version element
-    version = xmlNewChild(root, NULL, BAD_CAST "version", NULL);
+    cr_xml_dump_start(buf, 1, "version");
 
     // Write version attribute epoch
-    xmlNewProp(version, BAD_CAST "epoch", BAD_CAST package->epoch);
+    cr_xml_dump_attr_raw(buf, "epoch", package->epoch);
 
     // Write version attribute ver
-    xmlNewProp(version, BAD_CAST "ver", BAD_CAST package->version);
+    cr_xml_dump_attr_raw(buf, "ver", package->version);
 
     // Write version attribute rel
-    xmlNewProp(version, BAD_CAST "rel", BAD_CAST package->release);
+    cr_xml_dump_attr_raw(buf, "rel", package->release);
+
+    g_string_append_len(buf, "/>\n", 3);
 
 
     // Changelog dump
 
-    cr_xml_dump_other_changelog(root, package);
+    cr_xml_dump_other_changelog(buf, package);
+
+    cr_xml_dump_end(buf, 0, "package");
 }
 
 
 char *
 cr_xml_dump_other(cr_Package *package, GError **err)
 {
-    xmlNodePtr root;
-    char *result;
+    GString *buf;
 
     assert(!err || *err == NULL);
 
@@ -129,28 +126,7 @@ cr_xml_dump_other(cr_Package *package, GError **err)
 
     // Dump IT!
 
-    xmlBufferPtr buf = xmlBufferCreate();
-    if (buf == NULL) {
-        g_critical("%s: Error creating the xml buffer", __func__);
-        g_set_error(err, ERR_DOMAIN, CRE_MEMORY,
-                    "Cannot create an xml buffer");
-        return NULL;
-    }
-
-    root = xmlNewNode(NULL, BAD_CAST "package");
-    cr_xml_dump_other_items(root, package);
-    // xmlNodeDump seems to be a little bit faster than xmlDocDumpFormatMemory
-    xmlNodeDump(buf, NULL, root, FORMAT_LEVEL, FORMAT_XML);
-    assert(buf->content);
-    result = g_strndup((char *) buf->content, (buf->use+1));
-    result[buf->use]     = '\n';
-    result[buf->use+1]   = '\0';
-
-
-    // Cleanup
-
-    xmlBufferFree(buf);
-    xmlFreeNode(root);
-
-    return result;
+    buf = cr_xml_dump_buffer();
+    cr_xml_dump_other_items(buf, package);
+    return cr_xml_dump_buffer_finish(buf);
 }
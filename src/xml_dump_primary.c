@@ -21,8 +21,6 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
-#include <libxml/encoding.h>
-#include <libxml/xmlwriter.h>
 #include "error.h"
 #include "package.h"
 #include "xml_dump.h"
@@ -60,11 +58,21 @@ static PcoInfo pco_info[] = {
     { NULL,                 0 },
 };
 
-void
-cr_xml_dump_primary_dump_pco(xmlNodePtr root, cr_Package *package, PcoType pcotype)
+// Pre-escaped flags attributes of the known flags
+static const char dep_flag_attrs[CR_DEP_FLAG_UNKNOWN][12] = {
+    [CR_DEP_FLAG_LT] = " flags=\"LT\"",
+    [CR_DEP_FLAG_GT] = " flags=\"GT\"",
+    [CR_DEP_FLAG_EQ] = " flags=\"EQ\"",
+    [CR_DEP_FLAG_LE] = " flags=\"LE\"",
+    [CR_DEP_FLAG_GE] = " flags=\"GE\"",
+};
+
+static void
+cr_xml_dump_primary_dump_pco(GString *buf, cr_Package *package, PcoType pcotype)
 {
     const char *elem_name;
     GSList *list = NULL;
+    gboolean empty = TRUE;
 
     if (pcotype >= PCO_TYPE_SENTINEL)
         return;
@@ -80,9 +88,7 @@ cr_xml_dump_primary_dump_pco(xmlNodePtr root, cr_Package *package, PcoType pcoty
      PCOR Element: provides, oboletes, conflicts, requires
     ************************************/
 
-    xmlNodePtr pcor_node;
-
-    pcor_node = xmlNewChild(root, NULL, BAD_CAST elem_name, NULL);
+    cr_xml_dump_start(buf, 2, elem_name);
 
     GSList *element = NULL;
     for(element = list; element; element=element->next) {
@@ -95,284 +101,281 @@ cr_xml_dump_primary_dump_pco(xmlNodePtr root, cr_Package *package, PcoType pcoty
             continue;
         }
 
+        if (empty) {
+            g_string_append_len(buf, ">\n", 2);
+            empty = FALSE;
+        }
+
 
         /***********************************
          Element: entry
         ************************************/
 
-        xmlNodePtr entry_node;
+        cr_xml_dump_start(buf, 3, "rpm:entry");
+        cr_xml_dump_attr(buf, "name", entry->name);
 
-        entry_node = xmlNewChild(pcor_node, NULL, BAD_CAST "rpm:entry", NULL);
-        cr_xmlNewProp(entry_node, BAD_CAST "name", BAD_CAST entry->name);
+        cr_DependencyFlag flag = cr_dependency_flag(entry);
+        if (flag == CR_DEP_FLAG_UNKNOWN && entry->flags[0] == '\0')
+            flag = CR_DEP_FLAG_NONE;
 
-        if (entry->flags && entry->flags[0] != '\0') {
-            cr_xmlNewProp(entry_node, BAD_CAST "flags", BAD_CAST entry->flags);
+        if (flag != CR_DEP_FLAG_NONE) {
+            if (flag == CR_DEP_FLAG_UNKNOWN)
+                cr_xml_dump_attr(buf, "flags", entry->flags);
+            else
+                g_string_append_len(buf, dep_flag_attrs[flag],
+                                    sizeof(dep_flag_attrs[0]) - 1);
 
             if (entry->epoch && entry->epoch[0] != '\0') {
-                cr_xmlNewProp(entry_node, BAD_CAST "epoch", BAD_CAST entry->epoch);
+                cr_xml_dump_attr(buf, "epoch", entry->epoch);
             }
 
             if (entry->version && entry->version[0] != '\0') {
-                cr_xmlNewProp(entry_node, BAD_CAST "ver", BAD_CAST entry->version);
+                cr_xml_dump_attr(buf, "ver", entry->version);
             }
 
             if (entry->release && entry->release[0] != '\0') {
-                cr_xmlNewProp(entry_node, BAD_CAST "rel", BAD_CAST entry->release);
+                cr_xml_dump_attr(buf, "rel", entry->release);
             }
         }
 
         if (pcotype == PCO_TYPE_REQUIRES && entry->pre) {
             // Add pre attribute
-            xmlNewProp(entry_node, BAD_CAST "pre", BAD_CAST "1");
+            g_string_append_len(buf, " pre=\"1\"", 8);
         }
+
+        g_string_append_len(buf, "/>\n", 3);
     }
+
+    if (empty)
+        // All entries were skipped
+        g_string_append_len(buf, "/>\n", 3);
+    else
+        cr_xml_dump_end(buf, 2, elem_name);
 }
 
 
+static void
+cr_xml_dump_primary_location(GString *buf, int level, cr_Package *package)
+{
+    cr_xml_dump_start(buf, level, "location");
+
+    // Write location attribute base
+    if (package->location_base && package->location_base[0] != '\0') {
+        gchar *location_base_with_protocol = NULL;
+        location_base_with_protocol = cr_prepend_protocol(package->location_base);
+        cr_xml_dump_attr(buf, "xml:base", location_base_with_protocol);
+        g_free(location_base_with_protocol);
+    }
+
+    // Write location attribute href
+    cr_xml_dump_attr(buf, "href", package->location_href);
+
+    g_string_append_len(buf, "/>", 2);
+}
 
 void
-cr_xml_dump_primary_base_items(xmlNodePtr root, cr_Package *package)
+cr_xml_dump_primary_base_items(GString *buf, cr_Package *package)
 {
     /***********************************
      Element: package
     ************************************/
 
     // Add an attribute with type to package
-    xmlNewProp(root, BAD_CAST "type", BAD_CAST "rpm");
+    cr_xml_dump_start(buf, 0, "package");
+    cr_xml_dump_attr_raw(buf, "type", "rpm");
+    g_string_append_len(buf, ">\n", 2);
 
 
     /***********************************
      Element: name
     ************************************/
 
-    cr_xmlNewTextChild(root, NULL,  BAD_CAST "name", BAD_CAST package->name);
+    cr_xml_dump_text_element(buf, 1, "name", package->name);
 
 
     /***********************************
      Element: arch
     ************************************/
 
-    cr_xmlNewTextChild(root, NULL,  BAD_CAST "arch", BAD_CAST package->arch);
+    cr_xml_dump_text_element(buf, 1, "arch", package->arch);
 
 
     /***********************************
      Element: version
     ************************************/
 
-    xmlNodePtr version;
-
-    // Add version element
-    version = xmlNewChild(root, NULL, BAD_CAST "version", NULL);
+    cr_xml_dump_start(buf, 1, "version");
 
     // Write version attribute epoch
-    cr_xmlNewProp(version, BAD_CAST "epoch", BAD_CAST package->epoch);
+    cr_xml_dump_attr(buf, "epoch", package->epoch);
 
     // Write version attribute ver
-    cr_xmlNewProp(version, BAD_CAST "ver", BAD_CAST package->version);
+    cr_xml_dump_attr(buf, "ver", package->version);
 
     // Write version attribute rel
-    cr_xmlNewProp(version, BAD_CAST "rel", BAD_CAST package->release);
+    cr_xml_dump_attr(buf, "rel", package->release);
+
+    g_string_append_len(buf, "/>\n", 3);
 
 
     /***********************************
      Element: checksum
     ************************************/
 
-    xmlNodePtr checksum;
-
-    checksum = cr_xmlNewTextChild(root,
-                                  NULL,
-                                  BAD_CAST "checksum",
-                                  BAD_CAST package->pkgId);
+    cr_xml_dump_start(buf, 1, "checksum");
 
     // Write checksum attribute checksum_type
-    cr_xmlNewProp(checksum, BAD_CAST "type", BAD_CAST package->checksum_type);
+    cr_xml_dump_attr(buf, "type", package->checksum_type);
 
     // Write checksum attribute pkgid
-    xmlNewProp(checksum, BAD_CAST "pkgid", BAD_CAST "YES");
+    cr_xml_dump_attr_raw(buf, "pkgid", "YES");
+
+    g_string_append_c(buf, '>');
+    cr_xml_dump_text(buf, package->pkgId);
+    cr_xml_dump_end(buf, 0, "checksum");
 
 
     /***********************************
      Element: summary
     ************************************/
 
-    cr_xmlNewTextChild(root, NULL,  BAD_CAST "summary",
-                       BAD_CAST package->summary);
+    cr_xml_dump_text_element(buf, 1, "summary", package->summary);
 
 
     /***********************************
     Element: description
     ************************************/
 
-    cr_xmlNewTextChild(root, NULL,  BAD_CAST "description",
-                       BAD_CAST package->description);
+    cr_xml_dump_text_element(buf, 1, "description", package->description);
 
 
     /***********************************
      Element: packager
     ************************************/
 
-    cr_xmlNewTextChild(root, NULL,  BAD_CAST "packager",
-                       BAD_CAST package->rpm_packager);
+    cr_xml_dump_text_element(buf, 1, "packager", package->rpm_packager);
 
 
     /***********************************
      Element: url
     ************************************/
 
-    cr_xmlNewTextChild(root, NULL,  BAD_CAST "url", BAD_CAST package->url);
+    cr_xml_dump_text_element(buf, 1, "url", package->url);
 
 
     /***********************************
      Element: time
     ************************************/
 
-    xmlNodePtr time;
-    char date_str[DATE_STR_MAX_LEN];
-
-    time = xmlNewChild(root, NULL, BAD_CAST "time", NULL);
+    cr_xml_dump_start(buf, 1, "time");
 
     // Write time attribute file
-    g_snprintf(date_str, DATE_STR_MAX_LEN, "%"G_GINT64_FORMAT,
-               package->time_file);
-    xmlNewProp(time, BAD_CAST "file", BAD_CAST date_str);
+    cr_xml_dump_attr_int(buf, "file", package->time_file);
 
     // Write time attribute build
-    g_snprintf(date_str, DATE_STR_MAX_LEN, "%"G_GINT64_FORMAT,
-               package->time_build);
-    xmlNewProp(time, BAD_CAST "build", BAD_CAST date_str);
+    cr_xml_dump_attr_int(buf, "build", package->time_build);
+
+    g_string_append_len(buf, "/>\n", 3);
 
 
     /***********************************
      Element: size
     ************************************/
 
-    xmlNodePtr size;
-    char size_str[SIZE_STR_MAX_LEN];
-
-    size = xmlNewChild(root, NULL, BAD_CAST "size", NULL);
+    cr_xml_dump_start(buf, 1, "size");
 
     // Write size attribute package
-    g_snprintf(size_str, SIZE_STR_MAX_LEN, "%"G_GINT64_FORMAT,
-               package->size_package);
-    xmlNewProp(size, BAD_CAST "package", BAD_CAST size_str);
+    cr_xml_dump_attr_int(buf, "package", package->size_package);
 
     // Write size attribute installed
-    g_snprintf(size_str, SIZE_STR_MAX_LEN, "%"G_GINT64_FORMAT,
-               package->size_installed);
-    xmlNewProp(size, BAD_CAST "installed", BAD_CAST size_str);
+    cr_xml_dump_attr_int(buf, "installed", package->size_installed);
 
     // Write size attribute archive
-    g_snprintf(size_str, SIZE_STR_MAX_LEN, "%"G_GINT64_FORMAT,
-               package->size_archive);
-    xmlNewProp(size, BAD_CAST "archive", BAD_CAST size_str);
+    cr_xml_dump_attr_int(buf, "archive", package->size_archive);
+
+    g_string_append_len(buf, "/>\n", 3);
 
 
     /***********************************
      Element: location
     ************************************/
 
-    xmlNodePtr location;
-
-    location = xmlNewChild(root, NULL, BAD_CAST "location", NULL);
-
-    // Write location attribute base
-    if (package->location_base && package->location_base[0] != '\0') {
-        gchar *location_base_with_protocol = NULL;
-        location_base_with_protocol = cr_prepend_protocol(package->location_base);
-        cr_xmlNewProp(location,
-                      BAD_CAST "xml:base",
-                      BAD_CAST location_base_with_protocol);
-        g_free(location_base_with_protocol);
-    }
-
-    // Write location attribute href
-    cr_xmlNewProp(location, BAD_CAST "href", BAD_CAST package->location_href);
+    cr_xml_dump_primary_location(buf, 1, package);
+    g_string_append_c(buf, '\n');
 
 
     /***********************************
      Element: format
     ************************************/
 
-    xmlNodePtr format;
-
-    format = xmlNewChild(root, NULL, BAD_CAST "format", NULL);
+    cr_xml_dump_start(buf, 1, "format");
+    g_string_append_len(buf, ">\n", 2);
 
 
     /***********************************
      Element: license
     ************************************/
 
-    cr_xmlNewTextChild(format, NULL,  BAD_CAST "rpm:license",
-                       BAD_CAST package->rpm_license);
+    cr_xml_dump_text_element(buf, 2, "rpm:license", package->rpm_license);
 
 
     /***********************************
      Element: vendor
     ************************************/
 
-    cr_xmlNewTextChild(format, NULL,  BAD_CAST "rpm:vendor",
-                       BAD_CAST package->rpm_vendor);
+    cr_xml_dump_text_element(buf, 2, "rpm:vendor", package->rpm_vendor);
 
 
     /***********************************
      Element: group
     ************************************/
 
-    cr_xmlNewTextChild(format, NULL,  BAD_CAST "rpm:group",
-                       BAD_CAST package->rpm_group);
+    cr_xml_dump_text_element(buf, 2, "rpm:group", package->rpm_group);
 
 
     /***********************************
      Element: buildhost
     ************************************/
 
-    cr_xmlNewTextChild(format, NULL,  BAD_CAST "rpm:buildhost",
-                       BAD_CAST package->rpm_buildhost);
+    cr_xml_dump_text_element(buf, 2, "rpm:buildhost", package->rpm_buildhost);
 
 
     /***********************************
      Element: sourcerpm
     ************************************/
 
-    cr_xmlNewTextChild(format, NULL,  BAD_CAST "rpm:sourcerpm",
-                       BAD_CAST package->rpm_sourcerpm);
+    cr_xml_dump_text_element(buf, 2, "rpm:sourcerpm", package->rpm_sourcerpm);
 
 
     /***********************************
      Element: header-range
     ************************************/
 
-    xmlNodePtr header_range;
-
-    header_range = xmlNewChild(format, NULL, BAD_CAST "rpm:header-range", NULL);
+    cr_xml_dump_start(buf, 2, "rpm:header-range");
 
     // Write header-range attribute hdrstart
-    g_snprintf(size_str,
-               SIZE_STR_MAX_LEN,
-               "%"G_GINT64_FORMAT,
-               package->rpm_header_start);
-    xmlNewProp(header_range, BAD_CAST "start", BAD_CAST size_str);
+    cr_xml_dump_attr_int(buf, "start", package->rpm_header_start);
 
     // Write header-range attribute hdrend
-    g_snprintf(size_str,
-               SIZE_STR_MAX_LEN,
-               "%"G_GINT64_FORMAT,
-               package->rpm_header_end);
-    xmlNewProp(header_range, BAD_CAST "end", BAD_CAST size_str);
+    cr_xml_dump_attr_int(buf, "end", package->rpm_header_end);
+
+    g_string_append_len(buf, "/>\n", 3);
 
 
     // Files dump
 
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_PROVIDES);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_REQUIRES);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_CONFLICTS);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_OBSOLETES);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_SUGGESTS);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_ENHANCES);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_RECOMMENDS);
-    cr_xml_dump_primary_dump_pco(format,   package, PCO_TYPE_SUPPLEMENTS);
-    cr_xml_dump_files(format, package, 1);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_PROVIDES);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_REQUIRES);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_CONFLICTS);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_OBSOLETES);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_SUGGESTS);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_ENHANCES);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_RECOMMENDS);
+    cr_xml_dump_primary_dump_pco(buf, package, PCO_TYPE_SUPPLEMENTS);
+    cr_xml_dump_files(buf, package, 1, 2);
+
+    cr_xml_dump_end(buf, 1, "format");
+    cr_xml_dump_end(buf, 0, "package");
 }
 
 
@@ -380,8 +383,7 @@ cr_xml_dump_primary_base_items(xmlNodePtr root, cr_Package *package)
 char *
 cr_xml_dump_primary(cr_Package *package, GError **err)
 {
-    xmlNodePtr root;
-    char *result;
+    GString *buf;
 
     assert(!err || *err == NULL);
 
@@ -393,29 +395,42 @@ cr_xml_dump_primary(cr_Package *package, GError **err)
 
     // Dump IT!
 
-    xmlBufferPtr buf = xmlBufferCreate();
-    if (buf == NULL) {
-        g_critical("%s: Error creating the xml buffer", __func__);
-        g_set_error(err, ERR_DOMAIN, CRE_MEMORY,
-                    "Cannot create an xml buffer");
-        return NULL;
-    }
+    buf = cr_xml_dump_buffer();
+    cr_xml_dump_primary_base_items(buf, package);
+    return cr_xml_dump_buffer_finish(buf);
+}
 
-    root = xmlNewNode(NULL, BAD_CAST "package");
-    cr_xml_dump_primary_base_items(root, package);
-    // xmlNodeDump seems to be a little bit faster than xmlDocDumpFormatMemory
-    xmlNodeDump(buf, NULL, root, FORMAT_LEVEL, FORMAT_XML);
-    assert(buf->content);
-    result = g_strndup((char *) buf->content, (buf->use+1));
-    result[buf->use]     = '\n';
-    result[buf->use+1]   = '\0';
+char *
+cr_xml_dump_primary_from_raw(cr_Package *package, GError **err)
+{
+    const char *loc_start, *loc_end;
+    GString *buf;
 
+    assert(!err || *err == NULL);
 
-    // Cleanup
+    if (!package || !package->raw_primary) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "No raw primary xml of the package available");
+        return NULL;
+    }
 
-    xmlBufferFree(buf);
-    xmlFreeNode(root);
+    // Attribute values cannot contain '<' and the location element is
+    // always empty ("<location ... />")
+    loc_start = strstr(package->raw_primary, "<location ");
+    loc_end = loc_start ? strchr(loc_start, '>') : NULL;
+    if (!loc_end || *(loc_end - 1) != '/') {
+        g_set_error(err, ERR_DOMAIN, CRE_XMLDATA,
+                    "No location element found in the raw primary xml");
+        return NULL;
+    }
+    loc_end++;
 
-    return result;
+    buf = cr_xml_dump_buffer();
+    g_string_append_len(buf, package->raw_primary,
+                        loc_start - package->raw_primary);
+    cr_xml_dump_primary_location(buf, 0, package);
+    g_string_append(buf, loc_end);
+    g_string_append_c(buf, '\n');
 
+    return cr_xml_dump_buffer_finish(buf);
 }
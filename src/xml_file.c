@@ -22,6 +22,8 @@
 #include <assert.h>
 #include "xml_file.h"
 #include <errno.h>
+#include <string.h>
+#include "blockindex.h"
 #include "error.h"
 #include "xml_dump.h"
 #include "compression_wrapper.h"
@@ -92,13 +94,61 @@ cr_xmlfile_sopen(const char *filename,
     return f;
 }
 
+gboolean
+cr_xmlfile_deferred_supported(cr_CompressionType comtype)
+{
+    return comtype == CR_CW_NO_COMPRESSION
+           || comtype == CR_CW_GZ_COMPRESSION
+           || comtype == CR_CW_ZSTD_COMPRESSION;
+}
+
+cr_XmlFile *
+cr_xmlfile_sopen_deferred(const char *filename,
+                          cr_XmlFileType type,
+                          cr_CompressionType comtype,
+                          cr_ContentStat *stat,
+                          GError **err)
+{
+    cr_XmlFile *f;
+
+    assert(filename);
+    assert(!err || *err == NULL);
+
+    if (type != CR_XMLFILE_PRIMARY
+        && type != CR_XMLFILE_FILELISTS
+        && type != CR_XMLFILE_OTHER)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "The XML file has no number of packages");
+        return NULL;
+    }
+
+    if (!cr_xmlfile_deferred_supported(comtype)) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Unsupported compression for a deferred header: %s",
+                    cr_compression_suffix(comtype));
+        return NULL;
+    }
+
+    f = cr_xmlfile_sopen(filename, type, comtype, stat, err);
+    if (!f)
+        return NULL;
+
+    f->deferred = TRUE;
+    f->filename = g_strdup(filename);
+    f->comtype  = comtype;
+    f->stat     = stat;
+
+    return f;
+}
+
 int
 cr_xmlfile_set_num_of_pkgs(cr_XmlFile *f, long num, GError **err)
 {
     assert(f);
     assert(!err || *err == NULL);
 
-    if (f->header != 0) {
+    if (f->header != 0 && !f->deferred) {
         g_set_error(err, ERR_DOMAIN, CRE_BADARG,
                     "Header was already written");
         return CRE_BADARG;
@@ -114,6 +164,77 @@ cr_xmlfile_set_num_of_pkgs(cr_XmlFile *f, long num, GError **err)
     return CRE_OK;
 }
 
+int
+cr_xmlfile_set_blockindex(cr_XmlFile *f,
+                          cr_BlockIndex *index,
+                          gsize block_size,
+                          GError **err)
+{
+    assert(f);
+    assert(index);
+    assert(!err || *err == NULL);
+
+    if (f->type != CR_XMLFILE_PRIMARY
+        && f->type != CR_XMLFILE_FILELISTS
+        && f->type != CR_XMLFILE_OTHER)
+    {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "The XML file has no packages");
+        return CRE_BADARG;
+    }
+
+    if (!cr_xmlfile_deferred_supported(f->f->type)) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Unsupported compression for a block index: %s",
+                    cr_compression_suffix(f->f->type));
+        return CRE_BADARG;
+    }
+
+    if (f->header != 0) {
+        g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                    "Header was already written");
+        return CRE_BADARG;
+    }
+
+    f->blockindex = index;
+    f->block_size = block_size;
+    return CRE_OK;
+}
+
+/** End the current block of the packages and add it to the index.
+ */
+static int
+xmlfile_end_block(cr_XmlFile *f, GError **err)
+{
+    GError *tmp_err = NULL;
+    cr_BlockIndexEntry entry;
+    gint64 offset;
+
+    if (f->block_pkgs == 0)
+        return CRE_OK;
+
+    if (cr_end_member(f->f, &tmp_err) == CR_CW_ERR
+        || (offset = cr_member_offset(f->f, &tmp_err)) < 0)
+    {
+        int code = tmp_err->code;
+        g_propagate_prefixed_error(err, tmp_err, "Cannot end a block: ");
+        return code;
+    }
+
+    entry.first_pkg             = f->chunks - f->block_pkgs;
+    entry.pkgs                  = f->block_pkgs;
+    entry.offset                = f->block_offset;
+    entry.size                  = offset - f->block_offset;
+    entry.uncompressed_offset   = f->block_uoffset;
+    entry.uncompressed_size     = f->written - f->block_uoffset;
+    cr_blockindex_add(f->blockindex, f->type, &entry);
+
+    f->block_pkgs    = 0;
+    f->block_offset  = offset;
+    f->block_uoffset = f->written;
+    return CRE_OK;
+}
+
 int
 cr_xmlfile_write_xml_header(cr_XmlFile *f, GError **err)
 {
@@ -147,13 +268,43 @@ cr_xmlfile_write_xml_header(cr_XmlFile *f, GError **err)
         return CRE_ASSERT;
     }
 
-    if (cr_printf(&tmp_err, f->f, xml_header, f->pkgs) == CR_CW_ERR) {
+    int len = cr_printf(&tmp_err, f->f, xml_header, f->pkgs);
+    if (len == CR_CW_ERR) {
         int code = tmp_err->code;
         g_propagate_prefixed_error(err, tmp_err, "Cannot write XML header: ");
         return code;
     }
+    f->written += len;
 
     f->header = 1;
+    f->header_pkgs = f->pkgs;
+
+    // A header with a package count is compressed on its own, so the count
+    // can be corrected without recompression of the whole file
+    // (see cr_rewrite_header_package_count())
+    if (f->type == CR_XMLFILE_PRIMARY
+        || f->type == CR_XMLFILE_FILELISTS
+        || f->type == CR_XMLFILE_OTHER)
+    {
+        if (cr_end_member(f->f, &tmp_err) == CR_CW_ERR) {
+            int code = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot end XML header: ");
+            return code;
+        }
+
+        // The first block starts right after the header
+        if (f->blockindex) {
+            f->block_offset = cr_member_offset(f->f, &tmp_err);
+            if (f->block_offset < 0) {
+                int code = tmp_err->code;
+                g_propagate_prefixed_error(err, tmp_err,
+                                           "Cannot end XML header: ");
+                return code;
+            }
+            f->block_uoffset = f->written;
+        }
+    }
 
     return cr_end_chunk(f->f, err);
 }
@@ -253,6 +404,44 @@ cr_xmlfile_add_pkg(cr_XmlFile *f, cr_Package *pkg, GError **err)
     return CRE_OK;
 }
 
+int
+cr_xmlfile_add_updaterecord(cr_XmlFile *f, cr_UpdateRecord *rec, GError **err)
+{
+    char *xml;
+    GError *tmp_err = NULL;
+
+    assert(f);
+    assert(rec);
+    assert(!err || *err == NULL);
+    assert(f->footer == 0);
+
+    if (f->type != CR_XMLFILE_UPDATEINFO) {
+        g_critical("%s: Bad file type", __func__);
+        assert(0);
+        g_set_error(err, ERR_DOMAIN, CRE_ASSERT, "Bad file type");
+        return CRE_ASSERT;
+    }
+
+    xml = cr_xml_dump_updaterecord(rec, &tmp_err);
+    if (tmp_err) {
+        int code = tmp_err->code;
+        g_propagate_error(err, tmp_err);
+        g_free(xml);
+        return code;
+    }
+
+    cr_xmlfile_add_chunk(f, xml, &tmp_err);
+    g_free(xml);
+
+    if (tmp_err) {
+        int code = tmp_err->code;
+        g_propagate_error(err, tmp_err);
+        return code;
+    }
+
+    return CRE_OK;
+}
+
 int
 cr_xmlfile_add_chunk(cr_XmlFile *f, const char* chunk, GError **err)
 {
@@ -274,12 +463,20 @@ cr_xmlfile_add_chunk(cr_XmlFile *f, const char* chunk, GError **err)
         }
     }
 
-    cr_puts(f->f, chunk, &tmp_err);
+    int len = cr_puts(f->f, chunk, &tmp_err);
     if (tmp_err) {
         int code = tmp_err->code;
         g_propagate_prefixed_error(err, tmp_err, "Error while write: ");
         return code;
     }
+    f->written += len;
+    f->chunks++;
+
+    if (f->blockindex) {
+        f->block_pkgs++;
+        if (f->written - f->block_uoffset >= f->block_size)
+            return xmlfile_end_block(f, err);
+    }
 
     return CRE_OK;
 }
@@ -303,6 +500,16 @@ cr_xmlfile_close(cr_XmlFile *f, GError **err)
         }
     }
 
+    // The footer is not a part of the last block
+    if (f->blockindex && f->footer == 0) {
+        xmlfile_end_block(f, &tmp_err);
+        if (tmp_err) {
+            int code = tmp_err->code;
+            g_propagate_error(err, tmp_err);
+            return code;
+        }
+    }
+
     if (f->footer == 0) {
         cr_xmlfile_write_xml_footer(f, &tmp_err);
         if (tmp_err) {
@@ -317,9 +524,53 @@ cr_xmlfile_close(cr_XmlFile *f, GError **err)
         int code = tmp_err->code;
         g_propagate_prefixed_error(err, tmp_err,
                 "Error while closing a file: ");
+        g_free(f->filename);
         return code;
     }
 
+    if (f->deferred && f->pkgs != f->header_pkgs) {
+        GStatBuf st;
+        gint64 old_size = -1;
+
+        if (f->blockindex && g_stat(f->filename, &st) == 0)
+            old_size = st.st_size;
+
+        cr_rewrite_header_package_count(f->filename, f->comtype, f->pkgs,
+                                        f->header_pkgs, f->stat, NULL,
+                                        &tmp_err);
+        if (tmp_err) {
+            int code = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err,
+                    "Cannot correct the number of packages: ");
+            g_free(f->filename);
+            return code;
+        }
+
+        // Only the header was replaced, the blocks moved by the difference
+        // of the sizes
+        if (f->blockindex) {
+            gchar *old_count = g_strdup_printf("%ld", f->header_pkgs);
+            gchar *new_count = g_strdup_printf("%ld", f->pkgs);
+
+            if (old_size < 0 || g_stat(f->filename, &st) != 0) {
+                g_set_error(err, ERR_DOMAIN, CRE_IO,
+                            "Cannot stat %s: %s", f->filename,
+                            g_strerror(errno));
+                g_free(old_count);
+                g_free(new_count);
+                g_free(f->filename);
+                return CRE_IO;
+            }
+            cr_blockindex_shift(f->blockindex, f->type,
+                                (gint64) st.st_size - old_size,
+                                (gint64) strlen(new_count)
+                                - (gint64) strlen(old_count));
+            g_free(old_count);
+            g_free(new_count);
+        }
+    }
+
+    g_free(f->filename);
     g_free(f);
 
     return CRE_OK;
@@ -364,6 +615,145 @@ write_modified_header(int task_count,
     return bytes_written;
 }
 
+/** Replace the first gzip member or zstd frame of the file, if it contains
+ * just the header, and copy the rest of the compressed file as it is.
+ * Uncompressed files are handled the same way, with their beginning.
+ * @return      TRUE if the tmp_xml_filename was written, FALSE if the file
+ *              has to be recompressed or on error
+ */
+static gboolean
+rewrite_header_member(gchar *original_filename,
+                      gchar *tmp_xml_filename,
+                      cr_CompressionType xml_compression,
+                      int package_count,
+                      int task_count,
+                      cr_ContentStat *file_stat,
+                      GError **err)
+{
+    GError *tmp_err = NULL;
+    gchar *header_buf;
+    gsize header_len;
+    gint64 member_len;
+    cr_XmlFile *new_file;
+    FILE *in, *out;
+    gsize buffer_size = cr_get_io_buffer_size();
+    gchar *copy_buf;
+    size_t len_read;
+    CR_FILE *f;
+
+    if (xml_compression == CR_CW_NO_COMPRESSION) {
+        header_buf = g_malloc(XML_MAX_HEADER_SIZE);
+        in = fopen(original_filename, "rb");
+        if (!in) {
+            g_set_error(err, CREATEREPO_C_ERROR, CRE_IO,
+                        "Cannot open %s: %s", original_filename,
+                        g_strerror(errno));
+            g_free(header_buf);
+            return FALSE;
+        }
+        header_len = fread(header_buf, 1, XML_MAX_HEADER_SIZE, in);
+        fclose(in);
+        member_len = header_len;
+    } else {
+        member_len = cr_read_first_member(original_filename, xml_compression,
+                                          XML_MAX_HEADER_SIZE, &header_buf,
+                                          &header_len, &tmp_err);
+    }
+    if (member_len <= 0) {
+        if (xml_compression == CR_CW_NO_COMPRESSION)
+            g_free(header_buf);
+        if (tmp_err)
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot read the header:");
+        return FALSE;
+    }
+
+    // The member is compressed and written as a new file
+    new_file = cr_xmlfile_sopen_primary(tmp_xml_filename, xml_compression,
+                                        NULL, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "Error encountered while opening for writing:");
+        g_free(header_buf);
+        return FALSE;
+    }
+    if (!write_modified_header(task_count, package_count, new_file,
+                               header_buf, header_len, &tmp_err)) {
+        // No package count in the member - keep the old way
+        g_free(header_buf);
+        new_file->header = 1;
+        new_file->footer = 1;
+        cr_xmlfile_close(new_file, NULL);
+        g_remove(tmp_xml_filename);
+        if (tmp_err)
+            g_propagate_error(err, tmp_err);
+        return FALSE;
+    }
+    g_free(header_buf);
+    new_file->header = 1;
+    new_file->footer = 1;
+    cr_xmlfile_close(new_file, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "Error encountered while writing:");
+        return FALSE;
+    }
+
+    // The rest of the compressed file
+    in = fopen(original_filename, "rb");
+    out = fopen(tmp_xml_filename, "ab");
+    if (!in || !out || fseeko(in, member_len, SEEK_SET) != 0) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_IO,
+                    "Cannot copy %s: %s", original_filename, g_strerror(errno));
+        if (in)
+            fclose(in);
+        if (out)
+            fclose(out);
+        return FALSE;
+    }
+    copy_buf = g_malloc(buffer_size);
+    while ((len_read = fread(copy_buf, 1, buffer_size, in)) > 0)
+        if (fwrite(copy_buf, 1, len_read, out) != len_read)
+            break;
+    g_free(copy_buf);
+    if (ferror(in) || ferror(out)) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_IO,
+                    "Cannot copy %s: %s", original_filename, g_strerror(errno));
+        fclose(in);
+        fclose(out);
+        return FALSE;
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+        g_set_error(err, CREATEREPO_C_ERROR, CRE_IO,
+                    "Cannot copy %s: %s", original_filename, g_strerror(errno));
+        return FALSE;
+    }
+
+    // Stats of the open content, decompression is much cheaper
+    // than the compression
+    if (file_stat)
+        file_stat->size = 0;
+    f = cr_sopen(tmp_xml_filename, CR_CW_MODE_READ, xml_compression,
+                 file_stat, &tmp_err);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "Error encountered while reopening for reading:");
+        return FALSE;
+    }
+    copy_buf = g_malloc(buffer_size);
+    while (cr_read(f, copy_buf, buffer_size, &tmp_err) > 0)
+        ;
+    g_free(copy_buf);
+    if (!tmp_err)
+        cr_close(f, &tmp_err);
+    else
+        cr_close(f, NULL);
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "Error encountered while reading:");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 void
 cr_rewrite_header_package_count(gchar *original_filename,
                                 cr_CompressionType xml_compression,
@@ -374,13 +764,32 @@ cr_rewrite_header_package_count(gchar *original_filename,
                                 GError **err)
 {
     GError *tmp_err = NULL;
+    gchar *tmp_xml_filename = g_strconcat(original_filename, ".tmp", NULL);
+
+    if (rewrite_header_member(original_filename, tmp_xml_filename,
+                              xml_compression, package_count, task_count,
+                              file_stat, &tmp_err)) {
+        if (g_rename(tmp_xml_filename, original_filename) == -1)
+            g_set_error(err, CREATEREPO_C_ERROR, CRE_IO,
+                        "Error encountered while renaming: %s",
+                        g_strerror(errno));
+        g_free(tmp_xml_filename);
+        return;
+    }
+    if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        g_remove(tmp_xml_filename);
+        g_free(tmp_xml_filename);
+        return;
+    }
+
     CR_FILE *original_file = cr_open(original_filename, CR_CW_MODE_READ, CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
     if (tmp_err) {
         g_propagate_prefixed_error(err, tmp_err, "Error encountered while reopening for reading:");
+        g_free(tmp_xml_filename);
         return;
     }
 
-    gchar *tmp_xml_filename = g_strconcat(original_filename, ".tmp", NULL);
     cr_XmlFile *new_file = cr_xmlfile_sopen_primary(tmp_xml_filename,
                                                     xml_compression,
                                                     file_stat,
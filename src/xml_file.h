@@ -27,6 +27,7 @@ extern "C" {
 #include <glib.h>
 #include "compression_wrapper.h"
 #include "package.h"
+#include "updateinfo.h"
 
 /** \defgroup   xml_file        XML file API.
  *  \addtogroup xml_file
@@ -44,6 +45,8 @@ typedef enum {
     CR_XMLFILE_SENTINEL,    /*!< sentinel of the list */
 } cr_XmlFileType;
 
+struct _cr_BlockIndex;
+
 /** cr_XmlFile structure.
  */
 typedef struct {
@@ -57,6 +60,31 @@ typedef struct {
         0 if no footer was written yet. */
     long pkgs; /*!<
         Number of packages */
+    gboolean deferred; /*!<
+        Number of packages may be set after the header was written,
+        it is corrected by cr_xmlfile_close(). */
+    long header_pkgs; /*!<
+        Number of packages written in the header */
+    gchar *filename; /*!<
+        Filename (deferred file only) */
+    cr_CompressionType comtype; /*!<
+        Type of compression (deferred file only) */
+    cr_ContentStat *stat; /*!<
+        Stats of the file (deferred file only) */
+    struct _cr_BlockIndex *blockindex; /*!<
+        Index of the blocks of the file or NULL */
+    gsize block_size; /*!<
+        Uncompressed size after which a block is ended */
+    guint64 written; /*!<
+        Number of uncompressed bytes written */
+    long chunks; /*!<
+        Number of packages (chunks) written */
+    long block_pkgs; /*!<
+        Number of packages in the current block */
+    gint64 block_offset; /*!<
+        Compressed offset of the current block */
+    guint64 block_uoffset; /*!<
+        Uncompressed offset of the current block */
 } cr_XmlFile;
 
 /** Open a new primary XML file.
@@ -182,9 +210,53 @@ cr_XmlFile *cr_xmlfile_sopen(const char *filename,
                              cr_ContentStat *stat,
                              GError **err);
 
+/** Open a new primary, filelists or other XML file whose number
+ * of packages may be set at any time before cr_xmlfile_close().
+ * The header is compressed on its own and if the number changed after
+ * it was written, cr_xmlfile_close() replaces it and keeps the rest
+ * of the compressed file as it is, without recompression.
+ * Only gz, zstd and no compression are supported.
+ * @param filename      Filename.
+ * @param type          Type of XML file.
+ * @param comtype       Type of used compression.
+ * @param stat          pointer to cr_ContentStat or NULL
+ * @param err           **GError
+ * @return              Opened cr_XmlFile or NULL on error
+ */
+cr_XmlFile *cr_xmlfile_sopen_deferred(const char *filename,
+                                      cr_XmlFileType type,
+                                      cr_CompressionType comtype,
+                                      cr_ContentStat *stat,
+                                      GError **err);
+
+/** Check if cr_xmlfile_sopen_deferred() supports the compression type.
+ * @param comtype       Type of compression.
+ * @return              TRUE if supported
+ */
+gboolean cr_xmlfile_deferred_supported(cr_CompressionType comtype);
+
+/** Write the packages of a primary, filelists or other XML file in blocks
+ * compressed independently of each other and record them in the index
+ * (see blockindex.h). A block is ended by the first package which makes
+ * it at least block_size bytes long (uncompressed). Every chunk added by
+ * cr_xmlfile_add_chunk() must be exactly one package.
+ * Only gz, zstd and no compression are supported. It must be called
+ * before anything is written.
+ * @param f             An opened cr_XmlFile
+ * @param index         Index of the blocks, it must outlive the file
+ * @param block_size    Uncompressed size of a block
+ * @param err           **GError
+ * @return              cr_Error code
+ */
+int cr_xmlfile_set_blockindex(cr_XmlFile *f,
+                              struct _cr_BlockIndex *index,
+                              gsize block_size,
+                              GError **err);
+
 /** Set total number of packages that will be in the file.
  * This number must be set before any write operation
- * (cr_xml_add_pkg, cr_xml_file_add_chunk, ..).
+ * (cr_xml_add_pkg, cr_xml_file_add_chunk, ..), unless the file was
+ * opened by cr_xmlfile_sopen_deferred().
  * @param f             An opened cr_XmlFile
  * @param num           Total number of packages in the file.
  * @param err           **GError
@@ -200,6 +272,20 @@ int cr_xmlfile_set_num_of_pkgs(cr_XmlFile *f, long num, GError **err);
  */
 int cr_xmlfile_add_pkg(cr_XmlFile *f, cr_Package *pkg, GError **err);
 
+/** Add update record to the updateinfo xml file.
+ * The records are written one by one, so an updateinfo.xml of any size
+ * could be generated (e.g. from records passed by
+ * cr_xml_parse_updateinfo_records()) without the whole cr_UpdateInfo
+ * in memory.
+ * @param f             An opened cr_XmlFile of the CR_XMLFILE_UPDATEINFO type
+ * @param rec           Update record.
+ * @param err           **GError
+ * @return              cr_Error code
+ */
+int cr_xmlfile_add_updaterecord(cr_XmlFile *f,
+                                cr_UpdateRecord *rec,
+                                GError **err);
+
 /** Add (write) string with XML chunk into the file.
  * Note: Because of writing, in case of multithreaded program, should be
  * guarded by locks, this function could be much more effective than
@@ -222,8 +308,11 @@ int cr_xmlfile_add_chunk(cr_XmlFile *f, const char *chunk, GError **err);
 int cr_xmlfile_close(cr_XmlFile *f, GError **err);
 
 /** Rewrite package count field in repodata header in xml file.
- * In order to do this we have to decompress and after the change
- * compress the whole file again, so entirely new file is created.
+ * If the header is a gzip member or a zstd frame of its own (files
+ * written by cr_XmlFile) or the file is not compressed, just the header
+ * is replaced and the rest of the file is copied. Otherwise we have to
+ * decompress and after the change compress the whole file again.
+ * In both cases an entirely new file is created.
  * @param original_filename     Current file with wrong value in header
  * @param package_count         Actual package count (desired value in header)
  * @param task_count            Task count (current value in header)
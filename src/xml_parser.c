@@ -28,6 +28,12 @@
 
 #define ERR_DOMAIN      CREATEREPO_C_ERROR
 
+#define RAW_PACKAGE_START       "<package"
+#define RAW_PACKAGE_END         "</package>"
+
+// Mapped plain files are parsed by slices of this size
+#define MAPPED_SLICE_SIZE       (1024*1024)
+
 
 cr_ParserData *
 cr_xml_parser_data(unsigned int numstates)
@@ -37,6 +43,7 @@ cr_xml_parser_data(unsigned int numstates)
     pd->acontent = CONTENT_REALLOC_STEP;
     pd->swtab = g_malloc0(sizeof(cr_StatesSwitch *) * numstates);
     pd->sbtab = g_malloc(sizeof(unsigned int) * numstates);
+    pd->raw_start = -1;
 
     return pd;
 }
@@ -44,12 +51,39 @@ cr_xml_parser_data(unsigned int numstates)
 void
 cr_xml_parser_data_free(cr_ParserData *pd)
 {
+    if (pd->raw)
+        g_string_free(pd->raw, TRUE);
     g_free(pd->content);
     g_free(pd->swtab);
     g_free(pd->sbtab);
+    g_free(pd->swnames);
     g_free(pd);
 }
 
+void
+cr_xml_parser_set_switches(cr_ParserData *pd,
+                           cr_StatesSwitch *switches,
+                           unsigned int numstates)
+{
+    xmlDictPtr dict = pd->parser ? pd->parser->dict : NULL;
+    guint count = 0;
+
+    while (switches[count].from != numstates)
+        count++;
+
+    pd->switches = switches;
+    pd->swnames = g_new0(const xmlChar *, count + 1);
+
+    for (guint x = 0; x < count; x++) {
+        cr_StatesSwitch *sw = &switches[x];
+        if (!pd->swtab[sw->from])
+            pd->swtab[sw->from] = sw;
+        pd->sbtab[sw->to] = sw->from;
+        if (dict)
+            pd->swnames[x] = xmlDictLookup(dict, (xmlChar *) sw->ename, -1);
+    }
+}
+
 void
 cr_char_handler(void *pdata, const xmlChar *s, int len)
 {
@@ -65,8 +99,9 @@ cr_char_handler(void *pdata, const xmlChar *s, int len)
 
     l = pd->lcontent + len + 1;
     if (l > pd->acontent) {
-        pd->acontent = l + CONTENT_REALLOC_STEP;
-        pd->content = realloc(pd->content, pd->acontent);
+        // Grow geometrically, long contents come in many small pieces
+        pd->acontent = MAX(l, pd->acontent * 2);
+        pd->content = g_realloc(pd->content, pd->acontent);
     }
 
     c = pd->content + pd->lcontent;
@@ -76,6 +111,98 @@ cr_char_handler(void *pdata, const xmlChar *s, int len)
     *c = '\0';
 }
 
+/** Drop the already parsed part of the input from the raw buffer.
+ * Nothing is dropped while a package element is being parsed.
+ */
+static void
+cr_xml_parser_raw_trim(cr_ParserData *pd, gint64 upto)
+{
+    gint64 drop;
+
+    if (pd->raw_start >= 0)
+        return;
+
+    drop = CLAMP(upto - pd->raw_offset, 0, (gint64) pd->raw->len);
+    g_string_erase(pd->raw, 0, (gssize) drop);
+    pd->raw_offset += drop;
+}
+
+void
+cr_xml_parser_raw_start(cr_ParserData *pd)
+{
+    gint64 pos;
+
+    if (!pd->raw)
+        return;
+
+    // The start handler is called when the whole start tag was read,
+    // find its beginning ('<' cannot be a part of attribute values)
+    pos = (gint64) xmlByteConsumed(pd->parser) - pd->raw_offset;
+    pos = MIN(pos, (gint64) pd->raw->len - 1);
+    while (pos >= 0 && pd->raw->str[pos] != '<')
+        pos--;
+
+    pd->raw_start = (pos >= 0) ? pd->raw_offset + pos : -1;
+}
+
+static gboolean
+cr_xml_parser_raw_is_package(const char *str, gsize len)
+{
+    gsize start_len = strlen(RAW_PACKAGE_START);
+    gsize end_len = strlen(RAW_PACKAGE_END);
+
+    if (len <= start_len || strncmp(str, RAW_PACKAGE_START, start_len))
+        return FALSE;
+
+    // <package ...>...</package>
+    if (len > start_len + end_len
+        && !strncmp(str + len - end_len, RAW_PACKAGE_END, end_len))
+        return TRUE;
+
+    // <package .../>
+    return str[len - 2] == '/' && memchr(str, '>', len) == str + len - 1;
+}
+
+char *
+cr_xml_parser_raw_end(cr_ParserData *pd)
+{
+    gint64 start, end;
+    char *raw = NULL;
+
+    if (!pd->raw || pd->raw_start < 0)
+        goto out;
+
+    // Depending on libxml2 version the end handler is called right before
+    // or right after the closing '>' was consumed
+    start = pd->raw_start - pd->raw_offset;
+    end = (gint64) xmlByteConsumed(pd->parser) - pd->raw_offset - 1;
+    end = MAX(end, start);
+    while (end < (gint64) pd->raw->len && pd->raw->str[end] != '>')
+        end++;
+
+    pd->raw_start = -1;
+
+    if (end >= (gint64) pd->raw->len)
+        goto out;
+
+    gsize len = end - start + 1;
+    const char *str = pd->raw->str + start;
+
+    // Return the raw xml only if it is the whole element
+    if (pd->pkg && cr_xml_parser_raw_is_package(str, len))
+        raw = g_string_chunk_insert_len(pd->pkg->chunk, str, len);
+
+    cr_xml_parser_raw_trim(pd, pd->raw_offset + end + 1);
+
+out:
+    if (!raw && pd->raw_only && pd->pkg && !pd->err)
+        g_set_error(&pd->err, ERR_DOMAIN, CRE_XMLPARSER,
+                    "Cannot get raw xml of the package %s",
+                    pd->pkg->pkgId ? pd->pkg->pkgId : "");
+
+    return raw;
+}
+
 int
 cr_xml_parser_warning(cr_ParserData *pd,
                       cr_XmlParserWarningType type,
@@ -129,6 +256,17 @@ cr_xml_parser_strtoll(cr_ParserData *pd,
     if (!nptr)
         return 0;
 
+    if (base == 10) {
+        // Fast path for plain decimal numbers which can't overflow
+        const char *c = nptr;
+        guint64 uval = 0;
+        while (*c >= '0' && *c <= '9' && c - nptr < 18)
+            uval = uval * 10 + (guint64) (*c++ - '0');
+        if (*c == '\0' && c != nptr)
+            return (gint64) uval;
+    }
+
+    errno = 0;
     val = g_ascii_strtoll(nptr, &endptr, base);
 
     if ((val == G_MAXINT64 || val == G_MININT64) && errno == ERANGE)
@@ -157,6 +295,203 @@ cr_newpkgcb(cr_Package **pkg,
     return CRE_OK;
 }
 
+/* Readahead of compressed files. A thread decompresses the next block
+ * while the current one is parsed. Two blocks circulate between
+ * the queues: reader pops a free one, fills it and pushes it to the full
+ * queue, the parser returns it back to the free queue when done.
+ */
+
+#define READAHEAD_BLOCKS        2
+
+typedef struct {
+    char *data;
+    int len;
+    GError *err;
+} cr_ReadaheadBlock;
+
+typedef struct {
+    CR_FILE *f;
+    gsize block_size;
+    GAsyncQueue *free_blocks;
+    GAsyncQueue *full_blocks;
+    gint stop;
+} cr_Readahead;
+
+static gpointer
+cr_readahead_thread(gpointer data)
+{
+    cr_Readahead *ra = data;
+
+    while (1) {
+        cr_ReadaheadBlock *block = g_async_queue_pop(ra->free_blocks);
+        if (g_atomic_int_get(&ra->stop)) {
+            g_async_queue_push(ra->free_blocks, block);
+            break;
+        }
+
+        block->len = cr_read(ra->f, block->data, ra->block_size, &block->err);
+        g_async_queue_push(ra->full_blocks, block);
+        if (block->err || block->len == 0)
+            break;
+    }
+
+    return NULL;
+}
+
+static void
+cr_readahead_block_free(gpointer data)
+{
+    cr_ReadaheadBlock *block = data;
+    if (block->err)
+        g_error_free(block->err);
+    g_free(block->data);
+    g_free(block);
+}
+
+/** Parse a chunk of the xml, store it for the raw snippets if requested.
+ */
+static int
+cr_xml_parser_parse_chunk(xmlParserCtxtPtr parser,
+                          cr_ParserData *pd,
+                          const char *path,
+                          const char *data,
+                          int len,
+                          int terminate,
+                          GError **err)
+{
+    if (pd->store_raw) {
+        if (!pd->raw)
+            pd->raw = g_string_sized_new(2 * XML_BUFFER_SIZE);
+        g_string_append_len(pd->raw, data, len);
+    }
+
+    if (xmlParseChunk(parser, data, len, terminate)) {
+        xmlErrorPtr xml_err = xmlCtxtGetLastError(parser);
+        g_critical("%s: parsing error '%s': %s",
+                   __func__,
+                   path,
+                   xml_err->message);
+        g_set_error(err, ERR_DOMAIN, CRE_XMLPARSER,
+                    "Parse error '%s' at line: %d (%s)",
+                    path,
+                    (int) xml_err->line,
+                    (char *) xml_err->message);
+        return CRE_XMLPARSER;
+    }
+
+    if (pd->err) {
+        int code = pd->err->code;
+        g_propagate_error(err, pd->err);
+        return code;
+    }
+
+    if (pd->store_raw)
+        cr_xml_parser_raw_trim(pd, (gint64) xmlByteConsumed(parser));
+
+    return CRE_OK;
+}
+
+/** Parse the mapped content of a plain file in large slices.
+ */
+static int
+cr_xml_parser_parse_mapped(xmlParserCtxtPtr parser,
+                           cr_ParserData *pd,
+                           const char *path,
+                           const char *content,
+                           gsize len,
+                           GError **err)
+{
+    int ret = CRE_OK;
+    gsize offset = 0;
+
+    while (ret == CRE_OK) {
+        int slice = (int) MIN(len - offset, MAPPED_SLICE_SIZE);
+        ret = cr_xml_parser_parse_chunk(parser, pd, path, content + offset,
+                                        slice, slice == 0, err);
+        if (slice == 0)
+            break;
+        offset += slice;
+    }
+
+    return ret;
+}
+
+/** Parse the file by blocks of cr_read(), compressed files are read ahead.
+ */
+static int
+cr_xml_parser_parse_blocks(xmlParserCtxtPtr parser,
+                           cr_ParserData *pd,
+                           const char *path,
+                           CR_FILE *f,
+                           GError **err)
+{
+    int ret = CRE_OK;
+    GError *tmp_err = NULL;
+    cr_Readahead ra;
+    GThread *reader = NULL;
+    cr_ReadaheadBlock *block;
+
+    ra.f = f;
+    ra.block_size = cr_get_io_buffer_size();
+    ra.free_blocks = g_async_queue_new_full(cr_readahead_block_free);
+    ra.full_blocks = g_async_queue_new_full(cr_readahead_block_free);
+    ra.stop = 0;
+    for (int i = 0; i < READAHEAD_BLOCKS; i++) {
+        block = g_new0(cr_ReadaheadBlock, 1);
+        block->data = g_malloc(ra.block_size);
+        g_async_queue_push(ra.free_blocks, block);
+    }
+
+    // Plain files are read directly, there is nothing to overlap
+    if (f->type != CR_CW_NO_COMPRESSION)
+        reader = g_thread_try_new("readahead", cr_readahead_thread,
+                                  &ra, NULL);
+
+    while (1) {
+        int len;
+
+        if (reader) {
+            block = g_async_queue_pop(ra.full_blocks);
+        } else {
+            block = g_async_queue_pop(ra.free_blocks);
+            block->len = cr_read(f, block->data, ra.block_size, &block->err);
+        }
+
+        len = block->len;
+        if (block->err) {
+            tmp_err = block->err;
+            block->err = NULL;
+            ret = tmp_err->code;
+            g_critical("%s: Error while reading xml '%s': %s",
+                       __func__, path, tmp_err->message);
+            g_propagate_prefixed_error(err, tmp_err, "Read error: ");
+            g_async_queue_push(ra.free_blocks, block);
+            break;
+        }
+
+        ret = cr_xml_parser_parse_chunk(parser, pd, path, block->data, len,
+                                        len == 0, err);
+
+        // The block is parsed, the reader can fill it again
+        g_async_queue_push(ra.free_blocks, block);
+
+        if (ret != CRE_OK || len == 0)
+            break;
+    }
+
+    if (reader) {
+        // Wake up the reader if it waits for a free block
+        g_atomic_int_set(&ra.stop, 1);
+        block = g_new0(cr_ReadaheadBlock, 1);
+        g_async_queue_push(ra.free_blocks, block);
+        g_thread_join(reader);
+    }
+    g_async_queue_unref(ra.free_blocks);
+    g_async_queue_unref(ra.full_blocks);
+
+    return ret;
+}
+
 int
 cr_xml_parser_generic(xmlParserCtxtPtr parser,
                       cr_ParserData *pd,
@@ -165,10 +500,11 @@ cr_xml_parser_generic(xmlParserCtxtPtr parser,
 {
     /* Note: This function uses .err members of cr_ParserData! */
 
-    int ret = CRE_OK;
+    int ret;
     CR_FILE *f;
     GError *tmp_err = NULL;
-    char buf[XML_BUFFER_SIZE];
+    const char *content;
+    gsize content_len;
 
     assert(parser);
     assert(pd);
@@ -182,40 +518,16 @@ cr_xml_parser_generic(xmlParserCtxtPtr parser,
         return code;
     }
 
-    while (1) {
-        int len;
-        len = cr_read(f, buf, XML_BUFFER_SIZE, &tmp_err);
-        if (tmp_err) {
-            ret = tmp_err->code;
-            g_critical("%s: Error while reading xml '%s': %s",
-                       __func__, path, tmp_err->message);
-            g_propagate_prefixed_error(err, tmp_err, "Read error: ");
-            break;
-        }
-
-        if (xmlParseChunk(parser, buf, len, len == 0)) {
-            ret = CRE_XMLPARSER;
-            xmlErrorPtr xml_err = xmlCtxtGetLastError(parser);
-            g_critical("%s: parsing error '%s': %s",
-                       __func__,
-                       path,
-                       xml_err->message);
-            g_set_error(err, ERR_DOMAIN, CRE_XMLPARSER,
-                        "Parse error '%s' at line: %d (%s)",
-                        path,
-                        (int) xml_err->line,
-                        (char *) xml_err->message);
-            break;
-        }
-
-        if (pd->err) {
-            ret = pd->err->code;
-            g_propagate_error(err, pd->err);
-            break;
-        }
-
-        if (len == 0)
-            break;
+    // Plain local files are parsed right from their mapping
+    content = cr_map(f, &content_len, &tmp_err);
+    if (content) {
+        ret = cr_xml_parser_parse_mapped(parser, pd, path, content,
+                                         content_len, err);
+    } else if (tmp_err) {
+        ret = tmp_err->code;
+        g_propagate_prefixed_error(err, tmp_err, "Read error: ");
+    } else {
+        ret = cr_xml_parser_parse_blocks(parser, pd, path, f, err);
     }
 
     if (ret != CRE_OK) {
@@ -82,6 +82,18 @@ typedef int (*cr_XmlParserPkgCb)(cr_Package *pkg,
                                  void *cbdata,
                                  GError **err);
 
+/** Callback for XML parser which is called when an update element
+ * of updateinfo.xml is parsed.
+ * @param rec       Parsed update record. The callback takes the ownership
+ *                  of the record (free it by cr_updaterecord_free()).
+ * @param cbdata    User data.
+ * @param err       GError **
+ * @return          CR_CB_RET_OK (0) or CR_CB_RET_ERR (1) - stops the parsing
+ */
+typedef int (*cr_XmlParserUpdateRecordCb)(cr_UpdateRecord *rec,
+                                          void *cbdata,
+                                          GError **err);
+
 /** Callback for XML parser warnings. All reported warnings are non-fatal,
  * and ignored by default. But if callback return CR_CB_RET_ERR instead of
  * CR_CB_RET_OK then parsing is immediately interrupted.
@@ -174,6 +186,64 @@ int cr_xml_parse_filelists(const char *path,
                            void *warningcb_data,
                            GError **err);
 
+/** Parse filelists.xml using more threads. File could be compressed.
+ * The file is read sequentially and split before the <package> elements
+ * into parts which are parsed in parallel. Packages are passed to
+ * the newpkgcb and pkgcb in the original order from the calling thread,
+ * but the warningcb could be called from the parser threads.
+ * Because all the package data are parsed before the newpkgcb is called,
+ * skipping of a package by the newpkgcb doesn't save the parsing work.
+ * @param path           Path to filelists.xml
+ * @param newpkgcb       Callback for new package. If NULL cr_newpkgcb
+ *                       is used.
+ * @param newpkgcb_data  User data for the newpkgcb.
+ * @param pkgcb          Package callback. Could be NULL if newpkgcb is
+ *                       not NULL.
+ * @param pkgcb_data     User data for the pkgcb.
+ * @param warningcb      Callback for warning messages. Must be thread safe.
+ * @param warningcb_data User data for the warningcb.
+ * @param threads        Number of parser threads. With less than 2
+ *                       the cr_xml_parse_filelists() is used.
+ * @param err            GError **
+ * @return               cr_Error code.
+ */
+int cr_xml_parse_filelists_threaded(const char *path,
+                                    cr_XmlParserNewPkgCb newpkgcb,
+                                    void *newpkgcb_data,
+                                    cr_XmlParserPkgCb pkgcb,
+                                    void *pkgcb_data,
+                                    cr_XmlParserWarningCb warningcb,
+                                    void *warningcb_data,
+                                    int threads,
+                                    GError **err);
+
+/** Parse filelists.xml by a specialized scanner instead of libxml2.
+ * File could be compressed. The scanner handles the filelists.xml in
+ * the form generated by createrepo, packages with any unexpected
+ * content are parsed by libxml2, so the results are the same as with
+ * cr_xml_parse_filelists(). A file with an unexpected XML declaration
+ * (e.g. not UTF-8 encoding) is parsed by libxml2 entirely.
+ * @param path           Path to filelists.xml
+ * @param newpkgcb       Callback for new package. If NULL cr_newpkgcb
+ *                       is used.
+ * @param newpkgcb_data  User data for the newpkgcb.
+ * @param pkgcb          Package callback. Could be NULL if newpkgcb is
+ *                       not NULL.
+ * @param pkgcb_data     User data for the pkgcb.
+ * @param warningcb      Callback for warning messages.
+ * @param warningcb_data User data for the warningcb.
+ * @param err            GError **
+ * @return               cr_Error code.
+ */
+int cr_xml_parse_filelists_fast(const char *path,
+                                cr_XmlParserNewPkgCb newpkgcb,
+                                void *newpkgcb_data,
+                                cr_XmlParserPkgCb pkgcb,
+                                void *pkgcb_data,
+                                cr_XmlParserWarningCb warningcb,
+                                void *warningcb_data,
+                                GError **err);
+
 /** Parse string snippet of filelists xml repodata. Snippet cannot contain
  * root xml element <filelists>. It contains only <package> elemetns.
  * @param xml_string     String containg filelists xml data
@@ -248,6 +318,92 @@ int cr_xml_parse_other_snippet(const char *xml_string,
                                void *warningcb_data,
                                GError **err);
 
+/** Index of the package chunks of a zchunk compressed primary.xml,
+ * filelists.xml or other.xml. The chunks of metadata generated
+ * by createrepo_c follow the source rpms of the packages (see
+ * the --zck-chunking option), so only a few chunks have to be
+ * decompressed to read the packages built from a source rpm.
+ */
+typedef struct _cr_XmlZckIndex cr_XmlZckIndex;
+
+/** Read all chunks of a zchunk compressed xml once and record the source
+ * rpms of their packages. Packages of filelists.xml and other.xml don't
+ * contain their source rpm, it is found by their pkgId in the index
+ * of primary.xml of the same repo.
+ * @param path           Path to primary.xml.zck, filelists.xml.zck
+ *                       or other.xml.zck
+ * @param primary        Index of primary.xml.zck (needed only for
+ *                       filelists.xml.zck and other.xml.zck) or NULL
+ * @param err            GError **
+ * @return               cr_XmlZckIndex or NULL on error
+ */
+cr_XmlZckIndex *cr_xml_zck_index_new(const char *path,
+                                     const cr_XmlZckIndex *primary,
+                                     GError **err);
+
+/** Number of chunks of the indexed file (including the dictionary and
+ * the header chunks without packages).
+ * @param index          cr_XmlZckIndex
+ * @return               Number of chunks
+ */
+guint cr_xml_zck_index_chunk_count(const cr_XmlZckIndex *index);
+
+/** Source rpms of the packages in the chunk.
+ * @param index          cr_XmlZckIndex
+ * @param chunk          Index of the chunk
+ * @return               GPtrArray of source rpms (owned by the index)
+ *                       or NULL if the chunk has no packages
+ */
+const GPtrArray *cr_xml_zck_index_chunk_srpms(const cr_XmlZckIndex *index,
+                                              guint chunk);
+
+/** Chunks with packages built from the source rpm.
+ * @param index          cr_XmlZckIndex
+ * @param rpm_sourcerpm  Source rpm (e.g. "foo-1.0-1.src.rpm")
+ * @return               GArray of ascending chunk indexes (guint, owned
+ *                       by the index) or NULL if there is no such package
+ */
+const GArray *cr_xml_zck_index_srpm_chunks(const cr_XmlZckIndex *index,
+                                           const char *rpm_sourcerpm);
+
+/** Parse only the packages of the selected chunks of the indexed file.
+ * Only the selected chunks are decompressed. A chunk could contain also
+ * packages of other source rpms, see cr_xml_zck_index_chunk_srpms().
+ * This function is not thread safe (the index keeps the file open).
+ * @param index          cr_XmlZckIndex
+ * @param chunks         Indexes of the chunks
+ * @param count          Number of the chunks
+ * @param newpkgcb       Callback for new package (Called when new package
+ *                       xml chunk is found and package object to store
+ *                       the data is needed). If NULL cr_newpkgcb is used.
+ * @param newpkgcb_data  User data for the newpkgcb.
+ * @param pkgcb          Package callback. (Called when complete package
+ *                       xml chunk is parsed.). Could be NULL if newpkgcb is
+ *                       not NULL.
+ * @param pkgcb_data     User data for the pkgcb.
+ * @param warningcb      Callback for warning messages.
+ * @param warningcb_data User data for the warningcb.
+ * @param do_files       0 - Ignore file tags in primary.xml.
+ * @param err            GError **
+ * @return               cr_Error code.
+ */
+int cr_xml_parse_zck_chunks(cr_XmlZckIndex *index,
+                            const guint *chunks,
+                            guint count,
+                            cr_XmlParserNewPkgCb newpkgcb,
+                            void *newpkgcb_data,
+                            cr_XmlParserPkgCb pkgcb,
+                            void *pkgcb_data,
+                            cr_XmlParserWarningCb warningcb,
+                            void *warningcb_data,
+                            int do_files,
+                            GError **err);
+
+/** Free the index.
+ * @param index          cr_XmlZckIndex or NULL
+ */
+void cr_xml_zck_index_free(cr_XmlZckIndex *index);
+
 /** Parse repomd.xml. File could be compressed.
  * @param path           Path to repomd.xml
  * @param repomd         cr_Repomd object.
@@ -278,6 +434,78 @@ cr_xml_parse_updateinfo(const char *path,
                         void *warningcb_data,
                         GError **err);
 
+/** Parse updateinfo.xml record by record. File could be compressed.
+ * Every update record is passed to the recordcb as soon as it is parsed,
+ * so the memory doesn't grow with the number of records.
+ * @param path           Path to updateinfo.xml
+ * @param recordcb       Callback for the parsed update records.
+ * @param recordcb_data  User data for the recordcb.
+ * @param warningcb      Callback for warning messages.
+ * @param warningcb_data User data for the warningcb.
+ * @param err            GError **
+ * @return               cr_Error code.
+ */
+int
+cr_xml_parse_updateinfo_records(const char *path,
+                                cr_XmlParserUpdateRecordCb recordcb,
+                                void *recordcb_data,
+                                cr_XmlParserWarningCb warningcb,
+                                void *warningcb_data,
+                                GError **err);
+
+/** Iterator over packages of the primary.xml, filelists.xml and other.xml
+ * merged together.
+ */
+typedef struct _cr_PkgIterator cr_PkgIterator;
+
+/** Create an iterator which returns complete packages of the metadata.
+ * Every file is parsed by its own thread ahead of the iteration (with
+ * a limit of buffered packages) and the files and changelogs are merged
+ * into the packages from primary.xml by pkgId. The files are expected
+ * to be in the same order (as generated by createrepo), packages out of
+ * the order are kept in memory until they are needed.
+ * Packages of filelists.xml and other.xml which are not in the primary.xml
+ * are ignored.
+ * @param primary_path   Path to primary.xml
+ * @param filelists_path Path to filelists.xml or NULL
+ * @param other_path     Path to other.xml or NULL
+ * @param warningcb      Callback for warning messages. It is called from
+ *                       the parser threads, so it must be thread safe.
+ * @param warningcb_data User data for the warningcb.
+ * @param err            GError **
+ * @return               New iterator or NULL on error.
+ */
+cr_PkgIterator *
+cr_pkg_iterator_new(const char *primary_path,
+                    const char *filelists_path,
+                    const char *other_path,
+                    cr_XmlParserWarningCb warningcb,
+                    void *warningcb_data,
+                    GError **err);
+
+/** Get the next package.
+ * @param iter          Iterator
+ * @param err           GError **
+ * @return              Package (the caller owns it) or NULL if there are
+ *                      no more packages or on error.
+ */
+cr_Package *
+cr_pkg_iterator_next(cr_PkgIterator *iter, GError **err);
+
+/** Check if the iteration ended (all packages were returned or
+ * an error was reported by cr_pkg_iterator_next()).
+ * @param iter          Iterator
+ * @return              TRUE if cr_pkg_iterator_next() returns no packages
+ */
+gboolean
+cr_pkg_iterator_is_finished(cr_PkgIterator *iter);
+
+/** Stop the parsing and free the iterator.
+ * @param iter          Iterator
+ */
+void
+cr_pkg_iterator_free(cr_PkgIterator *iter);
+
 /** @} */
 
 #ifdef __cplusplus
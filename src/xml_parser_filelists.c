@@ -79,11 +79,12 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     if (!pd->pkg && pd->state != STATE_FILELISTS && pd->state != STATE_START)
         return;  // Do not parse current package tag and its content
 
+    if (pd->raw_only && pd->state == STATE_PACKAGE)
+        return;  // Only the raw xml of the package is stored
+
     // Find current state by its name
-    for (sw = pd->swtab[pd->state]; sw->from == pd->state; sw++)
-        if (!strcmp((char *) element, sw->ename))
-            break;
-    if (sw->from != pd->state) {
+    sw = cr_xml_parser_switch(pd, element);
+    if (!sw) {
         // No state for current element (unknown element)
         cr_xml_parser_warning(pd, CR_XML_WARNING_UNKNOWNTAG,
                               "Unknown element \"%s\"", element);
@@ -108,9 +109,16 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_PACKAGE: {
-        const char *pkgId = cr_find_attr("pkgid", attr);
-        const char *name  = cr_find_attr("name", attr);
-        const char *arch  = cr_find_attr("arch", attr);
+        if (pd->store_raw)
+            cr_xml_parser_raw_start(pd);
+
+        static const char * const names[] = { "pkgid", "name", "arch" };
+        const char *values[3];
+        cr_find_attrs(attr, names, values, 3);
+
+        const char *pkgId = values[0];
+        const char *name  = values[1];
+        const char *arch  = values[2];
 
 
         if (!pkgId) {
@@ -157,7 +165,7 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
             if (!pd->pkg->name && name)
                 pd->pkg->name = g_string_chunk_insert(pd->pkg->chunk, name);
             if (!pd->pkg->arch && arch)
-                pd->pkg->arch = g_string_chunk_insert(pd->pkg->chunk, arch);
+                pd->pkg->arch = cr_xml_parser_intern(pd->pkg, arch);
         }
         break;
     }
@@ -166,16 +174,7 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         assert(pd->pkg);
 
         // Version string insert only if them don't already exists
-
-        if (!pd->pkg->epoch)
-            pd->pkg->epoch = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("epoch", attr));
-        if (!pd->pkg->version)
-            pd->pkg->version = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("ver", attr));
-        if (!pd->pkg->release)
-            pd->pkg->release = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("rel", attr));
+        cr_xml_parser_evr(pd->pkg, attr);
         break;
 
     case STATE_FILE:
@@ -227,6 +226,12 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_PACKAGE:
+        if (pd->store_raw) {
+            char *raw = cr_xml_parser_raw_end(pd);
+            if (pd->pkg)
+                pd->pkg->raw_filelists = raw;
+        }
+
         if (!pd->pkg)
             return;
 
@@ -256,13 +261,14 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         if (!pd->content)
             break;
 
-        cr_PackageFile *pkg_file = cr_package_file_new();
-        pkg_file->name = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                                cr_get_filename(pd->content));
+        cr_PackageFile *pkg_file = cr_package_new_file(pd->pkg);
+        pkg_file->name = cr_xml_parser_intern(pd->pkg,
+                                              cr_get_filename(pd->content));
         if (!pkg_file->name) {
             g_set_error(&pd->err, ERR_DOMAIN, ERR_CODE_XML,
                         "Invalid <file> element: %s", pd->content);
-            g_free(pkg_file);
+            if (!pd->pkg->arena)
+                g_free(pkg_file);
             break;
         }
         pd->content[pd->lcontent - strlen(pkg_file->name)] = '\0';
@@ -270,12 +276,17 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
                                                            pd->content);
         switch (pd->last_file_type) {
             case FILE_FILE:  pkg_file->type = NULL;    break; // NULL => "file"
-            case FILE_DIR:   pkg_file->type = "dir";   break;
-            case FILE_GHOST: pkg_file->type = "ghost"; break;
+            case FILE_DIR:
+                pkg_file->type = (char *) cr_package_file_type_str(CR_FILE_TYPE_DIR);
+                break;
+            case FILE_GHOST:
+                pkg_file->type = (char *) cr_package_file_type_str(CR_FILE_TYPE_GHOST);
+                break;
             default: assert(0);  // Should not happend
         }
 
-        pd->pkg->files = g_slist_prepend(pd->pkg->files, pkg_file);
+        pd->pkg->files = cr_package_list_prepend(pd->pkg,
+                                            pd->pkg->files, pkg_file);
         break;
     }
 
@@ -292,6 +303,8 @@ cr_xml_parse_filelists_internal(const char *target,
                                 void *pkgcb_data,
                                 cr_XmlParserWarningCb warningcb,
                                 void *warningcb_data,
+                                gboolean store_raw,
+                                gboolean raw_only,
                                 int (*parser_func)(xmlParserCtxtPtr, cr_ParserData *, const char *, GError**),
                                 GError **err)
 {
@@ -326,11 +339,9 @@ cr_xml_parse_filelists_internal(const char *target,
     pd->pkgcb = pkgcb;
     pd->warningcb = warningcb;
     pd->warningcb_data = warningcb_data;
-    for (cr_StatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    pd->store_raw = store_raw || raw_only;
+    pd->raw_only = raw_only;
+    cr_xml_parser_set_switches(pd, stateswitches, NUMSTATES);
 
     // Parsing
 
@@ -376,7 +387,7 @@ cr_xml_parse_filelists(const char *path,
                        GError **err)
 {
     return cr_xml_parse_filelists_internal(path, newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
-                                           warningcb, warningcb_data, &cr_xml_parser_generic, err);
+                                           warningcb, warningcb_data, FALSE, FALSE, &cr_xml_parser_generic, err);
 }
 
 int
@@ -391,7 +402,1382 @@ cr_xml_parse_filelists_snippet(const char *xml_string,
 {
     char* wrapped_xml_string = g_strconcat("<filelists>", xml_string, "</filelists>", NULL);
     int ret = cr_xml_parse_filelists_internal(wrapped_xml_string, newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
-                                              warningcb, warningcb_data, &cr_xml_parser_generic_from_string, err);
+                                              warningcb, warningcb_data, FALSE, FALSE, &cr_xml_parser_generic_from_string, err);
     free(wrapped_xml_string);
     return ret;
 }
+
+/* Threaded parsing
+ * The calling thread reads the file and cuts it before a "<package "
+ * element into parts of about PART_SIZE bytes. Every part is made
+ * a standalone document and it is parsed by a thread from the pool into
+ * its own package objects. The packages are then passed to the callbacks
+ * by the calling thread in the original order.
+ */
+
+#define PART_SIZE           (4*1024*1024)
+#define PART_OPEN           "<filelists>"
+#define PART_CLOSE          "</filelists>"
+#define PART_BOUNDARY       "<package "
+
+typedef struct {
+    GString *xml;       /*!< The part as a standalone document */
+    GSList *pkgs;       /*!< Parsed packages (in the reversed order) */
+    GError *err;        /*!< Parsing error */
+    gboolean done;      /*!< The part was parsed */
+} cr_FilelistsPart;
+
+typedef struct {
+    GMutex mutex;
+    GCond cond;
+    cr_XmlParserWarningCb warningcb;
+    void *warningcb_data;
+} cr_FilelistsParts;
+
+static void
+cr_filelists_part_free(cr_FilelistsPart *part)
+{
+    if (!part)
+        return;
+    if (part->xml)
+        g_string_free(part->xml, TRUE);
+    g_slist_free_full(part->pkgs, (GDestroyNotify) cr_package_free);
+    g_clear_error(&part->err);
+    g_free(part);
+}
+
+static int
+cr_filelists_part_pkgcb(cr_Package *pkg,
+                        void *cbdata,
+                        G_GNUC_UNUSED GError **err)
+{
+    cr_FilelistsPart *part = cbdata;
+    part->pkgs = g_slist_prepend(part->pkgs, pkg);
+    return CR_CB_RET_OK;
+}
+
+/** Parse a whole part at once. Unlike cr_xml_parser_generic_from_string()
+ * the error message doesn't include the data, the part is big.
+ */
+static int
+cr_filelists_part_parser(xmlParserCtxtPtr parser,
+                         cr_ParserData *pd,
+                         const char *xml_string,
+                         GError **err)
+{
+    int ret = CRE_OK;
+
+    assert(!err || *err == NULL);
+
+    if (xmlParseChunk(parser, xml_string, strlen(xml_string), 1)) {
+        ret = CRE_XMLPARSER;
+        xmlErrorPtr xml_err = xmlCtxtGetLastError(parser);
+        g_set_error(err, ERR_DOMAIN, CRE_XMLPARSER,
+                    "Parse error at line: %d (%s)",
+                    xml_err ? (int) xml_err->line : 0,
+                    xml_err ? (char *) xml_err->message : "unknown error");
+    }
+
+    if (pd->err) {
+        ret = pd->err->code;
+        if (err && *err)
+            g_clear_error(&pd->err);
+        else
+            g_propagate_error(err, pd->err);
+        pd->err = NULL;
+    }
+
+    return ret;
+}
+
+static void
+cr_filelists_part_thread(gpointer data, gpointer user_data)
+{
+    cr_FilelistsPart *part = data;
+    cr_FilelistsParts *shared = user_data;
+    GError *tmp_err = NULL;
+
+    cr_xml_parse_filelists_internal(part->xml->str,
+                                    cr_newpkgcb, NULL,
+                                    cr_filelists_part_pkgcb, part,
+                                    shared->warningcb, shared->warningcb_data,
+                                    FALSE, FALSE,
+                                    &cr_filelists_part_parser, &tmp_err);
+
+    g_mutex_lock(&shared->mutex);
+    g_string_free(part->xml, TRUE);
+    part->xml = NULL;
+    part->pkgs = g_slist_reverse(part->pkgs);
+    part->err = tmp_err;
+    part->done = TRUE;
+    g_cond_broadcast(&shared->cond);
+    g_mutex_unlock(&shared->mutex);
+}
+
+/** Pass a package parsed by a thread to the caller's callbacks.
+ * The tmp package is always consumed.
+ */
+static int
+cr_filelists_part_pass_pkg(cr_Package *tmp,
+                           cr_XmlParserNewPkgCb newpkgcb,
+                           void *newpkgcb_data,
+                           cr_XmlParserPkgCb pkgcb,
+                           void *pkgcb_data,
+                           GError **err)
+{
+    cr_Package *pkg = NULL;
+    GError *tmp_err = NULL;
+
+    if (newpkgcb == cr_newpkgcb) {
+        pkg = tmp;
+    } else {
+        if (newpkgcb(&pkg, tmp->pkgId, tmp->name, tmp->arch,
+                     newpkgcb_data, &tmp_err))
+        {
+            cr_package_free(tmp);
+            if (tmp_err)
+                g_propagate_prefixed_error(err, tmp_err,
+                                           "Parsing interrupted: ");
+            else
+                g_set_error(err, ERR_DOMAIN, CRE_CBINTERRUPTED,
+                            "Parsing interrupted");
+            return CRE_CBINTERRUPTED;
+        }
+
+        if (!pkg) {
+            // The caller is not interested in this package
+            cr_package_free(tmp);
+            return CRE_OK;
+        }
+
+        // Move the parsed data into the caller's package object
+        if (!pkg->pkgId)
+            pkg->pkgId = cr_safe_string_chunk_insert(pkg->chunk, tmp->pkgId);
+        if (!pkg->name)
+            pkg->name = cr_safe_string_chunk_insert(pkg->chunk, tmp->name);
+        if (!pkg->arch)
+            pkg->arch = cr_xml_parser_intern(pkg, tmp->arch);
+        if (!pkg->epoch)
+            pkg->epoch = cr_xml_parser_intern(pkg, tmp->epoch);
+        if (!pkg->version)
+            pkg->version = cr_xml_parser_intern(pkg, tmp->version);
+        if (!pkg->release)
+            pkg->release = cr_xml_parser_intern(pkg, tmp->release);
+
+        GSList *files = NULL;
+        for (GSList *elem = tmp->files; elem; elem = g_slist_next(elem)) {
+            cr_PackageFile *tmp_file = elem->data;
+            cr_PackageFile *pkg_file = cr_package_new_file(pkg);
+            pkg_file->name = cr_xml_parser_intern(pkg, tmp_file->name);
+            pkg_file->path = cr_safe_string_chunk_insert_const(pkg->chunk,
+                                                               tmp_file->path);
+            pkg_file->type = tmp_file->type; // A static string or NULL
+            files = cr_package_list_prepend(pkg, files, pkg_file);
+        }
+        pkg->files = g_slist_concat(pkg->files, g_slist_reverse(files));
+        cr_package_free(tmp);
+    }
+
+    if (pkgcb && pkgcb(pkg, pkgcb_data, &tmp_err)) {
+        if (tmp_err)
+            g_propagate_prefixed_error(err, tmp_err, "Parsing interrupted: ");
+        else
+            g_set_error(err, ERR_DOMAIN, CRE_CBINTERRUPTED,
+                        "Parsing interrupted");
+        return CRE_CBINTERRUPTED;
+    }
+
+    return CRE_OK;
+}
+
+/** Pass the packages of the parsed parts from the head of the queue.
+ * Wait for the parts while the queue is longer than keep.
+ */
+static int
+cr_filelists_parts_flush(GQueue *parts,
+                         cr_FilelistsParts *shared,
+                         guint keep,
+                         cr_XmlParserNewPkgCb newpkgcb,
+                         void *newpkgcb_data,
+                         cr_XmlParserPkgCb pkgcb,
+                         void *pkgcb_data,
+                         GError **err)
+{
+    cr_FilelistsPart *part;
+
+    while ((part = g_queue_peek_head(parts))) {
+        g_mutex_lock(&shared->mutex);
+        if (!part->done && g_queue_get_length(parts) <= keep) {
+            g_mutex_unlock(&shared->mutex);
+            break;
+        }
+        while (!part->done)
+            g_cond_wait(&shared->cond, &shared->mutex);
+        g_mutex_unlock(&shared->mutex);
+
+        g_queue_pop_head(parts);
+
+        if (part->err) {
+            int code = part->err->code;
+            g_propagate_error(err, part->err);
+            part->err = NULL;
+            cr_filelists_part_free(part);
+            return code;
+        }
+
+        while (part->pkgs) {
+            cr_Package *pkg = part->pkgs->data;
+            part->pkgs = g_slist_delete_link(part->pkgs, part->pkgs);
+            int ret = cr_filelists_part_pass_pkg(pkg, newpkgcb, newpkgcb_data,
+                                                 pkgcb, pkgcb_data, err);
+            if (ret != CRE_OK) {
+                cr_filelists_part_free(part);
+                return ret;
+            }
+        }
+
+        cr_filelists_part_free(part);
+    }
+
+    return CRE_OK;
+}
+
+int
+cr_xml_parse_filelists_threaded(const char *path,
+                                cr_XmlParserNewPkgCb newpkgcb,
+                                void *newpkgcb_data,
+                                cr_XmlParserPkgCb pkgcb,
+                                void *pkgcb_data,
+                                cr_XmlParserWarningCb warningcb,
+                                void *warningcb_data,
+                                int threads,
+                                GError **err)
+{
+    int ret = CRE_OK;
+    CR_FILE *f;
+    GThreadPool *pool;
+    GQueue parts = G_QUEUE_INIT;
+    cr_FilelistsParts shared;
+    GError *tmp_err = NULL;
+
+    assert(path);
+    assert(newpkgcb || pkgcb);
+    assert(!err || *err == NULL);
+
+    if (threads < 2)
+        return cr_xml_parse_filelists(path, newpkgcb, newpkgcb_data,
+                                      pkgcb, pkgcb_data,
+                                      warningcb, warningcb_data, err);
+
+    if (!newpkgcb)  // Use default newpkgcb
+        newpkgcb = cr_newpkgcb;
+
+    f = cr_open(path, CR_CW_MODE_READ, CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+    if (tmp_err) {
+        int code = tmp_err->code;
+        g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ", path);
+        return code;
+    }
+
+    // libxml2 must be initialized before it is used from more threads
+    xmlInitParser();
+
+    g_mutex_init(&shared.mutex);
+    g_cond_init(&shared.cond);
+    shared.warningcb = warningcb;
+    shared.warningcb_data = warningcb_data;
+
+    pool = g_thread_pool_new(cr_filelists_part_thread, &shared,
+                             threads, FALSE, NULL);
+
+    gsize block_size = cr_get_io_buffer_size();
+    gchar *block = g_malloc(block_size);
+    GString *pending = g_string_sized_new(PART_SIZE + block_size);
+    gboolean first = TRUE;
+    gboolean eof = FALSE;
+
+    while (!eof) {
+        int len = cr_read(f, block, block_size, &tmp_err);
+        if (tmp_err) {
+            ret = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Error while reading %s: ", path);
+            break;
+        }
+
+        if (len == 0)
+            eof = TRUE;
+        else
+            g_string_append_len(pending, block, len);
+
+        if (!eof && pending->len < PART_SIZE)
+            continue;
+
+        gsize cut = pending->len;
+        if (!eof) {
+            // Cut just before the last package start
+            gchar *boundary = g_strrstr_len(pending->str, pending->len,
+                                            PART_BOUNDARY);
+            if (!boundary || boundary == pending->str)
+                continue; // A single package bigger than a part
+            cut = boundary - pending->str;
+        }
+
+        cr_FilelistsPart *part = g_new0(cr_FilelistsPart, 1);
+        part->xml = g_string_sized_new(cut + sizeof(PART_OPEN PART_CLOSE));
+        if (!first)
+            g_string_append(part->xml, PART_OPEN);
+        g_string_append_len(part->xml, pending->str, cut);
+        if (!eof)
+            g_string_append(part->xml, PART_CLOSE);
+        g_string_erase(pending, 0, cut);
+        first = FALSE;
+
+        g_queue_push_tail(&parts, part);
+        g_thread_pool_push(pool, part, NULL);
+
+        // Keep a bounded number of the parts in the memory
+        ret = cr_filelists_parts_flush(&parts, &shared,
+                                       eof ? 0 : 2 * threads,
+                                       newpkgcb, newpkgcb_data,
+                                       pkgcb, pkgcb_data, err);
+        if (ret != CRE_OK)
+            break;
+    }
+
+    // Wait for the threads and drop the unfinished work on an error
+    g_thread_pool_free(pool, ret != CRE_OK, TRUE);
+    for (GList *elem = parts.head; elem; elem = g_list_next(elem))
+        cr_filelists_part_free(elem->data);
+    g_queue_clear(&parts);
+
+    g_string_free(pending, TRUE);
+    g_free(block);
+    g_mutex_clear(&shared.mutex);
+    g_cond_clear(&shared.cond);
+
+    if (ret == CRE_OK) {
+        cr_close(f, &tmp_err);
+        if (tmp_err) {
+            ret = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err, "Error while closing: ");
+        }
+    } else {
+        cr_close(f, NULL);
+    }
+
+    return ret;
+}
+
+/* Fast scanner
+ * A specialized scanner for the filelists.xml in the form generated by
+ * createrepo. It doesn't build the attribute arrays, the strings are
+ * decoded right into a reused buffer and inserted into the package chunk.
+ * Any part of the file which contains something unexpected (comments
+ * inside of a package, unknown elements or values that need
+ * a normalization, ...) is passed to libxml2, so the results are
+ * the same as with the cr_xml_parse_filelists().
+ */
+
+typedef enum {
+    SCAN_OK,        /*!< Item was scanned */
+    SCAN_MORE,      /*!< More data are needed */
+    SCAN_FAIL,      /*!< Unexpected content */
+} cr_ScanResult;
+
+typedef enum {
+    SCAN_PKGID,
+    SCAN_NAME,
+    SCAN_ARCH,
+    SCAN_PKG_ATTRS,
+} cr_ScanPkgAttr;
+
+typedef enum {
+    SCAN_EPOCH,
+    SCAN_VER,
+    SCAN_REL,
+    SCAN_VERSION_ATTRS,
+} cr_ScanVersionAttr;
+
+static const char * const scan_pkg_attrs[]      = { "pkgid", "name", "arch", NULL };
+static const char * const scan_version_attrs[]  = { "epoch", "ver", "rel", NULL };
+static const char * const scan_file_attrs[]     = { "type", NULL };
+static const char * const scan_no_attrs[]       = { NULL };
+
+typedef struct {
+    gsize path;             /*!< Offset of the path in the buf */
+    char *type;             /*!< NULL (file), "dir" or "ghost" */
+} cr_ScanFile;
+
+typedef struct {
+    cr_XmlParserNewPkgCb newpkgcb;
+    void *newpkgcb_data;
+    cr_XmlParserPkgCb pkgcb;
+    void *pkgcb_data;
+    cr_XmlParserWarningCb warningcb;
+    void *warningcb_data;
+
+    GString *buf;           /*!< Decoded strings of the current package */
+    GArray *files;          /*!< cr_ScanFile items of the current package */
+    gssize pkg[SCAN_PKG_ATTRS];         /*!< Offsets of attrs or -1 */
+    gssize version[SCAN_VERSION_ATTRS]; /*!< Offsets of attrs or -1 */
+
+    cr_Package *pending;    /*!< Package from the newpkgcb whose content
+                                 couldn't be scanned, for the libxml2 parser */
+    cr_Package *handed;     /*!< The pending package given to the libxml2
+                                 parser, not passed to the pkgcb yet */
+
+    gboolean started;       /*!< The <filelists> start tag was scanned */
+    gboolean finished;      /*!< The </filelists> end tag was found */
+    gboolean fallback;      /*!< Unexpected start, use libxml2 for all */
+} cr_FilelistsScanner;
+
+#define SCAN_CHAR_TEXT      0x01    /*!< Plain character of a text */
+#define SCAN_CHAR_ATTR      0x02    /*!< Plain character of an attr value */
+
+/** Classes of characters (SCAN_CHAR_* flags) */
+static guchar scan_chars[256];
+
+static void
+scan_chars_init(void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        for (int c = 0; c < 256; c++) {
+            guchar flags = 0;
+            if (c >= 0x20 && c != '&' && c != '<') {
+                if (c != '>')
+                    flags |= SCAN_CHAR_TEXT;
+                if (c != '"' && c != '\'')
+                    flags |= SCAN_CHAR_ATTR;
+            }
+            scan_chars[c] = flags;
+        }
+        scan_chars['\t'] |= SCAN_CHAR_TEXT;
+        scan_chars['\n'] |= SCAN_CHAR_TEXT;
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+static inline gboolean
+scan_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline const char *
+scan_skip_space(const char *s, const char *end)
+{
+    while (s < end && scan_is_space(*s))
+        s++;
+    return s;
+}
+
+/** Names with non-ASCII characters are not expected */
+static inline const char *
+scan_name_end(const char *s, const char *end)
+{
+    while (s < end && (g_ascii_isalnum(*s) || *s == '_' || *s == '-'
+                       || *s == ':' || *s == '.'))
+        s++;
+    return s;
+}
+
+/** Check that s starts with the prefix. */
+static cr_ScanResult
+scan_prefix(const char *s, const char *end, const char *prefix)
+{
+    gsize len = strlen(prefix);
+    gsize avail = end - s;
+
+    if (memcmp(s, prefix, MIN(len, avail)))
+        return SCAN_FAIL;
+    return (avail < len) ? SCAN_MORE : SCAN_OK;
+}
+
+/** Check that s starts with the tag ("<name" or "</name") followed
+ * by a character which cannot be a part of the name.
+ */
+static cr_ScanResult
+scan_tag(const char *s, const char *end, const char *tag)
+{
+    cr_ScanResult ret = scan_prefix(s, end, tag);
+    if (ret != SCAN_OK)
+        return ret;
+    s += strlen(tag);
+    if (s == end)
+        return SCAN_MORE;
+    return (scan_name_end(s, end) == s) ? SCAN_OK : SCAN_FAIL;
+}
+
+static inline gboolean
+scan_is_xml_char(gunichar c)
+{
+    return c == 0x9 || c == 0xA || c == 0xD
+           || (c >= 0x20 && c <= 0xD7FF)
+           || (c >= 0xE000 && c <= 0xFFFD)
+           || (c >= 0x10000 && c <= 0x10FFFF);
+}
+
+/** Decode the entity or the character reference at *s into the buf. */
+static cr_ScanResult
+scan_entity(GString *buf, const char **s, const char *end)
+{
+    const char *name = *s + 1;
+    gsize avail = end - name;
+    const char *semicolon = memchr(name, ';', MIN(avail, 10));
+
+    if (!semicolon)
+        return (avail < 10) ? SCAN_MORE : SCAN_FAIL;
+
+    gsize len = semicolon - name;
+    if (len == 2 && !memcmp(name, "lt", 2)) {
+        g_string_append_c(buf, '<');
+    } else if (len == 2 && !memcmp(name, "gt", 2)) {
+        g_string_append_c(buf, '>');
+    } else if (len == 3 && !memcmp(name, "amp", 3)) {
+        g_string_append_c(buf, '&');
+    } else if (len == 4 && !memcmp(name, "quot", 4)) {
+        g_string_append_c(buf, '"');
+    } else if (len == 4 && !memcmp(name, "apos", 4)) {
+        g_string_append_c(buf, '\'');
+    } else if (len > 1 && name[0] == '#') {
+        gboolean hex = (name[1] == 'x');
+        const char *digits = name + (hex ? 2 : 1);
+        gunichar c = 0;
+
+        if (digits == semicolon)
+            return SCAN_FAIL;
+        for (const char *d = digits; d < semicolon; d++) {
+            int val = hex ? g_ascii_xdigit_value(*d) : g_ascii_digit_value(*d);
+            if (val < 0)
+                return SCAN_FAIL;
+            c = c * (hex ? 16 : 10) + val;
+        }
+        if (!scan_is_xml_char(c))
+            return SCAN_FAIL;
+
+        char utf8[6];
+        g_string_append_len(buf, utf8, g_unichar_to_utf8(c, utf8));
+    } else {
+        return SCAN_FAIL;
+    }
+
+    *s = semicolon + 1;
+    return SCAN_OK;
+}
+
+/** Decode an attribute value (up to the quote) or a text content
+ * (quote is 0, up to the next '<') into the buf as a NUL-terminated
+ * string. Values that would be normalized by a XML parser and
+ * references in attribute values are unexpected.
+ */
+static cr_ScanResult
+scan_value(GString *buf, const char **p, const char *end, char quote)
+{
+    const char *s = *p;
+    const char *run = s;
+    gsize start = buf->len;
+    guchar mask = quote ? SCAN_CHAR_ATTR : SCAN_CHAR_TEXT;
+    guchar high = 0;
+
+    while (s < end) {
+        guchar c = *s;
+
+        if (scan_chars[c] & mask) {
+            high |= c;
+            s++;
+            continue;
+        }
+
+        if (!quote && c == '>') {
+            // "]]>" is not allowed in a text content
+            if (s - *p >= 2 && s[-1] == ']' && s[-2] == ']')
+                return SCAN_FAIL;
+            s++;
+            continue;
+        }
+
+        if (quote && (c == '"' || c == '\'') && c != (guchar) quote) {
+            s++;
+            continue;
+        }
+
+        g_string_append_len(buf, run, s - run);
+
+        if (c == '&') {
+            // libxml2 keeps some references in attribute values
+            if (quote)
+                return SCAN_FAIL;
+            cr_ScanResult ret = scan_entity(buf, &s, end);
+            if (ret != SCAN_OK)
+                return ret;
+            run = s;
+            continue;
+        }
+
+        if ((quote && c == (guchar) quote) || (!quote && c == '<')) {
+            // Only non-ASCII values need the UTF-8 validation
+            if ((high & 0x80)
+                && !g_utf8_validate(buf->str + start, buf->len - start, NULL))
+                return SCAN_FAIL;
+            g_string_append_c(buf, '\0');
+            *p = quote ? s + 1 : s;
+            return SCAN_OK;
+        }
+
+        return SCAN_FAIL; // '<' in attribute value or a control character
+    }
+
+    return SCAN_MORE;
+}
+
+/** Scan attributes of a start tag up to its end. Values of the attributes
+ * from the names are stored into the buf, their offsets into the values.
+ */
+static cr_ScanResult
+scan_attrs(GString *buf,
+           const char **p,
+           const char *end,
+           const char * const *names,
+           gssize *values,
+           gboolean *empty)
+{
+    const char *s = *p;
+    cr_ScanResult ret;
+
+    for (int x = 0; names[x]; x++)
+        values[x] = -1;
+
+    while (1) {
+        const char *space = s;
+        s = scan_skip_space(s, end);
+        if (s == end)
+            return SCAN_MORE;
+
+        if (*s == '>') {
+            *empty = FALSE;
+            *p = s + 1;
+            return SCAN_OK;
+        }
+
+        if (*s == '/') {
+            if (s + 1 == end)
+                return SCAN_MORE;
+            if (s[1] != '>')
+                return SCAN_FAIL;
+            *empty = TRUE;
+            *p = s + 2;
+            return SCAN_OK;
+        }
+
+        if (s == space)
+            return SCAN_FAIL; // Attributes must be separated by a space
+
+        const char *name = s;
+        s = scan_name_end(s, end);
+        gsize name_len = s - name;
+        s = scan_skip_space(s, end);
+        if (s == end)
+            return SCAN_MORE;
+        if (!name_len || *s != '=')
+            return SCAN_FAIL;
+        s = scan_skip_space(s + 1, end);
+        if (s == end)
+            return SCAN_MORE;
+        if (*s != '"' && *s != '\'')
+            return SCAN_FAIL;
+        char quote = *s++;
+
+        int idx = -1;
+        for (int x = 0; names[x]; x++)
+            if (strlen(names[x]) == name_len
+                && !memcmp(names[x], name, name_len))
+            {
+                idx = x;
+                break;
+            }
+
+        if (idx < 0) {
+            // Unknown attribute, its value is only checked
+            gsize len = buf->len;
+            ret = scan_value(buf, &s, end, quote);
+            g_string_truncate(buf, len);
+        } else if (values[idx] >= 0) {
+            return SCAN_FAIL; // Duplicated attribute
+        } else {
+            values[idx] = buf->len;
+            ret = scan_value(buf, &s, end, quote);
+        }
+
+        if (ret != SCAN_OK)
+            return ret;
+    }
+}
+
+/** Scan the end tag of the element */
+static cr_ScanResult
+scan_end_tag(const char **p, const char *end, const char *tag)
+{
+    cr_ScanResult ret = scan_tag(*p, end, tag);
+    if (ret != SCAN_OK)
+        return ret;
+
+    const char *s = scan_skip_space(*p + strlen(tag), end);
+    if (s == end)
+        return SCAN_MORE;
+    if (*s != '>')
+        return SCAN_FAIL;
+
+    *p = s + 1;
+    return SCAN_OK;
+}
+
+/** Find the end of the package element whose content starts at s,
+ * without interpreting the content. Other markup than elements
+ * (comments, CDATA, ...) is unexpected.
+ * @param s             Content of the package element
+ * @param end           End of the data
+ * @param pkg_end       End of the package element if SCAN_OK
+ * @return              cr_ScanResult
+ */
+static cr_ScanResult
+scan_package_end(const char *s, const char *end, const char **pkg_end)
+{
+    cr_ScanResult ret;
+
+    // '<' cannot be a part of a text or of an attribute value
+    while ((s = memchr(s, '<', end - s))) {
+        if (end - s < 2)
+            return SCAN_MORE;
+        if (s[1] == '!' || s[1] == '?')
+            return SCAN_FAIL;
+        ret = scan_tag(s, end, "</package");
+        if (ret == SCAN_OK) {
+            ret = scan_end_tag(&s, end, "</package");
+            if (ret == SCAN_OK)
+                *pkg_end = s;
+            return ret;
+        }
+        if (ret == SCAN_MORE)
+            return ret;
+        s++;
+    }
+
+    return SCAN_MORE;
+}
+
+/** Scan the start tag of the package element at *p and find the end
+ * of the element, so the package can be skipped if it isn't wanted.
+ * @param sc            Scanner
+ * @param p             Start of the element, the content on SCAN_OK
+ * @param end           End of the data
+ * @param pkg_end       End of the package element if SCAN_OK
+ * @return              cr_ScanResult
+ */
+static cr_ScanResult
+scan_package_start(cr_FilelistsScanner *sc,
+                   const char **p,
+                   const char *end,
+                   const char **pkg_end)
+{
+    const char *s = *p + strlen("<package");
+    gboolean empty;
+    cr_ScanResult ret;
+
+    g_string_truncate(sc->buf, 0);
+    g_array_set_size(sc->files, 0);
+    for (int x = 0; x < SCAN_VERSION_ATTRS; x++)
+        sc->version[x] = -1;
+
+    ret = scan_attrs(sc->buf, &s, end, scan_pkg_attrs, sc->pkg, &empty);
+    if (ret != SCAN_OK)
+        return ret;
+
+    // libxml2 parser reports missing attributes
+    if (sc->pkg[SCAN_PKGID] < 0 || sc->pkg[SCAN_NAME] < 0
+        || sc->pkg[SCAN_ARCH] < 0)
+        return SCAN_FAIL;
+
+    if (empty) {
+        *pkg_end = s;
+    } else {
+        ret = scan_package_end(s, end, pkg_end);
+        if (ret != SCAN_OK)
+            return ret;
+    }
+
+    *p = s;
+    return SCAN_OK;
+}
+
+/** Scan the content of the package element at *p, whose end was already
+ * found by the scan_package_start().
+ */
+static cr_ScanResult
+scan_package_body(cr_FilelistsScanner *sc,
+                  const char **p,
+                  const char *end,
+                  const char *pkg_end)
+{
+    const char *s = *p;
+    gboolean empty = (s == pkg_end);
+    cr_ScanResult ret;
+
+    while (!empty) {
+        s = scan_skip_space(s, end);
+        if (end - s < (gssize) strlen("</package>"))
+            return SCAN_MORE;
+
+        if (scan_tag(s, end, "<file") == SCAN_OK) {
+            gssize type;
+            cr_ScanFile file = { 0, NULL };
+
+            s += strlen("<file");
+            ret = scan_attrs(sc->buf, &s, end, scan_file_attrs, &type, &empty);
+            if (ret != SCAN_OK)
+                return ret;
+            if (empty)
+                return SCAN_FAIL;
+            if (type >= 0) {
+                const char *val = sc->buf->str + type;
+                cr_PackageFileType ftype = cr_package_file_type_from_str(val);
+                if (ftype != CR_FILE_TYPE_DIR && ftype != CR_FILE_TYPE_GHOST)
+                    return SCAN_FAIL; // libxml2 parser warns about it
+                file.type = (char *) cr_package_file_type_str(ftype);
+                g_string_truncate(sc->buf, type);
+            }
+
+            file.path = sc->buf->len;
+            ret = scan_value(sc->buf, &s, end, 0);
+            if (ret == SCAN_OK)
+                ret = scan_end_tag(&s, end, "</file");
+            if (ret != SCAN_OK)
+                return ret;
+            g_array_append_val(sc->files, file);
+            empty = FALSE;
+
+        } else if (scan_tag(s, end, "<version") == SCAN_OK) {
+            gssize version[SCAN_VERSION_ATTRS];
+
+            s += strlen("<version");
+            ret = scan_attrs(sc->buf, &s, end, scan_version_attrs,
+                             version, &empty);
+            if (ret != SCAN_OK)
+                return ret;
+            if (!empty) {
+                s = scan_skip_space(s, end);
+                ret = scan_end_tag(&s, end, "</version");
+                if (ret != SCAN_OK)
+                    return ret;
+            }
+            empty = FALSE;
+
+            // The first present value is used
+            for (int x = 0; x < SCAN_VERSION_ATTRS; x++)
+                if (sc->version[x] < 0)
+                    sc->version[x] = version[x];
+
+        } else {
+            ret = scan_end_tag(&s, end, "</package");
+            if (ret != SCAN_OK)
+                return ret;
+            break;
+        }
+    }
+
+    if (s != pkg_end)
+        return SCAN_FAIL;
+
+    *p = s;
+    return SCAN_OK;
+}
+
+/** Get the package object for the scanned start tag from the newpkgcb.
+ * *pkg is NULL if the package should be skipped.
+ */
+static int
+scan_package_new(cr_FilelistsScanner *sc, cr_Package **pkg, GError **err)
+{
+    char *str = sc->buf->str;
+    GError *tmp_err = NULL;
+
+    *pkg = NULL;
+    if (sc->newpkgcb(pkg, str + sc->pkg[SCAN_PKGID], str + sc->pkg[SCAN_NAME],
+                     str + sc->pkg[SCAN_ARCH], sc->newpkgcb_data, &tmp_err)) {
+        if (tmp_err)
+            g_propagate_prefixed_error(err, tmp_err, "Parsing interrupted: ");
+        else
+            g_set_error(err, ERR_DOMAIN, CRE_CBINTERRUPTED,
+                        "Parsing interrupted");
+        return CRE_CBINTERRUPTED;
+    } else {
+        // If callback return CRE_OK but it simultaneously set
+        // the tmp_err then it's a programming error.
+        assert(tmp_err == NULL);
+    }
+
+    return CRE_OK;
+}
+
+/** Pass the scanned package to the callbacks. */
+static int
+scan_package_deliver(cr_FilelistsScanner *sc, cr_Package *pkg, GError **err)
+{
+    char *str = sc->buf->str;
+    const char *pkgId = str + sc->pkg[SCAN_PKGID];
+    const char *name = str + sc->pkg[SCAN_NAME];
+    const char *arch = str + sc->pkg[SCAN_ARCH];
+    GError *tmp_err = NULL;
+
+    if (!pkg->pkgId)
+        pkg->pkgId = g_string_chunk_insert(pkg->chunk, pkgId);
+    if (!pkg->name)
+        pkg->name = g_string_chunk_insert(pkg->chunk, name);
+    if (!pkg->arch)
+        pkg->arch = cr_xml_parser_intern(pkg, arch);
+
+#define SCAN_VERSION_VAL(x) \
+    (sc->version[x] >= 0 ? str + sc->version[x] : NULL)
+    if (!pkg->epoch)
+        pkg->epoch = cr_xml_parser_intern(pkg, SCAN_VERSION_VAL(SCAN_EPOCH));
+    if (!pkg->version)
+        pkg->version = cr_xml_parser_intern(pkg, SCAN_VERSION_VAL(SCAN_VER));
+    if (!pkg->release)
+        pkg->release = cr_xml_parser_intern(pkg, SCAN_VERSION_VAL(SCAN_REL));
+#undef SCAN_VERSION_VAL
+
+    GSList *files = NULL;
+    for (guint x = sc->files->len; x > 0; x--) {
+        cr_ScanFile *file = &g_array_index(sc->files, cr_ScanFile, x - 1);
+        char *path = str + file->path;
+        char *filename = cr_get_filename(path);
+
+        cr_PackageFile *pkg_file = cr_package_new_file(pkg);
+        pkg_file->name = cr_xml_parser_intern(pkg, filename);
+        *filename = '\0';
+        pkg_file->path = cr_safe_string_chunk_insert_const(pkg->chunk, path);
+        pkg_file->type = file->type;
+        files = cr_package_list_prepend(pkg, files, pkg_file);
+    }
+    pkg->files = g_slist_concat(pkg->files, files);
+
+    if (sc->pkgcb && sc->pkgcb(pkg, sc->pkgcb_data, &tmp_err)) {
+        if (tmp_err)
+            g_propagate_prefixed_error(err, tmp_err, "Parsing interrupted: ");
+        else
+            g_set_error(err, ERR_DOMAIN, CRE_CBINTERRUPTED,
+                        "Parsing interrupted");
+        return CRE_CBINTERRUPTED;
+    } else {
+        assert(tmp_err == NULL);
+    }
+
+    return CRE_OK;
+}
+
+/** Find the end of the element (or of other markup) at s without
+ * interpreting it. Returns NULL if the end is not in the data.
+ */
+static const char *
+scan_element_end(const char *s, const char *end)
+{
+    int depth = 0;
+
+    while (s < end) {
+        if (*s != '<') {
+            // Text content
+            s = memchr(s, '<', end - s);
+            if (!s)
+                return NULL;
+            continue;
+        }
+
+        const char *markup_end;
+        if (scan_prefix(s, end, "<!--") == SCAN_OK) {
+            markup_end = g_strstr_len(s, end - s, "-->");
+            if (!markup_end)
+                return NULL;
+            s = markup_end + 3;
+        } else if (scan_prefix(s, end, "<![CDATA[") == SCAN_OK) {
+            markup_end = g_strstr_len(s, end - s, "]]>");
+            if (!markup_end)
+                return NULL;
+            s = markup_end + 3;
+        } else if (scan_prefix(s, end, "<?") == SCAN_OK) {
+            markup_end = g_strstr_len(s, end - s, "?>");
+            if (!markup_end)
+                return NULL;
+            s = markup_end + 2;
+        } else {
+            // A tag, '>' could be a part of an attribute value
+            gboolean end_tag = (s + 1 < end && s[1] == '/');
+            char quote = 0;
+            for (s++; s < end && (quote || *s != '>'); s++)
+                if (quote ? *s == quote : (*s == '"' || *s == '\''))
+                    quote = quote ? 0 : *s;
+            if (s == end)
+                return NULL;
+            if (end_tag)
+                depth--;
+            else if (s[-1] != '/')
+                depth++;
+            s++;
+        }
+
+        if (depth <= 0)
+            return s;
+    }
+
+    return NULL;
+}
+
+/** The newpkgcb of the libxml2 parser gets the pending package (it's
+ * the first package of the parsed part) instead of a new one.
+ */
+static int
+scan_fallback_newpkgcb(cr_Package **pkg,
+                       const char *pkgId,
+                       const char *name,
+                       const char *arch,
+                       void *cbdata,
+                       GError **err)
+{
+    cr_FilelistsScanner *sc = cbdata;
+
+    if (sc->pending) {
+        *pkg = sc->handed = sc->pending;
+        sc->pending = NULL;
+        return CR_CB_RET_OK;
+    }
+
+    return sc->newpkgcb(pkg, pkgId, name, arch, sc->newpkgcb_data, err);
+}
+
+static int
+scan_fallback_pkgcb(cr_Package *pkg, void *cbdata, GError **err)
+{
+    cr_FilelistsScanner *sc = cbdata;
+
+    if (pkg == sc->handed)
+        sc->handed = NULL;
+
+    if (!sc->pkgcb)
+        return CR_CB_RET_OK;
+    return sc->pkgcb(pkg, sc->pkgcb_data, err);
+}
+
+/** Parse the part of the file by the libxml2 parser. */
+static int
+scan_fallback(cr_FilelistsScanner *sc,
+              const char *xml,
+              gsize len,
+              GError **err)
+{
+    gchar *snippet = g_strndup(xml, len);
+    int ret;
+
+    if (!sc->pending) {
+        ret = cr_xml_parse_filelists_snippet(snippet,
+                                             sc->newpkgcb, sc->newpkgcb_data,
+                                             sc->pkgcb, sc->pkgcb_data,
+                                             sc->warningcb, sc->warningcb_data,
+                                             err);
+        g_free(snippet);
+        return ret;
+    }
+
+    ret = cr_xml_parse_filelists_snippet(snippet,
+                                         scan_fallback_newpkgcb, sc,
+                                         scan_fallback_pkgcb, sc,
+                                         sc->warningcb, sc->warningcb_data,
+                                         err);
+    g_free(snippet);
+
+    // Like the libxml2 parser, free the package on error only if it
+    // was created by the default newpkgcb
+    if (sc->newpkgcb == cr_newpkgcb) {
+        g_clear_pointer(&sc->pending, cr_package_free);
+        g_clear_pointer(&sc->handed, cr_package_free);
+    }
+    sc->pending = sc->handed = NULL;
+
+    return ret;
+}
+
+/** Scan the XML declaration and the <filelists> start tag. */
+static cr_ScanResult
+scan_prolog(const char **p, const char *end)
+{
+    const char *s = *p;
+    cr_ScanResult ret;
+    gboolean empty;
+
+    if (end - s < 3)
+        return SCAN_MORE;
+    if (!memcmp(s, "\xEF\xBB\xBF", 3))
+        s += 3;  // UTF-8 BOM
+    s = scan_skip_space(s, end);
+
+    ret = scan_prefix(s, end, "<?xml");
+    if (ret == SCAN_MORE)
+        return ret;
+    if (ret == SCAN_OK) {
+        const char *decl_end = g_strstr_len(s, end - s, "?>");
+        if (!decl_end)
+            return SCAN_MORE;
+
+        // Only UTF-8 encoded files are scanned
+        const char *enc = g_strstr_len(s, decl_end - s, "encoding");
+        if (enc) {
+            enc = scan_skip_space(enc + strlen("encoding"), decl_end);
+            if (enc == decl_end || *enc != '=')
+                return SCAN_FAIL;
+            enc = scan_skip_space(enc + 1, decl_end);
+            if (decl_end - enc < 7
+                || (*enc != '"' && *enc != '\'')
+                || g_ascii_strncasecmp(enc + 1, "utf-8", 5)
+                || enc[6] != *enc)
+                return SCAN_FAIL;
+        }
+        s = decl_end + 2;
+    }
+
+    while (1) {
+        s = scan_skip_space(s, end);
+        ret = scan_prefix(s, end, "<!--");
+        if (ret == SCAN_MORE || s == end)
+            return SCAN_MORE;
+        if (ret == SCAN_FAIL)
+            break;
+        const char *comment_end = g_strstr_len(s, end - s, "-->");
+        if (!comment_end)
+            return SCAN_MORE;
+        s = comment_end + 3;
+    }
+
+    ret = scan_tag(s, end, "<filelists");
+    if (ret != SCAN_OK)
+        return ret;
+
+    GString *tmp = g_string_new(NULL);
+    s += strlen("<filelists");
+    ret = scan_attrs(tmp, &s, end, scan_no_attrs, NULL, &empty);
+    g_string_free(tmp, TRUE);
+    if (ret == SCAN_OK && empty)
+        return SCAN_FAIL;
+    if (ret == SCAN_OK)
+        *p = s;
+    return ret;
+}
+
+/** Scan as much of the data as possible.
+ * @param sc            Scanner
+ * @param data          Data
+ * @param len           Length of the data
+ * @param eof           No more data will follow
+ * @param consumed      Length of the processed data
+ * @param err           GError **
+ * @return              cr_Error code
+ */
+static int
+scan_data(cr_FilelistsScanner *sc,
+          const char *data,
+          gsize len,
+          gboolean eof,
+          gsize *consumed,
+          GError **err)
+{
+    const char *p = data;
+    const char *end = data + len;
+    cr_ScanResult res;
+    int ret = CRE_OK;
+
+    if (!sc->started) {
+        res = scan_prolog(&p, end);
+        if (res == SCAN_MORE && !eof) {
+            *consumed = 0;
+            return CRE_OK;
+        }
+        if (res != SCAN_OK) {
+            sc->fallback = TRUE;
+            *consumed = 0;
+            return CRE_OK;
+        }
+        sc->started = TRUE;
+    }
+
+    while (!sc->finished) {
+        const char *item = scan_skip_space(p, end);
+        const char *region_end = NULL;
+
+        p = item;
+        if (item == end)
+            break;
+
+        res = scan_tag(item, end, "<package");
+        if (res == SCAN_OK) {
+            const char *s = item;
+            const char *pkg_end;
+            cr_Package *pkg;
+
+            res = scan_package_start(sc, &s, end, &pkg_end);
+            if (res == SCAN_OK) {
+                ret = scan_package_new(sc, &pkg, err);
+                if (ret != CRE_OK)
+                    break;
+                if (!pkg) {
+                    // Package should be skipped, its content is not scanned
+                    p = pkg_end;
+                    continue;
+                }
+                res = scan_package_body(sc, &s, end, pkg_end);
+                if (res == SCAN_OK) {
+                    p = s;
+                    ret = scan_package_deliver(sc, pkg, err);
+                    if (ret != CRE_OK)
+                        break;
+                    continue;
+                }
+                // The whole element is in the data, libxml2 parser gets it
+                sc->pending = pkg;
+                res = SCAN_FAIL;
+            }
+            if (res == SCAN_MORE && !eof)
+                break;
+            region_end = scan_element_end(item, end);
+        } else if (res == SCAN_MORE && !eof) {
+            break;
+        } else if (scan_tag(item, end, "</filelists") != SCAN_FAIL) {
+            // The rest of the file is not checked
+            sc->finished = TRUE;
+            p = end;
+            break;
+        } else if (scan_prefix(item, end, "<!--") == SCAN_OK) {
+            region_end = g_strstr_len(item, end - item, "-->");
+            if (region_end) {
+                p = region_end + 3;
+                continue;
+            }
+        } else if (*item != '<') {
+            // Text content
+            region_end = memchr(item, '<', end - item);
+        } else {
+            // Unknown element
+            region_end = scan_element_end(item, end);
+        }
+
+        if (!region_end) {
+            if (!eof)
+                break;
+            region_end = end;
+        }
+
+        ret = scan_fallback(sc, item, region_end - item, err);
+        if (ret != CRE_OK)
+            break;
+        p = region_end;
+    }
+
+    *consumed = p - data;
+    return ret;
+}
+
+int
+cr_xml_parse_filelists_fast(const char *path,
+                            cr_XmlParserNewPkgCb newpkgcb,
+                            void *newpkgcb_data,
+                            cr_XmlParserPkgCb pkgcb,
+                            void *pkgcb_data,
+                            cr_XmlParserWarningCb warningcb,
+                            void *warningcb_data,
+                            GError **err)
+{
+    int ret = CRE_OK;
+    CR_FILE *f;
+    cr_FilelistsScanner sc;
+    GError *tmp_err = NULL;
+
+    assert(path);
+    assert(newpkgcb || pkgcb);
+    assert(!err || *err == NULL);
+
+    f = cr_open(path, CR_CW_MODE_READ, CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+    if (tmp_err) {
+        int code = tmp_err->code;
+        g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ", path);
+        return code;
+    }
+
+    scan_chars_init();
+
+    memset(&sc, 0, sizeof(sc));
+    sc.newpkgcb         = newpkgcb ? newpkgcb : cr_newpkgcb;
+    sc.newpkgcb_data    = newpkgcb_data;
+    sc.pkgcb            = pkgcb;
+    sc.pkgcb_data       = pkgcb_data;
+    sc.warningcb        = warningcb;
+    sc.warningcb_data   = warningcb_data;
+    sc.buf              = g_string_sized_new(XML_BUFFER_SIZE);
+    sc.files            = g_array_new(FALSE, FALSE, sizeof(cr_ScanFile));
+
+    gsize block_size = cr_get_io_buffer_size();
+    gchar *block = g_malloc(block_size);
+    GString *pending = g_string_sized_new(2 * block_size);
+    gsize wanted = 0;
+    gboolean eof = FALSE;
+
+    while (!eof && !sc.finished && !sc.fallback) {
+        int len = cr_read(f, block, block_size, &tmp_err);
+        if (tmp_err) {
+            ret = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Error while reading %s: ", path);
+            break;
+        }
+
+        eof = (len == 0);
+        g_string_append_len(pending, block, len);
+
+        // An unfinished item is scanned again when the data at least
+        // doubled, so a huge package doesn't make the scanning quadratic
+        if (!eof && pending->len < wanted)
+            continue;
+
+        gsize consumed = 0;
+        ret = scan_data(&sc, pending->str, pending->len, eof, &consumed, err);
+        if (ret != CRE_OK)
+            break;
+        g_string_erase(pending, 0, consumed);
+        wanted = 2 * pending->len;
+    }
+
+    if (ret == CRE_OK && eof && !sc.finished && !sc.fallback) {
+        ret = CRE_XMLPARSER;
+        g_set_error(err, ERR_DOMAIN, CRE_XMLPARSER,
+                    "Premature end of %s", path);
+    }
+
+    g_string_free(pending, TRUE);
+    g_free(block);
+    g_string_free(sc.buf, TRUE);
+    g_array_free(sc.files, TRUE);
+
+    if (ret == CRE_OK) {
+        cr_close(f, &tmp_err);
+        if (tmp_err) {
+            ret = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err, "Error while closing: ");
+        }
+    } else {
+        cr_close(f, NULL);
+    }
+
+    if (ret == CRE_OK && sc.fallback)
+        return cr_xml_parse_filelists(path, newpkgcb, newpkgcb_data,
+                                      pkgcb, pkgcb_data,
+                                      warningcb, warningcb_data, err);
+
+    return ret;
+}
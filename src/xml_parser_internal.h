@@ -81,6 +81,9 @@ typedef struct _cr_ParserData {
     xmlParserCtxtPtr parser;    /*!< The parser */
     cr_StatesSwitch **swtab;    /*!< Pointers to statesswitches table */
     unsigned int    *sbtab;     /*!< stab[to_state] = from_state */
+    cr_StatesSwitch *switches;  /*!< The statesswitches table */
+    const xmlChar   **swnames;  /*!< swnames[x] = switches[x].ename
+                                     interned in the dict of the parser */
 
     /* Common stuf */
 
@@ -134,6 +137,23 @@ typedef struct _cr_ParserData {
     cr_ChangelogEntry *changelog; /*!<
         Changelog entry object for currently parsed element (entry) */
 
+    /* Raw xml related stuff (primary, filelists, other) */
+
+    gboolean store_raw; /*!<
+        Store the raw xml of each package element into the raw_primary,
+        raw_filelists or raw_other of the package. Works only with
+        cr_xml_parser_generic(). */
+    gboolean raw_only; /*!<
+        Store only the raw xml, the content of package elements is not
+        parsed (filelists and other only). Missing raw xml is an error. */
+    GString *raw; /*!<
+        Input which wasn't parsed yet plus the input of the currently
+        parsed package element */
+    gint64 raw_offset; /*!<
+        Offset of the raw->str in the input */
+    gint64 raw_start; /*!<
+        Offset of the currently parsed package element in the input or -1 */
+
     /* Repomd related stuff */
 
     cr_Repomd *repomd; /*!<
@@ -146,7 +166,12 @@ typedef struct _cr_ParserData {
     /* Updateinfo related stuff */
 
     cr_UpdateInfo *updateinfo; /*!<
-        Update info object */
+        Update info object (NULL if the updaterecordcb is used) */
+    cr_XmlParserUpdateRecordCb updaterecordcb; /*!<
+        Callback called when a single update record is completely parsed,
+        the records are not appended to the updateinfo then */
+    void *updaterecordcb_data; /*!<
+        User data for the updaterecordcb */
     cr_UpdateRecord *updaterecord; /*!<
         Update record object */
     cr_UpdateCollection *updatecollection; /*!<
@@ -166,6 +191,74 @@ cr_ParserData *cr_xml_parser_data();
  */
 void cr_xml_parser_data_free(cr_ParserData *pd);
 
+/** Set the states switches of the parser (pd->parser must be already
+ * created). The names of the elements are interned in the dictionary
+ * of the parser, so cr_xml_parser_switch() compares just the pointers.
+ * @param pd        Parser data
+ * @param switches  Table of the states switches terminated by an item
+ *                  with from == numstates
+ * @param numstates Number of states
+ */
+void cr_xml_parser_set_switches(cr_ParserData *pd,
+                                cr_StatesSwitch *switches,
+                                unsigned int numstates);
+
+/** Find the states switch of a sub element of the current state.
+ * libxml2 passes the names of the elements from the dictionary of the
+ * parser, so the names are compared by the pointers first, strcmp() is
+ * used only for the names which are not found that way.
+ * @param pd        Parser data (pd->swtab[pd->state] must not be NULL)
+ * @param element   Name of the element
+ * @return          The states switch or NULL for an unknown element
+ */
+static inline cr_StatesSwitch *
+cr_xml_parser_switch(cr_ParserData *pd, const xmlChar *element)
+{
+    cr_StatesSwitch *sw;
+    unsigned int state = pd->state;
+
+    for (sw = pd->swtab[state]; sw->from == state; sw++)
+        if (pd->swnames[sw - pd->switches] == element)
+            return sw;
+
+    for (sw = pd->swtab[state]; sw->from == state; sw++)
+        if (!strcmp((const char *) element, sw->ename))
+            return sw;
+
+    return NULL;
+}
+
+/** Insert a string which is often the same in many packages (arch,
+ * dependencies, licenses, ...) into the chunk of the package.
+ * The string is deduplicated if the package uses a chunk shared with
+ * other packages with interning enabled (CR_PACKAGE_INTERNED).
+ * @param pkg       Package
+ * @param str       String or NULL
+ * @return          Pointer to the string in the chunk or NULL
+ */
+static inline gchar *
+cr_xml_parser_intern(cr_Package *pkg, const char *str)
+{
+    if (!str)
+        return NULL;
+    if (pkg->loadingflags & CR_PACKAGE_INTERNED)
+        return g_string_chunk_insert_const(pkg->chunk, str);
+    return g_string_chunk_insert(pkg->chunk, str);
+}
+
+/** Same as cr_xml_parser_intern() but an empty string is not inserted.
+ * @param pkg       Package
+ * @param str       String or NULL
+ * @return          Pointer to the string in the chunk or NULL
+ */
+static inline gchar *
+cr_xml_parser_intern_null(cr_Package *pkg, const char *str)
+{
+    if (!str || *str == '\0')
+        return NULL;
+    return cr_xml_parser_intern(pkg, str);
+}
+
 /** Find attribute in list of attributes.
  * @param name      Attribute name.
  * @param attr      List of attributes of the tag
@@ -183,6 +276,61 @@ cr_find_attr(const char *name, const xmlChar **attr)
     return NULL;
 }
 
+/** Find several attributes in list of attributes by a single pass
+ * over the list. Like cr_find_attr() the first occurrence of an attribute
+ * is used.
+ * @param attr      List of attributes of the tag
+ * @param names     Names of wanted attributes
+ * @param values    Array of count items where the values (or NULLs)
+ *                  are stored
+ * @param count     Number of the names
+ */
+static inline void
+cr_find_attrs(const xmlChar **attr,
+              const char * const *names,
+              const char **values,
+              int count)
+{
+    for (int x = 0; x < count; x++)
+        values[x] = NULL;
+
+    while (attr && *attr) {
+        const char *name = (const char *) *attr;
+        for (int x = 0; x < count; x++) {
+            if (name[0] == names[x][0] && !strcmp(name, names[x])) {
+                if (!values[x])
+                    values[x] = (const char *) attr[1];
+                break;
+            }
+        }
+        attr += 2;
+    }
+}
+
+/** Fill the epoch, version and release of the package from attributes
+ * of a version element. Values which are already set (e.g. by a parser
+ * of another metadata file) are kept.
+ * @param pkg       Package
+ * @param attr      List of attributes of the version element
+ */
+static inline void
+cr_xml_parser_evr(cr_Package *pkg, const xmlChar **attr)
+{
+    static const char * const names[] = { "epoch", "ver", "rel" };
+    const char *values[3];
+
+    if (pkg->epoch && pkg->version && pkg->release)
+        return;
+
+    cr_find_attrs(attr, names, values, 3);
+    if (!pkg->epoch)
+        pkg->epoch = cr_xml_parser_intern(pkg, values[0]);
+    if (!pkg->version)
+        pkg->version = cr_xml_parser_intern(pkg, values[1]);
+    if (!pkg->release)
+        pkg->release = cr_xml_parser_intern(pkg, values[2]);
+}
+
 /** XML character handler
  */
 void cr_char_handler(void *pdata, const xmlChar *s, int len);
@@ -211,6 +359,60 @@ int cr_newpkgcb(cr_Package **pkg,
                 void *cbdata,
                 GError **err);
 
+/** Mark the beginning of a package element. Should be called from the start
+ * handler if the store_raw is enabled.
+ */
+void cr_xml_parser_raw_start(cr_ParserData *pd);
+
+/** Get the raw xml of the just parsed package element (from the "<package"
+ * to the "</package>" including) stored in the chunk of the pd->pkg.
+ * Should be called from the end handler if the store_raw is enabled.
+ * @return          Raw xml or NULL if not available
+ */
+char *cr_xml_parser_raw_end(cr_ParserData *pd);
+
+/** Parsers with the ability to store raw xml of the packages.
+ * See cr_xml_parse_primary(), cr_xml_parse_filelists() and
+ * cr_xml_parse_other() for the description of the arguments.
+ * If raw_only is TRUE, the packages get only their pkgId and raw xml.
+ */
+int
+cr_xml_parse_primary_internal(const char *target,
+                              cr_XmlParserNewPkgCb newpkgcb,
+                              void *newpkgcb_data,
+                              cr_XmlParserPkgCb pkgcb,
+                              void *pkgcb_data,
+                              cr_XmlParserWarningCb warningcb,
+                              void *warningcb_data,
+                              int do_files,
+                              gboolean store_raw,
+                              int (*parser_func)(xmlParserCtxtPtr, cr_ParserData *, const char *, GError**),
+                              GError **err);
+int
+cr_xml_parse_filelists_internal(const char *target,
+                                cr_XmlParserNewPkgCb newpkgcb,
+                                void *newpkgcb_data,
+                                cr_XmlParserPkgCb pkgcb,
+                                void *pkgcb_data,
+                                cr_XmlParserWarningCb warningcb,
+                                void *warningcb_data,
+                                gboolean store_raw,
+                                gboolean raw_only,
+                                int (*parser_func)(xmlParserCtxtPtr, cr_ParserData *, const char *, GError**),
+                                GError **err);
+int
+cr_xml_parse_other_internal(const char *target,
+                            cr_XmlParserNewPkgCb newpkgcb,
+                            void *newpkgcb_data,
+                            cr_XmlParserPkgCb pkgcb,
+                            void *pkgcb_data,
+                            cr_XmlParserWarningCb warningcb,
+                            void *warningcb_data,
+                            gboolean store_raw,
+                            gboolean raw_only,
+                            int (*parser_func)(xmlParserCtxtPtr, cr_ParserData *, const char *, GError**),
+                            GError **err);
+
 /** Generic parser.
  */
 int
@@ -0,0 +1,393 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+#include "error.h"
+#include "misc.h"
+#include "xml_parser.h"
+#include "xml_parser_internal.h"
+
+#define ERR_DOMAIN      CREATEREPO_C_ERROR
+
+/* Maximal number of packages a parser thread parses ahead of the consumer.
+ * Packages of filelists.xml and other.xml which are not in the order of
+ * primary.xml are kept aside and don't count into the limit.
+ */
+#define PARSE_AHEAD     256
+
+typedef enum {
+    ITER_PRI,
+    ITER_FIL,
+    ITER_OTH,
+    ITER_SENTINEL,
+} cr_PkgIteratorFile;
+
+static const char *iter_file_names[] = {
+    "primary.xml",
+    "filelists.xml",
+    "other.xml",
+};
+
+typedef struct {
+    cr_PkgIterator *iter;
+    cr_PkgIteratorFile file;
+    gchar *path;            /*!< NULL if the file is not parsed */
+    GThread *thread;        /*!< Parser thread */
+    GQueue queue;           /*!< Parsed packages, access under iter->mutex */
+    GHashTable *pending;    /*!< Packages parsed before they were needed
+                                 (key is pkgId), only used by the consumer */
+    gboolean finished;      /*!< Parser thread ended */
+    GError *err;            /*!< Error of the parser thread */
+} cr_PkgIteratorParser;
+
+struct _cr_PkgIterator {
+    GMutex mutex;
+    GCond cond;             /*!< Signals every change of the queues */
+    gboolean cancelled;     /*!< Parser threads should stop */
+    gboolean finished;      /*!< All packages were returned or an error
+                                 was reported */
+    cr_XmlParserWarningCb warningcb;
+    void *warningcb_data;
+    cr_PkgIteratorParser parsers[ITER_SENTINEL];
+};
+
+static int
+iterator_pkgcb(cr_Package *pkg, void *cbdata, GError **err)
+{
+    cr_PkgIteratorParser *parser = cbdata;
+    cr_PkgIterator *iter = parser->iter;
+
+    g_mutex_lock(&iter->mutex);
+    while (parser->queue.length >= PARSE_AHEAD && !iter->cancelled)
+        g_cond_wait(&iter->cond, &iter->mutex);
+
+    if (iter->cancelled) {
+        g_mutex_unlock(&iter->mutex);
+        cr_package_free(pkg);
+        g_set_error(err, ERR_DOMAIN, CRE_CBINTERRUPTED,
+                    "Iteration was cancelled");
+        return CR_CB_RET_ERR;
+    }
+
+    g_queue_push_tail(&parser->queue, pkg);
+    g_cond_broadcast(&iter->cond);
+    g_mutex_unlock(&iter->mutex);
+
+    return CR_CB_RET_OK;
+}
+
+static gpointer
+iterator_parser_thread(gpointer data)
+{
+    cr_PkgIteratorParser *parser = data;
+    cr_PkgIterator *iter = parser->iter;
+    GError *tmp_err = NULL;
+
+    // The packages are created by cr_newpkgcb() and the pkgcb owns them
+    switch (parser->file) {
+        case ITER_PRI:
+            cr_xml_parse_primary(parser->path, NULL, NULL,
+                                 iterator_pkgcb, parser,
+                                 iter->warningcb, iter->warningcb_data,
+                                 iter->parsers[ITER_FIL].path ? 0 : 1,
+                                 &tmp_err);
+            break;
+        case ITER_FIL:
+            cr_xml_parse_filelists_fast(parser->path, NULL, NULL,
+                                        iterator_pkgcb, parser,
+                                        iter->warningcb, iter->warningcb_data,
+                                        &tmp_err);
+            break;
+        default:
+            cr_xml_parse_other(parser->path, NULL, NULL,
+                               iterator_pkgcb, parser,
+                               iter->warningcb, iter->warningcb_data,
+                               &tmp_err);
+            break;
+    }
+
+    g_mutex_lock(&iter->mutex);
+    parser->finished = TRUE;
+    parser->err = tmp_err;
+    g_cond_broadcast(&iter->cond);
+    g_mutex_unlock(&iter->mutex);
+
+    return NULL;
+}
+
+/** Pop the next parsed package of the file, wait for it if necessary.
+ * Must be called with the iter->mutex locked.
+ * @return      Package or NULL if the parser ended
+ */
+static cr_Package *
+iterator_pop(cr_PkgIterator *iter, cr_PkgIteratorParser *parser)
+{
+    cr_Package *pkg;
+
+    while (!parser->queue.length && !parser->finished)
+        g_cond_wait(&iter->cond, &iter->mutex);
+
+    pkg = g_queue_pop_head(&parser->queue);
+    if (pkg)
+        g_cond_broadcast(&iter->cond);
+    return pkg;
+}
+
+/** Find the package with the pkgId in filelists.xml or other.xml.
+ * The files are usually in the same order as the primary.xml, so the
+ * package is the next parsed one. Packages preceding it are kept
+ * in the parser->pending until the primary.xml gets to them.
+ * Must be called with the iter->mutex locked.
+ * @return      Package or NULL if the package is not in the file
+ */
+static cr_Package *
+iterator_find(cr_PkgIterator *iter,
+              cr_PkgIteratorParser *parser,
+              const char *pkgId)
+{
+    cr_Package *pkg;
+
+    if (g_hash_table_size(parser->pending)) {
+        pkg = g_hash_table_lookup(parser->pending, pkgId);
+        if (pkg) {
+            g_hash_table_steal(parser->pending, pkgId);
+            return pkg;
+        }
+    }
+
+    while ((pkg = iterator_pop(iter, parser))) {
+        if (!g_strcmp0(pkg->pkgId, pkgId))
+            return pkg;
+
+        if (!pkg->pkgId || g_hash_table_lookup(parser->pending, pkg->pkgId))
+            // Data of a package with the same checksum were already parsed
+            cr_package_free(pkg);
+        else
+            g_hash_table_insert(parser->pending, pkg->pkgId, pkg);
+    }
+
+    return NULL;
+}
+
+/** Move files or changelogs of the tpkg into the pkg.
+ * The strings are copied into the chunk of the pkg because the tpkg
+ * (and its chunk) is freed.
+ */
+static void
+iterator_merge(cr_Package *pkg, cr_Package *tpkg, cr_PkgIteratorFile file)
+{
+    GStringChunk *chunk = pkg->chunk;
+
+    if (file == ITER_FIL) {
+        pkg->loadingflags |= CR_PACKAGE_LOADED_FIL;
+        pkg->files = g_slist_concat(pkg->files, tpkg->files);
+        tpkg->files = NULL;
+        for (GSList *elem = pkg->files; elem; elem = g_slist_next(elem)) {
+            cr_PackageFile *entry = elem->data;
+            entry->type = cr_safe_string_chunk_insert_const(chunk, entry->type);
+            entry->path = cr_safe_string_chunk_insert_const(chunk, entry->path);
+            entry->name = cr_safe_string_chunk_insert(chunk, entry->name);
+        }
+    } else {
+        pkg->loadingflags |= CR_PACKAGE_LOADED_OTH;
+        pkg->changelogs = g_slist_concat(pkg->changelogs, tpkg->changelogs);
+        tpkg->changelogs = NULL;
+        for (GSList *elem = pkg->changelogs; elem; elem = g_slist_next(elem)) {
+            cr_ChangelogEntry *entry = elem->data;
+            entry->author = cr_safe_string_chunk_insert(chunk, entry->author);
+            entry->changelog = cr_safe_string_chunk_insert(chunk,
+                                                           entry->changelog);
+        }
+    }
+
+    cr_package_free(tpkg);
+}
+
+static void
+iterator_stop(cr_PkgIterator *iter)
+{
+    g_mutex_lock(&iter->mutex);
+    iter->cancelled = TRUE;
+    g_cond_broadcast(&iter->cond);
+    g_mutex_unlock(&iter->mutex);
+
+    for (int x = 0; x < ITER_SENTINEL; x++) {
+        cr_PkgIteratorParser *parser = &iter->parsers[x];
+        if (parser->thread)
+            g_thread_join(parser->thread);
+        parser->thread = NULL;
+    }
+}
+
+cr_PkgIterator *
+cr_pkg_iterator_new(const char *primary_path,
+                    const char *filelists_path,
+                    const char *other_path,
+                    cr_XmlParserWarningCb warningcb,
+                    void *warningcb_data,
+                    GError **err)
+{
+    const char *paths[] = { primary_path, filelists_path, other_path };
+    cr_PkgIterator *iter;
+
+    assert(primary_path);
+    assert(!err || *err == NULL);
+
+    for (int x = 0; x < ITER_SENTINEL; x++) {
+        if (paths[x] && !g_file_test(paths[x], G_FILE_TEST_IS_REGULAR)) {
+            g_set_error(err, ERR_DOMAIN, CRE_NOFILE,
+                        "File %s doesn't exist or is not a regular file",
+                        paths[x]);
+            return NULL;
+        }
+    }
+
+    // libxml2 must be initialized before it is used from multiple threads
+    xmlInitParser();
+
+    iter = g_new0(cr_PkgIterator, 1);
+    g_mutex_init(&iter->mutex);
+    g_cond_init(&iter->cond);
+    iter->warningcb = warningcb;
+    iter->warningcb_data = warningcb_data;
+
+    for (int x = 0; x < ITER_SENTINEL; x++) {
+        cr_PkgIteratorParser *parser = &iter->parsers[x];
+        parser->iter = iter;
+        parser->file = x;
+        parser->path = g_strdup(paths[x]);
+        g_queue_init(&parser->queue);
+        parser->pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                                (GDestroyNotify) cr_package_free);
+    }
+
+    for (int x = 0; x < ITER_SENTINEL; x++) {
+        cr_PkgIteratorParser *parser = &iter->parsers[x];
+        GError *tmp_err = NULL;
+
+        if (!parser->path)
+            continue;
+
+        parser->thread = g_thread_try_new(NULL, iterator_parser_thread,
+                                          parser, &tmp_err);
+        if (!parser->thread) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot create a thread parsing %s: ",
+                                       iter_file_names[x]);
+            cr_pkg_iterator_free(iter);
+            return NULL;
+        }
+    }
+
+    return iter;
+}
+
+cr_Package *
+cr_pkg_iterator_next(cr_PkgIterator *iter, GError **err)
+{
+    cr_PkgIteratorParser *pri = &iter->parsers[ITER_PRI];
+    cr_Package *pkg, *tpkgs[ITER_SENTINEL] = { NULL };
+
+    assert(iter);
+    assert(!err || *err == NULL);
+
+    if (iter->finished)
+        return NULL;
+
+    g_mutex_lock(&iter->mutex);
+
+    pkg = iterator_pop(iter, pri);
+    if (!pkg) {
+        iter->finished = TRUE;
+        if (pri->err) {
+            g_propagate_prefixed_error(err, pri->err, "%s parsing: ",
+                                       iter_file_names[ITER_PRI]);
+            pri->err = NULL;
+        }
+        g_mutex_unlock(&iter->mutex);
+        return NULL;
+    }
+
+    for (int x = ITER_FIL; x < ITER_SENTINEL; x++) {
+        cr_PkgIteratorParser *parser = &iter->parsers[x];
+
+        if (!parser->path)
+            continue;
+
+        tpkgs[x] = iterator_find(iter, parser, pkg->pkgId);
+        if (!tpkgs[x] && parser->err) {
+            // The package could be in the unparsed rest of the file
+            iter->finished = TRUE;
+            g_propagate_prefixed_error(err, parser->err, "%s parsing: ",
+                                       iter_file_names[x]);
+            parser->err = NULL;
+            break;
+        }
+    }
+
+    g_mutex_unlock(&iter->mutex);
+
+    if (iter->finished) {
+        for (int x = ITER_FIL; x < ITER_SENTINEL; x++)
+            cr_package_free(tpkgs[x]);
+        cr_package_free(pkg);
+        iterator_stop(iter);
+        return NULL;
+    }
+
+    pkg->loadingflags |= CR_PACKAGE_LOADED_PRI;
+    for (int x = ITER_FIL; x < ITER_SENTINEL; x++)
+        if (tpkgs[x])
+            iterator_merge(pkg, tpkgs[x], x);
+
+    return pkg;
+}
+
+gboolean
+cr_pkg_iterator_is_finished(cr_PkgIterator *iter)
+{
+    assert(iter);
+    return iter->finished;
+}
+
+void
+cr_pkg_iterator_free(cr_PkgIterator *iter)
+{
+    if (!iter)
+        return;
+
+    iterator_stop(iter);
+
+    for (int x = 0; x < ITER_SENTINEL; x++) {
+        cr_PkgIteratorParser *parser = &iter->parsers[x];
+        cr_Package *pkg;
+
+        while ((pkg = g_queue_pop_head(&parser->queue)))
+            cr_package_free(pkg);
+        g_hash_table_destroy(parser->pending);
+        g_clear_error(&parser->err);
+        g_free(parser->path);
+    }
+
+    g_cond_clear(&iter->cond);
+    g_mutex_clear(&iter->mutex);
+    g_free(iter);
+}
@@ -79,11 +79,12 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     if (!pd->pkg && pd->state != STATE_OTHERDATA && pd->state != STATE_START)
         return;  // Do not parse current package tag and its content
 
+    if (pd->raw_only && pd->state == STATE_PACKAGE)
+        return;  // Only the raw xml of the package is stored
+
     // Find current state by its name
-    for (sw = pd->swtab[pd->state]; sw->from == pd->state; sw++)
-        if (!strcmp((char *) element, sw->ename))
-            break;
-    if (sw->from != pd->state) {
+    sw = cr_xml_parser_switch(pd, element);
+    if (!sw) {
         // No state for current element (unknown element)
         cr_xml_parser_warning(pd, CR_XML_WARNING_UNKNOWNTAG,
                               "Unknown element \"%s\"", element);
@@ -97,8 +98,6 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     pd->lcontent   = 0;
     pd->content[0] = '\0';
 
-    const char *val;
-
     switch(pd->state) {
     case STATE_START:
         break;
@@ -108,9 +107,16 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_PACKAGE: {
-        const char *pkgId = cr_find_attr("pkgid", attr);
-        const char *name  = cr_find_attr("name", attr);
-        const char *arch  = cr_find_attr("arch", attr);
+        if (pd->store_raw)
+            cr_xml_parser_raw_start(pd);
+
+        static const char * const names[] = { "pkgid", "name", "arch" };
+        const char *values[3];
+        cr_find_attrs(attr, names, values, 3);
+
+        const char *pkgId = values[0];
+        const char *name  = values[1];
+        const char *arch  = values[2];
 
         if (!pkgId) {
             // Package without a pkgid attr is error
@@ -156,7 +162,7 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
             if (!pd->pkg->name && name)
                 pd->pkg->name = g_string_chunk_insert(pd->pkg->chunk, name);
             if (!pd->pkg->arch && arch)
-                pd->pkg->arch = g_string_chunk_insert(pd->pkg->chunk, arch);
+                pd->pkg->arch = cr_xml_parser_intern(pd->pkg, arch);
         }
         break;
     }
@@ -165,39 +171,33 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         assert(pd->pkg);
 
         // Version string insert only if them don't already exists
-
-        if (!pd->pkg->epoch)
-            pd->pkg->epoch = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("epoch", attr));
-        if (!pd->pkg->version)
-            pd->pkg->version = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("ver", attr));
-        if (!pd->pkg->release)
-            pd->pkg->release = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("rel", attr));
+        cr_xml_parser_evr(pd->pkg, attr);
         break;
 
     case STATE_CHANGELOG: {
         assert(pd->pkg);
         assert(!pd->changelog);
 
-        cr_ChangelogEntry *changelog = cr_changelog_entry_new();
+        cr_ChangelogEntry *changelog = cr_package_new_changelog_entry(pd->pkg);
+
+        static const char * const names[] = { "author", "date" };
+        const char *values[2];
+        cr_find_attrs(attr, names, values, 2);
 
-        val = cr_find_attr("author", attr);
-        if (!val)
+        if (!values[0])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"author\" of a package element");
         else
-            changelog->author = g_string_chunk_insert(pd->pkg->chunk, val);
+            changelog->author = cr_xml_parser_intern(pd->pkg, values[0]);
 
-        val = cr_find_attr("date", attr);
-        if (!val)
+        if (!values[1])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"date\" of a package element");
         else
-            changelog->date = cr_xml_parser_strtoll(pd, val, 10);
+            changelog->date = cr_xml_parser_strtoll(pd, values[1], 10);
 
-        pd->pkg->changelogs = g_slist_prepend(pd->pkg->changelogs, changelog);
+        pd->pkg->changelogs = cr_package_list_prepend(pd->pkg, pd->pkg->changelogs,
+                                                 changelog);
         pd->changelog = changelog;
 
         break;
@@ -236,6 +236,12 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_PACKAGE:
+        if (pd->store_raw) {
+            char *raw = cr_xml_parser_raw_end(pd);
+            if (pd->pkg)
+                pd->pkg->raw_other = raw;
+        }
+
         if (!pd->pkg)
             return;
 
@@ -285,6 +291,8 @@ cr_xml_parse_other_internal(const char *target,
                             void *pkgcb_data,
                             cr_XmlParserWarningCb warningcb,
                             void *warningcb_data,
+                            gboolean store_raw,
+                            gboolean raw_only,
                             int (*parser_func)(xmlParserCtxtPtr, cr_ParserData *, const char *, GError**),
                             GError **err)
 {
@@ -319,11 +327,9 @@ cr_xml_parse_other_internal(const char *target,
     pd->pkgcb = pkgcb;
     pd->warningcb = warningcb;
     pd->warningcb_data = warningcb_data;
-    for (cr_StatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    pd->store_raw = store_raw || raw_only;
+    pd->raw_only = raw_only;
+    cr_xml_parser_set_switches(pd, stateswitches, NUMSTATES);
 
     // Parsing
 
@@ -369,7 +375,7 @@ cr_xml_parse_other(const char *path,
                    GError **err)
 {
     return cr_xml_parse_other_internal(path, newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
-                                       warningcb, warningcb_data, &cr_xml_parser_generic, err);
+                                       warningcb, warningcb_data, FALSE, FALSE, &cr_xml_parser_generic, err);
 }
 
 int
@@ -384,7 +390,7 @@ cr_xml_parse_other_snippet(const char *xml_string,
 {
     char* wrapped_xml_string = g_strconcat("<otherdata>", xml_string, "</otherdata>", NULL);
     int ret = cr_xml_parse_other_internal(wrapped_xml_string, newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
-                                          warningcb, warningcb_data, &cr_xml_parser_generic_from_string, err);
+                                          warningcb, warningcb_data, FALSE, FALSE, &cr_xml_parser_generic_from_string, err);
     free(wrapped_xml_string);
     return ret;
 }
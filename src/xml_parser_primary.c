@@ -120,6 +120,41 @@ static cr_StatesSwitch stateswitches[] = {
     { NUMSTATES,            NULL,               NUMSTATES,              0 },
 };
 
+/* Attributes of the rpm:entry elements */
+enum {
+    ENTRY_NAME,
+    ENTRY_FLAGS,
+    ENTRY_EPOCH,
+    ENTRY_VER,
+    ENTRY_REL,
+    ENTRY_PRE,
+    ENTRY_ATTRS,
+};
+
+static const char * const entry_attrs[] = {
+    [ENTRY_NAME]  = "name",
+    [ENTRY_FLAGS] = "flags",
+    [ENTRY_EPOCH] = "epoch",
+    [ENTRY_VER]   = "ver",
+    [ENTRY_REL]   = "rel",
+    [ENTRY_PRE]   = "pre",
+};
+
+/** Flags of a dependency. The known flags are shared static strings,
+ * so they are neither copied nor looked up in the chunk.
+ */
+static gchar *
+cr_xml_parser_dep_flags(cr_Package *pkg, const char *flags)
+{
+    const char *known = cr_dependency_flag_str(
+                                    cr_dependency_flag_from_str(flags));
+
+    if (known)
+        return (gchar *) known;
+
+    return cr_xml_parser_intern(pkg, flags);
+}
+
 static void XMLCALL
 cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
 {
@@ -146,10 +181,8 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         return;  // Do not parse current package tag and its content
 
     // Find current state by its name
-    for (sw = pd->swtab[pd->state]; sw->from == pd->state; sw++)
-        if (!strcmp((char *) element, sw->ename))
-            break;
-    if (sw->from != pd->state) {
+    sw = cr_xml_parser_switch(pd, element);
+    if (!sw) {
         // No state for current element (unknown element)
         cr_xml_parser_warning(pd, CR_XML_WARNING_UNKNOWNTAG,
                               "Unknown element \"%s\"", element);
@@ -176,6 +209,9 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     case STATE_PACKAGE:
         assert(!pd->pkg);
 
+        if (pd->store_raw)
+            cr_xml_parser_raw_start(pd);
+
         val = cr_find_attr("type", attr);
 
         if (!val)
@@ -216,16 +252,7 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
 
         // Version strings insert only if them don't already exists
         // They could be already filled by filelists or other parser.
-
-        if (!pd->pkg->epoch)
-            pd->pkg->epoch = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("epoch", attr));
-        if (!pd->pkg->version)
-            pd->pkg->version = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("ver", attr));
-        if (!pd->pkg->release)
-            pd->pkg->release = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                            cr_find_attr("rel", attr));
+        cr_xml_parser_evr(pd->pkg, attr);
         break;
 
     case STATE_CHECKSUM:
@@ -235,7 +262,7 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"type\" of a checksum element");
         else
-            pd->pkg->checksum_type = g_string_chunk_insert(pd->pkg->chunk, val);
+            pd->pkg->checksum_type = cr_xml_parser_intern(pd->pkg, val);
         break;
 
     case STATE_SUMMARY:
@@ -247,63 +274,75 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     case STATE_TIME:
         assert(pd->pkg);
 
-        val = cr_find_attr("file", attr);
-        if (!val)
+    {
+        static const char * const names[] = { "file", "build" };
+        const char *values[2];
+        cr_find_attrs(attr, names, values, 2);
+
+        if (!values[0])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"file\" of a time element");
         else
-            pd->pkg->time_file = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->time_file = cr_xml_parser_strtoll(pd, values[0], 10);
 
-        val = cr_find_attr("build", attr);
-        if (!val)
+        if (!values[1])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"build\" of a time element");
         else
-            pd->pkg->time_build = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->time_build = cr_xml_parser_strtoll(pd, values[1], 10);
 
         break;
+    }
 
     case STATE_SIZE:
         assert(pd->pkg);
 
-        val = cr_find_attr("package", attr);
-        if (!val)
+    {
+        static const char * const names[] = { "package", "installed", "archive" };
+        const char *values[3];
+        cr_find_attrs(attr, names, values, 3);
+
+        if (!values[0])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"package\" of a size element");
         else
-            pd->pkg->size_package = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->size_package = cr_xml_parser_strtoll(pd, values[0], 10);
 
-        val = cr_find_attr("installed", attr);
-        if (!val)
+        if (!values[1])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"installed\" of a size element");
         else
-            pd->pkg->size_installed = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->size_installed = cr_xml_parser_strtoll(pd, values[1], 10);
 
-        val = cr_find_attr("archive", attr);
-        if (!val)
+        if (!values[2])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"archive\" of a size element");
         else
-            pd->pkg->size_archive = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->size_archive = cr_xml_parser_strtoll(pd, values[2], 10);
 
         break;
+    }
 
     case STATE_LOCATION:
         assert(pd->pkg);
 
-        val = cr_find_attr("href", attr);
-        if (!val)
+    {
+        static const char * const names[] = { "href", "xml:base" };
+        const char *values[2];
+        cr_find_attrs(attr, names, values, 2);
+
+        if (!values[0])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"href\" of a location element");
         else
-            pd->pkg->location_href = g_string_chunk_insert(pd->pkg->chunk, val);
+            pd->pkg->location_href = g_string_chunk_insert(pd->pkg->chunk,
+                                                           values[0]);
 
-        val = cr_find_attr("xml:base", attr);
-        if (val)
-            pd->pkg->location_base = g_string_chunk_insert(pd->pkg->chunk, val);
+        if (values[1])
+            pd->pkg->location_base = cr_xml_parser_intern(pd->pkg, values[1]);
 
         break;
+    }
 
     case STATE_FORMAT:
     case STATE_RPM_LICENSE:
@@ -316,21 +355,25 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     case STATE_RPM_HEADER_RANGE:
         assert(pd->pkg);
 
-        val = cr_find_attr("start", attr);
-        if (!val)
+    {
+        static const char * const names[] = { "start", "end" };
+        const char *values[2];
+        cr_find_attrs(attr, names, values, 2);
+
+        if (!values[0])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                     "Missing attribute \"start\" of a header-range element");
         else
-            pd->pkg->rpm_header_start = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->rpm_header_start = cr_xml_parser_strtoll(pd, values[0], 10);
 
-        val = cr_find_attr("end", attr);
-        if (!val)
+        if (!values[1])
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"end\" of a time element");
         else
-            pd->pkg->rpm_header_end = cr_xml_parser_strtoll(pd, val, 10);
+            pd->pkg->rpm_header_end = cr_xml_parser_strtoll(pd, values[1], 10);
 
         break;
+    }
 
     case STATE_RPM_PROVIDES:
     case STATE_RPM_REQUIRES:
@@ -353,34 +396,36 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     {
         assert(pd->pkg);
 
-        cr_Dependency *dep = cr_dependency_new();
+        cr_Dependency *dep = cr_package_new_dependency(pd->pkg);
+        const char *values[ENTRY_ATTRS];
+        cr_find_attrs(attr, entry_attrs, values, ENTRY_ATTRS);
 
-        val = cr_find_attr("name", attr);
+        val = values[ENTRY_NAME];
         if (!val)
             cr_xml_parser_warning(pd, CR_XML_WARNING_MISSINGATTR,
                         "Missing attribute \"name\" of an entry element");
         else
-            dep->name = g_string_chunk_insert(pd->pkg->chunk, val);
+            dep->name = cr_xml_parser_intern(pd->pkg, val);
 
         // Rest of attrs is optional
 
-        val = cr_find_attr("flags", attr);
+        val = values[ENTRY_FLAGS];
         if (val)
-            dep->flags = g_string_chunk_insert(pd->pkg->chunk, val);
+            dep->flags = cr_xml_parser_dep_flags(pd->pkg, val);
 
-        val = cr_find_attr("epoch", attr);
+        val = values[ENTRY_EPOCH];
         if (val)
-            dep->epoch = g_string_chunk_insert(pd->pkg->chunk, val);
+            dep->epoch = cr_xml_parser_intern(pd->pkg, val);
 
-        val = cr_find_attr("ver", attr);
+        val = values[ENTRY_VER];
         if (val)
-            dep->version = g_string_chunk_insert(pd->pkg->chunk, val);
+            dep->version = cr_xml_parser_intern(pd->pkg, val);
 
-        val = cr_find_attr("rel", attr);
+        val = values[ENTRY_REL];
         if (val)
-            dep->release = g_string_chunk_insert(pd->pkg->chunk, val);
+            dep->release = cr_xml_parser_intern(pd->pkg, val);
 
-        val = cr_find_attr("pre", attr);
+        val = values[ENTRY_PRE];
         if (val) {
             if (!strcmp(val, "0") ||
                 !strcmp(val, "FALSE") ||
@@ -393,28 +438,36 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
 
         switch (pd->state) {
             case STATE_RPM_ENTRY_PROVIDES:
-                pd->pkg->provides = g_slist_prepend(pd->pkg->provides, dep);
+                pd->pkg->provides = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->provides, dep);
                 break;
             case STATE_RPM_ENTRY_REQUIRES:
-                pd->pkg->requires = g_slist_prepend(pd->pkg->requires, dep);
+                pd->pkg->requires = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->requires, dep);
                 break;
             case STATE_RPM_ENTRY_CONFLICTS:
-                pd->pkg->conflicts = g_slist_prepend(pd->pkg->conflicts, dep);
+                pd->pkg->conflicts = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->conflicts, dep);
                 break;
             case STATE_RPM_ENTRY_OBSOLETES:
-                pd->pkg->obsoletes = g_slist_prepend(pd->pkg->obsoletes, dep);
+                pd->pkg->obsoletes = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->obsoletes, dep);
                 break;
             case STATE_RPM_ENTRY_SUGGESTS:
-                pd->pkg->suggests = g_slist_prepend(pd->pkg->suggests, dep);
+                pd->pkg->suggests = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->suggests, dep);
                 break;
             case STATE_RPM_ENTRY_ENHANCES:
-                pd->pkg->enhances = g_slist_prepend(pd->pkg->enhances, dep);
+                pd->pkg->enhances = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->enhances, dep);
                 break;
             case STATE_RPM_ENTRY_RECOMMENDS:
-                pd->pkg->recommends = g_slist_prepend(pd->pkg->recommends, dep);
+                pd->pkg->recommends = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->recommends, dep);
                 break;
             case STATE_RPM_ENTRY_SUPPLEMENTS:
-                pd->pkg->supplements = g_slist_prepend(pd->pkg->supplements, dep);
+                pd->pkg->supplements = cr_package_list_prepend(pd->pkg,
+                                                    pd->pkg->supplements, dep);
                 break;
             default: assert(0);
         }
@@ -473,6 +526,12 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_PACKAGE:
+        if (pd->store_raw) {
+            char *raw = cr_xml_parser_raw_end(pd);
+            if (pd->pkg)
+                pd->pkg->raw_primary = raw;
+        }
+
         if (!pd->pkg)
             return;
 
@@ -523,8 +582,8 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         assert(pd->pkg);
         if (!pd->pkg->arch)
             // arch could be already filled by filelists or other xml parser
-            pd->pkg->arch = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                             pd->content);
+            pd->pkg->arch = cr_xml_parser_intern_null(pd->pkg,
+                                                      pd->content);
         break;
 
     case STATE_CHECKSUM:
@@ -549,44 +608,44 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
 
     case STATE_PACKAGER:
         assert(pd->pkg);
-        pd->pkg->rpm_packager = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                                 pd->content);
+        pd->pkg->rpm_packager = cr_xml_parser_intern_null(pd->pkg,
+                                                          pd->content);
         break;
 
     case STATE_URL:
         assert(pd->pkg);
-        pd->pkg->url = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                        pd->content);
+        pd->pkg->url = cr_xml_parser_intern_null(pd->pkg,
+                                                 pd->content);
         break;
 
     case STATE_RPM_LICENSE:
         assert(pd->pkg);
-        pd->pkg->rpm_license = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                                pd->content);
+        pd->pkg->rpm_license = cr_xml_parser_intern_null(pd->pkg,
+                                                         pd->content);
         break;
 
     case STATE_RPM_VENDOR:
         assert(pd->pkg);
-        pd->pkg->rpm_vendor = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                               pd->content);
+        pd->pkg->rpm_vendor = cr_xml_parser_intern_null(pd->pkg,
+                                                        pd->content);
         break;
 
     case STATE_RPM_GROUP:
         assert(pd->pkg);
-        pd->pkg->rpm_group = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                              pd->content);
+        pd->pkg->rpm_group = cr_xml_parser_intern_null(pd->pkg,
+                                                       pd->content);
         break;
 
     case STATE_RPM_BUILDHOST:
         assert(pd->pkg);
-        pd->pkg->rpm_buildhost = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                                  pd->content);
+        pd->pkg->rpm_buildhost = cr_xml_parser_intern_null(pd->pkg,
+                                                           pd->content);
         break;
 
     case STATE_RPM_SOURCERPM:
         assert(pd->pkg);
-        pd->pkg->rpm_sourcerpm = cr_safe_string_chunk_insert_null(pd->pkg->chunk,
-                                                                  pd->content);
+        pd->pkg->rpm_sourcerpm = cr_xml_parser_intern_null(pd->pkg,
+                                                           pd->content);
         break;
 
     case STATE_RPM_PROVIDES:
@@ -630,13 +689,14 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         if (!pd->content)
             break;
 
-        cr_PackageFile *pkg_file = cr_package_file_new();
-        pkg_file->name = cr_safe_string_chunk_insert(pd->pkg->chunk,
-                                                cr_get_filename(pd->content));
+        cr_PackageFile *pkg_file = cr_package_new_file(pd->pkg);
+        pkg_file->name = cr_xml_parser_intern(pd->pkg,
+                                              cr_get_filename(pd->content));
         if (!pkg_file->name) {
             g_set_error(&pd->err, ERR_DOMAIN, ERR_CODE_XML,
                         "Invalid <file> element: %s", pd->content);
-            g_free(pkg_file);
+            if (!pd->pkg->arena)
+                g_free(pkg_file);
             break;
         }
         pd->content[pd->lcontent - strlen(pkg_file->name)] = '\0';
@@ -644,12 +704,17 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
                                                            pd->content);
         switch (pd->last_file_type) {
             case FILE_FILE:  pkg_file->type = NULL;    break; // NULL => "file"
-            case FILE_DIR:   pkg_file->type = "dir";   break;
-            case FILE_GHOST: pkg_file->type = "ghost"; break;
+            case FILE_DIR:
+                pkg_file->type = (char *) cr_package_file_type_str(CR_FILE_TYPE_DIR);
+                break;
+            case FILE_GHOST:
+                pkg_file->type = (char *) cr_package_file_type_str(CR_FILE_TYPE_GHOST);
+                break;
             default: assert(0);  // Should not happend
         }
 
-        pd->pkg->files = g_slist_prepend(pd->pkg->files, pkg_file);
+        pd->pkg->files = cr_package_list_prepend(pd->pkg,
+                                            pd->pkg->files, pkg_file);
         break;
     }
 
@@ -667,6 +732,7 @@ cr_xml_parse_primary_internal(const char *target,
                               cr_XmlParserWarningCb warningcb,
                               void *warningcb_data,
                               int do_files,
+                              gboolean store_raw,
                               int (*parser_func)(xmlParserCtxtPtr, cr_ParserData *, const char *, GError**),
                               GError **err)
 {
@@ -702,11 +768,8 @@ cr_xml_parse_primary_internal(const char *target,
     pd->do_files = do_files;
     pd->warningcb = warningcb;
     pd->warningcb_data = warningcb_data;
-    for (cr_StatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    pd->store_raw = store_raw;
+    cr_xml_parser_set_switches(pd, stateswitches, NUMSTATES);
 
     // Parsing
 
@@ -754,7 +817,7 @@ cr_xml_parse_primary(const char *path,
 {
 
     return cr_xml_parse_primary_internal(path, newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
-                                         warningcb, warningcb_data, do_files, &cr_xml_parser_generic, err);
+                                         warningcb, warningcb_data, do_files, FALSE, &cr_xml_parser_generic, err);
 }
 
 int
@@ -770,7 +833,7 @@ cr_xml_parse_primary_snippet(const char *xml_string,
 {
     char* wrapped_xml_string = g_strconcat("<metadata>", xml_string, "</metadata>", NULL);
     int ret =  cr_xml_parse_primary_internal(wrapped_xml_string, newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
-                                             warningcb, warningcb_data, do_files, &cr_xml_parser_generic_from_string, err);
+                                             warningcb, warningcb_data, do_files, FALSE, &cr_xml_parser_generic_from_string, err);
     free(wrapped_xml_string);
     return ret;
 }
@@ -104,10 +104,8 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     }
 
     // Find current state by its name
-    for (sw = pd->swtab[pd->state]; sw->from == pd->state; sw++)
-        if (!strcmp((char *) element, sw->ename))
-            break;
-    if (sw->from != pd->state) {
+    sw = cr_xml_parser_switch(pd, element);
+    if (!sw) {
         // No state for current element (unknown element)
         cr_xml_parser_warning(pd, CR_XML_WARNING_UNKNOWNTAG,
                               "Unknown element \"%s\"", element);
@@ -453,11 +451,7 @@ cr_xml_parse_repomd(const char *path,
     pd->repomd = repomd;
     pd->warningcb = warningcb;
     pd->warningcb_data = warningcb_data;
-    for (cr_StatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    cr_xml_parser_set_switches(pd, stateswitches, NUMSTATES);
 
     // Parsing
 
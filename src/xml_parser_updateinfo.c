@@ -122,10 +122,8 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     }
 
     // Find current state by its name
-    for (sw = pd->swtab[pd->state]; sw->from == pd->state; sw++)
-        if (!strcmp((char *) element, sw->ename))
-            break;
-    if (sw->from != pd->state) {
+    sw = cr_xml_parser_switch(pd, element);
+    if (!sw) {
         // No state for current element (unknown element)
         cr_xml_parser_warning(pd, CR_XML_WARNING_UNKNOWNTAG,
                               "Unknown element \"%s\"", element);
@@ -173,14 +171,15 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_UPDATE:
-        assert(pd->updateinfo);
+        assert(pd->updateinfo || pd->updaterecordcb);
         assert(!pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionmodule);
         assert(!pd->updatecollectionpackage);
 
         rec = cr_updaterecord_new();
-        cr_updateinfo_apped_record(pd->updateinfo, rec);
+        if (!pd->updaterecordcb)
+            cr_updateinfo_apped_record(pd->updateinfo, rec);
         pd->updaterecord = rec;
 
         val = cr_find_attr("from", attr);
@@ -202,7 +201,6 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_ISSUED:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionmodule);
@@ -213,7 +211,6 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_UPDATED:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionmodule);
@@ -226,13 +223,12 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     case STATE_REFERENCE: {
         cr_UpdateReference *ref;
 
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionmodule);
         assert(!pd->updatecollectionpackage);
 
-        ref = cr_updatereference_new();
+        ref = cr_updatereference_new_with_chunk(rec->chunk);
         cr_updaterecord_append_reference(rec, ref);
 
         val = cr_find_attr("id", attr);
@@ -255,13 +251,12 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
     }
 
     case STATE_COLLECTION:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionmodule);
         assert(!pd->updatecollectionpackage);
 
-        collection = cr_updatecollection_new();
+        collection = cr_updatecollection_new_with_chunk(rec->chunk);
         cr_updaterecord_append_collection(rec, collection);
         pd->updatecollection = collection;
 
@@ -272,13 +267,13 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_MODULE:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(!pd->updatecollectionmodule);
         assert(!pd->updatecollectionpackage);
 
-        cr_UpdateCollectionModule *module = cr_updatecollectionmodule_new();
+        cr_UpdateCollectionModule *module =
+            cr_updatecollectionmodule_new_with_chunk(rec->chunk);
         assert(module);
 
         if (module)
@@ -317,12 +312,11 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_PACKAGE:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(!pd->updatecollectionpackage);
 
-        package = cr_updatecollectionpackage_new();
+        package = cr_updatecollectionpackage_new_with_chunk(rec->chunk);
         assert(package);
 
         cr_updatecollection_append_package(collection, package);
@@ -355,7 +349,6 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_SUM:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -365,13 +358,11 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_UPDATERECORD_REBOOTSUGGESTED:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         rec->reboot_suggested = TRUE;
         break;
 
     case STATE_REBOOTSUGGESTED:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -379,7 +370,6 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_RESTARTSUGGESTED:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -387,7 +377,6 @@ cr_start_handler(void *pdata, const xmlChar *element, const xmlChar **attr)
         break;
 
     case STATE_RELOGINSUGGESTED:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -416,6 +405,8 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
     pd->state = pd->sbtab[pd->state];
     pd->docontent = 0;
 
+    GError *tmp_err = NULL;
+
     // Shortcuts
     char *content = pd->content;
     cr_UpdateRecord *rec = pd->updaterecord;
@@ -440,7 +431,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_ID:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -448,7 +438,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_TITLE:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -456,7 +445,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_RIGHTS:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -464,7 +452,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_RELEASE:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -472,7 +459,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_PUSHCOUNT:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -480,7 +466,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_SEVERITY:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -488,7 +473,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_SUMMARY:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -496,7 +480,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_DESCRIPTION:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -504,7 +487,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_SOLUTION:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -512,7 +494,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_NAME:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -520,7 +501,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_FILENAME:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -529,7 +509,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_SUM:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -537,7 +516,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_PACKAGE:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(pd->updatecollectionpackage);
@@ -545,7 +523,6 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_COLLECTION:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(pd->updatecollection);
         assert(!pd->updatecollectionpackage);
@@ -553,11 +530,28 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
         break;
 
     case STATE_UPDATE:
-        assert(pd->updateinfo);
         assert(pd->updaterecord);
         assert(!pd->updatecollection);
         assert(!pd->updatecollectionpackage);
         pd->updaterecord = NULL;
+
+        if (!pd->updaterecordcb)
+            break;
+
+        // The callback takes the record
+        if (pd->updaterecordcb(rec, pd->updaterecordcb_data, &tmp_err)) {
+            if (tmp_err)
+                g_propagate_prefixed_error(&pd->err,
+                                           tmp_err,
+                                           "Parsing interrupted: ");
+            else
+                g_set_error(&pd->err, ERR_DOMAIN, CRE_CBINTERRUPTED,
+                            "Parsing interrupted");
+        } else {
+            // If callback return CRE_OK but it simultaneously set
+            // the tmp_err then it's a programming error.
+            assert(tmp_err == NULL);
+        }
         break;
 
     default:
@@ -565,21 +559,19 @@ cr_end_handler(void *pdata, G_GNUC_UNUSED const xmlChar *element)
     }
 }
 
-int
-cr_xml_parse_updateinfo(const char *path,
-                        cr_UpdateInfo *updateinfo,
-                        cr_XmlParserWarningCb warningcb,
-                        void *warningcb_data,
-                        GError **err)
+static int
+cr_xml_parse_updateinfo_internal(const char *path,
+                                 cr_UpdateInfo *updateinfo,
+                                 cr_XmlParserUpdateRecordCb recordcb,
+                                 void *recordcb_data,
+                                 cr_XmlParserWarningCb warningcb,
+                                 void *warningcb_data,
+                                 GError **err)
 {
     int ret = CRE_OK;
     cr_ParserData *pd;
     GError *tmp_err = NULL;
 
-    assert(path);
-    assert(updateinfo);
-    assert(!err || *err == NULL);
-
     // Init
     xmlSAXHandler sax;
     memset(&sax, 0, sizeof(sax));
@@ -595,13 +587,11 @@ cr_xml_parse_updateinfo(const char *path,
     pd->parser = parser;
     pd->state = STATE_START;
     pd->updateinfo = updateinfo;
+    pd->updaterecordcb = recordcb;
+    pd->updaterecordcb_data = recordcb_data;
     pd->warningcb = warningcb;
     pd->warningcb_data = warningcb_data;
-    for (cr_StatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    cr_xml_parser_set_switches(pd, stateswitches, NUMSTATES);
 
     // Parsing
 
@@ -619,8 +609,49 @@ cr_xml_parse_updateinfo(const char *path,
 
     // Clean up
 
+    // The records are appended before they are parsed, an index built
+    // before the parsing doesn't know their ids and packages
+    if (updateinfo)
+        cr_updateinfo_reindex(updateinfo);
+
+    // A record interrupted by an error wasn't passed to the callback
+    if (recordcb)
+        cr_updaterecord_free(pd->updaterecord);
+
     cr_xml_parser_data_free(pd);
     xmlFreeParserCtxt(parser);
 
     return ret;
 }
+
+int
+cr_xml_parse_updateinfo(const char *path,
+                        cr_UpdateInfo *updateinfo,
+                        cr_XmlParserWarningCb warningcb,
+                        void *warningcb_data,
+                        GError **err)
+{
+    assert(path);
+    assert(updateinfo);
+    assert(!err || *err == NULL);
+
+    return cr_xml_parse_updateinfo_internal(path, updateinfo, NULL, NULL,
+                                            warningcb, warningcb_data, err);
+}
+
+int
+cr_xml_parse_updateinfo_records(const char *path,
+                                cr_XmlParserUpdateRecordCb recordcb,
+                                void *recordcb_data,
+                                cr_XmlParserWarningCb warningcb,
+                                void *warningcb_data,
+                                GError **err)
+{
+    assert(path);
+    assert(recordcb);
+    assert(!err || *err == NULL);
+
+    return cr_xml_parse_updateinfo_internal(path, NULL, recordcb,
+                                            recordcb_data, warningcb,
+                                            warningcb_data, err);
+}
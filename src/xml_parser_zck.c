@@ -0,0 +1,396 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <assert.h>
+#include "xml_parser.h"
+#include "compression_wrapper.h"
+#include "error.h"
+#include "package.h"
+
+#define ERR_DOMAIN      CREATEREPO_C_ERROR
+
+/* Chunk 0 of a zchunk file is its dictionary, the xml header is compressed
+ * in the chunk 1 and the footer at the end of the last chunk
+ * (see cr_xmlfile_write_xml_header()), the other chunks contain only
+ * <package> elements. */
+
+#define FIRST_DATA_CHUNK    1
+#define PACKAGE_START       "<package "
+
+typedef enum {
+    ZCK_XML_PRIMARY,
+    ZCK_XML_FILELISTS,
+    ZCK_XML_OTHER,
+    ZCK_XML_SENTINEL,
+} ZckXmlType;
+
+static const char *zck_xml_roots[] = {
+    [ZCK_XML_PRIMARY]   = "metadata",
+    [ZCK_XML_FILELISTS] = "filelists",
+    [ZCK_XML_OTHER]     = "otherdata",
+};
+
+struct _cr_XmlZckIndex {
+    CR_FILE *f;                 // The indexed file
+    ZckXmlType type;            // Type of its xml
+    GStringChunk *strings;      // Srpms and pkgIds
+    GPtrArray *chunk_srpms;     // Chunk -> GPtrArray of srpms or NULL
+    GHashTable *srpm_chunks;    // Srpm -> GArray of chunks (guint)
+    GHashTable *pkgid_srpms;    // PkgId -> srpm (primary only)
+};
+
+typedef struct {
+    cr_XmlZckIndex *index;
+    const cr_XmlZckIndex *primary;
+    guint chunk;
+} IndexData;
+
+/** Find the type of the xml by its root element in the header chunk.
+ */
+static ZckXmlType
+zck_xml_type(const char *data, gsize len)
+{
+    const char *end = g_strstr_len(data, len, PACKAGE_START);
+
+    if (end)
+        len = end - data;
+
+    for (int type = 0; type < ZCK_XML_SENTINEL; type++) {
+        gchar *tag = g_strconcat("<", zck_xml_roots[type], NULL);
+        gboolean found = g_strstr_len(data, len, tag) != NULL;
+        g_free(tag);
+        if (found)
+            return type;
+    }
+
+    return ZCK_XML_SENTINEL;
+}
+
+/** The <package> elements of the chunk (without the xml header or footer)
+ * or NULL if there are none.
+ */
+static gchar *
+chunk_packages(ZckXmlType type, const char *data, gsize len)
+{
+    const char *start = g_strstr_len(data, len, PACKAGE_START);
+    const char *end = data + len;
+
+    if (!start)
+        return NULL;
+
+    gchar *footer = g_strconcat("</", zck_xml_roots[type], NULL);
+    const char *footer_start = g_strstr_len(start, end - start, footer);
+    g_free(footer);
+    if (footer_start)
+        end = footer_start;
+
+    return g_strndup(start, end - start);
+}
+
+static int
+parse_chunk(ZckXmlType type,
+            const char *packages,
+            cr_XmlParserNewPkgCb newpkgcb,
+            void *newpkgcb_data,
+            cr_XmlParserPkgCb pkgcb,
+            void *pkgcb_data,
+            cr_XmlParserWarningCb warningcb,
+            void *warningcb_data,
+            int do_files,
+            GError **err)
+{
+    switch (type) {
+        case ZCK_XML_PRIMARY:
+            return cr_xml_parse_primary_snippet(packages,
+                                                newpkgcb, newpkgcb_data,
+                                                pkgcb, pkgcb_data,
+                                                warningcb, warningcb_data,
+                                                do_files, err);
+        case ZCK_XML_FILELISTS:
+            return cr_xml_parse_filelists_snippet(packages,
+                                                  newpkgcb, newpkgcb_data,
+                                                  pkgcb, pkgcb_data,
+                                                  warningcb, warningcb_data,
+                                                  err);
+        case ZCK_XML_OTHER:
+            return cr_xml_parse_other_snippet(packages,
+                                              newpkgcb, newpkgcb_data,
+                                              pkgcb, pkgcb_data,
+                                              warningcb, warningcb_data,
+                                              err);
+        default:
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG, "Bad xml type");
+            return CRE_BADARG;
+    }
+}
+
+static void
+index_add(cr_XmlZckIndex *index, guint chunk, const char *srpm)
+{
+    srpm = g_string_chunk_insert_const(index->strings, srpm);
+
+    GPtrArray *srpms = g_ptr_array_index(index->chunk_srpms, chunk);
+    if (!srpms) {
+        srpms = g_ptr_array_new();
+        index->chunk_srpms->pdata[chunk] = srpms;
+    }
+
+    // Strings are inserted only once, pointers are compared
+    for (guint x = 0; x < srpms->len; x++)
+        if (g_ptr_array_index(srpms, x) == srpm)
+            return;
+    g_ptr_array_add(srpms, (gpointer) srpm);
+
+    GArray *chunks = g_hash_table_lookup(index->srpm_chunks, srpm);
+    if (!chunks) {
+        chunks = g_array_new(FALSE, FALSE, sizeof(guint));
+        g_hash_table_insert(index->srpm_chunks, (gpointer) srpm, chunks);
+    }
+    g_array_append_val(chunks, chunk);
+}
+
+static int
+index_primary_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
+{
+    IndexData *data = cbdata;
+    cr_XmlZckIndex *index = data->index;
+
+    if (pkg->rpm_sourcerpm) {
+        index_add(index, data->chunk, pkg->rpm_sourcerpm);
+        if (pkg->pkgId)
+            g_hash_table_insert(index->pkgid_srpms,
+                g_string_chunk_insert_const(index->strings, pkg->pkgId),
+                g_string_chunk_insert_const(index->strings,
+                                            pkg->rpm_sourcerpm));
+    }
+
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+static int
+index_newpkgcb(cr_Package **pkg,
+               const char *pkgId,
+               G_GNUC_UNUSED const char *name,
+               G_GNUC_UNUSED const char *arch,
+               void *cbdata,
+               G_GNUC_UNUSED GError **err)
+{
+    IndexData *data = cbdata;
+    const char *srpm = NULL;
+
+    if (pkgId)
+        srpm = g_hash_table_lookup(data->primary->pkgid_srpms, pkgId);
+    if (srpm)
+        index_add(data->index, data->chunk, srpm);
+
+    // Only the pkgId is needed
+    *pkg = NULL;
+    return CR_CB_RET_OK;
+}
+
+cr_XmlZckIndex *
+cr_xml_zck_index_new(const char *path,
+                     const cr_XmlZckIndex *primary,
+                     GError **err)
+{
+    GError *tmp_err = NULL;
+    CR_FILE *f;
+
+    assert(path);
+    assert(!err || *err == NULL);
+
+    f = cr_open(path, CR_CW_MODE_READ, CR_CW_ZCK_COMPRESSION, &tmp_err);
+    if (!f) {
+        g_propagate_prefixed_error(err, tmp_err, "Cannot open %s: ", path);
+        return NULL;
+    }
+
+    cr_XmlZckIndex *index = g_new0(cr_XmlZckIndex, 1);
+    index->f = f;
+    index->type = ZCK_XML_SENTINEL;
+    index->strings = g_string_chunk_new(4096);
+    index->chunk_srpms = g_ptr_array_new();
+    index->srpm_chunks = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                               (GDestroyNotify) g_array_unref);
+    index->pkgid_srpms = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (guint chunk = 0; chunk < FIRST_DATA_CHUNK; chunk++)
+        g_ptr_array_add(index->chunk_srpms, NULL);
+
+    for (guint chunk = FIRST_DATA_CHUNK; ; chunk++) {
+        gchar *data = NULL;
+        ssize_t len = cr_get_zchunk_with_index(f, chunk, &data, &tmp_err);
+        if (len <= 0) {
+            g_free(data);
+            break;
+        }
+        g_ptr_array_add(index->chunk_srpms, NULL);
+
+        if (index->type == ZCK_XML_SENTINEL) {
+            index->type = zck_xml_type(data, len);
+            if (index->type == ZCK_XML_SENTINEL) {
+                g_set_error(&tmp_err, ERR_DOMAIN, CRE_XMLPARSER,
+                            "Unknown type of xml");
+            } else if (index->type != ZCK_XML_PRIMARY && !primary) {
+                g_set_error(&tmp_err, ERR_DOMAIN, CRE_BADARG,
+                            "Index of primary is needed for %s",
+                            zck_xml_roots[index->type]);
+            }
+            if (tmp_err) {
+                g_free(data);
+                break;
+            }
+        }
+
+        gchar *packages = chunk_packages(index->type, data, len);
+        g_free(data);
+        if (!packages)
+            continue;
+
+        IndexData index_data = { index, primary, chunk };
+        if (index->type == ZCK_XML_PRIMARY)
+            parse_chunk(index->type, packages,
+                        NULL, NULL, index_primary_pkgcb, &index_data,
+                        NULL, NULL, 0, &tmp_err);
+        else
+            parse_chunk(index->type, packages,
+                        index_newpkgcb, &index_data, NULL, NULL,
+                        NULL, NULL, 0, &tmp_err);
+        g_free(packages);
+        if (tmp_err) {
+            g_prefix_error(&tmp_err, "Chunk %u: ", chunk);
+            break;
+        }
+    }
+
+    if (tmp_err) {
+        g_propagate_prefixed_error(err, tmp_err, "Cannot index %s: ", path);
+        cr_xml_zck_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+guint
+cr_xml_zck_index_chunk_count(const cr_XmlZckIndex *index)
+{
+    assert(index);
+
+    return index->chunk_srpms->len;
+}
+
+const GPtrArray *
+cr_xml_zck_index_chunk_srpms(const cr_XmlZckIndex *index, guint chunk)
+{
+    assert(index);
+
+    if (chunk >= index->chunk_srpms->len)
+        return NULL;
+    return g_ptr_array_index(index->chunk_srpms, chunk);
+}
+
+const GArray *
+cr_xml_zck_index_srpm_chunks(const cr_XmlZckIndex *index,
+                             const char *rpm_sourcerpm)
+{
+    assert(index);
+    assert(rpm_sourcerpm);
+
+    return g_hash_table_lookup(index->srpm_chunks, rpm_sourcerpm);
+}
+
+int
+cr_xml_parse_zck_chunks(cr_XmlZckIndex *index,
+                        const guint *chunks,
+                        guint count,
+                        cr_XmlParserNewPkgCb newpkgcb,
+                        void *newpkgcb_data,
+                        cr_XmlParserPkgCb pkgcb,
+                        void *pkgcb_data,
+                        cr_XmlParserWarningCb warningcb,
+                        void *warningcb_data,
+                        int do_files,
+                        GError **err)
+{
+    int ret = CRE_OK;
+
+    assert(index);
+    assert(chunks || count == 0);
+    assert(newpkgcb || pkgcb);
+    assert(!err || *err == NULL);
+
+    for (guint x = 0; x < count && ret == CRE_OK; x++) {
+        GError *tmp_err = NULL;
+        gchar *data = NULL;
+
+        if (chunks[x] < FIRST_DATA_CHUNK
+            || chunks[x] >= index->chunk_srpms->len)
+        {
+            g_set_error(err, ERR_DOMAIN, CRE_BADARG,
+                        "Chunk %u is not indexed", chunks[x]);
+            return CRE_BADARG;
+        }
+
+        ssize_t len = cr_get_zchunk_with_index(index->f, chunks[x],
+                                               &data, &tmp_err);
+        if (tmp_err) {
+            ret = tmp_err->code;
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot read chunk %u: ", chunks[x]);
+            g_free(data);
+            break;
+        }
+
+        gchar *packages = len > 0 ? chunk_packages(index->type, data, len)
+                                  : NULL;
+        g_free(data);
+        if (!packages)
+            continue;
+
+        ret = parse_chunk(index->type, packages,
+                          newpkgcb, newpkgcb_data, pkgcb, pkgcb_data,
+                          warningcb, warningcb_data, do_files, err);
+        g_free(packages);
+    }
+
+    return ret;
+}
+
+void
+cr_xml_zck_index_free(cr_XmlZckIndex *index)
+{
+    if (!index)
+        return;
+
+    for (guint x = 0; x < index->chunk_srpms->len; x++) {
+        GPtrArray *srpms = g_ptr_array_index(index->chunk_srpms, x);
+        if (srpms)
+            g_ptr_array_free(srpms, TRUE);
+    }
+    g_ptr_array_free(index->chunk_srpms, TRUE);
+    g_hash_table_destroy(index->srpm_chunks);
+    g_hash_table_destroy(index->pkgid_srpms);
+    g_string_chunk_free(index->strings);
+    cr_close(index->f, NULL);
+    g_free(index);
+}
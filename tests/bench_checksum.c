@@ -0,0 +1,122 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Benchmark of the io modes of the checksum calculation.
+ *
+ * Usage: bench_checksum [-r ROUNDS] [-t CHECKSUM_TYPE] FILE [FILE ...]
+ *
+ * Every file is checksummed by all the modes. Note that all the modes
+ * drop the file from the page cache afterwards, so every round reads
+ * the file from the disk again (unless the filesystem ignores the advice).
+ * This program is not a part of the test suite (run_tests.sh runs only
+ * test_* binaries).
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "createrepo/checksum.h"
+
+static const struct {
+    const char *name;
+    cr_ChecksumIoMode mode;
+} modes[] = {
+    { "read",   CR_CHECKSUM_IO_READ },
+    { "mmap",   CR_CHECKSUM_IO_MMAP },
+    { "direct", CR_CHECKSUM_IO_DIRECT },
+};
+
+int
+main(int argc, char *argv[])
+{
+    gint rounds = 3;
+    gchar *type_str = NULL;
+    cr_ChecksumType type = CR_CHECKSUM_SHA256;
+    GError *tmp_err = NULL;
+    GOptionEntry entries[] = {
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+          "Number of rounds for each mode (default 3)", "ROUNDS" },
+        { "type", 't', 0, G_OPTION_ARG_STRING, &type_str,
+          "Checksum type (default sha256)", "CHECKSUM_TYPE" },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
+    };
+
+    GOptionContext *context = g_option_context_new("FILE [FILE ...]");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (type_str) {
+        type = cr_checksum_type(type_str);
+        if (type == CR_CHECKSUM_UNKNOWN) {
+            fprintf(stderr, "Unknown checksum type \"%s\"\n", type_str);
+            return EXIT_FAILURE;
+        }
+        g_free(type_str);
+    }
+
+    if (argc < 2 || rounds < 1) {
+        fprintf(stderr, "Usage: %s [-r ROUNDS] [-t TYPE] FILE [FILE ...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) == -1) {
+            fprintf(stderr, "Cannot stat %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+        printf("%s (%.1f MiB)\n", argv[i], st.st_size / (1024.0 * 1024.0));
+
+        for (size_t m = 0; m < G_N_ELEMENTS(modes); m++) {
+            gdouble best = 0.0;
+
+            for (gint r = 0; r < rounds; r++) {
+                GTimer *timer = g_timer_new();
+                char *checksum = cr_checksum_file_with_mode(argv[i], type,
+                                                            modes[m].mode,
+                                                            &tmp_err);
+                gdouble elapsed = g_timer_elapsed(timer, NULL);
+                g_timer_destroy(timer);
+
+                if (!checksum) {
+                    fprintf(stderr, "%s: %s\n", modes[m].name,
+                            tmp_err->message);
+                    g_clear_error(&tmp_err);
+                    break;
+                }
+                g_free(checksum);
+
+                if (r == 0 || elapsed < best)
+                    best = elapsed;
+            }
+
+            printf("  %-8s %8.3f s %10.1f MiB/s\n", modes[m].name, best,
+                   best > 0 ? st.st_size / (1024.0 * 1024.0) / best : 0.0);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Benchmark of the compression types and levels on the metadata of a repo.
+ *
+ * Usage: bench_compression [-r ROUNDS] [-t TYPE] [-b BUFFER_SIZE] REPO
+ *
+ * The primary, filelists and other xml of the REPO (a directory with
+ * the repodata/ subdirectory) are decompressed into memory and compressed
+ * by every level of every type (or just of the given TYPE). The best
+ * round of every level is reported with the compression speed and
+ * the ratio of the compressed and the uncompressed size, the values
+ * to pick the --compress-level of createrepo_c from (the current default
+ * levels are marked by "*").
+ * This program is not a part of the test suite (run_tests.sh runs only
+ * test_* binaries).
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/compression_wrapper.h"
+#include "createrepo/error.h"
+#include "createrepo/locate_metadata.h"
+#include "createrepo/misc.h"
+
+#define READ_CHUNK      (128*1024)
+
+static const struct {
+    cr_CompressionType type;
+    int min_level;
+    int max_level;
+} types[] = {
+    { CR_CW_GZ_COMPRESSION,     1, 9 },
+    { CR_CW_BZ2_COMPRESSION,    1, 9 },
+    { CR_CW_XZ_COMPRESSION,     0, 9 },
+#ifdef WITH_ZSTD
+    { CR_CW_ZSTD_COMPRESSION,   1, 19 },
+#endif
+};
+
+static GString *
+read_file(const char *path, GError **err)
+{
+    GString *content = g_string_new(NULL);
+    CR_FILE *f = cr_open(path, CR_CW_MODE_READ, CR_CW_AUTO_DETECT_COMPRESSION,
+                         err);
+    int ret;
+
+    if (!f) {
+        g_string_free(content, TRUE);
+        return NULL;
+    }
+
+    do {
+        g_string_set_size(content, content->len + READ_CHUNK);
+        ret = cr_read(f, content->str + content->len - READ_CHUNK,
+                      READ_CHUNK, err);
+        g_string_set_size(content, content->len - READ_CHUNK
+                          + (ret > 0 ? ret : 0));
+    } while (ret > 0);
+
+    cr_close(f, NULL);
+    if (ret < 0) {
+        g_string_free(content, TRUE);
+        return NULL;
+    }
+    return content;
+}
+
+/** Compress all the contents into files in the tmpdir.
+ * @return      Sum of the sizes of the files, -1 on error
+ */
+static gint64
+compress_all(GString **contents,
+             const char *tmpdir,
+             cr_CompressionType type,
+             GError **err)
+{
+    gint64 size = 0;
+
+    for (int x = 0; contents[x]; x++) {
+        gchar *path = g_strdup_printf("%s/%d%s", tmpdir, x,
+                                      cr_compression_suffix(type));
+        CR_FILE *f = cr_open(path, CR_CW_MODE_WRITE, type, err);
+        gboolean ok = (f != NULL);
+        GStatBuf st;
+
+        if (ok && cr_write(f, contents[x]->str, contents[x]->len, err)
+                  != (int) contents[x]->len)
+            ok = FALSE;
+        if (f && cr_close(f, ok ? err : NULL) != CRE_OK)
+            ok = FALSE;
+        if (ok && g_stat(path, &st) != 0) {
+            g_set_error(err, CREATEREPO_C_ERROR, CRE_IO, "Cannot stat %s",
+                        path);
+            ok = FALSE;
+        }
+
+        g_free(path);
+        if (!ok)
+            return -1;
+
+        size += st.st_size;
+    }
+
+    return size;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gint rounds = 3, buffer_size = 0;
+    gchar *type_str = NULL;
+    cr_CompressionType only_type = CR_CW_UNKNOWN_COMPRESSION;
+    GError *tmp_err = NULL;
+    struct cr_MetadataLocation *ml;
+    GString *contents[4] = { NULL };
+    gsize total = 0;
+    gchar *tmpdir;
+    int ret = EXIT_SUCCESS;
+    GOptionEntry entries[] = {
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+          "Number of rounds for each level (default 3)", "ROUNDS" },
+        { "type", 't', 0, G_OPTION_ARG_STRING, &type_str,
+          "Compression type (default all)", "TYPE" },
+        { "buffer-size", 'b', 0, G_OPTION_ARG_INT, &buffer_size,
+          "Size of I/O buffers in bytes (default of createrepo_c)",
+          "BUFFER_SIZE" },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
+    };
+
+    GOptionContext *context = g_option_context_new("REPO");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (type_str) {
+        only_type = cr_compression_type(type_str);
+        if (only_type == CR_CW_UNKNOWN_COMPRESSION) {
+            fprintf(stderr, "Unknown compression type \"%s\"\n", type_str);
+            return EXIT_FAILURE;
+        }
+        g_free(type_str);
+    }
+
+    if (argc != 2 || rounds < 1 || buffer_size < 0) {
+        fprintf(stderr, "Usage: %s [-r ROUNDS] [-t TYPE] [-b BUFFER_SIZE] "
+                "REPO\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!cr_set_io_buffer_size(buffer_size, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+
+    ml = cr_locate_metadata(argv[1], TRUE, &tmp_err);
+    if (!ml || !ml->pri_xml_href || !ml->fil_xml_href || !ml->oth_xml_href) {
+        fprintf(stderr, "Cannot locate metadata in %s%s%s\n", argv[1],
+                tmp_err ? ": " : "", tmp_err ? tmp_err->message : "");
+        return EXIT_FAILURE;
+    }
+
+    const char *paths[] = { ml->pri_xml_href, ml->fil_xml_href,
+                            ml->oth_xml_href };
+    for (int x = 0; x < 3; x++) {
+        contents[x] = read_file(paths[x], &tmp_err);
+        if (!contents[x]) {
+            fprintf(stderr, "Cannot read %s: %s\n", paths[x],
+                    tmp_err->message);
+            return EXIT_FAILURE;
+        }
+        total += contents[x]->len;
+    }
+    cr_metadatalocation_free(ml);
+
+    tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    if (!mkdtemp(tmpdir)) {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%s (%.1f MiB of XML, buffer %zu bytes)\n", argv[1],
+           total / (1024.0 * 1024.0), cr_get_io_buffer_size());
+
+    for (size_t t = 0; t < G_N_ELEMENTS(types) && ret == EXIT_SUCCESS; t++) {
+        cr_CompressionType type = types[t].type;
+        int default_level = cr_compression_level(type);
+
+        // Z_DEFAULT_COMPRESSION of zlib is the level 6
+        if (type == CR_CW_GZ_COMPRESSION && default_level < 0)
+            default_level = 6;
+
+        if (only_type != CR_CW_UNKNOWN_COMPRESSION && type != only_type)
+            continue;
+
+        for (int level = types[t].min_level;
+             level <= types[t].max_level && ret == EXIT_SUCCESS;
+             level++)
+        {
+            gdouble best = 0.0;
+            gint64 size = 0;
+
+            if (!cr_compression_set_level(type, level, &tmp_err)) {
+                fprintf(stderr, "%s\n", tmp_err->message);
+                g_clear_error(&tmp_err);
+                break;
+            }
+
+            for (gint r = 0; r < rounds; r++) {
+                GTimer *timer = g_timer_new();
+                size = compress_all(contents, tmpdir, type, &tmp_err);
+                gdouble elapsed = g_timer_elapsed(timer, NULL);
+                g_timer_destroy(timer);
+
+                if (size < 0) {
+                    fprintf(stderr, "%s: %s\n", cr_compression_suffix(type),
+                            tmp_err->message);
+                    g_clear_error(&tmp_err);
+                    ret = EXIT_FAILURE;
+                    break;
+                }
+
+                if (r == 0 || elapsed < best)
+                    best = elapsed;
+            }
+
+            if (ret == EXIT_SUCCESS)
+                printf("  %-4s %2d%s %8.3f s %10.1f MiB/s %7.2f %%\n",
+                       cr_compression_suffix(type) + 1, level,
+                       level == default_level ? "*" : " ",
+                       best,
+                       best > 0 ? total / (1024.0 * 1024.0) / best : 0.0,
+                       total ? 100.0 * size / total : 0.0);
+        }
+
+        cr_compression_set_level(type, default_level, NULL);
+    }
+
+    for (int x = 0; contents[x]; x++)
+        g_string_free(contents[x], TRUE);
+    cr_remove_dir(tmpdir, NULL);
+    g_free(tmpdir);
+
+    return ret;
+}
@@ -0,0 +1,481 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Benchmark of the stages of the metadata generation on a synthetic repo.
+ *
+ * Usage: bench_pipeline [-r ROUNDS] [-p PACKAGES] [-f FILES]
+ *                       [-c CHANGELOGS] [-s CHANGELOG_SIZE] [RPM ...]
+ *
+ * The packages are generated in memory (with the given number of files
+ * and changelog entries of the given size) and every stage runs on all
+ * of them: the XML dump, the insertion into the sqlite dbs, the writing
+ * of the XML with every compression, the checksum of the XML and
+ * the loading of the written metadata. The reading of rpm headers needs
+ * real packages, it is measured only on the given RPM files (e.g.
+ * tests/testdata/packages/*.rpm).
+ * The best round of every stage is reported in operations (packages,
+ * written chunks or files) per second and MiB per second.
+ * This program is not a part of the test suite (run_tests.sh runs only
+ * test_* binaries).
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "fixtures.h"
+#include "createrepo/checksum.h"
+#include "createrepo/compression_wrapper.h"
+#include "createrepo/error.h"
+#include "createrepo/load_metadata.h"
+#include "createrepo/locate_metadata.h"
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/parsepkg.h"
+#include "createrepo/sqlite.h"
+#include "createrepo/xml_dump.h"
+#include "createrepo/xml_file.h"
+
+typedef struct {
+    GPtrArray *packages;    /*!< Generated cr_Package objects */
+    GPtrArray *chunks;      /*!< XML chunks of the packages */
+    guint64 xml_size;       /*!< Size of all the chunks */
+    gchar *tmpdir;          /*!< Directory for the written files */
+    gchar *xml_path;        /*!< All the chunks in one file */
+    struct cr_MetadataLocation *ml; /*!< Written primary, filelists and
+                                         other */
+    char **rpms;            /*!< Paths to the rpm files */
+    cr_CompressionType comtype; /*!< Compression of bench_write() */
+} BenchCtx;
+
+/** Run one round of a stage.
+ * @return      FALSE on error
+ */
+typedef gboolean (*BenchFunc)(BenchCtx *ctx,
+                              guint64 *ops,
+                              guint64 *bytes,
+                              GError **err);
+
+static cr_Package *
+generate_package(guint num, gint files, gint changelogs, gint changelog_size)
+{
+    cr_Package *pkg = cr_package_new();
+    GStringChunk *chunk = pkg->chunk;
+    gchar *str, *dir, *text;
+
+    str = g_strdup_printf("bench-%06u", num);
+    pkg->name = g_string_chunk_insert(chunk, str);
+    g_free(str);
+    str = g_strdup_printf("Packages/%s-1.0-1.x86_64.rpm", pkg->name);
+    pkg->location_href = g_string_chunk_insert(chunk, str);
+    g_free(str);
+    str = g_strdup_printf("%064u", num);
+    pkg->pkgId = g_string_chunk_insert(chunk, str);
+    g_free(str);
+
+    pkg->arch = g_string_chunk_insert(chunk, "x86_64");
+    pkg->epoch = g_string_chunk_insert(chunk, "0");
+    pkg->version = g_string_chunk_insert(chunk, "1.0");
+    pkg->release = g_string_chunk_insert(chunk, "1");
+    pkg->checksum_type = g_string_chunk_insert(chunk, "sha256");
+    pkg->summary = g_string_chunk_insert(chunk, "Synthetic package");
+    pkg->description = g_string_chunk_insert(chunk,
+                            "Synthetic package generated by bench_pipeline");
+    pkg->url = g_string_chunk_insert(chunk, "http://example.com/");
+    pkg->rpm_license = g_string_chunk_insert(chunk, "GPLv2+");
+    pkg->rpm_group = g_string_chunk_insert(chunk, "Unspecified");
+    pkg->rpm_buildhost = g_string_chunk_insert(chunk, "localhost");
+    pkg->rpm_sourcerpm = g_string_chunk_insert(chunk, "bench-1.0-1.src.rpm");
+    pkg->time_file = 1400000000 + num;
+    pkg->time_build = 1400000000;
+    pkg->size_package = 10240 + num;
+    pkg->size_installed = 40960;
+    pkg->size_archive = 41984;
+    pkg->rpm_header_start = 280;
+    pkg->rpm_header_end = 4096;
+
+    cr_Dependency *provide = cr_dependency_new();
+    provide->name = pkg->name;
+    provide->flags = g_string_chunk_insert(chunk, "EQ");
+    provide->epoch = pkg->epoch;
+    provide->version = pkg->version;
+    provide->release = pkg->release;
+    pkg->provides = g_slist_prepend(pkg->provides, provide);
+
+    cr_Dependency *require = cr_dependency_new();
+    require->name = g_string_chunk_insert(chunk, "libc.so.6()(64bit)");
+    pkg->requires = g_slist_prepend(pkg->requires, require);
+
+    dir = g_strdup_printf("/usr/share/%s/", pkg->name);
+    for (gint x = 0; x < files; x++) {
+        cr_PackageFile *file = cr_package_file_new();
+        file->type = g_string_chunk_insert(chunk, "");
+        file->path = g_string_chunk_insert(chunk, dir);
+        str = g_strdup_printf("file-%d.txt", x);
+        file->name = g_string_chunk_insert(chunk, str);
+        g_free(str);
+        pkg->files = g_slist_prepend(pkg->files, file);
+    }
+    g_free(dir);
+
+    text = g_strnfill(changelog_size, 'x');
+    for (gint x = 0; x < changelogs; x++) {
+        cr_ChangelogEntry *entry = cr_changelog_entry_new();
+        entry->author = g_string_chunk_insert(chunk,
+                            "Packager <packager@example.com> - 1.0-1");
+        entry->date = 1400000000 - x * 86400;
+        entry->changelog = g_string_chunk_insert(chunk, text);
+        pkg->changelogs = g_slist_prepend(pkg->changelogs, entry);
+    }
+    g_free(text);
+
+    pkg->files = g_slist_reverse(pkg->files);
+    return pkg;
+}
+
+static gboolean
+bench_xml_dump(BenchCtx *ctx, guint64 *ops, guint64 *bytes, GError **err)
+{
+    for (guint x = 0; x < ctx->packages->len; x++) {
+        struct cr_XmlStruct xml = cr_xml_dump(ctx->packages->pdata[x], err);
+        if (!xml.primary)
+            return FALSE;
+        *bytes += strlen(xml.primary) + strlen(xml.filelists)
+                  + strlen(xml.other);
+        g_free(xml.primary);
+        g_free(xml.filelists);
+        g_free(xml.other);
+    }
+    *ops = ctx->packages->len;
+    return TRUE;
+}
+
+static gboolean
+bench_sqlite(BenchCtx *ctx, guint64 *ops, guint64 *bytes, GError **err)
+{
+    static const char *names[] = { "primary", "filelists", "other" };
+    static const cr_DatabaseType types[] = {
+        CR_DB_PRIMARY, CR_DB_FILELISTS, CR_DB_OTHER
+    };
+    gboolean ret = TRUE;
+
+    for (size_t d = 0; ret && d < G_N_ELEMENTS(types); d++) {
+        gchar *path = g_strdup_printf("%s/%s.sqlite", ctx->tmpdir, names[d]);
+        cr_SqliteDb *db;
+        GStatBuf st;
+
+        g_unlink(path);
+        db = cr_db_open(path, types[d], err);
+        if (!db) {
+            g_free(path);
+            return FALSE;
+        }
+
+        for (guint x = 0; x < ctx->packages->len; x++)
+            if (cr_db_add_pkg(db, ctx->packages->pdata[x], err) != CRE_OK) {
+                ret = FALSE;
+                break;
+            }
+
+        if (ret)
+            ret = (cr_db_close(db, err) == CRE_OK);
+        else
+            cr_db_close(db, NULL);
+        if (ret && g_stat(path, &st) == 0)
+            *bytes += st.st_size;
+        g_free(path);
+    }
+
+    *ops = ctx->packages->len;
+    return ret;
+}
+
+static gboolean
+bench_write(BenchCtx *ctx, guint64 *ops, guint64 *bytes, GError **err)
+{
+    gchar *path = g_strdup_printf("%s/write%s", ctx->tmpdir,
+                                  cr_compression_suffix(ctx->comtype) ?: "");
+    CR_FILE *f = cr_open(path, CR_CW_MODE_WRITE, ctx->comtype, err);
+    g_free(path);
+    if (!f)
+        return FALSE;
+
+    for (guint x = 0; x < ctx->chunks->len; x++) {
+        const char *chunk = ctx->chunks->pdata[x];
+        size_t len = strlen(chunk);
+        if (cr_write(f, chunk, len, err) != (int) len) {
+            cr_close(f, NULL);
+            return FALSE;
+        }
+    }
+
+    if (cr_close(f, err) != CRE_OK)
+        return FALSE;
+
+    *ops = ctx->chunks->len;
+    *bytes = ctx->xml_size;
+    return TRUE;
+}
+
+static gboolean
+bench_checksum(BenchCtx *ctx, guint64 *ops, guint64 *bytes, GError **err)
+{
+    char *checksum = cr_checksum_file(ctx->xml_path, CR_CHECKSUM_SHA256, err);
+    if (!checksum)
+        return FALSE;
+    g_free(checksum);
+    *ops = 1;
+    *bytes = ctx->xml_size;
+    return TRUE;
+}
+
+static gboolean
+bench_load_xml(BenchCtx *ctx, guint64 *ops, guint64 *bytes, GError **err)
+{
+    cr_Metadata *md = cr_metadata_new(CR_HT_KEY_HASH, 0, NULL);
+    int rc = cr_metadata_load_xml(md, ctx->ml, err);
+    if (rc == CRE_OK)
+        *ops = g_hash_table_size(cr_metadata_hashtable(md));
+    cr_metadata_free(md);
+    *bytes = ctx->xml_size;
+    return rc == CRE_OK;
+}
+
+static gboolean
+bench_from_rpm(BenchCtx *ctx, guint64 *ops, guint64 *bytes, GError **err)
+{
+    for (char **rpm = ctx->rpms; *rpm; rpm++) {
+        gchar *href = g_path_get_basename(*rpm);
+        cr_Package *pkg = cr_package_from_rpm(*rpm, CR_CHECKSUM_SHA256, href,
+                                              NULL, 10, NULL, CR_HDRR_NONE,
+                                              err);
+        g_free(href);
+        if (!pkg)
+            return FALSE;
+        *bytes += pkg->size_package;
+        cr_package_free(pkg);
+        (*ops)++;
+    }
+    return TRUE;
+}
+
+static gboolean
+run(BenchCtx *ctx, const char *name, BenchFunc func, gint rounds)
+{
+    gdouble best = 0.0;
+    guint64 ops = 0, bytes = 0;
+
+    for (gint r = 0; r < rounds; r++) {
+        GError *tmp_err = NULL;
+        GTimer *timer = g_timer_new();
+        guint64 round_ops = 0, round_bytes = 0;
+        gboolean ok = func(ctx, &round_ops, &round_bytes, &tmp_err);
+        gdouble elapsed = g_timer_elapsed(timer, NULL);
+        g_timer_destroy(timer);
+
+        if (!ok) {
+            fprintf(stderr, "%s: %s\n", name,
+                    tmp_err ? tmp_err->message : "Unknown error");
+            g_clear_error(&tmp_err);
+            return FALSE;
+        }
+
+        if (r == 0 || elapsed < best) {
+            best = elapsed;
+            ops = round_ops;
+            bytes = round_bytes;
+        }
+    }
+
+    printf("  %-16s %8.3f s %12.1f ops/s %10.1f MiB/s\n", name, best,
+           best > 0 ? ops / best : 0.0,
+           best > 0 ? bytes / (1024.0 * 1024.0) / best : 0.0);
+    return TRUE;
+}
+
+static gboolean
+write_metadata(BenchCtx *ctx, GError **err)
+{
+    cr_XmlFile *files[3];
+    GString *all = g_string_sized_new(1024 * 1024);
+    gboolean ret = TRUE;
+
+    ctx->ml = g_malloc0(sizeof(*ctx->ml));
+    ctx->ml->pri_xml_href = g_strconcat(ctx->tmpdir, "/primary.xml.gz", NULL);
+    ctx->ml->fil_xml_href = g_strconcat(ctx->tmpdir, "/filelists.xml.gz",
+                                        NULL);
+    ctx->ml->oth_xml_href = g_strconcat(ctx->tmpdir, "/other.xml.gz", NULL);
+    ctx->ml->local_path = g_strdup(ctx->tmpdir);
+
+    files[0] = cr_xmlfile_open_primary(ctx->ml->pri_xml_href,
+                                       CR_CW_GZ_COMPRESSION, err);
+    files[1] = files[0] ? cr_xmlfile_open_filelists(ctx->ml->fil_xml_href,
+                                                    CR_CW_GZ_COMPRESSION,
+                                                    err) : NULL;
+    files[2] = files[1] ? cr_xmlfile_open_other(ctx->ml->oth_xml_href,
+                                                CR_CW_GZ_COMPRESSION,
+                                                err) : NULL;
+    if (!files[2])
+        ret = FALSE;
+
+    for (int f = 0; ret && f < 3; f++)
+        ret = (cr_xmlfile_set_num_of_pkgs(files[f], ctx->packages->len,
+                                          err) == CRE_OK);
+
+    for (guint x = 0; ret && x < ctx->packages->len; x++) {
+        struct cr_XmlStruct xml = cr_xml_dump(ctx->packages->pdata[x], err);
+        if (!xml.primary) {
+            ret = FALSE;
+            break;
+        }
+
+        ret = cr_xmlfile_add_chunk(files[0], xml.primary, err) == CRE_OK
+              && cr_xmlfile_add_chunk(files[1], xml.filelists, err) == CRE_OK
+              && cr_xmlfile_add_chunk(files[2], xml.other, err) == CRE_OK;
+
+        g_string_append(all, xml.primary);
+        g_string_append(all, xml.filelists);
+        g_string_append(all, xml.other);
+        g_ptr_array_add(ctx->chunks, xml.primary);
+        g_ptr_array_add(ctx->chunks, xml.filelists);
+        g_ptr_array_add(ctx->chunks, xml.other);
+    }
+
+    for (int f = 0; f < 3; f++)
+        if (files[f] && cr_xmlfile_close(files[f], ret ? err : NULL) != CRE_OK)
+            ret = FALSE;
+
+    ctx->xml_size = all->len;
+    ctx->xml_path = g_strconcat(ctx->tmpdir, "/all.xml", NULL);
+    if (ret && !g_file_set_contents(ctx->xml_path, all->str, all->len, err))
+        ret = FALSE;
+
+    g_string_free(all, TRUE);
+    return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gint rounds = 3, packages = 1000, files = 20, changelogs = 10;
+    gint changelog_size = 200;
+    gboolean ret = TRUE;
+    GError *tmp_err = NULL;
+    BenchCtx ctx = { 0 };
+    GOptionEntry entries[] = {
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+          "Number of rounds for each stage (default 3)", "ROUNDS" },
+        { "packages", 'p', 0, G_OPTION_ARG_INT, &packages,
+          "Number of generated packages (default 1000)", "PACKAGES" },
+        { "files", 'f', 0, G_OPTION_ARG_INT, &files,
+          "Number of files per package (default 20)", "FILES" },
+        { "changelogs", 'c', 0, G_OPTION_ARG_INT, &changelogs,
+          "Number of changelog entries per package (default 10)",
+          "CHANGELOGS" },
+        { "changelog-size", 's', 0, G_OPTION_ARG_INT, &changelog_size,
+          "Size of a changelog entry in bytes (default 200)", "BYTES" },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
+    };
+
+    GOptionContext *context = g_option_context_new("[RPM ...]");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (rounds < 1 || packages < 1 || files < 0 || changelogs < 0
+        || changelog_size < 0)
+    {
+        fprintf(stderr, "Usage: %s [-r ROUNDS] [-p PACKAGES] [-f FILES] "
+                "[-c CHANGELOGS] [-s CHANGELOG_SIZE] [RPM ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    cr_xml_dump_init();
+    cr_package_parser_init();
+
+    ctx.tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    if (!mkdtemp(ctx.tmpdir)) {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    ctx.rpms = argv + 1;
+    ctx.packages = g_ptr_array_new_with_free_func(
+                                        (GDestroyNotify) cr_package_free);
+    ctx.chunks = g_ptr_array_new_with_free_func(g_free);
+    for (gint x = 0; x < packages; x++)
+        g_ptr_array_add(ctx.packages, generate_package(x, files, changelogs,
+                                                       changelog_size));
+
+    if (!write_metadata(&ctx, &tmp_err)) {
+        fprintf(stderr, "Cannot write metadata: %s\n", tmp_err->message);
+        g_clear_error(&tmp_err);
+        ret = FALSE;
+    }
+
+    if (ret) {
+        printf("%d packages, %d files, %d changelogs of %d bytes "
+               "(%.1f MiB of XML)\n", packages, files, changelogs,
+               changelog_size, ctx.xml_size / (1024.0 * 1024.0));
+
+        ret = run(&ctx, "xml_dump", bench_xml_dump, rounds)
+              && run(&ctx, "sqlite", bench_sqlite, rounds)
+              && run(&ctx, "checksum", bench_checksum, rounds)
+              && run(&ctx, "load_xml", bench_load_xml, rounds);
+    }
+
+    for (int c = CR_CW_NO_COMPRESSION; ret && c < CR_CW_COMPRESSION_SENTINEL;
+         c++)
+    {
+        gchar *name;
+#ifndef WITH_ZCHUNK
+        if (c == CR_CW_ZCK_COMPRESSION)
+            continue;
+#endif
+#ifndef WITH_ZSTD
+        if (c == CR_CW_ZSTD_COMPRESSION)
+            continue;
+#endif
+        ctx.comtype = c;
+        name = g_strconcat("write_", cr_compression_suffix(c) ?
+                           cr_compression_suffix(c) + 1 : "none", NULL);
+        ret = run(&ctx, name, bench_write, rounds);
+        g_free(name);
+    }
+
+    if (ret && *ctx.rpms)
+        ret = run(&ctx, "from_rpm", bench_from_rpm, rounds);
+
+    g_ptr_array_free(ctx.packages, TRUE);
+    g_ptr_array_free(ctx.chunks, TRUE);
+    cr_metadatalocation_free(ctx.ml);
+    g_free(ctx.xml_path);
+    cr_remove_dir(ctx.tmpdir, NULL);
+    g_free(ctx.tmpdir);
+
+    cr_package_parser_cleanup();
+    cr_xml_dump_cleanup();
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,242 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Benchmark of the primary files filter.
+ *
+ * Usage: bench_primary [-r ROUNDS] [-n FILES] [FILELIST]
+ *
+ * The paths are read from the FILELIST (one full path per line, e.g. the
+ * output of "rpm -qla") or generated (FILES paths in typical directories).
+ * Every path is split into its directory and name (as in cr_PackageFile)
+ * and checked by: the former strstr() based filter, cr_is_primary() of
+ * the full path, the concatenation of the parts with cr_is_primary()
+ * (what the dumpers did for every file) and cr_is_primary_file().
+ * All of them must agree, the best round of every one is reported in
+ * millions of files per second.
+ * This program is not a part of the test suite (run_tests.sh runs only
+ * test_* binaries).
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "createrepo/misc.h"
+
+typedef struct {
+    GPtrArray *full;
+    GPtrArray *paths;
+    GPtrArray *names;
+} FileList;
+
+typedef enum {
+    FILTER_STRSTR,
+    FILTER_FULL,
+    FILTER_CONCAT,
+    FILTER_SPLIT,
+} Filter;
+
+static const char *filter_names[] = {
+    "strstr", "full", "concat", "split",
+};
+
+/** The filter before the switch on the first characters and the scan
+ * for slashes.
+ */
+static int
+is_primary_strstr(const char *filename)
+{
+    if (!strncmp(filename, "/etc/", 5))
+        return 1;
+    if (!strcmp(filename, "/usr/lib/sendmail"))
+        return 1;
+    if (strstr(filename, "bin/"))
+        return 1;
+    return 0;
+}
+
+static void
+filelist_add(FileList *list, const char *full)
+{
+    const char *slash = strrchr(full, '/');
+    gsize path_len = slash ? (gsize) (slash - full) + 1 : 0;
+
+    g_ptr_array_add(list->full, g_strdup(full));
+    g_ptr_array_add(list->paths, g_strndup(full, path_len));
+    g_ptr_array_add(list->names, g_strdup(full + path_len));
+}
+
+static void
+filelist_generate(FileList *list, guint count)
+{
+    static const char *dirs[] = {
+        "/usr/share/doc/%s/",
+        "/usr/share/locale/de/LC_MESSAGES/",
+        "/usr/lib64/python3.12/site-packages/%s/",
+        "/usr/share/man/man1/",
+        "/usr/include/%s/",
+        "/usr/bin/",
+        "/etc/%s/",
+        "/usr/lib/",
+    };
+    GString *full = g_string_sized_new(256);
+
+    for (guint x = 0; x < count; x++) {
+        gchar *pkg = g_strdup_printf("package%u", x / 1000);
+        g_string_printf(full, dirs[x % G_N_ELEMENTS(dirs)], pkg);
+        g_string_append_printf(full, "file%u", x);
+        filelist_add(list, full->str);
+        g_free(pkg);
+    }
+
+    g_string_free(full, TRUE);
+}
+
+static gboolean
+filelist_read(FileList *list, const char *filename, GError **err)
+{
+    gchar *content, **lines;
+
+    if (!g_file_get_contents(filename, &content, NULL, err))
+        return FALSE;
+
+    lines = g_strsplit(content, "\n", -1);
+    for (gchar **line = lines; *line; line++)
+        if (**line)
+            filelist_add(list, *line);
+
+    g_strfreev(lines);
+    g_free(content);
+    return TRUE;
+}
+
+static guint
+run_filter(Filter filter, FileList *list)
+{
+    guint primary = 0;
+
+    for (guint x = 0; x < list->full->len; x++) {
+        const char *path = list->paths->pdata[x];
+        const char *name = list->names->pdata[x];
+        gchar *full;
+
+        switch (filter) {
+            case FILTER_STRSTR:
+                primary += is_primary_strstr(list->full->pdata[x]);
+                break;
+            case FILTER_FULL:
+                primary += cr_is_primary(list->full->pdata[x]);
+                break;
+            case FILTER_CONCAT:
+                full = g_strconcat(path, name, NULL);
+                primary += cr_is_primary(full);
+                g_free(full);
+                break;
+            case FILTER_SPLIT:
+                primary += cr_is_primary_file(path, name);
+                break;
+        }
+    }
+
+    return primary;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gint rounds = 5;
+    gint count = 1000000;
+    GError *tmp_err = NULL;
+    GOptionEntry entries[] = {
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+          "Number of rounds for each filter (default 5)", "ROUNDS" },
+        { "files", 'n', 0, G_OPTION_ARG_INT, &count,
+          "Number of generated files (default 1000000)", "FILES" },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL },
+    };
+    FileList list;
+
+    GOptionContext *context = g_option_context_new("[FILELIST]");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (argc > 2 || rounds < 1 || count < 1) {
+        fprintf(stderr, "Usage: %s [-r ROUNDS] [-n FILES] [FILELIST]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    list.full  = g_ptr_array_new_with_free_func(g_free);
+    list.paths = g_ptr_array_new_with_free_func(g_free);
+    list.names = g_ptr_array_new_with_free_func(g_free);
+
+    if (argc == 2) {
+        if (!filelist_read(&list, argv[1], &tmp_err)) {
+            fprintf(stderr, "%s\n", tmp_err->message);
+            return EXIT_FAILURE;
+        }
+    } else {
+        filelist_generate(&list, count);
+    }
+
+    // Every filter must give the same answer for every file
+    for (guint x = 0; x < list.full->len; x++) {
+        const char *full = list.full->pdata[x];
+        int expected = is_primary_strstr(full);
+        if (cr_is_primary(full) != expected
+            || cr_is_primary_file(list.paths->pdata[x],
+                                  list.names->pdata[x]) != expected)
+        {
+            fprintf(stderr, "Filters disagree on %s\n", full);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%u files\n", list.full->len);
+
+    for (Filter f = FILTER_STRSTR; f <= FILTER_SPLIT; f++) {
+        gdouble best = 0.0;
+        guint primary = 0;
+
+        for (gint r = 0; r < rounds; r++) {
+            GTimer *timer = g_timer_new();
+            primary = run_filter(f, &list);
+            gdouble elapsed = g_timer_elapsed(timer, NULL);
+            g_timer_destroy(timer);
+
+            if (r == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        printf("  %-8s %8.3f s %10.1f Mfiles/s (%u primary)\n",
+               filter_names[f], best,
+               best > 0 ? list.full->len / best / 1000000.0 : 0.0,
+               primary);
+    }
+
+    g_ptr_array_free(list.full, TRUE);
+    g_ptr_array_free(list.paths, TRUE);
+    g_ptr_array_free(list.names, TRUE);
+
+    return EXIT_SUCCESS;
+}
@@ -69,6 +69,8 @@
 #define TEST_REPO_WITH_ADDITIONAL_METADATA_FILELISTS_SQLITE_BZ2  TEST_REPO_WITH_ADDITIONAL_METADATA"repodata/4f4de7d3254a033b84626f330bc6adb8a3c1a4a20f0ddbe30a5692a041318c81-filelists.sqlite.bz2"
 #define TEST_REPO_WITH_ADDITIONAL_METADATA_OTHER_XML_GZ          TEST_REPO_WITH_ADDITIONAL_METADATA"repodata/fd458a424a3f3e0dadc95b806674b79055c24e73637e47ad5a6e57926aa1b9d1-other.xml.gz"
 #define TEST_REPO_WITH_ADDITIONAL_METADATA_OTHER_SQLITE_BZ2      TEST_REPO_WITH_ADDITIONAL_METADATA"repodata/8b13cba732c1a02b841f43d6791ca68788d45f376787d9f3ccf68e75f01af499-other.sqlite.bz2"
+#define TEST_REPO_WITH_ADDITIONAL_METADATA_PRIMARY_XML_ZCK       TEST_REPO_WITH_ADDITIONAL_METADATA"repodata/e9e6ca4765de75cc3b2bf05e6cf631703c6557edd642300748d7747000547365-primary.xml.zck"
+#define TEST_REPO_WITH_ADDITIONAL_METADATA_FILELISTS_XML_ZCK     TEST_REPO_WITH_ADDITIONAL_METADATA"repodata/3d6eaa7c77ef92586470dd6a542478e42cc421a85f12e0db93aa783077704cd0-filelists.xml.zck"
 
 // Modified repo files (MFR)
 
@@ -0,0 +1,50 @@
+import unittest
+import shutil
+import tempfile
+import os.path
+import createrepo_c as cr
+
+from .fixtures import *
+
+class TestCaseCreaterepo(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp(prefix="createrepo_ctest-")
+        for path in (PKG_ARCHER_PATH, PKG_FAKE_BASH_PATH):
+            shutil.copy(path, self.tmpdir)
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def test_createrepo(self):
+        res = cr.createrepo(self.tmpdir, quiet=True, workers=2)
+        self.assertEqual(res["task_count"], 2)
+        self.assertEqual(res["package_count"], 2)
+        self.assertFalse(res["had_errors"])
+        self.assertEqual(res["exit_val"], 0)
+        self.assertEqual(res["repomd_path"],
+                         os.path.join(self.tmpdir, "repodata/repomd.xml"))
+        self.assertTrue(os.path.isfile(res["repomd_path"]))
+
+        # The second run in the same process reuses the old metadata
+        shutil.copy(PKG_EMPTY_PATH, self.tmpdir)
+        res = cr.createrepo(self.tmpdir, quiet=True, update=True,
+                            excludes=[PKG_FAKE_BASH], simple_md_filenames=True)
+        self.assertEqual(res["package_count"], 2)
+        self.assertTrue(os.path.isfile(
+            os.path.join(self.tmpdir, "repodata/primary.xml.gz")))
+        self.assertFalse(os.path.exists(
+            os.path.join(self.tmpdir, ".repodata")))
+
+    def test_createrepo_errors(self):
+        self.assertRaises(IOError, cr.createrepo,
+                          os.path.join(self.tmpdir, "nonexistent"), quiet=True)
+        self.assertRaises(ValueError, cr.createrepo,
+                          self.tmpdir, quiet=True, compress_level="xz:42")
+
+        # The lock of another process is kept
+        os.mkdir(os.path.join(self.tmpdir, ".repodata"))
+        self.assertRaises(IOError, cr.createrepo,
+                          self.tmpdir, quiet=True)
+        self.assertTrue(os.path.isdir(os.path.join(self.tmpdir, ".repodata")))
+        self.assertFalse(os.path.exists(os.path.join(self.tmpdir, "repodata")))
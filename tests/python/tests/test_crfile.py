@@ -106,6 +106,22 @@ class TestCaseCrFile(unittest.TestCase):
             content = p.stdout.read().decode('utf-8')
             self.assertEqual(content, "foobar")
 
+    def test_crfile_zstd_compression(self):
+        if cr.HAS_ZSTD == 0:
+            return
+
+        path = os.path.join(self.tmpdir, "foo.zst")
+        f = cr.CrFile(path, cr.MODE_WRITE, cr.ZSTD_COMPRESSION)
+        self.assertTrue(f)
+        self.assertTrue(os.path.isfile(path))
+        f.write("foobar")
+        f.close()
+
+        import subprocess
+        with subprocess.Popen(["unzstd", "--stdout", path], stdout=subprocess.PIPE, close_fds=False) as p:
+            content = p.stdout.read().decode('utf-8')
+            self.assertEqual(content, "foobar")
+
     def test_crfile_zck_compression(self):
         if cr.HAS_ZCK == 0:
             return
@@ -121,3 +137,63 @@ class TestCaseCrFile(unittest.TestCase):
         with subprocess.Popen(["unzck", "--stdout", path], stdout=subprocess.PIPE, close_fds=False) as p:
             content = p.stdout.read().decode('utf-8')
             self.assertEqual(content, "foobar")
+
+    def test_crfile_read(self):
+        path = os.path.join(self.tmpdir, "foo.gz")
+        data = b"".join(b"line %d\n" % x for x in range(300000))
+        f = cr.CrFile(path, cr.MODE_WRITE, cr.GZ_COMPRESSION)
+        f.write(data[:10])
+        f.write(bytearray(data[10:20]))
+        f.write(memoryview(data)[20:])
+        f.close()
+
+        f = cr.CrFile(path, cr.MODE_READ, cr.GZ_COMPRESSION)
+        self.assertEqual(f.read(5), data[:5])
+        self.assertEqual(f.read(), data[5:])
+        self.assertEqual(f.read(), b"")
+        f.close()
+
+        # readinto
+        f = cr.CrFile(path, cr.MODE_READ, cr.GZ_COMPRESSION)
+        buf = bytearray(100)
+        self.assertEqual(f.readinto(buf), 100)
+        self.assertEqual(bytes(buf), data[:100])
+        view = memoryview(bytearray(len(data)))
+        self.assertEqual(f.readinto(view), len(data) - 100)
+        self.assertEqual(bytes(view[:len(data) - 100]), data[100:])
+        self.assertEqual(f.readinto(buf), 0)
+        self.assertRaises(TypeError, f.readinto, b"foo")
+        f.close()
+
+        # Iteration over chunks
+        f = cr.CrFile(path, cr.MODE_READ, cr.GZ_COMPRESSION)
+        chunks = list(f)
+        self.assertTrue(len(chunks) > 1)
+        self.assertEqual(b"".join(chunks), data)
+        f.close()
+
+        # Reading of a file opened for writing
+        f = cr.CrFile(path, cr.MODE_WRITE, cr.GZ_COMPRESSION)
+        self.assertRaises(ValueError, f.read)
+        f.close()
+        self.assertRaises(cr.CreaterepoCError, f.read)
+
+    def test_crfile_copy_to(self):
+        path = os.path.join(self.tmpdir, "foo.xz")
+        copy_path = os.path.join(self.tmpdir, "foo.gz")
+        data = b"foobar\n" * 100000
+        f = cr.CrFile(path, cr.MODE_WRITE, cr.XZ_COMPRESSION)
+        f.write(data)
+        f.close()
+
+        src = cr.CrFile(path, cr.MODE_READ, cr.XZ_COMPRESSION)
+        dst = cr.CrFile(copy_path, cr.MODE_WRITE, cr.GZ_COMPRESSION)
+        self.assertRaises(ValueError, src.copy_to, src)
+        self.assertRaises(TypeError, src.copy_to, "foo")
+        self.assertEqual(src.copy_to(dst), len(data))
+        src.close()
+        dst.close()
+
+        import gzip
+        with gzip.open(copy_path) as foo_gz:
+            self.assertEqual(foo_gz.read(), data)
@@ -61,6 +61,39 @@ class TestCaseLoadMetadata(unittest.TestCase):
         md = cr.Metadata(use_single_chunk=True)
         md.locate_and_load_xml(REPO_02_PATH)
         pkg = md.get('90f61e546938a11449b710160ad294618a5bd3062e46f8cf851fd0088af184b7')
-        del(md)  # in fact, md should not be destroyed yet, because it is
-                 # referenced from pkg!
+        del(md)  # pkg gets its own copy of the package
+        self.assertEqual(pkg.name, "fake_bash")
+
+    def test_load_metadata_repo02_iteration(self):
+        md = cr.Metadata()
+        md.locate_and_load_xml(REPO_02_PATH)
+        keys = sorted(md.keys())
+
+        self.assertEqual(sorted(md), keys)
+        self.assertEqual(sorted(md.iterkeys()), keys)
+        self.assertTrue(keys[0] in md)
+        self.assertFalse("foo" in md)
+        self.assertFalse(1 in md)
+        self.assertRaises(KeyError, md.__getitem__, "foo")
+
+        items = sorted(md.items(), key=lambda x: x[0])
+        self.assertEqual([key for key, _ in items], keys)
+        self.assertEqual(sorted(pkg.name for pkg in md.values()),
+                         ["fake_bash", "super_kernel"])
+
+        # Package objects are cached
+        pkg = md[keys[1]]
+        self.assertEqual(pkg.name, "fake_bash")
+        self.assertTrue(pkg is md.get(keys[1]))
+        self.assertTrue(pkg is items[1][1])
+
+        # Modification during the iteration
+        it = md.values()
+        next(it)
+        self.assertTrue(md.remove(keys[0]))
+        self.assertRaises(RuntimeError, next, it)
+
+        # The removed package stays usable
+        self.assertEqual(items[0][1].pkgId, keys[0])
+        del(md)
         self.assertEqual(pkg.name, "fake_bash")
@@ -229,3 +229,65 @@ class TestCasePackage(unittest.TestCase):
         self.assertEqual(pkg_d.name, "FooPackage")
         del(pkg_d)
 
+    def test_package_copy_on_write(self):
+        import copy
+
+        pkg_a = cr.package_from_rpm(PKG_ARCHER_PATH)
+        pkg_b = copy.copy(pkg_a)
+        pkg_c = copy.deepcopy(pkg_a)
+
+        # The copies are independent after a modification of any of them
+        pkg_b.location_href = "b/Archer.rpm"
+        pkg_a.release = "7"
+        pkg_c.requires = []
+        self.assertEqual(pkg_a.location_href, None)
+        self.assertEqual(pkg_b.location_href, "b/Archer.rpm")
+        self.assertEqual(pkg_c.location_href, None)
+        self.assertEqual(pkg_a.release, "7")
+        self.assertEqual(pkg_b.release, "6")
+        self.assertEqual(pkg_c.release, "6")
+        self.assertEqual(pkg_a.requires, pkg_b.requires)
+        self.assertEqual(pkg_c.requires, [])
+        self.assertTrue(len(pkg_a.requires) > 0)
+
+        del(pkg_a)
+        self.assertEqual(pkg_b.name, "Archer")
+        self.assertEqual(pkg_c.name, "Archer")
+
+
+    def test_package_cached_members(self):
+        pkg = cr.package_from_rpm(PKG_ARCHER_PATH)
+
+        # Strings and list items are converted only once
+        self.assertIs(pkg.name, pkg.name)
+        requires = pkg.requires
+        self.assertIsNot(requires, pkg.requires)
+        self.assertEqual(requires, pkg.requires)
+        self.assertIs(requires[0], pkg.requires[0])
+
+        # Modification of the returned list doesn't change the package
+        requires.append(('foo', None, None, None, None, False))
+        self.assertEqual(len(pkg.requires), len(requires) - 1)
+
+        # Setters replace the cached values
+        pkg.name = "foo"
+        self.assertEqual(pkg.name, "foo")
+        pkg.requires = []
+        self.assertEqual(pkg.requires, [])
+        pkg.files = [(None, '/foo/', 'bar')]
+        self.assertEqual(pkg.files, [(None, '/foo/', 'bar')])
+
+    def test_package_cached_members_shared(self):
+        md = cr.Metadata()
+        md.locate_and_load_xml(REPO_01_PATH)
+        key = md.keys()[0]
+
+        # Two objects of the same package see changes of each other
+        pkg_a = md.get(key)
+        pkg_b = md.get(key)
+        self.assertEqual(pkg_a.name, pkg_b.name)
+        self.assertEqual(pkg_a.files, pkg_b.files)
+        pkg_a.name = "foo"
+        pkg_a.files = []
+        self.assertEqual(pkg_b.name, "foo")
+        self.assertEqual(pkg_b.files, [])
@@ -48,6 +48,53 @@ class TestCaseParsepkg(unittest.TestCase):
         # File is not a rpm
         self.assertRaises(IOError, cr.package_from_rpm, FILE_BINARY_PATH)
 
+    def test_package_from_rpm_changelog_limit(self):
+        pkg = cr.package_from_rpm(PKG_ARCHER_PATH, changelog_limit=0)
+        self.assertEqual(pkg.changelogs, [])
+
+        # The newest entries are kept
+        pkg = cr.package_from_rpm(PKG_ARCHER_PATH, changelog_limit=1)
+        self.assertEqual(pkg.changelogs, [
+            ('Tomas Mlcoch <tmlcoch@redhat.com> - 3.3.3-3', 1365422400,
+                '- 3. changelog.')
+            ])
+
+        pkg = cr.package_from_rpm(PKG_ARCHER_PATH, changelog_limit=-1)
+        self.assertEqual(len(pkg.changelogs), 3)
+
+        # Only -1 means all the entries, the other negative limits none
+        pkg = cr.package_from_rpm(PKG_ARCHER_PATH, changelog_limit=-2)
+        self.assertEqual(pkg.changelogs, [])
+
+    def test_package_from_rpms(self):
+        paths = [PKG_ARCHER_PATH, PKG_FAKE_BASH_PATH, PKG_SUPER_KERNEL_PATH,
+                 PKG_EMPTY_PATH] * 5
+        names = ["Archer", "fake_bash", "super_kernel", "empty"] * 5
+
+        pkgs = list(cr.package_from_rpms(paths, workers=3, ordered=True))
+        self.assertEqual([pkg.name for pkg in pkgs], names)
+        self.assertEqual([pkg.location_href for pkg in pkgs], paths)
+
+        pkgs = list(cr.package_from_rpms(paths, workers=3))
+        self.assertEqual(sorted(pkg.name for pkg in pkgs), sorted(names))
+
+        self.assertEqual(list(cr.package_from_rpms([])), [])
+
+        # A bad rpm raises, the other packages are still returned
+        it = cr.package_from_rpms([PKG_ARCHER_PATH, FILE_BINARY_PATH,
+                                   PKG_EMPTY_PATH], workers=2, ordered=True)
+        self.assertEqual(next(it).name, "Archer")
+        self.assertRaises(IOError, next, it)
+        self.assertEqual(next(it).name, "empty")
+        self.assertRaises(StopIteration, next, it)
+
+        # Unconsumed results are dropped with the iterator
+        it = cr.package_from_rpms(paths, workers=2)
+        next(it)
+        del it
+
+        self.assertRaises(TypeError, cr.package_from_rpms, [1, 2])
+
     def test_xml_from_rpm(self):
         xml = cr.xml_from_rpm(PKG_ARCHER_PATH)
         self.assertTrue(xml)
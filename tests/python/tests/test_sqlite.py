@@ -205,6 +205,22 @@ class TestCaseSqlite(unittest.TestCase):
         self.assertEqual(con.execute("select * from db_info").fetchall(),
             [(10, u'somechecksum')])
 
+    def test_sqlite_primary_add_pkgs(self):
+        path = os.path.join(self.tmpdir, "primary.db")
+        db = cr.Sqlite(path, cr.DB_PRIMARY)
+        pkgs = [cr.package_from_rpm(PKG_ARCHER_PATH),
+                cr.package_from_rpm(PKG_BALICEK_UTF8_PATH)]
+        self.assertEqual(db.add_pkgs(iter(pkgs)), 2)
+        self.assertEqual(db.add_pkgs([]), 0)
+        self.assertRaises(TypeError, db.add_pkgs, None)
+        self.assertRaises(TypeError, db.add_pkgs, [pkgs[0], "foo"])
+        db.close()
+        self.assertRaises(cr.CreaterepoCError, db.add_pkgs, pkgs)
+
+        con = sqlite3.connect(path)
+        self.assertEqual(con.execute("select pkgKey, name from packages").fetchall(),
+            [(1, u'Archer'), (2, u'balicek-utf8')])
+
     def test_sqlite_filelists(self):
         path = os.path.join(self.tmpdir, "filelists.db")
         db = cr.Sqlite(path, cr.DB_FILELISTS)
@@ -80,6 +80,28 @@ class TestCaseUpdateInfo(unittest.TestCase):
         self.assertRaisesRegex(cr.CreaterepoCError, "Unable to parse updateinfo record date: 15mangled2",
                                rec.__getattribute__, "issued_date")
 
+    def test_updateinfo_lookup(self):
+        ui = cr.UpdateInfo(TEST_UPDATEINFO_03)
+
+        rec = ui.get_record("RHEA-2012:0057")
+        self.assertTrue(rec)
+        self.assertEqual(rec.id, "RHEA-2012:0057")
+        self.assertEqual(ui.get_record("RHEA-2012:0000"), None)
+
+        recs = ui.get_records_by_package("duck")
+        self.assertEqual([r.id for r in recs],
+                         ["RHEA-2012:0056", "RHEA-2012:0059", "RHEA-2012:0060"])
+        recs = ui.get_records_by_package("duck", version="0.7", release="1",
+                                         arch="noarch")
+        self.assertEqual([r.id for r in recs], ["RHEA-2012:0059"])
+        self.assertEqual(ui.get_records_by_package("cat"), [])
+
+        # Appended records are found too
+        rec = cr.UpdateRecord()
+        rec.id = "RHEA-2012:0061"
+        ui.append(rec)
+        self.assertEqual(ui.get_record("RHEA-2012:0061").id, "RHEA-2012:0061")
+
     def test_updateinfo_xml_dump_01(self):
         ui = cr.UpdateInfo()
         xml = ui.xml_dump()
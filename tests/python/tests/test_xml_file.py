@@ -359,3 +359,30 @@ class TestCaseXmlFile(unittest.TestCase):
 <otherdata xmlns="http://linux.duke.edu/metadata/other" packages="0">
   <chunk>Some XML chunk</chunk>
 </otherdata>""")
+
+    def test_xml_dump_many(self):
+        pkgs = [cr.package_from_rpm(PKG_ARCHER_PATH),
+                cr.package_from_rpm(PKG_BALICEK_ISO88591_PATH),
+                cr.package_from_rpm(PKG_FAKE_BASH_PATH)]
+        for pkg in pkgs:
+            pkg.time_file = 111
+        expected = [cr.xml_dump(pkg) for pkg in pkgs]
+
+        self.assertEqual(cr.xml_dump_many([]), [])
+        self.assertEqual(cr.xml_dump_many(pkgs), expected)
+        self.assertEqual(cr.xml_dump_many(pkgs, workers=3), expected)
+        self.assertRaises(TypeError, cr.xml_dump_many, None)
+        self.assertRaises(TypeError, cr.xml_dump_many, [pkgs[0], "foo"])
+
+        path = os.path.join(self.tmpdir, "primary.xml")
+        f = cr.PrimaryXmlFile(path, cr.NO_COMPRESSION)
+        self.assertRaises(TypeError, cr.xml_dump_many, pkgs, 2, "foo")
+        self.assertEqual(cr.xml_dump_many(pkgs, 2, primary=f), None)
+        f.close()
+        self.assertRaises(cr.CreaterepoCError, cr.xml_dump_many, pkgs,
+                          primary=f)
+
+        with open(path) as primary:
+            content = primary.read()
+        self.assertEqual(content.count('<package type="rpm">'), 3)
+        self.assertTrue(''.join(e[0] for e in expected) in content)
@@ -3,6 +3,7 @@ import unittest
 import shutil
 import tempfile
 import os.path
+import threading
 import createrepo_c as cr
 
 from .fixtures import *
@@ -221,6 +222,29 @@ class TestCaseXmlParserPrimary(unittest.TestCase):
         self.assertEqual([pkg.name for pkg in pkgs],
             ['fake_bash', 'super_kernel'])
 
+    def test_xml_parser_primary_repo02_threads(self):
+
+        # The parsing releases the GIL, the callbacks take it back
+        results = [None] * 4
+
+        def parse(idx):
+            pkgs = []
+            for _ in range(10):
+                cr.xml_parse_primary(REPO_02_PRIXML, None,
+                                     lambda pkg: pkgs.append(pkg.name),
+                                     None, 1)
+            results[idx] = pkgs
+
+        threads = [threading.Thread(target=parse, args=(x,))
+                   for x in range(len(results))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        for pkgs in results:
+            self.assertEqual(pkgs, ['fake_bash', 'super_kernel'] * 10)
+
     def test_xml_parser_primary_repo02_no_cbs(self):
         self.assertRaises(ValueError,
                           cr.xml_parse_primary,
@@ -950,3 +974,37 @@ class TestCaseXmlParserRepomd(unittest.TestCase):
         self.assertEqual(repomd.content_tags, [])
         self.assertEqual(len(repomd.records), 3)
 
+
+class TestCasePackageIterator(unittest.TestCase):
+
+    def test_package_iterator_repo02(self):
+        pkgs = list(cr.PackageIterator(REPO_02_PRIXML, REPO_02_FILXML,
+                                       REPO_02_OTHXML))
+
+        # The same packages as loaded by the Metadata
+        md = cr.Metadata()
+        md.locate_and_load_xml(REPO_02_PATH)
+        self.assertEqual(sorted(pkg.pkgId for pkg in pkgs), sorted(md.keys()))
+        for pkg in pkgs:
+            loaded = md.get(pkg.pkgId)
+            self.assertEqual(pkg.name, loaded.name)
+            self.assertEqual(pkg.files, loaded.files)
+            self.assertEqual(pkg.changelogs, loaded.changelogs)
+
+    def test_package_iterator_primary_only(self):
+        it = cr.PackageIterator(REPO_02_PRIXML)
+        self.assertIs(iter(it), it)
+        pkg = next(it)
+        self.assertEqual(pkg.name, "fake_bash")
+        self.assertTrue(pkg.files)
+        self.assertEqual(pkg.changelogs, [])
+        # Dropping the iterator stops the parsing
+        del it
+
+    def test_package_iterator_errors(self):
+        self.assertRaises(IOError, cr.PackageIterator, "/non/existing/file")
+        self.assertRaises(TypeError, cr.PackageIterator)
+
+        it = cr.PackageIterator(REPO_02_PRIXML, FILELISTS_ERROR_00_PATH)
+        self.assertRaises(cr.CreaterepoCError, next, it)
+        self.assertRaises(StopIteration, next, it)
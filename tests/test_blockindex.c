@@ -0,0 +1,253 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/blockindex.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/xml_file.h"
+#include "createrepo/xml_parser.h"
+
+#define TEST_PKGS           20
+#define TEST_BLOCK_SIZE     300
+
+typedef struct {
+    gchar *tmpdir;
+    gchar *path;
+} TestData;
+
+static void
+testdata_setup(TestData *testdata,
+               G_GNUC_UNUSED gconstpointer test_data)
+{
+    testdata->tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(testdata->tmpdir));
+    testdata->path = g_build_filename(testdata->tmpdir, "blockindex", NULL);
+}
+
+static void
+testdata_teardown(TestData *testdata,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_remove_dir(testdata->tmpdir, NULL);
+    g_free(testdata->tmpdir);
+    g_free(testdata->path);
+}
+
+static cr_Package *
+new_pkg(guint n)
+{
+    cr_Package *pkg = cr_package_new();
+    gchar *name = g_strdup_printf("pkg%02u", n);
+
+    pkg->name     = cr_safe_string_chunk_insert(pkg->chunk, name);
+    pkg->pkgId    = cr_safe_string_chunk_insert(pkg->chunk, name);
+    pkg->arch     = cr_safe_string_chunk_insert(pkg->chunk, "x86_64");
+    pkg->epoch    = cr_safe_string_chunk_insert(pkg->chunk, "0");
+    pkg->version  = cr_safe_string_chunk_insert(pkg->chunk, "1.0");
+    pkg->release  = cr_safe_string_chunk_insert(pkg->chunk, "1");
+    g_free(name);
+    return pkg;
+}
+
+static int
+count_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
+{
+    GString *names = cbdata;
+
+    g_string_append_printf(names, "%s ", pkg->name);
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+static gchar *
+expected_names(guint first, guint count)
+{
+    GString *names = g_string_new(NULL);
+
+    for (guint x = first; x < first + count; x++)
+        g_string_append_printf(names, "pkg%02u ", x);
+    return g_string_free(names, FALSE);
+}
+
+static void
+write_other(const char *path, cr_CompressionType type, cr_BlockIndex *index)
+{
+    GError *tmp_err = NULL;
+    cr_XmlFile *f;
+
+    f = cr_xmlfile_sopen_deferred(path, CR_XMLFILE_OTHER, type, NULL,
+                                  &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(cr_xmlfile_set_blockindex(f, index, TEST_BLOCK_SIZE,
+                                              &tmp_err), ==, CRE_OK);
+    g_assert_no_error(tmp_err);
+
+    // The count in the header is corrected on close, it has another
+    // number of digits
+    cr_xmlfile_set_num_of_pkgs(f, 1000, NULL);
+    for (guint x = 0; x < TEST_PKGS; x++) {
+        cr_Package *pkg = new_pkg(x);
+        g_assert_cmpint(cr_xmlfile_add_pkg(f, pkg, &tmp_err), ==, CRE_OK);
+        g_assert_no_error(tmp_err);
+        cr_package_free(pkg);
+    }
+    cr_xmlfile_set_num_of_pkgs(f, TEST_PKGS, NULL);
+    g_assert_cmpint(cr_xmlfile_close(f, &tmp_err), ==, CRE_OK);
+    g_assert_no_error(tmp_err);
+}
+
+static void
+test_helper_blocks(TestData *testdata, cr_CompressionType type)
+{
+    GError *tmp_err = NULL;
+    cr_BlockIndex *index = cr_blockindex_new();
+    gchar *path = g_strconcat(testdata->tmpdir, "/other.xml",
+                              cr_compression_suffix(type), NULL);
+    GString *names = g_string_new(NULL);
+    gchar *expected;
+    guint pkgs = 0;
+    guint64 uoffset;
+
+    write_other(path, type, index);
+    g_assert(cr_blockindex_write(index, testdata->path, &tmp_err));
+    g_assert_no_error(tmp_err);
+    cr_blockindex_free(index);
+
+    // Standard readers see one ordinary file
+    cr_xml_parse_other(path, NULL, NULL, count_pkgcb, names, NULL, NULL,
+                       &tmp_err);
+    g_assert_no_error(tmp_err);
+    expected = expected_names(0, TEST_PKGS);
+    g_assert_cmpstr(names->str, ==, expected);
+    g_free(expected);
+
+    index = cr_blockindex_load(testdata->path, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(index);
+    g_assert_cmpuint(cr_blockindex_count(index, CR_XMLFILE_PRIMARY), ==, 0);
+    g_assert_cmpuint(cr_blockindex_count(index, CR_XMLFILE_OTHER), >, 2);
+
+    // Every block is parsed on its own, the blocks follow each other
+    uoffset = cr_blockindex_get(index, CR_XMLFILE_OTHER, 0)->uncompressed_offset;
+    for (guint x = 0; x < cr_blockindex_count(index, CR_XMLFILE_OTHER); x++) {
+        const cr_BlockIndexEntry *entry = cr_blockindex_get(index,
+                                                            CR_XMLFILE_OTHER,
+                                                            x);
+        gchar *block = cr_blockindex_read_block(path, entry, &tmp_err);
+        g_assert_no_error(tmp_err);
+        g_assert(g_str_has_prefix(block, "<package "));
+
+        g_assert_cmpuint(entry->first_pkg, ==, pkgs);
+        g_assert_cmpuint(entry->uncompressed_offset, ==, uoffset);
+        g_string_truncate(names, 0);
+        cr_xml_parse_other_snippet(block, NULL, NULL, count_pkgcb, names,
+                                   NULL, NULL, &tmp_err);
+        g_assert_no_error(tmp_err);
+        expected = expected_names(entry->first_pkg, entry->pkgs);
+        g_assert_cmpstr(names->str, ==, expected);
+        g_free(expected);
+        g_free(block);
+
+        pkgs += entry->pkgs;
+        uoffset += entry->uncompressed_size;
+    }
+    g_assert_cmpuint(pkgs, ==, TEST_PKGS);
+
+    // The header with the corrected count ends where the first block starts
+    if (type == CR_CW_NO_COMPRESSION) {
+        gchar *content;
+        gsize len;
+        g_assert(g_file_get_contents(path, &content, &len, NULL));
+        g_assert(g_str_has_prefix(content + cr_blockindex_get(index,
+                                    CR_XMLFILE_OTHER, 0)->offset,
+                                  "<package "));
+        g_free(content);
+    }
+
+    gint n = cr_blockindex_find(index, CR_XMLFILE_OTHER, TEST_PKGS - 1);
+    g_assert_cmpint(n, ==, cr_blockindex_count(index, CR_XMLFILE_OTHER) - 1);
+    g_assert_cmpint(cr_blockindex_find(index, CR_XMLFILE_OTHER, 0), ==, 0);
+    g_assert_cmpint(cr_blockindex_find(index, CR_XMLFILE_OTHER, TEST_PKGS),
+                    ==, -1);
+
+    cr_blockindex_free(index);
+    g_string_free(names, TRUE);
+    g_free(path);
+}
+
+static void
+test_cr_blockindex_blocks(TestData *testdata,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    test_helper_blocks(testdata, CR_CW_NO_COMPRESSION);
+    test_helper_blocks(testdata, CR_CW_GZ_COMPRESSION);
+#ifdef WITH_ZSTD
+    test_helper_blocks(testdata, CR_CW_ZSTD_COMPRESSION);
+#endif // WITH_ZSTD
+}
+
+static void
+test_cr_blockindex_unsupported(TestData *testdata,
+                               G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_BlockIndex *index = cr_blockindex_new();
+    gchar *path = g_build_filename(testdata->tmpdir, "other.xml.xz", NULL);
+    cr_XmlFile *f;
+
+    f = cr_xmlfile_sopen_other(path, CR_CW_XZ_COMPRESSION, NULL, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(cr_xmlfile_set_blockindex(f, index, TEST_BLOCK_SIZE,
+                                              &tmp_err), ==, CRE_BADARG);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    cr_xmlfile_close(f, NULL);
+
+    cr_blockindex_free(index);
+
+    // Not an index
+    index = cr_blockindex_load(path, &tmp_err);
+    g_assert(!index);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    g_free(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/blockindex/test_cr_blockindex_blocks",
+               TestData, NULL, testdata_setup,
+               test_cr_blockindex_blocks, testdata_teardown);
+    g_test_add("/blockindex/test_cr_blockindex_unsupported",
+               TestData, NULL, testdata_setup,
+               test_cr_blockindex_unsupported, testdata_teardown);
+
+    return g_test_run();
+}
@@ -21,9 +21,12 @@
 #include <glib/gstdio.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "fixtures.h"
 #include "createrepo/checksum.h"
+#include "createrepo/error.h"
 
 static void
 test_cr_checksum_file(void)
@@ -99,6 +102,175 @@ test_cr_checksum_file(void)
 }
 
 
+static void
+test_cr_checksum_fd(void)
+{
+    int fd;
+    char *checksum;
+    GError *tmp_err = NULL;
+
+    fd = open(TEST_EMPTY_FILE, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    checksum = cr_checksum_fd(fd, CR_CHECKSUM_MD5, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpstr(checksum, ==, "d41d8cd98f00b204e9800998ecf8427e");
+    g_free(checksum);
+    close(fd);
+
+    fd = open(TEST_BINARY_FILE, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    checksum = cr_checksum_fd(fd, CR_CHECKSUM_SHA256, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpstr(checksum, ==, "bf68e32ad78cea8287be0f35b74fa3fecd0eaa91770"
+            "b48f1a7282b015d6d883e");
+    g_free(checksum);
+
+    // The whole file is used regardless of the current offset
+    g_assert_cmpint(lseek(fd, 16, SEEK_SET), ==, 16);
+    checksum = cr_checksum_fd(fd, CR_CHECKSUM_MD5, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpstr(checksum, ==, "4f8b033d7a402927a20c9328fc0e0f46");
+    g_free(checksum);
+    g_assert_cmpint(lseek(fd, 0, SEEK_CUR), ==, 16);
+
+    // Corner cases
+
+    checksum = cr_checksum_fd(fd, 244, &tmp_err);
+    g_assert(!checksum);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+    close(fd);
+}
+
+static void
+test_cr_checksum_file_with_mode(void)
+{
+    char *checksum;
+    GError *tmp_err = NULL;
+    cr_ChecksumIoMode modes[] = { CR_CHECKSUM_IO_READ,
+                                  CR_CHECKSUM_IO_MMAP,
+                                  CR_CHECKSUM_IO_DIRECT };
+
+    for (size_t x = 0; x < G_N_ELEMENTS(modes); x++) {
+        checksum = cr_checksum_file_with_mode(TEST_EMPTY_FILE,
+                                              CR_CHECKSUM_SHA1,
+                                              modes[x], &tmp_err);
+        g_assert(!tmp_err);
+        g_assert_cmpstr(checksum, ==,
+                        "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+        g_free(checksum);
+
+        checksum = cr_checksum_file_with_mode(TEST_BINARY_FILE,
+                                              CR_CHECKSUM_SHA256,
+                                              modes[x], &tmp_err);
+        g_assert(!tmp_err);
+        g_assert_cmpstr(checksum, ==, "bf68e32ad78cea8287be0f35b74fa3fecd0"
+                "eaa91770b48f1a7282b015d6d883e");
+        g_free(checksum);
+
+        checksum = cr_checksum_file_with_mode(NON_EXIST_FILE,
+                                              CR_CHECKSUM_MD5,
+                                              modes[x], &tmp_err);
+        g_assert(!checksum);
+        g_assert(tmp_err);
+        g_error_free(tmp_err);
+        tmp_err = NULL;
+    }
+
+    g_assert_cmpint(cr_checksum_io_mode("read"), ==, CR_CHECKSUM_IO_READ);
+    g_assert_cmpint(cr_checksum_io_mode("MMAP"), ==, CR_CHECKSUM_IO_MMAP);
+    g_assert_cmpint(cr_checksum_io_mode("direct"), ==, CR_CHECKSUM_IO_DIRECT);
+    g_assert_cmpint(cr_checksum_io_mode("foo"), ==, CR_CHECKSUM_IO_UNKNOWN);
+    g_assert_cmpint(cr_checksum_io_mode(NULL), ==, CR_CHECKSUM_IO_UNKNOWN);
+}
+
+static void
+test_cr_checksum_file_multi(void)
+{
+    char *checksum;
+    gchar **checksums;
+    cr_ChecksumCtx *ctx;
+    GError *tmp_err = NULL;
+    cr_ChecksumType types[] = { CR_CHECKSUM_SHA256,
+                                CR_CHECKSUM_MD5,
+                                CR_CHECKSUM_SHA512 };
+
+    checksums = cr_checksum_file_multi(TEST_BINARY_FILE, types,
+                                       G_N_ELEMENTS(types),
+                                       CR_CHECKSUM_IO_READ, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert(checksums);
+    g_assert_cmpuint(g_strv_length(checksums), ==, 3);
+    g_assert_cmpstr(checksums[0], ==, "bf68e32ad78cea8287be0f35b74fa3fecd0"
+            "eaa91770b48f1a7282b015d6d883e");
+    g_assert_cmpstr(checksums[1], ==, "4f8b033d7a402927a20c9328fc0e0f46");
+    g_assert_cmpstr(checksums[2], ==, "339877a8ce6cdb2df62f3f76c005cac4f50"
+            "144197bd095cec21056d6ddde570fe5b16e3f1cd077ece799d5dd23dc6c9c1af"
+            "ed018384d840bd97233c320e60dfa");
+    g_strfreev(checksums);
+
+    // cr_checksum_final() returns the first checksum
+    ctx = cr_checksum_multi_new(types, G_N_ELEMENTS(types), &tmp_err);
+    g_assert(ctx);
+    g_assert(!tmp_err);
+    g_assert_cmpint(cr_checksum_update(ctx, "", 0, &tmp_err), ==, CRE_OK);
+    checksum = cr_checksum_final(ctx, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpstr(checksum, ==, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649"
+            "b934ca495991b7852b855");
+    g_free(checksum);
+
+    // Corner cases
+
+    types[1] = 244;
+    ctx = cr_checksum_multi_new(types, G_N_ELEMENTS(types), &tmp_err);
+    g_assert(!ctx);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+
+    ctx = cr_checksum_multi_new(types, 0, &tmp_err);
+    g_assert(!ctx);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+}
+
+static void
+test_cr_fingerprint(void)
+{
+    cr_FingerprintCtx *ctx;
+    char *fingerprint;
+    const char *text = "Nobody inspects the spammish repetition";
+
+    ctx = cr_fingerprint_new();
+    fingerprint = cr_fingerprint_final(ctx);
+    g_assert_cmpstr(fingerprint, ==, "ef46db3751d8e999");
+    g_free(fingerprint);
+
+    ctx = cr_fingerprint_new();
+    cr_fingerprint_update(ctx, "abc", 3);
+    fingerprint = cr_fingerprint_final(ctx);
+    g_assert_cmpstr(fingerprint, ==, "44bc2cf5ad770999");
+    g_free(fingerprint);
+
+    ctx = cr_fingerprint_new();
+    cr_fingerprint_update(ctx, text, strlen(text));
+    fingerprint = cr_fingerprint_final(ctx);
+    g_assert_cmpstr(fingerprint, ==, "fbcea83c8a378bf1");
+    g_free(fingerprint);
+
+    // Result doesn't depend on how the data are split
+    ctx = cr_fingerprint_new();
+    cr_fingerprint_update(ctx, text, 5);
+    cr_fingerprint_update(ctx, text + 5, 30);
+    cr_fingerprint_update(ctx, text + 35, strlen(text) - 35);
+    fingerprint = cr_fingerprint_final(ctx);
+    g_assert_cmpstr(fingerprint, ==, "fbcea83c8a378bf1");
+    g_free(fingerprint);
+}
+
 static void
 test_cr_checksum_name_str(void)
 {
@@ -136,6 +308,14 @@ main(int argc, char *argv[])
 
     g_test_add_func("/checksum/test_cr_checksum_file",
             test_cr_checksum_file);
+    g_test_add_func("/checksum/test_cr_checksum_fd",
+            test_cr_checksum_fd);
+    g_test_add_func("/checksum/test_cr_checksum_file_with_mode",
+            test_cr_checksum_file_with_mode);
+    g_test_add_func("/checksum/test_cr_checksum_file_multi",
+            test_cr_checksum_file_multi);
+    g_test_add_func("/checksum/test_cr_fingerprint",
+            test_cr_fingerprint);
     g_test_add_func("/checksum/test_cr_checksum_name_str",
             test_cr_checksum_name_str);
 
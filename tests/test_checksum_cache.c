@@ -0,0 +1,201 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "fixtures.h"
+#include "createrepo/misc.h"
+#include "createrepo/checksum_cache.h"
+
+#define KEY_FOO         "foo.rpm-abc-1024-1357924680"
+#define KEY_BAR         "bar.rpm-def-2048-1357924680"
+#define CHECKSUM_FOO    "aaaa"
+#define CHECKSUM_BAR    "bbbb"
+
+typedef struct {
+    gchar *tmpdir;
+    gchar *path;
+} TestData;
+
+static void
+testdata_setup(TestData *testdata,
+               G_GNUC_UNUSED gconstpointer test_data)
+{
+    testdata->tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(testdata->tmpdir));
+    testdata->path = g_build_filename(testdata->tmpdir, "checksums", NULL);
+}
+
+static void
+testdata_teardown(TestData *testdata,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_remove_dir(testdata->tmpdir, NULL);
+    g_free(testdata->tmpdir);
+    g_free(testdata->path);
+}
+
+static void
+test_cr_checksum_cache_add_and_load(TestData *testdata,
+                                    G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gchar *checksum;
+
+    cr_ChecksumCache *cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_checksum_cache_size(cache), ==, 0);
+    g_assert(!cr_checksum_cache_lookup(cache, KEY_FOO));
+
+    g_assert(cr_checksum_cache_add(cache, KEY_FOO, CHECKSUM_FOO, &tmp_err));
+    g_assert(cr_checksum_cache_add(cache, KEY_BAR, CHECKSUM_BAR, &tmp_err));
+    g_assert(!tmp_err);
+    checksum = cr_checksum_cache_lookup(cache, KEY_FOO);
+    g_assert_cmpstr(checksum, ==, CHECKSUM_FOO);
+    g_free(checksum);
+    cr_checksum_cache_free(cache);
+
+    cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_checksum_cache_size(cache), ==, 2);
+    g_assert_cmpuint(cr_checksum_cache_garbage(cache), ==, 0);
+    checksum = cr_checksum_cache_lookup(cache, KEY_BAR);
+    g_assert_cmpstr(checksum, ==, CHECKSUM_BAR);
+    g_free(checksum);
+    cr_checksum_cache_free(cache);
+}
+
+static void
+test_cr_checksum_cache_compact(TestData *testdata,
+                               G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gchar *checksum;
+
+    cr_ChecksumCache *cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert(cr_checksum_cache_add(cache, KEY_FOO, CHECKSUM_FOO, &tmp_err));
+    g_assert(cr_checksum_cache_add(cache, KEY_FOO, CHECKSUM_FOO, &tmp_err));
+    g_assert(cr_checksum_cache_add(cache, KEY_FOO, CHECKSUM_BAR, &tmp_err));
+    g_assert(!tmp_err);
+    // The same value is not appended again, the new one replaces the old
+    g_assert_cmpuint(cr_checksum_cache_size(cache), ==, 1);
+    g_assert_cmpuint(cr_checksum_cache_garbage(cache), ==, 1);
+    cr_checksum_cache_free(cache);
+
+    cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert_cmpuint(cr_checksum_cache_garbage(cache), ==, 1);
+    checksum = cr_checksum_cache_lookup(cache, KEY_FOO);
+    g_assert_cmpstr(checksum, ==, CHECKSUM_BAR);
+    g_free(checksum);
+
+    g_assert(cr_checksum_cache_compact(cache, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_checksum_cache_garbage(cache), ==, 0);
+    // Appending continues into the compacted file
+    g_assert(cr_checksum_cache_add(cache, KEY_BAR, CHECKSUM_BAR, &tmp_err));
+    cr_checksum_cache_free(cache);
+
+    cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert_cmpuint(cr_checksum_cache_size(cache), ==, 2);
+    g_assert_cmpuint(cr_checksum_cache_garbage(cache), ==, 0);
+    checksum = cr_checksum_cache_lookup(cache, KEY_FOO);
+    g_assert_cmpstr(checksum, ==, CHECKSUM_BAR);
+    g_free(checksum);
+    cr_checksum_cache_free(cache);
+}
+
+static void
+test_cr_checksum_cache_truncated(TestData *testdata,
+                                 G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gchar *content, *checksum;
+    gsize length;
+
+    cr_ChecksumCache *cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert(cr_checksum_cache_add(cache, KEY_FOO, CHECKSUM_FOO, &tmp_err));
+    g_assert(cr_checksum_cache_add(cache, KEY_BAR, CHECKSUM_BAR, &tmp_err));
+    cr_checksum_cache_free(cache);
+
+    // Cut off a part of the last record
+    g_assert(g_file_get_contents(testdata->path, &content, &length, NULL));
+    g_assert(g_file_set_contents(testdata->path, content, length - 2, NULL));
+    g_free(content);
+
+    cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_checksum_cache_size(cache), ==, 1);
+    g_assert(!cr_checksum_cache_lookup(cache, KEY_BAR));
+    g_assert(cr_checksum_cache_add(cache, KEY_BAR, CHECKSUM_BAR, &tmp_err));
+    cr_checksum_cache_free(cache);
+
+    // The broken tail was removed, so the new record is readable
+    cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(cache);
+    g_assert_cmpuint(cr_checksum_cache_size(cache), ==, 2);
+    checksum = cr_checksum_cache_lookup(cache, KEY_BAR);
+    g_assert_cmpstr(checksum, ==, CHECKSUM_BAR);
+    g_free(checksum);
+    cr_checksum_cache_free(cache);
+}
+
+static void
+test_cr_checksum_cache_bad_file(TestData *testdata,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+
+    g_assert(g_file_set_contents(testdata->path, "something else", -1, NULL));
+    cr_ChecksumCache *cache = cr_checksum_cache_open(testdata->path, &tmp_err);
+    g_assert(!cache);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/checksum_cache/test_cr_checksum_cache_add_and_load",
+               TestData, NULL, testdata_setup,
+               test_cr_checksum_cache_add_and_load, testdata_teardown);
+    g_test_add("/checksum_cache/test_cr_checksum_cache_compact",
+               TestData, NULL, testdata_setup,
+               test_cr_checksum_cache_compact, testdata_teardown);
+    g_test_add("/checksum_cache/test_cr_checksum_cache_truncated",
+               TestData, NULL, testdata_setup,
+               test_cr_checksum_cache_truncated, testdata_teardown);
+    g_test_add("/checksum_cache/test_cr_checksum_cache_bad_file",
+               TestData, NULL, testdata_setup,
+               test_cr_checksum_cache_bad_file, testdata_teardown);
+
+    return g_test_run();
+}
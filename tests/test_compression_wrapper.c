@@ -21,6 +21,8 @@
 #include <glib/gstdio.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "fixtures.h"
 #include "createrepo/error.h"
@@ -37,6 +39,7 @@
 #define FILE_COMPRESSED_0_GZ                    TEST_COMPRESSED_FILES_PATH"/00_plain.txt.gz"
 #define FILE_COMPRESSED_0_BZ2                   TEST_COMPRESSED_FILES_PATH"/00_plain.txt.bz2"
 #define FILE_COMPRESSED_0_XZ                    TEST_COMPRESSED_FILES_PATH"/00_plain.txt.xz"
+#define FILE_COMPRESSED_0_ZSTD                  TEST_COMPRESSED_FILES_PATH"/00_plain.txt.zst"
 #define FILE_COMPRESSED_0_PLAIN_BAD_SUFFIX      TEST_COMPRESSED_FILES_PATH"/00_plain.foo0"
 #define FILE_COMPRESSED_0_GZ_BAD_SUFFIX         TEST_COMPRESSED_FILES_PATH"/00_plain.foo1"
 #define FILE_COMPRESSED_0_BZ2_BAD_SUFFIX        TEST_COMPRESSED_FILES_PATH"/00_plain.foo2"
@@ -49,10 +52,15 @@
 #define FILE_COMPRESSED_1_BZ2                   TEST_COMPRESSED_FILES_PATH"/01_plain.txt.bz2"
 #define FILE_COMPRESSED_1_XZ                    TEST_COMPRESSED_FILES_PATH"/01_plain.txt.xz"
 #define FILE_COMPRESSED_1_ZCK                   TEST_COMPRESSED_FILES_PATH"/01_plain.txt.zck"
+#define FILE_COMPRESSED_1_ZSTD                  TEST_COMPRESSED_FILES_PATH"/01_plain.txt.zst"
+#define FILE_COMPRESSED_2_XZ_BLOCKS             TEST_COMPRESSED_FILES_PATH"/02_blocks.txt.xz"
+#define FILE_COMPRESSED_2_XZ_BLOCKS_LINES       10000
 #define FILE_COMPRESSED_1_PLAIN_BAD_SUFFIX      TEST_COMPRESSED_FILES_PATH"/01_plain.foo0"
 #define FILE_COMPRESSED_1_GZ_BAD_SUFFIX         TEST_COMPRESSED_FILES_PATH"/01_plain.foo1"
 #define FILE_COMPRESSED_1_BZ2_BAD_SUFFIX        TEST_COMPRESSED_FILES_PATH"/01_plain.foo2"
 #define FILE_COMPRESSED_1_XZ_BAD_SUFFIX         TEST_COMPRESSED_FILES_PATH"/01_plain.foo3"
+#define FILE_COMPRESSED_1_ZCK_BAD_SUFFIX        TEST_COMPRESSED_FILES_PATH"/01_plain.foo4"
+#define FILE_COMPRESSED_1_ZSTD_BAD_SUFFIX       TEST_COMPRESSED_FILES_PATH"/01_plain.foo5"
 
 
 static void
@@ -98,6 +106,9 @@ test_cr_compression_suffix(void)
 
     suffix = cr_compression_suffix(CR_CW_XZ_COMPRESSION);
     g_assert_cmpstr(suffix, ==, ".xz");
+
+    suffix = cr_compression_suffix(CR_CW_ZSTD_COMPRESSION);
+    g_assert_cmpstr(suffix, ==, ".zst");
 }
 
 static void
@@ -134,6 +145,12 @@ test_cr_compression_type(void)
 
     type = cr_compression_type("xz");
     g_assert_cmpint(type, ==, CR_CW_XZ_COMPRESSION);
+
+    type = cr_compression_type("zstd");
+    g_assert_cmpint(type, ==, CR_CW_ZSTD_COMPRESSION);
+
+    type = cr_compression_type("zst");
+    g_assert_cmpint(type, ==, CR_CW_ZSTD_COMPRESSION);
 }
 
 static void
@@ -177,9 +194,29 @@ test_cr_detect_compression(void)
     ret = cr_detect_compression(FILE_COMPRESSED_1_XZ, &tmp_err);
     g_assert_cmpint(ret, ==, CR_CW_XZ_COMPRESSION);
     g_assert(!tmp_err);
+
+    // Zstd
+
+    ret = cr_detect_compression(FILE_COMPRESSED_0_ZSTD, &tmp_err);
+    g_assert_cmpint(ret, ==, CR_CW_ZSTD_COMPRESSION);
+    g_assert(!tmp_err);
+    ret = cr_detect_compression(FILE_COMPRESSED_1_ZSTD, &tmp_err);
+    g_assert_cmpint(ret, ==, CR_CW_ZSTD_COMPRESSION);
+    g_assert(!tmp_err);
 }
 
 
+static void
+test_cr_is_url(void)
+{
+    g_assert(cr_is_url("http://example.com/repodata/primary.xml.gz"));
+    g_assert(cr_is_url("https://example.com/repodata/primary.xml.gz"));
+    g_assert(cr_is_url("ftp://example.com/repodata/primary.xml.gz"));
+    g_assert(!cr_is_url("file:///repodata/primary.xml.gz"));
+    g_assert(!cr_is_url("/repodata/http://primary.xml.gz"));
+    g_assert(!cr_is_url(FILE_COMPRESSED_0_GZ));
+}
+
 static void
 test_cr_detect_compression_bad_suffix(void)
 {
@@ -221,6 +258,15 @@ test_cr_detect_compression_bad_suffix(void)
     ret = cr_detect_compression(FILE_COMPRESSED_1_XZ_BAD_SUFFIX, &tmp_err);
     g_assert_cmpint(ret, ==, CR_CW_XZ_COMPRESSION);
     g_assert(!tmp_err);
+
+    // Zck and zstd (recognized by their signatures only)
+
+    ret = cr_detect_compression(FILE_COMPRESSED_1_ZCK_BAD_SUFFIX, &tmp_err);
+    g_assert_cmpint(ret, ==, CR_CW_ZCK_COMPRESSION);
+    g_assert(!tmp_err);
+    ret = cr_detect_compression(FILE_COMPRESSED_1_ZSTD_BAD_SUFFIX, &tmp_err);
+    g_assert_cmpint(ret, ==, CR_CW_ZSTD_COMPRESSION);
+    g_assert(!tmp_err);
 }
 
 
@@ -281,6 +327,15 @@ test_cr_read_with_autodetection(void)
             FILE_COMPRESSED_0_CONTENT, FILE_COMPRESSED_0_CONTENT_LEN);
     test_helper_cw_input(FILE_COMPRESSED_1_XZ, CR_CW_AUTO_DETECT_COMPRESSION,
             FILE_COMPRESSED_1_CONTENT, FILE_COMPRESSED_1_CONTENT_LEN);
+
+#ifdef WITH_ZSTD
+    // Zstd
+
+    test_helper_cw_input(FILE_COMPRESSED_0_ZSTD, CR_CW_AUTO_DETECT_COMPRESSION,
+            FILE_COMPRESSED_0_CONTENT, FILE_COMPRESSED_0_CONTENT_LEN);
+    test_helper_cw_input(FILE_COMPRESSED_1_ZSTD, CR_CW_AUTO_DETECT_COMPRESSION,
+            FILE_COMPRESSED_1_CONTENT, FILE_COMPRESSED_1_CONTENT_LEN);
+#endif // WITH_ZSTD
 }
 
 
@@ -447,6 +502,29 @@ outputtest_cw_output(Outputtest *outputtest,
     test_helper_cw_output(OUTPUT_TYPE_PRINTF, outputtest->tmp_filename,
                           CR_CW_XZ_COMPRESSION, FILE_COMPRESSED_1_CONTENT,
                           FILE_COMPRESSED_1_CONTENT_LEN);
+
+#ifdef WITH_ZSTD
+    // Zstd
+
+    test_helper_cw_output(OUTPUT_TYPE_WRITE,  outputtest->tmp_filename,
+                          CR_CW_ZSTD_COMPRESSION, FILE_COMPRESSED_0_CONTENT,
+                          FILE_COMPRESSED_0_CONTENT_LEN);
+    test_helper_cw_output(OUTPUT_TYPE_WRITE,  outputtest->tmp_filename,
+                          CR_CW_ZSTD_COMPRESSION, FILE_COMPRESSED_1_CONTENT,
+                          FILE_COMPRESSED_1_CONTENT_LEN);
+    test_helper_cw_output(OUTPUT_TYPE_PUTS,   outputtest->tmp_filename,
+                          CR_CW_ZSTD_COMPRESSION, FILE_COMPRESSED_0_CONTENT,
+                          FILE_COMPRESSED_0_CONTENT_LEN);
+    test_helper_cw_output(OUTPUT_TYPE_PUTS,   outputtest->tmp_filename,
+                          CR_CW_ZSTD_COMPRESSION, FILE_COMPRESSED_1_CONTENT,
+                          FILE_COMPRESSED_1_CONTENT_LEN);
+    test_helper_cw_output(OUTPUT_TYPE_PRINTF, outputtest->tmp_filename,
+                          CR_CW_ZSTD_COMPRESSION, FILE_COMPRESSED_0_CONTENT,
+                          FILE_COMPRESSED_0_CONTENT_LEN);
+    test_helper_cw_output(OUTPUT_TYPE_PRINTF, outputtest->tmp_filename,
+                          CR_CW_ZSTD_COMPRESSION, FILE_COMPRESSED_1_CONTENT,
+                          FILE_COMPRESSED_1_CONTENT_LEN);
+#endif // WITH_ZSTD
 }
 
 
@@ -717,6 +795,64 @@ test_contentstating_multiwrite(Outputtest *outputtest,
     g_assert(!tmp_err);
 }
 
+static void
+test_contentstating_multichecksum(Outputtest *outputtest,
+                                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    CR_FILE *f;
+    int ret;
+    cr_ContentStat *stat;
+    GError *tmp_err = NULL;
+    cr_ChecksumType types[] = { CR_CHECKSUM_SHA256, CR_CHECKSUM_SHA512 };
+
+    const char *content = "sdlkjowykjnhsadyhfsoaf\nasoiuyseahlndsf\n";
+    const int content_len = 39;
+    const char *content_sha256 = "c9d112f052ab86270bfb484817a513d6ce188133ddc0"
+                                 "7c0fc1ac32018b6da6c7";
+    const char *content_sha512 = "93aee63f73a32db37d25c20d61b849335d45ed027e8f"
+                                 "c5b3483a1b14c902bc492a987593cf7c390551fb57d9"
+                                 "caaa6134547bc4530416a39ea4d30f0e9d172439";
+
+    stat = cr_contentstat_multi_new(types, G_N_ELEMENTS(types), &tmp_err);
+    g_assert(stat);
+    g_assert(!tmp_err);
+    g_assert_cmpint(stat->checksum_type, ==, CR_CHECKSUM_SHA256);
+
+    f = cr_sopen(outputtest->tmp_filename,
+                 CR_CW_MODE_WRITE,
+                 CR_CW_GZ_COMPRESSION,
+                 stat,
+                 &tmp_err);
+    g_assert(f);
+    g_assert(!tmp_err);
+
+    ret = cr_write(f, content, 10, &tmp_err);
+    g_assert_cmpint(ret, ==, 10);
+    g_assert(!tmp_err);
+
+    ret = cr_write(f, content+10, 29, &tmp_err);
+    g_assert_cmpint(ret, ==, 29);
+    g_assert(!tmp_err);
+
+    cr_close(f, &tmp_err);
+    g_assert(!tmp_err);
+
+    g_assert_cmpint(stat->size, ==, content_len);
+    g_assert_cmpstr(stat->checksum, ==, content_sha256);
+    g_assert_cmpstr(cr_contentstat_checksum(stat, CR_CHECKSUM_SHA256), ==,
+                    content_sha256);
+    g_assert_cmpstr(cr_contentstat_checksum(stat, CR_CHECKSUM_SHA512), ==,
+                    content_sha512);
+    g_assert(!cr_contentstat_checksum(stat, CR_CHECKSUM_MD5));
+    cr_contentstat_free(stat, &tmp_err);
+    g_assert(!tmp_err);
+
+    stat = cr_contentstat_multi_new(types, 0, &tmp_err);
+    g_assert(!stat);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+}
+
 static void
 test_cr_get_zchunk_with_index(void)
 {
@@ -759,6 +895,473 @@ test_cr_get_zchunk_with_index(void)
 
 }
 
+static void
+test_helper_threaded_roundtrip(const char *filename, cr_CompressionType type)
+{
+    GString *content = g_string_new(NULL);
+    cr_ContentStat *stat;
+    char buffer[4096];
+    gsize total = 0;
+    CR_FILE *f;
+    GError *tmp_err = NULL;
+    int ret;
+
+    // Not a multiple of the block size, the last block is partial
+    for (int x = 0; content->len < 3*1024*1024 + 123; x++)
+        g_string_append_printf(content, "<file>/usr/share/%d</file>\n", x);
+
+    stat = cr_contentstat_new(CR_CHECKSUM_SHA256, &tmp_err);
+    f = cr_sopen(filename, CR_CW_MODE_WRITE, type, stat, &tmp_err);
+    g_assert(f);
+    g_assert(!tmp_err);
+    // Small and big writes
+    g_assert_cmpint(cr_write(f, content->str, 10, &tmp_err), ==, 10);
+    ret = cr_write(f, content->str + 10, content->len - 10, &tmp_err);
+    g_assert_cmpint(ret, ==, content->len - 10);
+    g_assert(!tmp_err);
+    g_assert_cmpint(cr_close(f, &tmp_err), ==, CRE_OK);
+    g_assert(!tmp_err);
+    g_assert_cmpint(stat->size, ==, content->len);
+    cr_contentstat_free(stat, NULL);
+
+    f = cr_open(filename, CR_CW_MODE_READ, type, &tmp_err);
+    g_assert(f);
+    g_assert(!tmp_err);
+    while ((ret = cr_read(f, buffer, sizeof(buffer), &tmp_err)) > 0) {
+        g_assert(total + ret <= content->len);
+        g_assert(!memcmp(buffer, content->str + total, ret));
+        total += ret;
+    }
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!tmp_err);
+    g_assert_cmpint(total, ==, content->len);
+    g_assert_cmpint(cr_close(f, &tmp_err), ==, CRE_OK);
+
+    g_string_free(content, TRUE);
+}
+
+static void
+outputtest_threaded_compression(Outputtest *outputtest,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+
+    g_assert(!cr_compression_set_threads(CR_CW_MAX_COMPRESSION_THREADS + 1,
+                                         &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    g_assert(cr_compression_set_threads(4, &tmp_err));
+    g_assert(!tmp_err);
+
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_GZ_COMPRESSION);
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_XZ_COMPRESSION);
+
+    // Empty content
+    test_helper_cw_output(OUTPUT_TYPE_WRITE, outputtest->tmp_filename,
+                          CR_CW_GZ_COMPRESSION, FILE_COMPRESSED_0_CONTENT,
+                          FILE_COMPRESSED_0_CONTENT_LEN);
+    test_helper_cw_output(OUTPUT_TYPE_PUTS, outputtest->tmp_filename,
+                          CR_CW_GZ_COMPRESSION, FILE_COMPRESSED_1_CONTENT,
+                          FILE_COMPRESSED_1_CONTENT_LEN);
+
+    g_assert(cr_compression_set_threads(0, NULL));
+}
+
+static gint64
+test_helper_compressed_size(const char *filename, cr_CompressionType type)
+{
+    GString *content = g_string_new(NULL);
+    GError *tmp_err = NULL;
+    struct stat st;
+    CR_FILE *f;
+
+    for (int x = 0; content->len < 256*1024; x++)
+        g_string_append_printf(content, "<file>/usr/share/%d</file>\n", x);
+
+    f = cr_open(filename, CR_CW_MODE_WRITE, type, &tmp_err);
+    g_assert(f);
+    g_assert_cmpint(cr_write(f, content->str, content->len, &tmp_err), ==,
+                    content->len);
+    g_assert_cmpint(cr_close(f, &tmp_err), ==, CRE_OK);
+    g_assert(!tmp_err);
+    g_string_free(content, TRUE);
+
+    g_assert_cmpint(stat(filename, &st), ==, 0);
+    return st.st_size;
+}
+
+static void
+outputtest_compression_level(Outputtest *outputtest,
+                             G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gint64 fast, best;
+
+    g_assert(!cr_compression_set_level(CR_CW_GZ_COMPRESSION, 10, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert(!cr_compression_set_level(CR_CW_BZ2_COMPRESSION, 0, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert(!cr_compression_set_level(CR_CW_NO_COMPRESSION, 1, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert_cmpint(cr_compression_level(CR_CW_NO_COMPRESSION), ==,
+                    CR_CW_DEFAULT_COMPRESSION_LEVEL);
+
+    g_assert(cr_compression_set_level(CR_CW_GZ_COMPRESSION, 1, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpint(cr_compression_level(CR_CW_GZ_COMPRESSION), ==, 1);
+    fast = test_helper_compressed_size(outputtest->tmp_filename,
+                                       CR_CW_GZ_COMPRESSION);
+    g_assert(cr_compression_set_level(CR_CW_GZ_COMPRESSION, 9, NULL));
+    best = test_helper_compressed_size(outputtest->tmp_filename,
+                                       CR_CW_GZ_COMPRESSION);
+    g_assert_cmpint(fast, >, best);
+
+    // Files of the other levels are readable
+    g_assert(cr_compression_set_level(CR_CW_BZ2_COMPRESSION, 1, NULL));
+    g_assert(cr_compression_set_level(CR_CW_XZ_COMPRESSION, 0, NULL));
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_BZ2_COMPRESSION);
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_XZ_COMPRESSION);
+
+    g_assert(cr_compression_set_level(CR_CW_GZ_COMPRESSION,
+                                      CR_CW_DEFAULT_COMPRESSION_LEVEL, NULL));
+    g_assert(cr_compression_set_level(CR_CW_BZ2_COMPRESSION,
+                                      CR_CW_DEFAULT_COMPRESSION_LEVEL, NULL));
+    g_assert(cr_compression_set_level(CR_CW_XZ_COMPRESSION,
+                                      CR_CW_DEFAULT_COMPRESSION_LEVEL, NULL));
+    g_assert_cmpint(cr_compression_level(CR_CW_XZ_COMPRESSION), ==, 5);
+}
+
+static gpointer
+compression_level_thread(G_GNUC_UNUSED gpointer data)
+{
+    return GINT_TO_POINTER(cr_compression_level(CR_CW_GZ_COMPRESSION));
+}
+
+static void
+outputtest_compression_settings(Outputtest *outputtest,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CompressionSettings *settings = cr_compression_settings_new();
+    GError *tmp_err = NULL;
+    gint default_level = cr_compression_level(CR_CW_GZ_COMPRESSION);
+    gint64 fast, best, threaded;
+    GThread *thread;
+
+    g_assert(!cr_compression_settings_set_level(settings,
+                                                CR_CW_GZ_COMPRESSION, 10,
+                                                &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert(cr_compression_settings_set_level(settings, CR_CW_GZ_COMPRESSION,
+                                               1, &tmp_err));
+    g_assert(!tmp_err);
+
+    best = test_helper_compressed_size(outputtest->tmp_filename,
+                                       CR_CW_GZ_COMPRESSION);
+
+    // The settings are used only by the thread which pushed them
+    g_assert(!cr_compression_settings_get_thread_default());
+    cr_compression_settings_push_thread_default(settings);
+    g_assert(cr_compression_settings_get_thread_default() == settings);
+    g_assert_cmpint(cr_compression_level(CR_CW_GZ_COMPRESSION), ==, 1);
+    thread = g_thread_new(NULL, compression_level_thread, NULL);
+    g_assert_cmpint(GPOINTER_TO_INT(g_thread_join(thread)), ==,
+                    default_level);
+    fast = test_helper_compressed_size(outputtest->tmp_filename,
+                                       CR_CW_GZ_COMPRESSION);
+    g_assert_cmpint(fast, >, best);
+
+    // The threads of the gzip file compress by the level of the file
+    g_assert(cr_compression_settings_set_threads(settings, 4, NULL));
+    threaded = test_helper_compressed_size(outputtest->tmp_filename,
+                                           CR_CW_GZ_COMPRESSION);
+    g_assert_cmpint(threaded, >, best);
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_GZ_COMPRESSION);
+
+    // NULL are the process defaults
+    cr_compression_settings_push_thread_default(NULL);
+    g_assert_cmpint(cr_compression_level(CR_CW_GZ_COMPRESSION), ==,
+                    default_level);
+    cr_compression_settings_pop_thread_default(NULL);
+    g_assert_cmpint(cr_compression_level(CR_CW_GZ_COMPRESSION), ==, 1);
+
+    cr_compression_settings_pop_thread_default(settings);
+    g_assert(!cr_compression_settings_get_thread_default());
+    g_assert_cmpint(cr_compression_level(CR_CW_GZ_COMPRESSION), ==,
+                    default_level);
+    cr_compression_settings_free(settings);
+}
+
+static void
+outputtest_zstd_params(Outputtest *outputtest,
+                       G_GNUC_UNUSED gconstpointer test_data)
+{
+    CR_FILE *f;
+    GError *tmp_err = NULL;
+
+#ifdef WITH_ZSTD
+    GString *content = g_string_new(NULL);
+    char buffer[4096];
+    gsize total = 0;
+    int ret;
+
+    g_assert(!cr_zstd_set_params(-1, 0, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert(!cr_zstd_set_params(0, 2, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    // Long distance matching with a window bigger than the default one
+    g_assert(cr_zstd_set_params(3, 24, &tmp_err));
+    g_assert(!tmp_err);
+
+    for (int x = 0; content->len < 1024*1024; x++)
+        g_string_append_printf(content, "<package>%d</package>\n", x % 5000);
+
+    f = cr_open(outputtest->tmp_filename, CR_CW_MODE_WRITE,
+                CR_CW_ZSTD_COMPRESSION, &tmp_err);
+    g_assert(f);
+    g_assert(!tmp_err);
+    ret = cr_write(f, content->str, content->len, &tmp_err);
+    g_assert_cmpint(ret, ==, content->len);
+    g_assert(!tmp_err);
+    g_assert_cmpint(cr_close(f, &tmp_err), ==, CRE_OK);
+    g_assert(!tmp_err);
+
+    f = cr_open(outputtest->tmp_filename, CR_CW_MODE_READ,
+                CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+    g_assert(f);
+    g_assert(!tmp_err);
+    while ((ret = cr_read(f, buffer, sizeof(buffer), &tmp_err)) > 0) {
+        g_assert(total + ret <= content->len);
+        g_assert(!memcmp(buffer, content->str + total, ret));
+        total += ret;
+    }
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!tmp_err);
+    g_assert_cmpint(total, ==, content->len);
+    cr_close(f, NULL);
+
+    g_assert(cr_zstd_set_params(0, 0, NULL));
+    g_string_free(content, TRUE);
+#else
+    g_assert(!cr_zstd_set_params(0, 0, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_ZSTD);
+    g_clear_error(&tmp_err);
+
+    f = cr_open(outputtest->tmp_filename, CR_CW_MODE_WRITE,
+                CR_CW_ZSTD_COMPRESSION, &tmp_err);
+    g_assert(!f);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+#endif // WITH_ZSTD
+}
+
+static void
+outputtest_io_buffer_size(Outputtest *outputtest,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+
+    g_assert(!cr_set_io_buffer_size(CR_CW_MIN_BUFFER_SIZE - 1, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert(!cr_set_io_buffer_size(CR_CW_MAX_BUFFER_SIZE + 1, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    // The environment is used only if the size is not set
+    g_setenv(CR_CW_BUFFER_SIZE_ENV, "64K", TRUE);
+    g_assert(cr_set_io_buffer_size(0, NULL));
+    g_assert_cmpuint(cr_get_io_buffer_size(), ==, 64*1024);
+    g_assert(cr_set_io_buffer_size(8192, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_get_io_buffer_size(), ==, 8192);
+    g_unsetenv(CR_CW_BUFFER_SIZE_ENV);
+
+    // The smallest buffers still read and write the whole content
+    g_assert(cr_set_io_buffer_size(CR_CW_MIN_BUFFER_SIZE, NULL));
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_GZ_COMPRESSION);
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_BZ2_COMPRESSION);
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_XZ_COMPRESSION);
+    test_helper_threaded_roundtrip(outputtest->tmp_filename,
+                                   CR_CW_NO_COMPRESSION);
+
+    g_assert(cr_set_io_buffer_size(0, NULL));
+}
+
+static void
+test_helper_read_xz_blocks(const char *filename, GError **err)
+{
+    GString *content = g_string_new(NULL);
+    GString *output = g_string_new(NULL);
+    char buffer[1000];
+    CR_FILE *f;
+    int ret;
+
+    for (int x = 0; x < FILE_COMPRESSED_2_XZ_BLOCKS_LINES; x++)
+        g_string_append_printf(content, "<file>/usr/share/%d</file>\n", x);
+
+    f = cr_open(filename, CR_CW_MODE_READ, CR_CW_XZ_COMPRESSION, err);
+    g_assert(f);
+    while ((ret = cr_read(f, buffer, sizeof(buffer), err)) > 0)
+        g_string_append_len(output, buffer, ret);
+
+    if (ret == 0) {
+        g_assert_cmpint(output->len, ==, content->len);
+        g_assert(!memcmp(output->str, content->str, content->len));
+        // Reading after the end of the stream
+        g_assert_cmpint(cr_read(f, buffer, sizeof(buffer), NULL), ==, 0);
+    }
+    cr_close(f, NULL);
+
+    g_string_free(content, TRUE);
+    g_string_free(output, TRUE);
+}
+
+static void
+outputtest_threaded_decompression(Outputtest *outputtest,
+                                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gchar *content;
+    gsize length;
+
+    g_assert(!cr_decompression_set_threads(CR_CW_MAX_COMPRESSION_THREADS + 1,
+                                           &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    // The file consists of several blocks
+    g_assert(cr_decompression_set_threads(1, NULL));
+    test_helper_read_xz_blocks(FILE_COMPRESSED_2_XZ_BLOCKS, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert(cr_decompression_set_threads(4, NULL));
+    test_helper_read_xz_blocks(FILE_COMPRESSED_2_XZ_BLOCKS, &tmp_err);
+    g_assert(!tmp_err);
+
+    // Truncated file is an error, not a shorter content
+    g_assert(g_file_get_contents(FILE_COMPRESSED_2_XZ_BLOCKS, &content,
+                                 &length, NULL));
+    g_assert(g_file_set_contents(outputtest->tmp_filename, content,
+                                 length - 100, NULL));
+    g_free(content);
+    test_helper_read_xz_blocks(outputtest->tmp_filename, &tmp_err);
+    g_assert(tmp_err);
+    g_assert_cmpint(tmp_err->code, ==, CRE_XZ);
+    g_clear_error(&tmp_err);
+
+    g_assert(cr_decompression_set_threads(0, NULL));
+}
+
+static void
+outputtest_zck_train_dict(Outputtest *outputtest,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gsize dict_size = 0;
+    gchar *dict;
+
+#if defined(WITH_ZCHUNK) && defined(WITH_ZSTD)
+    CR_FILE *f = cr_open(outputtest->tmp_filename, CR_CW_MODE_WRITE,
+                         CR_CW_ZCK_COMPRESSION, &tmp_err);
+    g_assert(f);
+    g_assert(!tmp_err);
+    for (int x = 0; x < 2000; x++) {
+        cr_printf(&tmp_err, f,
+                  "<package type=\"rpm\"><name>foo%d</name>"
+                  "<version epoch=\"0\" ver=\"%d.0\" rel=\"1\"/>"
+                  "</package>\n", x, x % 17);
+        g_assert(!tmp_err);
+        g_assert_cmpint(cr_end_chunk(f, &tmp_err), ==, CRE_OK);
+    }
+    cr_close(f, &tmp_err);
+    g_assert(!tmp_err);
+
+    dict = cr_zck_train_dict(outputtest->tmp_filename, 4096, &dict_size,
+                             &tmp_err);
+    g_assert(dict);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(dict_size, >, 0);
+    g_assert_cmpuint(dict_size, <=, 4096);
+    g_free(dict);
+
+    // A single chunk is not enough for training
+    dict = cr_zck_train_dict(FILE_COMPRESSED_1_ZCK, 4096, &dict_size,
+                             &tmp_err);
+    g_assert(!dict);
+    g_assert_cmpint(tmp_err->code, ==, CRE_ZSTD);
+    g_clear_error(&tmp_err);
+#else
+    dict = cr_zck_train_dict(outputtest->tmp_filename, 4096, &dict_size,
+                             &tmp_err);
+    g_assert(!dict);
+    g_assert_cmpint(tmp_err->code, ==, CRE_IO);
+    g_clear_error(&tmp_err);
+#endif // WITH_ZCHUNK && WITH_ZSTD
+}
+
+static void
+test_cr_map(void)
+{
+    GError *tmp_err = NULL;
+    cr_ContentStat *stat;
+    CR_FILE *f;
+    const char *content;
+    gsize len;
+    char buf[16];
+
+    // The rest of a plain file after a read
+    stat = cr_contentstat_new(CR_CHECKSUM_UNKNOWN, NULL);
+    f = cr_sopen(FILE_COMPRESSED_1_PLAIN, CR_CW_MODE_READ,
+                 CR_CW_AUTO_DETECT_COMPRESSION, stat, &tmp_err);
+    g_assert(f);
+    g_assert_cmpint(cr_read(f, buf, 7, &tmp_err), ==, 7);
+    content = cr_map(f, &len, &tmp_err);
+    g_assert(content);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(len, ==, FILE_COMPRESSED_1_CONTENT_LEN - 7);
+    g_assert(!memcmp(content, FILE_COMPRESSED_1_CONTENT + 7, len));
+    g_assert_cmpint(cr_read(f, buf, sizeof(buf), &tmp_err), ==, 0);
+    g_assert(!cr_map(f, &len, &tmp_err));
+    g_assert(!tmp_err);
+    cr_close(f, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpint(stat->size, ==, FILE_COMPRESSED_1_CONTENT_LEN);
+    cr_contentstat_free(stat, NULL);
+
+    f = cr_open(FILE_COMPRESSED_0_PLAIN, CR_CW_MODE_READ,
+                CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+    g_assert(f);
+    content = cr_map(f, &len, &tmp_err);
+    g_assert(content);
+    g_assert_cmpuint(len, ==, 0);
+    cr_close(f, NULL);
+
+    // Compressed files are not mapped
+    f = cr_open(FILE_COMPRESSED_1_GZ, CR_CW_MODE_READ,
+                CR_CW_AUTO_DETECT_COMPRESSION, &tmp_err);
+    g_assert(f);
+    g_assert(!cr_map(f, &len, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpint(cr_read(f, buf, 6, &tmp_err), ==, 6);
+    g_assert(!memcmp(buf, FILE_COMPRESSED_1_CONTENT, 6));
+    cr_close(f, NULL);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -774,8 +1377,12 @@ main(int argc, char *argv[])
             test_cr_compression_type);
     g_test_add_func("/compression_wrapper/test_cr_detect_compression_bad_suffix",
             test_cr_detect_compression_bad_suffix);
+    g_test_add_func("/compression_wrapper/test_cr_is_url",
+            test_cr_is_url);
     g_test_add_func("/compression_wrapper/test_cr_read_with_autodetection",
             test_cr_read_with_autodetection);
+    g_test_add_func("/compression_wrapper/test_cr_map",
+            test_cr_map);
     g_test_add("/compression_wrapper/outputtest_cw_output", Outputtest, NULL,
             outputtest_setup, outputtest_cw_output, outputtest_teardown);
     g_test_add_func("/compression_wrapper/test_cr_error_handling",
@@ -786,8 +1393,32 @@ main(int argc, char *argv[])
     g_test_add("/compression_wrapper/test_contentstating_multiwrite",
             Outputtest, NULL, outputtest_setup,
             test_contentstating_multiwrite, outputtest_teardown);
+    g_test_add("/compression_wrapper/test_contentstating_multichecksum",
+            Outputtest, NULL, outputtest_setup,
+            test_contentstating_multichecksum, outputtest_teardown);
     g_test_add_func("/compression_wrapper/test_cr_get_zchunk_with_index",
             test_cr_get_zchunk_with_index);
+    g_test_add("/compression_wrapper/outputtest_threaded_compression",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_threaded_compression, outputtest_teardown);
+    g_test_add("/compression_wrapper/outputtest_compression_level",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_compression_level, outputtest_teardown);
+    g_test_add("/compression_wrapper/outputtest_compression_settings",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_compression_settings, outputtest_teardown);
+    g_test_add("/compression_wrapper/outputtest_zstd_params",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_zstd_params, outputtest_teardown);
+    g_test_add("/compression_wrapper/outputtest_io_buffer_size",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_io_buffer_size, outputtest_teardown);
+    g_test_add("/compression_wrapper/outputtest_threaded_decompression",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_threaded_decompression, outputtest_teardown);
+    g_test_add("/compression_wrapper/outputtest_zck_train_dict",
+            Outputtest, NULL, outputtest_setup,
+            outputtest_zck_train_dict, outputtest_teardown);
 
     return g_test_run();
 }
@@ -0,0 +1,866 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/createrepo.h"
+#include "createrepo/createrepo_internal.h"
+#include "createrepo/error.h"
+#include "createrepo/load_metadata.h"
+#include "createrepo/misc.h"
+#include "createrepo/pkgindex.h"
+#include "createrepo/shard.h"
+#include "createrepo/xml_parser.h"
+
+typedef struct {
+    gchar *tmpdir;
+} TestFixtures;
+
+static void
+fixtures_setup(TestFixtures *fixtures, G_GNUC_UNUSED gconstpointer test_data)
+{
+    const gchar *packages[] = { "Archer-3.4.5-6.x86_64.rpm",
+                                "fake_bash-1.1.1-1.x86_64.rpm", NULL };
+    gchar *template = g_strdup(TMPDIR_TEMPLATE);
+    fixtures->tmpdir = mkdtemp(template);
+    g_assert(fixtures->tmpdir);
+
+    for (int x = 0; packages[x]; x++) {
+        gchar *src = g_build_filename(TEST_PACKAGES_PATH, packages[x], NULL);
+        gchar *dst = g_build_filename(fixtures->tmpdir, packages[x], NULL);
+        g_assert(cr_copy_file(src, dst, NULL));
+        g_free(src);
+        g_free(dst);
+    }
+}
+
+static void
+fixtures_teardown(TestFixtures *fixtures,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    if (!fixtures->tmpdir)
+        return;
+
+    cr_remove_dir(fixtures->tmpdir, NULL);
+    g_free(fixtures->tmpdir);
+}
+
+static cr_CreaterepoResult *
+run(const gchar * const *args, GError **err)
+{
+    cr_CreaterepoOptions *options;
+    cr_CreaterepoResult *result;
+
+    options = cr_createrepo_options_new(args, err);
+    if (!options)
+        return NULL;
+    result = cr_createrepo_run(options, err);
+    cr_createrepo_options_free(options);
+    return result;
+}
+
+static void
+test_cr_createrepo_run(TestFixtures *fixtures,
+                       G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gchar *repomd = g_build_filename(fixtures->tmpdir, "repodata",
+                                     "repomd.xml", NULL);
+
+    gchar *progress = g_build_filename(fixtures->tmpdir, "progress.json",
+                                       NULL);
+    gchar *progress_arg = g_strconcat("--progress-file=", progress, NULL);
+    gchar *status;
+
+    const gchar *args[] = { "--quiet", "--workers=2", progress_arg,
+                            fixtures->tmpdir, NULL };
+    const gchar *update_args[] = { "--quiet", "--update", "--max-workers=8",
+                                   "--excludes=fake_bash*", fixtures->tmpdir,
+                                   NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->task_count, ==, 2);
+    g_assert_cmpint(result->package_count, ==, 2);
+    g_assert(!result->had_errors);
+    g_assert_cmpint(result->exit_val, ==, 0);
+    g_assert_cmpstr(result->repomd_path, ==, repomd);
+    g_assert(g_file_test(repomd, G_FILE_TEST_IS_REGULAR));
+    cr_createrepo_result_free(result);
+
+    // The final progress is written at the end
+    g_assert(g_file_get_contents(progress, &status, NULL, NULL));
+    g_assert(strstr(status, "\"total\": 2, \"read\": 2, \"done\": 2,"));
+    g_assert(strstr(status, "\"finished\": true"));
+    g_assert(strstr(status, "\"rss_bytes\": "));
+    g_free(status);
+    g_assert_cmpint(g_remove(progress), ==, 0);
+
+    // The second run in the same process updates the repo
+    result = run(update_args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->package_count, ==, 1);
+    cr_createrepo_result_free(result);
+
+    g_free(progress);
+    g_free(progress_arg);
+    g_free(repomd);
+}
+
+static void
+test_cr_createrepo_changed_pkgs(TestFixtures *fixtures,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gchar *changed = g_build_filename(fixtures->tmpdir, "changed", NULL);
+    gchar *removed = g_build_filename(fixtures->tmpdir, "removed", NULL);
+    gchar *empty = g_build_filename(fixtures->tmpdir, "empty-0-0.x86_64.rpm",
+                                    NULL);
+    gchar *fake_bash = g_build_filename(fixtures->tmpdir,
+                                        "fake_bash-1.1.1-1.x86_64.rpm", NULL);
+    gchar *changed_arg = g_strconcat("--changed-pkgs=", changed, NULL);
+    gchar *removed_arg = g_strconcat("--removed-pkgs=", removed, NULL);
+    const gchar *args[] = { "--quiet", fixtures->tmpdir, NULL };
+    const gchar *update_args[] = { "--quiet", changed_arg, removed_arg,
+                                   fixtures->tmpdir, NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    cr_createrepo_result_free(result);
+
+    // Only the changed packages are read, the rest comes from
+    // the old metadata
+    g_assert(cr_copy_file(TEST_PACKAGES_PATH"empty-0-0.x86_64.rpm", empty,
+                          NULL));
+    g_assert_cmpint(g_unlink(fake_bash), ==, 0);
+    g_assert(g_file_set_contents(changed, "empty-0-0.x86_64.rpm\n", -1,
+                                 NULL));
+    g_assert(g_file_set_contents(removed, "./fake_bash-1.1.1-1.x86_64.rpm\n\n",
+                                 -1, NULL));
+
+    result = run(update_args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->task_count, ==, 2);
+    g_assert_cmpint(result->package_count, ==, 2);
+    g_assert(!result->had_errors);
+    cr_createrepo_result_free(result);
+
+    g_assert_cmpint(g_unlink(changed), ==, 0);
+    result = run(update_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    g_free(changed);
+    g_free(removed);
+    g_free(empty);
+    g_free(fake_bash);
+    g_free(changed_arg);
+    g_free(removed_arg);
+}
+
+static void
+test_cr_createrepo_split(TestFixtures *fixtures,
+                         G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    cr_Metadata *md;
+    GHashTableIter iter;
+    gpointer value;
+    GError *tmp_err = NULL;
+    const gchar *packages[] = { "empty-0-0.x86_64.rpm",
+                                "Rimmer-1.0.2-2.x86_64.rpm" };
+    gchar *media[2];
+    gchar *outdir = g_build_filename(fixtures->tmpdir, "out", NULL);
+
+    g_assert_cmpint(g_mkdir(outdir, 0755), ==, 0);
+    for (int x = 0; x < 2; x++) {
+        gchar *src = g_build_filename(TEST_PACKAGES_PATH, packages[x], NULL);
+        gchar *dir = g_strdup_printf("%s/media%d/sub", fixtures->tmpdir, x + 1);
+        gchar *dst = g_build_filename(dir, packages[x], NULL);
+        g_assert_cmpint(g_mkdir_with_parents(dir, 0755), ==, 0);
+        g_assert(cr_copy_file(src, dst, NULL));
+        media[x] = g_path_get_dirname(dir);
+        g_free(src);
+        g_free(dir);
+        g_free(dst);
+    }
+
+    const gchar *args[] = { "--quiet", "--split", "--workers=2",
+                            "--prefetch=1", "--outputdir", outdir,
+                            media[0], media[1], NULL };
+
+    // Both media are walked at once, the packages keep their media
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->package_count, ==, 2);
+    cr_createrepo_result_free(result);
+
+    md = cr_metadata_new(CR_HT_KEY_NAME, 0, NULL);
+    g_assert_cmpint(cr_metadata_locate_and_load_xml(md, outdir, NULL),
+                    ==, CRE_OK);
+    g_assert_cmpuint(g_hash_table_size(cr_metadata_hashtable(md)), ==, 2);
+    g_hash_table_iter_init(&iter, cr_metadata_hashtable(md));
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        cr_Package *pkg = value;
+        g_assert_cmpstr(pkg->location_base, ==,
+                        !strcmp(pkg->location_href, "sub/empty-0-0.x86_64.rpm")
+                        ? "media:#1" : "media:#2");
+    }
+    cr_metadata_free(md);
+
+    for (int x = 0; x < 2; x++)
+        g_free(media[x]);
+    g_free(outdir);
+}
+
+static void
+test_cr_createrepo_run_errors(TestFixtures *fixtures,
+                              G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoOptions *options;
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gchar *missing = g_build_filename(fixtures->tmpdir, "missing", NULL);
+    gchar *lock = g_build_filename(fixtures->tmpdir, ".repodata", NULL);
+    gchar *repodata = g_build_filename(fixtures->tmpdir, "repodata", NULL);
+    const gchar *args[] = { "--quiet", fixtures->tmpdir, NULL };
+    const gchar *missing_args[] = { "--quiet", missing, NULL };
+    const gchar *level_args[] = { "--quiet", "--compress-level=xz:42",
+                                  fixtures->tmpdir, NULL };
+    const gchar *workers_args[] = { "--quiet", "--workers=4",
+                                    "--max-workers=2", fixtures->tmpdir,
+                                    NULL };
+
+    result = run(missing_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_NODIR);
+    g_clear_error(&tmp_err);
+
+    result = run(level_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    result = run(workers_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    // The lock of another process is kept
+    g_assert_cmpint(g_mkdir(lock, 0755), ==, 0);
+    result = run(args, &tmp_err);
+    g_assert(!result);
+    g_assert(tmp_err);
+    g_clear_error(&tmp_err);
+    g_assert(g_file_test(lock, G_FILE_TEST_IS_DIR));
+    g_assert(!g_file_test(repodata, G_FILE_TEST_EXISTS));
+    g_assert_cmpint(g_rmdir(lock), ==, 0);
+
+    // The options cannot be used twice
+    options = cr_createrepo_options_new(args, &tmp_err);
+    g_assert(options);
+    result = cr_createrepo_run(options, &tmp_err);
+    g_assert(result);
+    cr_createrepo_result_free(result);
+    result = cr_createrepo_run(options, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    cr_createrepo_options_free(options);
+
+    g_free(missing);
+    g_free(lock);
+    g_free(repodata);
+}
+
+/** Inode of the primary db in the repodata (0 if there is none).
+ */
+static guint64
+primary_db_inode(const gchar *repodata)
+{
+    GDir *dir = g_dir_open(repodata, 0, NULL);
+    const gchar *name;
+    guint64 inode = 0;
+
+    g_assert(dir);
+    while ((name = g_dir_read_name(dir))) {
+        if (strstr(name, "-primary.sqlite")) {
+            GStatBuf st;
+            gchar *path = g_build_filename(repodata, name, NULL);
+            g_assert_cmpint(g_stat(path, &st), ==, 0);
+            inode = st.st_ino;
+            g_free(path);
+        }
+    }
+    g_dir_close(dir);
+    return inode;
+}
+
+static void
+test_cr_createrepo_unchanged_db(TestFixtures *fixtures,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    guint64 inode;
+    gchar *repodata = g_build_filename(fixtures->tmpdir, "repodata", NULL);
+    const gchar *args[] = { "--quiet", fixtures->tmpdir, NULL };
+    const gchar *update_args[] = { "--quiet", "--update", fixtures->tmpdir,
+                                   NULL };
+    const gchar *exclude_args[] = { "--quiet", "--update",
+                                    "--excludes=fake_bash*", fixtures->tmpdir,
+                                    NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    cr_createrepo_result_free(result);
+    inode = primary_db_inode(repodata);
+    g_assert(inode);
+
+    // The db of the unchanged packages is not compressed again
+    result = run(update_args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    cr_createrepo_result_free(result);
+    g_assert_cmpuint(primary_db_inode(repodata), ==, inode);
+
+    result = run(exclude_args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->package_count, ==, 1);
+    cr_createrepo_result_free(result);
+    g_assert_cmpuint(primary_db_inode(repodata), !=, inode);
+
+    g_free(repodata);
+}
+
+static void
+test_cr_createrepo_shared_store(TestFixtures *fixtures,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    GDir *dir;
+    const gchar *name;
+    guint count = 0;
+    gchar *store = g_build_filename(fixtures->tmpdir, "store", NULL);
+    gchar *store_arg = g_strconcat("--shared-store=", store, NULL);
+    gchar *out1 = g_build_filename(fixtures->tmpdir, "out1", NULL);
+    gchar *out2 = g_build_filename(fixtures->tmpdir, "out2", NULL);
+    const gchar *args1[] = { "--quiet", "--no-database", store_arg,
+                             "--outputdir", out1, fixtures->tmpdir, NULL };
+    const gchar *args2[] = { "--quiet", "--no-database", store_arg,
+                             "--outputdir", out2, fixtures->tmpdir, NULL };
+    const gchar *simple_args[] = { "--quiet", "--simple-md-filenames",
+                                   store_arg, fixtures->tmpdir, NULL };
+
+    g_assert_cmpint(g_mkdir(store, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir(out1, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir(out2, 0755), ==, 0);
+
+    result = run(args1, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    cr_createrepo_result_free(result);
+
+    result = run(args2, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    cr_createrepo_result_free(result);
+
+    // Both repodata link the same stored files
+    dir = g_dir_open(store, 0, NULL);
+    g_assert(dir);
+    while ((name = g_dir_read_name(dir))) {
+        GStatBuf st;
+        gchar *path = g_build_filename(store, name, NULL);
+        g_assert_cmpint(g_stat(path, &st), ==, 0);
+        g_assert_cmpint(st.st_nlink, ==, 3);
+        g_free(path);
+        count++;
+    }
+    g_dir_close(dir);
+    g_assert_cmpint(count, ==, 3);
+
+    result = run(simple_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    g_free(store);
+    g_free(store_arg);
+    g_free(out1);
+    g_free(out2);
+}
+
+static void
+test_cr_createrepo_pkg_index(TestFixtures *fixtures,
+                             G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    cr_PkgIndex *index;
+    cr_PkgIndexEntry entry;
+    GError *tmp_err = NULL;
+    gchar *path = g_build_filename(fixtures->tmpdir, "repodata", "pkgindex",
+                                   NULL);
+    const gchar *args[] = { "--quiet", "--no-database", "--pkg-index",
+                            "--simple-md-filenames", fixtures->tmpdir, NULL };
+    const gchar *update_args[] = { "--quiet", "--no-database", "--update",
+                                   "--keep-all-metadata",
+                                   "--simple-md-filenames", fixtures->tmpdir,
+                                   NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    cr_createrepo_result_free(result);
+
+    index = cr_pkgindex_open(path, &tmp_err);
+    g_assert(index);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgindex_size(index), ==, 2);
+    g_assert(cr_pkgindex_get(index, 0, &entry));
+    g_assert_cmpstr(entry.location_href, ==, "Archer-3.4.5-6.x86_64.rpm");
+    cr_pkgindex_free(index);
+
+    // The index of the old packages is never kept
+    result = run(update_args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    cr_createrepo_result_free(result);
+    g_assert(!g_file_test(path, G_FILE_TEST_EXISTS));
+
+    g_free(path);
+}
+
+static void
+test_cr_createrepo_primary_only(TestFixtures *fixtures,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gchar *repodata = g_build_filename(fixtures->tmpdir, "repodata", NULL);
+    gchar *repomd_path = g_build_filename(repodata, "repomd.xml", NULL);
+    gchar *primary = g_build_filename(repodata, "primary.xml.gz", NULL);
+    gchar *filelists = g_build_filename(repodata, "filelists.xml.gz", NULL);
+    gchar *cache = g_build_filename(fixtures->tmpdir, "pkgcache", NULL);
+    gchar *cache_arg = g_strconcat("--pkg-cache=", cache, NULL);
+    gchar *repomd;
+    const gchar *args[] = { "--quiet", "--primary-only",
+                            "--simple-md-filenames", fixtures->tmpdir, NULL };
+    const gchar *cache_args[] = { "--quiet", "--primary-only", cache_arg,
+                                  fixtures->tmpdir, NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->package_count, ==, 2);
+    g_assert(!result->had_errors);
+    cr_createrepo_result_free(result);
+
+    g_assert(g_file_test(primary, G_FILE_TEST_IS_REGULAR));
+    g_assert(!g_file_test(filelists, G_FILE_TEST_EXISTS));
+    g_assert(g_file_get_contents(repomd_path, &repomd, NULL, NULL));
+    g_assert(strstr(repomd, "<data type=\"primary\">"));
+    g_assert(strstr(repomd, "<data type=\"primary_db\">"));
+    g_assert(!strstr(repomd, "filelists"));
+    g_assert(!strstr(repomd, "other"));
+    g_free(repomd);
+
+    // The cached packages would miss filelists and other
+    result = run(cache_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    g_free(repodata);
+    g_free(repomd_path);
+    g_free(primary);
+    g_free(filelists);
+    g_free(cache);
+    g_free(cache_arg);
+}
+
+static void
+test_cr_createrepo_shard(TestFixtures *fixtures,
+                         G_GNUC_UNUSED gconstpointer test_data)
+{
+    const gchar *packages[] = { "Archer-3.4.5-6.x86_64.rpm",
+                                "fake_bash-1.1.1-1.x86_64.rpm" };
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gint total = 0;
+
+    for (guint shard = 0; shard < 2; shard++) {
+        gchar *shard_arg = g_strdup_printf("--shard=%u/2", shard + 1);
+        const gchar *args[] = { "--quiet", shard_arg, fixtures->tmpdir,
+                                NULL };
+        gint expected = 0;
+
+        for (guint x = 0; x < G_N_ELEMENTS(packages); x++)
+            expected += cr_shard_of(packages[x], 2) == shard;
+
+        result = run(args, &tmp_err);
+        g_assert(result);
+        g_assert(!tmp_err);
+        g_assert_cmpint(result->package_count, ==, expected);
+        cr_createrepo_result_free(result);
+        total += expected;
+        g_free(shard_arg);
+    }
+
+    // Every package is in exactly one shard
+    g_assert_cmpint(total, ==, G_N_ELEMENTS(packages));
+
+    const gchar *bad_args[] = { "--quiet", "--shard=3/2", fixtures->tmpdir,
+                                NULL };
+    result = run(bad_args, &tmp_err);
+    g_assert(!result);
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+}
+
+/** Content hash stored in the repomd.xml of the repo (free it).
+ */
+static gchar *
+repo_contenthash(const gchar *repo)
+{
+    gchar *path = g_build_filename(repo, "repodata", "repomd.xml", NULL);
+    const gchar *tag = "<contenthash type=\"sha256\">";
+    gchar *repomd, *start, *hash = NULL;
+
+    g_assert(g_file_get_contents(path, &repomd, NULL, NULL));
+    if ((start = strstr(repomd, tag))) {
+        start += strlen(tag);
+        hash = g_strndup(start, strcspn(start, "<"));
+    }
+    g_free(repomd);
+    g_free(path);
+    return hash;
+}
+
+static void
+test_cr_createrepo_contenthash(TestFixtures *fixtures,
+                               G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gchar *cache = g_build_filename(fixtures->tmpdir, "pkgcache", NULL);
+    gchar *cache_arg = g_strconcat("--pkg-cache=", cache, NULL);
+    gchar *hash, *cached_hash, *other_hash;
+    const gchar *args[] = { "--quiet", "--set-contenthash", "--no-database",
+                            cache_arg, fixtures->tmpdir, NULL };
+    const gchar *exclude_args[] = { "--quiet", "--set-contenthash",
+                                    "--excludes=fake_bash*",
+                                    fixtures->tmpdir, NULL };
+    const gchar *no_args[] = { "--quiet", fixtures->tmpdir, NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    cr_createrepo_result_free(result);
+    hash = repo_contenthash(fixtures->tmpdir);
+    g_assert(hash);
+    g_assert_cmpint(strlen(hash), ==, 64);
+
+    // The packages from the package cache result in the same hash
+    result = run(args, &tmp_err);
+    g_assert(result);
+    cr_createrepo_result_free(result);
+    cached_hash = repo_contenthash(fixtures->tmpdir);
+    g_assert_cmpstr(cached_hash, ==, hash);
+
+    result = run(exclude_args, &tmp_err);
+    g_assert(result);
+    cr_createrepo_result_free(result);
+    other_hash = repo_contenthash(fixtures->tmpdir);
+    g_assert(other_hash);
+    g_assert_cmpstr(other_hash, !=, hash);
+    g_free(other_hash);
+
+    result = run(no_args, &tmp_err);
+    g_assert(result);
+    cr_createrepo_result_free(result);
+    g_assert(!repo_contenthash(fixtures->tmpdir));
+
+    g_free(hash);
+    g_free(cached_hash);
+    g_free(cache);
+    g_free(cache_arg);
+}
+
+#define CONCURRENT_RUNS     4
+
+typedef struct {
+    gchar *dir;
+    const gchar *level_arg;
+    gint64 size;                // Size of the xml files of the repo
+} ConcurrentRun;
+
+static gpointer
+concurrent_run_thread(gpointer data)
+{
+    ConcurrentRun *crun = data;
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    const gchar *args[] = { "--quiet", "--no-database", "--simple-md-filenames",
+                            "--workers=2", crun->level_arg, crun->dir, NULL };
+    const gchar *files[] = { "primary.xml.gz", "filelists.xml.gz",
+                             "other.xml.gz", NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->package_count, ==, 2);
+    cr_createrepo_result_free(result);
+
+    crun->size = 0;
+    for (int x = 0; files[x]; x++) {
+        gchar *path = g_build_filename(crun->dir, "repodata", files[x], NULL);
+        GStatBuf st;
+        g_assert_cmpint(g_stat(path, &st), ==, 0);
+        crun->size += st.st_size;
+        g_free(path);
+    }
+    return NULL;
+}
+
+static void
+test_cr_createrepo_concurrent(TestFixtures *fixtures,
+                              G_GNUC_UNUSED gconstpointer test_data)
+{
+    ConcurrentRun cruns[CONCURRENT_RUNS];
+    GThread *threads[CONCURRENT_RUNS];
+    const gchar *packages[] = { "Archer-3.4.5-6.x86_64.rpm",
+                                "fake_bash-1.1.1-1.x86_64.rpm", NULL };
+
+    // Repos of the same packages compressed by different levels
+    for (int x = 0; x < CONCURRENT_RUNS; x++) {
+        cruns[x].dir = g_strdup_printf("%s/repo%d", fixtures->tmpdir, x);
+        cruns[x].level_arg = (x % 2) ? "--compress-level=gz:9"
+                                     : "--compress-level=gz:1";
+        g_assert_cmpint(g_mkdir(cruns[x].dir, 0755), ==, 0);
+        for (int y = 0; packages[y]; y++) {
+            gchar *src = g_build_filename(TEST_PACKAGES_PATH, packages[y], NULL);
+            gchar *dst = g_build_filename(cruns[x].dir, packages[y], NULL);
+            g_assert(cr_copy_file(src, dst, NULL));
+            g_free(src);
+            g_free(dst);
+        }
+    }
+
+    // The runs don't share their settings
+    for (int x = 0; x < CONCURRENT_RUNS; x++)
+        threads[x] = g_thread_new(NULL, concurrent_run_thread, &cruns[x]);
+    for (int x = 0; x < CONCURRENT_RUNS; x++)
+        g_thread_join(threads[x]);
+
+    for (int x = 0; x < CONCURRENT_RUNS; x++) {
+        g_assert_cmpint(cruns[x].size, ==, cruns[x % 2].size);
+        g_free(cruns[x].dir);
+    }
+    g_assert_cmpint(cruns[0].size, >, cruns[1].size);
+}
+
+typedef struct {
+    gchar *dir;
+    GThreadPool *pool;
+    long package_count;
+} SharedPoolRun;
+
+static gpointer
+shared_pool_run_thread(gpointer data)
+{
+    SharedPoolRun *srun = data;
+    cr_CreaterepoResult *result;
+    struct CmdOptions *cmd_options;
+    GError *tmp_err = NULL;
+    gchar *dirs[] = { srun->dir, NULL };
+    char *args[] = { "createrepo_c", "--quiet", "--no-database",
+                     "--simple-md-filenames", NULL };
+    int argc = G_N_ELEMENTS(args) - 1;
+    char **argv = args;
+
+    cmd_options = cr_cmd_parse_arguments(&argc, &argv, &tmp_err);
+    g_assert(cmd_options);
+    result = cr_createrepo_run_cmd_options(cmd_options, dirs, FALSE,
+                                           srun->pool, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    srun->package_count = result->package_count;
+    cr_createrepo_result_free(result);
+    cr_cmd_free_options(cmd_options);
+    return NULL;
+}
+
+static void
+test_cr_createrepo_shared_pool(TestFixtures *fixtures,
+                               G_GNUC_UNUSED gconstpointer test_data)
+{
+    SharedPoolRun sruns[2];
+    GThread *threads[2];
+    const gchar *packages[] = { "Archer-3.4.5-6.x86_64.rpm",
+                                "fake_bash-1.1.1-1.x86_64.rpm",
+                                "super_kernel-6.0.1-2.x86_64.rpm", NULL };
+    GThreadPool *pool = cr_createrepo_shared_pool_new(2);
+
+    // The repos of 3 and 1 packages read by the same workers
+    for (int x = 0; x < 2; x++) {
+        sruns[x].dir = g_strdup_printf("%s/repo%d", fixtures->tmpdir, x);
+        sruns[x].pool = pool;
+        g_assert_cmpint(g_mkdir(sruns[x].dir, 0755), ==, 0);
+        for (int y = x * 2; packages[y]; y++) {
+            gchar *src = g_build_filename(TEST_PACKAGES_PATH, packages[y], NULL);
+            gchar *dst = g_build_filename(sruns[x].dir, packages[y], NULL);
+            g_assert(cr_copy_file(src, dst, NULL));
+            g_free(src);
+            g_free(dst);
+        }
+    }
+
+    for (int x = 0; x < 2; x++)
+        threads[x] = g_thread_new(NULL, shared_pool_run_thread, &sruns[x]);
+    for (int x = 0; x < 2; x++)
+        g_thread_join(threads[x]);
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    g_assert_cmpint(sruns[0].package_count, ==, 3);
+    g_assert_cmpint(sruns[1].package_count, ==, 1);
+    for (int x = 0; x < 2; x++)
+        g_free(sruns[x].dir);
+}
+
+static int
+stream_walk_pkgcb(cr_Package *pkg, void *cbdata, G_GNUC_UNUSED GError **err)
+{
+    g_ptr_array_add(cbdata, g_strdup(pkg->location_href));
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+static void
+test_cr_createrepo_stream_walk(TestFixtures *fixtures,
+                               G_GNUC_UNUSED gconstpointer test_data)
+{
+    // The packages of a directory go before its sub directories
+    const gchar *hrefs[] = { "Archer-3.4.5-6.x86_64.rpm",
+                             "fake_bash-1.1.1-1.x86_64.rpm",
+                             "a/Rimmer-1.0.2-2.x86_64.rpm",
+                             "b/super_kernel-6.0.1-2.x86_64.rpm",
+                             "b/a/empty-0-0.x86_64.rpm" };
+    cr_CreaterepoResult *result;
+    GError *tmp_err = NULL;
+    gchar *primary = g_build_filename(fixtures->tmpdir, "repodata",
+                                      "primary.xml.gz", NULL);
+    GPtrArray *found = g_ptr_array_new_with_free_func(g_free);
+
+    for (guint x = 2; x < G_N_ELEMENTS(hrefs); x++) {
+        gchar *src = g_build_filename(TEST_PACKAGES_PATH,
+                                      strrchr(hrefs[x], '/') + 1, NULL);
+        gchar *dst = g_build_filename(fixtures->tmpdir, hrefs[x], NULL);
+        gchar *dir = g_path_get_dirname(dst);
+        g_assert_cmpint(g_mkdir_with_parents(dir, 0755), ==, 0);
+        g_assert(cr_copy_file(src, dst, NULL));
+        g_free(src);
+        g_free(dst);
+        g_free(dir);
+    }
+
+    const gchar *args[] = { "--quiet", "--stream-walk", "--workers=2",
+                            "--prefetch=1", "--simple-md-filenames",
+                            fixtures->tmpdir, NULL };
+
+    result = run(args, &tmp_err);
+    g_assert(result);
+    g_assert(!tmp_err);
+    g_assert_cmpint(result->task_count, ==, G_N_ELEMENTS(hrefs));
+    g_assert_cmpint(result->package_count, ==, G_N_ELEMENTS(hrefs));
+    cr_createrepo_result_free(result);
+
+    g_assert_cmpint(cr_xml_parse_primary(primary, NULL, NULL,
+                                         stream_walk_pkgcb, found,
+                                         NULL, NULL, FALSE, &tmp_err),
+                    ==, CRE_OK);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(found->len, ==, G_N_ELEMENTS(hrefs));
+    for (guint x = 0; x < found->len; x++)
+        g_assert_cmpstr(g_ptr_array_index(found, x), ==, hrefs[x]);
+
+    g_ptr_array_free(found, TRUE);
+    g_free(primary);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/createrepo/test_cr_createrepo_run",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_run, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_changed_pkgs",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_changed_pkgs, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_split",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_split, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_run_errors",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_run_errors, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_unchanged_db",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_unchanged_db, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_shared_store",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_shared_store, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_pkg_index",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_pkg_index, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_primary_only",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_primary_only, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_shard",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_shard, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_contenthash",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_contenthash, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_concurrent",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_concurrent, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_stream_walk",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_stream_walk, fixtures_teardown);
+    g_test_add("/createrepo/test_cr_createrepo_shared_pool",
+               TestFixtures, NULL, fixtures_setup,
+               test_cr_createrepo_shared_pool, fixtures_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,128 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "createrepo/globset.h"
+
+static void
+test_cr_globset_empty(void)
+{
+    cr_GlobSet *set = cr_globset_new();
+
+    g_assert(!cr_globset_match(NULL, "foo.rpm"));
+    g_assert(!cr_globset_match(set, "foo.rpm"));
+    g_assert(!cr_globset_match(set, ""));
+
+    cr_globset_free(set);
+    cr_globset_free(NULL);
+}
+
+static void
+test_cr_globset_match(void)
+{
+    cr_GlobSet *set = cr_globset_new();
+
+    cr_globset_add(set, "exact.rpm");
+    cr_globset_add(set, "*.src.rpm");
+    cr_globset_add(set, "**.i686.rpm");
+    cr_globset_add(set, "debug*");
+    cr_globset_add(set, "*-debuginfo-*");
+    cr_globset_add(set, "kernel-?.*.rpm");
+
+    // Exact
+    g_assert(cr_globset_match(set, "exact.rpm"));
+    g_assert(!cr_globset_match(set, "exact.rpm.old"));
+    g_assert(!cr_globset_match(set, "sub/exact.rpm"));
+
+    // Suffix
+    g_assert(cr_globset_match(set, "foo-1-1.src.rpm"));
+    g_assert(cr_globset_match(set, ".src.rpm"));
+    g_assert(cr_globset_match(set, "foo-1-1.i686.rpm"));
+    g_assert(!cr_globset_match(set, "src.rpm"));
+
+    // Prefix
+    g_assert(cr_globset_match(set, "debug"));
+    g_assert(cr_globset_match(set, "debug/foo.rpm"));
+    g_assert(!cr_globset_match(set, "nodebug"));
+
+    // Infix
+    g_assert(cr_globset_match(set, "foo-debuginfo-1-1.x86_64.rpm"));
+    g_assert(!cr_globset_match(set, "foo-debuginfo.x86_64.rpm"));
+
+    // Other patterns
+    g_assert(cr_globset_match(set, "kernel-5.4.rpm"));
+    g_assert(!cr_globset_match(set, "kernel-54.4.rpm"));
+    g_assert(!cr_globset_match(set, "foo-1-1.x86_64.rpm"));
+
+    cr_globset_free(set);
+}
+
+static void
+test_cr_globset_star(void)
+{
+    cr_GlobSet *set = cr_globset_new();
+
+    cr_globset_add(set, "*");
+    g_assert(cr_globset_match(set, ""));
+    g_assert(cr_globset_match(set, "foo.rpm"));
+    cr_globset_free(set);
+}
+
+static void
+test_cr_globset_same_as_pattern_spec(void)
+{
+    const char *patterns[] = { "*.rpm", "a*", "*b*", "?c", "d?*e", "f",
+                               "*g?", "**", "h**i", NULL };
+    const char *strings[] = { "", "a", "b", "c", "xc", "de", "dxe", "f",
+                              "ff", "xgy", "hi", "hxi", "a.rpm", "xbx",
+                              "\xc3\xa1" "c", NULL };
+
+    for (int p = 0; patterns[p]; p++) {
+        cr_GlobSet *set = cr_globset_new();
+        GPatternSpec *spec = g_pattern_spec_new(patterns[p]);
+        cr_globset_add(set, patterns[p]);
+
+        for (int s = 0; strings[s]; s++)
+            g_assert_cmpint(cr_globset_match(set, strings[s]), ==,
+                            g_pattern_match_string(spec, strings[s]));
+
+        g_pattern_spec_free(spec);
+        cr_globset_free(set);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/globset/test_cr_globset_empty",
+                    test_cr_globset_empty);
+    g_test_add_func("/globset/test_cr_globset_match",
+                    test_cr_globset_match);
+    g_test_add_func("/globset/test_cr_globset_star",
+                    test_cr_globset_star);
+    g_test_add_func("/globset/test_cr_globset_same_as_pattern_spec",
+                    test_cr_globset_same_as_pattern_spec);
+
+    return g_test_run();
+}
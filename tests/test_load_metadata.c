@@ -20,6 +20,7 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "fixtures.h"
 #include "createrepo/error.h"
 #include "createrepo/package.h"
@@ -27,6 +28,7 @@
 #include "createrepo/load_metadata.h"
 #include "createrepo/locate_metadata.h"
 #include "createrepo/metadata_internal.h"
+#include "createrepo/xml_dump.h"
 
 #define REPO_SIZE_00    0
 
@@ -167,6 +169,304 @@ static void test_cr_metadata_locate_and_load_xml_detailed(void)
 }
 
 
+static void test_helper_check_files_and_changelogs(int use_single_chunk,
+                                                   gboolean lazy)
+{
+    int ret;
+    cr_Package *pkg;
+    cr_PackageFile *file;
+    cr_ChangelogEntry *entry;
+    cr_Metadata *metadata;
+    GError *tmp_err = NULL;
+
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, use_single_chunk, NULL);
+    g_assert(cr_metadata_set_lazy(metadata, lazy));
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_01, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(pkg);
+
+    if (lazy) {
+        g_assert(pkg->loadingflags & CR_PACKAGE_LAZY_FIL);
+        g_assert(pkg->loadingflags & CR_PACKAGE_LAZY_OTH);
+        g_assert(!pkg->files);
+        g_assert(!pkg->changelogs);
+        g_assert(pkg->raw_filelists);
+        g_assert(pkg->raw_other);
+    }
+
+    g_assert(cr_metadata_load_lazy_data(pkg, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert(!(pkg->loadingflags & CR_PACKAGE_LAZY_FIL));
+    g_assert(!(pkg->loadingflags & CR_PACKAGE_LAZY_OTH));
+
+    g_assert(pkg->loadingflags & CR_PACKAGE_LOADED_FIL);
+    g_assert(pkg->loadingflags & CR_PACKAGE_LOADED_OTH);
+
+    g_assert_cmpint(g_slist_length(pkg->files), ==, 2);
+    file = pkg->files->data;
+    g_assert_cmpstr(file->path, ==, "/usr/bin/");
+    g_assert_cmpstr(file->name, ==, "super_kernel");
+    file = pkg->files->next->data;
+    g_assert_cmpstr(file->path, ==, "/usr/share/man/");
+    g_assert_cmpstr(file->name, ==, "super_kernel.8.gz");
+
+    g_assert_cmpint(g_slist_length(pkg->changelogs), ==, 2);
+    entry = pkg->changelogs->data;
+    g_assert_cmpstr(entry->author, ==, "Tomas Mlcoch <tmlcoch@redhat.com> - 6.0.1-1");
+    g_assert_cmpint(entry->date, ==, 1334664000);
+    g_assert_cmpstr(entry->changelog, ==, "- First release");
+    entry = pkg->changelogs->next->data;
+    g_assert_cmpstr(entry->changelog, ==, "- Second release");
+
+    cr_metadata_free(metadata);
+}
+
+
+static void test_cr_metadata_locate_and_load_xml_files_and_changelogs(void)
+{
+    test_helper_check_files_and_changelogs(0, FALSE);
+    test_helper_check_files_and_changelogs(1, FALSE);
+}
+
+
+static void test_cr_metadata_locate_and_load_xml_lazy(void)
+{
+    test_helper_check_files_and_changelogs(0, TRUE);
+    test_helper_check_files_and_changelogs(1, TRUE);
+}
+
+
+static void test_cr_metadata_locate_and_load_xml_raw(void)
+{
+    int ret;
+    cr_Package *pkg;
+    cr_Metadata *metadata;
+    struct cr_XmlStruct res;
+    GError *tmp_err = NULL;
+
+    // Raw xml is not stored by default
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 0, NULL);
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_01, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(pkg);
+    g_assert(!pkg->raw_primary);
+    g_assert(!pkg->raw_filelists);
+    g_assert(!pkg->raw_other);
+    cr_metadata_free(metadata);
+
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 1, NULL);
+    g_assert(cr_metadata_set_store_raw(metadata, TRUE));
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_01, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(pkg);
+
+    g_assert(g_str_has_prefix(pkg->raw_primary, "<package type=\"rpm\">"));
+    g_assert(g_str_has_suffix(pkg->raw_primary, "</package>"));
+    g_assert(strstr(pkg->raw_primary, "<name>super_kernel</name>"));
+    g_assert(g_str_has_prefix(pkg->raw_filelists, "<package pkgid=\"152824bf"));
+    g_assert(g_str_has_suffix(pkg->raw_filelists, "</package>"));
+    g_assert(g_str_has_prefix(pkg->raw_other, "<package pkgid=\"152824bf"));
+    g_assert(g_str_has_suffix(pkg->raw_other, "</package>"));
+    g_assert(strstr(pkg->raw_other, "- Second release</changelog>"));
+
+    // Only the location is regenerated
+    pkg->location_href = "foo/super_kernel.rpm";
+    pkg->location_base = "/srv/repo";
+    res = cr_xml_dump_from_raw(pkg, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert(strstr(res.primary, "<location xml:base=\"file:///srv/repo\" "
+                                 "href=\"foo/super_kernel.rpm\"/>"));
+    g_assert(!strstr(res.primary, "super_kernel-6.0.1-2.x86_64.rpm\""));
+    g_assert(g_str_has_suffix(res.primary, "</package>\n"));
+    g_assert(g_str_has_suffix(res.filelists, "</package>\n"));
+    g_assert(g_str_has_suffix(res.other, "</package>\n"));
+    g_free(res.primary);
+    g_free(res.filelists);
+    g_free(res.other);
+
+    cr_metadata_free(metadata);
+}
+
+
+static void test_cr_metadata_locate_and_load_xml_spool(void)
+{
+    int ret;
+    cr_Package *pkg;
+    cr_Metadata *metadata;
+    GError *tmp_err = NULL;
+
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 1, NULL);
+    g_assert(cr_metadata_set_store_raw(metadata, TRUE));
+    g_assert(cr_metadata_set_lazy(metadata, TRUE));
+    g_assert(cr_metadata_set_spool_raw(metadata, TRUE));
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_01, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(pkg);
+
+    // The raw xml of files and changelogs waits in the spool
+    g_assert(pkg->spool);
+    g_assert(pkg->raw_primary);
+    g_assert(!pkg->raw_filelists);
+    g_assert(!pkg->raw_other);
+    g_assert(pkg->loadingflags & CR_PACKAGE_LAZY_FIL);
+    g_assert(pkg->loadingflags & CR_PACKAGE_LAZY_OTH);
+
+    g_assert(cr_metadata_load_spooled_raw(pkg, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert(!pkg->spool);
+    g_assert(g_str_has_prefix(pkg->raw_filelists, "<package pkgid=\"152824bf"));
+    g_assert(g_str_has_suffix(pkg->raw_filelists, "</package>"));
+    g_assert(g_str_has_prefix(pkg->raw_other, "<package pkgid=\"152824bf"));
+    g_assert(g_str_has_suffix(pkg->raw_other, "</package>"));
+
+    g_assert(cr_metadata_load_lazy_data(pkg, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpint(g_slist_length(pkg->files), ==, 2);
+    g_assert_cmpint(g_slist_length(pkg->changelogs), ==, 2);
+
+    cr_metadata_free(metadata);
+
+    // The lazy data are read from the spool right away too
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 0, NULL);
+    g_assert(cr_metadata_set_store_raw(metadata, TRUE));
+    g_assert(cr_metadata_set_lazy(metadata, TRUE));
+    g_assert(cr_metadata_set_spool_raw(metadata, TRUE));
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_02, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "fake_bash");
+    g_assert(pkg);
+    g_assert(pkg->spool);
+    g_assert(cr_metadata_load_lazy_data(pkg, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert(!pkg->spool);
+    g_assert(pkg->files);
+    g_assert(pkg->changelogs);
+
+    cr_metadata_free(metadata);
+}
+
+
+static void test_cr_metadata_locate_and_load_xml_intern(void)
+{
+    int ret;
+    cr_Package *bash, *kernel;
+    cr_Metadata *metadata;
+    GSList *chunks;
+
+    // Strings are not shared by default
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 1, NULL);
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_02, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    bash = g_hash_table_lookup(cr_metadata_hashtable(metadata), "fake_bash");
+    kernel = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(bash && kernel);
+    g_assert(!(bash->loadingflags & CR_PACKAGE_INTERNED));
+    g_assert_cmpstr(bash->arch, ==, kernel->arch);
+    g_assert(bash->arch != kernel->arch);
+    cr_metadata_free(metadata);
+
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 1, NULL);
+    g_assert(cr_metadata_set_intern_strings(metadata, TRUE));
+    ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_02, NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    bash = g_hash_table_lookup(cr_metadata_hashtable(metadata), "fake_bash");
+    kernel = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(bash && kernel);
+    g_assert(bash->loadingflags & CR_PACKAGE_INTERNED);
+    g_assert_cmpstr(bash->arch, ==, "x86_64");
+    g_assert(bash->arch == kernel->arch);
+    g_assert(bash->epoch == kernel->epoch);
+    g_assert_cmpstr(bash->version, ==, "1.1.1");
+    g_assert_cmpstr(kernel->version, ==, "6.0.1");
+    g_assert_cmpstr(bash->rpm_license, ==, "GPL");
+    g_assert_cmpstr(kernel->rpm_license, ==, "LGPLv2");
+
+    // The package outlives the metadata with the stolen chunks
+    g_assert(g_hash_table_steal(cr_metadata_hashtable(metadata), "super_kernel"));
+    chunks = cr_metadata_steal_chunks(metadata);
+    g_assert(chunks);
+    cr_metadata_free(metadata);
+    g_assert_cmpstr(kernel->name, ==, "super_kernel");
+    g_assert_cmpstr(kernel->arch, ==, "x86_64");
+    cr_package_free(kernel);
+    g_slist_free_full(chunks, (GDestroyNotify) g_string_chunk_free);
+}
+
+
+static void test_cr_metadata_locate_and_load_xml_pkglist(void)
+{
+    int ret;
+    cr_Package *pkg;
+    cr_Metadata *metadata;
+    GSList *pkglist = g_slist_prepend(NULL, "super_kernel-6.0.1-2.x86_64.rpm");
+
+    // The filelists.xml and other.xml parsers skip the dropped fake_bash
+    for (int fast = 0; fast < 2; fast++) {
+        metadata = cr_metadata_new(CR_HT_KEY_NAME, 1, pkglist);
+        g_assert(cr_metadata_set_fast_parser(metadata, fast));
+        ret = cr_metadata_locate_and_load_xml(metadata, TEST_REPO_02, NULL);
+        g_assert_cmpint(ret, ==, CRE_OK);
+        g_assert_cmpuint(g_hash_table_size(cr_metadata_hashtable(metadata)), ==, 1);
+        pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+        g_assert(pkg);
+        g_assert(pkg->loadingflags & CR_PACKAGE_LOADED_FIL);
+        g_assert(pkg->loadingflags & CR_PACKAGE_LOADED_OTH);
+        g_assert_cmpint(g_slist_length(pkg->files), ==, 2);
+        g_assert_cmpint(g_slist_length(pkg->changelogs), ==, 2);
+        cr_metadata_free(metadata);
+    }
+
+    g_slist_free(pkglist);
+}
+
+static void test_cr_metadata_load_sources(void)
+{
+    guint failed;
+    cr_Package *pkg;
+    cr_Metadata *metadata;
+    struct cr_MetadataLocation *ml = g_new0(struct cr_MetadataLocation, 1);
+    cr_MetadataSource sources[3] = { { 0 } };
+
+    sources[0].repopath = TEST_REPO_01;
+    sources[1].repopath = TEST_REPO_02;
+    // The location without primary.xml cannot be loaded
+    sources[2].ml = ml;
+
+    // The super_kernel of the first repo is kept, as if the repos
+    // were loaded one by one
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 1, NULL);
+    failed = cr_metadata_load_sources(metadata, sources, 3, 2);
+    g_assert_cmpuint(failed, ==, 1);
+    g_assert_cmpint(sources[0].code, ==, CRE_OK);
+    g_assert_no_error(sources[0].err);
+    g_assert_cmpint(sources[1].code, ==, CRE_OK);
+    g_assert_cmpint(sources[2].code, ==, CRE_BADARG);
+    g_assert(sources[2].err);
+    g_clear_error(&sources[2].err);
+    g_assert_cmpuint(g_hash_table_size(cr_metadata_hashtable(metadata)), ==, 2);
+    pkg = g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel");
+    g_assert(pkg);
+    g_assert_cmpstr(pkg->pkgId, ==, REPO_HASH_KEYS_01[0]);
+    g_assert(g_hash_table_lookup(cr_metadata_hashtable(metadata), "fake_bash"));
+    cr_metadata_free(metadata);
+
+    // The different super_kernels are both removed
+    metadata = cr_metadata_new(CR_HT_KEY_NAME, 0, NULL);
+    cr_metadata_set_dupaction(metadata, CR_HT_DUPACT_REMOVEALL);
+    failed = cr_metadata_load_sources(metadata, sources, 2, 2);
+    g_assert_cmpuint(failed, ==, 0);
+    g_assert_cmpuint(g_hash_table_size(cr_metadata_hashtable(metadata)), ==, 1);
+    g_assert(!g_hash_table_lookup(cr_metadata_hashtable(metadata), "super_kernel"));
+    cr_metadata_free(metadata);
+
+    cr_metadatalocation_free(ml);
+}
+
+
 #ifdef WITH_LIBMODULEMD
 static void test_cr_metadata_locate_and_load_modulemd(void)
 {
@@ -188,6 +488,34 @@ static void test_cr_metadata_locate_and_load_modulemd(void)
                       cr_metadata_modulemd(metadata),
                       "testmodule"));
 }
+
+static void test_cr_metadata_load_modulemds(void)
+{
+    int ret;
+    GError *tmp_err = NULL;
+    gchar *paths[] = { TEST_REPO_03_MODULEMD, TEST_REPO_03_MODULEMD,
+                       TEST_REPO_03_MODULEMD, NULL };
+    ModulemdModuleIndex *moduleindexes[3];
+
+    ret = cr_metadata_load_modulemds(moduleindexes, paths, 3, 2, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    for (int x = 0; x < 3; x++) {
+        g_assert_nonnull(modulemd_module_index_get_module(moduleindexes[x],
+                                                          "testmodule"));
+        g_object_unref(moduleindexes[x]);
+    }
+
+    // The first failed file is reported and no index is returned
+    paths[1] = "/nonexistent/modules.yaml";
+    ret = cr_metadata_load_modulemds(moduleindexes, paths, 3, 2, &tmp_err);
+    g_assert(tmp_err);
+    g_assert_cmpint(ret, !=, CRE_OK);
+    g_assert(strstr(tmp_err->message, paths[1]));
+    g_clear_error(&tmp_err);
+    for (int x = 0; x < 3; x++)
+        g_assert_null(moduleindexes[x]);
+}
 #endif /* WITH_LIBMODULEMD */
 
 
@@ -198,9 +526,17 @@ int main(int argc, char *argv[])
     g_test_add_func("/load_metadata/test_cr_metadata_new", test_cr_metadata_new);
     g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml", test_cr_metadata_locate_and_load_xml);
     g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_detailed", test_cr_metadata_locate_and_load_xml_detailed);
+    g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_files_and_changelogs", test_cr_metadata_locate_and_load_xml_files_and_changelogs);
+    g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_lazy", test_cr_metadata_locate_and_load_xml_lazy);
+    g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_raw", test_cr_metadata_locate_and_load_xml_raw);
+    g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_spool", test_cr_metadata_locate_and_load_xml_spool);
+    g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_intern", test_cr_metadata_locate_and_load_xml_intern);
+    g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_xml_pkglist", test_cr_metadata_locate_and_load_xml_pkglist);
+    g_test_add_func("/load_metadata/test_cr_metadata_load_sources", test_cr_metadata_load_sources);
 
 #ifdef WITH_LIBMODULEMD
     g_test_add_func("/load_metadata/test_cr_metadata_locate_and_load_modulemd", test_cr_metadata_locate_and_load_modulemd);
+    g_test_add_func("/load_metadata/test_cr_metadata_load_modulemds", test_cr_metadata_load_modulemds);
 #endif /* WITH_LIBMODULEMD */
 
     return g_test_run();
@@ -238,6 +238,37 @@ static void test_cr_parse_repomd_with_additional_metadata(void)
     g_slist_free_full(ret->additional_metadata, (GDestroyNotify) cr_metadatum_free);
 }
 
+static void test_cr_locate_metadata_list(void)
+{
+    GSList *repopaths = NULL;
+    GSList *locations = NULL;
+    struct cr_MetadataLocation *ml;
+    GError *tmp_err = NULL;
+
+    repopaths = g_slist_append(repopaths, TEST_REPO_01);
+    repopaths = g_slist_append(repopaths, TEST_REPO_00);
+    locations = cr_locate_metadata_list(repopaths, TRUE, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(2, ==, g_slist_length(locations));
+
+    ml = locations->data;
+    g_assert_cmpstr(TEST_REPO_01, ==, ml->original_url);
+    g_assert_cmpstr(TEST_REPO_01_PRIMARY, ==, ml->pri_xml_href);
+    ml = locations->next->data;
+    g_assert_cmpstr(TEST_REPO_00, ==, ml->original_url);
+    g_assert_cmpstr(TEST_REPO_00_PRIMARY, ==, ml->pri_xml_href);
+    g_slist_free_full(locations, (GDestroyNotify) cr_metadatalocation_free);
+
+    // Nothing is returned if a repo is missing
+    repopaths = g_slist_append(repopaths, TEST_PACKAGES_PATH);
+    locations = cr_locate_metadata_list(repopaths, TRUE, &tmp_err);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_IO);
+    g_assert(!locations);
+    g_clear_error(&tmp_err);
+
+    g_slist_free(repopaths);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -249,6 +280,7 @@ int main(int argc, char *argv[])
 
     g_test_add_func("/locate_metadata/test_cr_parse_repomd", test_cr_parse_repomd);
     g_test_add_func("/locate_metadata/test_cr_parse_repomd_with_additional_metadata", test_cr_parse_repomd_with_additional_metadata);
+    g_test_add_func("/locate_metadata/test_cr_locate_metadata_list", test_cr_locate_metadata_list);
 
     return g_test_run();
 }
@@ -0,0 +1,306 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/misc.h"
+#include "createrepo/metrics.h"
+
+#define THREADS     4
+#define CALLS       100
+
+static void
+test_cr_metrics_null(void)
+{
+    GMutex mutex;
+
+    // Disabled measuring only locks the mutex
+    g_mutex_init(&mutex);
+    g_assert_cmpint(cr_metrics_start(NULL), ==, 0);
+    cr_metrics_stop(NULL, CR_METRICS_CHECKSUM, 0, 10);
+    g_assert_cmpint(cr_metrics_mutex_lock(NULL, CR_METRICS_LOCK_RING, &mutex),
+                    ==, 0);
+    g_assert(!g_mutex_trylock(&mutex));
+    cr_metrics_mutex_unlock(NULL, CR_METRICS_LOCK_RING, &mutex, 0);
+    g_assert(g_mutex_trylock(&mutex));
+    g_mutex_unlock(&mutex);
+    g_mutex_clear(&mutex);
+    cr_metrics_set_value(NULL, "packages", 1);
+    cr_metrics_memory_add(NULL, CR_METRICS_MEM_RING, 1);
+    cr_metrics_memory_set(NULL, CR_METRICS_MEM_SQLITE, 1, 2);
+    cr_metrics_free(NULL);
+}
+
+static void
+test_cr_metrics_json(void)
+{
+    cr_Metrics *metrics = cr_metrics_new();
+    gchar *json;
+
+    json = cr_metrics_to_json(metrics);
+    g_assert(strstr(json, "\"wall_time_us\": "));
+    g_assert(strstr(json, "\"phases\": {}"));
+    g_assert(strstr(json, "\"threads\": []"));
+    g_free(json);
+
+    cr_metrics_set_thread_name(metrics, "main");
+    cr_metrics_set_value(metrics, "packages", 42);
+    cr_metrics_stop(metrics, CR_METRICS_CHECKSUM,
+                    cr_metrics_start(metrics), 1000);
+    cr_metrics_stop(metrics, CR_METRICS_CHECKSUM,
+                    cr_metrics_start(metrics), 24);
+
+    json = cr_metrics_to_json(metrics);
+    g_assert(strstr(json, "\"packages\": 42"));
+    g_assert(strstr(json, "\"name\": \"main\""));
+    g_assert(strstr(json, "\"checksum\": {\"count\": 2, "));
+    g_assert(strstr(json, "\"bytes\": 1024, "));
+    g_assert(!strstr(json, "\"walk\""));
+    g_free(json);
+
+    cr_metrics_free(metrics);
+}
+
+static gpointer
+measuring_thread(gpointer data)
+{
+    cr_Metrics *metrics = data;
+    for (int x = 0; x < CALLS; x++)
+        cr_metrics_stop(metrics, CR_METRICS_XML_DUMP,
+                        cr_metrics_start(metrics), 1);
+    return NULL;
+}
+
+static void
+test_cr_metrics_threads(void)
+{
+    cr_Metrics *metrics = cr_metrics_new();
+    GThread *threads[THREADS];
+    gchar *json, *expected;
+
+    for (int x = 0; x < THREADS; x++)
+        threads[x] = g_thread_new("metrics", measuring_thread, metrics);
+    for (int x = 0; x < THREADS; x++)
+        g_thread_join(threads[x]);
+
+    json = cr_metrics_to_json(metrics);
+
+    // The totals
+    expected = g_strdup_printf("\"xml_dump\": {\"count\": %d, ",
+                               THREADS * CALLS);
+    g_assert(strstr(json, expected));
+    g_free(expected);
+
+    // Every thread has its own values
+    expected = g_strdup_printf("{\"id\": %d, ", THREADS - 1);
+    g_assert(strstr(json, expected));
+    g_free(expected);
+    expected = g_strdup_printf("\"xml_dump\": {\"count\": %d, ", CALLS);
+    g_assert(strstr(json, expected));
+    g_free(expected);
+
+    g_free(json);
+    cr_metrics_free(metrics);
+}
+
+static gpointer
+locking_thread(gpointer data)
+{
+    gpointer *args = data;
+    cr_Metrics *metrics = args[0];
+    GMutex *mutex = args[1];
+
+    for (int x = 0; x < CALLS; x++) {
+        gint64 locked = cr_metrics_mutex_lock(metrics,
+                                              CR_METRICS_LOCK_PKG_LIST,
+                                              mutex);
+        g_usleep(10);
+        cr_metrics_mutex_unlock(metrics, CR_METRICS_LOCK_PKG_LIST, mutex,
+                                locked);
+    }
+    return NULL;
+}
+
+static void
+test_cr_metrics_locks(void)
+{
+    cr_Metrics *metrics = cr_metrics_new();
+    GThread *threads[THREADS];
+    GMutex mutex;
+    gpointer args[] = { metrics, &mutex };
+    gchar *json, *expected, *summary;
+
+    g_assert(!cr_metrics_locks_summary(metrics));
+
+    g_mutex_init(&mutex);
+    for (int x = 0; x < THREADS; x++)
+        threads[x] = g_thread_new("metrics", locking_thread, args);
+    for (int x = 0; x < THREADS; x++)
+        g_thread_join(threads[x]);
+    g_mutex_clear(&mutex);
+
+    json = cr_metrics_to_json(metrics);
+    expected = g_strdup_printf("\"pkg_list\": {\"acquisitions\": %d, ",
+                               THREADS * CALLS);
+    g_assert(strstr(json, expected));
+    g_free(expected);
+    expected = g_strdup_printf("\"holds\": %d, ", THREADS * CALLS);
+    g_assert(strstr(json, expected));
+    g_free(expected);
+    g_assert(strstr(json, "\"lock_wait\": {"));
+    g_assert(!strstr(json, "\"ring\""));
+    g_free(json);
+
+    summary = cr_metrics_locks_summary(metrics);
+    g_assert(g_str_has_prefix(summary, "pkg_list: "));
+    g_assert(!strchr(summary, '\n'));
+    g_free(summary);
+
+    cr_metrics_free(metrics);
+}
+
+static void
+test_cr_metrics_write_json(void)
+{
+    cr_Metrics *metrics = cr_metrics_new();
+    GError *tmp_err = NULL;
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    gchar *path, *content;
+
+    g_assert(mkdtemp(tmpdir));
+    path = g_build_filename(tmpdir, "metrics.json", NULL);
+
+    cr_metrics_stop(metrics, CR_METRICS_WALK, cr_metrics_start(metrics), 0);
+    g_assert(cr_metrics_write_json(metrics, path, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert(g_file_get_contents(path, &content, NULL, NULL));
+    g_assert(strstr(content, "\"walk\": {\"count\": 1, "));
+    g_free(content);
+
+    g_assert(!cr_metrics_write_json(metrics, tmpdir, &tmp_err));
+    g_assert(tmp_err);
+    g_clear_error(&tmp_err);
+
+    cr_metrics_free(metrics);
+    cr_remove_dir(tmpdir, NULL);
+    g_free(path);
+    g_free(tmpdir);
+}
+
+static void
+test_cr_metrics_trace(void)
+{
+    cr_Metrics *metrics = cr_metrics_new();
+    gchar *json;
+
+    cr_metrics_enable_trace(metrics);
+    cr_metrics_set_thread_name(metrics, "worker");
+
+    // Only the phases of a task are traced
+    cr_metrics_stop(metrics, CR_METRICS_WALK, cr_metrics_start(metrics), 0);
+    cr_metrics_set_task(metrics, 7, "a\"b.rpm");
+    cr_metrics_stop(metrics, CR_METRICS_CHECKSUM,
+                    cr_metrics_start(metrics), 10);
+    cr_metrics_set_task(metrics, 7, "other.rpm");
+    cr_metrics_stop(metrics, CR_METRICS_XML_DUMP,
+                    cr_metrics_start(metrics), 0);
+    cr_metrics_set_task(metrics, -1, NULL);
+    cr_metrics_stop(metrics, CR_METRICS_XML_DUMP,
+                    cr_metrics_start(metrics), 0);
+
+    json = cr_metrics_trace_to_json(metrics);
+    g_assert(g_str_has_prefix(json, "{\"traceEvents\": ["));
+    g_assert(strstr(json, "\"name\": \"thread_name\", \"ph\": \"M\""));
+    g_assert(strstr(json, "\"args\": {\"name\": \"worker\"}"));
+    g_assert(strstr(json, "{\"name\": \"checksum\", \"ph\": \"X\", "));
+    g_assert(strstr(json, "\"args\": {\"task\": 7, "
+                          "\"package\": \"a\\\"b.rpm\"}"));
+    g_assert(!strstr(json, "\"walk\""));
+    g_assert(!strstr(json, "other.rpm"));
+    // Exactly one XML dump
+    g_assert(strstr(json, "\"xml_dump\""));
+    g_assert(!strstr(strstr(json, "\"xml_dump\"") + 1, "\"xml_dump\""));
+    g_free(json);
+
+    cr_metrics_free(metrics);
+}
+
+static void
+test_cr_metrics_memory(void)
+{
+    cr_Metrics *metrics = cr_metrics_new();
+    gint64 peak_rss;
+    gchar *json, *summary;
+
+    g_assert_cmpint(cr_metrics_rss(&peak_rss), >, 0);
+    g_assert_cmpint(peak_rss, >, 0);
+
+    json = cr_metrics_to_json(metrics);
+    g_assert(strstr(json, "\"memory\": {\"rss_bytes\": "));
+    g_assert(strstr(json, "\"peak_rss_bytes\": "));
+    g_assert(!strstr(json, "\"reorder_buffer\""));
+    g_free(json);
+
+    cr_metrics_memory_add(metrics, CR_METRICS_MEM_RING, 1000);
+    cr_metrics_memory_add(metrics, CR_METRICS_MEM_RING, 24);
+    cr_metrics_memory_add(metrics, CR_METRICS_MEM_RING, -1000);
+    cr_metrics_memory_set(metrics, CR_METRICS_MEM_SQLITE, 10, 2048);
+    cr_metrics_memory_set(metrics, CR_METRICS_MEM_SQLITE, 20, -1);
+
+    json = cr_metrics_to_json(metrics);
+    g_assert(strstr(json, "\"reorder_buffer\": {\"bytes\": 24, "
+                          "\"peak_bytes\": 1024}"));
+    g_assert(strstr(json, "\"sqlite\": {\"bytes\": 20, "
+                          "\"peak_bytes\": 2048}"));
+    g_assert(!strstr(json, "\"old_metadata\""));
+    g_free(json);
+
+    summary = cr_metrics_memory_summary(metrics);
+    g_assert(g_str_has_prefix(summary, "RSS "));
+    g_assert(strstr(summary, ", reorder_buffer 0.0 MiB (peak 0.0 MiB)"));
+    g_free(summary);
+
+    cr_metrics_free(metrics);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/metrics/test_cr_metrics_null",
+                    test_cr_metrics_null);
+    g_test_add_func("/metrics/test_cr_metrics_json",
+                    test_cr_metrics_json);
+    g_test_add_func("/metrics/test_cr_metrics_threads",
+                    test_cr_metrics_threads);
+    g_test_add_func("/metrics/test_cr_metrics_locks",
+                    test_cr_metrics_locks);
+    g_test_add_func("/metrics/test_cr_metrics_write_json",
+                    test_cr_metrics_write_json);
+    g_test_add_func("/metrics/test_cr_metrics_trace",
+                    test_cr_metrics_trace);
+    g_test_add_func("/metrics/test_cr_metrics_memory",
+                    test_cr_metrics_memory);
+
+    return g_test_run();
+}
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "fixtures.h"
 #include "createrepo/checksum.h"
 #include "createrepo/misc.h"
@@ -330,6 +331,38 @@ test_cr_is_primary(void)
     g_assert(!cr_is_primary("/tmp/usr/lib/sendmail"));
 
     g_assert(!cr_is_primary(""));
+    g_assert(cr_is_primary("bin/foo"));
+    g_assert(!cr_is_primary("bin"));
+    g_assert(!cr_is_primary("/usr/lib/sendmail.d"));
+    g_assert(!cr_is_primary("/etc"));
+}
+
+static void
+test_cr_is_primary_file(void)
+{
+    g_assert(cr_is_primary_file("/etc/", "foobar"));
+    g_assert(cr_is_primary_file("/etc/", ""));
+    g_assert(!cr_is_primary_file("/", "etc"));
+    g_assert(!cr_is_primary_file("/tmp/etc/", "foobar"));
+
+    g_assert(cr_is_primary_file("/usr/bin/", "foobar"));
+    g_assert(cr_is_primary_file("/usr/share/man/bin/", "man0p"));
+    g_assert(!cr_is_primary_file("/foo/", "bindir"));
+    g_assert(!cr_is_primary_file("/foo/s", "bin"));
+
+    g_assert(cr_is_primary_file("/usr/lib/", "sendmail"));
+    g_assert(cr_is_primary_file("/usr/", "lib/sendmail"));
+    g_assert(cr_is_primary_file("", "/usr/lib/sendmail"));
+    g_assert(cr_is_primary_file("/usr/lib/sendmail", ""));
+    g_assert(!cr_is_primary_file("/usr/lib/sendmail", "x"));
+    g_assert(!cr_is_primary_file("/usr/lib/", "sendmail.cf"));
+    g_assert(!cr_is_primary_file("/tmp/usr/lib/", "sendmail"));
+
+    // The "bin/" split between the path and the name
+    g_assert(cr_is_primary_file("/usr/b", "in/foo"));
+    g_assert(cr_is_primary_file("/e", "tc/foo"));
+
+    g_assert(!cr_is_primary_file("", ""));
 }
 
 
@@ -357,6 +390,79 @@ test_cr_get_header_byte_range(void)
 }
 
 
+static void
+test_cr_get_header_byte_range_fd(void)
+{
+    int fd;
+    struct cr_HeaderRangeStruct hdr_range;
+    GError *tmp_err = NULL;
+
+    fd = open(PACKAGE_02, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    hdr_range = cr_get_header_byte_range_fd(fd, PACKAGE_02, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(hdr_range.start, ==, PACKAGE_02_HEADER_START);
+    g_assert_cmpuint(hdr_range.end, ==, PACKAGE_02_HEADER_END);
+    g_assert_cmpint(lseek(fd, 0, SEEK_CUR), ==, 0);
+    close(fd);
+
+    // Too short file
+    fd = open(TEST_EMPTY_FILE, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    hdr_range = cr_get_header_byte_range_fd(fd, NULL, &tmp_err);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+    g_assert_cmpuint(hdr_range.start, ==, 0);
+    g_assert_cmpuint(hdr_range.end, ==, 0);
+    close(fd);
+}
+
+static void
+test_cr_get_header_byte_range_data(void)
+{
+    struct cr_HeaderRangeStruct hdr_range;
+    GError *tmp_err = NULL;
+    gchar *content;
+    gsize len, needed, steps = 0;
+
+    g_assert(g_file_get_contents(PACKAGE_02, &content, &len, NULL));
+
+    // The data are extended to the needed length until the range is known
+    gsize readed = 0;
+    do {
+        hdr_range = cr_get_header_byte_range_data(content, readed, &needed,
+                                                  &tmp_err);
+        g_assert(!tmp_err);
+        g_assert_cmpuint(needed, <=, len);
+        if (needed) {
+            g_assert_cmpuint(needed, >, readed);
+            readed = needed;
+        }
+        steps++;
+    } while (needed);
+    g_assert_cmpuint(steps, ==, 4);
+    g_assert_cmpuint(readed, ==, PACKAGE_02_HEADER_END);
+    g_assert_cmpuint(hdr_range.start, ==, PACKAGE_02_HEADER_START);
+    g_assert_cmpuint(hdr_range.end, ==, PACKAGE_02_HEADER_END);
+
+    // More data than needed
+    hdr_range = cr_get_header_byte_range_data(content, len, &needed, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(needed, ==, 0);
+    g_assert_cmpuint(hdr_range.end, ==, PACKAGE_02_HEADER_END);
+
+    // Not a package
+    content[0] = 'x';
+    hdr_range = cr_get_header_byte_range_data(content, len, &needed, &tmp_err);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_assert_cmpuint(hdr_range.start, ==, 0);
+    g_assert_cmpuint(hdr_range.end, ==, 0);
+
+    g_free(content);
+}
+
 static void
 test_cr_get_filename(void)
 {
@@ -741,6 +847,41 @@ test_cr_better_copy_file_local(Copyfiletest *copyfiletest,
 }
 
 
+static void
+test_cr_link_or_copy_file(Copyfiletest *copyfiletest,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    gboolean ret;
+    char *checksum;
+    char *tmp_link;
+    GError *tmp_err = NULL;
+
+    // An existing destination is replaced
+    ret = cr_copy_file(TEST_TEXT_FILE, copyfiletest->dst_file, NULL);
+    g_assert(ret);
+    ret = cr_link_or_copy_file(TEST_BINARY_FILE, copyfiletest->dst_file, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert(ret);
+    g_assert(g_file_test(copyfiletest->dst_file, G_FILE_TEST_IS_REGULAR));
+    checksum = cr_checksum_file(copyfiletest->dst_file, CR_CHECKSUM_SHA256, NULL);
+    g_assert_cmpstr(checksum, ==, "bf68e32ad78cea8287be0f35b74fa3fecd0eaa91770b48f1a7282b015d6d883e");
+    g_free(checksum);
+
+    // The destination already is a link to the source
+    ret = cr_link_or_copy_file(TEST_BINARY_FILE, copyfiletest->dst_file, &tmp_err);
+    g_assert(!tmp_err);
+    g_assert(ret);
+    tmp_link = g_strdup_printf("%s.link.%d", copyfiletest->dst_file, (int) getpid());
+    g_assert(!g_file_test(tmp_link, G_FILE_TEST_EXISTS));
+    g_free(tmp_link);
+
+    ret = cr_link_or_copy_file(NON_EXIST_FILE, copyfiletest->dst_file, &tmp_err);
+    g_assert(!ret);
+    g_assert(tmp_err);
+    g_error_free(tmp_err);
+}
+
+
 static void
 test_cr_remove_dir(void)
 {
@@ -1087,6 +1228,60 @@ test_cr_split_rpm_filename(void)
 }
 
 
+static void
+test_cr_split_rpm_filename_view(void)
+{
+    const char *filename = "Packages/foo-2:1.0-3.x86_64.rpm";
+    cr_NEVRAView view;
+
+    g_assert(!cr_split_rpm_filename_view(NULL, &view));
+
+    g_assert(cr_split_rpm_filename_view(filename, &view));
+    g_assert(view.name == filename + 9);
+    g_assert_cmpuint(view.name_len, ==, 3);
+    g_assert(view.epoch == filename + 13);
+    g_assert_cmpuint(view.epoch_len, ==, 1);
+    g_assert_cmpuint(view.version_len, ==, 3);
+    g_assert_cmpuint(view.release_len, ==, 1);
+    g_assert(!strncmp(view.arch, "x86_64", view.arch_len));
+    g_assert_cmpuint(view.arch_len, ==, 6);
+
+    g_assert(cr_str_to_nevra_view("foo", &view));
+    g_assert_cmpuint(view.name_len, ==, 3);
+    g_assert(!view.epoch);
+    g_assert(!view.version);
+    g_assert(!view.release);
+    g_assert(!view.arch);
+}
+
+
+static void
+test_cr_split_rpm_filenames(void)
+{
+    const char *filenames[] = { "foo-1.0-1.i386.rpm",
+                                NULL,
+                                "bar-9-123a.ia64.rpm:3" };
+    cr_NEVRA *res = cr_split_rpm_filenames(filenames, 3);
+
+    g_assert(res);
+    g_assert_cmpstr(res[0].name, ==, "foo");
+    g_assert_cmpstr(res[0].version, ==, "1.0");
+    g_assert_cmpstr(res[0].release, ==, "1");
+    g_assert(!res[0].epoch);
+    g_assert_cmpstr(res[0].arch, ==, "i386");
+
+    g_assert(!res[1].name);
+    g_assert(!res[1].arch);
+
+    g_assert_cmpstr(res[2].name, ==, "bar");
+    g_assert_cmpstr(res[2].version, ==, "9");
+    g_assert_cmpstr(res[2].release, ==, "123a");
+    g_assert_cmpstr(res[2].epoch, ==, "3");
+    g_assert_cmpstr(res[2].arch, ==, "ia64");
+    g_free(res);
+}
+
+
 static void
 test_cr_str_to_nevr(void)
 {
@@ -1248,6 +1443,53 @@ test_cr_cmp_evr(void)
 }
 
 
+static void
+test_cr_cmp_evr_str(void)
+{
+    g_assert_cmpint(cr_cmp_evr_str("2-1", "0:2-1"), ==, 0);
+    g_assert_cmpint(cr_cmp_evr_str("2-2", "0:2-1"), ==, 1);
+    g_assert_cmpint(cr_cmp_evr_str("0:2-2", "1:2-1"), ==, -1);
+    g_assert_cmpint(cr_cmp_evr_str("10:1", "9:1"), ==, 1);
+    g_assert_cmpint(cr_cmp_evr_str("1.010-1", "1.9-1"), ==, 1);
+    g_assert_cmpint(cr_cmp_evr_str("1.0a", "1.0"), ==, 1);
+    g_assert_cmpint(cr_cmp_evr_str("1.0a", "1.0.1"), ==, -1);
+    g_assert_cmpint(cr_cmp_evr_str("1.0-1", "1.0"), ==, 1);
+    g_assert_cmpint(cr_cmp_evr_str("1.0~rc1", "1.0"), ==, -1);
+    g_assert_cmpint(cr_cmp_evr_str(NULL, ""), ==, 0);
+    g_assert_cmpint(cr_cmp_evr_str("1", NULL), ==, 1);
+}
+
+
+static void
+test_cr_str_to_evr_view(void)
+{
+    const char *string = "12:5.0.0-11";
+    cr_EVRView view;
+
+    cr_str_to_evr_view(string, &view);
+    g_assert(view.epoch == string);
+    g_assert_cmpuint(view.epoch_len, ==, 2);
+    g_assert(view.version == string + 3);
+    g_assert_cmpuint(view.version_len, ==, 5);
+    g_assert(view.release == string + 9);
+    g_assert_cmpuint(view.release_len, ==, 2);
+
+    cr_str_to_evr_view("6.1-", &view);
+    g_assert_cmpstr(view.epoch, ==, "0");
+    g_assert_cmpuint(view.version_len, ==, 3);
+    g_assert(!view.release);
+
+    cr_str_to_evr_view("foo:bar", &view);
+    g_assert(!view.epoch);
+    g_assert_cmpstr(view.version, ==, "bar");
+
+    cr_str_to_evr_view("", &view);
+    g_assert(!view.epoch);
+    g_assert(!view.version);
+    g_assert(!view.release);
+}
+
+
 static void
 test_cr_cut_dirs(void)
 {
@@ -1299,6 +1541,132 @@ test_cr_cut_dirs(void)
     g_assert_cmpstr(res, ==, "foo.rpm");
 }
 
+#define LOG_ASYNC_THREADS   4
+#define LOG_ASYNC_MESSAGES  2000
+
+static gpointer
+log_async_worker(gpointer data)
+{
+    gint id = GPOINTER_TO_INT(data);
+
+    for (gint x = 0; x < LOG_ASYNC_MESSAGES; x++) {
+        gchar *msg = g_strdup_printf("%d %d", id, x);
+        cr_log_async_fn(NULL, G_LOG_LEVEL_INFO, msg, NULL);
+        g_free(msg);
+    }
+    // Hidden
+    cr_log_async_fn(NULL, G_LOG_LEVEL_DEBUG, "hidden",
+                    GINT_TO_POINTER(G_LOG_LEVEL_DEBUG));
+    return NULL;
+}
+
+static void
+test_cr_log_async(void)
+{
+    GThread *threads[LOG_ASYNC_THREADS];
+    gint next[LOG_ASYNC_THREADS] = { 0 };
+    gchar *tmpfile = g_strdup(TMPDIR_TEMPLATE);
+    gchar *content, **lines;
+    gint fd, out;
+
+    // The messages are written to the stdout
+    fd = g_mkstemp(tmpfile);
+    g_assert_cmpint(fd, >=, 0);
+    fflush(stdout);
+    out = dup(STDOUT_FILENO);
+    g_assert_cmpint(dup2(fd, STDOUT_FILENO), ==, STDOUT_FILENO);
+
+    cr_log_async_start();
+    for (gint x = 0; x < LOG_ASYNC_THREADS; x++)
+        threads[x] = g_thread_new(NULL, log_async_worker, GINT_TO_POINTER(x));
+    for (gint x = 0; x < LOG_ASYNC_THREADS; x++)
+        g_thread_join(threads[x]);
+    cr_log_async_flush();
+    cr_log_async_fn(NULL, G_LOG_LEVEL_INFO, "flushed", NULL);
+    cr_log_async_stop();
+
+    // Without the background thread the messages are written directly
+    cr_log_async_fn(NULL, G_LOG_LEVEL_INFO, "stopped", NULL);
+
+    fflush(stdout);
+    g_assert_cmpint(dup2(out, STDOUT_FILENO), ==, STDOUT_FILENO);
+    close(out);
+    close(fd);
+
+    g_assert(g_file_get_contents(tmpfile, &content, NULL, NULL));
+    lines = g_strsplit(content, "\n", -1);
+    g_assert_cmpuint(g_strv_length(lines),
+                     ==, LOG_ASYNC_THREADS * LOG_ASYNC_MESSAGES + 3);
+
+    // Every message once, the messages of every thread in their order
+    for (gint x = 0; x < LOG_ASYNC_THREADS * LOG_ASYNC_MESSAGES; x++) {
+        gint id, n;
+        g_assert_cmpint(sscanf(lines[x], "%d %d", &id, &n), ==, 2);
+        g_assert_cmpint(id, >=, 0);
+        g_assert_cmpint(id, <, LOG_ASYNC_THREADS);
+        g_assert_cmpint(n, ==, next[id]);
+        next[id]++;
+    }
+    g_assert_cmpstr(lines[LOG_ASYNC_THREADS * LOG_ASYNC_MESSAGES],
+                    ==, "flushed");
+    g_assert_cmpstr(lines[LOG_ASYNC_THREADS * LOG_ASYNC_MESSAGES + 1],
+                    ==, "stopped");
+    g_assert_cmpstr(lines[LOG_ASYNC_THREADS * LOG_ASYNC_MESSAGES + 2], ==, "");
+
+    g_strfreev(lines);
+    g_free(content);
+    g_remove(tmpfile);
+    g_free(tmpfile);
+}
+
+static void
+test_cr_log_thread_hidden_levels(void)
+{
+    gchar *tmpfile = g_strdup(TMPDIR_TEMPLATE);
+    gchar *content;
+    gint fd, out;
+
+    fd = g_mkstemp(tmpfile);
+    g_assert_cmpint(fd, >=, 0);
+    fflush(stdout);
+    out = dup(STDOUT_FILENO);
+    g_assert_cmpint(dup2(fd, STDOUT_FILENO), ==, STDOUT_FILENO);
+
+    // The levels of the thread override the levels of the handler
+    g_assert_cmpint(cr_log_get_thread_hidden_levels(), ==, -1);
+    cr_log_push_thread_hidden_levels(G_LOG_LEVEL_INFO);
+    cr_log_push_thread_hidden_levels(0);
+    g_assert_cmpint(cr_log_get_thread_hidden_levels(), ==, 0);
+    cr_log_fn(NULL, G_LOG_LEVEL_INFO, "shown",
+              GINT_TO_POINTER(G_LOG_LEVEL_INFO));
+    cr_log_pop_thread_hidden_levels();
+    g_assert_cmpint(cr_log_get_thread_hidden_levels(), ==, G_LOG_LEVEL_INFO);
+    cr_log_fn(NULL, G_LOG_LEVEL_INFO, "hidden", NULL);
+
+    // The background thread runs until its last user stops it
+    cr_log_async_start();
+    cr_log_async_start();
+    cr_log_async_stop();
+    cr_log_async_fn(NULL, G_LOG_LEVEL_INFO, "hidden", NULL);
+    cr_log_async_fn(NULL, G_LOG_LEVEL_MESSAGE, "queued", NULL);
+    cr_log_async_stop();
+
+    cr_log_pop_thread_hidden_levels();
+    g_assert_cmpint(cr_log_get_thread_hidden_levels(), ==, -1);
+
+    fflush(stdout);
+    g_assert_cmpint(dup2(out, STDOUT_FILENO), ==, STDOUT_FILENO);
+    close(out);
+    close(fd);
+
+    g_assert(g_file_get_contents(tmpfile, &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "shown\nqueued\n");
+
+    g_free(content);
+    g_remove(tmpfile);
+    g_free(tmpfile);
+}
+
 
 int
 main(int argc, char *argv[])
@@ -1309,10 +1677,18 @@ main(int argc, char *argv[])
             test_cr_str_to_evr);
     g_test_add_func("/misc/test_cr_str_to_evr_with_chunk",
             test_cr_str_to_evr_with_chunk);
+    g_test_add_func("/misc/test_cr_str_to_evr_view",
+            test_cr_str_to_evr_view);
     g_test_add_func("/misc/test_cr_is_primary",
             test_cr_is_primary);
+    g_test_add_func("/misc/test_cr_is_primary_file",
+            test_cr_is_primary_file);
     g_test_add_func("/misc/test_cr_get_header_byte_range",
             test_cr_get_header_byte_range);
+    g_test_add_func("/misc/test_cr_get_header_byte_range_fd",
+            test_cr_get_header_byte_range_fd);
+    g_test_add_func("/misc/test_cr_get_header_byte_range_data",
+            test_cr_get_header_byte_range_data);
     g_test_add_func("/misc/test_cr_get_filename",
             test_cr_get_filename);
     g_test_add("/misc/copyfiletest_test_empty_file",
@@ -1354,6 +1730,9 @@ main(int argc, char *argv[])
     g_test_add("/misc/test_cr_better_copy_file_local",
             Copyfiletest, NULL, copyfiletest_setup,
             test_cr_better_copy_file_local, copyfiletest_teardown);
+    g_test_add("/misc/test_cr_link_or_copy_file",
+            Copyfiletest, NULL, copyfiletest_setup,
+            test_cr_link_or_copy_file, copyfiletest_teardown);
     g_test_add_func("/misc/test_cr_normalize_dir_path",
             test_cr_normalize_dir_path);
     g_test_add_func("/misc/test_cr_remove_dir",
@@ -1364,14 +1743,24 @@ main(int argc, char *argv[])
             test_cr_cmp_version_str);
     g_test_add_func("/misc/test_cr_split_rpm_filename",
             test_cr_split_rpm_filename);
+    g_test_add_func("/misc/test_cr_split_rpm_filename_view",
+            test_cr_split_rpm_filename_view);
+    g_test_add_func("/misc/test_cr_split_rpm_filenames",
+            test_cr_split_rpm_filenames);
     g_test_add_func("/misc/test_cr_str_to_nevr",
             test_cr_str_to_nevr);
     g_test_add_func("/misc/test_cr_str_to_nevra",
             test_cr_str_to_nevra);
     g_test_add_func("/misc/test_cr_cmp_evr",
             test_cr_cmp_evr);
+    g_test_add_func("/misc/test_cr_cmp_evr_str",
+            test_cr_cmp_evr_str);
     g_test_add_func("/misc/test_cr_cut_dirs",
             test_cr_cut_dirs);
+    g_test_add_func("/misc/test_cr_log_async",
+            test_cr_log_async);
+    g_test_add_func("/misc/test_cr_log_thread_hidden_levels",
+            test_cr_log_thread_hidden_levels);
 
     return g_test_run();
 }
@@ -22,6 +22,8 @@
 #include "fixtures.h"
 #include "createrepo/misc.h"
 #include "createrepo/modifyrepo_shared.h"
+#include "createrepo/repomd.h"
+#include "createrepo/xml_parser.h"
 
 static void 
 copy_repo_TEST_REPO_00(const gchar *target_path, const gchar *tmp){
@@ -128,6 +130,60 @@ test_cr_write_file_with_gz_file(void)
     g_free(out);
 }
 
+static void
+test_cr_modifyrepo_batch(void)
+{
+    char *tmp_dir;
+    tmp_dir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(tmp_dir));
+
+    gchar *repopath = g_strconcat(tmp_dir, "/", TEST_REPO_00, "repodata", NULL);
+    copy_repo_TEST_REPO_00(repopath, tmp_dir);
+
+    const gchar *paths[] = { TEST_TEXT_FILE, TEST_TEXT_FILE_XZ, TEST_SQLITE_FILE };
+    const gchar *types[] = { "foo", "bar", "baz" };
+    const gchar *files[] = { "text_file.gz", "bar_file.gz", "sqlite_file.sqlite" };
+    GSList *tasks = NULL;
+
+    for (int x = 0; x < 3; x++) {
+        cr_ModifyRepoTask *task = cr_modifyrepotask_new();
+        task->path = (gchar *) paths[x];
+        task->type = (gchar *) types[x];
+        task->compress = (x != 2);
+        task->compress_type = CR_CW_GZ_COMPRESSION;
+        if (x == 1)
+            task->new_name = "bar_file";
+        tasks = g_slist_append(tasks, task);
+    }
+
+    GError *err = NULL;
+    g_assert(cr_modifyrepo(tasks, repopath, &err));
+    g_assert_no_error(err);
+
+    // All the files are added and the repomd.xml lists them
+    gchar *repomd_path = g_build_filename(repopath, "repomd.xml", NULL);
+    cr_Repomd *repomd = cr_repomd_new();
+    cr_xml_parse_repomd(repomd_path, repomd, NULL, NULL, &err);
+    g_assert_no_error(err);
+
+    for (int x = 0; x < 3; x++) {
+        gchar *dst = g_build_filename(repopath, files[x], NULL);
+        g_assert(g_file_test(dst, G_FILE_TEST_IS_REGULAR));
+        cr_RepomdRecord *rec = cr_repomd_get_record(repomd, types[x]);
+        g_assert(rec);
+        g_assert(rec->checksum);
+        g_assert(g_str_has_suffix(rec->location_href, files[x]));
+        g_free(dst);
+    }
+    g_assert(cr_repomd_get_record(repomd, "primary"));
+
+    cr_repomd_free(repomd);
+    g_free(repomd_path);
+    g_slist_free_full(tasks, (GDestroyNotify) cr_modifyrepotask_free);
+    g_free(repopath);
+    g_free(tmp_dir);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -137,6 +193,7 @@ int main(int argc, char *argv[])
 
     g_test_add_func("/modifyrepo_shared/test_cr_write_file", test_cr_write_file);
     g_test_add_func("/modifyrepo_shared/test_cr_write_file_with_gz_file", test_cr_write_file_with_gz_file);
+    g_test_add_func("/modifyrepo_shared/test_cr_modifyrepo_batch", test_cr_modifyrepo_batch);
 
     return g_test_run();
 }
@@ -0,0 +1,281 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "fixtures.h"
+#include "createrepo/misc.h"
+#include "createrepo/pkgcache.h"
+
+#define FINGERPRINT     "sha256 10"
+
+typedef struct {
+    gchar *tmpdir;
+    gchar *path;
+} TestData;
+
+static void
+testdata_setup(TestData *testdata,
+               G_GNUC_UNUSED gconstpointer test_data)
+{
+    testdata->tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(testdata->tmpdir));
+    testdata->path = g_build_filename(testdata->tmpdir, "pkgcache", NULL);
+}
+
+static void
+testdata_teardown(TestData *testdata,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_remove_dir(testdata->tmpdir, NULL);
+    g_free(testdata->tmpdir);
+    g_free(testdata->path);
+}
+
+static void
+fill_entry(cr_PkgCacheEntry *entry, guint64 ino)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->key.dev          = 2049;
+    entry->key.ino          = ino;
+    entry->key.size         = 1024;
+    entry->key.mtime        = 1357924680;
+    entry->location_href    = "packages/foo.rpm";
+    entry->location_base    = NULL;
+    entry->rpm_sourcerpm    = "foo-1.0-1.src.rpm";
+    entry->primary          = "<package type=\"rpm\"/>\n";
+    entry->filelists        = "<package/>\n";
+    entry->other            = "<package/>\n";
+}
+
+static void
+test_cr_pkgcache_missing_file(TestData *testdata,
+                              G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCacheEntry entry;
+
+    cr_PkgCache *cache = cr_pkgcache_open(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgcache_size(cache), ==, 0);
+
+    fill_entry(&entry, 1);
+    g_assert(!cr_pkgcache_lookup(cache, &entry.key));
+    cr_pkgcache_free(cache);
+}
+
+static void
+test_cr_pkgcache_write_and_load(TestData *testdata,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCacheEntry entry;
+    const cr_PkgCacheEntry *found;
+
+    cr_PkgCacheWriter *writer = cr_pkgcache_writer_new(testdata->path,
+                                                       FINGERPRINT,
+                                                       &tmp_err);
+    g_assert(writer);
+    g_assert(!tmp_err);
+
+    fill_entry(&entry, 1);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    fill_entry(&entry, 2);
+    entry.location_href = "packages/bar.rpm";
+    entry.location_base = "http://foo/";
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    g_assert(!tmp_err);
+
+    // Nothing is visible until the writer is closed
+    g_assert(!g_file_test(testdata->path, G_FILE_TEST_EXISTS));
+    g_assert(cr_pkgcache_writer_close(writer, TRUE, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert(g_file_test(testdata->path, G_FILE_TEST_IS_REGULAR));
+
+    cr_PkgCache *cache = cr_pkgcache_open(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgcache_size(cache), ==, 2);
+
+    fill_entry(&entry, 1);
+    found = cr_pkgcache_lookup(cache, &entry.key);
+    g_assert(found);
+    g_assert_cmpstr(found->location_href, ==, "packages/foo.rpm");
+    g_assert_cmpstr(found->location_base, ==, NULL);
+    g_assert_cmpstr(found->rpm_sourcerpm, ==, "foo-1.0-1.src.rpm");
+    g_assert_cmpstr(found->primary, ==, entry.primary);
+    g_assert_cmpstr(found->filelists, ==, entry.filelists);
+    g_assert_cmpstr(found->other, ==, entry.other);
+
+    fill_entry(&entry, 2);
+    found = cr_pkgcache_lookup(cache, &entry.key);
+    g_assert(found);
+    g_assert_cmpstr(found->location_href, ==, "packages/bar.rpm");
+    g_assert_cmpstr(found->location_base, ==, "http://foo/");
+
+    // Changed mtime means changed package
+    fill_entry(&entry, 1);
+    entry.key.mtime++;
+    g_assert(!cr_pkgcache_lookup(cache, &entry.key));
+
+    cr_pkgcache_free(cache);
+
+    // Different options -> the cache is ignored
+    cache = cr_pkgcache_open(testdata->path, "sha1 10", &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgcache_size(cache), ==, 0);
+    cr_pkgcache_free(cache);
+}
+
+static void
+test_cr_pkgcache_truncated(TestData *testdata,
+                           G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCacheEntry entry;
+    gchar *content;
+    gsize length;
+
+    cr_PkgCacheWriter *writer = cr_pkgcache_writer_new(testdata->path,
+                                                       FINGERPRINT,
+                                                       &tmp_err);
+    g_assert(writer);
+    fill_entry(&entry, 1);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    fill_entry(&entry, 2);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    g_assert(cr_pkgcache_writer_close(writer, TRUE, &tmp_err));
+
+    // Cut the last record
+    g_assert(g_file_get_contents(testdata->path, &content, &length, NULL));
+    g_assert(g_file_set_contents(testdata->path, content, length - 5, NULL));
+    g_free(content);
+
+    cr_PkgCache *cache = cr_pkgcache_open(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(cache);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgcache_size(cache), ==, 1);
+    fill_entry(&entry, 1);
+    g_assert(cr_pkgcache_lookup(cache, &entry.key));
+    cr_pkgcache_free(cache);
+}
+
+static void
+test_cr_pkgcache_writer_abort(TestData *testdata,
+                              G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCacheEntry entry;
+
+    cr_PkgCacheWriter *writer = cr_pkgcache_writer_new(testdata->path,
+                                                       FINGERPRINT,
+                                                       &tmp_err);
+    g_assert(writer);
+    fill_entry(&entry, 1);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    g_assert(cr_pkgcache_writer_close(writer, FALSE, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert(!g_file_test(testdata->path, G_FILE_TEST_EXISTS));
+}
+
+static void
+test_cr_pkgcache_shared(TestData *testdata,
+                        G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgCacheEntry entry;
+    const cr_PkgCacheEntry *found;
+
+    cr_PkgCacheWriter *writer = cr_pkgcache_writer_new(testdata->path,
+                                                       FINGERPRINT,
+                                                       &tmp_err);
+    g_assert(writer);
+    fill_entry(&entry, 1);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    fill_entry(&entry, 2);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    g_assert(cr_pkgcache_writer_close(writer, TRUE, &tmp_err));
+
+    // Another repo with the second package and a new one
+    writer = cr_pkgcache_writer_new(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(writer);
+    cr_pkgcache_writer_set_shared(writer);
+    fill_entry(&entry, 2);
+    entry.location_href = "other/foo.rpm";
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    fill_entry(&entry, 3);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    g_assert(cr_pkgcache_writer_close(writer, TRUE, &tmp_err));
+    g_assert(!tmp_err);
+
+    cr_PkgCache *cache = cr_pkgcache_open(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(cache);
+    g_assert_cmpuint(cr_pkgcache_size(cache), ==, 3);
+    fill_entry(&entry, 1);
+    found = cr_pkgcache_lookup(cache, &entry.key);
+    g_assert(found);
+    g_assert_cmpstr(found->location_href, ==, "packages/foo.rpm");
+    fill_entry(&entry, 2);
+    found = cr_pkgcache_lookup(cache, &entry.key);
+    g_assert(found);
+    g_assert_cmpstr(found->location_href, ==, "other/foo.rpm");
+    cr_pkgcache_free(cache);
+
+    // Not shared cache keeps only its own packages
+    writer = cr_pkgcache_writer_new(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(writer);
+    fill_entry(&entry, 3);
+    g_assert(cr_pkgcache_writer_add(writer, &entry, &tmp_err));
+    g_assert(cr_pkgcache_writer_close(writer, TRUE, &tmp_err));
+
+    cache = cr_pkgcache_open(testdata->path, FINGERPRINT, &tmp_err);
+    g_assert(cache);
+    g_assert_cmpuint(cr_pkgcache_size(cache), ==, 1);
+    cr_pkgcache_free(cache);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/pkgcache/test_cr_pkgcache_missing_file",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgcache_missing_file, testdata_teardown);
+    g_test_add("/pkgcache/test_cr_pkgcache_write_and_load",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgcache_write_and_load, testdata_teardown);
+    g_test_add("/pkgcache/test_cr_pkgcache_truncated",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgcache_truncated, testdata_teardown);
+    g_test_add("/pkgcache/test_cr_pkgcache_writer_abort",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgcache_writer_abort, testdata_teardown);
+    g_test_add("/pkgcache/test_cr_pkgcache_shared",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgcache_shared, testdata_teardown);
+
+    return g_test_run();
+}
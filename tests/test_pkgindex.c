@@ -0,0 +1,237 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/pkgindex.h"
+
+typedef struct {
+    gchar *tmpdir;
+    gchar *path;
+} TestData;
+
+static void
+testdata_setup(TestData *testdata,
+               G_GNUC_UNUSED gconstpointer test_data)
+{
+    testdata->tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(testdata->tmpdir));
+    testdata->path = g_build_filename(testdata->tmpdir, "pkgindex", NULL);
+}
+
+static void
+testdata_teardown(TestData *testdata,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_remove_dir(testdata->tmpdir, NULL);
+    g_free(testdata->tmpdir);
+    g_free(testdata->path);
+}
+
+static cr_Dependency *
+new_dep(cr_Package *pkg, const char *name, const char *flags,
+        const char *version)
+{
+    cr_Dependency *dep = cr_dependency_new();
+    dep->name    = cr_safe_string_chunk_insert(pkg->chunk, name);
+    dep->flags   = cr_safe_string_chunk_insert(pkg->chunk, flags);
+    dep->epoch   = cr_safe_string_chunk_insert(pkg->chunk, version ? "0" : NULL);
+    dep->version = cr_safe_string_chunk_insert(pkg->chunk, version);
+    return dep;
+}
+
+static cr_Package *
+new_pkg(const char *name, const char *version, const char *arch)
+{
+    cr_Package *pkg = cr_package_new();
+    gchar *href = g_strconcat("Packages/", name, "-", version, ".", arch,
+                              ".rpm", NULL);
+
+    pkg->name          = cr_safe_string_chunk_insert(pkg->chunk, name);
+    pkg->epoch         = cr_safe_string_chunk_insert(pkg->chunk, "0");
+    pkg->version       = cr_safe_string_chunk_insert(pkg->chunk, version);
+    pkg->release       = cr_safe_string_chunk_insert(pkg->chunk, "1");
+    pkg->arch          = cr_safe_string_chunk_insert(pkg->chunk, arch);
+    pkg->location_href = cr_safe_string_chunk_insert(pkg->chunk, href);
+    pkg->checksum_type = cr_safe_string_chunk_insert(pkg->chunk, "sha256");
+    pkg->pkgId         = cr_safe_string_chunk_insert(pkg->chunk, href);
+    pkg->provides = g_slist_append(pkg->provides,
+                                   new_dep(pkg, name, "EQ", version));
+    pkg->requires = g_slist_append(pkg->requires,
+                                   new_dep(pkg, "libc.so.6", NULL, NULL));
+    g_free(href);
+    return pkg;
+}
+
+static void
+write_index(const char *path)
+{
+    const char *pkgs[][3] = { { "zsh", "5.9", "x86_64" },
+                              { "bash", "5.2", "x86_64" },
+                              { "bash", "5.2", "i686" },
+                              { "coreutils", "9.4", "x86_64" } };
+    GError *tmp_err = NULL;
+    cr_PkgIndexWriter *writer = cr_pkgindex_writer_new();
+
+    for (size_t x = 0; x < G_N_ELEMENTS(pkgs); x++) {
+        cr_Package *pkg = new_pkg(pkgs[x][0], pkgs[x][1], pkgs[x][2]);
+        g_assert(cr_pkgindex_writer_add(writer, pkg, &tmp_err));
+        g_assert(!tmp_err);
+        cr_package_free(pkg);
+    }
+
+    g_assert_cmpuint(cr_pkgindex_writer_size(writer), ==, 4);
+    g_assert(cr_pkgindex_writer_write(writer, path, &tmp_err));
+    g_assert(!tmp_err);
+    cr_pkgindex_writer_free(writer);
+}
+
+static void
+test_cr_pkgindex_write_and_load(TestData *testdata,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgIndexEntry entry;
+    cr_PkgIndexDep dep;
+    cr_PkgIndex *index;
+
+    write_index(testdata->path);
+
+    index = cr_pkgindex_open(testdata->path, &tmp_err);
+    g_assert(index);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgindex_size(index), ==, 4);
+
+    // Sorted by name, the same names in the order of addition
+    g_assert(cr_pkgindex_get(index, 0, &entry));
+    g_assert_cmpstr(entry.name, ==, "bash");
+    g_assert_cmpstr(entry.arch, ==, "x86_64");
+    g_assert(cr_pkgindex_get(index, 1, &entry));
+    g_assert_cmpstr(entry.name, ==, "bash");
+    g_assert_cmpstr(entry.arch, ==, "i686");
+    g_assert(cr_pkgindex_get(index, 3, &entry));
+    g_assert_cmpstr(entry.name, ==, "zsh");
+    g_assert(!cr_pkgindex_get(index, 4, &entry));
+
+    g_assert_cmpint(cr_pkgindex_find(index, "bash"), ==, 0);
+    g_assert_cmpint(cr_pkgindex_find(index, "zsh"), ==, 3);
+    g_assert_cmpint(cr_pkgindex_find(index, "coreutils"), ==, 2);
+    g_assert_cmpint(cr_pkgindex_find(index, "aaa"), ==, -1);
+    g_assert_cmpint(cr_pkgindex_find(index, "dash"), ==, -1);
+    g_assert_cmpint(cr_pkgindex_find(index, "zzz"), ==, -1);
+
+    g_assert(cr_pkgindex_get(index, 2, &entry));
+    g_assert_cmpstr(entry.epoch, ==, "0");
+    g_assert_cmpstr(entry.version, ==, "9.4");
+    g_assert_cmpstr(entry.release, ==, "1");
+    g_assert_cmpstr(entry.location_href, ==,
+                    "Packages/coreutils-9.4.x86_64.rpm");
+    g_assert_cmpstr(entry.location_base, ==, NULL);
+    g_assert_cmpstr(entry.checksum_type, ==, "sha256");
+    g_assert_cmpstr(entry.pkgId, ==, entry.location_href);
+
+    g_assert_cmpuint(entry.provides_count, ==, 1);
+    g_assert(cr_pkgindex_get_provide(index, &entry, 0, &dep));
+    g_assert_cmpstr(dep.name, ==, "coreutils");
+    g_assert_cmpstr(dep.flags, ==, "EQ");
+    g_assert_cmpstr(dep.version, ==, "9.4");
+    g_assert(!dep.pre);
+    g_assert(!cr_pkgindex_get_provide(index, &entry, 1, &dep));
+
+    g_assert_cmpuint(entry.requires_count, ==, 1);
+    g_assert(cr_pkgindex_get_require(index, &entry, 0, &dep));
+    g_assert_cmpstr(dep.name, ==, "libc.so.6");
+    g_assert_cmpstr(dep.flags, ==, NULL);
+    g_assert_cmpstr(dep.version, ==, NULL);
+
+    cr_pkgindex_free(index);
+}
+
+static void
+test_cr_pkgindex_empty(TestData *testdata,
+                       G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    cr_PkgIndexWriter *writer = cr_pkgindex_writer_new();
+    cr_PkgIndex *index;
+
+    g_assert(cr_pkgindex_writer_write(writer, testdata->path, &tmp_err));
+    cr_pkgindex_writer_free(writer);
+
+    index = cr_pkgindex_open(testdata->path, &tmp_err);
+    g_assert(index);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_pkgindex_size(index), ==, 0);
+    g_assert_cmpint(cr_pkgindex_find(index, "bash"), ==, -1);
+    cr_pkgindex_free(index);
+}
+
+static void
+test_cr_pkgindex_corrupted(TestData *testdata,
+                           G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    gchar *content;
+    gsize length;
+
+    g_assert(!cr_pkgindex_open(testdata->path, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_IO);
+    g_clear_error(&tmp_err);
+
+    write_index(testdata->path);
+
+    // Cut the string table
+    g_assert(g_file_get_contents(testdata->path, &content, &length, NULL));
+    g_assert(g_file_set_contents(testdata->path, content, length - 5, NULL));
+    g_assert(!cr_pkgindex_open(testdata->path, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    content[0] = 'X';
+    g_assert(g_file_set_contents(testdata->path, content, length, NULL));
+    g_assert(!cr_pkgindex_open(testdata->path, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+    g_free(content);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/pkgindex/test_cr_pkgindex_write_and_load",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgindex_write_and_load, testdata_teardown);
+    g_test_add("/pkgindex/test_cr_pkgindex_empty",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgindex_empty, testdata_teardown);
+    g_test_add("/pkgindex/test_cr_pkgindex_corrupted",
+               TestData, NULL, testdata_setup,
+               test_cr_pkgindex_corrupted, testdata_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,124 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/pkgtable.h"
+
+static cr_Package *
+new_pkg(const char *pkgId)
+{
+    cr_Package *pkg = cr_package_new();
+    pkg->pkgId = cr_safe_string_chunk_insert(pkg->chunk, pkgId);
+    return pkg;
+}
+
+static void
+test_cr_pkgtable_basic(void)
+{
+    cr_PkgTable *table = cr_pkgtable_new(0);
+    cr_Package *pkg = new_pkg("aaa");
+
+    g_assert_cmpuint(cr_pkgtable_size(table), ==, 0);
+    g_assert(!cr_pkgtable_lookup(table, "aaa"));
+
+    cr_pkgtable_insert(table, pkg->pkgId, pkg);
+    g_assert_cmpuint(cr_pkgtable_size(table), ==, 1);
+    g_assert(cr_pkgtable_lookup(table, "aaa") == pkg);
+    g_assert(cr_pkgtable_lookup_hashed(table, "aaa",
+                                       cr_pkgtable_hash("aaa")) == pkg);
+    g_assert(!cr_pkgtable_lookup(table, "bbb"));
+
+    g_assert(cr_pkgtable_steal(table, "aaa") == pkg);
+    g_assert(!cr_pkgtable_steal(table, "aaa"));
+    g_assert_cmpuint(cr_pkgtable_size(table), ==, 0);
+    g_assert(!cr_pkgtable_lookup(table, "aaa"));
+
+    cr_pkgtable_insert(table, pkg->pkgId, pkg);
+    g_assert(cr_pkgtable_remove(table, "aaa"));
+    g_assert(!cr_pkgtable_remove(table, "aaa"));
+
+    cr_pkgtable_free(table, TRUE);
+    cr_pkgtable_free(NULL, TRUE);
+}
+
+static void
+test_cr_pkgtable_grow_and_remove(void)
+{
+    // Sized for fewer packages, so the table has to grow
+    cr_PkgTable *table = cr_pkgtable_new(10);
+    const guint count = 5000;
+    cr_PkgTableIter iter;
+    const char *key;
+    cr_Package *pkg;
+    guint hash, found = 0;
+
+    for (guint x = 0; x < count; x++) {
+        gchar *id = g_strdup_printf("pkg%u", x);
+        pkg = new_pkg(id);
+        cr_pkgtable_insert(table, pkg->pkgId, pkg);
+        g_free(id);
+    }
+    g_assert_cmpuint(cr_pkgtable_size(table), ==, count);
+
+    // Remove every third package, the rest must stay reachable
+    for (guint x = 0; x < count; x += 3) {
+        gchar *id = g_strdup_printf("pkg%u", x);
+        g_assert(cr_pkgtable_remove(table, id));
+        g_free(id);
+    }
+
+    for (guint x = 0; x < count; x++) {
+        gchar *id = g_strdup_printf("pkg%u", x);
+        pkg = cr_pkgtable_lookup(table, id);
+        if (x % 3)
+            g_assert_cmpstr(pkg->pkgId, ==, id);
+        else
+            g_assert(!pkg);
+        g_free(id);
+    }
+
+    cr_pkgtable_iter_init(&iter, table);
+    while (cr_pkgtable_iter_next(&iter, &key, &pkg, &hash)) {
+        g_assert(key == pkg->pkgId);
+        g_assert_cmpuint(hash, ==, cr_pkgtable_hash(key));
+        found++;
+    }
+    g_assert_cmpuint(found, ==, cr_pkgtable_size(table));
+    g_assert_cmpuint(found, ==, count - (count + 2) / 3);
+
+    cr_pkgtable_free(table, TRUE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pkgtable/test_cr_pkgtable_basic",
+                    test_cr_pkgtable_basic);
+    g_test_add_func("/pkgtable/test_cr_pkgtable_grow_and_remove",
+                    test_cr_pkgtable_grow_and_remove);
+
+    return g_test_run();
+}
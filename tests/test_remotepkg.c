@@ -0,0 +1,261 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/parsepkg.h"
+#include "createrepo/remotepkg.h"
+
+static const char *test_pkgs[] = { "Archer-3.4.5-6.x86_64.rpm",
+                                   "fake_bash-1.1.1-1.x86_64.rpm",
+                                   "super_kernel-6.0.1-2.x86_64.rpm",
+                                   "Rimmer-1.0.2-2.x86_64.rpm" };
+
+typedef struct {
+    gchar *tmpdir;
+    gchar *manifest;
+} TestData;
+
+static void
+testdata_setup(TestData *testdata,
+               G_GNUC_UNUSED gconstpointer test_data)
+{
+    testdata->tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(testdata->tmpdir));
+    testdata->manifest = g_build_filename(testdata->tmpdir, "manifest", NULL);
+}
+
+static void
+testdata_teardown(TestData *testdata,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_remove_dir(testdata->tmpdir, NULL);
+    g_free(testdata->tmpdir);
+    g_free(testdata->manifest);
+}
+
+static GPtrArray *
+load_manifest(TestData *testdata,
+              const char *content,
+              const char *baseurl,
+              GError **err)
+{
+    g_assert(g_file_set_contents(testdata->manifest, content, -1, NULL));
+    return cr_remotepkg_load_manifest(testdata->manifest, baseurl, err);
+}
+
+static void
+test_cr_remotepkg_load_manifest(TestData *testdata,
+                                G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    GPtrArray *remotes;
+    cr_RemotePkg *remote;
+
+    remotes = load_manifest(testdata,
+        "# location\tsize\tmtime\tchecksum type\tchecksum\turl\n"
+        "\n"
+        "a/foo.rpm\t1024\t1400000000\tsha256\tabcd\n"
+        "bar.rpm\t0\t1\tsha1\tef01\thttp://mirror/x/bar.rpm\n",
+        "http://storage/bucket/", &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(remotes);
+    g_assert_cmpuint(remotes->len, ==, 2);
+
+    remote = g_ptr_array_index(remotes, 0);
+    g_assert_cmpstr(remote->url, ==, "http://storage/bucket/a/foo.rpm");
+    g_assert_cmpstr(remote->location_href, ==, "a/foo.rpm");
+    g_assert_cmpint(remote->size, ==, 1024);
+    g_assert_cmpint(remote->mtime, ==, 1400000000);
+    g_assert_cmpint(remote->checksum_type, ==, CR_CHECKSUM_SHA256);
+    g_assert_cmpstr(remote->checksum, ==, "abcd");
+
+    remote = g_ptr_array_index(remotes, 1);
+    g_assert_cmpstr(remote->url, ==, "http://mirror/x/bar.rpm");
+    g_assert_cmpint(remote->checksum_type, ==, CR_CHECKSUM_SHA1);
+    g_ptr_array_free(remotes, TRUE);
+
+    // Bad lines
+    const char *bad[] = { "foo.rpm\t1024\t1400000000\tsha256\n",
+                          "foo.rpm\t-1\t1400000000\tsha256\tabcd\n",
+                          "foo.rpm\t1024\tyesterday\tsha256\tabcd\n",
+                          "foo.rpm\t1024\t1400000000\tfoosum\tabcd\n",
+                          "\t1024\t1400000000\tsha256\tabcd\n" };
+    for (size_t x = 0; x < G_N_ELEMENTS(bad); x++) {
+        remotes = load_manifest(testdata, bad[x], "http://storage/",
+                                &tmp_err);
+        g_assert(!remotes);
+        g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+        g_clear_error(&tmp_err);
+    }
+
+    // No url
+    remotes = load_manifest(testdata, "foo.rpm\t1\t1\tsha256\tabcd\n", NULL,
+                            &tmp_err);
+    g_assert(!remotes);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    remotes = cr_remotepkg_load_manifest(TEST_PACKAGES_PATH "nonexistent",
+                                         NULL, &tmp_err);
+    g_assert(!remotes);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_IO);
+    g_clear_error(&tmp_err);
+}
+
+typedef struct {
+    cr_Package *pkgs[G_N_ELEMENTS(test_pkgs) + 2];
+    gchar *errors[G_N_ELEMENTS(test_pkgs) + 2];
+    guint reported;
+} ReadResult;
+
+static void
+read_cb(cr_RemotePkg *remote,
+        guint n,
+        cr_Package *pkg,
+        const GError *err,
+        void *cbdata)
+{
+    ReadResult *result = cbdata;
+
+    g_assert(remote);
+    g_assert_cmpuint(n, <, G_N_ELEMENTS(result->pkgs));
+    g_assert(!result->pkgs[n] && !result->errors[n]);
+    g_assert(pkg ? !err : err != NULL);
+
+    result->pkgs[n] = pkg;
+    result->errors[n] = err ? g_strdup(err->message) : NULL;
+    result->reported++;
+}
+
+static void
+test_cr_remotepkg_read_headers(TestData *testdata,
+                               G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *tmp_err = NULL;
+    GString *manifest = g_string_new(NULL);
+    gchar *cwd = g_get_current_dir();
+    gchar *baseurl = g_strconcat("file://", cwd, "/", TEST_PACKAGES_PATH,
+                                 NULL);
+    ReadResult result;
+    GPtrArray *remotes;
+    CURL *handle;
+    int ret;
+
+    for (size_t x = 0; x < G_N_ELEMENTS(test_pkgs); x++) {
+        gchar *path = g_build_filename(TEST_PACKAGES_PATH, test_pkgs[x],
+                                       NULL);
+        GStatBuf st;
+        g_assert_cmpint(g_stat(path, &st), ==, 0);
+
+        // The first range of the second package ends inside of its header,
+        // the rest of it is read by another request
+        g_string_append_printf(manifest, "%s\t%" G_GINT64_FORMAT
+                               "\t1400000000\tsha256\tchecksum%zu\n",
+                               test_pkgs[x],
+                               x == 1 ? (gint64) 200 : (gint64) st.st_size,
+                               x);
+        g_free(path);
+    }
+    // Missing file and a file which is not a package
+    g_string_append(manifest, "nonexistent.rpm\t1\t1\tsha256\tabcd\n");
+    g_string_append_printf(manifest, "fake.rpm\t1\t1\tsha256\tabcd"
+                           "\tfile://%s/%s\n", cwd,
+                           TEST_DATA_PATH "comps_files/comps_00.xml");
+
+    remotes = load_manifest(testdata, manifest->str, baseurl, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpuint(remotes->len, ==, G_N_ELEMENTS(result.pkgs));
+
+    memset(&result, 0, sizeof(result));
+    handle = curl_easy_init();
+    ret = cr_remotepkg_read_headers(handle, remotes, 2, 10, 0, read_cb,
+                                    &result, &tmp_err);
+    curl_easy_cleanup(handle);
+    g_assert_cmpint(ret, !=, CRE_OK);
+    g_assert(tmp_err);
+    g_clear_error(&tmp_err);
+    g_assert_cmpuint(result.reported, ==, remotes->len);
+
+    // The same packages as read from the files
+    for (size_t x = 0; x < G_N_ELEMENTS(test_pkgs); x++) {
+        gchar *path = g_build_filename(TEST_PACKAGES_PATH, test_pkgs[x],
+                                       NULL);
+        cr_Package *pkg = result.pkgs[x];
+        cr_Package *local = cr_package_from_rpm_base(path, 10, 0, &tmp_err);
+        struct cr_HeaderRangeStruct hdr_r;
+        gchar *checksum = g_strdup_printf("checksum%zu", x);
+
+        g_assert_no_error(tmp_err);
+        g_assert_cmpstr(result.errors[x], ==, NULL);
+        g_assert(pkg);
+        g_assert_cmpstr(pkg->name, ==, local->name);
+        g_assert_cmpstr(pkg->version, ==, local->version);
+        g_assert_cmpstr(pkg->release, ==, local->release);
+        g_assert_cmpstr(pkg->location_href, ==, test_pkgs[x]);
+        g_assert_cmpstr(pkg->pkgId, ==, checksum);
+        g_assert_cmpstr(pkg->checksum_type, ==, "sha256");
+        g_assert_cmpint(pkg->time_file, ==, 1400000000);
+
+        hdr_r = cr_get_header_byte_range(path, &tmp_err);
+        g_assert_no_error(tmp_err);
+        g_assert_cmpint(pkg->rpm_header_start, ==, hdr_r.start);
+        g_assert_cmpint(pkg->rpm_header_end, ==, hdr_r.end);
+
+        cr_package_free(local);
+        cr_package_free(pkg);
+        g_free(checksum);
+        g_free(path);
+    }
+
+    for (size_t x = G_N_ELEMENTS(test_pkgs); x < remotes->len; x++) {
+        g_assert(!result.pkgs[x]);
+        g_assert(result.errors[x]);
+    }
+    g_assert(strstr(result.errors[remotes->len - 1], "Not a rpm package"));
+
+    for (size_t x = 0; x < remotes->len; x++)
+        g_free(result.errors[x]);
+    g_ptr_array_free(remotes, TRUE);
+    g_string_free(manifest, TRUE);
+    g_free(baseurl);
+    g_free(cwd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/remotepkg/test_cr_remotepkg_load_manifest",
+               TestData, NULL, testdata_setup,
+               test_cr_remotepkg_load_manifest, testdata_teardown);
+    g_test_add("/remotepkg/test_cr_remotepkg_read_headers",
+               TestData, NULL, testdata_setup,
+               test_cr_remotepkg_read_headers, testdata_teardown);
+
+    return g_test_run();
+}
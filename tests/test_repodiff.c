@@ -0,0 +1,263 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/pkgindex.h"
+#include "createrepo/repodiff.h"
+#include "createrepo/repomd.h"
+#include "createrepo/xml_dump.h"
+
+typedef struct {
+    guint added;
+    guint removed;
+    guint changed;
+    GString *log;
+} DiffStats;
+
+static gboolean
+diff_cb(cr_RepoDiffType type,
+        const cr_RepoDiffPkg *old_pkg,
+        const cr_RepoDiffPkg *new_pkg,
+        void *cbdata)
+{
+    DiffStats *stats = cbdata;
+
+    switch (type) {
+        case CR_REPODIFF_ADDED:
+            g_assert(!old_pkg);
+            g_assert(new_pkg);
+            stats->added++;
+            g_string_append_printf(stats->log, "+%s-%s ",
+                                   new_pkg->name, new_pkg->version);
+            break;
+        case CR_REPODIFF_REMOVED:
+            g_assert(old_pkg);
+            g_assert(!new_pkg);
+            stats->removed++;
+            g_string_append_printf(stats->log, "-%s-%s ",
+                                   old_pkg->name, old_pkg->version);
+            break;
+        case CR_REPODIFF_CHANGED:
+            g_assert(old_pkg);
+            g_assert(new_pkg);
+            g_assert_cmpstr(old_pkg->name, ==, new_pkg->name);
+            g_assert_cmpstr(old_pkg->arch, ==, new_pkg->arch);
+            stats->changed++;
+            g_string_append_printf(stats->log, "~%s-%s-%s ", old_pkg->name,
+                                   old_pkg->version, new_pkg->version);
+            break;
+    }
+
+    return TRUE;
+}
+
+static guint
+diff_repos(const char *old_path, const char *new_path, gboolean use_index,
+           DiffStats *stats)
+{
+    GError *tmp_err = NULL;
+    cr_RepoDiffPkgs *old_pkgs, *new_pkgs;
+    guint diffs;
+
+    old_pkgs = cr_repodiff_pkgs_load(old_path, use_index, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(old_pkgs);
+    new_pkgs = cr_repodiff_pkgs_load(new_path, use_index, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(new_pkgs);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->log = g_string_new(NULL);
+    diffs = cr_repodiff(old_pkgs, new_pkgs, diff_cb, stats);
+    g_assert_cmpuint(diffs, ==, stats->added + stats->removed
+                                + stats->changed);
+
+    cr_repodiff_pkgs_free(old_pkgs);
+    cr_repodiff_pkgs_free(new_pkgs);
+    return diffs;
+}
+
+static void
+test_cr_repodiff_primary(void)
+{
+    DiffStats stats;
+
+    // The same repository
+    g_assert_cmpuint(diff_repos(TEST_REPO_02, TEST_REPO_02, TRUE, &stats),
+                     ==, 0);
+    g_string_free(stats.log, TRUE);
+
+    // fake_bash is new, super_kernel was rebuilt with another pkgId
+    g_assert_cmpuint(diff_repos(TEST_REPO_01, TEST_REPO_02, TRUE, &stats),
+                     ==, 2);
+    g_assert_cmpuint(stats.added, ==, 1);
+    g_assert_cmpuint(stats.removed, ==, 0);
+    g_assert_cmpuint(stats.changed, ==, 1);
+    g_assert_cmpstr(stats.log->str, ==,
+                    "+fake_bash-1.1.1 ~super_kernel-6.0.1-6.0.1 ");
+    g_string_free(stats.log, TRUE);
+
+    // Everything is removed
+    g_assert_cmpuint(diff_repos(TEST_REPO_02, TEST_REPO_00, TRUE, &stats),
+                     ==, 2);
+    g_assert_cmpuint(stats.removed, ==, 2);
+    g_string_free(stats.log, TRUE);
+}
+
+static void
+test_cr_repodiff_no_repo(void)
+{
+    GError *tmp_err = NULL;
+    cr_RepoDiffPkgs *pkgs;
+
+    pkgs = cr_repodiff_pkgs_load(TEST_DATA_PATH "nonexistent_repo", TRUE,
+                                 &tmp_err);
+    g_assert(!pkgs);
+    g_assert(tmp_err);
+    g_clear_error(&tmp_err);
+}
+
+static cr_Package *
+new_pkg(const char *name, const char *version)
+{
+    cr_Package *pkg = cr_package_new();
+    gchar *href = g_strconcat("Packages/", name, "-", version, ".x86_64.rpm",
+                              NULL);
+
+    pkg->name          = cr_safe_string_chunk_insert(pkg->chunk, name);
+    pkg->epoch         = cr_safe_string_chunk_insert(pkg->chunk, "0");
+    pkg->version       = cr_safe_string_chunk_insert(pkg->chunk, version);
+    pkg->release       = cr_safe_string_chunk_insert(pkg->chunk, "1");
+    pkg->arch          = cr_safe_string_chunk_insert(pkg->chunk, "x86_64");
+    pkg->location_href = cr_safe_string_chunk_insert(pkg->chunk, href);
+    pkg->checksum_type = cr_safe_string_chunk_insert(pkg->chunk, "sha256");
+    pkg->pkgId         = cr_safe_string_chunk_insert(pkg->chunk, href);
+    g_free(href);
+    return pkg;
+}
+
+/** Create a repository with only the package index in its repomd.xml.
+ */
+static void
+write_index_repo(const char *path, const char *pkgs[][2], size_t count)
+{
+    GError *tmp_err = NULL;
+    cr_PkgIndexWriter *writer = cr_pkgindex_writer_new();
+    gchar *repodata = g_build_filename(path, "repodata", NULL);
+    gchar *index_path = g_build_filename(repodata, "pkgindex", NULL);
+    gchar *repomd_path = g_build_filename(repodata, "repomd.xml", NULL);
+
+    g_assert_cmpint(g_mkdir_with_parents(repodata, 0755), ==, 0);
+
+    for (size_t x = 0; x < count; x++) {
+        cr_Package *pkg = new_pkg(pkgs[x][0], pkgs[x][1]);
+        g_assert(cr_pkgindex_writer_add(writer, pkg, &tmp_err));
+        g_assert_no_error(tmp_err);
+        cr_package_free(pkg);
+    }
+    g_assert(cr_pkgindex_writer_write(writer, index_path, &tmp_err));
+    g_assert_no_error(tmp_err);
+    cr_pkgindex_writer_free(writer);
+
+    cr_Repomd *repomd = cr_repomd_new();
+    cr_repomd_set_record(repomd, cr_repomd_record_new("pkgindex", index_path));
+    gchar *xml = cr_xml_dump_repomd(repomd, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(g_file_set_contents(repomd_path, xml, -1, NULL));
+    cr_repomd_free(repomd);
+
+    g_free(xml);
+    g_free(repodata);
+    g_free(index_path);
+    g_free(repomd_path);
+}
+
+static void
+test_cr_repodiff_pkgindex(void)
+{
+    const char *old_pkgs[][2] = { { "bash", "5.1" },
+                                  { "kernel", "6.1" },
+                                  { "kernel", "6.2" },
+                                  { "zsh", "5.9" } };
+    const char *new_pkgs[][2] = { { "bash", "5.2" },
+                                  { "coreutils", "9.4" },
+                                  { "kernel", "6.2" },
+                                  { "kernel", "6.3" },
+                                  { "kernel", "6.4" } };
+    GError *tmp_err = NULL;
+    cr_RepoDiffPkgs *pkgs;
+    DiffStats stats;
+
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(tmpdir));
+    gchar *old_path = g_build_filename(tmpdir, "old", NULL);
+    gchar *new_path = g_build_filename(tmpdir, "new", NULL);
+    write_index_repo(old_path, old_pkgs, G_N_ELEMENTS(old_pkgs));
+    write_index_repo(new_path, new_pkgs, G_N_ELEMENTS(new_pkgs));
+
+    pkgs = cr_repodiff_pkgs_load(old_path, TRUE, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpstr(cr_repodiff_pkgs_source(pkgs), ==, "pkgindex");
+    g_assert_cmpuint(cr_repodiff_pkgs_size(pkgs), ==, 4);
+    cr_repodiff_pkgs_free(pkgs);
+
+    // Without the index, there is no primary to read
+    pkgs = cr_repodiff_pkgs_load(old_path, FALSE, &tmp_err);
+    g_assert(!pkgs);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_NOFILE);
+    g_clear_error(&tmp_err);
+
+    // The unmatched kernels are paired by their versions
+    g_assert_cmpuint(diff_repos(old_path, new_path, TRUE, &stats), ==, 5);
+    g_assert_cmpuint(stats.added, ==, 2);
+    g_assert_cmpuint(stats.removed, ==, 1);
+    g_assert_cmpuint(stats.changed, ==, 2);
+    g_assert_cmpstr(stats.log->str, ==,
+                    "~bash-5.1-5.2 +coreutils-9.4 ~kernel-6.1-6.3 "
+                    "+kernel-6.4 -zsh-5.9 ");
+    g_string_free(stats.log, TRUE);
+
+    cr_remove_dir(tmpdir, NULL);
+    g_free(old_path);
+    g_free(new_path);
+    g_free(tmpdir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/repodiff/test_cr_repodiff_primary",
+                    test_cr_repodiff_primary);
+    g_test_add_func("/repodiff/test_cr_repodiff_no_repo",
+                    test_cr_repodiff_no_repo);
+    g_test_add_func("/repodiff/test_cr_repodiff_pkgindex",
+                    test_cr_repodiff_pkgindex);
+
+    return g_test_run();
+}
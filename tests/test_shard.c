@@ -0,0 +1,140 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/shard.h"
+
+#define PKG_A   "<package type=\"rpm\">\n" \
+                "  <name>a</name>\n" \
+                "  <location href=\"sub/a.rpm\"/>\n" \
+                "</package>\n"
+#define PKG_B   "<package type=\"rpm\">\n" \
+                "  <name>b</name>\n" \
+                "  <location xml:base=\"http://x/\" href=\"b.rpm\"/>\n" \
+                "</package>\n"
+#define PKG_B2  "<package type=\"rpm\">\n" \
+                "  <location href=\"sub/b.rpm\"/>\n" \
+                "</package>\n"
+
+typedef struct {
+    gchar *tmpdir;
+    gchar *path;
+} TestData;
+
+static void
+testdata_setup(TestData *testdata,
+               G_GNUC_UNUSED gconstpointer test_data)
+{
+    testdata->tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(testdata->tmpdir));
+    testdata->path = g_build_filename(testdata->tmpdir, "primary.xml", NULL);
+}
+
+static void
+testdata_teardown(TestData *testdata,
+                  G_GNUC_UNUSED gconstpointer test_data)
+{
+    cr_remove_dir(testdata->tmpdir, NULL);
+    g_free(testdata->tmpdir);
+    g_free(testdata->path);
+}
+
+static void
+test_cr_shard_of(void)
+{
+    // 32 bit FNV-1a
+    g_assert_cmpuint(cr_shard_of("", G_MAXUINT), ==, 2166136261u);
+    g_assert_cmpuint(cr_shard_of("a", G_MAXUINT), ==, 0xe40c292cu % G_MAXUINT);
+    g_assert_cmpuint(cr_shard_of("Packages/a.rpm", 1), ==, 0);
+
+    for (guint x = 0; x < 100; x++) {
+        gchar *path = g_strdup_printf("Packages/pkg%u.rpm", x);
+        g_assert_cmpuint(cr_shard_of(path, 7), <, 7);
+        g_assert_cmpuint(cr_shard_of(path, 7), ==, cr_shard_of(path, 7));
+        g_free(path);
+    }
+}
+
+static void
+test_cr_shard_chunk_cmp(void)
+{
+    // By the filename and then by the directory
+    g_assert_cmpint(cr_shard_chunk_cmp(PKG_A, PKG_B), <, 0);
+    g_assert_cmpint(cr_shard_chunk_cmp(PKG_B, PKG_A), >, 0);
+    g_assert_cmpint(cr_shard_chunk_cmp(PKG_B, PKG_B2), <, 0);
+    g_assert_cmpint(cr_shard_chunk_cmp(PKG_A, PKG_B2), <, 0);
+    g_assert_cmpint(cr_shard_chunk_cmp(PKG_A, PKG_A), ==, 0);
+}
+
+static void
+test_cr_shard_reader(TestData *testdata,
+                     G_GNUC_UNUSED gconstpointer test_data)
+{
+    const char *content = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                          "<metadata xmlns=\"http://linux.duke.edu/metadata/"
+                          "common\" packages=\"2\">\n"
+                          PKG_A PKG_B "</metadata>\n";
+    GError *tmp_err = NULL;
+    cr_ShardReader *reader;
+
+    g_assert(g_file_set_contents(testdata->path, content, -1, NULL));
+
+    reader = cr_shard_reader_open(testdata->path, &tmp_err);
+    g_assert(reader);
+    g_assert(!tmp_err);
+    g_assert_cmpint(cr_shard_reader_packages(reader), ==, 2);
+    g_assert_cmpstr(cr_shard_reader_next(reader, &tmp_err), ==, PKG_A);
+    g_assert_cmpstr(cr_shard_reader_next(reader, &tmp_err), ==, PKG_B);
+    g_assert(!cr_shard_reader_next(reader, &tmp_err));
+    g_assert(!tmp_err);
+    cr_shard_reader_free(reader);
+
+    // Cut in the middle of the second package
+    g_assert(g_file_set_contents(testdata->path, content,
+                                 strstr(content, "<name>b") - content, NULL));
+    reader = cr_shard_reader_open(testdata->path, &tmp_err);
+    g_assert(reader);
+    g_assert_cmpstr(cr_shard_reader_next(reader, &tmp_err), ==, PKG_A);
+    g_assert(!cr_shard_reader_next(reader, &tmp_err));
+    g_assert_cmpint(tmp_err->code, ==, CRE_XMLDATA);
+    g_clear_error(&tmp_err);
+    cr_shard_reader_free(reader);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/shard/test_cr_shard_of", test_cr_shard_of);
+    g_test_add_func("/shard/test_cr_shard_chunk_cmp",
+                    test_cr_shard_chunk_cmp);
+    g_test_add("/shard/test_cr_shard_reader",
+               TestData, NULL, testdata_setup,
+               test_cr_shard_reader, testdata_teardown);
+
+    return g_test_run();
+}
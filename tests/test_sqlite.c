@@ -29,6 +29,8 @@
 #include "createrepo/sqlite.h"
 #include "createrepo/parsepkg.h"
 #include "createrepo/constants.h"
+#include "createrepo/error.h"
+#include "createrepo/xml_dump.h"
 
 #define TMP_DIR_PATTERN         "/tmp/createrepo_test_XXXXXX"
 #define TMP_PRIMARY_NAME        "primary.sqlite"
@@ -243,6 +245,523 @@ test_all(TestData *testdata,
 
 
 
+static gint64
+count_rows(const char *path, const char *query)
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    gint64 count = -1;
+
+    g_assert_cmpint(sqlite3_open(path, &db), ==, SQLITE_OK);
+    g_assert_cmpint(sqlite3_prepare_v2(db, query, -1, &stmt, NULL), ==, SQLITE_OK);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        count = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return count;
+}
+
+
+static void
+test_cr_db_multirow_insert(TestData *testdata,
+                           G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    gchar *pri_path, *oth_path;
+    cr_SqliteDb *pri_db, *oth_db;
+    cr_Package *pkg;
+    char name[32];
+
+    pri_path = g_strconcat(testdata->tmp_dir, "/", TMP_PRIMARY_NAME, NULL);
+    oth_path = g_strconcat(testdata->tmp_dir, "/", TMP_OTHER_NAME, NULL);
+    pri_db = cr_db_open_primary(pri_path, &err);
+    g_assert(pri_db);
+    oth_db = cr_db_open_other(oth_path, &err);
+    g_assert(oth_db);
+    g_assert(!err);
+
+    // More rows than one statement inserts, the rest uses a shorter one
+    pkg = get_package();
+    for (int x = 0; x < 37; x++) {
+        cr_Dependency *dep = cr_dependency_new();
+        g_snprintf(name, sizeof(name), "req%d", x);
+        dep->name = g_string_chunk_insert(pkg->chunk, name);
+        dep->pre = (x % 2 == 0);
+        pkg->requires = g_slist_prepend(pkg->requires, dep);
+
+        cr_PackageFile *file = cr_package_file_new();
+        file->type = "";
+        file->path = "/usr/bin/";
+        g_snprintf(name, sizeof(name), "foo%d", x);
+        file->name = g_string_chunk_insert(pkg->chunk, name);
+        pkg->files = g_slist_prepend(pkg->files, file);
+
+        cr_ChangelogEntry *entry = cr_changelog_entry_new();
+        entry->author = "foo";
+        entry->date = x;
+        entry->changelog = "- bar";
+        pkg->changelogs = g_slist_prepend(pkg->changelogs, entry);
+    }
+
+    g_assert_cmpint(cr_db_add_pkg(pri_db, pkg, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_add_pkg(oth_db, pkg, &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert_cmpint(cr_db_close(pri_db, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_close(oth_db, &err), ==, CRE_OK);
+    g_assert(!err);
+
+    g_assert_cmpint(count_rows(pri_path, "SELECT COUNT(*) FROM requires"), ==, 39);
+    g_assert_cmpint(count_rows(pri_path, "SELECT COUNT(*) FROM requires "
+                               "WHERE pre = 'TRUE'"), ==, 20);
+    g_assert_cmpint(count_rows(pri_path, "SELECT COUNT(*) FROM provides"), ==, 1);
+    // Only /usr/bin/ files and the /bin/foo are primary files
+    g_assert_cmpint(count_rows(pri_path, "SELECT COUNT(*) FROM files"), ==, 38);
+    g_assert_cmpint(count_rows(oth_path, "SELECT COUNT(*) FROM changelog"), ==, 37);
+    g_assert_cmpint(count_rows(oth_path, "SELECT SUM(date) FROM changelog"), ==, 666);
+
+    cr_package_free(pkg);
+    g_free(pri_path);
+    g_free(oth_path);
+}
+
+
+static gchar *
+query_text(const char *path, const char *query)
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    gchar *text = NULL;
+
+    g_assert_cmpint(sqlite3_open(path, &db), ==, SQLITE_OK);
+    g_assert_cmpint(sqlite3_prepare_v2(db, query, -1, &stmt, NULL), ==, SQLITE_OK);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        text = g_strdup((const char *) sqlite3_column_text(stmt, 0));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return text;
+}
+
+
+static void
+test_cr_db_filelists_grouping(TestData *testdata,
+                              G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    gchar *path, *text;
+    cr_SqliteDb *db;
+    cr_Package *pkg;
+    const char *files[][3] = {
+        { "/usr/bin/",   "foo",     ""      },
+        { "/etc/",       "foo.conf", "ghost" },
+        { "/usr/bin/",   "bar",     "file"  },
+        { "/usr/bin/",   "baz",     "dir"   },
+        { "/etc/",       "bar.conf", ""      },
+    };
+
+    path = g_strconcat(testdata->tmp_dir, "/", TMP_FILELISTS_NAME, NULL);
+    db = cr_db_open_filelists(path, &err);
+    g_assert(db);
+    g_assert(!err);
+
+    // Directories are interleaved, files of each keep their order
+    pkg = get_package();
+    for (int x = (int) G_N_ELEMENTS(files) - 1; x >= 0; x--) {
+        cr_PackageFile *file = cr_package_file_new();
+        file->path = (char *) files[x][0];
+        file->name = (char *) files[x][1];
+        file->type = (char *) files[x][2];
+        pkg->files = g_slist_prepend(pkg->files, file);
+    }
+
+    g_assert_cmpint(cr_db_add_pkg(db, pkg, &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+    g_assert(!err);
+
+    // Files of the get_package() have their own rows
+    g_assert_cmpint(count_rows(path, "SELECT COUNT(*) FROM filelist"), ==, 4);
+    text = query_text(path, "SELECT filenames || ' ' || filetypes FROM "
+                            "filelist WHERE dirname = '/usr/bin'");
+    g_assert_cmpstr(text, ==, "foo/bar/baz ffd");
+    g_free(text);
+    text = query_text(path, "SELECT filenames || ' ' || filetypes FROM "
+                            "filelist WHERE dirname = '/etc'");
+    g_assert_cmpstr(text, ==, "foo.conf/bar.conf gf");
+    g_free(text);
+
+    cr_package_free(pkg);
+    g_free(path);
+}
+
+
+static void
+test_cr_db_reuse_packages(TestData *testdata,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    gchar *path, *text;
+    cr_SqliteDb *db;
+    cr_Package *kept, *removed, *added;
+    guint count;
+
+    path = g_strconcat(testdata->tmp_dir, "/", TMP_PRIMARY_NAME, NULL);
+    kept = get_package();
+    removed = get_package();
+    removed->pkgId = "removed";
+    removed->name = "removed";
+
+    db = cr_db_open_primary(path, &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_add_pkg(db, kept, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_add_pkg(db, removed, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_dbinfo_update(db, "foochecksum", &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+    g_assert(!err);
+
+    // Only the new package is inserted into the reopened db
+    added = get_package();
+    added->pkgId = "added";
+    added->name = "added";
+    db = cr_db_open_primary(path, &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_reuse_packages(db, &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert_cmpint(cr_db_add_pkg(db, kept, &err), ==, CRE_OK);
+    g_assert_cmpint(kept->pkgKey, ==, 1);
+    g_assert_cmpint(cr_db_add_pkg(db, added, &err), ==, CRE_OK);
+    g_assert_cmpint(added->pkgKey, ==, 3);
+    g_assert_cmpint(cr_db_remove_unused_packages(db, &count, &err), ==, CRE_OK);
+    g_assert_cmpuint(count, ==, 1);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+    g_assert(!err);
+
+    g_assert_cmpint(count_rows(path, "SELECT COUNT(*) FROM packages"), ==, 2);
+    g_assert_cmpint(count_rows(path, "SELECT COUNT(*) FROM requires"), ==, 4);
+    text = query_text(path, "SELECT group_concat(name) FROM packages "
+                            "WHERE pkgKey <> 1");
+    g_assert_cmpstr(text, ==, "added");
+    g_free(text);
+
+    // A db without the version in db_info cannot be reused
+    g_assert(!remove(path));
+    db = cr_db_open_primary(path, &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_reuse_packages(db, &err), ==, CRE_DB);
+    g_assert(err);
+    g_clear_error(&err);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+
+    cr_package_free(kept);
+    cr_package_free(removed);
+    cr_package_free(added);
+    g_free(path);
+}
+
+
+static void
+test_cr_db_close_compressed(TestData *testdata,
+                            G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    gchar *path, *gz_path;
+    cr_SqliteDb *pri_db, *oth_db;
+    cr_ContentStat *stat;
+    cr_Package *pkg;
+    GStatBuf st;
+
+    path = g_strconcat(testdata->tmp_dir, "/", TMP_PRIMARY_NAME, NULL);
+    gz_path = g_strconcat(path, ".gz", NULL);
+
+    // In-memory databases don't share their content
+    pri_db = cr_db_open_primary(CR_DB_IN_MEMORY, &err);
+    g_assert(pri_db);
+    oth_db = cr_db_open_other(CR_DB_IN_MEMORY, &err);
+    g_assert(oth_db);
+    g_assert(!err);
+    g_assert(!g_file_test(CR_DB_IN_MEMORY, G_FILE_TEST_EXISTS));
+
+    pkg = get_package();
+    g_assert_cmpint(cr_db_add_pkg(pri_db, pkg, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_dbinfo_update(pri_db, "foochecksum", &err), ==, CRE_OK);
+    g_assert(!err);
+
+    stat = cr_contentstat_new(CR_CHECKSUM_SHA256, NULL);
+    g_assert_cmpint(cr_db_close_compressed(pri_db, gz_path,
+                                           CR_CW_GZ_COMPRESSION, stat,
+                                           &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert_cmpint(cr_db_close(oth_db, &err), ==, CRE_OK);
+
+    g_assert_cmpint(cr_decompress_file(gz_path, path, CR_CW_GZ_COMPRESSION,
+                                       &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert(g_stat(path, &st) == 0);
+    g_assert_cmpint(stat->size, ==, st.st_size);
+    g_assert(stat->checksum);
+    g_assert_cmpint(count_rows(path, "SELECT COUNT(*) FROM packages"), ==, 1);
+    g_assert_cmpint(count_rows(path, "SELECT dbversion FROM db_info"),
+                    ==, CR_DB_CACHE_DBVERSION);
+
+    cr_contentstat_free(stat, NULL);
+    cr_package_free(pkg);
+    g_free(path);
+    g_free(gz_path);
+}
+
+
+static void
+test_cr_db_latin1_strings(TestData *testdata,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    gchar *pri_path, *fil_path, *text;
+    cr_SqliteDb *pri_db, *fil_db;
+    cr_Package *pkg;
+
+    pri_path = g_strconcat(testdata->tmp_dir, "/", TMP_PRIMARY_NAME, NULL);
+    fil_path = g_strconcat(testdata->tmp_dir, "/", TMP_FILELISTS_NAME, NULL);
+    pri_db = cr_db_open_primary(pri_path, &err);
+    g_assert(pri_db);
+    fil_db = cr_db_open_filelists(fil_path, &err);
+    g_assert(fil_db);
+    g_assert(!err);
+
+    // Strings which are not UTF-8 are converted from latin1
+    pkg = get_package();
+    pkg->summary = "caf\xe9 package";
+    pkg->description = "caf\xc3\xa9 package";
+    cr_PackageFile *file = cr_package_file_new();
+    file->path = "/usr/share/caf\xe9//";
+    file->name = "menu";
+    file->type = "";
+    pkg->files = g_slist_prepend(pkg->files, file);
+
+    g_assert_cmpint(cr_db_add_pkg(pri_db, pkg, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_add_pkg(fil_db, pkg, &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert_cmpint(cr_db_close(pri_db, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_close(fil_db, &err), ==, CRE_OK);
+    g_assert(!err);
+
+    text = query_text(pri_path, "SELECT summary FROM packages");
+    g_assert_cmpstr(text, ==, "caf\xc3\xa9 package");
+    g_free(text);
+    text = query_text(pri_path, "SELECT description FROM packages");
+    g_assert_cmpstr(text, ==, "caf\xc3\xa9 package");
+    g_free(text);
+    text = query_text(fil_path, "SELECT dirname FROM filelist "
+                                "WHERE filenames = 'menu'");
+    g_assert_cmpstr(text, ==, "/usr/share/caf\xc3\xa9");
+    g_free(text);
+
+    cr_package_free(pkg);
+    g_free(pri_path);
+    g_free(fil_path);
+}
+
+
+typedef struct {
+    cr_SqliteDb *db;
+    const cr_Package *pkg;
+} AddConstPkgData;
+
+static gpointer
+add_const_pkg_thread(gpointer data)
+{
+    AddConstPkgData *add = data;
+    for (int x = 0; x < 50; x++)
+        g_assert_cmpint(cr_db_add_const_pkg(add->db, add->pkg, NULL), ==, CRE_OK);
+    return NULL;
+}
+
+
+static void
+test_cr_db_add_const_pkg(TestData *testdata,
+                         G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    const char *names[] = { TMP_PRIMARY_NAME, TMP_FILELISTS_NAME, TMP_OTHER_NAME };
+    gchar *paths[3];
+    AddConstPkgData add[3];
+    GThread *threads[3];
+    cr_Package *pkg = get_package();
+
+    // The same package is added into all the databases at once
+    for (int x = 0; x < 3; x++) {
+        paths[x] = g_strconcat(testdata->tmp_dir, "/", names[x], NULL);
+        add[x].db = cr_db_open(paths[x], (cr_DatabaseType) x, &err);
+        g_assert(add[x].db);
+        g_assert(!err);
+        add[x].pkg = pkg;
+        threads[x] = g_thread_new("db", add_const_pkg_thread, &add[x]);
+    }
+
+    for (int x = 0; x < 3; x++) {
+        g_thread_join(threads[x]);
+        g_assert_cmpint(cr_db_close(add[x].db, &err), ==, CRE_OK);
+        g_assert(!err);
+    }
+
+    g_assert_cmpint(pkg->pkgKey, ==, 0);
+    g_assert_cmpint(count_rows(paths[0], "SELECT MAX(pkgKey) FROM requires"), ==, 50);
+    g_assert_cmpint(count_rows(paths[1], "SELECT COUNT(*) FROM packages"), ==, 50);
+    g_assert_cmpint(count_rows(paths[2], "SELECT MAX(pkgKey) FROM packages"), ==, 50);
+
+    for (int x = 0; x < 3; x++)
+        g_free(paths[x]);
+    cr_package_free(pkg);
+}
+
+
+static void
+test_cr_db_package_reader(TestData *testdata,
+                          G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    const char *names[] = { TMP_PRIMARY_NAME, TMP_FILELISTS_NAME, TMP_OTHER_NAME };
+    gchar *paths[3];
+    cr_Package *pkg, *read;
+    cr_DbPackageReader *reader;
+    struct cr_XmlStruct orig_xml, read_xml;
+
+    cr_ChangelogEntry *entry = cr_changelog_entry_new();
+
+    pkg = get_package();
+    entry->author = "Foo Bar <foo@bar.com> - 1.2.3-2";
+    entry->date = 1234567;
+    entry->changelog = "- Fix bar";
+    pkg->changelogs = g_slist_prepend(pkg->changelogs, entry);
+
+    // The files are read sorted by their paths (as they are in rpms),
+    // the file without a name is not dumped at all
+    g_free(g_slist_nth_data(pkg->files, 1));
+    pkg->files = g_slist_delete_link(pkg->files, g_slist_nth(pkg->files, 1));
+    pkg->files = g_slist_reverse(pkg->files);
+
+    for (int x = 0; x < 3; x++) {
+        cr_SqliteDb *db;
+        paths[x] = g_strconcat(testdata->tmp_dir, "/", names[x], NULL);
+        db = cr_db_open(paths[x], (cr_DatabaseType) x, &err);
+        g_assert(db);
+        g_assert_cmpint(cr_db_add_pkg(db, pkg, &err), ==, CRE_OK);
+        g_assert_cmpint(cr_db_dbinfo_update(db, "foochecksum", &err), ==, CRE_OK);
+        g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+        g_assert(!err);
+    }
+
+    reader = cr_db_package_reader_new(paths[0], paths[1], paths[2], &err);
+    g_assert(reader);
+    g_assert(!err);
+    g_assert_cmpuint(cr_db_package_reader_size(reader), ==, 1);
+
+    // Unknown location is not an error
+    g_assert(!cr_db_package_reader_get(reader, "bar.rpm", &err));
+    g_assert(!err);
+
+    // The package read back dumps to the same xml
+    read = cr_db_package_reader_get(reader, "foo.rpm", &err);
+    g_assert(read);
+    g_assert(!err);
+    g_assert(read->loadingflags & CR_PACKAGE_LOADED_FIL);
+    g_assert(read->loadingflags & CR_PACKAGE_LOADED_OTH);
+
+    orig_xml = cr_xml_dump(pkg, &err);
+    g_assert(!err);
+    read_xml = cr_xml_dump(read, &err);
+    g_assert(!err);
+    g_assert_cmpstr(read_xml.primary, ==, orig_xml.primary);
+    g_assert_cmpstr(read_xml.filelists, ==, orig_xml.filelists);
+    g_assert_cmpstr(read_xml.other, ==, orig_xml.other);
+
+    g_free(orig_xml.primary);
+    g_free(orig_xml.filelists);
+    g_free(orig_xml.other);
+    g_free(read_xml.primary);
+    g_free(read_xml.filelists);
+    g_free(read_xml.other);
+    cr_package_free(read);
+    cr_db_package_reader_free(reader);
+
+    // A db without the version in db_info is refused
+    g_assert(!remove(paths[1]));
+    cr_SqliteDb *db = cr_db_open_filelists(paths[1], &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+    g_assert(!cr_db_package_reader_new(paths[0], paths[1], paths[2], &err));
+    g_assert_error(err, CREATEREPO_C_ERROR, CRE_DB);
+    g_clear_error(&err);
+
+    for (int x = 0; x < 3; x++)
+        g_free(paths[x]);
+    cr_package_free(pkg);
+}
+
+
+static void
+test_cr_db_append_db(TestData *testdata,
+                     G_GNUC_UNUSED gconstpointer test_data)
+{
+    GError *err = NULL;
+    gchar *paths[3], *text;
+    cr_SqliteDb *db;
+    cr_Package *pkg;
+
+    for (int x = 0; x < 3; x++)
+        paths[x] = g_strdup_printf("%s/primary%d.sqlite", testdata->tmp_dir, x);
+
+    // Two shards with one package each
+    pkg = get_package();
+    for (int x = 0; x < 2; x++) {
+        db = cr_db_open_primary(paths[x], &err);
+        g_assert(db);
+        if (x == 1) {
+            pkg->location_href = "bar.rpm";
+            pkg->location_base = NULL;
+        }
+        g_assert_cmpint(cr_db_add_pkg(db, pkg, &err), ==, CRE_OK);
+        g_assert_cmpint(cr_db_dbinfo_update(db, "foochecksum", &err), ==, CRE_OK);
+        g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+        g_assert(!err);
+    }
+
+    db = cr_db_open_primary(paths[2], &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_append_db(db, paths[0], NULL, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_db_append_db(db, paths[1], "http://base", &err), ==, CRE_OK);
+    g_assert(!err);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+
+    g_assert_cmpint(count_rows(paths[2], "SELECT COUNT(*) FROM packages"), ==, 2);
+    g_assert_cmpint(count_rows(paths[2], "SELECT MAX(pkgKey) FROM packages"), ==, 2);
+    g_assert_cmpint(count_rows(paths[2], "SELECT COUNT(*) FROM requires"), ==, 4);
+    g_assert_cmpint(count_rows(paths[2], "SELECT MAX(pkgKey) FROM requires"), ==, 2);
+    text = query_text(paths[2], "SELECT location_base FROM packages "
+                                "WHERE location_href = 'foo.rpm'");
+    g_assert_cmpstr(text, ==, "/test/");
+    g_free(text);
+    text = query_text(paths[2], "SELECT location_base FROM packages "
+                                "WHERE location_href = 'bar.rpm'");
+    g_assert_cmpstr(text, ==, "http://base");
+    g_free(text);
+
+    // A db without the version in db_info is refused
+    g_assert(!remove(paths[1]));
+    db = cr_db_open_primary(paths[1], &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_close(db, &err), ==, CRE_OK);
+    db = cr_db_open_primary(paths[2], &err);
+    g_assert(db);
+    g_assert_cmpint(cr_db_append_db(db, paths[1], NULL, &err), ==, CRE_DB);
+    g_assert_error(err, CREATEREPO_C_ERROR, CRE_DB);
+    g_clear_error(&err);
+    cr_db_close(db, NULL);
+
+    for (int x = 0; x < 3; x++)
+        g_free(paths[x]);
+    cr_package_free(pkg);
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -252,6 +771,14 @@ main(int argc, char *argv[])
     g_test_add("/sqlite/test_cr_db_add_primary_pkg", TestData, NULL, testdata_setup, test_cr_db_add_primary_pkg, testdata_teardown);
     g_test_add("/sqlite/test_cr_db_dbinfo_update", TestData, NULL, testdata_setup, test_cr_db_dbinfo_update, testdata_teardown);
     g_test_add("/sqlite/test_all", TestData, NULL, testdata_setup, test_all, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_multirow_insert", TestData, NULL, testdata_setup, test_cr_db_multirow_insert, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_filelists_grouping", TestData, NULL, testdata_setup, test_cr_db_filelists_grouping, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_reuse_packages", TestData, NULL, testdata_setup, test_cr_db_reuse_packages, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_close_compressed", TestData, NULL, testdata_setup, test_cr_db_close_compressed, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_latin1_strings", TestData, NULL, testdata_setup, test_cr_db_latin1_strings, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_add_const_pkg", TestData, NULL, testdata_setup, test_cr_db_add_const_pkg, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_package_reader", TestData, NULL, testdata_setup, test_cr_db_package_reader, testdata_teardown);
+    g_test_add("/sqlite/test_cr_db_append_db", TestData, NULL, testdata_setup, test_cr_db_append_db, testdata_teardown);
 
     return g_test_run();
 }
@@ -0,0 +1,160 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#define _GNU_SOURCE             // sched_getcpu
+#include <glib.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/threads.h"
+
+static void
+test_cr_cpuset_from_str(void)
+{
+    GError *tmp_err = NULL;
+    cr_CpuSet *cpuset;
+
+    cpuset = cr_cpuset_from_str("3", &tmp_err);
+    g_assert(cpuset);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_cpuset_count(cpuset), ==, 1);
+    cr_cpuset_free(cpuset);
+
+    cpuset = cr_cpuset_from_str("0-7,16-23", &tmp_err);
+    g_assert(cpuset);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_cpuset_count(cpuset), ==, 16);
+    cr_cpuset_free(cpuset);
+
+    // Overlapping ranges
+    cpuset = cr_cpuset_from_str("0-3,2-5,5", &tmp_err);
+    g_assert(cpuset);
+    g_assert(!tmp_err);
+    g_assert_cmpuint(cr_cpuset_count(cpuset), ==, 6);
+    cr_cpuset_free(cpuset);
+
+    g_assert_cmpuint(cr_cpuset_count(NULL), ==, 0);
+}
+
+static void
+test_cr_cpuset_from_str_bad(void)
+{
+    const char *bad[] = { "", ",", "a", "1-", "-1", "3-1", "1,,2", "1 2",
+                          "0-99999", NULL };
+
+    for (const char **str = bad; *str; str++) {
+        GError *tmp_err = NULL;
+        cr_CpuSet *cpuset = cr_cpuset_from_str(*str, &tmp_err);
+        g_assert(!cpuset);
+        g_assert(tmp_err);
+        g_assert_cmpint(tmp_err->code, ==, CRE_BADARG);
+        g_error_free(tmp_err);
+    }
+}
+
+static void
+test_cr_cpuset_bind_current_thread(void)
+{
+    GError *tmp_err = NULL;
+    int cpu = sched_getcpu();
+
+    g_assert(cr_cpuset_bind_current_thread(NULL, &tmp_err));
+    g_assert(!tmp_err);
+
+    if (cpu < 0)
+        return;
+
+    gchar *str = g_strdup_printf("%d", cpu);
+    cr_CpuSet *cpuset = cr_cpuset_from_str(str, &tmp_err);
+    g_assert(cpuset);
+    g_assert(cr_cpuset_bind_current_thread(cpuset, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpint(sched_getcpu(), ==, cpu);
+    // Already bound
+    g_assert(cr_cpuset_bind_current_thread(cpuset, &tmp_err));
+    g_assert(!tmp_err);
+    cr_cpuset_free(cpuset);
+    g_free(str);
+}
+
+static void
+test_cr_repomd_record_compress_thread(void)
+{
+    GError *tmp_err = NULL;
+    GThreadPool *pool;
+    cr_RepomdRecordCompressTask *tasks[3];
+    cr_RepomdRecord *records[3], *crecords[3];
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+
+    g_assert(mkdtemp(tmpdir));
+
+    pool = g_thread_pool_new(cr_repomd_record_compress_thread, NULL, 3,
+                             FALSE, &tmp_err);
+    g_assert(pool);
+
+    for (int x = 0; x < 3; x++) {
+        gchar *name = g_strdup_printf("%s/file%d.xml", tmpdir, x);
+        g_assert(g_file_set_contents(name, "<metadata/>", -1, NULL));
+        records[x] = cr_repomd_record_new("foo", name);
+        crecords[x] = cr_repomd_record_new("foo_gz", NULL);
+        tasks[x] = cr_repomdrecordcompresstask_new(records[x], crecords[x],
+                                                   CR_CHECKSUM_SHA256,
+                                                   CR_CW_GZ_COMPRESSION,
+                                                   NULL, NULL);
+        g_thread_pool_push(pool, tasks[x], NULL);
+        g_free(name);
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (int x = 0; x < 3; x++) {
+        g_assert(!tasks[x]->err);
+        g_assert(records[x]->checksum);
+        g_assert(crecords[x]->checksum);
+        g_assert_cmpstr(crecords[x]->checksum_open, ==, records[x]->checksum);
+        g_assert(g_str_has_suffix(crecords[x]->location_real, ".xml.gz"));
+        g_assert(g_file_test(crecords[x]->location_real, G_FILE_TEST_IS_REGULAR));
+        cr_repomdrecordcompresstask_free(tasks[x], NULL);
+        cr_repomd_record_free(records[x]);
+        cr_repomd_record_free(crecords[x]);
+    }
+
+    cr_remove_dir(tmpdir, NULL);
+    g_free(tmpdir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/threads/test_cr_cpuset_from_str",
+                    test_cr_cpuset_from_str);
+    g_test_add_func("/threads/test_cr_cpuset_from_str_bad",
+                    test_cr_cpuset_from_str_bad);
+    g_test_add_func("/threads/test_cr_cpuset_bind_current_thread",
+                    test_cr_cpuset_bind_current_thread);
+    g_test_add_func("/threads/test_cr_repomd_record_compress_thread",
+            test_cr_repomd_record_compress_thread);
+
+    return g_test_run();
+}
@@ -0,0 +1,212 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "fixtures.h"
+#include "createrepo/checksum.h"
+#include "createrepo/error.h"
+#include "createrepo/misc.h"
+#include "createrepo/package.h"
+#include "createrepo/verify.h"
+
+static const char *test_pkgs[] = { "Archer-3.4.5-6.x86_64.rpm",
+                                   "fake_bash-1.1.1-1.x86_64.rpm",
+                                   "super_kernel-6.0.1-2.x86_64.rpm",
+                                   "Rimmer-1.0.2-2.x86_64.rpm" };
+
+static GSList *
+load_pkgs(void)
+{
+    GError *tmp_err = NULL;
+    GSList *pkgs = NULL;
+
+    for (size_t x = 0; x < G_N_ELEMENTS(test_pkgs); x++) {
+        gchar *path = g_build_filename(TEST_PACKAGES_PATH, test_pkgs[x],
+                                       NULL);
+        gchar *checksum = cr_checksum_file(path, CR_CHECKSUM_SHA256,
+                                           &tmp_err);
+        g_assert_no_error(tmp_err);
+        gchar *name = g_strndup(test_pkgs[x], strchr(test_pkgs[x], '-')
+                                              - test_pkgs[x]);
+        GStatBuf st;
+        g_assert_cmpint(g_stat(path, &st), ==, 0);
+
+        cr_Package *pkg = cr_package_new();
+        pkg->name          = cr_safe_string_chunk_insert(pkg->chunk, name);
+        pkg->location_href = cr_safe_string_chunk_insert(pkg->chunk,
+                                                         test_pkgs[x]);
+        pkg->checksum_type = cr_safe_string_chunk_insert(pkg->chunk,
+                                                         "sha256");
+        pkg->pkgId         = cr_safe_string_chunk_insert(pkg->chunk,
+                                                         checksum);
+        pkg->size_package  = st.st_size;
+        pkgs = g_slist_append(pkgs, pkg);
+
+        g_free(name);
+        g_free(checksum);
+        g_free(path);
+    }
+
+    return pkgs;
+}
+
+static void
+verify_cb(cr_Package *pkg,
+          const char *path,
+          cr_VerifyStatus status,
+          const char *message,
+          void *cbdata)
+{
+    GString *log = cbdata;
+
+    g_assert(g_str_has_suffix(path, pkg->location_href));
+    g_assert(status == CR_VERIFY_OK ? !message : message != NULL);
+    g_string_append_printf(log, "%s:%d ", pkg->name, status);
+}
+
+static void
+test_cr_verify_packages(void)
+{
+    GError *tmp_err = NULL;
+    GSList *pkgs = load_pkgs();
+    cr_VerifyOptions options = { 4, CR_CHECKSUM_IO_READ, FALSE };
+    GString *log = g_string_new(NULL);
+    gint ret;
+
+    ret = cr_verify_packages(pkgs, TEST_PACKAGES_PATH, &options, verify_cb,
+                             log, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpstr(log->str, ==, "Archer:0 fake_bash:0 super_kernel:0 "
+                                  "Rimmer:0 ");
+
+    // Break every package except of the first one in another way
+    cr_Package *pkg = g_slist_nth_data(pkgs, 1);
+    pkg->size_package++;
+    pkg = g_slist_nth_data(pkgs, 2);
+    pkg->pkgId = "0000000000000000000000000000000000000000000000000000000000000000";
+    pkg = g_slist_nth_data(pkgs, 3);
+    pkg->location_href = "nonexistent-1.0-1.x86_64.rpm";
+
+    g_string_truncate(log, 0);
+    ret = cr_verify_packages(pkgs, TEST_PACKAGES_PATH, &options, verify_cb,
+                             log, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, 3);
+    g_assert_cmpstr(log->str, ==, "Archer:0 fake_bash:2 super_kernel:3 "
+                                  "Rimmer:1 ");
+
+    // Only the sizes, the wrong checksum is not noticed
+    options.size_only = TRUE;
+    g_string_truncate(log, 0);
+    ret = cr_verify_packages(pkgs, TEST_PACKAGES_PATH, &options, verify_cb,
+                             log, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, 2);
+    g_assert_cmpstr(log->str, ==, "Archer:0 fake_bash:2 super_kernel:0 "
+                                  "Rimmer:1 ");
+
+    g_string_free(log, TRUE);
+    g_slist_free_full(pkgs, (GDestroyNotify) cr_package_free);
+}
+
+/** Create a repository with the repodata of the repo in the testdata
+ * and copies of its packages.
+ */
+static gchar *
+create_repo(const char *testrepo)
+{
+    GError *tmp_err = NULL;
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(tmpdir));
+
+    gchar *cwd = g_get_current_dir();
+    gchar *src = g_build_filename(cwd, testrepo, "repodata", NULL);
+    gchar *dst = g_build_filename(tmpdir, "repodata", NULL);
+    g_assert_cmpint(symlink(src, dst), ==, 0);
+    g_free(cwd);
+    g_free(src);
+    g_free(dst);
+
+    for (size_t x = 1; x < 3; x++) {
+        src = g_build_filename(TEST_PACKAGES_PATH, test_pkgs[x], NULL);
+        dst = g_build_filename(tmpdir, test_pkgs[x], NULL);
+        g_assert(cr_copy_file(src, dst, &tmp_err));
+        g_assert_no_error(tmp_err);
+        g_free(src);
+        g_free(dst);
+    }
+
+    return tmpdir;
+}
+
+static void
+test_cr_verify_repo(void)
+{
+    GError *tmp_err = NULL;
+    GString *log = g_string_new(NULL);
+    gchar *repo;
+    gint ret;
+
+    repo = create_repo(TEST_REPO_02);
+    ret = cr_verify_repo(repo, NULL, verify_cb, log, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpstr(log->str, ==, "fake_bash:0 super_kernel:0 ");
+    cr_remove_dir(repo, NULL);
+    g_free(repo);
+
+    // super_kernel of repo_01 was built from the same spec, it has
+    // the same size but another checksum
+    repo = create_repo(TEST_REPO_01);
+    g_string_truncate(log, 0);
+    ret = cr_verify_repo(repo, NULL, verify_cb, log, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, 1);
+    g_assert_cmpstr(log->str, ==, "super_kernel:3 ");
+    cr_remove_dir(repo, NULL);
+    g_free(repo);
+
+    // The packages of the repos in the testdata are elsewhere
+    g_string_truncate(log, 0);
+    ret = cr_verify_repo(TEST_REPO_01, NULL, verify_cb, log, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, 1);
+    g_assert_cmpstr(log->str, ==, "super_kernel:1 ");
+
+    g_string_free(log, TRUE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/verify/test_cr_verify_packages",
+                    test_cr_verify_packages);
+    g_test_add_func("/verify/test_cr_verify_repo",
+                    test_cr_verify_repo);
+
+    return g_test_run();
+}
@@ -2,11 +2,14 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "fixtures.h"
 #include "createrepo/error.h"
 #include "createrepo/package.h"
 #include "createrepo/misc.h"
+#include "createrepo/parsepkg.h"
 #include "createrepo/xml_dump.h"
+#include "createrepo/xml_dump_internal.h"
 
 // Tests
 
@@ -93,6 +96,273 @@ test_cr_GSList_of_cr_Dependency_contains_forbidden_control_chars_02(void)
     g_assert(!cr_GSList_of_cr_Dependency_contains_forbidden_control_chars(p->requires));
 }
 
+static void
+test_cr_hascontrollchars_long_strings(void)
+{
+    // Long strings are scanned by blocks, check all positions
+    // of the character in the block and behind it
+    for (int pos = 0; pos < 100; pos++) {
+        char str[101];
+        memset(str, 'a', 100);
+        str[100] = '\0';
+
+        g_assert(!cr_hascontrollchars((unsigned char *) str));
+        str[pos] = '\t';
+        g_assert(!cr_hascontrollchars((unsigned char *) str));
+        str[pos] = '\x01';
+        g_assert(cr_hascontrollchars((unsigned char *) str));
+        str[pos] = '\xc3';
+        g_assert(!cr_hascontrollchars((unsigned char *) str));
+    }
+}
+
+static void
+test_cr_xml_dump_other_long_strings(void)
+{
+    cr_Package *p = cr_package_new();
+    cr_ChangelogEntry *entry = cr_changelog_entry_new();
+    gchar *xml, *expected;
+
+    p->pkgId    = "0123456789abcdef0123456789abcdef0123456789abcdef";
+    p->name     = "package-with-a-long-name-which-is-longer-than-a-block";
+    p->arch     = "x86_64";
+    p->epoch    = "0";
+    p->version  = "1.0";
+    p->release  = "1";
+
+    entry->author       = "Author Name With A Long Name <author@example.com>";
+    entry->date         = 1;
+    entry->changelog    = "- a long changelog entry text which must be "
+                          "escaped after block boundaries: <&> "
+                          "and also some non-ASCII text: \xc3\xa9";
+    p->changelogs = g_slist_append(p->changelogs, entry);
+
+    xml = cr_xml_dump_other(p, NULL);
+    expected = g_strconcat(
+        "<package pkgid=\"", p->pkgId, "\" name=\"", p->name,
+        "\" arch=\"x86_64\">\n"
+        "  <version epoch=\"0\" ver=\"1.0\" rel=\"1\"/>\n"
+        "  <changelog author=\"Author Name With A Long Name "
+        "&lt;author@example.com&gt;\" date=\"1\">"
+        "- a long changelog entry text which must be "
+        "escaped after block boundaries: &lt;&amp;&gt; "
+        "and also some non-ASCII text: \xc3\xa9</changelog>\n"
+        "</package>\n", NULL);
+    g_assert_cmpstr(xml, ==, expected);
+
+    g_free(xml);
+    g_free(expected);
+    cr_package_free(p);
+}
+
+static cr_Package *
+get_package_with_special_chars(void)
+{
+    cr_Package *p = cr_package_new();
+    cr_ChangelogEntry *entry = cr_changelog_entry_new();
+    cr_PackageFile *file = cr_package_file_new();
+
+    p->pkgId    = "abc";
+    p->name     = "a<b&c";
+    p->arch     = "x86_64";
+    p->epoch    = "0";
+    p->version  = "1";
+    p->release  = "1\"";
+
+    entry->author       = "J\xc3\xa9r\xc3\xb4me <j@x>";
+    entry->date         = 123;
+    entry->changelog    = "- fix <bug> & \r\n";
+    p->changelogs = g_slist_append(p->changelogs, entry);
+
+    // Latin1 filename must be converted to UTF-8
+    file->type  = "dir";
+    file->path  = "/usr/share/";
+    file->name  = "caf\xe9";
+    p->files = g_slist_append(p->files, file);
+
+    return p;
+}
+
+static void
+test_cr_xml_dump_filelists_special_chars(void)
+{
+    cr_Package *p = get_package_with_special_chars();
+    char *xml = cr_xml_dump_filelists(p, NULL);
+    g_assert_cmpstr(xml, ==,
+        "<package pkgid=\"abc\" name=\"a&lt;b&amp;c\" arch=\"x86_64\">\n"
+        "  <version epoch=\"0\" ver=\"1\" rel=\"1&quot;\"/>\n"
+        "  <file type=\"dir\">/usr/share/caf\xc3\xa9</file>\n"
+        "</package>\n");
+    g_free(xml);
+    cr_package_free(p);
+}
+
+static void
+test_cr_xml_dump_other_special_chars(void)
+{
+    cr_Package *p = get_package_with_special_chars();
+    char *xml = cr_xml_dump_other(p, NULL);
+    // Non-ASCII chars in attributes are written as character references
+    g_assert_cmpstr(xml, ==,
+        "<package pkgid=\"abc\" name=\"a&lt;b&amp;c\" arch=\"x86_64\">\n"
+        "  <version epoch=\"0\" ver=\"1\" rel=\"1&quot;\"/>\n"
+        "  <changelog author=\"J&#xE9;r&#xF4;me &lt;j@x&gt;\" date=\"123\">"
+        "- fix &lt;bug&gt; &amp; &#13;\n</changelog>\n"
+        "</package>\n");
+    g_free(xml);
+    cr_package_free(p);
+}
+
+static void
+test_helper_dump_with_arena(const char *path)
+{
+    GError *tmp_err = NULL;
+    cr_Package *pkg, *apkg;
+    struct cr_XmlStruct res, ares;
+
+    pkg = cr_package_from_rpm(path, CR_CHECKSUM_SHA256, path, NULL, 10,
+                              NULL, CR_HDRR_NONE, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(pkg);
+    g_assert(!pkg->arena);
+
+    apkg = cr_package_from_rpm(path, CR_CHECKSUM_SHA256, path, NULL, 10,
+                               NULL, CR_HDRR_USEARENA, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(apkg);
+    g_assert(apkg->arena);
+    g_assert_cmpint(g_slist_length(apkg->files), ==,
+                    g_slist_length(pkg->files));
+    g_assert_cmpint(g_slist_length(apkg->requires), ==,
+                    g_slist_length(pkg->requires));
+
+    res = cr_xml_dump(pkg, &tmp_err);
+    g_assert_no_error(tmp_err);
+    ares = cr_xml_dump(apkg, &tmp_err);
+    g_assert_no_error(tmp_err);
+
+    g_assert_cmpstr(ares.primary, ==, res.primary);
+    g_assert_cmpstr(ares.filelists, ==, res.filelists);
+    g_assert_cmpstr(ares.other, ==, res.other);
+
+    g_free(res.primary);
+    g_free(res.filelists);
+    g_free(res.other);
+    g_free(ares.primary);
+    g_free(ares.filelists);
+    g_free(ares.other);
+    cr_package_free(pkg);
+    cr_package_free(apkg);
+}
+
+static void
+test_cr_xml_dump_package_with_arena(void)
+{
+    test_helper_dump_with_arena(TEST_PACKAGES_PATH"Archer-3.4.5-6.x86_64.rpm");
+    test_helper_dump_with_arena(TEST_PACKAGES_PATH"super_kernel-6.0.1-2.x86_64.rpm");
+    test_helper_dump_with_arena(TEST_PACKAGES_PATH"empty-0-0.x86_64.rpm");
+}
+
+static void
+test_helper_dump_fast_read(const char *path)
+{
+    GError *tmp_err = NULL;
+    cr_Package *pkg, *fpkg;
+    struct cr_XmlStruct res, fres;
+    int flags = CR_HDRR_LOADHDRID | CR_HDRR_LOADSIGNATURES;
+
+    pkg = cr_package_from_rpm(path, CR_CHECKSUM_SHA256, path, NULL, 10,
+                              NULL, flags, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(pkg);
+
+    fpkg = cr_package_from_rpm(path, CR_CHECKSUM_SHA256, path, NULL, 10,
+                               NULL, flags | CR_HDRR_FASTREAD, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(fpkg);
+
+    // Tags merged from the signature header
+    g_assert_cmpstr(fpkg->hdrid, ==, pkg->hdrid);
+    g_assert_cmpint(fpkg->size_archive, ==, pkg->size_archive);
+    g_assert_cmpint(!fpkg->siggpg, ==, !pkg->siggpg);
+    g_assert_cmpint(!fpkg->sigpgp, ==, !pkg->sigpgp);
+    g_assert_cmpint(fpkg->rpm_header_end, ==, pkg->rpm_header_end);
+
+    res = cr_xml_dump(pkg, &tmp_err);
+    g_assert_no_error(tmp_err);
+    fres = cr_xml_dump(fpkg, &tmp_err);
+    g_assert_no_error(tmp_err);
+
+    g_assert_cmpstr(fres.primary, ==, res.primary);
+    g_assert_cmpstr(fres.filelists, ==, res.filelists);
+    g_assert_cmpstr(fres.other, ==, res.other);
+
+    g_free(res.primary);
+    g_free(res.filelists);
+    g_free(res.other);
+    g_free(fres.primary);
+    g_free(fres.filelists);
+    g_free(fres.other);
+    cr_package_free(pkg);
+    cr_package_free(fpkg);
+}
+
+static void
+test_cr_xml_dump_package_fast_read(void)
+{
+    test_helper_dump_fast_read(TEST_PACKAGES_PATH"Archer-3.4.5-6.x86_64.rpm");
+    test_helper_dump_fast_read(TEST_PACKAGES_PATH"super_kernel-6.0.1-2.x86_64.rpm");
+    test_helper_dump_fast_read(TEST_PACKAGES_PATH"empty-0-0.x86_64.rpm");
+    // Doesn't have the RPMTAG_SOURCEPACKAGE - read by rpmReadPackageFile()
+    test_helper_dump_fast_read(TEST_PACKAGES_PATH"empty-0-0.src.rpm");
+}
+
+static void
+test_cr_xml_dump_to_buffers(void)
+{
+    GError *tmp_err = NULL;
+    const char *path = TEST_PACKAGES_PATH"Archer-3.4.5-6.x86_64.rpm";
+    cr_Package *pkg;
+    struct cr_XmlStruct res, pres;
+    cr_XmlBufferPool *pool = cr_xml_buffer_pool_new(3);
+    GString *bufs[3];
+
+    pkg = cr_package_from_rpm(path, CR_CHECKSUM_SHA256, path, NULL, 10,
+                              NULL, CR_HDRR_NONE, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(pkg);
+
+    res = cr_xml_dump(pkg, &tmp_err);
+    g_assert_no_error(tmp_err);
+
+    // The buffers returned into the pool are reused
+    for (int round = 0; round < 2; round++) {
+        GString *prev = round ? bufs[0] : NULL;
+
+        for (int x = 0; x < 3; x++)
+            bufs[x] = cr_xml_buffer_pool_get(pool);
+        if (prev)
+            g_assert(bufs[0] == prev || bufs[1] == prev || bufs[2] == prev);
+
+        pres = cr_xml_dump_to_buffers(pkg, bufs[0], bufs[1], bufs[2],
+                                      &tmp_err);
+        g_assert_no_error(tmp_err);
+        g_assert(pres.primary == bufs[0]->str);
+        g_assert_cmpstr(pres.primary, ==, res.primary);
+        g_assert_cmpstr(pres.filelists, ==, res.filelists);
+        g_assert_cmpstr(pres.other, ==, res.other);
+
+        for (int x = 0; x < 3; x++)
+            cr_xml_buffer_pool_put(pool, bufs[x]);
+    }
+
+    g_free(res.primary);
+    g_free(res.filelists);
+    g_free(res.other);
+    cr_package_free(pkg);
+    cr_xml_buffer_pool_free(pool);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -117,5 +387,19 @@ main(int argc, char *argv[])
                     test_cr_GSList_of_cr_Dependency_contains_forbidden_control_chars_01);
     g_test_add_func("/xml_dump/test_cr_GSList_of_cr_Dependency_contains_forbidden_control_chars_02",
                     test_cr_GSList_of_cr_Dependency_contains_forbidden_control_chars_02);
+    g_test_add_func("/xml_dump/test_cr_hascontrollchars_long_strings",
+                    test_cr_hascontrollchars_long_strings);
+    g_test_add_func("/xml_dump/test_cr_xml_dump_other_long_strings",
+                    test_cr_xml_dump_other_long_strings);
+    g_test_add_func("/xml_dump/test_cr_xml_dump_filelists_special_chars",
+                    test_cr_xml_dump_filelists_special_chars);
+    g_test_add_func("/xml_dump/test_cr_xml_dump_other_special_chars",
+                    test_cr_xml_dump_other_special_chars);
+    g_test_add_func("/xml_dump/test_cr_xml_dump_package_with_arena",
+                    test_cr_xml_dump_package_with_arena);
+    g_test_add_func("/xml_dump/test_cr_xml_dump_to_buffers",
+                    test_cr_xml_dump_to_buffers);
+    g_test_add_func("/xml_dump/test_cr_xml_dump_package_fast_read",
+                    test_cr_xml_dump_package_fast_read);
     return g_test_run();
 }
@@ -9,6 +9,23 @@
 
 #define IF_NULL_EMPTY(x) (x) ? x : ""
 
+// Empty element content and empty attribute value have no text node
+// after parsing
+#define NODE_CONTENT(node) \
+    ((node)->children ? (char *) (node)->children->content : "")
+
+static xmlNodePtr
+parse_dumped_xml(GString *buf)
+{
+    // The rpm namespace is intentionally not declared, so the element names
+    // stay the same as in the dumped xml ("rpm:entry", ...)
+    xmlDocPtr doc = xmlReadMemory(buf->str, buf->len, NULL, NULL,
+                                  XML_PARSE_NOBLANKS | XML_PARSE_NOERROR
+                                  | XML_PARSE_NOWARNING);
+    g_assert(doc);
+    return xmlDocGetRootElement(doc);
+}
+
 xmlNodePtr cmp_package_files_and_xml(GSList *files, xmlNodePtr current, int only_primary_files)
 {
     if (!current || !files) {
@@ -36,10 +53,10 @@ xmlNodePtr cmp_package_files_and_xml(GSList *files, xmlNodePtr current, int only
             continue;
         }
         g_assert_cmpstr((char *) current->name, ==, "file");
-        g_assert_cmpstr((char *) current->children->content, ==, fullname);
+        g_assert_cmpstr(NODE_CONTENT(current), ==, fullname);
         if (entry->type && entry->type[0] != '\0' && strcmp(entry->type, "file")) {
             g_assert_cmpstr((char *) current->properties->name, ==, "type");
-            g_assert_cmpstr((char *) current->properties->children->content, ==, IF_NULL_EMPTY(entry->type));
+            g_assert_cmpstr(NODE_CONTENT(current->properties), ==, IF_NULL_EMPTY(entry->type));
         }
     }
 
@@ -74,36 +91,36 @@ xmlNodePtr cmp_package_pco_and_xml(GSList *pco_list, xmlNodePtr current, PcoType
             xmlAttrPtr current_attrs;
             current_attrs = current->properties;
             g_assert_cmpstr((char *) current_attrs->name, ==, "name");
-            g_assert_cmpstr((char *) current_attrs->children->content, ==, item->name);
+            g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, item->name);
 
             if (item->flags && item->flags[0] != '\0') {
                 current_attrs = current_attrs->next;
                 g_assert_cmpstr((char *) current_attrs->name, ==, "flags");
-                g_assert_cmpstr((char *) current_attrs->children->content, ==, IF_NULL_EMPTY(item->flags));
+                g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, IF_NULL_EMPTY(item->flags));
 
                 if (item->epoch && item->epoch[0] != '\0') {
                     current_attrs = current_attrs->next;
                     g_assert_cmpstr((char *) current_attrs->name, ==, "epoch");
-                    g_assert_cmpstr((char *) current_attrs->children->content, ==, IF_NULL_EMPTY(item->epoch));
+                    g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, IF_NULL_EMPTY(item->epoch));
                 }
 
                 if (item->version && item->version[0] != '\0') {
                     current_attrs = current_attrs->next;
                     g_assert_cmpstr((char *) current_attrs->name, ==, "ver");
-                    g_assert_cmpstr((char *) current_attrs->children->content, ==, IF_NULL_EMPTY(item->version));
+                    g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, IF_NULL_EMPTY(item->version));
                 }
 
                 if (item->release && item->release[0] != '\0') {
                     current_attrs = current_attrs->next;
                     g_assert_cmpstr((char *) current_attrs->name, ==, "rel");
-                    g_assert_cmpstr((char *) current_attrs->children->content, ==, IF_NULL_EMPTY(item->release));
+                    g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, IF_NULL_EMPTY(item->release));
                 }
             }
 
             if (pcotype == PCO_TYPE_REQUIRES && item->pre) {
                 current_attrs = current_attrs->next;
                 g_assert_cmpstr((char *) current_attrs->name, ==, "pre");
-                g_assert_cmpstr((char *) current_attrs->children->content, ==, "1");
+                g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, "1");
             }
         }
     }
@@ -121,69 +138,69 @@ cmp_package_and_xml_node(cr_Package *pkg, xmlNodePtr node)
 
     current = node->children;
     g_assert_cmpstr((char *) current->name, ==, "name");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->name));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->name));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "arch");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->arch));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->arch));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "version");
     g_assert_cmpstr((char *) current->properties->name, ==, "epoch");
-    g_assert_cmpstr((char *) current->properties->children->content, ==, IF_NULL_EMPTY(pkg->epoch));
+    g_assert_cmpstr(NODE_CONTENT(current->properties), ==, IF_NULL_EMPTY(pkg->epoch));
     g_assert_cmpstr((char *) current->properties->next->name, ==, "ver");
-    g_assert_cmpstr((char *) current->properties->next->children->content, ==, IF_NULL_EMPTY(pkg->version));
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next), ==, IF_NULL_EMPTY(pkg->version));
     g_assert_cmpstr((char *) current->properties->next->next->name, ==, "rel");
-    g_assert_cmpstr((char *) current->properties->next->next->children->content, ==, IF_NULL_EMPTY(pkg->release));
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next->next), ==, IF_NULL_EMPTY(pkg->release));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "checksum");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->pkgId));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->pkgId));
     g_assert_cmpstr((char *) current->properties->name, ==, "type");
-    g_assert_cmpstr((char *) current->properties->children->content, ==, IF_NULL_EMPTY(pkg->checksum_type));
+    g_assert_cmpstr(NODE_CONTENT(current->properties), ==, IF_NULL_EMPTY(pkg->checksum_type));
     g_assert_cmpstr((char *) current->properties->next->name, ==, "pkgid");
-    g_assert_cmpstr((char *) current->properties->next->children->content, ==, "YES" );
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next), ==, "YES" );
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "summary");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->summary));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->summary));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "description");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->description));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->description));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "packager");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->rpm_packager));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->rpm_packager));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "url");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->url));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->url));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "time");
     g_assert_cmpstr((char *) current->properties->name, ==, "file");
     gchar *tmp = g_strdup_printf("%i", (gint32) pkg->time_file);
-    g_assert_cmpstr((char *) current->properties->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties), ==, tmp);
     g_free(tmp);
     g_assert_cmpstr((char *) current->properties->next->name, ==, "build");
     tmp = g_strdup_printf("%i", (gint32) pkg->time_build);
-    g_assert_cmpstr((char *) current->properties->next->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next), ==, tmp);
     g_free(tmp);
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "size");
     g_assert_cmpstr((char *) current->properties->name, ==, "package");
     tmp = g_strdup_printf("%i", (gint32) pkg->size_package);
-    g_assert_cmpstr((char *) current->properties->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties), ==, tmp);
     g_free(tmp);
     g_assert_cmpstr((char *) current->properties->next->name, ==, "installed");
     tmp = g_strdup_printf("%i", (gint32) pkg->size_installed);
-    g_assert_cmpstr((char *) current->properties->next->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next), ==, tmp);
     g_free(tmp);
     g_assert_cmpstr((char *) current->properties->next->next->name, ==, "archive");
     tmp = g_strdup_printf("%i", (gint32) pkg->size_archive);
-    g_assert_cmpstr((char *) current->properties->next->next->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next->next), ==, tmp);
     g_free(tmp);
 
     current = current->next;
@@ -194,41 +211,41 @@ cmp_package_and_xml_node(cr_Package *pkg, xmlNodePtr node)
         g_assert_cmpstr((char *) current_attrs->name, ==, "xml:base");
         gchar *location_base_with_protocol = NULL;
         location_base_with_protocol = cr_prepend_protocol(pkg->location_base);
-        g_assert_cmpstr((char *) current_attrs->children->content, ==, IF_NULL_EMPTY(location_base_with_protocol));
+        g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, IF_NULL_EMPTY(location_base_with_protocol));
         g_free(location_base_with_protocol);
         current_attrs = current_attrs->next;
     }
 
     g_assert_cmpstr((char *) current_attrs->name, ==, "href");
-    g_assert_cmpstr((char *) current_attrs->children->content, ==, IF_NULL_EMPTY(pkg->location_href));
+    g_assert_cmpstr(NODE_CONTENT(current_attrs), ==, IF_NULL_EMPTY(pkg->location_href));
 
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "format");
 
     current = current->children;
     g_assert_cmpstr((char *) current->name, ==, "rpm:license");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->rpm_license));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->rpm_license));
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "rpm:vendor");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->rpm_vendor));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->rpm_vendor));
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "rpm:group");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->rpm_group));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->rpm_group));
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "rpm:buildhost");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->rpm_buildhost));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->rpm_buildhost));
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "rpm:sourcerpm");
-    g_assert_cmpstr((char *) current->children->content, ==, IF_NULL_EMPTY(pkg->rpm_sourcerpm));
+    g_assert_cmpstr(NODE_CONTENT(current), ==, IF_NULL_EMPTY(pkg->rpm_sourcerpm));
     current = current->next;
     g_assert_cmpstr((char *) current->name, ==, "rpm:header-range");
     g_assert_cmpstr((char *) current->properties->name, ==, "start");
     tmp = g_strdup_printf("%i", (gint32) pkg->rpm_header_start);
-    g_assert_cmpstr((char *) current->properties->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties), ==, tmp);
     g_free(tmp);
     g_assert_cmpstr((char *) current->properties->next->name, ==, "end");
     tmp = g_strdup_printf("%i", (gint32) pkg->rpm_header_end);
-    g_assert_cmpstr((char *) current->properties->next->children->content, ==, tmp);
+    g_assert_cmpstr(NODE_CONTENT(current->properties->next), ==, tmp);
     g_free(tmp);
 
     current = current->next;
@@ -271,8 +288,11 @@ test_cr_xml_dump_primary_dump_pco_00(void)
     p->requires = (g_slist_prepend(p->requires, dep));
 
     xmlNodePtr node;
-    node = xmlNewNode(NULL, BAD_CAST "wrapper");
-    cr_xml_dump_primary_dump_pco(node, p, PCO_TYPE_REQUIRES);
+    GString *buf = g_string_new("<wrapper>");
+    cr_xml_dump_primary_dump_pco(buf, p, PCO_TYPE_REQUIRES);
+    g_string_append(buf, "</wrapper>");
+    node = parse_dumped_xml(buf);
+    g_string_free(buf, TRUE);
     node = node->children;
     node = cmp_package_pco_and_xml(p->requires, node, PCO_TYPE_REQUIRES);
 }
@@ -323,11 +343,14 @@ test_cr_xml_dump_primary_dump_pco_01(void)
     p->obsoletes = (g_slist_prepend(p->obsoletes, dep));
 
     xmlNodePtr node;
-    node = xmlNewNode(NULL, BAD_CAST "wrapper");
+    GString *buf = g_string_new("<wrapper>");
 
-    cr_xml_dump_primary_dump_pco(node, p, PCO_TYPE_REQUIRES);
-    cr_xml_dump_primary_dump_pco(node, p, PCO_TYPE_OBSOLETES);
+    cr_xml_dump_primary_dump_pco(buf, p, PCO_TYPE_REQUIRES);
+    cr_xml_dump_primary_dump_pco(buf, p, PCO_TYPE_OBSOLETES);
+    g_string_append(buf, "</wrapper>");
 
+    node = parse_dumped_xml(buf);
+    g_string_free(buf, TRUE);
     node = node->children;
     node = cmp_package_pco_and_xml(p->requires, node, PCO_TYPE_REQUIRES);
     node = cmp_package_pco_and_xml(p->obsoletes, node, PCO_TYPE_OBSOLETES);
@@ -336,15 +359,16 @@ test_cr_xml_dump_primary_dump_pco_01(void)
 static void
 test_cr_xml_dump_primary_base_items_00(void)
 {
-    xmlNodePtr node = xmlNewNode(NULL, BAD_CAST "package");
+    GString *buf = g_string_new(NULL);
     cr_Package *pkg = NULL;
 
     pkg = get_package();
 
     g_assert(pkg);
 
-    cr_xml_dump_primary_base_items(node, pkg);
-    cmp_package_and_xml_node(pkg, node);
+    cr_xml_dump_primary_base_items(buf, pkg);
+    cmp_package_and_xml_node(pkg, parse_dumped_xml(buf));
+    g_string_free(buf, TRUE);
 
     cr_package_free(pkg);
 }
@@ -352,7 +376,7 @@ test_cr_xml_dump_primary_base_items_00(void)
 static void
 test_cr_xml_dump_primary_base_items_01(void)
 {
-    xmlNodePtr node = xmlNewNode(NULL, BAD_CAST "package");
+    GString *buf = g_string_new(NULL);
     cr_Package *pkg = NULL;
 
     pkg = get_package();
@@ -360,8 +384,9 @@ test_cr_xml_dump_primary_base_items_01(void)
 
     g_assert(pkg);
 
-    cr_xml_dump_primary_base_items(node, pkg);
-    cmp_package_and_xml_node(pkg, node);
+    cr_xml_dump_primary_base_items(buf, pkg);
+    cmp_package_and_xml_node(pkg, parse_dumped_xml(buf));
+    g_string_free(buf, TRUE);
 
     cr_package_free(pkg);
 }
@@ -369,15 +394,16 @@ test_cr_xml_dump_primary_base_items_01(void)
 static void
 test_cr_xml_dump_primary_base_items_02(void)
 {
-    xmlNodePtr node = xmlNewNode(NULL, BAD_CAST "package");
+    GString *buf = g_string_new(NULL);
     cr_Package *pkg = NULL;
 
     pkg = get_empty_package();
 
     g_assert(pkg);
 
-    cr_xml_dump_primary_base_items(node, pkg);
-    cmp_package_and_xml_node(pkg, node);
+    cr_xml_dump_primary_base_items(buf, pkg);
+    cmp_package_and_xml_node(pkg, parse_dumped_xml(buf));
+    g_string_free(buf, TRUE);
 
     cr_package_free(pkg);
 }
@@ -23,11 +23,13 @@
 #include <glib/gstdio.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "fixtures.h"
 #include "createrepo/misc.h"
 #include "createrepo/xml_file.h"
 #include "createrepo/compression_wrapper.h"
+#include "createrepo/error.h"
 
 typedef struct {
     gchar *tmpdir;
@@ -139,6 +141,182 @@ test_rewrite_header_pacakge_count(TestFixtures *fixtures,
     g_free(path);
 }
 
+static void
+test_helper_rewrite_header_member(const char *path, cr_CompressionType type)
+{
+    cr_XmlFile *f;
+    cr_ContentStat *stat;
+    gchar *header, *old_content, *new_content, *expected;
+    gsize header_len, old_len, new_len;
+    gint64 old_member_len, new_member_len;
+    GString *body = g_string_new(NULL);
+    GString *content = g_string_new(NULL);
+    gchar buffer[4096];
+    CR_FILE *crf;
+    GError *err = NULL;
+    int ret;
+
+    for (int x = 0; x < 2000; x++)
+        g_string_append_printf(body, "<package>%d</package>\n", x);
+
+    f = cr_xmlfile_open_primary(path, type, &err);
+    g_assert(f);
+    cr_xmlfile_set_num_of_pkgs(f, 2001, &err);
+    cr_xmlfile_add_chunk(f, body->str, &err);
+    g_assert(!err);
+    cr_xmlfile_close(f, &err);
+    g_assert(!err);
+
+    // The header is compressed on its own
+    old_member_len = cr_read_first_member(path, type, 300, &header,
+                                          &header_len, &err);
+    g_assert(!err);
+    g_assert_cmpint(old_member_len, >, 0);
+    g_assert(g_strstr_len(header, header_len, "packages=\"2001\">\n"));
+    g_free(header);
+    g_assert(g_file_get_contents(path, &old_content, &old_len, NULL));
+
+    stat = cr_contentstat_new(CR_CHECKSUM_SHA256, &err);
+    cr_rewrite_header_package_count((gchar *) path, type, 2000, 2001,
+                                    stat, NULL, &err);
+    g_assert(!err);
+
+    // The rest of the compressed file was copied
+    new_member_len = cr_read_first_member(path, type, 300, &header,
+                                          &header_len, &err);
+    g_assert_cmpint(new_member_len, >, 0);
+    g_free(header);
+    g_assert(g_file_get_contents(path, &new_content, &new_len, NULL));
+    g_assert_cmpint(new_len - new_member_len, ==, old_len - old_member_len);
+    g_assert(!memcmp(new_content + new_member_len,
+                     old_content + old_member_len,
+                     new_len - new_member_len));
+    g_free(old_content);
+    g_free(new_content);
+
+    crf = cr_open(path, CR_CW_MODE_READ, CR_CW_AUTO_DETECT_COMPRESSION, &err);
+    g_assert(crf);
+    while ((ret = cr_read(crf, buffer, sizeof(buffer), &err)) > 0)
+        g_string_append_len(content, buffer, ret);
+    g_assert(!err);
+    cr_close(crf, NULL);
+
+    expected = g_strconcat("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<metadata xmlns=\"http://linux.duke.edu/metadata/common\" "
+            "xmlns:rpm=\"http://linux.duke.edu/metadata/rpm\" "
+            "packages=\"2000\">\n", body->str, "</metadata>", NULL);
+    g_assert_cmpstr(content->str, ==, expected);
+    g_assert_cmpint(stat->size, ==, content->len);
+    g_assert(stat->checksum);
+    g_free(expected);
+
+    cr_contentstat_free(stat, NULL);
+    g_string_free(body, TRUE);
+    g_string_free(content, TRUE);
+}
+
+static void
+test_rewrite_header_member(TestFixtures *fixtures,
+                           G_GNUC_UNUSED gconstpointer test_data)
+{
+    gchar *path;
+
+    path = g_build_filename(fixtures->tmpdir, "primary.xml.gz", NULL);
+    test_helper_rewrite_header_member(path, CR_CW_GZ_COMPRESSION);
+    g_remove(path);
+
+    // Threaded gzip writer
+    g_assert(cr_compression_set_threads(2, NULL));
+    test_helper_rewrite_header_member(path, CR_CW_GZ_COMPRESSION);
+    g_assert(cr_compression_set_threads(0, NULL));
+    g_free(path);
+
+#ifdef WITH_ZSTD
+    path = g_build_filename(fixtures->tmpdir, "primary.xml.zst", NULL);
+    test_helper_rewrite_header_member(path, CR_CW_ZSTD_COMPRESSION);
+    g_free(path);
+#endif // WITH_ZSTD
+}
+
+static void
+test_helper_deferred(const char *path, cr_CompressionType type)
+{
+    cr_XmlFile *f;
+    cr_ContentStat *stat, *read_stat;
+    gchar buffer[4096];
+    CR_FILE *crf;
+    GError *err = NULL;
+    int ret;
+
+    stat = cr_contentstat_new(CR_CHECKSUM_SHA256, &err);
+    f = cr_xmlfile_sopen_deferred(path, CR_XMLFILE_OTHER, type, stat, &err);
+    g_assert(f);
+    g_assert(!err);
+    g_assert_cmpint(cr_xmlfile_set_num_of_pkgs(f, 3, &err), ==, CRE_OK);
+    cr_xmlfile_add_chunk(f, "<package>a</package>\n", &err);
+    cr_xmlfile_add_chunk(f, "<package>b</package>\n", &err);
+    g_assert(!err);
+    // The header was already written
+    g_assert_cmpint(cr_xmlfile_set_num_of_pkgs(f, 2, &err), ==, CRE_OK);
+    g_assert_cmpint(cr_xmlfile_close(f, &err), ==, CRE_OK);
+    g_assert(!err);
+
+    read_stat = cr_contentstat_new(CR_CHECKSUM_SHA256, &err);
+    crf = cr_sopen(path, CR_CW_MODE_READ, CR_CW_AUTO_DETECT_COMPRESSION,
+                   read_stat, &err);
+    g_assert(crf);
+    ret = cr_read(crf, buffer, sizeof(buffer) - 1, &err);
+    g_assert_cmpint(ret, >, 0);
+    buffer[ret] = '\0';
+    g_assert_cmpint(cr_read(crf, buffer + ret, 1, &err), ==, 0);
+    cr_close(crf, &err);
+    g_assert(!err);
+    g_assert_cmpstr(buffer, ==, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<otherdata xmlns=\"http://linux.duke.edu/metadata/other\" "
+            "packages=\"2\">\n"
+            "<package>a</package>\n<package>b</package>\n</otherdata>");
+
+    // Stats are of the corrected content
+    g_assert_cmpint(stat->size, ==, read_stat->size);
+    g_assert_cmpstr(stat->checksum, ==, read_stat->checksum);
+
+    cr_contentstat_free(stat, NULL);
+    cr_contentstat_free(read_stat, NULL);
+}
+
+static void
+test_deferred_header(TestFixtures *fixtures,
+                     G_GNUC_UNUSED gconstpointer test_data)
+{
+    gchar *path;
+    cr_XmlFile *f;
+    GError *err = NULL;
+
+    path = g_build_filename(fixtures->tmpdir, "other.xml", NULL);
+    test_helper_deferred(path, CR_CW_NO_COMPRESSION);
+    g_free(path);
+
+    path = g_build_filename(fixtures->tmpdir, "other.xml.gz", NULL);
+    test_helper_deferred(path, CR_CW_GZ_COMPRESSION);
+    g_free(path);
+
+#ifdef WITH_ZSTD
+    path = g_build_filename(fixtures->tmpdir, "other.xml.zst", NULL);
+    test_helper_deferred(path, CR_CW_ZSTD_COMPRESSION);
+    g_free(path);
+#endif // WITH_ZSTD
+
+    // The header of xz cannot be replaced alone
+    path = g_build_filename(fixtures->tmpdir, "other.xml.xz", NULL);
+    g_assert(!cr_xmlfile_deferred_supported(CR_CW_XZ_COMPRESSION));
+    f = cr_xmlfile_sopen_deferred(path, CR_XMLFILE_OTHER,
+                                  CR_CW_XZ_COMPRESSION, NULL, &err);
+    g_assert(!f);
+    g_assert_cmpint(err->code, ==, CRE_BADARG);
+    g_clear_error(&err);
+    g_free(path);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -147,6 +325,10 @@ main(int argc, char *argv[])
     g_test_add("/xml_file/test_no_packages", TestFixtures, NULL, fixtures_setup, test_no_packages, fixtures_teardown);
     g_test_add("/xml_file/test_write_modified_header", TestFixtures, NULL,
             fixtures_setup, test_rewrite_header_pacakge_count, fixtures_teardown);
+    g_test_add("/xml_file/test_rewrite_header_member", TestFixtures, NULL,
+            fixtures_setup, test_rewrite_header_member, fixtures_teardown);
+    g_test_add("/xml_file/test_deferred_header", TestFixtures, NULL,
+            fixtures_setup, test_deferred_header, fixtures_teardown);
 
     return g_test_run();
 }
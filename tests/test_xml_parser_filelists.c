@@ -20,6 +20,7 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include "fixtures.h"
 #include "createrepo/error.h"
 #include "createrepo/package.h"
@@ -135,6 +136,80 @@ warningcb_interrupt(G_GNUC_UNUSED cr_XmlParserWarningType type,
     return CR_CB_RET_ERR;
 }
 
+static int
+pkgcb_check_order(cr_Package *pkg, void *cbdata, GError **err)
+{
+    g_assert(pkg);
+    g_assert(!err || *err == NULL);
+
+    int *parsed = cbdata;
+    gchar *name = g_strdup_printf("pkg%d", *parsed);
+    g_assert_cmpstr(pkg->name, ==, name);
+    g_free(name);
+    g_assert_cmpstr(pkg->version, ==, "1.0");
+    g_assert_cmpint(g_slist_length(pkg->files), ==, 3);
+    cr_PackageFile *file = pkg->files->data;
+    g_assert_cmpstr(file->name, ==, "a");
+    g_assert(!file->type);
+    file = g_slist_last(pkg->files)->data;
+    g_assert_cmpstr(file->name, ==, "c");
+    g_assert_cmpstr(file->type, ==, "dir");
+
+    *parsed += 1;
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+static int
+pkgcb_dump(cr_Package *pkg, void *cbdata, GError **err)
+{
+    GString *dump = cbdata;
+
+    g_assert(pkg);
+    g_assert(!err || *err == NULL);
+
+    g_string_append_printf(dump, "%s %s %s %s:%s-%s\n", pkg->pkgId,
+                           pkg->name, pkg->arch, pkg->epoch,
+                           pkg->version, pkg->release);
+    for (GSList *elem = pkg->files; elem; elem = g_slist_next(elem)) {
+        cr_PackageFile *file = elem->data;
+        g_string_append_printf(dump, "  %s %s|%s\n", file->type,
+                               file->path, file->name);
+    }
+
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+/** Check that the fast scanner gives the same results as libxml2 */
+static void
+compare_fast_parser(const char *path)
+{
+    GString *dump = g_string_new(NULL);
+    GString *fast_dump = g_string_new(NULL);
+    GString *warnmsgs = g_string_new(NULL);
+    GString *fast_warnmsgs = g_string_new(NULL);
+    GError *tmp_err = NULL, *fast_err = NULL;
+
+    int ret = cr_xml_parse_filelists(path, NULL, NULL, pkgcb_dump, dump,
+                                     warningcb, warnmsgs, &tmp_err);
+    int fast_ret = cr_xml_parse_filelists_fast(path, NULL, NULL,
+                                               pkgcb_dump, fast_dump,
+                                               warningcb, fast_warnmsgs,
+                                               &fast_err);
+    g_assert_cmpint(fast_ret, ==, ret);
+    g_assert_cmpstr(fast_dump->str, ==, dump->str);
+    g_assert_cmpstr(fast_warnmsgs->str, ==, warnmsgs->str);
+    g_assert(!fast_err == !tmp_err);
+
+    g_clear_error(&tmp_err);
+    g_clear_error(&fast_err);
+    g_string_free(dump, TRUE);
+    g_string_free(fast_dump, TRUE);
+    g_string_free(warnmsgs, TRUE);
+    g_string_free(fast_warnmsgs, TRUE);
+}
+
 // Tests
 
 static void
@@ -338,6 +413,202 @@ test_cr_xml_parse_different_md_type(void)
     g_free(warnmsgs);
 }
 
+static void
+test_cr_xml_parse_filelists_threaded_skip_fake_bash(void)
+{
+    int parsed = 0;
+    GError *tmp_err = NULL;
+    int ret = cr_xml_parse_filelists_threaded(TEST_MRF_UE_FIL_00,
+                                              newpkgcb_skip_fake_bash, NULL,
+                                              pkgcb, &parsed, NULL, NULL,
+                                              4, &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(parsed, ==, 1);
+}
+
+static void
+test_cr_xml_parse_filelists_threaded_split(void)
+{
+    int parsed = 0;
+    int packages = 40000;
+    GError *tmp_err = NULL;
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(tmpdir));
+    gchar *path = g_build_filename(tmpdir, "filelists.xml", NULL);
+
+    // Big enough to be parsed in more parts
+    GString *xml = g_string_new("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<filelists xmlns=\"http://linux.duke.edu/metadata/filelists\">\n");
+    for (int x = 0; x < packages; x++)
+        g_string_append_printf(xml,
+            "<package pkgid=\"%064d\" name=\"pkg%d\" arch=\"x86_64\">\n"
+            "  <version epoch=\"0\" ver=\"1.0\" rel=\"1\"/>\n"
+            "  <file>/usr/share/pkg%d/a</file>\n"
+            "  <file>/usr/share/pkg%d/b</file>\n"
+            "  <file type=\"dir\">/usr/share/pkg%d/c</file>\n"
+            "</package>\n", x, x, x, x, x);
+    g_string_append(xml, "</filelists>\n");
+    g_assert(g_file_set_contents(path, xml->str, xml->len, NULL));
+    g_string_free(xml, TRUE);
+
+    int ret = cr_xml_parse_filelists_threaded(path, NULL, NULL,
+                                              pkgcb_check_order, &parsed,
+                                              NULL, NULL, 4, &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(parsed, ==, packages);
+
+    parsed = 0;
+    ret = cr_xml_parse_filelists_threaded(path, NULL, NULL,
+                                          pkgcb_interrupt, &parsed,
+                                          NULL, NULL, 4, &tmp_err);
+    g_assert(tmp_err != NULL);
+    g_error_free(tmp_err);
+    g_assert_cmpint(ret, ==, CRE_CBINTERRUPTED);
+    g_assert_cmpint(parsed, ==, 1);
+
+    cr_remove_dir(tmpdir, NULL);
+    g_free(path);
+    g_free(tmpdir);
+}
+
+static void
+test_cr_xml_parse_filelists_fast_00(void)
+{
+    int parsed = 0;
+    GError *tmp_err = NULL;
+    int ret = cr_xml_parse_filelists_fast(TEST_REPO_02_FILELISTS, NULL, NULL,
+                                          pkgcb, &parsed, NULL, NULL,
+                                          &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(parsed, ==, 2);
+
+    compare_fast_parser(TEST_REPO_00_FILELISTS);
+    compare_fast_parser(TEST_REPO_01_FILELISTS);
+    compare_fast_parser(TEST_REPO_02_FILELISTS);
+}
+
+static void
+test_cr_xml_parse_filelists_fast_fallback(void)
+{
+    int parsed = 0;
+    GError *tmp_err = NULL;
+
+    compare_fast_parser(TEST_MRF_UE_FIL_00);
+    compare_fast_parser(TEST_MRF_UE_FIL_01);
+    compare_fast_parser(TEST_MRF_UE_FIL_02);
+    compare_fast_parser(TEST_MRF_BAD_TYPE_FIL);
+
+    int ret = cr_xml_parse_filelists_fast(TEST_MRF_UE_FIL_00,
+                                          newpkgcb_skip_fake_bash, NULL,
+                                          pkgcb, &parsed, NULL, NULL,
+                                          &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(parsed, ==, 1);
+
+    ret = cr_xml_parse_filelists_fast(TEST_MRF_NO_PKGID_FIL, NULL, NULL,
+                                      pkgcb, NULL, NULL, NULL, &tmp_err);
+    g_assert(tmp_err != NULL);
+    g_error_free(tmp_err);
+    g_assert_cmpint(ret, ==, CRE_BADXMLFILELISTS);
+}
+
+static void
+test_cr_xml_parse_filelists_fast_escaping(void)
+{
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(tmpdir));
+    gchar *path = g_build_filename(tmpdir, "filelists.xml", NULL);
+
+    const char *xml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!-- comment -->\n"
+        "<filelists xmlns=\"http://linux.duke.edu/metadata/filelists\" packages=\"4\">\n"
+        "<package pkgid=\"a1\" name='a&amp;b' arch=\"noarch\">\n"
+        "  <version epoch=\"0\" ver=\"1\" rel=\"2\"/>\n"
+        "  <file>/usr/bin/a&lt;&#62;&#x263A;</file>\n"
+        "  <file type=\"ghost\">/var/log/\xc5\xbe.log</file>\n"
+        "  <file type=\"dir\">/etc/a</file>\n"
+        "</package>\n"
+        "<package pkgid=\"b1\" name=\"b\" arch=\"x86_64\">\n"
+        "  <version epoch=\"1\" ver=\"2\" rel=\"3\"></version>\n"
+        "  <!-- parsed by libxml2 -->\n"
+        "  <file>/bin/b</file>\n"
+        "</package>\n"
+        "<package pkgid=\"c1\" name=\"c\" arch=\"x86_64\">\n"
+        "  <version epoch=\"0\" ver=\"3\" rel=\"4\"/>\n"
+        "  <file><![CDATA[/bin/c]]></file>\n"
+        "</package>\n"
+        "<package pkgid=\"d1\" name=\"d\" arch=\"x86_64\"/>\n"
+        "</filelists>\n";
+    g_assert(g_file_set_contents(path, xml, -1, NULL));
+    compare_fast_parser(path);
+
+    cr_remove_dir(tmpdir, NULL);
+    g_free(path);
+    g_free(tmpdir);
+}
+
+static void
+test_cr_xml_parse_filelists_fast_skip(void)
+{
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    g_assert(mkdtemp(tmpdir));
+    gchar *path = g_build_filename(tmpdir, "filelists.xml", NULL);
+    GString *dump = g_string_new(NULL);
+    GString *fast_dump = g_string_new(NULL);
+    GError *tmp_err = NULL;
+    int ret;
+
+    // Content of the skipped packages is not scanned at all,
+    // the content of d1 is parsed by libxml2
+    const char *xml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<filelists xmlns=\"http://linux.duke.edu/metadata/filelists\" packages=\"4\">\n"
+        "<package pkgid=\"a1\" name=\"fake_bash\" arch=\"noarch\">\n"
+        "  <version epoch=\"0\" ver=\"1\" rel=\"2\"/>\n"
+        "  <file type=\"unknown\">/usr/bin/a&lt;</file>\n"
+        "</package>\n"
+        "<package pkgid=\"b1\" name=\"b\" arch=\"x86_64\">\n"
+        "  <version epoch=\"1\" ver=\"2\" rel=\"3\"/>\n"
+        "  <file type=\"dir\">/etc/b</file>\n"
+        "  <file>/bin/b</file>\n"
+        "</package>\n"
+        "<package pkgid=\"c1\" name=\"fake_bash\" arch=\"x86_64\"/>\n"
+        "<package pkgid=\"d1\" name=\"d\" arch=\"x86_64\">\n"
+        "  <version epoch=\"0\" ver=\"3\" rel=\"4\"/>\n"
+        "  <unknown/>\n"
+        "  <file>/bin/d</file>\n"
+        "</package>\n"
+        "</filelists>\n";
+    g_assert(g_file_set_contents(path, xml, -1, NULL));
+
+    ret = cr_xml_parse_filelists(path, newpkgcb_skip_fake_bash, NULL,
+                                 pkgcb_dump, dump, NULL, NULL, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    ret = cr_xml_parse_filelists_fast(path, newpkgcb_skip_fake_bash, NULL,
+                                      pkgcb_dump, fast_dump, NULL, NULL,
+                                      &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpstr(fast_dump->str, ==, dump->str);
+    g_assert_cmpstr(fast_dump->str, ==, "b1 b x86_64 1:2-3\n"
+                                        "  dir /etc/|b\n"
+                                        "  (null) /bin/|b\n"
+                                        "d1 d x86_64 0:3-4\n"
+                                        "  (null) /bin/|d\n");
+
+    cr_remove_dir(tmpdir, NULL);
+    g_string_free(dump, TRUE);
+    g_string_free(fast_dump, TRUE);
+    g_free(path);
+    g_free(tmpdir);
+}
+
 static void
 test_cr_xml_parse_filelists_snippet_snippet_01(void)
 {
@@ -403,5 +674,19 @@ main(int argc, char *argv[])
                     test_cr_xml_parse_filelists_snippet_snippet_01);
     g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_snippet_snippet_02",
                     test_cr_xml_parse_filelists_snippet_snippet_02);
+    g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_threaded_skip_fake_bash",
+                    test_cr_xml_parse_filelists_threaded_skip_fake_bash);
+    g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_threaded_split",
+                    test_cr_xml_parse_filelists_threaded_split);
+
+    g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_fast_00",
+                    test_cr_xml_parse_filelists_fast_00);
+    g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_fast_fallback",
+                    test_cr_xml_parse_filelists_fast_fallback);
+    g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_fast_escaping",
+                    test_cr_xml_parse_filelists_fast_escaping);
+    g_test_add_func("/xml_parser_filelists/test_cr_xml_parse_filelists_fast_skip",
+                    test_cr_xml_parse_filelists_fast_skip);
+
     return g_test_run();
 }
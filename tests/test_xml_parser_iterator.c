@@ -0,0 +1,137 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/load_metadata.h"
+#include "createrepo/package.h"
+#include "createrepo/xml_parser.h"
+
+static void
+test_cr_pkg_iterator_repo02(void)
+{
+    cr_Metadata *md = cr_metadata_new(CR_HT_KEY_HASH, 0, NULL);
+    cr_PkgIterator *iter;
+    cr_Package *pkg;
+    GError *tmp_err = NULL;
+    guint count = 0;
+
+    // The iterator returns the same packages as the cr_Metadata loads
+    g_assert_cmpint(cr_metadata_locate_and_load_xml(md, TEST_REPO_02, NULL),
+                    ==, CRE_OK);
+
+    iter = cr_pkg_iterator_new(TEST_REPO_02_PRIMARY,
+                               TEST_REPO_02_FILELISTS,
+                               TEST_REPO_02_OTHER,
+                               NULL, NULL, &tmp_err);
+    g_assert(iter);
+    g_assert(!tmp_err);
+
+    while ((pkg = cr_pkg_iterator_next(iter, &tmp_err))) {
+        cr_Package *loaded = g_hash_table_lookup(cr_metadata_hashtable(md),
+                                                 pkg->pkgId);
+        g_assert(loaded);
+        g_assert_cmpstr(pkg->name, ==, loaded->name);
+        g_assert_cmpint(g_slist_length(pkg->files), ==,
+                        g_slist_length(loaded->files));
+        g_assert_cmpint(g_slist_length(pkg->changelogs), ==,
+                        g_slist_length(loaded->changelogs));
+        g_assert(pkg->loadingflags & CR_PACKAGE_LOADED_FIL);
+        g_assert(pkg->loadingflags & CR_PACKAGE_LOADED_OTH);
+        cr_package_free(pkg);
+        count++;
+    }
+
+    g_assert(!tmp_err);
+    g_assert(cr_pkg_iterator_is_finished(iter));
+    g_assert(!cr_pkg_iterator_next(iter, &tmp_err));
+    g_assert(!tmp_err);
+    g_assert_cmpint(count, ==, g_hash_table_size(cr_metadata_hashtable(md)));
+
+    cr_pkg_iterator_free(iter);
+    cr_metadata_free(md);
+}
+
+static void
+test_cr_pkg_iterator_primary_only(void)
+{
+    cr_PkgIterator *iter;
+    cr_Package *pkg;
+    GError *tmp_err = NULL;
+
+    // Without the filelists.xml the files come from the primary.xml
+    iter = cr_pkg_iterator_new(TEST_REPO_02_PRIMARY, NULL, NULL,
+                               NULL, NULL, &tmp_err);
+    g_assert(iter);
+
+    pkg = cr_pkg_iterator_next(iter, &tmp_err);
+    g_assert(pkg);
+    g_assert(!tmp_err);
+    g_assert(pkg->files);
+    g_assert(!pkg->changelogs);
+    g_assert(!(pkg->loadingflags & CR_PACKAGE_LOADED_FIL));
+    cr_package_free(pkg);
+
+    // The rest of the packages are dropped with the iterator
+    g_assert(!cr_pkg_iterator_is_finished(iter));
+    cr_pkg_iterator_free(iter);
+}
+
+static void
+test_cr_pkg_iterator_errors(void)
+{
+    cr_PkgIterator *iter;
+    GError *tmp_err = NULL;
+
+    iter = cr_pkg_iterator_new(TEST_REPO_02_PRIMARY, "/non/existing/file",
+                               NULL, NULL, NULL, &tmp_err);
+    g_assert(!iter);
+    g_assert_cmpint(tmp_err->code, ==, CRE_NOFILE);
+    g_clear_error(&tmp_err);
+
+    // The filelists.xml fails on its first package
+    iter = cr_pkg_iterator_new(TEST_REPO_02_PRIMARY,
+                               TEST_MODIFIED_REPO_FILES_PATH"error_00-filelists.xml",
+                               TEST_REPO_02_OTHER, NULL, NULL, &tmp_err);
+    g_assert(iter);
+    g_assert(!cr_pkg_iterator_next(iter, &tmp_err));
+    g_assert(tmp_err);
+    g_assert(g_str_has_prefix(tmp_err->message, "filelists.xml parsing: "));
+    g_clear_error(&tmp_err);
+    g_assert(cr_pkg_iterator_is_finished(iter));
+    cr_pkg_iterator_free(iter);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/xml_parser_iterator/test_cr_pkg_iterator_repo02",
+                    test_cr_pkg_iterator_repo02);
+    g_test_add_func("/xml_parser_iterator/test_cr_pkg_iterator_primary_only",
+                    test_cr_pkg_iterator_primary_only);
+    g_test_add_func("/xml_parser_iterator/test_cr_pkg_iterator_errors",
+                    test_cr_pkg_iterator_errors);
+
+    return g_test_run();
+}
@@ -23,6 +23,8 @@
 #include "fixtures.h"
 #include "createrepo/error.h"
 #include "createrepo/misc.h"
+#include "createrepo/xml_dump.h"
+#include "createrepo/xml_file.h"
 #include "createrepo/xml_parser.h"
 #include "createrepo/updateinfo.h"
 
@@ -269,6 +271,200 @@ test_cr_xml_parse_updateinfo_03(void)
     cr_updateinfo_free(ui);
 }
 
+static int
+write_record_cb(cr_UpdateRecord *rec, void *cbdata, GError **err)
+{
+    int ret = cr_xmlfile_add_updaterecord(cbdata, rec, err);
+    cr_updaterecord_free(rec);
+    return ret == CRE_OK ? CR_CB_RET_OK : CR_CB_RET_ERR;
+}
+
+static int
+collect_record_cb(cr_UpdateRecord *rec,
+                  void *cbdata,
+                  G_GNUC_UNUSED GError **err)
+{
+    cr_updateinfo_apped_record(cbdata, rec);
+    return CR_CB_RET_OK;
+}
+
+static int
+interrupt_record_cb(cr_UpdateRecord *rec,
+                    void *cbdata,
+                    G_GNUC_UNUSED GError **err)
+{
+    int *count = cbdata;
+    cr_updaterecord_free(rec);
+    return ++(*count) == 2 ? CR_CB_RET_ERR : CR_CB_RET_OK;
+}
+
+static void
+test_cr_xml_parse_updateinfo_records(void)
+{
+    GError *tmp_err = NULL;
+    cr_UpdateInfo *ui = cr_updateinfo_new();
+    cr_UpdateInfo *streamed = cr_updateinfo_new();
+    cr_XmlFile *f;
+    gchar *tmpdir = g_strdup(TMPDIR_TEMPLATE);
+    gchar *path;
+    int count = 0;
+
+    g_assert_cmpint(cr_xml_parse_updateinfo(TEST_UPDATEINFO_03, ui,
+                                            NULL, NULL, &tmp_err),
+                    ==, CRE_OK);
+
+    // Just copy the records into a new updateinfo.xml
+    g_assert(mkdtemp(tmpdir));
+    path = g_build_filename(tmpdir, "updateinfo.xml", NULL);
+    f = cr_xmlfile_sopen_updateinfo(path, CR_CW_NO_COMPRESSION, NULL, &tmp_err);
+    g_assert(f);
+    int ret = cr_xml_parse_updateinfo_records(TEST_UPDATEINFO_03,
+                                              write_record_cb, f,
+                                              NULL, NULL, &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(cr_xmlfile_close(f, &tmp_err), ==, CRE_OK);
+
+    // The copy has the same records as the original
+    ret = cr_xml_parse_updateinfo_records(path, collect_record_cb, streamed,
+                                          NULL, NULL, &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(g_slist_length(streamed->updates), ==,
+                    g_slist_length(ui->updates));
+    g_assert_cmpint(g_slist_length(ui->updates), >, 1);
+    for (GSList *e1 = ui->updates, *e2 = streamed->updates;
+         e1 && e2;
+         e1 = g_slist_next(e1), e2 = g_slist_next(e2))
+    {
+        gchar *xml1 = cr_xml_dump_updaterecord(e1->data, NULL);
+        gchar *xml2 = cr_xml_dump_updaterecord(e2->data, NULL);
+        g_assert_cmpstr(xml1, ==, xml2);
+        g_free(xml1);
+        g_free(xml2);
+    }
+
+    // The callback stops the parsing
+    ret = cr_xml_parse_updateinfo_records(TEST_UPDATEINFO_03,
+                                          interrupt_record_cb, &count,
+                                          NULL, NULL, &tmp_err);
+    g_assert_cmpint(ret, ==, CRE_CBINTERRUPTED);
+    g_assert_cmpint(tmp_err->code, ==, CRE_CBINTERRUPTED);
+    g_assert_cmpint(count, ==, 2);
+    g_clear_error(&tmp_err);
+
+    cr_remove_dir(tmpdir, NULL);
+    g_free(tmpdir);
+    g_free(path);
+    cr_updateinfo_free(streamed);
+    cr_updateinfo_free(ui);
+}
+
+static void
+test_cr_updateinfo_index(void)
+{
+    GError *tmp_err = NULL;
+    cr_UpdateInfo *ui = cr_updateinfo_new();
+    cr_UpdateRecord *rec;
+    cr_UpdateCollection *col;
+    cr_UpdateCollectionPackage *pkg;
+    GPtrArray *records;
+
+    int ret = cr_xml_parse_updateinfo(TEST_UPDATEINFO_03, ui,
+                                      NULL, NULL, &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+
+    rec = cr_updateinfo_get_record(ui, "RHEA-2012:0057");
+    g_assert(rec);
+    g_assert_cmpstr(rec->id, ==, "RHEA-2012:0057");
+    g_assert(!cr_updateinfo_get_record(ui, "RHEA-2012:0000"));
+
+    records = cr_updateinfo_get_records_by_package(ui, "duck", NULL, NULL,
+                                                   NULL, NULL);
+    g_assert(records);
+    g_assert_cmpint(records->len, ==, 3);
+    g_assert_cmpstr(((cr_UpdateRecord *) records->pdata[0])->id, ==,
+                    "RHEA-2012:0056");
+    g_assert_cmpstr(((cr_UpdateRecord *) records->pdata[2])->id, ==,
+                    "RHEA-2012:0060");
+
+    records = cr_updateinfo_get_records_by_package(ui, "duck", "0", "0.7",
+                                                   "1", "noarch");
+    g_assert(records);
+    g_assert_cmpint(records->len, ==, 1);
+    g_assert_cmpstr(((cr_UpdateRecord *) records->pdata[0])->id, ==,
+                    "RHEA-2012:0059");
+    g_assert(!cr_updateinfo_get_records_by_package(ui, "duck", NULL, "0.7",
+                                                   "1", "x86_64"));
+    g_assert(!cr_updateinfo_get_records_by_package(ui, "cat", NULL, NULL,
+                                                   NULL, NULL));
+
+    // Appended records are added to the built index
+    rec = cr_updaterecord_new();
+    rec->id = g_string_chunk_insert(rec->chunk, "RHEA-2012:0061");
+    col = cr_updatecollection_new();
+    pkg = cr_updatecollectionpackage_new();
+    pkg->name = g_string_chunk_insert(pkg->chunk, "duck");
+    cr_updatecollection_append_package(col, pkg);
+    cr_updaterecord_append_collection(rec, col);
+    cr_updateinfo_apped_record(ui, rec);
+
+    g_assert(cr_updateinfo_get_record(ui, "RHEA-2012:0061") == rec);
+    records = cr_updateinfo_get_records_by_package(ui, "duck", NULL, NULL,
+                                                   NULL, NULL);
+    g_assert_cmpint(records->len, ==, 4);
+
+    cr_updateinfo_free(ui);
+}
+
+static void
+test_cr_updaterecord_copy(void)
+{
+    GError *tmp_err = NULL;
+    cr_UpdateInfo *ui = cr_updateinfo_new();
+    GSList *copies = NULL, *xmls = NULL;
+
+    int ret = cr_xml_parse_updateinfo(TEST_UPDATEINFO_03, ui,
+                                      NULL, NULL, &tmp_err);
+    g_assert(tmp_err == NULL);
+    g_assert_cmpint(ret, ==, CRE_OK);
+
+    for (GSList *elem = ui->updates; elem; elem = g_slist_next(elem)) {
+        cr_UpdateRecord *rec = elem->data;
+        cr_UpdateRecord *copy = cr_updaterecord_copy(rec);
+
+        // The parsed and the copied records keep all the strings
+        // of their collections in their own chunk
+        for (GSList *c = rec->collections; c; c = g_slist_next(c))
+            g_assert(((cr_UpdateCollection *) c->data)->chunk == rec->chunk);
+        for (GSList *c = copy->collections; c; c = g_slist_next(c)) {
+            cr_UpdateCollection *col = c->data;
+            g_assert(col->chunk == copy->chunk);
+            if (col->packages)
+                g_assert(((cr_UpdateCollectionPackage *)
+                          col->packages->data)->chunk == copy->chunk);
+        }
+
+        copies = g_slist_prepend(copies, copy);
+        xmls = g_slist_prepend(xmls, cr_xml_dump_updaterecord(rec, NULL));
+    }
+
+    // The copies don't depend on the original records
+    cr_updateinfo_free(ui);
+
+    for (GSList *c = copies, *x = xmls; c && x;
+         c = g_slist_next(c), x = g_slist_next(x))
+    {
+        gchar *xml = cr_xml_dump_updaterecord(c->data, NULL);
+        g_assert_cmpstr(xml, ==, x->data);
+        g_free(xml);
+    }
+
+    g_slist_free_full(copies, (GDestroyNotify) cr_updaterecord_free);
+    g_slist_free_full(xmls, g_free);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -282,6 +478,12 @@ main(int argc, char *argv[])
                     test_cr_xml_parse_updateinfo_02);
     g_test_add_func("/xml_parser_updateinfo/test_cr_xml_parse_updateinfo_03",
                     test_cr_xml_parse_updateinfo_03);
+    g_test_add_func("/xml_parser_updateinfo/test_cr_xml_parse_updateinfo_records",
+                    test_cr_xml_parse_updateinfo_records);
+    g_test_add_func("/xml_parser_updateinfo/test_cr_updateinfo_index",
+                    test_cr_updateinfo_index);
+    g_test_add_func("/xml_parser_updateinfo/test_cr_updaterecord_copy",
+                    test_cr_updaterecord_copy);
 
     return g_test_run();
 }
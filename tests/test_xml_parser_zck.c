@@ -0,0 +1,132 @@
+/* createrepo_c - Library of routines for manipulation with repodata
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "fixtures.h"
+#include "createrepo/error.h"
+#include "createrepo/package.h"
+#include "createrepo/xml_parser.h"
+
+#ifdef WITH_ZCHUNK
+
+#define TEST_SRPM   "fontconfig-2.8.0-5.el6.src.rpm"
+
+static int
+pkgcb(cr_Package *pkg, void *cbdata, GError **err)
+{
+    g_assert(pkg);
+    g_assert(!err || *err == NULL);
+    g_assert_cmpstr(pkg->name, ==, "fontconfig");
+    g_assert(pkg->files);
+    *((int *) cbdata) += 1;
+    cr_package_free(pkg);
+    return CR_CB_RET_OK;
+}
+
+static void
+test_cr_xml_zck_index_primary(void)
+{
+    GError *tmp_err = NULL;
+    cr_XmlZckIndex *index;
+
+    index = cr_xml_zck_index_new(TEST_REPO_WITH_ADDITIONAL_METADATA_PRIMARY_XML_ZCK,
+                                 NULL, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert(index);
+    g_assert_cmpuint(cr_xml_zck_index_chunk_count(index), >, 1);
+    g_assert(!cr_xml_zck_index_chunk_srpms(index, 0));
+    g_assert(!cr_xml_zck_index_srpm_chunks(index, "foo-1-1.src.rpm"));
+
+    const GArray *chunks = cr_xml_zck_index_srpm_chunks(index, TEST_SRPM);
+    g_assert(chunks);
+    g_assert_cmpuint(chunks->len, ==, 1);
+
+    guint chunk = g_array_index(chunks, guint, 0);
+    const GPtrArray *srpms = cr_xml_zck_index_chunk_srpms(index, chunk);
+    g_assert(srpms);
+    g_assert_cmpuint(srpms->len, ==, 1);
+    g_assert_cmpstr(g_ptr_array_index(srpms, 0), ==, TEST_SRPM);
+
+    cr_xml_zck_index_free(index);
+}
+
+static void
+test_cr_xml_parse_zck_chunks(void)
+{
+    GError *tmp_err = NULL;
+    cr_XmlZckIndex *primary, *filelists;
+    int parsed = 0;
+
+    primary = cr_xml_zck_index_new(TEST_REPO_WITH_ADDITIONAL_METADATA_PRIMARY_XML_ZCK,
+                                   NULL, &tmp_err);
+    g_assert_no_error(tmp_err);
+
+    // Filelists don't contain source rpms
+    filelists = cr_xml_zck_index_new(TEST_REPO_WITH_ADDITIONAL_METADATA_FILELISTS_XML_ZCK,
+                                     NULL, &tmp_err);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+    g_assert(!filelists);
+    g_clear_error(&tmp_err);
+
+    filelists = cr_xml_zck_index_new(TEST_REPO_WITH_ADDITIONAL_METADATA_FILELISTS_XML_ZCK,
+                                     primary, &tmp_err);
+    g_assert_no_error(tmp_err);
+    cr_xml_zck_index_free(primary);
+
+    const GArray *chunks = cr_xml_zck_index_srpm_chunks(filelists, TEST_SRPM);
+    g_assert(chunks);
+
+    int ret = cr_xml_parse_zck_chunks(filelists,
+                                      (const guint *) chunks->data, chunks->len,
+                                      NULL, NULL, pkgcb, &parsed, NULL, NULL,
+                                      0, &tmp_err);
+    g_assert_no_error(tmp_err);
+    g_assert_cmpint(ret, ==, CRE_OK);
+    g_assert_cmpint(parsed, ==, 1);
+
+    // Chunk 0 is the zchunk dictionary
+    guint dict_chunk = 0;
+    ret = cr_xml_parse_zck_chunks(filelists, &dict_chunk, 1,
+                                  NULL, NULL, pkgcb, &parsed, NULL, NULL,
+                                  0, &tmp_err);
+    g_assert_error(tmp_err, CREATEREPO_C_ERROR, CRE_BADARG);
+    g_assert_cmpint(ret, ==, CRE_BADARG);
+    g_clear_error(&tmp_err);
+
+    cr_xml_zck_index_free(filelists);
+}
+
+#endif // WITH_ZCHUNK
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef WITH_ZCHUNK
+    g_test_add_func("/xml_parser_zck/test_cr_xml_zck_index_primary",
+                    test_cr_xml_zck_index_primary);
+    g_test_add_func("/xml_parser_zck/test_cr_xml_parse_zck_chunks",
+                    test_cr_xml_parse_zck_chunks);
+#endif // WITH_ZCHUNK
+
+    return g_test_run();
+}